@@ -4,39 +4,2293 @@
 */
 
 #include "api_interface.h"
+#include "memory_budget.h"
+#include "metrics.h"
 #include <iostream>
 #include <sstream>
 #include <algorithm>
 #include <random>
+#include <cerrno>
+#include <filesystem>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
 
 namespace StreamDAB {
 
-// HTTPServer implementation stubs
-HTTPServer::HTTPServer(const APIConfig& config) : config_(config) {
-    std::cout << "HTTPServer initialized on port " << config_.port << std::endl;
+static bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) { return tolower((unsigned char) x) == tolower((unsigned char) y); });
+}
+
+static bool ContainsIgnoreCase(std::string_view text, std::string_view word) {
+    for (size_t i = 0; i + word.size() <= text.size(); i++) {
+        if (EqualsIgnoreCase(text.substr(i, word.size()), word)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static std::string_view Trim(std::string_view s) {
+    size_t start = s.find_first_not_of(" \t");
+    if (start == std::string_view::npos) {
+        return std::string_view();
+    }
+    return s.substr(start, s.find_last_not_of(" \t") - start + 1);
+}
+
+static void AppendDecoded(std::string& out, std::string_view s) {
+    auto hex = [](char c) { return isdigit((unsigned char) c) ? c - '0' : tolower((unsigned char) c) - 'a' + 10; };
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '+') {
+            out += ' ';
+        } else if (s[i] == '%' && i + 2 < s.size() && isxdigit((unsigned char) s[i + 1]) && isxdigit((unsigned char) s[i + 2])) {
+            out += (char) (hex(s[i + 1]) << 4 | hex(s[i + 2]));
+            i += 2;
+        } else {
+            out += s[i];
+        }
+    }
+}
+
+static void ParseQuery(std::string_view query, std::map<std::string, std::string>& params) {
+    while (!query.empty()) {
+        size_t end = query.find('&');
+        std::string_view pair = query.substr(0, end);
+        query = end == std::string_view::npos ? std::string_view() : query.substr(end + 1);
+        if (pair.empty()) {
+            continue;
+        }
+
+        size_t equals = pair.find('=');
+        std::string key;
+        AppendDecoded(key, pair.substr(0, equals));
+        std::string& value = params[key];
+        value.clear();
+        if (equals != std::string_view::npos) {
+            AppendDecoded(value, pair.substr(equals + 1));
+        }
+    }
+}
+
+static const char* StatusText(int status_code) {
+    switch (status_code) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 202: return "Accepted";
+        case 204: return "No Content";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 409: return "Conflict";
+        case 413: return "Payload Too Large";
+        case 415: return "Unsupported Media Type";
+        case 422: return "Unprocessable Entity";
+        case 429: return "Too Many Requests";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 503: return "Service Unavailable";
+        case 507: return "Insufficient Storage";
+        default: return "Unknown";
+    }
+}
+
+// JSONWriter implementation
+void JSONWriter::Separate() {
+    if (need_comma_) {
+        out_ += ',';
+    }
+}
+
+void JSONWriter::BeginObject(size_t) {
+    Separate();
+    out_ += '{';
+    need_comma_ = false;
+}
+
+void JSONWriter::EndObject() {
+    out_ += '}';
+    need_comma_ = true;
+}
+
+void JSONWriter::BeginArray(size_t) {
+    Separate();
+    out_ += '[';
+    need_comma_ = false;
+}
+
+void JSONWriter::EndArray() {
+    out_ += ']';
+    need_comma_ = true;
+}
+
+void JSONWriter::Key(std::string_view key) {
+    String(key);
+    out_ += ':';
+    need_comma_ = false;
+}
+
+void JSONWriter::String(std::string_view value) {
+    static const char hex[] = "0123456789abcdef";
+    Separate();
+    out_ += '"';
+    size_t plain = 0;   // start of the characters to copy as they are
+    for (size_t i = 0; i < value.size(); i++) {
+        const unsigned char c = value[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out_.append(value.data() + plain, i - plain);
+        plain = i + 1;
+        switch (c) {
+            case '"': out_ += "\\\""; break;
+            case '\\': out_ += "\\\\"; break;
+            case '\n': out_ += "\\n"; break;
+            case '\r': out_ += "\\r"; break;
+            case '\t': out_ += "\\t"; break;
+            default:
+                out_ += "\\u00";
+                out_ += hex[c >> 4];
+                out_ += hex[c & 0xF];
+        }
+    }
+    out_.append(value.data() + plain, value.size() - plain);
+    out_ += '"';
+    need_comma_ = true;
+}
+
+void JSONWriter::Int(int64_t value) {
+    char buffer[24];
+    Separate();
+    out_.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+    need_comma_ = true;
+}
+
+void JSONWriter::UInt(uint64_t value) {
+    char buffer[24];
+    Separate();
+    out_.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+    need_comma_ = true;
+}
+
+void JSONWriter::Double(double value) {
+    if (!std::isfinite(value)) {
+        Null();
+        return;
+    }
+    char buffer[32];
+    Separate();
+    out_.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+    need_comma_ = true;
+}
+
+void JSONWriter::Bool(bool value) {
+    Separate();
+    out_ += value ? "true" : "false";
+    need_comma_ = true;
+}
+
+void JSONWriter::Null() {
+    Separate();
+    out_ += "null";
+    need_comma_ = true;
+}
+
+// JSONReader implementation
+void JSONReader::SkipWhitespace() {
+    while (pos_ < json_.size() && (json_[pos_] == ' ' || json_[pos_] == '\t' ||
+                                   json_[pos_] == '\n' || json_[pos_] == '\r')) {
+        pos_++;
+    }
+}
+
+JSONReader::Token JSONReader::Fail() {
+    invalid_ = true;
+    return Token::INVALID;
+}
+
+JSONReader::Token JSONReader::Next() {
+    if (invalid_) {
+        return Token::INVALID;
+    }
+    SkipWhitespace();
+    
+    if (after_key_) {
+        if (pos_ == json_.size() || json_[pos_] != ':') {
+            return Fail();
+        }
+        pos_++;
+        after_key_ = false;
+        return ReadValue();
+    }
+    
+    if (nesting_.empty()) {
+        if (!after_value_) {
+            return ReadValue();
+        }
+        return pos_ == json_.size() ? Token::END : Fail();
+    }
+    
+    if (pos_ == json_.size()) {
+        return Fail();
+    }
+    
+    // the end of the container may follow a value, or its start
+    const char close = nesting_.back() == '{' ? '}' : ']';
+    if (json_[pos_] == close) {
+        pos_++;
+        nesting_.pop_back();
+        after_value_ = true;
+        return close == '}' ? Token::END_OBJECT : Token::END_ARRAY;
+    }
+    
+    if (after_value_) {
+        if (json_[pos_] != ',') {
+            return Fail();
+        }
+        pos_++;
+        SkipWhitespace();
+    }
+    
+    if (nesting_.back() == '{') {
+        if (pos_ == json_.size() || json_[pos_] != '"') {
+            return Fail();
+        }
+        after_key_ = true;
+        return ReadString(Token::KEY);
+    }
+    return ReadValue();
+}
+
+JSONReader::Token JSONReader::ReadString(Token token) {
+    const size_t start = ++pos_;
+    escaped_ = false;
+    while (pos_ < json_.size()) {
+        const unsigned char c = json_[pos_];
+        if (c == '"') {
+            text_ = json_.substr(start, pos_ - start);
+            pos_++;
+            after_value_ = token == Token::STRING;
+            return token;
+        }
+        if (c < 0x20) {
+            return Fail();
+        }
+        if (c == '\\') {
+            escaped_ = true;
+            pos_++;
+        }
+        pos_++;
+    }
+    return Fail();
+}
+
+JSONReader::Token JSONReader::ReadValue() {
+    SkipWhitespace();
+    if (pos_ == json_.size()) {
+        return Fail();
+    }
+    
+    const char c = json_[pos_];
+    if (c == '{' || c == '[') {
+        pos_++;
+        nesting_.push_back(c);
+        after_value_ = false;
+        return c == '{' ? Token::BEGIN_OBJECT : Token::BEGIN_ARRAY;
+    }
+    if (c == '"') {
+        return ReadString(Token::STRING);
+    }
+    
+    static const std::pair<std::string_view, Token> literals[] = {
+        {"true", Token::BOOLEAN}, {"false", Token::BOOLEAN}, {"null", Token::NULL_VALUE}
+    };
+    for (const auto& literal : literals) {
+        if (json_.compare(pos_, literal.first.size(), literal.first) == 0) {
+            text_ = json_.substr(pos_, literal.first.size());
+            pos_ += literal.first.size();
+            after_value_ = true;
+            return literal.second;
+        }
+    }
+    
+    if (c == '-' || (c >= '0' && c <= '9')) {
+        const size_t start = pos_;
+        while (pos_ < json_.size() && std::strchr("0123456789+-.eE", json_[pos_]) && json_[pos_] != '\0') {
+            pos_++;
+        }
+        text_ = json_.substr(start, pos_ - start);
+        after_value_ = true;
+        return Token::NUMBER;
+    }
+    return Fail();
+}
+
+bool JSONReader::Skip() {
+    size_t depth = 0;
+    do {
+        switch (Next()) {
+            case Token::BEGIN_OBJECT:
+            case Token::BEGIN_ARRAY:
+                depth++;
+                break;
+            case Token::END_OBJECT:
+            case Token::END_ARRAY:
+                if (depth == 0) {
+                    return false;   // there was no value
+                }
+                depth--;
+                break;
+            case Token::INVALID:
+            case Token::END:
+                return false;
+            default:
+                break;
+        }
+    } while (depth > 0);
+    return true;
+}
+
+std::string JSONReader::String() const {
+    return escaped_ ? Unescape(text_) : std::string(text_);
+}
+
+double JSONReader::Number() const {
+    double value = 0.0;
+    std::from_chars(text_.data(), text_.data() + text_.size(), value);
+    return value;
+}
+
+static void AppendUTF8(std::string& out, uint32_t code_point) {
+    if (code_point < 0x80) {
+        out += (char) code_point;
+    } else if (code_point < 0x800) {
+        out += (char) (0xC0 | (code_point >> 6));
+        out += (char) (0x80 | (code_point & 0x3F));
+    } else if (code_point < 0x10000) {
+        out += (char) (0xE0 | (code_point >> 12));
+        out += (char) (0x80 | ((code_point >> 6) & 0x3F));
+        out += (char) (0x80 | (code_point & 0x3F));
+    } else {
+        out += (char) (0xF0 | (code_point >> 18));
+        out += (char) (0x80 | ((code_point >> 12) & 0x3F));
+        out += (char) (0x80 | ((code_point >> 6) & 0x3F));
+        out += (char) (0x80 | (code_point & 0x3F));
+    }
+}
+
+std::string JSONReader::Unescape(std::string_view text) {
+    auto hex4 = [&text](size_t pos, uint32_t& value) {
+        return pos + 4 <= text.size() &&
+               std::from_chars(text.data() + pos, text.data() + pos + 4, value, 16).ptr == text.data() + pos + 4;
+    };
+    
+    std::string out;
+    out.reserve(text.size());
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] != '\\' || i + 1 == text.size()) {
+            out += text[i];
+            continue;
+        }
+        switch (text[++i]) {
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                uint32_t code_point = 0;
+                if (!hex4(i + 1, code_point)) {
+                    out += "\\u";
+                    break;
+                }
+                i += 4;
+                // a surrogate pair
+                uint32_t low = 0;
+                if (code_point >= 0xD800 && code_point < 0xDC00 && i + 2 < text.size() &&
+                    text[i + 1] == '\\' && text[i + 2] == 'u' && hex4(i + 3, low) &&
+                    low >= 0xDC00 && low < 0xE000) {
+                    code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                    i += 6;
+                }
+                AppendUTF8(out, code_point);
+                break;
+            }
+            default:
+                out += text[i];
+        }
+    }
+    return out;
+}
+
+// MessagePackWriter implementation
+void MessagePackWriter::Put(uint8_t type, uint64_t value, int bytes) {
+    out_.push_back(type);
+    for (int i = bytes - 1; i >= 0; i--) {
+        out_.push_back((uint8_t) (value >> (8 * i)));
+    }
+}
+
+void MessagePackWriter::Header(uint8_t fix, uint8_t fix_max, uint8_t type8, uint8_t type16, uint8_t type32, size_t size) {
+    if (size <= fix_max) {
+        out_.push_back(fix | (uint8_t) size);
+    } else if (size <= 0xFF && type8) {
+        Put(type8, size, 1);
+    } else if (size <= 0xFFFF) {
+        Put(type16, size, 2);
+    } else {
+        Put(type32, size, 4);
+    }
+}
+
+void MessagePackWriter::BeginObject(size_t members) {
+    Header(0x80, 0x0F, 0, 0xDE, 0xDF, members);
+}
+
+void MessagePackWriter::BeginArray(size_t elements) {
+    Header(0x90, 0x0F, 0, 0xDC, 0xDD, elements);
+}
+
+void MessagePackWriter::String(std::string_view value) {
+    Header(0xA0, 0x1F, 0xD9, 0xDA, 0xDB, value.size());
+    out_.insert(out_.end(), value.begin(), value.end());
+}
+
+void MessagePackWriter::Binary(const uint8_t* data, size_t size) {
+    // bin has no fix variant; 0xC4 is bin 8
+    if (size <= 0xFF) {
+        Put(0xC4, size, 1);
+    } else {
+        Header(0, 0, 0, 0xC5, 0xC6, size);
+    }
+    out_.insert(out_.end(), data, data + size);
+}
+
+void MessagePackWriter::Int(int64_t value) {
+    if (value >= 0) {
+        UInt(value);
+    } else if (value >= -32) {
+        out_.push_back((uint8_t) value);
+    } else if (value >= INT8_MIN) {
+        Put(0xD0, (uint64_t) value, 1);
+    } else if (value >= INT16_MIN) {
+        Put(0xD1, (uint64_t) value, 2);
+    } else if (value >= INT32_MIN) {
+        Put(0xD2, (uint64_t) value, 4);
+    } else {
+        Put(0xD3, (uint64_t) value, 8);
+    }
+}
+
+void MessagePackWriter::UInt(uint64_t value) {
+    if (value < 0x80) {
+        out_.push_back((uint8_t) value);
+    } else if (value <= UINT8_MAX) {
+        Put(0xCC, value, 1);
+    } else if (value <= UINT16_MAX) {
+        Put(0xCD, value, 2);
+    } else if (value <= UINT32_MAX) {
+        Put(0xCE, value, 4);
+    } else {
+        Put(0xCF, value, 8);
+    }
+}
+
+void MessagePackWriter::Double(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    Put(0xCB, bits, 8);
+}
+
+void MessagePackWriter::Number(double value) {
+    if (value >= -0x1p63 && value < 0x1p63 && value == std::floor(value)) {
+        Int((int64_t) value);
+    } else if ((double) (float) value == value) {
+        const float f = (float) value;
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        Put(0xCA, bits, 4);
+    } else {
+        Double(value);
+    }
+}
+
+void MessagePackWriter::Bool(bool value) {
+    out_.push_back(value ? 0xC3 : 0xC2);
+}
+
+void MessagePackWriter::Null() {
+    out_.push_back(0xC0);
+}
+
+// MessagePackReader implementation
+bool MessagePackReader::Read(uint64_t& value, int bytes) {
+    if (size_ - pos_ < (size_t) bytes) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value = (value << 8) | data_[pos_++];
+    }
+    return true;
+}
+
+MessagePackReader::Type MessagePackReader::ReadBytes(Type type, size_t length) {
+    if (size_ - pos_ < length) {
+        return Type::INVALID;
+    }
+    bytes_ = data_ + pos_;
+    length_ = length;
+    pos_ += length;
+    return type;
+}
+
+MessagePackReader::Type MessagePackReader::Next() {
+    if (pos_ == size_) {
+        return Type::END;
+    }
+    
+    const uint8_t type = data_[pos_++];
+    negative_ = false;
+    uint64_t value = 0;
+    
+    if (type < 0x80) {
+        integer_ = type;
+        return Type::INTEGER;
+    }
+    if (type >= 0xE0) {
+        integer_ = (uint64_t) (int64_t) (int8_t) type;
+        negative_ = true;
+        return Type::INTEGER;
+    }
+    if (type < 0x90) {
+        length_ = type & 0x0F;
+        return Type::MAP;
+    }
+    if (type < 0xA0) {
+        length_ = type & 0x0F;
+        return Type::ARRAY;
+    }
+    if (type < 0xC0) {
+        return ReadBytes(Type::STRING, type & 0x1F);
+    }
+    
+    switch (type) {
+        case 0xC0:
+            return Type::NIL;
+        case 0xC2:
+        case 0xC3:
+            integer_ = type & 1;
+            return Type::BOOLEAN;
+        case 0xC4: case 0xC5: case 0xC6:
+            return Read(value, 1 << (type - 0xC4)) ? ReadBytes(Type::BINARY, value) : Type::INVALID;
+        case 0xC7: case 0xC8: case 0xC9:
+            // the extension type precedes the data
+            return Read(value, 1 << (type - 0xC7)) ? ReadBytes(Type::EXTENSION, value + 1) : Type::INVALID;
+        case 0xCA: {
+            float f;
+            if (!Read(value, 4)) {
+                return Type::INVALID;
+            }
+            const uint32_t bits = (uint32_t) value;
+            std::memcpy(&f, &bits, sizeof(f));
+            float_ = f;
+            return Type::FLOAT;
+        }
+        case 0xCB:
+            if (!Read(value, 8)) {
+                return Type::INVALID;
+            }
+            std::memcpy(&float_, &value, sizeof(float_));
+            return Type::FLOAT;
+        case 0xCC: case 0xCD: case 0xCE: case 0xCF:
+            if (!Read(integer_, 1 << (type - 0xCC))) {
+                return Type::INVALID;
+            }
+            return Type::INTEGER;
+        case 0xD0: case 0xD1: case 0xD2: case 0xD3: {
+            const int bytes = 1 << (type - 0xD0);
+            if (!Read(value, bytes)) {
+                return Type::INVALID;
+            }
+            // sign extension
+            const int shift = 64 - 8 * bytes;
+            integer_ = shift ? (uint64_t) ((int64_t) (value << shift) >> shift) : value;
+            negative_ = (int64_t) integer_ < 0;
+            return Type::INTEGER;
+        }
+        case 0xD4: case 0xD5: case 0xD6: case 0xD7: case 0xD8:
+            return ReadBytes(Type::EXTENSION, (1 << (type - 0xD4)) + 1);
+        case 0xD9: case 0xDA: case 0xDB:
+            return Read(value, 1 << (type - 0xD9)) ? ReadBytes(Type::STRING, value) : Type::INVALID;
+        case 0xDC: case 0xDD:
+        case 0xDE: case 0xDF:
+            if (!Read(value, type & 1 ? 4 : 2)) {
+                return Type::INVALID;
+            }
+            length_ = value;
+            return type < 0xDE ? Type::ARRAY : Type::MAP;
+        default:
+            return Type::INVALID;   // 0xC1 is never used
+    }
+}
+
+bool MessagePackReader::Skip() {
+    size_t remaining = 1;
+    while (remaining > 0) {
+        remaining--;
+        switch (Next()) {
+            case Type::ARRAY:
+                remaining += length_;
+                break;
+            case Type::MAP:
+                remaining += 2 * length_;
+                break;
+            case Type::END:
+            case Type::INVALID:
+                return false;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+template <typename Writer>
+static void WriteVariant(Writer& writer, const std::variant<std::string, int, double, bool>& value) {
+    std::visit([&writer](auto&& arg) {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, std::string>) {
+            writer.String(arg);
+        } else if constexpr (std::is_same_v<T, bool>) {
+            writer.Bool(arg);
+        } else if constexpr (std::is_same_v<T, int>) {
+            writer.Int(arg);
+        } else {
+            writer.Double(arg);
+        }
+    }, value);
+}
+
+static int64_t ToMilliseconds(std::chrono::system_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+}
+
+// Calls field(name, member) for each member of the status, so that one
+// list serves for writing (status const) and reading
+template <typename Status, typename Visitor>
+static void VisitStatusFields(Status& status, Visitor&& field) {
+    field("is_running", status.is_running);
+    field("started_at", status.started_at);
+    field("active_connections", status.active_connections);
+    field("total_requests", status.total_requests);
+    field("failed_requests", status.failed_requests);
+    field("total_images", status.total_images);
+    field("active_images", status.active_images);
+    field("current_image", status.current_image);
+    field("average_image_quality", status.average_image_quality);
+    field("total_messages", status.total_messages);
+    field("queued_messages", status.queued_messages);
+    field("current_message", status.current_message);
+    field("highest_priority", status.highest_priority);
+    field("cpu_usage", status.cpu_usage);
+    field("memory_usage", status.memory_usage);
+    field("avg_response_time_us", status.avg_response_time);
+    field("thai_messages_processed", status.thai_messages_processed);
+    field("buddhist_calendar_active", status.buddhist_calendar_active);
+    field("last_updated", status.last_updated);
+}
+
+template <typename Writer, typename T>
+static void WriteStatusValue(Writer& writer, const T& value) {
+    if constexpr (std::is_same_v<T, bool>) {
+        writer.Bool(value);
+    } else if constexpr (std::is_same_v<T, size_t>) {
+        writer.UInt(value);
+    } else if constexpr (std::is_same_v<T, double>) {
+        writer.Double(value);
+    } else if constexpr (std::is_same_v<T, std::string>) {
+        writer.String(value);
+    } else if constexpr (std::is_same_v<T, MessagePriority>) {
+        writer.Int((int64_t) value);
+    } else if constexpr (std::is_same_v<T, std::chrono::microseconds>) {
+        writer.Int(value.count());
+    } else {
+        writer.Int(ToMilliseconds(value));
+    }
+}
+
+template <typename Writer>
+static void WriteStatus(Writer& writer, const SystemStatus& status) {
+    size_t members = 0;
+    VisitStatusFields(status, [&members](const char*, const auto&) { members++; });
+    
+    writer.BeginObject(members);
+    VisitStatusFields(status, [&writer](const char* name, const auto& value) {
+        writer.Key(name);
+        WriteStatusValue(writer, value);
+    });
+    writer.EndObject();
+}
+
+// Sets the member named by the key from the value that follows it; other
+// members are skipped
+static bool ReadStatusField(MessagePackReader& reader, std::string_view key, SystemStatus& status) {
+    bool found = false;
+    bool valid = true;
+    VisitStatusFields(status, [&](const char* name, auto& member) {
+        using T = std::decay_t<decltype(member)>;
+        if (found || key != name) {
+            return;
+        }
+        found = true;
+        const auto type = reader.Next();
+        if constexpr (std::is_same_v<T, bool>) {
+            valid = type == MessagePackReader::Type::BOOLEAN;
+            member = reader.Boolean();
+        } else if constexpr (std::is_same_v<T, double>) {
+            valid = type == MessagePackReader::Type::FLOAT || type == MessagePackReader::Type::INTEGER;
+            member = type == MessagePackReader::Type::FLOAT ? reader.Float() : (double) reader.Integer();
+        } else if constexpr (std::is_same_v<T, std::string>) {
+            valid = type == MessagePackReader::Type::STRING;
+            member.assign(reader.String());
+        } else {
+            valid = type == MessagePackReader::Type::INTEGER;
+            if constexpr (std::is_same_v<T, size_t>) {
+                member = reader.Unsigned();
+            } else if constexpr (std::is_same_v<T, MessagePriority>) {
+                member = (MessagePriority) reader.Integer();
+            } else if constexpr (std::is_same_v<T, std::chrono::microseconds>) {
+                member = std::chrono::microseconds(reader.Integer());
+            } else {
+                member = std::chrono::system_clock::time_point(std::chrono::milliseconds(reader.Integer()));
+            }
+        }
+    });
+    return found ? valid : reader.Skip();
+}
+
+// VersionedStatus implementation
+bool VersionedStatus::Update(const SystemStatus& status) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t index = 0;
+    bool changed = false;
+    VisitStatusFields(status, [&](const char* name, const auto& value) {
+        if (index == fields_.size()) {
+            fields_.emplace_back();
+        }
+        scratch_.clear();
+        MessagePackWriter writer(scratch_);
+        writer.Key(name);
+        WriteStatusValue(writer, value);
+        
+        Field& field = fields_[index++];
+        if (field.encoded != scratch_) {
+            field.encoded.swap(scratch_);
+            field.version = version_ + 1;
+            changed = true;
+        }
+    });
+    
+    if (changed) {
+        version_++;
+    }
+    return changed;
+}
+
+uint64_t VersionedStatus::GetVersion() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return version_;
+}
+
+uint64_t VersionedStatus::Delta(uint64_t since, std::vector<uint8_t>& patch) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (since > version_) {
+        since = 0;  // a version from before a restart
+    }
+    
+    size_t changed = 0;
+    size_t size = 0;
+    for (const auto& field : fields_) {
+        if (field.version > since) {
+            changed++;
+            size += field.encoded.size();
+        }
+    }
+    
+    patch.clear();
+    patch.reserve(size + 40);
+    MessagePackWriter writer(patch);
+    writer.BeginObject(3);
+    writer.Key("version");
+    writer.UInt(version_);
+    writer.Key("since");
+    writer.UInt(since);
+    writer.Key("fields");
+    writer.BeginObject(changed);
+    for (const auto& field : fields_) {
+        if (field.version > since) {
+            patch.insert(patch.end(), field.encoded.begin(), field.encoded.end());
+        }
+    }
+    return version_;
+}
+
+// ImageUpload implementation
+ImageUpload::ImageUpload(const std::string& directory, const std::string& filename, size_t max_size,
+                         CompletionHandler on_complete)
+    : directory_(directory), max_size_(max_size), on_complete_(std::move(on_complete)) {
+    // only plain names are kept; the extension is that of the format
+    const std::string name = std::filesystem::path(filename).stem().string();
+    if (!name.empty() && name[0] != '.' &&
+        name.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789._-") == std::string::npos) {
+        filename_ = name;
+    }
+    
+    std::error_code error;
+    std::filesystem::create_directories(directory_, error);
+    std::string path = (std::filesystem::path(directory_) / ".upload-XXXXXX").string();
+    fd_ = mkstemp(&path[0]);
+    if (fd_ == -1) {
+        Reject(500, "Cannot store upload");
+        return;
+    }
+    temp_path_ = path;
+    
+    if (!digest_.IsValid()) {
+        Reject(500, "Cannot store upload");
+    }
+}
+
+ImageUpload::~ImageUpload() {
+    if (fd_ != -1) {
+        close(fd_);
+    }
+    if (!temp_path_.empty()) {
+        unlink(temp_path_.c_str());
+    }
+}
+
+std::string ImageUpload::DetectImageType(const uint8_t* data, size_t len) {
+    static const uint8_t png_signature[] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
+    if (len >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) {
+        return "image/jpeg";
+    }
+    if (len >= 8 && memcmp(data, png_signature, 8) == 0) {
+        return "image/png";
+    }
+    if (len >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WEBP", 4) == 0) {
+        return "image/webp";
+    }
+    if (len >= 12 && memcmp(data + 4, "ftyp", 4) == 0) {
+        for (const char* brand : {"heic", "heix", "hevc", "hevx", "mif1"}) {
+            if (memcmp(data + 8, brand, 4) == 0) {
+                return "image/heif";
+            }
+        }
+    }
+    return std::string();
+}
+
+bool ImageUpload::Reject(int status_code, const std::string& error) {
+    if (!error_status_) {
+        error_status_ = status_code;
+        error_ = error;
+    }
+    if (fd_ != -1) {
+        close(fd_);
+        fd_ = -1;
+    }
+    if (!temp_path_.empty()) {
+        unlink(temp_path_.c_str());
+        temp_path_.clear();
+    }
+    return false;
+}
+
+bool ImageUpload::Write(const uint8_t* data, size_t len) {
+    if (error_status_) {
+        return false;
+    }
+    if (len > max_size_ - size_) {
+        return Reject(413, "Image too large");
+    }
+    
+    // the first bytes are held until the format is known
+    size_t used = 0;
+    if (size_ < HEAD_SIZE) {
+        used = std::min(len, HEAD_SIZE - size_);
+        memcpy(head_ + size_, data, used);
+        size_ += used;
+        if (size_ < HEAD_SIZE) {
+            return true;
+        }
+        mime_type_ = DetectImageType(head_, HEAD_SIZE);
+        if (mime_type_.empty()) {
+            return Reject(415, "Unsupported image format");
+        }
+        if (!Append(head_, HEAD_SIZE)) {
+            return false;
+        }
+    }
+    size_ += len - used;
+    return Append(data + used, len - used);
+}
+
+bool ImageUpload::Append(const uint8_t* data, size_t len) {
+    if (len == 0) {
+        return true;
+    }
+    if (!digest_.Update(data, len)) {
+        return Reject(500, "Cannot store upload");
+    }
+    if (len >= 2) {
+        tail_[0] = data[len - 2];
+        tail_[1] = data[len - 1];
+    } else {
+        tail_[0] = tail_[1];
+        tail_[1] = data[0];
+    }
+    
+    while (len > 0) {
+        ssize_t written = write(fd_, data, len);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return Reject(errno == ENOSPC ? 507 : 500, "Cannot store upload");
+        }
+        data += written;
+        len -= written;
+    }
+    return true;
+}
+
+APIResponse ImageUpload::Finish() {
+    if (!error_status_ && size_ < HEAD_SIZE) {
+        mime_type_ = DetectImageType(head_, size_);
+        if (mime_type_.empty() || !Append(head_, size_)) {
+            Reject(415, "Unsupported image format");
+        }
+    }
+    if (!error_status_ && mime_type_ == "image/jpeg" && (tail_[0] != 0xFF || tail_[1] != 0xD9)) {
+        Reject(415, "Invalid image/jpeg format");
+    }
+    
+    if (!error_status_) {
+        hash_ = digest_.FinalHex();
+        if (hash_.empty()) {
+            Reject(500, "Cannot store upload");
+        }
+    }
+    if (error_status_) {
+        return APIUtils::CreateErrorResponse(error_, error_status_);
+    }
+    
+    // moved into place, without replacing an existing image
+    static const std::map<std::string, const char*> extensions = {
+        {"image/jpeg", ".jpg"}, {"image/png", ".png"}, {"image/webp", ".webp"}, {"image/heif", ".heif"}
+    };
+    const std::string name = (filename_.empty() ? hash_.substr(0, 16) : filename_) + extensions.at(mime_type_);
+    const std::string path = (std::filesystem::path(directory_) / name).string();
+    close(fd_);
+    fd_ = -1;
+    if (link(temp_path_.c_str(), path.c_str()) == -1) {
+        return errno == EEXIST ? APIUtils::CreateErrorResponse("Image exists", 409)
+                               : APIUtils::CreateErrorResponse("Cannot store upload", 500);
+    }
+    unlink(temp_path_.c_str());
+    temp_path_.clear();
+    path_ = path;
+    
+    if (on_complete_) {
+        return on_complete_(*this);
+    }
+    return APIUtils::CreateJSONResponse({{"filename", name}, {"hash", hash_}, {"size", (int) size_}}, 201);
+}
+
+// HTTPRequest implementation
+HTTPRequest::ParseResult HTTPRequest::Parse(const char* data, size_t len, size_t max_request_size, size_t& length) {
+    head_length = 0;
+    std::string_view input(data, std::min(len, MAX_HEAD_SIZE));
+    size_t head_end = input.find("\r\n\r\n");
+    if (head_end == std::string_view::npos) {
+        return len >= MAX_HEAD_SIZE ? ParseResult::TOO_LARGE : ParseResult::INCOMPLETE;
+    }
+    std::string_view head = input.substr(0, head_end);
+
+    // request line
+    size_t line_end = head.find("\r\n");
+    std::string_view line = head.substr(0, line_end);
+    size_t method_end = line.find(' ');
+    size_t target_end = method_end == std::string_view::npos ? method_end : line.find(' ', method_end + 1);
+    if (target_end == std::string_view::npos) {
+        return ParseResult::INVALID;
+    }
+    method = line.substr(0, method_end);
+    std::string_view target = line.substr(method_end + 1, target_end - method_end - 1);
+    version = line.substr(target_end + 1);
+    if (method.empty() || target.empty() || version.substr(0, 7) != "HTTP/1.") {
+        return ParseResult::INVALID;
+    }
+    size_t query_start = target.find('?');
+    path = target.substr(0, query_start);
+    query = query_start == std::string_view::npos ? std::string_view() : target.substr(query_start + 1);
+
+    // header fields
+    header_count = 0;
+    keep_alive = version != "HTTP/1.0";
+    content_length = 0;
+    while (line_end != std::string_view::npos) {
+        size_t start = line_end + 2;
+        line_end = head.find("\r\n", start);
+        line = head.substr(start, line_end == std::string_view::npos ? std::string_view::npos : line_end - start);
+
+        size_t colon = line.find(':');
+        if (colon == 0 || colon == std::string_view::npos || header_count == MAX_HEADERS) {
+            return ParseResult::INVALID;
+        }
+        std::string_view name = line.substr(0, colon);
+        std::string_view value = Trim(line.substr(colon + 1));
+        headers[header_count++] = {name, value};
+
+        if (EqualsIgnoreCase(name, "Content-Length")) {
+            if (value.empty() || value.size() > 18 || value.find_first_not_of("0123456789") != std::string_view::npos) {
+                return ParseResult::INVALID;
+            }
+            content_length = 0;
+            for (char c : value) {
+                content_length = content_length * 10 + (c - '0');
+            }
+        } else if (EqualsIgnoreCase(name, "Transfer-Encoding")) {
+            return ParseResult::INVALID;    // request bodies need a length
+        } else if (EqualsIgnoreCase(name, "Connection")) {
+            if (ContainsIgnoreCase(value, "close")) {
+                keep_alive = false;
+            } else if (ContainsIgnoreCase(value, "keep-alive")) {
+                keep_alive = true;
+            }
+        }
+    }
+
+    const size_t body_start = head_end + 4;
+    head_length = body_start;
+    if (content_length > max_request_size) {
+        return ParseResult::TOO_LARGE;
+    }
+    if (len - body_start < content_length) {
+        return ParseResult::INCOMPLETE;
+    }
+    body = std::string_view(data + body_start, content_length);
+    length = body_start + content_length;
+    return ParseResult::COMPLETE;
+}
+
+std::string_view HTTPRequest::Header(std::string_view name) const {
+    for (size_t i = 0; i < header_count; i++) {
+        if (EqualsIgnoreCase(headers[i].first, name)) {
+            return headers[i].second;
+        }
+    }
+    return std::string_view();
+}
+
+// RateLimiter implementation
+const std::chrono::seconds RateLimiter::SWEEP_INTERVAL{10};
+
+RateLimiter::RateLimiter(size_t requests_per_minute)
+    : requests_per_minute_(requests_per_minute),
+      interval_(requests_per_minute ? 60000000000LL / (int64_t) requests_per_minute : 0),
+      tolerance_(60000000000LL - interval_) {
+}
+
+bool RateLimiter::IsLimited(std::string_view client, std::chrono::steady_clock::time_point now_point) {
+    if (requests_per_minute_ == 0) {
+        return true;
+    }
+    const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(now_point.time_since_epoch()).count();
+    if (now >= next_sweep_.load(std::memory_order_relaxed)) {
+        Sweep(now);
+    }
+
+    const uint64_t hash = std::hash<std::string_view>{}(client);
+    Shard& shard = shards_[hash % SHARDS];
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.buckets.find(hash);
+        if (it != shard.buckets.end()) {
+            return !TakeToken(it->second, now);
+        }
+    }
+
+    // a new client, or one whose bucket was full and swept
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.buckets.try_emplace(hash, now).first;
+    return !TakeToken(it->second, now);
+}
+
+bool RateLimiter::TakeToken(std::atomic<int64_t>& bucket, int64_t now) const {
+    // a token moves the time of being full by one interval
+    int64_t full_at = bucket.load(std::memory_order_relaxed);
+    for (;;) {
+        const int64_t from = std::max(full_at, now);
+        if (from - now > tolerance_) {
+            return false;
+        }
+        if (bucket.compare_exchange_weak(full_at, from + interval_, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+}
+
+void RateLimiter::Sweep(int64_t now) {
+    // by one of the callers due, the others go on
+    int64_t due = next_sweep_.load(std::memory_order_relaxed);
+    const int64_t next = now + std::chrono::duration_cast<std::chrono::nanoseconds>(SWEEP_INTERVAL).count();
+    if (now < due || !next_sweep_.compare_exchange_strong(due, next, std::memory_order_relaxed)) {
+        return;
+    }
+
+    for (Shard& shard : shards_) {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        for (auto it = shard.buckets.begin(); it != shard.buckets.end();) {
+            if (it->second.load(std::memory_order_relaxed) <= now) {
+                it = shard.buckets.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+}
+
+size_t RateLimiter::GetClientCount() const {
+    size_t count = 0;
+    for (const Shard& shard : shards_) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        count += shard.buckets.size();
+    }
+    return count;
+}
+
+// the whole file into out (replacing its content)
+template<typename Buffer>
+static bool ReadWholeFile(const std::string& file_path, Buffer& out) {
+    const int fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat file_stat;
+    bool ok = fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode);
+    if (ok) {
+        out.resize(file_stat.st_size);
+        size_t pos = 0;
+        while (ok && pos < out.size()) {
+            const ssize_t len = read(fd, &out[pos], out.size() - pos);
+            if (len > 0) {
+                pos += len;
+            } else if (len == 0) {
+                out.resize(pos);    // truncated meanwhile
+                break;
+            } else {
+                ok = errno == EINTR;
+            }
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+// StaticAssets implementation
+const size_t StaticAssets::MAX_CACHED_FILE_SIZE = 256 * 1024;
+const size_t StaticAssets::MAX_CACHE_SIZE = 32 * 1024 * 1024;
+
+// of the variants next to a file, by encoding
+static const char* const ENCODING_SUFFIXES[StaticAssets::ENCODINGS] = {"", ".gz", ".br"};
+// the encodings tried, preferred first
+static const StaticAssets::Encoding COMPRESSED_ENCODINGS[] = {StaticAssets::BROTLI, StaticAssets::GZIP};
+
+// distinct for each variant, as they are different representations
+static std::string MakeETag(off_t size, int64_t mtime_ns, StaticAssets::Encoding encoding) {
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"%llx-%llx%s\"", (unsigned long long) size, (unsigned long long) mtime_ns,
+             ENCODING_SUFFIXES[encoding]);
+    return etag;
+}
+
+static int64_t MTimeNs(const struct stat& file_stat) {
+    return file_stat.st_mtim.tv_sec * 1000000000LL + file_stat.st_mtim.tv_nsec;
+}
+
+StaticAssets::StaticAssets(std::string directory) : directory_(std::move(directory)) {}
+
+const char* StaticAssets::EncodingName(Encoding encoding) {
+    static const char* const names[ENCODINGS] = {"identity", "gzip", "br"};
+    return names[encoding];
+}
+
+bool StaticAssets::Accepts(std::string_view accept_encoding, std::string_view coding) {
+    while (!accept_encoding.empty()) {
+        const size_t end = std::min(accept_encoding.find(','), accept_encoding.size());
+        const std::string_view item = accept_encoding.substr(0, end);
+        accept_encoding.remove_prefix(std::min(end + 1, accept_encoding.size()));
+
+        const size_t params = item.find(';');
+        if (!EqualsIgnoreCase(Trim(item.substr(0, params)), coding)) {
+            continue;
+        }
+        // declined by a weight of 0
+        const std::string_view weight = params == std::string_view::npos ? std::string_view() : Trim(item.substr(params + 1));
+        return weight.substr(0, 2) != "q=" || weight.find_first_not_of("0.", 2) != std::string_view::npos;
+    }
+    return false;
+}
+
+std::shared_ptr<const StaticAssets::Asset> StaticAssets::Load(const std::string& file_path, const struct stat& file_stat) {
+    auto asset = std::make_shared<Asset>();
+    asset->size = file_stat.st_size;
+    asset->mtime_ns = MTimeNs(file_stat);
+    if (!ReadWholeFile(file_path, asset->bodies[IDENTITY])) {
+        return nullptr;
+    }
+    for (Encoding encoding : COMPRESSED_ENCODINGS) {
+        if (!ReadWholeFile(file_path + ENCODING_SUFFIXES[encoding], asset->bodies[encoding])) {
+            asset->bodies[encoding].clear();
+        }
+    }
+    return asset;
+}
+
+bool StaticAssets::Open(std::string_view path, std::string_view accept_encoding, Body& body) {
+    // neither hidden files nor ".." (nor a query-like or empty segment)
+    if ((!path.empty() && path[0] == '.') || path.find("/.") != std::string_view::npos ||
+            path.find("//") != std::string_view::npos || path.find('\0') != std::string_view::npos) {
+        return false;
+    }
+    std::string relative(path);
+    if (relative.empty() || relative.back() == '/') {
+        relative += "index.html";
+    }
+    const std::string file_path = directory_ + "/" + relative;
+    struct stat file_stat;
+    if (stat(file_path.c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+        return false;
+    }
+    const size_t slash = relative.rfind('/');
+    const size_t dot = relative.rfind('.');
+    body.content_type = APIUtils::MimeTypeOf(dot != std::string::npos && (slash == std::string::npos || dot > slash)
+                                             ? std::string_view(relative).substr(dot) : std::string_view());
+
+    if ((size_t) file_stat.st_size <= MAX_CACHED_FILE_SIZE) {
+        std::shared_ptr<const Asset> asset;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = cache_.find(relative);
+            if (it != cache_.end() && it->second->size == file_stat.st_size && it->second->mtime_ns == MTimeNs(file_stat)) {
+                asset = it->second;
+            }
+        }
+        if (!asset) {
+            // loaded outside the lock; at worst twice, by concurrent requests
+            asset = Load(file_path, file_stat);
+            if (!asset) {
+                return false;
+            }
+            size_t size = 0;
+            for (const std::string& variant : asset->bodies) {
+                size += variant.size();
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto& entry = cache_[relative];
+            if (entry) {
+                for (const std::string& variant : entry->bodies) {
+                    cache_size_ -= variant.size();
+                }
+            }
+            entry = asset;
+            cache_size_ += size;
+            if (cache_size_ > MAX_CACHE_SIZE) {
+                cache_.clear();     // many files: start over
+                cache_[relative] = asset;
+                cache_size_ = size;
+            }
+        }
+
+        body.asset = asset;
+        body.encoding = IDENTITY;
+        for (Encoding encoding : COMPRESSED_ENCODINGS) {
+            if (!asset->bodies[encoding].empty() && Accepts(accept_encoding, EncodingName(encoding))) {
+                body.encoding = encoding;
+                break;
+            }
+        }
+        body.data = asset->bodies[body.encoding];
+        body.length = body.data.size();
+        body.etag = MakeETag(asset->size, asset->mtime_ns, body.encoding);
+        return true;
+    }
+
+    // from the disk: the variant, if accepted and there is one
+    body.encoding = IDENTITY;
+    for (Encoding encoding : COMPRESSED_ENCODINGS) {
+        if (Accepts(accept_encoding, EncodingName(encoding))) {
+            body.fd = open((file_path + ENCODING_SUFFIXES[encoding]).c_str(), O_RDONLY | O_CLOEXEC);
+            if (body.fd != -1) {
+                body.encoding = encoding;
+                break;
+            }
+        }
+    }
+    if (body.fd == -1) {
+        body.fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    struct stat open_stat;
+    if (body.fd == -1 || fstat(body.fd, &open_stat) != 0 || !S_ISREG(open_stat.st_mode)) {
+        if (body.fd != -1) {
+            close(body.fd);
+            body.fd = -1;
+        }
+        return false;
+    }
+    body.length = open_stat.st_size;
+    body.etag = MakeETag(file_stat.st_size, MTimeNs(file_stat), body.encoding);
+    return true;
+}
+
+// HTTPServer implementation
+struct HTTPServer::Connection {
+    int fd = -1;
+    std::shared_ptr<ClientConnection> client;
+    std::chrono::steady_clock::time_point last_activity;
+
+    std::string in;             // received, from the first request not yet answered
+    std::string out;            // responses not yet sent
+    size_t out_pos = 0;
+    bool readable = false;      // the socket may have more to read (edge-triggered)
+    bool peer_closed = false;
+    bool closing = false;       // once the responses are sent
+
+    // handler arguments, reused so that their storage is kept
+    std::map<std::string, std::string> params;
+    std::vector<uint8_t> body;
+
+    // a request body being passed to the sink of a body handler
+    std::unique_ptr<BodySink> upload;
+    size_t upload_remaining = 0;
+    bool upload_keep_alive = true;
+    std::string upload_endpoint;
+    std::chrono::steady_clock::time_point upload_start;
+
+    // the body of a static file, sent once out is: from the cache or the file
+    StaticAssets::Body static_body;
+    size_t static_sent = 0;
+
+    void ReleaseStaticBody() {
+        if (static_body.fd != -1) {
+            close(static_body.fd);
+        }
+        static_body = StaticAssets::Body();
+        static_sent = 0;
+    }
+    bool SendingStaticBody() const { return static_body.length > static_sent; }
+
+    ~Connection() { ReleaseStaticBody(); }
+};
+
+struct HTTPServer::EventLoop {
+    int epoll_fd = -1;
+    int listen_fd = -1;
+    int wake_fd = -1;
+    std::thread thread;
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;   // by socket
+
+    ~EventLoop() {
+        for (int fd : {epoll_fd, listen_fd, wake_fd}) {
+            if (fd != -1) {
+                close(fd);
+            }
+        }
+    }
+};
+
+// responses waiting to be sent, beyond which pipelined requests wait
+static const size_t MAX_PENDING_OUTPUT = 256 * 1024;
+// received per round, before it is processed: so that a large body is passed
+// on to a body handler as it arrives
+static const size_t READ_CHUNK_SIZE = 64 * 1024;
+
+static int Listen(const std::string& address, uint16_t port) {
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+    struct addrinfo* addresses;
+    if (getaddrinfo(address.empty() ? nullptr : address.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo* addr = addresses; addr && fd == -1; addr = addr->ai_next) {
+        fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, addr->ai_protocol);
+        if (fd == -1) {
+            continue;
+        }
+        const int one = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1 ||
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1 ||
+            bind(fd, addr->ai_addr, addr->ai_addrlen) == -1 ||
+            listen(fd, SOMAXCONN) == -1) {
+            int error = errno;
+            close(fd);
+            fd = -1;
+            errno = error;
+        }
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+HTTPServer::HTTPServer(const APIConfig& config)
+    : config_(config), rate_limiter_(config.max_requests_per_minute) {
+    char prefix[16];
+    snprintf(prefix, sizeof(prefix), "%08x-", std::random_device{}());
+    etag_prefix_ = prefix;
+
+    if (!config_.static_directory.empty()) {
+        static_assets_ = std::make_unique<StaticAssets>(config_.static_directory);
+    }
+
+    // for scrapers
+    if (!config_.metrics_path.empty()) {
+        APIEndpoint metrics;
+        metrics.path = config_.metrics_path;
+        metrics.method = "GET";
+        metrics.handler = [](const std::map<std::string, std::string>&, const std::vector<uint8_t>&) {
+            APIResponse response;
+            response.content_type = MetricsRegistry::CONTENT_TYPE;
+            const std::string text = MetricsRegistry::Global().Render();
+            response.body.assign(text.begin(), text.end());
+            return response;
+        };
+        metrics.description = "Metrics of the process in the OpenMetrics text format";
+        RegisterEndpoint(metrics);
+    }
+    if (!config_.metrics_history_path.empty()) {
+        APIEndpoint history;
+        history.path = config_.metrics_history_path;
+        history.method = "GET";
+        history.handler = [](const std::map<std::string, std::string>& params, const std::vector<uint8_t>&) {
+            auto param = [&params](const char* name) {
+                auto it = params.find(name);
+                return it != params.end() ? it->second : std::string();
+            };
+            std::string json;
+            const std::string series = param("series");
+            if (series.empty()) {
+                // the names of the series
+                JSONWriter writer(json);
+                writer.BeginArray();
+                for (const std::string& name : MetricsHistory::Global().Series()) {
+                    writer.String(name);
+                }
+                writer.EndArray();
+            } else {
+                // by default the last day, by minute
+                MetricsHistory::resolution_t resolution = MetricsHistory::RESOLUTION_MINUTE;
+                if (!param("resolution").empty() && !MetricsHistory::ParseResolution(param("resolution"), resolution)) {
+                    return APIUtils::CreateErrorResponse("Unknown resolution", 400);
+                }
+                const int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+                const int64_t from = param("from").empty() ? now - 24 * 3600 : std::atoll(param("from").c_str());
+                const int64_t to = param("to").empty() ? now : std::atoll(param("to").c_str());
+                json = MetricsHistory::Global().QueryJSON(series, resolution, from, to);
+            }
+            APIResponse response;
+            response.body.assign(json.begin(), json.end());
+            return response;
+        };
+        history.description = "Recent values of a metric (series, resolution 1s/1m/1h, from/to in seconds since the epoch)";
+        RegisterEndpoint(history);
+    }
+    std::cout << "HTTPServer initialized on port " << config_.port << std::endl;
+}
+
+HTTPServer::~HTTPServer() {
+    Stop();
+}
+
+bool HTTPServer::Start() {
+    if (server_running_.exchange(true)) {
+        return true; // Already running
+    }
+
+    // each loop listens on the port of the first, in case that was chosen by the system
+    const size_t loop_count = config_.event_loops ? config_.event_loops : std::max(1u, std::thread::hardware_concurrency());
+    port_ = config_.port;
+    for (size_t i = 0; i < loop_count; i++) {
+        auto loop = std::make_unique<EventLoop>();
+        loop->listen_fd = Listen(config_.bind_address, port_);
+        if (loop->listen_fd == -1) {
+            std::cerr << "HTTPServer: cannot listen on " << config_.bind_address << ":" << port_
+                      << ": " << strerror(errno) << std::endl;
+            break;
+        }
+        if (i == 0) {
+            struct sockaddr_storage addr;
+            socklen_t addr_len = sizeof(addr);
+            if (getsockname(loop->listen_fd, (struct sockaddr*) &addr, &addr_len) == 0) {
+                port_ = ntohs(addr.ss_family == AF_INET6 ? ((struct sockaddr_in6*) &addr)->sin6_port
+                                                         : ((struct sockaddr_in*) &addr)->sin_port);
+            }
+        }
+
+        loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        struct epoll_event listen_event = {};
+        listen_event.events = EPOLLIN;
+        listen_event.data.fd = loop->listen_fd;
+        struct epoll_event wake_event = {};
+        wake_event.events = EPOLLIN;
+        wake_event.data.fd = loop->wake_fd;
+        if (loop->epoll_fd == -1 || loop->wake_fd == -1 ||
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->listen_fd, &listen_event) == -1 ||
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &wake_event) == -1) {
+            perror("HTTPServer: error while creating event loop");
+            break;
+        }
+        loops_.push_back(std::move(loop));
+    }
+    if (loops_.size() != loop_count) {
+        loops_.clear();
+        server_running_ = false;
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_ = ServerStatistics();
+        stats_.start_time = std::chrono::system_clock::now();
+    }
+    for (auto& loop : loops_) {
+        loop->thread = std::thread(&HTTPServer::ServerLoop, this, std::ref(*loop));
+    }
+    if (!config_.metrics_history_path.empty()) {
+        MetricsHistory::Global().Start();
+    }
+
+    std::cout << "HTTP Server started on " << config_.bind_address << ":" << port_
+              << " (" << loops_.size() << " event loops)" << std::endl;
+    return true;
+}
+
+void HTTPServer::Stop() {
+    if (!server_running_.exchange(false)) {
+        return;
+    }
+
+    for (auto& loop : loops_) {
+        const uint64_t one = 1;
+        if (write(loop->wake_fd, &one, sizeof(one)) == -1) {
+            perror("HTTPServer: error while waking event loop");
+        }
+    }
+    for (auto& loop : loops_) {
+        if (loop->thread.joinable()) {
+            loop->thread.join();
+        }
+    }
+    loops_.clear();
+    if (!config_.metrics_history_path.empty()) {
+        MetricsHistory::Global().Stop();
+    }
+    std::cout << "HTTP Server stopped" << std::endl;
+}
+
+void HTTPServer::ServerLoop(EventLoop& loop) {
+    // sendfile() has no MSG_NOSIGNAL: a peer gone is an EPIPE error instead
+    sigset_t sigpipe;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+
+    struct epoll_event events[64];
+    auto next_sweep = std::chrono::steady_clock::now() + std::chrono::seconds{1};
+
+    while (server_running_) {
+        int count = epoll_wait(loop.epoll_fd, events, 64, 1000);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("HTTPServer: error while waiting for events");
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            const int fd = events[i].data.fd;
+            if (fd == loop.listen_fd) {
+                AcceptConnections(loop);
+            } else if (fd == loop.wake_fd) {
+                uint64_t value;
+                while (read(loop.wake_fd, &value, sizeof(value)) > 0) {}
+            } else {
+                auto it = loop.connections.find(fd);
+                if (it != loop.connections.end()) {
+                    HandleConnection(loop, *it->second, events[i].events);
+                }
+            }
+        }
+
+        // idle and disconnected clients
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= next_sweep) {
+            next_sweep = now + std::chrono::seconds{1};
+            std::vector<int> expired;
+            for (const auto& entry : loop.connections) {
+                const Connection& conn = *entry.second;
+                if (!conn.client->is_active || now - conn.last_activity > config_.connection_timeout) {
+                    expired.push_back(entry.first);
+                }
+            }
+            for (int fd : expired) {
+                CloseConnection(loop, fd);
+            }
+        }
+    }
+
+    while (!loop.connections.empty()) {
+        CloseConnection(loop, loop.connections.begin()->first);
+    }
+}
+
+void HTTPServer::AcceptConnections(EventLoop& loop) {
+    for (;;) {
+        struct sockaddr_storage addr;
+        socklen_t addr_len = sizeof(addr);
+        int fd = accept4(loop.listen_fd, (struct sockaddr*) &addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("HTTPServer: error while accepting connection");
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            if (stats_.active_connections >= config_.max_connections) {
+                close(fd);
+                continue;
+            }
+            stats_.active_connections++;
+            stats_.peak_connections = std::max(stats_.peak_connections, stats_.active_connections);
+        }
+
+        // responses are written whole, there is nothing to coalesce
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        auto conn = std::make_unique<Connection>();
+        conn->fd = fd;
+        conn->last_activity = std::chrono::steady_clock::now();
+        conn->client = std::make_shared<ClientConnection>();
+        conn->client->client_id = "client_" + std::to_string(++next_client_id_);
+        char ip[INET6_ADDRSTRLEN] = "";
+        if (addr.ss_family == AF_INET6) {
+            inet_ntop(AF_INET6, &((struct sockaddr_in6*) &addr)->sin6_addr, ip, sizeof(ip));
+        } else {
+            inet_ntop(AF_INET, &((struct sockaddr_in*) &addr)->sin_addr, ip, sizeof(ip));
+        }
+        conn->client->ip_address = ip;
+        conn->client->connected_at = conn->client->last_activity = std::chrono::system_clock::now();
+        {
+            std::lock_guard<ProfiledMutex> lock(connections_mutex_);
+            connections_[conn->client->client_id] = conn->client;
+        }
+
+        struct epoll_event event = {};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = fd;
+        loop.connections.emplace(fd, std::move(conn));
+        if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            perror("HTTPServer: error while adding connection");
+            CloseConnection(loop, fd);
+        }
+    }
+}
+
+void HTTPServer::HandleConnection(EventLoop& loop, Connection& conn, uint32_t events) {
+    if (events & EPOLLERR) {
+        CloseConnection(loop, conn.fd);
+        return;
+    }
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+        conn.readable = true;
+    }
+
+    // at most one request beyond the size limit is buffered
+    const size_t input_limit = config_.max_request_size + HTTPRequest::MAX_HEAD_SIZE;
+    for (;;) {
+        bool received = false;
+        size_t read = 0;
+        while (conn.readable && conn.in.size() < input_limit && read < READ_CHUNK_SIZE) {
+            char buffer[16384];
+            ssize_t len = recv(conn.fd, buffer, sizeof(buffer), 0);
+            if (len > 0) {
+                conn.in.append(buffer, len);
+                read += len;
+                received = true;
+            } else if (len == 0) {
+                conn.readable = false;
+                conn.peer_closed = true;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                conn.readable = false;
+            } else if (errno != EINTR) {
+                CloseConnection(loop, conn.fd);
+                return;
+            }
+        }
+        if (received) {
+            conn.last_activity = std::chrono::steady_clock::now();
+            std::lock_guard<ProfiledMutex> lock(connections_mutex_);
+            conn.client->last_activity = std::chrono::system_clock::now();
+        }
+
+        // answer the complete requests in order, unless their responses pile up
+        // (or a static file is being sent, which is not buffered)
+        const bool backlog = conn.out.size() - conn.out_pos >= MAX_PENDING_OUTPUT || conn.SendingStaticBody();
+        size_t pos = 0;
+        while (!conn.closing && pos < conn.in.size() && conn.out.size() - conn.out_pos < MAX_PENDING_OUTPUT &&
+               !conn.SendingStaticBody()) {
+            if (conn.upload) {
+                const size_t len = std::min(conn.upload_remaining, conn.in.size() - pos);
+                const bool accepted = conn.upload->Write((const uint8_t*) conn.in.data() + pos, len);
+                pos += len;
+                conn.upload_remaining -= len;
+                if (!accepted || conn.upload_remaining == 0) {
+                    FinishUpload(conn, accepted);
+                }
+                continue;
+            }
+
+            HTTPRequest request;
+            size_t length = 0;
+            auto result = request.Parse(conn.in.data() + pos, conn.in.size() - pos, config_.max_request_size, length);
+            if (request.head_length && has_body_handlers_ && StartUpload(conn, request)) {
+                pos += request.head_length;
+                continue;
+            }
+            if (result == HTTPRequest::ParseResult::INCOMPLETE) {
+                break;
+            }
+            if (result != HTTPRequest::ParseResult::COMPLETE) {
+                bool too_large = result == HTTPRequest::ParseResult::TOO_LARGE;
+                WriteResponse(conn, APIUtils::CreateErrorResponse(too_large ? "Request too large" : "Invalid request",
+                                                                  too_large ? 413 : 400), false);
+                std::lock_guard<std::mutex> lock(stats_mutex_);
+                stats_.total_requests++;
+                stats_.failed_requests++;
+                break;
+            }
+            ProcessRequest(conn, request);
+            pos += length;
+        }
+        conn.in.erase(0, pos);
+
+        if (!Flush(conn)) {
+            CloseConnection(loop, conn.fd);
+            return;
+        }
+        if (conn.out_pos < conn.out.size() || conn.SendingStaticBody()) {
+            return;     // resumed once the socket is writable
+        }
+        if (conn.closing || (conn.peer_closed && !conn.readable)) {
+            CloseConnection(loop, conn.fd);
+            return;
+        }
+        // more to read or answer, as the limits stopped it
+        if (pos == 0 && !backlog && !(conn.readable && conn.in.size() < input_limit)) {
+            return;
+        }
+    }
+}
+
+bool HTTPServer::Flush(Connection& conn) {
+    while (conn.out_pos < conn.out.size()) {
+        ssize_t sent = send(conn.fd, conn.out.data() + conn.out_pos, conn.out.size() - conn.out_pos, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        conn.out_pos += sent;
+    }
+    conn.out.clear();
+    conn.out_pos = 0;
+
+    const StaticAssets::Body& body = conn.static_body;
+    while (conn.SendingStaticBody()) {
+        ssize_t sent;
+        if (body.fd != -1) {
+            off_t offset = conn.static_sent;
+            sent = sendfile(conn.fd, body.fd, &offset, body.length - conn.static_sent);
+        } else {
+            sent = send(conn.fd, body.data.data() + conn.static_sent, body.length - conn.static_sent, MSG_NOSIGNAL);
+        }
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (sent == 0) {
+            return false;   // the file was truncated meanwhile
+        }
+        conn.static_sent += sent;
+    }
+    conn.ReleaseStaticBody();
+    return true;
+}
+
+void HTTPServer::CloseConnection(EventLoop& loop, int fd) {
+    auto it = loop.connections.find(fd);
+    if (it == loop.connections.end()) {
+        return;
+    }
+    close(fd);    // also removes it from the epoll set
+
+    const auto& client = it->second->client;
+    client->is_active = false;
+    {
+        std::lock_guard<ProfiledMutex> lock(connections_mutex_);
+        connections_.erase(client->client_id);
+    }
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.active_connections--;
+    }
+    loop.connections.erase(it);
+}
+
+void HTTPServer::ProcessRequest(Connection& conn, const HTTPRequest& request) {
+    const auto start = std::chrono::steady_clock::now();
+    APIResponse response;
+    std::shared_ptr<const APIResponse> cached;
+    const std::string* endpoint_path = nullptr;
+
+    if (config_.enable_rate_limiting && IsRateLimited(conn.client->ip_address)) {
+        response = APIUtils::CreateErrorResponse("Too many requests", 429);
+    } else {
+        std::shared_lock<std::shared_mutex> lock(endpoints_mutex_);
+        bool path_found = false;
+        const APIEndpoint* endpoint = FindEndpoint(request, path_found);
+
+        if (!endpoint && !path_found && ServeStatic(conn, request)) {
+            lock.unlock();
+            RecordRequest(config_.static_path, 200, start);
+            return;
+        } else if (!endpoint) {
+            response = path_found ? APIUtils::CreateErrorResponse("Method not allowed", 405)
+                                  : APIUtils::CreateErrorResponse("Not found", 404);
+        } else if ((config_.enable_authentication || endpoint->requires_authentication) && !AuthenticateRequest(request)) {
+            response = APIUtils::CreateErrorResponse("Unauthorized", 401);
+        } else if (endpoint->generation && request.method == "GET") {
+            endpoint_path = &endpoint->path;
+            const uint64_t generation = endpoint->generation();
+            const std::string etag = "\"" + etag_prefix_ + std::to_string(generation) + "\"";
+            const std::string_view if_none_match = request.Header("If-None-Match");
+            if (if_none_match == "*" || if_none_match.find(etag) != std::string_view::npos) {
+                response.status_code = 304;
+                response.headers["ETag"] = etag;
+            } else {
+                cached = GetCachedResponse(conn, request, *endpoint, generation);
+            }
+        } else {
+            endpoint_path = &endpoint->path;
+            conn.params.clear();
+            ParseQuery(request.query, conn.params);
+            conn.body.assign(request.body.begin(), request.body.end());
+            try {
+                response = endpoint->handler(conn.params, conn.body);
+            } catch (const std::exception& e) {
+                std::cerr << "HTTPServer: error in handler of " << endpoint->path << ": " << e.what() << std::endl;
+                response = APIUtils::CreateErrorResponse("Internal server error", 500);
+            }
+        }
+
+        std::lock_guard<std::mutex> stats_lock(stats_mutex_);
+        if (endpoint_path) {
+            stats_.endpoint_usage[*endpoint_path]++;
+        }
+    }
+
+    WriteResponse(conn, cached ? *cached : response, request.keep_alive);
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.total_requests++;
+    if ((cached ? *cached : response).status_code < 400) {
+        stats_.successful_requests++;
+    } else {
+        stats_.failed_requests++;
+    }
+    stats_.average_response_time += (elapsed - stats_.average_response_time) / 16;
+}
+
+std::shared_ptr<const APIResponse> HTTPServer::GetCachedResponse(Connection& conn, const HTTPRequest& request,
+                                                              const APIEndpoint& endpoint, uint64_t generation) {
+    std::string key;
+    key.reserve(request.path.size() + 1 + request.query.size());
+    key.append(request.path).append(1, '?').append(request.query);
+    {
+        std::lock_guard<std::mutex> lock(response_cache_mutex_);
+        auto it = response_cache_.find(key);
+        if (it != response_cache_.end() && it->second.generation == generation) {
+            return it->second.response;
+        }
+    }
+
+    // computed outside the lock; at worst twice, by concurrent requests
+    auto response = std::make_shared<APIResponse>();
+    conn.params.clear();
+    ParseQuery(request.query, conn.params);
+    conn.body.clear();
+    try {
+        *response = endpoint.handler(conn.params, conn.body);
+    } catch (const std::exception& e) {
+        std::cerr << "HTTPServer: error in handler of " << endpoint.path << ": " << e.what() << std::endl;
+        return std::make_shared<APIResponse>(APIUtils::CreateErrorResponse("Internal server error", 500));
+    }
+    if (response->status_code != 200) {
+        return response;
+    }
+    response->headers["ETag"] = "\"" + etag_prefix_ + std::to_string(generation) + "\"";
+    response->headers["Cache-Control"] = "no-cache";
+
+    std::lock_guard<std::mutex> lock(response_cache_mutex_);
+    if (response_cache_.size() >= RESPONSE_CACHE_SIZE) {
+        response_cache_.clear();    // many queries: start over
+    }
+    response_cache_[std::move(key)] = CachedResponse{generation, response};
+    return response;
+}
+
+const APIEndpoint* HTTPServer::FindEndpoint(const HTTPRequest& request, bool& path_found) const {
+    for (const auto& candidate : endpoints_) {
+        if (request.path == candidate.path) {
+            path_found = true;
+            if (request.method == candidate.method) {
+                return &candidate;
+            }
+        }
+    }
+    return nullptr;
+}
+
+bool HTTPServer::StartUpload(Connection& conn, const HTTPRequest& request) {
+    const auto start = std::chrono::steady_clock::now();
+    APIResponse response;
+    {
+        std::shared_lock<std::shared_mutex> lock(endpoints_mutex_);
+        bool path_found = false;
+        const APIEndpoint* endpoint = FindEndpoint(request, path_found);
+        if (!endpoint || !endpoint->body_handler) {
+            return false;
+        }
+        conn.upload_endpoint = endpoint->path;
+
+        const size_t max_body_size = endpoint->max_body_size ? endpoint->max_body_size : config_.max_request_size;
+        if (config_.enable_rate_limiting && IsRateLimited(conn.client->ip_address)) {
+            response = APIUtils::CreateErrorResponse("Too many requests", 429);
+        } else if ((config_.enable_authentication || endpoint->requires_authentication) && !AuthenticateRequest(request)) {
+            response = APIUtils::CreateErrorResponse("Unauthorized", 401);
+        } else if (request.content_length > max_body_size) {
+            response = APIUtils::CreateErrorResponse("Request too large", 413);
+        } else {
+            conn.params.clear();
+            ParseQuery(request.query, conn.params);
+            try {
+                conn.upload = endpoint->body_handler(conn.params);
+            } catch (const std::exception& e) {
+                std::cerr << "HTTPServer: error in body handler of " << endpoint->path << ": " << e.what() << std::endl;
+            }
+            if (!conn.upload) {
+                response = APIUtils::CreateErrorResponse("Internal server error", 500);
+            }
+        }
+    }
+
+    if (!conn.upload) {
+        // the body is not read, so the connection is closed
+        WriteResponse(conn, response, false);
+        RecordRequest(conn.upload_endpoint, response.status_code, start);
+        return true;
+    }
+
+    conn.upload_remaining = request.content_length;
+    conn.upload_keep_alive = request.keep_alive;
+    conn.upload_start = start;
+    if (conn.upload_remaining == 0) {
+        FinishUpload(conn, true);
+    }
+    return true;
+}
+
+void HTTPServer::FinishUpload(Connection& conn, bool complete) {
+    APIResponse response;
+    try {
+        response = conn.upload->Finish();
+    } catch (const std::exception& e) {
+        std::cerr << "HTTPServer: error in body handler of " << conn.upload_endpoint << ": " << e.what() << std::endl;
+        response = APIUtils::CreateErrorResponse("Internal server error", 500);
+    }
+    conn.upload.reset();
+
+    // the rest of a rejected body is not read
+    WriteResponse(conn, response, complete && conn.upload_keep_alive);
+    RecordRequest(conn.upload_endpoint, response.status_code, conn.upload_start);
+}
+
+void HTTPServer::RecordRequest(const std::string& endpoint_path, int status_code, std::chrono::steady_clock::time_point start) {
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.endpoint_usage[endpoint_path]++;
+    stats_.total_requests++;
+    if (status_code < 400) {
+        stats_.successful_requests++;
+    } else {
+        stats_.failed_requests++;
+    }
+    stats_.average_response_time += (elapsed - stats_.average_response_time) / 16;
+}
+
+void HTTPServer::WriteResponse(Connection& conn, const APIResponse& response, bool keep_alive) {
+    char number[24];
+    std::string& out = conn.out;
+    out += "HTTP/1.1 ";
+    snprintf(number, sizeof(number), "%d ", response.status_code);
+    out += number;
+    out += StatusText(response.status_code);
+    if (response.status_code != 304) {
+        out += "\r\nContent-Type: ";
+        out += response.content_type;
+        out += "\r\nContent-Length: ";
+        snprintf(number, sizeof(number), "%zu", response.body.size());
+        out += number;
+    }
+    if (!config_.cors_origin.empty()) {
+        out += "\r\nAccess-Control-Allow-Origin: ";
+        out += config_.cors_origin;
+    }
+    for (const auto& header : response.headers) {
+        out += "\r\n";
+        out += header.first;
+        out += ": ";
+        out += header.second;
+    }
+    out += keep_alive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n";
+    out.append(response.body.begin(), response.body.end());
+
+    if (!keep_alive) {
+        conn.closing = true;
+    }
+}
+
+bool HTTPServer::ServeStatic(Connection& conn, const HTTPRequest& request) {
+    if (!static_assets_ || (request.method != "GET" && request.method != "HEAD") ||
+            request.path.substr(0, config_.static_path.size()) != config_.static_path) {
+        return false;
+    }
+    StaticAssets::Body body;
+    if (!static_assets_->Open(request.path.substr(config_.static_path.size()), request.Header("Accept-Encoding"), body)) {
+        return false;
+    }
+
+    const std::string_view if_none_match = request.Header("If-None-Match");
+    const bool not_modified = if_none_match == "*" || if_none_match.find(body.etag) != std::string_view::npos;
+    char number[24];
+    std::string& out = conn.out;
+    out += not_modified ? "HTTP/1.1 304 Not Modified" : "HTTP/1.1 200 OK";
+    if (!not_modified) {
+        out += "\r\nContent-Type: ";
+        out += body.content_type;
+        out += "\r\nContent-Length: ";
+        snprintf(number, sizeof(number), "%zu", body.length);
+        out += number;
+        if (body.encoding != StaticAssets::IDENTITY) {
+            out += "\r\nContent-Encoding: ";
+            out += StaticAssets::EncodingName(body.encoding);
+        }
+    }
+    if (!config_.cors_origin.empty()) {
+        out += "\r\nAccess-Control-Allow-Origin: ";
+        out += config_.cors_origin;
+    }
+    out += "\r\nETag: ";
+    out += body.etag;
+    out += "\r\nCache-Control: no-cache\r\nVary: Accept-Encoding";
+    out += request.keep_alive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n";
+    if (!request.keep_alive) {
+        conn.closing = true;
+    }
+
+    // the body itself is not copied into out, but sent after it
+    conn.ReleaseStaticBody();
+    conn.static_body = std::move(body);
+    if (not_modified || request.method == "HEAD") {
+        conn.ReleaseStaticBody();
+    }
+    return true;
+}
+
+bool HTTPServer::IsRateLimited(const std::string& client_ip) {
+    return rate_limiter_.IsLimited(client_ip);
+}
+
+bool HTTPServer::AuthenticateRequest(const HTTPRequest& request) {
+    std::string_view key = request.Header("X-API-Key");
+    std::string_view authorization = request.Header("Authorization");
+    if (key.empty() && authorization.substr(0, 7) == "Bearer ") {
+        key = Trim(authorization.substr(7));
+    }
+    if (!config_.api_key.empty() && key.size() == config_.api_key.size() &&
+            SecureMemoryManager::GetInstance().SecureCompare(key.data(), config_.api_key.data(), key.size())) {
+        return true;
+    }
+    return !config_.token_secret.empty() && VerifyToken(key);
+}
+
+bool HTTPServer::VerifyToken(std::string_view token) {
+    const size_t signature_start = token.rfind('.');
+    if (signature_start == std::string_view::npos) {
+        return false;
+    }
+    const std::string_view signed_part = token.substr(0, signature_start);
+    const std::string_view signature = token.substr(signature_start + 1);
+    const size_t expiry_start = signed_part.rfind('.');
+    if (expiry_start == std::string_view::npos || signature.size() != 64) {
+        return false;
+    }
+
+    // also for a cached token, so that it expires on time
+    int64_t expiry = 0;
+    const std::string_view expiry_text = signed_part.substr(expiry_start + 1);
+    if (std::from_chars(expiry_text.data(), expiry_text.data() + expiry_text.size(), expiry).ptr != expiry_text.data() + expiry_text.size() ||
+            expiry < std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count()) {
+        return false;
+    }
+
+    SecureMemoryManager& memory = SecureMemoryManager::GetInstance();
+    {
+        // a token verified before: a lookup, instead of the HMAC
+        std::lock_guard<std::mutex> lock(verified_tokens_mutex_);
+        auto it = verified_token_index_.find(signature);
+        if (it != verified_token_index_.end()) {
+            const std::string& cached = it->second->second;
+            if (cached.size() != signed_part.size() || !memory.SecureCompare(cached.data(), signed_part.data(), cached.size())) {
+                return false;
+            }
+            verified_tokens_.splice(verified_tokens_.begin(), verified_tokens_, it->second);
+            return true;
+        }
+    }
+
+    const std::string expected = SecurityUtils::CalculateHMACSHA256(config_.token_secret, signed_part.data(), signed_part.size());
+    if (expected.size() != signature.size() || !memory.SecureCompare(expected.data(), signature.data(), signature.size())) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(verified_tokens_mutex_);
+    if (config_.token_cache_size == 0 || verified_token_index_.count(signature)) {
+        return true;
+    }
+    if (verified_tokens_.size() >= config_.token_cache_size) {
+        verified_token_index_.erase(verified_tokens_.back().first);
+        verified_tokens_.pop_back();
+    }
+    verified_tokens_.emplace_front(std::string(signature), std::string(signed_part));
+    verified_token_index_[verified_tokens_.front().first] = verified_tokens_.begin();
+    return true;
 }
 
-HTTPServer::~HTTPServer() {
-    Stop();
+std::string HTTPServer::IssueToken(const std::string& subject, std::chrono::system_clock::time_point expiry) const {
+    if (config_.token_secret.empty()) {
+        return "";
+    }
+    const std::string signed_part = subject + "." +
+        std::to_string(std::chrono::duration_cast<std::chrono::seconds>(expiry.time_since_epoch()).count());
+    return signed_part + "." + SecurityUtils::CalculateHMACSHA256(config_.token_secret, signed_part.data(), signed_part.size());
 }
 
-bool HTTPServer::Start() {
-    if (server_running_.exchange(true)) {
-        return true; // Already running
+void HTTPServer::RegisterEndpoint(const APIEndpoint& endpoint) {
+    std::unique_lock<std::shared_mutex> lock(endpoints_mutex_);
+    if (endpoint.body_handler) {
+        has_body_handlers_ = true;
     }
-    
-    // In a real implementation, this would start the actual HTTP server
-    std::cout << "HTTP Server started on " << config_.bind_address << ":" << config_.port << std::endl;
-    return true;
+    for (auto& existing : endpoints_) {
+        if (existing.path == endpoint.path && existing.method == endpoint.method) {
+            existing = endpoint;
+            return;
+        }
+    }
+    endpoints_.push_back(endpoint);
 }
 
-void HTTPServer::Stop() {
-    if (server_running_.exchange(false)) {
-        std::cout << "HTTP Server stopped" << std::endl;
+void HTTPServer::UnregisterEndpoint(const std::string& path, const std::string& method) {
+    std::unique_lock<std::shared_mutex> lock(endpoints_mutex_);
+    endpoints_.erase(std::remove_if(endpoints_.begin(), endpoints_.end(), [&](const APIEndpoint& endpoint) {
+        return endpoint.path == path && endpoint.method == method;
+    }), endpoints_.end());
+}
+
+std::vector<std::shared_ptr<ClientConnection>> HTTPServer::GetActiveConnections() const {
+    std::lock_guard<ProfiledMutex> lock(connections_mutex_);
+    std::vector<std::shared_ptr<ClientConnection>> connections;
+    connections.reserve(connections_.size());
+    for (const auto& entry : connections_) {
+        connections.push_back(entry.second);
+    }
+    return connections;
+}
+
+void HTTPServer::DisconnectClient(const std::string& client_id) {
+    // closed by its event loop, within a second
+    std::lock_guard<ProfiledMutex> lock(connections_mutex_);
+    auto it = connections_.find(client_id);
+    if (it != connections_.end()) {
+        it->second->is_active = false;
     }
 }
 
-// WebSocketServer implementation stubs
+HTTPServer::ServerStatistics HTTPServer::GetStatistics() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+// WebSocketServer implementation
 WebSocketServer::WebSocketServer() {
     std::cout << "WebSocket Server initialized" << std::endl;
 }
@@ -50,24 +2304,554 @@ bool WebSocketServer::Start(uint16_t port) {
         return true;
     }
     
+    broadcast_thread_ = std::thread(&WebSocketServer::BroadcastLoop, this);
     std::cout << "WebSocket Server started on port " << port << std::endl;
     return true;
 }
 
 void WebSocketServer::Stop() {
     if (server_running_.exchange(false)) {
+        {
+            std::lock_guard<ProfiledMutex> lock(clients_mutex_);
+            Notify();
+        }
+        if (broadcast_thread_.joinable()) {
+            broadcast_thread_.join();
+        }
         std::cout << "WebSocket Server stopped" << std::endl;
     }
 }
 
+void WebSocketServer::AddClient(const std::string& client_id, std::shared_ptr<ClientConnection> connection) {
+    std::lock_guard<ProfiledMutex> lock(clients_mutex_);
+    RemoveClientLocked(client_id);
+    Client& client = websocket_clients_[client_id];
+    client.connection = connection;
+    client.deflate = connection->permessage_deflate;
+    if (client.deflate) {
+        deflate_clients_++;
+    }
+}
+
+void WebSocketServer::RemoveClient(const std::string& client_id) {
+    std::lock_guard<ProfiledMutex> lock(clients_mutex_);
+    RemoveClientLocked(client_id);
+}
+
+void WebSocketServer::RemoveClientLocked(const std::string& client_id) {
+    auto it = websocket_clients_.find(client_id);
+    if (it == websocket_clients_.end()) {
+        return;
+    }
+    
+    Client* client = &it->second;
+    for (const auto& topic : client->topics) {
+        auto subscribers = subscribers_.find(topic);
+        subscribers->second.erase(client);
+        if (subscribers->second.empty()) {
+            subscribers_.erase(subscribers);
+        }
+    }
+    if (client->pending) {
+        pending_clients_.erase(std::find(pending_clients_.begin(), pending_clients_.end(), client));
+    }
+    if (client->deflate) {
+        deflate_clients_--;
+    }
+    websocket_clients_.erase(it);
+}
+
+std::vector<std::string> WebSocketServer::GetConnectedClients() const {
+    std::lock_guard<ProfiledMutex> lock(clients_mutex_);
+    std::vector<std::string> clients;
+    clients.reserve(websocket_clients_.size());
+    for (const auto& entry : websocket_clients_) {
+        clients.push_back(entry.first);
+    }
+    return clients;
+}
+
 void WebSocketServer::BroadcastMessage(const WebSocketMessage& message) {
-    // Implementation stub
-    std::cout << "Broadcasting WebSocket message to " << websocket_clients_.size() << " clients" << std::endl;
+    const Frames frames = Encode(message);
+    std::lock_guard<ProfiledMutex> lock(clients_mutex_);
+    stats_.frames_encoded++;
+    stats_.frames_deflated += frames.deflated ? 1 : 0;
+    for (auto& entry : websocket_clients_) {
+        Enqueue(entry.second, frames);
+    }
+    Notify();
+}
+
+void WebSocketServer::SendToClient(const std::string& client_id, const WebSocketMessage& message) {
+    const Frames frames = Encode(message);
+    std::lock_guard<ProfiledMutex> lock(clients_mutex_);
+    stats_.frames_encoded++;
+    stats_.frames_deflated += frames.deflated ? 1 : 0;
+    auto it = websocket_clients_.find(client_id);
+    if (it != websocket_clients_.end()) {
+        Enqueue(it->second, frames);
+        Notify();
+    }
+}
+
+void WebSocketServer::SendToSubscribers(const std::string& topic, const WebSocketMessage& message) {
+    const Frames frames = Encode(message);
+    std::lock_guard<ProfiledMutex> lock(clients_mutex_);
+    stats_.frames_encoded++;
+    stats_.frames_deflated += frames.deflated ? 1 : 0;
+    auto subscribers = subscribers_.find(topic);
+    if (subscribers != subscribers_.end()) {
+        for (Client* client : subscribers->second) {
+            Enqueue(*client, frames);
+        }
+        Notify();
+    }
+}
+
+void WebSocketServer::SubscribeClient(const std::string& client_id, const std::string& topic) {
+    std::lock_guard<ProfiledMutex> lock(clients_mutex_);
+    auto it = websocket_clients_.find(client_id);
+    if (it != websocket_clients_.end() && it->second.topics.insert(topic).second) {
+        subscribers_[topic].insert(&it->second);
+    }
+}
+
+void WebSocketServer::UnsubscribeClient(const std::string& client_id, const std::string& topic) {
+    std::lock_guard<ProfiledMutex> lock(clients_mutex_);
+    auto it = websocket_clients_.find(client_id);
+    if (it != websocket_clients_.end() && it->second.topics.erase(topic)) {
+        auto subscribers = subscribers_.find(topic);
+        subscribers->second.erase(&it->second);
+        if (subscribers->second.empty()) {
+            subscribers_.erase(subscribers);
+        }
+    }
+}
+
+void WebSocketServer::BroadcastStatusUpdate(const SystemStatus& status) {
+    WebSocketMessage message;
+    message.type = WebSocketMessageType::STATUS_UPDATE;
+    message.payload = APIUtils::PackStatusUpdate(status);
+    message.timestamp = std::chrono::system_clock::now();
+    BroadcastMessage(message);
+}
+
+void WebSocketServer::BroadcastEmergencyAlert(const std::string& alert) {
+    WebSocketMessage message;
+    message.type = WebSocketMessageType::EMERGENCY_ALERT;
+    message.payload.assign(alert.begin(), alert.end());
+    message.timestamp = std::chrono::system_clock::now();
+    message.requires_acknowledgment = true;
+    BroadcastMessage(message);
+}
+
+WebSocketServer::Frame WebSocketServer::EncodeFrame(const WebSocketMessage& message) {
+    const size_t payload_len = message.payload.size();
+    const size_t packed_len = 1 + 1 + 9 + 1 + (payload_len < 0x100 ? 2 : payload_len < 0x10000 ? 3 : 5) + payload_len;
+    const size_t header_len = packed_len < 126 ? 2 : packed_len < 0x10000 ? 4 : 10;
+    auto frame = std::make_shared<std::vector<uint8_t>>();
+    frame->reserve(header_len + packed_len);
+    auto put_be = [&frame](uint64_t value, int bytes) {
+        for (int i = bytes - 1; i >= 0; i--) {
+            frame->push_back((uint8_t) (value >> (8 * i)));
+        }
+    };
+    
+    // FIN, binary frame; the length
+    frame->push_back(0x82);
+    if (packed_len < 126) {
+        frame->push_back((uint8_t) packed_len);
+    } else if (packed_len < 0x10000) {
+        frame->push_back(126);
+        put_be(packed_len, 2);
+    } else {
+        frame->push_back(127);
+        put_be(packed_len, 8);
+    }
+    
+    // MessagePack: fixarray, positive fixint, uint64, bool, bin
+    frame->push_back(0x94);
+    frame->push_back((uint8_t) message.type & 0x7F);
+    frame->push_back(0xCF);
+    put_be(std::chrono::duration_cast<std::chrono::milliseconds>(message.timestamp.time_since_epoch()).count(), 8);
+    frame->push_back(message.requires_acknowledgment ? 0xC3 : 0xC2);
+    if (payload_len < 0x100) {
+        frame->push_back(0xC4);
+        put_be(payload_len, 1);
+    } else if (payload_len < 0x10000) {
+        frame->push_back(0xC5);
+        put_be(payload_len, 2);
+    } else {
+        frame->push_back(0xC6);
+        put_be(payload_len, 4);
+    }
+    frame->insert(frame->end(), message.payload.begin(), message.payload.end());
+    return frame;
+}
+
+// A raw deflate stream per thread, reset for each message (no context
+// takeover), so that its allocations are reused
+class FrameDeflater {
+private:
+    z_stream stream_ = {};
+    bool initialised_ = false;
+    
+public:
+    FrameDeflater() {
+        initialised_ = deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+    ~FrameDeflater() {
+        if (initialised_) {
+            deflateEnd(&stream_);
+        }
+    }
+    FrameDeflater(const FrameDeflater&) = delete;
+    FrameDeflater& operator=(const FrameDeflater&) = delete;
+    
+    // Appends the compressed data, without the empty block ending the flush
+    bool Deflate(const uint8_t* data, size_t size, std::vector<uint8_t>& out) {
+        if (!initialised_ || deflateReset(&stream_) != Z_OK) {
+            return false;
+        }
+        const size_t start = out.size();
+        stream_.next_in = const_cast<uint8_t*>(data);
+        stream_.avail_in = size;
+        do {
+            const size_t used = out.size();
+            out.resize(used + std::max<size_t>(deflateBound(&stream_, stream_.avail_in), 64));
+            stream_.next_out = out.data() + used;
+            stream_.avail_out = out.size() - used;
+            if (deflate(&stream_, Z_SYNC_FLUSH) == Z_STREAM_ERROR) {
+                out.resize(start);
+                return false;
+            }
+            out.resize(out.size() - stream_.avail_out);
+        } while (stream_.avail_in > 0 || stream_.avail_out == 0);
+        
+        static const uint8_t TAIL[] = {0x00, 0x00, 0xFF, 0xFF};
+        if (out.size() - start < sizeof(TAIL) || !std::equal(std::begin(TAIL), std::end(TAIL), out.end() - sizeof(TAIL))) {
+            out.resize(start);
+            return false;
+        }
+        out.resize(out.size() - sizeof(TAIL));
+        return true;
+    }
+};
+
+WebSocketServer::Frame WebSocketServer::DeflateFrame(const std::vector<uint8_t>& frame) {
+    if (frame.size() < 2) {
+        return nullptr;
+    }
+    const size_t header_len = frame[1] < 126 ? 2 : frame[1] == 126 ? 4 : 10;
+    const size_t payload_len = frame.size() - header_len;
+    if (payload_len < MIN_DEFLATE_SIZE) {
+        return nullptr;
+    }
+    
+    static thread_local FrameDeflater deflater;
+    std::vector<uint8_t> compressed;
+    compressed.reserve(payload_len / 2);
+    if (!deflater.Deflate(frame.data() + header_len, payload_len, compressed) || compressed.size() + 8 >= payload_len) {
+        return nullptr;
+    }
+    
+    // the opcode, with RSV1 marking the compressed message
+    auto deflated = std::make_shared<std::vector<uint8_t>>();
+    const size_t len = compressed.size();
+    deflated->reserve(10 + len);
+    deflated->push_back(frame[0] | 0x40);
+    if (len < 126) {
+        deflated->push_back((uint8_t) len);
+    } else {
+        const int bytes = len < 0x10000 ? 2 : 8;
+        deflated->push_back(bytes == 2 ? 126 : 127);
+        for (int i = bytes - 1; i >= 0; i--) {
+            deflated->push_back((uint8_t) (len >> (8 * i)));
+        }
+    }
+    deflated->insert(deflated->end(), compressed.begin(), compressed.end());
+    return deflated;
+}
+
+std::string WebSocketServer::NegotiateDeflate(std::string_view offers, ClientConnection& connection) {
+    connection.permessage_deflate = false;
+    
+    // offers are separated by commas, their parameters by semicolons; the
+    // first one that can be taken as is is accepted
+    while (!offers.empty()) {
+        const size_t comma = offers.find(',');
+        std::string_view offer = offers.substr(0, comma);
+        offers = comma == std::string_view::npos ? std::string_view() : offers.substr(comma + 1);
+        
+        bool acceptable = true;
+        bool first = true;
+        while (acceptable && !offer.empty()) {
+            const size_t semicolon = offer.find(';');
+            std::string_view parameter = Trim(offer.substr(0, semicolon));
+            offer = semicolon == std::string_view::npos ? std::string_view() : offer.substr(semicolon + 1);
+            
+            std::string_view value;
+            const size_t equals = parameter.find('=');
+            if (equals != std::string_view::npos) {
+                value = Trim(parameter.substr(equals + 1));
+                parameter = Trim(parameter.substr(0, equals));
+                if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+                    value = value.substr(1, value.size() - 2);
+                }
+            }
+            
+            if (first) {
+                acceptable = EqualsIgnoreCase(parameter, "permessage-deflate") && equals == std::string_view::npos;
+                first = false;
+            } else if (EqualsIgnoreCase(parameter, "server_no_context_takeover") ||
+                       EqualsIgnoreCase(parameter, "client_no_context_takeover")) {
+                acceptable = value.empty();
+            } else if (EqualsIgnoreCase(parameter, "client_max_window_bits")) {
+                // the client's window is its own; frames from it are inflated with the largest
+                acceptable = true;
+            } else if (EqualsIgnoreCase(parameter, "server_max_window_bits")) {
+                // the shared deflater has the largest window only
+                acceptable = value == "15";
+            } else {
+                acceptable = false;
+            }
+        }
+        
+        if (acceptable && !first) {
+            connection.permessage_deflate = true;
+            return "permessage-deflate; server_no_context_takeover";
+        }
+    }
+    return "";
+}
+
+WebSocketServer::Frames WebSocketServer::Encode(const WebSocketMessage& message) const {
+    Frames frames;
+    frames.plain = EncodeFrame(message);
+    if (deflate_clients_ > 0) {
+        frames.deflated = DeflateFrame(*frames.plain);
+    }
+    return frames;
+}
+
+WebSocketServer::Statistics WebSocketServer::GetStatistics() const {
+    std::lock_guard<ProfiledMutex> lock(clients_mutex_);
+    return stats_;
+}
+
+void WebSocketServer::Enqueue(Client& client, const Frames& frames) {
+    if (client.connection->socket_fd == -1 || !client.connection->is_active) {
+        return;
+    }
+    
+    const Frame& frame = client.deflate && frames.deflated ? frames.deflated : frames.plain;
+    if (frame == frames.deflated) {
+        stats_.bytes_saved += frames.plain->size() - frame->size();
+    }
+    
+    // a slow client loses its oldest frames, but not one partly sent
+    const size_t keep = client.sent ? 1 : 0;
+    while (client.queue.size() > keep && client.queued_bytes + frame->size() > MAX_QUEUED_BYTES) {
+        client.queued_bytes -= client.queue[keep]->size();
+        client.queue.erase(client.queue.begin() + keep);
+        stats_.frames_dropped++;
+    }
+    client.queue.push_back(frame);
+    client.queued_bytes += frame->size();
+    stats_.frames_queued++;
+    
+    if (!client.pending) {
+        client.pending = true;
+        pending_clients_.push_back(&client);
+    }
+}
+
+bool WebSocketServer::SendQueued(Client& client) {
+    const int fd = client.connection->socket_fd;
+    while (!client.queue.empty()) {
+        const auto& frame = *client.queue.front();
+        ssize_t sent = send(fd, frame.data() + client.sent, frame.size() - client.sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return false;
+            }
+            // the connection is gone
+            client.connection->is_active = false;
+            stats_.frames_dropped += client.queue.size();
+            client.queue.clear();
+            client.queued_bytes = 0;
+            client.sent = 0;
+            return true;
+        }
+        
+        client.sent += sent;
+        if (client.sent == frame.size()) {
+            client.queued_bytes -= frame.size();
+            client.queue.pop_front();
+            client.sent = 0;
+            stats_.frames_sent++;
+        }
+    }
+    return true;
+}
+
+std::vector<uint8_t> WebSocketServer::EncodeMessagePack(const std::map<std::string, std::string>& data) {
+    std::vector<uint8_t> packed;
+    MessagePackWriter writer(packed);
+    writer.BeginObject(data.size());
+    for (const auto& [key, value] : data) {
+        writer.Key(key);
+        writer.String(value);
+    }
+    return packed;
+}
+
+std::map<std::string, std::string> WebSocketServer::DecodeMessagePack(const std::vector<uint8_t>& data) {
+    std::map<std::string, std::string> decoded;
+    MessagePackReader reader(data);
+    if (reader.Next() != MessagePackReader::Type::MAP) {
+        return decoded;
+    }
+    
+    // scalars are kept as text; arrays and maps are skipped
+    for (size_t entries = reader.Size(); entries > 0; entries--) {
+        if (reader.Next() != MessagePackReader::Type::STRING) {
+            break;
+        }
+        const std::string_view key = reader.String();
+        switch (reader.Next()) {
+            case MessagePackReader::Type::STRING:
+                decoded[std::string(key)] = reader.String();
+                break;
+            case MessagePackReader::Type::INTEGER:
+                decoded[std::string(key)] = std::to_string(reader.Integer());
+                break;
+            case MessagePackReader::Type::FLOAT:
+                decoded[std::string(key)] = std::to_string(reader.Float());
+                break;
+            case MessagePackReader::Type::BOOLEAN:
+                decoded[std::string(key)] = reader.Boolean() ? "true" : "false";
+                break;
+            case MessagePackReader::Type::ARRAY:
+                for (size_t elements = reader.Size(); elements > 0; elements--) {
+                    if (!reader.Skip()) {
+                        return decoded;
+                    }
+                }
+                break;
+            case MessagePackReader::Type::MAP:
+                for (size_t entries = 2 * reader.Size(); entries > 0; entries--) {
+                    if (!reader.Skip()) {
+                        return decoded;
+                    }
+                }
+                break;
+            case MessagePackReader::Type::END:
+            case MessagePackReader::Type::INVALID:
+                return decoded;
+            default:
+                break;
+        }
+    }
+    return decoded;
+}
+
+void WebSocketServer::SubscribeStatus(const std::string& client_id, uint64_t last_version, const VersionedStatus& status) {
+    std::lock_guard<ProfiledMutex> lock(clients_mutex_);
+    auto it = websocket_clients_.find(client_id);
+    if (it == websocket_clients_.end()) {
+        return;
+    }
+    
+    Client& client = it->second;
+    client.status_subscriber = true;
+    client.status_version = last_version;
+    if (last_version == status.GetVersion()) {
+        return;
+    }
+    
+    WebSocketMessage message;
+    message.type = WebSocketMessageType::STATUS_UPDATE;
+    message.timestamp = std::chrono::system_clock::now();
+    client.status_version = status.Delta(last_version, message.payload);
+    Frames frames;
+    frames.plain = EncodeFrame(message);
+    if (client.deflate) {
+        frames.deflated = DeflateFrame(*frames.plain);
+    }
+    stats_.frames_encoded++;
+    stats_.frames_deflated += frames.deflated ? 1 : 0;
+    Enqueue(client, frames);
+    Notify();
+}
+
+void WebSocketServer::PublishStatus(const VersionedStatus& status) {
+    const uint64_t version = status.GetVersion();
+    const auto now = std::chrono::system_clock::now();
+    
+    // one frame per version the subscribers are at
+    std::map<uint64_t, std::pair<Frames, uint64_t>> frames;
+    std::lock_guard<ProfiledMutex> lock(clients_mutex_);
+    for (auto& entry : websocket_clients_) {
+        Client& client = entry.second;
+        if (!client.status_subscriber || client.status_version == version) {
+            continue;
+        }
+        
+        auto frame = frames.find(client.status_version);
+        if (frame == frames.end()) {
+            WebSocketMessage message;
+            message.type = WebSocketMessageType::STATUS_UPDATE;
+            message.timestamp = now;
+            const uint64_t patched = status.Delta(client.status_version, message.payload);
+            frame = frames.emplace(client.status_version, std::make_pair(Encode(message), patched)).first;
+            stats_.frames_encoded++;
+            stats_.frames_deflated += frame->second.first.deflated ? 1 : 0;
+        }
+        Enqueue(client, frame->second.first);
+        client.status_version = frame->second.second;
+    }
+    
+    if (!frames.empty()) {
+        Notify();
+    }
+}
+
+void WebSocketServer::Notify() {
+    wake_ = true;
+    broadcast_condition_.notify_one();
+}
+
+void WebSocketServer::BroadcastLoop() {
+    std::unique_lock<ProfiledMutex> lock(clients_mutex_);
+    while (server_running_) {
+        // clients whose sockets would block are retried shortly
+        std::vector<Client*> blocked;
+        for (Client* client : pending_clients_) {
+            if (SendQueued(*client)) {
+                client->pending = false;
+            } else {
+                blocked.push_back(client);
+            }
+        }
+        pending_clients_.swap(blocked);
+        
+        wake_ = false;
+        auto woken = [this]() { return wake_ || !server_running_; };
+        if (pending_clients_.empty()) {
+            broadcast_condition_.wait(lock, woken);
+        } else {
+            broadcast_condition_.wait_for(lock, std::chrono::milliseconds{10}, woken);
+        }
+    }
 }
 
 // StreamDABAPIService implementation
 StreamDABAPIService::StreamDABAPIService(const APIConfig& config) 
-    : api_config_(config), http_server_(config) {
+    : http_server_(config), api_config_(config) {
     
     // Initialize components
     mot_processor_ = std::make_unique<EnhancedMOTProcessor>();
@@ -106,6 +2890,7 @@ bool StreamDABAPIService::Start() {
     
     // Start background processing
     mot_processor_->StartBackgroundProcessing();
+    ResourceSampler::Global().Start();
     
     // Start status update thread
     status_update_thread_ = std::thread(&StreamDABAPIService::StatusUpdateLoop, this);
@@ -130,6 +2915,7 @@ void StreamDABAPIService::Stop() {
     }
     
     // Stop components
+    ResourceSampler::Global().Stop();
     mot_processor_->StopBackgroundProcessing();
     dls_processor_->Stop();
     websocket_server_.Stop();
@@ -140,19 +2926,185 @@ void StreamDABAPIService::Stop() {
 
 void StreamDABAPIService::InitializeEndpoints() {
     // Endpoint initialization would register actual HTTP handlers
+    
+    // image uploads go to the slide pipeline as they are received
+    APIEndpoint add_image;
+    add_image.path = "/api/v1/images";
+    add_image.method = "POST";
+    add_image.body_handler = [this](const std::map<std::string, std::string>& params) {
+        return CreateImageUpload(params);
+    };
+    add_image.max_body_size = api_config_.max_upload_size;
+    add_image.requires_authentication = true;
+    add_image.description = "Upload an image to the slide carousel";
+    http_server_.RegisterEndpoint(add_image);
+    
+    // read-only views, cached until what they show changes; statistics are
+    // sampled with the status
+    auto get = [this](const char* path, APIResponse (StreamDABAPIService::*handler)(const std::map<std::string, std::string>&,
+                                                                                     const std::vector<uint8_t>&),
+                      std::function<uint64_t()> generation) {
+        APIEndpoint endpoint;
+        endpoint.path = path;
+        endpoint.method = "GET";
+        endpoint.handler = [this, handler](const std::map<std::string, std::string>& params, const std::vector<uint8_t>& body) {
+            return (this->*handler)(params, body);
+        };
+        endpoint.generation = std::move(generation);
+        http_server_.RegisterEndpoint(endpoint);
+    };
+    get("/api/v1/status", &StreamDABAPIService::HandleGetStatus, [this]() { return status_versions_.GetVersion(); });
+    get("/api/v1/images", &StreamDABAPIService::HandleGetImages, [this]() { return mot_processor_->GetGeneration(); });
+    get("/api/v1/messages", &StreamDABAPIService::HandleGetMessages, [this]() { return dls_processor_->GetGeneration(); });
+    get("/api/v1/statistics", &StreamDABAPIService::HandleGetStatistics, [this]() { return status_versions_.GetVersion(); });
+    get("/api/v1/memory", &StreamDABAPIService::HandleGetMemory, [this]() { return status_versions_.GetVersion(); });
+    get("/api/v1/configuration", &StreamDABAPIService::HandleGetConfiguration, [this]() { return config_generation_.load(); });
+    
     std::cout << "API endpoints initialized" << std::endl;
 }
 
+std::unique_ptr<ImageUpload> StreamDABAPIService::CreateImageUpload(const std::map<std::string, std::string>& params) {
+    std::string directory = api_config_.upload_directory;
+    if (directory.empty()) {
+        directory = (std::filesystem::temp_directory_path() / "streamdab_uploads").string();
+    }
+    auto filename = params.find("filename");
+    
+    return std::make_unique<ImageUpload>(directory, filename != params.end() ? filename->second : std::string(),
+                                         api_config_.max_upload_size, [this](const ImageUpload& upload) {
+        if (!mot_processor_->AddImage(upload.GetPath())) {
+            unlink(upload.GetPath().c_str());
+            return APIUtils::CreateErrorResponse("Image rejected", 422);
+        }
+        return APIUtils::CreateJSONResponse({
+            {"filename", std::filesystem::path(upload.GetPath()).filename().string()},
+            {"hash", upload.GetHash()},
+            {"content_type", upload.GetMimeType()},
+            {"size", (int) upload.GetSize()}
+        }, 201);
+    });
+}
+
+static APIResponse JSONResponse(const std::string& json) {
+    APIResponse response;
+    response.body.assign(json.begin(), json.end());
+    return response;
+}
+
+APIResponse StreamDABAPIService::HandleGetStatus(const std::map<std::string, std::string>&,
+                                                 const std::vector<uint8_t>&) {
+    return JSONResponse(APIUtils::StatusToJSON(GetCurrentStatus()));
+}
+
+APIResponse StreamDABAPIService::HandleGetImages(const std::map<std::string, std::string>&,
+                                                 const std::vector<uint8_t>&) {
+    const auto images = mot_processor_->GetImageList();
+    std::string json;
+    JSONWriter writer(json);
+    writer.BeginObject();
+    writer.Key("count");
+    writer.UInt(images.size());
+    writer.Key("images");
+    writer.BeginArray();
+    for (const auto& image : images) {
+        writer.String(image);
+    }
+    writer.EndArray();
+    writer.EndObject();
+    return JSONResponse(json);
+}
+
+APIResponse StreamDABAPIService::HandleGetMessages(const std::map<std::string, std::string>&,
+                                                   const std::vector<uint8_t>&) {
+    const auto stats = dls_processor_->GetStatistics();
+    std::string json;
+    JSONWriter writer(json);
+    writer.BeginObject();
+    writer.Key("queue_size");
+    writer.UInt(stats.queue_size);
+    writer.Key("messages_processed");
+    writer.UInt(stats.messages_processed);
+    writer.Key("messages_sent");
+    writer.UInt(stats.messages_sent);
+    writer.Key("messages_optimized");
+    writer.UInt(stats.messages_optimized);
+    writer.Key("messages_rejected");
+    writer.UInt(stats.messages_rejected);
+    writer.Key("context");
+    writer.Int((int64_t) stats.current_context);
+    writer.Key("by_priority");
+    writer.BeginObject();
+    for (const auto& [priority, count] : stats.priority_distribution) {
+        writer.Key(std::to_string((int) priority));
+        writer.UInt(count);
+    }
+    writer.EndObject();
+    writer.EndObject();
+    return JSONResponse(json);
+}
+
+APIResponse StreamDABAPIService::HandleGetStatistics(const std::map<std::string, std::string>&,
+                                                     const std::vector<uint8_t>&) {
+    return JSONResponse(APIUtils::StatisticsToJSON(http_server_.GetStatistics()));
+}
+
+APIResponse StreamDABAPIService::HandleGetMemory(const std::map<std::string, std::string>&,
+                                                 const std::vector<uint8_t>&) {
+    return JSONResponse(MemoryBudget::Global().StatsJSON());
+}
+
+APIResponse StreamDABAPIService::HandleGetConfiguration(const std::map<std::string, std::string>&,
+                                                        const std::vector<uint8_t>&) {
+    // without the API key and certificate paths
+    std::string json;
+    JSONWriter writer(json);
+    std::lock_guard<ProfiledMutex> lock(status_mutex_);
+    writer.BeginObject();
+    writer.Key("port");
+    writer.UInt(api_config_.port);
+    writer.Key("bind_address");
+    writer.String(api_config_.bind_address);
+    writer.Key("enable_ssl");
+    writer.Bool(api_config_.enable_ssl);
+    writer.Key("max_connections");
+    writer.UInt(api_config_.max_connections);
+    writer.Key("connection_timeout_s");
+    writer.Int(api_config_.connection_timeout.count());
+    writer.Key("max_request_size");
+    writer.UInt(api_config_.max_request_size);
+    writer.Key("cors_origin");
+    writer.String(api_config_.cors_origin);
+    writer.Key("enable_authentication");
+    writer.Bool(api_config_.enable_authentication);
+    writer.Key("enable_rate_limiting");
+    writer.Bool(api_config_.enable_rate_limiting);
+    writer.Key("max_requests_per_minute");
+    writer.UInt(api_config_.max_requests_per_minute);
+    writer.Key("status_update_interval_ms");
+    writer.Int(api_config_.status_update_interval.count());
+    writer.Key("max_upload_size");
+    writer.UInt(api_config_.max_upload_size);
+    writer.EndObject();
+    return JSONResponse(json);
+}
+
+APIResponse StreamDABAPIService::HandleAddImage(const std::map<std::string, std::string>& params,
+                                                const std::vector<uint8_t>& body) {
+    auto upload = CreateImageUpload(params);
+    upload->Write(body.data(), body.size());
+    return upload->Finish();
+}
+
 void StreamDABAPIService::StatusUpdateLoop() {
     while (service_running_) {
         UpdateSystemStatus();
         BroadcastStatusUpdate();
-        std::this_thread::sleep_for(std::chrono::seconds(10));
+        std::this_thread::sleep_for(api_config_.status_update_interval);
     }
 }
 
 void StreamDABAPIService::UpdateSystemStatus() {
-    std::lock_guard<std::mutex> lock(status_mutex_);
+    std::lock_guard<ProfiledMutex> lock(status_mutex_);
     
     current_status_.last_updated = std::chrono::system_clock::now();
     current_status_.total_images = mot_processor_->GetImageCount();
@@ -162,6 +3114,11 @@ void StreamDABAPIService::UpdateSystemStatus() {
     current_status_.total_messages = dls_stats.messages_processed;
     current_status_.queued_messages = dls_stats.queue_size;
     
+    // as sampled in the background, over the update interval
+    const auto& sampler = ResourceSampler::Global();
+    current_status_.cpu_usage = sampler.CPUUsage(api_config_.status_update_interval);
+    current_status_.memory_usage = sampler.Latest().memory_usage;
+    
     // Get current content
     auto current_image = mot_processor_->GetNextImage();
     if (current_image) {
@@ -176,16 +3133,19 @@ void StreamDABAPIService::UpdateSystemStatus() {
 }
 
 SystemStatus StreamDABAPIService::GetCurrentStatus() const {
-    std::lock_guard<std::mutex> lock(status_mutex_);
+    std::lock_guard<ProfiledMutex> lock(status_mutex_);
     return current_status_;
 }
 
 void StreamDABAPIService::BroadcastStatusUpdate() {
-    WebSocketMessage status_msg;
-    status_msg.type = WebSocketMessageType::STATUS_UPDATE;
-    status_msg.timestamp = std::chrono::system_clock::now();
-    
-    websocket_server_.BroadcastMessage(status_msg);
+    if (status_versions_.Update(GetCurrentStatus())) {
+        websocket_server_.PublishStatus(status_versions_);
+    }
+}
+
+void StreamDABAPIService::SubscribeStatus(const std::string& client_id, uint64_t last_version) {
+    status_versions_.Update(GetCurrentStatus());
+    websocket_server_.SubscribeStatus(client_id, last_version, status_versions_);
 }
 
 void StreamDABAPIService::TriggerEmergencyMode(const std::string& message) {
@@ -197,12 +3157,7 @@ void StreamDABAPIService::TriggerEmergencyMode(const std::string& message) {
     dls_processor_->AddMessage(message, MessagePriority::EMERGENCY, ContentSource::EMERGENCY_SYSTEM);
     
     // Broadcast emergency alert
-    WebSocketMessage emergency_alert;
-    emergency_alert.type = WebSocketMessageType::EMERGENCY_ALERT;
-    emergency_alert.timestamp = std::chrono::system_clock::now();
-    emergency_alert.requires_acknowledgment = true;
-    
-    websocket_server_.BroadcastMessage(emergency_alert);
+    websocket_server_.BroadcastEmergencyAlert(message);
     
     std::cout << "Emergency mode activated: " << message << std::endl;
 }
@@ -218,9 +3173,7 @@ bool StreamDABAPIService::PerformHealthCheck() {
     if (!service_running_) return false;
     if (!http_server_.IsRunning()) return false;
     
-    // Check components
-    if (mot_processor_->GetImageCount() == 0) return false;
-    
+    // no images (yet) is a state of the carousel, not a fault
     return true;
 }
 
@@ -235,19 +3188,101 @@ std::vector<std::string> StreamDABAPIService::GetHealthIssues() {
         issues.push_back("HTTP server not running");
     }
     
-    if (mot_processor_->GetImageCount() == 0) {
-        issues.push_back("No images available");
-    }
-    
     return issues;
 }
 
 void StreamDABAPIService::UpdateConfiguration(const APIConfig& new_config) {
-    api_config_ = new_config;
+    {
+        std::lock_guard<ProfiledMutex> lock(status_mutex_);
+        api_config_ = new_config;
+    }
+    config_generation_++;
     std::cout << "Configuration updated" << std::endl;
 }
 
+std::string StreamDABAPIService::SerializeJSON(const std::map<std::string, std::variant<std::string, int, double, bool>>& data) {
+    std::string json;
+    JSONWriter writer(json);
+    writer.BeginObject();
+    for (const auto& [key, value] : data) {
+        writer.Key(key);
+        WriteVariant(writer, value);
+    }
+    writer.EndObject();
+    return json;
+}
+
+std::map<std::string, std::string> StreamDABAPIService::ParseJSON(const std::vector<uint8_t>& json_data) {
+    std::map<std::string, std::string> parsed;
+    JSONReader reader(std::string_view((const char*) json_data.data(), json_data.size()));
+    if (reader.Next() != JSONReader::Token::BEGIN_OBJECT) {
+        return parsed;
+    }
+    
+    // the members of a flat object: scalars as text, arrays and objects skipped
+    while (reader.Next() == JSONReader::Token::KEY) {
+        std::string key = reader.String();
+        switch (reader.Next()) {
+            case JSONReader::Token::STRING:
+                parsed[std::move(key)] = reader.String();
+                break;
+            case JSONReader::Token::NUMBER:
+            case JSONReader::Token::BOOLEAN:
+                parsed[std::move(key)] = reader.Text();
+                break;
+            case JSONReader::Token::NULL_VALUE:
+                break;
+            case JSONReader::Token::BEGIN_OBJECT:
+            case JSONReader::Token::BEGIN_ARRAY: {
+                size_t depth = 1;
+                while (depth > 0) {
+                    const auto token = reader.Next();
+                    if (token == JSONReader::Token::BEGIN_OBJECT || token == JSONReader::Token::BEGIN_ARRAY) {
+                        depth++;
+                    } else if (token == JSONReader::Token::END_OBJECT || token == JSONReader::Token::END_ARRAY) {
+                        depth--;
+                    } else if (token == JSONReader::Token::INVALID) {
+                        return {};
+                    }
+                }
+                break;
+            }
+            default:
+                return {};
+        }
+    }
+    return parsed;
+}
+
 // APIUtils implementation
+
+template <typename Writer>
+static void WriteServerStatistics(Writer& writer, const HTTPServer::ServerStatistics& stats) {
+    writer.BeginObject(8);
+    writer.Key("start_time");
+    writer.Int(ToMilliseconds(stats.start_time));
+    writer.Key("total_requests");
+    writer.UInt(stats.total_requests);
+    writer.Key("successful_requests");
+    writer.UInt(stats.successful_requests);
+    writer.Key("failed_requests");
+    writer.UInt(stats.failed_requests);
+    writer.Key("active_connections");
+    writer.UInt(stats.active_connections);
+    writer.Key("peak_connections");
+    writer.UInt(stats.peak_connections);
+    writer.Key("average_response_time_us");
+    writer.Int(stats.average_response_time.count());
+    writer.Key("endpoint_usage");
+    writer.BeginObject(stats.endpoint_usage.size());
+    for (const auto& [endpoint, count] : stats.endpoint_usage) {
+        writer.Key(endpoint);
+        writer.UInt(count);
+    }
+    writer.EndObject();
+    writer.EndObject();
+}
+
 namespace APIUtils {
 
 APIResponse CreateJSONResponse(const std::map<std::string, std::variant<std::string, int, double, bool>>& data, int status_code) {
@@ -256,31 +3291,15 @@ APIResponse CreateJSONResponse(const std::map<std::string, std::variant<std::str
     response.content_type = "application/json";
     response.success = (status_code >= 200 && status_code < 300);
     
-    // Simple JSON serialization (in real implementation, use a proper JSON library)
-    std::ostringstream json;
-    json << "{";
-    bool first = true;
+    std::string json;
+    JSONWriter writer(json);
+    writer.BeginObject();
     for (const auto& [key, value] : data) {
-        if (!first) json << ",";
-        json << "\"" << key << "\":";
-        
-        std::visit([&json](auto&& arg) {
-            using T = std::decay_t<decltype(arg)>;
-            if constexpr (std::is_same_v<T, std::string>) {
-                json << "\"" << arg << "\"";
-            } else if constexpr (std::is_same_v<T, bool>) {
-                json << (arg ? "true" : "false");
-            } else {
-                json << arg;
-            }
-        }, value);
-        
-        first = false;
+        writer.Key(key);
+        WriteVariant(writer, value);
     }
-    json << "}";
-    
-    std::string json_str = json.str();
-    response.body.assign(json_str.begin(), json_str.end());
+    writer.EndObject();
+    response.body.assign(json.begin(), json.end());
     
     return response;
 }
@@ -307,96 +3326,194 @@ APIResponse CreateSuccessResponse(const std::string& message) {
     return CreateJSONResponse(success_data, 200);
 }
 
+// by extension (lower case), sorted for the binary search
+static const std::pair<std::string_view, std::string_view> MIME_TYPES[] = {
+    {".css", "text/css"},
+    {".gif", "image/gif"},
+    {".heic", "image/heif"},
+    {".heif", "image/heif"},
+    {".htm", "text/html"},
+    {".html", "text/html"},
+    {".ico", "image/x-icon"},
+    {".jpeg", "image/jpeg"},
+    {".jpg", "image/jpeg"},
+    {".js", "application/javascript"},
+    {".json", "application/json"},
+    {".map", "application/json"},
+    {".mjs", "application/javascript"},
+    {".png", "image/png"},
+    {".svg", "image/svg+xml"},
+    {".txt", "text/plain"},
+    {".wasm", "application/wasm"},
+    {".webmanifest", "application/manifest+json"},
+    {".webp", "image/webp"},
+    {".woff", "font/woff"},
+    {".woff2", "font/woff2"},
+    {".xml", "application/xml"},
+};
+
+std::string_view MimeTypeOf(std::string_view file_extension) {
+    static const std::string_view unknown = "application/octet-stream";
+    char lower[16];
+    if (file_extension.size() > sizeof(lower)) {
+        return unknown;
+    }
+    for (size_t i = 0; i < file_extension.size(); i++) {
+        lower[i] = tolower((unsigned char) file_extension[i]);
+    }
+    const std::string_view ext(lower, file_extension.size());
+
+    auto it = std::lower_bound(std::begin(MIME_TYPES), std::end(MIME_TYPES), ext,
+                               [](const std::pair<std::string_view, std::string_view>& entry, std::string_view key) {
+                                   return entry.first < key;
+                               });
+    return (it != std::end(MIME_TYPES) && it->first == ext) ? it->second : unknown;
+}
+
 std::string GetMimeType(const std::string& file_extension) {
-    std::string ext = file_extension;
-    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
-    
-    static std::map<std::string, std::string> mime_types = {
-        {".jpg", "image/jpeg"},
-        {".jpeg", "image/jpeg"},
-        {".png", "image/png"},
-        {".webp", "image/webp"},
-        {".heif", "image/heif"},
-        {".heic", "image/heif"},
-        {".json", "application/json"},
-        {".txt", "text/plain"},
-        {".html", "text/html"},
-        {".css", "text/css"},
-        {".js", "application/javascript"}
-    };
-    
-    auto it = mime_types.find(ext);
-    return (it != mime_types.end()) ? it->second : "application/octet-stream";
+    return std::string(MimeTypeOf(file_extension));
+}
+
+std::vector<uint8_t> LoadFileContent(const std::string& file_path) {
+    std::vector<uint8_t> content;
+    if (!ReadWholeFile(file_path, content)) {
+        content.clear();
+    }
+    return content;
 }
 
 bool ValidateImageUpload(const std::vector<uint8_t>& data, const std::string& content_type) {
     if (data.empty()) return false;
     
-    ContentSecurityScanner scanner;
+    static const ContentSecurityScanner scanner;
     auto validation = scanner.ScanContent(data, content_type);
     
     return validation.is_safe;
 }
 
 std::string GenerateClientID() {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_int_distribution<> dis(0, 15);
-    
-    std::ostringstream ss;
-    ss << "client_";
-    for (int i = 0; i < 8; ++i) {
-        ss << std::hex << dis(gen);
-    }
-    
-    return ss.str();
+    return SecurityUtils::GenerateID("client_");
 }
 
 std::vector<uint8_t> PackStatusUpdate(const SystemStatus& status) {
-    // Simple MessagePack-like encoding (in real implementation, use msgpack library)
     std::vector<uint8_t> packed;
-    
-    // This is a simplified implementation
-    std::string json = "{\"is_running\":" + std::string(status.is_running ? "true" : "false") + 
-                      ",\"active_connections\":" + std::to_string(status.active_connections) + 
-                      ",\"total_requests\":" + std::to_string(status.total_requests) + "}";
-    
-    packed.assign(json.begin(), json.end());
+    packed.reserve(512);
+    MessagePackWriter writer(packed);
+    WriteStatus(writer, status);
     return packed;
 }
 
 SystemStatus UnpackStatusUpdate(const std::vector<uint8_t>& packed_data) {
     SystemStatus status;
+    MessagePackReader reader(packed_data);
+    if (reader.Next() != MessagePackReader::Type::MAP) {
+        return status;
+    }
     
-    // Simple unpacking (in real implementation, use msgpack library)
-    std::string json(packed_data.begin(), packed_data.end());
+    for (size_t entries = reader.Size(); entries > 0; entries--) {
+        if (reader.Next() != MessagePackReader::Type::STRING ||
+            !ReadStatusField(reader, reader.String(), status)) {
+            break;
+        }
+    }
+    return status;
+}
+
+bool ApplyStatusPatch(const std::vector<uint8_t>& patch, SystemStatus& status, uint64_t& version) {
+    SystemStatus patched = status;
+    uint64_t patched_version = 0;
+    uint64_t since = UINT64_MAX;
     
-    // Basic parsing (this is simplified)
-    if (json.find("\"is_running\":true") != std::string::npos) {
-        status.is_running = true;
+    MessagePackReader reader(patch);
+    if (reader.Next() != MessagePackReader::Type::MAP) {
+        return false;
+    }
+    for (size_t entries = reader.Size(); entries > 0; entries--) {
+        if (reader.Next() != MessagePackReader::Type::STRING) {
+            return false;
+        }
+        const std::string_view key = reader.String();
+        if (key == "fields") {
+            if (reader.Next() != MessagePackReader::Type::MAP) {
+                return false;
+            }
+            for (size_t fields = reader.Size(); fields > 0; fields--) {
+                if (reader.Next() != MessagePackReader::Type::STRING ||
+                    !ReadStatusField(reader, reader.String(), patched)) {
+                    return false;
+                }
+            }
+        } else if (key == "version" || key == "since") {
+            if (reader.Next() != MessagePackReader::Type::INTEGER) {
+                return false;
+            }
+            (key == "version" ? patched_version : since) = reader.Unsigned();
+        } else if (!reader.Skip()) {
+            return false;
+        }
     }
     
-    status.last_updated = std::chrono::system_clock::now();
-    return status;
+    // a patch since 0 holds all fields
+    if (since != 0 && since != version) {
+        return false;
+    }
+    status = patched;
+    version = patched_version;
+    return true;
 }
 
 std::vector<uint8_t> PackStatistics(const std::map<std::string, double>& stats) {
-    std::ostringstream json;
-    json << "{";
-    bool first = true;
+    std::vector<uint8_t> packed;
+    MessagePackWriter writer(packed);
+    writer.BeginObject(stats.size());
     for (const auto& [key, value] : stats) {
-        if (!first) json << ",";
-        json << "\"" << key << "\":" << value;
-        first = false;
+        writer.Key(key);
+        writer.Number(value);
     }
-    json << "}";
-    
-    std::string json_str = json.str();
+    return packed;
+}
+
+std::vector<uint8_t> PackStatistics(const HTTPServer::ServerStatistics& stats) {
     std::vector<uint8_t> packed;
-    packed.assign(json_str.begin(), json_str.end());
+    MessagePackWriter writer(packed);
+    WriteServerStatistics(writer, stats);
     return packed;
 }
 
+std::vector<uint8_t> PackStatistics(const WebSocketServer::Statistics& stats) {
+    std::vector<uint8_t> packed;
+    MessagePackWriter writer(packed);
+    writer.BeginObject(6);
+    writer.Key("frames_encoded");
+    writer.UInt(stats.frames_encoded);
+    writer.Key("frames_deflated");
+    writer.UInt(stats.frames_deflated);
+    writer.Key("frames_queued");
+    writer.UInt(stats.frames_queued);
+    writer.Key("frames_sent");
+    writer.UInt(stats.frames_sent);
+    writer.Key("frames_dropped");
+    writer.UInt(stats.frames_dropped);
+    writer.Key("bytes_saved");
+    writer.UInt(stats.bytes_saved);
+    return packed;
+}
+
+std::string StatusToJSON(const SystemStatus& status) {
+    std::string json;
+    json.reserve(768);
+    JSONWriter writer(json);
+    WriteStatus(writer, status);
+    return json;
+}
+
+std::string StatisticsToJSON(const HTTPServer::ServerStatistics& stats) {
+    std::string json;
+    JSONWriter writer(json);
+    WriteServerStatistics(writer, stats);
+    return json;
+}
+
 } // namespace APIUtils
 
 } // namespace StreamDAB
\ No newline at end of file
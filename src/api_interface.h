@@ -14,6 +14,7 @@
 
 #include "common.h"
 #include "enhanced_mot.h"
+#include "metrics.h"
 #include "thai_rendering.h"
 #include "smart_dls.h"
 #include "security_utils.h"
@@ -29,6 +30,15 @@
 #include <functional>
 #include <chrono>
 #include <queue>
+#include <deque>
+#include <list>
+#include <set>
+#include <condition_variable>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+#include <cstdint>
+#include <sys/stat.h>
 
 // HTTP server dependencies (would use a library like cpp-httplib or similar)
 // For this implementation, we'll define the interface
@@ -64,12 +74,35 @@ struct WebSocketMessage {
     bool requires_acknowledgment = false;
 };
 
+// The receiver of a request body that is passed on in chunks as it arrives,
+// rather than buffered (see APIEndpoint::body_handler)
+class BodySink {
+public:
+    virtual ~BodySink() = default;
+    
+    // false rejects the request: the rest of the body is not read, and the
+    // response is that of Finish
+    virtual bool Write(const uint8_t* data, size_t len) = 0;
+    // Once the body is complete, or rejected; a sink destroyed without is
+    // one whose connection was lost
+    virtual APIResponse Finish() = 0;
+};
+
 // API endpoint information
 struct APIEndpoint {
     std::string path;
     std::string method; // GET, POST, PUT, DELETE
     std::function<APIResponse(const std::map<std::string, std::string>& params,
                              const std::vector<uint8_t>& body)> handler;
+    // Instead of handler, for large bodies (uploads): creates the sink the
+    // body of a request is passed to
+    std::function<std::unique_ptr<BodySink>(const std::map<std::string, std::string>& params)> body_handler;
+    size_t max_body_size = 0;   // with body_handler; 0: APIConfig::max_request_size
+    // For GET endpoints whose response only changes with some data: the
+    // generation of that data, which increases with each change. Responses
+    // are then cached (by path and query) until it does, and tagged with it
+    // (ETag), so that a client that has the current one gets 304.
+    std::function<uint64_t()> generation;
     bool requires_authentication = false;
     std::vector<std::string> required_permissions;
     std::string description;
@@ -85,6 +118,8 @@ struct ClientConnection {
     std::string user_agent;
     std::vector<std::string> subscriptions; // WebSocket subscriptions
     std::atomic<bool> is_active{true};
+    int socket_fd = -1;     // of an upgraded WebSocket connection; frames are only sent to those
+    bool permessage_deflate = false;    // negotiated on the upgrade (WebSocketServer::NegotiateDeflate)
 };
 
 // API configuration
@@ -100,8 +135,18 @@ struct APIConfig {
     std::string cors_origin = "*";
     bool enable_authentication = false;
     std::string api_key;
+    std::string token_secret;           // signs bearer tokens (see HTTPServer::IssueToken()); empty: API key only
+    size_t token_cache_size = 256;      // verified tokens kept, so that polling clients are not verified again
     bool enable_rate_limiting = true;
     size_t max_requests_per_minute = 60;
+    size_t event_loops = 0;     // HTTP server threads, 0: one per core
+    std::chrono::milliseconds status_update_interval{1000};    // of status pushes to WebSocket clients
+    std::string upload_directory;       // of uploaded images; empty: the system's temporary directory
+    size_t max_upload_size = 50 * 1024 * 1024;
+    std::string metrics_path = "/metrics";  // of the process's metrics (OpenMetrics); empty: none
+    std::string metrics_history_path = "/api/v1/metrics/history";  // of their recent values (MetricsHistory); empty: none
+    std::string static_directory;       // of static files, e.g. the web dashboard (see StaticAssets); empty: none
+    std::string static_path = "/";      // the path they are served under, where no endpoint matches
 };
 
 // Real-time status information
@@ -136,32 +181,436 @@ struct SystemStatus {
     std::chrono::system_clock::time_point last_updated;
 };
 
-// HTTP server interface
+// JSON, written straight into a string: no document is built first.
+// Member counts are only taken for the interface of MessagePackWriter, so
+// that one serializer can produce either.
+class JSONWriter {
+private:
+    std::string& out_;
+    bool need_comma_ = false;
+    
+    void Separate();
+    
+public:
+    explicit JSONWriter(std::string& out) : out_(out) {}
+    
+    void BeginObject(size_t members = 0);
+    void EndObject();
+    void BeginArray(size_t elements = 0);
+    void EndArray();
+    void Key(std::string_view key);
+    
+    void String(std::string_view value);
+    void Int(int64_t value);
+    void UInt(uint64_t value);
+    void Double(double value);     // null, if not finite
+    void Bool(bool value);
+    void Null();
+};
+
+// JSON, read token by token (pull parser) without copying: keys and
+// strings are views into the input, which must outlive them, with their
+// escapes left in place.
+class JSONReader {
+public:
+    enum class Token {
+        BEGIN_OBJECT,
+        END_OBJECT,
+        BEGIN_ARRAY,
+        END_ARRAY,
+        KEY,
+        STRING,
+        NUMBER,
+        BOOLEAN,
+        NULL_VALUE,
+        END,
+        INVALID
+    };
+    
+private:
+    std::string_view json_;
+    size_t pos_ = 0;
+    std::vector<char> nesting_;     // '{' or '['
+    bool after_value_ = false;      // a comma or the end of the container is due
+    bool after_key_ = false;
+    bool invalid_ = false;
+    std::string_view text_;
+    bool escaped_ = false;
+    
+    void SkipWhitespace();
+    Token ReadString(Token token);
+    Token ReadValue();
+    Token Fail();
+    
+public:
+    explicit JSONReader(std::string_view json) : json_(json) {}
+    
+    Token Next();
+    // Skips the value that follows (after a KEY, or in an array); false, if
+    // the input is invalid
+    bool Skip();
+    
+    // The text of the last KEY, STRING, NUMBER or BOOLEAN, as in the input;
+    // for keys and strings, without the quotes and still escaped
+    std::string_view Text() const { return text_; }
+    bool IsEscaped() const { return escaped_; }
+    std::string String() const;     // unescaped
+    double Number() const;
+    bool Boolean() const { return text_ == "true"; }
+    
+    static std::string Unescape(std::string_view text);
+};
+
+// MessagePack, appended to a buffer; always in the smallest encoding
+class MessagePackWriter {
+private:
+    std::vector<uint8_t>& out_;
+    
+    void Put(uint8_t type, uint64_t value, int bytes);
+    void Header(uint8_t fix, uint8_t fix_max, uint8_t type8, uint8_t type16, uint8_t type32, size_t size);
+    
+public:
+    explicit MessagePackWriter(std::vector<uint8_t>& out) : out_(out) {}
+    
+    void BeginObject(size_t members);   // a map
+    void EndObject() {}
+    void BeginArray(size_t elements);
+    void EndArray() {}
+    void Key(std::string_view key) { String(key); }
+    
+    void String(std::string_view value);
+    void Binary(const uint8_t* data, size_t size);
+    void Int(int64_t value);
+    void UInt(uint64_t value);
+    void Double(double value);
+    // A double in the smallest encoding that keeps it exact: an integer, a
+    // float 32 or a float 64
+    void Number(double value);
+    void Bool(bool value);
+    void Null();
+};
+
+// MessagePack, read value by value without copying: strings and binaries
+// are views into the input. Arrays and maps are only announced, with their
+// number of elements or entries; their contents follow.
+class MessagePackReader {
+public:
+    enum class Type {
+        NIL,
+        BOOLEAN,
+        INTEGER,
+        FLOAT,
+        STRING,
+        BINARY,
+        ARRAY,
+        MAP,
+        EXTENSION,
+        END,
+        INVALID
+    };
+    
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t pos_ = 0;
+    
+    uint64_t integer_ = 0;
+    bool negative_ = false;
+    double float_ = 0.0;
+    size_t length_ = 0;         // bytes of strings, binaries and extensions; entries of arrays and maps
+    const uint8_t* bytes_ = nullptr;
+    
+    bool Read(uint64_t& value, int bytes);
+    Type ReadBytes(Type type, size_t length);
+    
+public:
+    MessagePackReader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+    explicit MessagePackReader(const std::vector<uint8_t>& data) : MessagePackReader(data.data(), data.size()) {}
+    
+    Type Next();
+    // Skips the next value, with all it contains; false, if the input is invalid
+    bool Skip();
+    
+    bool Boolean() const { return integer_ != 0; }
+    int64_t Integer() const { return (int64_t) integer_; }
+    uint64_t Unsigned() const { return negative_ ? 0 : integer_; }
+    double Float() const { return float_; }
+    std::string_view String() const { return std::string_view((const char*) bytes_, length_); }
+    const uint8_t* Data() const { return bytes_; }
+    size_t Size() const { return length_; }
+};
+
+// The system status, versioned for delta updates: each update that changes
+// anything is a new version, and each field keeps the version it last
+// changed in. A client that has seen some version thus needs only the fields
+// changed since, whatever its version: patches are MessagePack maps
+//   {"version": current, "since": the client's version, "fields": {name: value}}
+// with "since" 0 for all fields (a client that is new, or whose version is
+// unknown). The fields are kept encoded, so that patches are concatenations.
+class VersionedStatus {
+private:
+    struct Field {
+        std::vector<uint8_t> encoded;   // name and value
+        uint64_t version = 0;
+    };
+    
+    std::vector<Field> fields_;
+    uint64_t version_ = 0;
+    std::vector<uint8_t> scratch_;
+    mutable std::mutex mutex_;
+    
+public:
+    // false, if the status is unchanged
+    bool Update(const SystemStatus& status);
+    uint64_t GetVersion() const;
+    
+    // The patch from version since to the current one, which is returned
+    uint64_t Delta(uint64_t since, std::vector<uint8_t>& patch) const;
+};
+
+// An image upload, written to a temporary file in the upload directory as
+// it is received, so that memory use is that of a chunk, whatever the size.
+// The format is checked on the first bytes and the SHA-256 of the content
+// computed as it arrives. Once complete, the file is moved to its name in
+// the directory (with the extension of its format; by default, named after
+// its hash) and passed to on_complete, which gives the response.
+class ImageUpload : public BodySink {
+public:
+    typedef std::function<APIResponse(const ImageUpload& upload)> CompletionHandler;
+    
+private:
+    static constexpr size_t HEAD_SIZE = 12;     // enough for the magic bytes of all formats
+    
+    std::string directory_;
+    std::string filename_;
+    size_t max_size_;
+    CompletionHandler on_complete_;
+    
+    int fd_ = -1;
+    std::string temp_path_;
+    std::string path_;
+    Hasher digest_;
+    uint8_t head_[HEAD_SIZE];
+    uint8_t tail_[2] = {0, 0};     // the last bytes, for the JPEG end marker
+    size_t size_ = 0;
+    std::string mime_type_;
+    std::string hash_;
+    
+    int error_status_ = 0;
+    std::string error_;
+    
+    bool Append(const uint8_t* data, size_t len);
+    bool Reject(int status_code, const std::string& error);
+    
+public:
+    // filename: as given by the client; only its name is used, if safe
+    ImageUpload(const std::string& directory, const std::string& filename, size_t max_size,
+                CompletionHandler on_complete = nullptr);
+    ~ImageUpload() override;    // removes the file, unless complete
+    
+    bool Write(const uint8_t* data, size_t len) override;
+    APIResponse Finish() override;
+    
+    const std::string& GetPath() const { return path_; }       // once complete
+    const std::string& GetHash() const { return hash_; }       // SHA-256, hex
+    const std::string& GetMimeType() const { return mime_type_; }
+    size_t GetSize() const { return size_; }
+    
+    // The MIME type of an image by its first bytes, empty if not supported
+    static std::string DetectImageType(const uint8_t* data, size_t len);
+};
+
+// An HTTP/1.1 request, parsed in place: its views reference the receive
+// buffer of the connection, and remain valid while the request is processed
+struct HTTPRequest {
+    static constexpr size_t MAX_HEADERS = 32;
+    static constexpr size_t MAX_HEAD_SIZE = 16384;
+    
+    enum class ParseResult { COMPLETE, INCOMPLETE, INVALID, TOO_LARGE };
+    
+    std::string_view method;
+    std::string_view path;
+    std::string_view query;
+    std::string_view version;
+    std::pair<std::string_view, std::string_view> headers[MAX_HEADERS];
+    size_t header_count = 0;
+    std::string_view body;
+    bool keep_alive = true;
+    // once the head is parsed, even if the body is incomplete or too large
+    size_t head_length = 0;
+    size_t content_length = 0;
+    
+    // Parses the request at the start of data; if complete, length is that of
+    // the request (head and body), so that a pipelined request may follow
+    ParseResult Parse(const char* data, size_t len, size_t max_request_size, size_t& length);
+    
+    // The value of a header (name case-insensitive), empty if not present
+    std::string_view Header(std::string_view name) const;
+};
+
+// Requests per minute by client, as token buckets holding a minute's worth.
+// A bucket is a single atomic: the time at which it would be full again
+// (generic cell rate algorithm), so that a check is a shared lock of the
+// client's shard and a compare-and-swap. Full buckets are swept, so that
+// only the clients of about the last minute take memory.
+class RateLimiter {
+public:
+    explicit RateLimiter(size_t requests_per_minute);
+    
+    // true, if the client exceeds its rate; otherwise the request is counted
+    bool IsLimited(std::string_view client, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+    
+    size_t GetClientCount() const;
+    
+private:
+    static const size_t SHARDS = 16;
+    static const std::chrono::seconds SWEEP_INTERVAL;
+    
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<uint64_t, std::atomic<int64_t>> buckets;    // by client hash: full at, in ns
+    };
+    
+    const size_t requests_per_minute_;
+    const int64_t interval_;    // ns per request
+    const int64_t tolerance_;   // how far a bucket may be from full, in ns
+    Shard shards_[SHARDS];
+    std::atomic<int64_t> next_sweep_{0};
+    
+    bool TakeToken(std::atomic<int64_t>& bucket, int64_t now) const;
+    void Sweep(int64_t now);
+};
+
+// The static files of a directory (e.g. the web dashboard), served without
+// copying them in user space. Files up to MAX_CACHED_FILE_SIZE are kept in
+// memory, together with their pre-compressed variants (FILE.br and FILE.gz
+// next to FILE, e.g. made at build time) and ETag; their bodies are sent from
+// the cache. Larger files (or their variants) are sent from the disk by
+// sendfile(). A file changed on disk is noticed by its size and mtime.
+class StaticAssets {
+public:
+    static const size_t MAX_CACHED_FILE_SIZE;
+    static const size_t MAX_CACHE_SIZE;     // of all cached bodies; beyond it, the cache starts over
+    
+    enum Encoding { IDENTITY, GZIP, BROTLI, ENCODINGS };
+    
+    struct Asset {
+        std::string etag;               // quoted
+        std::string_view content_type;  // static storage
+        off_t size = 0;                 // of the file on disk
+        int64_t mtime_ns = 0;
+        std::string bodies[ENCODINGS];  // empty: no such variant
+    };
+    
+    // What to send for a request: a cached asset's body, or an open file
+    // (to be closed by the receiver)
+    struct Body {
+        std::shared_ptr<const Asset> asset;     // keeps data valid
+        std::string_view data;
+        int fd = -1;
+        size_t length = 0;
+        std::string etag;
+        std::string_view content_type;
+        Encoding encoding = IDENTITY;
+    };
+    
+    explicit StaticAssets(std::string directory);
+    
+    // The file of a path relative to the directory (a directory: its
+    // index.html) in the best encoding accepted; false, if there is none or
+    // the path leaves the directory
+    bool Open(std::string_view path, std::string_view accept_encoding, Body& body);
+    
+    static const char* EncodingName(Encoding encoding);
+    // whether the Accept-Encoding header value accepts the encoding
+    static bool Accepts(std::string_view accept_encoding, std::string_view coding);
+    
+private:
+    const std::string directory_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<const Asset>> cache_;   // by relative path
+    size_t cache_size_ = 0;
+    
+    std::shared_ptr<const Asset> Load(const std::string& file_path, const struct stat& file_stat);
+};
+
+// HTTP server: one event loop per thread, each with its own listening socket
+// on the same port (SO_REUSEPORT), so that the kernel spreads connections.
+// Sockets are non-blocking and edge-triggered; connections are kept alive,
+// and pipelined requests are answered in order.
 class HTTPServer {
+public:
+    struct ServerStatistics {
+        std::chrono::system_clock::time_point start_time;
+        size_t total_requests = 0;
+        size_t successful_requests = 0;
+        size_t failed_requests = 0;
+        size_t active_connections = 0;
+        size_t peak_connections = 0;
+        std::chrono::microseconds average_response_time{0};
+        std::map<std::string, size_t> endpoint_usage;
+    };
+    
 private:
+    struct Connection;
+    struct EventLoop;
+    
     APIConfig config_;
     std::vector<APIEndpoint> endpoints_;
+    mutable std::shared_mutex endpoints_mutex_;
     std::map<std::string, std::shared_ptr<ClientConnection>> connections_;
     std::atomic<bool> server_running_{false};
-    std::thread server_thread_;
-    std::mutex connections_mutex_;
-    
-    // Rate limiting
-    std::map<std::string, std::queue<std::chrono::steady_clock::time_point>> rate_limit_data_;
-    std::mutex rate_limit_mutex_;
-    
-    // Request processing
-    APIResponse ProcessRequest(const std::string& method,
-                              const std::string& path,
-                              const std::map<std::string, std::string>& headers,
-                              const std::map<std::string, std::string>& params,
-                              const std::vector<uint8_t>& body);
+    std::vector<std::unique_ptr<EventLoop>> loops_;
+    std::atomic<uint16_t> port_{0};
+    std::atomic<uint64_t> next_client_id_{0};
+    mutable ProfiledMutex connections_mutex_{"http_connections"};
+    
+    RateLimiter rate_limiter_;
+    std::atomic<bool> has_body_handlers_{false};
+    
+    // Responses of endpoints with a generation, by path and query
+    struct CachedResponse {
+        uint64_t generation;
+        std::shared_ptr<const APIResponse> response;
+    };
+    static const size_t RESPONSE_CACHE_SIZE = 256;
+    std::unordered_map<std::string, CachedResponse> response_cache_;
+    std::mutex response_cache_mutex_;
+    std::string etag_prefix_;   // distinct for each server instance, as generations start over
+    
+    std::unique_ptr<StaticAssets> static_assets_;   // if a static directory is configured
+    
+    // Verified bearer tokens by signature, most recently used first
+    typedef std::list<std::pair<std::string, std::string>> TokenList;   // signature, signed part
+    TokenList verified_tokens_;
+    std::unordered_map<std::string_view, TokenList::iterator> verified_token_index_;    // views into the list
+    std::mutex verified_tokens_mutex_;
+    
+    ServerStatistics stats_;
+    mutable std::mutex stats_mutex_;
+    
+    // Request processing; the response is appended to the connection's output
+    const APIEndpoint* FindEndpoint(const HTTPRequest& request, bool& path_found) const;   // endpoints_mutex_ held
+    void ProcessRequest(Connection& conn, const HTTPRequest& request);
+    std::shared_ptr<const APIResponse> GetCachedResponse(Connection& conn, const HTTPRequest& request,
+                                                         const APIEndpoint& endpoint, uint64_t generation);
+    bool StartUpload(Connection& conn, const HTTPRequest& request);     // false, if not for a body handler
+    void FinishUpload(Connection& conn, bool complete);
+    void RecordRequest(const std::string& endpoint_path, int status_code, std::chrono::steady_clock::time_point start);
+    void WriteResponse(Connection& conn, const APIResponse& response, bool keep_alive);
+    // false, if there is no such static file
+    bool ServeStatic(Connection& conn, const HTTPRequest& request);
     
     bool IsRateLimited(const std::string& client_ip);
-    bool AuthenticateRequest(const std::map<std::string, std::string>& headers);
+    bool AuthenticateRequest(const HTTPRequest& request);
+    bool VerifyToken(std::string_view token);
     
-    // Server implementation (would use actual HTTP library)
-    void ServerLoop();
+    // Event loops
+    void ServerLoop(EventLoop& loop);
+    void AcceptConnections(EventLoop& loop);
+    void HandleConnection(EventLoop& loop, Connection& conn, uint32_t events);
+    bool Flush(Connection& conn);
+    void CloseConnection(EventLoop& loop, int fd);
     
 public:
     explicit HTTPServer(const APIConfig& config = APIConfig{});
@@ -171,6 +620,11 @@ public:
     bool Start();
     void Stop();
     bool IsRunning() const { return server_running_; }
+    uint16_t GetPort() const { return port_; }    // the bound port, if the configured one is 0
+    
+    // "SUBJECT.EXPIRY.SIGNATURE": the HMAC-SHA256 (hex) of "SUBJECT.EXPIRY" (Unix time)
+    // with the token secret, accepted as bearer token until expiry; empty without a secret
+    std::string IssueToken(const std::string& subject, std::chrono::system_clock::time_point expiry) const;
     
     // Endpoint management
     void RegisterEndpoint(const APIEndpoint& endpoint);
@@ -181,34 +635,78 @@ public:
     void DisconnectClient(const std::string& client_id);
     
     // Statistics
-    struct ServerStatistics {
-        std::chrono::system_clock::time_point start_time;
-        size_t total_requests = 0;
-        size_t successful_requests = 0;
-        size_t failed_requests = 0;
-        size_t active_connections = 0;
-        size_t peak_connections = 0;
-        std::chrono::microseconds average_response_time{0};
-        std::map<std::string, size_t> endpoint_usage;
-    };
     ServerStatistics GetStatistics() const;
 };
 
-// WebSocket server for real-time communication
+// WebSocket server for real-time communication. A message is framed once,
+// into a buffer shared by all of its recipients, and queued for each; the
+// broadcast thread writes the queues without blocking. A client falling
+// behind by more than MAX_QUEUED_BYTES loses its oldest frames. Topics index
+// their subscribers, so that a topic message only visits those.
+//
+// With permessage-deflate, messages are compressed without context takeover:
+// each on its own, so that a message is also compressed once, into a frame
+// shared by all clients that negotiated the extension.
 class WebSocketServer {
+public:
+    typedef std::shared_ptr<const std::vector<uint8_t>> Frame;
+    
+    static constexpr size_t MAX_QUEUED_BYTES = 1024 * 1024;
+    static constexpr size_t MIN_DEFLATE_SIZE = 64;     // of payloads; smaller ones are sent as they are
+    
+    struct Statistics {
+        size_t frames_encoded = 0;
+        size_t frames_deflated = 0;
+        size_t frames_queued = 0;
+        size_t frames_sent = 0;
+        size_t frames_dropped = 0;
+        size_t bytes_saved = 0;     // by queueing deflated frames
+    };
+    
 private:
-    std::map<std::string, std::shared_ptr<ClientConnection>> websocket_clients_;
-    std::mutex clients_mutex_;
+    // A message framed for both kinds of clients; deflated is null if no
+    // client takes it or the payload does not shrink
+    struct Frames {
+        Frame plain;
+        Frame deflated;
+    };
+    
+    struct Client {
+        std::shared_ptr<ClientConnection> connection;
+        bool deflate = false;
+        std::deque<Frame> queue;
+        size_t queued_bytes = 0;
+        size_t sent = 0;            // of the first frame
+        bool pending = false;       // in pending_clients_
+        std::set<std::string> topics;
+        bool status_subscriber = false;
+        uint64_t status_version = 0;    // the last sent
+    };
+    
+    std::map<std::string, Client> websocket_clients_;
+    std::unordered_map<std::string, std::set<Client*>> subscribers_;  // by topic
+    std::vector<Client*> pending_clients_;     // with frames to send
+    mutable ProfiledMutex clients_mutex_{"websocket_clients"};
     std::atomic<bool> server_running_{false};
     std::thread broadcast_thread_;
-    std::queue<WebSocketMessage> broadcast_queue_;
-    std::mutex broadcast_mutex_;
-    std::condition_variable broadcast_condition_;
+    std::condition_variable_any broadcast_condition_;
+    bool wake_ = false;
+    Statistics stats_;
+    std::atomic<size_t> deflate_clients_{0};
     
     // MessagePack encoding/decoding
     std::vector<uint8_t> EncodeMessagePack(const std::map<std::string, std::string>& data);
     std::map<std::string, std::string> DecodeMessagePack(const std::vector<uint8_t>& data);
     
+    // Frames; to be called with clients_mutex_ held
+    void RemoveClientLocked(const std::string& client_id);
+    void Enqueue(Client& client, const Frames& frames);
+    bool SendQueued(Client& client);    // false, if the socket would block
+    void Notify();
+    
+    // Frames a message, deflated too if any client takes it
+    Frames Encode(const WebSocketMessage& message) const;
+    
     void BroadcastLoop();
     void HandleClientMessage(const std::string& client_id, const WebSocketMessage& message);
     
@@ -237,6 +735,27 @@ public:
     // Status broadcasting
     void BroadcastStatusUpdate(const SystemStatus& status);
     void BroadcastEmergencyAlert(const std::string& message);
+    
+    // Delta status updates: a subscriber is sent the patch from the version it
+    // has seen (0: none) at once, and then one per version published. Each
+    // distinct patch is framed once, for all subscribers at the same version.
+    void SubscribeStatus(const std::string& client_id, uint64_t last_version, const VersionedStatus& status);
+    void PublishStatus(const VersionedStatus& status);
+    
+    // A binary WebSocket frame (server to client, unmasked) carrying the
+    // message as MessagePack array: type, timestamp (ms), acknowledgment
+    // required, payload
+    static Frame EncodeFrame(const WebSocketMessage& message);
+    // The frame with its payload deflated (RSV1 set), as per RFC 7692; null
+    // if that does not make it smaller
+    static Frame DeflateFrame(const std::vector<uint8_t>& frame);
+    
+    // The Sec-WebSocket-Extensions response to the offers of a client's
+    // upgrade request; empty to decline. Sets the connection's
+    // permessage_deflate, to be called before AddClient.
+    static std::string NegotiateDeflate(std::string_view offers, ClientConnection& connection);
+    
+    Statistics GetStatistics() const;
 };
 
 // Main API service that integrates all components
@@ -254,7 +773,8 @@ private:
     
     // System status
     SystemStatus current_status_;
-    std::mutex status_mutex_;
+    VersionedStatus status_versions_;
+    mutable ProfiledMutex status_mutex_{"api_status"};
     std::atomic<bool> service_running_{false};
     std::thread status_update_thread_;
     
@@ -265,9 +785,11 @@ private:
     
     // Configuration
     APIConfig api_config_;
+    std::atomic<uint64_t> config_generation_{0};
     
     // Initialize API endpoints
     void InitializeEndpoints();
+    std::unique_ptr<ImageUpload> CreateImageUpload(const std::map<std::string, std::string>& params);
     void UpdateSystemStatus();
     void StatusUpdateLoop();
     
@@ -294,6 +816,8 @@ private:
                                       const std::vector<uint8_t>& body);
     APIResponse HandleGetStatistics(const std::map<std::string, std::string>& params,
                                    const std::vector<uint8_t>& body);
+    APIResponse HandleGetMemory(const std::map<std::string, std::string>& params,
+                               const std::vector<uint8_t>& body);
     APIResponse HandleHealthCheck(const std::map<std::string, std::string>& params,
                                  const std::vector<uint8_t>& body);
     
@@ -330,7 +854,9 @@ public:
     
     // Status and statistics
     SystemStatus GetCurrentStatus() const;
+    uint64_t GetStatusVersion() const { return status_versions_.GetVersion(); }
     void BroadcastStatusUpdate();
+    void SubscribeStatus(const std::string& client_id, uint64_t last_version);
     
     // Configuration management
     void UpdateConfiguration(const APIConfig& new_config);
@@ -353,15 +879,26 @@ namespace APIUtils {
     APIResponse CreateSuccessResponse(const std::string& message = "OK");
     
     std::string GetMimeType(const std::string& file_extension);
+    // as above, without allocating: a binary search of a precomputed table
+    std::string_view MimeTypeOf(std::string_view file_extension);
     std::vector<uint8_t> LoadFileContent(const std::string& file_path);
     
     bool ValidateImageUpload(const std::vector<uint8_t>& data, const std::string& content_type);
-    std::string GenerateClientID();
+    std::string GenerateClientID();     // "client_" and 16 random hex digits
     
     // MessagePack utilities
     std::vector<uint8_t> PackStatusUpdate(const SystemStatus& status);
     std::vector<uint8_t> PackStatistics(const std::map<std::string, double>& stats);
+    std::vector<uint8_t> PackStatistics(const HTTPServer::ServerStatistics& stats);
+    std::vector<uint8_t> PackStatistics(const WebSocketServer::Statistics& stats);
     SystemStatus UnpackStatusUpdate(const std::vector<uint8_t>& packed_data);
+    // Applies a patch of VersionedStatus to the status at version; false (and
+    // both unchanged), if the patch is invalid or from another version
+    bool ApplyStatusPatch(const std::vector<uint8_t>& patch, SystemStatus& status, uint64_t& version);
+    
+    // JSON utilities
+    std::string StatusToJSON(const SystemStatus& status);
+    std::string StatisticsToJSON(const HTTPServer::ServerStatistics& stats);
 }
 
 } // namespace StreamDAB
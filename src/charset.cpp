@@ -24,7 +24,9 @@
 */
 
 #include "charset.h"
+#include "utf8_scan.h"
 #include <algorithm>
+#include <iterator>
 
 /**********************************************/
 /************* BIG FAT WARNING ****************/
@@ -39,7 +41,7 @@
 #define CHARSET_TABLE_OFFSET 1 // NUL at index 0 cannot be represented
 #define CHARSET_TABLE_ENTRIES (256 - CHARSET_TABLE_OFFSET)
 
-static const char* utf8_encoded_EBU_Latin[CHARSET_TABLE_ENTRIES] = {
+static constexpr const char* utf8_encoded_EBU_Latin[CHARSET_TABLE_ENTRIES] = {
      "Ę", "Į", "Ų", "Ă", "Ė", "Ď", "Ș", "Ț", "Ċ", "\n","\v","Ġ", "Ĺ", "Ż", "Ń",
 "ą", "ę", "į", "ų", "ă", "ė", "ď", "ș", "ț", "ċ", "Ň", "Ě", "ġ", "ĺ", "ż", "\u0082",
 " ", "!", "\"","#", "ł", "%", "&", "'", "(", ")", "*", "+", ",", "-", ".", "/",
@@ -57,56 +59,213 @@ static const char* utf8_encoded_EBU_Latin[CHARSET_TABLE_ENTRIES] = {
 "Ã", "Å", "Æ", "Œ", "ŷ", "Ý", "Õ", "Ø", "Þ", "Ŋ", "Ŕ", "Ć", "Ś", "Ź", "Ť", "ð",
 "ã", "å", "æ", "œ", "ŵ", "ý", "õ", "ø", "þ", "ŋ", "ŕ", "ć", "ś", "ź", "ť", "ħ"};
 
-using namespace std;
+/*! The first code point of a UTF-8 sequence, at compile time; the entries of
+ * the table above are all valid.
+ */
+static constexpr uint32_t decode_utf8(const char* s)
+{
+    const uint8_t lead = s[0];
+    if (lead < 0x80)
+        return lead;
+    if (lead < 0xE0)
+        return (lead & 0x1F) << 6 | (s[1] & 0x3F);
+    if (lead < 0xF0)
+        return (lead & 0x0F) << 12 | (s[1] & 0x3F) << 6 | (s[2] & 0x3F);
+    return (lead & 0x07) << 18 | (s[1] & 0x3F) << 12 | (s[2] & 0x3F) << 6 | (s[3] & 0x3F);
+}
 
-CharsetConverter::CharsetConverter()
+// the pages of 256 code points with at least one EBU Latin character
+static constexpr size_t count_ebu_latin_pages()
 {
-    /*! Build the converstion table that contains the known code points,
-     * at the indices corresponding to the EBU Latin table
-     */
-    using namespace std;
+    bool used[256] = {};
+    size_t pages = 0;
     for (size_t i = 0; i < CHARSET_TABLE_ENTRIES; i++) {
-        string table_entry(utf8_encoded_EBU_Latin[i]);
-        string::iterator it = table_entry.begin();
-        uint32_t code_point = utf8::next(it, table_entry.end());
-        m_conversion_table.push_back(code_point);
+        const uint32_t code_point = decode_utf8(utf8_encoded_EBU_Latin[i]);
+        if (code_point <= 0xFFFF && !used[code_point >> 8]) {
+            used[code_point >> 8] = true;
+            pages++;
+        }
     }
+    return pages;
 }
 
-std::string CharsetConverter::convert(std::string line_utf8, bool up_to_first_error)
+static constexpr size_t EBU_LATIN_PAGES = count_ebu_latin_pages();
+
+/*! Two-level lookup of the EBU Latin character for each code point in the
+ *  Basic Multilingual Plane: the high byte selects one of the pages of 256
+ *  characters (or none), the low byte the character within it. 0 stands
+ *  for characters not in the table, as NUL cannot be represented anyway.
+ */
+struct ebu_latin_table_t {
+    uint8_t page_index[256];    // page number + 1, or 0
+    uint8_t pages[EBU_LATIN_PAGES * 256];
+    uint8_t ascii_table[128];   // for the fast path; ' ' if not representable
+};
+
+/*! Build the lookup table of the EBU Latin characters by code point,
+ * keeping the first one in case of duplicates - at compile time, so that
+ * no converter has to at start
+ */
+static constexpr ebu_latin_table_t build_ebu_latin_table()
 {
-    string::iterator end_it;
+    ebu_latin_table_t table = {};
+    size_t pages = 0;
+    for (size_t i = 0; i < CHARSET_TABLE_ENTRIES; i++) {
+        const uint32_t code_point = decode_utf8(utf8_encoded_EBU_Latin[i]);
+        if (code_point > 0xFFFF)
+            continue;
 
-    if (up_to_first_error) {
-        // check for invalid utf-8, we only convert up to the first error
-        end_it = utf8::find_invalid(line_utf8.begin(), line_utf8.end());
+        uint8_t& page = table.page_index[code_point >> 8];
+        if (page == 0)
+            page = ++pages;
+        uint8_t& entry = table.pages[(page - 1) * 256 + (code_point & 0xFF)];
+        if (entry == 0)
+            entry = i + CHARSET_TABLE_OFFSET;
     }
-    else {
-        end_it = line_utf8.end();
+
+    for (uint32_t c = 0; c < 128; c++) {
+        const uint8_t page = table.page_index[0];
+        const uint8_t entry = page ? table.pages[(page - 1) * 256 + c] : 0;
+        table.ascii_table[c] = entry ? entry : ' ';
     }
+    return table;
+}
 
-    // Convert it to utf-32
-    vector<uint32_t> utf32line;
-    utf8::utf8to32(line_utf8.begin(), end_it, back_inserter(utf32line));
+static constexpr ebu_latin_table_t ebu_latin_table = build_ebu_latin_table();
+static_assert(ebu_latin_table.ascii_table['A'] == 'A', "EBU Latin table");
 
-    string encoded_line(utf32line.size(), '0');
+using namespace std;
 
-    // Try to convert each codepoint
-    for (size_t i = 0; i < utf32line.size(); i++) {
-        vector<uint32_t>::iterator iter = find(m_conversion_table.begin(),
-                m_conversion_table.end(), utf32line[i]);
-        if (iter != m_conversion_table.end()) {
-            size_t index = std::distance(m_conversion_table.begin(), iter);
 
-            encoded_line[i] = (char)(index + CHARSET_TABLE_OFFSET);
-        }
-        else {
-            encoded_line[i] = ' ';
-        }
+uint8_t CharsetConverter::encode(uint32_t code_point) const
+{
+    if (code_point <= 0xFFFF) {
+        uint8_t page = ebu_latin_table.page_index[code_point >> 8];
+        if (page)
+            return ebu_latin_table.pages[(page - 1) * 256 + (code_point & 0xFF)];
     }
+    return 0;
+}
+
+uint8_t CharsetConverter::lookup(uint32_t code_point) const
+{
+    uint8_t entry = encode(code_point);
+    return entry ? entry : ' ';
+}
+
+std::string CharsetConverter::convert(const std::string& line_utf8, bool up_to_first_error)
+{
+    string encoded_line;
+    convert(line_utf8.data(), line_utf8.size(), encoded_line, up_to_first_error);
     return encoded_line;
 }
 
+void CharsetConverter::convert(const char* utf8, size_t len, std::string& encoded, bool up_to_first_error)
+{
+    // we only convert up to the first error, or raise the same exception as utf8::next
+    const size_t valid_len = utf8_valid_prefix(utf8, len);
+    if (valid_len < len && !up_to_first_error) {
+        const char* error = utf8 + valid_len;
+        utf8::next(error, utf8 + len);
+    }
+    convert_valid(utf8, valid_len, encoded);
+}
+
+void CharsetConverter::convert_valid(const char* utf8, size_t len, std::string& encoded) const
+{
+    // one output char per code point, so never more than the input length
+    encoded.resize(len);
+    size_t encoded_len = 0;
+
+    const char* it = utf8;
+    const char* end = utf8 + len;
+    while (it != end) {
+        // fast path for runs of 7-bit chars
+        while (it != end && (uint8_t) *it < 0x80)
+            encoded[encoded_len++] = ebu_latin_table.ascii_table[(uint8_t) *it++];
+        if (it == end)
+            break;
+
+        encoded[encoded_len++] = lookup(utf8::unchecked::next(it));
+    }
+
+    encoded.resize(encoded_len);
+}
+
+DABCharset CharsetConverter::select_charset(const char* utf8, size_t len, bool validated) const
+{
+    if (!validated)
+        len = utf8_valid_prefix(utf8, len);
+
+    bool ebu_latin = true;
+    bool bmp = true;
+    size_t ucs2_len = 0;
+
+    const char* it = utf8;
+    const char* end = utf8 + len;
+    while (it != end) {
+        uint32_t code_point = (uint8_t) *it;
+        if (code_point < 0x80)
+            it++;
+        else
+            code_point = utf8::unchecked::next(it);
+        ebu_latin = ebu_latin && encode(code_point);
+        bmp = bmp && code_point <= 0xFFFF;
+        ucs2_len += 2;
+    }
+
+    if (ebu_latin)
+        return DABCharset::COMPLETE_EBU_LATIN;
+    return bmp && ucs2_len < len ? DABCharset::UCS2_BE : DABCharset::UTF8;
+}
+
+void CharsetConverter::convert(const char* utf8, size_t len, DABCharset charset, std::string& encoded, bool validated)
+{
+    switch (charset) {
+    case DABCharset::UCS2_BE:
+        {
+            if (!validated)
+                len = utf8_valid_prefix(utf8, len);
+            encoded.resize(2 * len);
+            size_t encoded_len = 0;
+            const char* it = utf8;
+            const char* end = utf8 + len;
+            while (it != end) {
+                uint32_t code_point = (uint8_t) *it;
+                if (code_point < 0x80)
+                    it++;
+                else
+                    code_point = utf8::unchecked::next(it);
+                if (code_point > 0xFFFF)
+                    code_point = ' ';
+                encoded[encoded_len++] = code_point >> 8;
+                encoded[encoded_len++] = code_point & 0xFF;
+            }
+            encoded.resize(encoded_len);
+        }
+        break;
+    case DABCharset::UTF8:
+        encoded.assign(utf8, validated ? len : utf8_valid_prefix(utf8, len));
+        break;
+    default:
+        convert_valid(utf8, validated ? len : utf8_valid_prefix(utf8, len), encoded);
+        break;
+    }
+}
+
+std::string CharsetConverter::convert_ucs2_be_to_utf8(const std::string& str)
+{
+    string utf8_str;
+    for (size_t i = 0; i + 1 < str.size(); i += 2) {
+        uint32_t code_point = ((uint8_t) str[i] << 8) | (uint8_t) str[i + 1];
+        if (code_point >= 0xD800 && code_point <= 0xDFFF)
+            continue;
+        utf8::append(code_point, back_inserter(utf8_str));
+    }
+
+    return utf8_str;
+}
+
 std::string CharsetConverter::convert_ebu_to_utf8(const std::string& str)
 {
     string utf8_str;
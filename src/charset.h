@@ -29,24 +29,56 @@
 #include <string>
 #include <vector>
 #include "utf8.h"
+#include "pad_common.h"
 
 class CharsetConverter
 {
     public:
-        CharsetConverter();
-
         /*! Convert a UTF-8 encoded text line into an EBU Latin encoded byte
          *  stream. If up_to_first_error is set, convert as much text as possible.
          *  If false, raise an utf8::exception in case of conversion errors.
          */
-        std::string convert(std::string line_utf8, bool up_to_first_error = true);
+        std::string convert(const std::string& line_utf8, bool up_to_first_error = true);
+
+        /*! Same as above, but converting from a buffer into a (reused) string,
+         *  to avoid any allocation once the string has grown large enough.
+         */
+        void convert(const char* utf8, size_t len, std::string& encoded, bool up_to_first_error = true);
 
         /*! Convert a EBU Latin byte stream to a UTF-8 encoded string.
          *  Invalid input characters are converted to ⁇ (unicode U+2047).
          */
         std::string convert_ebu_to_utf8(const std::string& str);
 
+        /*! Convert a UCS-2 BE byte stream to a UTF-8 encoded string. A trailing
+         *  odd byte and surrogates (not valid in UCS-2) are dropped.
+         */
+        std::string convert_ucs2_be_to_utf8(const std::string& str);
+
+        /*! The most compact DAB character set for a UTF-8 encoded text: the
+         *  Complete EBU Latin based repertoire, if it has all characters, else
+         *  the shorter of UCS-2 BE (only for the Basic Multilingual Plane) and
+         *  UTF-8. Like convert, only the text up to the first error counts.
+         *  If validated, the whole text is known to be valid UTF-8 (see
+         *  utf8_valid_prefix), so that it is not validated again.
+         */
+        DABCharset select_charset(const char* utf8, size_t len, bool validated = false) const;
+
+        /*! Convert a UTF-8 encoded text into the Complete EBU Latin based
+         *  repertoire (as convert, up to the first error), UCS-2 BE or UTF-8,
+         *  reusing the output string. Characters the character set cannot
+         *  represent become spaces. validated as for select_charset.
+         */
+        void convert(const char* utf8, size_t len, DABCharset charset, std::string& encoded, bool validated = false);
+
+        /*! The EBU Latin character of a single code point, or 0 if there is
+         *  none (as opposed to convert, which substitutes a space).
+         */
+        uint8_t encode(uint32_t code_point) const;
+
     private:
-        // Representation of the table in 32-bit unicode
-        std::vector<uint32_t> m_conversion_table;
+        // in the EBU Latin table, which is built at compile time
+        uint8_t lookup(uint32_t code_point) const;
+        // as convert, for valid UTF-8
+        void convert_valid(const char* utf8, size_t len, std::string& encoded) const;
 };
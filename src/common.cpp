@@ -23,6 +23,10 @@
 
 #include "common.h"
 
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 int verbose = 0;
 
 std::vector<std::string> split_string(const std::string &s, const char delimiter) {
@@ -34,3 +38,25 @@ std::vector<std::string> split_string(const std::string &s, const char delimiter
         result.push_back(part);
     return result;
 }
+
+/*! Checks for (and consumes) a re-read request file.
+ *
+ * \return 1 if a re-read was requested, 0 if not, and -1 on error
+ */
+int check_reread_file(const std::string& type, const std::string& path) {
+    struct stat path_stat;
+    if (stat(path.c_str(), &path_stat)) {
+        // ignore missing request file
+        if (errno != ENOENT) {
+            perror(("ODR-PadEnc Error: could not retrieve " + type +" re-read request file stat").c_str());
+            return -1;  // error
+        }
+        return 0;   // no re-read
+    } else {
+        // handle request
+        fprintf(stderr, "ODR-PadEnc received %s re-read request!\n", type.c_str());
+        if (unlink(path.c_str()))
+            perror(("ODR-PadEnc Error: erasing file '" + path +"' failed").c_str());
+        return 1;   // re-read
+    }
+}
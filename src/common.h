@@ -47,5 +47,6 @@
 
 extern int verbose;
 extern std::vector<std::string> split_string(const std::string &s, const char delimiter);
+extern int check_reread_file(const std::string& type, const std::string& path);
 
 #endif /* COMMON_H_ */
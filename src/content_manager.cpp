@@ -4,14 +4,130 @@
 */
 
 #include "content_manager.h"
+#include "content_store.h"
+#include "event_notifier.h"
 #include <iostream>
 #include <algorithm>
 #include <sstream>
+#include <ctime>
+#include <tuple>
 
 namespace StreamDAB {
 
+// ContentData implementation
+ContentData::ContentData(const uint8_t* data, size_t len) {
+    if (len > 0) {
+        blob_ = SlideBlobStore::Global().Intern(data, len);
+    }
+}
+
+ContentData::ContentData(const slide_blob_t& blob) {
+    if (blob && blob->Size() > 0) {
+        blob_ = SlideBlobStore::Global().Intern(blob);
+    }
+}
+
+bool ContentData::operator==(const ContentData& other) const {
+    // interned blobs of the same content are the same, but a hash collision may have kept two apart
+    return blob_ == other.blob_ || (size() == other.size() && std::equal(begin(), end(), other.begin()));
+}
+
+// ScheduleIntervalIndex implementation
+void ScheduleIntervalIndex::Insert(Interval interval) {
+    intervals_.push_back(std::move(interval));
+    sorted_ = false;
+}
+
+void ScheduleIntervalIndex::Remove(const std::string& item_id, std::chrono::system_clock::time_point start) {
+    auto it = std::find_if(intervals_.begin(), intervals_.end(),
+                          [&](const Interval& interval) { return interval.start == start && interval.item_id == item_id; });
+    if (it != intervals_.end()) {
+        intervals_.erase(it);   // keeps the order
+        augmented_ = false;
+    }
+}
+
+void ScheduleIntervalIndex::RemoveItem(const std::string& item_id) {
+    auto end = std::remove_if(intervals_.begin(), intervals_.end(),
+                             [&](const Interval& interval) { return interval.item_id == item_id; });
+    if (end != intervals_.end()) {
+        intervals_.erase(end, intervals_.end());
+        augmented_ = false;
+    }
+}
+
+void ScheduleIntervalIndex::Clear() {
+    intervals_.clear();
+    max_end_.clear();
+    sorted_ = true;
+    augmented_ = true;
+}
+
+void ScheduleIntervalIndex::Update() const {
+    if (!sorted_) {
+        std::sort(intervals_.begin(), intervals_.end(),
+                 [](const Interval& a, const Interval& b) { return a.start < b.start; });
+        sorted_ = true;
+        augmented_ = false;
+    }
+    if (!augmented_) {
+        max_end_.resize(intervals_.size());
+        Augment(0, intervals_.size());
+        augmented_ = true;
+    }
+}
+
+// The subtree of [lo, hi) is rooted at its middle
+std::chrono::system_clock::time_point ScheduleIntervalIndex::Augment(size_t lo, size_t hi) const {
+    if (lo >= hi) return std::chrono::system_clock::time_point::min();
+    
+    size_t mid = lo + (hi - lo) / 2;
+    max_end_[mid] = std::max({intervals_[mid].end, Augment(lo, mid), Augment(mid + 1, hi)});
+    return max_end_[mid];
+}
+
+std::vector<std::string> ScheduleIntervalIndex::Stab(std::chrono::system_clock::time_point t) const {
+    Update();
+    
+    std::vector<std::string> ids;
+    Stab(0, intervals_.size(), t, ids);
+    
+    // the activations of an item overlap when it is active for over a day
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    return ids;
+}
+
+void ScheduleIntervalIndex::Stab(size_t lo, size_t hi, std::chrono::system_clock::time_point t,
+                                 std::vector<std::string>& ids) const {
+    if (lo >= hi) return;
+    
+    size_t mid = lo + (hi - lo) / 2;
+    if (max_end_[mid] < t) return;     // everything in the subtree ended before t
+    
+    Stab(lo, mid, t, ids);
+    if (intervals_[mid].start <= t) {
+        if (t <= intervals_[mid].end) {
+            ids.push_back(intervals_[mid].item_id);
+        }
+        Stab(mid + 1, hi, t, ids);
+    }
+}
+
+std::chrono::system_clock::time_point ScheduleIntervalIndex::NextStart(std::chrono::system_clock::time_point t) const {
+    Update();
+    
+    auto it = std::upper_bound(intervals_.begin(), intervals_.end(), t,
+                              [](std::chrono::system_clock::time_point time, const Interval& interval) {
+                                  return time < interval.start;
+                              });
+    return it != intervals_.end() ? it->start : std::chrono::system_clock::time_point::max();
+}
+
 // ContentScheduler implementation
-ContentScheduler::ContentScheduler() {
+const std::chrono::seconds ContentScheduler::RESCORE_INTERVAL{60};
+
+ContentScheduler::ContentScheduler() : snapshot_(std::make_shared<const ContentSnapshot>()) {
     std::cout << "Content Scheduler initialized" << std::endl;
 }
 
@@ -33,6 +149,12 @@ void ContentScheduler::Stop() {
         return; // Not running
     }
     
+    {
+        // the loop is either waiting, or will see the flag before it waits
+        std::lock_guard<std::mutex> lock(schedule_mutex_);
+    }
+    schedule_cv_.notify_all();
+    
     if (scheduler_thread_.joinable()) {
         scheduler_thread_.join();
     }
@@ -41,21 +163,31 @@ void ContentScheduler::Stop() {
 }
 
 void ContentScheduler::SchedulingLoop() {
+    std::unique_lock<std::mutex> lock(schedule_mutex_);
     while (scheduler_running_) {
         try {
             ProcessScheduledContent();
-            UpdateContentMetrics();
-            std::this_thread::sleep_for(std::chrono::seconds(1));
+            PublishSnapshot();
         } catch (const std::exception& e) {
             std::cerr << "Error in scheduling loop: " << e.what() << std::endl;
         }
+        
+        // Sleep until the next event, or until the content changes
+        const auto next_event = GetNextEvent();
+        if (next_event == std::chrono::system_clock::time_point::max()) {
+            schedule_cv_.wait(lock);
+        } else {
+            schedule_cv_.wait_until(lock, next_event);
+        }
     }
 }
 
 void ContentScheduler::ProcessScheduledContent() {
-    std::lock_guard<std::mutex> lock(schedule_mutex_);
-    
     auto now = std::chrono::system_clock::now();
+    ProcessDueEvents(now);
+    
+    auto previous_mot = current_mot_content_;
+    auto previous_dls = current_dls_content_;
     
     // Process emergency overrides first
     if (emergency_override_ && emergency_content_) {
@@ -63,6 +195,8 @@ void ContentScheduler::ProcessScheduledContent() {
         if (emergency_duration < emergency_duration_) {
             current_mot_content_ = emergency_content_;
             current_dls_content_ = emergency_content_;
+            UpdateContentMetrics(previous_mot, current_mot_content_, now);
+            UpdateContentMetrics(previous_dls, current_dls_content_, now);
             return;
         } else {
             // Emergency period expired
@@ -74,52 +208,210 @@ void ContentScheduler::ProcessScheduledContent() {
     // Select next content based on schedule
     current_mot_content_ = SelectNextMOTContent();
     current_dls_content_ = SelectNextDLSContent();
+    UpdateContentMetrics(previous_mot, current_mot_content_, now);
+    UpdateContentMetrics(previous_dls, current_dls_content_, now);
 }
 
-std::shared_ptr<ContentItem> ContentScheduler::SelectNextMOTContent() {
-    std::vector<std::shared_ptr<ContentItem>> candidates;
+void ContentScheduler::ScheduleItem(std::shared_ptr<ContentItem> item, std::chrono::system_clock::time_point now) {
+    UnscheduleItem(item->item_id);
+    
+    ScheduleEntry& entry = scheduled_content_[item->item_id];
+    entry.item = item;
+    entry.generation = next_generation_++;
+    CompileActivations(entry, now);
+    RecordChange(item->item_id, item);
+    UpdateTotals(*item, true);
+    active_changed_ = true;
+}
+
+void ContentScheduler::UnscheduleItem(const std::string& item_id) {
+    auto it = scheduled_content_.find(item_id);
+    if (it == scheduled_content_.end()) return;
+    
+    // its pending events are skipped once they are due
+    SetReady(it->second, false);
+    activation_index_.RemoveItem(item_id);
+    UpdateTotals(*it->second.item, false);
+    scheduled_content_.erase(it);
+    RecordChange(item_id, nullptr);
+    active_changed_ = true;
+}
+
+void ContentScheduler::UpdateTotals(const ContentItem& item, bool add) {
+    const auto displayed = std::make_pair(item.metrics.last_displayed, item.item_id);
+    if (add) {
+        if (item.is_active) totals_.active_items++;
+        totals_.type_counts[item.type]++;
+        totals_.priority_counts[item.priority]++;
+        totals_.display_time += item.metrics.total_display_time;
+        totals_.display_count += item.metrics.display_count;
+        if (item.metrics.display_count > 0) totals_.recent_displays.insert(displayed);
+    } else {
+        if (item.is_active) totals_.active_items--;
+        if (--totals_.type_counts[item.type] == 0) totals_.type_counts.erase(item.type);
+        if (--totals_.priority_counts[item.priority] == 0) totals_.priority_counts.erase(item.priority);
+        totals_.display_time -= item.metrics.total_display_time;
+        totals_.display_count -= item.metrics.display_count;
+        totals_.recent_displays.erase(displayed);
+    }
+}
+
+bool ContentScheduler::IsScheduled(const std::shared_ptr<ContentItem>& item) const {
+    auto it = scheduled_content_.find(item->item_id);
+    return it != scheduled_content_.end() && it->second.item == item;
+}
+
+void ContentScheduler::PublishSnapshot() {
+    // only this (locked) writer replaces the snapshot, so it is read plainly here
+    const auto& previous = snapshot_;
+    if (!active_changed_ && previous->mot_content == current_mot_content_ &&
+        previous->dls_content == current_dls_content_) {
+        return;
+    }
     
-    // Find eligible MOT content
-    for (auto& item : scheduled_content_) {
-        if (!item->is_active) continue;
-        if (item->type != ContentType::MOT_SLIDESHOW && item->type != ContentType::COMBINED) continue;
-        if (!ShouldScheduleContent(*item)) continue;
-        
-        candidates.push_back(item);
+    auto snapshot = std::make_shared<ContentSnapshot>();
+    if (active_changed_) {
+        for (const auto& entry : scheduled_content_) {
+            if (entry.second.item->is_active) {
+                snapshot->active_content.push_back(entry.second.item);
+            }
+        }
+    } else {
+        snapshot->active_content = previous->active_content;
     }
+    snapshot->mot_content = current_mot_content_;
+    snapshot->dls_content = current_dls_content_;
+    snapshot->version = previous->version + 1;
+    active_changed_ = false;
     
-    if (candidates.empty()) return nullptr;
+    std::atomic_store(&snapshot_, std::shared_ptr<const ContentSnapshot>(std::move(snapshot)));
+}
+
+void ContentScheduler::RecordChange(const std::string& item_id, std::shared_ptr<ContentItem> item) {
+    auto it = change_versions_.find(item_id);
+    if (it != change_versions_.end()) {
+        change_log_.erase(it->second);
+    }
     
-    // Sort by scheduling score
-    std::sort(candidates.begin(), candidates.end(), 
-             [this](const auto& a, const auto& b) {
-                 return CalculateSchedulingScore(*a) > CalculateSchedulingScore(*b);
-             });
+    const uint64_t version = ++content_version_;
+    change_log_[version] = std::make_pair(item_id, std::move(item));
+    change_versions_[item_id] = version;
+}
+
+void ContentScheduler::CompileActivations(ScheduleEntry& entry, std::chrono::system_clock::time_point from) {
+    const std::string& item_id = entry.item->item_id;
+    for (const auto& activation : ContentUtils::GetActivations(entry.item->schedule, from, COMPILE_AHEAD)) {
+        entry.activations.push_back(activation);
+        activation_index_.Insert({activation.first, activation.second, item_id});
+    }
     
-    return candidates.front();
+    if (!entry.activations.empty()) {
+        schedule_events_.push({entry.activations.front().first, EventType::WINDOW_START, item_id, entry.generation});
+    }
 }
 
-std::shared_ptr<ContentItem> ContentScheduler::SelectNextDLSContent() {
-    std::vector<std::shared_ptr<ContentItem>> candidates;
+void ContentScheduler::EndActivation(ScheduleEntry& entry) {
+    SetReady(entry, false);
+    
+    const ContentUtils::Activation ended = entry.activations.front();
+    activation_index_.Remove(entry.item->item_id, ended.first);
+    entry.activations.pop_front();
+    
+    if (entry.activations.empty()) {
+        CompileActivations(entry, ended.second);
+    } else {
+        schedule_events_.push({entry.activations.front().first, EventType::WINDOW_START, entry.item->item_id, entry.generation});
+    }
+}
+
+void ContentScheduler::SetReady(ScheduleEntry& entry, bool ready) {
+    const ContentType type = entry.item->type;
+    const bool mot = type == ContentType::MOT_SLIDESHOW || type == ContentType::COMBINED;
+    const bool dls = type == ContentType::DLS_MESSAGE || type == ContentType::COMBINED;
+    const double score = ready ? CalculateSchedulingScore(*entry.item) : 0.0;
+    
+    if (entry.ready) {
+        ReadyKey key(entry.score, entry.item->item_id);
+        if (mot) ready_mot_.erase(key);
+        if (dls) ready_dls_.erase(key);
+    }
     
-    // Find eligible DLS content
-    for (auto& item : scheduled_content_) {
+    entry.ready = ready;
+    if (ready) {
+        entry.score = score;
+        ReadyKey key(entry.score, entry.item->item_id);
+        if (mot) ready_mot_.insert(key);
+        if (dls) ready_dls_.insert(key);
+    }
+}
+
+void ContentScheduler::ProcessDueEvents(std::chrono::system_clock::time_point now) {
+    while (!schedule_events_.empty() && schedule_events_.top().time <= now) {
+        ScheduleEvent event = schedule_events_.top();
+        schedule_events_.pop();
+        
+        auto it = scheduled_content_.find(event.item_id);
+        if (it == scheduled_content_.end() || it->second.generation != event.generation) {
+            continue; // outdated
+        }
+        ScheduleEntry& entry = it->second;
+        
+        switch (event.type) {
+            case EventType::WINDOW_START:
+                if (now > entry.activations.front().second) {
+                    EndActivation(entry);   // already over
+                    break;
+                }
+                SetReady(entry, true);
+                schedule_events_.push({entry.activations.front().second, EventType::WINDOW_END, event.item_id, event.generation});
+                if (!entry.rescore_pending) {
+                    entry.rescore_pending = true;
+                    schedule_events_.push({now + RESCORE_INTERVAL, EventType::RESCORE, event.item_id, event.generation});
+                }
+                break;
+            case EventType::RESCORE:
+                entry.rescore_pending = false;
+                if (!entry.ready) break;
+                SetReady(entry, true);
+                entry.rescore_pending = true;
+                schedule_events_.push({now + RESCORE_INTERVAL, EventType::RESCORE, event.item_id, event.generation});
+                break;
+            case EventType::WINDOW_END:
+                EndActivation(entry);
+                break;
+        }
+    }
+}
+
+std::chrono::system_clock::time_point ContentScheduler::GetNextEvent() const {
+    auto next_event = schedule_events_.empty() ?
+        std::chrono::system_clock::time_point::max() : schedule_events_.top().time;
+    
+    if (emergency_override_ && emergency_content_) {
+        next_event = std::min(next_event, emergency_start_ + emergency_duration_);
+    }
+    return next_event;
+}
+
+std::shared_ptr<ContentItem> ContentScheduler::SelectNextMOTContent() {
+    return SelectReadyContent(ready_mot_);
+}
+
+std::shared_ptr<ContentItem> ContentScheduler::SelectNextDLSContent() {
+    return SelectReadyContent(ready_dls_);
+}
+
+std::shared_ptr<ContentItem> ContentScheduler::SelectReadyContent(const ReadySet& ready) const {
+    // The best scored item, skipping inactive and used up ones
+    for (const auto& key : ready) {
+        const auto& item = scheduled_content_.at(key.second).item;
         if (!item->is_active) continue;
-        if (item->type != ContentType::DLS_MESSAGE && item->type != ContentType::COMBINED) continue;
         if (!ShouldScheduleContent(*item)) continue;
         
-        candidates.push_back(item);
+        return item;
     }
     
-    if (candidates.empty()) return nullptr;
-    
-    // Sort by scheduling score
-    std::sort(candidates.begin(), candidates.end(), 
-             [this](const auto& a, const auto& b) {
-                 return CalculateSchedulingScore(*a) > CalculateSchedulingScore(*b);
-             });
-    
-    return candidates.front();
+    return nullptr;
 }
 
 bool ContentScheduler::ShouldScheduleContent(const ContentItem& item) const {
@@ -175,44 +467,166 @@ double ContentScheduler::CalculateSchedulingScore(const ContentItem& item) const
     return score;
 }
 
-void ContentScheduler::UpdateContentMetrics() {
-    std::lock_guard<std::mutex> lock(schedule_mutex_);
-    
-    // Update current content metrics
-    if (current_mot_content_) {
-        current_mot_content_->metrics.display_count++;
-        current_mot_content_->metrics.last_displayed = std::chrono::system_clock::now();
+void ContentScheduler::UpdateContentMetrics(const std::shared_ptr<ContentItem>& previous,
+                                            const std::shared_ptr<ContentItem>& current,
+                                            std::chrono::system_clock::time_point now) {
+    if (current == previous) return;
+    
+    // Account the display time of the replaced content; the totals only
+    // cover scheduled items (not e.g. emergency content)
+    if (previous) {
+        const auto display_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+            now - previous->metrics.last_displayed);
+        previous->metrics.total_display_time += display_time;
+        if (IsScheduled(previous)) totals_.display_time += display_time;
     }
     
-    if (current_dls_content_) {
-        current_dls_content_->metrics.display_count++;
-        current_dls_content_->metrics.last_displayed = std::chrono::system_clock::now();
+    if (current) {
+        const bool scheduled = IsScheduled(current);
+        if (scheduled) {
+            totals_.recent_displays.erase(std::make_pair(current->metrics.last_displayed, current->item_id));
+            totals_.recent_displays.insert(std::make_pair(now, current->item_id));
+            totals_.display_count++;
+        }
+        current->metrics.display_count++;
+        current->metrics.last_displayed = now;
     }
 }
 
 bool ContentScheduler::AddContent(std::shared_ptr<ContentItem> item) {
     if (!item) return false;
     
-    std::lock_guard<std::mutex> lock(schedule_mutex_);
-    scheduled_content_.push_back(item);
+    {
+        std::lock_guard<std::mutex> lock(schedule_mutex_);
+        ScheduleItem(item, std::chrono::system_clock::now());
+        PublishSnapshot();
+    }
+    schedule_cv_.notify_one();
     
     std::cout << "Content added: " << item->item_id << " (type: " << static_cast<int>(item->type) << ")" << std::endl;
     return true;
 }
 
 bool ContentScheduler::RemoveContent(const std::string& item_id) {
+    {
+        std::lock_guard<std::mutex> lock(schedule_mutex_);
+        if (scheduled_content_.find(item_id) == scheduled_content_.end()) {
+            return false;
+        }
+        UnscheduleItem(item_id);
+        PublishSnapshot();
+    }
+    schedule_cv_.notify_one();
+    
+    std::cout << "Content removed: " << item_id << std::endl;
+    return true;
+}
+
+bool ContentScheduler::UpdateContent(std::shared_ptr<ContentItem> item) {
+    if (!item) return false;
+    
+    {
+        std::lock_guard<std::mutex> lock(schedule_mutex_);
+        if (scheduled_content_.find(item->item_id) == scheduled_content_.end()) {
+            return false;
+        }
+        ScheduleItem(item, std::chrono::system_clock::now());
+        PublishSnapshot();
+    }
+    schedule_cv_.notify_one();
+    return true;
+}
+
+std::shared_ptr<ContentItem> ContentScheduler::GetContent(const std::string& item_id) const {
+    std::lock_guard<std::mutex> lock(schedule_mutex_);
+    
+    auto it = scheduled_content_.find(item_id);
+    return it != scheduled_content_.end() ? it->second.item : nullptr;
+}
+
+std::vector<std::shared_ptr<ContentItem>> ContentScheduler::GetActiveContent() const {
+    return GetSnapshot()->active_content;
+}
+
+std::shared_ptr<const ContentScheduler::ContentSnapshot> ContentScheduler::GetSnapshot() const {
+    return std::atomic_load(&snapshot_);
+}
+
+std::vector<std::shared_ptr<ContentItem>> ContentScheduler::GetScheduledContent(std::chrono::system_clock::time_point time) const {
     std::lock_guard<std::mutex> lock(schedule_mutex_);
     
-    auto it = std::find_if(scheduled_content_.begin(), scheduled_content_.end(),
-                          [&item_id](const auto& item) { return item->item_id == item_id; });
+    std::vector<std::shared_ptr<ContentItem>> scheduled;
+    for (const auto& item_id : activation_index_.Stab(time)) {
+        scheduled.push_back(scheduled_content_.at(item_id).item);
+    }
+    return scheduled;
+}
+
+std::chrono::system_clock::time_point ContentScheduler::GetNextActivation(std::chrono::system_clock::time_point after) const {
+    std::lock_guard<std::mutex> lock(schedule_mutex_);
+    return activation_index_.NextStart(after);
+}
+
+std::vector<ContentScheduler::ContentChange> ContentScheduler::GetChangesSince(uint64_t version) const {
+    std::lock_guard<std::mutex> lock(schedule_mutex_);
     
-    if (it != scheduled_content_.end()) {
-        scheduled_content_.erase(it);
-        std::cout << "Content removed: " << item_id << std::endl;
-        return true;
+    std::vector<ContentChange> changes;
+    for (auto it = change_log_.upper_bound(version); it != change_log_.end(); ++it) {
+        changes.push_back({it->second.first, it->second.second, it->first});
+    }
+    return changes;
+}
+
+void ContentScheduler::ExportStore(ContentStoreWriter& writer) const {
+    std::lock_guard<std::mutex> lock(schedule_mutex_);
+    for (const auto& entry : scheduled_content_) {
+        writer.Add(*entry.second.item);
+    }
+}
+
+void ContentScheduler::ImportStore(const ContentStoreView& store) {
+    {
+        std::lock_guard<std::mutex> lock(schedule_mutex_);
+        const auto now = std::chrono::system_clock::now();
+        for (size_t i = 0; i < store.Size(); i++) {
+            auto item = store.Item(i).ToItem();
+            if (item) {
+                ScheduleItem(item, now);
+            }
+        }
+        PublishSnapshot();
     }
+    schedule_cv_.notify_one();
+}
+
+std::vector<uint8_t> ContentScheduler::ExportContent() const {
+    ContentStoreWriter writer;
+    ExportStore(writer);
+    return writer.Finish();
+}
+
+bool ContentScheduler::ImportContent(const uint8_t* data, size_t len) {
+    ContentStoreView store;
+    if (!store.Open(data, len)) return false;
+    
+    ImportStore(store);
+    return true;
+}
+
+bool ContentScheduler::SaveState(const std::string& path) const {
+    ContentStoreWriter writer;
+    ExportStore(writer);
+    return writer.WriteFile(path);
+}
+
+bool ContentScheduler::LoadState(const std::string& path) {
+    // the store is read in place; only the items are built
+    MappedContentStore store;
+    if (!store.Open(path)) return false;
     
-    return false;
+    ImportStore(store.View());
+    std::cout << "Loaded " << store.View().Size() << " content items from " << path << std::endl;
+    return true;
 }
 
 void ContentScheduler::TriggerEmergency(std::shared_ptr<ContentItem> emergency_item, 
@@ -224,6 +638,11 @@ void ContentScheduler::TriggerEmergency(std::shared_ptr<ContentItem> emergency_i
     emergency_start_ = std::chrono::system_clock::now();
     emergency_duration_ = duration;
     
+    // selected and published at once, not only once the scheduling thread wakes up
+    ProcessScheduledContent();
+    PublishSnapshot();
+    schedule_cv_.notify_one();
+    
     std::cout << "Emergency content activated for " << duration.count() << " seconds" << std::endl;
 }
 
@@ -232,40 +651,39 @@ void ContentScheduler::ClearEmergency() {
     
     emergency_override_ = false;
     emergency_content_.reset();
+    ProcessScheduledContent();
+    PublishSnapshot();
+    schedule_cv_.notify_one();
     
     std::cout << "Emergency content cleared" << std::endl;
 }
 
 std::shared_ptr<ContentItem> ContentScheduler::GetCurrentMOTContent() const {
-    std::lock_guard<std::mutex> lock(schedule_mutex_);
-    return current_mot_content_;
+    return GetSnapshot()->mot_content;
 }
 
 std::shared_ptr<ContentItem> ContentScheduler::GetCurrentDLSContent() const {
-    std::lock_guard<std::mutex> lock(schedule_mutex_);
-    return current_dls_content_;
+    return GetSnapshot()->dls_content;
 }
 
 ContentScheduler::SchedulerStatistics ContentScheduler::GetStatistics() const {
     std::lock_guard<std::mutex> lock(schedule_mutex_);
     
+    // from the running totals, without walking the items
+    const auto now = std::chrono::system_clock::now();
+    auto& recent = totals_.recent_displays;
+    recent.erase(recent.begin(), recent.lower_bound(std::make_pair(now - std::chrono::hours{24}, std::string())));
+    
     SchedulerStatistics stats;
     stats.total_content_items = scheduled_content_.size();
-    stats.last_schedule_update = std::chrono::system_clock::now();
-    
-    for (const auto& item : scheduled_content_) {
-        if (item->is_active) {
-            stats.active_content_items++;
-        }
-        
-        stats.content_type_counts[item->type]++;
-        stats.priority_distribution[item->priority]++;
-        
-        // Check if scheduled today
-        auto now = std::chrono::system_clock::now();
-        if (item->metrics.last_displayed > (now - std::chrono::hours{24})) {
-            stats.scheduled_today++;
-        }
+    stats.active_content_items = totals_.active_items;
+    stats.scheduled_today = recent.size();
+    stats.last_schedule_update = now;
+    stats.content_type_counts = totals_.type_counts;
+    stats.priority_distribution = totals_.priority_counts;
+    if (totals_.display_count > 0) {
+        stats.average_display_duration = std::chrono::duration<double>(totals_.display_time).count() /
+                                         totals_.display_count;
     }
     
     if (emergency_override_) {
@@ -282,6 +700,7 @@ ContentCoordinator::ContentCoordinator(const CoordinatorConfig& config) : config
     APIConfig api_config;
     api_config.port = 8008; // StreamDAB allocated port
     api_service_ = std::make_unique<StreamDABAPIService>(api_config);
+    validator_ = std::make_unique<ContentValidator>();
 }
 
 ContentCoordinator::ContentCoordinator() : ContentCoordinator(CoordinatorConfig{}) {
@@ -322,6 +741,7 @@ void ContentCoordinator::Stop() {
         return; // Not running
     }
     
+    WakeCoordination();
     if (coordination_thread_.joinable()) {
         coordination_thread_.join();
     }
@@ -340,45 +760,87 @@ void ContentCoordinator::CoordinationLoop() {
             BroadcastStatus();
             ValidateContentCompliance();
             
-            std::this_thread::sleep_for(config_.content_sync_interval);
+            // until the next cycle, or until woken (e.g. for an emergency broadcast)
+            std::unique_lock<std::mutex> lock(state_mutex_);
+            coordination_cv_.wait_for(lock, config_.content_sync_interval,
+                                      [this] { return coordination_wake_ || !coordinator_running_; });
+            coordination_wake_ = false;
         } catch (const std::exception& e) {
             std::cerr << "Error in coordination loop: " << e.what() << std::endl;
         }
     }
 }
 
+void ContentCoordinator::WakeCoordination() {
+    {
+        std::lock_guard<std::mutex> lock(state_mutex_);
+        coordination_wake_ = true;
+    }
+    coordination_cv_.notify_one();
+}
+
 void ContentCoordinator::SynchronizeContent() {
-    // Get current content from scheduler
-    auto mot_content = scheduler_->GetCurrentMOTContent();
-    auto dls_content = scheduler_->GetCurrentDLSContent();
-    
-    // Process content through appropriate processors
-    if (mot_content) {
-        ProcessMOTContent(mot_content);
+    // Only what changed since the last cycle: items from the scheduler's
+    // change log, and the current content if it was replaced
+    auto changes = scheduler_->GetChangesSince(synced_version_);
+    if (!changes.empty()) {
+        synced_version_ = changes.back().version;
     }
     
-    if (dls_content) {
-        ProcessDLSContent(dls_content);
-        
-        // Check for Thai content
-        if (dls_content->is_thai_content) {
-            ProcessThaiContent(dls_content);
+    std::vector<std::shared_ptr<ContentItem>> thai_items;
+    for (const auto& change : changes) {
+        if (change.item && change.item->is_thai_content) {
+            thai_items.push_back(change.item);
         }
+        
+        // queued, the content manager is never waited for
+        ContentUtils::NotifyContentManager(config_.content_manager_url,
+                                           change.item ? "content_updated" : "content_removed",
+                                           {{"item_id", change.item_id}, {"version", std::to_string(change.version)}});
     }
     
+    std::vector<std::shared_ptr<ContentItem>> mot_items;
+    // both selections from one snapshot
+    const auto snapshot = scheduler_->GetSnapshot();
+    auto mot_content = snapshot->mot_content;
+    if (mot_content != synced_mot_content_) {
+        synced_mot_content_ = mot_content;
+        if (mot_content) mot_items.push_back(mot_content);
+    }
+    
+    std::vector<std::shared_ptr<ContentItem>> dls_items;
+    auto dls_content = snapshot->dls_content;
+    if (dls_content != synced_dls_content_) {
+        synced_dls_content_ = dls_content;
+        if (dls_content) dls_items.push_back(dls_content);
+    }
+    
+    // Thai text is validated and formatted before it is handed out
+    if (!thai_items.empty()) ProcessThaiContent(thai_items);
+    if (!mot_items.empty()) ProcessMOTContent(mot_items);
+    if (!dls_items.empty()) ProcessDLSContent(dls_items);
+    
     last_sync_ = std::chrono::system_clock::now();
 }
 
-void ContentCoordinator::ProcessMOTContent(std::shared_ptr<ContentItem> item) {
+void ContentCoordinator::ProcessMOTContent(const std::vector<std::shared_ptr<ContentItem>>& items) {
     auto mot_processor = api_service_->GetMOTProcessor();
-    if (mot_processor && !item->image_path.empty()) {
-        mot_processor->AddImage(item->image_path);
+    if (!mot_processor) return;
+    
+    for (const auto& item : items) {
+        if (!item->image_path.empty()) {
+            mot_processor->AddImage(item->image_path);
+        }
     }
 }
 
-void ContentCoordinator::ProcessDLSContent(std::shared_ptr<ContentItem> item) {
+void ContentCoordinator::ProcessDLSContent(const std::vector<std::shared_ptr<ContentItem>>& items) {
     auto dls_processor = api_service_->GetDLSProcessor();
-    if (dls_processor && !item->text_content.empty()) {
+    if (!dls_processor) return;
+    
+    for (const auto& item : items) {
+        if (item->text_content.empty()) continue;
+        
         MessagePriority msg_priority = MessagePriority::NORMAL;
         switch (item->priority) {
             case SchedulePriority::EMERGENCY: msg_priority = MessagePriority::EMERGENCY; break;
@@ -392,9 +854,13 @@ void ContentCoordinator::ProcessDLSContent(std::shared_ptr<ContentItem> item) {
     }
 }
 
-void ContentCoordinator::ProcessThaiContent(std::shared_ptr<ContentItem> item) {
+void ContentCoordinator::ProcessThaiContent(const std::vector<std::shared_ptr<ContentItem>>& items) {
     auto thai_processor = api_service_->GetThaiProcessor();
-    if (thai_processor && !item->text_content.empty()) {
+    if (!thai_processor) return;
+    
+    for (const auto& item : items) {
+        if (item->text_content.empty()) continue;
+        
         // Validate Thai content
         auto validation = thai_processor->ValidateContent(item->text_content);
         item->cultural_validation = validation;
@@ -447,7 +913,20 @@ bool ContentCoordinator::AddContent(const std::string& content_data,
     item->schedule.end_time = item->schedule.start_time + std::chrono::hours{1};
     item->schedule.duration = std::chrono::hours{1};
     
-    return scheduler_->AddContent(item);
+    // scheduled once validated; repeated content reuses its verdict
+    validator_->ValidateContentItemAsync(item, [this, item](const ContentValidator::ValidationResult& result) {
+        if (result.is_valid) {
+            scheduler_->AddContent(item);
+        } else {
+            ContentUtils::SendComplianceReport(config_.compliance_monitor_url, result.violations);
+            std::cerr << "Content " << item->item_id << " rejected";
+            for (const auto& violation : result.violations) {
+                std::cerr << ": " << violation;
+            }
+            std::cerr << std::endl;
+        }
+    });
+    return true;
 }
 
 void ContentCoordinator::TriggerEmergencyBroadcast(const std::string& message, 
@@ -467,8 +946,9 @@ void ContentCoordinator::TriggerEmergencyBroadcast(const std::string& message,
     emergency_item->schedule.end_time = emergency_item->schedule.start_time + duration;
     emergency_item->schedule.duration = std::chrono::duration_cast<std::chrono::minutes>(duration);
     
-    // Trigger emergency in scheduler
+    // Trigger emergency in scheduler, and hand it on without waiting for the next cycle
     scheduler_->TriggerEmergency(emergency_item, duration);
+    WakeCoordination();
     
     // Trigger emergency in API service
     if (api_service_) {
@@ -480,6 +960,7 @@ void ContentCoordinator::TriggerEmergencyBroadcast(const std::string& message,
 
 void ContentCoordinator::ClearEmergencyBroadcast() {
     scheduler_->ClearEmergency();
+    WakeCoordination();
     
     if (api_service_) {
         api_service_->ClearEmergencyMode();
@@ -492,6 +973,7 @@ ContentCoordinator::SystemHealth ContentCoordinator::GetSystemHealth() const {
     SystemHealth health;
     health.last_check = std::chrono::system_clock::now();
     health.overall_healthy = true;
+    health.memory_usage = ResourceSampler::Global().Latest().memory_usage;
     
     // Check scheduler
     health.component_status["scheduler"] = scheduler_ && scheduler_->IsRunning();
@@ -522,6 +1004,7 @@ ContentValidator::ContentValidator(const ValidationRules& rules) : rules_(rules)
     path_validator_ = std::make_unique<SecurePathValidator>();
     security_scanner_ = std::make_unique<ContentSecurityScanner>();
     thai_processor_ = std::make_unique<ThaiLanguageProcessor>();
+    validation_pool_ = std::make_unique<ThreadPool>(std::max(2u, std::thread::hardware_concurrency()));
     
     std::cout << "Content Validator initialized" << std::endl;
 }
@@ -530,14 +1013,78 @@ ContentValidator::ContentValidator() : ContentValidator(ValidationRules{}) {
 }
 
 ContentValidator::ValidationResult ContentValidator::ValidateContentItem(const ContentItem& item) {
+    auto verdict = GetVerdict(std::make_shared<const ContentItem>(item), false);
+    return CompleteVerdict(verdict.get(), item.schedule);
+}
+
+void ContentValidator::ValidateContentItemAsync(std::shared_ptr<const ContentItem> item, ValidationCallback callback) {
+    auto verdict = GetVerdict(item, true);
+    if (verdict.wait_for(std::chrono::seconds{0}) == std::future_status::ready) {
+        callback(CompleteVerdict(verdict.get(), item->schedule));
+        return;
+    }
+    
+    // queued after the content checks, so this only waits while they run
+    validation_pool_->SubmitTask([this, item, verdict, callback]() {
+        callback(CompleteVerdict(verdict.get(), item->schedule));
+    });
+}
+
+std::shared_future<ContentValidator::ValidationResult> ContentValidator::GetVerdict(
+        const std::shared_ptr<const ContentItem>& item, bool async) {
+    const std::string digest = ContentDigest(*item);
+    auto promise = std::make_shared<std::promise<ValidationResult>>();
+    std::shared_future<ValidationResult> verdict;
+    {
+        std::lock_guard<std::mutex> lock(verdict_mutex_);
+        auto it = verdicts_.find(digest);
+        if (it != verdicts_.end()) {
+            return it->second;
+        }
+        
+        verdict = promise->get_future().share();
+        verdicts_.emplace(digest, verdict);
+        verdict_order_.push_back(digest);
+        if (verdict_order_.size() > MAX_VERDICTS) {
+            verdicts_.erase(verdict_order_.front());
+            verdict_order_.pop_front();
+        }
+    }
+    
+    auto check = [this, item, promise, digest]() {
+        try {
+            promise->set_value(ValidateContent(*item));
+        } catch (...) {
+            // not cached; the next validation tries again
+            {
+                std::lock_guard<std::mutex> lock(verdict_mutex_);
+                verdicts_.erase(digest);
+            }
+            promise->set_exception(std::current_exception());
+        }
+    };
+    
+    if (async) {
+        validation_pool_->SubmitTask(check);
+    } else {
+        check();
+    }
+    return verdict;
+}
+
+ContentValidator::ValidationResult ContentValidator::ValidateContent(const ContentItem& item) {
     ValidationResult result;
     result.compliance_score = 1.0;
     
     // Validate text content
     if (!item.text_content.empty()) {
         auto text_validation = ValidateText(item.text_content, item.is_thai_content);
-        if (!text_validation.is_valid) {
-            result.is_valid = false;
+        result.cultural_result = text_validation.cultural_result;
+        result.security_result = text_validation.security_result;
+        result.warnings.insert(result.warnings.end(), 
+                              text_validation.warnings.begin(), 
+                              text_validation.warnings.end());
+        if (!text_validation.is_valid || !text_validation.is_safe) {
             result.violations.insert(result.violations.end(), 
                                    text_validation.violations.begin(), 
                                    text_validation.violations.end());
@@ -546,32 +1093,93 @@ ContentValidator::ValidationResult ContentValidator::ValidateContentItem(const C
     
     // Validate image content
     if (!item.binary_data.empty()) {
-        auto image_validation = ValidateImage(item.binary_data, "image/jpeg");
+        auto image_validation = ValidateImage(item.binary_data.ToVector(), "");
+        if (!image_validation.security_result.is_safe) {
+            result.security_result = image_validation.security_result;
+        }
         if (!image_validation.is_valid) {
-            result.is_valid = false;
             result.violations.insert(result.violations.end(), 
                                    image_validation.violations.begin(), 
                                    image_validation.violations.end());
         }
     }
     
+    // ETSI compliance check
+    auto etsi_violations = CheckETSIViolations(item);
+    if (!etsi_violations.empty()) {
+        result.compliance_score *= 0.5;
+        result.warnings.push_back("ETSI compliance issues detected");
+        result.warnings.insert(result.warnings.end(), etsi_violations.begin(), etsi_violations.end());
+    }
+    
+    result.is_valid = result.violations.empty();
+    result.is_safe = result.is_valid && result.security_result.is_safe;
+    
+    return result;
+}
+
+ContentValidator::ValidationResult ContentValidator::CompleteVerdict(ValidationResult result, const ScheduleWindow& schedule) {
     // Validate scheduling
-    auto schedule_validation = ValidateScheduling(item.schedule);
+    auto schedule_validation = ValidateScheduling(schedule);
     if (!schedule_validation.is_valid) {
         result.warnings.insert(result.warnings.end(), 
                               schedule_validation.warnings.begin(), 
                               schedule_validation.warnings.end());
     }
     
-    // ETSI compliance check
-    if (!ValidateETSICompliance(item)) {
-        result.compliance_score *= 0.5;
-        result.warnings.push_back("ETSI compliance issues detected");
+    return result;
+}
+
+std::string ContentValidator::ContentDigest(const ContentItem& item) {
+    Hasher hasher;
+    const uint8_t flags[] = {static_cast<uint8_t>(item.type), item.is_thai_content};
+    hasher.UpdateField(flags, sizeof(flags));
+    hasher.UpdateField(item.text_content.data(), item.text_content.size());
+    hasher.UpdateField(item.image_path.data(), item.image_path.size());
+    hasher.UpdateField(item.binary_data.data(), item.binary_data.size());
+    return hasher.Final();
+}
+
+ContentValidator::ValidationResult ContentValidator::ValidateImage(const std::vector<uint8_t>& image_data, const std::string& format) {
+    ValidationResult result;
+    result.is_valid = true;
+    
+    if (image_data.size() > rules_.max_image_size) {
+        result.violations.push_back("Image exceeds maximum size");
     }
     
-    result.is_valid = result.violations.empty();
-    result.is_safe = result.is_valid && result.security_result.is_safe;
+    // the given format, or else the detected one
+    const ContentSecurityScanner& scanner = *security_scanner_;
+    const std::vector<std::tuple<std::string, std::string, bool (ContentSecurityScanner::*)(const std::vector<uint8_t>&) const>> formats = {
+        {"JPEG", "image/jpeg", &ContentSecurityScanner::ValidateJPEG},
+        {"PNG", "image/png", &ContentSecurityScanner::ValidatePNG},
+        {"WebP", "image/webp", &ContentSecurityScanner::ValidateWebP},
+        {"HEIF", "image/heif", &ContentSecurityScanner::ValidateHEIF}
+    };
+    std::string mime_type;
+    std::string name;
+    for (const auto& f : formats) {
+        bool matches = format.empty() ? (scanner.*std::get<2>(f))(image_data)
+                                      : (format == std::get<0>(f) || format == std::get<1>(f));
+        if (matches) {
+            name = std::get<0>(f);
+            mime_type = std::get<1>(f);
+            break;
+        }
+    }
     
+    if (mime_type.empty() || std::find(rules_.allowed_image_formats.begin(), rules_.allowed_image_formats.end(), name) ==
+                                 rules_.allowed_image_formats.end()) {
+        result.violations.push_back("Image format not allowed");
+    } else {
+        result.security_result = security_scanner_->ScanContent(image_data, mime_type);
+        if (!result.security_result.is_safe) {
+            result.violations.push_back("Security threats detected in image");
+        }
+    }
+    
+    result.is_valid = result.violations.empty();
+    result.is_safe = result.security_result.is_safe;
     return result;
 }
 
@@ -606,24 +1214,53 @@ ContentValidator::ValidationResult ContentValidator::ValidateText(const std::str
     return result;
 }
 
+ContentValidator::ValidationResult ContentValidator::ValidateScheduling(const ScheduleWindow& schedule) {
+    ValidationResult result;
+    
+    if (schedule.end_time < schedule.start_time) {
+        result.warnings.push_back("Schedule ends before it starts");
+    }
+    if ((schedule.repeat_daily || schedule.repeat_weekly) && schedule.duration.count() <= 0) {
+        result.warnings.push_back("Repeating schedule without duration");
+    }
+    for (int day : schedule.days_of_week) {
+        if (day < 0 || day > 6) {
+            result.warnings.push_back("Invalid day of week in schedule");
+            break;
+        }
+    }
+    
+    result.is_valid = result.warnings.empty();
+    return result;
+}
+
 bool ContentValidator::ValidateETSICompliance(const ContentItem& item) {
-    // Basic ETSI compliance checks
+    return CheckETSIViolations(item).empty();
+}
+
+std::vector<std::string> ContentValidator::CheckETSIViolations(const ContentItem& item) {
+    std::vector<std::string> violations;
     
     // Text content compliance
-    if (!item.text_content.empty()) {
-        if (item.text_content.length() > 128) {
-            return false; // DLS text too long
-        }
+    if (item.text_content.length() > 128) {
+        violations.push_back("DLS text too long");
     }
     
     // Image content compliance
-    if (!item.binary_data.empty()) {
-        if (item.binary_data.size() > 50 * 1024) {
-            return false; // Image too large for MOT
-        }
+    if (item.binary_data.size() > 50 * 1024) {
+        violations.push_back("Image too large for MOT");
     }
     
-    return true;
+    return violations;
+}
+
+void ContentValidator::UpdateValidationRules(const ValidationRules& new_rules) {
+    std::lock_guard<std::mutex> lock(verdict_mutex_);
+    rules_ = new_rules;
+    
+    // the cached verdicts were reached under the previous rules
+    verdicts_.clear();
+    verdict_order_.clear();
 }
 
 // ContentUtils implementation
@@ -662,6 +1299,36 @@ std::shared_ptr<ContentItem> CreateEmergencyContent(const std::string& message)
     return item;
 }
 
+// A local broken-down time, with DST left to mktime()
+static std::chrono::system_clock::time_point LocalTime(std::tm tm) {
+    tm.tm_isdst = -1;
+    return std::chrono::system_clock::from_time_t(std::mktime(&tm));
+}
+
+ScheduleWindow CreateDailySchedule(int hour, int minute, int duration_minutes) {
+    std::time_t now = std::time(nullptr);
+    std::tm today;
+    localtime_r(&now, &today);
+    today.tm_hour = hour;
+    today.tm_min = minute;
+    today.tm_sec = 0;
+    
+    ScheduleWindow schedule;
+    schedule.start_time = LocalTime(today);
+    schedule.end_time = std::chrono::system_clock::time_point::max();
+    schedule.repeat_daily = true;
+    schedule.duration = std::chrono::minutes{duration_minutes};
+    return schedule;
+}
+
+ScheduleWindow CreateWeeklySchedule(const std::vector<int>& days, int hour, int minute, int duration_minutes) {
+    ScheduleWindow schedule = CreateDailySchedule(hour, minute, duration_minutes);
+    schedule.repeat_daily = false;
+    schedule.repeat_weekly = true;
+    schedule.days_of_week = days;
+    return schedule;
+}
+
 ScheduleWindow CreateImmediateSchedule(std::chrono::seconds duration) {
     ScheduleWindow schedule;
     schedule.start_time = std::chrono::system_clock::now();
@@ -670,6 +1337,80 @@ ScheduleWindow CreateImmediateSchedule(std::chrono::seconds duration) {
     return schedule;
 }
 
+std::vector<Activation> GetActivations(const ScheduleWindow& schedule,
+                                       std::chrono::system_clock::time_point from, size_t count) {
+    std::vector<Activation> activations;
+    if (count == 0 || schedule.end_time < schedule.start_time) return activations;
+    
+    if ((!schedule.repeat_daily && !schedule.repeat_weekly) || schedule.duration.count() <= 0) {
+        if (schedule.end_time > from) {
+            activations.emplace_back(schedule.start_time, schedule.end_time);
+        }
+        return activations;
+    }
+    
+    // Occurrences are offset from the start time by whole local days, which
+    // keeps its time of day (and its fraction of a second) across DST changes
+    std::time_t start_t = std::chrono::system_clock::to_time_t(schedule.start_time);
+    std::tm start_tm;
+    localtime_r(&start_t, &start_tm);
+    const auto start_local = LocalTime(start_tm);
+    
+    std::vector<int> days = schedule.days_of_week;
+    if (schedule.repeat_weekly && days.empty()) {
+        days.push_back(start_tm.tm_wday);
+    }
+    
+    // Begin on the day before the first one that can end after from
+    std::tm day = start_tm;
+    if (from - schedule.duration > schedule.start_time) {
+        std::time_t first_t = std::chrono::system_clock::to_time_t(from - schedule.duration);
+        std::tm first_tm;
+        localtime_r(&first_t, &first_tm);
+        day.tm_year = first_tm.tm_year;
+        day.tm_mon = first_tm.tm_mon;
+        day.tm_mday = first_tm.tm_mday - 1;
+    }
+    
+    // a week of days without an occurrence means there is none
+    for (size_t idle_days = 0; activations.size() < count && idle_days < 8; day.tm_mday++) {
+        std::tm occurrence_tm = day;
+        auto occurrence = schedule.start_time + (LocalTime(occurrence_tm) - start_local);
+        std::mktime(&occurrence_tm);    // normalizes the date, for tm_wday
+        idle_days++;
+        
+        if (occurrence > schedule.end_time) break;
+        if (occurrence < schedule.start_time) continue;
+        if (schedule.repeat_weekly &&
+            std::find(days.begin(), days.end(), occurrence_tm.tm_wday) == days.end()) {
+            continue;
+        }
+        
+        auto end = occurrence + schedule.duration;
+        if (end > schedule.end_time || end < occurrence) {
+            end = schedule.end_time;
+        }
+        if (end > from) {
+            activations.emplace_back(occurrence, end);
+        }
+        idle_days = 0;
+    }
+    
+    return activations;
+}
+
+std::vector<uint8_t> SerializeContentItem(const ContentItem& item) {
+    ContentStoreWriter writer;
+    writer.Add(item);
+    return writer.Finish();
+}
+
+std::shared_ptr<ContentItem> DeserializeContentItem(const std::vector<uint8_t>& data) {
+    ContentStoreView store;
+    if (!store.Open(data.data(), data.size()) || store.Size() != 1) return nullptr;
+    return store.Item(0).ToItem();
+}
+
 bool IsThaiContent(const std::string& text) {
     return text.find_first_of("กขคฆงจฉชซฌญฎฏฐฑฒณดตถทธนบปผฝพฟภมยรลวศษสหฬอฮ") != std::string::npos;
 }
@@ -682,6 +1423,60 @@ std::string ExtractContentHash(const ContentItem& item) {
     return std::to_string(std::hash<std::string>{}(content_str));
 }
 
+static std::string JSONString(const std::string& str) {
+    std::string json = "\"";
+    for (unsigned char c : str) {
+        switch (c) {
+            case '"': json += "\\\""; break;
+            case '\\': json += "\\\\"; break;
+            case '\n': json += "\\n"; break;
+            case '\r': json += "\\r"; break;
+            case '\t': json += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char escape[8];
+                    snprintf(escape, sizeof(escape), "\\u%04x", c);
+                    json += escape;
+                } else {
+                    json += c;
+                }
+        }
+    }
+    return json + "\"";
+}
+
+// One for all callers, so that their events to the same URL share batches
+static EventNotifier& Notifier() {
+    static EventNotifier notifier;
+    return notifier;
+}
+
+bool NotifyContentManager(const std::string& manager_url, const std::string& event, const std::map<std::string, std::string>& data) {
+    if (manager_url.empty()) return false;
+    
+    std::string json = "{\"event\":" + JSONString(event) +
+                       ",\"timestamp\":" + std::to_string(std::time(nullptr)) + ",\"data\":{";
+    for (const auto& field : data) {
+        if (json.back() != '{') json += ',';
+        json += JSONString(field.first) + ":" + JSONString(field.second);
+    }
+    json += "}}";
+    return Notifier().Post(manager_url, std::move(json));
+}
+
+bool SendComplianceReport(const std::string& monitor_url, const std::vector<std::string>& violations) {
+    if (monitor_url.empty()) return false;
+    
+    std::string json = "{\"event\":\"compliance_report\",\"timestamp\":" + std::to_string(std::time(nullptr)) +
+                       ",\"violations\":[";
+    for (const auto& violation : violations) {
+        if (json.back() != '[') json += ',';
+        json += JSONString(violation);
+    }
+    json += "]}";
+    return Notifier().Post(monitor_url, std::move(json));
+}
+
 } // namespace ContentUtils
 
 } // namespace StreamDAB
\ No newline at end of file
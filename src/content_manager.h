@@ -25,10 +25,21 @@
 #include <atomic>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <future>
+#include <initializer_list>
+#include <queue>
+#include <set>
+#include <unordered_map>
 
 namespace StreamDAB {
 
+class ContentStoreView;
+class ContentStoreWriter;
+class ContentValidator;
+
 // Content scheduling priority
 enum class SchedulePriority {
     EMERGENCY = 0,      // Immediate override
@@ -63,6 +74,34 @@ struct ScheduleWindow {
     int current_repeats = 0;
 };
 
+// Binary data of a content item: a handle to an immutable blob of
+// SlideBlobStore::Global(), so that the same data is held once, however many
+// items, images and MOT objects refer to it. Copying the handle (or the item)
+// does not copy the data; assigning new data interns it.
+class ContentData {
+public:
+    ContentData() = default;
+    ContentData(const uint8_t* data, size_t len);
+    ContentData(const std::vector<uint8_t>& data) : ContentData(data.data(), data.size()) {}
+    ContentData(std::initializer_list<uint8_t> data) : ContentData(data.begin(), data.size()) {}
+    explicit ContentData(const slide_blob_t& blob);
+    
+    const uint8_t* data() const { return blob_ ? blob_->Data() : nullptr; }
+    size_t size() const { return blob_ ? blob_->Size() : 0; }
+    bool empty() const { return size() == 0; }
+    const uint8_t* begin() const { return data(); }
+    const uint8_t* end() const { return data() + size(); }
+    std::vector<uint8_t> ToVector() const { return std::vector<uint8_t>(begin(), end()); }
+    // the blob, e.g. to be sent without copying; NULL if empty
+    const slide_blob_t& Blob() const { return blob_; }
+    
+    bool operator==(const ContentData& other) const;
+    bool operator!=(const ContentData& other) const { return !(*this == other); }
+    
+private:
+    slide_blob_t blob_;
+};
+
 // Content item for scheduling
 struct ContentItem {
     std::string item_id;
@@ -73,7 +112,7 @@ struct ContentItem {
     // Content data
     std::string text_content;
     std::string image_path;
-    std::vector<uint8_t> binary_data;
+    ContentData binary_data;
     std::map<std::string, std::string> metadata;
     
     // Thai language support
@@ -105,11 +144,115 @@ struct ContentItem {
     std::string content_hash;
 };
 
+namespace ContentUtils {
+    // The start and (inclusive) end of an active period of a schedule window
+    typedef std::pair<std::chrono::system_clock::time_point, std::chrono::system_clock::time_point> Activation;
+}
+
+// Activation intervals of scheduled items, for "which items are active at
+// time t" and "when does the next item activate" queries. The intervals are
+// kept in an array sorted by start, over which an implicit balanced tree
+// holds the latest end of each subtree; both are brought up to date by the
+// first query after a change.
+class ScheduleIntervalIndex {
+public:
+    struct Interval {
+        std::chrono::system_clock::time_point start;
+        std::chrono::system_clock::time_point end;     // inclusive
+        std::string item_id;
+    };
+    
+    void Insert(Interval interval);
+    void Remove(const std::string& item_id, std::chrono::system_clock::time_point start);
+    void RemoveItem(const std::string& item_id);
+    void Clear();
+    size_t Size() const { return intervals_.size(); }
+    
+    // IDs of the items with an interval containing t, each once
+    std::vector<std::string> Stab(std::chrono::system_clock::time_point t) const;
+    // The earliest start after t; time_point::max(), if there is none
+    std::chrono::system_clock::time_point NextStart(std::chrono::system_clock::time_point t) const;
+    
+private:
+    mutable std::vector<Interval> intervals_;
+    mutable std::vector<std::chrono::system_clock::time_point> max_end_;   // of the subtree rooted at each index
+    mutable bool sorted_ = true;
+    mutable bool augmented_ = true;
+    
+    void Update() const;
+    std::chrono::system_clock::time_point Augment(size_t lo, size_t hi) const;
+    void Stab(size_t lo, size_t hi, std::chrono::system_clock::time_point t, std::vector<std::string>& ids) const;
+};
+
 // Content scheduling engine
+//
+// Items enter the ready sets of their channels (MOT and/or DLS) when one of
+// their activations starts, and leave them when it ends; both are events in a
+// timer heap. The next COMPILE_AHEAD activations of each item are compiled
+// from its schedule window in advance (and again once they are used up), and
+// are kept in an interval index for queries. A ready set is ordered by scheduling score, so the next content
+// is found at its front; scores are refreshed every RESCORE_INTERVAL. The
+// scheduling thread sleeps until the next event, or until the content changes.
+// Changes to an item take effect when it is passed to UpdateContent().
+// The active items and the current selections are published as an immutable
+// snapshot, which readers take without the scheduler lock.
 class ContentScheduler {
+public:
+    // Published state; replaced as a whole whenever it changes, never modified
+    struct ContentSnapshot {
+        std::vector<std::shared_ptr<ContentItem>> active_content;
+        std::shared_ptr<ContentItem> mot_content;
+        std::shared_ptr<ContentItem> dls_content;
+        uint64_t version = 0;
+    };
+    
 private:
-    std::vector<std::shared_ptr<ContentItem>> scheduled_content_;
+    enum class EventType { WINDOW_START, RESCORE, WINDOW_END };
+    
+    struct ScheduleEvent {
+        std::chrono::system_clock::time_point time;
+        EventType type;
+        std::string item_id;
+        uint64_t generation;    // events of a replaced item are outdated
+        
+        bool operator>(const ScheduleEvent& other) const { return time > other.time; }
+    };
+    
+    struct ScheduleEntry {
+        std::shared_ptr<ContentItem> item;
+        uint64_t generation = 0;
+        std::deque<ContentUtils::Activation> activations;  // the current/next one first
+        bool ready = false;
+        bool rescore_pending = false;
+        double score = 0.0;
+    };
+    
+    // (score, item ID), best score first
+    typedef std::pair<double, std::string> ReadyKey;
+    struct ReadyOrder {
+        bool operator()(const ReadyKey& a, const ReadyKey& b) const {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        }
+    };
+    typedef std::set<ReadyKey, ReadyOrder> ReadySet;
+    
+    static const std::chrono::seconds RESCORE_INTERVAL;
+    static const size_t COMPILE_AHEAD = 8;
+    
+    std::unordered_map<std::string, ScheduleEntry> scheduled_content_;
+    ScheduleIntervalIndex activation_index_;
+    
+    // Change log: each changed item once, at the version of its latest change
+    uint64_t content_version_ = 0;
+    std::map<uint64_t, std::pair<std::string, std::shared_ptr<ContentItem>>> change_log_;
+    std::unordered_map<std::string, uint64_t> change_versions_;
+    std::priority_queue<ScheduleEvent, std::vector<ScheduleEvent>, std::greater<ScheduleEvent>> schedule_events_;
+    ReadySet ready_mot_;
+    ReadySet ready_dls_;
+    uint64_t next_generation_ = 0;
+    
     mutable std::mutex schedule_mutex_;
+    std::condition_variable schedule_cv_;
     std::atomic<bool> scheduler_running_{false};
     std::thread scheduler_thread_;
     
@@ -117,6 +260,22 @@ private:
     std::shared_ptr<ContentItem> current_mot_content_;
     std::shared_ptr<ContentItem> current_dls_content_;
     
+    // Written under schedule_mutex_, read with std::atomic_load only
+    std::shared_ptr<const ContentSnapshot> snapshot_;
+    bool active_changed_ = false;
+    
+    // Running totals of the scheduled items, for GetStatistics()
+    struct StatisticsTotals {
+        size_t active_items = 0;
+        std::map<ContentType, size_t> type_counts;
+        std::map<SchedulePriority, size_t> priority_counts;
+        std::chrono::milliseconds display_time{0};
+        size_t display_count = 0;
+        // (last display, item ID); entries older than a day are dropped when read
+        std::set<std::pair<std::chrono::system_clock::time_point, std::string>> recent_displays;
+    };
+    mutable StatisticsTotals totals_;
+    
     // Emergency override
     std::atomic<bool> emergency_override_{false};
     std::shared_ptr<ContentItem> emergency_content_;
@@ -126,12 +285,31 @@ private:
     // Scheduling algorithms
     std::shared_ptr<ContentItem> SelectNextMOTContent();
     std::shared_ptr<ContentItem> SelectNextDLSContent();
+    std::shared_ptr<ContentItem> SelectReadyContent(const ReadySet& ready) const;
     bool ShouldScheduleContent(const ContentItem& item) const;
     double CalculateSchedulingScore(const ContentItem& item) const;
     
+    // Timer heap and ready sets; schedule_mutex_ must be held
+    void ScheduleItem(std::shared_ptr<ContentItem> item, std::chrono::system_clock::time_point now);
+    void UnscheduleItem(const std::string& item_id);
+    void CompileActivations(ScheduleEntry& entry, std::chrono::system_clock::time_point from);
+    void EndActivation(ScheduleEntry& entry);
+    
+    void RecordChange(const std::string& item_id, std::shared_ptr<ContentItem> item);
+    void UpdateTotals(const ContentItem& item, bool add);
+    bool IsScheduled(const std::shared_ptr<ContentItem>& item) const;
+    void ExportStore(ContentStoreWriter& writer) const;
+    void ImportStore(const ContentStoreView& store);
+    void SetReady(ScheduleEntry& entry, bool ready);
+    void PublishSnapshot();
+    void ProcessDueEvents(std::chrono::system_clock::time_point now);
+    std::chrono::system_clock::time_point GetNextEvent() const;
+    
     void SchedulingLoop();
     void ProcessScheduledContent();
-    void UpdateContentMetrics();
+    void UpdateContentMetrics(const std::shared_ptr<ContentItem>& previous,
+                              const std::shared_ptr<ContentItem>& current,
+                              std::chrono::system_clock::time_point now);
     
 public:
     ContentScheduler();
@@ -148,6 +326,28 @@ public:
     bool UpdateContent(std::shared_ptr<ContentItem> item);
     std::shared_ptr<ContentItem> GetContent(const std::string& item_id) const;
     std::vector<std::shared_ptr<ContentItem>> GetActiveContent() const;
+    // The latest snapshot, without copying the item list
+    std::shared_ptr<const ContentSnapshot> GetSnapshot() const;
+    
+    // Schedule queries, within the compiled activations
+    std::vector<std::shared_ptr<ContentItem>> GetScheduledContent(std::chrono::system_clock::time_point time) const;
+    std::chrono::system_clock::time_point GetNextActivation(std::chrono::system_clock::time_point after) const;
+    
+    // Items added, updated or removed (then without item) after a version,
+    // by version; repeated changes of an item are coalesced into the latest
+    struct ContentChange {
+        std::string item_id;
+        std::shared_ptr<ContentItem> item;
+        uint64_t version;
+    };
+    std::vector<ContentChange> GetChangesSince(uint64_t version) const;
+    
+    // Content as a binary store (see content_store.h), for persistence and
+    // for other coordinators; importing adds or replaces items
+    std::vector<uint8_t> ExportContent() const;
+    bool ImportContent(const uint8_t* data, size_t len);
+    bool SaveState(const std::string& path) const;
+    bool LoadState(const std::string& path);
     
     // Emergency override
     void TriggerEmergency(std::shared_ptr<ContentItem> emergency_item, 
@@ -168,7 +368,7 @@ public:
         std::chrono::system_clock::time_point last_schedule_update;
         std::map<ContentType, size_t> content_type_counts;
         std::map<SchedulePriority, size_t> priority_distribution;
-        double average_display_duration = 0.0;
+        double average_display_duration = 0.0;    // seconds
     };
     SchedulerStatistics GetStatistics() const;
 };
@@ -182,6 +382,7 @@ private:
     std::unique_ptr<ThaiLanguageProcessor> thai_processor_;
     std::unique_ptr<ContentScheduler> scheduler_;
     std::unique_ptr<StreamDABAPIService> api_service_;
+    std::unique_ptr<ContentValidator> validator_;   // last, as its threads use the others
     
     // Configuration
     struct CoordinatorConfig {
@@ -199,22 +400,28 @@ private:
     std::atomic<bool> coordinator_running_{false};
     std::thread coordination_thread_;
     std::mutex state_mutex_;
+    std::condition_variable coordination_cv_;
+    bool coordination_wake_ = false;    // under state_mutex_
     
     // Content synchronization
     std::chrono::system_clock::time_point last_sync_;
+    uint64_t synced_version_ = 0;
+    std::shared_ptr<ContentItem> synced_mot_content_;
+    std::shared_ptr<ContentItem> synced_dls_content_;
     std::map<std::string, std::chrono::system_clock::time_point> component_status_;
     
     // Inter-component communication
     void CoordinationLoop();
+    void WakeCoordination();
     void SynchronizeContent();
     void BroadcastStatus();
     void HandleEmergencyAlert(const std::string& alert_data);
     void ValidateContentCompliance();
     
-    // Component integration
-    void ProcessMOTContent(std::shared_ptr<ContentItem> item);
-    void ProcessDLSContent(std::shared_ptr<ContentItem> item);
-    void ProcessThaiContent(std::shared_ptr<ContentItem> item);
+    // Component integration, a batch of items per component
+    void ProcessMOTContent(const std::vector<std::shared_ptr<ContentItem>>& items);
+    void ProcessDLSContent(const std::vector<std::shared_ptr<ContentItem>>& items);
+    void ProcessThaiContent(const std::vector<std::shared_ptr<ContentItem>>& items);
     
 public:
     explicit ContentCoordinator(const CoordinatorConfig& config);
@@ -322,9 +529,29 @@ public:
     bool ValidateThaiCompliance(const ContentItem& item);
     bool ValidateNBTCCompliance(const ContentItem& item);
     
+    // Validates on the validation threads. The content checks are cached by
+    // content hash, so validating the same content again only checks its
+    // schedule, and the callback is then called at once.
+    typedef std::function<void(const ValidationResult& result)> ValidationCallback;
+    void ValidateContentItemAsync(std::shared_ptr<const ContentItem> item, ValidationCallback callback);
+    
     // Configuration
     void UpdateValidationRules(const ValidationRules& new_rules);
     ValidationRules GetValidationRules() const { return rules_; }
+    
+private:
+    static const size_t MAX_VERDICTS = 4096;
+    
+    std::unique_ptr<ThreadPool> validation_pool_;
+    std::mutex verdict_mutex_;
+    std::unordered_map<std::string, std::shared_future<ValidationResult>> verdicts_;
+    std::deque<std::string> verdict_order_;     // oldest first, for eviction
+    
+    // The checks of an item's content (text, image, ETSI compliance)
+    ValidationResult ValidateContent(const ContentItem& item);
+    std::shared_future<ValidationResult> GetVerdict(const std::shared_ptr<const ContentItem>& item, bool async);
+    ValidationResult CompleteVerdict(ValidationResult result, const ScheduleWindow& schedule);
+    static std::string ContentDigest(const ContentItem& item);
 };
 
 // Integration utilities
@@ -339,6 +566,14 @@ namespace ContentUtils {
     ScheduleWindow CreateWeeklySchedule(const std::vector<int>& days, int hour, int minute, int duration_minutes);
     ScheduleWindow CreateImmediateSchedule(std::chrono::seconds duration);
     
+    // The next activations of a schedule that end after from, at most count.
+    // A repeating window is active for its duration at the (local) time of day
+    // of its start time: daily, or on its days of the week (default: the day
+    // of its start time), until its end time. Other windows are active from
+    // their start until their end time.
+    std::vector<Activation> GetActivations(const ScheduleWindow& schedule,
+                                           std::chrono::system_clock::time_point from, size_t count);
+    
     // Content analysis
     ContentType DetectContentType(const std::vector<uint8_t>& data);
     bool IsThaiContent(const std::string& text);
@@ -354,7 +589,9 @@ namespace ContentUtils {
     void OptimizeImageForBroadcast(std::vector<uint8_t>& image_data);
     void OptimizeTextForDLS(std::string& text, size_t max_length = 128);
     
-    // Integration helpers
+    // Integration helpers; these queue the event and return at once. Events
+    // to the same URL are delivered in batches, as JSON arrays (EventNotifier).
+    // false, if the event cannot be queued.
     bool NotifyContentManager(const std::string& manager_url, const std::string& event, const std::map<std::string, std::string>& data);
     bool SendComplianceReport(const std::string& monitor_url, const std::vector<std::string>& violations);
 }
@@ -0,0 +1,445 @@
+/*
+    StreamDAB Content Store Implementation
+    Copyright (C) 2024 StreamDAB Project
+*/
+
+#include "content_store.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace StreamDAB {
+
+const char ContentStoreView::MAGIC[8] = {'S', 'D', 'A', 'B', 'C', 'N', 'T', 'S'};
+const uint32_t ContentStoreView::FORMAT_VERSION = 1;
+
+// Little-endian integers, independent of the host's byte order and alignment
+template<typename T> static T ReadLE(const uint8_t* p) {
+    typedef typename std::make_unsigned<T>::type U;
+    U value = 0;
+    for (size_t i = 0; i < sizeof(T); i++) {
+        value |= static_cast<U>(p[i]) << (8 * i);
+    }
+    return static_cast<T>(value);
+}
+
+template<typename T> static void WriteLE(uint8_t* p, T value) {
+    typedef typename std::make_unsigned<T>::type U;
+    U v = static_cast<U>(value);
+    for (size_t i = 0; i < sizeof(T); i++) {
+        p[i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+}
+
+static double ReadDouble(const uint8_t* p) {
+    uint64_t bits = ReadLE<uint64_t>(p);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void WriteDouble(uint8_t* p, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    WriteLE<uint64_t>(p, bits);
+}
+
+// The extreme time points (open schedule windows) map to the extreme values
+static int64_t EncodeTime(std::chrono::system_clock::time_point time) {
+    if (time == std::chrono::system_clock::time_point::max()) return std::numeric_limits<int64_t>::max();
+    if (time == std::chrono::system_clock::time_point::min()) return std::numeric_limits<int64_t>::min();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+static std::chrono::system_clock::time_point DecodeTime(int64_t ns) {
+    if (ns == std::numeric_limits<int64_t>::max()) return std::chrono::system_clock::time_point::max();
+    if (ns == std::numeric_limits<int64_t>::min()) return std::chrono::system_clock::time_point::min();
+    return std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds{ns}));
+}
+
+// ContentItemView implementation
+ContentItemView::ContentItemView(const uint8_t* store, size_t store_len, size_t offset)
+    : store_(store), store_len_(store_len) {
+    if (offset > store_len || store_len - offset < 4) return;
+
+    size_t size = ReadLE<uint32_t>(store + offset);
+    if (size < F_ITEM_ID + 8 || size > store_len - offset) return;
+
+    record_ = store + offset;
+    record_size_ = size;
+}
+
+template<typename T> T ContentItemView::Get(Field field) const {
+    if (!record_ || field + sizeof(T) > record_size_) return T();
+    return ReadLE<T>(record_ + field);
+}
+
+std::chrono::system_clock::time_point ContentItemView::Time(Field field) const {
+    if (!record_ || field + 8 > record_size_) return std::chrono::system_clock::time_point();
+    return DecodeTime(ReadLE<int64_t>(record_ + field));
+}
+
+std::string_view ContentItemView::StringAt(const uint8_t* reference) const {
+    uint32_t offset = ReadLE<uint32_t>(reference);
+    uint32_t len = ReadLE<uint32_t>(reference + 4);
+    if (offset > store_len_ || len > store_len_ - offset) return std::string_view();
+    return std::string_view(reinterpret_cast<const char*>(store_ + offset), len);
+}
+
+std::string_view ContentItemView::String(Field field) const {
+    if (!record_ || field + 8 > record_size_) return std::string_view();
+    return StringAt(record_ + field);
+}
+
+const uint8_t* ContentItemView::Array(Field field, size_t element_size, size_t& count) const {
+    count = 0;
+    if (!record_ || field + 8 > record_size_) return nullptr;
+
+    uint32_t offset = ReadLE<uint32_t>(record_ + field);
+    uint32_t n = ReadLE<uint32_t>(record_ + field + 4);
+    if (offset > store_len_ || n > (store_len_ - offset) / element_size) return nullptr;
+
+    count = n;
+    return store_ + offset;
+}
+
+std::vector<std::string> ContentItemView::Strings(Field field) const {
+    size_t count;
+    const uint8_t* references = Array(field, 8, count);
+
+    std::vector<std::string> strings;
+    strings.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        strings.emplace_back(StringAt(references + 8 * i));
+    }
+    return strings;
+}
+
+size_t ContentItemView::MetadataCount() const {
+    size_t count;
+    Array(F_METADATA, 16, count);
+    return count;
+}
+
+std::pair<std::string_view, std::string_view> ContentItemView::Metadata(size_t index) const {
+    size_t count;
+    const uint8_t* entries = Array(F_METADATA, 16, count);
+    if (index >= count) return {};
+    return {StringAt(entries + 16 * index), StringAt(entries + 16 * index + 8)};
+}
+
+void ContentItemView::CopyTo(ContentItem& item) const {
+    item.item_id = std::string(ItemId());
+    item.type = Type();
+    item.priority = Priority();
+
+    item.schedule.start_time = StartTime();
+    item.schedule.end_time = EndTime();
+    item.schedule.repeat_daily = HasFlag(REPEAT_DAILY);
+    item.schedule.repeat_weekly = HasFlag(REPEAT_WEEKLY);
+    size_t days_count;
+    const uint8_t* days = Array(F_DAYS_OF_WEEK, 1, days_count);
+    item.schedule.days_of_week.assign(days, days + days_count);
+    item.schedule.duration = std::chrono::minutes{Get<int64_t>(F_DURATION)};
+    item.schedule.max_repeats = Get<int32_t>(F_MAX_REPEATS);
+    item.schedule.current_repeats = Get<int32_t>(F_CURRENT_REPEATS);
+
+    item.text_content = std::string(TextContent());
+    item.image_path = std::string(ImagePath());
+    std::string_view binary = BinaryData();
+    item.binary_data = ContentData(reinterpret_cast<const uint8_t*>(binary.data()), binary.size());
+    item.metadata.clear();
+    for (size_t i = 0; i < MetadataCount(); i++) {
+        auto entry = Metadata(i);
+        item.metadata.emplace(std::string(entry.first), std::string(entry.second));
+    }
+
+    item.is_thai_content = HasFlag(IS_THAI_CONTENT);
+    item.thai_romanization = std::string(String(F_THAI_ROMANIZATION));
+    item.cultural_validation.is_appropriate = HasFlag(IS_APPROPRIATE);
+    item.cultural_validation.contains_religious_content = HasFlag(RELIGIOUS_CONTENT);
+    item.cultural_validation.contains_royal_references = HasFlag(ROYAL_REFERENCES);
+    item.cultural_validation.requires_special_formatting = HasFlag(SPECIAL_FORMATTING);
+    item.cultural_validation.warnings = Strings(F_CULTURAL_WARNINGS);
+    item.cultural_validation.suggestions = Strings(F_CULTURAL_SUGGESTIONS);
+    item.cultural_validation.cultural_sensitivity_score =
+        F_SENSITIVITY_SCORE + 8 <= record_size_ ? ReadDouble(record_ + F_SENSITIVITY_SCORE) : 1.0;
+
+    item.created_at = Time(F_CREATED_AT);
+    item.last_scheduled = Time(F_LAST_SCHEDULED);
+    item.next_scheduled = Time(F_NEXT_SCHEDULED);
+    item.schedule_count = Get<int32_t>(F_SCHEDULE_COUNT);
+    item.is_active = HasFlag(IS_ACTIVE);
+    item.is_emergency = HasFlag(IS_EMERGENCY);
+
+    item.metrics.total_display_time = std::chrono::milliseconds{Get<int64_t>(F_DISPLAY_TIME)};
+    item.metrics.display_count = Get<int32_t>(F_DISPLAY_COUNT);
+    item.metrics.user_engagement =
+        F_USER_ENGAGEMENT + 8 <= record_size_ ? ReadDouble(record_ + F_USER_ENGAGEMENT) : 0.0;
+    item.metrics.delivery_confirmed = HasFlag(DELIVERY_CONFIRMED);
+    item.metrics.last_displayed = Time(F_LAST_DISPLAYED);
+
+    item.source_channel = std::string(String(F_SOURCE_CHANNEL));
+    item.source_application = std::string(String(F_SOURCE_APPLICATION));
+    item.creator_id = std::string(String(F_CREATOR_ID));
+    item.content_hash = std::string(String(F_CONTENT_HASH));
+}
+
+std::shared_ptr<ContentItem> ContentItemView::ToItem() const {
+    if (!Valid()) return nullptr;
+
+    auto item = std::make_shared<ContentItem>();
+    CopyTo(*item);
+    return item;
+}
+
+// ContentStoreView implementation
+bool ContentStoreView::Open(const uint8_t* data, size_t len) {
+    *this = ContentStoreView();
+    if (len < HEADER_SIZE || memcmp(data, MAGIC, sizeof(MAGIC)) != 0) return false;
+    if (ReadLE<uint32_t>(data + 8) != FORMAT_VERSION) return false;
+
+    uint32_t count = ReadLE<uint32_t>(data + 12);
+    uint32_t index_offset = ReadLE<uint32_t>(data + 16);
+    uint32_t size = ReadLE<uint32_t>(data + 20);
+    if (size > len || index_offset > size || count > (size - index_offset) / 4) return false;
+
+    data_ = data;
+    len_ = size;
+    count_ = count;
+    index_ = data + index_offset;
+    return true;
+}
+
+ContentItemView ContentStoreView::Item(size_t index) const {
+    if (index >= count_) return ContentItemView();
+    return ContentItemView(data_, len_, ReadLE<uint32_t>(index_ + 4 * index));
+}
+
+ContentItemView ContentStoreView::Find(std::string_view item_id) const {
+    size_t lo = 0;
+    size_t hi = count_;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (Item(mid).ItemId() < item_id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < count_) {
+        ContentItemView item = Item(lo);
+        if (item.ItemId() == item_id) return item;
+    }
+    return ContentItemView();
+}
+
+// MappedContentStore implementation
+MappedContentStore::~MappedContentStore() {
+    Close();
+}
+
+void MappedContentStore::Close() {
+    if (map_) {
+        munmap(map_, map_len_);
+        map_ = nullptr;
+        map_len_ = 0;
+    }
+    view_ = ContentStoreView();
+}
+
+bool MappedContentStore::Open(const std::string& path) {
+    Close();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        std::cerr << "Unable to open content store '" << path << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) || file_stat.st_size == 0) {
+        close(fd);
+        std::cerr << "Unable to read content store '" << path << "'" << std::endl;
+        return false;
+    }
+
+    void* map = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        std::cerr << "Unable to map content store '" << path << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+    map_ = map;
+    map_len_ = file_stat.st_size;
+
+    if (!view_.Open(static_cast<const uint8_t*>(map_), map_len_)) {
+        std::cerr << "Invalid content store '" << path << "'" << std::endl;
+        Close();
+        return false;
+    }
+    return true;
+}
+
+// ContentStoreWriter implementation
+ContentStoreWriter::ContentStoreWriter() : data_(ContentStoreView::HEADER_SIZE) {
+}
+
+uint32_t ContentStoreWriter::Append(const void* data, size_t len) {
+    uint32_t offset = data_.size();
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    data_.insert(data_.end(), bytes, bytes + len);
+    return offset;
+}
+
+void ContentStoreWriter::Align() {
+    data_.resize((data_.size() + 7) & ~size_t(7));
+}
+
+void ContentStoreWriter::PutReference(uint8_t* fixed, ContentItemView::Field field, uint32_t offset, size_t len) {
+    WriteLE<uint32_t>(fixed + field, offset);
+    WriteLE<uint32_t>(fixed + field + 4, len);
+}
+
+void ContentStoreWriter::PutString(uint8_t* fixed, ContentItemView::Field field, const std::string& str) {
+    PutReference(fixed, field, Append(str.data(), str.size()), str.size());
+}
+
+void ContentStoreWriter::PutStrings(uint8_t* fixed, ContentItemView::Field field, const std::vector<std::string>& strings) {
+    std::vector<uint8_t> references(8 * strings.size());
+    for (size_t i = 0; i < strings.size(); i++) {
+        WriteLE<uint32_t>(&references[8 * i], Append(strings[i].data(), strings[i].size()));
+        WriteLE<uint32_t>(&references[8 * i + 4], strings[i].size());
+    }
+    PutReference(fixed, field, Append(references.data(), references.size()), strings.size());
+}
+
+void ContentStoreWriter::Add(const ContentItem& item) {
+    typedef ContentItemView V;
+    uint8_t fixed[V::RECORD_SIZE] = {};
+
+    // the referenced data first, then the fixed part
+    PutString(fixed, V::F_ITEM_ID, item.item_id);
+    PutString(fixed, V::F_TEXT_CONTENT, item.text_content);
+    PutString(fixed, V::F_IMAGE_PATH, item.image_path);
+    PutReference(fixed, V::F_BINARY_DATA, Append(item.binary_data.data(), item.binary_data.size()), item.binary_data.size());
+    PutString(fixed, V::F_THAI_ROMANIZATION, item.thai_romanization);
+    PutString(fixed, V::F_SOURCE_CHANNEL, item.source_channel);
+    PutString(fixed, V::F_SOURCE_APPLICATION, item.source_application);
+    PutString(fixed, V::F_CREATOR_ID, item.creator_id);
+    PutString(fixed, V::F_CONTENT_HASH, item.content_hash);
+
+    std::vector<uint8_t> days(item.schedule.days_of_week.begin(), item.schedule.days_of_week.end());
+    PutReference(fixed, V::F_DAYS_OF_WEEK, Append(days.data(), days.size()), days.size());
+
+    std::vector<uint8_t> metadata(16 * item.metadata.size());
+    size_t i = 0;
+    for (const auto& entry : item.metadata) {
+        WriteLE<uint32_t>(&metadata[16 * i], Append(entry.first.data(), entry.first.size()));
+        WriteLE<uint32_t>(&metadata[16 * i + 4], entry.first.size());
+        WriteLE<uint32_t>(&metadata[16 * i + 8], Append(entry.second.data(), entry.second.size()));
+        WriteLE<uint32_t>(&metadata[16 * i + 12], entry.second.size());
+        i++;
+    }
+    PutReference(fixed, V::F_METADATA, Append(metadata.data(), metadata.size()), item.metadata.size());
+
+    PutStrings(fixed, V::F_CULTURAL_WARNINGS, item.cultural_validation.warnings);
+    PutStrings(fixed, V::F_CULTURAL_SUGGESTIONS, item.cultural_validation.suggestions);
+
+    uint16_t flags = 0;
+    if (item.schedule.repeat_daily) flags |= V::REPEAT_DAILY;
+    if (item.schedule.repeat_weekly) flags |= V::REPEAT_WEEKLY;
+    if (item.is_thai_content) flags |= V::IS_THAI_CONTENT;
+    if (item.is_active) flags |= V::IS_ACTIVE;
+    if (item.is_emergency) flags |= V::IS_EMERGENCY;
+    if (item.metrics.delivery_confirmed) flags |= V::DELIVERY_CONFIRMED;
+    if (item.cultural_validation.is_appropriate) flags |= V::IS_APPROPRIATE;
+    if (item.cultural_validation.contains_religious_content) flags |= V::RELIGIOUS_CONTENT;
+    if (item.cultural_validation.contains_royal_references) flags |= V::ROYAL_REFERENCES;
+    if (item.cultural_validation.requires_special_formatting) flags |= V::SPECIAL_FORMATTING;
+
+    WriteLE<uint32_t>(fixed + V::F_RECORD_SIZE, V::RECORD_SIZE);
+    WriteLE<uint8_t>(fixed + V::F_TYPE, static_cast<uint8_t>(item.type));
+    WriteLE<uint8_t>(fixed + V::F_PRIORITY, static_cast<uint8_t>(item.priority));
+    WriteLE<uint16_t>(fixed + V::F_FLAGS, flags);
+    WriteLE<int32_t>(fixed + V::F_MAX_REPEATS, item.schedule.max_repeats);
+    WriteLE<int32_t>(fixed + V::F_CURRENT_REPEATS, item.schedule.current_repeats);
+    WriteLE<int32_t>(fixed + V::F_SCHEDULE_COUNT, item.schedule_count);
+    WriteLE<int32_t>(fixed + V::F_DISPLAY_COUNT, item.metrics.display_count);
+    WriteLE<int64_t>(fixed + V::F_START_TIME, EncodeTime(item.schedule.start_time));
+    WriteLE<int64_t>(fixed + V::F_END_TIME, EncodeTime(item.schedule.end_time));
+    WriteLE<int64_t>(fixed + V::F_CREATED_AT, EncodeTime(item.created_at));
+    WriteLE<int64_t>(fixed + V::F_LAST_SCHEDULED, EncodeTime(item.last_scheduled));
+    WriteLE<int64_t>(fixed + V::F_NEXT_SCHEDULED, EncodeTime(item.next_scheduled));
+    WriteLE<int64_t>(fixed + V::F_LAST_DISPLAYED, EncodeTime(item.metrics.last_displayed));
+    WriteLE<int64_t>(fixed + V::F_DURATION, item.schedule.duration.count());
+    WriteLE<int64_t>(fixed + V::F_DISPLAY_TIME, item.metrics.total_display_time.count());
+    WriteDouble(fixed + V::F_USER_ENGAGEMENT, item.metrics.user_engagement);
+    WriteDouble(fixed + V::F_SENSITIVITY_SCORE, item.cultural_validation.cultural_sensitivity_score);
+
+    Align();
+    records_.emplace_back(item.item_id, Append(fixed, sizeof(fixed)));
+}
+
+std::vector<uint8_t> ContentStoreWriter::Finish() {
+    std::stable_sort(records_.begin(), records_.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    Align();
+    uint32_t index_offset = data_.size();
+    data_.resize(data_.size() + 4 * records_.size());
+    for (size_t i = 0; i < records_.size(); i++) {
+        WriteLE<uint32_t>(&data_[index_offset + 4 * i], records_[i].second);
+    }
+
+    memcpy(&data_[0], ContentStoreView::MAGIC, sizeof(ContentStoreView::MAGIC));
+    WriteLE<uint32_t>(&data_[8], ContentStoreView::FORMAT_VERSION);
+    WriteLE<uint32_t>(&data_[12], records_.size());
+    WriteLE<uint32_t>(&data_[16], index_offset);
+    WriteLE<uint32_t>(&data_[20], data_.size());
+
+    std::vector<uint8_t> store;
+    store.swap(data_);
+    data_.resize(ContentStoreView::HEADER_SIZE);
+    records_.clear();
+    return store;
+}
+
+bool ContentStoreWriter::WriteFile(const std::string& path) {
+    std::vector<uint8_t> store = Finish();
+
+    std::string tmp_path = path + ".tmp";
+    FILE* f = fopen(tmp_path.c_str(), "wb");
+    if (!f) {
+        std::cerr << "Unable to create content store '" << tmp_path << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    bool ok = fwrite(store.data(), 1, store.size(), f) == store.size();
+    if (fclose(f)) ok = false;
+    if (!ok) {
+        std::cerr << "Unable to write content store '" << tmp_path << "'" << std::endl;
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    if (rename(tmp_path.c_str(), path.c_str())) {
+        std::cerr << "Unable to replace content store '" << path << "': " << strerror(errno) << std::endl;
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace StreamDAB
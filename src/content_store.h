@@ -0,0 +1,197 @@
+/*
+    StreamDAB Content Store
+    Copyright (C) 2024 StreamDAB Project
+
+    Binary layout of content items
+    Read in place, from memory or a mapped file
+    Persistent scheduler state and coordinator sync
+*/
+
+#ifndef CONTENT_STORE_H_
+#define CONTENT_STORE_H_
+
+#include "content_manager.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace StreamDAB {
+
+/*
+ * A store is a header, the records of its items and an index of them.
+ * All integers are little-endian; offsets count from the start of the store,
+ * and a reference to a string or an array is its offset and length (uint32
+ * each). Records are 8-byte aligned.
+ *
+ * header: magic (8), format version (uint32), item count (uint32),
+ *         index offset (uint32), store size (uint32)
+ * index:  record offsets (uint32), by ascending item ID
+ * record: a fixed part with its own size first, see ContentItemView::Field,
+ *         followed or preceded by the data it references
+ *
+ * Fields are only ever appended to the fixed part of a record. A reader
+ * takes a field beyond the record's size as absent, so that stores written
+ * by a newer version remain readable; the format version only changes with
+ * incompatible layouts.
+ */
+
+// An item record, read in place; the store's memory must outlive it.
+// Corrupt references read as empty.
+class ContentItemView {
+public:
+    // offsets within the fixed part of a record (format version 1)
+    enum Field : uint32_t {
+        F_RECORD_SIZE = 0,          // uint32
+        F_TYPE = 4,                 // uint8
+        F_PRIORITY = 5,             // uint8
+        F_FLAGS = 6,                // uint16, see Flag
+        F_MAX_REPEATS = 8,          // int32
+        F_CURRENT_REPEATS = 12,     // int32
+        F_SCHEDULE_COUNT = 16,      // int32
+        F_DISPLAY_COUNT = 20,       // int32
+        F_START_TIME = 24,          // int64 time points, ns since the epoch
+        F_END_TIME = 32,
+        F_CREATED_AT = 40,
+        F_LAST_SCHEDULED = 48,
+        F_NEXT_SCHEDULED = 56,
+        F_LAST_DISPLAYED = 64,
+        F_DURATION = 72,            // int64, minutes
+        F_DISPLAY_TIME = 80,        // int64, ms
+        F_USER_ENGAGEMENT = 88,     // double
+        F_SENSITIVITY_SCORE = 96,   // double
+        F_ITEM_ID = 104,            // string references
+        F_TEXT_CONTENT = 112,
+        F_IMAGE_PATH = 120,
+        F_BINARY_DATA = 128,
+        F_THAI_ROMANIZATION = 136,
+        F_SOURCE_CHANNEL = 144,
+        F_SOURCE_APPLICATION = 152,
+        F_CREATOR_ID = 160,
+        F_CONTENT_HASH = 168,
+        F_DAYS_OF_WEEK = 176,       // uint8 array
+        F_METADATA = 184,           // array of key and value string references
+        F_CULTURAL_WARNINGS = 192,  // arrays of string references
+        F_CULTURAL_SUGGESTIONS = 200,
+        RECORD_SIZE = 208
+    };
+
+    enum Flag : uint16_t {
+        REPEAT_DAILY = 1 << 0,
+        REPEAT_WEEKLY = 1 << 1,
+        IS_THAI_CONTENT = 1 << 2,
+        IS_ACTIVE = 1 << 3,
+        IS_EMERGENCY = 1 << 4,
+        DELIVERY_CONFIRMED = 1 << 5,
+        IS_APPROPRIATE = 1 << 6,
+        RELIGIOUS_CONTENT = 1 << 7,
+        ROYAL_REFERENCES = 1 << 8,
+        SPECIAL_FORMATTING = 1 << 9
+    };
+
+    ContentItemView() = default;
+    ContentItemView(const uint8_t* store, size_t store_len, size_t offset);
+
+    bool Valid() const { return record_ != nullptr; }
+
+    std::string_view ItemId() const { return String(F_ITEM_ID); }
+    ContentType Type() const { return static_cast<ContentType>(Get<uint8_t>(F_TYPE)); }
+    SchedulePriority Priority() const { return static_cast<SchedulePriority>(Get<uint8_t>(F_PRIORITY)); }
+    bool HasFlag(Flag flag) const { return (Get<uint16_t>(F_FLAGS) & flag) != 0; }
+    std::chrono::system_clock::time_point StartTime() const { return Time(F_START_TIME); }
+    std::chrono::system_clock::time_point EndTime() const { return Time(F_END_TIME); }
+    std::string_view TextContent() const { return String(F_TEXT_CONTENT); }
+    std::string_view ImagePath() const { return String(F_IMAGE_PATH); }
+    std::string_view BinaryData() const { return String(F_BINARY_DATA); }
+
+    size_t MetadataCount() const;
+    std::pair<std::string_view, std::string_view> Metadata(size_t index) const;
+
+    // Copies all fields into an item
+    void CopyTo(ContentItem& item) const;
+    std::shared_ptr<ContentItem> ToItem() const;
+
+private:
+    const uint8_t* store_ = nullptr;
+    size_t store_len_ = 0;
+    const uint8_t* record_ = nullptr;
+    size_t record_size_ = 0;
+
+    template<typename T> T Get(Field field) const;
+    std::chrono::system_clock::time_point Time(Field field) const;
+    std::string_view String(Field field) const;
+    std::string_view StringAt(const uint8_t* reference) const;
+    const uint8_t* Array(Field field, size_t element_size, size_t& count) const;
+    std::vector<std::string> Strings(Field field) const;
+};
+
+// A store in memory, read in place; opening it only checks its header and
+// index, so that its items are available at once
+class ContentStoreView {
+public:
+    static const char MAGIC[8];
+    static const uint32_t FORMAT_VERSION;
+    static const size_t HEADER_SIZE = 24;
+
+    // false, if the data is not a store of a supported version
+    bool Open(const uint8_t* data, size_t len);
+
+    size_t Size() const { return count_; }
+    ContentItemView Item(size_t index) const;   // by ascending item ID
+    ContentItemView Find(std::string_view item_id) const;   // invalid, if not present
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t len_ = 0;
+    size_t count_ = 0;
+    const uint8_t* index_ = nullptr;
+};
+
+// A store file, mapped into memory
+class MappedContentStore {
+public:
+    MappedContentStore() = default;
+    ~MappedContentStore();
+    MappedContentStore(const MappedContentStore&) = delete;
+    MappedContentStore& operator=(const MappedContentStore&) = delete;
+
+    bool Open(const std::string& path);
+    const ContentStoreView& View() const { return view_; }
+
+private:
+    void* map_ = nullptr;
+    size_t map_len_ = 0;
+    ContentStoreView view_;
+
+    void Close();
+};
+
+// Builds a store from items
+class ContentStoreWriter {
+public:
+    ContentStoreWriter();
+
+    void Add(const ContentItem& item);
+
+    // The complete store; the writer is empty afterwards
+    std::vector<uint8_t> Finish();
+    // Replaces the file atomically, so that existing mappings stay intact
+    bool WriteFile(const std::string& path);
+
+private:
+    std::vector<uint8_t> data_;
+    std::vector<std::pair<std::string, uint32_t>> records_;    // item ID, offset
+
+    uint32_t Append(const void* data, size_t len);
+    void Align();
+    void PutReference(uint8_t* fixed, ContentItemView::Field field, uint32_t offset, size_t len);
+    void PutString(uint8_t* fixed, ContentItemView::Field field, const std::string& str);
+    void PutStrings(uint8_t* fixed, ContentItemView::Field field, const std::vector<std::string>& strings);
+};
+
+} // namespace StreamDAB
+
+#endif // CONTENT_STORE_H_
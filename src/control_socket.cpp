@@ -0,0 +1,96 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file control_socket.cpp
+    \brief Local socket to inject labels and slides into a running service
+*/
+
+#include "control_socket.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+// --- ControlSocket -----------------------------------------------------------------
+const size_t ControlSocket::MAX_DATAGRAM = 1024 * 1024;    // e.g. an unprocessed slide
+
+void ControlSocket::Open(const std::string& path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("control socket path '" + path + "' too long");
+    strcpy(addr.sun_path, path.c_str());
+
+    sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+        throw std::runtime_error("control socket creation failed: " + std::string(strerror(errno)));
+
+    if (unlink(addr.sun_path) == -1 && errno != ENOENT)
+        fprintf(stderr, "ODR-PadEnc Warning: unlinking of control socket %s failed: %s\n", addr.sun_path, strerror(errno));
+    if (bind(sock, (const struct sockaddr*) &addr, sizeof(addr)) == -1)
+        throw std::runtime_error("control socket bind to '" + path + "' failed: " + std::string(strerror(errno)));
+    this->path = path;
+
+    // room for a slide or two, even if not processed at once
+    int rcvbuf = 2 * MAX_DATAGRAM;
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)))
+        perror("ODR-PadEnc Warning: cannot enlarge the control socket buffer");
+
+    buffer.resize(MAX_DATAGRAM);
+}
+
+ControlSocket::~ControlSocket() {
+    if (sock != -1)
+        close(sock);
+    if (!path.empty())
+        unlink(path.c_str());
+}
+
+void ControlSocket::Process(const handler_t& handler) {
+    for (;;) {
+        struct sockaddr_un sender;
+        socklen_t sender_len = sizeof(sender);
+        ssize_t len = recvfrom(sock, &buffer[0], buffer.size(), MSG_TRUNC, (struct sockaddr*) &sender, &sender_len);
+        if (len == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("ODR-PadEnc Error: receiving from control socket failed");
+            return;
+        }
+
+        status_t status = STATUS_INVALID;
+        if (len > 0 && (size_t) len <= buffer.size())
+            status = handler(buffer[0], &buffer[1], len - 1);
+        else
+            fprintf(stderr, "ODR-PadEnc Warning: ignoring control command of %zd bytes\n", len);
+
+        // only a bound sender can receive the status
+        if (sender_len > sizeof(sa_family_t)) {
+            if (sendto(sock, &status, 1, MSG_DONTWAIT, (const struct sockaddr*) &sender, sender_len) == -1)
+                perror("ODR-PadEnc Warning: sending control command status failed");
+        }
+    }
+}
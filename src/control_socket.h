@@ -0,0 +1,76 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file control_socket.h
+    \brief Local socket to inject labels and slides into a running service
+*/
+
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+
+// --- ControlSocket -----------------------------------------------------------------
+/*! A UNIX datagram socket, over which e.g. automation software hands labels
+ * and slides to a service at once - instead of writing files and re-read
+ * request files.
+ *
+ * Each datagram is one command: its first byte is the command, the rest are
+ * its arguments (see command_t). If the sender's socket is bound to an
+ * address, it gets a datagram with the one byte status back.
+ */
+class ControlSocket {
+public:
+    enum command_t : uint8_t {
+        CMD_LABEL           = 1,    // DLS file content (incl. DL Plus params), shown instead of the DLS files
+        CMD_LABEL_URGENT    = 2,    // as above, but interrupting any other PAD data at once
+        CMD_LABEL_RELEASE   = 3,    // back to the DLS files
+        CMD_SLIDE_FILE      = 4,    // path of an image file, sent before the slides of the slides dir
+        CMD_SLIDE_DATA      = 5,    // content of a JPEG/PNG file, as above
+        CMD_REREAD_SLIDES   = 6,    // as the re-read request file of the slides dir
+        CMD_REREAD_DLS      = 7,    // as the re-read request file of the DLS file with the index (1 byte)
+        CMD_SLIDE_FILES     = 8,    // paths of image files, each terminated by a null byte, as CMD_SLIDE_FILE in this order
+    };
+    enum status_t : uint8_t {
+        STATUS_OK           = 0,
+        STATUS_INVALID      = 1,    // unknown command or invalid arguments
+        STATUS_UNAVAILABLE  = 2,    // e.g. before the first PAD request, or without slides dir
+    };
+    static const size_t MAX_DATAGRAM;
+
+    typedef std::function<status_t(uint8_t command, const uint8_t* args, size_t len)> handler_t;
+
+    ControlSocket() : sock(-1) {}
+    ~ControlSocket();
+    ControlSocket(const ControlSocket&) = delete;
+    ControlSocket& operator=(const ControlSocket&) = delete;
+
+    // binds to the path (replacing an existing socket); throws std::runtime_error on failure
+    void Open(const std::string& path);
+    int fd() const {return sock;}
+
+    // runs the handler for each received command, without waiting for any
+    void Process(const handler_t& handler);
+private:
+    int sock;
+    std::string path;
+    std::vector<uint8_t> buffer;
+};
@@ -19,6 +19,16 @@
 #include "crc.h"
 #include <stdio.h>
 #include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+#  include <arm_neon.h>
+#  include <sys/auxv.h>
+#  include <asm/hwcap.h>
+#endif
 
 //#define CCITT       0x1021
 
@@ -60,41 +70,54 @@ namespace odr{
 	};
 
 
-	uint16_t crc16tab[256] = {
-		0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
-		0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
-		0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
-		0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
-		0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
-		0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
-		0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
-		0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
-		0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
-		0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
-		0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
-		0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
-		0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
-		0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
-		0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
-		0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
-		0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
-		0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
-		0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
-		0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
-		0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
-		0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
-		0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
-		0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
-		0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
-		0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
-		0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
-		0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
-		0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
-		0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
-		0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
-		0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
+	// --- CRC-16 (CCITT) ---------------------------------------------------------
+	/*! The CCITT tables are generated at compile time. Table k holds the CRC of
+	 * the byte i followed by k zero bytes, to process eight bytes per step
+	 * (slice-by-8).
+	 */
+	static const uint16_t CRC16_CCITT_POLY = 0x1021;
+
+	static constexpr uint16_t crc16_shift_bits(uint16_t crc, int bits) {
+		return bits == 0 ? crc : crc16_shift_bits((crc << 1) ^ ((crc & 0x8000) ? CRC16_CCITT_POLY : 0), bits - 1);
+	}
+
+	static constexpr uint16_t crc16_table_entry(int table, uint16_t value) {
+		return table == 0 ?
+			crc16_shift_bits(value << 8, 8) :
+			(crc16_table_entry(table - 1, value) << 8) ^ crc16_table_entry(0, crc16_table_entry(table - 1, value) >> 8);
+	}
+
+	// x^n mod P, as used by the carry-less multiplication folding
+	static constexpr uint16_t crc16_xpow_mod(int n) {
+		return n < 16 ? (1 << n) : crc16_shift_bits(crc16_xpow_mod(n - 8), 8);
+	}
+
+	template<size_t... I> struct crc16_index_list {};
+	template<size_t N, size_t... I> struct crc16_make_index_list : crc16_make_index_list<N - 1, N - 1, I...> {};
+	template<size_t... I> struct crc16_make_index_list<0, I...> {typedef crc16_index_list<I...> type;};
+
+	struct crc16_tables_t {
+		uint16_t t[8][256];
 	};
 
+	template<size_t... I>
+	static constexpr crc16_tables_t crc16_make_tables(crc16_index_list<I...>) {
+		return crc16_tables_t {{
+			{crc16_table_entry(0, I)...}, {crc16_table_entry(1, I)...},
+			{crc16_table_entry(2, I)...}, {crc16_table_entry(3, I)...},
+			{crc16_table_entry(4, I)...}, {crc16_table_entry(5, I)...},
+			{crc16_table_entry(6, I)...}, {crc16_table_entry(7, I)...}
+		}};
+	}
+
+	static constexpr crc16_tables_t crc16_ccitt = crc16_make_tables(crc16_make_index_list<256>::type());
+
+	static_assert(crc16_ccitt.t[0][1] == 0x1021 && crc16_ccitt.t[0][255] == 0x1ef0, "CRC-16 table generation broken");
+
+	// table set by init_crc16tab(), used instead of the CCITT tables
+	uint16_t crc16tab[256];
+	static bool crc16tab_custom = false;
+
 
 	uint32_t crc32tab[256] = {
 		0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9,
@@ -203,6 +226,7 @@ namespace odr{
 			crc ^= 0xff00;
 			crc16tab[i] = crc;
 		}
+		crc16tab_custom = true;
 	}
 
 
@@ -238,17 +262,155 @@ namespace odr{
 	}
 
 
-	uint16_t crc16(uint16_t l_crc, const void *lp_data, unsigned l_nb)
+	static uint16_t crc16_bytewise(const uint16_t* tab, uint16_t l_crc, const uint8_t* data, size_t l_nb)
 	{
-		const uint8_t* data = (const uint8_t*)lp_data;
 		while (l_nb--) {
 			l_crc =
-				(l_crc << 8) ^ crc16tab[(l_crc >> 8) ^ *(data++)];
+				(l_crc << 8) ^ tab[(l_crc >> 8) ^ *(data++)];
 		}
 		return (l_crc);
 	}
 
 
+	static uint16_t crc16_slice8(uint16_t l_crc, const uint8_t* data, size_t l_nb)
+	{
+		const uint16_t (*t)[256] = crc16_ccitt.t;
+
+		for (; l_nb >= 8; l_nb -= 8, data += 8) {
+			l_crc ^= (data[0] << 8) | data[1];
+			l_crc =
+				t[7][l_crc >> 8] ^ t[6][l_crc & 0xFF] ^
+				t[5][data[2]] ^ t[4][data[3]] ^ t[3][data[4]] ^
+				t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+		}
+		return crc16_bytewise(t[0], l_crc, data, l_nb);
+	}
+
+
+	/*! Carry-less multiplication path: the data is folded in 16 byte blocks
+	 * into a 128 bit accumulator A (A * x^128 = H * x^192 + L * x^128, with
+	 * both factors reduced mod P), which is then fed into the table based
+	 * CRC with the remaining bytes.
+	 */
+	static const size_t CRC16_CLMUL_MIN_LEN = 64;
+	static const uint16_t CRC16_K_192 = crc16_xpow_mod(192);
+	static const uint16_t CRC16_K_128 = crc16_xpow_mod(128);
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+	__attribute__((target("pclmul,ssse3")))
+	static uint16_t crc16_clmul(uint16_t l_crc, const uint8_t* data, size_t l_nb)
+	{
+		if (l_nb < CRC16_CLMUL_MIN_LEN)
+			return crc16_slice8(l_crc, data, l_nb);
+
+		const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		const __m128i k = _mm_set_epi64x(CRC16_K_192, CRC16_K_128);
+
+		// the initial CRC is added to the first two message bytes
+		__m128i acc = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) data), reverse);
+		acc = _mm_xor_si128(acc, _mm_slli_si128(_mm_cvtsi32_si128(l_crc), 14));
+		data += 16;
+		l_nb -= 16;
+
+		for (; l_nb >= 16; l_nb -= 16, data += 16) {
+			__m128i block = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) data), reverse);
+			acc = _mm_xor_si128(
+					_mm_xor_si128(_mm_clmulepi64_si128(acc, k, 0x11), _mm_clmulepi64_si128(acc, k, 0x00)),
+					block);
+		}
+
+		uint8_t acc_bytes[16];
+		_mm_storeu_si128((__m128i*) acc_bytes, _mm_shuffle_epi8(acc, reverse));
+		l_crc = crc16_slice8(0, acc_bytes, sizeof(acc_bytes));
+
+		return crc16_slice8(l_crc, data, l_nb);
+	}
+
+	static bool crc16_clmul_supported()
+	{
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+	}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+	static uint16_t crc16_clmul(uint16_t l_crc, const uint8_t* data, size_t l_nb)
+	{
+		if (l_nb < CRC16_CLMUL_MIN_LEN)
+			return crc16_slice8(l_crc, data, l_nb);
+
+		// accumulator as two 64 bit polynomials (hi = first eight bytes), big endian
+		uint64_t hi = __builtin_bswap64(*(const uint64_t*) (const void*) data) ^ ((uint64_t) l_crc << 48);
+		uint64_t lo = __builtin_bswap64(*(const uint64_t*) (const void*) (data + 8));
+		data += 16;
+		l_nb -= 16;
+
+		for (; l_nb >= 16; l_nb -= 16, data += 16) {
+			poly128_t fold =
+				(poly128_t) veorq_u8(
+					vreinterpretq_u8_p128(vmull_p64((poly64_t) hi, (poly64_t) CRC16_K_192)),
+					vreinterpretq_u8_p128(vmull_p64((poly64_t) lo, (poly64_t) CRC16_K_128)));
+			uint64x2_t fold64 = vreinterpretq_u64_p128(fold);
+			hi = vgetq_lane_u64(fold64, 1) ^ __builtin_bswap64(*(const uint64_t*) (const void*) data);
+			lo = vgetq_lane_u64(fold64, 0) ^ __builtin_bswap64(*(const uint64_t*) (const void*) (data + 8));
+		}
+
+		uint8_t acc_bytes[16];
+		for (int i = 0; i < 8; i++) {
+			acc_bytes[i]     = hi >> (56 - 8 * i);
+			acc_bytes[8 + i] = lo >> (56 - 8 * i);
+		}
+		l_crc = crc16_slice8(0, acc_bytes, sizeof(acc_bytes));
+
+		return crc16_slice8(l_crc, data, l_nb);
+	}
+
+	static bool crc16_clmul_supported()
+	{
+		return getauxval(AT_HWCAP) & HWCAP_PMULL;
+	}
+#else
+	static uint16_t crc16_clmul(uint16_t l_crc, const uint8_t* data, size_t l_nb)
+	{
+		return crc16_slice8(l_crc, data, l_nb);
+	}
+
+	static bool crc16_clmul_supported()
+	{
+		return false;
+	}
+#endif
+
+
+	typedef uint16_t (*crc16_engine_t)(uint16_t l_crc, const uint8_t* data, size_t l_nb);
+
+	static crc16_engine_t crc16_select_engine()
+	{
+		return crc16_clmul_supported() ? crc16_clmul : crc16_slice8;
+	}
+
+
+	uint16_t crc16(uint16_t l_crc, const void *lp_data, unsigned l_nb)
+	{
+		const uint8_t* data = (const uint8_t*)lp_data;
+		if (crc16tab_custom)
+			return crc16_bytewise(crc16tab, l_crc, data, l_nb);
+
+		static const crc16_engine_t engine = crc16_select_engine();
+		return engine(l_crc, data, l_nb);
+	}
+
+
+	uint16_t crc16_reference(uint16_t l_crc, const void *lp_data, unsigned l_nb)
+	{
+		return crc16_bytewise(crc16_ccitt.t[0], l_crc, (const uint8_t*)lp_data, l_nb);
+	}
+
+
+	const char* crc16_engine_name()
+	{
+		return crc16_clmul_supported() ? "clmul" : "slice-by-8";
+	}
+
+
 	uint32_t crc32(uint32_t l_crc, const void *lp_data, unsigned l_nb)
 	{
 		const uint8_t* data = (const uint8_t*)lp_data;
@@ -259,4 +421,97 @@ namespace odr{
 		return (l_crc);
 	}
 
-}
\ No newline at end of file
+
+
+	// --- 64-bit hash -------------------------------------------------------------
+	/*! XXH64, which processes 32 bytes per step in four independent lanes
+	 * (see https://github.com/Cyan4973/xxHash).
+	 */
+	static const uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+	static const uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+	static const uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+	static const uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+	static const uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+	static inline uint64_t xxh_rotl(uint64_t x, int r) {
+		return (x << r) | (x >> (64 - r));
+	}
+
+	static inline uint64_t xxh_read64(const uint8_t* p) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		v = __builtin_bswap64(v);
+#endif
+		return v;
+	}
+
+	static inline uint32_t xxh_read32(const uint8_t* p) {
+		uint32_t v;
+		memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		v = __builtin_bswap32(v);
+#endif
+		return v;
+	}
+
+	static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+		acc += input * XXH_PRIME64_2;
+		return xxh_rotl(acc, 31) * XXH_PRIME64_1;
+	}
+
+	static inline uint64_t xxh_merge_round(uint64_t acc, uint64_t val) {
+		acc ^= xxh_round(0, val);
+		return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+
+	uint64_t hash64(const void *lp_data, size_t l_nb, uint64_t l_seed)
+	{
+		const uint8_t* p = (const uint8_t*)lp_data;
+		const uint8_t* const end = p + l_nb;
+		uint64_t h;
+
+		if (l_nb >= 32) {
+			uint64_t v1 = l_seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+			uint64_t v2 = l_seed + XXH_PRIME64_2;
+			uint64_t v3 = l_seed;
+			uint64_t v4 = l_seed - XXH_PRIME64_1;
+			for (; p + 32 <= end; p += 32) {
+				v1 = xxh_round(v1, xxh_read64(p));
+				v2 = xxh_round(v2, xxh_read64(p + 8));
+				v3 = xxh_round(v3, xxh_read64(p + 16));
+				v4 = xxh_round(v4, xxh_read64(p + 24));
+			}
+			h = xxh_rotl(v1, 1) + xxh_rotl(v2, 7) + xxh_rotl(v3, 12) + xxh_rotl(v4, 18);
+			h = xxh_merge_round(h, v1);
+			h = xxh_merge_round(h, v2);
+			h = xxh_merge_round(h, v3);
+			h = xxh_merge_round(h, v4);
+		} else {
+			h = l_seed + XXH_PRIME64_5;
+		}
+		h += (uint64_t)l_nb;
+
+		for (; p + 8 <= end; p += 8) {
+			h ^= xxh_round(0, xxh_read64(p));
+			h = xxh_rotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+		}
+		if (p + 4 <= end) {
+			h ^= (uint64_t)xxh_read32(p) * XXH_PRIME64_1;
+			h = xxh_rotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+			p += 4;
+		}
+		for (; p < end; p++) {
+			h ^= (*p) * XXH_PRIME64_5;
+			h = xxh_rotl(h, 11) * XXH_PRIME64_1;
+		}
+
+		h ^= h >> 33;
+		h *= XXH_PRIME64_2;
+		h ^= h >> 29;
+		h *= XXH_PRIME64_3;
+		h ^= h >> 32;
+		return h;
+	}
+
+}
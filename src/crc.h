@@ -20,6 +20,7 @@
 
 #include "common.h"
 
+#include <stddef.h>
 #include <stdint.h>
 
 namespace odr{
@@ -31,8 +32,16 @@ namespace odr{
 
 	void init_crc16tab(uint16_t l_code, uint16_t l_init);
 	uint16_t crc16(uint16_t l_crc, const void *lp_data, unsigned l_nb);
+
+	// byte-at-a-time CRC-16 (CCITT), e.g. to verify the accelerated crc16()
+	uint16_t crc16_reference(uint16_t l_crc, const void *lp_data, unsigned l_nb);
+	// name of the CRC-16 (CCITT) implementation picked for this CPU
+	const char* crc16_engine_name();
 	
 	void init_crc32tab(uint32_t l_code, uint32_t l_init);
 	uint32_t crc32(uint32_t l_crc, const void *lp_data, unsigned l_nb);
+
+	// fast 64-bit non-cryptographic hash (XXH64), e.g. to recognise files of the same content
+	uint64_t hash64(const void *lp_data, size_t l_nb, uint64_t l_seed = 0);
 	
 }
@@ -28,6 +28,142 @@
 */
 
 #include "dls.h"
+#include "log.h"
+#include "metrics.h"
+#include "thread_placement.h"
+#include "trace.h"
+#include "utf8_scan.h"
+
+
+// of all encoders
+static MetricCounter& dls_insertions_metric() {
+    static MetricCounter& counter = MetricsRegistry::Global().Counter("odr_padenc_dls_insertions", "DL states queued for transmission");
+    return counter;
+}
+
+
+// --- DLPlusTagger -----------------------------------------------------------------
+static const std::map<std::string, int> DL_PLUS_ITEM_TYPES = {
+    {"title", 1}, {"album", 2}, {"tracknumber", 3}, {"artist", 4}, {"composition", 5}, {"movement", 6},
+    {"conductor", 7}, {"composer", 8}, {"band", 9}, {"comment", 10}, {"genre", 11}, {"*", -1}
+};
+
+static int utf8_chars(const std::string& text, size_t begin, size_t end) {
+    return utf8_count(text.data() + begin, end - begin);
+}
+
+bool DLPlusTagger::addFormat(const std::string& format) {
+    format_t compiled;
+    compiled.literals.emplace_back();
+    size_t tagged = 0;
+    for (size_t pos = 0; pos < format.size(); pos++) {
+        if (format[pos] != '{') {
+            compiled.literals.back() += format[pos];
+            continue;
+        }
+
+        size_t close = format.find('}', pos);
+        std::map<std::string, int>::const_iterator type = DL_PLUS_ITEM_TYPES.end();
+        if (close != std::string::npos)
+            type = DL_PLUS_ITEM_TYPES.find(format.substr(pos + 1, close - pos - 1));
+        if (type == DL_PLUS_ITEM_TYPES.end()) {
+            fprintf(stderr, "ODR-PadEnc Warning: DL Plus format '%s' has an unknown field at %zu - ignored\n", format.c_str(), pos);
+            return false;
+        }
+        if (!compiled.content_types.empty() && compiled.literals.back().empty()) {
+            fprintf(stderr, "ODR-PadEnc Warning: DL Plus format '%s' has fields without text between them - ignored\n", format.c_str());
+            return false;
+        }
+        compiled.content_types.push_back(type->second);
+        compiled.literals.emplace_back();
+        if (type->second > 0)
+            tagged++;
+        pos = close;
+    }
+
+    if (tagged == 0 || tagged > 4) {
+        fprintf(stderr, "ODR-PadEnc Warning: DL Plus format '%s' must have one to four tagged fields - ignored\n", format.c_str());
+        return false;
+    }
+    formats.push_back(compiled);
+    return true;
+}
+
+bool DLPlusTagger::match(const format_t& format, const std::string& line, int line_start, dl_plus_tags_t& tags) {
+    const std::string& prefix = format.literals.front();
+    if (line.compare(0, prefix.size(), prefix) != 0)
+        return false;
+
+    size_t pos = prefix.size();
+    for (size_t i = 0; i < format.content_types.size(); i++) {
+        // the first occurrence of the following text; the last field up to the suffix
+        const std::string& next = format.literals[i + 1];
+        size_t start = pos;
+        size_t end;
+        if (i + 1 == format.content_types.size()) {
+            if (line.size() < start + 1 + next.size() || line.compare(line.size() - next.size(), next.size(), next) != 0)
+                return false;
+            end = line.size() - next.size();
+        } else {
+            end = line.find(next, start + 1);
+            if (end == std::string::npos)
+                return false;
+        }
+        pos = end + next.size();
+
+        if (format.content_types[i] < 0)
+            continue;
+        while (start < end && line[start] == ' ')
+            start++;
+        while (end > start && line[end - 1] == ' ')
+            end--;
+        if (start == end)
+            return false;
+        int start_marker = line_start + utf8_chars(line, 0, start);
+        int length_marker = utf8_chars(line, start, end) - 1;
+        if (start_marker > 0x7F || length_marker > 0x7F)
+            return false;
+        tags.emplace_back(format.content_types[i], start_marker, length_marker);
+    }
+    return true;
+}
+
+bool DLPlusTagger::tag(const std::vector<std::string>& dls_lines, DL_STATE& dl_state) {
+    if (formats.empty() || dls_lines.empty() || dl_state.dl_plus_enabled)
+        return false;
+
+    if (dls_lines != last_lines) {
+        last_lines = dls_lines;
+        last_tags.clear();
+
+        int line_start = 0;
+        for (const std::string& line : dls_lines) {
+            for (size_t i = 0; i < formats.size() && last_tags.empty(); i++) {
+                size_t f = (last_format + i) % formats.size();
+                if (match(formats[f], line, line_start, last_tags))
+                    last_format = f;
+                else
+                    last_tags.clear();
+            }
+            if (!last_tags.empty()) {
+                if (line != item_line) {
+                    item_line = line;
+                    item_toggle = !item_toggle;
+                }
+                break;
+            }
+            line_start += utf8_chars(line, 0, line.size()) + 1;    // incl. line break
+        }
+    }
+    if (last_tags.empty())
+        return false;
+
+    dl_state.dl_plus_enabled = true;
+    dl_state.dl_plus_item_toggle = item_toggle;
+    dl_state.dl_plus_item_running = true;
+    dl_state.dl_plus_tags = last_tags;
+    return true;
+}
 
 
 // --- DLSEncoder -----------------------------------------------------------------
@@ -36,42 +172,63 @@ const size_t DLSEncoder::DLS_SEG_LEN_PREFIX = 2;
 const size_t DLSEncoder::DLS_SEG_LEN_CHAR_MAX = 16;
 const std::string DLSEncoder::DL_PARAMS_OPEN  = "##### parameters { #####";
 const std::string DLSEncoder::DL_PARAMS_CLOSE = "##### parameters } #####";
+const size_t DLSEncoder::MAXTEMPLATES = 16; // labels; default, enough for the usual DLS file rotations
 const int DLSEncoder::APPTYPE_START = 2;
+
+static LogSite label_log("dls.label", 0);
+static LogSite dl_plus_log("dls.dl_plus_tags", 0);
 const int DLSEncoder::APPTYPE_CONT = 3;
 const std::string DLSEncoder::REQUEST_REREAD_SUFFIX = ".REQUEST_DLS_REREAD";
 
 
 
-DATA_GROUP* DLSEncoder::createDynamicLabelCommand(uint8_t command) {
-    DATA_GROUP* dg = new DATA_GROUP(2, APPTYPE_START, APPTYPE_CONT);
-    uint8_vector_t &seg_data = dg->data;
+/*! The DGs (incl. CRC) of the commands without field, by command and
+ * toggle bit value; built once, so that a command DG only references them.
+ */
+struct dl_command_table_t {
+    static const size_t DG_LEN = 4;     // prefix and CRC
+    uint8_t dgs[16][2][DG_LEN];
 
-    // prefix: toggle? + first seg + last seg + command flag + command
-    seg_data[0] =
-            (dls_toggle ? (1 << 7) : 0) +
-            (1 << 6) +
-            (1 << 5) +
-            (1 << 4) +
-            command;
+    dl_command_table_t() {
+        for (uint8_t command = 0; command < 16; command++) {
+            for (int toggle = 0; toggle < 2; toggle++) {
+                DATA_GROUP dg(2, DLSEncoder::APPTYPE_START, DLSEncoder::APPTYPE_CONT);
 
-    // prefix: reserved
-    seg_data[1] = 0;
+                // prefix: toggle? + first seg + last seg + command flag + command
+                dg.data[0] =
+                        (toggle ? (1 << 7) : 0) +
+                        (1 << 6) +
+                        (1 << 5) +
+                        (1 << 4) +
+                        command;
+
+                // prefix: reserved
+                dg.data[1] = 0;
+
+                // CRC
+                dg.AppendCRC();
+                memcpy(dgs[command][toggle], dg.data.data(), DG_LEN);
+            }
+        }
+    }
+};
 
-    // CRC
-    dg->AppendCRC();
+DATA_GROUP* DLSEncoder::createDynamicLabelCommand(uint8_t command) {
+    static const dl_command_table_t table;
 
+    DATA_GROUP* dg = pad_packetizer->CreateDataGroup(0, APPTYPE_START, APPTYPE_CONT);
+    dg->SetExternalPayload(table.dgs[command & 0x0F][dls_toggle ? 1 : 0], dl_command_table_t::DG_LEN, nullptr);
     return dg;
 }
 
-DATA_GROUP* DLSEncoder::createDynamicLabelPlus(const DL_STATE& dl_state) {
+void DLSEncoder::dl_plus_data(const DL_STATE& dl_state, bool toggle, uint8_vector_t& seg_data) {
     size_t tags_size = dl_state.dl_plus_tags.size();
     size_t len_dl_plus_cmd_field = 1 + 3 * tags_size;
-    DATA_GROUP* dg = new DATA_GROUP(2 + len_dl_plus_cmd_field, APPTYPE_START, APPTYPE_CONT);
-    uint8_vector_t &seg_data = dg->data;
+    seg_data.resize(2 + len_dl_plus_cmd_field);
 
     // prefix: toggle? + first seg + last seg + command flag + command
     seg_data[0] =
-            (dls_toggle ? (1 << 7) : 0) +
+            (toggle ? (1 << 7) : 0) +
             (1 << 6) +
             (1 << 5) +
             (1 << 4) +
@@ -79,7 +236,7 @@ DATA_GROUP* DLSEncoder::createDynamicLabelPlus(const DL_STATE& dl_state) {
 
     // prefix: link bit + length
     seg_data[1] =
-            (dls_toggle ? (1 << 7) : 0) +
+            (toggle ? (1 << 7) : 0) +
             (len_dl_plus_cmd_field - 1);    // -1 !
 
     // DL Plus tags command: CId + IT + IR + NT
@@ -95,11 +252,6 @@ DATA_GROUP* DLSEncoder::createDynamicLabelPlus(const DL_STATE& dl_state) {
         seg_data[4 + 3 * i] = dl_state.dl_plus_tags[i].start_marker & 0x7F;
         seg_data[5 + 3 * i] = dl_state.dl_plus_tags[i].length_marker & 0x7F;
     }
-
-    // CRC
-    dg->AppendCRC();
-
-    return dg;
 }
 
 
@@ -126,7 +278,7 @@ bool DLSEncoder::parse_dl_param_int_dl_plus_tag(const std::string &key, const st
     return false;
 }
 
-void DLSEncoder::parse_dl_params(std::ifstream &dls_fstream, DL_STATE &dl_state) {
+void DLSEncoder::parse_dl_params(std::istream &dls_fstream, DL_STATE &dl_state) {
     std::string line;
     while (std::getline(dls_fstream, line)) {
         // return on params close
@@ -174,7 +326,7 @@ void DLSEncoder::parse_dl_params(std::ifstream &dls_fstream, DL_STATE &dl_state)
                 continue;
             }
 
-            int content_type, start_marker, length_marker;
+            int content_type = 0, start_marker = 0, length_marker = 0;
             if (parse_dl_param_int_dl_plus_tag("content_type", params[0], content_type) &
                 parse_dl_param_int_dl_plus_tag("start_marker", params[1], start_marker) &
                 parse_dl_param_int_dl_plus_tag("length_marker", params[2], length_marker))
@@ -190,13 +342,17 @@ void DLSEncoder::parse_dl_params(std::ifstream &dls_fstream, DL_STATE &dl_state)
 
 
 bool DLSEncoder::parseLabel(const std::string& dls_file, const DL_PARAMS& dl_params, DL_STATE& dl_state) {
-    std::vector<std::string> dls_lines;
-
     std::ifstream dls_fstream(dls_file);
     if (!dls_fstream.is_open()) {
         std::cerr << "Could not open " << dls_file << std::endl;
         return false;
     }
+    return parseLabel(dls_fstream, dl_params, dl_state);
+}
+
+
+bool DLSEncoder::parseLabel(std::istream& dls_fstream, const DL_PARAMS& dl_params, DL_STATE& dl_state) {
+    std::vector<std::string> dls_lines;
 
     std::string line;
     // Read and convert lines one by one because the converter doesn't understand
@@ -207,52 +363,320 @@ bool DLSEncoder::parseLabel(const std::string& dls_file, const DL_PARAMS& dl_par
         if (line == DL_PARAMS_OPEN) {
             parse_dl_params(dls_fstream, dl_state);
         } else {
-            if (not dl_params.raw_dls && dl_params.charset == DABCharset::UTF8) {
-                dls_lines.push_back(charset_converter.convert(line));
-            }
-            else {
-                dls_lines.push_back(line);
-            }
-            // TODO handle the other charsets accordingly
+            dls_lines.push_back(line);
         }
     }
 
-    std::stringstream ss;
-    for (size_t i = 0; i < dls_lines.size(); i++) {
-        if (i != 0) {
+    if (dl_params.charset == DABCharset::UTF8)
+        dl_plus_tagger.tag(dls_lines, dl_state);
+    dl_state.dl_text = join_dl_lines(dls_lines, dl_params, dl_state.charset);
+    fit_dl_text(dl_state);
+    return true;
+}
+
+
+std::string DLSEncoder::join_dl_lines(std::vector<std::string>& dls_lines, const DL_PARAMS& dl_params, DABCharset& charset) {
+    std::string dl_text;
+    if (not dl_params.raw_dls && (dl_params.charset == DABCharset::UTF8 || dl_params.charset == DABCharset::UCS2_BE)) {
+        // as UTF-8, into the most compact charset for the whole label
+        std::string utf8_text;
+        for (size_t i = 0; i < dls_lines.size(); i++) {
+            if (i != 0)
+                utf8_text += '\n';
             if (dl_params.charset == DABCharset::UCS2_BE)
-                ss << '\0' << '\n';
+                utf8_text += charset_converter.convert_ucs2_be_to_utf8(dls_lines[i]);
             else
-                ss << '\n';
+                utf8_text += dls_lines[i];
+        }
+
+        // validated once, up to the first error, for both the selection and the conversion
+        const size_t valid_len = utf8_valid_prefix(utf8_text.data(), utf8_text.size());
+        charset = charset_converter.select_charset(utf8_text.data(), valid_len, true);
+        charset_converter.convert(utf8_text.data(), valid_len, charset, dl_text, true);
+    } else {
+        // Complete EBU Latin needs no conversion
+        charset = dl_params.raw_dls ? dl_params.charset : DABCharset::COMPLETE_EBU_LATIN;
+
+        std::stringstream ss;
+        for (size_t i = 0; i < dls_lines.size(); i++) {
+            if (i != 0) {
+                if (charset == DABCharset::UCS2_BE)
+                    ss << '\0' << '\n';
+                else
+                    ss << '\n';
+            }
+
+            // UCS-2 BE: if from file the first byte of \0\n remains, remove it
+            if (charset == DABCharset::UCS2_BE && dls_lines[i].size() % 2) {
+                dls_lines[i].resize(dls_lines[i].size() - 1);
+            }
+
+            ss << dls_lines[i];
         }
+        dl_text = ss.str();
+    }
+
+    return dl_text;
+}
+
+
+void DLSEncoder::fit_dl_text(DL_STATE& dl_state) {
+    /* Fit the text into as few segments as possible, working on characters
+     * of the charset (2 bytes for UCS-2 BE; for the others, spaces and line
+     * breaks are single bytes that are never part of another character). */
+    std::string& dl_text = dl_state.dl_text;
+    const DABCharset charset = dl_state.charset;
+    const size_t unit = charset == DABCharset::UCS2_BE ? 2 : 1;
+    auto char_at = [&](size_t pos) {
+        return unit == 2 ? (dl_text[pos] == '\0' ? dl_text[pos + 1] : '\xFF') : dl_text[pos];
+    };
+    auto segments = [](size_t len) {
+        len = std::min(len, MAXDLS);
+        return len / DLS_SEG_LEN_CHAR_MAX + (len % DLS_SEG_LEN_CHAR_MAX ? 1 : 0);
+    };
+    dl_text.resize(dl_text.size() - dl_text.size() % unit);
+
+    // spaces at the end of lines are not visible anyway; runs of spaces are
+    // collapsed, if that saves a segment or the text is too long otherwise.
+    // With DL Plus, only those at the end, as the tags refer to positions.
+    std::string trimmed;
+    std::string collapsed;
+    size_t spaces = 0;
+    for (size_t pos = 0; pos <= dl_text.size(); pos += unit) {
+        const bool end = pos == dl_text.size();
+        if (!end && char_at(pos) == ' ') {
+            spaces++;
+            continue;
+        }
+        if (!end && (char_at(pos) != '\n' || dl_state.dl_plus_enabled)) {
+            for (size_t i = 0; i < spaces; i++)
+                trimmed.append(dl_text, pos - (spaces - i) * unit, unit);
+            if (spaces)
+                collapsed.append(dl_text, pos - unit, unit);
+        }
+        spaces = 0;
+        if (!end) {
+            trimmed.append(dl_text, pos, unit);
+            collapsed.append(dl_text, pos, unit);
+        }
+    }
+    if (!dl_state.dl_plus_enabled && (segments(collapsed.size()) < segments(trimmed.size()) || trimmed.size() > MAXDLS))
+        dl_text.swap(collapsed);
+    else
+        dl_text.swap(trimmed);
+
+    if (dl_text.size() > MAXDLS) {
+        fprintf(stderr, "ODR-PadEnc Warning: oversized DLS text (%zu chars) had to be shortened\n", dl_text.size());
+
+        // not within a character
+        size_t len = MAXDLS - MAXDLS % unit;
+        if (charset == DABCharset::UTF8)
+            while (len > 0 && ((uint8_t) dl_text[len] & 0xC0) == 0x80)
+                len--;
+
+        // rather at a word boundary, if that takes as many segments
+        auto is_break = [&](size_t pos) {
+            return char_at(pos) == ' ' || char_at(pos) == '\n';
+        };
+        if (!is_break(len)) {
+            for (size_t pos = len; pos >= unit && segments(pos - unit) == segments(len); pos -= unit) {
+                if (is_break(pos - unit)) {
+                    len = pos - unit;
+                    break;
+                }
+            }
+        }
+        while (len >= unit && is_break(len - unit))
+            len -= unit;
+        dl_text.resize(len);
+    }
+}
+
 
-        // UCS-2 BE: if from file the first byte of \0\n remains, remove it
-        if (dl_params.charset == DABCharset::UCS2_BE && dls_lines[i].size() % 2) {
-            dls_lines[i].resize(dls_lines[i].size() - 1);
+bool DLSEncoder::parseLabelCached(const std::string& dls_file, const DL_PARAMS& dl_params, DL_STATE& dl_state) {
+    /* Re-use the previous result, if neither the file nor the parameters changed.
+     * FIFOs and other non-regular files are always read. */
+    FilePrefetcher::snapshot_t snapshot;
+    const bool prefetched = file_prefetcher && file_prefetcher->Get(dls_file, snapshot);
+    struct stat file_stat;
+    bool cacheable;
+    if (prefetched) {
+        file_stat = snapshot.file_stat;
+        cacheable = true;
+    } else {
+        cacheable = stat(dls_file.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode);
+    }
+    if (cacheable) {
+        std::map<std::string, dl_file_cache_entry_t>::const_iterator it = parsed_files.find(dls_file);
+        if (it != parsed_files.end() && it->second.Matches(file_stat, dl_params)) {
+            dl_state = it->second.dl_state;
+            return true;
         }
+    }
+    parsed_files.erase(dls_file);
 
-        ss << dls_lines[i];
+    if (prefetched) {
+        std::istringstream dls_stream(*snapshot.content);
+        if (!parseLabel(dls_stream, dl_params, dl_state))
+            return false;
+    } else if (!parseLabel(dls_file, dl_params, dl_state)) {
+        return false;
     }
 
-    dl_state.dl_text = ss.str();
-    if (dl_state.dl_text.size() > MAXDLS) {
-        fprintf(stderr, "ODR-PadEnc Warning: oversized DLS text (%zu chars) had to be shortened\n", dl_state.dl_text.size());
-        dl_state.dl_text.resize(MAXDLS);
+    /* A file modified in the last second may be changed again without a
+     * different mtime (coarse timestamps), so it is parsed again next time. */
+    if (cacheable && time(NULL) > file_stat.st_mtim.tv_sec + 1) {
+        dl_file_cache_entry_t& entry = parsed_files[dls_file];
+        entry.Set(file_stat, dl_params);
+        entry.dl_state = dl_state;
     }
 
     return true;
 }
 
 
+bool DLSEncoder::prefetch_file(const std::string& file, const DL_PARAMS& dl_params, FilePrefetcher* prefetcher, dl_file_cache_entry_t& entry) {
+    FilePrefetcher::snapshot_t snapshot;
+    const bool prefetched = prefetcher && prefetcher->Get(file, snapshot);
+    struct stat file_stat;
+    if (prefetched)
+        file_stat = snapshot.file_stat;
+    else if (stat(file.c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode))
+        return false;
+
+    // as parseLabelCached: the result of a freshly modified file would not be re-used
+    if (time(NULL) <= file_stat.st_mtim.tv_sec + 1)
+        return false;
+
+    entry.Set(file_stat, dl_params);
+    if (prefetched) {
+        std::istringstream dls_stream(*snapshot.content);
+        return parseLabel(dls_stream, dl_params, entry.dl_state);
+    }
+    return parseLabel(file, dl_params, entry.dl_state);
+}
+
+
+void DLSEncoder::prefetch(label_prefetch_t& job) {
+    job.ok = prefetch_file(job.dls_file, job.dl_params, job.file_prefetcher, job.dls_entry);
+    if (!job.ok)
+        return;
+
+    // the DL state as encodeLabel() and encodeState() derive it
+    DL_STATE dl_state = job.dls_entry.dl_state;
+    if (!job.item_state_file.empty()) {
+        job.ok = prefetch_file(job.item_state_file, DL_PARAMS(), job.file_prefetcher, job.item_entry);
+        if (!job.ok)
+            return;
+
+        dl_state.dl_plus_enabled = true;
+        dl_state.dl_plus_item_toggle = job.item_entry.dl_state.dl_plus_item_toggle;
+        dl_state.dl_plus_item_running = job.item_entry.dl_state.dl_plus_item_running;
+    }
+    if (dl_state.dl_plus_enabled && dl_state.dl_plus_tags.empty())
+        dl_state.dl_plus_tags.emplace_back();
+
+    job.dl_template = make_dl_template(dl_state, dl_state.charset, false);
+}
+
+
+void DLSEncoder::run_prefetch() {
+    ThreadPlacement::Global().EnterWorker();
+
+    std::unique_lock<std::mutex> lock(prefetch_mutex);
+    for (;;) {
+        prefetch_cond.wait(lock, [this]() {return prefetch_stop || !prefetch_jobs.empty();});
+        if (prefetch_stop)
+            return;
+
+        label_prefetch_t job = std::move(prefetch_jobs.front());
+        prefetch_jobs.pop_front();
+        prefetch_running++;
+
+        lock.unlock();
+        prefetch(job);
+        lock.lock();
+
+        prefetch_running--;
+        if (job.ok)
+            prefetch_results.push_back(std::move(job));
+        prefetch_done_cond.notify_all();
+    }
+}
+
+
+DLSEncoder::~DLSEncoder() {
+    {
+        std::lock_guard<std::mutex> lock(prefetch_mutex);
+        prefetch_stop = true;
+    }
+    prefetch_cond.notify_one();
+    if (prefetch_thread.joinable())
+        prefetch_thread.join();
+}
+
+
+void DLSEncoder::prefetchLabel(const std::string& dls_file, const char* item_state_file, const DL_PARAMS& dl_params) {
+    if (!dl_plus_tagger.empty())
+        return;
+
+    label_prefetch_t job;
+    job.dls_file = dls_file;
+    job.item_state_file = item_state_file ? item_state_file : "";
+    job.dl_params = dl_params;
+    job.file_prefetcher = file_prefetcher;
+    {
+        std::lock_guard<std::mutex> lock(prefetch_mutex);
+        prefetch_jobs.push_back(std::move(job));
+        if (!prefetch_thread.joinable())
+            prefetch_thread = std::thread(&DLSEncoder::run_prefetch, this);
+    }
+    prefetch_cond.notify_one();
+}
+
+
+void DLSEncoder::flushPrefetch() {
+    std::unique_lock<std::mutex> lock(prefetch_mutex);
+    prefetch_done_cond.wait(lock, [this]() {return prefetch_jobs.empty() && prefetch_running == 0;});
+}
+
+
+void DLSEncoder::adopt_prefetched() {
+    std::deque<label_prefetch_t> results;
+    {
+        std::lock_guard<std::mutex> lock(prefetch_mutex);
+        if (prefetch_results.empty())
+            return;
+        results.swap(prefetch_results);
+    }
+
+    for (label_prefetch_t& result : results) {
+        parsed_files[result.dls_file] = result.dls_entry;
+        if (!result.item_state_file.empty())
+            parsed_files[result.item_state_file] = result.item_entry;
+
+        const dl_template_t& dl_template = result.dl_template;
+        bool known = std::any_of(dl_templates.begin(), dl_templates.end(), [&](const dl_template_t& t) {
+            return t.charset == dl_template.charset && t.dl_state == dl_template.dl_state;
+        });
+        if (!known)
+            store_dl_template(std::move(result.dl_template));
+    }
+}
+
+
 void DLSEncoder::encodeLabel(const std::string& dls_file, const char* item_state_file, const DL_PARAMS& dl_params) {
+    PADENC_TRACE1(label_encode_begin, dls_file.c_str());
+    adopt_prefetched();
+
     DL_STATE dl_state;
-    if (!parseLabel(dls_file, dl_params, dl_state))
+    if (!parseLabelCached(dls_file, dl_params, dl_state))
         return;
 
     // if enabled, derive DL Plus Item Toggle/Running bits from separate file
     if (item_state_file) {
         DL_STATE item_state;
-        if (!parseLabel(item_state_file, DL_PARAMS(), item_state))
+        if (!parseLabelCached(item_state_file, DL_PARAMS(), item_state))
             return;
 
         dl_state.dl_plus_enabled = true;
@@ -260,6 +684,48 @@ void DLSEncoder::encodeLabel(const std::string& dls_file, const char* item_state
         dl_state.dl_plus_item_running = item_state.dl_plus_item_running;
     }
 
+    encodeState(dl_state, dl_params, false);
+}
+
+
+void DLSEncoder::encodeLabelContent(const std::string& content, const DL_PARAMS& dl_params, bool preempt) {
+    DL_STATE dl_state;
+    std::istringstream dls_stream(content);
+    if (parseLabel(dls_stream, dl_params, dl_state))
+        encodeState(dl_state, dl_params, preempt);
+}
+
+
+void DLSEncoder::encodeText(const std::string& text, const DL_PARAMS& dl_params, bool preempt) {
+    DL_STATE dl_state;
+    dl_state.dl_text = text;
+    encodeLabel(dl_state, dl_params, preempt);
+}
+
+
+void DLSEncoder::encodeLabel(const DL_STATE& dl_state, const DL_PARAMS& dl_params, bool preempt) {
+    if (dl_state != label_prev || dl_params.charset != label_params_prev.charset || dl_params.raw_dls != label_params_prev.raw_dls) {
+        std::vector<std::string> dls_lines;
+        std::istringstream text_stream(dl_state.dl_text);
+        std::string line;
+        while (std::getline(text_stream, line))
+            if (!line.empty())
+                dls_lines.push_back(line);
+
+        label_prev = dl_state;
+        label_params_prev = dl_params;
+        label_converted_prev = dl_state;
+        if (dl_params.charset == DABCharset::UTF8)
+            dl_plus_tagger.tag(dls_lines, label_converted_prev);
+        label_converted_prev.dl_text = join_dl_lines(dls_lines, dl_params, label_converted_prev.charset);
+        fit_dl_text(label_converted_prev);
+    }
+
+    encodeState(label_converted_prev, dl_params, preempt);
+}
+
+
+void DLSEncoder::encodeState(DL_STATE dl_state, const DL_PARAMS& dl_params, bool preempt) {
     // if DL Plus enabled, but no DL Plus tags were added, add the required DUMMY tag
     if (dl_state.dl_plus_enabled && dl_state.dl_plus_tags.empty())
         dl_state.dl_plus_tags.emplace_back();
@@ -267,25 +733,31 @@ void DLSEncoder::encodeLabel(const std::string& dls_file, const char* item_state
     // toggle the toggle bit only on new DL state
     bool dl_state_is_new = dl_state != dl_state_prev;
     if (verbose) {
-        fprintf(stderr, "ODR-PadEnc writing %s DLS text \"" ODR_COLOR_DL "%s" ODR_COLOR_RST "\"\n", dl_state_is_new ? "new" : "old", dl_state.dl_text.c_str());
+        PadLog::Global().Write(label_log, LogLevel::INFO, {{"new", dl_state_is_new}, {"bytes", (long long) dl_state.dl_text.size()}},
+                               "writing %s DLS text \"" ODR_COLOR_DL "%s" ODR_COLOR_RST "\"", dl_state_is_new ? "new" : "old", dl_state.dl_text.c_str());
         if (dl_state.dl_plus_enabled) {
-            fprintf(
-                    stderr, "ODR-PadEnc writing %s DL Plus tags (IT/IR: %d/%d): ",
-                    dl_state_is_new ? "new" : "old",
-                    dl_state.dl_plus_item_toggle ? 1 : 0,
-                    dl_state.dl_plus_item_running ? 1 : 0);
-            for (dl_plus_tags_t::const_iterator it = dl_state.dl_plus_tags.begin(); it != dl_state.dl_plus_tags.end(); it++) {
-                if (it != dl_state.dl_plus_tags.begin())
-                    fprintf(stderr, ", ");
+            char tags[4 * 32] = "";
+            size_t len = 0;
+            for (dl_plus_tags_t::const_iterator it = dl_state.dl_plus_tags.begin(); it != dl_state.dl_plus_tags.end() && len < sizeof(tags); it++) {
+                const char* separator = it != dl_state.dl_plus_tags.begin() ? ", " : "";
                 if (it->content_type == 0 && it->start_marker == 0 && it->length_marker == 0)
-                    fprintf(stderr, "(DUMMY)");
+                    len += snprintf(tags + len, sizeof(tags) - len, "%s(DUMMY)", separator);
                 else
-                    fprintf(stderr, "%d (S/L: %d/%d)", it->content_type, it->start_marker, it->length_marker);
+                    len += snprintf(tags + len, sizeof(tags) - len, "%s%d (S/L: %d/%d)", separator, it->content_type, it->start_marker, it->length_marker);
             }
-            fprintf(stderr, "\n");
+            PadLog::Global().Write(dl_plus_log, LogLevel::INFO, {{"tags", (long long) dl_state.dl_plus_tags.size()}},
+                                   "writing %s DL Plus tags (IT/IR: %d/%d): %s",
+                                   dl_state_is_new ? "new" : "old",
+                                   dl_state.dl_plus_item_toggle ? 1 : 0,
+                                   dl_state.dl_plus_item_running ? 1 : 0,
+                                   tags);
         }
     }
 
+    // the segments of the previous label not yet started are obsolete
+    if (preempt)
+        pad_packetizer->DropDGs(APPTYPE_START);
+
     DATA_GROUP *remove_label_dg = NULL;
     if (dl_state_is_new) {
         if (dl_params.remove_dls)
@@ -296,9 +768,11 @@ void DLSEncoder::encodeLabel(const std::string& dls_file, const char* item_state
         dl_state_prev = dl_state;
     }
 
-    prepend_dl_dgs(dl_state, dl_params.raw_dls ? dl_params.charset : DABCharset::COMPLETE_EBU_LATIN);
+    prepend_dl_dgs(dl_state, dl_state.charset, preempt);
     if (remove_label_dg)
-        pad_packetizer->AddDG(remove_label_dg, true);
+        pad_packetizer->AddDG(remove_label_dg, true, preempt);
+    dls_insertions_metric().Add();
+    PADENC_TRACE3(label_encode_end, dl_state.dl_text.size(), (int) dl_state.charset, pad_packetizer->QueuedDGs(APPTYPE_START));
 }
 
 
@@ -308,20 +782,18 @@ int DLSEncoder::dls_count(const std::string& text) {
 }
 
 
-DATA_GROUP* DLSEncoder::dls_get(const std::string& text, DABCharset charset, int seg_index) {
+void DLSEncoder::dls_segment_data(const std::string& text, DABCharset charset, int seg_index, bool toggle, uint8_vector_t& seg_data) {
     bool first_seg = seg_index == 0;
     bool last_seg  = seg_index == dls_count(text) - 1;
 
     int seg_text_offset = seg_index * DLS_SEG_LEN_CHAR_MAX;
     const char *seg_text_start = text.c_str() + seg_text_offset;
     size_t seg_text_len = std::min(text.size() - seg_text_offset, DLS_SEG_LEN_CHAR_MAX);
-
-    DATA_GROUP* dg = new DATA_GROUP(DLS_SEG_LEN_PREFIX + seg_text_len, APPTYPE_START, APPTYPE_CONT);
-    uint8_vector_t &seg_data = dg->data;
+    seg_data.resize(DLS_SEG_LEN_PREFIX + seg_text_len);
 
     // prefix: toggle? + first seg? + last seg? + (seg len - 1)
     seg_data[0] =
-            (dls_toggle ? (1 << 7) : 0) +
+            (toggle     ? (1 << 7) : 0) +
             (first_seg  ? (1 << 6) : 0) +
             (last_seg   ? (1 << 5) : 0) +
             (seg_text_len - 1);
@@ -332,39 +804,148 @@ DATA_GROUP* DLSEncoder::dls_get(const std::string& text, DABCharset charset, int
     // character field
     memcpy(&seg_data[DLS_SEG_LEN_PREFIX], seg_text_start, seg_text_len);
 
-    // CRC
-    dg->AppendCRC();
-
 #ifdef DEBUG
     fprintf(stderr, "DL segment:");
     for (const uint8_t& b : seg_data)
         fprintf(stderr, " %02x", b);
     fprintf(stderr, "\n");
 #endif
-    return dg;
 }
 
 
-void DLSEncoder::prepend_dl_dgs(const DL_STATE& dl_state, DABCharset charset) {
-    // process all DL segments
+dl_template_t DLSEncoder::make_dl_template(const DL_STATE& dl_state, DABCharset charset, bool toggle) {
+    dl_template_t dl_template;
+    dl_template.dl_state = dl_state;
+    dl_template.charset = charset;
+    dl_template.toggle = toggle;
+
+    // all DL segments and, if enabled, the DL Plus data group
     int seg_count = dls_count(dl_state.dl_text);
+    size_t dg_count = seg_count + (dl_state.dl_plus_enabled ? 1 : 0);
+    dl_template.segs.resize(dg_count);
+    for (size_t i = 0; i < dg_count; i++) {
+        dl_segment_template_t& seg = dl_template.segs[i];
+
+        // the DL Plus DG also has the toggle bit as link bit
+        bool dl_plus = (int) i == seg_count;
+        if (dl_plus)
+            dl_plus_data(dl_state, toggle, seg.data);
+        else
+            dls_segment_data(dl_state.dl_text, charset, i, toggle, seg.data);
+        seg.toggle_mask[0] = 1 << 7;
+        seg.toggle_mask[1] = dl_plus ? (1 << 7) : 0;
+
+        // CRC for the other toggle bit value, so that it can be patched without recalculation
+        uint8_vector_t toggled(seg.data);
+        toggled[0] ^= seg.toggle_mask[0];
+        toggled[1] ^= seg.toggle_mask[1];
+        seg.crc_toggled = ~odr::crc16(0xFFFF, toggled.data(), toggled.size());
+
+        uint16_t crc = ~odr::crc16(0xFFFF, seg.data.data(), seg.data.size());
+        seg.data.push_back((crc & 0xFF00) >> 8);
+        seg.data.push_back((crc & 0x00FF));
+    }
+    return dl_template;
+}
+
+
+void DLSEncoder::store_dl_template(dl_template_t&& dl_template) {
+    dl_templates.push_front(std::move(dl_template));
+    if (dl_templates.size() > max_templates)
+        dl_templates.pop_back();
+}
+
+
+bool DLSEncoder::prepend_dl_template(const DL_STATE& dl_state, DABCharset charset, bool preempt) {
+    std::list<dl_template_t>::iterator it;
+    for (it = dl_templates.begin(); it != dl_templates.end(); it++)
+        if (it->charset == charset && it->dl_state == dl_state)
+            break;
+    if (it == dl_templates.end())
+        return false;
+    dl_templates.splice(dl_templates.begin(), dl_templates, it);
+
+    // re-emit the stored bytes, only patching the toggle bit if needed
+    bool patch_toggle = it->toggle != dls_toggle;
     std::vector<DATA_GROUP*> segs;
-    for (int seg_index = 0; seg_index < seg_count; seg_index++) {
-#ifdef DEBUG
-        fprintf(stderr, "Segment number %d\n", seg_index + 1);
-#endif
-        segs.push_back(dls_get(dl_state.dl_text, charset, seg_index));
+    segs.reserve(it->segs.size());
+    for (const dl_segment_template_t& seg : it->segs) {
+        DATA_GROUP* dg = pad_packetizer->CreateDataGroup(seg.data.size() - 2, APPTYPE_START, APPTYPE_CONT);
+        dg->data.assign(seg.data.begin(), seg.data.end());
+        if (patch_toggle) {
+            dg->data[0] ^= seg.toggle_mask[0];
+            dg->data[1] ^= seg.toggle_mask[1];
+            dg->data[dg->data.size() - 2] = (seg.crc_toggled & 0xFF00) >> 8;
+            dg->data[dg->data.size() - 1] = (seg.crc_toggled & 0x00FF);
+        }
+        segs.push_back(dg);
     }
 
-    // if enabled, add DL Plus data group
-    if (dl_state.dl_plus_enabled)
-        segs.push_back(createDynamicLabelPlus(dl_state));
+    pad_packetizer->AddDGs(segs, true, preempt);
+    return true;
+}
+
 
-    // prepend to packetizer
-    pad_packetizer->AddDGs(segs, true);
+std::vector<DATA_GROUP*> DLSEncoder::labelDGs(PADPacketizer* packetizer, int dl_plus) const {
+    std::vector<DATA_GROUP*> dgs;
+    if (dl_state_prev.dl_text.empty())
+        return dgs;
+
+    DL_STATE dl_state = dl_state_prev;
+    if (dl_plus >= 0)
+        dl_state.dl_plus_enabled = dl_plus;
+    if (dl_state.dl_plus_enabled && dl_state.dl_plus_tags.empty())
+        dl_state.dl_plus_tags.emplace_back();   // the DUMMY tag, as by encodeState()
+
+    for (const dl_segment_template_t& seg : make_dl_template(dl_state, dl_state.charset, dls_toggle).segs) {
+        DATA_GROUP* dg = packetizer->CreateDataGroup(seg.data.size() - 2, APPTYPE_START, APPTYPE_CONT);
+        dg->data.assign(seg.data.begin(), seg.data.end());
+        dgs.push_back(dg);
+    }
+    return dgs;
+}
+
+
+void DLSEncoder::prepend_dl_dgs(const DL_STATE& dl_state, DABCharset charset, bool preempt) {
+    // the DGs are always emitted from the (kept) bytes
+    if (!prepend_dl_template(dl_state, charset, preempt)) {
+        store_dl_template(make_dl_template(dl_state, charset, dls_toggle));
+        prepend_dl_template(dl_state, charset, preempt);
+    }
 
 #ifdef DEBUG
     fprintf(stderr, "DLS text: %s\n", dl_state.dl_text.c_str());
-    fprintf(stderr, "Number of DL segments: %d\n", seg_count);
+    fprintf(stderr, "Number of DL segments: %d\n", dls_count(dl_state.dl_text));
 #endif
 }
+
+
+// --- DLSCarousel -----------------------------------------------------------------
+void DLSCarousel::Add(const std::string& dls_file, int weight) {
+    label_t label;
+    label.dls_file = dls_file;
+    label.weight = std::max(weight, 1);
+    labels.push_back(label);
+}
+
+
+void DLSCarousel::Start(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::duration interval) {
+    this->interval = interval;
+    Select(0, now);
+}
+
+
+void DLSCarousel::Select(size_t index, std::chrono::steady_clock::time_point now) {
+    current = index;
+    next_switch = now + labels[current].weight * interval;
+}
+
+
+bool DLSCarousel::Advance(std::chrono::steady_clock::time_point now) {
+    if (labels.size() < 2 || now < next_switch)
+        return false;
+
+    current = (current + 1) % labels.size();
+    next_switch += labels[current].weight * interval;
+    return true;
+}
@@ -30,12 +30,23 @@
 #ifndef DLS_H_
 #define DLS_H_
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "common.h"
 #include "pad_common.h"
 #include "charset.h"
+#include "file_prefetcher.h"
 
 
 // DL/DL+ commands
@@ -93,6 +104,7 @@ typedef std::vector<DL_PLUS_TAG> dl_plus_tags_t;
 // --- DL_STATE -----------------------------------------------------------------
 struct DL_STATE {
     std::string dl_text;
+    DABCharset charset;         // of dl_text, once joined/converted
 
     bool dl_plus_enabled;
     bool dl_plus_item_toggle;
@@ -100,6 +112,7 @@ struct DL_STATE {
     dl_plus_tags_t dl_plus_tags;
 
     DL_STATE() :
+        charset(DABCharset::COMPLETE_EBU_LATIN),
         dl_plus_enabled(false),
         dl_plus_item_toggle(false),
         dl_plus_item_running(false)
@@ -108,6 +121,8 @@ struct DL_STATE {
     bool operator==(const DL_STATE& other) const {
         if (dl_text != other.dl_text)
             return false;
+        if (charset != other.charset)
+            return false;
         if (dl_plus_enabled != other.dl_plus_enabled)
             return false;
         if (dl_plus_enabled) {
@@ -126,6 +141,102 @@ struct DL_STATE {
 };
 
 
+// --- dl_file_cache_entry_t -----------------------------------------------------------------
+/*! A parsed DLS (or item state) file, together with the file attributes and
+ * parameters it was parsed with.
+ */
+struct dl_file_cache_entry_t {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    bool raw_dls = false;
+    DABCharset charset = DABCharset::COMPLETE_EBU_LATIN;
+
+    DL_STATE dl_state;
+
+    bool Matches(const struct stat& file_stat, const DL_PARAMS& dl_params) const {
+        return dev == file_stat.st_dev &&
+                ino == file_stat.st_ino &&
+                size == file_stat.st_size &&
+                mtime.tv_sec == file_stat.st_mtim.tv_sec &&
+                mtime.tv_nsec == file_stat.st_mtim.tv_nsec &&
+                raw_dls == dl_params.raw_dls &&
+                charset == dl_params.charset;
+    }
+    void Set(const struct stat& file_stat, const DL_PARAMS& dl_params) {
+        dev = file_stat.st_dev;
+        ino = file_stat.st_ino;
+        size = file_stat.st_size;
+        mtime = file_stat.st_mtim;
+        raw_dls = dl_params.raw_dls;
+        charset = dl_params.charset;
+    }
+};
+
+
+// --- dl_segment_template_t -----------------------------------------------------------------
+/*! The complete data (incl. CRC) of a DL segment or DL Plus data group,
+ * as built for a certain toggle bit value.
+ */
+struct dl_segment_template_t {
+    uint8_vector_t data;
+    uint8_t toggle_mask[2];     // toggle bits within the first two bytes
+    uint16_t crc_toggled;       // the CRC for the other toggle bit value
+};
+
+
+// --- dl_template_t -----------------------------------------------------------------
+/*! All data groups of a DL state, to re-insert an unchanged label from
+ * stored bytes.
+ */
+struct dl_template_t {
+    DL_STATE dl_state;
+    DABCharset charset = DABCharset::COMPLETE_EBU_LATIN;
+    bool toggle = false;
+    std::vector<dl_segment_template_t> segs;
+};
+
+
+// --- DLPlusTagger -----------------------------------------------------------------
+/*! Derives DL Plus tags from labels in now-playing formats such as
+ * "{artist} - {title}", so that they need not be given in the DLS file.
+ * Fields are ITEM content types by name (title, album, tracknumber, artist,
+ * composition, movement, conductor, composer, band, comment, genre), or *
+ * for text not to be tagged; the text between two fields separates them.
+ * The formats are parsed once. The first label line matching any of them
+ * (the one that matched last tried first) is tagged; the tags of the last
+ * label are kept, as a label is mostly encoded again unchanged.
+ */
+class DLPlusTagger {
+private:
+    struct format_t {
+        std::vector<std::string> literals;  // before/between/after the fields
+        std::vector<int> content_types;     // per field; -1: not tagged
+    };
+
+    std::vector<format_t> formats;
+    size_t last_format;
+    std::vector<std::string> last_lines;
+    dl_plus_tags_t last_tags;
+    std::string item_line;      // of the current item
+    bool item_toggle;
+
+    static bool match(const format_t& format, const std::string& line, int line_start, dl_plus_tags_t& tags);
+public:
+    DLPlusTagger() : last_format(0), item_toggle(false) {}
+
+    // false (with a warning), if the format is invalid
+    bool addFormat(const std::string& format);
+    bool empty() const { return formats.empty(); }
+    /*! tags a label without DL Plus from its (UTF-8) lines, with the markers
+     *  counting characters, and toggles the item bit on a new item; false,
+     *  if no line matches
+     */
+    bool tag(const std::vector<std::string>& dls_lines, DL_STATE& dl_state);
+};
+
+
 // --- DLSEncoder -----------------------------------------------------------------
 class DLSEncoder {
 private:
@@ -134,29 +245,160 @@ private:
     static const size_t DLS_SEG_LEN_CHAR_MAX;
     static const std::string DL_PARAMS_OPEN;
     static const std::string DL_PARAMS_CLOSE;
+    static const size_t MAXTEMPLATES;
+
+    // a label to be parsed and built in the background, and the result
+    struct label_prefetch_t {
+        std::string dls_file;
+        std::string item_state_file;    // empty, if none
+        DL_PARAMS dl_params;
+        FilePrefetcher* file_prefetcher;
+
+        bool ok = false;
+        dl_file_cache_entry_t dls_entry;
+        dl_file_cache_entry_t item_entry;
+        dl_template_t dl_template;
+    };
 
     DATA_GROUP* createDynamicLabelCommand(uint8_t command);
-    DATA_GROUP* createDynamicLabelPlus(const DL_STATE& dl_state);
+    static void dl_plus_data(const DL_STATE& dl_state, bool toggle, uint8_vector_t& seg_data);
     bool parse_dl_param_bool(const std::string &key, const std::string &value, bool &target);
     bool parse_dl_param_int_dl_plus_tag(const std::string &key, const std::string &value, int &target);
-    void parse_dl_params(std::ifstream &dls_fstream, DL_STATE &dl_state);
-    int dls_count(const std::string& text);
-    DATA_GROUP* dls_get(const std::string& text, DABCharset charset, int seg_index);
-    void prepend_dl_dgs(const DL_STATE& dl_state, DABCharset charset);
+    void parse_dl_params(std::istream &dls_fstream, DL_STATE &dl_state);
+    static int dls_count(const std::string& text);
+    static void dls_segment_data(const std::string& text, DABCharset charset, int seg_index, bool toggle, uint8_vector_t& seg_data);
+    void prepend_dl_dgs(const DL_STATE& dl_state, DABCharset charset, bool preempt);
+    // all DGs of a DL state (incl. CRC), as built for the given toggle bit value
+    static dl_template_t make_dl_template(const DL_STATE& dl_state, DABCharset charset, bool toggle);
+    void store_dl_template(dl_template_t&& dl_template);
+    bool prepend_dl_template(const DL_STATE& dl_state, DABCharset charset, bool preempt);
+    std::string join_dl_lines(std::vector<std::string>& dls_lines, const DL_PARAMS& dl_params, DABCharset& charset);
+    void fit_dl_text(DL_STATE& dl_state);
+    void encodeState(DL_STATE dl_state, const DL_PARAMS& dl_params, bool preempt);
 
     PADPacketizer* pad_packetizer;
     CharsetConverter charset_converter;
+    DLPlusTagger dl_plus_tagger;
     bool dls_toggle;
     DL_STATE dl_state_prev;
+    std::map<std::string, dl_file_cache_entry_t> parsed_files;
+    FilePrefetcher* file_prefetcher;
+    std::list<dl_template_t> dl_templates;      // most recently used first
+    size_t max_templates;
+
+    std::deque<label_prefetch_t> prefetch_jobs;
+    std::deque<label_prefetch_t> prefetch_results;
+    size_t prefetch_running;
+    bool prefetch_stop;
+    std::mutex prefetch_mutex;
+    std::condition_variable prefetch_cond;
+    std::condition_variable prefetch_done_cond;
+    std::thread prefetch_thread;
+
+    // the last label given as DL state, before and after joining/converting its text
+    DL_STATE label_prev;
+    DL_PARAMS label_params_prev;
+    DL_STATE label_converted_prev;
 
     bool parseLabel(const std::string& dls_file, const DL_PARAMS& dl_params, DL_STATE& dl_state);
+    bool parseLabel(std::istream& dls_fstream, const DL_PARAMS& dl_params, DL_STATE& dl_state);
+    bool parseLabelCached(const std::string& dls_file, const DL_PARAMS& dl_params, DL_STATE& dl_state);
+    // parses a file that may be cached (as parseLabelCached), into entry; false, if not
+    bool prefetch_file(const std::string& file, const DL_PARAMS& dl_params, FilePrefetcher* prefetcher, dl_file_cache_entry_t& entry);
+    void prefetch(label_prefetch_t& job);
+    void run_prefetch();
+    // takes over the labels prefetched meanwhile into the caches
+    void adopt_prefetched();
 public:
     static const int APPTYPE_START;
     static const int APPTYPE_CONT;
     static const std::string REQUEST_REREAD_SUFFIX;
 
-    DLSEncoder(PADPacketizer* pad_packetizer) : pad_packetizer(pad_packetizer), dls_toggle(false) {}
+    DLSEncoder(PADPacketizer* pad_packetizer) :
+        pad_packetizer(pad_packetizer), dls_toggle(false), file_prefetcher(nullptr), max_templates(MAXTEMPLATES),
+        prefetch_running(0), prefetch_stop(false) {}
+    ~DLSEncoder();
+    DLSEncoder(const DLSEncoder&) = delete;
+    DLSEncoder& operator=(const DLSEncoder&) = delete;
+
     void encodeLabel(const std::string& dls_file, const char* item_state_file, const DL_PARAMS& dl_params);
+    /*! has a label that is to be encoded soon (e.g. the next one of the
+     *  rotation) read, parsed and its DGs built in a background thread, so
+     *  that encodeLabel() later only re-emits them. Not done with DL Plus
+     *  formats, as their tagging depends on the labels encoded before.
+     */
+    void prefetchLabel(const std::string& dls_file, const char* item_state_file, const DL_PARAMS& dl_params);
+    // waits for the labels to be prefetched so far, e.g. in tests
+    void flushPrefetch();
+    /*! encodes a label from a text (lines separated by newlines) instead of a
+     *  file; if preempt, the label interrupts any other PAD data, e.g. for
+     *  emergency messages, and replaces the previous label at once
+     */
+    void encodeText(const std::string& text, const DL_PARAMS& dl_params, bool preempt);
+    /*! encodes a label given like the content of a DLS file (incl. any DL Plus
+     *  parameters), e.g. received over the control socket; preempt as above
+     */
+    void encodeLabelContent(const std::string& content, const DL_PARAMS& dl_params, bool preempt);
+    /*! encodes a label from a DL state (the text as in a DLS file, i.e. not yet
+     *  converted, and the DL Plus tags/flags) without any file; a label equal
+     *  to the previous one is not converted again
+     */
+    void encodeLabel(const DL_STATE& dl_state, const DL_PARAMS& dl_params, bool preempt = false);
+    // derives the DL Plus tags of UTF-8 labels without any from this format
+    bool addDLPlusFormat(const std::string& format) { return dl_plus_tagger.addFormat(format); }
+    // keeps the data groups of at least the given number of labels
+    void reserveTemplates(size_t labels) { max_templates = std::max(MAXTEMPLATES, labels); }
+    // takes the DLS files from the prefetcher, if already read there, instead of reading them
+    void setFilePrefetcher(FilePrefetcher* prefetcher) { file_prefetcher = prefetcher; }
+
+    // the toggle bit and the DL state last sent, e.g. to be replicated to a standby instance
+    bool getToggle() const { return dls_toggle; }
+    const DL_STATE& getState() const { return dl_state_prev; }
+    /*! continues with the toggle bit and DL state of another instance, so
+     *  that receivers see the same label as unchanged
+     */
+    void restoreState(bool toggle, const DL_STATE& dl_state) { dls_toggle = toggle; dl_state_prev = dl_state; }
+    /*! the DGs of the label last sent, as inserted again, created on another
+     *  packetizer (e.g. a dry-run copy, see PADPacketizer::DryRunCopy) - with
+     *  (1) or without (0) DL Plus data, or as sent (-1); none, if no label was sent yet
+     */
+    std::vector<DATA_GROUP*> labelDGs(PADPacketizer* packetizer, int dl_plus) const;
+};
+
+
+// --- DLSCarousel -----------------------------------------------------------------
+/*! Schedules the rotation through several DLS files: each file stays the
+ * current one for its weight times the label interval. Advancing is O(1),
+ * regardless of the number of files.
+ */
+class DLSCarousel {
+private:
+    struct label_t {
+        std::string dls_file;
+        int weight;
+    };
+
+    std::vector<label_t> labels;
+    std::chrono::steady_clock::duration interval;
+    size_t current;
+    std::chrono::steady_clock::time_point next_switch;
+public:
+    DLSCarousel() : interval(0), current(0) {}
+
+    void Add(const std::string& dls_file, int weight);
+    size_t Count() const { return labels.size(); }
+    size_t CurrentIndex() const { return current; }
+    const std::string& Current() const { return labels[current].dls_file; }
+    // the file after the current one, and when it is switched to
+    const std::string& Next() const { return labels[(current + 1) % labels.size()].dls_file; }
+    std::chrono::steady_clock::time_point NextSwitch() const { return next_switch; }
+
+    // starts with the first file
+    void Start(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::duration interval);
+    // switches to the given file, e.g. due to a re-read request
+    void Select(size_t index, std::chrono::steady_clock::time_point now);
+    // switches to the next file, if due; returns whether it switched
+    bool Advance(std::chrono::steady_clock::time_point now);
 };
 
 #endif /* DLS_H_ */
@@ -4,12 +4,17 @@
 */
 
 #include "enhanced_mot.h"
+#include "slide_codec.h"
+#include "crc.h"
 #include <filesystem>
 #include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <iterator>
 #include <cmath>
+#include <cstdio>
+#include <cinttypes>
 #ifdef HAVE_IMAGEMAGICK
 #include <Magick++.h>
 #endif
@@ -22,8 +27,13 @@ using namespace std::chrono;
 
 namespace StreamDAB {
 
+const size_t EnhancedMOTProcessor::PENDING_IMAGES_LEN = 16;
+const size_t EnhancedMOTProcessor::TRANSCODE_CACHE_LEN = 200;
+const std::chrono::milliseconds EnhancedMOTProcessor::DETECT_INTERVAL(200);
+
 EnhancedMOTProcessor::EnhancedMOTProcessor(const CarouselConfig& config) 
-    : config_(config) {
+    : config_(config),
+      snapshot_(std::make_shared<const CacheSnapshot>()) {
 #ifdef HAVE_IMAGEMAGICK
     // Initialize Magick++
     try {
@@ -67,10 +77,10 @@ ImageFormat EnhancedMOTProcessor::DetectImageFormat(const std::string& filepath)
     return ImageFormat::UNKNOWN;
 }
 
-std::string EnhancedMOTProcessor::CalculateImageHash(const std::vector<uint8_t>& data) {
+std::string EnhancedMOTProcessor::CalculateImageHash(const uint8_t* data, size_t len) {
 #ifdef HAVE_OPENSSL
     unsigned char hash[MD5_DIGEST_LENGTH];
-    MD5(data.data(), data.size(), hash);
+    MD5(data, len, hash);
     
     std::ostringstream ss;
     for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
@@ -79,7 +89,7 @@ std::string EnhancedMOTProcessor::CalculateImageHash(const std::vector<uint8_t>&
     return ss.str();
 #else
     // Simple hash fallback without OpenSSL
-    size_t hash = std::hash<std::string>{}(std::string(data.begin(), data.end()));
+    size_t hash = std::hash<std::string>{}(std::string(data, data + len));
     std::ostringstream ss;
     ss << std::hex << hash;
     return ss.str();
@@ -87,41 +97,91 @@ std::string EnhancedMOTProcessor::CalculateImageHash(const std::vector<uint8_t>&
 }
 
 ImageQuality EnhancedMOTProcessor::AnalyzeImageQuality(const std::vector<uint8_t>& image_data) {
+#if HAVE_LIBJPEG || defined(HAVE_IMAGEMAGICK)
+    // Thumbnail size analysed (instead of the full resolution image)
+    static const size_t THUMBNAIL_WIDTH = 80;
+    static const size_t THUMBNAIL_HEIGHT = 60;
+#endif
+    static const size_t QUALITY_CACHE_LEN = 1000;
+
+    const std::string hash = CalculateImageHash(image_data.data(), image_data.size());
+    {
+        std::lock_guard<std::mutex> lock(quality_mutex_);
+        auto cached = quality_cache_.find(hash);
+        if (cached != quality_cache_.end()) {
+            return cached->second;
+        }
+    }
+
     ImageQuality quality;
-    
+    bool analyzed = false;
+
+#if HAVE_LIBJPEG
+    // JPEG/PNG: decode a DCT scaled thumbnail and analyse it directly
+    SlideCodec::Format format = SlideCodec::DetectFormat(image_data.data(), image_data.size());
+    rgb_image_t decoded;
+    if (SlideCodec::Supported(format) &&
+        SlideCodec::Decode(format, image_data.data(), image_data.size(), THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT, decoded)) {
+        rgb_image_t thumbnail;
+        size_t width = std::min(decoded.width, THUMBNAIL_WIDTH);
+        size_t height = std::max<size_t>(decoded.height * width / std::max<size_t>(decoded.width, 1), 1);
+        SlideCodec::Downscale(decoded, width, height, thumbnail);
+
+        image_stats_t stats = SlideCodec::Analyze(thumbnail);
+        quality.sharpness = stats.sharpness;
+        quality.contrast = stats.contrast;
+        quality.brightness = stats.brightness;
+        analyzed = true;
+    }
+#endif
+
 #ifdef HAVE_IMAGEMAGICK
-    try {
-        // Create image from data
-        Magick::Blob blob(image_data.data(), image_data.size());
-        Magick::Image image(blob);
-        
-        // Calculate sharpness using Laplacian variance
-        Magick::Image temp_image = image;
-        temp_image.edge(1.0);
-        quality.sharpness = temp_image.statistics().mean.quantum;
-        
-        // Calculate contrast using standard deviation
-        auto stats = image.statistics();
-        quality.contrast = stats.standard_deviation.quantum;
-        
-        // Calculate brightness using mean luminance
-        quality.brightness = stats.mean.quantum;
-        
-    } catch (const std::exception& e) {
-        std::cerr << "Error analyzing image quality: " << e.what() << std::endl;
+    if (!analyzed) {
+        try {
+            // Create image from data, reduced to a thumbnail
+            Magick::Blob blob(image_data.data(), image_data.size());
+            Magick::Image image(blob);
+            image.sample(Magick::Geometry(THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT));
+
+            // Calculate sharpness using Laplacian variance
+            Magick::Image temp_image = image;
+            temp_image.edge(1.0);
+            quality.sharpness = temp_image.statistics().mean.quantum;
+
+            // Calculate contrast using standard deviation
+            auto stats = image.statistics();
+            quality.contrast = stats.standard_deviation.quantum;
+
+            // Calculate brightness using mean luminance
+            quality.brightness = stats.mean.quantum;
+            analyzed = true;
+
+        } catch (const std::exception& e) {
+            std::cerr << "Error analyzing image quality: " << e.what() << std::endl;
+        }
     }
-#else
-    // Simple quality estimation without ImageMagick
-    quality.sharpness = 0.7; // Default reasonable values
-    quality.contrast = 0.6;
-    quality.brightness = 0.5;
 #endif
-    
+
+    if (!analyzed) {
+        // Simple quality estimation without image decoding
+        quality.sharpness = 0.7; // Default reasonable values
+        quality.contrast = 0.6;
+        quality.brightness = 0.5;
+    }
+
     // Initialize freshness score
     quality.freshness_score = 1.0;
     quality.last_used = system_clock::now();
     quality.usage_count = 0;
-    
+
+    {
+        std::lock_guard<std::mutex> lock(quality_mutex_);
+        if (quality_cache_.size() >= QUALITY_CACHE_LEN) {
+            quality_cache_.clear();
+        }
+        quality_cache_[hash] = quality;
+    }
+
     return quality;
 }
 
@@ -256,10 +316,15 @@ bool EnhancedMOTProcessor::ConvertToProgressiveJPEG(const Magick::Image& image,
         return false;
     }
 }
+#endif
 
 bool EnhancedMOTProcessor::OptimizeImage(const std::string& input_path, 
                                          std::vector<uint8_t>& output_data, 
-                                         ImageFormat target_format) {
+                                         ImageFormat target_format,
+                                         size_t max_size) {
+#ifdef HAVE_IMAGEMAGICK
+    static const int MIN_QUALITY = 40;
+    
     try {
         Magick::Image image;
         image.read(input_path);
@@ -272,20 +337,44 @@ bool EnhancedMOTProcessor::OptimizeImage(const std::string& input_path,
             ImageOptimizer::ResizeImage(image, 320, 240);
         }
         
-        // Convert to target format
+        // Convert to target format, lowering the quality until the size budget is met
         switch (target_format) {
             case ImageFormat::WEBP:
-                return ConvertToWebP(image, output_data, 80);
+                for (int quality = 80; ; quality -= 10) {
+                    if (!ConvertToWebP(image, output_data, quality)) {
+                        return false;
+                    }
+                    if (output_data.size() <= max_size || quality <= MIN_QUALITY) {
+                        return true;
+                    }
+                }
             case ImageFormat::HEIF:
-                return ConvertToHEIF(image, output_data, 80);
+                for (int quality = 80; ; quality -= 10) {
+                    if (!ConvertToHEIF(image, output_data, quality)) {
+                        return false;
+                    }
+                    if (output_data.size() <= max_size || quality <= MIN_QUALITY) {
+                        return true;
+                    }
+                }
             case ImageFormat::JPEG:
                 if (config_.enable_progressive_jpeg) {
-                    return ConvertToProgressiveJPEG(image, output_data, 85);
+                    for (int quality = 85; ; quality -= 10) {
+                        if (!ConvertToProgressiveJPEG(image, output_data, quality)) {
+                            return false;
+                        }
+                        if (output_data.size() <= max_size || quality <= MIN_QUALITY) {
+                            return true;
+                        }
+                    }
                 } else {
                     image.format("JPEG");
                     image.quality(85);
                 }
                 break;
+            case ImageFormat::PNG:
+                image.format("PNG");
+                break;
             default:
                 // Keep original format
                 break;
@@ -306,6 +395,122 @@ bool EnhancedMOTProcessor::OptimizeImage(const std::string& input_path,
         std::cerr << "Error optimizing image " << input_path << ": " << e.what() << std::endl;
         return false;
     }
+#else
+    std::cerr << "Image optimization not compiled in" << std::endl;
+    return false;
+#endif
+}
+
+bool EnhancedMOTProcessor::FormatSupported(ImageFormat format) {
+    switch (format) {
+#ifdef HAVE_IMAGEMAGICK
+        case ImageFormat::JPEG:
+        case ImageFormat::PNG:
+        case ImageFormat::WEBP:
+            return true;
+#endif
+#ifdef HAVE_HEIF
+        case ImageFormat::HEIF:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+std::string EnhancedMOTProcessor::TranscodeKey(uint64_t source_hash, ImageFormat format, size_t max_size, bool progressive) {
+    static const char* const FORMAT_NAMES[] = {"jpeg", "png", "webp", "heif", "unknown"};
+    
+    char key[64];
+    snprintf(key, sizeof(key), "%016" PRIx64 "_%s%s_%zu", source_hash,
+             FORMAT_NAMES[static_cast<int>(format)], format == ImageFormat::JPEG && progressive ? "p" : "", max_size);
+    return key;
+}
+
+slide_blob_t EnhancedMOTProcessor::Transcode(const std::string& input_path, uint64_t source_hash, ImageFormat target_format) {
+    const std::string key = TranscodeKey(source_hash, target_format, config_.max_image_size, config_.enable_progressive_jpeg);
+    
+    // Take the result of an earlier (or concurrent) transcode of the same content
+    std::promise<slide_blob_t> promise;
+    std::shared_future<slide_blob_t> earlier;
+    {
+        std::lock_guard<std::mutex> lock(transcode_mutex_);
+        auto cached = transcode_cache_.find(key);
+        if (cached != transcode_cache_.end()) {
+            earlier = cached->second;
+        } else {
+            if (transcode_cache_.size() >= TRANSCODE_CACHE_LEN) {
+                // forget the finished transcodes (the images in use keep their data)
+                for (auto it = transcode_cache_.begin(); it != transcode_cache_.end(); ) {
+                    if (it->second.wait_for(seconds(0)) == std::future_status::ready) {
+                        it = transcode_cache_.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+            transcode_cache_[key] = promise.get_future().share();
+        }
+    }
+    if (earlier.valid()) {
+        return earlier.get();
+    }
+    
+    // held by another processor (or content item) already
+    slide_blob_t result = SlideBlobStore::Global().FindRendition(key);
+    const std::string cache_path = config_.transcode_cache_dir.empty() ? "" : config_.transcode_cache_dir + "/" + key;
+    if (!result && !cache_path.empty()) {
+        std::shared_ptr<const MappedFile> file = MappedFile::Open(cache_path, true);
+        if (file && file->Size()) {
+            result = std::make_shared<const SlideBlob>(file, 0, file->Size());
+        }
+    }
+    
+    if (!result) {
+        std::vector<uint8_t> output_data;
+        if (OptimizeImage(input_path, output_data, target_format, config_.max_image_size)) {
+            if (!cache_path.empty()) {
+                // replace by renaming, as the file may be mapped
+                const std::string temp_path = cache_path + ".tmp";
+                std::ofstream cache_file(temp_path, std::ios::binary);
+                cache_file.write(reinterpret_cast<const char*>(output_data.data()), output_data.size());
+                cache_file.close();
+                if (!cache_file || std::rename(temp_path.c_str(), cache_path.c_str())) {
+                    std::cerr << "Error writing transcode cache file " << cache_path << std::endl;
+                    std::remove(temp_path.c_str());
+                }
+            }
+            result = std::make_shared<const SlideBlob>(std::move(output_data));
+        }
+    }
+    
+    if (result) {
+        result = SlideBlobStore::Global().AddRendition(key, result);
+    } else {
+        // don't keep the failure, so that it is retried next time
+        std::lock_guard<std::mutex> lock(transcode_mutex_);
+        transcode_cache_.erase(key);
+    }
+    promise.set_value(result);
+    return result;
+}
+
+ImageFormat EnhancedMOTProcessor::NegotiateFormat(const std::string& service_id) const {
+    auto preference = config_.service_formats.find(service_id);
+    if (preference != config_.service_formats.end()) {
+        for (ImageFormat format : preference->second) {
+            if (FormatSupported(format)) {
+                return format;
+            }
+        }
+    }
+    
+    // the one every receiver supports
+    return ImageFormat::JPEG;
+}
+
+slide_blob_t EnhancedMOTProcessor::GetImageForService(const EnhancedImageData& image_data, const std::string& service_id) {
+    return Transcode(image_data.source_path, image_data.source_hash, NegotiateFormat(service_id));
 }
 
 double EnhancedMOTProcessor::CalculateFreshnessScore(const EnhancedImageData& image_data) {
@@ -320,130 +525,210 @@ double EnhancedMOTProcessor::CalculateFreshnessScore(const EnhancedImageData& im
 }
 
 std::vector<size_t> EnhancedMOTProcessor::SelectBestImages(size_t count) {
-    std::vector<std::pair<double, size_t>> scored_images;
-    
-    std::lock_guard<std::mutex> lock(cache_mutex_);
-    
-    for (size_t i = 0; i < image_cache_.size(); ++i) {
-        const auto& image = image_cache_[i];
-        double score = 0.0;
-        
-        // Quality-based scoring
-        score += image->quality.sharpness * 0.3;
-        score += image->quality.contrast * 0.2;
-        score += (1.0 - image->quality.brightness) * 0.1; // Prefer medium brightness
-        
-        // Freshness scoring
-        score += CalculateFreshnessScore(*image) * 0.4;
-        
-        scored_images.emplace_back(score, i);
+    // expects cache_mutex_ to be held
+    return score_table_.Select(ImageScoreTable::BALANCED, system_clock::now(), count);
+}
+
+EnhancedMOTProcessor::HashShard& EnhancedMOTProcessor::ShardOf(const std::string& hash) {
+    return hash_shards_[std::hash<std::string>{}(hash) % HASH_SHARDS];
+}
+
+bool EnhancedMOTProcessor::ReserveHash(const std::string& hash) {
+    HashShard& shard = ShardOf(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    size_t& count = shard.counts[hash];
+    if (count > 0 && config_.enable_duplicate_detection) {
+        return false;
     }
-    
-    // Sort by score (highest first)
-    std::sort(scored_images.begin(), scored_images.end(), 
-              [](const auto& a, const auto& b) { return a.first > b.first; });
-    
-    std::vector<size_t> selected_indices;
-    for (size_t i = 0; i < std::min(count, scored_images.size()); ++i) {
-        selected_indices.push_back(scored_images[i].second);
+    count++;
+    return true;
+}
+
+void EnhancedMOTProcessor::ReleaseHash(const std::string& hash) {
+    HashShard& shard = ShardOf(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.counts.find(hash);
+    if (it != shard.counts.end() && --it->second == 0) {
+        shard.counts.erase(it);
     }
-    
-    return selected_indices;
 }
 
-bool EnhancedMOTProcessor::IsDuplicate(const std::string& hash) {
-    return hash_index_.find(hash) != hash_index_.end();
+bool EnhancedMOTProcessor::IsImageFilename(const std::string& filename) {
+    std::string extension = fs::path(filename).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    
+    return extension == ".jpg" || extension == ".jpeg" || 
+           extension == ".png" || extension == ".webp" || 
+           extension == ".heic" || extension == ".heif";
 }
 
 bool EnhancedMOTProcessor::ProcessImageDirectory(const std::string& directory_path) {
+    // all images processed first, then published at once
+    std::vector<std::unique_ptr<EnhancedImageData>> images;
     try {
         if (!fs::exists(directory_path) || !fs::is_directory(directory_path)) {
             std::cerr << "Invalid directory path: " << directory_path << std::endl;
             return false;
         }
         
-        size_t processed_count = 0;
+        // later changes are picked up by the background processing
+        {
+            std::lock_guard<std::mutex> lock(pipeline_mutex_);
+            watch_dir_ = directory_path;
+        }
+        
         size_t skipped_count = 0;
         
         for (const auto& entry : fs::directory_iterator(directory_path)) {
             if (entry.is_regular_file()) {
                 std::string filepath = entry.path().string();
-                std::string extension = entry.path().extension().string();
-                std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
                 
                 // Check if it's an image file
-                if (extension == ".jpg" || extension == ".jpeg" || 
-                    extension == ".png" || extension == ".webp" || 
-                    extension == ".heic" || extension == ".heif") {
-                    
-                    if (AddImage(filepath)) {
-                        processed_count++;
+                if (IsImageFilename(filepath)) {
+                    std::unique_ptr<EnhancedImageData> image_data = PrepareImage(filepath);
+                    if (image_data) {
+                        images.push_back(std::move(image_data));
                     } else {
                         skipped_count++;
                     }
                 }
             }
         }
+        const size_t processed_count = InsertImages(images);
         
         std::cout << "Processed " << processed_count << " images, skipped " << skipped_count << std::endl;
         return processed_count > 0;
         
     } catch (const std::exception& e) {
         std::cerr << "Error processing directory " << directory_path << ": " << e.what() << std::endl;
+        InsertImages(images);   // those processed before
         return false;
     }
 }
 
 bool EnhancedMOTProcessor::AddImage(const std::string& filepath) {
+    std::vector<std::unique_ptr<EnhancedImageData>> images;
+    images.push_back(PrepareImage(filepath));
+    return images.back() && InsertImages(images) > 0;
+}
+
+std::unique_ptr<EnhancedImageData> EnhancedMOTProcessor::PrepareImage(const std::string& filepath) {
     try {
-        // Load and process image
+        std::ifstream file(filepath, std::ios::binary);
+        std::vector<uint8_t> file_data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        // Only read the image attributes; the quality is analysed on a thumbnail
+#ifdef HAVE_IMAGEMAGICK
         Magick::Image image;
-        image.read(filepath);
+        image.ping(filepath);
+        const size_t width = image.columns();
+        const size_t height = image.rows();
+#else
+        image_probe_t probe;
+        SlideCodec::Probe(file_data.data(), file_data.size(), probe);
+        const size_t width = probe.width;
+        const size_t height = probe.height;
+#endif
         
         auto image_data = std::make_unique<EnhancedImageData>();
         image_data->filename = fs::path(filepath).filename().string();
+        image_data->source_path = filepath;
+        image_data->source_hash = odr::hash64(file_data.data(), file_data.size());
         image_data->format = DetectImageFormat(filepath);
-        image_data->width = image.columns();
-        image_data->height = image.rows();
-        image_data->quality = AnalyzeImageQuality(image);
+        image_data->width = width;
+        image_data->height = height;
+        image_data->quality = AnalyzeImageQuality(file_data);
         
-        // Optimize image
-        if (OptimizeImage(filepath, image_data->processed_data, ImageFormat::JPEG)) {
+        // Optimize image (unless already done for the same content)
+        slide_blob_t processed_data = Transcode(filepath, image_data->source_hash, ImageFormat::JPEG);
+        if (processed_data) {
             image_data->is_optimized = true;
-            image_data->quality.file_size = image_data->processed_data.size();
-            image_data->hash = CalculateImageHash(image_data->processed_data);
-            
-            // Check for duplicates
-            if (config_.enable_duplicate_detection && IsDuplicate(image_data->hash)) {
-                return false; // Skip duplicate
-            }
-            
-            std::lock_guard<std::mutex> lock(cache_mutex_);
-            
-            // Add to cache
-            size_t index = image_cache_.size();
-            hash_index_[image_data->hash] = index;
-            image_cache_.push_back(std::move(image_data));
+            image_data->quality.file_size = processed_data->Size();
+            image_data->hash = CalculateImageHash(processed_data->Data(), processed_data->Size());
+            image_data->processed_data = processed_data;
             
-            // Remove old images if cache is full
-            if (image_cache_.size() > config_.max_images) {
-                RemoveOldImages();
+            // Skip duplicates, also of images being added at the same time
+            if (!ReserveHash(image_data->hash)) {
+                return nullptr;
             }
-            
-            return true;
+            return image_data;
         }
         
     } catch (const std::exception& e) {
         std::cerr << "Error adding image " << filepath << ": " << e.what() << std::endl;
     }
     
-    return false;
+    return nullptr;
+}
+
+size_t EnhancedMOTProcessor::InsertImages(std::vector<std::unique_ptr<EnhancedImageData>>& images) {
+    std::lock_guard<ProfiledMutex> lock(cache_mutex_);
+    
+    size_t inserted = 0;
+    for (std::unique_ptr<EnhancedImageData>& image_data : images) {
+        if (!image_data) {
+            continue;
+        }
+        
+        // Add to cache, reusing the slot of a removed image if any
+        size_t index;
+        if (free_slots_.empty()) {
+            index = image_cache_.size();
+            image_cache_.push_back(nullptr);
+        } else {
+            index = free_slots_.back();
+            free_slots_.pop_back();
+        }
+        score_table_.Set(index, image_data->quality);
+        image_cache_[index] = std::move(image_data);
+        inserted++;
+    }
+    if (inserted == 0) {
+        return 0;
+    }
+    
+    // Remove old images if cache is full
+    if (image_cache_.size() - free_slots_.size() > config_.max_images) {
+        RemoveOldImages();
+    }
+    generation_++;
+    PublishSnapshot();
+    return inserted;
+}
+
+void EnhancedMOTProcessor::RemoveSlot(size_t index) {
+    // expects cache_mutex_ to be held
+    ReleaseHash(image_cache_[index]->hash);
+    image_cache_[index].reset();
+    score_table_.Clear(index);
+    free_slots_.push_back(index);
+}
+
+void EnhancedMOTProcessor::PublishSnapshot() {
+    // expects cache_mutex_ to be held
+    auto snapshot = std::make_shared<CacheSnapshot>();
+    snapshot->filenames.reserve(image_cache_.size() - free_slots_.size());
+    for (const auto& image : image_cache_) {
+        if (!image) {
+            continue;
+        }
+        snapshot->filenames.push_back(image->filename);
+        if (image->is_optimized) {
+            snapshot->optimized_images++;
+        }
+        snapshot->compressed_size_bytes += image->quality.file_size;
+        snapshot->total_quality += (image->quality.sharpness + image->quality.contrast) / 2.0;
+        
+        // Estimate original size (this would need to be tracked during processing)
+        snapshot->total_size_bytes += image->quality.file_size * 1.5; // Rough estimate
+    }
+    std::atomic_store(&snapshot_, std::shared_ptr<const CacheSnapshot>(std::move(snapshot)));
 }
 
 std::unique_ptr<EnhancedImageData> EnhancedMOTProcessor::GetNextImage() {
-    std::lock_guard<std::mutex> lock(cache_mutex_);
+    std::lock_guard<ProfiledMutex> lock(cache_mutex_);
     
-    if (image_cache_.empty()) {
+    if (image_cache_.size() == free_slots_.size()) {
         return nullptr;
     }
     
@@ -457,8 +742,9 @@ std::unique_ptr<EnhancedImageData> EnhancedMOTProcessor::GetNextImage() {
             image->quality.last_used = system_clock::now();
             image->quality.usage_count++;
             image->quality.freshness_score = CalculateFreshnessScore(*image);
+            score_table_.Set(index, image->quality);
             
-            // Create a copy to return
+            // Create a copy to return (sharing the image data)
             auto result = std::make_unique<EnhancedImageData>(*image);
             return result;
         }
@@ -466,8 +752,13 @@ std::unique_ptr<EnhancedImageData> EnhancedMOTProcessor::GetNextImage() {
     
     // Fallback to round-robin selection
     static size_t current_index = 0;
-    if (current_index >= image_cache_.size()) {
-        current_index = 0;
+    for (;; current_index++) {
+        if (current_index >= image_cache_.size()) {
+            current_index = 0;
+        }
+        if (image_cache_[current_index]) {
+            break;
+        }
     }
     
     auto result = std::make_unique<EnhancedImageData>(*image_cache_[current_index]);
@@ -478,95 +769,75 @@ std::unique_ptr<EnhancedImageData> EnhancedMOTProcessor::GetNextImage() {
 
 void EnhancedMOTProcessor::RemoveOldImages() {
     // Remove oldest images based on usage and quality
-    if (image_cache_.size() <= config_.max_images) {
+    size_t image_count = image_cache_.size() - free_slots_.size();
+    if (image_count <= config_.max_images) {
         return;
     }
     
-    size_t to_remove = image_cache_.size() - config_.max_images;
+    size_t to_remove = image_count - config_.max_images;
     
     // Create vector of indices with scores (lower score = more likely to remove)
-    std::vector<std::pair<double, size_t>> scored_for_removal;
+    static const ImageScoreTable::Weights RETENTION = {0.4, 0.4, 0.0, 0.6};
+    std::vector<double> scores;
+    score_table_.Score(RETENTION, system_clock::now(), scores);
     
-    for (size_t i = 0; i < image_cache_.size(); ++i) {
-        const auto& image = image_cache_[i];
-        double removal_score = image->quality.freshness_score * 0.6 +
-                              (image->quality.sharpness + image->quality.contrast) * 0.4;
-        scored_for_removal.emplace_back(removal_score, i);
+    std::vector<std::pair<double, size_t>> scored_for_removal;
+    scored_for_removal.reserve(image_count);
+    for (size_t i = 0; i < scores.size(); ++i) {
+        if (score_table_.Used(i)) {
+            scored_for_removal.emplace_back(scores[i], i);
+        }
     }
     
-    // Sort by removal score (lowest first)
-    std::sort(scored_for_removal.begin(), scored_for_removal.end());
+    // Find the images with the lowest scores (in any order)
+    std::nth_element(scored_for_removal.begin(), scored_for_removal.begin() + (to_remove - 1), scored_for_removal.end());
     
-    // Remove images with lowest scores
-    std::vector<size_t> indices_to_remove;
+    // Free their slots; the other images keep theirs
     for (size_t i = 0; i < to_remove; ++i) {
-        indices_to_remove.push_back(scored_for_removal[i].second);
-    }
-    
-    // Sort indices in descending order for proper removal
-    std::sort(indices_to_remove.rbegin(), indices_to_remove.rend());
-    
-    for (size_t index : indices_to_remove) {
-        // Remove from hash index
-        hash_index_.erase(image_cache_[index]->hash);
-        // Remove from cache
-        image_cache_.erase(image_cache_.begin() + index);
+        RemoveSlot(scored_for_removal[i].second);
     }
-    
-    // Rebuild hash index
-    hash_index_.clear();
-    for (size_t i = 0; i < image_cache_.size(); ++i) {
-        hash_index_[image_cache_[i]->hash] = i;
+}
+
+bool EnhancedMOTProcessor::RemoveImage(const std::string& filename) {
+    std::lock_guard<ProfiledMutex> lock(cache_mutex_);
+    for (size_t index = 0; index < image_cache_.size(); index++) {
+        if (image_cache_[index] && image_cache_[index]->filename == filename) {
+            RemoveSlot(index);
+            generation_++;
+            PublishSnapshot();
+            return true;
+        }
     }
+    return false;
+}
+
+std::vector<std::string> EnhancedMOTProcessor::GetImageList() const {
+    return std::atomic_load(&snapshot_)->filenames;
 }
 
 size_t EnhancedMOTProcessor::GetImageCount() const {
-    std::lock_guard<std::mutex> lock(cache_mutex_);
-    return image_cache_.size();
+    return std::atomic_load(&snapshot_)->filenames.size();
 }
 
 double EnhancedMOTProcessor::GetAverageQuality() const {
-    std::lock_guard<std::mutex> lock(cache_mutex_);
-    
-    if (image_cache_.empty()) {
+    std::shared_ptr<const CacheSnapshot> snapshot = std::atomic_load(&snapshot_);
+    if (snapshot->filenames.empty()) {
         return 0.0;
     }
-    
-    double total_quality = 0.0;
-    for (const auto& image : image_cache_) {
-        total_quality += (image->quality.sharpness + image->quality.contrast) / 2.0;
-    }
-    
-    return total_quality / image_cache_.size();
+    return snapshot->total_quality / snapshot->filenames.size();
 }
 
 EnhancedMOTProcessor::Statistics EnhancedMOTProcessor::GetStatistics() const {
-    std::lock_guard<std::mutex> lock(cache_mutex_);
+    std::shared_ptr<const CacheSnapshot> snapshot = std::atomic_load(&snapshot_);
     
     Statistics stats;
-    stats.total_images = image_cache_.size();
-    
-    size_t total_original_size = 0;
-    size_t total_compressed_size = 0;
-    double total_quality = 0.0;
-    
-    for (const auto& image : image_cache_) {
-        if (image->is_optimized) {
-            stats.optimized_images++;
-        }
-        
-        total_compressed_size += image->quality.file_size;
-        total_quality += (image->quality.sharpness + image->quality.contrast) / 2.0;
-        
-        // Estimate original size (this would need to be tracked during processing)
-        total_original_size += image->quality.file_size * 1.5; // Rough estimate
-    }
-    
-    stats.total_size_bytes = total_original_size;
-    stats.compressed_size_bytes = total_compressed_size;
-    stats.average_quality = stats.total_images > 0 ? total_quality / stats.total_images : 0.0;
-    stats.compression_ratio = total_original_size > 0 ? 
-        static_cast<double>(total_compressed_size) / total_original_size : 0.0;
+    stats.total_images = snapshot->filenames.size();
+    stats.optimized_images = snapshot->optimized_images;
+    stats.total_size_bytes = snapshot->total_size_bytes;
+    stats.compressed_size_bytes = snapshot->compressed_size_bytes;
+    stats.average_quality = stats.total_images > 0 ? snapshot->total_quality / stats.total_images : 0.0;
+    stats.compression_ratio = snapshot->total_size_bytes > 0 ? 
+        static_cast<double>(snapshot->compressed_size_bytes) / snapshot->total_size_bytes : 0.0;
     
     return stats;
 }
@@ -574,35 +845,100 @@ EnhancedMOTProcessor::Statistics EnhancedMOTProcessor::GetStatistics() const {
 void EnhancedMOTProcessor::StartBackgroundProcessing() {
     if (!processing_active_.exchange(true)) {
         background_processor_ = std::thread(&EnhancedMOTProcessor::BackgroundProcessingLoop, this);
+        image_worker_ = std::thread(&EnhancedMOTProcessor::ImageWorkerLoop, this);
     }
 }
 
 void EnhancedMOTProcessor::StopBackgroundProcessing() {
     if (processing_active_.exchange(false)) {
+        {
+            std::lock_guard<std::mutex> lock(pipeline_mutex_);
+            pipeline_cv_.notify_all();
+        }
         if (background_processor_.joinable()) {
             background_processor_.join();
         }
+        if (image_worker_.joinable()) {
+            image_worker_.join();
+        }
     }
 }
 
 void EnhancedMOTProcessor::BackgroundProcessingLoop() {
+    SlideDirWatcher watcher;
+    std::map<std::string, fingerprint_t> known_files;   // as processed (or handed over to the worker)
+    auto next_cleanup = steady_clock::now() + minutes(5);
+    
     while (processing_active_) {
         try {
-            // Periodic cleanup and optimization
-            std::this_thread::sleep_for(std::chrono::minutes(5));
+            std::string dir;
+            {
+                std::unique_lock<std::mutex> lock(pipeline_mutex_);
+                pipeline_cv_.wait_for(lock, DETECT_INTERVAL, [this]{ return !processing_active_; });
+                dir = watch_dir_;
+            }
+            if (!processing_active_) {
+                break;
+            }
+            
+            // Detect changed images; the initial ones were processed by ProcessImageDirectory()
+            if (!dir.empty() && dir != watcher.GetDir()) {
+                watcher.Watch(dir);
+                known_files = watcher.GetFiles();
+            } else if (!dir.empty() && watcher.Update()) {
+                bool handed_over = false;
+                for (const auto& file : watcher.GetFiles()) {
+                    auto known = known_files.find(file.first);
+                    if ((known != known_files.end() && known->second == file.second) || !IsImageFilename(file.first)) {
+                        continue;
+                    }
+                    
+                    // if the worker lags behind, the rest stays unknown until the next pass
+                    if (!pending_images_.Push(dir + "/" + file.first)) {
+                        break;
+                    }
+                    known_files[file.first] = file.second;
+                    handed_over = true;
+                }
+                if (handed_over) {
+                    std::lock_guard<std::mutex> lock(pipeline_mutex_);
+                    pipeline_cv_.notify_all();
+                }
+                
+                // forget removed files, so that they count as new if they reappear
+                for (auto it = known_files.begin(); it != known_files.end(); ) {
+                    if (watcher.GetFiles().count(it->first)) {
+                        ++it;
+                    } else {
+                        it = known_files.erase(it);
+                    }
+                }
+            }
+            
+            if (steady_clock::now() < next_cleanup) {
+                continue;
+            }
+            next_cleanup = steady_clock::now() + minutes(5);
             
             // Update freshness scores
             {
-                std::lock_guard<std::mutex> lock(cache_mutex_);
+                std::lock_guard<ProfiledMutex> lock(cache_mutex_);
                 for (auto& image : image_cache_) {
-                    image->quality.freshness_score = CalculateFreshnessScore(*image);
+                    if (image) {
+                        image->quality.freshness_score = CalculateFreshnessScore(*image);
+                    }
                 }
             }
             
             // Check if cache needs cleanup
             if (GetImageCount() > config_.max_images * 0.9) {
-                std::lock_guard<std::mutex> lock(cache_mutex_);
+                std::lock_guard<ProfiledMutex> lock(cache_mutex_);
+                const size_t image_count = image_cache_.size() - free_slots_.size();
                 RemoveOldImages();
+                if (image_cache_.size() - free_slots_.size() != image_count) {
+                    generation_++;
+                    PublishSnapshot();
+                }
             }
             
         } catch (const std::exception& e) {
@@ -611,10 +947,100 @@ void EnhancedMOTProcessor::BackgroundProcessingLoop() {
     }
 }
 
+void EnhancedMOTProcessor::ImageWorkerLoop() {
+    while (processing_active_) {
+        std::string filepath;
+        {
+            std::unique_lock<std::mutex> lock(pipeline_mutex_);
+            pipeline_cv_.wait(lock, [this]{ return !pending_images_.Empty() || !processing_active_; });
+        }
+        
+        while (processing_active_ && pending_images_.Pop(filepath)) {
+            AddImage(filepath);
+        }
+    }
+}
+
+// ImageScoreTable implementation
+const ImageScoreTable::Weights ImageScoreTable::QUALITY = {0.5, 0.5, 0.0, 0.0};
+const ImageScoreTable::Weights ImageScoreTable::RECENCY = {0.0, 0.0, 0.0, 1.0};
+const ImageScoreTable::Weights ImageScoreTable::BALANCED = {0.3, 0.2, 0.1, 0.4};
+
+void ImageScoreTable::Set(size_t slot, const ImageQuality& quality) {
+    if (slot >= used_.size()) {
+        sharpness_.resize(slot + 1);
+        contrast_.resize(slot + 1);
+        brightness_.resize(slot + 1);
+        last_used_hours_.resize(slot + 1);
+        usage_count_.resize(slot + 1);
+        used_.resize(slot + 1);
+    }
+    
+    sharpness_[slot] = quality.sharpness;
+    contrast_[slot] = quality.contrast;
+    brightness_[slot] = quality.brightness;
+    last_used_hours_[slot] = duration<double, std::ratio<3600>>(quality.last_used.time_since_epoch()).count();
+    usage_count_[slot] = quality.usage_count;
+    used_[slot] = true;
+}
+
+void ImageScoreTable::Clear(size_t slot) {
+    if (slot < used_.size()) {
+        used_[slot] = false;
+    }
+}
+
+void ImageScoreTable::Score(const Weights& weights, system_clock::time_point now, std::vector<double>& scores) const {
+    const double now_hours = duration<double, std::ratio<3600>>(now.time_since_epoch()).count();
+    const size_t n = used_.size();
+    scores.resize(n);
+    
+    const double* sharpness = sharpness_.data();
+    const double* contrast = contrast_.data();
+    const double* brightness = brightness_.data();
+    const double* last_used_hours = last_used_hours_.data();
+    const double* usage_count = usage_count_.data();
+    double* score = scores.data();
+    
+    // Freshness as with CalculateFreshnessScore(), but without rounding to whole hours
+    for (size_t i = 0; i < n; i++) {
+        double freshness = std::exp(-std::max(now_hours - last_used_hours[i], 0.0) / 24.0) / (1.0 + usage_count[i] * 0.1);
+        score[i] = sharpness[i] * weights.sharpness + contrast[i] * weights.contrast +
+                   (1.0 - brightness[i]) * weights.darkness + freshness * weights.freshness;
+    }
+}
+
+std::vector<size_t> ImageScoreTable::Select(const Weights& weights, system_clock::time_point now,
+                                            size_t count, const std::vector<bool>& excluded) const {
+    std::vector<double> scores;
+    Score(weights, now, scores);
+    
+    std::vector<std::pair<double, size_t>> candidates;
+    candidates.reserve(scores.size());
+    for (size_t i = 0; i < scores.size(); i++) {
+        if (used_[i] && !(i < excluded.size() && excluded[i])) {
+            candidates.emplace_back(scores[i], i);
+        }
+    }
+    
+    // Only the best ones need to be ordered (highest score first)
+    count = std::min(count, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+                      [](const auto& a, const auto& b) { return a.first > b.first; });
+    
+    std::vector<size_t> selected;
+    selected.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        selected.push_back(candidates[i].second);
+    }
+    return selected;
+}
+
 // ImageOptimizer implementation
 bool ImageOptimizer::OptimizeForDAB(const std::string& input_path, 
                                    std::vector<uint8_t>& output_data,
                                    size_t max_size) {
+#ifdef HAVE_IMAGEMAGICK
     try {
         Magick::Image image;
         image.read(input_path);
@@ -647,8 +1073,13 @@ bool ImageOptimizer::OptimizeForDAB(const std::string& input_path,
         std::cerr << "Error optimizing image for DAB: " << e.what() << std::endl;
         return false;
     }
+#else
+    std::cerr << "Image optimization not compiled in" << std::endl;
+    return false;
+#endif
 }
 
+#ifdef HAVE_IMAGEMAGICK
 bool ImageOptimizer::ResizeImage(Magick::Image& image, uint32_t max_width, uint32_t max_height) {
     try {
         uint32_t width = image.columns();
@@ -694,10 +1125,83 @@ bool ImageOptimizer::ApplyDABProfile(Magick::Image& image) {
         return false;
     }
 }
+#endif
 
 double ImageOptimizer::CalculateCompressionRatio(size_t original_size, size_t compressed_size) {
     if (original_size == 0) return 0.0;
     return static_cast<double>(compressed_size) / original_size;
 }
 
+// SmartContentSelector implementation
+SmartContentSelector::SmartContentSelector(std::function<double(const EnhancedImageData&)> scorer)
+    : scoring_function_(scorer) {
+}
+
+std::vector<size_t> SmartContentSelector::SelectContent(const std::vector<std::unique_ptr<EnhancedImageData>>& images,
+                                                        size_t count,
+                                                        const std::vector<std::string>& excluded_hashes) {
+    std::vector<bool> excluded(images.size());
+    for (size_t i = 0; i < images.size(); i++) {
+        excluded[i] = !images[i] ||
+            std::find(excluded_hashes.begin(), excluded_hashes.end(), images[i]->hash) != excluded_hashes.end();
+    }
+    
+    if (scoring_function_) {
+        std::vector<std::pair<double, size_t>> candidates;
+        for (size_t i = 0; i < images.size(); i++) {
+            if (!excluded[i]) {
+                candidates.emplace_back(scoring_function_(*images[i]), i);
+            }
+        }
+        
+        count = std::min(count, candidates.size());
+        std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+                          [](const auto& a, const auto& b) { return a.first > b.first; });
+        
+        std::vector<size_t> selected;
+        for (size_t i = 0; i < count; i++) {
+            selected.push_back(candidates[i].second);
+        }
+        return selected;
+    }
+    
+    ImageScoreTable table;
+    for (size_t i = 0; i < images.size(); i++) {
+        if (!excluded[i]) {
+            table.Set(i, images[i]->quality);
+        }
+    }
+    return SelectContent(table, count, excluded);
+}
+
+std::vector<size_t> SmartContentSelector::SelectContent(const ImageScoreTable& table,
+                                                        size_t count,
+                                                        const std::vector<bool>& excluded) const {
+    return table.Select(weights_, system_clock::now(), count, excluded);
+}
+
+void SmartContentSelector::SetScoringFunction(std::function<double(const EnhancedImageData&)> scorer) {
+    scoring_function_ = scorer;
+}
+
+double SmartContentSelector::QualityBasedScoring(const EnhancedImageData& image) {
+    return (image.quality.sharpness + image.quality.contrast) / 2.0;
+}
+
+double SmartContentSelector::RecencyBasedScoring(const EnhancedImageData& image) {
+    ImageScoreTable table;
+    table.Set(0, image.quality);
+    std::vector<double> scores;
+    table.Score(ImageScoreTable::RECENCY, system_clock::now(), scores);
+    return scores[0];
+}
+
+double SmartContentSelector::BalancedScoring(const EnhancedImageData& image) {
+    ImageScoreTable table;
+    table.Set(0, image.quality);
+    std::vector<double> scores;
+    table.Score(ImageScoreTable::BALANCED, system_clock::now(), scores);
+    return scores[0];
+}
+
 } // namespace StreamDAB
\ No newline at end of file
@@ -11,7 +11,9 @@
 #define ENHANCED_MOT_H_
 
 #include "common.h"
+#include "metrics.h"
 #include "sls.h"
+#include "spsc_queue.h"
 #ifdef HAVE_IMAGEMAGICK
 #include <Magick++.h>
 #endif
@@ -28,7 +30,11 @@
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <future>
+#include <map>
+#include <string>
 
 namespace StreamDAB {
 
@@ -55,9 +61,11 @@ struct ImageQuality {
 // Enhanced image metadata
 struct EnhancedImageData {
     std::string filename;
+    std::string source_path;
+    uint64_t source_hash = 0;       // of the source file, to look up its transcoded versions
     std::string content_type;
     ImageFormat format;
-    std::vector<uint8_t> processed_data;
+    slide_blob_t processed_data;    // immutable, shared with copies and the MOT objects created from it
     ImageQuality quality;
     std::string hash;
     bool is_optimized = false;
@@ -74,22 +82,109 @@ struct CarouselConfig {
     bool enable_duplicate_detection = true;
     bool enable_smart_selection = true;
     bool enable_progressive_jpeg = true;
+    size_t max_image_size = SLSEncoder::MAXSLIDESIZE_SIMPLE;
+    std::string transcode_cache_dir;    // if not empty, transcoded images are also kept there
+    // output formats by service ID, in order of preference (JPEG if none supported)
+    std::map<std::string, std::vector<ImageFormat>> service_formats;
+};
+
+// Score inputs of images as contiguous columns (by slot), so that all
+// candidates are scored in one (vectorisable) pass
+class ImageScoreTable {
+public:
+    // score = sharpness * w + contrast * w + (1 - brightness) * w + freshness * w
+    struct Weights {
+        double sharpness;
+        double contrast;
+        double darkness;
+        double freshness;
+    };
+    static const Weights QUALITY;
+    static const Weights RECENCY;
+    static const Weights BALANCED;
+
+    void Set(size_t slot, const ImageQuality& quality);
+    void Clear(size_t slot);    // an empty slot is never selected
+    size_t Size() const { return used_.size(); }
+    bool Used(size_t slot) const { return slot < used_.size() && used_[slot]; }
+
+    // scores every slot (also the empty ones)
+    void Score(const Weights& weights, std::chrono::system_clock::time_point now, std::vector<double>& scores) const;
+    /*! the used slots with the best scores, highest first; excluded is
+     *  either empty or has one bit per slot
+     */
+    std::vector<size_t> Select(const Weights& weights, std::chrono::system_clock::time_point now,
+                               size_t count, const std::vector<bool>& excluded = {}) const;
+
+private:
+    std::vector<double> sharpness_;
+    std::vector<double> contrast_;
+    std::vector<double> brightness_;
+    std::vector<double> last_used_hours_;   // since the epoch
+    std::vector<double> usage_count_;
+    std::vector<bool> used_;
 };
 
 class EnhancedMOTProcessor {
 private:
     CarouselConfig config_;
-    std::vector<std::unique_ptr<EnhancedImageData>> image_cache_;
-    std::unordered_map<std::string, size_t> hash_index_;
-    mutable std::mutex cache_mutex_;
+    // The slots, guarded by cache_mutex_, which is only held to change them:
+    // images are processed before, and readers take the published snapshot
+    std::vector<std::unique_ptr<EnhancedImageData>> image_cache_;  // slots; those of removed images are empty (nullptr)
+    std::vector<size_t> free_slots_;                                // empty slots of image_cache_, reused first
+    ImageScoreTable score_table_;                                   // of the images, by slot
+    mutable ProfiledMutex cache_mutex_{"mot_cache"};
+
+    // What the accessors report, rebuilt on each change of the set of images;
+    // written under cache_mutex_, read with std::atomic_load only
+    struct CacheSnapshot {
+        std::vector<std::string> filenames;
+        size_t optimized_images = 0;
+        size_t total_size_bytes = 0;    // estimated, of the originals
+        size_t compressed_size_bytes = 0;
+        double total_quality = 0.0;     // of (sharpness + contrast) / 2
+    };
+    std::shared_ptr<const CacheSnapshot> snapshot_;
+
+    // Hashes of the images in the cache or being added, sharded by hash, so
+    // that concurrent adds of the same image find each other without the slots
+    static const size_t HASH_SHARDS = 16;
+    struct HashShard {
+        std::mutex mutex;
+        std::unordered_map<std::string, size_t> counts;
+    };
+    HashShard hash_shards_[HASH_SHARDS];
+
+    std::unordered_map<std::string, ImageQuality> quality_cache_;  // by image hash, so that each image is analysed once
+    std::mutex quality_mutex_;
+    // transcodes in progress (or recently done) by source hash, target format and size budget, so that
+    // each is produced once; the results are renditions of SlideBlobStore::Global(), held once per process
+    std::unordered_map<std::string, std::shared_future<slide_blob_t>> transcode_cache_;
+    std::mutex transcode_mutex_;
+    std::atomic<uint64_t> generation_{0};  // of the set of images
     std::atomic<bool> processing_active_{false};
-    std::thread background_processor_;
+    std::thread background_processor_;     // detects changed images, does the periodic cleanup
+    std::thread image_worker_;             // processes and caches the detected images
+
+    // background pipeline
+    static const size_t PENDING_IMAGES_LEN;
+    static const size_t TRANSCODE_CACHE_LEN;
+    static const std::chrono::milliseconds DETECT_INTERVAL;
+    std::string watch_dir_;                // guarded by pipeline_mutex_
+    std::mutex pipeline_mutex_;
+    std::condition_variable pipeline_cv_;  // signalled on new pending images and on stop
+    SPSCQueue<std::string> pending_images_{PENDING_IMAGES_LEN};   // paths, from the detector to the worker
     
     // Image processing methods
     ImageFormat DetectImageFormat(const std::string& filepath);
-    std::string CalculateImageHash(const std::vector<uint8_t>& data);
+    static bool IsImageFilename(const std::string& filename);
+    std::string CalculateImageHash(const uint8_t* data, size_t len);
     ImageQuality AnalyzeImageQuality(const std::vector<uint8_t>& image_data);
-    bool OptimizeImage(const std::string& input_path, std::vector<uint8_t>& output_data, ImageFormat target_format);
+    bool OptimizeImage(const std::string& input_path, std::vector<uint8_t>& output_data, ImageFormat target_format, size_t max_size);
+    static bool FormatSupported(ImageFormat format);
+    static std::string TranscodeKey(uint64_t source_hash, ImageFormat format, size_t max_size, bool progressive);
+    // returns NULL on error
+    slide_blob_t Transcode(const std::string& input_path, uint64_t source_hash, ImageFormat target_format);
 #ifdef HAVE_IMAGEMAGICK
     bool ConvertToWebP(const Magick::Image& image, std::vector<uint8_t>& output_data, int quality = 80);
     bool ConvertToHEIF(const Magick::Image& image, std::vector<uint8_t>& output_data, int quality = 80);
@@ -99,9 +194,19 @@ private:
     // Smart selection algorithms
     double CalculateFreshnessScore(const EnhancedImageData& image_data);
     std::vector<size_t> SelectBestImages(size_t count);
-    bool IsDuplicate(const std::string& hash);
+    HashShard& ShardOf(const std::string& hash);
+    // false if the image is a duplicate (and duplicates are not wanted)
+    bool ReserveHash(const std::string& hash);
+    void ReleaseHash(const std::string& hash);
+    // read, analysed and transcoded without holding cache_mutex_; NULL on error or duplicate
+    std::unique_ptr<EnhancedImageData> PrepareImage(const std::string& filepath);
+    // into the slots and published at once; returns how many
+    size_t InsertImages(std::vector<std::unique_ptr<EnhancedImageData>>& images);
+    void RemoveSlot(size_t index);
+    void PublishSnapshot();
     void RemoveOldImages();
     void BackgroundProcessingLoop();
+    void ImageWorkerLoop();
     
 public:
     explicit EnhancedMOTProcessor(const CarouselConfig& config = CarouselConfig{});
@@ -119,9 +224,17 @@ public:
     CarouselConfig GetConfig() const { return config_; }
     size_t GetImageCount() const;
     double GetAverageQuality() const;
+    // increases with each change of the set of images, for caching what is derived from it
+    uint64_t GetGeneration() const { return generation_; }
     
     // ETSI compliance methods
     bool ValidateETSICompliance(const EnhancedImageData& image_data);
+    // the output format for a service, according to its preference
+    ImageFormat NegotiateFormat(const std::string& service_id) const;
+    /*! the image in the output format of a service; services getting the same
+     *  format share the same (cached) bytes; returns NULL on error
+     */
+    slide_blob_t GetImageForService(const EnhancedImageData& image_data, const std::string& service_id);
     std::vector<uint8_t> GenerateMOTObject(const EnhancedImageData& image_data, uint16_t transport_id);
     
     // Statistics and monitoring
@@ -136,7 +249,10 @@ public:
     };
     Statistics GetStatistics() const;
     
-    // Thread safety
+    /*! Background processing: images created or changed in the directory
+     *  last passed to ProcessImageDirectory() are processed (and added to
+     *  the cache) right away.
+     */
     void StartBackgroundProcessing();
     void StopBackgroundProcessing();
 };
@@ -160,7 +276,8 @@ public:
 // Content-aware selection engine
 class SmartContentSelector {
 private:
-    std::function<double(const EnhancedImageData&)> scoring_function_;
+    std::function<double(const EnhancedImageData&)> scoring_function_;  // if set, instead of the weights
+    ImageScoreTable::Weights weights_ = ImageScoreTable::BALANCED;
     
 public:
     explicit SmartContentSelector(std::function<double(const EnhancedImageData&)> scorer = nullptr);
@@ -168,8 +285,13 @@ public:
     std::vector<size_t> SelectContent(const std::vector<std::unique_ptr<EnhancedImageData>>& images,
                                      size_t count,
                                      const std::vector<std::string>& excluded_hashes = {});
+    // batch variant, by weights; excluded is either empty or has one bit per slot
+    std::vector<size_t> SelectContent(const ImageScoreTable& table,
+                                     size_t count,
+                                     const std::vector<bool>& excluded = {}) const;
     
     void SetScoringFunction(std::function<double(const EnhancedImageData&)> scorer);
+    void SetWeights(const ImageScoreTable::Weights& weights) { weights_ = weights; scoring_function_ = nullptr; }
     
     // Pre-defined scoring strategies
     static double QualityBasedScoring(const EnhancedImageData& image);
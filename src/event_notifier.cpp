@@ -0,0 +1,395 @@
+/*
+    Outbound Event Notifier Implementation
+    Copyright (C) 2024 StreamDAB Project
+*/
+
+#include "event_notifier.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace StreamDAB {
+
+struct EventNotifier::Endpoint {
+    struct Event {
+        std::chrono::steady_clock::time_point queued;
+        std::string json;
+    };
+
+    std::string url;
+    std::string host;
+    std::string port;
+    std::string path;
+
+    std::deque<Event> events;
+    size_t bytes = 0;
+    std::chrono::steady_clock::time_point retry_at;     // while backing off
+    std::chrono::milliseconds backoff{0};
+
+    // owned by the loop
+    int fd = -1;
+    std::string in;     // received, not yet processed
+
+    void Close() {
+        if (fd != -1) {
+            close(fd);
+            fd = -1;
+        }
+        in.clear();
+    }
+};
+
+static bool ParseURL(const std::string& url, std::string& host, std::string& port, std::string& path) {
+    const std::string scheme = "http://";
+    if (url.compare(0, scheme.size(), scheme) != 0) {
+        return false;
+    }
+
+    size_t host_end = url.find_first_of(":/", scheme.size());
+    host = url.substr(scheme.size(), host_end - scheme.size());
+    if (host.empty()) {
+        return false;
+    }
+
+    port = "80";
+    path = "/";
+    if (host_end == std::string::npos) {
+        return true;
+    }
+    size_t path_start = url.find('/', host_end);
+    if (url[host_end] == ':') {
+        port = url.substr(host_end + 1, path_start == std::string::npos ? std::string::npos : path_start - host_end - 1);
+        if (port.empty() || port.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+    }
+    if (path_start != std::string::npos) {
+        path = url.substr(path_start);
+    }
+    return true;
+}
+
+EventNotifier::EventNotifier(const Config& config) : config_(config) {
+    thread_ = std::thread(&EventNotifier::Loop, this);
+}
+
+EventNotifier::EventNotifier() : EventNotifier(Config{}) {
+}
+
+EventNotifier::~EventNotifier() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    wake_.notify_one();
+    thread_.join();
+
+    for (auto& endpoint : endpoints_) {
+        endpoint.second->Close();
+    }
+}
+
+bool EventNotifier::Post(const std::string& url, std::string event) {
+    if (event.size() > config_.memory_budget) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = endpoints_.find(url);
+    if (it == endpoints_.end()) {
+        auto endpoint = std::make_unique<Endpoint>();
+        if (!ParseURL(url, endpoint->host, endpoint->port, endpoint->path)) {
+            std::cerr << "EventNotifier: unsupported URL '" << url << "'" << std::endl;
+            return false;
+        }
+        endpoint->url = url;
+        it = endpoints_.emplace(url, std::move(endpoint)).first;
+    }
+
+    Endpoint& endpoint = *it->second;
+    endpoint.bytes += event.size();
+    queued_bytes_ += event.size();
+    endpoint.events.push_back({std::chrono::steady_clock::now(), std::move(event)});
+    stats_.events_posted++;
+    EnforceBudget();
+
+    // the first event starts the batch delay, a full batch is due at once
+    if (endpoint.events.size() == 1 || endpoint.events.size() >= config_.max_batch_events) {
+        wake_.notify_one();
+    }
+    return true;
+}
+
+EventNotifier::Statistics EventNotifier::GetStatistics() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void EventNotifier::EnforceBudget() {
+    // the oldest events of the endpoint queueing the most
+    while (queued_bytes_ > config_.memory_budget) {
+        Endpoint* largest = nullptr;
+        for (auto& endpoint : endpoints_) {
+            if (!endpoint.second->events.empty() && (!largest || endpoint.second->bytes > largest->bytes)) {
+                largest = endpoint.second.get();
+            }
+        }
+        if (!largest) {
+            break;
+        }
+        const size_t size = largest->events.front().json.size();
+        largest->bytes -= size;
+        queued_bytes_ -= size;
+        largest->events.pop_front();
+        stats_.events_dropped++;
+    }
+}
+
+void EventNotifier::Loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        // an endpoint with a batch due; when stopping, all get a last attempt
+        const auto now = std::chrono::steady_clock::now();
+        auto wakeup = std::chrono::steady_clock::time_point::max();
+        Endpoint* due = nullptr;
+        for (auto& entry : endpoints_) {
+            Endpoint& endpoint = *entry.second;
+            if (endpoint.events.empty()) {
+                continue;
+            }
+            auto ready = endpoint.events.size() >= config_.max_batch_events ? now :
+                         endpoint.events.front().queued + config_.max_batch_delay;
+            ready = std::max(ready, endpoint.retry_at);
+            if (!running_ || ready <= now) {
+                due = &endpoint;
+                break;
+            }
+            wakeup = std::min(wakeup, ready);
+        }
+
+        if (!due) {
+            if (!running_) {
+                return;
+            }
+            if (wakeup == std::chrono::steady_clock::time_point::max()) {
+                wake_.wait(lock);
+            } else {
+                wake_.wait_until(lock, wakeup);
+            }
+            continue;
+        }
+
+        // the batch leaves the queue while it is sent, and returns on failure
+        const size_t count = std::min(config_.max_batch_events, due->events.size());
+        std::deque<Endpoint::Event> batch(std::make_move_iterator(due->events.begin()),
+                                          std::make_move_iterator(due->events.begin() + count));
+        due->events.erase(due->events.begin(), due->events.begin() + count);
+        std::string body = "[";
+        size_t bytes = 0;
+        for (const auto& event : batch) {
+            if (body.size() > 1) {
+                body += ',';
+            }
+            body += event.json;
+            bytes += event.json.size();
+        }
+        body += ']';
+        due->bytes -= bytes;
+        queued_bytes_ -= bytes;
+        stats_.requests++;
+        const bool last_attempt = !running_;
+
+        lock.unlock();
+        int status = 0;
+        bool sent = SendBatch(*due, body, status);
+        lock.lock();
+
+        if (sent && status >= 200 && status < 300) {
+            stats_.events_sent += count;
+            due->backoff = std::chrono::milliseconds{0};
+            due->retry_at = std::chrono::steady_clock::time_point();
+            continue;
+        }
+
+        stats_.requests_failed++;
+        std::cerr << "EventNotifier: error while posting to '" << due->url << "': "
+                  << (sent ? "HTTP status " + std::to_string(status) : std::string("no response")) << std::endl;
+
+        // a rejected batch would be rejected again
+        const bool permanent = sent && status >= 400 && status < 500 && status != 408 && status != 429;
+        if (permanent || last_attempt) {
+            stats_.events_dropped += count;
+            if (last_attempt) {
+                stats_.events_dropped += due->events.size();
+                queued_bytes_ -= due->bytes;
+                due->bytes = 0;
+                due->events.clear();
+            }
+            continue;
+        }
+
+        due->backoff = due->backoff.count() ? std::min(due->backoff * 2, config_.max_backoff) : config_.initial_backoff;
+        due->retry_at = std::chrono::steady_clock::now() + due->backoff;
+        due->events.insert(due->events.begin(), std::make_move_iterator(batch.begin()),
+                           std::make_move_iterator(batch.end()));
+        due->bytes += bytes;
+        queued_bytes_ += bytes;
+        EnforceBudget();
+    }
+}
+
+bool EventNotifier::Connect(Endpoint& endpoint) {
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses;
+    int ret = getaddrinfo(endpoint.host.c_str(), endpoint.port.c_str(), &hints, &addresses);
+    if (ret != 0) {
+        std::cerr << "EventNotifier: cannot resolve host '" << endpoint.host << "': " << gai_strerror(ret) << std::endl;
+        return false;
+    }
+
+    // the timeouts apply to connecting as well
+    struct timeval timeout = {};
+    timeout.tv_sec = config_.request_timeout.count();
+    for (struct addrinfo* address = addresses; address && endpoint.fd == -1; address = address->ai_next) {
+        endpoint.fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+        if (endpoint.fd == -1) {
+            continue;
+        }
+        setsockopt(endpoint.fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        setsockopt(endpoint.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (connect(endpoint.fd, address->ai_addr, address->ai_addrlen) == -1) {
+            endpoint.Close();
+        }
+    }
+    freeaddrinfo(addresses);
+    return endpoint.fd != -1;
+}
+
+bool EventNotifier::SendBatch(Endpoint& endpoint, const std::string& body, int& status) {
+    const std::string request =
+        "POST " + endpoint.path + " HTTP/1.1\r\n"
+        "Host: " + (endpoint.port == "80" ? endpoint.host : endpoint.host + ":" + endpoint.port) + "\r\n"
+        "User-Agent: ODR-PadEnc\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n" + body;
+
+    for (;;) {
+        const bool reused = endpoint.fd != -1;
+        if (!reused && !Connect(endpoint)) {
+            return false;
+        }
+
+        bool sent = true;
+        for (size_t pos = 0; pos < request.size();) {
+            ssize_t n = send(endpoint.fd, request.data() + pos, request.size() - pos, MSG_NOSIGNAL);
+            if (n == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                sent = false;
+                break;
+            }
+            pos += n;
+        }
+        if (sent && ReadResponse(endpoint, status)) {
+            return true;
+        }
+
+        // a kept-alive connection may have been closed by the server meanwhile
+        const bool received = status != 0;
+        endpoint.Close();
+        if (!reused || received) {
+            return false;
+        }
+    }
+}
+
+bool EventNotifier::ReadResponse(Endpoint& endpoint, int& status) {
+    char buffer[4096];
+    auto receive = [&]() {
+        ssize_t n;
+        do {
+            n = recv(endpoint.fd, buffer, sizeof(buffer), 0);
+        } while (n == -1 && errno == EINTR);
+        if (n > 0) {
+            endpoint.in.append(buffer, n);
+        }
+        return n > 0;
+    };
+
+    size_t head_end;
+    while ((head_end = endpoint.in.find("\r\n\r\n")) == std::string::npos) {
+        if (endpoint.in.size() > 65536 || !receive()) {
+            return false;
+        }
+    }
+    std::string head = endpoint.in.substr(0, head_end);
+    endpoint.in.erase(0, head_end + 4);
+    if (head.compare(0, 5, "HTTP/") != 0 || head.size() < 12) {
+        return false;
+    }
+    status = atoi(head.c_str() + 9);
+
+    // only a body of known length keeps the connection usable
+    bool keep_alive = head.compare(5, 3, "1.0") != 0;
+    bool has_length = false;
+    size_t length = 0;
+    for (size_t pos = head.find("\r\n"); pos != std::string::npos;) {
+        size_t next = head.find("\r\n", pos + 2);
+        std::string header = head.substr(pos + 2, next == std::string::npos ? std::string::npos : next - pos - 2);
+        pos = next;
+
+        size_t colon = header.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string name = header.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return tolower(c); });
+        std::string value = header.substr(colon + 1);
+        std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return tolower(c); });
+
+        if (name == "content-length") {
+            has_length = true;
+            length = strtoull(value.c_str(), nullptr, 10);
+        } else if (name == "transfer-encoding") {
+            has_length = false;
+            keep_alive = false;
+        } else if (name == "connection") {
+            if (value.find("close") != std::string::npos) {
+                keep_alive = false;
+            } else if (value.find("keep-alive") != std::string::npos) {
+                keep_alive = true;
+            }
+        }
+    }
+    if (status == 204 || status == 304) {
+        has_length = true;
+        length = 0;
+    }
+
+    if (keep_alive && has_length) {
+        while (endpoint.in.size() < length) {
+            if (!receive()) {
+                endpoint.Close();
+                return true;    // the status is known nonetheless
+            }
+        }
+        endpoint.in.erase(0, length);
+    } else {
+        endpoint.Close();
+    }
+    return true;
+}
+
+} // namespace StreamDAB
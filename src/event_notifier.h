@@ -0,0 +1,85 @@
+/*
+    Outbound Event Notifier
+    Copyright (C) 2024 StreamDAB Project
+
+    Queues events for external services (content manager, compliance monitor)
+    Batched HTTP POSTs over kept-alive connections
+    Retries with backoff, within a bounded memory budget
+*/
+
+#ifndef EVENT_NOTIFIER_H_
+#define EVENT_NOTIFIER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace StreamDAB {
+
+// Delivers events to HTTP endpoints from its own thread, so that posting
+// never waits for the network. The events for an endpoint are sent as one
+// JSON array per request, once enough of them are queued or the oldest has
+// waited long enough. A failed request is retried with exponential backoff;
+// while an endpoint is unreachable, its oldest events are dropped to keep
+// the queued events within the memory budget.
+// Only plain http:// URLs are supported; host names are resolved blocking,
+// in the notifier's own thread.
+class EventNotifier {
+public:
+    struct Config {
+        size_t max_batch_events = 64;
+        std::chrono::milliseconds max_batch_delay{500};
+        size_t memory_budget = 1024 * 1024;     // bytes of queued events, all endpoints
+        std::chrono::milliseconds initial_backoff{1000};
+        std::chrono::milliseconds max_backoff{60000};
+        std::chrono::seconds request_timeout{10};
+    };
+
+    struct Statistics {
+        size_t events_posted = 0;
+        size_t events_sent = 0;
+        size_t events_dropped = 0;
+        size_t requests = 0;
+        size_t requests_failed = 0;
+    };
+
+    EventNotifier();
+    explicit EventNotifier(const Config& config);
+    // Makes a last attempt to send what is queued
+    ~EventNotifier();
+
+    // Queues an event (a JSON value) for the endpoint at url. false, if the
+    // URL is not supported or the event alone exceeds the memory budget.
+    bool Post(const std::string& url, std::string event);
+
+    Statistics GetStatistics() const;
+
+private:
+    struct Endpoint;
+
+    const Config config_;
+    std::thread thread_;
+    bool running_ = true;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::map<std::string, std::unique_ptr<Endpoint>> endpoints_;    // by URL
+    size_t queued_bytes_ = 0;
+    Statistics stats_;
+
+    void Loop();
+    void EnforceBudget();
+    bool SendBatch(Endpoint& endpoint, const std::string& body, int& status);
+    bool Connect(Endpoint& endpoint);
+    bool ReadResponse(Endpoint& endpoint, int& status);
+};
+
+} // namespace StreamDAB
+
+#endif // EVENT_NOTIFIER_H_
@@ -0,0 +1,934 @@
+/*
+    Asynchronous Feed Fetcher Implementation
+    Copyright (C) 2024 StreamDAB Project
+*/
+
+#include "feed_fetcher.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace StreamDAB {
+
+// --- XMLFeedParser ---
+
+void XMLFeedParser::Reset() {
+    state_ = State::TEXT;
+    tag_.clear();
+    quote_ = 0;
+    entity_.clear();
+    special_.clear();
+    in_item_ = false;
+    field_.clear();
+    text_.clear();
+    item_ = FeedItem();
+    item_has_id_ = false;
+}
+
+void XMLFeedParser::AppendText(const std::string& text) {
+    if (!field_.empty() && text_.size() < MAX_TEXT_LEN) {
+        text_.append(text, 0, MAX_TEXT_LEN - text_.size());
+    }
+}
+
+std::string XMLFeedParser::DecodeEntity(const std::string& entity) {
+    if (entity == "amp") return "&";
+    if (entity == "lt") return "<";
+    if (entity == "gt") return ">";
+    if (entity == "quot") return "\"";
+    if (entity == "apos") return "'";
+
+    if (entity.size() > 1 && entity[0] == '#') {
+        unsigned long cp;
+        try {
+            cp = entity[1] == 'x' || entity[1] == 'X' ? std::stoul(entity.substr(2), nullptr, 16) : std::stoul(entity.substr(1));
+        } catch (const std::exception&) {
+            return "";
+        }
+
+        // as UTF-8
+        std::string utf8;
+        if (cp < 0x80) {
+            utf8 += (char) cp;
+        } else if (cp < 0x800) {
+            utf8 += (char) (0xC0 | (cp >> 6));
+            utf8 += (char) (0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            utf8 += (char) (0xE0 | (cp >> 12));
+            utf8 += (char) (0x80 | ((cp >> 6) & 0x3F));
+            utf8 += (char) (0x80 | (cp & 0x3F));
+        } else if (cp < 0x110000) {
+            utf8 += (char) (0xF0 | (cp >> 18));
+            utf8 += (char) (0x80 | ((cp >> 12) & 0x3F));
+            utf8 += (char) (0x80 | ((cp >> 6) & 0x3F));
+            utf8 += (char) (0x80 | (cp & 0x3F));
+        }
+        return utf8;
+    }
+
+    return "&" + entity + ";";  // unknown entity
+}
+
+std::string XMLFeedParser::GetAttribute(const std::string& tag, const std::string& name) {
+    for (size_t pos = tag.find(name + "="); pos != std::string::npos; pos = tag.find(name + "=", pos + 1)) {
+        if (pos == 0 || !isspace((unsigned char) tag[pos - 1])) {
+            continue;
+        }
+        size_t start = pos + name.size() + 1;
+        if (start >= tag.size() || (tag[start] != '"' && tag[start] != '\'')) {
+            continue;
+        }
+        size_t end = tag.find(tag[start], start + 1);
+        if (end != std::string::npos) {
+            return tag.substr(start + 1, end - start - 1);
+        }
+    }
+    return "";
+}
+
+void XMLFeedParser::HandleTag(const ItemHandler& handler) {
+    if (tag_.empty() || tag_[0] == '?' || tag_[0] == '!') {
+        return;     // declaration/doctype
+    }
+
+    const bool closing = tag_[0] == '/';
+    const bool self_closing = tag_.back() == '/';
+    size_t name_start = closing ? 1 : 0;
+    size_t name_end = tag_.find_first_of(" \t\r\n/", name_start);
+    if (name_end == std::string::npos) {
+        name_end = tag_.size();
+    }
+    std::string name = tag_.substr(name_start, name_end - name_start);
+    size_t colon = name.find(':');
+    if (colon != std::string::npos) {
+        name.erase(0, colon + 1);   // namespace prefix
+    }
+
+    if (name == "item" || name == "entry") {
+        if (closing) {
+            if (in_item_ && !item_.text.empty()) {
+                if (item_.id.empty()) {
+                    item_.id = item_.text;
+                }
+                handler(std::move(item_));
+            }
+            in_item_ = false;
+        } else if (!self_closing) {
+            in_item_ = true;
+            item_ = FeedItem();
+            item_has_id_ = false;
+        }
+        field_.clear();
+        return;
+    }
+    if (!in_item_) {
+        return;
+    }
+
+    if (closing) {
+        if (name != field_) {
+            return;
+        }
+        if (name == "title") {
+            // collapse whitespace
+            std::string title;
+            for (char c : text_) {
+                if (isspace((unsigned char) c)) {
+                    if (!title.empty() && title.back() != ' ') {
+                        title += ' ';
+                    }
+                } else {
+                    title += c;
+                }
+            }
+            if (!title.empty() && title.back() == ' ') {
+                title.pop_back();
+            }
+            item_.text = title;
+        } else if (name == "guid" || name == "id") {
+            item_.id = text_;
+            item_has_id_ = true;
+        } else if (name == "link" && !item_has_id_) {
+            item_.id = text_;
+        }
+        field_.clear();
+    } else if (name == "link" && self_closing) {
+        // Atom
+        if (!item_has_id_ && item_.id.empty()) {
+            item_.id = GetAttribute(tag_, "href");
+        }
+    } else if (!self_closing && (name == "title" || name == "guid" || name == "id" || name == "link")) {
+        field_ = name;
+        text_.clear();
+    }
+}
+
+void XMLFeedParser::Parse(const char* data, size_t len, const ItemHandler& handler) {
+    for (size_t i = 0; i < len; i++) {
+        const char c = data[i];
+        switch (state_) {
+        case State::TEXT:
+            if (c == '<') {
+                state_ = State::TAG;
+                tag_.clear();
+            } else if (c == '&') {
+                state_ = State::ENTITY;
+                entity_.clear();
+            } else if (!field_.empty() && text_.size() < MAX_TEXT_LEN) {
+                text_ += c;
+            }
+            break;
+        case State::ENTITY:
+            if (c == ';') {
+                AppendText(DecodeEntity(entity_));
+                state_ = State::TEXT;
+            } else if ((isalnum((unsigned char) c) || c == '#') && entity_.size() < 10) {
+                entity_ += c;
+            } else {
+                // not an entity: a literal ampersand, and the character again as text
+                AppendText("&" + entity_);
+                state_ = State::TEXT;
+                i--;
+            }
+            break;
+        case State::TAG:
+            if (c == '>') {
+                state_ = State::TEXT;
+                HandleTag(handler);
+            } else if (c == '"' || c == '\'') {
+                state_ = State::TAG_QUOTE;
+                quote_ = c;
+                tag_ += c;
+            } else {
+                tag_ += c;
+                if (tag_ == "![CDATA[") {
+                    state_ = State::CDATA;
+                    special_.clear();
+                } else if (tag_ == "!--") {
+                    state_ = State::COMMENT;
+                    special_.clear();
+                }
+            }
+            break;
+        case State::TAG_QUOTE:
+            tag_ += c;
+            if (c == quote_) {
+                state_ = State::TAG;
+            }
+            break;
+        case State::CDATA:
+        case State::COMMENT: {
+            // keep back the characters which may begin the end marker
+            const std::string end = state_ == State::CDATA ? "]]>" : "-->";
+            special_ += c;
+            if (special_ == end) {
+                state_ = State::TEXT;
+                special_.clear();
+                break;
+            }
+            // all but the longest end that may begin the end marker is content
+            size_t keep = std::min(special_.size(), end.size() - 1);
+            while (keep > 0 && special_.compare(special_.size() - keep, keep, end, 0, keep) != 0) {
+                keep--;
+            }
+            if (state_ == State::CDATA) {
+                AppendText(special_.substr(0, special_.size() - keep));
+            }
+            special_.erase(0, special_.size() - keep);
+            break;
+        }
+        }
+
+        if (tag_.size() > MAX_TEXT_LEN) {
+            tag_.clear();   // no tag of interest is that long
+        }
+    }
+}
+
+
+// --- JSONFeedParser ---
+
+void JSONFeedParser::Reset() {
+    in_string_ = false;
+    escape_ = false;
+    unicode_.clear();
+    high_surrogate_ = 0;
+    string_is_value_ = false;
+    after_colon_ = false;
+    string_.clear();
+    last_string_.clear();
+    current_key_.clear();
+}
+
+void JSONFeedParser::Parse(const char* data, size_t len, const ItemHandler& handler) {
+    for (size_t i = 0; i < len; i++) {
+        const char c = data[i];
+
+        if (!in_string_) {
+            if (c == '"') {
+                in_string_ = true;
+                string_is_value_ = after_colon_ && current_key_ == key_;
+                after_colon_ = false;
+                string_.clear();
+            } else if (c == ':') {
+                current_key_ = last_string_;
+                after_colon_ = true;
+            } else if (!isspace((unsigned char) c)) {
+                after_colon_ = false;
+            }
+            continue;
+        }
+
+        if (!unicode_.empty()) {
+            // \u escape: collect four hex digits
+            unicode_ += c;
+            if (unicode_.size() < 5) {
+                continue;
+            }
+            uint32_t cp = strtoul(unicode_.c_str() + 1, nullptr, 16);
+            unicode_.clear();
+            if (cp >= 0xD800 && cp < 0xDC00) {
+                high_surrogate_ = cp;
+                continue;
+            }
+            if (cp >= 0xDC00 && cp < 0xE000 && high_surrogate_) {
+                cp = 0x10000 + ((high_surrogate_ - 0xD800) << 10) + (cp - 0xDC00);
+            }
+            high_surrogate_ = 0;
+
+            if (cp < 0x80) {
+                string_ += (char) cp;
+            } else if (cp < 0x800) {
+                string_ += (char) (0xC0 | (cp >> 6));
+                string_ += (char) (0x80 | (cp & 0x3F));
+            } else if (cp < 0x10000) {
+                string_ += (char) (0xE0 | (cp >> 12));
+                string_ += (char) (0x80 | ((cp >> 6) & 0x3F));
+                string_ += (char) (0x80 | (cp & 0x3F));
+            } else {
+                string_ += (char) (0xF0 | (cp >> 18));
+                string_ += (char) (0x80 | ((cp >> 12) & 0x3F));
+                string_ += (char) (0x80 | ((cp >> 6) & 0x3F));
+                string_ += (char) (0x80 | (cp & 0x3F));
+            }
+            continue;
+        }
+
+        if (escape_) {
+            escape_ = false;
+            switch (c) {
+            case 'n': string_ += '\n'; break;
+            case 't': string_ += '\t'; break;
+            case 'r': string_ += '\r'; break;
+            case 'b': string_ += '\b'; break;
+            case 'f': string_ += '\f'; break;
+            case 'u': unicode_ = "u"; break;
+            default:  string_ += c; break;
+            }
+            continue;
+        }
+
+        if (c == '\\') {
+            escape_ = true;
+        } else if (c == '"') {
+            in_string_ = false;
+            if (string_is_value_) {
+                if (!string_.empty()) {
+                    FeedItem item;
+                    item.id = string_;
+                    item.text = std::move(string_);
+                    handler(std::move(item));
+                }
+            } else {
+                last_string_ = std::move(string_);
+            }
+            string_.clear();
+        } else if (string_.size() < MAX_TEXT_LEN) {
+            string_ += c;
+        }
+    }
+}
+
+
+// --- FeedFetcher ---
+
+const std::chrono::seconds FeedFetcher::REQUEST_TIMEOUT{30};
+
+struct FeedFetcher::Feed {
+    std::string url;
+    std::string host;
+    std::string port;
+    std::string path;
+    std::unique_ptr<FeedParser> parser;
+    ItemHandler handler;
+    std::chrono::seconds interval;
+    std::chrono::steady_clock::time_point next_poll;
+    bool busy = false;
+
+    // for conditional requests
+    std::string etag;
+    std::string last_modified;
+
+    // IDs of the items of the last response, and of the current one
+    std::set<std::string> seen;
+    std::set<std::string> current;
+
+    std::string Server() const { return host + ":" + port; }
+};
+
+struct FeedFetcher::Connection {
+    enum class State { CONNECTING, SENDING, HEADERS, BODY, IDLE };
+    enum class Framing { LENGTH, CHUNKED, CLOSE };
+    enum class ChunkState { SIZE, DATA, DATA_END, TRAILER };
+
+    int fd = -1;
+    std::string server;
+    State state = State::CONNECTING;
+    Feed* feed = nullptr;       // the feed requested, if any
+    bool reused = false;
+    bool received = false;      // anything of the response
+    std::chrono::steady_clock::time_point deadline;
+
+    std::string out;
+    size_t out_pos = 0;
+
+    // response
+    std::string head;
+    int status = 0;
+    bool keep_alive = true;
+    std::string etag;
+    std::string last_modified;
+    Framing framing = Framing::CLOSE;
+    size_t remaining = 0;       // of the body or the current chunk
+    ChunkState chunk_state = ChunkState::SIZE;
+    std::string line;
+    bool complete = false;
+
+    void Close() {
+        if (fd != -1) {
+            close(fd);
+            fd = -1;
+        }
+    }
+};
+
+static bool ParseURL(const std::string& url, std::string& host, std::string& port, std::string& path) {
+    const std::string scheme = "http://";
+    if (url.compare(0, scheme.size(), scheme) != 0) {
+        return false;
+    }
+
+    size_t host_end = url.find_first_of(":/", scheme.size());
+    host = url.substr(scheme.size(), host_end - scheme.size());
+    if (host.empty()) {
+        return false;
+    }
+
+    port = "80";
+    path = "/";
+    if (host_end == std::string::npos) {
+        return true;
+    }
+    size_t path_start = url.find('/', host_end);
+    if (url[host_end] == ':') {
+        port = url.substr(host_end + 1, path_start == std::string::npos ? std::string::npos : path_start - host_end - 1);
+        if (port.empty() || port.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+    }
+    if (path_start != std::string::npos) {
+        path = url.substr(path_start);
+    }
+    return true;
+}
+
+static std::string ToLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return tolower(c); });
+    return s;
+}
+
+FeedFetcher::FeedFetcher() {
+    if (pipe2(wake_pipe_, O_NONBLOCK | O_CLOEXEC) == -1) {
+        wake_pipe_[0] = wake_pipe_[1] = -1;
+        perror("FeedFetcher: error while creating wake pipe");
+    }
+}
+
+FeedFetcher::~FeedFetcher() {
+    Stop();
+    for (int fd : wake_pipe_) {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+}
+
+bool FeedFetcher::AddFeed(const std::string& url, std::unique_ptr<FeedParser> parser, ItemHandler handler,
+                          std::chrono::seconds interval) {
+    auto feed = std::make_unique<Feed>();
+    if (!parser || !ParseURL(url, feed->host, feed->port, feed->path)) {
+        std::cerr << "FeedFetcher: unsupported feed URL '" << url << "'" << std::endl;
+        return false;
+    }
+    feed->url = url;
+    feed->parser = std::move(parser);
+    feed->handler = handler;
+    feed->interval = interval;
+    feed->next_poll = std::chrono::steady_clock::now();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        new_feeds_.push_back(std::move(feed));
+    }
+    Wake();
+    return true;
+}
+
+void FeedFetcher::Start() {
+    if (wake_pipe_[0] != -1 && !running_.exchange(true)) {
+        thread_ = std::thread(&FeedFetcher::Loop, this);
+    }
+}
+
+void FeedFetcher::Stop() {
+    if (running_.exchange(false)) {
+        Wake();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+}
+
+FeedFetcher::Statistics FeedFetcher::GetStatistics() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void FeedFetcher::CountStat(size_t Statistics::* counter, size_t n) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.*counter += n;
+}
+
+void FeedFetcher::Wake() {
+    if (wake_pipe_[1] != -1 && write(wake_pipe_[1], "", 1) == -1 && errno != EAGAIN) {
+        perror("FeedFetcher: error while waking");
+    }
+}
+
+void FeedFetcher::StartRequest(Feed& feed, bool allow_reuse) {
+    feed.busy = true;
+    feed.current.clear();
+    feed.parser->Reset();
+    CountStat(&Statistics::requests);
+
+    // an idle connection to the same server, if any
+    const std::string server = feed.Server();
+    Connection* conn = nullptr;
+    if (allow_reuse) {
+        for (auto& idle : connections_) {
+            if (idle->fd != -1 && idle->state == Connection::State::IDLE && idle->server == server) {
+                conn = idle.get();
+                break;
+            }
+        }
+    }
+
+    if (conn) {
+        const int fd = conn->fd;
+        *conn = Connection();
+        conn->fd = fd;
+        conn->server = server;
+        conn->reused = true;
+        conn->state = Connection::State::SENDING;
+    } else {
+        connections_.push_back(std::make_unique<Connection>());
+        conn = connections_.back().get();
+        conn->server = server;
+
+        struct addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo* addresses;
+        int ret = getaddrinfo(feed.host.c_str(), feed.port.c_str(), &hints, &addresses);
+        if (ret != 0) {
+            conn->feed = &feed;
+            Finish(*conn, false, std::string("cannot resolve host: ") + gai_strerror(ret));
+            return;
+        }
+        for (struct addrinfo* address = addresses; address && conn->fd == -1; address = address->ai_next) {
+            conn->fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+            if (conn->fd == -1) {
+                continue;
+            }
+            if (connect(conn->fd, address->ai_addr, address->ai_addrlen) == 0) {
+                conn->state = Connection::State::SENDING;
+            } else if (errno == EINPROGRESS) {
+                conn->state = Connection::State::CONNECTING;
+            } else {
+                conn->Close();
+            }
+        }
+        freeaddrinfo(addresses);
+        if (conn->fd == -1) {
+            conn->feed = &feed;
+            Finish(*conn, false, std::string("cannot connect: ") + strerror(errno));
+            return;
+        }
+    }
+
+    conn->feed = &feed;
+    conn->deadline = std::chrono::steady_clock::now() + REQUEST_TIMEOUT;
+    conn->out = "GET " + feed.path + " HTTP/1.1\r\n"
+                "Host: " + (feed.port == "80" ? feed.host : server) + "\r\n"
+                "User-Agent: ODR-PadEnc\r\n"
+                "Accept-Encoding: identity\r\n"
+                "Connection: keep-alive\r\n";
+    if (!feed.etag.empty()) {
+        conn->out += "If-None-Match: " + feed.etag + "\r\n";
+    }
+    if (!feed.last_modified.empty()) {
+        conn->out += "If-Modified-Since: " + feed.last_modified + "\r\n";
+    }
+    conn->out += "\r\n";
+}
+
+bool FeedFetcher::Send(Connection& conn) {
+    while (conn.out_pos < conn.out.size()) {
+        ssize_t sent = send(conn.fd, conn.out.data() + conn.out_pos, conn.out.size() - conn.out_pos, MSG_NOSIGNAL);
+        if (sent == -1) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        conn.out_pos += sent;
+    }
+    conn.state = Connection::State::HEADERS;
+    return true;
+}
+
+bool FeedFetcher::ProcessHeaders(Connection& conn) {
+    size_t head_end = conn.head.find("\r\n\r\n");
+    if (head_end == std::string::npos) {
+        return conn.head.size() < 65536;
+    }
+    std::string body = conn.head.substr(head_end + 4);
+    conn.head.resize(head_end);
+
+    // status line
+    if (conn.head.compare(0, 5, "HTTP/") != 0 || conn.head.size() < 12) {
+        return false;
+    }
+    conn.keep_alive = conn.head.compare(5, 3, "1.0") != 0;
+    conn.status = atoi(conn.head.c_str() + 9);
+
+    bool chunked = false;
+    bool has_length = false;
+    size_t length = 0;
+    for (size_t pos = conn.head.find("\r\n"); pos != std::string::npos;) {
+        size_t next = conn.head.find("\r\n", pos + 2);
+        std::string header = conn.head.substr(pos + 2, next == std::string::npos ? std::string::npos : next - pos - 2);
+        pos = next;
+
+        size_t colon = header.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string name = ToLower(header.substr(0, colon));
+        size_t value_start = header.find_first_not_of(" \t", colon + 1);
+        std::string value = value_start == std::string::npos ? "" : header.substr(value_start);
+
+        if (name == "content-length") {
+            has_length = true;
+            length = strtoull(value.c_str(), nullptr, 10);
+        } else if (name == "transfer-encoding") {
+            chunked = ToLower(value).find("chunked") != std::string::npos;
+        } else if (name == "connection") {
+            std::string option = ToLower(value);
+            if (option.find("close") != std::string::npos) {
+                conn.keep_alive = false;
+            } else if (option.find("keep-alive") != std::string::npos) {
+                conn.keep_alive = true;
+            }
+        } else if (name == "etag") {
+            conn.etag = value;
+        } else if (name == "last-modified") {
+            conn.last_modified = value;
+        }
+    }
+
+    conn.state = Connection::State::BODY;
+    if (conn.status == 304 || conn.status == 204 || conn.status < 200) {
+        conn.framing = Connection::Framing::LENGTH;
+        conn.remaining = 0;
+    } else if (chunked) {
+        conn.framing = Connection::Framing::CHUNKED;
+    } else if (has_length) {
+        conn.framing = Connection::Framing::LENGTH;
+        conn.remaining = length;
+    } else {
+        conn.framing = Connection::Framing::CLOSE;
+    }
+    conn.complete = conn.framing == Connection::Framing::LENGTH && conn.remaining == 0;
+
+    return ProcessBody(conn, body.data(), body.size());
+}
+
+bool FeedFetcher::ProcessBody(Connection& conn, const char* data, size_t len) {
+    Feed& feed = *conn.feed;
+    auto deliver = [&](const char* part, size_t part_len) {
+        if (conn.status != 200 || part_len == 0) {
+            return;
+        }
+        feed.parser->Parse(part, part_len, [&](FeedItem&& item) {
+            if (!feed.current.insert(item.id).second || feed.seen.count(item.id)) {
+                return;
+            }
+            CountStat(&Statistics::items);
+            feed.handler(std::move(item));
+        });
+    };
+
+    switch (conn.framing) {
+    case Connection::Framing::CLOSE:
+        deliver(data, len);
+        return true;
+    case Connection::Framing::LENGTH: {
+        size_t part = std::min(conn.remaining, len);
+        deliver(data, part);
+        conn.remaining -= part;
+        conn.complete = conn.remaining == 0;
+        return true;
+    }
+    case Connection::Framing::CHUNKED:
+        break;
+    }
+
+    for (size_t i = 0; i < len && !conn.complete;) {
+        if (conn.chunk_state == Connection::ChunkState::DATA) {
+            size_t part = std::min(conn.remaining, len - i);
+            deliver(data + i, part);
+            i += part;
+            conn.remaining -= part;
+            if (conn.remaining == 0) {
+                conn.chunk_state = Connection::ChunkState::DATA_END;
+            }
+            continue;
+        }
+
+        // a line: chunk size, end of chunk data or trailer
+        const char c = data[i++];
+        if (c != '\n') {
+            if (c != '\r' && conn.line.size() < 1024) {
+                conn.line += c;
+            }
+            continue;
+        }
+        switch (conn.chunk_state) {
+        case Connection::ChunkState::SIZE: {
+            char* end;
+            conn.remaining = strtoull(conn.line.c_str(), &end, 16);
+            if (end == conn.line.c_str()) {
+                return false;
+            }
+            conn.chunk_state = conn.remaining ? Connection::ChunkState::DATA : Connection::ChunkState::TRAILER;
+            break;
+        }
+        case Connection::ChunkState::DATA_END:
+            conn.chunk_state = Connection::ChunkState::SIZE;
+            break;
+        case Connection::ChunkState::TRAILER:
+            conn.complete = conn.line.empty();
+            break;
+        case Connection::ChunkState::DATA:
+            break;
+        }
+        conn.line.clear();
+    }
+    return true;
+}
+
+bool FeedFetcher::Receive(Connection& conn) {
+    char buffer[16384];
+    for (int reads = 0; reads < 16 && !conn.complete; reads++) {
+        ssize_t received = recv(conn.fd, buffer, sizeof(buffer), 0);
+        if (received == -1) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (received == 0) {
+            // closed by the server; completes a body without length
+            if (conn.state == Connection::State::BODY && conn.framing == Connection::Framing::CLOSE) {
+                conn.complete = true;
+                return true;
+            }
+            return false;
+        }
+        conn.received = true;
+
+        if (conn.state == Connection::State::HEADERS) {
+            conn.head.append(buffer, received);
+            if (!ProcessHeaders(conn)) {
+                return false;
+            }
+        } else if (!ProcessBody(conn, buffer, received)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FeedFetcher::HandleEvent(Connection& conn, short revents) {
+    if (conn.state == Connection::State::IDLE) {
+        conn.Close();   // closed by the server, or unexpected data
+        return;
+    }
+
+    if (conn.state == Connection::State::CONNECTING) {
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+        if (getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &error_len) == -1) {
+            error = errno;
+        }
+        if (error) {
+            Finish(conn, false, std::string("cannot connect: ") + strerror(error));
+            return;
+        }
+        conn.state = Connection::State::SENDING;
+    }
+
+    if (conn.state == Connection::State::SENDING) {
+        if (!Send(conn)) {
+            Finish(conn, false, std::string("cannot send request: ") + strerror(errno));
+        }
+        return;
+    }
+
+    if (!Receive(conn)) {
+        Finish(conn, false, conn.received ? "invalid or incomplete response" : "connection closed");
+    } else if (conn.complete) {
+        Finish(conn, true);
+    }
+}
+
+void FeedFetcher::Finish(Connection& conn, bool success, const std::string& error) {
+    Feed& feed = *conn.feed;
+    conn.feed = nullptr;
+    if (success && conn.keep_alive && conn.framing != Connection::Framing::CLOSE) {
+        conn.state = Connection::State::IDLE;
+    } else {
+        conn.Close();
+    }
+
+    // a kept-alive connection may have been closed by the server meanwhile
+    if (!success && conn.reused && !conn.received) {
+        StartRequest(feed, false);
+        return;
+    }
+
+    feed.busy = false;
+    feed.next_poll = std::chrono::steady_clock::now() + feed.interval;
+
+    if (success && conn.status == 200) {
+        feed.etag = conn.etag;
+        feed.last_modified = conn.last_modified;
+        feed.seen.swap(feed.current);
+    } else if (success && conn.status == 304) {
+        CountStat(&Statistics::not_modified);
+    } else {
+        CountStat(&Statistics::errors);
+        std::cerr << "FeedFetcher: error while fetching '" << feed.url << "': "
+                  << (success ? "HTTP status " + std::to_string(conn.status) : error) << std::endl;
+
+        // do not hand out again what was handed out before the error
+        feed.seen.insert(feed.current.begin(), feed.current.end());
+    }
+    feed.current.clear();
+}
+
+void FeedFetcher::Loop() {
+    std::vector<struct pollfd> fds;
+    std::vector<Connection*> polled;
+
+    while (running_) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto& feed : new_feeds_) {
+                feeds_.push_back(std::move(feed));
+            }
+            new_feeds_.clear();
+        }
+
+        // requests due, and requests timed out
+        auto now = std::chrono::steady_clock::now();
+        for (auto& feed : feeds_) {
+            if (!feed->busy && now >= feed->next_poll) {
+                StartRequest(*feed);
+            }
+        }
+        for (size_t i = 0; i < connections_.size(); i++) {
+            Connection* conn = connections_[i].get();
+            if (conn->feed && now >= conn->deadline) {
+                conn->Close();
+                Finish(*conn, false, "timeout");
+            }
+        }
+        connections_.erase(std::remove_if(connections_.begin(), connections_.end(),
+                                          [](const std::unique_ptr<Connection>& conn) { return conn->fd == -1; }),
+                           connections_.end());
+
+        // wait for the sockets, the next request due or timing out, or being woken
+        auto wakeup = std::chrono::steady_clock::time_point::max();
+        for (auto& feed : feeds_) {
+            if (!feed->busy) {
+                wakeup = std::min(wakeup, feed->next_poll);
+            }
+        }
+        fds.assign(1, {wake_pipe_[0], POLLIN, 0});
+        polled.assign(1, nullptr);
+        for (auto& conn : connections_) {
+            bool writing = conn->state == Connection::State::CONNECTING || conn->state == Connection::State::SENDING;
+            fds.push_back({conn->fd, (short) (writing ? POLLOUT : POLLIN), 0});
+            polled.push_back(conn.get());
+            if (conn->feed) {
+                wakeup = std::min(wakeup, conn->deadline);
+            }
+        }
+
+        int timeout = -1;
+        if (wakeup != std::chrono::steady_clock::time_point::max()) {
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(wakeup - now).count() + 1;
+            timeout = (int) std::max<int64_t>(0, std::min<int64_t>(wait, 60000));
+        }
+        if (poll(fds.data(), fds.size(), timeout) == -1) {
+            if (errno != EINTR) {
+                perror("FeedFetcher: error while polling");
+                break;
+            }
+            continue;
+        }
+
+        if (fds[0].revents) {
+            char buffer[64];
+            while (read(wake_pipe_[0], buffer, sizeof(buffer)) > 0) {}
+        }
+        for (size_t i = 1; i < fds.size(); i++) {
+            if (fds[i].revents && polled[i]->fd != -1) {
+                HandleEvent(*polled[i], fds[i].revents);
+            }
+        }
+    }
+
+    for (auto& conn : connections_) {
+        conn->Close();
+    }
+    connections_.clear();
+    for (auto& feed : feeds_) {
+        feed->busy = false;
+    }
+}
+
+} // namespace StreamDAB
@@ -0,0 +1,157 @@
+/*
+    Asynchronous Feed Fetcher
+    Copyright (C) 2024 StreamDAB Project
+
+    Polls HTTP feeds from a single event loop
+    Conditional GET and connection reuse
+    Incremental extraction of new feed items
+*/
+
+#ifndef FEED_FETCHER_H_
+#define FEED_FETCHER_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace StreamDAB {
+
+// An item extracted from a feed
+struct FeedItem {
+    std::string id;     // GUID/ID/link, or the text if there is none
+    std::string text;
+};
+
+// Extracts items from a feed document while it arrives, in chunks of any size
+class FeedParser {
+public:
+    typedef std::function<void(FeedItem&& item)> ItemHandler;
+
+    virtual ~FeedParser() = default;
+    virtual void Reset() = 0;
+    virtual void Parse(const char* data, size_t len, const ItemHandler& handler) = 0;
+
+protected:
+    static const size_t MAX_TEXT_LEN = 4096;    // longer texts are cut
+};
+
+// RSS <item> and Atom <entry> elements: the text of their <title>, and their
+// <guid>/<id> (or else <link>) as ID
+class XMLFeedParser : public FeedParser {
+private:
+    enum class State { TEXT, TAG, TAG_QUOTE, ENTITY, CDATA, COMMENT };
+
+    State state_ = State::TEXT;
+    std::string tag_;
+    char quote_ = 0;
+    std::string entity_;
+    std::string special_;       // the end of a CDATA section/comment seen so far
+    bool in_item_ = false;
+    std::string field_;         // the item field whose text is collected, if any
+    std::string text_;
+    FeedItem item_;
+    bool item_has_id_ = false;
+
+    void HandleTag(const ItemHandler& handler);
+    void AppendText(const std::string& text);
+    static std::string DecodeEntity(const std::string& entity);
+    static std::string GetAttribute(const std::string& tag, const std::string& name);
+
+public:
+    void Reset() override;
+    void Parse(const char* data, size_t len, const ItemHandler& handler) override;
+};
+
+// The string values of a key, at any depth of a JSON document
+class JSONFeedParser : public FeedParser {
+private:
+    std::string key_;
+
+    bool in_string_ = false;
+    bool escape_ = false;
+    std::string unicode_;       // hex digits of a \u escape
+    uint32_t high_surrogate_ = 0;
+    bool string_is_value_ = false;
+    bool after_colon_ = false;
+    std::string string_;
+    std::string last_string_;
+    std::string current_key_;
+
+public:
+    explicit JSONFeedParser(const std::string& key) : key_(key) {}
+
+    void Reset() override;
+    void Parse(const char* data, size_t len, const ItemHandler& handler) override;
+};
+
+// Polls HTTP feeds in a single thread, with non-blocking sockets. Requests
+// are conditional (by ETag and Last-Modified), so an unchanged feed costs an
+// empty 304 response, and connections to the same server are kept alive and
+// reused. Response bodies are parsed while they arrive, and only items not
+// contained in the previous response are handed out.
+// Only plain http:// URLs are supported; host names are resolved blocking,
+// in the fetcher's own thread.
+class FeedFetcher {
+public:
+    typedef FeedParser::ItemHandler ItemHandler;
+
+    struct Statistics {
+        size_t requests = 0;
+        size_t not_modified = 0;
+        size_t items = 0;
+        size_t errors = 0;
+    };
+
+    FeedFetcher();
+    ~FeedFetcher();
+
+    // Polls the feed at url; the handler is called from the fetcher's thread,
+    // for each new item. false, if the URL is not supported.
+    bool AddFeed(const std::string& url, std::unique_ptr<FeedParser> parser, ItemHandler handler,
+                 std::chrono::seconds interval = std::chrono::seconds{300});
+
+    void Start();
+    void Stop();
+
+    Statistics GetStatistics() const;
+
+private:
+    struct Feed;
+    struct Connection;
+
+    static const std::chrono::seconds REQUEST_TIMEOUT;
+
+    std::thread thread_;
+    std::atomic<bool> running_{false};
+    int wake_pipe_[2] = {-1, -1};
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Feed>> new_feeds_;   // not yet taken over by the loop
+    Statistics stats_;
+
+    // owned by the loop
+    std::vector<std::unique_ptr<Feed>> feeds_;
+    std::vector<std::unique_ptr<Connection>> connections_;
+
+    void Loop();
+    void Wake();
+    void StartRequest(Feed& feed, bool allow_reuse = true);
+    void HandleEvent(Connection& conn, short revents);
+    bool Send(Connection& conn);
+    bool Receive(Connection& conn);
+    bool ProcessHeaders(Connection& conn);
+    bool ProcessBody(Connection& conn, const char* data, size_t len);
+    void Finish(Connection& conn, bool success, const std::string& error = "");
+    void CountStat(size_t Statistics::* counter, size_t n = 1);
+};
+
+} // namespace StreamDAB
+
+#endif // FEED_FETCHER_H_
@@ -0,0 +1,168 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file file_prefetcher.cpp
+    \brief Reads watched files ahead of need on a worker thread
+*/
+
+#include "file_prefetcher.h"
+#include "thread_placement.h"
+
+#include <fstream>
+#include <iterator>
+#include <time.h>
+#include <vector>
+
+
+// --- FilePrefetcher -----------------------------------------------------------------
+const std::chrono::milliseconds FilePrefetcher::DEFAULT_INTERVAL(100);
+
+FilePrefetcher& FilePrefetcher::Global() {
+    static FilePrefetcher prefetcher;
+    return prefetcher;
+}
+
+FilePrefetcher::~FilePrefetcher() {
+    {
+        std::lock_guard<std::mutex> lock(files_mutex);
+        stop = true;
+    }
+    wakeup.notify_one();
+    if (thread.joinable())
+        thread.join();
+}
+
+void FilePrefetcher::Watch(const std::string& path) {
+    std::lock_guard<std::mutex> lock(files_mutex);
+    if (files.count(path))
+        return;
+
+    file_t& file = files[path];
+    file.available = false;
+    file.settled = false;
+    file.version = 0;
+
+    if (!thread.joinable())
+        thread = std::thread(&FilePrefetcher::Run, this);
+    wake_requested = true;
+    wakeup.notify_one();
+}
+
+bool FilePrefetcher::Get(const std::string& path, snapshot_t& snapshot) {
+    std::lock_guard<std::mutex> lock(files_mutex);
+    std::map<std::string, file_t>::const_iterator it = files.find(path);
+    if (it == files.end() || !it->second.available)
+        return false;
+    snapshot = it->second.snapshot;
+    return true;
+}
+
+void FilePrefetcher::Invalidate(const std::string& path) {
+    std::lock_guard<std::mutex> lock(files_mutex);
+    std::map<std::string, file_t>::iterator it = files.find(path);
+    if (it == files.end())
+        return;
+
+    it->second.available = false;
+    it->second.version++;
+    it->second.snapshot.content.reset();
+    wake_requested = true;
+    wakeup.notify_one();
+}
+
+void FilePrefetcher::Sync() {
+    std::unique_lock<std::mutex> lock(files_mutex);
+    if (!thread.joinable())
+        return;
+
+    // a round already in progress may have missed recent changes
+    const size_t target = rounds + (checking ? 2 : 1);
+    wake_requested = true;
+    wakeup.notify_one();
+    checked.wait(lock, [&]{return rounds >= target || stop;});
+}
+
+bool FilePrefetcher::Read(const std::string& path, std::string& content) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return false;
+    content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !file.bad();
+}
+
+void FilePrefetcher::Run() {
+    ThreadPlacement::Global().EnterWorker();
+
+    std::unique_lock<std::mutex> lock(files_mutex);
+    while (!stop) {
+        // check all files at once, without holding the lock meanwhile
+        std::vector<std::pair<std::string, file_t>> round(files.begin(), files.end());
+        checking = true;
+        lock.unlock();
+
+        for (std::pair<std::string, file_t>& entry : round) {
+            const std::string& path = entry.first;
+            file_t& file = entry.second;
+
+            struct stat file_stat;
+            if (stat(path.c_str(), &file_stat) || !S_ISREG(file_stat.st_mode)) {
+                file.available = false;
+                file.snapshot.content.reset();
+                continue;
+            }
+
+            const struct stat& prev = file.snapshot.file_stat;
+            if (file.available && file.settled &&
+                    prev.st_dev == file_stat.st_dev &&
+                    prev.st_ino == file_stat.st_ino &&
+                    prev.st_size == file_stat.st_size &&
+                    prev.st_mtim.tv_sec == file_stat.st_mtim.tv_sec &&
+                    prev.st_mtim.tv_nsec == file_stat.st_mtim.tv_nsec)
+                continue;
+
+            std::shared_ptr<std::string> content = std::make_shared<std::string>();
+            if (!Read(path, *content)) {
+                file.available = false;
+                file.snapshot.content.reset();
+                continue;
+            }
+            file.available = true;
+            file.snapshot.file_stat = file_stat;
+            file.snapshot.content = content;
+
+            /* A file modified in the last second may be changed again without a
+             * different mtime (coarse timestamps), so it is read again next time. */
+            file.settled = time(NULL) > file_stat.st_mtim.tv_sec + 1;
+        }
+
+        lock.lock();
+        for (std::pair<std::string, file_t>& entry : round) {
+            // keep an invalidation that happened meanwhile
+            file_t& file = files[entry.first];
+            if (file.version == entry.second.version)
+                file = entry.second;
+        }
+        checking = false;
+        rounds++;
+        checked.notify_all();
+
+        wakeup.wait_for(lock, interval, [this]{return stop || wake_requested;});
+        wake_requested = false;
+    }
+}
@@ -0,0 +1,89 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file file_prefetcher.h
+    \brief Reads watched files ahead of need on a worker thread
+*/
+
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <sys/stat.h>
+
+
+// --- FilePrefetcher -----------------------------------------------------------------
+/*! Keeps the content of watched files in memory, so that e.g. a label file
+ * on a slow (network) filesystem is taken without the real-time loop
+ * waiting for the storage.
+ *
+ * A worker thread (started with the first watch) checks all watched files
+ * by stat() every interval and (re-)reads the changed ones. Only regular
+ * files are prefetched; others (e.g. FIFOs) must be read by the caller.
+ */
+class FilePrefetcher {
+public:
+    static const std::chrono::milliseconds DEFAULT_INTERVAL;
+
+    struct snapshot_t {
+        struct stat file_stat;      // before reading the content
+        std::shared_ptr<const std::string> content;
+    };
+
+    static FilePrefetcher& Global();
+
+    FilePrefetcher(std::chrono::milliseconds interval = DEFAULT_INTERVAL) : interval(interval), stop(false) {}
+    ~FilePrefetcher();
+    FilePrefetcher(const FilePrefetcher&) = delete;
+    FilePrefetcher& operator=(const FilePrefetcher&) = delete;
+
+    // has the file checked (at once) and read
+    void Watch(const std::string& path);
+    // the latest content of the file without blocking; false, if not (yet) available
+    bool Get(const std::string& path, snapshot_t& snapshot);
+    // has the file read again, as it is known to have changed (e.g. on a re-read request); meanwhile not available
+    void Invalidate(const std::string& path);
+    // waits until all watched files were checked once more (e.g. for tests)
+    void Sync();
+private:
+    struct file_t {
+        bool available;
+        bool settled;       // not modified within the timestamp granularity
+        unsigned int version;   // incremented on each invalidation
+        snapshot_t snapshot;
+    };
+
+    std::chrono::milliseconds interval;
+    std::map<std::string, file_t> files;
+    std::mutex files_mutex;
+    std::condition_variable wakeup;
+    std::condition_variable checked;
+    size_t rounds = 0;          // of checking all files
+    bool checking = false;
+    bool wake_requested = false;
+    bool stop;
+    std::thread thread;
+
+    void Run();
+    static bool Read(const std::string& path, std::string& content);
+};
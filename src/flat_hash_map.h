@@ -0,0 +1,140 @@
+/*
+    Flat Hash Map
+    Copyright (C) 2024 StreamDAB Project
+
+    Open addressing hash map with string keys
+*/
+
+#ifndef FLAT_HASH_MAP_H_
+#define FLAT_HASH_MAP_H_
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace StreamDAB {
+
+// Maps string keys to values in a single array of slots (linear probing,
+// deletion by backward shifting), so that entries need no allocation of their
+// own. Each slot keeps the 64-bit hash of its key; the key itself is compared
+// only when the hashes match.
+template<typename V>
+class FlatHashMap {
+public:
+    FlatHashMap() : slots_(MIN_CAPACITY), size_(0) {}
+
+    size_t Size() const { return size_; }
+    bool Empty() const { return size_ == 0; }
+
+    // nullptr, if the key is not present; valid until the map is changed
+    V* Find(const std::string& key) {
+        size_t slot = Lookup(Hash(key), key);
+        return slot == NONE ? nullptr : &slots_[slot].value;
+    }
+    const V* Find(const std::string& key) const {
+        size_t slot = Lookup(Hash(key), key);
+        return slot == NONE ? nullptr : &slots_[slot].value;
+    }
+
+    // inserts or replaces
+    void Set(const std::string& key, V value) {
+        const uint64_t hash = Hash(key);
+        size_t slot = Lookup(hash, key);
+        if (slot != NONE) {
+            slots_[slot].value = std::move(value);
+            return;
+        }
+
+        if ((size_ + 1) * 4 > slots_.size() * 3) {
+            Grow();
+        }
+        Place(hash, key, std::move(value));
+        size_++;
+    }
+
+    bool Erase(const std::string& key) {
+        size_t slot = Lookup(Hash(key), key);
+        if (slot == NONE) {
+            return false;
+        }
+
+        // shift the following entries of the probe sequence back into the gap
+        const size_t mask = slots_.size() - 1;
+        size_t gap = slot;
+        for (size_t next = (gap + 1) & mask; slots_[next].used; next = (next + 1) & mask) {
+            size_t home = slots_[next].hash & mask;
+            if (((next - home) & mask) >= ((next - gap) & mask)) {
+                slots_[gap] = std::move(slots_[next]);
+                gap = next;
+            }
+        }
+        slots_[gap] = Slot();
+        size_--;
+        return true;
+    }
+
+    void Clear() {
+        slots_.assign(MIN_CAPACITY, Slot());
+        size_ = 0;
+    }
+
+    // FNV-1a
+    static uint64_t Hash(const std::string& key) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (unsigned char c : key) {
+            hash = (hash ^ c) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+private:
+    struct Slot {
+        uint64_t hash = 0;
+        bool used = false;
+        std::string key;
+        V value = V();
+    };
+
+    static const size_t MIN_CAPACITY = 16;     // a power of two
+    static const size_t NONE = SIZE_MAX;
+
+    std::vector<Slot> slots_;
+    size_t size_;
+
+    size_t Lookup(uint64_t hash, const std::string& key) const {
+        const size_t mask = slots_.size() - 1;
+        for (size_t slot = hash & mask; slots_[slot].used; slot = (slot + 1) & mask) {
+            if (slots_[slot].hash == hash && slots_[slot].key == key) {
+                return slot;
+            }
+        }
+        return NONE;
+    }
+
+    void Place(uint64_t hash, std::string key, V value) {
+        const size_t mask = slots_.size() - 1;
+        size_t slot = hash & mask;
+        while (slots_[slot].used) {
+            slot = (slot + 1) & mask;
+        }
+        slots_[slot].hash = hash;
+        slots_[slot].used = true;
+        slots_[slot].key = std::move(key);
+        slots_[slot].value = std::move(value);
+    }
+
+    void Grow() {
+        std::vector<Slot> old(slots_.size() * 2);
+        old.swap(slots_);
+        for (Slot& slot : old) {
+            if (slot.used) {
+                Place(slot.hash, std::move(slot.key), std::move(slot.value));
+            }
+        }
+    }
+};
+
+} // namespace StreamDAB
+
+#endif // FLAT_HASH_MAP_H_
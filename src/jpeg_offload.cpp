@@ -0,0 +1,284 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file jpeg_offload.cpp
+    \brief Optional JPEG encoding of slides on a hardware encoder
+*/
+
+#include "jpeg_offload.h"
+#include "thread_placement.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+#if HAVE_NVJPEG
+#  include <cuda_runtime_api.h>
+#  include <nvjpeg.h>
+#endif
+
+
+#if HAVE_NVJPEG
+// --- NvJPEGDevice -----------------------------------------------------------------
+/*! nvJPEG on an NVIDIA GPU: each job of a batch has its own encoder state
+ * and parameters, so that all of them are queued on the stream before it is
+ * synchronised once.
+ */
+class NvJPEGDevice : public JPEGDevice {
+private:
+    struct slot_t {
+        nvjpegEncoderState_t state;
+        nvjpegEncoderParams_t params;
+        unsigned char* pixels;      // on the device
+        size_t pixels_size;
+    };
+
+    nvjpegHandle_t handle;
+    cudaStream_t stream;
+    std::vector<slot_t> slots;
+
+    bool Upload(slot_t& slot, const rgb_image_t& image) {
+        const size_t size = image.pixels.size();
+        if (slot.pixels_size < size) {
+            cudaFree(slot.pixels);
+            slot.pixels = NULL;
+            slot.pixels_size = 0;
+            if (cudaMalloc((void**) &slot.pixels, size) != cudaSuccess)
+                return false;
+            slot.pixels_size = size;
+        }
+        return cudaMemcpyAsync(slot.pixels, image.pixels.data(), size, cudaMemcpyHostToDevice, stream) == cudaSuccess;
+    }
+public:
+    NvJPEGDevice() : handle(NULL), stream(NULL) {}
+    ~NvJPEGDevice() {
+        for (slot_t& slot : slots) {
+            nvjpegEncoderParamsDestroy(slot.params);
+            nvjpegEncoderStateDestroy(slot.state);
+            cudaFree(slot.pixels);
+        }
+        if (stream)
+            cudaStreamDestroy(stream);
+        if (handle)
+            nvjpegDestroy(handle);
+    }
+
+    bool Init() {
+        if (nvjpegCreateSimple(&handle) != NVJPEG_STATUS_SUCCESS) {
+            handle = NULL;
+            return false;
+        }
+        if (cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking) != cudaSuccess) {
+            stream = NULL;
+            return false;
+        }
+        for (size_t i = 0; i < JPEGOffload::MAX_BATCH; i++) {
+            slot_t slot = {NULL, NULL, NULL, 0};
+            if (nvjpegEncoderStateCreate(handle, &slot.state, stream) != NVJPEG_STATUS_SUCCESS)
+                return false;
+            if (nvjpegEncoderParamsCreate(handle, &slot.params, stream) != NVJPEG_STATUS_SUCCESS) {
+                nvjpegEncoderStateDestroy(slot.state);
+                return false;
+            }
+            slots.push_back(slot);
+
+            // 4:2:0 baseline, as the software encoder
+            if (nvjpegEncoderParamsSetSamplingFactors(slot.params, NVJPEG_CSS_420, stream) != NVJPEG_STATUS_SUCCESS ||
+                    nvjpegEncoderParamsSetOptimizedHuffman(slot.params, 1, stream) != NVJPEG_STATUS_SUCCESS)
+                return false;
+        }
+        return true;
+    }
+
+    const char* Name() const {return "nvjpeg";}
+
+    void EncodeBatch(const std::vector<jpeg_job_t*>& jobs) {
+        std::vector<bool> queued(jobs.size(), false);
+        for (size_t i = 0; i < jobs.size() && i < slots.size(); i++) {
+            const rgb_image_t& image = *jobs[i]->image;
+            slot_t& slot = slots[i];
+            if (!Upload(slot, image) ||
+                    nvjpegEncoderParamsSetQuality(slot.params, jobs[i]->quality, stream) != NVJPEG_STATUS_SUCCESS)
+                continue;
+
+            nvjpegImage_t source = {};
+            source.channel[0] = slot.pixels;
+            source.pitch[0] = image.width * 3;
+            queued[i] = nvjpegEncodeImage(handle, slot.state, slot.params, &source, NVJPEG_INPUT_RGBI,
+                    image.width, image.height, stream) == NVJPEG_STATUS_SUCCESS;
+        }
+        if (cudaStreamSynchronize(stream) != cudaSuccess)
+            return;
+
+        for (size_t i = 0; i < jobs.size(); i++) {
+            if (!queued[i])
+                continue;
+            size_t len = 0;
+            if (nvjpegEncodeRetrieveBitstream(handle, slots[i].state, NULL, &len, stream) != NVJPEG_STATUS_SUCCESS)
+                continue;
+            jobs[i]->out->resize(len);
+            jobs[i]->ok = nvjpegEncodeRetrieveBitstream(handle, slots[i].state, jobs[i]->out->data(), &len, stream) == NVJPEG_STATUS_SUCCESS;
+        }
+        if (cudaStreamSynchronize(stream) != cudaSuccess) {
+            for (jpeg_job_t* job : jobs)
+                job->ok = false;
+        }
+    }
+};
+#endif
+
+
+// --- JPEGOffload -----------------------------------------------------------------
+const size_t JPEGOffload::MAX_BATCH = 8;
+const size_t JPEGOffload::MAX_DEVICE_FAILURES = 3;
+
+JPEGOffload::JPEGOffload() :
+        stop(false),
+        device_failures(0),
+        batches(0),
+        fallbacks(0)
+{}
+
+JPEGOffload::~JPEGOffload() {
+    Shutdown();
+}
+
+JPEGOffload& JPEGOffload::Global() {
+    static JPEGOffload offload;
+    return offload;
+}
+
+std::string JPEGOffload::AvailableDevices() {
+#if HAVE_NVJPEG
+    return "nvjpeg";
+#else
+    return "";
+#endif
+}
+
+bool JPEGOffload::Open(const std::string& device_name) {
+#if HAVE_NVJPEG
+    if (device_name == "nvjpeg") {
+        std::unique_ptr<NvJPEGDevice> nvjpeg(new NvJPEGDevice());
+        if (!nvjpeg->Init()) {
+            fprintf(stderr, "ODR-PadEnc Warning: JPEG device 'nvjpeg' could not be initialised; encoding slides in software\n");
+            return false;
+        }
+        SetDevice(std::move(nvjpeg));
+        return true;
+    }
+#endif
+    const std::string available = AvailableDevices();
+    fprintf(stderr, "ODR-PadEnc Warning: JPEG device '%s' not available (compiled in: %s); encoding slides in software\n",
+            device_name.c_str(), available.empty() ? "none" : available.c_str());
+    return false;
+}
+
+void JPEGOffload::SetDevice(std::unique_ptr<JPEGDevice> device) {
+    Shutdown();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    this->device = std::move(device);
+    device_failures = 0;
+    if (this->device)
+        submitter = std::thread(&JPEGOffload::Submit, this);
+}
+
+bool JPEGOffload::Offloading() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return (bool) device;
+}
+
+void JPEGOffload::Shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    jobs_cond.notify_all();
+    if (submitter.joinable())
+        submitter.join();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = false;
+}
+
+void JPEGOffload::Submit() {
+    ThreadPlacement::Global().EnterWorker();
+
+    std::vector<jpeg_job_t*> batch;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        jobs_cond.wait(lock, [&]{return stop || !pending.empty();});
+
+        // the jobs waiting on a stop or a given up device are left to the software encoder
+        if (stop || !device) {
+            for (jpeg_job_t* job : pending)
+                job->done = true;
+            pending.clear();
+            done_cond.notify_all();
+            if (stop)
+                return;
+            continue;
+        }
+
+        // all jobs gathered while the device was busy with the previous batch
+        const size_t count = std::min(pending.size(), MAX_BATCH);
+        batch.assign(pending.begin(), pending.begin() + count);
+        pending.erase(pending.begin(), pending.begin() + count);
+
+        lock.unlock();
+        for (jpeg_job_t* job : batch)
+            job->ok = false;
+        device->EncodeBatch(batch);
+        batches++;
+        lock.lock();
+
+        const bool any_ok = std::any_of(batch.begin(), batch.end(), [](const jpeg_job_t* job){return job->ok;});
+        device_failures = any_ok ? 0 : device_failures + 1;
+        if (device_failures >= MAX_DEVICE_FAILURES) {
+            fprintf(stderr, "ODR-PadEnc Warning: JPEG device '%s' failed %zu batches in a row; encoding slides in software\n",
+                    device->Name(), device_failures);
+            device.reset();
+        }
+
+        for (jpeg_job_t* job : batch)
+            job->done = true;
+        done_cond.notify_all();
+    }
+}
+
+bool JPEGOffload::Encode(const rgb_image_t& image, int quality, std::vector<uint8_t>& out) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (device) {
+            jpeg_job_t job = {&image, quality, &out, false, false};
+            pending.push_back(&job);
+            jobs_cond.notify_one();
+            done_cond.wait(lock, [&]{return job.done;});
+            if (job.ok)
+                return true;
+            fallbacks++;
+        }
+    }
+
+#if HAVE_LIBJPEG
+    return SlideCodec::EncodeJPEG(image, quality, out);
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,108 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file jpeg_offload.h
+    \brief Optional JPEG encoding of slides on a hardware encoder
+*/
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "slide_codec.h"
+
+
+// --- jpeg_job_t -----------------------------------------------------------------
+struct jpeg_job_t {
+    const rgb_image_t* image;
+    int quality;
+    std::vector<uint8_t>* out;
+    bool done;
+    bool ok;
+};
+
+
+// --- JPEGDevice -----------------------------------------------------------------
+/*! A hardware JPEG encoder. It gets the jobs gathered meanwhile as one batch,
+ * so that their uploads, encodings and downloads overlap on the device.
+ */
+class JPEGDevice {
+public:
+    virtual ~JPEGDevice() {}
+    virtual const char* Name() const = 0;
+    // encodes the jobs (as baseline JPEG), setting ok of each
+    virtual void EncodeBatch(const std::vector<jpeg_job_t*>& jobs) = 0;
+};
+
+
+// --- JPEGOffload -----------------------------------------------------------------
+/*! Encodes the JPEG slides of all services (see --jpeg-offload) on a hardware
+ * encoder, if there is one, or else in software (SlideCodec). A job the
+ * device fails is encoded in software as well; after MAX_DEVICE_FAILURES
+ * failed batches in a row, the device is no longer used.
+ *
+ * Encode() blocks its (slide preparation) thread until the job is done; the
+ * jobs of all threads waiting meanwhile are submitted to the device together.
+ */
+class JPEGOffload {
+public:
+    static const size_t MAX_BATCH;
+    static const size_t MAX_DEVICE_FAILURES;
+
+    JPEGOffload();
+    ~JPEGOffload();
+    JPEGOffload(const JPEGOffload&) = delete;
+    JPEGOffload& operator=(const JPEGOffload&) = delete;
+
+    static JPEGOffload& Global();
+    // the devices compiled in, e.g. "nvjpeg"; empty if none
+    static std::string AvailableDevices();
+
+    // opens the named device; false (leaving the software encoder), if it is not available
+    bool Open(const std::string& device_name);
+    // uses the given device (e.g. a test double)
+    void SetDevice(std::unique_ptr<JPEGDevice> device);
+    bool Offloading();
+
+    bool Encode(const rgb_image_t& image, int quality, std::vector<uint8_t>& out);
+
+    size_t GetBatches() const {return batches;}
+    size_t GetFallbacks() const {return fallbacks;}
+private:
+    std::mutex mutex;
+    std::condition_variable jobs_cond;
+    std::condition_variable done_cond;
+    std::unique_ptr<JPEGDevice> device;
+    std::vector<jpeg_job_t*> pending;
+    std::thread submitter;
+    bool stop;
+    size_t device_failures;     // batches in a row
+    std::atomic<size_t> batches;
+    std::atomic<size_t> fallbacks;  // jobs encoded in software after all
+
+    void Submit();
+    void Shutdown();
+};
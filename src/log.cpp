@@ -0,0 +1,247 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file log.cpp
+    \brief Asynchronous, rate-limited log messages of the encoding loop
+*/
+
+#include "log.h"
+#include "metrics.h"
+#include "utf8.h"
+
+#include <chrono>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+
+// --- LogSite -----------------------------------------------------------------
+bool LogSite::Admit(uint64_t now_ns, uint32_t& suppressed_before) {
+    suppressed_before = 0;
+    if (burst == 0)
+        return true;
+
+    // a new window; of concurrent callers, only one starts it
+    uint64_t start = window_start.load(std::memory_order_relaxed);
+    if (now_ns - start >= window_ns && window_start.compare_exchange_strong(start, now_ns, std::memory_order_relaxed))
+        count.store(0, std::memory_order_relaxed);
+
+    if (count.fetch_add(1, std::memory_order_relaxed) >= burst) {
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    suppressed_before = suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+}
+
+
+// --- PadLog -----------------------------------------------------------------
+static MetricCounter& dropped_metric() {
+    static MetricCounter& counter = MetricsRegistry::Global().Counter(
+            "odr_padenc_log_messages_dropped", "Log messages dropped, as the log writer could not keep up");
+    return counter;
+}
+
+static const char* LEVEL_PREFIXES[] = {"ODR-PadEnc ", "ODR-PadEnc ", "ODR-PadEnc Warning: ", "ODR-PadEnc Error: "};
+static const char* LEVEL_NAMES[] = {"debug", "info", "warning", "error"};
+
+PadLog& PadLog::Global() {
+    static PadLog log;
+    return log;
+}
+
+PadLog::PadLog() : queue(CAPACITY), running(false), dropped(0), json(false), dropped_reported(0), repeated(0) {
+    last.site = nullptr;
+}
+
+PadLog::~PadLog() {
+    Stop();
+}
+
+void PadLog::Start(bool json) {
+    if (running.load(std::memory_order_acquire))
+        return;
+    this->json = json;
+    running.store(true, std::memory_order_release);
+    writer = std::thread(&PadLog::Run, this);
+}
+
+void PadLog::Stop() {
+    if (!running.exchange(false, std::memory_order_acq_rel))
+        return;
+    writer.join();
+
+    // what was pushed meanwhile
+    std::lock_guard<std::mutex> lock(output_mutex);
+    record_t record;
+    while (queue.Pop(record))
+        Output(record, true);
+    OutputRepeated();
+    OutputDropped();
+    fflush(stderr);
+}
+
+void PadLog::Write(LogSite& site, LogLevel level, std::initializer_list<log_field_t> fields, const char* format, ...) {
+    uint32_t suppressed;
+    const uint64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (!site.Admit(now_ns, suppressed))
+        return;
+
+    record_t record;
+    record.site = &site;
+    record.level = level;
+    record.suppressed = suppressed;
+    record.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    record.field_count = 0;
+    for (const log_field_t& field : fields) {
+        if (record.field_count == MAX_FIELDS)
+            break;
+        record.fields[record.field_count++] = field;
+    }
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(record.text, sizeof(record.text), format, args);
+    va_end(args);
+
+    if (running.load(std::memory_order_acquire)) {
+        if (!queue.Push(std::move(record))) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            dropped_metric().Add();
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(output_mutex);
+    Output(record, false);
+}
+
+void PadLog::Run() {
+    record_t record;
+    std::chrono::steady_clock::time_point idle_since = std::chrono::steady_clock::now();
+    while (running.load(std::memory_order_acquire)) {
+        bool written = false;
+        while (queue.Pop(record)) {
+            Output(record, true);
+            written = true;
+        }
+        OutputDropped();
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (written) {
+            fflush(stderr);
+            idle_since = now;
+            continue;
+        }
+
+        // don't hold back the repetitions of the last message for long
+        if (repeated && now - idle_since >= std::chrono::seconds(1)) {
+            OutputRepeated();
+            fflush(stderr);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
+
+void PadLog::Output(const record_t& record, bool deduplicate) {
+    if (deduplicate) {
+        if (record.site == last.site && record.level == last.level && !strcmp(record.text, last.text)) {
+            repeated++;
+            return;
+        }
+        OutputRepeated();
+        last = record;
+    }
+    Print(record);
+}
+
+void PadLog::OutputRepeated() {
+    if (!repeated)
+        return;
+
+    if (json)
+        fprintf(stderr, "{\"time\":%.3f,\"level\":\"%s\",\"site\":\"%s\",\"repeated\":%zu}\n",
+                last.time_ns / 1e9, LEVEL_NAMES[(int) last.level], last.site->name, repeated);
+    else
+        fprintf(stderr, "ODR-PadEnc last message repeated %zu times\n", repeated);
+    repeated = 0;
+}
+
+void PadLog::OutputDropped() {
+    const uint64_t dropped_now = Dropped();
+    if (dropped_now == dropped_reported)
+        return;
+
+    if (json)
+        fprintf(stderr, "{\"level\":\"warning\",\"site\":\"log\",\"dropped\":%llu}\n",
+                (unsigned long long) (dropped_now - dropped_reported));
+    else
+        fprintf(stderr, "ODR-PadEnc Warning: %llu log messages dropped, as the log could not keep up\n",
+                (unsigned long long) (dropped_now - dropped_reported));
+    dropped_reported = dropped_now;
+}
+
+void PadLog::Print(const record_t& record) {
+    if (!json) {
+        if (record.suppressed)
+            fprintf(stderr, "%s%s (%u similar messages suppressed)\n", LEVEL_PREFIXES[(int) record.level], record.text, record.suppressed);
+        else
+            fprintf(stderr, "%s%s\n", LEVEL_PREFIXES[(int) record.level], record.text);
+        return;
+    }
+
+    std::string line;
+    line.reserve(TEXT_LEN + 128);
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "{\"time\":%.3f,\"level\":\"", record.time_ns / 1e9);
+    line += buffer;
+    line += LEVEL_NAMES[(int) record.level];
+    line += "\",\"site\":\"";
+    line += record.site->name;
+    line += "\",\"text\":\"";
+    const char* end = record.text + strlen(record.text);
+    for (const char* c = record.text; c < end;) {
+        switch (*c) {
+        case '"':  line += "\\\""; c++; continue;
+        case '\\': line += "\\\\"; c++; continue;
+        case '\n': line += "\\n"; c++; continue;
+        }
+        const char* next = c;
+        if ((unsigned char) *c >= 0x20 && utf8::internal::validate_next(next, end) == utf8::internal::UTF8_OK) {
+            line.append(c, next);
+        } else {
+            // control characters, and e.g. EBU Latin bytes of a converted label
+            snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned char) *c);
+            line += buffer;
+            next = c + 1;
+        }
+        c = next;
+    }
+    line += '"';
+    if (record.suppressed) {
+        snprintf(buffer, sizeof(buffer), ",\"suppressed\":%u", record.suppressed);
+        line += buffer;
+    }
+    for (size_t i = 0; i < record.field_count; i++) {
+        snprintf(buffer, sizeof(buffer), ",\"%s\":%lld", record.fields[i].key, record.fields[i].value);
+        line += buffer;
+    }
+    line += "}\n";
+    fputs(line.c_str(), stderr);
+}
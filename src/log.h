@@ -0,0 +1,137 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file log.h
+    \brief Asynchronous, rate-limited log messages of the encoding loop
+*/
+
+#pragma once
+#include "mpsc_queue.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <thread>
+
+
+enum class LogLevel {DEBUG, INFO, WARNING, ERROR};
+
+// a structured field of a message, e.g. {"bytes", 58}
+struct log_field_t {
+    const char* key;
+    long long value;
+};
+
+
+// --- LogSite -----------------------------------------------------------------
+/*! A place in the code that logs, declared once, e.g.
+ *
+ *      static LogSite send_failed_log("pad.send_failed");
+ *
+ *  Its messages are rate-limited together: at most BURST within a window,
+ *  the others only counted and reported with the next one let through.
+ */
+class LogSite {
+public:
+    static const unsigned DEFAULT_BURST = 5;
+    static const unsigned DEFAULT_WINDOW = 10;  // seconds
+
+    const char* const name;
+
+    // a burst of 0 lets all messages through, e.g. those only shown when verbose
+    LogSite(const char* name, unsigned burst = DEFAULT_BURST, unsigned window = DEFAULT_WINDOW)
+    : name(name), burst(burst), window_ns((uint64_t) window * 1000000000) {}
+    LogSite(const LogSite&) = delete;
+    LogSite& operator=(const LogSite&) = delete;
+
+    // whether a message may be logged now; if so, the messages suppressed since the last one
+    bool Admit(uint64_t now_ns, uint32_t& suppressed_before);
+private:
+    const unsigned burst;
+    const uint64_t window_ns;
+    std::atomic<uint64_t> window_start{0};
+    std::atomic<uint32_t> count{0};
+    std::atomic<uint32_t> suppressed{0};
+};
+
+
+// --- PadLog -----------------------------------------------------------------
+/*! Log messages that are written without holding up the PAD timing.
+ *
+ * Write() only checks the rate limit, formats the message into a fixed size
+ * record and pushes that into a lock-free ring; a background thread writes
+ * them to stderr. If the ring is full, the message is dropped and counted.
+ * Until Start() (and after Stop()) messages are written at once, e.g. in
+ * the tests.
+ *
+ * Consecutive messages of the same text are only written once, followed by
+ * a line of how often they were repeated. In JSON mode each message is one
+ * object with its time, level, site, text and fields; otherwise the fields
+ * are not written (the texts contain the same values).
+ */
+class PadLog {
+public:
+    static const size_t CAPACITY = 1024;    // messages
+    static const size_t TEXT_LEN = 768;     // incl. a hex dump of the longest PAD
+    static const size_t MAX_FIELDS = 4;
+
+    static PadLog& Global();
+    ~PadLog();
+
+    void Start(bool json);
+    // writes the queued messages
+    void Stop();
+
+    void Write(LogSite& site, LogLevel level, std::initializer_list<log_field_t> fields, const char* format, ...)
+        __attribute__((format(printf, 5, 6)));
+
+    uint64_t Dropped() const {return dropped.load(std::memory_order_relaxed);}
+
+private:
+    struct record_t {
+        const LogSite* site;
+        LogLevel level;
+        uint32_t suppressed;    // of the site before this message
+        int64_t time_ns;        // since the epoch
+        size_t field_count;
+        log_field_t fields[MAX_FIELDS];
+        char text[TEXT_LEN];
+    };
+
+    MPSCQueue<record_t> queue;
+    std::atomic<bool> running;
+    std::thread writer;
+    std::mutex output_mutex;    // while not running
+    std::atomic<uint64_t> dropped;
+
+    // only used by the writing thread
+    bool json;
+    uint64_t dropped_reported;
+    record_t last;
+    size_t repeated;
+
+    PadLog();
+    void Run();
+    void Output(const record_t& record, bool deduplicate);
+    void OutputRepeated();
+    void OutputDropped();
+    void Print(const record_t& record);
+};
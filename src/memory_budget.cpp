@@ -0,0 +1,146 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file memory_budget.cpp
+    \brief Memory of the caches and queues, each within a byte budget
+*/
+
+#include "memory_budget.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+
+static std::string account_labels(const std::string& name, const std::string& owner) {
+    return "account=\"" + name + "\"" + (owner.empty() ? "" : ",service=\"" + owner + "\"");
+}
+
+
+// --- MemoryAccount -----------------------------------------------------------------
+MemoryAccount::MemoryAccount(const std::string& name, const std::string& owner, size_t budget, evict_t evict) :
+        name(name),
+        owner(owner),
+        budget(budget),
+        evict(evict),
+        usage(0),
+        evicted(0),
+        usage_metric(MetricsRegistry::Global().Gauge("odr_padenc_memory_bytes", "Bytes used by a cache or queue",
+                                                     account_labels(name, owner))),
+        evicted_metric(MetricsRegistry::Global().Counter("odr_padenc_memory_evicted_bytes", "Bytes evicted from a cache to keep within the budget",
+                                                         account_labels(name, owner)))
+{
+    if (budget)
+        MetricsRegistry::Global().Gauge("odr_padenc_memory_budget_bytes", "Byte budget of a cache or queue",
+                                        account_labels(name, owner)).Set(budget);
+    MemoryBudget::Global().Register(this);
+}
+
+MemoryAccount::~MemoryAccount() {
+    SetUsage(0);
+    MemoryBudget::Global().Unregister(this);
+}
+
+void MemoryAccount::Update(size_t new_usage) {
+    SetUsage(new_usage);
+    if (!evict)
+        return;
+
+    size_t target = budget ? std::min(new_usage, budget) : new_usage;
+    const size_t excess = MemoryBudget::Global().Excess(new_usage);
+    target = std::min(target, new_usage - std::min(excess, new_usage));
+    if (target >= new_usage)
+        return;
+
+    const size_t evicted_usage = std::min(evict(target), new_usage);
+    evicted.fetch_add(new_usage - evicted_usage, std::memory_order_relaxed);
+    evicted_metric.Add(new_usage - evicted_usage);
+    SetUsage(evicted_usage);
+}
+
+void MemoryAccount::SetUsage(size_t new_usage) {
+    const size_t old_usage = usage.exchange(new_usage, std::memory_order_relaxed);
+    MemoryBudget::Global().Adjust(*this, old_usage, new_usage);
+    usage_metric.Set(new_usage);
+}
+
+
+// --- MemoryBudget -----------------------------------------------------------------
+MemoryBudget& MemoryBudget::Global() {
+    static MemoryBudget budget;
+    return budget;
+}
+
+void MemoryBudget::Register(const MemoryAccount* account) {
+    std::lock_guard<std::mutex> lock(mutex);
+    accounts.push_back(account);
+}
+
+void MemoryBudget::Unregister(const MemoryAccount* account) {
+    std::lock_guard<std::mutex> lock(mutex);
+    accounts.erase(std::remove(accounts.begin(), accounts.end(), account), accounts.end());
+}
+
+void MemoryBudget::Adjust(const MemoryAccount& account, size_t old_usage, size_t new_usage) {
+    // wraps around for a decrease, which is still the right sum
+    total_usage.fetch_add(new_usage - old_usage, std::memory_order_relaxed);
+    if (account.Evictable())
+        evictable_usage.fetch_add(new_usage - old_usage, std::memory_order_relaxed);
+}
+
+size_t MemoryBudget::Excess(size_t usage) const {
+    const size_t budget = TotalBudget();
+    const size_t total = TotalUsage();
+    if (budget == 0 || total <= budget)
+        return 0;
+
+    const size_t evictable = evictable_usage.load(std::memory_order_relaxed);
+    if (evictable == 0)
+        return 0;
+    // rounded up, so that the shares cover the excess
+    return (size_t) (((double) (total - budget) * usage + evictable - 1) / evictable);
+}
+
+std::vector<MemoryBudget::account_stats_t> MemoryBudget::Stats(const std::string& owner) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<account_stats_t> stats;
+    for (const MemoryAccount* account : accounts) {
+        if (!owner.empty() && account->owner != owner)
+            continue;
+        stats.push_back({account->name, account->owner, account->Usage(), account->Budget(),
+                         account->Evictable(), account->Evicted()});
+    }
+    return stats;
+}
+
+std::string MemoryBudget::StatsJSON() const {
+    // names and owners are identifiers and socket names, which need no escaping
+    std::string json = "{\"total_usage\":" + std::to_string(TotalUsage()) + ",\"total_budget\":" + std::to_string(TotalBudget()) + ",\"accounts\":[";
+    bool first = true;
+    for (const account_stats_t& account : Stats()) {
+        json += first ? "{" : ",{";
+        json += "\"name\":\"" + account.name + "\",\"service\":\"" + account.owner + "\"";
+        json += ",\"usage\":" + std::to_string(account.usage);
+        json += ",\"budget\":" + std::to_string(account.budget);
+        json += ",\"evictable\":" + std::string(account.evictable ? "true" : "false");
+        json += ",\"evicted\":" + std::to_string(account.evicted) + "}";
+        first = false;
+    }
+    json += "]}";
+    return json;
+}
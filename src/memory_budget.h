@@ -0,0 +1,121 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file memory_budget.h
+    \brief Memory of the caches and queues, each within a byte budget
+*/
+
+#pragma once
+#include "metrics.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// --- MemoryAccount -----------------------------------------------------------------
+/*! The memory of one cache or queue, e.g. the slide cache of a service.
+ *
+ * The owner reports its usage with Update(), on the thread that uses the
+ * cache. If the account is then over its budget, or the process over its
+ * total budget, the eviction callback is called right away on that thread,
+ * with the usage to get down to; it returns the usage it got down to and
+ * must not call Update() itself. Accounts without callback are only
+ * reported, e.g. memory allocated once.
+ *
+ * Update() does not lock; the account must outlive its last Update().
+ */
+class MemoryAccount {
+public:
+    typedef std::function<size_t(size_t target)> evict_t;
+
+    const std::string name;     // e.g. "slide_cache"
+    const std::string owner;    // e.g. the output of the service; empty for the process
+
+    // a budget of 0 means no budget of its own
+    MemoryAccount(const std::string& name, const std::string& owner, size_t budget, evict_t evict = nullptr);
+    ~MemoryAccount();
+    MemoryAccount(const MemoryAccount&) = delete;
+    MemoryAccount& operator=(const MemoryAccount&) = delete;
+
+    void Update(size_t usage);
+
+    size_t Usage() const {return usage.load(std::memory_order_relaxed);}
+    size_t Budget() const {return budget;}
+    bool Evictable() const {return (bool) evict;}
+    uint64_t Evicted() const {return evicted.load(std::memory_order_relaxed);}  // bytes
+private:
+    const size_t budget;
+    const evict_t evict;
+    std::atomic<size_t> usage;
+    std::atomic<uint64_t> evicted;
+    MetricGauge& usage_metric;
+    MetricCounter& evicted_metric;
+
+    void SetUsage(size_t new_usage);
+};
+
+
+// --- MemoryBudget -----------------------------------------------------------------
+/*! All memory accounts of the process, with an optional total budget.
+ *
+ * Over the total budget, the evictable accounts give up the excess in
+ * proportion to their usage, each on its next update.
+ */
+class MemoryBudget {
+public:
+    struct account_stats_t {
+        std::string name;
+        std::string owner;
+        size_t usage;
+        size_t budget;
+        bool evictable;
+        uint64_t evicted;
+    };
+
+    static MemoryBudget& Global();
+
+    // 0: none
+    void SetTotalBudget(size_t bytes) {total_budget.store(bytes, std::memory_order_relaxed);}
+    size_t TotalBudget() const {return total_budget.load(std::memory_order_relaxed);}
+    size_t TotalUsage() const {return total_usage.load(std::memory_order_relaxed);}
+
+    // of the given owner (all, if empty), in the order of registration
+    std::vector<account_stats_t> Stats(const std::string& owner = "") const;
+    // as JSON object, with the totals
+    std::string StatsJSON() const;
+
+private:
+    friend class MemoryAccount;
+
+    mutable std::mutex mutex;   // only for (un)registering and the stats
+    std::vector<const MemoryAccount*> accounts;
+    std::atomic<size_t> total_budget{0};
+    std::atomic<size_t> total_usage{0};
+    std::atomic<size_t> evictable_usage{0};
+
+    void Register(const MemoryAccount* account);
+    void Unregister(const MemoryAccount* account);
+    void Adjust(const MemoryAccount& account, size_t old_usage, size_t new_usage);
+    // what an evictable account with the given usage has to give up of the total excess
+    size_t Excess(size_t usage) const;
+};
@@ -0,0 +1,374 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file metrics.cpp
+    \brief Process-wide counters and histograms in the OpenMetrics format
+*/
+
+#include "metrics.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <stdio.h>
+
+
+// --- MetricCounter -----------------------------------------------------------------
+size_t MetricCounter::Shard() {
+    static std::atomic<size_t> next_thread(0);
+    thread_local const size_t shard = next_thread.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+    return shard;
+}
+
+uint64_t MetricCounter::Value() const {
+    uint64_t value = 0;
+    for (const shard_t& shard : shards)
+        value += shard.value.load(std::memory_order_relaxed);
+    return value;
+}
+
+
+// --- MetricHistogram -----------------------------------------------------------------
+const std::vector<double> MetricHistogram::LATENCY_BOUNDS = {
+    0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 1
+};
+const std::vector<double> MetricHistogram::DURATION_BOUNDS = {
+    0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+const std::vector<double> MetricHistogram::LOCK_BOUNDS = {
+    0.000001, 0.0000025, 0.000005, 0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.01, 0.1
+};
+
+MetricHistogram::MetricHistogram(const std::vector<double>& bounds) : bounds(bounds) {
+    if (bounds.size() > MAX_BUCKETS || !std::is_sorted(bounds.begin(), bounds.end()))
+        throw std::invalid_argument("histogram bounds must be ascending and at most " + std::to_string(MAX_BUCKETS));
+}
+
+void MetricHistogram::Observe(double value) {
+    shard_t& shard = shards[MetricCounter::Shard()];
+    const size_t bucket = std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+    shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    // hardly ever contended, as the shard is usually the thread's own
+    double sum = shard.sum.load(std::memory_order_relaxed);
+    while (!shard.sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {}
+}
+
+MetricHistogram::snapshot_t MetricHistogram::Snapshot() const {
+    snapshot_t snapshot;
+    snapshot.bounds = bounds;
+    snapshot.cumulative.assign(bounds.size() + 1, 0);
+    for (const shard_t& shard : shards) {
+        for (size_t i = 0; i <= bounds.size(); i++)
+            snapshot.cumulative[i] += shard.buckets[i].load(std::memory_order_relaxed);
+        snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+    }
+    for (size_t i = 1; i < snapshot.cumulative.size(); i++)
+        snapshot.cumulative[i] += snapshot.cumulative[i - 1];
+    return snapshot;
+}
+
+
+// --- MetricsRegistry -----------------------------------------------------------------
+const char* MetricsRegistry::CONTENT_TYPE = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+MetricCounter& MetricsRegistry::Counter(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    family_t& family = families[name];
+    if (!family.histograms.empty() || !family.gauges.empty())
+        throw std::invalid_argument("metric '" + name + "' is not a counter");
+    if (family.help.empty())
+        family.help = help;
+
+    std::unique_ptr<MetricCounter>& counter = family.counters[labels];
+    if (!counter)
+        counter.reset(new MetricCounter());
+    return *counter;
+}
+
+MetricHistogram& MetricsRegistry::Histogram(const std::string& name, const std::string& help, const std::vector<double>& bounds,
+                                            const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    family_t& family = families[name];
+    if (!family.counters.empty() || !family.gauges.empty())
+        throw std::invalid_argument("metric '" + name + "' is not a histogram");
+    if (family.help.empty())
+        family.help = help;
+
+    std::unique_ptr<MetricHistogram>& histogram = family.histograms[labels];
+    if (!histogram)
+        histogram.reset(new MetricHistogram(bounds));
+    return *histogram;
+}
+
+MetricGauge& MetricsRegistry::Gauge(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    family_t& family = families[name];
+    if (!family.counters.empty() || !family.histograms.empty())
+        throw std::invalid_argument("metric '" + name + "' is not a gauge");
+    if (family.help.empty())
+        family.help = help;
+
+    std::unique_ptr<MetricGauge>& gauge = family.gauges[labels];
+    if (!gauge)
+        gauge.reset(new MetricGauge());
+    return *gauge;
+}
+
+static std::string format_number(double value) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.15g", value);
+    return buffer;
+}
+
+static std::string with_label(const std::string& labels, const std::string& label) {
+    return "{" + labels + (labels.empty() ? "" : ",") + label + "}";
+}
+
+std::string MetricsRegistry::Render() const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::string text;
+    for (const auto& name_family : families) {
+        const std::string& name = name_family.first;
+        const family_t& family = name_family.second;
+
+        const char* type = !family.counters.empty() ? " counter\n" : !family.gauges.empty() ? " gauge\n" : " histogram\n";
+        text += "# TYPE " + name + type;
+        text += "# HELP " + name + " " + family.help + "\n";
+        for (const auto& counter : family.counters) {
+            const std::string& labels = counter.first;
+            text += name + "_total" + (labels.empty() ? "" : "{" + labels + "}") + " " + std::to_string(counter.second->Value()) + "\n";
+        }
+        for (const auto& gauge : family.gauges) {
+            const std::string& labels = gauge.first;
+            text += name + (labels.empty() ? "" : "{" + labels + "}") + " " + std::to_string(gauge.second->Value()) + "\n";
+        }
+        for (const auto& histogram : family.histograms) {
+            const std::string& labels = histogram.first;
+            const MetricHistogram::snapshot_t snapshot = histogram.second->Snapshot();
+            for (size_t i = 0; i < snapshot.bounds.size(); i++) {
+                text += name + "_bucket" + with_label(labels, "le=\"" + format_number(snapshot.bounds[i]) + "\"") + " " +
+                        std::to_string(snapshot.cumulative[i]) + "\n";
+            }
+            text += name + "_bucket" + with_label(labels, "le=\"+Inf\"") + " " + std::to_string(snapshot.cumulative.back()) + "\n";
+            text += name + "_sum" + (labels.empty() ? "" : "{" + labels + "}") + " " + format_number(snapshot.sum) + "\n";
+            text += name + "_count" + (labels.empty() ? "" : "{" + labels + "}") + " " + std::to_string(snapshot.cumulative.back()) + "\n";
+        }
+    }
+    text += "# EOF\n";
+    return text;
+}
+
+void MetricsRegistry::Values(std::vector<std::pair<std::string, double>>& values) const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    values.clear();
+    for (const auto& name_family : families) {
+        const std::string& name = name_family.first;
+        const family_t& family = name_family.second;
+
+        for (const auto& counter : family.counters) {
+            const std::string& labels = counter.first;
+            values.emplace_back(name + "_total" + (labels.empty() ? "" : "{" + labels + "}"), (double) counter.second->Value());
+        }
+        for (const auto& gauge : family.gauges) {
+            const std::string& labels = gauge.first;
+            values.emplace_back(name + (labels.empty() ? "" : "{" + labels + "}"), (double) gauge.second->Value());
+        }
+        for (const auto& histogram : family.histograms) {
+            const std::string& labels = histogram.first;
+            const MetricHistogram::snapshot_t snapshot = histogram.second->Snapshot();
+            values.emplace_back(name + "_count" + (labels.empty() ? "" : "{" + labels + "}"), (double) snapshot.cumulative.back());
+            values.emplace_back(name + "_sum" + (labels.empty() ? "" : "{" + labels + "}"), snapshot.sum);
+        }
+    }
+}
+
+MetricsRegistry& MetricsRegistry::Global() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+
+// --- ProfiledMutex -----------------------------------------------------------------
+const uint32_t ProfiledMutex::HOLD_SAMPLING;
+
+ProfiledMutex::ProfiledMutex(const std::string& name) :
+    acquisitions(MetricsRegistry::Global().Counter("odr_padenc_lock_acquisitions", "Acquisitions of a lock", "lock=\"" + name + "\"")),
+    contended(MetricsRegistry::Global().Counter("odr_padenc_lock_contended", "Acquisitions of a lock that had to wait", "lock=\"" + name + "\"")),
+    wait(MetricsRegistry::Global().Histogram("odr_padenc_lock_wait_seconds", "Time waited for a lock, if held by another thread",
+                                             MetricHistogram::LOCK_BOUNDS, "lock=\"" + name + "\"")),
+    hold(MetricsRegistry::Global().Histogram("odr_padenc_lock_hold_seconds", "Time a lock was held, sampled",
+                                             MetricHistogram::LOCK_BOUNDS, "lock=\"" + name + "\"")) {}
+
+void ProfiledMutex::LockContended() {
+    contended.Add();
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    mutex.lock();
+    wait.ObserveDuration(std::chrono::steady_clock::now() - start);
+}
+
+
+// --- MetricsHistory -----------------------------------------------------------------
+const int64_t MetricsHistory::PERIODS[RESOLUTIONS] = {1, 60, 3600};
+const size_t MetricsHistory::POINTS[RESOLUTIONS] = {900, 1440, 168};   // 15 min, 24 h, 7 days
+
+MetricsHistory::~MetricsHistory() {
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex);
+        stop = true;
+    }
+    stop_cond.notify_all();
+    if (sampler.joinable())
+        sampler.join();
+}
+
+void MetricsHistory::Sample(int64_t now) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    registry.Values(values);
+    for (const auto& value : values) {
+        std::unique_ptr<series_t>& entry = series[value.first];
+        if (!entry) {
+            entry.reset(new series_t());
+            for (int r = 0; r < RESOLUTIONS; r++)
+                entry->rings[r].assign(POINTS[r], point_t{-1, 0, 0, 0, 0});
+        }
+
+        // the point of the interval, unless it still holds an earlier one
+        for (int r = 0; r < RESOLUTIONS; r++) {
+            const int64_t interval = now / PERIODS[r];
+            point_t& point = entry->rings[r][interval % POINTS[r]];
+            const int64_t start = interval * PERIODS[r];
+            if (point.start != start) {
+                point = point_t{start, value.second, value.second, value.second, 1};
+            } else {
+                point.min = std::min(point.min, value.second);
+                point.max = std::max(point.max, value.second);
+                point.sum += value.second;
+                point.count++;
+            }
+        }
+    }
+}
+
+void MetricsHistory::Start() {
+    std::lock_guard<std::mutex> control(control_mutex);
+    if (users++ > 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex);
+        stop = false;
+    }
+    sampler = std::thread(&MetricsHistory::Run, this);
+}
+
+void MetricsHistory::Stop() {
+    std::lock_guard<std::mutex> control(control_mutex);
+    if (users == 0 || --users > 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex);
+        stop = true;
+    }
+    stop_cond.notify_all();
+    sampler.join();
+}
+
+void MetricsHistory::Run() {
+    using std::chrono::system_clock;
+
+    std::unique_lock<std::mutex> lock(thread_mutex);
+    while (!stop) {
+        const int64_t now = std::chrono::duration_cast<std::chrono::seconds>(system_clock::now().time_since_epoch()).count();
+        lock.unlock();
+        Sample(now);
+        lock.lock();
+
+        // at the start of the next second
+        stop_cond.wait_until(lock, system_clock::time_point(std::chrono::seconds(now + 1)), [&]{return stop;});
+    }
+}
+
+std::vector<std::string> MetricsHistory::Series() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> names;
+    for (const auto& entry : series)
+        names.push_back(entry.first);
+    return names;
+}
+
+std::vector<MetricsHistory::point_t> MetricsHistory::Query(const std::string& name, resolution_t resolution,
+                                                           int64_t from, int64_t to) const {
+    std::vector<point_t> points;
+    if (resolution < 0 || resolution >= RESOLUTIONS)
+        return points;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto entry = series.find(name);
+    if (entry == series.end())
+        return points;
+    for (const point_t& point : entry->second->rings[resolution]) {
+        if (point.count > 0 && point.start >= from && point.start <= to)
+            points.push_back(point);
+    }
+    std::sort(points.begin(), points.end(), [](const point_t& a, const point_t& b) {return a.start < b.start;});
+    return points;
+}
+
+std::string MetricsHistory::QueryJSON(const std::string& name, resolution_t resolution, int64_t from, int64_t to) const {
+    static const char* resolution_names[RESOLUTIONS] = {"1s", "1m", "1h"};
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (series.find(name) == series.end())
+            return "{\"series\":null,\"points\":[]}";
+    }
+
+    std::string json = "{\"series\":\"";
+    for (char c : name)
+        json += c == '"' || c == '\\' ? std::string("\\") + c : std::string(1, c);
+    json += "\",\"resolution\":\"" + std::string(resolution_names[resolution]) + "\",\"points\":[";
+    bool first = true;
+    for (const point_t& point : Query(name, resolution, from, to)) {
+        json += first ? "[" : ",[";
+        json += std::to_string(point.start) + "," + format_number(point.min) + "," + format_number(point.max) + "," +
+                format_number(point.Avg()) + "]";
+        first = false;
+    }
+    json += "]}";
+    return json;
+}
+
+bool MetricsHistory::ParseResolution(const std::string& text, resolution_t& resolution) {
+    if (text == "1s")
+        resolution = RESOLUTION_SECOND;
+    else if (text == "1m")
+        resolution = RESOLUTION_MINUTE;
+    else if (text == "1h")
+        resolution = RESOLUTION_HOUR;
+    else
+        return false;
+    return true;
+}
+
+MetricsHistory& MetricsHistory::Global() {
+    static MetricsHistory history(MetricsRegistry::Global());
+    return history;
+}
@@ -0,0 +1,291 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file metrics.h
+    \brief Process-wide counters and histograms in the OpenMetrics format
+*/
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+// --- MetricCounter -----------------------------------------------------------------
+/*! A monotonic counter that any number of threads add to without locking.
+ *
+ * Each thread adds to one of a few shards, each in a cache line of its own,
+ * so that threads do not contend for the same line; only reading the
+ * value sums the shards up.
+ */
+class MetricCounter {
+public:
+    static const size_t SHARDS = 16;
+
+    MetricCounter() {}
+    MetricCounter(const MetricCounter&) = delete;
+    MetricCounter& operator=(const MetricCounter&) = delete;
+
+    void Add(uint64_t n = 1) {shards[Shard()].value.fetch_add(n, std::memory_order_relaxed);}
+    uint64_t Value() const;
+
+    // the shard of the calling thread
+    static size_t Shard();
+private:
+    struct alignas(64) shard_t {
+        std::atomic<uint64_t> value{0};
+    };
+    shard_t shards[SHARDS];
+};
+
+
+// --- MetricGauge -----------------------------------------------------------------
+/*! A value that goes up and down, e.g. bytes in use; set by its owner.
+ */
+class MetricGauge {
+public:
+    MetricGauge() {}
+    MetricGauge(const MetricGauge&) = delete;
+    MetricGauge& operator=(const MetricGauge&) = delete;
+
+    void Set(int64_t v) {value.store(v, std::memory_order_relaxed);}
+    int64_t Value() const {return value.load(std::memory_order_relaxed);}
+private:
+    std::atomic<int64_t> value{0};
+};
+
+
+// --- MetricHistogram -----------------------------------------------------------------
+/*! Counts observations (e.g. durations in seconds) by upper bounds of
+ * buckets, sharded per thread like MetricCounter.
+ */
+class MetricHistogram {
+public:
+    static const size_t MAX_BUCKETS = 15;   // excl. the one up to +Inf
+
+    struct snapshot_t {
+        std::vector<double> bounds;
+        std::vector<uint64_t> cumulative;   // per bound, then +Inf (= count)
+        double sum = 0;
+    };
+
+    // bounds ascending, at most MAX_BUCKETS
+    explicit MetricHistogram(const std::vector<double>& bounds);
+    MetricHistogram(const MetricHistogram&) = delete;
+    MetricHistogram& operator=(const MetricHistogram&) = delete;
+
+    void Observe(double value);
+    void ObserveDuration(std::chrono::steady_clock::duration duration) {
+        Observe(std::chrono::duration<double>(duration).count());
+    }
+    snapshot_t Snapshot() const;
+
+    /*! Observes the time until it goes out of scope, in seconds
+     */
+    class Timer {
+    public:
+        explicit Timer(MetricHistogram& histogram) : histogram(histogram), start(std::chrono::steady_clock::now()) {}
+        ~Timer() {histogram.ObserveDuration(std::chrono::steady_clock::now() - start);}
+    private:
+        MetricHistogram& histogram;
+        const std::chrono::steady_clock::time_point start;
+    };
+
+    static const std::vector<double> LATENCY_BOUNDS;    // 50 us .. 1 s
+    static const std::vector<double> DURATION_BOUNDS;   // 1 ms .. 10 s
+    static const std::vector<double> LOCK_BOUNDS;       // 1 us .. 100 ms
+private:
+    struct alignas(64) shard_t {
+        std::atomic<uint64_t> buckets[MAX_BUCKETS + 1] = {};
+        std::atomic<double> sum{0};
+    };
+    const std::vector<double> bounds;
+    shard_t shards[MetricCounter::SHARDS];
+};
+
+
+// --- MetricsRegistry -----------------------------------------------------------------
+/*! Names the metrics and renders them for a scrape.
+ *
+ * Registering takes a lock and should be done once, keeping the returned
+ * reference; it stays valid for the lifetime of the registry. Registering
+ * the same name and labels again returns the same metric.
+ * Labels are given as in the exposition format, e.g. <tt>apptype="12"</tt>.
+ */
+class MetricsRegistry {
+public:
+    static const char* CONTENT_TYPE;
+
+    MetricCounter& Counter(const std::string& name, const std::string& help, const std::string& labels = "");
+    MetricHistogram& Histogram(const std::string& name, const std::string& help, const std::vector<double>& bounds,
+                               const std::string& labels = "");
+    MetricGauge& Gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+
+    // in the OpenMetrics text format
+    std::string Render() const;
+    /*! the current value of each series, named as rendered - counters as
+     *  <tt>name_total{labels}</tt>, histograms by their _count and _sum
+     */
+    void Values(std::vector<std::pair<std::string, double>>& values) const;
+
+    // the one of the process, which all of ODR-PadEnc reports to
+    static MetricsRegistry& Global();
+private:
+    struct family_t {
+        std::string help;
+        std::map<std::string, std::unique_ptr<MetricCounter>> counters;        // by labels
+        std::map<std::string, std::unique_ptr<MetricHistogram>> histograms;    // by labels
+        std::map<std::string, std::unique_ptr<MetricGauge>> gauges;            // by labels
+    };
+
+    mutable std::mutex mutex;
+    std::map<std::string, family_t> families;   // by name
+};
+
+
+// --- ProfiledMutex -----------------------------------------------------------------
+/*! A mutex that reports its use to the global registry, per lock name: the
+ * acquisitions, those that had to wait, the waiting times and the holding
+ * times (of every HOLD_SAMPLING-th acquisition of a thread), as the
+ * odr_padenc_lock_* metrics with a lock label.
+ *
+ * An uncontended acquisition only costs a try_lock() and a counter update;
+ * the clock is read while waiting and for the sampled holds only. Usable
+ * with std::lock_guard/std::unique_lock and std::condition_variable_any.
+ */
+class ProfiledMutex {
+public:
+    static const uint32_t HOLD_SAMPLING = 64;
+
+    // the locks of the same name (e.g. of several instances of a class) are reported together
+    explicit ProfiledMutex(const std::string& name);
+    ProfiledMutex(const ProfiledMutex&) = delete;
+    ProfiledMutex& operator=(const ProfiledMutex&) = delete;
+
+    void lock() {
+        if (!mutex.try_lock())
+            LockContended();
+        Acquired();
+    }
+    bool try_lock() {
+        if (!mutex.try_lock())
+            return false;
+        Acquired();
+        return true;
+    }
+    void unlock() {
+        if (held_since != std::chrono::steady_clock::time_point()) {
+            hold.ObserveDuration(std::chrono::steady_clock::now() - held_since);
+            held_since = std::chrono::steady_clock::time_point();
+        }
+        mutex.unlock();
+    }
+private:
+    std::mutex mutex;
+    MetricCounter& acquisitions;
+    MetricCounter& contended;
+    MetricHistogram& wait;
+    MetricHistogram& hold;
+    std::chrono::steady_clock::time_point held_since;  // of a sampled hold, by the holder
+
+    void LockContended();
+    void Acquired() {
+        static thread_local uint32_t acquired = 0;
+        acquisitions.Add();
+        if (++acquired % HOLD_SAMPLING == 0)
+            held_since = std::chrono::steady_clock::now();
+    }
+};
+
+
+// --- MetricsHistory -----------------------------------------------------------------
+/*! The recent values of all series of a registry, for graphing without
+ * external storage: each series has a ring of points per resolution (second,
+ * minute, hour), each point the min/max/avg of the samples in its interval.
+ * The memory per series is fixed; a query only copies the points out.
+ *
+ * Counters are kept as sampled, so a rate is the difference of two points.
+ */
+class MetricsHistory {
+public:
+    enum resolution_t {RESOLUTION_SECOND, RESOLUTION_MINUTE, RESOLUTION_HOUR, RESOLUTIONS};
+    static const int64_t PERIODS[RESOLUTIONS];  // in seconds
+    static const size_t POINTS[RESOLUTIONS];    // kept per series
+
+    struct point_t {
+        int64_t start;      // seconds since the epoch
+        double min;
+        double max;
+        double sum;
+        uint32_t count;
+
+        double Avg() const {return count ? sum / count : 0;}
+    };
+
+    explicit MetricsHistory(const MetricsRegistry& registry) : registry(registry), users(0), stop(false) {}
+    ~MetricsHistory();
+    MetricsHistory(const MetricsHistory&) = delete;
+    MetricsHistory& operator=(const MetricsHistory&) = delete;
+
+    // adds the current values as of the given time
+    void Sample(int64_t now);
+    /*! samples once a second on a thread of its own, until Stop() was called
+     *  as often as Start()
+     */
+    void Start();
+    void Stop();
+
+    std::vector<std::string> Series() const;
+    // the points starting within [from, to], oldest first
+    std::vector<point_t> Query(const std::string& series, resolution_t resolution, int64_t from, int64_t to) const;
+    // the same as JSON: the series, resolution and points as [start, min, max, avg]
+    std::string QueryJSON(const std::string& series, resolution_t resolution, int64_t from, int64_t to) const;
+    // "1s", "1m" or "1h"
+    static bool ParseResolution(const std::string& text, resolution_t& resolution);
+
+    // the one of the global registry
+    static MetricsHistory& Global();
+private:
+    struct series_t {
+        std::vector<point_t> rings[RESOLUTIONS];
+    };
+
+    const MetricsRegistry& registry;
+    mutable std::mutex mutex;
+    std::map<std::string, std::unique_ptr<series_t>> series;    // by name
+    std::vector<std::pair<std::string, double>> values;         // reused for sampling
+
+    std::mutex control_mutex;   // of Start()/Stop()
+    std::mutex thread_mutex;
+    std::condition_variable stop_cond;
+    std::thread sampler;
+    size_t users;
+    bool stop;
+
+    void Run();
+};
@@ -0,0 +1,105 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file mpsc_queue.h
+    \brief Lock-free multi producer/single consumer queue
+*/
+
+#ifndef MPSC_QUEUE_H_
+#define MPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+
+// --- MPSCQueue -----------------------------------------------------------------
+/*! A bounded ring buffer for any number of producer threads and exactly one
+ * consumer thread. Neither side ever blocks: Push() fails if the queue is
+ * full and Pop() fails if it is empty.
+ *
+ * Producers claim a position by advancing the tail; each slot carries a
+ * sequence number telling whether it is free for that position or
+ * holds the item of it.
+ */
+template<typename T>
+class MPSCQueue {
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    const size_t capacity;
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<size_t> tail;   // next position to push; claimed by the producers
+    std::atomic<size_t> head;   // next position to pop; only written by the consumer
+public:
+    MPSCQueue(size_t capacity) : capacity(capacity), slots(new Slot[capacity]), tail(0), head(0) {
+        for (size_t i = 0; i < capacity; i++)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    size_t Capacity() const {return capacity;}
+    // approximate, while producers are pushing
+    size_t Size() const {
+        const size_t h = head.load(std::memory_order_acquire);
+        const size_t t = tail.load(std::memory_order_acquire);
+        return t > h ? t - h : 0;
+    }
+    bool Empty() const {return Size() == 0;}
+
+    // producer side
+    bool Push(T&& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &slots[t % capacity];
+            const intptr_t diff = (intptr_t) slot->sequence.load(std::memory_order_acquire) - (intptr_t) t;
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(t, t + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;   // the slot still holds the item of the previous round
+            } else {
+                t = tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->item = std::move(item);
+        slot->sequence.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side
+    bool Pop(T& item) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        Slot& slot = slots[h % capacity];
+        if (slot.sequence.load(std::memory_order_acquire) != h + 1)
+            return false;   // empty, or the producer of the position is still writing
+
+        item = std::move(slot.item);
+        slot.sequence.store(h + capacity, std::memory_order_release);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+#endif /* MPSC_QUEUE_H_ */
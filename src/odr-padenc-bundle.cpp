@@ -0,0 +1,174 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file odr-padenc-bundle.cpp
+    \brief Compile the slides of a directory ahead of time into a slide bundle
+
+    The bundle holds the processed image of each slide together with its MOT
+    header (incl. the parameters of its .sls_params file), in the format of
+    the slide state file. ODR-PadEnc maps it with --slide-bundle and then
+    transmits these slides without any image processing.
+*/
+
+#include "common.h"
+#include "sls.h"
+
+#include <atomic>
+#include <getopt.h>
+#include <limits>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+
+static void usage(const char* name) {
+    fprintf(stderr, "ODR-PadEnc Bundle %s - compiles MOT Slideshow slides ahead of time\n\n"
+                    "Usage: %s [OPTIONS...] -d DIRNAME -o FILENAME\n"
+                    " -d, --dir=DIRNAME         Directory of the slides to compile (as for ODR-PadEnc)\n"
+                    " -o, --output=FILENAME     Slide bundle to write, for ODR-PadEnc --slide-bundle\n"
+                    " -m, --max-slide-size=SIZE Recompress slides above the specified maximum size in bytes.\n"
+                    "                             Must match the one of ODR-PadEnc. Default: %zu (Simple Profile)\n"
+                    " -R, --raw-slides          Do not process slides (see ODR-PadEnc)\n"
+                    " -j, --threads=COUNT       Process COUNT slides at once. Default: all CPUs (%u)\n"
+                    " --slide-candidates        Try each resized slide as PNG next to JPEG (see ODR-PadEnc)\n"
+                    " --exhaustive-png          Compress PNG slides as far as possible, trying all PNG filters and\n"
+                    "                             deflate strategies (takes many times longer)\n"
+                    " -v, --verbose             Print more information to the console\n",
+#if defined(GITVERSION)
+            GITVERSION,
+#else
+            PACKAGE_VERSION,
+#endif
+            name, SLSEncoder::MAXSLIDESIZE_SIMPLE, std::max(std::thread::hardware_concurrency(), 1u));
+}
+
+
+int main(int argc, char *argv[]) {
+    std::string sls_dir;
+    std::string output;
+    size_t max_slide_size = SLSEncoder::MAXSLIDESIZE_SIMPLE;
+    bool raw_slides = false;
+    bool slide_candidates = false;
+    bool exhaustive_png = false;
+    size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    const struct option longopts[] = {
+        {"dir",             required_argument,  0, 'd'},
+        {"output",          required_argument,  0, 'o'},
+        {"max-slide-size",  required_argument,  0, 'm'},
+        {"raw-slides",      no_argument,        0, 'R'},
+        {"threads",         required_argument,  0, 'j'},
+        {"slide-candidates", no_argument,       0, 1},
+        {"exhaustive-png",  no_argument,        0, 2},
+        {"help",            no_argument,        0, 'h'},
+        {"verbose",         no_argument,        0, 'v'},
+        {0,0,0,0},
+    };
+
+    int ch;
+    while ((ch = getopt_long(argc, argv, "d:o:m:Rj:hv", longopts, NULL)) != -1) {
+        switch (ch) {
+            case 'd':
+                sls_dir = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'm':
+                max_slide_size = strtoul(optarg, NULL, 10);
+                break;
+            case 'R':
+                raw_slides = true;
+                break;
+            case 'j':
+                threads = std::max(atoi(optarg), 1);
+                break;
+            case 1: // slide-candidates
+                slide_candidates = true;
+                break;
+            case 2: // exhaustive-png
+                exhaustive_png = true;
+                break;
+            case 'v':
+                verbose++;
+                break;
+            case '?':
+            case 'h':
+                usage(argv[0]);
+                return ch == 'h' ? 0 : 1;
+        }
+    }
+
+    if (sls_dir.empty() || output.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (max_slide_size == 0) {
+        fprintf(stderr, "ODR-PadEnc Error: The maximum slide size must be greater than 0!\n");
+        return 1;
+    }
+
+#if HAVE_MAGICKWAND
+    // the slides are encoded in parallel already
+    MagickWandPool::Global().Configure(magick_limits_t(), false);
+#endif
+
+    SlideStore slides;
+    if (!slides.InitFromDir(sls_dir)) {
+        perror(("ODR-PadEnc Error: Unable to read slides dir '" + sls_dir + "'").c_str());
+        return 1;
+    }
+    if (slides.Empty()) {
+        fprintf(stderr, "ODR-PadEnc Error: No slides in '%s'\n", sls_dir.c_str());
+        return 1;
+    }
+
+    // the bundle holds all slides, however large
+    PADPacketizer pad_packetizer(58);
+    SLSEncoder sls_encoder(&pad_packetizer, std::numeric_limits<size_t>::max() / 2);
+    sls_encoder.SetFormatCandidates(slide_candidates);
+    sls_encoder.SetExhaustivePNG(exhaustive_png);
+
+    const std::atomic<bool> stop(false);
+    sls_encoder.preEncodeSlides(slides.GetSlides(), raw_slides, max_slide_size, stop, threads);
+
+    // the slides not encoded above (e.g. on a single thread) now, the others from the cache
+    size_t failed = 0;
+    for (const slide_metadata_t& md : slides.GetSlides()) {
+        prepared_slide_t slide;
+        if (!sls_encoder.prepareSlide(md.filepath, md.fidx, raw_slides, max_slide_size, slide)) {
+            fprintf(stderr, "ODR-PadEnc Warning: Unable to encode slide '%s'; not bundled\n", md.filepath.c_str());
+            failed++;
+        }
+    }
+
+    SlideStateFile bundle(output);
+    const bool saved = bundle.Save(slides.GetHistory(), sls_encoder.GetSlideCache());
+    if (saved) {
+        fprintf(stderr, "ODR-PadEnc bundled %zu slides (%zu bytes) into '%s'\n",
+                sls_encoder.GetSlideCache().Count(), sls_encoder.GetSlideCache().Size(), output.c_str());
+    }
+
+#if HAVE_MAGICKWAND
+    MagickWandPool::Global().Terminate();
+#endif
+
+    return saved && failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,285 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file odr-padenc-relay.cpp
+    \brief Serve a local audio encoder with the PAD of a remote ODR-PadEnc
+
+    ODR-PadEnc then runs on a central content server with its output on a UDP
+    port (-o udp:PORT), while the relay on the node of the audio encoder
+    requests batches of frames from it ahead of time and answers the audio
+    encoder's requests from its jitter buffer, as a local ODR-PadEnc would.
+*/
+
+#include "common.h"
+#include "pad_interface.h"
+#include "pad_relay.h"
+
+#include <atomic>
+#include <cerrno>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+
+static const size_t DEFAULT_BUFFER_FRAMES = 40;    // 1 s of 24 ms frames
+static const size_t DEFAULT_BATCH_FRAMES = 10;
+static const int DEFAULT_TIMEOUT_MS = 500;
+
+static std::atomic<bool> do_exit(false);
+
+static void break_handler(int) {
+    do_exit.store(true);
+}
+
+
+static void usage(const char* name) {
+    fprintf(stderr, "ODR-PadEnc Relay %s - serves a local audio encoder with the PAD of a remote ODR-PadEnc\n\n"
+                    "Usage: %s [OPTIONS...] -u HOST:PORT -o IDENTIFIER\n"
+                    " -u, --upstream=HOST:PORT  The remote ODR-PadEnc, with the output udp:PORT\n"
+                    " -o, --output=IDENTIFIER   Socket to communicate with the audio encoder (as for ODR-PadEnc)\n"
+                    " -b, --buffer=COUNT        Keep COUNT frames buffered or requested ahead of the audio encoder\n"
+                    "                             Default: %zu\n"
+                    " --batch=COUNT             Request up to COUNT frames at once (1-255). Default: %zu\n"
+                    " --timeout=MS              Give up a request without answer after MS milliseconds\n"
+                    "                             Default: %d\n"
+                    " -v, --verbose             Print more information to the console\n",
+#if defined(GITVERSION)
+            GITVERSION,
+#else
+            PACKAGE_VERSION,
+#endif
+            name, DEFAULT_BUFFER_FRAMES, DEFAULT_BATCH_FRAMES, DEFAULT_TIMEOUT_MS);
+}
+
+
+// a UDP socket connected to the upstream ODR-PadEnc; -1 on failure
+static int connect_upstream(const std::string& upstream) {
+    int sock = PadInterface::connect_udp(upstream, "upstream");
+    if (sock == -1)
+        return -1;
+
+    // room for a few batches of the largest frames
+    int rcvbuf = 1024 * 1024;
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)))
+        perror("ODR-PadEnc Warning: cannot enlarge the upstream socket buffer");
+    return sock;
+}
+
+
+// takes over the answers received so far
+static void receive_answers(int upstream, PadRelayBuffer& relay, std::vector<uint8_t>& answer) {
+    for (;;) {
+        ssize_t len = recv(upstream, answer.data(), answer.size(), MSG_DONTWAIT);
+        if (len == -1) {
+            // ECONNREFUSED: no ODR-PadEnc at the port (yet), as reported for an earlier request
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED)
+                perror("ODR-PadEnc Error: receiving from upstream failed");
+            return;
+        }
+
+        const size_t seq_len = PadInterface::SEQUENCE_LEN;
+        if ((size_t) len < seq_len + 2)
+            continue;
+        uint32_t sequence = 0;
+        for (size_t i = 0; i < seq_len; i++)
+            sequence = (sequence << 8) | answer[i];
+
+        const uint8_t* message = &answer[seq_len];
+        const size_t message_len = len - seq_len;
+        size_t frames = 1;
+        const uint8_t* data = message + PadInterface::MESSAGE_HEADER_LEN;
+        size_t data_len = message_len - PadInterface::MESSAGE_HEADER_LEN;
+        if (message[0] == PadInterface::MESSAGE_PAD_DATA_BATCH) {
+            frames = message[1];
+            data = message + PadInterface::BATCH_HEADER_LEN;
+            data_len = message_len - PadInterface::BATCH_HEADER_LEN;
+        } else if (message[0] != PadInterface::MESSAGE_PAD_DATA) {
+            continue;
+        }
+        if (frames == 0 || data_len % frames)
+            continue;
+
+        if (!relay.AddAnswer(sequence, data, frames, data_len / frames) && verbose)
+            fprintf(stderr, "ODR-PadEnc Relay ignoring late or unexpected answer %u\n", sequence);
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+    std::string upstream;
+    std::string output;
+    size_t buffer_frames = DEFAULT_BUFFER_FRAMES;
+    size_t batch_frames = DEFAULT_BATCH_FRAMES;
+    int timeout_ms = DEFAULT_TIMEOUT_MS;
+
+    const struct option longopts[] = {
+        {"upstream",        required_argument,  0, 'u'},
+        {"output",          required_argument,  0, 'o'},
+        {"buffer",          required_argument,  0, 'b'},
+        {"batch",           required_argument,  0, 1},
+        {"timeout",         required_argument,  0, 2},
+        {"help",            no_argument,        0, 'h'},
+        {"verbose",         no_argument,        0, 'v'},
+        {0,0,0,0},
+    };
+
+    int ch;
+    while ((ch = getopt_long(argc, argv, "u:o:b:hv", longopts, NULL)) != -1) {
+        switch (ch) {
+            case 'u':
+                upstream = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'b':
+                buffer_frames = strtoul(optarg, NULL, 10);
+                break;
+            case 1: // batch
+                batch_frames = strtoul(optarg, NULL, 10);
+                break;
+            case 2: // timeout
+                timeout_ms = atoi(optarg);
+                break;
+            case 'v':
+                verbose++;
+                break;
+            case '?':
+            case 'h':
+                usage(argv[0]);
+                return ch == 'h' ? 0 : 1;
+        }
+    }
+
+    if (upstream.empty() || output.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (buffer_frames < 1 || batch_frames < 1 || batch_frames > 255 || timeout_ms < 1) {
+        fprintf(stderr, "ODR-PadEnc Error: The buffer must hold at least 1 frame, a batch 1 to 255 frames "
+                "and the timeout be at least 1 ms!\n");
+        return 1;
+    }
+    if (PadInterface::is_udp_ident(output)) {
+        fprintf(stderr, "ODR-PadEnc Error: The output must be the local socket of the audio encoder!\n");
+        return 1;
+    }
+
+    int sock = connect_upstream(upstream);
+    if (sock == -1)
+        return 1;
+
+    if (signal(SIGINT, break_handler) == SIG_ERR || signal(SIGTERM, break_handler) == SIG_ERR) {
+        perror("ODR-PadEnc Error: could not set signal handlers");
+        return 1;
+    }
+
+    PadRelayBuffer relay(buffer_frames, batch_frames, std::chrono::milliseconds(timeout_ms));
+    std::vector<uint8_t> answer(65536);
+    std::vector<uint8_t> message;
+    bool dry = false;
+    size_t lost_reported = 0;
+
+    fprintf(stderr, "ODR-PadEnc Relay serving '%s' with the PAD of '%s', %zu frames ahead\n",
+            output.c_str(), upstream.c_str(), buffer_frames);
+
+    try {
+        PadInterface intf;
+        intf.open(output);
+
+        while (!do_exit) {
+            struct pollfd fds[2];
+            fds[0].fd = intf.fd();
+            fds[0].events = POLLIN;
+            fds[1].fd = sock;
+            fds[1].events = POLLIN;
+            // wakes up regularly for the request timeouts
+            if (poll(fds, 2, 10) == -1 && errno != EINTR)
+                throw std::runtime_error("poll failed: " + std::string(strerror(errno)));
+
+            // the audio encoder's requests, answered from the buffer
+            for (;;) {
+                size_t frames = 1;
+                uint8_t padlen = intf.receive_request(frames, 0);
+                if (padlen == 0)
+                    break;
+                if (padlen != relay.GetPADLength()) {
+                    fprintf(stderr, "ODR-PadEnc Relay (re)starting with PAD length %d\n", padlen);
+                    relay.SetPADLength(padlen);
+                }
+
+                const size_t frame_size = relay.GetFrameSize();
+                const size_t header_len = frames > 1 ? PadInterface::BATCH_HEADER_LEN : PadInterface::MESSAGE_HEADER_LEN;
+                message.resize(header_len + frames * frame_size);
+                bool complete = true;
+                for (size_t i = 0; i < frames; i++)
+                    complete &= relay.TakeFrame(&message[header_len + i * frame_size]);
+                if (frames > 1)
+                    intf.send_pad_frames(message.data(), frame_size, frames);
+                else
+                    intf.send_pad_frame(message.data(), frame_size);
+
+                if (!complete && !dry)
+                    fprintf(stderr, "ODR-PadEnc Relay Warning: buffer ran dry, sending frames without X-PAD\n");
+                else if (complete && dry)
+                    fprintf(stderr, "ODR-PadEnc Relay buffer filled again\n");
+                dry = !complete;
+            }
+
+            receive_answers(sock, relay, answer);
+
+            const PadRelayBuffer::time_point now = std::chrono::steady_clock::now();
+            relay.ExpireRequests(now);
+            if (relay.GetLostFrames() > lost_reported) {
+                fprintf(stderr, "ODR-PadEnc Relay Warning: %zu frames lost (no answer within %d ms)\n",
+                        relay.GetLostFrames() - lost_reported, timeout_ms);
+                lost_reported = relay.GetLostFrames();
+            }
+
+            // the requests to refill the buffer
+            uint32_t sequence;
+            size_t frames;
+            while (relay.NextRequest(now, sequence, frames)) {
+                uint8_t request[3 + PadInterface::SEQUENCE_LEN] = {PadInterface::MESSAGE_REQUEST, relay.GetPADLength(), (uint8_t) frames};
+                for (size_t i = 0; i < PadInterface::SEQUENCE_LEN; i++)
+                    request[3 + i] = sequence >> (8 * (PadInterface::SEQUENCE_LEN - 1 - i));
+                // a refused request (no ODR-PadEnc yet) expires as any other lost one
+                if (send(sock, request, sizeof(request), 0) == -1 && errno != ECONNREFUSED && verbose)
+                    perror("ODR-PadEnc Relay Warning: sending request failed");
+            }
+        }
+    }
+    catch (const std::runtime_error& e) {
+        fprintf(stderr, "ODR-PadEnc Relay failure: %s\n", e.what());
+        close(sock);
+        return 1;
+    }
+
+    fprintf(stderr, "ODR-PadEnc Relay exits: %zu frames lost, %zu frames without X-PAD\n",
+            relay.GetLostFrames(), relay.GetUnderruns());
+    close(sock);
+    return 0;
+}
@@ -28,13 +28,33 @@
 */
 
 #include "odr-padenc.h"
-#include <memory>
 
 std::atomic<bool> do_exit;
+static const size_t MAX_SHARDS = 64;
+static std::atomic<Reactor*> pad_reactors[MAX_SHARDS];  // of the shards (see --shards)
+
+// async-signal-safe
+static void wake_pad_reactors() {
+    for (std::atomic<Reactor*>& pad_reactor : pad_reactors) {
+        Reactor* reactor = pad_reactor.load();
+        if (reactor)
+            reactor->Wake();
+    }
+}
 
 static void break_handler(int) {
     fprintf(stderr, "...ODR-PadEnc exits...\n");
     do_exit.store(true);
+
+    // the event loops need not wait for their next event to notice
+    wake_pad_reactors();
+}
+
+static sem_t reload_sem;   // posted on SIGHUP
+
+static void reload_handler(int) {
+    // the only thing allowed here; the live configs are read by reload_live_configs()
+    sem_post(&reload_sem);
 }
 
 static void header() {
@@ -60,7 +80,16 @@ static void usage(const char* name) {
                     "                             been encoded.\n"
                     " -s, --sleep=DUR           Wait DUR seconds between each slide\n"
                     "                             Default: %d\n"
-                    " -o, --output=IDENTIFIER   Socket to communicate with audio encoder\n"
+                    " -o, --output=IDENTIFIER   Socket to communicate with audio encoder; udp:PORT for a remote one,\n"
+                    "                             served by odr-padenc-relay on its node\n"
+                    " --mirror=IDENTIFIER       Serve another audio encoder (e.g. of a backup chain) over this socket with\n"
+                    "                             the same PAD frames, each encoded once: the n-th frame requested by\n"
+                    "                             either is the same (may be used more than once)\n"
+                    " --shm-frames=COUNT        Instead of the socket, hand the PAD frames to the audio encoder through\n"
+                    "                             the shared memory ring /odr-padenc-IDENTIFIER, filled up to COUNT frames ahead\n"
+                    " --pad-lookahead=COUNT     Encode up to COUNT PAD frames before they are requested over the socket,\n"
+                    "                             so that a request is answered at once (0: encode on request)\n"
+                    "                             Default: %zu\n"
                     " --dump-current-slide=F1   Write the slide currently being transmitted to the file F1\n"
                     " --dump-completed-slide=F2 Once the slide is transmitted, move the file from F1 to F2\n"
                     " -t, --dls=FILENAME        FIFO or file to read DLS text from.\n"
@@ -72,31 +101,154 @@ static void usage(const char* name) {
                     "                             Default: 15\n"
                     " -r, --remove-dls          Always insert a DLS Remove Label command when replacing a DLS text.\n"
                     " -C, --raw-dls             Do not convert DLS texts to Complete EBU Latin based repertoire\n"
-                    "                             character set encoding.\n"
+                    "                             character set encoding (or, for labels with characters it lacks,\n"
+                    "                             to the shorter of UCS-2 BE and UTF-8).\n"
                     " -I, --item-state=FILENAME FIFO or file to read the DL Plus Item Toggle/Running bits from (instead of the current DLS file).\n"
+                    " --dl-plus-format=FORMAT   Derive the DL Plus tags of UTF-8 labels without any from this format,\n"
+                    "                             e.g. \"{artist} - {title}\" (may be used more than once; see dls.h)\n"
                     " -m, --max-slide-size=SIZE Recompress slide if above the specified maximum size in bytes.\n"
                     "                             Default: %zu (Simple Profile)\n"
+                    " --segment-size=SIZE       Split slides into MOT segments of SIZE bytes, or 'auto' for the size\n"
+                    "                             with the least overhead at the PAD length\n"
+                    "                             Default: %zu\n"
+                    " --mot-carousel            Repeat the last slide until the next one, for receivers that tuned in\n"
+                    "                             during its transmission\n"
+                    " --idle-fill               Repeat the last slide in X-PAD that would be unused otherwise; the\n"
+                    "                             repetition yields to any label or slide at once\n"
+                    " --header-repetition=COUNT Repeat the MOT header after every COUNT body segments\n"
+                    " --header-positions=SEG,.. Also repeat the MOT header before these body segments (from 0; negative\n"
+                    "                             ones count from the end), e.g. 1,-1 for receivers tuning in during a slide\n"
+                    " --mot-directory=COUNT     Send the slides in MOT directory mode, with the last COUNT slides in the\n"
+                    "                             directory, so that receivers can keep them in their cache\n"
+                    " --mot-directory-resend=N  In MOT directory mode, send the body of an unchanged slide only every N\n"
+                    "                             times (0: only once). Default: %zu\n"
+                    " --adaptive-slide-size     Recompress slides further, so that they can be sent within the slide\n"
+                    "                             interval at the measured X-PAD throughput (at most the max slide size)\n"
                     " -R, --raw-slides          Do not process slides. Integrity checks and resizing\n"
                     "                             slides is skipped. Use this if you know what you are doing !\n"
                     "                             Slides whose name ends in _PadEncRawMode.jpg or _PadEncRawMode.png are always transmitted unprocessed, regardless of\n"
                     "                             the -R option being set \n"
                     "                             It is useful only when -d is used\n"
+                    "                             Raw slides are memory-mapped, so replace them by renaming a new file over them\n"
+                    "                             instead of rewriting them in place.\n"
+                    " --slide-cache=SIZE        Keep up to SIZE bytes of encoded slides in memory, so that unchanged\n"
+                    "                             slides are not processed again (0 disables the cache).\n"
+                    "                             Default: %zu\n"
+                    " --slide-similarity=BITS   Take the encoded slide for another image, if their difference hashes differ\n"
+                    "                             in at most BITS of 64 bits (e.g. 4, for re-exported or recompressed images;\n"
+                    "                             JPEG/PNG only). Files of the same content are always recognised\n"
+                    " --slide-candidates        Try each resized JPEG/PNG slide as PNG (with a palette, if it is a graphic)\n"
+                    "                             next to JPEG, at once, and send the smaller one (otherwise: PNG for PNG images only)\n"
+                    " --slide-store=DIR         Share the encoded slides with all other instances using DIR (e.g. in /dev/shm),\n"
+                    "                             so that an image is processed only once per host and maximum slide size.\n"
+                    "                             The slides in DIR may be deleted at any time\n"
+                    " --slide-spill=DIR         Move the slides evicted from the slide cache to files in DIR (e.g. on a\n"
+                    "                             local SSD) instead of dropping them; slides used less often than the\n"
+                    "                             ones in memory stay there. The files are deleted right away\n"
+                    " --slide-spill-size=SIZE   Keep up to SIZE bytes of slides in DIR. Default: %zu\n"
+                    " --slide-bundle=FILENAME   Take the encoded slides from this bundle of odr-padenc-bundle, so that\n"
+                    "                             they are transmitted without any image processing. The slide cache\n"
+                    "                             must be large enough to hold them\n"
+                    " --slide-history=COUNT     Remember COUNT slides, to retransmit them with the same ID (least recently\n"
+                    "                             used ones are forgotten first). Default: %zu\n"
+                    " --slide-content-ids       Recognise a slide copied again (new mtime) by its content, so that it keeps\n"
+                    "                             its ID and encoding; a file is only hashed once its size or mtime changed\n"
+                    " --slide-state=FILENAME    Keep the slide history and cache in this file, so that after a restart\n"
+                    "                             the slides are transmitted at once and with the same IDs as before\n"
+                    " --slides-window=COUNT     Stream the slides dir instead of reading it completely: take COUNT slides\n"
+                    "                             at a time, in directory order (for huge dirs; Linux only). With\n"
+                    "                             --slide-state, the position is kept in FILENAME.cursor across restarts\n"
+                    " --change-settle=MS[,MAX]  Take over changes of the slides dir and reread requests (slides and DLS)\n"
+                    "                             only once none followed for MS milliseconds, but at the latest after MAX\n"
+                    "                             milliseconds, so that a bulk update is applied as a whole. Default: 0 (at once)\n"
+                    " --slide-lookahead=COUNT   Prepare up to COUNT slides ahead in a separate thread\n"
+                    "                             (0: prepare each slide when it is inserted)\n"
+                    "                             Default: %zu\n"
                     " -v, --verbose             Print more information to the console (may be used more than once)\n"
+                    " --log-json                Print the messages of the encoding as JSON objects (one per line), with\n"
+                    "                             their time, level, source and fields\n"
                     " --version                 Print version information and quit\n"
                     " -l, --label=DUR           Wait DUR seconds between each label (if more than one file used)\n"
                     "                             Default: %d\n"
+                    " --label-weight=COUNT      Show the label of the preceding DLS file COUNT times as long as the others\n"
+                    "                             Default: 1\n"
                     " -L, --label-ins=DUR       Insert label every DUR milliseconds\n"
                     "                             Default: %d\n"
+                    " --adaptive-label-ins      Insert an unchanged label less often (up to 8 times DUR) while slides\n"
+                    "                             are sent, and a changed one at once\n"
                     " -X, --xpad-interval=COUNT Output X-PAD every COUNT frames/AUs (otherwise: only F-PAD)\n"
                     "                             Default: %d\n"
+                    " --lookahead-packing       Choose the X-PAD sub-field sizes for several data groups at once,\n"
+                    "                             to reduce the padding (useful for small PAD lengths)\n"
+                    " --dls-share=PERCENT       Share the X-PAD between DLS and Slideshow, while both have data to send,\n"
+                    "                             giving DLS PERCENT of it (otherwise: DLS is sent before slides)\n"
+                    " --stats=DUR               Print the X-PAD usage and the data group latency every DUR seconds\n"
+                    " --memory-budget=MB        Keep the caches of all services within MB MiB in total, evicting slides\n"
+                    "                             from the slide caches if necessary (0: only each cache's own size)\n"
+                    " --rt-priority=PRIO        Answer the PAD requests in a thread with SCHED_FIFO priority PRIO (1-99;\n"
+                    "                             needs CAP_SYS_NICE or an rtprio limit)\n"
+                    " --rt-cpu=CPU              Answer the PAD requests in a thread pinned to CPU; by default, the other\n"
+                    "                             threads (slide preparation etc.) then keep off that CPU\n"
+                    " --worker-cpus=LIST        Run the threads other than the PAD request one on these CPUs (e.g. 0-2,4)\n"
+                    " --shards=COUNT            Answer the PAD requests of several services in COUNT threads, each with\n"
+                    "                             its own event loop and a share of the services by their requests. Default: 1\n"
+                    " --numa-node=NODE          Run the service on the CPUs of this NUMA node, so that its PAD requests, slides\n"
+                    "                             and caches stay in the node's memory ('auto': the node its audio encoder runs\n"
+                    "                             on at the start). The services of each node get shards of their own;\n"
+                    "                             --rt-cpu only applies to the node it is on\n"
+                    " --magick-threads=COUNT    Let ImageMagick use at most COUNT threads for processing a slide\n"
+                    "                             (0: one per core). Default: %zu\n"
+                    " --magick-limits=LIST      Limit ImageMagick's pixel cache to these MiB in memory, memory-mapped\n"
+                    "                             and on disk (e.g. memory=64,map=128,disk=512); by default, memory\n"
+                    "                             is limited to the --memory-budget\n"
+                    " --jpeg-offload=DEVICE     Encode the JPEG slides of all services on a hardware encoder (nvjpeg), batching\n"
+                    "                             concurrent slides; in software, if it is not available or fails\n"
+                    " --frame-budget=MS         Warn about PAD requests answered after more than MS milliseconds, with\n"
+                    "                             the time taken by slides, labels etc. (0: no warnings). Default: %d\n"
+                    "                             Slide preparation is throttled as the requests use up the budget\n"
+                    " --live-config=FILENAME    Take these settings from FILENAME (one KEY=VALUE per line; keys as the\n"
+                    "                             long options): sleep, label, label-ins, xpad-interval, max-slide-size,\n"
+                    "                             dls and label-weight. On SIGHUP, the file is read again and the\n"
+                    "                             settings are changed without interrupting the encoding\n"
+                    " --control-socket=PATH     Accept commands on the UNIX datagram socket PATH, to inject labels and\n"
+                    "                             slides or request re-reads at once (see control_socket.h)\n"
+                    " --replicate-to=HOST:PORT  Stream the encoder state (slide IDs, slide in transmission, DLS toggle bit and\n"
+                    "                             label) to a standby instance, so that it can take over without receivers noticing\n"
+                    " --standby=PORT            Run as hot standby of the instance replicating to this UDP port: follow its\n"
+                    "                             state, and take over its output once it falls silent (one service only)\n"
+                    " --next-service            Encode another service in the same process; the following options\n"
+                    "                             apply to it. Its output and mirrors, slides dir, DLS, state and live config files and\n"
+                    "                             control socket must be given again, all other options are taken over\n"
+                    "                             from the previous one.\n"
+                    " --simulate=DUR            Encode DUR seconds of PAD as fast as possible, in virtual time and without\n"
+                    "                             audio encoder (slides are prepared without lookahead), then print the stats\n"
+                    " --simulate-pad=LEN        PAD length of the simulation. Default: %d\n"
+                    " --simulate-frame=MS       Duration of a frame/AU in the simulation. Default: %d\n"
+                    " --simulate-output=FILE    Write the simulated PAD frames (each followed by the used PAD length) to FILE\n"
+                    " --plan=QUESTION           After the simulation, answer a what-if question about the X-PAD capacity by\n"
+                    "                             replaying the queued data: how long a slide takes (e.g. pad=34,xpad-interval=2,\n"
+                    "                             slide=12000, also telling the cost of DL Plus unless dl-plus=0/1 is given), or\n"
+                    "                             the largest slide sent in time (e.g. pad=34,within=10 for 10 s). May be given\n"
+                    "                             more than once\n"
                     "\n"
                     "The PAD length is configured on the audio encoder and communicated over the socket to ODR-PadEnc\n"
                     "Allowed PAD lengths are: %s\n",
                     options_default.slide_interval,
+                    options_default.pad_lookahead,
                     options_default.max_slide_size,
+                    options_default.segment_len,
+                    options_default.mot_directory_resend,
+                    options_default.slide_cache_size,
+                    options_default.slide_spill_size,
+                    options_default.slide_history_len,
+                    options_default.slide_lookahead,
                     options_default.label_interval,
                     options_default.label_insertion,
                     options_default.xpad_interval,
+                    magick_limits_t::DEFAULT_THREADS,
+                    options_default.frame_budget,
+                    options_default.simulation_padlen,
+                    options_default.simulation_frame_duration,
                     PADPacketizer::ALLOWED_PADLEN.c_str()
            );
 }
@@ -113,6 +265,633 @@ static std::string list_dls_files(std::vector<std::string> dls_files) {
 }
 
 
+// checks (and prints) the options of a service
+static int check_options(const PadEncoderOptions& options, const char* progname) {
+    if (options.max_slide_size > SLSEncoder::MAXSLIDESIZE_SIMPLE) {
+        fprintf(stderr, "ODR-PadEnc Error: max slide size %zu exceeds Simple Profile limit %zu\n",
+                options.max_slide_size, SLSEncoder::MAXSLIDESIZE_SIMPLE);
+        return 2;
+    }
+
+    if (options.segment_len < 1 || options.segment_len > SLSEncoder::MAXSEGLEN_LIMIT) {
+        fprintf(stderr, "ODR-PadEnc Error: MOT segment size %zu must be between 1 and %zu\n",
+                options.segment_len, SLSEncoder::MAXSEGLEN_LIMIT);
+        return 2;
+    }
+
+    if (options.mot_carousel && options.slide_interval == 0) {
+        fprintf(stderr, "ODR-PadEnc Error: The MOT carousel needs a slide interval!\n");
+        return 2;
+    }
+
+    if (options.slide_similarity < -1 || options.slide_similarity > 64) {
+        fprintf(stderr, "ODR-PadEnc Error: slide similarity %d must be between 0 and 64 bits\n", options.slide_similarity);
+        return 2;
+    }
+#if !HAVE_LIBJPEG
+    if (options.slide_similarity >= 0)
+        fprintf(stderr, "ODR-PadEnc Warning: compiled without libjpeg, so only files of the same content are recognised\n");
+#endif
+
+    if (options.adaptive_slide_size && options.slide_interval == 0) {
+        fprintf(stderr, "ODR-PadEnc Error: An adaptive slide size needs a slide interval!\n");
+        return 2;
+    }
+
+    if (options.slide_history_len < 1 || options.slide_history_len > (size_t) History::MAXSLIDEID + 1) {
+        fprintf(stderr, "ODR-PadEnc Error: slide history length %zu must be between 1 and %d\n",
+                options.slide_history_len, History::MAXSLIDEID + 1);
+        return 2;
+    }
+
+    if (options.SLSEnabled() && options.DLSEnabled()) {
+        fprintf(stderr, "ODR-PadEnc encoding Slideshow from '%s' and DLS from %s to '%s'\n",
+                options.sls_dir.c_str(), list_dls_files(options.dls_files).c_str(), options.socket_ident.c_str());
+    }
+    else if (options.SLSEnabled()) {
+        fprintf(stderr, "ODR-PadEnc encoding Slideshow from '%s' to '%s'. No DLS.\n",
+                options.sls_dir.c_str(), options.socket_ident.c_str());
+    }
+    else if (not options.dls_files.empty()) {
+        fprintf(stderr, "ODR-PadEnc encoding DLS from %s to '%s'. No Slideshow.\n",
+                list_dls_files(options.dls_files).c_str(), options.socket_ident.c_str());
+    }
+    else {
+        fprintf(stderr, "ODR-PadEnc Error: Neither DLS nor Slideshow to encode !\n");
+        usage(progname);
+        return 1;
+    }
+
+    const char* user_charset;
+    switch (options.dl_params.charset) {
+        case DABCharset::COMPLETE_EBU_LATIN:
+            user_charset = "Complete EBU Latin";
+            break;
+        case DABCharset::EBU_LATIN_CY_GR:
+            user_charset = "EBU Latin core, Cyrillic, Greek";
+            break;
+        case DABCharset::EBU_LATIN_AR_HE_CY_GR:
+            user_charset = "EBU Latin core, Arabic, Hebrew, Cyrillic, Greek";
+            break;
+        case DABCharset::ISO_LATIN_ALPHABET_2:
+            user_charset = "ISO Latin Alphabet 2";
+            break;
+        case DABCharset::UCS2_BE:
+            user_charset = "UCS-2 BE";
+            break;
+        case DABCharset::UTF8:
+            user_charset = "UTF-8";
+            break;
+        default:
+            fprintf(stderr, "ODR-PadEnc Error: Invalid charset!\n");
+            usage(progname);
+            return 1;
+    }
+
+    fprintf(stderr, "ODR-PadEnc using charset %s (%d)\n",
+           user_charset, (int) options.dl_params.charset);
+
+    if (not options.dl_params.raw_dls) {
+        switch (options.dl_params.charset) {
+        case DABCharset::COMPLETE_EBU_LATIN:
+            // no conversion needed
+            break;
+        case DABCharset::UTF8:
+        case DABCharset::UCS2_BE:
+            fprintf(stderr, "ODR-PadEnc converting DLS texts to Complete EBU Latin, or UCS-2 BE/UTF-8 for other characters\n");
+            break;
+        default:
+            fprintf(stderr, "ODR-PadEnc Error: DLS conversion is currently only supported for UTF-8 and UCS-2 BE input!\n");
+            return 1;
+        }
+    }
+
+    if (!options.item_state_file.empty())
+        fprintf(stderr, "ODR-PadEnc reading DL Plus Item Toggle/Running bits from '%s'.\n", options.item_state_file.c_str());
+
+
+    // TODO: check uniform PAD encoder options!?
+
+    if (options.xpad_interval < 1) {
+        fprintf(stderr, "ODR-PadEnc Error: The X-PAD interval must be 1 or greater!\n");
+        return 1;
+    }
+
+    if (options.dls_share < 0 || options.dls_share > 99) {
+        fprintf(stderr, "ODR-PadEnc Error: DLS share %d%% must be between 1 and 99 (or 0 to disable)\n", options.dls_share);
+        return 2;
+    }
+
+    if (options.stats_interval < 0) {
+        fprintf(stderr, "ODR-PadEnc Error: The stats interval must not be negative!\n");
+        return 2;
+    }
+
+    if (options.frame_budget < 0) {
+        fprintf(stderr, "ODR-PadEnc Error: The frame budget must not be negative!\n");
+        return 2;
+    }
+
+    DLPlusTagger dl_plus_tagger;
+    for (const std::string& format : options.dl_plus_formats) {
+        if (!dl_plus_tagger.addFormat(format)) {
+            fprintf(stderr, "ODR-PadEnc Error: invalid DL Plus format '%s'\n", format.c_str());
+            return 2;
+        }
+    }
+
+    if (options.simulation < 0) {
+        fprintf(stderr, "ODR-PadEnc Error: The simulation duration must not be negative!\n");
+        return 2;
+    }
+    if (options.simulation > 0) {
+        if (!PADPacketizer::CheckPADLen(options.simulation_padlen)) {
+            fprintf(stderr, "ODR-PadEnc Error: PAD length %d invalid: Possible values: %s\n",
+                    options.simulation_padlen, PADPacketizer::ALLOWED_PADLEN.c_str());
+            return 2;
+        }
+        if (options.simulation_frame_duration < 1) {
+            fprintf(stderr, "ODR-PadEnc Error: The simulated frame duration must be 1 ms or greater!\n");
+            return 2;
+        }
+        if (!options.control_socket.empty()) {
+            fprintf(stderr, "ODR-PadEnc Error: The control socket is not supported in the simulation!\n");
+            return 2;
+        }
+    } else if (!options.capacity_queries.empty()) {
+        fprintf(stderr, "ODR-PadEnc Error: The capacity questions are answered after a simulation (--simulate)!\n");
+        return 2;
+    }
+
+    if (options.shm_frames > 0 && PadInterface::is_udp_ident(options.socket_ident)) {
+        fprintf(stderr, "ODR-PadEnc Error: The shared memory ring is only available to a local audio encoder!\n");
+        return 2;
+    }
+
+    if (!options.replicate_to.empty() && options.simulation > 0) {
+        fprintf(stderr, "ODR-PadEnc Error: The encoder state is not replicated in the simulation!\n");
+        return 2;
+    }
+
+    if (!options.mirror_idents.empty()) {
+        if (options.simulation > 0 || options.shm_frames > 0) {
+            fprintf(stderr, "ODR-PadEnc Error: Mirrored audio encoders are only supported over the socket!\n");
+            return 2;
+        }
+        if (options.pad_lookahead > 0) {
+            fprintf(stderr, "ODR-PadEnc Error: The PAD lookahead is not supported with mirrored audio encoders!\n");
+            return 2;
+        }
+    }
+
+    return 0;
+}
+
+
+// reads the live configs again on each SIGHUP, until the process exits
+static void reload_live_configs(const std::vector<PadEncoderOptions>& services, std::deque<LiveOptions>& live_options) {
+    ThreadPlacement::Global().EnterWorker();
+
+    for (;;) {
+        while (sem_wait(&reload_sem) && errno == EINTR)
+            ;
+        if (do_exit)
+            return;
+
+        for (size_t i = 0; i < services.size(); i++) {
+            if (services[i].live_config_file.empty())
+                continue;
+
+            // unlisted settings are those of the command line
+            std::shared_ptr<PadEncoderOptions> options = std::make_shared<PadEncoderOptions>(services[i]);
+            if (read_live_config(options->live_config_file, *options) && check_live_options(*options)) {
+                live_options[i].Publish(options);
+                fprintf(stderr, "ODR-PadEnc reloaded live config '%s'\n", options->live_config_file.c_str());
+            } else {
+                fprintf(stderr, "ODR-PadEnc Warning: keeping the previous settings of '%s'\n", services[i].socket_ident.c_str());
+            }
+        }
+    }
+}
+
+
+// (re)initialises the encoder on a changed PAD length
+static int apply_padlen(PadEncoderOptions& options, uint8_t padlen, std::shared_ptr<PadEncoder>& pad_encoder,
+                        LiveOptions& live_options, Reactor* reactor = nullptr, const EncoderReplica* replica = nullptr) {
+    if (padlen == options.padlen && pad_encoder)
+        return 0;
+    options.padlen = padlen;
+
+    if (!PADPacketizer::CheckPADLen(options.padlen)) {
+        fprintf(stderr, "ODR-PadEnc Error: PAD length %d invalid: Possible values: %s\n",
+                options.padlen, PADPacketizer::ALLOWED_PADLEN.c_str());
+        return 2;
+    }
+
+    fprintf(stderr, "ODR-PadEnc Reinitialise PAD length to %d\n", options.padlen);
+    if (pad_encoder)
+        pad_encoder->SetPADLength(options.padlen);
+    else {
+        pad_encoder = std::make_shared<PadEncoder>(options, nullptr, reactor, replica);
+        pad_encoder->SetLiveOptions(&live_options);
+    }
+    return 0;
+}
+
+
+// writes an injected slide's content to a temporary file, to be erased once sent; empty, on failure
+static std::string write_temp_slide(const uint8_t* data, size_t len) {
+    static const uint8_t JPEG_MAGIC[] = {0xFF, 0xD8, 0xFF};
+    static const uint8_t PNG_MAGIC[] = {0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A};
+
+    const char* suffix;
+    if (len >= sizeof(JPEG_MAGIC) && !memcmp(data, JPEG_MAGIC, sizeof(JPEG_MAGIC)))
+        suffix = ".jpg";
+    else if (len >= sizeof(PNG_MAGIC) && !memcmp(data, PNG_MAGIC, sizeof(PNG_MAGIC)))
+        suffix = ".png";
+    else {
+        fprintf(stderr, "ODR-PadEnc Warning: injected slide neither JPEG nor PNG\n");
+        return "";
+    }
+
+    std::string path = std::string(P_tmpdir) + "/odr-padenc-slide-XXXXXX" + suffix;
+    int fd = mkstemps(&path[0], strlen(suffix));
+    if (fd == -1) {
+        perror("ODR-PadEnc Error: creating temporary slide file failed");
+        return "";
+    }
+    bool success = write(fd, data, len) == (ssize_t) len;
+    if (!success)
+        perror(("ODR-PadEnc Error: writing temporary slide file '" + path + "' failed").c_str());
+    close(fd);
+    if (!success) {
+        unlink(path.c_str());
+        return "";
+    }
+    return path;
+}
+
+
+// runs a command received over the control socket
+static ControlSocket::status_t run_control_command(PadEncoder* pad_encoder, uint8_t command, const uint8_t* args, size_t len) {
+    // the encoder is created on the first PAD request
+    if (!pad_encoder)
+        return ControlSocket::STATUS_UNAVAILABLE;
+
+    bool available;
+    switch (command) {
+    case ControlSocket::CMD_LABEL:
+    case ControlSocket::CMD_LABEL_URGENT:
+        available = pad_encoder->InjectLabel(std::string((const char*) args, len), command == ControlSocket::CMD_LABEL_URGENT);
+        break;
+    case ControlSocket::CMD_LABEL_RELEASE:
+        pad_encoder->ReleaseLabel();
+        available = true;
+        break;
+    case ControlSocket::CMD_SLIDE_FILE:
+        if (len == 0)
+            return ControlSocket::STATUS_INVALID;
+        available = pad_encoder->InjectSlide({std::string((const char*) args, len), false});
+        break;
+    case ControlSocket::CMD_SLIDE_FILES: {
+        // one command (and injection) for all, e.g. the slides of the hour
+        std::vector<injected_slide_t> slides;
+        for (size_t start = 0, end; start < len; start = end + 1) {
+            end = std::find(args + start, args + len, '\0') - args;
+            if (end == start || end == len)
+                return ControlSocket::STATUS_INVALID;
+            slides.push_back({std::string((const char*) args + start, end - start), false});
+        }
+        if (slides.empty())
+            return ControlSocket::STATUS_INVALID;
+        available = pad_encoder->InjectSlides(slides);
+        break;
+    }
+    case ControlSocket::CMD_SLIDE_DATA: {
+        std::string path = write_temp_slide(args, len);
+        if (path.empty())
+            return ControlSocket::STATUS_INVALID;
+        available = pad_encoder->InjectSlide({path, true});
+        if (!available)
+            unlink(path.c_str());
+        break;
+    }
+    case ControlSocket::CMD_REREAD_SLIDES:
+        available = pad_encoder->TriggerSlidesReread();
+        break;
+    case ControlSocket::CMD_REREAD_DLS:
+        if (len != 1)
+            return ControlSocket::STATUS_INVALID;
+        available = pad_encoder->TriggerLabelReread(args[0]);
+        break;
+    default:
+        fprintf(stderr, "ODR-PadEnc Warning: unknown control command %d\n", command);
+        return ControlSocket::STATUS_INVALID;
+    }
+    return available ? ControlSocket::STATUS_OK : ControlSocket::STATUS_UNAVAILABLE;
+}
+
+
+// encodes a single service over the shared memory ring
+static int run_service(PadEncoderOptions options, LiveOptions& live_options) {
+    int result = 0;
+
+    PadShmRing ring;
+    ring.create(options.socket_ident, options.shm_frames);
+    fprintf(stderr, "ODR-PadEnc handing PAD frames over shared memory, up to %zu frames ahead\n", options.shm_frames);
+
+    std::shared_ptr<PadEncoder> pad_encoder;
+
+    ControlSocket control;
+    if (!options.control_socket.empty())
+        control.Open(options.control_socket);
+    const ControlSocket::handler_t control_handler = [&pad_encoder](uint8_t command, const uint8_t* args, size_t len) {
+        return run_control_command(pad_encoder.get(), command, args, len);
+    };
+
+    while (!do_exit) {
+        // between the requests, as there is no event loop
+        if (control.fd() != -1)
+            control.Process(control_handler);
+
+        uint8_t padlen = ring.wait_for_request(240);
+        if (padlen > 0) {
+            result = apply_padlen(options, padlen, pad_encoder, live_options);
+            if (result)
+                break;
+
+            result = pad_encoder->Encode(ring);
+            if (result > 0) {
+                break;
+            }
+        }
+    }
+
+    return result;
+}
+
+
+// answers a capacity question (see --plan) for the state the encoder is in
+static void print_capacity_plan(const PadEncoder& pad_encoder, const PadEncoderOptions& options, const capacity_query_t& query) {
+    const int padlen = query.padlen ? query.padlen : options.padlen;
+    const int xpad_interval = query.xpad_interval ? query.xpad_interval : options.xpad_interval;
+    fprintf(stderr, "ODR-PadEnc plan for PAD length %d, X-PAD interval %d: ", padlen, xpad_interval);
+
+    if (query.within > std::chrono::milliseconds::zero()) {
+        fprintf(stderr, "slides of up to %zu bytes are sent within %.1f s\n",
+                pad_encoder.PlanMaxSlideSize(query), query.within.count() / 1000.0);
+        return;
+    }
+
+    capacity_plan_t plan;
+    if (!pad_encoder.PlanCapacity(query, plan)) {
+        fprintf(stderr, "a slide of %zu bytes is not sent within %d minutes\n",
+                query.slide_size, (int) PadEncoder::MAX_PLAN_DURATION.count());
+        return;
+    }
+    fprintf(stderr, "a slide of %zu bytes is sent after %.2f s (%zu frames), with %zu bytes of labels meanwhile (%.1f%% of the X-PAD)\n",
+            query.slide_size, plan.duration.count() / 1000.0, plan.frames, plan.label_bytes,
+            100.0 * plan.label_bytes / std::max(plan.capacity_bytes, (size_t) 1));
+
+    // what DL Plus costs, unless asked for the label with or without it
+    capacity_query_t with = query;
+    capacity_query_t without = query;
+    with.dl_plus = 1;
+    without.dl_plus = 0;
+    capacity_plan_t with_plan;
+    capacity_plan_t without_plan;
+    if (query.dl_plus < 0 && options.DLSEnabled() && pad_encoder.PlanCapacity(with, with_plan) && pad_encoder.PlanCapacity(without, without_plan))
+        fprintf(stderr, "ODR-PadEnc plan:   DL Plus delays the slide by %.2f s (%zu instead of %zu bytes of labels)\n",
+                (with_plan.duration - without_plan.duration).count() / 1000.0, with_plan.label_bytes, without_plan.label_bytes);
+}
+
+
+// encodes a single service in virtual time, as fast as possible
+static int run_simulation(PadEncoderOptions options) {
+    // slides prepared in another thread would be ready at different frames on each run
+    options.slide_lookahead = 0;
+    options.padlen = options.simulation_padlen;
+
+    FILE* output = nullptr;
+    if (!options.simulation_output.empty()) {
+        output = fopen(options.simulation_output.c_str(), "wb");
+        if (!output) {
+            perror(("ODR-PadEnc Error: opening simulation output '" + options.simulation_output + "' failed").c_str());
+            return 1;
+        }
+    }
+
+    VirtualPadClock clock;
+    PadEncoder pad_encoder(options, &clock);
+    std::vector<uint8_t> pad(pad_encoder.GetPADFrameSize());
+    const std::chrono::milliseconds frame_duration(options.simulation_frame_duration);
+    const size_t frames = (size_t) options.simulation * 1000 / options.simulation_frame_duration;
+    fprintf(stderr, "ODR-PadEnc simulating %zu frames of PAD length %d (%d s)\n", frames, options.padlen, options.simulation);
+
+    int result = 0;
+    size_t frame = 0;
+    const steady_clock::time_point start = steady_clock::now();
+    for (; frame < frames && !do_exit; frame++) {
+        result = pad_encoder.Encode(&pad[0]);
+        if (result)
+            break;
+        if (output && fwrite(&pad[0], pad.size(), 1, output) != 1) {
+            perror("ODR-PadEnc Error: writing simulation output failed");
+            result = 1;
+            break;
+        }
+        clock.Advance(frame_duration);
+    }
+    const double elapsed = std::chrono::duration<double>(steady_clock::now() - start).count();
+
+    if (output)
+        fclose(output);
+
+    fprintf(stderr, "ODR-PadEnc simulated %zu frames in %.2f s (%.0fx real time)\n",
+            frame, elapsed, elapsed > 0 ? frame * options.simulation_frame_duration / 1000.0 / elapsed : 0.0);
+    pad_encoder.DumpStats();
+    for (const capacity_query_t& query : options.capacity_queries)
+        print_capacity_plan(pad_encoder, options, query);
+    return result;
+}
+
+
+// follows the journal of the primary instance (see --standby) until it falls silent or exit is requested; 1 on error
+static int wait_for_takeover(const std::string& port, EncoderReplica& replica) {
+    ReplicaReceiver receiver(replica);
+    receiver.Open(port);
+    fprintf(stderr, "ODR-PadEnc standby, waiting for the journal of the primary on UDP port %s\n", port.c_str());
+
+    const int poll_ms = ReplicaReceiver::TAKEOVER_TIMEOUT.count() / 10;
+    steady_clock::time_point last_record = steady_clock::now();
+    while (!do_exit) {
+        int received = receiver.Receive(poll_ms);
+        if (received < 0)
+            return 1;
+
+        const steady_clock::time_point now = steady_clock::now();
+        if (received) {
+            if (receiver.GetRecords() == 1)
+                fprintf(stderr, "ODR-PadEnc standby following the primary\n");
+            last_record = now;
+        } else if (receiver.HeardPrimary() && now - last_record >= ReplicaReceiver::TAKEOVER_TIMEOUT) {
+            fprintf(stderr, "ODR-PadEnc primary silent for %lld ms, taking over with %zu slide IDs%s%s (%zu journal records, %zu lost)\n",
+                    (long long) std::chrono::duration_cast<std::chrono::milliseconds>(now - last_record).count(),
+                    replica.GetEntries().size(), replica.HasCurrentSlide() ? ", the current slide" : "",
+                    replica.HasLabel() ? ", the label" : "", receiver.GetRecords(), receiver.GetLostRecords());
+            return 0;
+        }
+    }
+    return 0;
+}
+
+
+/*! places the services on the shards, balancing the sockets whose requests
+ *  each shard answers; the services of a NUMA node only share shards with
+ *  each other, and each node gets at least one
+ */
+static std::vector<std::vector<size_t>> place_services(const std::vector<PadEncoderOptions>& services_options, size_t shards,
+                                                       std::vector<int>& shard_nodes) {
+    auto load = [&](size_t i) {return 1 + services_options[i].mirror_idents.size();};
+    struct group_t {
+        std::vector<size_t> services;
+        size_t load = 0;
+        size_t shards = 1;
+    };
+    std::map<int, group_t> groups;  // by node
+    for (size_t i = 0; i < services_options.size(); i++) {
+        group_t& group = groups[services_options[i].numa_node];
+        group.services.push_back(i);
+        group.load += load(i);
+    }
+
+    // the further shards to the groups with the most load per shard
+    for (size_t extra = groups.size(); extra < shards; extra++) {
+        group_t* busiest = nullptr;
+        for (auto& node_group : groups) {
+            group_t& group = node_group.second;
+            if (group.shards < group.services.size() && (!busiest || group.load * busiest->shards > busiest->load * group.shards))
+                busiest = &group;
+        }
+        if (!busiest)
+            break;
+        busiest->shards++;
+    }
+
+    std::vector<std::vector<size_t>> placement;
+    shard_nodes.clear();
+    for (auto& node_group : groups) {
+        group_t& group = node_group.second;
+        std::stable_sort(group.services.begin(), group.services.end(), [&](size_t a, size_t b) {return load(a) > load(b);});
+
+        // the busiest services first, each to the least loaded shard
+        std::vector<std::vector<size_t>> group_placement(group.shards);
+        std::vector<size_t> shard_loads(group.shards, 0);
+        for (size_t i : group.services) {
+            size_t shard = std::min_element(shard_loads.begin(), shard_loads.end()) - shard_loads.begin();
+            group_placement[shard].push_back(i);
+            shard_loads[shard] += load(i);
+        }
+        for (std::vector<size_t>& services : group_placement) {
+            std::sort(services.begin(), services.end());
+            placement.push_back(services);
+            shard_nodes.push_back(node_group.first);
+        }
+    }
+    return placement;
+}
+
+/*! encodes the given services over their sockets, all served by the one event
+ *  loop; an error sets stop, also for the other shards
+ */
+static int run_services(const std::vector<PadEncoderOptions>& services_options, std::deque<LiveOptions>& live_options,
+                        const std::vector<size_t>& service_indices, Reactor& reactor, std::atomic<bool>& stop,
+                        const EncoderReplica* replica = nullptr) {
+    struct service_t {
+        PadEncoderOptions options;
+        LiveOptions* live_options;
+        std::deque<PadInterface> intfs;     // the output, then the mirrors
+        std::shared_ptr<PadEncoder> pad_encoder;
+        std::unique_ptr<PadFanOut> fan_out; // if mirrored
+        ControlSocket control;
+    };
+
+    int result = 0;
+
+    std::vector<std::unique_ptr<service_t>> services;
+    for (size_t i : service_indices) {
+        const PadEncoderOptions& options = services_options[i];
+        services.emplace_back(new service_t());
+        service_t& service = *services.back();
+        service.options = options;
+        service.live_options = &live_options[i];
+        service.intfs.emplace_back();
+        service.intfs.back().open(options.socket_ident);
+        for (const std::string& ident : options.mirror_idents) {
+            service.intfs.emplace_back();
+            service.intfs.back().open(ident);
+        }
+        if (service.intfs.size() > 1) {
+            service.fan_out.reset(new PadFanOut(service.intfs.size()));
+            fprintf(stderr, "ODR-PadEnc serving '%s' and %zu mirrors with the same PAD\n",
+                    options.socket_ident.c_str(), options.mirror_idents.size());
+        }
+
+        for (size_t peer = 0; peer < service.intfs.size(); peer++) {
+            PadInterface& intf = service.intfs[peer];
+            reactor.Add(intf.fd(), [&service, &intf, peer, &reactor, replica, &result, &stop]() {
+                // drain all pending requests, as the socket is only reported once for them
+                for (;;) {
+                    size_t frames = 1;
+                    uint8_t padlen = intf.receive_request(frames, 0);
+                    if (padlen == 0)
+                        return;
+
+                    int service_result = apply_padlen(service.options, padlen, service.pad_encoder, *service.live_options, &reactor, replica);
+                    if (!service_result) {
+                        if (service.fan_out)
+                            service_result = service.fan_out->Encode(*service.pad_encoder, peer, intf, frames);
+                        else
+                            service_result = service.pad_encoder->Encode(intf, frames);
+                    }
+                    if (service_result > 0) {
+                        result = service_result;
+                        stop.store(true);
+                        wake_pad_reactors();
+                        return;
+                    }
+                }
+            });
+        }
+
+        // in the same loop, so that a command never races a PAD request
+        if (!options.control_socket.empty()) {
+            service.control.Open(options.control_socket);
+            reactor.Add(service.control.fd(), [&service]() {
+                service.control.Process([&service](uint8_t command, const uint8_t* args, size_t len) {
+                    return run_control_command(service.pad_encoder.get(), command, args, len);
+                });
+            });
+        }
+    }
+    if (services.size() > 1 && services.size() == services_options.size())
+        fprintf(stderr, "ODR-PadEnc encoding %zu services\n", services.size());
+
+    while (!do_exit && !stop)
+        reactor.RunOnce(-1);
+
+    // the encoders watch their re-read requests with the reactor, too
+    for (std::unique_ptr<service_t>& service : services) {
+        for (PadInterface& intf : service->intfs)
+            reactor.Remove(intf.fd());
+        if (service->control.fd() != -1)
+            reactor.Remove(service->control.fd());
+        service->pad_encoder.reset();
+    }
+    return result;
+}
+
+
 int main(int argc, char *argv[]) {
     // Version handling is done very early to ensure nothing else but the version gets printed out
     if (argc == 2 and strcmp(argv[1], "--version") == 0) {
@@ -130,6 +909,16 @@ int main(int argc, char *argv[]) {
 
     // get/check options
     PadEncoderOptions options;
+    std::vector<PadEncoderOptions> services;
+    bool log_json = false;
+    size_t memory_budget = 0;
+    int rt_priority = 0;
+    int rt_cpu = -1;
+    std::vector<int> worker_cpus;
+    magick_limits_t magick_limits;
+    std::string jpeg_device;
+    std::string standby_port;
+    size_t shards = 1;
 
     const struct option longopts[] = {
         {"charset",         required_argument,  0, 'c'},
@@ -150,6 +939,57 @@ int main(int argc, char *argv[]) {
         {"verbose",         no_argument,        0, 'v'},
         {"dump-current-slide",   required_argument, 0, 1},
         {"dump-completed-slide", required_argument, 0, 2},
+        {"slide-cache",     required_argument,  0, 3},
+        {"slide-lookahead", required_argument,  0, 4},
+        {"slide-history",   required_argument,  0, 5},
+        {"slide-state",     required_argument,  0, 6},
+        {"shm-frames",      required_argument,  0, 7},
+        {"pad-lookahead",   required_argument,  0, 8},
+        {"label-weight",    required_argument,  0, 9},
+        {"next-service",    no_argument,        0, 10},
+        {"lookahead-packing", no_argument,      0, 11},
+        {"dls-share",       required_argument,  0, 12},
+        {"stats",           required_argument,  0, 13},
+        {"adaptive-slide-size", no_argument,    0, 14},
+        {"segment-size",    required_argument,  0, 15},
+        {"mot-carousel",    no_argument,        0, 16},
+        {"header-repetition", required_argument, 0, 17},
+        {"slide-similarity", required_argument, 0, 18},
+        {"dl-plus-format",  required_argument,  0, 19},
+        {"simulate",        required_argument,  0, 20},
+        {"simulate-pad",    required_argument,  0, 21},
+        {"simulate-frame",  required_argument,  0, 22},
+        {"simulate-output", required_argument,  0, 23},
+        {"frame-budget",    required_argument,  0, 24},
+        {"log-json",        no_argument,        0, 25},
+        {"memory-budget",   required_argument,  0, 26},
+        {"rt-priority",     required_argument,  0, 27},
+        {"rt-cpu",          required_argument,  0, 28},
+        {"worker-cpus",     required_argument,  0, 29},
+        {"magick-threads",  required_argument,  0, 30},
+        {"slide-store",     required_argument,  0, 31},
+        {"slide-bundle",    required_argument,  0, 32},
+        {"live-config",     required_argument,  0, 33},
+        {"control-socket",  required_argument,  0, 34},
+        {"slides-window",   required_argument,  0, 35},
+        {"mirror",          required_argument,  0, 36},
+        {"replicate-to",    required_argument,  0, 37},
+        {"standby",         required_argument,  0, 38},
+        {"magick-limits",   required_argument,  0, 39},
+        {"jpeg-offload",    required_argument,  0, 40},
+        {"slide-candidates", no_argument,       0, 41},
+        {"header-positions", required_argument, 0, 42},
+        {"slide-content-ids", no_argument,      0, 43},
+        {"idle-fill",       no_argument,        0, 44},
+        {"adaptive-label-ins", no_argument,     0, 45},
+        {"shards",          required_argument,  0, 46},
+        {"slide-spill",     required_argument,  0, 47},
+        {"slide-spill-size", required_argument, 0, 48},
+        {"mot-directory",   required_argument,  0, 49},
+        {"mot-directory-resend", required_argument, 0, 50},
+        {"change-settle",   required_argument,  0, 51},
+        {"plan",            required_argument,  0, 52},
+        {"numa-node",       required_argument,  0, 53},
         {0,0,0,0},
     };
 
@@ -179,6 +1019,7 @@ int main(int argc, char *argv[]) {
                 break;
             case 't':   // can be used more than once!
                 options.dls_files.push_back(optarg);
+                options.dls_weights.push_back(1);
                 break;
             case 'I':
                 options.item_state_file = optarg;
@@ -207,97 +1048,314 @@ int main(int argc, char *argv[]) {
             case 2: // dump-completed-slide
                 options.completed_slide_dump_name = optarg;
                 break;
+            case 3: // slide-cache
+                options.slide_cache_size = strtoul(optarg, NULL, 10);
+                break;
+            case 4: // slide-lookahead
+                options.slide_lookahead = strtoul(optarg, NULL, 10);
+                break;
+            case 5: // slide-history
+                options.slide_history_len = strtoul(optarg, NULL, 10);
+                break;
+            case 6: // slide-state
+                options.slide_state_file = optarg;
+                break;
+            case 7: // shm-frames
+                options.shm_frames = strtoul(optarg, NULL, 10);
+                break;
+            case 8: // pad-lookahead
+                options.pad_lookahead = strtoul(optarg, NULL, 10);
+                break;
+            case 9: // label-weight
+                if (options.dls_files.empty()) {
+                    fprintf(stderr, "ODR-PadEnc Error: label weight must follow a DLS file\n");
+                    return 2;
+                }
+                options.dls_weights.back() = atoi(optarg);
+                if (options.dls_weights.back() < 1) {
+                    fprintf(stderr, "ODR-PadEnc Error: label weight %d must be at least 1\n", options.dls_weights.back());
+                    return 2;
+                }
+                break;
+            case 10: // next-service
+                services.push_back(options);
+                options.sls_dir.clear();
+                options.socket_ident.clear();
+                options.mirror_idents.clear();
+                options.dls_files.clear();
+                options.dls_weights.clear();
+                options.item_state_file.clear();
+                options.current_slide_dump_name.clear();
+                options.completed_slide_dump_name.clear();
+                options.slide_state_file.clear();
+                options.live_config_file.clear();
+                options.control_socket.clear();
+                options.replicate_to.clear();
+                break;
+            case 11: // lookahead-packing
+                options.lookahead_packing = true;
+                break;
+            case 12: // dls-share
+                options.dls_share = atoi(optarg);
+                break;
+            case 13: // stats
+                options.stats_interval = atoi(optarg);
+                break;
+            case 14: // adaptive-slide-size
+                options.adaptive_slide_size = true;
+                break;
+            case 15: // segment-size
+                options.adaptive_segment_len = strcmp(optarg, "auto") == 0;
+                if (!options.adaptive_segment_len)
+                    options.segment_len = atoi(optarg);
+                break;
+            case 16: // mot-carousel
+                options.mot_carousel = true;
+                break;
+            case 17: // header-repetition
+                options.header_repetition = atoi(optarg);
+                break;
+            case 18: // slide-similarity
+                options.slide_similarity = atoi(optarg);
+                break;
+            case 19: // dl-plus-format
+                options.dl_plus_formats.push_back(optarg);
+                break;
+            case 20: // simulate
+                options.simulation = atoi(optarg);
+                break;
+            case 21: // simulate-pad
+                options.simulation_padlen = atoi(optarg);
+                break;
+            case 22: // simulate-frame
+                options.simulation_frame_duration = atoi(optarg);
+                break;
+            case 23: // simulate-output
+                options.simulation_output = optarg;
+                break;
+            case 24: // frame-budget
+                options.frame_budget = atoi(optarg);
+                break;
+            case 25: // log-json
+                log_json = true;
+                break;
+            case 26: // memory-budget
+                memory_budget = (size_t) std::max(atoi(optarg), 0) * 1024 * 1024;
+                break;
+            case 27: // rt-priority
+                rt_priority = atoi(optarg);
+                if (rt_priority < 1 || rt_priority > 99) {
+                    fprintf(stderr, "ODR-PadEnc Error: real-time priority %d must be between 1 and 99\n", rt_priority);
+                    return 2;
+                }
+                break;
+            case 28: // rt-cpu
+                rt_cpu = atoi(optarg);
+                if (rt_cpu < 0) {
+                    fprintf(stderr, "ODR-PadEnc Error: CPU %d is invalid\n", rt_cpu);
+                    return 2;
+                }
+                break;
+            case 29: // worker-cpus
+                if (!ThreadPlacement::ParseCPUList(optarg, worker_cpus)) {
+                    fprintf(stderr, "ODR-PadEnc Error: CPU list '%s' is invalid\n", optarg);
+                    return 2;
+                }
+                break;
+            case 30: // magick-threads
+                magick_limits.threads = std::max(atoi(optarg), 0);
+                break;
+            case 31: // slide-store
+                options.slide_store_dir = optarg;
+                break;
+            case 32: // slide-bundle
+                options.slide_bundle_file = optarg;
+                break;
+            case 33: // live-config
+                options.live_config_file = optarg;
+                break;
+            case 34: // control-socket
+                options.control_socket = optarg;
+                break;
+            case 35: // slides-window
+                options.slides_window = strtoul(optarg, NULL, 10);
+                break;
+            case 36: // mirror
+                options.mirror_idents.push_back(optarg);
+                break;
+            case 37: // replicate-to
+                options.replicate_to = optarg;
+                break;
+            case 38: // standby
+                standby_port = optarg;
+                break;
+            case 39: // magick-limits
+                if (!magick_limits.Parse(optarg)) {
+                    fprintf(stderr, "ODR-PadEnc Error: ImageMagick limits '%s' are invalid\n", optarg);
+                    return 2;
+                }
+                break;
+            case 40: // jpeg-offload
+                jpeg_device = optarg;
+                break;
+            case 41: // slide-candidates
+                options.slide_candidates = true;
+                break;
+            case 42: // header-positions
+                if (!MOTObjectBuilder::ParseHeaderPositions(optarg, options.header_positions)) {
+                    fprintf(stderr, "ODR-PadEnc Error: MOT header positions '%s' are invalid\n", optarg);
+                    return 2;
+                }
+                break;
+            case 43: // slide-content-ids
+                options.slide_content_ids = true;
+                break;
+            case 44: // idle-fill
+                options.idle_fill = true;
+                break;
+            case 45: // adaptive-label-ins
+                options.adaptive_label_insertion = true;
+                break;
+            case 46: // shards
+                if (atoi(optarg) < 1 || (size_t) atoi(optarg) > MAX_SHARDS) {
+                    fprintf(stderr, "ODR-PadEnc Error: shard count %s is not within 1 to %zu\n", optarg, MAX_SHARDS);
+                    return 2;
+                }
+                shards = atoi(optarg);
+                break;
+            case 47: // slide-spill
+                options.slide_spill_dir = optarg;
+                break;
+            case 48: // slide-spill-size
+                options.slide_spill_size = strtoul(optarg, NULL, 10);
+                break;
+            case 49: // mot-directory
+                options.mot_directory = strtoul(optarg, NULL, 10);
+                break;
+            case 50: // mot-directory-resend
+                options.mot_directory_resend = strtoul(optarg, NULL, 10);
+                break;
+            case 51: // change-settle
+                if (!ChangeCoalescer::ParseSettle(optarg, options.change_settle)) {
+                    fprintf(stderr, "ODR-PadEnc Error: change settle time '%s' is invalid\n", optarg);
+                    return 2;
+                }
+                break;
+            case 52: // plan
+            {
+                capacity_query_t query;
+                if (!query.Parse(optarg)) {
+                    fprintf(stderr, "ODR-PadEnc Error: capacity question '%s' is invalid\n", optarg);
+                    return 2;
+                }
+                options.capacity_queries.push_back(query);
+                break;
+            }
+            case 53: // numa-node
+                if (strcmp(optarg, "auto") == 0) {
+                    options.numa_node = PadEncoderOptions::NUMA_PEER;
+                }
+                else {
+                    char* end;
+                    options.numa_node = strtol(optarg, &end, 10);
+                    if (end == optarg || *end || options.numa_node < 0 || options.numa_node >= NumaTopology::MAX_NODES) {
+                        fprintf(stderr, "ODR-PadEnc Error: NUMA node '%s' is invalid\n", optarg);
+                        return 2;
+                    }
+                }
+                break;
             case '?':
             case 'h':
                 usage(argv[0]);
                 return 0;
         }
     }
+    services.push_back(options);
 
-    if (options.max_slide_size > SLSEncoder::MAXSLIDESIZE_SIMPLE) {
-        fprintf(stderr, "ODR-PadEnc Error: max slide size %zu exceeds Simple Profile limit %zu\n",
-                options.max_slide_size, SLSEncoder::MAXSLIDESIZE_SIMPLE);
-        return 2;
+    // the live configs override the settings of the command line
+    for (PadEncoderOptions& service : services) {
+        if (!service.live_config_file.empty() && !(read_live_config(service.live_config_file, service) && check_live_options(service)))
+            return 2;
     }
 
-    if (options.sls_dir && not options.dls_files.empty()) {
-        fprintf(stderr, "ODR-PadEnc encoding Slideshow from '%s' and DLS from %s to '%s'\n",
-                options.sls_dir, list_dls_files(options.dls_files).c_str(), options.socket_ident.c_str());
-    }
-    else if (options.sls_dir) {
-        fprintf(stderr, "ODR-PadEnc encoding Slideshow from '%s' to '%s'. No DLS.\n",
-                options.sls_dir, options.socket_ident.c_str());
-    }
-    else if (not options.dls_files.empty()) {
-        fprintf(stderr, "ODR-PadEnc encoding DLS from %s to '%s'. No Slideshow.\n",
-                list_dls_files(options.dls_files).c_str(), options.socket_ident.c_str());
-    }
-    else {
-        fprintf(stderr, "ODR-PadEnc Error: Neither DLS nor Slideshow to encode !\n");
-        usage(argv[0]);
-        return 1;
-    }
+    std::set<std::string> socket_idents;
+    for (const PadEncoderOptions& service : services) {
+        int result = check_options(service, argv[0]);
+        if (result)
+            return result;
 
-    const char* user_charset;
-    switch (options.dl_params.charset) {
-        case DABCharset::COMPLETE_EBU_LATIN:
-            user_charset = "Complete EBU Latin";
-            break;
-        case DABCharset::EBU_LATIN_CY_GR:
-            user_charset = "EBU Latin core, Cyrillic, Greek";
-            break;
-        case DABCharset::EBU_LATIN_AR_HE_CY_GR:
-            user_charset = "EBU Latin core, Arabic, Hebrew, Cyrillic, Greek";
-            break;
-        case DABCharset::ISO_LATIN_ALPHABET_2:
-            user_charset = "ISO Latin Alphabet 2";
-            break;
-        case DABCharset::UCS2_BE:
-            user_charset = "UCS-2 BE";
-            break;
-        case DABCharset::UTF8:
-            user_charset = "UTF-8";
-            break;
-        default:
-            fprintf(stderr, "ODR-PadEnc Error: Invalid charset!\n");
-            usage(argv[0]);
-            return 1;
+        if (!socket_idents.insert(service.socket_ident).second) {
+            fprintf(stderr, "ODR-PadEnc Error: output '%s' used by more than one service\n", service.socket_ident.c_str());
+            return 2;
+        }
+        if (services.size() > 1 && service.shm_frames > 0) {
+            fprintf(stderr, "ODR-PadEnc Error: shared memory output not supported with several services\n");
+            return 2;
+        }
+        if (services.size() > 1 && service.simulation > 0) {
+            fprintf(stderr, "ODR-PadEnc Error: simulation not supported with several services\n");
+            return 2;
+        }
+    }
+    if (!standby_port.empty() && (services.size() > 1 || services.front().shm_frames > 0 || services.front().simulation > 0)) {
+        fprintf(stderr, "ODR-PadEnc Error: A standby only supports one service over the socket!\n");
+        return 2;
     }
 
-    fprintf(stderr, "ODR-PadEnc using charset %s (%d)\n",
-           user_charset, (int) options.dl_params.charset);
-
-    if (not options.dl_params.raw_dls) {
-        switch (options.dl_params.charset) {
-        case DABCharset::COMPLETE_EBU_LATIN:
-            // no conversion needed
-            break;
-        case DABCharset::UTF8:
-            fprintf(stderr, "ODR-PadEnc converting DLS texts to Complete EBU Latin\n");
-            break;
-        default:
-            fprintf(stderr, "ODR-PadEnc Error: DLS conversion to EBU is currently only supported for UTF-8 input!\n");
-            return 1;
+    // a shard per service at most
+    shards = std::min(shards, services.size());
+    ThreadPlacement& placement = ThreadPlacement::Global();
+
+    // the NUMA nodes of the services, each with shards of its own
+    const NumaTopology& topology = NumaTopology::Global();
+    std::set<int> numa_nodes;
+    for (PadEncoderOptions& service : services) {
+        if (service.numa_node == PadEncoderOptions::NUMA_PEER) {
+            service.numa_node = topology.NodeOfSocketPeer("/tmp/" + service.socket_ident + ".audioenc");
+            if (service.numa_node < 0)
+                fprintf(stderr, "ODR-PadEnc Warning: the NUMA node of the audio encoder of output '%s' is unknown "
+                        "(not running yet?), so the service runs on any node\n", service.socket_ident.c_str());
+        }
+        else if (service.numa_node >= 0 && topology.CPUs(service.numa_node).empty()) {
+            fprintf(stderr, "ODR-PadEnc Error: NUMA node %d has no CPUs\n", service.numa_node);
+            return 2;
         }
+        numa_nodes.insert(service.numa_node);
+    }
+    if (numa_nodes != std::set<int>{-1}) {
+        placement.EnableNodeBinding();
+        shards = std::max(shards, numa_nodes.size());
     }
 
-    if (options.item_state_file)
-        fprintf(stderr, "ODR-PadEnc reading DL Plus Item Toggle/Running bits from '%s'.\n", options.item_state_file);
-
-
-    // TODO: check uniform PAD encoder options!?
+    MemoryBudget::Global().SetTotalBudget(memory_budget);
 
-    if (options.xpad_interval < 1) {
-        fprintf(stderr, "ODR-PadEnc Error: The X-PAD interval must be 1 or greater!\n");
-        return 1;
+    // before any other thread is started, so that they all inherit the worker CPUs
+    if (!placement.Configure(rt_priority, rt_cpu, worker_cpus))
+        return 2;
+    if (placement.Enabled()) {
+        placement.EnterWorker();
+        fprintf(stderr, "ODR-PadEnc %s\n", placement.Describe().c_str());
+        for (const PadEncoderOptions& service : services) {
+            if (service.SLSEnabled() && service.slide_lookahead == 0 && service.simulation == 0)
+                fprintf(stderr, "ODR-PadEnc Warning: output '%s' prepares its slides in the PAD request thread, "
+                        "as its slide lookahead is 0\n", service.socket_ident.c_str());
+        }
     }
 
 #if HAVE_MAGICKWAND
-    MagickWandGenesis();
-    if (verbose)
-        fprintf(stderr, "ODR-PadEnc using ImageMagick version '%s'\n", GetMagickVersion(NULL));
+    // beyond, ImageMagick uses its disk cache
+    if (!magick_limits.memory)
+        magick_limits.memory = memory_budget;
+    // applied once the first slide is converted
+    MagickWandPool::Global().Configure(magick_limits, verbose);
+#else
+    if (magick_limits.threads != magick_limits_t::DEFAULT_THREADS || magick_limits.memory || magick_limits.map || magick_limits.disk)
+        fprintf(stderr, "ODR-PadEnc Warning: compiled without ImageMagick, so --magick-threads/--magick-limits have no effect\n");
 #endif
 
+    if (!jpeg_device.empty() && JPEGOffload::Global().Open(jpeg_device))
+        fprintf(stderr, "ODR-PadEnc encoding JPEG slides on '%s'\n", jpeg_device.c_str());
+
     // handle signals
     if (signal(SIGINT, break_handler) == SIG_ERR) {
         perror("ODR-PadEnc Error: could not set SIGINT handler");
@@ -312,241 +1370,120 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    int result = 0;
-
-    PadInterface intf;
-    try {
-        intf.open(options.socket_ident);
-
-        uint8_t previous_padlen = 0;
-
-        std::shared_ptr<PadEncoder> pad_encoder;
-
-        while (!do_exit) {
-            options.padlen = intf.receive_request();
-
-            if (options.padlen > 0) {
-                if (previous_padlen != options.padlen) {
-                    previous_padlen = options.padlen;
-
-                    if (!PADPacketizer::CheckPADLen(options.padlen)) {
-                        fprintf(stderr, "ODR-PadEnc Error: PAD length %d invalid: Possible values: %s\n",
-                                options.padlen, PADPacketizer::ALLOWED_PADLEN.c_str());
-                        result = 2;
-                        break;
-                    }
-                    else {
-                        fprintf(stderr, "ODR-PadEnc Reinitialise PAD length to %d\n", options.padlen);
-                        pad_encoder = std::make_shared<PadEncoder>(options);
-                    }
-                }
-
-                result = pad_encoder->Encode(intf);
-                if (result > 0) {
-                    break;
-                }
-            }
-        }
-    }
-    catch (const std::runtime_error& e) {
-        fprintf(stderr, "ODR-PadEnc failure: %s\n", e.what());
-    }
-
-#if HAVE_MAGICKWAND
-    MagickWandTerminus();
-#endif
-
-    return result;
-}
-
-
-// --- PadEncoder -----------------------------------------------------------------
-PadEncoder::PadEncoder(PadEncoderOptions options) :
-        options(options),
-        pad_packetizer(PADPacketizer(options.padlen)),
-        dls_encoder(DLSEncoder(&pad_packetizer)),
-        sls_encoder(SLSEncoder(&pad_packetizer)),
-        slides_success(false),
-        curr_dls_file(0)
-{
-    // PAD related timelines
-    next_slide = next_label = next_label_insertion = steady_clock::now();
-
-    // if multiple DLS files, ensure that initial increment leads to first one
-    if (options.dls_files.size() > 1) {
-        curr_dls_file = -1;
-    }
-
-    xpad_interval_counter = 0;
-}
-
-
-int PadEncoder::CheckRereadFile(const std::string& type, const std::string& path) {
-    struct stat path_stat;
-    if (stat(path.c_str(), &path_stat)) {
-        // ignore missing request file
-        if (errno != ENOENT) {
-            perror(("ODR-PadEnc Error: could not retrieve " + type +" re-read request file stat").c_str());
-            return -1;  // error
+    // one snapshot slot per service, filled on SIGHUP by the reload thread
+    std::deque<LiveOptions> live_options(services.size());
+    std::thread reload_thread;
+    if (std::any_of(services.begin(), services.end(), [](const PadEncoderOptions& service) {return !service.live_config_file.empty();})) {
+        sem_init(&reload_sem, 0, 0);
+        if (signal(SIGHUP, reload_handler) == SIG_ERR) {
+            perror("ODR-PadEnc Error: could not set SIGHUP handler");
+            return 1;
         }
-        return 0;   // no re-read
-    } else {
-        // handle request
-        fprintf(stderr, "ODR-PadEnc received %s re-read request!\n", type.c_str());
-        if (unlink(path.c_str()))
-            perror(("ODR-PadEnc Error: erasing file '" + path +"' failed").c_str());
-        return 1;   // re-read
+        reload_thread = std::thread(reload_live_configs, std::cref(services), std::ref(live_options));
     }
-}
 
-int PadEncoder::EncodeSlide() {
-    // skip insertion, if previous one not yet finished
-    if (pad_packetizer.QueueContainsDG(SLSEncoder::APPTYPE_MOT_START)) {
-        fprintf(stderr, "ODR-PadEnc Warning: skipping slide insertion, as previous one still in transmission!\n");
-        return 0;
-    }
-
-    // check for slides dir re-read request
-    int reread = CheckRereadFile("slides dir", std::string(options.sls_dir) + "/" + SLSEncoder::REQUEST_REREAD_FILENAME);
-    switch (reread) {
-    case 1:     // re-read requested
-        slides.Clear();
-        break;
-    case -1:    // error
-        return 1;
-    }
-
-    // usually invoked once
-    for (;;) {
-        // try to read slides dir (if present)
-        if (slides.Empty()) {
-            if (!slides.InitFromDir(options.sls_dir))
-                return 1;
-            slides_success = false;
-        }
+    // from now on, the messages of the encoding are written in the background
+    PadLog::Global().Start(log_json);
 
-        // if slides available, encode the first one
-        if (!slides.Empty()) {
-            slide_metadata_t slide = slides.GetSlide();
-
-            if (sls_encoder.encodeSlide(slide.filepath, slide.fidx, options.raw_slides, options.max_slide_size, options.current_slide_dump_name)) {
-                slides_success = true;
-                if (options.erase_after_tx) {
-                    if (unlink(slide.filepath.c_str()))
-                        perror(("ODR-PadEnc Error: erasing file '" + slide.filepath +"' failed").c_str());
+    int result = 0;
+    EncoderReplica replica(services.front().slide_history_len);
+
+    // each shard with its services, event loop and thread of its own; they only share the process-wide caches
+    auto run_shards = [&]() {
+        std::vector<int> shard_nodes;
+        const std::vector<std::vector<size_t>> shard_services = place_services(services, shards, shard_nodes);
+        fprintf(stderr, "ODR-PadEnc encoding %zu services in %zu shards\n", services.size(), shard_services.size());
+
+        std::atomic<bool> stop(false);
+        std::vector<int> results(shard_services.size(), 0);
+        std::vector<std::thread> threads;
+        for (size_t shard = 0; shard < shard_services.size(); shard++) {
+            threads.emplace_back([&, shard]() {
+                if (placement.Enabled())
+                    placement.EnterRealtime();
+                // before anything of the services is allocated
+                placement.EnterNode(shard_nodes[shard]);
+                try {
+                    Reactor reactor;
+                    pad_reactors[shard].store(&reactor);
+                    results[shard] = run_services(services, live_options, shard_services[shard], reactor, stop);
+                    pad_reactors[shard].store(nullptr);
                 }
-            } else {
-                /* skip to next slide, except this is the last slide and so far
-                 * no slide worked, to prevent an infinite loop and because
-                 * re-reading the slides dir just moments later won't result in
-                 * a different amount of slides. */
-                bool skipping = !(slides.Empty() && !slides_success);
-                fprintf(stderr, "ODR-PadEnc Error: cannot encode file '%s'; %s\n", slide.filepath.c_str(), skipping ? "skipping" : "giving up for now");
-                if (skipping)
-                    continue;
-            }
+                catch (const std::runtime_error& e) {
+                    pad_reactors[shard].store(nullptr);
+                    fprintf(stderr, "ODR-PadEnc failure in shard %zu: %s\n", shard, e.what());
+                    stop.store(true);
+                    wake_pad_reactors();
+                }
+            });
         }
+        for (std::thread& thread : threads)
+            thread.join();
+        for (int shard_result : results)
+            if (shard_result)
+                result = shard_result;
+    };
 
-        break;
-    }
-
-    return 0;
-}
-
-int PadEncoder::EncodeLabel() {
-    // skip insertion, if previous one not yet finished
-    if (pad_packetizer.QueueContainsDG(DLSEncoder::APPTYPE_START)) {
-        fprintf(stderr, "ODR-PadEnc Warning: skipping label insertion, as previous one still in transmission!\n");
-    }
-    else {
-        dls_encoder.encodeLabel(options.dls_files[curr_dls_file], options.item_state_file, options.dl_params);
-    }
-
-    return 0;
-}
-
-
-int PadEncoder::Encode(PadInterface& intf) {
-    steady_clock::time_point pad_timeline = std::chrono::steady_clock::now();
-
-    int result = 0;
-
-    // handle SLS
-    if (options.SLSEnabled()) {
+    auto run = [&]() {
+        // a single shard only serves services of one node
+        if (shards == 1)
+            placement.EnterNode(services.front().numa_node);
+        try {
+            // a standby only takes over once the primary is gone
+            if (!standby_port.empty()) {
+                result = wait_for_takeover(standby_port, replica);
+                if (result || do_exit)
+                    return;
+            }
 
-        // Check if slide transmission is complete
-        if (    not options.completed_slide_dump_name.empty() and
-                not options.current_slide_dump_name.empty() and
-                not pad_packetizer.QueueContainsDG(SLSEncoder::APPTYPE_MOT_START)) {
-            if (rename(options.current_slide_dump_name.c_str(), options.completed_slide_dump_name.c_str())) {
-                if (errno != ENOENT) {
-                    perror("ODR-PadEnc Error: renaming completed slide file failed");
-                }
+            if (services.front().simulation > 0) {
+                result = run_simulation(services.front());
             }
-            else {
-                fprintf(stderr, "ODR-PadEnc completed slide transmission.\n");
+            else if (services.front().shm_frames > 0) {
+                result = run_service(services.front(), live_options.front());
             }
-        }
-
-        if (options.slide_interval > 0) {
-            // encode slides regularly
-            if (pad_timeline >= next_slide) {
-                result = EncodeSlide();
-                next_slide += std::chrono::seconds(options.slide_interval);
+            else if (shards == 1) {
+                std::vector<size_t> all(services.size());
+                for (size_t i = 0; i < all.size(); i++)
+                    all[i] = i;
+                std::atomic<bool> stop(false);
+                Reactor reactor;
+                pad_reactors[0].store(&reactor);
+                result = run_services(services, live_options, all, reactor, stop, standby_port.empty() ? nullptr : &replica);
+                pad_reactors[0].store(nullptr);
             }
-        } else {
-            // encode slide as soon as previous slide has been transmitted
-            if (!pad_packetizer.QueueContainsDG(SLSEncoder::APPTYPE_MOT_START))
-                result = EncodeSlide();
-        }
-    }
-    if (result)
-        return result;
-
-    // handle DLS
-    if (options.DLSEnabled()) {
-        // check for DLS re-read request
-        for (size_t i = 0; i < options.dls_files.size(); i++) {
-            int reread = CheckRereadFile("DLS file '" + options.dls_files[i] + "'", options.dls_files[i] + DLSEncoder::REQUEST_REREAD_SUFFIX);
-            switch (reread) {
-            case 1:     // re-read requested
-                // switch to desired DLS file
-                curr_dls_file = i;
-                next_label = pad_timeline + std::chrono::seconds(options.label_interval);
-
-                // enforce label insertion
-                next_label_insertion = pad_timeline;
-                break;
-            case -1:    // error
-                return 1;
+            else {
+                run_shards();
             }
         }
-
-        if (options.dls_files.size() > 1 && pad_timeline >= next_label) {
-            // switch to next DLS file
-            curr_dls_file = (curr_dls_file + 1) % options.dls_files.size();
-            next_label += std::chrono::seconds(options.label_interval);
-
-            // enforce label insertion
-            next_label_insertion = pad_timeline;
+        catch (const std::runtime_error& e) {
+            pad_reactors[0].store(nullptr);
+            fprintf(stderr, "ODR-PadEnc failure: %s\n", e.what());
         }
+    };
 
-        if (pad_timeline >= next_label_insertion) {
-            // encode label
-            result = EncodeLabel();
-            next_label_insertion += std::chrono::milliseconds(options.label_insertion);
-        }
+    // the PAD requests in a thread of their own, which the signals can still stop
+    if (placement.Enabled()) {
+        std::thread pad_thread([&]() {
+            placement.EnterRealtime();
+            run();
+        });
+        pad_thread.join();
+    }
+    else {
+        run();
     }
-    if (result)
-        return result;
-
-    // flush one PAD (considering X-PAD output interval)
-    auto pad = pad_packetizer.GetNextPAD(xpad_interval_counter == 0);
 
-    intf.send_pad_data(pad.data(), pad.size());
+    if (reload_thread.joinable()) {
+        do_exit.store(true);
+        sem_post(&reload_sem);
+        reload_thread.join();
+    }
+    PadLog::Global().Stop();
 
-    // update X-PAD output interval counter
-    xpad_interval_counter = (xpad_interval_counter + 1) % options.xpad_interval;
+#if HAVE_MAGICKWAND
+    MagickWandPool::Global().Terminate();
+#endif
 
-    return 0;
+    return result;
 }
@@ -30,7 +30,16 @@
 #include "common.h"
 
 #include <atomic>
+#include <deque>
+#include <errno.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <poll.h>
+#include <semaphore.h>
+#include <set>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <string>
 #include <thread>
@@ -41,61 +50,9 @@
 #include <getopt.h>
 #include <unistd.h>
 
-#include "pad_interface.h"
-#include "pad_common.h"
-#include "dls.h"
-#include "sls.h"
-
-using std::chrono::steady_clock;
-
-
-// --- PadEncoderOptions -----------------------------------------------------------------
-struct PadEncoderOptions {
-    uint8_t padlen = 0;
-    bool erase_after_tx = false;
-    int slide_interval = 10;
-    int label_interval = 12;    // uniform PAD encoder only
-    int label_insertion = 1200; // uniform PAD encoder only
-    int xpad_interval = 1;      // uniform PAD encoder only
-    size_t max_slide_size = SLSEncoder::MAXSLIDESIZE_SIMPLE;
-    bool raw_slides = false;
-    DL_PARAMS dl_params;
-
-    const char *sls_dir = nullptr;
-    std::string socket_ident;
-    std::vector<std::string> dls_files;
-    const char *item_state_file = nullptr;
-    std::string current_slide_dump_name;
-    std::string completed_slide_dump_name;
-
-    bool DLSEnabled() const { return !dls_files.empty(); }
-    bool SLSEnabled() const { return sls_dir; }
-};
-
-
-// --- PadEncoder -----------------------------------------------------------------
-class PadEncoder {
-protected:
-    PadEncoderOptions options;
-    PADPacketizer pad_packetizer;
-    DLSEncoder dls_encoder;
-    SLSEncoder sls_encoder;
-    SlideStore slides;
-    bool slides_success;
-    int curr_dls_file;
-    steady_clock::time_point next_slide;
-    steady_clock::time_point next_label;
-    steady_clock::time_point next_label_insertion;
-    size_t xpad_interval_counter;
-
-    int EncodeSlide();
-    int EncodeLabel();
-    static int CheckRereadFile(const std::string& type, const std::string& path);
-
-public:
-    PadEncoder(PadEncoderOptions options);
-    virtual ~PadEncoder() {}
-
-    int Encode(PadInterface& intf);
-};
-
+#include "control_socket.h"
+#include "file_prefetcher.h"
+#include "jpeg_offload.h"
+#include "metrics.h"
+#include "pad_encoder.h"
+#include "thread_placement.h"
@@ -0,0 +1,212 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file odrpadenc.cpp
+    \brief C API of libodrpadenc, to encode PAD within the audio encoder's process
+*/
+
+#include "odrpadenc.h"
+#include "pad_encoder.h"
+
+#include <exception>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+struct odr_padenc_options {
+    PadEncoderOptions options;
+};
+
+struct odr_padenc {
+    std::unique_ptr<PadEncoder> encoder;
+};
+
+
+odr_padenc_options* odr_padenc_options_new(void) {
+    return new (std::nothrow) odr_padenc_options();
+}
+
+void odr_padenc_options_free(odr_padenc_options* options) {
+    delete options;
+}
+
+int odr_padenc_options_set(odr_padenc_options* options, const char* key, const char* value) {
+    PadEncoderOptions& o = options->options;
+    const std::string k = key;
+    const bool flag = strcmp(value, "0") != 0;
+
+    if (k == "dir") {
+        o.sls_dir = value;
+    } else if (k == "dls") {
+        o.dls_files.push_back(value);
+        o.dls_weights.push_back(1);
+    } else if (k == "label-weight") {
+        if (o.dls_weights.empty())
+            return -1;
+        o.dls_weights.back() = atoi(value);
+    } else if (k == "item-state") {
+        o.item_state_file = value;
+    } else if (k == "charset") {
+        o.dl_params.charset = (DABCharset) atoi(value);
+    } else if (k == "raw-dls") {
+        o.dl_params.raw_dls = flag;
+    } else if (k == "remove-dls") {
+        o.dl_params.remove_dls = flag;
+    } else if (k == "dl-plus-format") {
+        o.dl_plus_formats.push_back(value);
+    } else if (k == "dls-share") {
+        o.dls_share = atoi(value);
+    } else if (k == "erase") {
+        o.erase_after_tx = flag;
+    } else if (k == "raw-slides") {
+        o.raw_slides = flag;
+    } else if (k == "sleep") {
+        o.slide_interval = atoi(value);
+    } else if (k == "label") {
+        o.label_interval = atoi(value);
+    } else if (k == "label-ins") {
+        o.label_insertion = atoi(value);
+    } else if (k == "adaptive-label-ins") {
+        o.adaptive_label_insertion = flag;
+    } else if (k == "xpad-interval") {
+        o.xpad_interval = atoi(value);
+    } else if (k == "max-slide-size") {
+        o.max_slide_size = strtoul(value, NULL, 10);
+    } else if (k == "adaptive-slide-size") {
+        o.adaptive_slide_size = flag;
+    } else if (k == "segment-size") {
+        o.adaptive_segment_len = strcmp(value, "auto") == 0;
+        if (!o.adaptive_segment_len)
+            o.segment_len = atoi(value);
+    } else if (k == "mot-carousel") {
+        o.mot_carousel = flag;
+    } else if (k == "idle-fill") {
+        o.idle_fill = flag;
+    } else if (k == "header-repetition") {
+        o.header_repetition = atoi(value);
+    } else if (k == "header-positions") {
+        if (!MOTObjectBuilder::ParseHeaderPositions(value, o.header_positions))
+            return -1;
+    } else if (k == "mot-directory") {
+        o.mot_directory = strtoul(value, NULL, 10);
+    } else if (k == "mot-directory-resend") {
+        o.mot_directory_resend = strtoul(value, NULL, 10);
+    } else if (k == "lookahead-packing") {
+        o.lookahead_packing = flag;
+    } else if (k == "slide-cache") {
+        o.slide_cache_size = strtoul(value, NULL, 10);
+    } else if (k == "slide-spill") {
+        o.slide_spill_dir = value;
+    } else if (k == "slide-spill-size") {
+        o.slide_spill_size = strtoul(value, NULL, 10);
+    } else if (k == "slide-similarity") {
+        o.slide_similarity = atoi(value);
+    } else if (k == "slide-candidates") {
+        o.slide_candidates = flag;
+    } else if (k == "slide-lookahead") {
+        o.slide_lookahead = strtoul(value, NULL, 10);
+    } else if (k == "slide-history") {
+        o.slide_history_len = strtoul(value, NULL, 10);
+    } else if (k == "slide-content-ids") {
+        o.slide_content_ids = flag;
+    } else if (k == "slide-state") {
+        o.slide_state_file = value;
+    } else if (k == "slides-window") {
+        o.slides_window = strtoul(value, NULL, 10);
+    } else if (k == "change-settle") {
+        if (!ChangeCoalescer::ParseSettle(value, o.change_settle))
+            return -1;
+    } else if (k == "dump-current-slide") {
+        o.current_slide_dump_name = value;
+    } else if (k == "dump-completed-slide") {
+        o.completed_slide_dump_name = value;
+    } else if (k == "replicate-to") {
+        o.replicate_to = value;
+    } else if (k == "stats") {
+        o.stats_interval = atoi(value);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+
+odr_padenc* odr_padenc_new(const odr_padenc_options* options) {
+    PadEncoderOptions o = options->options;
+    if (!o.DLSEnabled() && !o.SLSEnabled()) {
+        fprintf(stderr, "ODR-PadEnc Error: Neither DLS nor Slideshow to encode !\n");
+        return NULL;
+    }
+    if (!check_live_options(o))
+        return NULL;
+
+    // until the first frame request tells the actual PAD length
+    o.padlen = o.simulation_padlen;
+
+    try {
+        std::unique_ptr<odr_padenc> enc(new odr_padenc());
+        enc->encoder.reset(new PadEncoder(o));
+        return enc.release();
+    } catch (const std::exception& e) {
+        fprintf(stderr, "ODR-PadEnc Error: creating the encoder failed: %s\n", e.what());
+        return NULL;
+    }
+}
+
+void odr_padenc_free(odr_padenc* enc) {
+    delete enc;
+}
+
+
+int odr_padenc_get_next_pad(odr_padenc* enc, uint8_t padlen, uint8_t* pad) {
+    try {
+        int result = enc->encoder->GetNextPAD(padlen, pad);
+        if (result == 2)
+            fprintf(stderr, "ODR-PadEnc Error: PAD length %d not supported\n", padlen);
+        return result ? -1 : 0;
+    } catch (const std::exception& e) {
+        fprintf(stderr, "ODR-PadEnc Error: encoding the PAD failed: %s\n", e.what());
+        return -1;
+    }
+}
+
+
+int odr_padenc_inject_label(odr_padenc* enc, const char* label, int urgent) {
+    return enc->encoder->InjectLabel(label, urgent) ? 0 : -1;
+}
+
+void odr_padenc_release_label(odr_padenc* enc) {
+    enc->encoder->ReleaseLabel();
+}
+
+
+double odr_padenc_plan(const odr_padenc* enc, const char* question) {
+    capacity_query_t query;
+    if (!query.Parse(question))
+        return -1;
+    if (query.within > std::chrono::milliseconds::zero())
+        return enc->encoder->PlanMaxSlideSize(query);
+
+    capacity_plan_t plan;
+    if (!enc->encoder->PlanCapacity(query, plan))
+        return -1;
+    return plan.duration.count() / 1000.0;
+}
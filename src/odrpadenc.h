@@ -0,0 +1,100 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file odrpadenc.h
+    \brief C API of libodrpadenc, to encode PAD within the audio encoder's process
+
+    Instead of exchanging each PAD frame over the socket or the shared memory
+    ring with a separate odr-padenc process, an audio encoder may link the
+    library and request the next frame by a function call:
+
+        odr_padenc_options* options = odr_padenc_options_new();
+        odr_padenc_options_set(options, "dls", "/run/dls.txt");
+        odr_padenc_options_set(options, "dir", "/run/slides");
+        odr_padenc* enc = odr_padenc_new(options);
+        odr_padenc_options_free(options);
+        ...
+        uint8_t pad[padlen + 1];
+        odr_padenc_get_next_pad(enc, padlen, pad);   // once per audio frame
+        ...
+        odr_padenc_free(enc);
+
+    An encoder may only be used by one thread at a time; warnings and errors
+    are printed to stderr, as by odr-padenc.
+*/
+
+#ifndef ODRPADENC_H_
+#define ODRPADENC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct odr_padenc_options odr_padenc_options;
+typedef struct odr_padenc odr_padenc;
+
+/*! the options of an encoder, initially the defaults of odr-padenc */
+odr_padenc_options* odr_padenc_options_new(void);
+void odr_padenc_options_free(odr_padenc_options* options);
+
+/*! sets the option named as the odr-padenc long option (without the leading
+ *  dashes), e.g. "dir", "dls" (can be set more than once), "label-weight",
+ *  "sleep" or "max-slide-size"; options without argument (e.g. "erase") take
+ *  "1" or "0". Returns 0, or -1 if the option is unknown or not available
+ *  in-process (e.g. "output", "shm-frames").
+ */
+int odr_padenc_options_set(odr_padenc_options* options, const char* key, const char* value);
+
+/*! creates an encoder with a copy of the options; NULL, if they are invalid
+ *  or neither DLS nor slides are to be encoded
+ */
+odr_padenc* odr_padenc_new(const odr_padenc_options* options);
+void odr_padenc_free(odr_padenc* enc);
+
+/*! writes the next PAD frame for the given PAD length (which may change
+ *  between calls): padlen bytes of PAD, as odr-padenc sends them to
+ *  ODR-AudioEnc, followed by one byte with the used PAD length. So pad must
+ *  hold padlen + 1 bytes. Returns 0, or -1 on failure.
+ */
+int odr_padenc_get_next_pad(odr_padenc* enc, uint8_t padlen, uint8_t* pad);
+
+/*! shows the label (given like the content of a DLS file) instead of the
+ *  DLS files until released; an urgent label interrupts any other PAD data at
+ *  once. Returns 0, or -1 if DLS is disabled.
+ */
+int odr_padenc_inject_label(odr_padenc* enc, const char* label, int urgent);
+void odr_padenc_release_label(odr_padenc* enc);
+
+/*! answers a what-if question about the X-PAD capacity, given as to the
+ *  odr-padenc --plan option (e.g. "pad=34,xpad-interval=2,slide=12000" or
+ *  "pad=34,within=10"), by replaying the data queued now in a dry run: the
+ *  seconds until the slide is sent, or with "within" the largest slide size
+ *  in bytes sent in time. Returns -1, if the question is invalid or the slide
+ *  is not sent within 10 minutes.
+ */
+double odr_padenc_plan(const odr_padenc* enc, const char* question);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ODRPADENC_H_ */
@@ -28,19 +28,61 @@
 */
 
 #include "pad_common.h"
+#include "log.h"
+#include "metrics.h"
+#include "trace.h"
+
+
+// X-PAD bytes per (start) app type, of all packetizers; registered on first use
+static MetricCounter& xpad_data_bytes_metric(int apptype) {
+    static std::atomic<MetricCounter*> counters[PAD_STATS::APPTYPES];
+    MetricCounter* counter = counters[apptype].load(std::memory_order_acquire);
+    if (!counter) {
+        counter = &MetricsRegistry::Global().Counter("odr_padenc_xpad_data_bytes", "X-PAD bytes used by data groups, per (start) app type",
+                                                     "apptype=\"" + std::to_string(apptype) + "\"");
+        counters[apptype].store(counter, std::memory_order_release);
+    }
+    return *counter;
+}
 
 
 // --- DATA_GROUP -----------------------------------------------------------------
-DATA_GROUP::DATA_GROUP(size_t len, int apptype_start, int apptype_cont) {
-    this->data.resize(len);
+DATA_GROUP::DATA_GROUP(size_t len, int apptype_start, int apptype_cont) : pooled(false) {
+    Init(len, apptype_start, apptype_cont);
+}
+
+void DATA_GROUP::Init(size_t len, int apptype_start, int apptype_cont) {
+    // keep the (possibly recycled) buffer and reserve space for the CRC
+    this->data.reserve(len + 2);
+    this->data.assign(len, 0x00);
     this->apptype_start = apptype_start;
     this->apptype_cont = apptype_cont;
     written = 0;
+
+    ext_owner.reset();
+    ext_data = nullptr;
+    ext_len = 0;
+    ext_offset = 0;
+    done_handler = nullptr;
+}
+
+void DATA_GROUP::SetExternalPayload(const uint8_t* payload, size_t len, const std::shared_ptr<const void>& owner) {
+    // the payload follows the data present so far
+    ext_owner = owner;
+    ext_data = payload;
+    ext_len = len;
+    ext_offset = data.size();
 }
 
 void DATA_GROUP::AppendCRC() {
     uint16_t crc = 0xFFFF;
-    crc = odr::crc16(crc, &data[0], data.size());
+    if (ext_len) {
+        crc = odr::crc16(crc, data.data(), ext_offset);
+        crc = odr::crc16(crc, ext_data, ext_len);
+        crc = odr::crc16(crc, data.data() + ext_offset, data.size() - ext_offset);
+    } else {
+        crc = odr::crc16(crc, &data[0], data.size());
+    }
     crc = ~crc;
 #ifdef DEBUG
     fprintf(stderr, "crc=%04x ~crc=%04x\n", crc, ~crc);
@@ -50,15 +92,36 @@ void DATA_GROUP::AppendCRC() {
     data.push_back((crc & 0x00FF));
 }
 
-size_t DATA_GROUP::Available() {
-    return data.size() - written;
+size_t DATA_GROUP::Available() const {
+    return Size() - written;
 }
 
 int DATA_GROUP::Write(uint8_t *write_data, size_t len, int *cont_apptype) {
     size_t written_now = std::min(len, Available());
 
+    if (ext_len) {
+        // copy the parts before, of and after the external payload
+        uint8_t* out = write_data;
+        size_t pos = written;
+        size_t left = written_now;
+
+        if (left && pos < ext_offset) {
+            size_t part = std::min(left, ext_offset - pos);
+            memcpy(out, &data[pos], part);
+            out += part; pos += part; left -= part;
+        }
+        if (left && pos < ext_offset + ext_len) {
+            size_t part = std::min(left, ext_offset + ext_len - pos);
+            memcpy(out, ext_data + (pos - ext_offset), part);
+            out += part; pos += part; left -= part;
+        }
+        if (left)
+            memcpy(out, &data[pos - ext_len], left);
+    } else {
+        memcpy(write_data, &data[written], written_now);
+    }
+
     // fill up remaining bytes with zero padding
-    memcpy(write_data, &data[written], written_now);
     memset(write_data + written_now, 0x00, len - written_now);
 
     // set app type depending on progress
@@ -66,6 +129,10 @@ int DATA_GROUP::Write(uint8_t *write_data, size_t len, int *cont_apptype) {
 
     written += written_now;
 
+    // release the external payload as early as possible
+    if (Available() == 0)
+        ext_owner.reset();
+
     // prevent continuation of a different DG having the same type
     if (cont_apptype)
         *cont_apptype = Available() > 0 ? apptype_cont : -1;
@@ -74,6 +141,70 @@ int DATA_GROUP::Write(uint8_t *write_data, size_t len, int *cont_apptype) {
 }
 
 
+// --- DataGroupPool -----------------------------------------------------------------
+const size_t DataGroupPool::SLAB_SIZE = 64; // DGs per slab; a max size slide needs about 100 DGs
+
+void DataGroupPool::AddSlab() {
+    DATA_GROUP* slab = new DATA_GROUP[SLAB_SIZE];
+    slabs.emplace_back(slab);
+
+    free_dgs.reserve(Capacity());
+    for (size_t i = SLAB_SIZE; i > 0; i--) {
+        slab[i - 1].pooled = true;
+        free_dgs.push_back(&slab[i - 1]);
+    }
+}
+
+DATA_GROUP* DataGroupPool::Acquire(size_t len, int apptype_start, int apptype_cont) {
+    if (free_dgs.empty())
+        AddSlab();
+
+    DATA_GROUP* dg = free_dgs.back();
+    free_dgs.pop_back();
+
+    dg->Init(len, apptype_start, apptype_cont);
+    return dg;
+}
+
+void DataGroupPool::Release(DATA_GROUP* dg) {
+    dg->ext_owner.reset();
+    dg->done_handler = nullptr;
+    free_dgs.push_back(dg);
+}
+
+size_t DataGroupPool::AllocatedBytes() const {
+    size_t bytes = free_dgs.capacity() * sizeof(DATA_GROUP*);
+    for (const std::unique_ptr<DATA_GROUP[]>& slab : slabs) {
+        for (size_t i = 0; i < SLAB_SIZE; i++)
+            bytes += sizeof(DATA_GROUP) + slab[i].data.capacity();
+    }
+    return bytes;
+}
+
+void DataGroupPool::Trim() {
+    for (DATA_GROUP* dg : free_dgs)
+        uint8_vector_t().swap(dg->data);
+}
+
+
+// --- PAD_STATS -----------------------------------------------------------------
+void PAD_STATS::Reset() {
+    frames = 0;
+    frames_without_xpad = 0;
+    capacity_bytes = 0;
+    ci_bytes = 0;
+    subfield_padding_bytes = 0;
+    unused_bytes = 0;
+    queued_dgs_max = 0;
+    fill_bytes = 0;
+    fill_dgs_abandoned = 0;
+    std::fill(data_bytes, data_bytes + APPTYPES, 0);
+    std::fill(dgs_sent, dgs_sent + APPTYPES, 0);
+    std::fill(latency_frames, latency_frames + APPTYPES, 0);
+    std::fill(latency_frames_max, latency_frames_max + APPTYPES, 0);
+}
+
+
 // --- PADPacketizer -----------------------------------------------------------------
 const size_t PADPacketizer::SUBFIELD_LENS[]     = {4, 6, 8, 12, 16, 24, 32, 48};
 const size_t PADPacketizer::FPAD_LEN            =   2;
@@ -82,97 +213,475 @@ const size_t PADPacketizer::VARSIZE_PAD_MIN     =   8; // F-PAD + 1x CI + end ma
 const size_t PADPacketizer::VARSIZE_PAD_MAX     = 196; // F-PAD + 4x CI              + 4x 48 bytes data sub-field
 const std::string PADPacketizer::ALLOWED_PADLEN = "6 (short X-PAD), 8 to 196 (variable size X-PAD)";
 const int PADPacketizer::APPTYPE_DGLI = 1;
+const TimingOperation PADPacketizer::TIMING_WRITE_PAD("pad.write_next_pad");
+
+static LogSite pad_dump_log("pad.dump", 0);
 
 PADPacketizer::PADPacketizer(size_t pad_size) :
-    xpad_size_max(pad_size - FPAD_LEN),
-    short_xpad(pad_size == SHORT_PAD),
-    max_cis(short_xpad ? 1 : 4),
-    last_ci_type(-1)
-{
+        active_queues(0),
+        queued_total(0),
+        next_front_seq(-1),
+        next_back_seq(0),
+        last_appended_queue(-1),
+        writing_fill(false),
+        weighted(false),
+        vtime(0),
+        frame_number(0),
+        dry_run(false),
+        lookahead_packing(false) {
+    std::fill(queued_dgs, queued_dgs + APPTYPES, 0);
+    std::fill(queued_bytes, queued_bytes + APPTYPES, 0);
+    std::fill(queue_weights, queue_weights + APPTYPES, 1);
+    std::fill(queue_vtimes, queue_vtimes + APPTYPES, 0);
+    SetPADLength(pad_size);
+}
+
+void PADPacketizer::SetPADLength(size_t pad_size) {
+    xpad_size_max = pad_size - FPAD_LEN;
+    short_xpad = pad_size == SHORT_PAD;
+    max_cis = MaxCIs(short_xpad);
+
+    // the X-PAD type is fixed until the next change, so are the code paths
+    get_pad = short_xpad ? &PADPacketizer::GetPAD<true> : &PADPacketizer::GetPAD<false>;
+    flush_pad = short_xpad ? &PADPacketizer::FlushPAD<true> : &PADPacketizer::FlushPAD<false>;
+
+    // the next PAD must have a CI list, as the previous sub-field sizes no longer apply
+    last_ci_type = -1;
     ResetPAD();
 }
 
 PADPacketizer::~PADPacketizer() {
-    while (!queue.empty()) {
-        delete queue.front();
-        queue.pop_front();
+    for (RingQueue<queued_dg_t>& queue : queues) {
+        while (!queue.empty()) {
+            DisposeDG(queue.front().dg);
+            queue.pop_front();
+        }
+    }
+    while (!fill_queue.empty()) {
+        ReleaseDG(fill_queue.front().dg);
+        fill_queue.pop_front();
     }
 }
 
-void PADPacketizer::AddDG(DATA_GROUP* dg, bool prepend) {
-    queue.insert(prepend ? queue.begin() : queue.end(), dg);
+void PADPacketizer::DisposeDG(DATA_GROUP* dg) {
+    if (dg->apptype_start >= 0 && dg->apptype_start < APPTYPES) {
+        queued_dgs[dg->apptype_start]--;
+        queued_bytes[dg->apptype_start] -= dg->Available();
+    }
+    queued_total--;
+    ReleaseDG(dg);
 }
 
-void PADPacketizer::AddDGs(const std::vector<DATA_GROUP*>& dgs, bool prepend) {
-    queue.insert(prepend ? queue.begin() : queue.end(), dgs.cbegin(), dgs.cend());
+void PADPacketizer::ReleaseDG(DATA_GROUP* dg) {
+    // DGs not created by the packetizer are still accepted
+    if (dg->pooled)
+        dg_pool.Release(dg);
+    else
+        delete dg;
 }
 
-bool PADPacketizer::QueueFilled() {
-    return !queue.empty();
+void PADPacketizer::UpdateActiveQueue(int app) {
+    if (queues[app].empty())
+        active_queues &= ~(1u << app);
+    else
+        active_queues |= 1u << app;
 }
 
-bool PADPacketizer::QueueContainsDG(int apptype_start) {
-    for (const DATA_GROUP* dg : queue)
-        if (dg->apptype_start == apptype_start)
-            return true;
-    return false;
+DATA_GROUP* PADPacketizer::CreateDataGroup(size_t len, int apptype_start, int apptype_cont) {
+    return dg_pool.Acquire(len, apptype_start, apptype_cont);
+}
+
+void PADPacketizer::EnqueueDG(DATA_GROUP* dg, bool prepend, bool preempt) {
+    int app = 0;
+    if (dg->apptype_start >= 0 && dg->apptype_start < APPTYPES) {
+        app = dg->apptype_start;
+        queued_dgs[app]++;
+        queued_bytes[app] += dg->Available();
+    }
+    queued_total++;
+    PADENC_TRACE4(dg_enqueued, dg, dg->apptype_start, dg->Available(), queued_total);
+
+    // a queue becoming active must not have gathered credit meanwhile
+    if (queues[app].empty())
+        queue_vtimes[app] = std::max(queue_vtimes[app], vtime);
+
+    // a DGLI not yet started is moved to the queue of the DG appended after it
+    bool after_dgli = false;
+    if (!prepend && app != APPTYPE_DGLI && last_appended_queue == APPTYPE_DGLI) {
+        RingQueue<queued_dg_t>& dgli_queue = queues[APPTYPE_DGLI];
+        if (!dgli_queue.empty() && dgli_queue.back().seq == next_back_seq - 1 && dgli_queue.back().dg->written == 0) {
+            queues[app].push_back(dgli_queue.back());
+            dgli_queue.pop_back();
+            UpdateActiveQueue(APPTYPE_DGLI);
+            after_dgli = true;
+        }
+    }
+
+    queued_dg_t queued_dg;
+    queued_dg.dg = dg;
+    queued_dg.preempt = preempt;
+    queued_dg.after_dgli = after_dgli;
+    queued_dg.added_frame = (uint32_t) frame_number;
+    if (prepend || preempt) {
+        queued_dg.seq = next_front_seq--;
+        RingQueue<queued_dg_t>& queue = queues[app];
+        if (!queue.empty() && queue.front().dg->written > 0) {
+            // a DG partly sent is finished first, as its continuation cannot follow the start of another one
+            queued_dg_t started = queue.front();
+            queue.pop_front();
+            std::swap(queued_dg.seq, started.seq);
+            started.preempt = started.preempt || preempt;
+            queue.push_front(queued_dg);
+            queue.push_front(started);
+        } else {
+            queue.push_front(queued_dg);
+        }
+    } else {
+        queued_dg.seq = next_back_seq++;
+        queues[app].push_back(queued_dg);
+        last_appended_queue = app;
+    }
+    active_queues |= 1u << app;
+}
+
+void PADPacketizer::AddDG(DATA_GROUP* dg, bool prepend, bool preempt) {
+    EnqueueDG(dg, prepend, preempt);
+}
+
+void PADPacketizer::AddDGs(const std::vector<DATA_GROUP*>& dgs, bool prepend, bool preempt) {
+    // prepended DGs keep their order in front of the others
+    if (prepend || preempt) {
+        for (std::vector<DATA_GROUP*>::const_reverse_iterator it = dgs.crbegin(); it != dgs.crend(); it++)
+            EnqueueDG(*it, true, preempt);
+    } else {
+        for (DATA_GROUP* dg : dgs)
+            EnqueueDG(dg, false, false);
+    }
+}
+
+size_t PADPacketizer::DropDGs(int apptype_start) {
+    if (apptype_start < 0 || apptype_start >= APPTYPES)
+        return 0;
+
+    RingQueue<queued_dg_t>& queue = queues[apptype_start];
+    size_t dropped = 0;
+    for (size_t i = 0; i < queue.size(); ) {
+        DATA_GROUP* dg = queue[i].dg;
+        if (dg->written == 0) {
+            std::function<void(bool)> done_handler = std::move(dg->done_handler);
+            DisposeDG(dg);
+            queue.erase(i);
+            UpdateActiveQueue(apptype_start);
+            dropped++;
+            if (done_handler)
+                done_handler(false);
+        } else {
+            i++;
+        }
+    }
+    return dropped;
+}
+
+size_t PADPacketizer::RestartDGs() {
+    size_t restarted = 0;
+    for (int app = 0; app < APPTYPES; app++) {
+        RingQueue<queued_dg_t>& queue = queues[app];
+        if (queue.empty() || queue.front().dg->written == 0)
+            continue;
+
+        // only the front DG of a queue can be partly written
+        queued_dg_t& started = queue.front();
+        DATA_GROUP* dg = started.dg;
+        if (dg->apptype_start >= 0 && dg->apptype_start < APPTYPES)
+            queued_bytes[dg->apptype_start] += dg->written;
+        dg->written = 0;
+        restarted++;
+
+        if (started.after_dgli) {
+            // its DGLI was released once written
+            queued_dg_t queued_dgli = started;
+            queued_dgli.dg = CreateDataGroupLengthIndicator(dg->Size());
+            queued_dgli.after_dgli = false;
+            queued_dgs[APPTYPE_DGLI]++;
+            queued_bytes[APPTYPE_DGLI] += queued_dgli.dg->Available();
+            queued_total++;
+            queue.push_front(queued_dgli);
+        }
+    }
+
+    AbandonFillDG();
+
+    last_ci_type = -1;
+    return restarted;
 }
 
-pad_t* PADPacketizer::GetPAD() {
+void PADPacketizer::AddFillDG(DATA_GROUP* dg) {
+    queued_dg_t queued_dg;
+    queued_dg.dg = dg;
+    queued_dg.seq = 0;
+    queued_dg.added_frame = (uint32_t) frame_number;
+    queued_dg.preempt = false;
+    queued_dg.after_dgli = false;
+    fill_queue.push_back(queued_dg);
+}
+
+size_t PADPacketizer::DropFillDGs() {
+    size_t dropped = 0;
+    for (size_t i = 0; i < fill_queue.size(); ) {
+        DATA_GROUP* dg = fill_queue[i].dg;
+        if (dg->written == 0) {
+            std::function<void(bool)> done_handler = std::move(dg->done_handler);
+            ReleaseDG(dg);
+            fill_queue.erase(i);
+            dropped++;
+            if (done_handler)
+                done_handler(false);
+        } else {
+            i++;
+        }
+    }
+    return dropped;
+}
+
+void PADPacketizer::AbandonFillDG() {
+    // a receiver could not tell the continuation of a fill DG from the DGs written meanwhile
+    bool after_dgli = false;
+    while (!fill_queue.empty()) {
+        DATA_GROUP* dg = fill_queue.front().dg;
+        if (dg->written == 0 && !after_dgli)
+            break;
+        after_dgli = dg->apptype_start == APPTYPE_DGLI;
+        if (dg->Available() > 0)
+            stats.fill_dgs_abandoned++;
+
+        fill_queue.pop_front();
+        std::function<void(bool)> done_handler = std::move(dg->done_handler);
+        ReleaseDG(dg);
+        if (done_handler)
+            done_handler(false);
+    }
+}
+
+size_t PADPacketizer::QueuedDGs(int apptype_start) const {
+    return apptype_start >= 0 && apptype_start < APPTYPES ? queued_dgs[apptype_start] : 0;
+}
+
+size_t PADPacketizer::QueuedBytes(int apptype_start) const {
+    return apptype_start >= 0 && apptype_start < APPTYPES ? queued_bytes[apptype_start] : 0;
+}
+
+void PADPacketizer::SetAppTypeWeight(int apptype_start, unsigned int weight) {
+    if (apptype_start < 0 || apptype_start >= APPTYPES || weight == 0)
+        return;
+    queue_weights[apptype_start] = weight;
+    weighted = true;
+}
+
+int PADPacketizer::NextQueue() const {
+    /*! Return the queue to serve next: the one with a preempting DG - or with
+     * the DG added first - or, if weighted, the one that got the least bytes
+     * per weight so far.
+     */
+    int next = -1;
+    for (uint32_t active = active_queues; active; active &= active - 1) {
+        const int app = __builtin_ctz(active);
+        if (next != -1 && queues[app].front().preempt != queues[next].front().preempt) {
+            if (queues[app].front().preempt)
+                next = app;
+            continue;
+        }
+        if (next == -1 ||
+                (weighted && queue_vtimes[app] < queue_vtimes[next]) ||
+                ((!weighted || queue_vtimes[app] == queue_vtimes[next]) && queues[app].front().seq < queues[next].front().seq))
+            next = app;
+    }
+    return next;
+}
+
+size_t PADPacketizer::PeekDGs(DATA_GROUP** dgs, size_t max_dgs) const {
+    // the next DGs in the order of addition (while serving the queues in order)
+    size_t positions[APPTYPES] = {};
+    size_t count = 0;
+    while (count < max_dgs) {
+        int next = -1;
+        for (uint32_t active = active_queues; active; active &= active - 1) {
+            const int app = __builtin_ctz(active);
+            if (positions[app] < queues[app].size() &&
+                    (next == -1 || queues[app][positions[app]].seq < queues[next][positions[next]].seq))
+                next = app;
+        }
+        if (next == -1)
+            break;
+        dgs[count++] = queues[next][positions[next]++].dg;
+    }
+    return count;
+}
+
+template<bool SHORT_XPAD>
+void PADPacketizer::GetPAD(uint8_t* pad) {
     bool pad_flushable = false;
+    stats.queued_dgs_max = std::max(stats.queued_dgs_max, queued_total);
 
-    // process DG queue
-    while (!pad_flushable && !queue.empty()) {
-        DATA_GROUP* dg = queue.front();
+    if (active_queues && !fill_queue.empty())
+        AbandonFillDG();
+
+    // process DG queues
+    int app;
+    while (!pad_flushable && (app = NextQueue()) != -1) {
+        DATA_GROUP* dg = queues[app].front().dg;
+        const size_t available = dg->Available();
 
         // repeatedly append DG
         while (!pad_flushable && dg->Available() > 0)
-            pad_flushable = AppendDG(dg);
+            pad_flushable = AppendDG<SHORT_XPAD>(dg);
+
+        vtime = queue_vtimes[app];
+        queue_vtimes[app] += (double) (available - dg->Available()) / queue_weights[app];
 
         if (dg->Available() == 0) {
-            delete dg;
-            queue.pop_front();
+            // the current frame counts as well
+            size_t latency = (uint32_t) ((uint32_t) frame_number - queues[app].front().added_frame) + 1;
+            stats.dgs_sent[app]++;
+            stats.latency_frames[app] += latency;
+            stats.latency_frames_max[app] = std::max(stats.latency_frames_max[app], latency);
+            PADENC_TRACE3(dg_sent, dg, app, latency);
+
+            queues[app].pop_front();
+            UpdateActiveQueue(app);
+            // the handler may already queue further DGs
+            std::function<void(bool)> done_handler = std::move(dg->done_handler);
+            DisposeDG(dg);
+            if (done_handler)
+                done_handler(true);
         }
     }
 
+    // the background fill, with the X-PAD left (and unless the done handlers queued further DGs)
+    writing_fill = true;
+    while (!pad_flushable && !active_queues && !fill_queue.empty()) {
+        DATA_GROUP* dg = fill_queue.front().dg;
+        while (!pad_flushable && dg->Available() > 0)
+            pad_flushable = AppendDG<SHORT_XPAD>(dg);
+
+        if (dg->Available() == 0) {
+            fill_queue.pop_front();
+            std::function<void(bool)> done_handler = std::move(dg->done_handler);
+            ReleaseDG(dg);
+            if (done_handler)
+                done_handler(true);
+        }
+    }
+    writing_fill = false;
+
     // (possibly empty) PAD
-    return FlushPAD();
+    FlushPAD<SHORT_XPAD>(pad);
 }
 
-std::vector<uint8_t> PADPacketizer::GetNextPAD(bool output_xpad) {
-    pad_t* pad = output_xpad ? GetPAD() : FlushPAD();
+size_t PADPacketizer::WriteNextPAD(bool output_xpad, uint8_t* pad) {
+    /*! Write the next PAD into a caller-owned buffer of (at least) GetPADFrameSize() bytes,
+     * so that the per-frame path does not need any heap allocation.
+     */
+    const size_t pad_size = GetPADFrameSize();
+    if (dry_run) {
+        (this->*(output_xpad ? get_pad : flush_pad))(pad);
+        return pad_size;
+    }
+
+    ScopedTiming timing(TIMING_WRITE_PAD);
+
+    if (output_xpad)
+        (this->*get_pad)(pad);
+    else
+        (this->*flush_pad)(pad);
 
     if (verbose >= 2) {
-        fprintf(stderr, "ODR-PadEnc writing PAD (%zu bytes):", pad->size());
-        for (size_t j = 0; j < pad->size(); j++) {
-            const char sep = (j == (pad->size() - 1) || j == (pad->size() - 1 - FPAD_LEN)) ? '|' : ' ';
-            fprintf(stderr, "%c%02X", sep , (*pad)[j]);
+        static const char HEX[] = "0123456789ABCDEF";
+        char dump[VARSIZE_PAD_MAX * 3 + 1];
+        char* out = dump;
+        for (size_t j = 0; j < pad_size; j++) {
+            *out++ = (j == (pad_size - 1) || j == (pad_size - 1 - FPAD_LEN)) ? '|' : ' ';
+            *out++ = HEX[pad[j] >> 4];
+            *out++ = HEX[pad[j] & 0x0F];
         }
-        fprintf(stderr, "\n");
+        *out = '\0';
+        PadLog::Global().Write(pad_dump_log, LogLevel::DEBUG, {{"bytes", (long long) pad_size}}, "writing PAD (%zu bytes):%s", pad_size, dump);
     }
 
-    std::vector<uint8_t> p = *pad;
-    delete pad;
-    return p;
+    return pad_size;
+}
+
+std::vector<uint8_t> PADPacketizer::GetNextPAD(bool output_xpad) {
+    pad_t pad(GetPADFrameSize());
+    WriteNextPAD(output_xpad, &pad[0]);
+    return pad;
+}
+
+DATA_GROUP* PADPacketizer::CopyDG(const DATA_GROUP* dg) {
+    DATA_GROUP* copy = dg_pool.Acquire(0, dg->apptype_start, dg->apptype_cont);
+    copy->data = dg->data;
+    copy->written = dg->written;
+    copy->ext_owner = dg->ext_owner;
+    copy->ext_data = dg->ext_data;
+    copy->ext_len = dg->ext_len;
+    copy->ext_offset = dg->ext_offset;
+    return copy;
+}
+
+void PADPacketizer::CopyQueue(const RingQueue<queued_dg_t>& source, RingQueue<queued_dg_t>& target) {
+    for (size_t i = 0; i < source.size(); i++) {
+        queued_dg_t queued_dg = source[i];
+        queued_dg.dg = CopyDG(queued_dg.dg);
+        target.push_back(queued_dg);
+    }
+}
+
+std::unique_ptr<PADPacketizer> PADPacketizer::DryRunCopy() const {
+    std::unique_ptr<PADPacketizer> copy(new PADPacketizer(xpad_size_max + FPAD_LEN));
+    copy->dry_run = true;
+
+    // the queues as they are, incl. their order and sharing
+    for (int app = 0; app < APPTYPES; app++)
+        copy->CopyQueue(queues[app], copy->queues[app]);
+    copy->CopyQueue(fill_queue, copy->fill_queue);
+    copy->active_queues = active_queues;
+    copy->queued_total = queued_total;
+    copy->next_front_seq = next_front_seq;
+    copy->next_back_seq = next_back_seq;
+    copy->last_appended_queue = last_appended_queue;
+    std::copy(queued_dgs, queued_dgs + APPTYPES, copy->queued_dgs);
+    std::copy(queued_bytes, queued_bytes + APPTYPES, copy->queued_bytes);
+    copy->weighted = weighted;
+    std::copy(queue_weights, queue_weights + APPTYPES, copy->queue_weights);
+    std::copy(queue_vtimes, queue_vtimes + APPTYPES, copy->queue_vtimes);
+    copy->vtime = vtime;
+    copy->frame_number = frame_number;
+
+    // a DG continued without CI list continues so in the copy, too
+    copy->last_ci_type = last_ci_type;
+    copy->last_ci_size = last_ci_size;
+    copy->lookahead_packing = lookahead_packing;
+    return copy;
 }
 
 
+template<bool SHORT_XPAD>
 size_t PADPacketizer::AddCINeededBytes() {
     // returns the amount of additional bytes needed for the next CI
 
     // special cases: end marker added/replaced
-    if (!short_xpad && used_cis == 0)
+    if (!SHORT_XPAD && used_cis == 0)
         return 2;
-    if (!short_xpad && used_cis == (max_cis - 1))
+    if (!SHORT_XPAD && used_cis == (MaxCIs(SHORT_XPAD) - 1))
         return 0;
     return 1;
 }
 
+template<bool SHORT_XPAD>
 void PADPacketizer::AddCI(int apptype, int len_index) {
     ci_type[used_cis] = apptype;
     ci_len_index[used_cis] = len_index;
 
-    xpad_size += AddCINeededBytes();
+    xpad_size += AddCINeededBytes<SHORT_XPAD>();
     used_cis++;
 }
 
@@ -187,7 +696,7 @@ int PADPacketizer::OptimalSubFieldSizeIndex(size_t available_bytes) {
 
     while ((len_index + 1) < 8 && SUBFIELD_LENS[len_index] < available_bytes)
         len_index++;
-    while ((len_index - 1) >= 0 && (SUBFIELD_LENS[len_index] + AddCINeededBytes()) > (xpad_size_max - xpad_size))
+    while ((len_index - 1) >= 0 && (SUBFIELD_LENS[len_index] + AddCINeededBytes<false>()) > (xpad_size_max - xpad_size))
         len_index--;
     if ((len_index - 1) >= 0 && ((int) SUBFIELD_LENS[len_index] - (int) available_bytes) >= (int) SUBFIELD_LENS[0])
         len_index--;
@@ -195,21 +704,117 @@ int PADPacketizer::OptimalSubFieldSizeIndex(size_t available_bytes) {
     return len_index;
 }
 
+
+// --- sub_field_planner_t -----------------------------------------------------------------
+/*! Searches the sub-field sizes for the next DGs (each sub-field holding
+ * bytes of one DG only), that fit the most DG bytes into the X-PAD -
+ * with as few X-PAD bytes as possible.
+ */
+struct sub_field_planner_t {
+    const size_t* subfield_lens;
+    const size_t* dg_available;     // per DG
+    size_t dgs;
+    size_t max_cis;
+    size_t xpad_size_max;
+
+    struct plan_t {
+        int len_index[4];
+        size_t cis;
+        size_t data;    // DG bytes
+        size_t size;    // X-PAD bytes (incl. CI list)
+    } plan, best;
+
+    void Search(size_t dg, size_t dg_left) {
+        if (plan.data > best.data || (plan.data == best.data && plan.size < best.size))
+            best = plan;
+        if (dg == dgs || plan.cis == max_cis)
+            return;
+
+        // the 4th CI replaces the end marker
+        size_t ci_bytes = plan.cis == 0 ? 2 : (plan.cis == max_cis - 1 ? 0 : 1);
+        for (int len_index = 0; len_index < 8; len_index++) {
+            size_t len = subfield_lens[len_index];
+            if (plan.size + ci_bytes + len > xpad_size_max)
+                break;
+
+            size_t written = std::min(len, dg_left);
+            plan.len_index[plan.cis++] = len_index;
+            plan.data += written;
+            plan.size += ci_bytes + len;
+
+            if (written == dg_left)
+                Search(dg + 1, dg + 1 < dgs ? dg_available[dg + 1] : 0);
+            else
+                Search(dg, dg_left - written);
+
+            plan.cis--;
+            plan.data -= written;
+            plan.size -= ci_bytes + len;
+
+            // bigger sub-fields would only add padding
+            if (len >= dg_left)
+                break;
+        }
+    }
+};
+
+
+void PADPacketizer::PlanSubFields() {
+    /*! Plan the sub-fields of the whole PAD w/ CI list, regarding as many
+     * queued DGs as there may be CIs (the first one being the current one).
+     */
+    DATA_GROUP* next_dgs[4];
+    size_t next_dgs_count = PeekDGs(next_dgs, max_cis);
+    size_t dg_available[4];
+    size_t dgs = 0;
+    for (size_t i = 0; i < next_dgs_count; i++)
+        if (next_dgs[i]->Available() > 0)
+            dg_available[dgs++] = next_dgs[i]->Available();
+
+    sub_field_planner_t planner;
+    planner.subfield_lens = SUBFIELD_LENS;
+    planner.dg_available = dg_available;
+    planner.dgs = dgs;
+    planner.max_cis = max_cis;
+    planner.xpad_size_max = xpad_size_max;
+    planner.plan.cis = planner.plan.data = planner.plan.size = 0;
+    planner.best = planner.plan;
+    if (dgs > 0)
+        planner.Search(0, dg_available[0]);
+
+    std::copy(planner.best.len_index, planner.best.len_index + planner.best.cis, planned_len_index);
+    planned_cis = planner.best.cis;
+}
+
 int PADPacketizer::WriteDGToSubField(DATA_GROUP* dg, size_t len) {
+    const size_t data_len = std::min(len, dg->Available());
+    if (writing_fill)
+        stats.fill_bytes += data_len;
+    if (dg->apptype_start >= 0 && dg->apptype_start < APPTYPES) {
+        if (!writing_fill)
+            queued_bytes[dg->apptype_start] -= data_len;
+        stats.data_bytes[dg->apptype_start] += data_len;
+        if (data_len && !dry_run)
+            xpad_data_bytes_metric(dg->apptype_start).Add(data_len);
+    }
+    stats.subfield_padding_bytes += len - data_len;
+
     int apptype = dg->Write(&subfields[subfields_size], len, &last_ci_type);
     subfields_size += len;
     xpad_size += len;
+    PADENC_TRACE4(subfield_written, dg, apptype, len, data_len);
     return apptype;
 }
 
 
+template<bool SHORT_XPAD>
 bool PADPacketizer::AppendDG(DATA_GROUP* dg) {
     /*! use X-PAD w/o CIs instead of X-PAD w/ CIs, if we can save some bytes or at least do not waste additional bytes
      *
      * Omit CI list in case:
      * 1.   no pending data sub-fields
      * 2.   last CI type valid
-     * 3.   last CI type matching current (continuity) CI type
+     * 3.   last CI type matching current (continuity) CI type, of a DG already started
      * 4a.  short X-PAD; OR
      * 4ba. size of the last X-PAD being at least as big as the available X-PAD payload in case all CIs are used AND
      * 4bb. the amount of available DG bytes being at least as big as the size of the last X-PAD in case all CIs are used
@@ -218,29 +823,40 @@ bool PADPacketizer::AppendDG(DATA_GROUP* dg) {
             used_cis == 0 &&
             last_ci_type != -1 &&
             last_ci_type == dg->apptype_cont &&
-            (short_xpad ||
-                    (last_ci_size >= (xpad_size_max - max_cis) &&
-                            dg->Available() >= (last_ci_size - max_cis)))
+            dg->written > 0 &&
+            (SHORT_XPAD ||
+                    (last_ci_size >= (xpad_size_max - MaxCIs(SHORT_XPAD)) &&
+                            dg->Available() >= (last_ci_size - MaxCIs(SHORT_XPAD))))
             ) {
         AppendDGWithoutCI(dg);
         return true;
     } else {
-        AppendDGWithCI(dg);
+        AppendDGWithCI<SHORT_XPAD>(dg);
 
         // if no further sub-fields could be added, PAD must be flushed
-        if (used_cis == max_cis || SUBFIELD_LENS[0] + AddCINeededBytes() > (xpad_size_max - xpad_size))
+        if (used_cis == MaxCIs(SHORT_XPAD) || SUBFIELD_LENS[0] + AddCINeededBytes<SHORT_XPAD>() > (xpad_size_max - xpad_size))
             return true;
     }
     return false;
 }
 
 
+template<bool SHORT_XPAD>
 void PADPacketizer::AppendDGWithCI(DATA_GROUP* dg) {
-    int len_index = short_xpad ? 0 : OptimalSubFieldSizeIndex(dg->Available());
-    size_t len_size = short_xpad ? 3 : SUBFIELD_LENS[len_index];
+    if (lookahead_packing && !SHORT_XPAD && used_cis == 0)
+        PlanSubFields();
+
+    int len_index;
+    if (SHORT_XPAD)
+        len_index = 0;
+    else if (used_cis < planned_cis)
+        len_index = planned_len_index[used_cis];
+    else
+        len_index = OptimalSubFieldSizeIndex(dg->Available());
+    size_t len_size = SHORT_XPAD ? 3 : SUBFIELD_LENS[len_index];
 
     int apptype = WriteDGToSubField(dg, len_size);
-    AddCI(apptype, len_index);
+    AddCI<SHORT_XPAD>(apptype, len_index);
 
 #ifdef DEBUG
     fprintf(stderr, "PADPacketizer: added sub-field w/  CI - type: %2d, size: %2zu\n", apptype, len_size);
@@ -263,28 +879,42 @@ void PADPacketizer::ResetPAD() {
     xpad_size = 0;
     subfields_size = 0;
     used_cis = 0;
+    planned_cis = 0;
 }
 
-pad_t* PADPacketizer::FlushPAD() {
-    pad_t* result = new pad_t(xpad_size_max + FPAD_LEN + 1);
-    pad_t &pad = *result;
+// writes the bytes of src to dst in reverse order, eight at a time by a byte swap
+static inline void copy_reversed(uint8_t* dst, const uint8_t* src, size_t len) {
+    uint8_t* out = dst + len;
+    size_t off = 0;
+    for (; off + 8 <= len; off += 8) {
+        uint64_t word;
+        memcpy(&word, src + off, 8);
+        word = __builtin_bswap64(word);
+        out -= 8;
+        memcpy(out, &word, 8);
+    }
+    for (; off < len; off++)
+        *--out = src[off];
+}
 
+template<bool SHORT_XPAD>
+void PADPacketizer::FlushPAD(uint8_t* pad) {
     size_t pad_offset = xpad_size_max;
 
     if (subfields_size > 0) {
         if (used_cis > 0) {
             // X-PAD: CIs
             for (size_t i = 0; i < used_cis; i++)
-                pad[--pad_offset] = (short_xpad ? 0 : ci_len_index[i]) << 5 | ci_type[i];
+                pad[--pad_offset] = (SHORT_XPAD ? 0 : ci_len_index[i]) << 5 | ci_type[i];
 
             // X-PAD: end marker (if needed)
-            if (used_cis < max_cis)
+            if (used_cis < MaxCIs(SHORT_XPAD))
                 pad[--pad_offset] = 0x00;
         }
 
         // X-PAD: sub-fields (reversed on-the-fly)
-        for (size_t off = 0; off < subfields_size; off++)
-            pad[--pad_offset] = subfields[off];
+        pad_offset -= subfields_size;
+        copy_reversed(&pad[pad_offset], subfields, subfields_size);
     } else {
         // no X-PAD
         last_ci_type = -1;
@@ -294,19 +924,27 @@ pad_t* PADPacketizer::FlushPAD() {
     memset(&pad[0], 0x00, pad_offset);
 
     // F-PAD
-    pad[xpad_size_max + 0] = subfields_size > 0 ? (short_xpad ? 0x10 : 0x20) : 0x00;
+    pad[xpad_size_max + 0] = subfields_size > 0 ? (SHORT_XPAD ? 0x10 : 0x20) : 0x00;
     pad[xpad_size_max + 1] = subfields_size > 0 ? (used_cis > 0 ? 0x02 : 0x00) : 0x00;
 
     // used PAD len
     pad[xpad_size_max + FPAD_LEN] = xpad_size + FPAD_LEN;
 
+    stats.frames++;
+    if (subfields_size == 0)
+        stats.frames_without_xpad++;
+    stats.capacity_bytes += xpad_size_max;
+    stats.ci_bytes += xpad_size - subfields_size;
+    stats.unused_bytes += xpad_size_max - xpad_size;
+    PADENC_TRACE4(pad_flushed, frame_number, xpad_size, subfields_size, used_cis);
+    frame_number++;
+
     last_ci_size = xpad_size;
     ResetPAD();
-    return result;
 }
 
 DATA_GROUP* PADPacketizer::CreateDataGroupLengthIndicator(size_t len) {
-    DATA_GROUP* dg = new DATA_GROUP(2, APPTYPE_DGLI, APPTYPE_DGLI);    // continuation never used (except for comparison at short X-PAD)
+    DATA_GROUP* dg = CreateDataGroup(2, APPTYPE_DGLI, APPTYPE_DGLI);   // continuation never used (except for comparison at short X-PAD)
     uint8_vector_t &data = dg->data;
 
     // Data Group length
@@ -322,3 +960,51 @@ DATA_GROUP* PADPacketizer::CreateDataGroupLengthIndicator(size_t len) {
 bool PADPacketizer::CheckPADLen(size_t len) {
     return len == PADPacketizer::SHORT_PAD || (len >= PADPacketizer::VARSIZE_PAD_MIN && len <= PADPacketizer::VARSIZE_PAD_MAX);
 }
+
+
+// --- PADThroughputEstimator -----------------------------------------------------------------
+const size_t PADThroughputEstimator::MAX_PENDING_FRAMES = 1000;    // then older frames are weighted down
+const std::chrono::milliseconds PADThroughputEstimator::MIN_WINDOW = std::chrono::milliseconds(2000);
+
+PADThroughputEstimator::PADThroughputEstimator() :
+        pending_frames(0),
+        pending_bytes(0),
+        frame_duration(std::chrono::steady_clock::duration::zero()),
+        window_frames(0) {}
+
+void PADThroughputEstimator::Update(std::chrono::steady_clock::time_point now, size_t bytes_sent, bool pending) {
+    if (pending) {
+        pending_frames++;
+        pending_bytes += bytes_sent;
+        if (pending_frames > MAX_PENDING_FRAMES) {
+            pending_frames /= 2;
+            pending_bytes /= 2;
+        }
+    }
+
+    // frames may be requested in bursts, so the duration is measured over a longer window
+    if (window_frames == 0) {
+        window_start = now;
+    } else if (now - window_start >= MIN_WINDOW) {
+        std::chrono::steady_clock::duration measured = (now - window_start) / window_frames;
+        frame_duration = frame_duration == std::chrono::steady_clock::duration::zero() ? measured : (frame_duration + measured) / 2;
+        window_start = now;
+        window_frames = 0;
+    }
+    window_frames++;
+}
+
+bool PADThroughputEstimator::Estimate(size_t bytes, std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point& completion) const {
+    if (pending_bytes == 0 || frame_duration == std::chrono::steady_clock::duration::zero())
+        return false;
+
+    double frames = bytes * pending_frames / pending_bytes;
+    completion = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(frame_duration * frames);
+    return true;
+}
+
+double PADThroughputEstimator::BytesPerSecond() const {
+    if (pending_frames == 0 || frame_duration == std::chrono::steady_clock::duration::zero())
+        return 0;
+    return pending_bytes / pending_frames / std::chrono::duration<double>(frame_duration).count();
+}
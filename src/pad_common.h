@@ -31,6 +31,10 @@
 #define PAD_COMMON_H_
 
 #include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <vector>
 #include <deque>
 #include <string.h>
@@ -39,6 +43,7 @@
 #include <unistd.h>
 
 #include "crc.h"
+#include "timing.h"
 
 
 
@@ -57,19 +62,150 @@ enum class DABCharset : uint8_t {
 };
 
 // --- DATA_GROUP -----------------------------------------------------------------
+/*! The DG content is \c data - or, if an external payload is set, the
+ * first \c ext_offset bytes of \c data, followed by the external payload
+ * and the remaining bytes of \c data (e.g. the CRC).
+ */
 struct DATA_GROUP {
     uint8_vector_t data;
     int apptype_start;
     int apptype_cont;
     size_t written;
+    bool pooled;    // owned by a DataGroupPool (must not be deleted)
 
+    // external payload, referenced in place (kept alive by ext_owner)
+    std::shared_ptr<const void> ext_owner;
+    const uint8_t* ext_data;
+    size_t ext_len;
+    size_t ext_offset;
+
+    /*! called once the DG has been sent completely (true) or dropped unsent
+     *  (false), from within WriteNextPAD() resp. DropDGs(); not when the
+     *  packetizer is destroyed
+     */
+    std::function<void(bool sent)> done_handler;
+
+    DATA_GROUP() : apptype_start(-1), apptype_cont(-1), written(0), pooled(false), ext_data(nullptr), ext_len(0), ext_offset(0) {}
     DATA_GROUP(size_t len, int apptype_start, int apptype_cont);
+    void Init(size_t len, int apptype_start, int apptype_cont);
+    void SetExternalPayload(const uint8_t* payload, size_t len, const std::shared_ptr<const void>& owner);
     void AppendCRC();
-    size_t Available();
+    size_t Size() const {return data.size() + ext_len;}
+    size_t Available() const;
     int Write(uint8_t *write_data, size_t len, int *cont_apptype);
 };
 
 
+// --- DataGroupPool -----------------------------------------------------------------
+/*! Provides DATA_GROUPs from slabs and recycles them (incl. their payload
+ * buffers) once released, so that in steady state no heap allocation
+ * happens when creating DGs.
+ */
+class DataGroupPool {
+private:
+    static const size_t SLAB_SIZE;
+
+    std::vector<std::unique_ptr<DATA_GROUP[]>> slabs;
+    std::vector<DATA_GROUP*> free_dgs;
+
+    void AddSlab();
+public:
+    DATA_GROUP* Acquire(size_t len, int apptype_start, int apptype_cont);
+    void Release(DATA_GROUP* dg);
+
+    size_t Capacity() const {return slabs.size() * SLAB_SIZE;}
+    size_t FreeCount() const {return free_dgs.size();}
+    // incl. the payload buffers kept for recycling
+    size_t AllocatedBytes() const;
+    // frees the payload buffers of the DGs not in use
+    void Trim();
+};
+
+
+// --- PAD_STATS -----------------------------------------------------------------
+/*! Usage of the X-PAD since the packetizer was created or the stats were
+ * reset, e.g. to tune the slide size and interval. DG related counters are
+ * per (start) app type; a DGLI counts as DG of its own.
+ */
+struct PAD_STATS {
+    static const int APPTYPES = 32;
+
+    size_t frames;              // incl. frames w/o X-PAD
+    size_t frames_without_xpad;
+    size_t capacity_bytes;      // X-PAD bytes available in all frames
+    size_t ci_bytes;            // CI lists incl. end markers
+    size_t subfield_padding_bytes;  // sub-fields not filled up by the end of a DG
+    size_t unused_bytes;        // X-PAD bytes not used at all
+    size_t queued_dgs_max;      // queue depth
+    size_t fill_bytes;          // data bytes of the background fill (incl. in data_bytes)
+    size_t fill_dgs_abandoned;  // partly written, when other DGs came
+
+    size_t data_bytes[APPTYPES];
+    size_t dgs_sent[APPTYPES];
+    size_t latency_frames[APPTYPES];    // sum over the sent DGs, from adding to the last byte
+    size_t latency_frames_max[APPTYPES];
+
+    PAD_STATS() {Reset();}
+    void Reset();
+};
+
+
+// --- RingQueue -----------------------------------------------------------------
+/*! A double-ended queue within a single ring buffer, doubled in size when
+ * full. Unlike std::deque its entries are contiguous (apart from the
+ * wrap-around), and once it has grown to the usual depth, adding and removing
+ * entries no longer allocates.
+ */
+template<typename T>
+class RingQueue {
+private:
+    std::vector<T> ring;    // of a power of two size
+    size_t first;
+    size_t count;
+
+    size_t Slot(size_t i) const {return (first + i) & (ring.size() - 1);}
+    void Grow() {
+        std::vector<T> grown(std::max<size_t>(2 * ring.size(), 8));
+        for (size_t i = 0; i < count; i++)
+            grown[i] = std::move(ring[Slot(i)]);
+        ring.swap(grown);
+        first = 0;
+    }
+public:
+    RingQueue() : first(0), count(0) {}
+
+    bool empty() const {return count == 0;}
+    size_t size() const {return count;}
+    T& operator[](size_t i) {return ring[Slot(i)];}
+    const T& operator[](size_t i) const {return ring[Slot(i)];}
+    T& front() {return ring[first];}
+    const T& front() const {return ring[first];}
+    T& back() {return ring[Slot(count - 1)];}
+    const T& back() const {return ring[Slot(count - 1)];}
+
+    void push_back(const T& entry) {
+        if (count == ring.size())
+            Grow();
+        ring[Slot(count++)] = entry;
+    }
+    void push_front(const T& entry) {
+        if (count == ring.size())
+            Grow();
+        first = Slot(ring.size() - 1);
+        ring[first] = entry;
+        count++;
+    }
+    void pop_front() {first = Slot(1); count--;}
+    void pop_back() {count--;}
+    // removes the i-th entry, keeping the order of the others
+    void erase(size_t i) {
+        for (; i + 1 < count; i++)
+            (*this)[i] = std::move((*this)[i + 1]);
+        count--;
+    }
+};
+
+
 // --- PADPacketizer -----------------------------------------------------------------
 class PADPacketizer {
 private:
@@ -79,11 +215,50 @@ private:
     static const size_t VARSIZE_PAD_MIN;
     static const size_t VARSIZE_PAD_MAX;
 
-    const size_t xpad_size_max;
-    const bool short_xpad;
-    const size_t max_cis;
-
-    std::deque<DATA_GROUP*> queue;
+    size_t xpad_size_max;
+    bool short_xpad;
+    size_t max_cis;
+
+    static const int APPTYPES = PAD_STATS::APPTYPES;
+
+    // all the queue walk needs, without touching the DG itself
+    struct queued_dg_t {
+        DATA_GROUP* dg;
+        long long seq;      // order of addition (prepended DGs first)
+        uint32_t added_frame;
+        bool preempt;       // served before all other DGs
+        bool after_dgli;    // preceded by a DGLI (written again if the DG is restarted)
+    };
+
+    /*! queued DGs per (start) app type, a DGLI together with the DG it precedes;
+     *  the queues are served in the order of addition - or by weight, if set
+     */
+    RingQueue<queued_dg_t> queues[APPTYPES];
+    uint32_t active_queues;         // a bit per non-empty queue
+    static_assert(APPTYPES <= 32, "a bit per queue");
+    size_t queued_total;
+    long long next_front_seq;
+    long long next_back_seq;
+    int last_appended_queue;
+    DataGroupPool dg_pool;
+
+    // background fill: only written while no other DG is queued (not counted as queued)
+    RingQueue<queued_dg_t> fill_queue;
+    bool writing_fill;
+
+    // queued DGs and their bytes not yet written, per (start) app type
+    size_t queued_dgs[APPTYPES];
+    size_t queued_bytes[APPTYPES];
+
+    // weighted sharing of the X-PAD between the queues
+    bool weighted;
+    unsigned int queue_weights[APPTYPES];
+    double queue_vtimes[APPTYPES];  // bytes written per weight
+    double vtime;                   // of the queue served last
+
+    PAD_STATS stats;
+    size_t frame_number;            // independent of stats resets
+    bool dry_run;                   // see DryRunCopy()
 
     size_t xpad_size;
     uint8_t subfields[4*48];
@@ -98,35 +273,146 @@ private:
     int last_ci_type;
     size_t last_ci_size;
 
-    size_t AddCINeededBytes();
-    void AddCI(int apptype, int len_index);
+    // sub-field sizes planned for the current PAD (look-ahead packing only)
+    bool lookahead_packing;
+    int planned_len_index[4];
+    size_t planned_cis;
+
+    /*! The per sub-field paths are instantiated for short and variable size
+     *  X-PAD each, so that they do not branch on the X-PAD type; the
+     *  instantiation is chosen whenever the PAD length is set.
+     */
+    static size_t MaxCIs(bool short_xpad) {return short_xpad ? 1 : 4;}
+    void (PADPacketizer::*get_pad)(uint8_t* pad);
+    void (PADPacketizer::*flush_pad)(uint8_t* pad);
+
+    template<bool SHORT_XPAD> size_t AddCINeededBytes();
+    template<bool SHORT_XPAD> void AddCI(int apptype, int len_index);
 
     int OptimalSubFieldSizeIndex(size_t available_bytes);
+    void PlanSubFields();
     int WriteDGToSubField(DATA_GROUP* dg, size_t len);
 
-    bool AppendDG(DATA_GROUP* dg);
-    void AppendDGWithCI(DATA_GROUP* dg);
+    template<bool SHORT_XPAD> bool AppendDG(DATA_GROUP* dg);
+    template<bool SHORT_XPAD> void AppendDGWithCI(DATA_GROUP* dg);
     void AppendDGWithoutCI(DATA_GROUP* dg);
 
-    pad_t* GetPAD();
+    template<bool SHORT_XPAD> void GetPAD(uint8_t* pad);
     void ResetPAD();
-    pad_t* FlushPAD();
+    template<bool SHORT_XPAD> void FlushPAD(uint8_t* pad);
+    void DisposeDG(DATA_GROUP* dg);
+    void ReleaseDG(DATA_GROUP* dg);
+    DATA_GROUP* CopyDG(const DATA_GROUP* dg);
+    void CopyQueue(const RingQueue<queued_dg_t>& source, RingQueue<queued_dg_t>& target);
+    void AbandonFillDG();
+    void UpdateActiveQueue(int app);
+    void EnqueueDG(DATA_GROUP* dg, bool prepend, bool preempt);
+    int NextQueue() const;
+    size_t PeekDGs(DATA_GROUP** dgs, size_t max_dgs) const;
 public:
     static const std::string ALLOWED_PADLEN;
     static const int APPTYPE_DGLI;
+    static const TimingOperation TIMING_WRITE_PAD;  // WriteNextPAD(), of all packetizers
 
     PADPacketizer(size_t pad_size);
     ~PADPacketizer();
 
-    void AddDG(DATA_GROUP* dg, bool prepend);
-    void AddDGs(const std::vector<DATA_GROUP*>& dgs, bool prepend);
-    bool QueueFilled();
-    bool QueueContainsDG(int apptype_start);
-
+    /*! adds DGs to the queue end or (if prepend) front; preempting DGs
+     *  (e.g. emergency labels) are prepended and, regardless of any weights,
+     *  served before all others - interrupting a partly written DG at the
+     *  next sub-field, which is resumed afterwards
+     */
+    void AddDG(DATA_GROUP* dg, bool prepend, bool preempt = false);
+    void AddDGs(const std::vector<DATA_GROUP*>& dgs, bool prepend, bool preempt = false);
+    // removes the queued DGs of an app type that were not started yet
+    size_t DropDGs(int apptype_start);
+    /*! the PADs written so far did not go on air (e.g. PAD frames encoded
+     *  ahead were dropped): restarts the partly written DGs (incl. the DGLI
+     *  before each), abandons a partly written fill DG and makes the next PAD
+     *  carry a CI list, so that no continuation follows the dropped PADs
+     */
+    size_t RestartDGs();
+    /*! adds a DG to the background fill, e.g. a slide repetition: it only
+     *  uses X-PAD that would be unused otherwise, i.e. it is written while no
+     *  other DG is queued. As soon as there is one, a partly written fill DG
+     *  (incl. the DG after a written DGLI) is abandoned.
+     */
+    void AddFillDG(DATA_GROUP* dg);
+    // removes the fill DGs that were not started yet
+    size_t DropFillDGs();
+    bool FillQueued() const {return !fill_queue.empty();}
+    bool QueueFilled() const {return queued_total > 0;}
+    bool QueueContainsDG(int apptype_start) const {return QueuedDGs(apptype_start) > 0;}
+    size_t QueuedDGs(int apptype_start) const;
+    size_t QueuedBytes(int apptype_start) const;
+
+    // X-PAD usage (snapshot by copying)
+    const PAD_STATS& GetStats() const {return stats;}
+    void ResetStats() {stats.Reset();}
+
+    /*! a copy with the same settings and queued DGs (incl. the progress of a
+     *  partly written one and the background fill), but without their done
+     *  handlers and with the stats reset - e.g. to find out by writing its
+     *  PADs how long the queued data takes. Its PADs neither count as written
+     *  (timings and metrics of the process) nor are dumped.
+     */
+    std::unique_ptr<PADPacketizer> DryRunCopy() const;
+
+    /*! chooses the sub-field sizes of a PAD w/ CI list for the next queued DGs
+     *  at once (minimising padding), instead of one DG at a time
+     */
+    void SetLookaheadPacking(bool enabled) {lookahead_packing = enabled;}
+
+    /*! shares the X-PAD between app types by weight (e.g. DLS 1, MOT 9 for
+     *  10% DLS), instead of strictly in the order the DGs were added; app
+     *  types without weight get 1. DGLIs are served along with their DG.
+     */
+    void SetAppTypeWeight(int apptype_start, unsigned int weight);
+
+    // changes the PAD length, keeping the queued DGs (incl. the progress of a partly written one)
+    void SetPADLength(size_t pad_size);
+    size_t GetPADFrameSize() const {return xpad_size_max + FPAD_LEN + 1;}
+    size_t WriteNextPAD(bool output_xpad, uint8_t* pad);
     std::vector<uint8_t> GetNextPAD(bool output_xpad);
 
-    static DATA_GROUP* CreateDataGroupLengthIndicator(size_t len);
+    DATA_GROUP* CreateDataGroup(size_t len, int apptype_start, int apptype_cont);
+    DATA_GROUP* CreateDataGroupLengthIndicator(size_t len);
+    const DataGroupPool& GetDataGroupPool() const {return dg_pool;}
+    DataGroupPool& GetDataGroupPool() {return dg_pool;}
     static bool CheckPADLen(size_t len);
 };
 
+
+// --- PADThroughputEstimator -----------------------------------------------------------------
+/*! Estimates when queued data (e.g. of a slide) will have been sent, from
+ * the bytes sent per frame while data was pending and from the measured
+ * frame duration. Recent frames count more, so that both adapt to a changed
+ * PAD length, X-PAD interval or share of the X-PAD.
+ */
+class PADThroughputEstimator {
+private:
+    static const size_t MAX_PENDING_FRAMES;
+    static const std::chrono::milliseconds MIN_WINDOW;
+
+    double pending_frames;      // frames during which data was queued
+    double pending_bytes;       // bytes sent in those frames
+    std::chrono::steady_clock::duration frame_duration; // zero until measured
+    std::chrono::steady_clock::time_point window_start;
+    size_t window_frames;
+public:
+    PADThroughputEstimator();
+
+    // accounts one frame that sent the given bytes, while data was pending (or not)
+    void Update(std::chrono::steady_clock::time_point now, size_t bytes_sent, bool pending);
+
+    /*! estimates when the given bytes will have been sent; false, if there
+     *  are no measurements yet
+     */
+    bool Estimate(size_t bytes, std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point& completion) const;
+    // the bytes sent per second while data is pending; 0, if there are no measurements yet
+    double BytesPerSecond() const;
+    // the measured duration of a frame; zero, if not measured yet
+    std::chrono::steady_clock::duration FrameDuration() const {return frame_duration;}
+};
+
 #endif /* PAD_COMMON_H_ */
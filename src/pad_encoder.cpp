@@ -0,0 +1,1264 @@
+/*
+    Copyright (C) 2014 CSP Innovazione nelle ICT s.c.a r.l. (http://rd.csp.it/)
+
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file pad_encoder.cpp
+    \brief The PAD encoder of a service, usable in-process (see odrpadenc.h)
+
+    \author Sergio Sagliocco <sergio.sagliocco@csp.it>
+    \author Matthias P. Braendli <matthias@mpb.li>
+    \author Stefan Pöschel <odr@basicmaster.de>
+*/
+
+#include "pad_encoder.h"
+#include "file_prefetcher.h"
+#include "metrics.h"
+#include "thread_placement.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <string.h>
+#include <unistd.h>
+
+
+// --- FrameDeadlines -----------------------------------------------------------------
+const char* FrameDeadlines::PHASE_NAMES[PHASES] = {"slide", "re-read check", "label", "PAD", "send"};
+const TimingOperation FrameDeadlines::TIMING_REQUEST("padenc.request");
+
+// of all services
+static MetricCounter& over_budget_metric() {
+    static MetricCounter& counter = MetricsRegistry::Global().Counter(
+            "odr_padenc_requests_over_budget", "PAD requests whose frames were sent later than the frame budget");
+    return counter;
+}
+
+FrameDeadlines::FrameDeadlines(int budget_ms) :
+        budget_ms(budget_ms),
+        ns_per_tick(TimingClock::NanosecondsPerTick()),
+        start(0),
+        last(0),
+        requests(0),
+        over_budget(0),
+        warning_log("padenc.over_budget", 1, 10)
+{
+    budget_ticks = budget_ms > 0 ? (uint64_t) (budget_ms * 1e6 / ns_per_tick) : UINT64_MAX;
+    std::fill(phase_ticks, phase_ticks + PHASES, 0);
+}
+
+bool FrameDeadlines::End(size_t frames) {
+    const uint64_t ticks = TimingClock::Now() - start;
+    Timings::Record(TIMING_REQUEST.id, ticks);
+    requests++;
+    if (budget_ms > 0)
+        WorkGovernor::Global().Report(1.0 - (double) ticks / budget_ticks);
+    if (ticks <= budget_ticks)
+        return false;
+
+    over_budget++;
+    over_budget_metric().Add();
+
+    slow_request_t slow_request;
+    slow_request.request = requests;
+    slow_request.frames = frames;
+    slow_request.total_ms = ticks * ns_per_tick / 1e6;
+    for (int phase = 0; phase < PHASES; phase++)
+        slow_request.phase_ms[phase] = phase_ticks[phase] * ns_per_tick / 1e6;
+    if (slow_log.size() == SLOW_LOG_LEN)
+        slow_log.pop_front();
+    slow_log.push_back(slow_request);
+
+    PadLog::Global().Write(warning_log, LogLevel::WARNING, {{"request", (long long) requests}, {"frames", (long long) frames}},
+                           "PAD request over the budget of %d ms: %s", budget_ms, Describe(slow_request).c_str());
+    return true;
+}
+
+std::string FrameDeadlines::Describe(const slow_request_t& slow_request) {
+    char text[64];
+    snprintf(text, sizeof(text), "request %zu, %zu frame(s) in %.1f ms", slow_request.request, slow_request.frames, slow_request.total_ms);
+    std::string result = text;
+
+    // the phases that took noticeable time
+    const char* separator = ":";
+    for (int phase = 0; phase < PHASES; phase++) {
+        if (slow_request.phase_ms[phase] < 0.05)
+            continue;
+        snprintf(text, sizeof(text), "%s %s %.1f ms", separator, PHASE_NAMES[phase], slow_request.phase_ms[phase]);
+        result += text;
+        separator = ",";
+    }
+    return result;
+}
+
+void FrameDeadlines::ResetStats() {
+    over_budget = 0;
+    slow_log.clear();
+
+    // the calibration gets more precise over time
+    ns_per_tick = TimingClock::NanosecondsPerTick();
+    if (budget_ms > 0)
+        budget_ticks = (uint64_t) (budget_ms * 1e6 / ns_per_tick);
+}
+
+
+// --- PadEncoderOptions -----------------------------------------------------------------
+bool read_live_config(const std::string& path, PadEncoderOptions& options) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        perror(("ODR-PadEnc Error: opening live config '" + path + "' failed").c_str());
+        return false;
+    }
+
+    // the DLS files listed replace the previous ones
+    bool dls_listed = false;
+    std::string line;
+    for (size_t line_no = 1; std::getline(file, line); line_no++) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        size_t separator = line.find('=');
+        if (separator == std::string::npos) {
+            fprintf(stderr, "ODR-PadEnc Error: live config '%s' line %zu: KEY=VALUE expected\n", path.c_str(), line_no);
+            return false;
+        }
+        const std::string key = line.substr(0, separator);
+        const std::string value = line.substr(separator + 1);
+
+        if (key == "sleep") {
+            options.slide_interval = atoi(value.c_str());
+        } else if (key == "label") {
+            options.label_interval = atoi(value.c_str());
+        } else if (key == "label-ins") {
+            options.label_insertion = atoi(value.c_str());
+        } else if (key == "xpad-interval") {
+            options.xpad_interval = atoi(value.c_str());
+        } else if (key == "max-slide-size") {
+            options.max_slide_size = strtoul(value.c_str(), NULL, 10);
+        } else if (key == "dls") {
+            if (!dls_listed) {
+                options.dls_files.clear();
+                options.dls_weights.clear();
+                dls_listed = true;
+            }
+            options.dls_files.push_back(value);
+            options.dls_weights.push_back(1);
+        } else if (key == "label-weight") {
+            if (!dls_listed) {
+                fprintf(stderr, "ODR-PadEnc Error: live config '%s' line %zu: label weight must follow a DLS file\n", path.c_str(), line_no);
+                return false;
+            }
+            options.dls_weights.back() = atoi(value.c_str());
+        } else {
+            fprintf(stderr, "ODR-PadEnc Error: live config '%s' line %zu: unknown key '%s'\n", path.c_str(), line_no, key.c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool check_live_options(const PadEncoderOptions& options) {
+    if (options.max_slide_size == 0 || options.max_slide_size > SLSEncoder::MAXSLIDESIZE_SIMPLE) {
+        fprintf(stderr, "ODR-PadEnc Error: max slide size %zu must be between 1 and %zu (Simple Profile limit)\n",
+                options.max_slide_size, SLSEncoder::MAXSLIDESIZE_SIMPLE);
+        return false;
+    }
+    if (options.slide_interval < 0 || options.label_interval < 0 || options.label_insertion < 1) {
+        fprintf(stderr, "ODR-PadEnc Error: The slide/label intervals must not be negative, the label insertion interval at least 1 ms!\n");
+        return false;
+    }
+    if ((options.mot_carousel || options.adaptive_slide_size) && options.slide_interval == 0) {
+        fprintf(stderr, "ODR-PadEnc Error: The MOT carousel and an adaptive slide size need a slide interval!\n");
+        return false;
+    }
+    if (options.xpad_interval < 1) {
+        fprintf(stderr, "ODR-PadEnc Error: The X-PAD interval must be 1 or greater!\n");
+        return false;
+    }
+    for (int weight : options.dls_weights) {
+        if (weight < 1) {
+            fprintf(stderr, "ODR-PadEnc Error: label weight %d must be at least 1\n", weight);
+            return false;
+        }
+    }
+    if (!options.SLSEnabled() && !options.DLSEnabled()) {
+        fprintf(stderr, "ODR-PadEnc Error: Neither DLS nor Slideshow to encode !\n");
+        return false;
+    }
+    return true;
+}
+
+
+// --- capacity_query_t -----------------------------------------------------------------
+bool capacity_query_t::Parse(const std::string& spec) {
+    for (const std::string& item : split_string(spec, ',')) {
+        const size_t sep = item.find('=');
+        if (sep == std::string::npos)
+            return false;
+        const std::string name = item.substr(0, sep);
+        const std::string value = item.substr(sep + 1);
+        char* end;
+        const double number = strtod(value.c_str(), &end);
+        if (value.empty() || *end || number < 0)
+            return false;
+
+        if (name == "pad")
+            padlen = (int) number;
+        else if (name == "xpad-interval")
+            xpad_interval = (int) number;
+        else if (name == "slide")
+            slide_size = (size_t) number;
+        else if (name == "dl-plus")
+            dl_plus = number ? 1 : 0;
+        else if (name == "within")
+            within = std::chrono::milliseconds((long long) (number * 1000));
+        else
+            return false;
+    }
+    if (padlen && !PADPacketizer::CheckPADLen(padlen))
+        return false;
+    return (slide_size > 0) != (within > std::chrono::milliseconds::zero());
+}
+
+
+// --- LiveOptions -----------------------------------------------------------------
+void LiveOptions::Publish(std::shared_ptr<const PadEncoderOptions> options) {
+    std::atomic_store(&this->options, options);
+    version++;
+}
+
+std::shared_ptr<const PadEncoderOptions> LiveOptions::GetIfChanged(unsigned int& seen_version) const {
+    // usually nothing changed, which costs no more than this load
+    const unsigned int current_version = version;
+    if (current_version == seen_version)
+        return nullptr;
+    seen_version = current_version;
+    return std::atomic_load(&options);
+}
+
+
+// --- LabelInsertionPolicy -----------------------------------------------------------------
+const int LabelInsertionPolicy::MAX_BACKOFF = 3;
+
+steady_clock::duration LabelInsertionPolicy::Next(steady_clock::duration interval, bool changed, bool loaded) {
+    if (changed || !loaded)
+        backoff = 0;
+    else if (backoff < MAX_BACKOFF)
+        backoff++;
+    return interval * (1 << backoff);
+}
+
+
+// --- PadEncoder -----------------------------------------------------------------
+const size_t PadEncoder::MIN_ADAPTIVE_SLIDE_SIZE = 4096;   // below that, slides hardly look acceptable
+const steady_clock::duration PadEncoder::LABEL_PREFETCH_LEAD = std::chrono::seconds(2);
+const PadClock PadEncoder::STEADY_CLOCK;
+
+PadEncoder::PadEncoder(PadEncoderOptions options, const PadClock* clock, Reactor* reactor, const EncoderReplica* replica) :
+        options(options),
+        clock(clock ? *clock : STEADY_CLOCK),
+        data_groups_memory("data_groups", options.socket_ident, 0, [this](size_t) {
+            // the payload buffers kept for recycling
+            pad_packetizer.GetDataGroupPool().Trim();
+            return pad_packetizer.GetDataGroupPool().AllocatedBytes();
+        }),
+        slide_history_memory("slide_history", options.socket_ident, 0),
+        pad_packetizer(options.padlen),
+        dls_encoder(&pad_packetizer),
+        sls_encoder(&pad_packetizer, options.slide_cache_size),
+        slide_state(options.slide_state_file),
+        reread_watcher(reactor),
+        slides_reread_request(NULL),
+        dls_reread_generation(0),
+        dls_reread_index(0),
+        slides(options.slide_history_len),
+        slides_success(false),
+        slide_pending(false),
+        slide_size(options.max_slide_size),
+        slide_repeating(false),
+        deadlines(options.frame_budget),
+        ahead_first(0),
+        ahead_count(0),
+        live_options(nullptr),
+        live_options_version(0),
+        label_injected(false)
+{
+    // PAD related timelines
+    pad_packetizer.SetLookaheadPacking(options.lookahead_packing);
+    if (options.dls_share > 0) {
+        pad_packetizer.SetAppTypeWeight(DLSEncoder::APPTYPE_START, options.dls_share);
+        pad_packetizer.SetAppTypeWeight(SLSEncoder::APPTYPE_MOT_START, 100 - options.dls_share);
+    }
+
+    ApplySegmentLength();
+    sls_encoder.SetHeaderRepetition(options.header_repetition);
+    sls_encoder.SetHeaderPositions(options.header_positions);
+    sls_encoder.SetDirectoryMode(options.mot_directory, options.mot_directory_resend);
+    sls_encoder.SetSimilarityDistance(options.slide_similarity);
+    sls_encoder.SetFormatCandidates(options.slide_candidates);
+    // bound to a NUMA node: the shared slides are copied into its memory, off the PAD requests
+    sls_encoder.SetSharedStore(SharedSlideStore(options.slide_store_dir, options.numa_node >= 0));
+    sls_encoder.SetSlideSpill(options.slide_spill_dir, options.slide_spill_size);
+    dls_reread_coalescer.SetSettle(options.change_settle);
+
+    next_slide = next_label_insertion = next_memory_update = this->clock.Now();
+    next_stats_dump = next_slide + std::chrono::seconds(options.stats_interval);
+
+    StartLabels(next_label_insertion, std::vector<std::string>());
+    for (const std::string& format : options.dl_plus_formats)
+        dls_encoder.addDLPlusFormat(format);
+
+    xpad_interval_counter = 0;
+
+    // re-read requests
+    if (options.SLSEnabled())
+        slides_reread_request = reread_watcher.Add("slides dir", options.sls_dir + "/" + SLSEncoder::REQUEST_REREAD_FILENAME);
+
+    pad_frame.resize(PadInterface::MESSAGE_HEADER_LEN + pad_packetizer.GetPADFrameSize());
+    ahead_frames.resize(options.pad_lookahead * pad_packetizer.GetPADFrameSize());
+
+    if (sls_encoder.GetSlideCache().Enabled()) {
+        slide_cache_memory.reset(new MemoryAccount("slide_cache", options.socket_ident, options.slide_cache_size, [this](size_t target) {
+            // from within an update of the cache, i.e. under its lock if slides are prepared ahead
+            return sls_encoder.GetSlideCache().Shrink(target);
+        }));
+        sls_encoder.GetSlideCache().SetMemoryAccount(slide_cache_memory.get());
+    }
+
+    // slides compiled ahead of time; the slide IDs are still assigned here
+    if (!options.slide_bundle_file.empty()) {
+        History bundle_history;
+        size_t bundled = SlideStateFile(options.slide_bundle_file).Load(bundle_history, sls_encoder.GetSlideCache());
+        if (bundled > sls_encoder.GetSlideCache().Count()) {
+            fprintf(stderr, "ODR-PadEnc Warning: only %zu of the %zu slides of bundle '%s' fit into the slide cache\n",
+                    sls_encoder.GetSlideCache().Count(), bundled, options.slide_bundle_file.c_str());
+        }
+    }
+
+    // the state of the primary instance, so that receivers keep the slide IDs and see the label unchanged
+    if (replica) {
+        slide_state.SetReplicatedHistory(replica->GetEntries(), replica->GetLastGivenFidx());
+        if (replica->HasLabel())
+            dls_encoder.restoreState(replica->GetToggle(), replica->GetLabel());
+    }
+
+    // the position in a streamed slides dir, next to its state
+    const std::string slides_cursor_file = options.slide_state_file.empty() ? "" : options.slide_state_file + ".cursor";
+    if (options.SLSEnabled() && options.slide_lookahead > 0) {
+        slide_preparer.reset(new SlidePreparer(&sls_encoder, options.sls_dir, options.raw_slides, options.max_slide_size,
+                options.erase_after_tx, options.slide_history_len, options.slide_content_ids, options.slide_lookahead, std::chrono::seconds(std::max(options.slide_interval, 1)),
+                &slide_state, slides_reread_request, options.slides_window, slides_cursor_file, options.change_settle));
+    } else if (options.SLSEnabled()) {
+        slides.SetStreaming(options.slides_window, slides_cursor_file);
+        slides.SetContentHashing(options.slide_content_ids);
+        slides.SetSettle(options.change_settle);
+        slide_state.Load(slides.GetHistory(), sls_encoder.GetSlideCache());
+    }
+
+    // the slides dir's history, and that of the preparation thread
+    slide_history_memory.Update(History::allocated_bytes(options.slide_history_len) * (slide_preparer ? 2 : 1));
+
+    // the slide in transmission is sent again first, under the same ID, so that receivers complete it
+    if (replica && replica->HasCurrentSlide() && options.SLSEnabled()) {
+        const std::string filepath = options.sls_dir + "/" + replica->GetCurrentSlide().s_name;
+        if (access(filepath.c_str(), R_OK) == 0)
+            InjectSlide(injected_slide_t{filepath, false});
+    }
+
+    if (!options.replicate_to.empty()) {
+        replicator.reset(new StateReplicator(options.slide_history_len));
+        if (!replicator->Open(options.replicate_to))
+            throw std::runtime_error("cannot replicate the encoder state to '" + options.replicate_to + "'");
+
+        // the slide IDs given before this instance started
+        if (replica) {
+            replicator->Seed(replica->GetEntries(), replica->GetLastGivenFidx());
+        } else if (slide_state.Enabled()) {
+            History history(options.slide_history_len);
+            SlideCache no_cache(0);
+            SlideStateFile(options.slide_state_file).Load(history, no_cache);
+            replicator->Seed(history.get_entries(), history.get_last_given_fidx());
+        }
+    }
+}
+
+
+void PadEncoder::StartLabels(steady_clock::time_point now, const std::vector<std::string>& prev_dls_files) {
+    std::vector<RereadRequest*> prev_requests;
+    prev_requests.swap(dls_reread_requests);
+    dls_carousel = DLSCarousel();
+    dls_reread_coalescer.Clear();   // the indexes may have changed
+
+    for (size_t i = 0; i < options.dls_files.size(); i++) {
+        const std::string& dls_file = options.dls_files[i];
+        dls_carousel.Add(dls_file, i < options.dls_weights.size() ? options.dls_weights[i] : 1);
+
+        std::vector<std::string>::const_iterator prev = std::find(prev_dls_files.begin(), prev_dls_files.end(), dls_file);
+        if (prev != prev_dls_files.end() && prev_requests[prev - prev_dls_files.begin()]) {
+            dls_reread_requests.push_back(prev_requests[prev - prev_dls_files.begin()]);
+            prev_requests[prev - prev_dls_files.begin()] = nullptr;
+        } else {
+            dls_reread_requests.push_back(reread_watcher.Add("DLS file '" + dls_file + "'", dls_file + DLSEncoder::REQUEST_REREAD_SUFFIX));
+        }
+    }
+    // those of the DLS files no longer listed
+    for (RereadRequest* request : prev_requests)
+        if (request)
+            reread_watcher.Remove(request);
+    if (!options.DLSEnabled())
+        return;
+
+    dls_carousel.Start(now, std::chrono::seconds(options.label_interval));
+
+    // have the label files read ahead, so that storage stalls do not delay the PAD
+    FilePrefetcher& prefetcher = FilePrefetcher::Global();
+    dls_encoder.setFilePrefetcher(&prefetcher);
+    for (const std::string& dls_file : options.dls_files)
+        prefetcher.Watch(dls_file);
+    if (!options.item_state_file.empty())
+        prefetcher.Watch(options.item_state_file);
+
+    // keep the data groups of all rotating labels
+    dls_encoder.reserveTemplates(options.dls_files.size());
+
+    // have the other labels of the rotation built in the background meanwhile, so that each is ready when first due
+    for (const std::string& dls_file : options.dls_files)
+        if (dls_file != dls_carousel.Current())
+            dls_encoder.prefetchLabel(dls_file, options.item_state_file.empty() ? nullptr : options.item_state_file.c_str(), options.dl_params);
+}
+
+
+void PadEncoder::ApplyLiveOptions(const PadEncoderOptions& live) {
+    const steady_clock::time_point now = clock.Now();
+
+    // shorter intervals apply at once, not only after the pending one
+    options.slide_interval = live.slide_interval;
+    if (options.slide_interval > 0)
+        next_slide = std::min(next_slide, now + std::chrono::seconds(options.slide_interval));
+    options.label_insertion = live.label_insertion;
+    next_label_insertion = std::min(next_label_insertion, now + std::chrono::milliseconds(options.label_insertion));
+
+    options.xpad_interval = live.xpad_interval;
+    xpad_interval_counter %= options.xpad_interval;
+
+    if (live.max_slide_size != options.max_slide_size) {
+        options.max_slide_size = live.max_slide_size;
+        slide_size = options.adaptive_slide_size ? std::min(slide_size, options.max_slide_size) : options.max_slide_size;
+        if (slide_preparer)
+            slide_preparer->SetMaxSlideSize(slide_size);
+    }
+
+    if (live.label_interval != options.label_interval || live.dls_files != options.dls_files || live.dls_weights != options.dls_weights) {
+        const std::vector<std::string> prev_dls_files = options.dls_files;
+        options.label_interval = live.label_interval;
+        options.dls_files = live.dls_files;
+        options.dls_weights = live.dls_weights;
+        StartLabels(now, prev_dls_files);
+
+        ForceLabelInsertion(now);
+    }
+}
+
+
+void PadEncoder::SetPADLength(uint8_t padlen) {
+    options.padlen = padlen;
+    pad_packetizer.SetPADLength(padlen);
+    ApplySegmentLength();
+
+    // frames encoded ahead for the previous length can no longer be sent
+    DropAheadFrames("for the previous PAD length");
+    ahead_frames.resize(options.pad_lookahead * pad_packetizer.GetPADFrameSize());
+}
+
+
+void PadEncoder::DropAheadFrames(const char* reason) {
+    if (ahead_count == 0)
+        return;
+
+    fprintf(stderr, "ODR-PadEnc Warning: dropping %zu PAD frames encoded ahead %s\n", ahead_count, reason);
+    ahead_count = 0;
+
+    /* a DG continued in the next frame actually sent would be taken for the
+     * continuation of whatever DG the receiver was reassembling
+     */
+    size_t restarted = pad_packetizer.RestartDGs();
+    if (restarted && verbose)
+        fprintf(stderr, "ODR-PadEnc restarting %zu partly written DGs\n", restarted);
+}
+
+
+void PadEncoder::ApplySegmentLength() {
+    if (!options.SLSEnabled())
+        return;
+
+    size_t len = options.adaptive_segment_len ? SLSEncoder::OptimalSegmentLength(options.padlen) : options.segment_len;
+    if (len != sls_encoder.GetSegmentLength() && options.adaptive_segment_len)
+        fprintf(stderr, "ODR-PadEnc using MOT segments of %zu bytes\n", len);
+    sls_encoder.SetSegmentLength(len);
+}
+
+
+static LogSite slide_delayed_log("slide.delayed");
+static LogSite slide_visible_log("slide.visible", 0);
+static LogSite slide_failed_log("slide.failed");
+static LogSite slide_size_log("slide.size", 0);
+static LogSite label_skipped_log("dls.skipped");
+
+void PadEncoder::ReportSlideCompletion(LogSite& site, LogLevel level, const char* what) {
+    steady_clock::time_point now = clock.Now();
+    steady_clock::time_point completion;
+    const size_t queued = pad_packetizer.QueuedBytes(SLSEncoder::APPTYPE_MOT_START);
+    if (mot_throughput.Estimate(queued, now, completion)) {
+        const double seconds = std::chrono::duration<double>(completion - now).count();
+        PadLog::Global().Write(site, level, {{"queued_bytes", (long long) queued}, {"expected_ms", (long long) (seconds * 1000)}},
+                               "%s (expected in %.1f s)", what, seconds);
+    } else {
+        PadLog::Global().Write(site, level, {{"queued_bytes", (long long) queued}}, "%s", what);
+    }
+}
+
+void PadEncoder::AdaptSlideSize() {
+    /*! Limit the slides to the bytes that can be sent within the slide interval,
+     * keeping some margin for the MOT overhead. The size is rounded down to
+     * whole KiB, so that cached slides can be re-used as long as the
+     * throughput hardly changes.
+     */
+    const double bytes_per_second = mot_throughput.BytesPerSecond();
+    if (bytes_per_second == 0)
+        return;
+
+    size_t budget = (size_t) (bytes_per_second * options.slide_interval * 0.9) / 1024 * 1024;
+    budget = std::min(std::max(budget, MIN_ADAPTIVE_SLIDE_SIZE), options.max_slide_size);
+    if (budget == slide_size)
+        return;
+
+    slide_size = budget;
+    if (slide_preparer)
+        slide_preparer->SetMaxSlideSize(slide_size);
+    if (verbose)
+        PadLog::Global().Write(slide_size_log, LogLevel::INFO, {{"bytes", (long long) slide_size}},
+                               "limiting slides to %zu bytes (%.0f bytes/s)", slide_size, bytes_per_second);
+}
+
+void PadEncoder::DropSlideRepetition() {
+    // a partly sent DG is completed, anyway
+    if (slide_repeating)
+        pad_packetizer.DropDGs(SLSEncoder::APPTYPE_MOT_START);
+    slide_repeating = false;
+    pad_packetizer.DropFillDGs();
+}
+
+// of all services
+static MetricHistogram& slide_transmit_metric() {
+    static MetricHistogram& histogram = MetricsRegistry::Global().Histogram(
+            "odr_padenc_slide_transmit_seconds", "Time from queueing a slide until its last MOT segment is sent",
+            MetricHistogram::DURATION_BOUNDS);
+    return histogram;
+}
+
+std::function<void(bool)> PadEncoder::SlideDoneHandler(const std::string& filepath, const injected_slide_t* injected) {
+    const steady_clock::time_point queued = clock.Now();
+    const bool is_injected = injected;
+    const bool erase_injected = injected && injected->erase;
+    return [this, filepath, queued, is_injected, erase_injected](bool sent) {
+        if (sent) {
+            slide_transmit_metric().ObserveDuration(clock.Now() - queued);
+            if (!options.current_slide_dump_name.empty() && !options.completed_slide_dump_name.empty())
+                sls_encoder.GetDumper().Complete(options.current_slide_dump_name, options.completed_slide_dump_name);
+        }
+
+        // an injected slide is not sent again
+        if (is_injected) {
+            if (erase_injected && unlink(filepath.c_str()))
+                perror(("ODR-PadEnc Error: erasing file '" + filepath +"' failed").c_str());
+            return;
+        }
+
+        // a dropped slide stays, to be sent later
+        if (slide_preparer) {
+            slide_preparer->SlideDone(filepath, sent);
+        } else if (sent && options.erase_after_tx) {
+            if (unlink(filepath.c_str()))
+                perror(("ODR-PadEnc Error: erasing file '" + filepath +"' failed").c_str());
+        }
+    };
+}
+
+int PadEncoder::EncodeSlide() {
+    // delay insertion until the previous one is finished (unless just repeated)
+    if (!slide_repeating && pad_packetizer.QueueContainsDG(SLSEncoder::APPTYPE_MOT_START)) {
+        if (!slide_pending)
+            ReportSlideCompletion(slide_delayed_log, LogLevel::WARNING, "delaying slide insertion, as previous one still in transmission");
+        slide_pending = true;
+        return 0;
+    }
+
+    if (options.adaptive_slide_size)
+        AdaptSlideSize();
+
+    // take a slide prepared ahead, without waiting
+    if (slide_preparer) {
+        if (slide_preparer->Failed())
+            return 1;
+
+        prepared_slide_t slide;
+        injected_slide_t injected;
+        if (slide_preparer->GetInjectedSlide(slide, injected.erase)) {
+            DropSlideRepetition();
+            sls_encoder.queueSlide(slide, options.current_slide_dump_name, SlideDoneHandler(slide.filepath, &injected));
+            ReplicateSlide(slide.filepath, slide.fidx);
+            slide_pending = false;
+            return 0;
+        }
+        // the injected slides go first, even if still being prepared
+        if (slide_preparer->InjectedPending() > 0) {
+            slide_pending = true;
+            return 0;
+        }
+
+        slide_pending = !slide_preparer->GetSlide(slide);
+        if (!slide_pending) {
+            DropSlideRepetition();
+            sls_encoder.queueSlide(slide, options.current_slide_dump_name, SlideDoneHandler(slide.filepath));
+            ReplicateSlide(slide.filepath, slide.fidx);
+            if (verbose)
+                ReportSlideCompletion(slide_visible_log, LogLevel::INFO, "slide visible");
+        }
+        return 0;
+    }
+
+    slide_pending = false;
+
+    // injected slides go first
+    while (!injected_slides.empty()) {
+        injected_slide_t injected = injected_slides.front();
+        injected_slides.pop_front();
+
+        DropSlideRepetition();
+        int fidx = slides.GetHistory().get_fidx(injected.filepath.c_str());
+        if (sls_encoder.encodeSlide(injected.filepath, fidx, options.raw_slides, slide_size, options.current_slide_dump_name,
+                                    SlideDoneHandler(injected.filepath, &injected))) {
+            ReplicateSlide(injected.filepath, fidx);
+            slide_state.SaveIfChanged(slides.GetHistory(), sls_encoder.GetSlideCache());
+            return 0;
+        }
+        PadLog::Global().Write(slide_failed_log, LogLevel::ERROR, {{"slide", fidx}},
+                               "cannot encode injected file '%s'; skipping", injected.filepath.c_str());
+        if (injected.erase && unlink(injected.filepath.c_str()))
+            perror(("ODR-PadEnc Error: erasing file '" + injected.filepath +"' failed").c_str());
+    }
+
+    // check for slides dir re-read request
+    int reread = slides_reread_request->Check();
+    switch (reread) {
+    case 1:     // re-read requested
+        slides.RequestReread();
+        break;
+    case -1:    // error
+        return 1;
+    }
+    slides.TakeReread();
+
+    // usually invoked once
+    for (;;) {
+        // try to read slides dir (if present)
+        if (slides.Empty()) {
+            if (!slides.InitFromDir(options.sls_dir))
+                return 1;
+            slides_success = false;
+        }
+
+        // if slides available, encode the first one
+        if (!slides.Empty()) {
+            slide_metadata_t slide = slides.GetSlide();
+
+            DropSlideRepetition();
+            if (sls_encoder.encodeSlide(slide.filepath, slide.fidx, options.raw_slides, slide_size, options.current_slide_dump_name,
+                                        SlideDoneHandler(slide.filepath))) {
+                slides_success = true;
+                ReplicateSlide(slide.filepath, slide.fidx);
+                if (verbose)
+                    ReportSlideCompletion(slide_visible_log, LogLevel::INFO, "slide visible");
+                slide_state.SaveIfChanged(slides.GetHistory(), sls_encoder.GetSlideCache());
+            } else {
+                /* skip to next slide, except this is the last slide and so far
+                 * no slide worked, to prevent an infinite loop and because
+                 * re-reading the slides dir just moments later won't result in
+                 * a different amount of slides. */
+                bool skipping = !(slides.Empty() && !slides_success);
+                PadLog::Global().Write(slide_failed_log, LogLevel::ERROR, {{"slide", slide.fidx}},
+                                       "cannot encode file '%s'; %s", slide.filepath.c_str(), skipping ? "skipping" : "giving up for now");
+                if (skipping)
+                    continue;
+            }
+        }
+
+        break;
+    }
+
+    return 0;
+}
+
+// of all services
+static MetricCounter& frames_sent_metric() {
+    static MetricCounter& counter = MetricsRegistry::Global().Counter("odr_padenc_pad_frames_sent", "PAD frames handed to the audio encoder");
+    return counter;
+}
+
+static MetricHistogram& request_latency_metric() {
+    static MetricHistogram& histogram = MetricsRegistry::Global().Histogram(
+            "odr_padenc_request_latency_seconds", "Time from a PAD request over the socket until its frames are sent",
+            MetricHistogram::LATENCY_BOUNDS);
+    return histogram;
+}
+
+static MetricCounter& dls_skipped_metric() {
+    static MetricCounter& counter = MetricsRegistry::Global().Counter(
+            "odr_padenc_dls_insertions_skipped", "Label insertions skipped, as the previous label was still in transmission");
+    return counter;
+}
+
+bool PadEncoder::LabelFilesChanged(bool remember) {
+    const std::string* paths[2] = {&dls_carousel.Current(), options.item_state_file.empty() ? nullptr : &options.item_state_file};
+    bool changed = false;
+    for (size_t i = 0; i < 2; i++) {
+        FilePrefetcher::snapshot_t snapshot;
+        if (!paths[i])
+            continue;
+        if (!FilePrefetcher::Global().Get(*paths[i], snapshot)) {
+            snapshot.content.reset();
+            changed = true;
+        }
+        // a file read again has a new content
+        changed |= snapshot.content != label_contents[i];
+        if (remember)
+            label_contents[i] = snapshot.content;
+    }
+    return changed;
+}
+
+int PadEncoder::EncodeLabel() {
+    // skip insertion, if previous one not yet finished
+    if (pad_packetizer.QueueContainsDG(DLSEncoder::APPTYPE_START)) {
+        PadLog::Global().Write(label_skipped_log, LogLevel::WARNING, {{"queued_bytes", (long long) pad_packetizer.QueuedBytes(DLSEncoder::APPTYPE_START)}},
+                               "skipping label insertion, as previous one still in transmission!");
+        dls_skipped_metric().Add();
+    }
+    else if (label_injected) {
+        dls_encoder.encodeLabelContent(injected_label, options.dl_params, false);
+    }
+    else {
+        dls_encoder.encodeLabel(dls_carousel.Current(), options.item_state_file.empty() ? nullptr : options.item_state_file.c_str(), options.dl_params);
+    }
+
+    return 0;
+}
+
+
+bool PadEncoder::InjectLabel(const std::string& content, bool urgent) {
+    if (!options.DLSEnabled())
+        return false;
+
+    label_injected = true;
+    injected_label = content;
+    if (urgent) {
+        /* on air with the next requested frame: the frames encoded ahead are
+         * dropped (first, so that the label does not wait for a DG that was
+         * only started there)
+         */
+        DropAheadFrames("for an urgent label");
+        dls_encoder.encodeLabelContent(content, options.dl_params, true);
+    } else {
+        ForceLabelInsertion(clock.Now());
+    }
+    return true;
+}
+
+
+void PadEncoder::ReleaseLabel() {
+    if (!label_injected)
+        return;
+    label_injected = false;
+    ForceLabelInsertion(clock.Now());
+}
+
+
+bool PadEncoder::InjectSlides(const std::vector<injected_slide_t>& slides) {
+    if (!options.SLSEnabled())
+        return false;
+
+    if (slide_preparer)
+        slide_preparer->Inject(slides);
+    else
+        injected_slides.insert(injected_slides.end(), slides.begin(), slides.end());
+    next_slide = clock.Now();
+    return true;
+}
+
+
+bool PadEncoder::TriggerSlidesReread() {
+    if (!slides_reread_request)
+        return false;
+    reread_watcher.Trigger(slides_reread_request);
+    return true;
+}
+
+
+bool PadEncoder::TriggerLabelReread(size_t index) {
+    if (index >= options.dls_files.size() || index >= dls_reread_requests.size())
+        return false;
+    reread_watcher.Trigger(dls_reread_requests[index]);
+    return true;
+}
+
+
+int PadEncoder::Encode(PadInterface& intf, size_t frames) {
+    const steady_clock::time_point request_time = steady_clock::now();
+    deadlines.Begin();
+    const size_t frame_size = pad_packetizer.GetPADFrameSize();
+    const size_t header_len = frames > 1 ? PadInterface::BATCH_HEADER_LEN : PadInterface::MESSAGE_HEADER_LEN;
+
+    // only grows, so that the buffer is not re-allocated on every message
+    if (pad_frame.size() < header_len + frames * frame_size)
+        pad_frame.resize(header_len + frames * frame_size);
+
+    for (size_t i = 0; i < frames; i++) {
+        uint8_t* pad = &pad_frame[header_len + i * frame_size];
+        if (ahead_count > 0) {
+            memcpy(pad, &ahead_frames[ahead_first * frame_size], frame_size);
+            ahead_first = (ahead_first + 1) % options.pad_lookahead;
+            ahead_count--;
+        } else {
+            int result = EncodeFrame(pad);
+            if (result)
+                return result;
+        }
+    }
+
+    deadlines.Phase(FrameDeadlines::PHASE_PAD);   // incl. frames encoded ahead
+
+    if (frames > 1)
+        intf.send_pad_frames(pad_frame.data(), frame_size, frames);
+    else
+        intf.send_pad_frame(pad_frame.data(), frame_size);
+    deadlines.Phase(FrameDeadlines::PHASE_SEND);
+    deadlines.End(frames);
+    frames_sent_metric().Add(frames);
+    request_latency_metric().ObserveDuration(steady_clock::now() - request_time);
+
+    // encode the next frames now, so that the next request only has to send them
+    return FillAheadFrames();
+}
+
+
+int PadEncoder::FillAheadFrames() {
+    const size_t frame_size = pad_packetizer.GetPADFrameSize();
+
+    while (ahead_count < options.pad_lookahead) {
+        size_t slot = (ahead_first + ahead_count) % options.pad_lookahead;
+        int result = EncodeFrame(&ahead_frames[slot * frame_size]);
+        if (result)
+            return result;
+        ahead_count++;
+    }
+
+    return 0;
+}
+
+
+int PadEncoder::Encode(PadShmRing& ring) {
+    deadlines.Begin();
+
+    // written in place into the ring slot
+    uint8_t* pad = ring.frame_buffer();
+
+    int result = EncodeFrame(pad);
+    if (result)
+        return result;
+
+    ring.push_frame(pad_packetizer.GetPADFrameSize(), options.padlen);
+    deadlines.Phase(FrameDeadlines::PHASE_SEND);
+    deadlines.End(1);
+    frames_sent_metric().Add();
+    return 0;
+}
+
+
+int PadEncoder::Encode(uint8_t* pad) {
+    deadlines.Begin();
+    int result = EncodeFrame(pad);
+    if (!result)
+        deadlines.End(1);
+    return result;
+}
+
+
+int PadEncoder::GetNextPAD(uint8_t padlen, uint8_t* pad) {
+    if (padlen != options.padlen) {
+        if (!PADPacketizer::CheckPADLen(padlen))
+            return 2;
+        SetPADLength(padlen);
+    }
+
+    return Encode(pad);
+}
+
+
+void PadEncoder::DumpStats() {
+    const PAD_STATS& stats = pad_packetizer.GetStats();
+    const double capacity = std::max(stats.capacity_bytes, (size_t) 1);
+
+    size_t data_bytes = 0;
+    for (int app = 0; app < PAD_STATS::APPTYPES; app++)
+        data_bytes += stats.data_bytes[app];
+
+    std::string service = options.socket_ident.empty() ? "" : " (" + options.socket_ident + ")";
+    fprintf(stderr, "ODR-PadEnc stats%s: %zu frames (%zu w/o X-PAD), X-PAD used %.1f%% by data (%.1f%% background fill), %.1f%% by CIs, "
+            "%.1f%% by sub-field padding, max queue %zu DGs\n",
+            service.c_str(), stats.frames, stats.frames_without_xpad, 100 * data_bytes / capacity, 100 * stats.fill_bytes / capacity,
+            100 * stats.ci_bytes / capacity, 100 * stats.subfield_padding_bytes / capacity, stats.queued_dgs_max);
+
+    for (int app = 0; app < PAD_STATS::APPTYPES; app++) {
+        if (!stats.data_bytes[app])
+            continue;
+        const char* name = app == DLSEncoder::APPTYPE_START ? "DLS" :
+                app == SLSEncoder::APPTYPE_MOT_START ? "MOT" :
+                app == PADPacketizer::APPTYPE_DGLI ? "DGLI" : "other";
+        fprintf(stderr, "ODR-PadEnc stats%s:   app type %2d (%s): %.1f%% of X-PAD, %zu DGs sent, latency avg %.1f / max %zu frames\n",
+                service.c_str(), app, name, 100 * stats.data_bytes[app] / capacity, stats.dgs_sent[app],
+                stats.dgs_sent[app] ? (double) stats.latency_frames[app] / stats.dgs_sent[app] : 0.0, stats.latency_frames_max[app]);
+    }
+
+    // the timings are of the whole process, i.e. of all services
+    TimingSnapshot timing = Timings::Read(PADPacketizer::TIMING_WRITE_PAD.id);
+    const TimingSnapshot total = timing;
+    timing -= write_pad_timing;
+    write_pad_timing = total;
+    fprintf(stderr, "ODR-PadEnc stats%s:   writing a PAD took avg %.0f / p99 %.0f / max %.0f ns\n",
+            service.c_str(), timing.MeanNanoseconds(), timing.PercentileNanoseconds(99), timing.MaxNanoseconds());
+
+    TimingSnapshot requests = Timings::Read(FrameDeadlines::TIMING_REQUEST.id);
+    const TimingSnapshot requests_total = requests;
+    requests -= request_timing;
+    request_timing = requests_total;
+    fprintf(stderr, "ODR-PadEnc stats%s:   answering a request took avg %.3f / p99 %.3f / max %.3f ms, %zu of %llu over budget\n",
+            service.c_str(), requests.MeanNanoseconds() / 1e6, requests.PercentileNanoseconds(99) / 1e6, requests.MaxNanoseconds() / 1e6,
+            deadlines.OverBudget(), (unsigned long long) requests.count);
+    for (const FrameDeadlines::slow_request_t& slow_request : deadlines.SlowLog())
+        fprintf(stderr, "ODR-PadEnc stats%s:     %s\n", service.c_str(), FrameDeadlines::Describe(slow_request).c_str());
+    deadlines.ResetStats();
+    const WorkGovernor& governor = WorkGovernor::Global();
+    if (governor.Throttled() || governor.Paused())
+        fprintf(stderr, "ODR-PadEnc stats%s:   background work items throttled %zu / paused %zu times (process)\n",
+                service.c_str(), governor.Throttled(), governor.Paused());
+
+    // memory of this service, and of the process
+    std::string memory;
+    for (const MemoryBudget::account_stats_t& account : MemoryBudget::Global().Stats(options.socket_ident)) {
+        char text[128];
+        snprintf(text, sizeof(text), "%s%s %.1f", memory.empty() ? "" : ", ", account.name.c_str(), account.usage / 1024.0);
+        memory += text;
+        if (account.budget) {
+            snprintf(text, sizeof(text), " of %.1f", account.budget / 1024.0);
+            memory += text;
+        }
+        if (account.evicted) {
+            snprintf(text, sizeof(text), " (%.1f evicted)", account.evicted / 1024.0);
+            memory += text;
+        }
+    }
+    const size_t total_budget = MemoryBudget::Global().TotalBudget();
+    fprintf(stderr, "ODR-PadEnc stats%s:   memory in KiB: %s; process %.1f%s\n", service.c_str(), memory.c_str(),
+            MemoryBudget::Global().TotalUsage() / 1024.0,
+            total_budget ? (" of " + std::to_string(total_budget / 1024)).c_str() : "");
+
+    pad_packetizer.ResetStats();
+}
+
+
+const std::chrono::minutes PadEncoder::MAX_PLAN_DURATION(10);
+
+bool PadEncoder::PlanCapacity(const capacity_query_t& query, capacity_plan_t& plan) const {
+    const int padlen = query.padlen ? query.padlen : options.padlen;
+    const int xpad_interval = query.xpad_interval ? query.xpad_interval : options.xpad_interval;
+    if (!PADPacketizer::CheckPADLen(padlen) || xpad_interval < 1 || query.slide_size == 0)
+        return false;
+
+    steady_clock::duration frame_duration = mot_throughput.FrameDuration();
+    if (frame_duration == steady_clock::duration::zero())
+        frame_duration = std::chrono::milliseconds(options.simulation_frame_duration);
+
+    std::unique_ptr<PADPacketizer> dry = pad_packetizer.DryRunCopy();
+    dry->SetPADLength(padlen);
+    const size_t seglen = options.adaptive_segment_len ? SLSEncoder::OptimalSegmentLength(padlen) : sls_encoder.GetSegmentLength();
+    bool sent = false;
+    sls_encoder.queuePlannedSlide(dry.get(), query.slide_size, seglen, [&sent](bool done) {sent = done;});
+
+    // the frames as EncodeFrame() would write them, apart from new slides
+    const size_t max_frames = MAX_PLAN_DURATION / frame_duration;
+    std::vector<uint8_t> pad(dry->GetPADFrameSize());
+    steady_clock::duration until_label = next_label_insertion - clock.Now();
+    size_t xpad_counter = xpad_interval_counter % xpad_interval;
+    size_t frames = 0;
+    for (; !sent && frames < max_frames; frames++) {
+        if (options.DLSEnabled() && until_label <= steady_clock::duration::zero()) {
+            if (!dry->QueueContainsDG(DLSEncoder::APPTYPE_START))
+                dry->AddDGs(dls_encoder.labelDGs(dry.get(), query.dl_plus), true);
+            until_label += std::chrono::milliseconds(options.label_insertion);
+        }
+        dry->WriteNextPAD(xpad_counter == 0, &pad[0]);
+        xpad_counter = (xpad_counter + 1) % xpad_interval;
+        until_label -= frame_duration;
+    }
+
+    const PAD_STATS& stats = dry->GetStats();
+    plan.frames = frames;
+    plan.duration = std::chrono::duration_cast<std::chrono::milliseconds>(frames * frame_duration);
+    plan.label_bytes = stats.data_bytes[DLSEncoder::APPTYPE_START];
+    plan.capacity_bytes = stats.capacity_bytes;
+    return sent;
+}
+
+
+size_t PadEncoder::PlanMaxSlideSize(const capacity_query_t& query) const {
+    const size_t MAX_SIZE = 16 * 1024 * 1024;
+
+    // whether a slide of the size is sent in time
+    capacity_query_t slide_query = query;
+    auto fits = [&](size_t size) {
+        capacity_plan_t plan;
+        slide_query.slide_size = size;
+        return PlanCapacity(slide_query, plan) && plan.duration <= query.within;
+    };
+
+    // the sending time grows with the size, so the size that fits is bracketed, then bisected
+    size_t fitting = 0;
+    size_t too_large = 1024;
+    while (too_large <= MAX_SIZE && fits(too_large)) {
+        fitting = too_large;
+        too_large *= 2;
+    }
+    while (too_large - fitting > 1) {
+        const size_t size = fitting + (too_large - fitting) / 2;
+        if (fits(size))
+            fitting = size;
+        else
+            too_large = size;
+    }
+    return fitting;
+}
+
+
+void PadEncoder::UpdateMemoryUsage() {
+    data_groups_memory.Update(pad_packetizer.GetDataGroupPool().AllocatedBytes());
+#if HAVE_MAGICKWAND
+    // of the process, as ImageMagick's resources
+    static MemoryAccount imagemagick_memory("imagemagick", "", 0);
+    if (MagickWandPool::Global().Initialised())
+        imagemagick_memory.Update(MagickGetResource(MemoryResource));
+#endif
+}
+
+
+int PadEncoder::ProduceSlides(steady_clock::time_point now) {
+    int result = 0;
+    if (options.slide_interval > 0) {
+        // encode slides regularly
+        if (now >= next_slide) {
+            result = EncodeSlide();
+            next_slide += std::chrono::seconds(options.slide_interval);
+        } else if (slide_pending) {
+            // retry until the prepared slide is available
+            result = EncodeSlide();
+        }
+    } else {
+        // encode slide as soon as previous slide has been transmitted
+        if (!pad_packetizer.QueueContainsDG(SLSEncoder::APPTYPE_MOT_START))
+            result = EncodeSlide();
+    }
+
+    // use the X-PAD meanwhile to repeat the last slide
+    if (!result && options.mot_carousel && !pad_packetizer.QueueContainsDG(SLSEncoder::APPTYPE_MOT_START))
+        slide_repeating = sls_encoder.repeatSlide();
+    // and the X-PAD left unused otherwise
+    if (!result && options.idle_fill && !pad_packetizer.FillQueued())
+        sls_encoder.repeatSlide(true);
+    deadlines.Phase(FrameDeadlines::PHASE_SLIDE);
+    return result;
+}
+
+int PadEncoder::ProduceLabels(steady_clock::time_point now) {
+    // check for DLS re-read request (only if any request file may have appeared)
+    if (reread_watcher.MayBePending(dls_reread_generation)) {
+        for (size_t i = 0; i < options.dls_files.size(); i++) {
+            int reread = dls_reread_requests[i]->Check();
+            switch (reread) {
+            case 1:     // re-read requested
+                // the prefetched content may not be the requested one yet
+                FilePrefetcher::Global().Invalidate(options.dls_files[i]);
+                dls_reread_index = i;
+                dls_reread_coalescer.Note(now);
+                break;
+            case -1:    // error
+                return 1;
+            }
+        }
+    }
+    // once the requests settled, switch to the last requested DLS file
+    if (dls_reread_coalescer.TakeDue(now)) {
+        label_injected = false;
+        dls_carousel.Select(dls_reread_index, now);
+        ForceLabelInsertion(now);
+    }
+    deadlines.Phase(FrameDeadlines::PHASE_REREAD);
+
+    // have the next label of the rotation ready shortly before it is due
+    if (dls_carousel.Count() > 1 && !label_injected &&
+            dls_carousel.NextSwitch() != label_prefetched_for && dls_carousel.NextSwitch() - now <= LABEL_PREFETCH_LEAD) {
+        label_prefetched_for = dls_carousel.NextSwitch();
+        dls_encoder.prefetchLabel(dls_carousel.Next(), options.item_state_file.empty() ? nullptr : options.item_state_file.c_str(), options.dl_params);
+    }
+
+    if (dls_carousel.Advance(now))
+        ForceLabelInsertion(now);
+
+    int result = 0;
+    if (now >= next_label_insertion) {
+        // while backed off, a label is only inserted if it may have changed
+        if (!options.adaptive_label_insertion || now >= label_backoff_end || (!label_injected && LabelFilesChanged(false))) {
+            // encode label (the files as before, so that a change meanwhile is noticed)
+            const bool toggle = dls_encoder.getToggle();
+            if (options.adaptive_label_insertion)
+                LabelFilesChanged(true);
+            result = EncodeLabel();
+            if (options.adaptive_label_insertion)
+                label_backoff_end = now + label_insertion_policy.Next(std::chrono::milliseconds(options.label_insertion),
+                        dls_encoder.getToggle() != toggle, pad_packetizer.QueueContainsDG(SLSEncoder::APPTYPE_MOT_START));
+        }
+        next_label_insertion += std::chrono::milliseconds(options.label_insertion);
+    }
+    deadlines.Phase(FrameDeadlines::PHASE_LABEL);
+    return result;
+}
+
+void PadEncoder::EmitPAD(steady_clock::time_point now, uint8_t* pad) {
+    // flush one PAD (considering X-PAD output interval), measuring the slide throughput
+    size_t mot_bytes = pad_packetizer.QueuedBytes(SLSEncoder::APPTYPE_MOT_START);
+    pad_packetizer.WriteNextPAD(xpad_interval_counter == 0, pad);
+    mot_throughput.Update(now, mot_bytes - pad_packetizer.QueuedBytes(SLSEncoder::APPTYPE_MOT_START), mot_bytes > 0);
+
+    // update X-PAD output interval counter
+    xpad_interval_counter = (xpad_interval_counter + 1) % options.xpad_interval;
+}
+
+void PadEncoder::Housekeeping(steady_clock::time_point now) {
+    if (now >= next_memory_update) {
+        UpdateMemoryUsage();
+        next_memory_update = now + std::chrono::seconds(1);
+    }
+    if (options.stats_interval > 0 && now >= next_stats_dump) {
+        DumpStats();
+        next_stats_dump += std::chrono::seconds(options.stats_interval);
+    }
+    deadlines.Phase(FrameDeadlines::PHASE_PAD);
+
+    // the label last sent, and a heartbeat, for the standby
+    if (replicator) {
+        if (options.DLSEnabled())
+            replicator->LabelSent(dls_encoder.getToggle(), dls_encoder.getState());
+        replicator->Tick(steady_clock::now());
+    }
+}
+
+int PadEncoder::EncodeFrame(uint8_t* pad) {
+    // options published meanwhile
+    if (live_options) {
+        std::shared_ptr<const PadEncoderOptions> live = live_options->GetIfChanged(live_options_version);
+        if (live)
+            ApplyLiveOptions(*live);
+    }
+
+    const steady_clock::time_point pad_timeline = clock.Now();
+
+    // the producers only queue DGs (or pick up what was prepared in the background), never blocking the frame
+    int result = options.SLSEnabled() ? ProduceSlides(pad_timeline) : 0;
+    if (!result && options.DLSEnabled())
+        result = ProduceLabels(pad_timeline);
+    if (result)
+        return result;
+
+    EmitPAD(pad_timeline, pad);
+    Housekeeping(pad_timeline);
+    return 0;
+}
+
+
+// --- PadFanOut -----------------------------------------------------------------
+const size_t PadFanOut::HISTORY_FRAMES = 250;  // 6 s of 24 ms frames
+
+PadFanOut::PadFanOut(size_t peers) :
+        cursors(peers, 0),
+        produced(0),
+        oldest(0),
+        frame_size(0)
+{}
+
+int PadFanOut::Encode(PadEncoder& encoder, size_t peer, PadInterface& intf, size_t frames) {
+    const steady_clock::time_point request_time = steady_clock::now();
+
+    // after a PAD length change, the kept frames can no longer be sent
+    if (encoder.GetPADFrameSize() != frame_size) {
+        frame_size = encoder.GetPADFrameSize();
+        history.assign(HISTORY_FRAMES * frame_size, 0);
+        oldest = produced;
+        std::fill(cursors.begin(), cursors.end(), produced);
+    }
+
+    uint64_t& cursor = cursors[peer];
+    if (cursor < oldest) {
+        fprintf(stderr, "ODR-PadEnc Warning: audio encoder %zu lagged %llu frames behind the others, "
+                "continuing with the next new frame\n", peer, (unsigned long long) (produced - cursor));
+        cursor = produced;
+    }
+
+    const size_t header_len = frames > 1 ? PadInterface::BATCH_HEADER_LEN : PadInterface::MESSAGE_HEADER_LEN;
+    if (message.size() < header_len + frames * frame_size)
+        message.resize(header_len + frames * frame_size);
+
+    for (size_t i = 0; i < frames; i++, cursor++) {
+        if (cursor == produced) {
+            int result = encoder.Encode(&history[(produced % HISTORY_FRAMES) * frame_size]);
+            if (result)
+                return result;
+            produced++;
+            oldest = std::max(oldest, produced > HISTORY_FRAMES ? produced - HISTORY_FRAMES : 0);
+        }
+        memcpy(&message[header_len + i * frame_size], &history[(cursor % HISTORY_FRAMES) * frame_size], frame_size);
+    }
+
+    if (frames > 1)
+        intf.send_pad_frames(message.data(), frame_size, frames);
+    else
+        intf.send_pad_frame(message.data(), frame_size);
+    frames_sent_metric().Add(frames);
+    request_latency_metric().ObserveDuration(steady_clock::now() - request_time);
+    return 0;
+}
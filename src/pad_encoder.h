@@ -0,0 +1,450 @@
+/*
+    Copyright (C) 2014 CSP Innovazione nelle ICT s.c.a r.l. (http://rd.csp.it/)
+
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file pad_encoder.h
+    \brief The PAD encoder of a service, usable in-process (see odrpadenc.h)
+
+    \author Sergio Sagliocco <sergio.sagliocco@csp.it>
+    \author Matthias P. Braendli <matthias@mpb.li>
+    \author Stefan Pöschel <odr@basicmaster.de>
+*/
+
+#ifndef PAD_ENCODER_H_
+#define PAD_ENCODER_H_
+
+#include "common.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pad_interface.h"
+#include "pad_shm.h"
+#include "pad_common.h"
+#include "dls.h"
+#include "sls.h"
+#include "log.h"
+#include "memory_budget.h"
+#include "reactor.h"
+#include "replication.h"
+#include "reread_watcher.h"
+#include "timing.h"
+
+using std::chrono::steady_clock;
+
+
+// --- capacity_query_t -----------------------------------------------------------------
+/*! A what-if question about the X-PAD capacity of a service (see
+ * PadEncoder::PlanCapacity()), e.g. to size its PAD when planning a multiplex.
+ */
+struct capacity_query_t {
+    int padlen = 0;             // 0: the current one
+    int xpad_interval = 0;      // 0: the current one
+    size_t slide_size = 0;      // bytes of a slide (MOT body) queued behind the data queued now
+    int dl_plus = -1;           // the label with (1) or without (0) DL Plus; -1: as sent
+    std::chrono::milliseconds within{0};    // instead of a slide size: find the largest slide sent within this time
+
+    /*! takes over e.g. "pad=34,xpad-interval=2,slide=12000" or
+     *  "pad=34,within=10" (seconds), optionally with "dl-plus=0/1"; false,
+     *  if invalid or not exactly one of slide and within is given
+     */
+    bool Parse(const std::string& spec);
+};
+
+// the answer to a capacity_query_t for a slide size
+struct capacity_plan_t {
+    size_t frames = 0;          // until the slide has been sent
+    std::chrono::milliseconds duration{0};
+    size_t label_bytes = 0;     // X-PAD used by labels meanwhile
+    size_t capacity_bytes = 0;  // X-PAD available meanwhile
+};
+
+
+// --- PadEncoderOptions -----------------------------------------------------------------
+struct PadEncoderOptions {
+    static const int NUMA_PEER = -2;
+
+    uint8_t padlen = 0;
+    bool erase_after_tx = false;
+    int slide_interval = 10;
+    int label_interval = 12;    // uniform PAD encoder only
+    int label_insertion = 1200; // uniform PAD encoder only
+    bool adaptive_label_insertion = false;  // back off while unchanged and slides are sent
+    int xpad_interval = 1;      // uniform PAD encoder only
+    bool lookahead_packing = false;
+    int dls_share = 0;          // percent of the X-PAD; 0: DLS before anything else
+    int stats_interval = 0;     // seconds between X-PAD usage dumps; 0: none
+    int frame_budget = 10;      // milliseconds from a PAD request until its frames are sent; 0: no overrun alarms
+    size_t max_slide_size = SLSEncoder::MAXSLIDESIZE_SIMPLE;
+    bool adaptive_slide_size = false;   // limit slides further to what can be sent within the slide interval
+    size_t segment_len = SLSEncoder::MAXSEGLEN;
+    bool adaptive_segment_len = false;  // choose the segment length by the PAD length
+    bool mot_carousel = false;  // repeat the last slide until the next one
+    bool idle_fill = false;     // repeat the last slide as background fill (only in X-PAD unused otherwise)
+    size_t header_repetition = 0;   // body segments between MOT header repetitions; 0: none
+    std::vector<int> header_positions;  // body segments to repeat the MOT header before (negative: from the end)
+    size_t mot_directory = 0;   // slides in the MOT directory; 0: MOT header mode
+    size_t mot_directory_resend = 4;    // in MOT directory mode, an unchanged slide's body is sent every so many times
+    bool raw_slides = false;
+    size_t slide_cache_size = SlideCache::DEFAULT_MAX_SIZE;
+    int slide_similarity = -1;  // max difference hash distance of images considered the same; -1: exact content only
+    bool slide_candidates = false;  // try PNG for each resized slide, next to JPEG
+    std::string slide_store_dir;    // shared with other instances; empty: none
+    std::string slide_spill_dir;    // for the slides evicted from the slide cache; empty: none
+    size_t slide_spill_size = SlideSpill::DEFAULT_SIZE;
+    std::string slide_bundle_file;  // compiled by odr-padenc-bundle; empty: none
+    size_t slide_lookahead = 2;
+    size_t slide_history_len = History::MAXHISTORYLEN;
+    bool slide_content_ids = false;     // a slide copied again unchanged keeps its ID (by its content hash)
+    size_t slides_window = 0;   // slides taken from the slides dir per cycle; 0: all
+    change_settle_t change_settle;  // of bursts of slide changes and reread requests
+    DL_PARAMS dl_params;
+
+    std::string sls_dir;
+    std::string socket_ident;
+    std::vector<std::string> mirror_idents;     // further audio encoders, served with the same frames
+    std::vector<std::string> dls_files;
+    std::vector<int> dls_weights;   // per DLS file
+    std::string item_state_file;
+    std::vector<std::string> dl_plus_formats;
+    std::string current_slide_dump_name;
+    std::string completed_slide_dump_name;
+    std::string slide_state_file;
+    int numa_node = -1;         // to run on; -1: any, NUMA_PEER: the one of the audio encoder
+    size_t shm_frames = 0;      // 0: use the socket
+    size_t pad_lookahead = 0;   // socket only
+    int simulation = 0;         // seconds of PAD to encode in virtual time, without audio encoder; 0: none
+    uint8_t simulation_padlen = 58;
+    int simulation_frame_duration = 24; // milliseconds
+    std::string simulation_output;      // file to write the simulated frames to; empty: none
+    std::vector<capacity_query_t> capacity_queries;     // answered after the simulation
+    std::string live_config_file;       // settings to (re-)load on SIGHUP; empty: none
+    std::string control_socket;         // to inject labels and slides; empty: none
+    std::string replicate_to;           // standby instance (HOST:PORT) to stream the encoder state to; empty: none
+
+    bool DLSEnabled() const { return !dls_files.empty(); }
+    bool SLSEnabled() const { return !sls_dir.empty(); }
+};
+
+// reads the settings of a live config file (see --live-config) into the options; prints the first error
+bool read_live_config(const std::string& path, PadEncoderOptions& options);
+// checks the options that a live config may change; prints the first error
+bool check_live_options(const PadEncoderOptions& options);
+
+
+// --- LiveOptions -----------------------------------------------------------------
+/*! The options of a service that can change while it is encoding (see
+ * --live-config). Each change is published as a new immutable snapshot,
+ * which the encoder takes over at its next frame - keeping its queued data
+ * groups, slide cache and history.
+ */
+class LiveOptions {
+private:
+    std::shared_ptr<const PadEncoderOptions> options;
+    std::atomic<unsigned int> version;
+public:
+    LiveOptions() : version(0) {}
+    LiveOptions(const LiveOptions&) = delete;
+    LiveOptions& operator=(const LiveOptions&) = delete;
+
+    // from any thread
+    void Publish(std::shared_ptr<const PadEncoderOptions> options);
+    // the latest snapshot, if published since seen_version (initially 0); else none
+    std::shared_ptr<const PadEncoderOptions> GetIfChanged(unsigned int& seen_version) const;
+};
+
+
+// --- PadClock -----------------------------------------------------------------
+/*! The time that slides and labels are scheduled by; the steady clock by default.
+ */
+class PadClock {
+public:
+    virtual ~PadClock() {}
+    virtual steady_clock::time_point Now() const {return steady_clock::now();}
+};
+
+/*! A clock that only advances when told to, e.g. by one frame duration per
+ * encoded frame. So hours of PAD can be encoded in seconds, with the same
+ * result on every run.
+ */
+class VirtualPadClock : public PadClock {
+private:
+    steady_clock::time_point now;
+public:
+    VirtualPadClock() : now(steady_clock::time_point()) {}
+    steady_clock::time_point Now() const {return now;}
+    void Advance(steady_clock::duration duration) {now += duration;}
+};
+
+
+// --- FrameDeadlines -----------------------------------------------------------------
+/*! Measures the time from a PAD request until its frames are sent, split
+ * into the phases of the encoding. Requests over the budget are counted and
+ * kept in a rolling log with their time per phase, so that an overrun can be
+ * attributed. A measurement only takes a few time stamp counter reads.
+ */
+class FrameDeadlines {
+public:
+    enum phase_t {PHASE_SLIDE, PHASE_REREAD, PHASE_LABEL, PHASE_PAD, PHASE_SEND, PHASES};
+    static const char* PHASE_NAMES[PHASES];
+    static const size_t SLOW_LOG_LEN = 8;
+    static const TimingOperation TIMING_REQUEST;    // of all encoders
+
+    struct slow_request_t {
+        size_t request;     // counted since the start
+        size_t frames;
+        double total_ms;
+        double phase_ms[PHASES];
+    };
+
+    // 0: no budget
+    explicit FrameDeadlines(int budget_ms);
+
+    void Begin() {
+        start = last = TimingClock::Now();
+        std::fill(phase_ticks, phase_ticks + PHASES, 0);
+    }
+    // the time since the previous phase (or the begin) is attributed to this one
+    void Phase(phase_t phase) {
+        const uint64_t now = TimingClock::Now();
+        phase_ticks[phase] += now - last;
+        last = now;
+    }
+    // true, if the request was over budget
+    bool End(size_t frames);
+
+    size_t OverBudget() const {return over_budget;}
+    const std::deque<slow_request_t>& SlowLog() const {return slow_log;}
+    static std::string Describe(const slow_request_t& slow_request);
+    // for the next stats interval
+    void ResetStats();
+
+private:
+    const int budget_ms;
+    uint64_t budget_ticks;
+    double ns_per_tick;
+    uint64_t start;
+    uint64_t last;
+    uint64_t phase_ticks[PHASES];
+    size_t requests;
+    size_t over_budget;
+    LogSite warning_log;    // at most one warning every 10 seconds
+    std::deque<slow_request_t> slow_log;
+};
+
+
+// --- LabelInsertionPolicy -----------------------------------------------------------------
+/*! The time until the current label is inserted again (see
+ * --adaptive-label-ins): the label insertion interval right after a change,
+ * for a fast acquisition, and twice as long after each unchanged insertion
+ * (up to MAX_BACKOFF doublings) - but only while the X-PAD is loaded with a
+ * slide, as it would be unused otherwise.
+ */
+class LabelInsertionPolicy {
+public:
+    static const int MAX_BACKOFF;
+
+    LabelInsertionPolicy() : backoff(0) {}
+    steady_clock::duration Next(steady_clock::duration interval, bool changed, bool loaded);
+    int Backoff() const {return backoff;}
+private:
+    int backoff;    // doublings
+};
+
+
+// --- PadEncoder -----------------------------------------------------------------
+class PadEncoder {
+protected:
+    static const size_t MIN_ADAPTIVE_SLIDE_SIZE;
+    static const steady_clock::duration LABEL_PREFETCH_LEAD;
+
+    static const PadClock STEADY_CLOCK;
+
+    PadEncoderOptions options;
+    const PadClock& clock;
+    // memory of the caches and queues; before them, so that they are destroyed first
+    MemoryAccount data_groups_memory;
+    MemoryAccount slide_history_memory;
+    std::unique_ptr<MemoryAccount> slide_cache_memory;  // if the cache is enabled
+    PADPacketizer pad_packetizer;
+    DLSEncoder dls_encoder;
+    SLSEncoder sls_encoder;
+    SlideStateFile slide_state;
+    RereadWatcher reread_watcher;
+    RereadRequest* slides_reread_request;
+    std::vector<RereadRequest*> dls_reread_requests;
+    unsigned int dls_reread_generation;
+    ChangeCoalescer dls_reread_coalescer;
+    size_t dls_reread_index;    // of the DLS file requested last
+    SlideStore slides;
+    std::unique_ptr<SlidePreparer> slide_preparer;   // if slides are prepared ahead
+    bool slides_success;
+    bool slide_pending;         // slide insertion waits for a prepared slide or the previous slide's completion
+    PADThroughputEstimator mot_throughput;
+    size_t slide_size;          // max slide size currently applied
+    bool slide_repeating;       // the queued MOT DGs only repeat the last slide
+    DLSCarousel dls_carousel;
+    steady_clock::time_point label_prefetched_for;  // the switch the next label was prefetched for
+    LabelInsertionPolicy label_insertion_policy;
+    steady_clock::time_point label_backoff_end;     // of the adaptive label insertion
+    std::shared_ptr<const std::string> label_contents[2];   // of the DLS and item state file, at the last insertion
+    steady_clock::time_point next_slide;
+    steady_clock::time_point next_label_insertion;
+    steady_clock::time_point next_stats_dump;
+    steady_clock::time_point next_memory_update;
+    TimingSnapshot write_pad_timing;    // at the last stats dump
+    TimingSnapshot request_timing;      // at the last stats dump
+    FrameDeadlines deadlines;
+    size_t xpad_interval_counter;
+    std::vector<uint8_t> pad_frame;     // reused for every message, incl. the socket message header
+    std::vector<uint8_t> ahead_frames;  // ring of frames encoded before they were requested
+    size_t ahead_first;
+    size_t ahead_count;
+    LiveOptions* live_options;
+    unsigned int live_options_version;
+    bool label_injected;        // the injected label is shown instead of the DLS files
+    std::string injected_label;
+    std::deque<injected_slide_t> injected_slides;   // if not prepared ahead
+    std::unique_ptr<StateReplicator> replicator;    // if replicating to a standby
+
+    int EncodeSlide();
+    void ReportSlideCompletion(LogSite& site, LogLevel level, const char* what);
+    void AdaptSlideSize();
+    void ApplySegmentLength();
+    // drops the frames encoded ahead, restarting the DGs written there (none of them went on air)
+    void DropAheadFrames(const char* reason);
+    void DropSlideRepetition();
+    // for a queued slide: completes its dump and erases it (if requested), once sent
+    std::function<void(bool)> SlideDoneHandler(const std::string& filepath, const injected_slide_t* injected = nullptr);
+    void ReplicateSlide(const std::string& filepath, int fidx) {if (replicator) replicator->SlideQueued(filepath, fidx);}
+    // (re)starts the label rotation; the re-read requests of the previous DLS files still listed are kept, the others removed
+    void StartLabels(steady_clock::time_point now, const std::vector<std::string>& prev_dls_files);
+    // inserts the label at the next frame, regardless of any back-off
+    void ForceLabelInsertion(steady_clock::time_point now) {next_label_insertion = label_backoff_end = now;}
+    /*! whether the files of the current label changed since their content
+     *  was remembered (or are not prefetched); remember: takes their current content
+     */
+    bool LabelFilesChanged(bool remember);
+    void ApplyLiveOptions(const PadEncoderOptions& live);
+    int EncodeLabel();
+    /*! The stages of a frame, in this order: the slide and label producers
+     *  queue the DGs due (picking up what was prepared or prefetched in the
+     *  background meanwhile), EmitPAD writes the frame and Housekeeping does
+     *  the periodic tasks. A producer result other than 0 ends the frame.
+     */
+    int ProduceSlides(steady_clock::time_point now);
+    int ProduceLabels(steady_clock::time_point now);
+    void EmitPAD(steady_clock::time_point now, uint8_t* pad);
+    void Housekeeping(steady_clock::time_point now);
+    int EncodeFrame(uint8_t* pad);
+    void UpdateMemoryUsage();
+    int FillAheadFrames();
+
+public:
+    /*! With the given clock, which must outlive the encoder; else the steady
+     *  clock. The re-read request files are watched by means of the reactor
+     *  (which must outlive the encoder, too), if any. A standby taking over
+     *  continues with the state replicated from the primary instance.
+     */
+    PadEncoder(PadEncoderOptions options, const PadClock* clock = nullptr, Reactor* reactor = nullptr,
+               const EncoderReplica* replica = nullptr);
+    virtual ~PadEncoder() {}
+
+    // answers a request for the given number of frames
+    int Encode(PadInterface& intf, size_t frames = 1);
+    // adds one frame to the shared memory ring
+    int Encode(PadShmRing& ring);
+    // writes one frame of GetPADFrameSize() bytes, without audio encoder (simulation)
+    int Encode(uint8_t* pad);
+    size_t GetPADFrameSize() const {return pad_packetizer.GetPADFrameSize();}
+    /*! writes the next frame for the given PAD length (switching to it, if
+     *  needed) - the PAD followed by the used PAD length, as handed to the audio
+     *  encoder, so padlen + 1 bytes; 2, if the PAD length is not supported
+     */
+    int GetNextPAD(uint8_t padlen, uint8_t* pad);
+    // switches to another PAD length, continuing the current transmissions
+    void SetPADLength(uint8_t padlen);
+    /*! takes over the interval, max slide size and DLS file settings of each
+     *  snapshot published there (which must outlive the encoder)
+     */
+    void SetLiveOptions(LiveOptions* live_options) {this->live_options = live_options;}
+    // prints the X-PAD usage since the last dump
+    void DumpStats();
+
+    static const std::chrono::minutes MAX_PLAN_DURATION;
+    /*! answers the query for its slide size by replaying instead of estimating:
+     *  a dry-run copy of the packetizer (see PADPacketizer::DryRunCopy) writes
+     *  the data queued now and the slide behind it at the query's PAD length and
+     *  X-PAD interval, inserting the current label every label-ins ms, in frames
+     *  of the measured duration (of the simulated one, until measured); false,
+     *  if the query is invalid or the slide is not sent within MAX_PLAN_DURATION
+     */
+    bool PlanCapacity(const capacity_query_t& query, capacity_plan_t& plan) const;
+    // the largest slide sent within the query's time, replaying as above; 0, if none
+    size_t PlanMaxSlideSize(const capacity_query_t& query) const;
+
+    /*! shows the label (given like the content of a DLS file) instead of the
+     *  DLS files until released or a DLS re-read request; an urgent label
+     *  interrupts any other PAD data at once, dropping the frames encoded
+     *  ahead (see pad_lookahead). False, if DLS is disabled.
+     */
+    bool InjectLabel(const std::string& content, bool urgent);
+    void ReleaseLabel();
+    // sends the slide next, once the current slide is sent; false, if SLS is disabled
+    bool InjectSlide(const injected_slide_t& slide) {return InjectSlides(std::vector<injected_slide_t>(1, slide));}
+    // as above, for several slides in order (prepared on several threads at once)
+    bool InjectSlides(const std::vector<injected_slide_t>& slides);
+    // act like the re-read request files; false, if the file is not used
+    bool TriggerSlidesReread();
+    bool TriggerLabelReread(size_t index);
+};
+
+
+// --- PadFanOut -----------------------------------------------------------------
+/*! Serves several audio encoders (e.g. the main and backup chains of a
+ * service) with the frames of one encoder: the n-th frame requested by each
+ * peer is the encoder's n-th frame, so that the chains carry bit-identical
+ * PAD. A frame is encoded when the first peer requests it and kept for the
+ * others for up to HISTORY_FRAMES frames; a peer lagging further behind (e.g.
+ * after a restart) continues with the next new frame.
+ */
+class PadFanOut {
+private:
+    std::vector<uint64_t> cursors;  // per peer: the number of its next frame
+    uint64_t produced;              // frames encoded so far
+    uint64_t oldest;                // number of the oldest frame still kept
+    size_t frame_size;              // of the kept frames; changes with the PAD length
+    std::vector<uint8_t> history;   // ring of the last frames
+    std::vector<uint8_t> message;   // reused for every message, incl. the message header
+public:
+    static const size_t HISTORY_FRAMES;
+
+    explicit PadFanOut(size_t peers);
+
+    // answers a request of the peer for the given number of frames
+    int Encode(PadEncoder& encoder, size_t peer, PadInterface& intf, size_t frames = 1);
+};
+
+#endif /* PAD_ENCODER_H_ */
@@ -18,26 +18,56 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
-#include "config.h"
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
 #include "pad_interface.h"
+#include "log.h"
+#include "trace.h"
 #include <stdexcept>
 #include <sstream>
 #include <cstring>
 #include <cerrno>
+#include <cstdlib>
 #include <cassert>
+#include <algorithm>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
+#include <netinet/in.h>
+#include <netdb.h>
 #include <unistd.h>
 #include <poll.h>
 
-#define MESSAGE_REQUEST 1
-#define MESSAGE_PAD_DATA 2
+/* Messages (each one datagram):
+ *   request:         MESSAGE_REQUEST, padlen [, frames]
+ *   PAD data:        MESSAGE_PAD_DATA, PAD
+ *   batch PAD data:  MESSAGE_PAD_DATA_BATCH, frames, PAD * frames
+ *
+ * The frame count is optional, so that audio encoders which request one
+ * frame at a time are served with the original PAD data message.
+ *
+ * Over UDP, a request also carries a sequence number (SEQUENCE_LEN bytes,
+ * echoed as they are), which precedes the answer, so that the requester can
+ * tell late, lost or reordered answers:
+ *   request:         MESSAGE_REQUEST, padlen, frames, sequence
+ *   (batch) PAD data: sequence, (batch) PAD data message as above
+ */
 
 using namespace std;
 
+static LogSite unreachable_log("pad.unreachable", 0);
+static LogSite send_failed_log("pad.send_failed");
+
+const std::string PadInterface::UDP_PREFIX = "udp:";
+
 void PadInterface::open(const std::string &pad_ident)
 {
     m_pad_ident = pad_ident;
+    if (is_udp_ident(pad_ident)) {
+        open_udp(pad_ident.substr(UDP_PREFIX.size()));
+        return;
+    }
 
     m_sock = socket(AF_UNIX, SOCK_DGRAM, 0);
     if (m_sock == -1) {
@@ -58,65 +88,225 @@ void PadInterface::open(const std::string &pad_ident)
     }
 }
 
+int PadInterface::bind_udp(const std::string &port, const std::string &what)
+{
+    char *end;
+    long port_no = strtol(port.c_str(), &end, 10);
+    if (port.empty() or *end or port_no < 1 or port_no > 65535) {
+        throw runtime_error(what + " UDP port '" + port + "' invalid");
+    }
+
+    // dual stack if available, so that IPv4 peers are served, too
+    int ret;
+    int sock = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (sock != -1) {
+        int v6only = 0;
+        setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+
+        struct sockaddr_in6 addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin6_family = AF_INET6;
+        addr.sin6_addr = in6addr_any;
+        addr.sin6_port = htons(port_no);
+        ret = bind(sock, (const struct sockaddr *) &addr, sizeof(addr));
+    }
+    else {
+        sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sock == -1) {
+            throw runtime_error(what + " UDP socket creation failed: " + string(strerror(errno)));
+        }
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port_no);
+        ret = bind(sock, (const struct sockaddr *) &addr, sizeof(addr));
+    }
+    if (ret == -1) {
+        throw runtime_error(what + " UDP socket bind to port " + port + " failed: " + string(strerror(errno)));
+    }
+    return sock;
+}
+
+int PadInterface::connect_udp(const std::string &host_port, const std::string &what)
+{
+    size_t separator = host_port.rfind(':');
+    if (separator == string::npos or separator == 0) {
+        fprintf(stderr, "ODR-PadEnc Error: %s '%s' is not of the form HOST:PORT\n", what.c_str(), host_port.c_str());
+        return -1;
+    }
+    string host = host_port.substr(0, separator);
+    const string port = host_port.substr(separator + 1);
+    if (host.size() > 2 and host.front() == '[' and host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo* addrs;
+    int error = getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs);
+    if (error) {
+        fprintf(stderr, "ODR-PadEnc Error: resolving %s '%s' failed: %s\n", what.c_str(), host_port.c_str(), gai_strerror(error));
+        return -1;
+    }
+
+    int sock = -1;
+    for (struct addrinfo* addr = addrs; addr; addr = addr->ai_next) {
+        sock = socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC, addr->ai_protocol);
+        if (sock == -1)
+            continue;
+        if (connect(sock, addr->ai_addr, addr->ai_addrlen) == 0)
+            break;
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(addrs);
+
+    if (sock == -1)
+        perror(("ODR-PadEnc Error: connecting to " + what + " '" + host_port + "' failed").c_str());
+    return sock;
+}
+
+void PadInterface::open_udp(const std::string &port)
+{
+    m_sock = bind_udp(port, "PAD");
+
+    // a batch of frames may take some 50 kB
+    int sndbuf = 256 * 1024;
+    setsockopt(m_sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    m_udp = true;
+}
+
 uint8_t PadInterface::receive_request()
 {
+    size_t frames;
+    return receive_request(frames);
+}
+
+uint8_t PadInterface::receive_request(size_t &frames, int timeout_ms)
+{
+    frames = 1;
+
     if (m_pad_ident.empty()) {
         throw logic_error("Uninitialised PadInterface::request() called");
     }
 
-    vector<uint8_t> buffer(4);
+    uint8_t buffer[8];
 
     while (true) {
-        struct pollfd fds[1];
-        fds[0].fd = m_sock;
-        fds[0].events = POLLIN;
-        int timeout_ms = 240;
-
-        int retval = poll(fds, 1, timeout_ms);
+        if (timeout_ms != 0) {
+            struct pollfd fds[1];
+            fds[0].fd = m_sock;
+            fds[0].events = POLLIN;
 
-        if (retval == -1) {
-            std::string errstr(strerror(errno));
-            throw std::runtime_error("PAD socket poll error: " + errstr);
+            int retval = poll(fds, 1, timeout_ms);
+            if (retval == -1) {
+                std::string errstr(strerror(errno));
+                throw std::runtime_error("PAD socket poll error: " + errstr);
+            }
+            if (retval == 0) {
+                return 0;
+            }
         }
-        else if (retval > 0) {
-            ssize_t ret = recvfrom(m_sock, buffer.data(), buffer.size(), 0, nullptr, nullptr);
 
-            if (ret == -1) {
-                throw runtime_error(string("Can't receive data: ") + strerror(errno));
+        struct sockaddr_storage sender;
+        socklen_t sender_len = sizeof(sender);
+        ssize_t ret = recvfrom(m_sock, buffer, sizeof(buffer), MSG_DONTWAIT, (struct sockaddr *) &sender, &sender_len);
+        if (ret == -1) {
+            if (errno == EAGAIN or errno == EWOULDBLOCK) {
+                if (timeout_ms == 0) {
+                    return 0;
+                }
+                continue;
             }
-            else {
-                buffer.resize(ret);
+            throw runtime_error(string("Can't receive data: ") + strerror(errno));
+        }
 
-                // We could check where the data comes from, but since we're using UNIX sockets
-                // the source is anyway local to the machine.
+        // We could check where the data comes from, but since we're using UNIX sockets
+        // the source is anyway local to the machine.
 
-                if (buffer[0] == MESSAGE_REQUEST) {
-                    uint8_t padlen = buffer[1];
-                    return padlen;
-                }
-                else {
-                    continue;
-                }
+        if (m_udp) {
+            if (ret < (ssize_t) (3 + SEQUENCE_LEN) or buffer[0] != MESSAGE_REQUEST) {
+                continue;
             }
+            memcpy(&m_peer, &sender, sender_len);
+            m_peer_len = sender_len;
+            memcpy(m_sequence, &buffer[3], SEQUENCE_LEN);
         }
-        else {
-            return 0;
+
+        if (ret >= 2 and buffer[0] == MESSAGE_REQUEST) {
+            uint8_t padlen = buffer[1];
+            frames = ret >= 3 ? max<size_t>(buffer[2], 1) : 1;
+            PADENC_TRACE2(pad_request, padlen, frames);
+            return padlen;
         }
     }
 }
 
 void PadInterface::send_pad_data(const uint8_t *data, size_t len)
 {
+    // the message buffer is kept, to not allocate on every frame
+    m_message.resize(MESSAGE_HEADER_LEN + len);
+    copy(data, data + len, m_message.begin() + MESSAGE_HEADER_LEN);
+
+    send_pad_frame(m_message.data(), len);
+}
+
+void PadInterface::send_pad_frame(uint8_t *frame, size_t len)
+{
+    frame[0] = MESSAGE_PAD_DATA;
+
+    send_message(frame, MESSAGE_HEADER_LEN + len);
+}
+
+void PadInterface::send_pad_frames(uint8_t *message, size_t len, size_t frames)
+{
+    assert(frames >= 1 and frames <= 255);
+
+    message[0] = MESSAGE_PAD_DATA_BATCH;
+    message[1] = frames;
+
+    send_message(message, BATCH_HEADER_LEN + frames * len);
+}
+
+void PadInterface::send_message(const uint8_t *message, size_t message_len)
+{
+    ssize_t ret;
+    size_t sent_len;
     struct sockaddr_un claddr;
-    memset(&claddr, 0, sizeof(struct sockaddr_un));
-    claddr.sun_family = AF_UNIX;
-    snprintf(claddr.sun_path, sizeof(claddr.sun_path), "/tmp/%s.audioenc", m_pad_ident.c_str());
+    const char *destination;
+    if (m_udp) {
+        // the sequence number of the request in front, without copying the message
+        struct iovec iov[2];
+        iov[0].iov_base = m_sequence;
+        iov[0].iov_len = SEQUENCE_LEN;
+        iov[1].iov_base = const_cast<uint8_t *>(message);
+        iov[1].iov_len = message_len;
 
-    vector<uint8_t> message(len + 1);
-    message[0] = MESSAGE_PAD_DATA;
-    copy(data, data + len, message.begin() + 1);
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = &m_peer;
+        msg.msg_namelen = m_peer_len;
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
 
-    ssize_t ret = sendto(m_sock, message.data(), message.size(), 0, (struct sockaddr*)&claddr, sizeof(struct sockaddr_un));
+        ret = sendmsg(m_sock, &msg, 0);
+        sent_len = SEQUENCE_LEN + message_len;
+        destination = m_pad_ident.c_str();
+    }
+    else {
+        memset(&claddr, 0, sizeof(struct sockaddr_un));
+        claddr.sun_family = AF_UNIX;
+        snprintf(claddr.sun_path, sizeof(claddr.sun_path), "/tmp/%s.audioenc", m_pad_ident.c_str());
+
+        ret = sendto(m_sock, message, message_len, 0, (struct sockaddr*)&claddr, sizeof(struct sockaddr_un));
+        sent_len = message_len;
+        destination = claddr.sun_path;
+    }
+    PADENC_TRACE3(pad_sent, sent_len, ret, ret == -1 ? errno : 0);
     if (ret == -1) {
         // This suppresses the -Wlogical-op warning
         if (errno == EAGAIN
@@ -126,19 +316,22 @@ void PadInterface::send_pad_data(const uint8_t *data, size_t len)
                 or errno == ECONNREFUSED
                 or errno == ENOENT) {
             if (m_audioenc_reachable) {
-                fprintf(stderr, "ODR-PadEnc at %s not reachable\n", claddr.sun_path);
+                PadLog::Global().Write(unreachable_log, LogLevel::INFO, {}, "at %s not reachable", destination);
                 m_audioenc_reachable = false;
             }
         }
         else {
-            fprintf(stderr, "PAD send failed: %s\n", strerror(errno));
+            const int error = errno;
+            PadLog::Global().Write(send_failed_log, LogLevel::ERROR, {{"errno", error}, {"bytes", (long long) sent_len}},
+                                   "PAD send failed: %s", strerror(error));
         }
     }
-    else if ((size_t)ret != message.size()) {
-        fprintf(stderr, "PAD incorrect length sent: %zu bytes of %zu transmitted\n", ret, len);
+    else if ((size_t)ret != sent_len) {
+        PadLog::Global().Write(send_failed_log, LogLevel::ERROR, {{"sent", ret}, {"bytes", (long long) sent_len}},
+                               "PAD incorrect length sent: %zd bytes of %zu transmitted", ret, sent_len);
     }
     else if (not m_audioenc_reachable) {
-        fprintf(stderr, "Audio encoder is now reachable at %s\n", claddr.sun_path);
+        PadLog::Global().Write(unreachable_log, LogLevel::INFO, {}, "audio encoder is now reachable at %s", destination);
         m_audioenc_reachable = true;
     }
 }
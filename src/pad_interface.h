@@ -25,6 +25,7 @@
 #include <cstdint>
 #include <cstddef>
 #include <cstdio>
+#include <sys/socket.h>
 
 /*! \file PadInterface.h
  *
@@ -35,19 +36,101 @@ class PadInterface {
     public:
         /*! Create a new PAD data interface that binds to /tmp/pad_ident.padenc and
          * communicates with ODR-AudioEnc at /tmp/pad_ident.audioenc
+         *
+         * With a pad_ident of the form udp:PORT, it instead binds to the UDP
+         * port and answers each request to its sender (e.g. odr-padenc-relay
+         * on the node of a remote audio encoder), echoing its sequence number.
          */
         void open(const std::string &pad_ident);
 
+        /*! The prefix of pad_ident for a UDP port
+         */
+        static const std::string UDP_PREFIX;
+        static bool is_udp_ident(const std::string &pad_ident) {
+            return pad_ident.compare(0, UDP_PREFIX.size(), UDP_PREFIX) == 0;
+        }
+
+        /*! A UDP socket bound to the port (dual stack, if available), for
+         * the given purpose (e.g. "PAD"); throws runtime_error on failure
+         */
+        static int bind_udp(const std::string &port, const std::string &what);
+
+        /*! A UDP socket connected to HOST:PORT (an IPv6 address in brackets),
+         * named in the error messages as what (e.g. "upstream"); -1 on failure
+         */
+        static int connect_udp(const std::string &host_port, const std::string &what);
+
+        /*! Bytes of the sequence number in front of each message over UDP
+         */
+        static const size_t SEQUENCE_LEN = 4;
+
+        /*! The first byte of each message (see pad_interface.cpp)
+         */
+        static const uint8_t MESSAGE_REQUEST = 1;
+        static const uint8_t MESSAGE_PAD_DATA = 2;
+        static const uint8_t MESSAGE_PAD_DATA_BATCH = 3;
+
         /*! Receives a request from the audio encoder
          *
          * \return the desired padlen
          */
         uint8_t receive_request();
 
+        /*! Receives a request from the audio encoder, which may ask for
+         * several PAD frames at once (see send_pad_frames())
+         *
+         * \param frames     set to the number of requested frames (at least 1)
+         * \param timeout_ms how long to wait for a request (0: only read what is
+         *                   there, without polling, e.g. when the socket is readable)
+         * \return the desired padlen; 0, if no request within the timeout
+         */
+        uint8_t receive_request(size_t &frames, int timeout_ms = 240);
+
+        /*! The socket, e.g. to wait for requests of several interfaces at once
+         */
+        int fd() const { return m_sock; }
+
+        /*! Bytes to reserve in front of the PAD data when using send_pad_frame()
+         */
+        static const size_t MESSAGE_HEADER_LEN = 1;
+
         void send_pad_data(const uint8_t *data, size_t len);
 
+        /*! Sends PAD data that was written into a frame buffer at offset
+         * MESSAGE_HEADER_LEN, so that the message header can be filled in
+         * front of it and the frame sent without any copy or allocation.
+         *
+         * \param frame buffer of at least MESSAGE_HEADER_LEN + len bytes
+         * \param len   the PAD length (excluding the header)
+         */
+        void send_pad_frame(uint8_t *frame, size_t len);
+
+        /*! Bytes to reserve in front of the PAD data when using send_pad_frames()
+         */
+        static const size_t BATCH_HEADER_LEN = 2;
+
+        /*! Answers a request for several frames with all of them in a
+         * single message, written into a buffer at offset BATCH_HEADER_LEN.
+         *
+         * \param message buffer of at least BATCH_HEADER_LEN + frames * len bytes
+         * \param len     the PAD length of each frame (excluding any header)
+         * \param frames  the number of consecutive frames
+         */
+        void send_pad_frames(uint8_t *message, size_t len, size_t frames);
+
     private:
+        void send_message(const uint8_t *message, size_t message_len);
+
+        void open_udp(const std::string &port);
+
         std::string m_pad_ident;
+        std::vector<uint8_t> m_message;
         int m_sock = -1;
         bool m_audioenc_reachable = true;
+
+        // UDP only: the sender of the last request, to answer with its sequence number
+        bool m_udp = false;
+        struct sockaddr_storage m_peer;
+        socklen_t m_peer_len = 0;
+        uint8_t m_sequence[SEQUENCE_LEN] = {};
 };
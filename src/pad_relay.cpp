@@ -0,0 +1,109 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file pad_relay.cpp
+    \brief Jitter buffer of odr-padenc-relay, for PAD frames received over UDP
+*/
+
+#include "pad_relay.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+// --- PadRelayBuffer -----------------------------------------------------------------
+PadRelayBuffer::PadRelayBuffer(size_t target_frames, size_t batch_frames, std::chrono::milliseconds timeout) :
+        target_frames(target_frames),
+        batch_frames(std::min<size_t>(std::max<size_t>(batch_frames, 1), 255)),
+        timeout(timeout),
+        padlen(0),
+        next_sequence(0),
+        requested_frames(0),
+        lost_frames(0),
+        underruns(0)
+{}
+
+void PadRelayBuffer::SetPADLength(uint8_t padlen) {
+    this->padlen = padlen;
+    requests.clear();
+    requested_frames = 0;
+    buffer.clear();
+}
+
+bool PadRelayBuffer::NextRequest(time_point now, uint32_t& sequence, size_t& frames) {
+    const size_t available = Buffered() + requested_frames;
+    if (padlen == 0 || available >= target_frames)
+        return false;
+
+    sequence = next_sequence++;
+    frames = std::min(batch_frames, target_frames - available);
+    requests.push_back(request_t{sequence, frames, now, false, std::deque<uint8_t>()});
+    requested_frames += frames;
+    return true;
+}
+
+bool PadRelayBuffer::AddAnswer(uint32_t sequence, const uint8_t* data, size_t frames, size_t frame_size) {
+    if (frame_size != GetFrameSize())
+        return false;
+
+    for (request_t& request : requests) {
+        if (request.sequence != sequence)
+            continue;
+        if (request.answered || request.frames != frames)
+            return false;
+        request.answered = true;
+        request.data.assign(data, data + frames * frame_size);
+        requested_frames -= frames;
+        Deliver();
+        return true;
+    }
+    return false;
+}
+
+void PadRelayBuffer::ExpireRequests(time_point now) {
+    // later requests stay buffered until the earlier ones are answered or given up
+    while (!requests.empty() && !requests.front().answered && now - requests.front().sent > timeout) {
+        lost_frames += requests.front().frames;
+        requested_frames -= requests.front().frames;
+        requests.pop_front();
+        Deliver();
+    }
+}
+
+void PadRelayBuffer::Deliver() {
+    while (!requests.empty() && requests.front().answered) {
+        buffer.insert(buffer.end(), requests.front().data.begin(), requests.front().data.end());
+        requests.pop_front();
+    }
+}
+
+bool PadRelayBuffer::TakeFrame(uint8_t* pad) {
+    const size_t frame_size = GetFrameSize();
+    if (buffer.size() < frame_size) {
+        // the two bytes of F-PAD only (without X-PAD), followed by the used length
+        memset(pad, 0, frame_size);
+        pad[frame_size - 1] = 2;
+        underruns++;
+        return false;
+    }
+
+    std::copy(buffer.begin(), buffer.begin() + frame_size, pad);
+    buffer.erase(buffer.begin(), buffer.begin() + frame_size);
+    return true;
+}
@@ -0,0 +1,98 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file pad_relay.h
+    \brief Jitter buffer of odr-padenc-relay, for PAD frames received over UDP
+*/
+
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+
+// --- PadRelayBuffer -----------------------------------------------------------------
+/*! The PAD frames requested from a remote ODR-PadEnc ahead of the local
+ * audio encoder, so that its requests are answered at once, however late the
+ * network delivers.
+ *
+ * Requests for batches of frames are numbered; the answers are buffered in
+ * the order of their requests, so that reordered answers are put back in
+ * order. A request without answer within the timeout counts as lost, as does
+ * a late answer then. If the buffer runs dry, frames without X-PAD fill in.
+ */
+class PadRelayBuffer {
+public:
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    /*! keeps target_frames buffered or requested, requested in batches of up
+     *  to batch_frames (at most 255)
+     */
+    PadRelayBuffer(size_t target_frames, size_t batch_frames, std::chrono::milliseconds timeout);
+
+    // switches to the PAD length of the audio encoder, discarding the buffered and requested frames
+    void SetPADLength(uint8_t padlen);
+    uint8_t GetPADLength() const {return padlen;}
+    size_t GetFrameSize() const {return padlen + 1;}
+
+    /*! the next batch to request, if the buffered and requested frames are
+     *  below the target (and the PAD length is known); false, if none
+     */
+    bool NextRequest(time_point now, uint32_t& sequence, size_t& frames);
+    /*! takes over the answer to a request (frames of GetFrameSize() bytes);
+     *  false, if it is not expected (e.g. late, duplicate or of another PAD length)
+     */
+    bool AddAnswer(uint32_t sequence, const uint8_t* data, size_t frames, size_t frame_size);
+    // gives up the requests without answer for longer than the timeout
+    void ExpireRequests(time_point now);
+
+    /*! writes the next frame (GetFrameSize() bytes); false, if the buffer ran
+     *  dry and a frame without X-PAD was written instead
+     */
+    bool TakeFrame(uint8_t* pad);
+
+    size_t Buffered() const {return buffer.size() / GetFrameSize();}
+    size_t Requested() const {return requested_frames;}
+    size_t GetLostFrames() const {return lost_frames;}
+    size_t GetUnderruns() const {return underruns;}
+private:
+    struct request_t {
+        uint32_t sequence;
+        size_t frames;
+        time_point sent;
+        bool answered;
+        std::deque<uint8_t> data;
+    };
+
+    const size_t target_frames;
+    const size_t batch_frames;
+    const std::chrono::milliseconds timeout;
+
+    uint8_t padlen;
+    uint32_t next_sequence;
+    std::deque<request_t> requests;     // in the order of their sequence numbers
+    size_t requested_frames;            // of the unanswered requests
+    std::deque<uint8_t> buffer;         // the frames to hand out, in order
+    size_t lost_frames;
+    size_t underruns;
+
+    // moves the answered requests ahead of any unanswered one to the buffer
+    void Deliver();
+};
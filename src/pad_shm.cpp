@@ -0,0 +1,228 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef HAVE_CONFIG_H
+#   include "config.h"
+#endif
+#include "pad_shm.h"
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#endif
+
+using namespace std;
+
+static_assert(sizeof(PadShmSlot) == 256, "PadShmSlot layout changed");
+static_assert(sizeof(PadShmHeader) == 32, "PadShmHeader layout changed");
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "Shared memory ring needs lock-free atomics");
+
+// The indices run freely; the slot is the index modulo the slot count.
+
+static void futex_wait(std::atomic<uint32_t> *addr, uint32_t expected, int timeout_ms)
+{
+#ifdef __linux__
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+#else
+    if (addr->load() == expected)
+        usleep(1000);
+#endif
+}
+
+static void futex_wake(std::atomic<uint32_t> *addr)
+{
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+#endif
+}
+
+PadShmRing::~PadShmRing()
+{
+    if (m_header) {
+        munmap(m_header, m_len);
+    }
+    if (m_owner) {
+        shm_unlink(m_name.c_str());
+    }
+}
+
+void PadShmRing::map(int fd, size_t len)
+{
+    void *mem = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        string errstr(strerror(errno));
+        close(fd);
+        throw runtime_error("PAD shared memory mapping failed: " + errstr);
+    }
+    close(fd);
+
+    m_header = static_cast<PadShmHeader*>(mem);
+    m_len = len;
+}
+
+void PadShmRing::create(const std::string &pad_ident, size_t frames)
+{
+    if (frames < 1) {
+        throw invalid_argument("PAD shared memory ring needs at least one frame");
+    }
+
+    m_name = "/odr-padenc-" + pad_ident;
+
+    // a ring left over from a previous run is replaced
+    if (shm_unlink(m_name.c_str()) == -1 and errno != ENOENT) {
+        fprintf(stderr, "Unlinking of shared memory %s failed: %s\n", m_name.c_str(), strerror(errno));
+    }
+
+    int fd = shm_open(m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) {
+        throw runtime_error("PAD shared memory creation failed: " + string(strerror(errno)));
+    }
+    m_owner = true;
+
+    const size_t len = sizeof(PadShmHeader) + frames * sizeof(PadShmSlot);
+    if (ftruncate(fd, len) == -1) {
+        string errstr(strerror(errno));
+        close(fd);
+        throw runtime_error("PAD shared memory sizing failed: " + errstr);
+    }
+    map(fd, len);
+
+    // the new object is zero-filled, so only the constant fields need to be set
+    m_header->version = FORMAT_VERSION;
+    m_header->slot_count = frames;
+    m_header->magic.store(MAGIC, std::memory_order_release);
+}
+
+void PadShmRing::attach(const std::string &pad_ident)
+{
+    m_name = "/odr-padenc-" + pad_ident;
+
+    int fd = shm_open(m_name.c_str(), O_RDWR, 0);
+    if (fd == -1) {
+        throw runtime_error("PAD shared memory opening failed: " + string(strerror(errno)));
+    }
+
+    struct stat shm_stat;
+    if (fstat(fd, &shm_stat) == -1 or (size_t) shm_stat.st_size < sizeof(PadShmHeader)) {
+        close(fd);
+        throw runtime_error("PAD shared memory " + m_name + " not ready");
+    }
+    map(fd, shm_stat.st_size);
+
+    if (m_header->magic.load(std::memory_order_acquire) != MAGIC or
+            m_header->version != FORMAT_VERSION or
+            sizeof(PadShmHeader) + m_header->slot_count * sizeof(PadShmSlot) > m_len) {
+        munmap(m_header, m_len);
+        m_header = nullptr;
+        throw runtime_error("PAD shared memory " + m_name + " has an incompatible format");
+    }
+}
+
+uint8_t PadShmRing::wait_for_request(int timeout_ms)
+{
+    if (not m_header) {
+        throw logic_error("Uninitialised PadShmRing::wait_for_request() called");
+    }
+
+    const uint32_t tail = m_header->tail.load(std::memory_order_relaxed);
+    uint32_t head = m_header->head.load(std::memory_order_acquire);
+    uint8_t padlen = m_header->padlen.load(std::memory_order_acquire);
+
+    if (tail - head < m_header->slot_count and padlen > 0) {
+        return padlen;
+    }
+
+    // announce the wait before checking again, so that the consumer cannot miss it
+    m_header->producer_waiting.store(1);
+    head = m_header->head.load();
+    padlen = m_header->padlen.load();
+    if (tail - head >= m_header->slot_count or padlen == 0) {
+        futex_wait(&m_header->head, head, timeout_ms);
+    }
+    m_header->producer_waiting.store(0);
+
+    head = m_header->head.load(std::memory_order_acquire);
+    padlen = m_header->padlen.load(std::memory_order_acquire);
+    return tail - head < m_header->slot_count ? padlen : 0;
+}
+
+uint8_t* PadShmRing::frame_buffer()
+{
+    return slot(m_header->tail.load(std::memory_order_relaxed) % m_header->slot_count)->data;
+}
+
+void PadShmRing::push_frame(size_t len, uint8_t padlen)
+{
+    assert(len <= max_frame_len());
+
+    const uint32_t tail = m_header->tail.load(std::memory_order_relaxed);
+    PadShmSlot *s = slot(tail % m_header->slot_count);
+    s->len = len;
+    s->padlen = padlen;
+
+    m_header->tail.store(tail + 1, std::memory_order_release);
+}
+
+void PadShmRing::wake_producer()
+{
+    if (m_header->producer_waiting.load()) {
+        futex_wake(&m_header->head);
+    }
+}
+
+void PadShmRing::request(uint8_t padlen)
+{
+    m_header->padlen.store(padlen);
+    wake_producer();
+}
+
+size_t PadShmRing::pop_frame(uint8_t *data, size_t max_len)
+{
+    const uint8_t padlen = m_header->padlen.load(std::memory_order_relaxed);
+    uint32_t head = m_header->head.load(std::memory_order_relaxed);
+    const uint32_t tail = m_header->tail.load(std::memory_order_acquire);
+
+    size_t len = 0;
+    while (head != tail) {
+        const PadShmSlot *s = slot(head % m_header->slot_count);
+        head++;
+
+        // drop frames written before a PAD length change
+        if (s->padlen == padlen and s->len <= max_len) {
+            len = s->len;
+            memcpy(data, s->data, len);
+            break;
+        }
+    }
+
+    m_header->head.store(head);
+    wake_producer();
+    return len;
+}
@@ -0,0 +1,113 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/*! \file pad_shm.h
+ *
+ * Hands PAD frames to the audio encoder through a ring buffer in POSIX
+ * shared memory, as an alternative to the socket of PadInterface.
+ *
+ * ODR-PadEnc creates the shared memory object /odr-padenc-<pad_ident> and
+ * fills the ring ahead with frames of the PAD length the audio encoder
+ * last asked for. The audio encoder pops one frame per audio frame without
+ * any syscall; only when ODR-PadEnc waits for a free slot, it is woken up
+ * through a futex on the head index.
+ */
+
+struct PadShmSlot {
+    uint16_t len;       // bytes used in data
+    uint8_t padlen;     // PAD length the frame was written for
+    uint8_t reserved;
+    uint8_t data[252];
+};
+
+struct PadShmHeader {
+    std::atomic<uint32_t> magic;            // written last when the ring is ready
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t reserved;
+    std::atomic<uint32_t> padlen;           // written by the audio encoder; 0 = no request yet
+    std::atomic<uint32_t> head;             // next slot to pop; only written by the audio encoder
+    std::atomic<uint32_t> tail;             // next slot to push; only written by ODR-PadEnc
+    std::atomic<uint32_t> producer_waiting; // ODR-PadEnc waits on the head index
+    // followed by slot_count slots
+};
+
+class PadShmRing {
+    public:
+        static const uint32_t MAGIC = 0x4F445250;  // "ODRP"
+        static const uint32_t FORMAT_VERSION = 1;
+        static const size_t DEFAULT_FRAMES = 8;
+
+        PadShmRing() {}
+        ~PadShmRing();
+
+        /*! Create the ring for the given number of frames ahead (producer side)
+         */
+        void create(const std::string &pad_ident, size_t frames);
+
+        /*! Attach to a ring created by ODR-PadEnc (consumer side)
+         */
+        void attach(const std::string &pad_ident);
+
+        // --- producer side
+
+        /*! Wait until a slot is free and a PAD length is requested
+         *
+         * \return the requested padlen; 0, if none within the timeout
+         */
+        uint8_t wait_for_request(int timeout_ms);
+
+        /*! The slot to write the next frame into, of at least max_frame_len() bytes
+         */
+        uint8_t* frame_buffer();
+        static size_t max_frame_len() { return sizeof(((PadShmSlot*) nullptr)->data); }
+
+        /*! Publish the frame written into frame_buffer()
+         */
+        void push_frame(size_t len, uint8_t padlen);
+
+        // --- consumer side
+
+        /*! Ask for frames of another PAD length; frames of the previous
+         * length still in the ring are dropped by pop_frame()
+         */
+        void request(uint8_t padlen);
+
+        /*! Take the next frame without blocking
+         *
+         * \return the frame length; 0, if no frame of the requested PAD length is available
+         */
+        size_t pop_frame(uint8_t *data, size_t max_len);
+
+    private:
+        void map(int fd, size_t len);
+        void wake_producer();
+        PadShmSlot* slot(uint32_t index) { return reinterpret_cast<PadShmSlot*>(m_header + 1) + index; }
+
+        std::string m_name;
+        bool m_owner = false;
+        PadShmHeader *m_header = nullptr;
+        size_t m_len = 0;
+};
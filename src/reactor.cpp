@@ -0,0 +1,251 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file reactor.cpp
+    \brief Event loop over the sockets, watches and timers of all services
+*/
+
+#include "reactor.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
+
+using std::chrono::steady_clock;
+
+
+// --- Reactor -----------------------------------------------------------------
+Reactor::Reactor() : poll_fd(-1), timer_fd(-1), next_timer_id(1), wakeups(0) {
+#ifdef __linux__
+    poll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd[0] = wake_fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (poll_fd == -1 || wake_fd[0] == -1 || timer_fd == -1)
+        throw std::runtime_error("reactor creation failed: " + std::string(strerror(errno)));
+
+    for (int fd : {wake_fd[0], timer_fd}) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(poll_fd, EPOLL_CTL_ADD, fd, &event))
+            throw std::runtime_error("reactor creation failed: " + std::string(strerror(errno)));
+    }
+#else
+    if (pipe(wake_fd))
+        throw std::runtime_error("reactor creation failed: " + std::string(strerror(errno)));
+    for (int fd : wake_fd)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#endif
+}
+
+Reactor::~Reactor() {
+    for (int fd : {poll_fd, timer_fd, wake_fd[0]})
+        if (fd != -1)
+            close(fd);
+    if (wake_fd[1] != wake_fd[0])
+        close(wake_fd[1]);
+}
+
+void Reactor::Add(int fd, handler_t handler) {
+    fds[fd] = std::unique_ptr<handler_t>(new handler_t(handler));
+#ifdef __linux__
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(poll_fd, EPOLL_CTL_ADD, fd, &event))
+        throw std::runtime_error("reactor cannot watch fd " + std::to_string(fd) + ": " + strerror(errno));
+#endif
+}
+
+void Reactor::Remove(int fd) {
+    auto it = fds.find(fd);
+    if (it == fds.end())
+        return;
+#ifdef __linux__
+    epoll_ctl(poll_fd, EPOLL_CTL_DEL, fd, nullptr);
+#endif
+    // the handler may be running
+    removed_fds.push_back(std::move(it->second));
+    fds.erase(it);
+}
+
+int Reactor::AddTimer(std::chrono::milliseconds interval, handler_t handler) {
+    const int id = next_timer_id++;
+    const steady_clock::duration duration = std::max<steady_clock::duration>(interval, std::chrono::milliseconds(1));
+    timers[id] = timer_t{duration, steady_clock::now() + duration, handler};
+    ArmTimer();
+    return id;
+}
+
+void Reactor::RemoveTimer(int id) {
+    timers.erase(id);
+    ArmTimer();
+}
+
+void Reactor::ArmTimer() {
+#ifdef __linux__
+    // the timerfd only for the next due timer
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (!timers.empty()) {
+        steady_clock::time_point due = steady_clock::time_point::max();
+        for (const auto& timer : timers)
+            due = std::min(due, timer.second.due);
+        const int64_t ns = std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(due - steady_clock::now()).count(), 1);
+        spec.it_value.tv_sec = ns / 1000000000;
+        spec.it_value.tv_nsec = ns % 1000000000;
+    }
+    timerfd_settime(timer_fd, 0, &spec, nullptr);
+#endif
+}
+
+int Reactor::TimeoutMs() const {
+    if (timers.empty())
+        return -1;
+    steady_clock::time_point due = steady_clock::time_point::max();
+    for (const auto& timer : timers)
+        due = std::min(due, timer.second.due);
+    const int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(due - steady_clock::now()).count() + 1;
+    return (int) std::max<int64_t>(ms, 0);
+}
+
+bool Reactor::RunTimers() {
+    const steady_clock::time_point now = steady_clock::now();
+    std::vector<int> due;
+    for (const auto& timer : timers)
+        if (timer.second.due <= now)
+            due.push_back(timer.first);
+
+    for (int id : due) {
+        // removed by a previous handler
+        auto it = timers.find(id);
+        if (it == timers.end())
+            continue;
+        // missed intervals are skipped
+        while (it->second.due <= now)
+            it->second.due += it->second.interval;
+        handler_t handler = it->second.handler;
+        handler();
+    }
+    ArmTimer();
+    return !due.empty();
+}
+
+void Reactor::Dispatch(int fd) {
+    auto it = fds.find(fd);
+    if (it == fds.end())
+        return;
+    // stays valid, if removed by itself
+    (*it->second)();
+}
+
+void Reactor::DrainWake() {
+    uint64_t value;
+    while (read(wake_fd[0], &value, sizeof(value)) > 0) {}
+}
+
+void Reactor::Wake() {
+    const uint64_t value = 1;
+    if (write(wake_fd[1], &value, sizeof(value)) == -1) {
+        // already pending
+    }
+}
+
+bool Reactor::RunOnce(int timeout_ms) {
+#ifdef __linux__
+    const int MAX_EVENTS = 64;
+    struct epoll_event events[MAX_EVENTS];
+    const int count = epoll_wait(poll_fd, events, MAX_EVENTS, timeout_ms);
+    if (count == -1) {
+        if (errno == EINTR)
+            return true;
+        throw std::runtime_error("reactor wait failed: " + std::string(strerror(errno)));
+    }
+    if (count == 0)
+        return false;
+    wakeups++;
+
+    for (int i = 0; i < count; i++) {
+        const int fd = events[i].data.fd;
+        if (fd == wake_fd[0]) {
+            DrainWake();
+        }
+        else if (fd == timer_fd) {
+            uint64_t expirations;
+            if (read(timer_fd, &expirations, sizeof(expirations)) == -1) {
+                // spurious
+            }
+            RunTimers();
+        }
+        else {
+            Dispatch(fd);
+        }
+    }
+#else
+    std::vector<struct pollfd> poll_fds(1);
+    poll_fds[0].fd = wake_fd[0];
+    poll_fds[0].events = POLLIN;
+    for (const auto& entry : fds) {
+        struct pollfd entry_fd;
+        entry_fd.fd = entry.first;
+        entry_fd.events = POLLIN;
+        poll_fds.push_back(entry_fd);
+    }
+
+    int timeout = TimeoutMs();
+    if (timeout_ms >= 0)
+        timeout = timeout == -1 ? timeout_ms : std::min(timeout, timeout_ms);
+    const int count = poll(poll_fds.data(), poll_fds.size(), timeout);
+    if (count == -1) {
+        if (errno == EINTR)
+            return true;
+        throw std::runtime_error("reactor wait failed: " + std::string(strerror(errno)));
+    }
+
+    if (count > 0) {
+        if (poll_fds[0].revents)
+            DrainWake();
+        for (size_t i = 1; i < poll_fds.size(); i++)
+            if (poll_fds[i].revents)
+                Dispatch(poll_fds[i].fd);
+    }
+    const bool timers_due = RunTimers();
+    if (count == 0 && !timers_due)
+        return false;
+    wakeups++;
+#endif
+    removed_fds.clear();
+    return true;
+}
+
+void Reactor::Run(const std::atomic<bool>& stop) {
+    while (!stop.load())
+        RunOnce(-1);
+}
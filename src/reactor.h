@@ -0,0 +1,93 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file reactor.h
+    \brief Event loop over the sockets, watches and timers of all services
+*/
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+
+// --- Reactor -----------------------------------------------------------------
+/*! Waits for the sockets and inotify watches of all services at once (by
+ * means of epoll, or poll() on other systems than Linux) and runs the
+ * handler of each one that became readable, as well as due timers.
+ *
+ * The thread only wakes up on these events, or on Wake(), e.g. from a
+ * signal handler. Handlers run on the thread of Run() and must not block;
+ * CPU heavy work belongs in the worker threads. Except Wake(), the methods
+ * must be called on that thread, also from within handlers.
+ */
+class Reactor {
+public:
+    typedef std::function<void()> handler_t;
+
+    Reactor();
+    ~Reactor();
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    // runs the handler while the fd is readable
+    void Add(int fd, handler_t handler);
+    void Remove(int fd);
+
+    // runs the handler every interval (the first time after one); returns its ID
+    int AddTimer(std::chrono::milliseconds interval, handler_t handler);
+    void RemoveTimer(int id);
+
+    /*! Handles events until stop is set (and Wake() called after that).
+     *  Throws std::runtime_error, if waiting fails.
+     */
+    void Run(const std::atomic<bool>& stop);
+    // handles the events of one wakeup, waiting at most timeout_ms (-1: no limit); false on a timeout
+    bool RunOnce(int timeout_ms);
+
+    // async-signal-safe
+    void Wake();
+
+    size_t Wakeups() const {return wakeups;}
+private:
+    struct timer_t {
+        std::chrono::steady_clock::duration interval;
+        std::chrono::steady_clock::time_point due;
+        handler_t handler;
+    };
+
+    int poll_fd;        // epoll; -1 on other systems
+    int wake_fd[2];     // eventfd (both the same) or pipe
+    int timer_fd;       // -1 on other systems
+    std::map<int, std::unique_ptr<handler_t>> fds;
+    std::vector<std::unique_ptr<handler_t>> removed_fds;   // until the handlers of a wakeup are done
+    std::map<int, timer_t> timers;
+    int next_timer_id;
+    size_t wakeups;
+
+    void ArmTimer();
+    int TimeoutMs() const;
+    bool RunTimers();   // whether any was due
+    void Dispatch(int fd);
+    void DrainWake();
+};
@@ -0,0 +1,397 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file replication.cpp
+    \brief Replication of the encoder state to a hot standby instance
+*/
+
+#include "replication.h"
+#include "pad_interface.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+// --- EncoderReplica -----------------------------------------------------------------
+/* Record layout (network byte order):
+ *   magic, version, type (uint8), sequence (uint32), then by type:
+ *   heartbeat: -
+ *   slide:     fingerprint
+ *   label:     label
+ *   snapshot:  last given fidx (int32), current slide flag (uint8) [, fingerprint],
+ *              label flag (uint8) [, label], entry count (uint32), entries (least recently used first)
+ *
+ * fingerprint: name len (uint16), name, size (int64), mtime (uint64), fidx (int32)
+ * label:       toggle (uint8), charset (uint8), DL Plus flags (uint8: enabled, item toggle, item running),
+ *              text len (uint16), text, tag count (uint8), tags (content type, start, length; uint8 each)
+ */
+const uint8_t EncoderReplica::MAGIC[4] = {'O', 'D', 'R', 'R'};
+const uint8_t EncoderReplica::FORMAT_VERSION = 1;
+const size_t EncoderReplica::MAX_RECORD_LEN = 60000;
+
+class RecordWriter {
+private:
+    std::vector<uint8_t>& data;
+public:
+    RecordWriter(std::vector<uint8_t>& data) : data(data) {data.clear();}
+
+    void Put(const void* bytes, size_t len) {
+        data.insert(data.end(), (const uint8_t*) bytes, (const uint8_t*) bytes + len);
+    }
+    template<typename T> void Put(T value) {
+        for (int shift = 8 * (sizeof(T) - 1); shift >= 0; shift -= 8)
+            data.push_back((uint64_t) value >> shift);
+    }
+    void PutFingerprint(const fingerprint_t& fp) {
+        Put<uint16_t>(fp.s_name.size());
+        Put(fp.s_name.data(), fp.s_name.size());
+        Put<int64_t>(fp.s_size);
+        Put<uint64_t>(fp.s_mtime);
+        Put<int32_t>(fp.fidx);
+    }
+    void PutLabel(bool toggle, const DL_STATE& dl_state) {
+        Put<uint8_t>(toggle);
+        Put<uint8_t>((uint8_t) dl_state.charset);
+        Put<uint8_t>((dl_state.dl_plus_enabled ? 1 : 0) | (dl_state.dl_plus_item_toggle ? 2 : 0) | (dl_state.dl_plus_item_running ? 4 : 0));
+        Put<uint16_t>(dl_state.dl_text.size());
+        Put(dl_state.dl_text.data(), dl_state.dl_text.size());
+        Put<uint8_t>(dl_state.dl_plus_tags.size());
+        for (const DL_PLUS_TAG& tag : dl_state.dl_plus_tags) {
+            Put<uint8_t>(tag.content_type);
+            Put<uint8_t>(tag.start_marker);
+            Put<uint8_t>(tag.length_marker);
+        }
+    }
+};
+
+class RecordReader {
+private:
+    const uint8_t* data;
+    size_t len;
+    size_t pos;
+    bool ok;
+public:
+    RecordReader(const uint8_t* data, size_t len) : data(data), len(len), pos(0), ok(true) {}
+
+    bool Ok() const {return ok;}
+    bool AtEnd() const {return pos == len;}
+
+    const uint8_t* Skip(size_t count) {
+        const uint8_t* bytes = data + pos;
+        if (ok && count <= len - pos)
+            pos += count;
+        else
+            ok = false;
+        return bytes;
+    }
+    template<typename T> T Get() {
+        const uint8_t* bytes = Skip(sizeof(T));
+        uint64_t value = 0;
+        for (size_t i = 0; ok && i < sizeof(T); i++)
+            value = value << 8 | bytes[i];
+        return (T) value;
+    }
+    bool GetFingerprint(fingerprint_t& fp) {
+        uint16_t name_len = Get<uint16_t>();
+        const uint8_t* name = Skip(name_len);
+        if (ok)
+            fp.s_name.assign((const char*) name, name_len);
+        fp.s_size = Get<int64_t>();
+        fp.s_mtime = Get<uint64_t>();
+        fp.fidx = Get<int32_t>();
+        return ok && fp.fidx >= 0 && fp.fidx <= History::MAXSLIDEID;
+    }
+    bool GetLabel(bool& toggle, DL_STATE& dl_state) {
+        toggle = Get<uint8_t>();
+        dl_state.charset = (DABCharset) Get<uint8_t>();
+        uint8_t flags = Get<uint8_t>();
+        dl_state.dl_plus_enabled = flags & 1;
+        dl_state.dl_plus_item_toggle = flags & 2;
+        dl_state.dl_plus_item_running = flags & 4;
+        uint16_t text_len = Get<uint16_t>();
+        const uint8_t* text = Skip(text_len);
+        if (ok)
+            dl_state.dl_text.assign((const char*) text, text_len);
+        dl_state.dl_plus_tags.resize(Get<uint8_t>());
+        for (DL_PLUS_TAG& tag : dl_state.dl_plus_tags) {
+            tag.content_type = Get<uint8_t>();
+            tag.start_marker = Get<uint8_t>();
+            tag.length_marker = Get<uint8_t>();
+        }
+        return ok;
+    }
+};
+
+
+EncoderReplica::EncoderReplica(size_t history_len) :
+        history_len(std::max<size_t>(history_len, 1)),
+        last_given_fidx(0),
+        has_current_slide(false),
+        has_label(false),
+        dls_toggle(false)
+{
+    current_slide.fidx = -1;
+}
+
+void EncoderReplica::SlideQueued(const fingerprint_t& fp) {
+    std::vector<fingerprint_t>::iterator it = std::find(entries.begin(), entries.end(), fp);
+    if (it != entries.end())
+        entries.erase(it);
+    else
+        last_given_fidx = fp.fidx < History::MAXSLIDEID ? fp.fidx + 1 : 0;  // as counted by History: the next one to give
+    entries.push_back(fp);
+    if (entries.size() > history_len)
+        entries.erase(entries.begin());
+
+    has_current_slide = true;
+    current_slide = fp;
+}
+
+void EncoderReplica::LabelSent(bool toggle, const DL_STATE& dl_state) {
+    has_label = true;
+    dls_toggle = toggle;
+    this->dl_state = dl_state;
+}
+
+void EncoderReplica::Restore(const std::vector<fingerprint_t>& entries, int last_given_fidx) {
+    this->entries.assign(entries.end() - std::min(entries.size(), history_len), entries.end());
+    this->last_given_fidx = last_given_fidx;
+}
+
+void EncoderReplica::Record(record_t type, uint32_t sequence, std::vector<uint8_t>& record) const {
+    RecordWriter writer(record);
+    writer.Put(MAGIC, sizeof(MAGIC));
+    writer.Put<uint8_t>(FORMAT_VERSION);
+    writer.Put<uint8_t>(type);
+    writer.Put<uint32_t>(sequence);
+
+    switch (type) {
+    case RECORD_HEARTBEAT:
+        break;
+    case RECORD_SLIDE:
+        writer.PutFingerprint(current_slide);
+        break;
+    case RECORD_LABEL:
+        writer.PutLabel(dls_toggle, dl_state);
+        break;
+    case RECORD_SNAPSHOT: {
+        writer.Put<int32_t>(last_given_fidx);
+        writer.Put<uint8_t>(has_current_slide);
+        if (has_current_slide)
+            writer.PutFingerprint(current_slide);
+        writer.Put<uint8_t>(has_label);
+        if (has_label)
+            writer.PutLabel(dls_toggle, dl_state);
+
+        // the most recent entries that fit
+        size_t len = record.size() + 4;
+        size_t first = entries.size();
+        while (first > 0 && len + 22 + entries[first - 1].s_name.size() <= MAX_RECORD_LEN)
+            len += 22 + entries[--first].s_name.size();
+        writer.Put<uint32_t>(entries.size() - first);
+        for (size_t i = first; i < entries.size(); i++)
+            writer.PutFingerprint(entries[i]);
+        break; }
+    }
+}
+
+bool EncoderReplica::Apply(const uint8_t* record, size_t len, uint32_t& sequence) {
+    RecordReader reader(record, len);
+    const uint8_t* magic = reader.Skip(sizeof(MAGIC));
+    if (!reader.Ok() || memcmp(magic, MAGIC, sizeof(MAGIC)) || reader.Get<uint8_t>() != FORMAT_VERSION)
+        return false;
+    uint8_t type = reader.Get<uint8_t>();
+    sequence = reader.Get<uint32_t>();
+    if (!reader.Ok())
+        return false;
+
+    switch (type) {
+    case RECORD_HEARTBEAT:
+        return reader.AtEnd();
+    case RECORD_SLIDE: {
+        fingerprint_t fp;
+        if (!reader.GetFingerprint(fp) || !reader.AtEnd())
+            return false;
+        SlideQueued(fp);
+        return true; }
+    case RECORD_LABEL: {
+        bool toggle;
+        DL_STATE label;
+        if (!reader.GetLabel(toggle, label) || !reader.AtEnd())
+            return false;
+        LabelSent(toggle, label);
+        return true; }
+    case RECORD_SNAPSHOT: {
+        int32_t snapshot_last_fidx = reader.Get<int32_t>();
+        fingerprint_t snapshot_current;
+        snapshot_current.fidx = -1;
+        bool snapshot_has_current = reader.Get<uint8_t>();
+        if (snapshot_has_current && !reader.GetFingerprint(snapshot_current))
+            return false;
+        bool toggle = false;
+        DL_STATE label;
+        bool snapshot_has_label = reader.Get<uint8_t>();
+        if (snapshot_has_label && !reader.GetLabel(toggle, label))
+            return false;
+        uint32_t count = reader.Get<uint32_t>();
+        std::vector<fingerprint_t> snapshot_entries;
+        for (uint32_t i = 0; i < count && reader.Ok(); i++) {
+            fingerprint_t fp;
+            if (!reader.GetFingerprint(fp))
+                return false;
+            snapshot_entries.push_back(fp);
+        }
+        if (!reader.Ok() || !reader.AtEnd() || snapshot_last_fidx < 0 || snapshot_last_fidx > History::MAXSLIDEID)
+            return false;
+
+        if (snapshot_entries.size() > history_len)
+            snapshot_entries.erase(snapshot_entries.begin(), snapshot_entries.end() - history_len);
+        entries.swap(snapshot_entries);
+        last_given_fidx = snapshot_last_fidx;
+        has_current_slide = snapshot_has_current;
+        current_slide = snapshot_current;
+        has_label = snapshot_has_label;
+        dls_toggle = toggle;
+        dl_state = label;
+        return true; }
+    }
+    return false;
+}
+
+
+// --- StateReplicator -----------------------------------------------------------------
+const std::chrono::milliseconds StateReplicator::HEARTBEAT_INTERVAL(20);
+const std::chrono::seconds StateReplicator::SNAPSHOT_INTERVAL(2);
+
+StateReplicator::StateReplicator(size_t history_len) :
+        replica(history_len),
+        sock(-1),
+        sequence(0),
+        records_sent(0)
+{}
+
+StateReplicator::~StateReplicator() {
+    if (sock != -1)
+        close(sock);
+}
+
+bool StateReplicator::Open(const std::string& standby) {
+    sock = PadInterface::connect_udp(standby, "standby");
+    return sock != -1;
+}
+
+void StateReplicator::Seed(const std::vector<fingerprint_t>& entries, int last_given_fidx) {
+    replica.Restore(entries, last_given_fidx);
+}
+
+void StateReplicator::SlideQueued(const std::string& filepath, int fidx) {
+    fingerprint_t fp;
+    fp.load_from_file(filepath.c_str());
+    fp.fidx = fidx;
+    replica.SlideQueued(fp);
+    Send(EncoderReplica::RECORD_SLIDE);
+}
+
+void StateReplicator::LabelSent(bool toggle, const DL_STATE& dl_state) {
+    // the toggle bit changes with each new label
+    if (replica.HasLabel() && toggle == replica.GetToggle())
+        return;
+    replica.LabelSent(toggle, dl_state);
+    Send(EncoderReplica::RECORD_LABEL);
+}
+
+void StateReplicator::Tick(std::chrono::steady_clock::time_point now) {
+    if (now >= next_snapshot) {
+        Send(EncoderReplica::RECORD_SNAPSHOT);
+        next_snapshot = now + SNAPSHOT_INTERVAL;
+    } else if (now - last_send >= HEARTBEAT_INTERVAL) {
+        Send(EncoderReplica::RECORD_HEARTBEAT);
+    }
+}
+
+void StateReplicator::Send(EncoderReplica::record_t type) {
+    if (sock == -1)
+        return;
+    replica.Record(type, sequence++, record);
+
+    // refused while the standby is not running yet
+    if (send(sock, record.data(), record.size(), MSG_DONTWAIT) == -1 && errno != ECONNREFUSED && errno != EAGAIN)
+        perror("ODR-PadEnc Warning: sending to the standby failed");
+    last_send = std::chrono::steady_clock::now();
+    records_sent++;
+}
+
+
+// --- ReplicaReceiver -----------------------------------------------------------------
+const std::chrono::milliseconds ReplicaReceiver::TAKEOVER_TIMEOUT(100);
+
+ReplicaReceiver::ReplicaReceiver(EncoderReplica& replica) :
+        replica(replica),
+        sock(-1),
+        record(EncoderReplica::MAX_RECORD_LEN),
+        records(0),
+        lost_records(0),
+        next_sequence(0)
+{}
+
+ReplicaReceiver::~ReplicaReceiver() {
+    if (sock != -1)
+        close(sock);
+}
+
+void ReplicaReceiver::Open(const std::string& port) {
+    sock = PadInterface::bind_udp(port, "standby");
+}
+
+int ReplicaReceiver::Receive(int timeout_ms) {
+    struct pollfd fds = {sock, POLLIN, 0};
+    int ready = poll(&fds, 1, timeout_ms);
+    if (ready == -1) {
+        if (errno == EINTR)
+            return 0;
+        perror("ODR-PadEnc Error: waiting for the primary's journal failed");
+        return -1;
+    }
+    if (ready == 0)
+        return 0;
+
+    ssize_t len = recv(sock, record.data(), record.size(), 0);
+    if (len == -1) {
+        perror("ODR-PadEnc Error: receiving the primary's journal failed");
+        return -1;
+    }
+
+    uint32_t sequence;
+    if (!replica.Apply(record.data(), len, sequence)) {
+        fprintf(stderr, "ODR-PadEnc Warning: ignoring invalid journal record of %zd bytes\n", len);
+        return 0;
+    }
+
+    // a restarted primary starts over
+    if (records > 0 && sequence > next_sequence)
+        lost_records += sequence - next_sequence;
+    next_sequence = sequence + 1;
+    records++;
+    return 1;
+}
@@ -0,0 +1,164 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file replication.h
+    \brief Replication of the encoder state to a hot standby instance
+*/
+
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dls.h"
+#include "sls.h"
+
+
+// --- EncoderReplica -----------------------------------------------------------------
+/*! The state that a standby instance needs to take over from the primary
+ * without receivers noticing: the slide IDs given so far (the history), the
+ * slide in transmission and the DLS toggle bit with the label last sent.
+ *
+ * The primary journals each change as a record, a datagram of its own; a
+ * snapshot of the whole state now and then repairs any record lost on the
+ * way. The standby applies the records as received.
+ */
+class EncoderReplica {
+public:
+    enum record_t {RECORD_HEARTBEAT, RECORD_SLIDE, RECORD_LABEL, RECORD_SNAPSHOT};
+    // a snapshot with more history entries only carries the most recent ones
+    static const size_t MAX_RECORD_LEN;
+
+    explicit EncoderReplica(size_t history_len = History::MAXHISTORYLEN);
+
+    // the slide (with its fidx) now in transmission, and most recently used
+    void SlideQueued(const fingerprint_t& fp);
+    void LabelSent(bool toggle, const DL_STATE& dl_state);
+    // replaces the history, e.g. with the one restored from the slide state file
+    void Restore(const std::vector<fingerprint_t>& entries, int last_given_fidx);
+
+    /*! writes the record of the given type with the current state and
+     *  sequence number into record
+     */
+    void Record(record_t type, uint32_t sequence, std::vector<uint8_t>& record) const;
+    /*! applies a record received; false, if it is invalid. The sequence
+     *  number is set, even for a heartbeat.
+     */
+    bool Apply(const uint8_t* record, size_t len, uint32_t& sequence);
+
+    // the history entries, least recently used first
+    const std::vector<fingerprint_t>& GetEntries() const {return entries;}
+    int GetLastGivenFidx() const {return last_given_fidx;}
+    bool HasCurrentSlide() const {return has_current_slide;}
+    const fingerprint_t& GetCurrentSlide() const {return current_slide;}
+    bool HasLabel() const {return has_label;}
+    bool GetToggle() const {return dls_toggle;}
+    const DL_STATE& GetLabel() const {return dl_state;}
+
+private:
+    static const uint8_t MAGIC[4];
+    static const uint8_t FORMAT_VERSION;
+
+    size_t history_len;
+    std::vector<fingerprint_t> entries;
+    int last_given_fidx;
+    bool has_current_slide;
+    fingerprint_t current_slide;
+    bool has_label;
+    bool dls_toggle;
+    DL_STATE dl_state;
+};
+
+
+// --- StateReplicator -----------------------------------------------------------------
+/*! Streams the journal of an encoder to its standby instance over UDP (see
+ * --replicate-to): a record per change, a heartbeat if nothing was sent for
+ * HEARTBEAT_INTERVAL and a snapshot every SNAPSHOT_INTERVAL. Sending never blocks; a
+ * standby not running yet is no error.
+ */
+class StateReplicator {
+public:
+    static const std::chrono::milliseconds HEARTBEAT_INTERVAL;
+    static const std::chrono::seconds SNAPSHOT_INTERVAL;
+
+    StateReplicator(size_t history_len);
+    ~StateReplicator();
+    StateReplicator(const StateReplicator&) = delete;
+    StateReplicator& operator=(const StateReplicator&) = delete;
+
+    // connects to the standby at HOST:PORT; false on failure
+    bool Open(const std::string& standby);
+    // the history to start with, i.e. given before the encoder started
+    void Seed(const std::vector<fingerprint_t>& entries, int last_given_fidx);
+
+    void SlideQueued(const std::string& filepath, int fidx);
+    // journals the label, if it changed since the last one (cheap enough for every frame)
+    void LabelSent(bool toggle, const DL_STATE& dl_state);
+    // once per frame: sends a heartbeat or snapshot, if due
+    void Tick(std::chrono::steady_clock::time_point now);
+
+    size_t GetRecordsSent() const {return records_sent;}
+private:
+    EncoderReplica replica;
+    int sock;
+    uint32_t sequence;
+    std::vector<uint8_t> record;
+    std::chrono::steady_clock::time_point last_send;
+    std::chrono::steady_clock::time_point next_snapshot;
+    size_t records_sent;
+
+    void Send(EncoderReplica::record_t type);
+};
+
+
+// --- ReplicaReceiver -----------------------------------------------------------------
+/*! The standby side (see --standby): receives the journal of the primary
+ * into a replica, so that it can take over once the primary falls silent.
+ */
+class ReplicaReceiver {
+public:
+    // no journal record for this long: the primary is gone
+    static const std::chrono::milliseconds TAKEOVER_TIMEOUT;
+
+    ReplicaReceiver(EncoderReplica& replica);
+    ~ReplicaReceiver();
+    ReplicaReceiver(const ReplicaReceiver&) = delete;
+    ReplicaReceiver& operator=(const ReplicaReceiver&) = delete;
+
+    // binds to the UDP port; throws runtime_error on failure
+    void Open(const std::string& port);
+
+    /*! waits up to timeout_ms for the next record and applies it; 1, if
+     *  applied; 0, if none within the timeout; -1 on error
+     */
+    int Receive(int timeout_ms);
+
+    bool HeardPrimary() const {return records > 0;}
+    size_t GetRecords() const {return records;}
+    size_t GetLostRecords() const {return lost_records;}
+private:
+    EncoderReplica& replica;
+    int sock;
+    std::vector<uint8_t> record;
+    size_t records;
+    size_t lost_records;    // by sequence gaps
+    uint32_t next_sequence;
+};
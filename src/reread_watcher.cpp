@@ -0,0 +1,232 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file reread_watcher.cpp
+    \brief Event driven detection of re-read request files
+*/
+
+#include "reread_watcher.h"
+#include "thread_placement.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#ifdef __linux__
+#  include <sys/inotify.h>
+#endif
+
+
+// --- RereadRequest -----------------------------------------------------------------
+RereadRequest::RereadRequest(const std::string& type, const std::string& path) :
+    type(type),
+    path(path),
+    wd(-1),
+    pending(true),      // the file may already exist
+    polling(true),
+    triggered(false)
+{
+    size_t slash = path.rfind('/');
+    dir = slash == std::string::npos ? "." : path.substr(0, std::max(slash, (size_t) 1));
+    name = slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+
+int RereadRequest::Check() {
+    if (triggered.exchange(false)) {
+        fprintf(stderr, "ODR-PadEnc received %s re-read request!\n", type.c_str());
+        return 1;
+    }
+    if (!polling && !pending.exchange(false))
+        return 0;
+    return check_reread_file(type, path);
+}
+
+
+// --- RereadWatcher -----------------------------------------------------------------
+RereadWatcher::RereadWatcher(Reactor* reactor) :
+    inotify_fd(-1),
+    reactor(reactor),
+    generation(0),
+    any_polling(false)
+{
+    stop_pipe[0] = stop_pipe[1] = -1;
+
+#ifdef __linux__
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd == -1) {
+        perror("ODR-PadEnc Warning: cannot watch re-read request files - checking them on each frame instead");
+        return;
+    }
+    if (reactor) {
+        reactor->Add(inotify_fd, [this]() {ProcessEvents();});
+        return;
+    }
+    if (pipe2(stop_pipe, O_CLOEXEC)) {
+        perror("ODR-PadEnc Warning: cannot watch re-read request files - checking them on each frame instead");
+        close(inotify_fd);
+        inotify_fd = -1;
+        return;
+    }
+
+    thread = std::thread(&RereadWatcher::Run, this);
+#endif
+}
+
+
+RereadWatcher::~RereadWatcher() {
+    if (reactor && inotify_fd != -1)
+        reactor->Remove(inotify_fd);
+    if (thread.joinable()) {
+        // wake up the thread
+        if (write(stop_pipe[1], "", 1) != 1)
+            perror("ODR-PadEnc Error: cannot stop re-read request watcher");
+        thread.join();
+    }
+
+    for (int fd : {inotify_fd, stop_pipe[0], stop_pipe[1]})
+        if (fd != -1)
+            close(fd);
+}
+
+
+RereadRequest* RereadWatcher::Add(const std::string& type, const std::string& path) {
+    std::lock_guard<std::mutex> lock(requests_mutex);
+
+    requests.emplace_back(new RereadRequest(type, path));
+    RereadRequest* request = requests.back().get();
+
+#ifdef __linux__
+    if (inotify_fd != -1) {
+        request->wd = inotify_add_watch(inotify_fd, request->dir.c_str(), IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (request->wd == -1)
+            perror(("ODR-PadEnc Warning: cannot watch " + type + " re-read request file - checking it on each frame instead").c_str());
+        else
+            request->polling = false;
+    }
+#endif
+
+    if (request->polling)
+        any_polling = true;
+    generation++;   // the new request is pending
+
+    return request;
+}
+
+
+void RereadWatcher::Remove(RereadRequest* request) {
+    std::lock_guard<std::mutex> lock(requests_mutex);
+
+    std::vector<std::unique_ptr<RereadRequest>>::iterator it = std::find_if(requests.begin(), requests.end(),
+            [request](const std::unique_ptr<RereadRequest>& entry) {return entry.get() == request;});
+    if (it == requests.end())
+        return;
+
+#ifdef __linux__
+    // the requests in the same dir share its watch
+    if (request->wd != -1 && std::none_of(requests.begin(), requests.end(),
+            [request](const std::unique_ptr<RereadRequest>& entry) {return entry.get() != request && entry->wd == request->wd;}))
+        inotify_rm_watch(inotify_fd, request->wd);
+#endif
+
+    requests.erase(it);
+    any_polling = std::any_of(requests.begin(), requests.end(),
+            [](const std::unique_ptr<RereadRequest>& entry) {return (bool) entry->polling;});
+}
+
+
+bool RereadWatcher::MayBePending(unsigned int& seen_generation) {
+    unsigned int current_generation = generation;
+    if (current_generation == seen_generation && !any_polling)
+        return false;
+    seen_generation = current_generation;
+    return true;
+}
+
+
+void RereadWatcher::Trigger(RereadRequest* request) {
+    request->triggered = true;
+    generation++;
+}
+
+
+void RereadWatcher::Run() {
+    ThreadPlacement::Global().EnterWorker();
+    struct pollfd fds[2];
+    fds[0].fd = inotify_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = stop_pipe[0];
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("ODR-PadEnc Error: cannot watch re-read request files - checking them on each frame instead");
+            break;
+        }
+        if (fds[1].revents)
+            return;
+        if (fds[0].revents)
+            ProcessEvents();
+    }
+
+    // fall back to checking each time
+    std::lock_guard<std::mutex> lock(requests_mutex);
+    for (const std::unique_ptr<RereadRequest>& request : requests)
+        request->polling = true;
+    any_polling = true;
+}
+
+
+void RereadWatcher::ProcessEvents() {
+#ifdef __linux__
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t len = read(inotify_fd, buffer, sizeof(buffer));
+        if (len == -1)
+            return;     // incl. EAGAIN, when all events are processed
+
+        std::lock_guard<std::mutex> lock(requests_mutex);
+        for (char* ptr = buffer; ptr < buffer + len; ) {
+            const struct inotify_event* event = (const struct inotify_event*) ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            for (const std::unique_ptr<RereadRequest>& request : requests) {
+                // events got lost, so check again
+                if (event->mask & IN_Q_OVERFLOW)
+                    request->pending = true;
+
+                if (event->wd != request->wd)
+                    continue;
+
+                // the dir is gone (and may be re-created later)
+                if (event->mask & IN_IGNORED) {
+                    request->polling = true;
+                    any_polling = true;
+                }
+                else if (event->len && request->name == event->name)
+                    request->pending = true;
+            }
+        }
+        generation++;
+    }
+#endif
+}
@@ -0,0 +1,109 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file reread_watcher.h
+    \brief Event driven detection of re-read request files
+*/
+
+#ifndef REREAD_WATCHER_H_
+#define REREAD_WATCHER_H_
+
+#include "common.h"
+#include "reactor.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// --- RereadRequest -----------------------------------------------------------------
+/*! A re-read request file, e.g. of the slides dir or of a DLS file.
+ */
+class RereadRequest {
+private:
+    friend class RereadWatcher;
+
+    std::string type;
+    std::string path;
+    std::string dir;
+    std::string name;
+    int wd;                         // -1, if not watched
+    std::atomic<bool> pending;      // the file may have been created
+    std::atomic<bool> polling;      // the file cannot be watched, so must be checked each time
+    std::atomic<bool> triggered;    // requested without a file
+
+    RereadRequest(const std::string& type, const std::string& path);
+public:
+    // same result as check_reread_file(), but the filesystem is only accessed, if the file was created
+    int Check();
+};
+
+
+// --- RereadWatcher -----------------------------------------------------------------
+/*! Watches for re-read request files in a separate thread (or by means of
+ * the reactor of the PAD requests), so that checking for a request on each
+ * PAD frame needs no filesystem access.
+ *
+ * On Linux, the directories of the request files are watched by means of
+ * inotify. Otherwise (or if a directory cannot be watched), the request
+ * file is checked with stat() each time, as before.
+ */
+class RereadWatcher {
+private:
+    int inotify_fd;     // -1, if not available
+    Reactor* reactor;   // if watching by means of it
+    int stop_pipe[2];
+    std::vector<std::unique_ptr<RereadRequest>> requests;
+    std::mutex requests_mutex;
+    std::thread thread;
+    std::atomic<unsigned int> generation;   // incremented whenever a request may have become pending
+    std::atomic<bool> any_polling;
+
+    RereadWatcher(const RereadWatcher&);
+    RereadWatcher& operator=(const RereadWatcher&);
+
+    void Run();
+    void ProcessEvents();
+public:
+    // with a reactor, which must outlive the watcher, no thread is started
+    explicit RereadWatcher(Reactor* reactor = nullptr);
+    ~RereadWatcher();
+
+    /*! Adds a request file to watch; the result stays valid as long as the watcher.
+     * Must not be called while requests are being checked by other threads.
+     */
+    RereadRequest* Add(const std::string& type, const std::string& path);
+    /*! Stops watching a request file added before; the request is deleted.
+     * Must not be called while requests are being checked by other threads.
+     */
+    void Remove(RereadRequest* request);
+
+    /*! Whether any request may be pending since the last call with the same
+     * counter (initially 0), so that checking many requests can be skipped.
+     */
+    bool MayBePending(unsigned int& seen_generation);
+
+    // makes a request pending without its file, e.g. on a control command (from any thread)
+    void Trigger(RereadRequest* request);
+};
+
+#endif /* REREAD_WATCHER_H_ */
@@ -5,29 +5,36 @@
 
 #include "security_utils.h"
 #include <algorithm>
-#include <regex>
 #include <fstream>
 #include <sstream>
 #include <iomanip>
 #include <random>
-#include <openssl/sha.h>
-#include <openssl/md5.h>
+#include <cmath>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
 #include <openssl/rand.h>
 #include <filesystem>
+#include <sys/random.h>
 #include <sys/stat.h>
+#include <pthread.h>
+#include <sched.h>
+#include <set>
+#ifdef __linux__
+#  include <sys/inotify.h>
+#endif
+#include <queue>
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+#include <fcntl.h>
 #include <unistd.h>
 
 namespace fs = std::filesystem;
 
 namespace StreamDAB {
 
-SecurePathValidator::SecurePathValidator() : strict_mode_(true) {
-    // Default blocked patterns
-    blocked_patterns_ = {
-        "..", "~", "$", "`", "|", "&", ";", 
-        "<", ">", "\"", "'", "\\x", "\\u",
-        "\\r", "\\n", "\\t", "\\0"
-    };
+SecurePathValidator::SecurePathValidator() : SecurePathValidator(std::vector<std::string>{}, true) {
 }
 
 SecurePathValidator::SecurePathValidator(const std::vector<std::string>& allowed_dirs, bool strict) 
@@ -37,6 +44,19 @@ SecurePathValidator::SecurePathValidator(const std::vector<std::string>& allowed
         "<", ">", "\"", "'", "\\x", "\\u",
         "\\r", "\\n", "\\t", "\\0"
     };
+    
+#ifdef __linux__
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd_ == -1) {
+        std::cerr << "Path validator: cannot watch directories, so results depending on files are not cached" << std::endl;
+    }
+#endif
+}
+
+SecurePathValidator::~SecurePathValidator() {
+    if (inotify_fd_ != -1) {
+        close(inotify_fd_);
+    }
 }
 
 bool SecurePathValidator::ContainsTraversal(const std::string& path) const {
@@ -85,45 +105,55 @@ bool SecurePathValidator::MatchesBlockedPattern(const std::string& path) const {
     return false;
 }
 
-std::string SecurePathValidator::ResolvePath(const std::string& path) const {
-    try {
-        return fs::canonical(fs::path(path)).string();
-    } catch (const fs::filesystem_error&) {
-        // If path doesn't exist or can't be resolved, return normalized path
-        return NormalizePath(path);
+std::string SecurePathValidator::ResolvePath(const std::string& path) {
+    std::error_code error;
+    const fs::path absolute = fs::absolute(fs::path(path), error);
+    if (error) {
+        return "";
     }
+    const fs::path resolved = fs::weakly_canonical(absolute, error);
+    return error ? "" : resolved.string();
 }
 
-FileValidation SecurePathValidator::ValidatePath(const std::string& path) const {
-    FileValidation validation;
-    validation.sanitized_path = SanitizePath(path);
-    
+std::vector<std::string> SecurePathValidator::DirectoriesOn(const std::string& canonical) {
+    std::vector<std::string> directories;
+    for (size_t slash = canonical.find('/'); slash != std::string::npos && slash + 1 < canonical.size();
+         slash = canonical.find('/', slash + 1)) {
+        directories.push_back(slash == 0 ? "/" : canonical.substr(0, slash));
+    }
+    return directories;
+}
+
+bool SecurePathValidator::CheckPathName(const std::string& path, FileValidation& validation) const {
     // Check for traversal attempts
     if (ContainsTraversal(path)) {
         validation.security_issues.push_back("Directory traversal attempt detected");
-        return validation;
+        return false;
     }
     
     // Check against blocked patterns
     if (MatchesBlockedPattern(path)) {
         validation.security_issues.push_back("Contains blocked pattern");
-        return validation;
+        return false;
     }
     
     // Check if in allowed directory
     if (!IsInAllowedDirectory(path)) {
         validation.security_issues.push_back("Path not in allowed directory");
-        return validation;
+        return false;
     }
-    
+    return true;
+}
+
+void SecurePathValidator::CheckFile(const std::string& path, FileValidation& validation) const {
     // Check if file exists and get properties
     try {
-        if (fs::exists(validation.sanitized_path)) {
+        if (fs::exists(path)) {
             validation.is_valid = true;
-            validation.file_size = fs::file_size(validation.sanitized_path);
+            validation.file_size = fs::file_size(path);
             
             // Basic file type detection
-            std::string ext = fs::path(validation.sanitized_path).extension().string();
+            std::string ext = fs::path(path).extension().string();
             std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
             
             if (ext == ".jpg" || ext == ".jpeg") {
@@ -145,22 +175,205 @@ FileValidation SecurePathValidator::ValidatePath(const std::string& path) const
     } catch (const fs::filesystem_error& e) {
         validation.security_issues.push_back("Filesystem error: " + std::string(e.what()));
     }
+}
+
+FileValidation SecurePathValidator::ValidatePath(const std::string& path) const {
+    FileValidation validation;
+    validation.sanitized_path = SanitizePath(path);
+    {
+        std::lock_guard<ProfiledMutex> lock(cache_mutex_);
+        if (!CheckPathName(path, validation)) {
+            return validation;
+        }
+    }
+    
+    const std::string canonical = ResolvePath(validation.sanitized_path);
+    if (canonical.empty()) {
+        CheckFile(validation.sanitized_path, validation);
+        return validation;
+    }
+    
+    const std::vector<std::string> directories = DirectoriesOn(canonical);
+    std::vector<uint64_t> generations(directories.size());
+    bool watched = true;
+    {
+        std::lock_guard<ProfiledMutex> lock(cache_mutex_);
+        ProcessWatchEvents();
+        auto it = cache_.find(canonical);
+        if (it != cache_.end()) {
+            cache_order_.splice(cache_order_.begin(), cache_order_, it->second.order);
+            FileValidation cached = it->second.validation;
+            cached.sanitized_path = validation.sanitized_path;
+            return cached;
+        }
+        
+        // watched before the check, so that no change after it is missed
+        for (size_t i = 0; i < directories.size() && watched; i++) {
+            watched = WatchDirectory(directories[i], generations[i]);
+        }
+    }
+    
+    CheckFile(canonical, validation);
+    if (!watched) {
+        return validation;
+    }
     
+    std::lock_guard<ProfiledMutex> lock(cache_mutex_);
+    ProcessWatchEvents();
+    for (size_t i = 0; i < directories.size(); i++) {
+        auto current = directory_generations_.find(directories[i]);
+        if (current == directory_generations_.end() || current->second != generations[i]) {
+            return validation;
+        }
+    }
+    if (cache_.count(canonical)) {
+        return validation;
+    }
+    
+    if (cache_.size() >= CACHE_CAPACITY) {
+        cache_.erase(cache_order_.back());
+        cache_order_.pop_back();
+    }
+    cache_order_.push_front(canonical);
+    cache_.emplace(canonical, CacheEntry{validation, cache_order_.begin()});
     return validation;
 }
 
-std::string SecurePathValidator::SanitizePath(const std::string& path) const {
-    std::string sanitized = path;
+bool SecurePathValidator::IsPathSafe(const std::string& path) const {
+    return ValidatePath(path).is_safe;
+}
+
+size_t SecurePathValidator::GetCachedPathCount() const {
+    std::lock_guard<ProfiledMutex> lock(cache_mutex_);
+    return cache_.size();
+}
+
+bool SecurePathValidator::WatchDirectory(const std::string& directory, uint64_t& generation) const {
+#ifdef __linux__
+    auto known = directory_generations_.find(directory);
+    if (known != directory_generations_.end()) {
+        generation = known->second;
+        return true;
+    }
+    if (inotify_fd_ == -1 || directory_generations_.size() >= MAX_WATCHED_DIRECTORIES) {
+        return false;
+    }
     
-    // Remove null bytes
-    sanitized.erase(std::remove(sanitized.begin(), sanitized.end(), '\0'), sanitized.end());
+    const int wd = inotify_add_watch(inotify_fd_, directory.c_str(),
+            IN_CREATE | IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE |
+            IN_DELETE_SELF | IN_MOVE_SELF);
+    if (wd == -1) {
+        return false;
+    }
+    watched_directories_[wd] = directory;
+    generation = directory_generations_[directory] = ++last_generation_;
+    return true;
+#else
+    (void) directory;
+    (void) generation;
+    return false;
+#endif
+}
+
+void SecurePathValidator::ProcessWatchEvents() const {
+#ifdef __linux__
+    if (inotify_fd_ == -1) {
+        return;
+    }
     
-    // Replace backslashes with forward slashes
-    std::replace(sanitized.begin(), sanitized.end(), '\\', '/');
+    std::set<std::string> changed_directories;
+    std::set<std::string> changed;      // paths whose entries, and those below, are dropped
+    bool overflow = false;
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        const ssize_t len = read(inotify_fd_, buffer, sizeof(buffer));
+        if (len <= 0) {
+            break;
+        }
+        for (const char* ptr = buffer; ptr < buffer + len; ) {
+            const struct inotify_event* event = (const struct inotify_event*) ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+            
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflow = true;
+                continue;
+            }
+            auto watched = watched_directories_.find(event->wd);
+            if (watched == watched_directories_.end()) {
+                continue;
+            }
+            changed_directories.insert(watched->second);
+            if (event->len > 0) {
+                changed.insert((watched->second == "/" ? "" : watched->second) + "/" + event->name);
+            } else {
+                changed.insert(watched->second);
+            }
+            if (event->mask & IN_IGNORED) {
+                // the directory is gone; watched again when used again
+                directory_generations_.erase(watched->second);
+                watched_directories_.erase(watched);
+            }
+        }
+    }
+    if (changed.empty() && !overflow) {
+        return;
+    }
     
-    // Remove double slashes
-    while (sanitized.find("//") != std::string::npos) {
-        sanitized = std::regex_replace(sanitized, std::regex("//+"), "/");
+    for (auto& generation : directory_generations_) {
+        if (overflow || changed_directories.count(generation.first)) {
+            generation.second = ++last_generation_;
+        }
+    }
+    for (auto it = cache_order_.begin(); it != cache_order_.end(); ) {
+        // the path itself or any of the directories on it
+        const std::string& path = *it;
+        bool dropped = overflow || changed.count(path) || changed.count("/");
+        for (size_t slash = path.find('/', 1); !dropped && slash != std::string::npos; slash = path.find('/', slash + 1)) {
+            dropped = changed.count(path.substr(0, slash)) > 0;
+        }
+        if (dropped) {
+            cache_.erase(path);
+            it = cache_order_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+#endif
+}
+
+void SecurePathValidator::ClearCache() {
+    cache_.clear();
+    cache_order_.clear();
+}
+
+void SecurePathValidator::AddAllowedDirectory(const std::string& directory) {
+    std::lock_guard<ProfiledMutex> lock(cache_mutex_);
+    allowed_directories_.push_back(directory);
+    ClearCache();
+}
+
+void SecurePathValidator::AddBlockedPattern(const std::string& pattern) {
+    std::lock_guard<ProfiledMutex> lock(cache_mutex_);
+    blocked_patterns_.push_back(pattern);
+    ClearCache();
+}
+
+void SecurePathValidator::SetStrictMode(bool strict) {
+    std::lock_guard<ProfiledMutex> lock(cache_mutex_);
+    strict_mode_ = strict;
+    ClearCache();
+}
+
+std::string SecurePathValidator::SanitizePath(const std::string& path) const {
+    std::string sanitized;
+    sanitized.reserve(path.size());
+    
+    // Remove null bytes, use forward slashes only, no double ones
+    for (char c : path) {
+        if (c == '\0') continue;
+        if (c == '\\') c = '/';
+        if (c == '/' && !sanitized.empty() && sanitized.back() == '/') continue;
+        sanitized.push_back(c);
     }
     
     // Remove trailing slash (except for root)
@@ -172,20 +385,175 @@ std::string SecurePathValidator::SanitizePath(const std::string& path) const {
 }
 
 std::string SecurePathValidator::NormalizePath(const std::string& path) {
-    std::string normalized = path;
+    const bool absolute = IsAbsolutePath(path);
+    std::string normalized;
+    normalized.reserve(path.size());
+    std::vector<size_t> segments;   // where those that .. can remove start, incl. their slash
+    
+    for (size_t start = 0; start <= path.size(); ) {
+        size_t end = start;
+        while (end < path.size() && path[end] != '/' && path[end] != '\\') {
+            end++;
+        }
+        const size_t length = end - start;
+        
+        if (length == 2 && path[start] == '.' && path[start + 1] == '.' && (!segments.empty() || absolute)) {
+            // above the root is the root
+            if (!segments.empty()) {
+                normalized.resize(segments.back());
+                segments.pop_back();
+            }
+        } else if (length > 0 && !(length == 1 && path[start] == '.')) {
+            const bool parent = length == 2 && path[start] == '.' && path[start + 1] == '.';
+            if (!parent) {
+                segments.push_back(normalized.size());
+            }
+            if (absolute || !normalized.empty()) {
+                normalized.push_back('/');
+            }
+            for (size_t i = start; i < end; i++) {
+                normalized.push_back(static_cast<char>(tolower(static_cast<unsigned char>(path[i]))));
+            }
+        }
+        start = end + 1;
+    }
     
-    // Convert to lowercase for case-insensitive comparisons
-    std::transform(normalized.begin(), normalized.end(), normalized.begin(), ::tolower);
+    if (absolute && normalized.empty()) {
+        normalized = "/";
+    }
+    return normalized;
+}
+
+bool SecurePathValidator::IsAbsolutePath(const std::string& path) {
+    return !path.empty() && (path[0] == '/' || path[0] == '\\');
+}
+
+std::string SecurePathValidator::GetParentDirectory(const std::string& path) {
+    const size_t slash = path.find_last_of("/\\");
+    if (slash == std::string::npos) {
+        return ".";
+    }
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+std::string SecurePathValidator::GetFileName(const std::string& path) {
+    const size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+MultiPatternMatcher::MultiPatternMatcher(const std::vector<std::string>& patterns) {
+    // the trie, state 0 being the root
+    std::vector<int32_t> goto_table(ALPHABET, -1);
+    matches_.assign(1, -1);
+    for (size_t i = 0; i < patterns.size(); i++) {
+        if (patterns[i].empty()) {
+            continue;
+        }
+        
+        int32_t state = 0;
+        for (unsigned char c : patterns[i]) {
+            int32_t& next = goto_table[state * ALPHABET + c];
+            if (next < 0) {
+                next = static_cast<int32_t>(matches_.size());
+                matches_.push_back(-1);
+                goto_table.resize(goto_table.size() + ALPHABET, -1);
+            }
+            state = goto_table[state * ALPHABET + c];
+        }
+        if (matches_[state] < 0) {
+            matches_[state] = static_cast<int32_t>(i);
+        }
+        pattern_count_++;
+        
+        const uint8_t first = patterns[i][0];
+        if (!is_start_byte_[first]) {
+            is_start_byte_[first] = true;
+            start_bytes_.push_back(first);
+        }
+    }
     
-    // Replace backslashes with forward slashes
-    std::replace(normalized.begin(), normalized.end(), '\\', '/');
+    // complete it to a DFA in breadth-first order, following failure links
+    transitions_.assign(goto_table.size(), 0);
+    std::vector<int32_t> failure(matches_.size(), 0);
+    std::queue<int32_t> states;
+    for (size_t c = 0; c < ALPHABET; c++) {
+        const int32_t next = goto_table[c];
+        if (next > 0) {
+            transitions_[c] = next;
+            states.push(next);
+        }
+    }
+    while (!states.empty()) {
+        const int32_t state = states.front();
+        states.pop();
+        if (matches_[state] < 0) {
+            matches_[state] = matches_[failure[state]];
+        }
+        for (size_t c = 0; c < ALPHABET; c++) {
+            const int32_t next = goto_table[state * ALPHABET + c];
+            const int32_t fallback = transitions_[failure[state] * ALPHABET + c];
+            if (next > 0) {
+                failure[next] = fallback;
+                transitions_[state * ALPHABET + c] = next;
+                states.push(next);
+            } else {
+                transitions_[state * ALPHABET + c] = fallback;
+            }
+        }
+    }
     
-    // Remove double slashes
-    while (normalized.find("//") != std::string::npos) {
-        normalized = std::regex_replace(normalized, std::regex("//+"), "/");
+    // entries become offsets of the next state's row, or ~state where a pattern ends
+    for (int32_t& next : transitions_) {
+        next = matches_[next] >= 0 ? ~next : next * static_cast<int32_t>(ALPHABET);
+    }
+}
+
+size_t MultiPatternMatcher::SkipToStartByte(const uint8_t* data, size_t pos, size_t size) const {
+#if defined(__SSE2__)
+    if (start_bytes_.size() <= MAX_SIMD_START_BYTES) {
+        __m128i needles[MAX_SIMD_START_BYTES];
+        for (size_t i = 0; i < start_bytes_.size(); i++) {
+            needles[i] = _mm_set1_epi8(static_cast<char>(start_bytes_[i]));
+        }
+        for (; pos + 16 <= size; pos += 16) {
+            const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+            __m128i hits = _mm_setzero_si128();
+            for (size_t i = 0; i < start_bytes_.size(); i++) {
+                hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles[i]));
+            }
+            const int mask = _mm_movemask_epi8(hits);
+            if (mask) {
+                return pos + __builtin_ctz(mask);
+            }
+        }
+    }
+#endif
+    while (pos < size && !is_start_byte_[data[pos]]) {
+        pos++;
+    }
+    return pos;
+}
+
+int MultiPatternMatcher::FindFirst(const uint8_t* data, size_t size) const {
+    if (pattern_count_ == 0) {
+        return -1;
     }
     
-    return normalized;
+    int32_t row = 0;
+    size_t pos = 0;
+    while (pos < size) {
+        if (row == 0 && !is_start_byte_[data[pos]]) {
+            pos = SkipToStartByte(data, pos + 1, size);
+            if (pos == size) {
+                break;
+            }
+        }
+        row = transitions_[row + data[pos++]];
+        if (row < 0) {
+            return matches_[~row];
+        }
+    }
+    return -1;
 }
 
 ContentSecurityScanner::ContentSecurityScanner() {
@@ -200,6 +568,11 @@ ContentSecurityScanner::ContentSecurityScanner() {
         "\\xff\\xd8\\xff",          // Potential JPEG exploit signatures
     };
     
+    // the same for every scanner, so compiled once
+    static const std::shared_ptr<const MultiPatternMatcher> default_matcher =
+        std::make_shared<const MultiPatternMatcher>(malicious_patterns_);
+    pattern_matcher_ = default_matcher;
+    
     suspicious_extensions_ = {
         ".exe", ".bat", ".cmd", ".com", ".scr", ".pif",
         ".php", ".asp", ".jsp", ".py", ".pl", ".sh"
@@ -213,18 +586,36 @@ ContentSecurityScanner::ContentSecurityScanner() {
 }
 
 bool ContentSecurityScanner::ScanForMaliciousContent(const std::vector<uint8_t>& data) const {
-    std::string data_str(data.begin(), data.end());
+    return pattern_matcher_->Matches(data.data(), data.size());
+}
+
+void ContentSecurityScanner::AddMaliciousPattern(const std::string& pattern) {
+    if (pattern.empty()) return;
     
-    for (const auto& pattern : malicious_patterns_) {
-        if (data_str.find(pattern) != std::string::npos) {
-            return true;
-        }
+    malicious_patterns_.push_back(pattern);
+    pattern_matcher_ = std::make_shared<const MultiPatternMatcher>(malicious_patterns_);
+}
+
+void ContentSecurityScanner::LoadMaliciousPatterns(const std::string& config_file) {
+    std::ifstream file(config_file);
+    if (!file) {
+        std::cerr << "Cannot read malicious patterns from " << config_file << std::endl;
+        return;
     }
     
-    return false;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty() && line[0] != '#') {
+            malicious_patterns_.push_back(line);
+        }
+    }
+    pattern_matcher_ = std::make_shared<const MultiPatternMatcher>(malicious_patterns_);
 }
 
-SecurityValidation ContentSecurityScanner::ScanContent(const std::vector<uint8_t>& data, const std::string& content_type) {
+SecurityValidation ContentSecurityScanner::ScanContent(const std::vector<uint8_t>& data, const std::string& content_type) const {
     SecurityValidation validation;
     validation.is_safe = true;
     validation.risk_score = 0.0;
@@ -260,6 +651,39 @@ SecurityValidation ContentSecurityScanner::ScanContent(const std::vector<uint8_t
     return validation;
 }
 
+SecurityValidation ContentSecurityScanner::ScanTextContent(const std::string& text) const {
+    return ScanContent(std::vector<uint8_t>(text.begin(), text.end()), "text/plain");
+}
+
+SecurityValidation ContentSecurityScanner::ScanImageFile(const std::string& filepath) const {
+    std::string extension = std::filesystem::path(filepath).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    
+    SecurityValidation validation;
+    if (std::find(suspicious_extensions_.begin(), suspicious_extensions_.end(), extension) != suspicious_extensions_.end()) {
+        validation.is_safe = false;
+        validation.threats_detected.push_back("Suspicious file extension " + extension);
+        validation.risk_score = 1.0;
+        return validation;
+    }
+    
+    std::ifstream file(filepath, std::ios::binary);
+    if (!file) {
+        validation.is_safe = false;
+        validation.threats_detected.push_back("Cannot read " + filepath);
+        validation.risk_score = 1.0;
+        return validation;
+    }
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    
+    static const std::map<std::string, std::string> content_types = {
+        {".jpg", "image/jpeg"}, {".jpeg", "image/jpeg"}, {".png", "image/png"},
+        {".webp", "image/webp"}, {".heif", "image/heif"}, {".heic", "image/heif"}
+    };
+    auto content_type = content_types.find(extension);
+    return ScanContent(data, content_type != content_types.end() ? content_type->second : "");
+}
+
 bool ContentSecurityScanner::ValidateJPEG(const std::vector<uint8_t>& data) const {
     if (data.size() < 4) return false;
     
@@ -353,73 +777,115 @@ void InputSanitizer::InitializeEntities() {
     html_entities_["\""] = "&quot;";
     html_entities_["'"] = "&#x27;";
     html_entities_["/"] = "&#x2F;";
+    
+    escapes_.assign(256, "");
+    for (const auto& entity : html_entities_) {
+        escapes_[static_cast<unsigned char>(entity.first[0])] = entity.second;
+    }
 }
 
-std::string InputSanitizer::SanitizeText(const std::string& input, bool allow_basic_formatting) {
-    std::string result = input;
-    
-    // Remove control characters
-    result = RemoveControlCharacters(result);
+static bool IsControlCharacter(unsigned char c) {
+    // tabs, newlines and carriage returns are whitespace
+    return (c < 32 && c != '\t' && c != '\n' && c != '\r') || c == 127;
+}
+
+static bool IsWhitespace(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+size_t InputSanitizer::DangerousTagLength(const std::string& input, size_t pos, bool skip_controls, size_t& next_close) const {
+    // <\s*/?\s*name ... >, looking through control characters that are removed anyway
+    size_t i = pos + 1;
+    auto skip = [&](bool whitespace) {
+        while (i < input.size() && ((skip_controls && IsControlCharacter(input[i])) ||
+                                    (whitespace && IsWhitespace(input[i])))) {
+            i++;
+        }
+    };
     
-    // Normalize whitespace
-    result = NormalizeWhitespace(result);
+    skip(true);
+    const bool closing = i < input.size() && input[i] == '/';
+    if (closing) {
+        i++;
+        skip(true);
+    }
     
-    if (!allow_basic_formatting) {
-        // Escape HTML entities
-        result = EscapeHTML(result);
-    } else {
-        // Remove only dangerous tags and attributes
-        for (const auto& tag : dangerous_tags_) {
-            std::regex tag_regex("<\\s*" + tag + "[^>]*>", std::regex_constants::icase);
-            result = std::regex_replace(result, tag_regex, "");
-            
-            std::regex close_tag_regex("<\\s*/\\s*" + tag + "\\s*>", std::regex_constants::icase);
-            result = std::regex_replace(result, close_tag_regex, "");
-        }
+    std::string name;
+    for (skip(false); i < input.size() && isalnum(static_cast<unsigned char>(input[i])) && name.size() <= 16; skip(false)) {
+        name.push_back(static_cast<char>(tolower(static_cast<unsigned char>(input[i++]))));
+    }
+    if (name.empty() || std::find(dangerous_tags_.begin(), dangerous_tags_.end(), name) == dangerous_tags_.end()) {
+        return 0;
     }
     
-    return result;
-}
-
-std::string InputSanitizer::EscapeHTML(const std::string& input) {
-    std::string result = input;
+    if (closing) {
+        skip(true);
+        return i < input.size() && input[i] == '>' ? i + 1 - pos : 0;
+    }
     
-    for (const auto& entity : html_entities_) {
-        size_t pos = 0;
-        while ((pos = result.find(entity.first, pos)) != std::string::npos) {
-            result.replace(pos, entity.first.length(), entity.second);
-            pos += entity.second.length();
+    // attributes up to the next '>', found once per run of tags before it
+    if (next_close == std::string::npos || next_close < i) {
+        next_close = input.find('>', i);
+        if (next_close == std::string::npos) {
+            next_close = input.size();
         }
     }
-    
-    return result;
+    return next_close < input.size() ? next_close + 1 - pos : 0;
 }
 
-std::string InputSanitizer::RemoveControlCharacters(const std::string& input) {
+std::string InputSanitizer::Sanitize(const std::string& input, unsigned steps) const {
     std::string result;
-    result.reserve(input.size());
-    
-    for (unsigned char c : input) {
-        // Allow printable characters, tabs, newlines, and carriage returns
-        if (c >= 32 || c == '\t' || c == '\n' || c == '\r') {
-            result.push_back(c);
+    result.reserve(steps & ESCAPE_ENTITIES ? input.size() + input.size() / 8 : input.size());
+    
+    const bool skip_controls = steps & REMOVE_CONTROLS;
+    bool pending_space = false;
+    size_t next_close = std::string::npos;
+    for (size_t i = 0; i < input.size(); i++) {
+        const unsigned char c = input[i];
+        if (skip_controls && IsControlCharacter(c)) {
+            continue;
+        }
+        if ((steps & COLLAPSE_WHITESPACE) && IsWhitespace(c)) {
+            pending_space = true;
+            continue;
+        }
+        if ((steps & STRIP_DANGEROUS_TAGS) && c == '<') {
+            const size_t length = DangerousTagLength(input, i, skip_controls, next_close);
+            if (length > 0) {
+                i += length - 1;
+                continue;
+            }
+        }
+        
+        if (pending_space && !result.empty()) {
+            result.push_back(' ');
+        }
+        pending_space = false;
+        if ((steps & ESCAPE_ENTITIES) && !escapes_[c].empty()) {
+            result += escapes_[c];
+        } else {
+            result.push_back(static_cast<char>(c));
         }
     }
-    
     return result;
 }
 
+std::string InputSanitizer::SanitizeText(const std::string& input, bool allow_basic_formatting) {
+    // Escape all HTML, or remove only dangerous tags
+    return Sanitize(input, REMOVE_CONTROLS | COLLAPSE_WHITESPACE |
+                           (allow_basic_formatting ? STRIP_DANGEROUS_TAGS : ESCAPE_ENTITIES));
+}
+
+std::string InputSanitizer::EscapeHTML(const std::string& input) {
+    return Sanitize(input, ESCAPE_ENTITIES);
+}
+
+std::string InputSanitizer::RemoveControlCharacters(const std::string& input) {
+    return Sanitize(input, REMOVE_CONTROLS);
+}
+
 std::string InputSanitizer::NormalizeWhitespace(const std::string& input) {
-    std::string result = input;
-    
-    // Replace multiple whitespace with single space
-    result = std::regex_replace(result, std::regex(R"(\s+)"), " ");
-    
-    // Trim leading and trailing whitespace
-    result.erase(0, result.find_first_not_of(" \t\n\r"));
-    result.erase(result.find_last_not_of(" \t\n\r") + 1);
-    
-    return result;
+    return Sanitize(input, COLLAPSE_WHITESPACE);
 }
 
 std::string InputSanitizer::SanitizeFilename(const std::string& filename) {
@@ -434,181 +900,1485 @@ std::string InputSanitizer::SanitizeFilename(const std::string& filename) {
     // Remove control characters
     result = RemoveControlCharacters(result);
     
+    // No parent references (runs of dots as one) and no hidden files
+    result.erase(std::unique(result.begin(), result.end(), [](char a, char b) { return a == '.' && b == '.'; }), result.end());
+    result.erase(0, result.find_first_not_of('.'));
+    
     // Limit length
     if (result.length() > 255) {
         result = result.substr(0, 255);
     }
     
-    // Ensure it's not empty or just dots
-    if (result.empty() || result == "." || result == "..") {
+    // Ensure it's not empty (e.g. just dots)
+    if (result.empty()) {
         result = "sanitized_filename";
     }
     
     return result;
 }
 
-SecureMemoryManager& SecureMemoryManager::GetInstance() {
-    static SecureMemoryManager instance;
-    return instance;
-}
-
-SecureMemoryManager::SecureMemoryManager() {
-    // Initialize memory management
-}
-
-SecureMemoryManager::~SecureMemoryManager() {
-    // Check for leaks on destruction
-    auto leaks = DetectLeaks();
-    if (!leaks.empty()) {
-        std::cerr << "Memory leaks detected: " << leaks.size() << " allocations" << std::endl;
-        PrintMemoryReport();
-    }
-}
-
-void* SecureMemoryManager::SecureAlloc(size_t size, const std::string& location) {
-    void* ptr = malloc(size);
-    if (ptr) {
-        // Zero the memory
-        memset(ptr, 0, size);
-        
-        RecordAllocation(ptr, size, location);
+bool InputSanitizer::IsValidURL(const std::string& url) const {
+    // http(s)://host[:port][/path][?query][#fragment], with nothing to be escaped
+    size_t pos;
+    if (url.compare(0, 7, "http://") == 0) {
+        pos = 7;
+    } else if (url.compare(0, 8, "https://") == 0) {
+        pos = 8;
+    } else {
+        return false;
     }
-    return ptr;
-}
-
-void SecureMemoryManager::SecureFree(void* ptr) {
-    if (!ptr) return;
     
-    {
-        std::lock_guard<std::mutex> lock(allocations_mutex_);
-        auto it = allocations_.find(ptr);
-        if (it != allocations_.end()) {
-            // Zero memory before freeing
-            SecureZero(ptr, it->second.size);
-            allocations_.erase(it);
-            deallocation_count_++;
+    const size_t host_start = pos;
+    if (pos < url.size() && url[pos] == '[') {
+        // IPv6 literal
+        const size_t close = url.find(']', pos);
+        if (close == std::string::npos || close == pos + 1) {
+            return false;
+        }
+        for (size_t i = pos + 1; i < close; i++) {
+            if (!isxdigit(static_cast<unsigned char>(url[i])) && url[i] != ':' && url[i] != '.') {
+                return false;
+            }
+        }
+        pos = close + 1;
+    } else {
+        while (pos < url.size() && (isalnum(static_cast<unsigned char>(url[pos])) || url[pos] == '-' || url[pos] == '.')) {
+            pos++;
+        }
+        if (pos == host_start || url[host_start] == '.' || url[host_start] == '-') {
+            return false;
         }
     }
     
-    free(ptr);
-}
-
+    if (pos < url.size() && url[pos] == ':') {
+        const size_t port_start = ++pos;
+        while (pos < url.size() && isdigit(static_cast<unsigned char>(url[pos]))) {
+            pos++;
+        }
+        if (pos == port_start || pos - port_start > 5 || std::stoul(url.substr(port_start, pos - port_start)) > 65535) {
+            return false;
+        }
+    }
+    
+    if (pos < url.size() && url[pos] != '/' && url[pos] != '?' && url[pos] != '#') {
+        return false;
+    }
+    for (; pos < url.size(); pos++) {
+        const unsigned char c = url[pos];
+        if (c <= ' ' || c >= 0x7F || c == '"' || c == '<' || c == '>' || c == '\\' || c == '`') {
+            return false;
+        }
+    }
+    return true;
+}
+
+namespace {
+
+// Size-class slabs behind SecureMemoryManager. Process-wide and never
+// destroyed, so that blocks in the caches of exiting threads can always be
+// returned. Each block starts with a header; free blocks are linked through
+// their first bytes, which are zeroed again when handed out.
+class SlabAllocator {
+public:
+    static constexpr size_t CLASSES = 13;               // 16 bytes .. 64 KiB
+    static constexpr size_t SLAB_SIZE = 256 * 1024;
+    static constexpr size_t BATCH_BYTES = 16 * 1024;    // moved between a thread cache and the central list at once
+    static constexpr size_t MAX_BATCH = 64;
+    static constexpr uint16_t LARGE_CLASS = 0xFFFF;
+    static constexpr uint32_t ALLOCATED_MAGIC = 0x5EC0A110;
+    static constexpr uint32_t FREE_MAGIC = 0x5EC0F4EE;
+    static constexpr uint16_t TRACKED = 1;
+    
+    struct alignas(16) Header {
+        uint32_t magic;
+        uint16_t size_class;
+        uint16_t flags;
+        size_t size;
+    };
+    static_assert(sizeof(Header) == 16, "blocks must stay 16-byte aligned");
+    
+    struct FreeList {
+        Header* head = nullptr;
+        size_t count = 0;
+    };
+    
+    static SlabAllocator& Instance() {
+        static SlabAllocator* instance = new SlabAllocator();
+        return *instance;
+    }
+    
+    static size_t ClassOf(size_t size) {
+        return size <= 16 ? 0 : 64 - __builtin_clzll(size - 1) - 4;
+    }
+    static size_t ClassSize(size_t size_class) { return size_t(16) << size_class; }
+    static size_t Batch(size_t size_class) {
+        return std::max<size_t>(1, std::min(MAX_BATCH, BATCH_BYTES / (sizeof(Header) + ClassSize(size_class))));
+    }
+    
+    static Header* HeaderOf(void* ptr) { return static_cast<Header*>(ptr) - 1; }
+    static Header*& Next(Header* header) { return *reinterpret_cast<Header**>(header + 1); }
+    
+    // zeroed
+    void* Allocate(size_t size);
+    // the block is zeroed already
+    void Free(Header* header);
+    // of the calling thread
+    void FlushCache();
+    
+    size_t ReservedBytes() const { return reserved_bytes_; }
+    size_t LargeBytes() const { return large_bytes_; }
+    
+private:
+    struct alignas(64) Central {
+        std::mutex mutex;
+        FreeList list;
+    };
+    
+    struct ThreadCache {
+        FreeList lists[CLASSES];
+        ~ThreadCache() { SlabAllocator::Instance().Flush(*this); }
+    };
+    
+    Central central_[CLASSES];
+    std::atomic<size_t> reserved_bytes_{0};
+    std::atomic<size_t> large_bytes_{0};
+    
+    static ThreadCache& Cache() {
+        thread_local ThreadCache cache;
+        return cache;
+    }
+    
+    bool Refill(size_t size_class, FreeList& list);
+    void Release(size_t size_class, FreeList& list, size_t count);
+    void Flush(ThreadCache& cache);
+};
+
+void* SlabAllocator::Allocate(size_t size) {
+    Header* header;
+    if (size > ClassSize(CLASSES - 1)) {
+        header = static_cast<Header*>(calloc(1, sizeof(Header) + size));
+        if (!header) {
+            return nullptr;
+        }
+        header->size_class = LARGE_CLASS;
+        large_bytes_ += size;
+    } else {
+        const size_t size_class = ClassOf(size);
+        FreeList& list = Cache().lists[size_class];
+        if (!list.head && !Refill(size_class, list)) {
+            return nullptr;
+        }
+        header = list.head;
+        list.head = Next(header);
+        list.count--;
+        Next(header) = nullptr;
+        header->size_class = size_class;
+    }
+    header->magic = ALLOCATED_MAGIC;
+    header->flags = 0;
+    header->size = size;
+    return header + 1;
+}
+
+void SlabAllocator::Free(Header* header) {
+    header->magic = FREE_MAGIC;
+    if (header->size_class == LARGE_CLASS) {
+        large_bytes_ -= header->size;
+        free(header);
+        return;
+    }
+    
+    const size_t size_class = header->size_class;
+    FreeList& list = Cache().lists[size_class];
+    Next(header) = list.head;
+    list.head = header;
+    list.count++;
+    if (list.count >= 2 * Batch(size_class)) {
+        Release(size_class, list, Batch(size_class));
+    }
+}
+
+bool SlabAllocator::Refill(size_t size_class, FreeList& list) {
+    Central& central = central_[size_class];
+    const size_t batch = Batch(size_class);
+    std::lock_guard<std::mutex> lock(central.mutex);
+    
+    if (central.list.count < batch) {
+        const size_t stride = sizeof(Header) + ClassSize(size_class);
+        uint8_t* slab = static_cast<uint8_t*>(calloc(1, SLAB_SIZE));
+        if (slab) {
+            reserved_bytes_ += SLAB_SIZE;
+            for (size_t offset = 0; offset + stride <= SLAB_SIZE; offset += stride) {
+                Header* header = reinterpret_cast<Header*>(slab + offset);
+                header->magic = FREE_MAGIC;
+                Next(header) = central.list.head;
+                central.list.head = header;
+                central.list.count++;
+            }
+        }
+    }
+    
+    for (size_t i = 0; i < batch && central.list.head; i++) {
+        Header* header = central.list.head;
+        central.list.head = Next(header);
+        central.list.count--;
+        Next(header) = list.head;
+        list.head = header;
+        list.count++;
+    }
+    return list.head != nullptr;
+}
+
+void SlabAllocator::Release(size_t size_class, FreeList& list, size_t count) {
+    if (!list.head || count == 0) {
+        return;
+    }
+    
+    // detach the first count blocks as a chain
+    Header* first = list.head;
+    Header* last = first;
+    size_t released = 1;
+    while (released < count && Next(last)) {
+        last = Next(last);
+        released++;
+    }
+    list.head = Next(last);
+    list.count -= released;
+    
+    Central& central = central_[size_class];
+    std::lock_guard<std::mutex> lock(central.mutex);
+    Next(last) = central.list.head;
+    central.list.head = first;
+    central.list.count += released;
+}
+
+void SlabAllocator::Flush(ThreadCache& cache) {
+    for (size_t size_class = 0; size_class < CLASSES; size_class++) {
+        Release(size_class, cache.lists[size_class], cache.lists[size_class].count);
+    }
+}
+
+void SlabAllocator::FlushCache() {
+    Flush(Cache());
+}
+
+} // namespace
+
+SecureMemoryManager& SecureMemoryManager::GetInstance() {
+    static SecureMemoryManager instance;
+    return instance;
+}
+
+SecureMemoryManager::SecureMemoryManager() {
+    // Initialize memory management
+}
+
+SecureMemoryManager::~SecureMemoryManager() {
+    // Check for leaks on destruction
+    if (HasLeaks()) {
+        std::cerr << "Memory leaks detected: " << DetectLeaks().size() << " allocations" << std::endl;
+        PrintMemoryReport();
+    }
+}
+
+void* SecureMemoryManager::SecureAlloc(size_t size, const std::string& location) {
+    void* ptr = SlabAllocator::Instance().Allocate(size);
+    if (ptr) {
+        allocated_blocks_.Add();
+        allocated_bytes_.Add(size);
+        if (ShouldTrack()) {
+            SlabAllocator::HeaderOf(ptr)->flags |= SlabAllocator::TRACKED;
+            RecordAllocation(ptr, size, location);
+        }
+    }
+    return ptr;
+}
+
+void SecureMemoryManager::SecureFree(void* ptr) {
+    if (!ptr) return;
+    
+    SlabAllocator::Header* header = SlabAllocator::HeaderOf(ptr);
+    if (header->magic != SlabAllocator::ALLOCATED_MAGIC) {
+        std::cerr << "SecureFree: " << ptr << " is not an allocated block (freed twice?)" << std::endl;
+        return;
+    }
+    
+    if (header->flags & SlabAllocator::TRACKED) {
+        RecordDeallocation(ptr);
+    }
+    freed_blocks_.Add();
+    freed_bytes_.Add(header->size);
+    
+    // Zero memory before freeing
+    SecureZero(ptr, header->size);
+    SlabAllocator::Instance().Free(header);
+}
+
+void* SecureMemoryManager::SecureRealloc(void* ptr, size_t new_size, const std::string& location) {
+    if (!ptr) {
+        return SecureAlloc(new_size, location);
+    }
+    if (new_size == 0) {
+        SecureFree(ptr);
+        return nullptr;
+    }
+    
+    void* new_ptr = SecureAlloc(new_size, location);
+    if (new_ptr) {
+        memcpy(new_ptr, ptr, std::min(new_size, SlabAllocator::HeaderOf(ptr)->size));
+        SecureFree(ptr);
+    }
+    return new_ptr;
+}
+
 void SecureMemoryManager::SecureZero(void* ptr, size_t size) {
     if (ptr && size > 0) {
-        // Use volatile to prevent optimization
-        volatile uint8_t* p = static_cast<volatile uint8_t*>(ptr);
-        for (size_t i = 0; i < size; i++) {
-            p[i] = 0;
+        memset(ptr, 0, size);
+        // keep the compiler from dropping the stores to memory about to be freed
+        __asm__ __volatile__("" : : "r"(ptr) : "memory");
+    }
+}
+
+bool SecureMemoryManager::SecureCompare(const void* ptr1, const void* ptr2, size_t size) {
+    // in constant time, whatever differs
+    const volatile uint8_t* a = static_cast<const volatile uint8_t*>(ptr1);
+    const volatile uint8_t* b = static_cast<const volatile uint8_t*>(ptr2);
+    uint8_t difference = 0;
+    for (size_t i = 0; i < size; i++) {
+        difference |= a[i] ^ b[i];
+    }
+    return difference == 0;
+}
+
+void SecureMemoryManager::SetTrackingMode(MemoryTrackingMode mode, size_t sample_interval) {
+    sample_interval_ = std::max<size_t>(1, sample_interval);
+    tracking_mode_ = mode;
+}
+
+bool SecureMemoryManager::ShouldTrack() const {
+    switch (tracking_mode_.load(std::memory_order_relaxed)) {
+        case MemoryTrackingMode::FULL:
+            return true;
+        case MemoryTrackingMode::SAMPLED: {
+            thread_local size_t allocations = 0;
+            return ++allocations % sample_interval_.load(std::memory_order_relaxed) == 0;
         }
+        default:
+            return false;
     }
 }
 
+SecureMemoryManager::TrackingShard& SecureMemoryManager::ShardOf(void* ptr) {
+    const uint64_t hash = (reinterpret_cast<uintptr_t>(ptr) >> 4) * 0x9E3779B97F4A7C15ull;
+    return tracking_[(hash >> 32) % TRACKING_SHARDS];
+}
+
+size_t SecureMemoryManager::UpdatePeak() const {
+    // freed first, so that the difference cannot underflow
+    const size_t freed = freed_bytes_.Value();
+    const size_t current = allocated_bytes_.Value() - freed;
+    size_t current_peak = peak_allocated_.load();
+    while (current > current_peak && !peak_allocated_.compare_exchange_weak(current_peak, current)) {
+        // Retry
+    }
+    return current;
+}
+
 void SecureMemoryManager::RecordAllocation(void* ptr, size_t size, const std::string& location) {
-    std::lock_guard<std::mutex> lock(allocations_mutex_);
-    
     AllocationInfo info;
     info.ptr = ptr;
     info.size = size;
     info.allocated_at = std::chrono::system_clock::now();
     info.source_location = location;
     
-    allocations_[ptr] = info;
-    
-    size_t current_total = total_allocated_ += size;
-    size_t current_peak = peak_allocated_.load();
-    while (current_total > current_peak && 
-           !peak_allocated_.compare_exchange_weak(current_peak, current_total)) {
-        // Retry
+    TrackingShard& shard = ShardOf(ptr);
+    {
+        std::lock_guard<ProfiledMutex> lock(shard.mutex);
+        shard.allocations[ptr] = std::move(info);
     }
-    
-    allocation_count_++;
+    UpdatePeak();
+}
+
+void SecureMemoryManager::RecordDeallocation(void* ptr) {
+    TrackingShard& shard = ShardOf(ptr);
+    std::lock_guard<ProfiledMutex> lock(shard.mutex);
+    shard.allocations.erase(ptr);
 }
 
 std::vector<SecureMemoryManager::AllocationInfo> SecureMemoryManager::DetectLeaks() const {
-    std::lock_guard<std::mutex> lock(allocations_mutex_);
-    
     std::vector<AllocationInfo> leaks;
-    for (const auto& allocation : allocations_) {
-        leaks.push_back(allocation.second);
+    for (const TrackingShard& shard : tracking_) {
+        std::lock_guard<ProfiledMutex> lock(shard.mutex);
+        for (const auto& allocation : shard.allocations) {
+            leaks.push_back(allocation.second);
+        }
     }
     
+    std::sort(leaks.begin(), leaks.end(), [](const AllocationInfo& a, const AllocationInfo& b) {
+        return a.allocated_at < b.allocated_at;
+    });
     return leaks;
 }
 
+bool SecureMemoryManager::HasLeaks() const {
+    for (const TrackingShard& shard : tracking_) {
+        std::lock_guard<ProfiledMutex> lock(shard.mutex);
+        if (!shard.allocations.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SecureMemoryManager::PrintMemoryReport() const {
+    const MemoryStats stats = GetMemoryStats();
+    std::cout << "Secure memory: " << stats.current_usage_bytes << " bytes in use (peak "
+              << stats.peak_usage_bytes << "), " << stats.allocated_blocks << " blocks allocated, "
+              << stats.freed_blocks << " freed, fragmentation " << std::fixed << std::setprecision(2)
+              << stats.fragmentation_ratio << std::endl;
+    
+    const auto leaks = DetectLeaks();
+    const size_t shown = std::min<size_t>(leaks.size(), 20);
+    for (size_t i = 0; i < shown; i++) {
+        std::cout << "  " << leaks[i].size << " bytes at " << leaks[i].ptr
+                  << (leaks[i].source_location.empty() ? "" : " from " + leaks[i].source_location) << std::endl;
+    }
+    if (leaks.size() > shown) {
+        std::cout << "  ... and " << leaks.size() - shown << " more" << std::endl;
+    }
+}
+
 MemoryStats SecureMemoryManager::GetMemoryStats() const {
     MemoryStats stats;
     
-    std::lock_guard<std::mutex> lock(allocations_mutex_);
-    
-    stats.current_usage_bytes = total_allocated_;
+    stats.current_usage_bytes = UpdatePeak();
     stats.peak_usage_bytes = peak_allocated_;
-    stats.allocated_blocks = allocation_count_;
-    stats.freed_blocks = deallocation_count_;
+    stats.allocated_blocks = allocated_blocks_.Value();
+    stats.freed_blocks = freed_blocks_.Value();
     stats.last_updated = std::chrono::system_clock::now();
     
-    // Calculate fragmentation (simplified)
-    if (allocations_.size() > 0) {
-        stats.fragmentation_ratio = static_cast<double>(allocations_.size()) / allocation_count_;
+    // the share of the slabs not in use, incl. the unused rest of each block
+    const SlabAllocator& slabs = SlabAllocator::Instance();
+    const size_t reserved = slabs.ReservedBytes();
+    if (reserved > 0) {
+        const size_t large = slabs.LargeBytes();
+        const size_t in_slabs = stats.current_usage_bytes > large ? stats.current_usage_bytes - large : 0;
+        stats.fragmentation_ratio = 1.0 - std::min(1.0, static_cast<double>(in_slabs) / reserved);
     }
     
     return stats;
 }
 
-namespace SecurityUtils {
+void* SecureMemoryManager::AllocateFromPool(size_t size) {
+    return SlabAllocator::Instance().Allocate(size);
+}
 
-std::string CalculateSHA256(const std::vector<uint8_t>& data) {
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256(data.data(), data.size(), hash);
+void SecureMemoryManager::ReturnToPool(void* ptr, size_t size) {
+    if (!ptr) return;
     
-    std::ostringstream ss;
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
+    SlabAllocator::Header* header = SlabAllocator::HeaderOf(ptr);
+    if (header->magic != SlabAllocator::ALLOCATED_MAGIC || header->size != size) {
+        std::cerr << "ReturnToPool: " << ptr << " is not an allocated block of " << size << " bytes" << std::endl;
+        return;
     }
     
-    return ss.str();
+    SecureZero(ptr, size);
+    SlabAllocator::Instance().Free(header);
 }
 
-std::string CalculateMD5(const std::vector<uint8_t>& data) {
-    unsigned char hash[MD5_DIGEST_LENGTH];
-    MD5(data.data(), data.size(), hash);
+void SecureMemoryManager::OptimizePools() {
+    SlabAllocator::Instance().FlushCache();
+}
+
+// ResourceSampler implementation
+ResourceSampler::ResourceSampler(std::chrono::milliseconds interval)
+    : interval_(interval),
+      stat_fd_(open("/proc/self/stat", O_RDONLY | O_CLOEXEC)),
+      statm_fd_(open("/proc/self/statm", O_RDONLY | O_CLOEXEC)) {
+}
+
+ResourceSampler::~ResourceSampler() {
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex_);
+        stop_ = true;
+    }
+    stop_condition_.notify_all();
+    if (sampler_.joinable()) {
+        sampler_.join();
+    }
+    if (stat_fd_ != -1) {
+        close(stat_fd_);
+    }
+    if (statm_fd_ != -1) {
+        close(statm_fd_);
+    }
+}
+
+ResourceSampler& ResourceSampler::Global() {
+    static ResourceSampler sampler;
+    return sampler;
+}
+
+void ResourceSampler::Start() {
+    std::lock_guard<std::mutex> control(control_mutex_);
+    if (users_++ > 0) {
+        return;
+    }
+    Sample();
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex_);
+        stop_ = false;
+    }
+    sampler_ = std::thread(&ResourceSampler::Run, this);
+}
+
+void ResourceSampler::Stop() {
+    std::lock_guard<std::mutex> control(control_mutex_);
+    if (users_ == 0 || --users_ > 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex_);
+        stop_ = true;
+    }
+    stop_condition_.notify_all();
+    sampler_.join();
+}
+
+void ResourceSampler::Run() {
+    std::unique_lock<std::mutex> lock(thread_mutex_);
+    auto next = std::chrono::steady_clock::now() + interval_;
+    while (!stop_condition_.wait_until(lock, next, [this] { return stop_; })) {
+        lock.unlock();
+        Sample();
+        lock.lock();
+        next += interval_;
+    }
+}
+
+void ResourceSampler::Sample() {
+    std::lock_guard<std::mutex> lock(sample_mutex_);
+    char buffer[1024];
+    
+    // the fields after the command, which may contain anything: state is
+    // the 3rd, utime and stime the 14th and 15th, num_threads the 20th
+    uint64_t ticks = 0;
+    size_t threads = 0;
+    ssize_t length = stat_fd_ == -1 ? -1 : pread(stat_fd_, buffer, sizeof(buffer) - 1, 0);
+    if (length > 0) {
+        buffer[length] = '\0';
+        const char* field = strrchr(buffer, ')');
+        for (int number = 2; field && number < 20; number++) {
+            field = strchr(field + 1, ' ');
+            if (field && (number + 1 == 14 || number + 1 == 15)) {
+                ticks += strtoull(field + 1, nullptr, 10);
+            } else if (field && number + 1 == 20) {
+                threads = strtoull(field + 1, nullptr, 10);
+            }
+        }
+    }
     
-    std::ostringstream ss;
-    for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
+    size_t resident = 0;
+    length = statm_fd_ == -1 ? -1 : pread(statm_fd_, buffer, sizeof(buffer) - 1, 0);
+    if (length > 0) {
+        buffer[length] = '\0';
+        const char* field = strchr(buffer, ' ');
+        if (field) {
+            resident = strtoull(field + 1, nullptr, 10) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        }
     }
     
-    return ss.str();
+    // there is only one writer: the slot is filled before it is published
+    const uint64_t index = published_.load(std::memory_order_relaxed);
+    Slot& slot = slots_[index % HISTORY];
+    slot.time_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count(), std::memory_order_relaxed);
+    slot.cpu_ticks.store(ticks, std::memory_order_relaxed);
+    slot.memory_usage.store(resident, std::memory_order_relaxed);
+    slot.thread_count.store(threads, std::memory_order_relaxed);
+    published_.store(index + 1, std::memory_order_release);
 }
 
-std::vector<uint8_t> GenerateRandomBytes(size_t count) {
-    std::vector<uint8_t> buffer(count);
+bool ResourceSampler::Read(uint64_t index, uint64_t& ticks, ResourceSample& sample) const {
+    const Slot& slot = slots_[index % HISTORY];
+    sample.time = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(slot.time_ns.load(std::memory_order_relaxed)));
+    ticks = slot.cpu_ticks.load(std::memory_order_relaxed);
+    sample.memory_usage = slot.memory_usage.load(std::memory_order_relaxed);
+    sample.thread_count = slot.thread_count.load(std::memory_order_relaxed);
+    
+    // the slot is reused for sample index + HISTORY, which is written before it is published
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return published_.load(std::memory_order_relaxed) < index + HISTORY;
+}
+
+ResourceSample ResourceSampler::Between(uint64_t from, uint64_t to) const {
+    static const double TICKS_PER_SECOND = static_cast<double>(sysconf(_SC_CLK_TCK));
+    for (;;) {
+        ResourceSample first;
+        ResourceSample sample;
+        uint64_t first_ticks;
+        uint64_t ticks;
+        if (!Read(from, first_ticks, first) || !Read(to, ticks, sample)) {
+            // overtaken by the sampler; the latest ones are still there
+            const uint64_t published = published_.load(std::memory_order_acquire);
+            from = std::max(from, published - HISTORY / 2);
+            to = std::max(to, published - 1);
+            continue;
+        }
+        
+        const double wall = std::chrono::duration<double>(sample.time - first.time).count();
+        sample.cpu_usage = wall > 0 ? 100.0 * (ticks - first_ticks) / TICKS_PER_SECOND / wall : 0.0;
+        return sample;
+    }
+}
+
+ResourceSample ResourceSampler::Latest() const {
+    const uint64_t published = published_.load(std::memory_order_acquire);
+    if (published == 0) {
+        return ResourceSample();
+    }
+    return Between(published > 1 ? published - 2 : 0, published - 1);
+}
+
+double ResourceSampler::CPUUsage(std::chrono::milliseconds window) const {
+    const uint64_t published = published_.load(std::memory_order_acquire);
+    if (published == 0) {
+        return 0.0;
+    }
+    const uint64_t intervals = std::max<int64_t>(1, window / interval_);
+    const uint64_t span = std::min<uint64_t>({intervals, published - 1, HISTORY - 2});
+    return Between(published - 1 - span, published - 1).cpu_usage;
+}
+
+std::vector<ResourceSample> ResourceSampler::History() const {
+    const uint64_t published = published_.load(std::memory_order_acquire);
+    const uint64_t first = published >= HISTORY ? published - HISTORY + 1 : 0;
+    std::vector<ResourceSample> history;
+    history.reserve(published - first);
+    for (uint64_t index = first; index < published; index++) {
+        history.push_back(Between(index > 0 ? index - 1 : 0, index));
+    }
+    return history;
+}
+
+// PerformanceMonitor implementation
+PerformanceMonitor::PerformanceMonitor()
+    : reset_time_(std::chrono::steady_clock::now()) {
+    ResourceSampler::Global().Start();
+}
+
+PerformanceMonitor::~PerformanceMonitor() {
+    ResourceSampler::Global().Stop();
+}
+
+PerformanceMonitor::ScopedTimer::ScopedTimer(PerformanceMonitor& monitor, const std::string& operation)
+    : monitor_(monitor), operation_(TimingOperation::Intern(operation)), start_ticks_(TimingClock::Now()) {
+}
+
+// started timings of the thread, by operation
+static thread_local uint64_t timing_starts[TimingOperation::MAX_OPERATIONS];
+
+void PerformanceMonitor::StartTiming(const TimingOperation& operation) {
+    timing_starts[operation.id] = TimingClock::Now();
+}
+
+void PerformanceMonitor::EndTiming(const TimingOperation& operation) {
+    const uint64_t end = TimingClock::Now();
+    if (monitoring_active_.load(std::memory_order_relaxed) && timing_starts[operation.id]) {
+        Timings::Record(operation.id, end - timing_starts[operation.id]);
+    }
+    timing_starts[operation.id] = 0;
+}
+
+void PerformanceMonitor::StartTiming(const std::string& operation) {
+    StartTiming(TimingOperation(operation));
+}
+
+void PerformanceMonitor::EndTiming(const std::string& operation) {
+    EndTiming(TimingOperation(operation));
+}
+
+PerformanceMonitor::ScopedTimer PerformanceMonitor::CreateScopedTimer(const std::string& operation) {
+    return ScopedTimer(*this, operation);
+}
+
+TimingSnapshot PerformanceMonitor::ReadSince(size_t operation) const {
+    TimingSnapshot snapshot = Timings::Read(operation);
+    std::lock_guard<std::mutex> lock(baseline_mutex_);
+    auto baseline = baselines_.find(operation);
+    if (baseline != baselines_.end()) {
+        snapshot -= baseline->second;
+    }
+    return snapshot;
+}
+
+static PerformanceMetrics ToPerformanceMetrics(const TimingSnapshot& snapshot, double seconds) {
+    PerformanceMetrics metrics;
+    metrics.operation_count = snapshot.count;
+    metrics.average_processing_time = std::chrono::microseconds(std::llround(snapshot.MeanNanoseconds() / 1000));
+    metrics.peak_processing_time = std::chrono::microseconds(std::llround(snapshot.MaxNanoseconds() / 1000));
+    metrics.median_processing_time = std::chrono::nanoseconds(std::llround(snapshot.PercentileNanoseconds(50)));
+    metrics.p99_processing_time = std::chrono::nanoseconds(std::llround(snapshot.PercentileNanoseconds(99)));
+    metrics.operations_per_second = seconds > 0 ? static_cast<size_t>(snapshot.count / seconds) : 0;
+    metrics.measurement_time = std::chrono::system_clock::now();
+    return metrics;
+}
+
+PerformanceMetrics PerformanceMonitor::GetMetrics(const std::string& operation) const {
+    // without interning unknown names
+    const auto names = TimingOperation::Names();
+    const auto it = std::find(names.begin(), names.end(), operation);
+    if (it == names.end()) {
+        return PerformanceMetrics();
+    }
+    
+    std::chrono::duration<double> elapsed;
+    {
+        std::lock_guard<std::mutex> lock(baseline_mutex_);
+        elapsed = std::chrono::steady_clock::now() - reset_time_;
+    }
+    return ToPerformanceMetrics(ReadSince(it - names.begin()), elapsed.count());
+}
+
+std::map<std::string, PerformanceMetrics> PerformanceMonitor::GetAllMetrics() const {
+    std::chrono::duration<double> elapsed;
+    {
+        std::lock_guard<std::mutex> lock(baseline_mutex_);
+        elapsed = std::chrono::steady_clock::now() - reset_time_;
+    }
+    
+    std::map<std::string, PerformanceMetrics> all;
+    const auto names = TimingOperation::Names();
+    for (size_t id = 0; id < names.size(); id++) {
+        const TimingSnapshot snapshot = ReadSince(id);
+        if (snapshot.count > 0) {
+            all[names[id]] = ToPerformanceMetrics(snapshot, elapsed.count());
+        }
+    }
+    return all;
+}
+
+void PerformanceMonitor::PrintPerformanceReport() const {
+    std::cout << "Performance report:" << std::endl;
+    for (const auto& [operation, metrics] : GetAllMetrics()) {
+        std::cout << "  " << operation << ": " << metrics.operation_count << " calls, median "
+                  << metrics.median_processing_time.count() << " ns, p99 " << metrics.p99_processing_time.count()
+                  << " ns, peak " << metrics.peak_processing_time.count() << " us" << std::endl;
+    }
+    std::cout << "  CPU " << std::fixed << std::setprecision(1) << GetCPUUsage() << "%, memory "
+              << GetMemoryUsage() / 1024 << " KiB, " << GetThreadCount() << " threads" << std::endl;
+}
+
+double PerformanceMonitor::GetCPUUsage() const {
+    return ResourceSampler::Global().Latest().cpu_usage;
+}
+
+size_t PerformanceMonitor::GetMemoryUsage() const {
+    return ResourceSampler::Global().Latest().memory_usage;
+}
+
+size_t PerformanceMonitor::GetThreadCount() const {
+    return ResourceSampler::Global().Latest().thread_count;
+}
+
+void PerformanceMonitor::Enable() {
+    monitoring_active_ = true;
+}
+
+void PerformanceMonitor::Disable() {
+    monitoring_active_ = false;
+}
+
+void PerformanceMonitor::Reset() {
+    const auto names = TimingOperation::Names();
+    std::map<size_t, TimingSnapshot> baselines;
+    for (size_t id = 0; id < names.size(); id++) {
+        baselines[id] = Timings::Read(id);
+    }
+    
+    std::lock_guard<std::mutex> lock(baseline_mutex_);
+    baselines_ = std::move(baselines);
+    reset_time_ = std::chrono::steady_clock::now();
+}
+
+void PerformanceMonitor::ResetOperation(const std::string& operation) {
+    const size_t id = TimingOperation::Intern(operation);
+    TimingSnapshot baseline = Timings::Read(id);
+    std::lock_guard<std::mutex> lock(baseline_mutex_);
+    baselines_[id] = baseline;
+}
+
+// ThreadPool implementation
+ThreadPool::ThreadPool(size_t thread_count, const std::vector<int>& cpus) : cpus_(cpus) {
+    Resize(thread_count);
+}
+
+ThreadPool::~ThreadPool() {
+    Stop();
+}
+
+void ThreadPool::Enqueue(PoolTask task, TaskPriority priority) {
+    const size_t p = static_cast<size_t>(priority);
+    pending_tasks_.fetch_add(1, std::memory_order_seq_cst);
+    
+    bool queued = false;
+    if (current_pool_ == this) {
+        queued = workers_[current_worker_]->deques[p].Push(std::move(task));
+    }
+    if (!queued && running_) {
+        queued = injected_[p].Push(std::move(task));
+    }
+    if (!queued) {
+        // stopped or all full, run in the caller's thread
+        RunTask(task);
+        return;
+    }
+    
+    // pairs with the sleeping worker checking pending_tasks_ after registering
+    if (sleeping_workers_.load(std::memory_order_seq_cst) > 0) {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        wake_condition_.notify_one();
+    }
+}
+
+bool ThreadPool::FindTask(size_t worker, PoolTask& task) {
+    const size_t count = workers_.size();
+    for (size_t p = 0; p < PRIORITIES; p++) {
+        if (workers_[worker]->deques[p].Pop(task) || injected_[p].Pop(task)) {
+            return true;
+        }
+        for (size_t i = 1; i < count; i++) {
+            if (workers_[(worker + i) % count]->deques[p].Steal(task)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ThreadPool::RunTask(PoolTask& task) {
+    // counted as active before it is no longer pending, for WaitForAllTasks()
+    active_tasks_++;
+    pending_tasks_--;
+    try {
+        task();
+    } catch (const std::exception& e) {
+        std::cerr << "Error in thread pool task: " << e.what() << std::endl;
+    }
+    task.Reset();
+    
+    if (active_tasks_.fetch_sub(1) == 1 && pending_tasks_ == 0) {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        done_condition_.notify_all();
+    }
+}
+
+void ThreadPool::WorkerLoop(size_t worker) {
+    current_pool_ = this;
+    current_worker_ = worker;
+    if (!cpus_.empty()) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpus_[worker % cpus_.size()], &cpu_set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0) {
+            std::cerr << "Could not pin thread pool worker to CPU " << cpus_[worker % cpus_.size()] << std::endl;
+        }
+    }
     
-    if (RAND_bytes(buffer.data(), count) != 1) {
-        // Fallback to system random
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_int_distribution<> dis(0, 255);
+    PoolTask task;
+    while (!stop_) {
+        if (FindTask(worker, task)) {
+            RunTask(task);
+            continue;
+        }
         
-        for (auto& byte : buffer) {
-            byte = static_cast<uint8_t>(dis(gen));
+        // nothing to take, though a task may still be on its way into a queue
+        if (pending_tasks_ > 0) {
+            std::this_thread::yield();
+            continue;
         }
+        
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        sleeping_workers_.fetch_add(1, std::memory_order_seq_cst);
+        wake_condition_.wait(lock, [this]() {
+            return stop_ || pending_tasks_.load(std::memory_order_seq_cst) > 0;
+        });
+        sleeping_workers_--;
+    }
+    current_pool_ = nullptr;
+}
+
+size_t ThreadPool::GetThreadCount() const {
+    return workers_.size();
+}
+
+size_t ThreadPool::GetActiveTaskCount() const {
+    return active_tasks_;
+}
+
+size_t ThreadPool::GetQueuedTaskCount() const {
+    return pending_tasks_;
+}
+
+void ThreadPool::WaitForAllTasks() {
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    done_condition_.wait(lock, [this]() { return !running_ || (pending_tasks_ == 0 && active_tasks_ == 0); });
+}
+
+void ThreadPool::Stop() {
+    // queued tasks are completed first
+    WaitForAllTasks();
+    Resize(0);
+}
+
+void ThreadPool::Resize(size_t new_thread_count) {
+    // the workers finish their current tasks; queued ones wait for the new workers
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stop_ = true;
+    }
+    wake_condition_.notify_all();
+    for (auto& worker : workers_) {
+        worker->thread.join();
     }
     
-    return buffer;
+    // hand the tasks in the old workers' deques over
+    PoolTask task;
+    for (auto& worker : workers_) {
+        for (size_t p = 0; p < PRIORITIES; p++) {
+            while (worker->deques[p].Steal(task)) {
+                if (new_thread_count == 0 || !injected_[p].Push(std::move(task))) {
+                    RunTask(task);
+                }
+            }
+        }
+    }
+    
+    workers_.clear();
+    stop_ = false;
+    for (size_t i = 0; i < new_thread_count; i++) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    running_ = new_thread_count > 0;
+    for (size_t i = 0; i < new_thread_count; i++) {
+        workers_[i]->thread = std::thread(&ThreadPool::WorkerLoop, this, i);
+    }
+    
+    if (!running_) {
+        // submitted while stopping
+        for (size_t p = 0; p < PRIORITIES; p++) {
+            while (injected_[p].Pop(task)) {
+                RunTask(task);
+            }
+        }
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        done_condition_.notify_all();
+    }
 }
 
-bool VerifyChecksum(const std::vector<uint8_t>& data, const std::string& expected_hash, const std::string& algorithm) {
-    std::string calculated_hash;
+// Hasher implementation
+Hasher::Hasher(Algorithm algorithm) : context_(EVP_MD_CTX_new()), algorithm_(algorithm) {
+    Reset();
+}
+
+Hasher::~Hasher() {
+    EVP_MD_CTX_free(context_);
+}
+
+Hasher::Hasher(Hasher&& other) noexcept
+    : context_(other.context_), algorithm_(other.algorithm_), failed_(other.failed_) {
+    other.context_ = nullptr;
+}
+
+Hasher& Hasher::operator=(Hasher&& other) noexcept {
+    std::swap(context_, other.context_);
+    std::swap(algorithm_, other.algorithm_);
+    std::swap(failed_, other.failed_);
+    return *this;
+}
+
+void Hasher::Reset() {
+    const EVP_MD* md = algorithm_ == Algorithm::MD5 ? EVP_md5() : EVP_sha256();
+    failed_ = !context_ || EVP_DigestInit_ex(context_, md, nullptr) != 1;
+}
+
+bool Hasher::Update(const void* data, size_t size) {
+    if (failed_ || !context_) {
+        return false;
+    }
+    if (size > 0 && EVP_DigestUpdate(context_, data, size) != 1) {
+        failed_ = true;
+    }
+    return !failed_;
+}
+
+bool Hasher::UpdateField(const void* data, uint64_t size) {
+    return Update(&size, sizeof(size)) && Update(data, size);
+}
+
+bool Hasher::UpdateFromFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    
+    uint8_t buffer[64 * 1024];
+    bool ok = true;
+    for (;;) {
+        ssize_t got = read(fd, buffer, sizeof(buffer));
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            ok = got == 0;
+            break;
+        }
+        if (!Update(buffer, got)) {
+            ok = false;
+            break;
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+std::string Hasher::Final() {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    std::string result;
+    if (!failed_ && context_ && EVP_DigestFinal_ex(context_, digest, &digest_len) == 1) {
+        result.assign(reinterpret_cast<const char*>(digest), digest_len);
+    }
+    Reset();
+    return result;
+}
+
+std::string Hasher::FinalHex() {
+    return SecurityUtils::ToHex(Final());
+}
+
+bool Hasher::ParseAlgorithm(const std::string& name, Algorithm& algorithm) {
+    if (name == "SHA256") {
+        algorithm = Algorithm::SHA256;
+    } else if (name == "MD5") {
+        algorithm = Algorithm::MD5;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// SafeBuffer implementation
+SafeBuffer::SafeBuffer(size_t capacity, size_t max_capacity)
+    : max_capacity_(std::max(capacity, max_capacity)) {
+    Reserve(capacity);
+}
+
+SafeBuffer::SafeBuffer(const void* data, size_t size) : SafeBuffer(size) {
+    Write(0, data, size);
+}
+
+SafeBuffer::SafeBuffer(const SafeBuffer& other) : SafeBuffer(other.size_, other.max_capacity_) {
+    Write(0, other.Storage(), other.size_);
+    read_only_ = other.read_only_;
+}
+
+SafeBuffer::SafeBuffer(SafeBuffer&& other) noexcept : max_capacity_(other.max_capacity_) {
+    *this = std::move(other);
+}
+
+SafeBuffer& SafeBuffer::operator=(const SafeBuffer& other) {
+    if (this != &other) {
+        *this = SafeBuffer(other);
+    }
+    return *this;
+}
+
+SafeBuffer& SafeBuffer::operator=(SafeBuffer&& other) noexcept {
+    if (this != &other) {
+        heap_ = std::move(other.heap_);
+        on_heap_ = other.on_heap_;
+        size_ = other.size_;
+        max_capacity_ = other.max_capacity_;
+        read_only_ = other.read_only_;
+        if (!on_heap_) {
+            memcpy(inline_, other.inline_, size_);
+        }
+        other.heap_.clear();
+        other.on_heap_ = false;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+bool SafeBuffer::Grow(size_t needed, bool exact) {
+    const size_t storage = on_heap_ ? heap_.capacity() : INLINE_CAPACITY;
+    if (needed <= storage) {
+        return true;
+    }
+    if (needed > max_capacity_) {
+        return false;
+    }
     
-    if (algorithm == "SHA256") {
-        calculated_hash = CalculateSHA256(data);
-    } else if (algorithm == "MD5") {
-        calculated_hash = CalculateMD5(data);
+    const size_t capacity = exact ? needed : std::min(std::max(needed, 2 * storage), max_capacity_);
+    if (on_heap_) {
+        heap_.reserve(capacity);
+    } else {
+        std::vector<uint8_t> heap;
+        heap.reserve(capacity);
+        heap.assign(inline_, inline_ + size_);
+        heap_ = std::move(heap);
+        on_heap_ = true;
+    }
+    return true;
+}
+
+void SafeBuffer::SetSize(size_t size) {
+    if (on_heap_) {
+        heap_.resize(size);
+    } else if (size > size_) {
+        memset(inline_ + size_, 0, size - size_);
+    }
+    size_ = size;
+}
+
+bool SafeBuffer::Write(size_t offset, const void* data, size_t length) {
+    if (read_only_ || !InBounds(offset, length, max_capacity_) || !Grow(offset + length)) {
+        return false;
+    }
+    if (offset + length > size_) {
+        SetSize(offset + length);
+    }
+    if (length > 0) {
+        memcpy(Storage() + offset, data, length);
+    }
+    return true;
+}
+
+bool SafeBuffer::Read(size_t offset, void* data, size_t length) const {
+    if (!InBounds(offset, length, size_)) {
+        return false;
+    }
+    if (length > 0) {
+        memcpy(data, Storage() + offset, length);
+    }
+    return true;
+}
+
+bool SafeBuffer::Append(const void* data, size_t length) {
+    return Write(size_, data, length);
+}
+
+bool SafeBuffer::WriteString(size_t offset, const std::string& str) {
+    return Write(offset, str.data(), str.size());
+}
+
+std::string SafeBuffer::ReadString(size_t offset, size_t max_length) const {
+    if (offset >= size_) {
+        return std::string();
+    }
+    const char* text = reinterpret_cast<const char*>(Storage()) + offset;
+    return std::string(text, std::min(max_length, size_ - offset));
+}
+
+void SafeBuffer::Clear() {
+    if (!read_only_) {
+        SetSize(0);
+    }
+}
+
+bool SafeBuffer::Resize(size_t new_size) {
+    if (read_only_ || !Grow(new_size)) {
+        return false;
+    }
+    SetSize(new_size);
+    return true;
+}
+
+bool SafeBuffer::Reserve(size_t new_capacity) {
+    return Grow(new_capacity, true);
+}
+
+void SafeBuffer::SetMaxCapacity(size_t max_capacity) {
+    max_capacity_ = std::max(max_capacity, size_);
+}
+
+std::vector<uint8_t> SafeBuffer::Release() {
+    std::vector<uint8_t> data;
+    if (on_heap_) {
+        data = std::move(heap_);
+        heap_.clear();
+        on_heap_ = false;
     } else {
+        data.assign(inline_, inline_ + size_);
+    }
+    size_ = 0;
+    return data;
+}
+
+void SafeBuffer::Adopt(std::vector<uint8_t>&& data) {
+    heap_ = std::move(data);
+    on_heap_ = true;
+    size_ = heap_.size();
+    max_capacity_ = std::max(max_capacity_, size_);
+}
+
+// SecureRandom implementation
+static inline uint32_t RotateLeft(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static inline uint32_t LoadLE32(const uint8_t* bytes) {
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+}
+
+void SecureRandom::Block(const uint8_t key[32], uint32_t counter, const uint8_t nonce[12], uint8_t out[64]) {
+    // "expand 32-byte k", the key, the counter and the nonce
+    uint32_t input[16] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+    for (int i = 0; i < 8; i++) {
+        input[4 + i] = LoadLE32(key + 4 * i);
+    }
+    input[12] = counter;
+    for (int i = 0; i < 3; i++) {
+        input[13 + i] = LoadLE32(nonce + 4 * i);
+    }
+    
+    uint32_t x[16];
+    memcpy(x, input, sizeof(x));
+    auto quarter_round = [&x](int a, int b, int c, int d) {
+        x[a] += x[b]; x[d] = RotateLeft(x[d] ^ x[a], 16);
+        x[c] += x[d]; x[b] = RotateLeft(x[b] ^ x[c], 12);
+        x[a] += x[b]; x[d] = RotateLeft(x[d] ^ x[a], 8);
+        x[c] += x[d]; x[b] = RotateLeft(x[b] ^ x[c], 7);
+    };
+    for (int round = 0; round < 10; round++) {
+        // columns, then diagonals
+        quarter_round(0, 4, 8, 12);
+        quarter_round(1, 5, 9, 13);
+        quarter_round(2, 6, 10, 14);
+        quarter_round(3, 7, 11, 15);
+        quarter_round(0, 5, 10, 15);
+        quarter_round(1, 6, 11, 12);
+        quarter_round(2, 7, 8, 13);
+        quarter_round(3, 4, 9, 14);
+    }
+    for (int i = 0; i < 16; i++) {
+        const uint32_t word = x[i] + input[i];
+        out[4 * i] = (uint8_t) word;
+        out[4 * i + 1] = (uint8_t) (word >> 8);
+        out[4 * i + 2] = (uint8_t) (word >> 16);
+        out[4 * i + 3] = (uint8_t) (word >> 24);
+    }
+}
+
+// counts forks in the child; a thread state of an older generation is reseeded
+static std::atomic<uint32_t> random_fork_generation{0};
+
+namespace {
+
+struct RandomState {
+    uint8_t key[32];
+    uint8_t buffer[SecureRandom::BLOCKS * 64];
+    size_t available = 0;       // at the end of the buffer
+    size_t since_reseed = 0;
+    uint32_t fork_generation = 0;
+    bool seeded = false;
+    
+    ~RandomState() {
+        OPENSSL_cleanse(key, sizeof(key));
+        OPENSSL_cleanse(buffer, sizeof(buffer));
+    }
+    
+    void Seed() {
+        static std::once_flag at_fork;
+        std::call_once(at_fork, [] {
+            pthread_atfork(nullptr, nullptr, [] { random_fork_generation++; });
+        });
+        
+        size_t got = 0;
+        while (got < sizeof(key)) {
+            const ssize_t n = getrandom(key + got, sizeof(key) - got, 0);
+            if (n > 0) {
+                got += n;
+            } else if (n == -1 && errno != EINTR) {
+                break;
+            }
+        }
+        if (got < sizeof(key) && RAND_bytes(key, sizeof(key)) != 1) {
+            // rather than going on with a predictable key
+            std::cerr << "SecureRandom: no entropy available" << std::endl;
+            std::abort();
+        }
+        since_reseed = 0;
+        seeded = true;
+    }
+    
+    void Refill() {
+        if (!seeded || since_reseed >= SecureRandom::RESEED_BYTES) {
+            Seed();
+        }
+        static const uint8_t nonce[12] = {};
+        for (size_t i = 0; i < SecureRandom::BLOCKS; i++) {
+            SecureRandom::Block(key, i, nonce, buffer + 64 * i);
+        }
+        memcpy(key, buffer, sizeof(key));
+        OPENSSL_cleanse(buffer, sizeof(key));
+        available = sizeof(buffer) - sizeof(key);
+    }
+    
+    void Take(uint8_t* out, size_t size) {
+        // a forked child must not hand out what its parent may too
+        const uint32_t generation = random_fork_generation.load(std::memory_order_relaxed);
+        if (fork_generation != generation) {
+            fork_generation = generation;
+            seeded = false;
+            available = 0;
+        }
+        
+        while (size > 0) {
+            if (available == 0) {
+                Refill();
+            }
+            const size_t n = std::min(size, available);
+            uint8_t* from = buffer + sizeof(buffer) - available;
+            memcpy(out, from, n);
+            memset(from, 0, n);
+            available -= n;
+            since_reseed += n;
+            out += n;
+            size -= n;
+        }
+    }
+};
+
+thread_local RandomState random_state;
+
+} // namespace
+
+void SecureRandom::Fill(void* data, size_t size) {
+    random_state.Take(static_cast<uint8_t*>(data), size);
+}
+
+uint64_t SecureRandom::Next64() {
+    uint64_t value;
+    random_state.Take(reinterpret_cast<uint8_t*>(&value), sizeof(value));
+    return value;
+}
+
+uint32_t SecureRandom::Uniform(uint32_t bound) {
+    // values below 2^32 mod bound would come up once more often
+    const uint32_t threshold = -bound % bound;
+    for (;;) {
+        uint32_t value;
+        random_state.Take(reinterpret_cast<uint8_t*>(&value), sizeof(value));
+        if (value >= threshold) {
+            return value % bound;
+        }
+    }
+}
+
+namespace SecurityUtils {
+
+static void WriteHex(const uint8_t* bytes, size_t size, char* out) {
+    static const struct HexTable {
+        char pairs[256][2];
+        HexTable() {
+            static const char digits[] = "0123456789abcdef";
+            for (int i = 0; i < 256; i++) {
+                pairs[i][0] = digits[i >> 4];
+                pairs[i][1] = digits[i & 0xF];
+            }
+        }
+    } table;
+    
+    for (size_t i = 0; i < size; i++) {
+        memcpy(out + 2 * i, table.pairs[bytes[i]], 2);
+    }
+}
+
+std::string ToHex(const void* data, size_t size) {
+    std::string hex(2 * size, '\0');
+    WriteHex(static_cast<const uint8_t*>(data), size, &hex[0]);
+    return hex;
+}
+
+std::string CalculateSHA256(const void* data, size_t size) {
+    Hasher hasher(Hasher::Algorithm::SHA256);
+    hasher.Update(data, size);
+    return hasher.FinalHex();
+}
+
+std::string CalculateSHA256(const std::vector<uint8_t>& data) {
+    return CalculateSHA256(data.data(), data.size());
+}
+
+std::string CalculateHMACSHA256(const std::string& key, const void* data, size_t size) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_size = 0;
+    if (!HMAC(EVP_sha256(), key.data(), static_cast<int>(key.size()), static_cast<const unsigned char*>(data), size,
+              digest, &digest_size)) {
+        return "";
+    }
+    return ToHex(digest, digest_size);
+}
+
+std::string CalculateMD5(const void* data, size_t size) {
+    Hasher hasher(Hasher::Algorithm::MD5);
+    hasher.Update(data, size);
+    return hasher.FinalHex();
+}
+
+std::string CalculateMD5(const std::vector<uint8_t>& data) {
+    return CalculateMD5(data.data(), data.size());
+}
+
+std::vector<uint8_t> GenerateRandomBytes(size_t count) {
+    std::vector<uint8_t> buffer(count);
+    SecureRandom::Fill(buffer.data(), count);
+    return buffer;
+}
+
+std::string GenerateRandomString(size_t length, const std::string& charset) {
+    std::string random(charset.empty() ? 0 : length, '\0');
+    for (char& c : random) {
+        c = charset[SecureRandom::Uniform(charset.size())];
+    }
+    return random;
+}
+
+std::string GenerateID(std::string_view prefix, size_t random_bytes) {
+    uint8_t bytes[32];
+    random_bytes = std::min(random_bytes, sizeof(bytes));
+    SecureRandom::Fill(bytes, random_bytes);
+    
+    std::string id(prefix.size() + 2 * random_bytes, '\0');
+    memcpy(&id[0], prefix.data(), prefix.size());
+    WriteHex(bytes, random_bytes, &id[prefix.size()]);
+    return id;
+}
+
+bool VerifyChecksum(const void* data, size_t size, const std::string& expected_hash, const std::string& algorithm) {
+    Hasher::Algorithm parsed;
+    if (!Hasher::ParseAlgorithm(algorithm, parsed)) {
+        return false;
+    }
+    Hasher hasher(parsed);
+    hasher.Update(data, size);
+    const std::string calculated_hash = hasher.FinalHex();
+    if (calculated_hash.empty() || expected_hash.size() != calculated_hash.size()) {
         return false;
     }
     
-    return calculated_hash == expected_hash;
+    uint8_t difference = 0;
+    for (size_t i = 0; i < calculated_hash.size(); i++) {
+        difference |= static_cast<uint8_t>(std::tolower(static_cast<unsigned char>(expected_hash[i])) ^ calculated_hash[i]);
+    }
+    return difference == 0;
+}
+
+bool VerifyChecksum(const std::vector<uint8_t>& data, const std::string& expected_hash, const std::string& algorithm) {
+    return VerifyChecksum(data.data(), data.size(), expected_hash, algorithm);
 }
 
 bool RunSecuritySelfTest() {
@@ -643,6 +2413,34 @@ bool RunSecuritySelfTest() {
     }
 }
 
+std::vector<std::string> GetSecurityWarnings() {
+    std::vector<std::string> warnings;
+    
+    if (geteuid() == 0) {
+        warnings.push_back("running as root");
+    }
+    
+    // from /proc, as setting it to read it would race with other threads
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "Umask:") == 0) {
+            if (!(std::stoul(line.substr(6), nullptr, 8) & S_IWOTH)) {
+                warnings.push_back("umask allows world-writable files");
+            }
+            break;
+        }
+    }
+    
+    std::ifstream aslr("/proc/sys/kernel/randomize_va_space");
+    int randomize = -1;
+    if (aslr >> randomize && randomize == 0) {
+        warnings.push_back("address space layout randomization is disabled");
+    }
+    
+    return warnings;
+}
+
 } // namespace SecurityUtils
 
 } // namespace StreamDAB
\ No newline at end of file
@@ -12,7 +12,12 @@
 #define SECURITY_UTILS_H_
 
 #include "common.h"
+#include "metrics.h"
+#include "timing.h"
+#include "work_stealing.h"
+#include <algorithm>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
 #include <chrono>
@@ -20,13 +25,17 @@
 #include <atomic>
 #include <thread>
 #include <functional>
+#include <list>
 #include <map>
-#include <queue>
+#include <unordered_map>
 #include <condition_variable>
 #include <future>
 #include <cstring>
+#include <ctime>
 #include <iostream>
 
+struct evp_md_ctx_st;       // OpenSSL's EVP_MD_CTX
+
 namespace StreamDAB {
 
 // Security validation results
@@ -68,28 +77,68 @@ struct PerformanceMetrics {
     size_t thread_count = 0;
     size_t queue_depth = 0;
     std::chrono::system_clock::time_point measurement_time;
+    size_t operation_count = 0;
+    std::chrono::nanoseconds median_processing_time{0};
+    std::chrono::nanoseconds p99_processing_time{0};
 };
 
 // Secure path validator
+// The path as given is checked on every call. What the filesystem tells of
+// it is cached per canonical path, i.e. absolute and with symlinks resolved,
+// so independent of the current directory (up to CACHE_CAPACITY, least
+// recently used dropped). It is only cached while every directory on the
+// canonical path is watched by inotify; a change of any name on the path
+// (the file itself, a directory above it or a symlink replacing one) drops
+// the entries concerned. Configuration changes clear the cache.
 class SecurePathValidator {
 private:
+    static constexpr size_t CACHE_CAPACITY = 4096;
+    static constexpr size_t MAX_WATCHED_DIRECTORIES = 64;
+    
+    struct CacheEntry {
+        FileValidation validation;
+        std::list<std::string>::iterator order;
+    };
+    
     std::vector<std::string> allowed_directories_;
     std::vector<std::string> blocked_patterns_;
     bool strict_mode_ = true;
     
+    mutable ProfiledMutex cache_mutex_{"path_cache"};                // also guards the configuration above
+    mutable std::unordered_map<std::string, CacheEntry> cache_;
+    mutable std::list<std::string> cache_order_;                    // most recently used first
+    int inotify_fd_ = -1;                                           // -1, if not available
+    mutable std::unordered_map<int, std::string> watched_directories_;      // by watch descriptor
+    mutable std::unordered_map<std::string, uint64_t> directory_generations_;   // of the watched ones, changed on events
+    mutable uint64_t last_generation_ = 0;
+    
     bool ContainsTraversal(const std::string& path) const;
     bool IsInAllowedDirectory(const std::string& path) const;
     bool MatchesBlockedPattern(const std::string& path) const;
-    std::string ResolvePath(const std::string& path) const;
+    // absolute, with the symlinks of its existing part resolved; empty on error
+    static std::string ResolvePath(const std::string& path);
+    // the directories on a canonical path, from the root down to its parent
+    static std::vector<std::string> DirectoriesOn(const std::string& canonical);
+    void CheckFile(const std::string& path, FileValidation& validation) const;
+    
+    // with cache_mutex_ held
+    bool CheckPathName(const std::string& path, FileValidation& validation) const;
+    bool WatchDirectory(const std::string& directory, uint64_t& generation) const;
+    void ProcessWatchEvents() const;
+    void ClearCache();
     
 public:
     SecurePathValidator();
     explicit SecurePathValidator(const std::vector<std::string>& allowed_dirs, bool strict = true);
+    ~SecurePathValidator();
+    SecurePathValidator(const SecurePathValidator&) = delete;
+    SecurePathValidator& operator=(const SecurePathValidator&) = delete;
     
     // Path validation
     FileValidation ValidatePath(const std::string& path) const;
     std::string SanitizePath(const std::string& path) const;
     bool IsPathSafe(const std::string& path) const;
+    size_t GetCachedPathCount() const;
     
     // Configuration
     void AddAllowedDirectory(const std::string& directory);
@@ -97,6 +146,7 @@ public:
     void SetStrictMode(bool strict);
     
     // Utility methods
+    // lowercase, with single forward slashes and dot segments resolved lexically
     static std::string NormalizePath(const std::string& path);
     static bool IsAbsolutePath(const std::string& path);
     static std::string GetParentDirectory(const std::string& path);
@@ -104,9 +154,37 @@ public:
 };
 
 // Content security scanner
+// Finds any of a set of byte patterns in a single pass over a buffer, with
+// an Aho-Corasick automaton. While the automaton is in its start state, the
+// bytes that cannot start a pattern are skipped 16 at a time (SSE2).
+class MultiPatternMatcher {
+private:
+    static constexpr size_t ALPHABET = 256;
+    static constexpr size_t MAX_SIMD_START_BYTES = 8;
+    
+    std::vector<int32_t> transitions_;  // a row of ALPHABET entries per state
+    std::vector<int32_t> matches_;      // per state, a pattern ending there, or -1
+    std::vector<uint8_t> start_bytes_;
+    bool is_start_byte_[ALPHABET] = {};
+    size_t pattern_count_ = 0;
+    
+    size_t SkipToStartByte(const uint8_t* data, size_t pos, size_t size) const;
+    
+public:
+    MultiPatternMatcher() = default;
+    // empty patterns are ignored
+    explicit MultiPatternMatcher(const std::vector<std::string>& patterns);
+    
+    // the index of the pattern whose match ends first, or -1
+    int FindFirst(const uint8_t* data, size_t size) const;
+    bool Matches(const uint8_t* data, size_t size) const { return FindFirst(data, size) >= 0; }
+    size_t PatternCount() const { return pattern_count_; }
+};
+
 class ContentSecurityScanner {
 private:
     std::vector<std::string> malicious_patterns_;
+    std::shared_ptr<const MultiPatternMatcher> pattern_matcher_;    // of malicious_patterns_
     std::vector<std::string> suspicious_extensions_;
     std::map<std::string, std::function<bool(const std::vector<uint8_t>&)>> format_validators_;
     
@@ -118,9 +196,9 @@ public:
     ContentSecurityScanner();
     
     // Content validation
-    SecurityValidation ScanContent(const std::vector<uint8_t>& data, const std::string& content_type = "");
-    SecurityValidation ScanTextContent(const std::string& text);
-    SecurityValidation ScanImageFile(const std::string& filepath);
+    SecurityValidation ScanContent(const std::vector<uint8_t>& data, const std::string& content_type = "") const;
+    SecurityValidation ScanTextContent(const std::string& text) const;
+    SecurityValidation ScanImageFile(const std::string& filepath) const;
     
     // File format validation
     bool ValidateJPEG(const std::vector<uint8_t>& data) const;
@@ -128,19 +206,32 @@ public:
     bool ValidateWebP(const std::vector<uint8_t>& data) const;
     bool ValidateHEIF(const std::vector<uint8_t>& data) const;
     
-    // Configuration
+    // Configuration; the patterns are compiled into a matcher on each change
     void AddMaliciousPattern(const std::string& pattern);
-    void LoadMaliciousPatterns(const std::string& config_file);
+    void LoadMaliciousPatterns(const std::string& config_file);     // one per line, # for comments
 };
 
 // Input sanitizer
+// Text is sanitized in a single pass into a reserved output, combining
+// whichever of the steps below a call needs, without regular expressions.
 class InputSanitizer {
 private:
+    enum SanitizeStep : unsigned {
+        REMOVE_CONTROLS = 1,
+        COLLAPSE_WHITESPACE = 2,    // to single spaces, trimmed
+        ESCAPE_ENTITIES = 4,
+        STRIP_DANGEROUS_TAGS = 8
+    };
+    
     std::map<std::string, std::string> html_entities_;
+    std::vector<std::string> escapes_;      // by byte, from html_entities_
     std::vector<std::string> dangerous_tags_;
     std::vector<std::string> dangerous_attributes_;
     
     void InitializeEntities();
+    std::string Sanitize(const std::string& input, unsigned steps) const;
+    // the length of the dangerous tag starting at pos, or 0
+    size_t DangerousTagLength(const std::string& input, size_t pos, bool skip_controls, size_t& next_close) const;
     
 public:
     InputSanitizer();
@@ -166,6 +257,19 @@ public:
 };
 
 // Memory manager with leak detection
+// Allocations of up to 64 KiB come from size-class slabs through per-thread
+// caches, so that they take no lock most of the time; larger ones from
+// malloc(). Blocks are zeroed when freed and handed out zeroed. Slabs are
+// kept for reuse for the lifetime of the process.
+// Which allocations are recorded for leak detection is up to the tracking
+// mode: every one (the default), every n-th one per thread on busy paths, or
+// none. Records are kept in shards by address rather than under one lock.
+enum class MemoryTrackingMode {
+    NONE,
+    SAMPLED,
+    FULL
+};
+
 class SecureMemoryManager {
 private:
     struct AllocationInfo {
@@ -175,13 +279,25 @@ private:
         std::string source_location;
     };
     
-    std::map<void*, AllocationInfo> allocations_;
-    mutable std::mutex allocations_mutex_;
-    std::atomic<size_t> total_allocated_{0};
-    std::atomic<size_t> peak_allocated_{0};
-    std::atomic<size_t> allocation_count_{0};
-    std::atomic<size_t> deallocation_count_{0};
+    static constexpr size_t TRACKING_SHARDS = 16;
     
+    struct alignas(64) TrackingShard {
+        mutable ProfiledMutex mutex{"memory_allocations"};
+        std::unordered_map<void*, AllocationInfo> allocations;
+    };
+    
+    TrackingShard tracking_[TRACKING_SHARDS];
+    std::atomic<MemoryTrackingMode> tracking_mode_{MemoryTrackingMode::FULL};
+    std::atomic<size_t> sample_interval_{64};
+    MetricCounter allocated_blocks_;
+    MetricCounter freed_blocks_;
+    MetricCounter allocated_bytes_;
+    MetricCounter freed_bytes_;
+    mutable std::atomic<size_t> peak_allocated_{0};     // as seen at tracked allocations and reads
+    
+    bool ShouldTrack() const;
+    TrackingShard& ShardOf(void* ptr);
+    size_t UpdatePeak() const;
     void RecordAllocation(void* ptr, size_t size, const std::string& location = "");
     void RecordDeallocation(void* ptr);
     
@@ -198,38 +314,105 @@ public:
     void SecureZero(void* ptr, size_t size);
     bool SecureCompare(const void* ptr1, const void* ptr2, size_t size);
     
-    // Memory statistics and leak detection
+    // Tracking; SAMPLED records every sample_interval-th allocation of a thread
+    void SetTrackingMode(MemoryTrackingMode mode, size_t sample_interval = 64);
+    MemoryTrackingMode GetTrackingMode() const { return tracking_mode_; }
+    
+    // Memory statistics and leak detection (of tracked allocations)
     MemoryStats GetMemoryStats() const;
     std::vector<AllocationInfo> DetectLeaks() const;
     bool HasLeaks() const;
     void PrintMemoryReport() const;
     
-    // Memory pool management
+    // Memory pool management; pool blocks are neither tracked nor counted
     void* AllocateFromPool(size_t size);
-    void ReturnToPool(void* ptr, size_t size);
-    void OptimizePools();
+    void ReturnToPool(void* ptr, size_t size);     // size as allocated
+    void OptimizePools();   // returns the calling thread's cached blocks
     
     // Singleton access
     static SecureMemoryManager& GetInstance();
 };
 
-// Performance monitor
-class PerformanceMonitor {
+// A sample of the process' resources
+struct ResourceSample {
+    std::chrono::steady_clock::time_point time;
+    double cpu_usage = 0.0;     // since the previous sample, in percent of one core
+    size_t memory_usage = 0;    // resident, in bytes
+    size_t thread_count = 0;
+};
+
+// Samples the CPU time, resident memory and threads of the process at a
+// fixed interval, on a thread of its own, from /proc/self/stat and statm
+// kept open. The last HISTORY samples are kept in a ring that is read
+// without a lock, so that probes cost no more than a copy. Sampling runs
+// from the first Start() until Stop() was called as often.
+class ResourceSampler {
+public:
+    static constexpr size_t HISTORY = 64;
+    
 private:
-    struct TimingData {
-        std::chrono::high_resolution_clock::time_point start_time;
-        std::chrono::microseconds total_time{0};
-        size_t call_count = 0;
-        std::chrono::microseconds min_time{std::chrono::microseconds::max()};
-        std::chrono::microseconds max_time{0};
+    // a sample as read; the CPU usage is derived from two of them
+    struct Slot {
+        std::atomic<int64_t> time_ns{0};
+        std::atomic<uint64_t> cpu_ticks{0};
+        std::atomic<size_t> memory_usage{0};
+        std::atomic<size_t> thread_count{0};
     };
     
-    std::map<std::string, TimingData> timing_data_;
-    std::mutex timing_mutex_;
+    const std::chrono::milliseconds interval_;
+    Slot slots_[HISTORY];
+    std::atomic<uint64_t> published_{0};    // samples taken; the latest is in slot (published_ - 1) % HISTORY
+    std::mutex sample_mutex_;
+    int stat_fd_ = -1;
+    int statm_fd_ = -1;
+    
+    std::mutex control_mutex_;      // of Start()/Stop()
+    std::mutex thread_mutex_;
+    std::condition_variable stop_condition_;
+    std::thread sampler_;
+    size_t users_ = 0;
+    bool stop_ = false;
+    
+    void Run();
+    // false, if the sample was overwritten while being read
+    bool Read(uint64_t index, uint64_t& ticks, ResourceSample& sample) const;
+    ResourceSample Between(uint64_t from, uint64_t to) const;
+    
+public:
+    explicit ResourceSampler(std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+    ~ResourceSampler();
+    ResourceSampler(const ResourceSampler&) = delete;
+    ResourceSampler& operator=(const ResourceSampler&) = delete;
+    
+    void Start();       // takes a first sample before it returns
+    void Stop();
+    void Sample();      // takes one now
+    
+    // The latest sample; all zero before the first one
+    ResourceSample Latest() const;
+    // The CPU usage over (about) the window, as far as the history reaches
+    double CPUUsage(std::chrono::milliseconds window) const;
+    // The samples kept (up to HISTORY - 1), oldest first
+    std::vector<ResourceSample> History() const;
+    
+    static ResourceSampler& Global();
+};
+
+// Performance monitor
+// Measures operations by interned ID (TimingOperation) into per-thread
+// histograms, so that hot paths can be timed at a few nanoseconds each. The
+// operations are those of the process; a monitor only keeps where it was
+// reset. Timing by name interns the name on each call, which takes a lock.
+// The system figures are those of the global ResourceSampler, which runs
+// while there is a monitor.
+class PerformanceMonitor {
+private:
     std::atomic<bool> monitoring_active_{true};
-    std::thread monitoring_thread_;
+    mutable std::mutex baseline_mutex_;
+    std::map<size_t, TimingSnapshot> baselines_;    // by operation, at the last reset
+    std::chrono::steady_clock::time_point reset_time_;
     
-    void MonitoringLoop();
+    TimingSnapshot ReadSince(size_t operation) const;
     
 public:
     PerformanceMonitor();
@@ -239,17 +422,25 @@ public:
     class ScopedTimer {
     private:
         PerformanceMonitor& monitor_;
-        std::string operation_name_;
-        std::chrono::high_resolution_clock::time_point start_time_;
+        size_t operation_;
+        uint64_t start_ticks_;
         
     public:
         ScopedTimer(PerformanceMonitor& monitor, const std::string& operation);
-        ~ScopedTimer();
+        ScopedTimer(PerformanceMonitor& monitor, const TimingOperation& operation)
+            : monitor_(monitor), operation_(operation.id), start_ticks_(TimingClock::Now()) {}
+        ~ScopedTimer() {
+            if (monitor_.monitoring_active_.load(std::memory_order_relaxed)) {
+                Timings::Record(operation_, TimingClock::Now() - start_ticks_);
+            }
+        }
     };
     
-    // Timing operations
+    // Timing operations; a start is kept per thread
     void StartTiming(const std::string& operation);
     void EndTiming(const std::string& operation);
+    void StartTiming(const TimingOperation& operation);
+    void EndTiming(const TimingOperation& operation);
     ScopedTimer CreateScopedTimer(const std::string& operation);
     
     // Performance reporting
@@ -258,8 +449,8 @@ public:
     void PrintPerformanceReport() const;
     
     // System monitoring
-    double GetCPUUsage() const;
-    size_t GetMemoryUsage() const;
+    double GetCPUUsage() const;     // of the process over the last sampling interval, in percent of one core
+    size_t GetMemoryUsage() const;  // resident, in bytes
     size_t GetThreadCount() const;
     
     // Control
@@ -269,25 +460,79 @@ public:
     void ResetOperation(const std::string& operation);
 };
 
-// Thread pool for concurrent processing
+// Priorities of thread pool tasks; queued ones of a higher priority are
+// always taken first
+enum class TaskPriority {
+    REALTIME = 0,       // preparing PAD for the next frames
+    SLIDE_ENCODE = 1,
+    ANALYSIS = 2        // image analysis, content validation
+};
+
+// Work-stealing thread pool: each worker has a deque per priority that the
+// tasks it submits go to, and takes from it LIFO; idle workers steal from
+// the others. Tasks submitted from other threads go to a lock-free queue
+// per priority. Only idle workers block on a mutex.
 class ThreadPool {
 private:
-    std::vector<std::thread> workers_;
-    std::queue<std::function<void()>> tasks_;
-    std::mutex queue_mutex_;
-    std::condition_variable condition_;
+    static constexpr size_t PRIORITIES = 3;
+    static constexpr size_t DEQUE_CAPACITY = 256;
+    static constexpr size_t INJECTION_CAPACITY = 1024;
+    
+    struct Worker {
+        WorkStealingDeque<PoolTask> deques[PRIORITIES];
+        std::thread thread;
+        
+        Worker() : deques{WorkStealingDeque<PoolTask>(DEQUE_CAPACITY),
+                          WorkStealingDeque<PoolTask>(DEQUE_CAPACITY),
+                          WorkStealingDeque<PoolTask>(DEQUE_CAPACITY)} {}
+    };
+    
+    std::vector<std::unique_ptr<Worker>> workers_;
+    MPMCQueue<PoolTask> injected_[PRIORITIES] = {MPMCQueue<PoolTask>(INJECTION_CAPACITY),
+                                                  MPMCQueue<PoolTask>(INJECTION_CAPACITY),
+                                                  MPMCQueue<PoolTask>(INJECTION_CAPACITY)};
+    const std::vector<int> cpus_;
+    
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_condition_;
+    std::condition_variable done_condition_;
+    std::atomic<bool> running_{false};
     std::atomic<bool> stop_{false};
+    std::atomic<size_t> pending_tasks_{0};
     std::atomic<size_t> active_tasks_{0};
+    std::atomic<size_t> sleeping_workers_{0};
+    
+    // the pool and index of the worker running on this thread
+    inline static thread_local ThreadPool* current_pool_ = nullptr;
+    inline static thread_local size_t current_worker_ = 0;
+    
+    void Enqueue(PoolTask task, TaskPriority priority);
+    bool FindTask(size_t worker, PoolTask& task);
+    void RunTask(PoolTask& task);
+    void WorkerLoop(size_t worker);
     
 public:
-    explicit ThreadPool(size_t thread_count = std::thread::hardware_concurrency());
+    // workers are pinned to the given CPUs in turn, if any
+    explicit ThreadPool(size_t thread_count = std::thread::hardware_concurrency(),
+                        const std::vector<int>& cpus = {});
     ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
     
     // Task submission
     template<typename F, typename... Args>
-    auto Submit(F&& f, Args&&... args) -> std::future<typename std::result_of<F(Args...)>::type>;
+    auto Submit(F&& f, Args&&... args) -> std::future<std::invoke_result_t<F, Args...>> {
+        return SubmitWithPriority(TaskPriority::ANALYSIS, std::forward<F>(f), std::forward<Args>(args)...);
+    }
     
-    void SubmitTask(std::function<void()> task);
+    template<typename F, typename... Args>
+    auto SubmitWithPriority(TaskPriority priority, F&& f, Args&&... args) -> std::future<std::invoke_result_t<F, Args...>>;
+    
+    // without allocating, if the callable fits into a PoolTask
+    template<typename F>
+    void SubmitTask(F&& task, TaskPriority priority = TaskPriority::ANALYSIS) {
+        Enqueue(PoolTask(std::forward<F>(task)), priority);
+    }
     
     // Pool management
     size_t GetThreadCount() const;
@@ -299,18 +544,45 @@ public:
     void Resize(size_t new_thread_count);
 };
 
+template<typename F, typename... Args>
+auto ThreadPool::SubmitWithPriority(TaskPriority priority, F&& f, Args&&... args)
+    -> std::future<std::invoke_result_t<F, Args...>> {
+    typedef std::invoke_result_t<F, Args...> Result;
+    std::packaged_task<Result()> task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    std::future<Result> result = task.get_future();
+    Enqueue(PoolTask(std::move(task)), priority);
+    return result;
+}
+
 // Buffer overflow protection
+// Bytes of untrusted size, bounds checked: writes and appends beyond the
+// maximum capacity fail, and reads only return what was written. Small
+// contents stay inline; beyond INLINE_CAPACITY the storage is a vector
+// that grows to twice its size at least, up to the maximum, so that it can
+// be released to (or adopted from) e.g. DATA_GROUP::data without a copy.
 class SafeBuffer {
+public:
+    static constexpr size_t INLINE_CAPACITY = 64;
+    
 private:
-    std::unique_ptr<uint8_t[]> data_;
-    size_t size_;
-    size_t capacity_;
+    uint8_t inline_[INLINE_CAPACITY];
+    std::vector<uint8_t> heap_;     // if on_heap_; its size is size_
+    bool on_heap_ = false;
+    size_t size_ = 0;
+    size_t max_capacity_;
     bool read_only_ = false;
     
-    void CheckBounds(size_t offset, size_t length) const;
+    bool InBounds(size_t offset, size_t length, size_t limit) const {
+        return length <= limit && offset <= limit - length;
+    }
+    bool Grow(size_t needed, bool exact = false);     // else at least twice the storage
+    void SetSize(size_t size);      // within the storage; new bytes are zero
+    uint8_t* Storage() { return on_heap_ ? heap_.data() : inline_; }
+    const uint8_t* Storage() const { return on_heap_ ? heap_.data() : inline_; }
     
 public:
-    explicit SafeBuffer(size_t capacity);
+    // max_capacity 0: the capacity is fixed
+    explicit SafeBuffer(size_t capacity, size_t max_capacity = 0);
     SafeBuffer(const void* data, size_t size);
     SafeBuffer(const SafeBuffer& other);
     SafeBuffer(SafeBuffer&& other) noexcept;
@@ -329,33 +601,112 @@ public:
     
     // Buffer properties
     size_t Size() const { return size_; }
-    size_t Capacity() const { return capacity_; }
+    size_t Capacity() const { return std::min(on_heap_ ? heap_.capacity() : INLINE_CAPACITY, max_capacity_); }
+    size_t MaxCapacity() const { return max_capacity_; }
     bool IsEmpty() const { return size_ == 0; }
-    bool IsFull() const { return size_ == capacity_; }
+    bool IsFull() const { return size_ == max_capacity_; }
     
     // Buffer operations
     void Clear();
     bool Resize(size_t new_size);
     bool Reserve(size_t new_capacity);
+    void SetMaxCapacity(size_t max_capacity);   // not below the size
+    
+    // Ownership of the contents: Release() leaves the buffer empty, and only
+    // copies inline contents; Adopt() raises the maximum capacity to the
+    // size of the data, if below
+    std::vector<uint8_t> Release();
+    void Adopt(std::vector<uint8_t>&& data);
     
     // Safe access
-    const uint8_t* Data() const { return data_.get(); }
-    uint8_t* Data() { return read_only_ ? nullptr : data_.get(); }
+    const uint8_t* Data() const { return Storage(); }
+    uint8_t* Data() { return read_only_ ? nullptr : Storage(); }
     
     void SetReadOnly(bool read_only = true) { read_only_ = read_only; }
     bool IsReadOnly() const { return read_only_; }
 };
 
+// Cryptographically secure random bytes from a ChaCha20 keystream per
+// thread, generated BLOCKS blocks at a time and handed out from the buffer,
+// so that a call costs about a copy. The first bytes of each buffer are the
+// next key and the bytes handed out are erased, so that earlier output
+// cannot be recovered from the state. The key is drawn from getrandom()
+// on first use, after RESEED_BYTES and in a forked child.
+class SecureRandom {
+public:
+    static constexpr size_t BLOCKS = 16;
+    static constexpr size_t RESEED_BYTES = 1024 * 1024;
+    
+    static void Fill(void* data, size_t size);
+    static uint64_t Next64();
+    // Uniform in [0, bound), without bias; bound > 0
+    static uint32_t Uniform(uint32_t bound);
+    
+    // The ChaCha20 block function of RFC 8439
+    static void Block(const uint8_t key[32], uint32_t counter, const uint8_t nonce[12], uint8_t out[64]);
+};
+
 // Security utility functions
+// Incremental hash (OpenSSL EVP), for data that arrives or is read in
+// pieces: Update() with each, then Final(), after which the hasher starts
+// anew. Once OpenSSL failed (i.e. out of memory), the digest is empty.
+class Hasher {
+public:
+    enum class Algorithm { SHA256, MD5 };
+    
+    explicit Hasher(Algorithm algorithm = Algorithm::SHA256);
+    ~Hasher();
+    Hasher(Hasher&& other) noexcept;
+    Hasher& operator=(Hasher&& other) noexcept;
+    Hasher(const Hasher&) = delete;
+    Hasher& operator=(const Hasher&) = delete;
+    
+    bool Update(const void* data, size_t size);
+    bool Update(const std::vector<uint8_t>& data) { return Update(data.data(), data.size()); }
+    bool Update(const std::string& data) { return Update(data.data(), data.size()); }
+    // the data prefixed with its size, so that the boundaries of fields count
+    bool UpdateField(const void* data, uint64_t size);
+    // in chunks, without reading the file into memory; false if it cannot be read
+    bool UpdateFromFile(const std::string& path);
+    
+    std::string Final();        // raw bytes
+    std::string FinalHex();
+    void Reset();
+    
+    bool IsValid() const { return context_ && !failed_; }
+    Algorithm GetAlgorithm() const { return algorithm_; }
+    size_t GetDigestSize() const { return algorithm_ == Algorithm::MD5 ? 16 : 32; }
+    
+    // "SHA256" or "MD5"; false for others
+    static bool ParseAlgorithm(const std::string& name, Algorithm& algorithm);
+    
+private:
+    ::evp_md_ctx_st* context_ = nullptr;
+    Algorithm algorithm_;
+    bool failed_ = false;
+};
+
 namespace SecurityUtils {
     // Cryptographic functions
+    std::string CalculateSHA256(const void* data, size_t size);
     std::string CalculateSHA256(const std::vector<uint8_t>& data);
+    std::string CalculateMD5(const void* data, size_t size);
     std::string CalculateMD5(const std::vector<uint8_t>& data);
+    // hex; empty if OpenSSL failed
+    std::string CalculateHMACSHA256(const std::string& key, const void* data, size_t size);
+    // expected_hash: hex, in either case; compared in constant time
+    bool VerifyChecksum(const void* data, size_t size, const std::string& expected_hash, const std::string& algorithm = "SHA256");
     bool VerifyChecksum(const std::vector<uint8_t>& data, const std::string& expected_hash, const std::string& algorithm = "SHA256");
     
-    // Random number generation
+    // Lowercase hex, through a table of the 256 byte values
+    std::string ToHex(const void* data, size_t size);
+    inline std::string ToHex(const std::string& bytes) { return ToHex(bytes.data(), bytes.size()); }
+    
+    // Random number generation (SecureRandom)
     std::vector<uint8_t> GenerateRandomBytes(size_t count);
     std::string GenerateRandomString(size_t length, const std::string& charset = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789");
+    // The prefix followed by random_bytes random bytes in hex: an ID of fixed width
+    std::string GenerateID(std::string_view prefix, size_t random_bytes = 8);
     
     // Time-based operations
     bool IsTimestampValid(std::chrono::system_clock::time_point timestamp, std::chrono::seconds max_age);
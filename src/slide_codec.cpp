@@ -0,0 +1,880 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file slide_codec.cpp
+    \brief Lean JPEG/PNG slide processing without MagickWand
+*/
+
+#include "slide_codec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_LIBJPEG
+#  include <jpeglib.h>
+#endif
+#if HAVE_LIBJPEG && HAVE_LIBPNG
+#  include <png.h>
+#  include <zlib.h>
+#endif
+
+
+// --- SlideCodec -----------------------------------------------------------------
+const size_t SlideCodec::MAX_WIDTH  = 320;
+const size_t SlideCodec::MAX_HEIGHT = 240;
+const double SlideCodec::MAX_PALETTE_ERROR = 6.5; // i.e. a PSNR of 40 dB
+
+SlideCodec::Format SlideCodec::DetectFormat(const uint8_t* data, size_t len) {
+    static const uint8_t PNG_SIGNATURE[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+    if (len >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF)
+        return Format::JPEG;
+    if (len >= sizeof(PNG_SIGNATURE) && memcmp(data, PNG_SIGNATURE, sizeof(PNG_SIGNATURE)) == 0)
+        return Format::PNG;
+    if (len >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WEBP", 4) == 0)
+        return Format::WEBP;
+    if (len >= 12 && memcmp(data + 4, "ftyp", 4) == 0) {
+        static const char* HEIF_BRANDS[] = {"heic", "heix", "heim", "heis", "hevc", "hevx", "mif1", "msf1", "avif", "avis"};
+        for (const char* brand : HEIF_BRANDS)
+            if (memcmp(data + 8, brand, 4) == 0)
+                return Format::HEIF;
+    }
+    if (len >= 6 && (memcmp(data, "GIF87a", 6) == 0 || memcmp(data, "GIF89a", 6) == 0))
+        return Format::GIF;
+    if (len >= 2 && data[0] == 'B' && data[1] == 'M')
+        return Format::BMP;
+    return Format::UNKNOWN;
+}
+
+static uint32_t read_be16(const uint8_t* p) {return (p[0] << 8) | p[1];}
+static uint32_t read_be32(const uint8_t* p) {return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];}
+static uint32_t read_le16(const uint8_t* p) {return p[0] | (p[1] << 8);}
+static uint32_t read_le24(const uint8_t* p) {return p[0] | (p[1] << 8) | (p[2] << 16);}
+static uint32_t read_le32(const uint8_t* p) {return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);}
+
+static bool probe_jpeg(const uint8_t* data, size_t len, image_probe_t& probe) {
+    // markers (each with a length, except RSTn/SOI/TEM) up to the first SOFn
+    size_t pos = 2;
+    while (pos + 4 <= len) {
+        if (data[pos] != 0xFF)
+            return false;
+        const uint8_t marker = data[pos + 1];
+        if (marker == 0xFF) {   // fill byte
+            pos++;
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+            pos += 2;
+            continue;
+        }
+        if (marker == 0xD9 || marker == 0xDA)   // EOI/SOS before any frame
+            return false;
+
+        const size_t segment_len = read_be16(data + pos + 2);
+        if (segment_len < 2)
+            return false;
+
+        // SOF0..SOF15, except DHT (C4), JPG (C8) and DAC (CC)
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (pos + 9 > len || segment_len < 7)
+                return false;
+            probe.height = read_be16(data + pos + 5);
+            probe.width = read_be16(data + pos + 7);
+            probe.progressive = marker == 0xC2 || marker == 0xC6 || marker == 0xCA || marker == 0xCE;
+            return probe.width && probe.height;
+        }
+        pos += 2 + segment_len;
+    }
+    return false;
+}
+
+static bool probe_webp(const uint8_t* data, size_t len, image_probe_t& probe) {
+    // the first chunk after "RIFF" <size> "WEBP"
+    if (len < 30)
+        return false;
+    const uint8_t* chunk = data + 12;
+    if (memcmp(chunk, "VP8 ", 4) == 0) {
+        // lossy: key frame start code, then 14 bit width and height
+        if (chunk[11] != 0x9D || chunk[12] != 0x01 || chunk[13] != 0x2A)
+            return false;
+        probe.width = read_le16(chunk + 14) & 0x3FFF;
+        probe.height = read_le16(chunk + 16) & 0x3FFF;
+    } else if (memcmp(chunk, "VP8L", 4) == 0) {
+        // lossless: signature byte, then 14 bit width-1 and height-1
+        if (chunk[8] != 0x2F)
+            return false;
+        const uint32_t bits = read_le32(chunk + 9);
+        probe.width = (bits & 0x3FFF) + 1;
+        probe.height = ((bits >> 14) & 0x3FFF) + 1;
+    } else if (memcmp(chunk, "VP8X", 4) == 0) {
+        // extended: 24 bit canvas width-1 and height-1
+        probe.width = read_le24(chunk + 12) + 1;
+        probe.height = read_le24(chunk + 15) + 1;
+    } else {
+        return false;
+    }
+    return probe.width && probe.height;
+}
+
+static bool probe_heif(const uint8_t* data, size_t len, image_probe_t& probe) {
+    // the largest image spatial extents ("ispe") property, i.e. the primary
+    // image rather than a thumbnail; it is in meta/iprp/ipco, which is
+    // searched for the box type instead of walking all the boxes
+    for (size_t pos = 4; pos + 16 <= len; pos++) {
+        if (memcmp(data + pos, "ispe", 4) != 0)
+            continue;
+        const size_t width = read_be32(data + pos + 8);
+        const size_t height = read_be32(data + pos + 12);
+        if (width * height > probe.width * probe.height) {
+            probe.width = width;
+            probe.height = height;
+        }
+    }
+    return probe.width && probe.height;
+}
+
+bool SlideCodec::Probe(const uint8_t* data, size_t len, image_probe_t& probe) {
+    probe = image_probe_t();
+    probe.format = DetectFormat(data, len);
+
+    switch (probe.format) {
+    case Format::JPEG:
+        return probe_jpeg(data, len, probe);
+    case Format::PNG:
+        // IHDR is the first chunk
+        if (len < 24 || memcmp(data + 12, "IHDR", 4) != 0)
+            return false;
+        probe.width = read_be32(data + 16);
+        probe.height = read_be32(data + 20);
+        return probe.width && probe.height;
+    case Format::WEBP:
+        return probe_webp(data, len, probe);
+    case Format::HEIF:
+        return probe_heif(data, len, probe);
+    case Format::GIF:
+        if (len < 10)
+            return false;
+        probe.width = read_le16(data + 6);
+        probe.height = read_le16(data + 8);
+        return probe.width && probe.height;
+    case Format::BMP: {
+        // BITMAPINFOHEADER (or later); the height is negative for top-down rows
+        if (len < 26 || read_le32(data + 14) < 40)
+            return false;
+        const int32_t height = (int32_t) read_le32(data + 22);
+        probe.width = read_le32(data + 18);
+        probe.height = height < 0 ? -(int64_t) height : height;
+        return probe.width && probe.height;
+    }
+    default:
+        return false;
+    }
+}
+
+bool SlideCodec::ReadInfo(Format format, const uint8_t* data, size_t len, size_t& width, size_t& height, bool& progressive) {
+    image_probe_t probe;
+    if (!Probe(data, len, probe) || probe.format != format)
+        return false;
+    width = probe.width;
+    height = probe.height;
+    progressive = probe.progressive;
+    return true;
+}
+
+bool SlideCodec::StripMetadata(Format format, const uint8_t* data, size_t len, std::vector<uint8_t>& out) {
+    out.clear();
+    switch (format) {
+    case Format::JPEG: {
+        // markers up to the scan; APP0 (JFIF) and APP14 (Adobe) are kept, as they affect decoding
+        out.insert(out.end(), data, data + 2);
+        size_t pos = 2;
+        while (pos + 4 <= len && data[pos] == 0xFF) {
+            uint8_t marker = data[pos + 1];
+            if (marker == 0xDA) {
+                out.insert(out.end(), data + pos, data + len);
+                return out.size() < len;
+            }
+            size_t seg_len = 2 + (data[pos + 2] << 8 | data[pos + 3]);
+            if (pos + seg_len > len)
+                break;
+            bool meta = (marker >= 0xE1 && marker <= 0xEF && marker != 0xEE) || marker == 0xFE;
+            if (!meta)
+                out.insert(out.end(), data + pos, data + pos + seg_len);
+            pos += seg_len;
+        }
+        return false;   // malformed, so leave it to the decoder
+    }
+    case Format::PNG: {
+        static const char* const META_CHUNKS[] = {"tEXt", "zTXt", "iTXt", "tIME", "eXIf"};
+
+        out.insert(out.end(), data, data + 8);
+        size_t pos = 8;
+        while (pos + 12 <= len) {
+            size_t chunk_len = 12 + ((size_t) data[pos] << 24 | data[pos + 1] << 16 | data[pos + 2] << 8 | data[pos + 3]);
+            if (pos + chunk_len > len)
+                return false;
+            bool meta = false;
+            for (const char* type : META_CHUNKS)
+                meta |= memcmp(data + pos + 4, type, 4) == 0;
+            if (!meta)
+                out.insert(out.end(), data + pos, data + pos + chunk_len);
+            if (memcmp(data + pos + 4, "IEND", 4) == 0)
+                return out.size() < len;
+            pos += chunk_len;
+        }
+        return false;
+    }
+    default:
+        return false;
+    }
+}
+
+void SlideCodec::FitSize(size_t& width, size_t& height) {
+    if (height <= MAX_HEIGHT && width <= MAX_WIDTH)
+        return;
+
+    if (height / (double) MAX_HEIGHT > width / (double) MAX_WIDTH) {
+        width = std::max((size_t) (width * (double) MAX_HEIGHT / height), (size_t) 1);
+        height = MAX_HEIGHT;
+    } else {
+        height = std::max((size_t) (height * (double) MAX_WIDTH / width), (size_t) 1);
+        width = MAX_WIDTH;
+    }
+}
+
+
+#if HAVE_LIBJPEG
+// libjpeg reports fatal errors by a callback that must not return
+struct jpeg_error_t {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+};
+
+static void jpeg_error_exit(j_common_ptr cinfo) {
+    jpeg_error_t* error = (jpeg_error_t*) cinfo->err;
+    char message[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, message);
+    fprintf(stderr, "ODR-PadEnc Error: JPEG processing failed: %s\n", message);
+    longjmp(error->jump, 1);
+}
+
+static void jpeg_no_warning(j_common_ptr /*cinfo*/, int /*msg_level*/) {}
+
+
+bool SlideCodec::Supported(Format format) {
+    switch (format) {
+    case Format::JPEG:
+        return true;
+#if HAVE_LIBPNG
+    case Format::PNG:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+bool SlideCodec::Decode(Format format, const uint8_t* data, size_t len, size_t min_width, size_t min_height, rgb_image_t& image) {
+    switch (format) {
+    case Format::JPEG: {
+        struct jpeg_decompress_struct cinfo;
+        jpeg_error_t error;
+        cinfo.err = jpeg_std_error(&error.mgr);
+        error.mgr.error_exit = jpeg_error_exit;
+        error.mgr.emit_message = jpeg_no_warning;
+        if (setjmp(error.jump)) {
+            jpeg_destroy_decompress(&cinfo);
+            return false;
+        }
+
+        jpeg_create_decompress(&cinfo);
+        jpeg_mem_src(&cinfo, (unsigned char*) data, len);
+        jpeg_read_header(&cinfo, TRUE);
+        cinfo.out_color_space = JCS_RGB;
+
+        // the largest DCT scaling that keeps at least the min size
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = 1;
+        for (unsigned int denom = 8; denom > 1; denom /= 2) {
+            if ((cinfo.image_width + denom - 1) / denom >= min_width && (cinfo.image_height + denom - 1) / denom >= min_height) {
+                cinfo.scale_denom = denom;
+                break;
+            }
+        }
+
+        jpeg_start_decompress(&cinfo);
+        image.width = cinfo.output_width;
+        image.height = cinfo.output_height;
+        image.pixels.resize(image.width * image.height * 3);
+        while (cinfo.output_scanline < cinfo.output_height) {
+            JSAMPROW row = &image.pixels[cinfo.output_scanline * image.width * 3];
+            jpeg_read_scanlines(&cinfo, &row, 1);
+        }
+        jpeg_finish_decompress(&cinfo);
+        jpeg_destroy_decompress(&cinfo);
+        return true;
+    }
+#if HAVE_LIBPNG
+    case Format::PNG: {
+        png_image png;
+        memset(&png, 0, sizeof(png));
+        png.version = PNG_IMAGE_VERSION;
+        if (!png_image_begin_read_from_memory(&png, data, len)) {
+            fprintf(stderr, "ODR-PadEnc Error: PNG processing failed: %s\n", png.message);
+            return false;
+        }
+
+        // a transparent image is shown on white
+        png.format = PNG_FORMAT_RGB;
+        png_color background = {0xFF, 0xFF, 0xFF};
+        image.width = png.width;
+        image.height = png.height;
+        image.pixels.resize(PNG_IMAGE_SIZE(png));
+        if (!png_image_finish_read(&png, &background, &image.pixels[0], 0, NULL)) {
+            fprintf(stderr, "ODR-PadEnc Error: PNG processing failed: %s\n", png.message);
+            png_image_free(&png);
+            return false;
+        }
+        return true;
+    }
+#endif
+    default:
+        return false;
+    }
+}
+
+// fixed-point weights of each target pixel; horizontally Q8 (so that a filtered row fits 16 bits), vertically Q14
+static const unsigned int HORIZONTAL_BITS = 8;
+static const unsigned int VERTICAL_BITS = 14;
+
+struct area_taps_t {
+    std::vector<uint32_t> first;    // per target pixel (+ end), into index/weight
+    std::vector<uint32_t> index;    // source pixel
+    std::vector<uint16_t> weight;
+
+    /*! The weight of a source pixel is the fraction of the target pixel it
+     * covers. Rounding errors are carried over to the next tap, so that the
+     * weights of each target pixel sum up to exactly 1 << bits.
+     */
+    area_taps_t(size_t src_len, size_t dst_len, unsigned int bits) {
+        const uint64_t one = 1 << bits;
+        first.reserve(dst_len + 1);
+        for (size_t i = 0; i < dst_len; i++) {
+            first.push_back(index.size());
+
+            // in units of 1 / dst_len source pixels
+            const uint64_t start = (uint64_t) i * src_len;
+            const uint64_t end = start + src_len;
+            uint64_t covered = 0;
+            uint64_t assigned = 0;
+            for (uint64_t s = start / dst_len; s * dst_len < end; s++) {
+                covered += std::min(end, (s + 1) * dst_len) - std::max(start, s * dst_len);
+                const uint64_t weight = covered * one / src_len - assigned;
+                assigned += weight;
+                index.push_back(s);
+                this->weight.push_back(weight);
+            }
+        }
+        first.push_back(index.size());
+    }
+};
+
+void SlideCodec::Downscale(const rgb_image_t& src, size_t width, size_t height, rgb_image_t& dst) {
+    const area_taps_t horizontal(src.width, width, HORIZONTAL_BITS);
+    const area_taps_t vertical(src.height, height, VERTICAL_BITS);
+    const size_t row_len = width * 3;
+    const uint32_t round = 1 << (HORIZONTAL_BITS + VERTICAL_BITS - 1);
+
+    dst.width = width;
+    dst.height = height;
+    dst.pixels.resize(row_len * height);
+
+    /*! Only a single horizontally filtered source row is kept (a row shared
+     * by two target rows is filtered once), and summed up into the current
+     * target row; the inner loops are plain enough to be vectorised.
+     */
+    std::vector<uint16_t> row(row_len);
+    std::vector<uint32_t> sum(row_len);
+    size_t row_index = (size_t) -1;
+    for (size_t y = 0; y < height; y++) {
+        std::fill(sum.begin(), sum.end(), 0);
+
+        for (size_t v = vertical.first[y]; v < vertical.first[y + 1]; v++) {
+            if (vertical.index[v] != row_index) {
+                row_index = vertical.index[v];
+                const uint8_t* src_row = &src.pixels[row_index * src.width * 3];
+                for (size_t x = 0; x < width; x++) {
+                    uint32_t r = 0, g = 0, b = 0;
+                    for (size_t h = horizontal.first[x]; h < horizontal.first[x + 1]; h++) {
+                        const uint8_t* pixel = src_row + horizontal.index[h] * 3;
+                        const uint32_t weight = horizontal.weight[h];
+                        r += pixel[0] * weight;
+                        g += pixel[1] * weight;
+                        b += pixel[2] * weight;
+                    }
+                    row[x * 3 + 0] = r;
+                    row[x * 3 + 1] = g;
+                    row[x * 3 + 2] = b;
+                }
+            }
+
+            const uint32_t weight = vertical.weight[v];
+            const uint16_t* row_data = row.data();
+            uint32_t* sum_data = sum.data();
+            for (size_t i = 0; i < row_len; i++)
+                sum_data[i] += row_data[i] * weight;
+        }
+
+        uint8_t* dst_row = &dst.pixels[y * row_len];
+        for (size_t i = 0; i < row_len; i++)
+            dst_row[i] = (sum[i] + round) >> (HORIZONTAL_BITS + VERTICAL_BITS);
+    }
+}
+
+uint64_t SlideCodec::DifferenceHash(const rgb_image_t& image) {
+    rgb_image_t thumbnail;
+    Downscale(image, 9, 8, thumbnail);
+
+    uint64_t hash = 0;
+    for (size_t y = 0; y < 8; y++) {
+        const uint8_t* row = &thumbnail.pixels[y * 9 * 3];
+        unsigned int left = 0;
+        for (size_t x = 0; x < 9; x++) {
+            const uint8_t* pixel = row + x * 3;
+            unsigned int luma = 299 * pixel[0] + 587 * pixel[1] + 114 * pixel[2];
+            if (x > 0)
+                hash = (hash << 1) | (luma > left);
+            left = luma;
+        }
+    }
+    return hash;
+}
+
+image_stats_t SlideCodec::Analyze(const rgb_image_t& image) {
+    const size_t count = image.width * image.height;
+    std::vector<uint8_t> luma(count);
+    const uint8_t* pixel = image.pixels.data();
+    uint64_t sum = 0;
+    uint64_t sum_sq = 0;
+    for (size_t i = 0; i < count; i++, pixel += 3) {
+        const uint32_t value = (77 * pixel[0] + 150 * pixel[1] + 29 * pixel[2]) >> 8;
+        luma[i] = value;
+        sum += value;
+        sum_sq += value * value;
+    }
+
+    // 4-neighbour Laplacian of the inner pixels
+    int64_t laplace_sum = 0;
+    uint64_t laplace_sum_sq = 0;
+    size_t laplace_count = 0;
+    for (size_t y = 1; y + 1 < image.height; y++) {
+        const uint8_t* row = &luma[y * image.width];
+        for (size_t x = 1; x + 1 < image.width; x++) {
+            const int32_t value = 4 * row[x] - row[x - 1] - row[x + 1] - row[x - image.width] - row[x + image.width];
+            laplace_sum += value;
+            laplace_sum_sq += value * value;
+        }
+        laplace_count += image.width - 2;
+    }
+
+    image_stats_t stats = {0, 0, 0};
+    if (count) {
+        const double mean = (double) sum / count;
+        stats.brightness = mean / 255;
+        stats.contrast = std::min(std::sqrt(std::max((double) sum_sq / count - mean * mean, 0.0)) / 127.5, 1.0);
+    }
+    if (laplace_count) {
+        const double mean = (double) laplace_sum / laplace_count;
+        stats.sharpness = std::min(std::sqrt(std::max((double) laplace_sum_sq / laplace_count - mean * mean, 0.0)) / 64, 1.0);
+    }
+    return stats;
+}
+
+bool SlideCodec::EncodeJPEG(const rgb_image_t& image, int quality, std::vector<uint8_t>& out) {
+    struct jpeg_compress_struct cinfo;
+    jpeg_error_t error;
+    unsigned char* buffer = NULL;
+    unsigned long buffer_len = 0;
+    cinfo.err = jpeg_std_error(&error.mgr);
+    error.mgr.error_exit = jpeg_error_exit;
+    if (setjmp(error.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        free(buffer);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buffer, &buffer_len);
+    cinfo.image_width = image.width;
+    cinfo.image_height = image.height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.optimize_coding = TRUE;
+
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = (JSAMPROW) &image.pixels[cinfo.next_scanline * image.width * 3];
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    out.assign(buffer, buffer + buffer_len);
+    free(buffer);
+    return true;
+}
+
+#if HAVE_LIBPNG
+static void png_write_vector(png_structp png, png_bytep data, png_size_t len) {
+    std::vector<uint8_t>* out = (std::vector<uint8_t>*) png_get_io_ptr(png);
+    out->insert(out->end(), data, data + len);
+}
+
+static void png_flush_nothing(png_structp /*png*/) {}
+
+static void png_error_exit(png_structp png, png_const_charp message) {
+    fprintf(stderr, "ODR-PadEnc Error: PNG processing failed: %s\n", message);
+    png_longjmp(png, 1);
+}
+
+static void png_no_warning(png_structp /*png*/, png_const_charp /*message*/) {}
+
+/*! writes a PNG (RGB, or with a palette of 3 bytes per entry) with the
+ * given deflate settings, which the simplified libpng API does not offer
+ */
+static bool png_write(size_t width, size_t height, const uint8_t* rows, size_t row_len, const std::vector<uint8_t>* colormap,
+                      int filters, int strategy, std::vector<uint8_t>& out) {
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, png_error_exit, png_no_warning);
+    if (!png)
+        return false;
+    png_infop info = png_create_info_struct(png);
+    if (!info) {
+        png_destroy_write_struct(&png, NULL);
+        return false;
+    }
+    out.clear();
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        return false;
+    }
+
+    png_set_write_fn(png, &out, png_write_vector, png_flush_nothing);
+    png_set_compression_level(png, Z_BEST_COMPRESSION);
+    png_set_compression_mem_level(png, MAX_MEM_LEVEL);
+    png_set_compression_strategy(png, strategy);
+    png_set_filter(png, PNG_FILTER_TYPE_BASE, filters);
+    png_set_IHDR(png, info, width, height, 8, colormap ? PNG_COLOR_TYPE_PALETTE : PNG_COLOR_TYPE_RGB,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    if (colormap)
+        png_set_PLTE(png, info, (png_const_colorp) colormap->data(), colormap->size() / 3);
+
+    png_write_info(png, info);
+    for (size_t y = 0; y < height; y++)
+        png_write_row(png, rows + y * row_len);
+    png_write_end(png, info);
+    png_destroy_write_struct(&png, &info);
+    return true;
+}
+
+// the smallest PNG of all filter and deflate strategy combinations
+static bool png_write_smallest(size_t width, size_t height, const uint8_t* rows, size_t row_len, const std::vector<uint8_t>* colormap,
+                               std::vector<uint8_t>& out) {
+    static const int FILTERS[] = {PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_PAETH, PNG_ALL_FILTERS};
+    static const int STRATEGIES[] = {Z_DEFAULT_STRATEGY, Z_FILTERED, Z_RLE};
+
+    std::vector<uint8_t> attempt;
+    out.clear();
+    for (int filters : FILTERS) {
+        for (int strategy : STRATEGIES) {
+            if (png_write(width, height, rows, row_len, colormap, filters, strategy, attempt) &&
+                    (out.empty() || attempt.size() < out.size()))
+                out.swap(attempt);
+        }
+    }
+    return !out.empty();
+}
+#endif
+
+bool SlideCodec::EncodePNG(const rgb_image_t& image, std::vector<uint8_t>& out, bool exhaustive) {
+#if HAVE_LIBPNG
+    if (exhaustive)
+        return png_write_smallest(image.width, image.height, &image.pixels[0], image.width * 3, NULL, out);
+
+    png_image png;
+    memset(&png, 0, sizeof(png));
+    png.version = PNG_IMAGE_VERSION;
+    png.width = image.width;
+    png.height = image.height;
+    png.format = PNG_FORMAT_RGB;
+
+    png_alloc_size_t len = 0;
+    if (!png_image_write_get_memory_size(png, len, 0, &image.pixels[0], 0, NULL)) {
+        fprintf(stderr, "ODR-PadEnc Error: PNG processing failed: %s\n", png.message);
+        return false;
+    }
+    out.resize(len);
+    if (!png_image_write_to_memory(&png, &out[0], &len, 0, &image.pixels[0], 0, NULL)) {
+        fprintf(stderr, "ODR-PadEnc Error: PNG processing failed: %s\n", png.message);
+        return false;
+    }
+    out.resize(len);
+    return true;
+#else
+    (void) image;
+    (void) exhaustive;
+    out.clear();
+    return false;
+#endif
+}
+
+bool SlideCodec::EncodePNG(const palette_image_t& image, std::vector<uint8_t>& out, bool exhaustive) {
+#if HAVE_LIBPNG
+    if (exhaustive)
+        return png_write_smallest(image.width, image.height, &image.indices[0], image.width, &image.colormap, out);
+
+    png_image png;
+    memset(&png, 0, sizeof(png));
+    png.version = PNG_IMAGE_VERSION;
+    png.width = image.width;
+    png.height = image.height;
+    png.format = PNG_FORMAT_RGB_COLORMAP;
+    png.colormap_entries = image.colormap.size() / 3;
+
+    png_alloc_size_t len = 0;
+    if (!png_image_write_get_memory_size(png, len, 0, &image.indices[0], 0, &image.colormap[0])) {
+        fprintf(stderr, "ODR-PadEnc Error: PNG processing failed: %s\n", png.message);
+        return false;
+    }
+    out.resize(len);
+    if (!png_image_write_to_memory(&png, &out[0], &len, 0, &image.indices[0], 0, &image.colormap[0])) {
+        fprintf(stderr, "ODR-PadEnc Error: PNG processing failed: %s\n", png.message);
+        return false;
+    }
+    out.resize(len);
+    return true;
+#else
+    (void) image;
+    (void) exhaustive;
+    out.clear();
+    return false;
+#endif
+}
+
+bool SlideCodec::EncodePalettePNG(const rgb_image_t& image, std::vector<uint8_t>& out) {
+    palette_image_t palette;
+    return ExactPalette(image, palette) && EncodePNG(palette, out);
+}
+
+bool SlideCodec::ExactPalette(const rgb_image_t& image, palette_image_t& palette) {
+    // the palette index of each colour, by open addressing (the table at most half full)
+    const size_t TABLE_SIZE = 512;
+    uint32_t colours[TABLE_SIZE];
+    uint8_t table_index[TABLE_SIZE];
+    std::fill(colours, colours + TABLE_SIZE, 0xFFFFFFFF);
+
+    const size_t pixels = image.width * image.height;
+    palette.width = image.width;
+    palette.height = image.height;
+    palette.indices.resize(pixels);
+    palette.colormap.clear();
+    for (size_t i = 0; i < pixels; i++) {
+        const uint8_t* rgb = &image.pixels[3 * i];
+        const uint32_t colour = (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+        size_t slot = (colour * 2654435761u) >> 23;
+        while (colours[slot] != colour && colours[slot] != 0xFFFFFFFF)
+            slot = (slot + 1) % TABLE_SIZE;
+        if (colours[slot] == 0xFFFFFFFF) {
+            const size_t entries = palette.colormap.size() / 3;
+            if (entries == 256)
+                return false;
+            colours[slot] = colour;
+            table_index[slot] = entries;
+            palette.colormap.insert(palette.colormap.end(), rgb, rgb + 3);
+        }
+        palette.indices[i] = table_index[slot];
+    }
+    return true;
+}
+
+
+// --- palette quantisation -----------------------------------------------------------------
+namespace {
+struct colour_count_t {
+    uint8_t rgb[3];
+    uint32_t count;
+};
+
+// a box of the median cut: a range of the distinct colours
+struct colour_box_t {
+    size_t begin;
+    size_t end;
+    uint64_t pixels;
+    int channel;        // the one with the widest range
+    int range;
+
+    void Measure(const std::vector<colour_count_t>& colours) {
+        uint8_t min[3] = {255, 255, 255};
+        uint8_t max[3] = {0, 0, 0};
+        pixels = 0;
+        for (size_t i = begin; i < end; i++) {
+            for (int c = 0; c < 3; c++) {
+                min[c] = std::min(min[c], colours[i].rgb[c]);
+                max[c] = std::max(max[c], colours[i].rgb[c]);
+            }
+            pixels += colours[i].count;
+        }
+        channel = 0;
+        range = -1;
+        for (int c = 0; c < 3; c++) {
+            if (max[c] - min[c] > range) {
+                range = max[c] - min[c];
+                channel = c;
+            }
+        }
+    }
+};
+
+/*! The palette entries in separate arrays per channel, so that the distance
+ * of a colour to all entries is computed by the compiler's SIMD instructions.
+ */
+struct palette_planes_t {
+    size_t entries;
+    int32_t r[256];
+    int32_t g[256];
+    int32_t b[256];
+
+    uint8_t Nearest(const uint8_t* rgb, uint32_t& distance) const {
+        int32_t distances[256];
+        const int32_t cr = rgb[0];
+        const int32_t cg = rgb[1];
+        const int32_t cb = rgb[2];
+        for (size_t i = 0; i < entries; i++)
+            distances[i] = (r[i] - cr) * (r[i] - cr) + (g[i] - cg) * (g[i] - cg) + (b[i] - cb) * (b[i] - cb);
+
+        size_t nearest = 0;
+        int32_t nearest_distance = INT32_MAX;
+        for (size_t i = 0; i < entries; i++) {
+            if (distances[i] < nearest_distance) {
+                nearest_distance = distances[i];
+                nearest = i;
+            }
+        }
+        distance = nearest_distance;
+        return nearest;
+    }
+};
+}
+
+double SlideCodec::QuantizePalette(const rgb_image_t& image, palette_image_t& palette) {
+    const size_t pixels = image.width * image.height;
+    palette.width = image.width;
+    palette.height = image.height;
+    palette.indices.resize(pixels);
+    palette.colormap.clear();
+    if (pixels == 0)
+        return 0;
+
+    // the distinct colours (with the pixel each is found at)
+    std::vector<uint64_t> keys(pixels);
+    for (size_t i = 0; i < pixels; i++) {
+        const uint8_t* rgb = &image.pixels[3 * i];
+        keys[i] = ((uint64_t) ((rgb[0] << 16) | (rgb[1] << 8) | rgb[2]) << 32) | i;
+    }
+    std::sort(keys.begin(), keys.end());
+    std::vector<colour_count_t> distinct;
+    std::vector<uint32_t> colour_of_pixel(pixels);
+    for (size_t i = 0; i < pixels; i++) {
+        const uint32_t colour = keys[i] >> 32;
+        if (i == 0 || (keys[i - 1] >> 32) != colour)
+            distinct.push_back(colour_count_t{{(uint8_t) (colour >> 16), (uint8_t) (colour >> 8), (uint8_t) colour}, 0});
+        distinct.back().count++;
+        colour_of_pixel[(uint32_t) keys[i]] = distinct.size() - 1;
+    }
+    std::vector<colour_count_t> colours(distinct);
+
+    // median cut: splits the box of most pixels (among those of more than one colour) at its weighted median
+    std::vector<colour_box_t> boxes(1);
+    boxes[0].begin = 0;
+    boxes[0].end = colours.size();
+    boxes[0].Measure(colours);
+    while (boxes.size() < 256) {
+        colour_box_t* widest = NULL;
+        for (colour_box_t& box : boxes)
+            if (box.range > 0 && (!widest || box.pixels * box.range > widest->pixels * widest->range))
+                widest = &box;
+        if (!widest)
+            break;
+
+        const int channel = widest->channel;
+        std::sort(colours.begin() + widest->begin, colours.begin() + widest->end,
+                  [channel](const colour_count_t& a, const colour_count_t& b){return a.rgb[channel] < b.rgb[channel];});
+        uint64_t below = 0;
+        size_t split = widest->begin + 1;
+        for (size_t i = widest->begin; i < widest->end - 1; i++) {
+            below += colours[i].count;
+            split = i + 1;
+            if (2 * below >= widest->pixels)
+                break;
+        }
+
+        colour_box_t upper = *widest;
+        upper.begin = split;
+        widest->end = split;
+        widest->Measure(colours);
+        upper.Measure(colours);
+        boxes.push_back(upper);
+    }
+
+    // each box by its (weighted) mean colour
+    palette_planes_t planes;
+    planes.entries = boxes.size();
+    for (size_t i = 0; i < boxes.size(); i++) {
+        uint64_t sum[3] = {0, 0, 0};
+        for (size_t j = boxes[i].begin; j < boxes[i].end; j++)
+            for (int c = 0; c < 3; c++)
+                sum[c] += (uint64_t) colours[j].rgb[c] * colours[j].count;
+        planes.r[i] = (sum[0] + boxes[i].pixels / 2) / boxes[i].pixels;
+        planes.g[i] = (sum[1] + boxes[i].pixels / 2) / boxes[i].pixels;
+        planes.b[i] = (sum[2] + boxes[i].pixels / 2) / boxes[i].pixels;
+    }
+
+    // the distinct colours in their original order, as the median cut sorted its copy
+    std::vector<uint8_t> colour_index(distinct.size());
+    uint64_t error = 0;
+    for (size_t i = 0; i < distinct.size(); i++) {
+        uint32_t distance;
+        colour_index[i] = planes.Nearest(distinct[i].rgb, distance);
+        error += (uint64_t) distance * distinct[i].count;
+    }
+
+    for (size_t i = 0; i < pixels; i++)
+        palette.indices[i] = colour_index[colour_of_pixel[i]];
+    for (size_t i = 0; i < planes.entries; i++) {
+        palette.colormap.push_back(planes.r[i]);
+        palette.colormap.push_back(planes.g[i]);
+        palette.colormap.push_back(planes.b[i]);
+    }
+    return (double) error / (3 * pixels);
+}
+#endif /* HAVE_LIBJPEG */
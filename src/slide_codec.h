@@ -0,0 +1,158 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file slide_codec.h
+    \brief Lean JPEG/PNG slide processing without MagickWand
+*/
+
+#ifndef SLIDE_CODEC_H_
+#define SLIDE_CODEC_H_
+
+#include "common.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+
+// --- rgb_image_t -----------------------------------------------------------------
+struct rgb_image_t {
+    size_t width;
+    size_t height;
+    std::vector<uint8_t> pixels;    // 3 bytes (RGB) per pixel, row by row
+
+    rgb_image_t() : width(0), height(0) {}
+};
+
+
+// --- palette_image_t -----------------------------------------------------------------
+struct palette_image_t {
+    size_t width;
+    size_t height;
+    std::vector<uint8_t> indices;   // 1 byte per pixel, row by row
+    std::vector<uint8_t> colormap;  // 3 bytes (RGB) per entry, up to 256 entries
+
+    palette_image_t() : width(0), height(0) {}
+};
+
+
+// --- image_stats_t -----------------------------------------------------------------
+// simple quality measures of an image, each from 0 to 1
+struct image_stats_t {
+    double brightness;  // mean luma
+    double contrast;    // standard deviation of the luma (relative to half the range)
+    double sharpness;   // standard deviation of the luma Laplacian (saturating at 64 luma steps)
+};
+
+
+struct image_probe_t;
+
+
+// --- SlideCodec -----------------------------------------------------------------
+/*! Decodes, scales down and encodes the common JPEG and PNG slides directly
+ * by means of libjpeg(-turbo) and libpng, so that MagickWand (and its per
+ * image setup) is only needed for other formats.
+ *
+ * JPEG slides are already scaled down while decoding (in the DCT domain) by
+ * the largest power of 2 that keeps at least the target size.
+ */
+class SlideCodec {
+public:
+    enum class Format {UNKNOWN, JPEG, PNG, WEBP, HEIF, GIF, BMP};
+
+    static const size_t MAX_WIDTH;
+    static const size_t MAX_HEIGHT;
+    // mean squared error per channel up to which a quantised palette is used (graphics, not photos)
+    static const double MAX_PALETTE_ERROR;
+
+    // the format by its signature; only JPEG and PNG are Supported() for decoding
+    static Format DetectFormat(const uint8_t* data, size_t len);
+    static bool Supported(Format format);
+
+    /*! reads the format, size and (for JPEG) whether progressive from the
+     *  header alone, i.e. the markers up to SOF, the IHDR chunk, the VP8 or
+     *  VP8X chunk or the ispe box; no library is involved and nothing is
+     *  decoded, so it works on the first few KB of a file
+     */
+    static bool Probe(const uint8_t* data, size_t len, image_probe_t& probe);
+    // as Probe(), for an image of a known format
+    static bool ReadInfo(Format format, const uint8_t* data, size_t len, size_t& width, size_t& height, bool& progressive);
+
+    /*! removes meta data (e.g. Exif, comments, text chunks) without
+     *  recompression; returns false, if there is nothing to remove
+     */
+    static bool StripMetadata(Format format, const uint8_t* data, size_t len, std::vector<uint8_t>& out);
+
+    // the size within MAX_WIDTH x MAX_HEIGHT, keeping the aspect ratio (as with MagickWand before)
+    static void FitSize(size_t& width, size_t& height);
+
+    /*! decodes an image; a JPEG image is scaled down to at least
+     *  min_width x min_height while decoding
+     */
+    static bool Decode(Format format, const uint8_t* data, size_t len, size_t min_width, size_t min_height, rgb_image_t& image);
+
+    /*! scales down by averaging the covered area of each target pixel
+     *  (separable, in fixed-point arithmetic, keeping one source row at a time)
+     */
+    static void Downscale(const rgb_image_t& src, size_t width, size_t height, rgb_image_t& dst);
+
+    /*! 64-bit difference hash (dHash) of the image, i.e. whether the
+     *  brightness rises from pixel to pixel of a 9x8 thumbnail; similar
+     *  images (e.g. re-exported or recompressed) differ in a few bits only
+     */
+    static uint64_t DifferenceHash(const rgb_image_t& image);
+
+    /*! analyses the luma of an image, in integer arithmetic; meant for a
+     *  thumbnail (e.g. 80x60) rather than the full image
+     */
+    static image_stats_t Analyze(const rgb_image_t& image);
+
+    // baseline JPEG (as progressive coding is optional for receivers)
+    static bool EncodeJPEG(const rgb_image_t& image, int quality, std::vector<uint8_t>& out);
+    /*! exhaustive: tries all filter and deflate strategy combinations at
+     *  the highest compression level, for the smallest PNG (e.g. offline)
+     */
+    static bool EncodePNG(const rgb_image_t& image, std::vector<uint8_t>& out, bool exhaustive = false);
+    static bool EncodePNG(const palette_image_t& image, std::vector<uint8_t>& out, bool exhaustive = false);
+    /*! PNG with a palette, which keeps the image unchanged; false for more
+     *  than 256 colours (e.g. photos)
+     */
+    static bool EncodePalettePNG(const rgb_image_t& image, std::vector<uint8_t>& out);
+
+    // the palette of the image, if it has at most 256 colours
+    static bool ExactPalette(const rgb_image_t& image, palette_image_t& palette);
+    /*! reduces the image to 256 colours by median cut and maps each colour
+     *  to the nearest one; returns the mean squared error per channel
+     */
+    static double QuantizePalette(const rgb_image_t& image, palette_image_t& palette);
+};
+
+
+// --- image_probe_t -----------------------------------------------------------------
+// what the header of an image tells, without decoding it
+struct image_probe_t {
+    SlideCodec::Format format;
+    size_t width;
+    size_t height;
+    bool progressive;   // JPEG only
+
+    image_probe_t() : format(SlideCodec::Format::UNKNOWN), width(0), height(0), progressive(false) {}
+};
+
+#endif /* SLIDE_CODEC_H_ */
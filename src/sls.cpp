@@ -28,45 +28,259 @@
 */
 
 #include "sls.h"
+#include "slide_codec.h"
+#include "jpeg_offload.h"
+#include "crc.h"
+#include "log.h"
+#include "metrics.h"
+#include "thread_placement.h"
+#include "trace.h"
+
+#include <set>
+#include <sstream>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#  include <sys/inotify.h>
+#  include <sys/syscall.h>
+#endif
 
 
 // --- History -----------------------------------------------------------------
-const size_t History::MAXHISTORYLEN   =    50; // How many slides to keep in history
+const size_t History::MAXHISTORYLEN   =    50; // How many slides to keep in history by default
 const int    History::MAXSLIDEID      =  9999; // Roll-over value for fidx
+const int    History::NONE            =    -1; // No entry
+
+History::History(size_t hist_size) :
+    m_count(0),
+    m_oldest(NONE),
+    m_newest(NONE),
+    m_hist_size(std::max(hist_size, (size_t) 1)),
+    m_last_given_fidx(0),
+    m_changes(0),
+    m_content_hashing(false)
+{
+    m_entries.resize(m_hist_size);
+    m_index.assign(index_size(m_hist_size), NONE);
+    m_index_mask = m_index.size() - 1;
+}
+
+
+size_t History::index_size(size_t hist_size)
+{
+    // keep the load factor at 50% at most
+    size_t size = 1;
+    while (size < 2 * hist_size)
+        size <<= 1;
+    return size;
+}
+
+
+size_t History::allocated_bytes(size_t hist_size)
+{
+    hist_size = std::max(hist_size, (size_t) 1);
+    return hist_size * sizeof(entry_t) + index_size(hist_size) * sizeof(int);
+}
+
+
+size_t History::hash(const fingerprint_t& fp)
+{
+    // the same fields that fingerprint_t::operator== compares
+    size_t h = std::hash<std::string>()(fp.s_name);
+    h ^= std::hash<off_t>()(fp.s_size) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    h ^= std::hash<unsigned long>()(fp.s_mtime) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    return h;
+}
+
+
+uint64_t History::content_hash(const char* filepath)
+{
+    // the same hash as the slide cache's content hash
+    slide_blob_t file = SlideBlob::MapFile(filepath);
+    return file ? odr::hash64(file->Data(), file->Size()) : 0;
+}
+
+
+void History::unlink_entry(int entry)
+{
+    entry_t& e = m_entries[entry];
+    if (e.older != NONE)
+        m_entries[e.older].newer = e.newer;
+    else
+        m_oldest = e.newer;
+
+    if (e.newer != NONE)
+        m_entries[e.newer].older = e.older;
+    else
+        m_newest = e.older;
+}
+
+
+void History::link_newest(int entry)
+{
+    entry_t& e = m_entries[entry];
+    e.older = m_newest;
+    e.newer = NONE;
+
+    if (m_newest != NONE)
+        m_entries[m_newest].newer = entry;
+    else
+        m_oldest = entry;
+    m_newest = entry;
+}
 
-int History::find(const fingerprint_t& fp) const
+
+void History::index_insert(int entry)
+{
+    size_t i = m_entries[entry].hash & m_index_mask;
+    while (m_index[i] != NONE)
+        i = (i + 1) & m_index_mask;
+    m_index[i] = entry;
+}
+
+
+void History::index_remove(int entry)
+{
+    size_t i = m_entries[entry].hash & m_index_mask;
+    while (m_index[i] != entry)
+        i = (i + 1) & m_index_mask;
+
+    // shift back following entries of the same probe sequence, so that no tombstones are needed
+    for (;;) {
+        m_index[i] = NONE;
+
+        size_t j = i;
+        for (;;) {
+            j = (j + 1) & m_index_mask;
+            if (m_index[j] == NONE)
+                return;
+
+            // an entry may only move towards its home slot
+            size_t home = m_entries[m_index[j]].hash & m_index_mask;
+            bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+            if (!stays)
+                break;
+        }
+
+        m_index[i] = m_index[j];
+        i = j;
+    }
+}
+
+
+int History::find(const fingerprint_t& fp)
 {
-    // return the id of fingerprint found
-    for (const fingerprint_t& db_fp : m_database)
-        if (db_fp == fp)
-            return db_fp.fidx;
+    const size_t h = hash(fp);
+
+    for (size_t i = h & m_index_mask; m_index[i] != NONE; i = (i + 1) & m_index_mask) {
+        int entry = m_index[i];
+        entry_t& e = m_entries[entry];
+        if (e.hash == h && e.fp == fp) {
+            // return the id of fingerprint found
+            if (entry != m_newest) {
+                unlink_entry(entry);
+                link_newest(entry);
+            }
+            return e.fp.fidx;
+        }
+    }
 
     // return -1 when the database doesn't contain this fingerprint
     return -1;
 }
 
 
-void History::add(fingerprint_t& fp)
+int History::find_content(const fingerprint_t& fp)
 {
-    m_database.push_back(fp);
+    if (fp.s_content_hash == 0)
+        return -1;
+
+    for (int entry = m_newest; entry != NONE; entry = m_entries[entry].older) {
+        entry_t& e = m_entries[entry];
+        if (e.fp.s_content_hash != fp.s_content_hash || e.fp.s_size != fp.s_size || e.fp.s_name != fp.s_name)
+            continue;
+
+        // re-indexed by the new attributes, so that the file is found without hashing next time
+        index_remove(entry);
+        e.fp.s_mtime = fp.s_mtime;
+        e.hash = hash(e.fp);
+        index_insert(entry);
+        if (entry != m_newest) {
+            unlink_entry(entry);
+            link_newest(entry);
+        }
+        m_changes++;
+        return e.fp.fidx;
+    }
+    return -1;
+}
 
-    if (m_database.size() > m_hist_size) {
-        m_database.pop_front();
+
+void History::add(const fingerprint_t& fp, int fidx)
+{
+    int entry;
+    if (m_count < m_hist_size) {
+        entry = m_count++;
     }
+    else {
+        // reuse the least recently used entry
+        entry = m_oldest;
+        index_remove(entry);
+        unlink_entry(entry);
+    }
+
+    entry_t& e = m_entries[entry];
+    e.fp = fp;
+    e.fp.fidx = fidx;
+    e.hash = hash(fp);
+    link_newest(entry);
+    index_insert(entry);
+
+    m_changes++;
+}
+
+
+std::vector<fingerprint_t> History::get_entries() const
+{
+    std::vector<fingerprint_t> result;
+    result.reserve(m_count);
+    for (int entry = m_oldest; entry != NONE; entry = m_entries[entry].newer)
+        result.push_back(m_entries[entry].fp);
+    return result;
+}
+
+
+void History::restore(const std::vector<fingerprint_t>& entries, int last_given_fidx)
+{
+    m_count = 0;
+    m_oldest = m_newest = NONE;
+    m_index.assign(m_index.size(), NONE);
+
+    for (const fingerprint_t& fp : entries)
+        if (find(fp) < 0)
+            add(fp, fp.fidx);
+
+    m_last_given_fidx = last_given_fidx;
+    m_changes++;
 }
 
 
 void History::disp_database()
 {
-    size_t id;
+    size_t id = 0;
     printf("HISTORY DATABASE:\n");
-    if (m_database.empty()) {
+    if (m_count == 0) {
         printf(" empty\n");
     }
     else {
-        for (id = 0; id < m_database.size(); id++) {
-            printf(" id %4zu: ", id);
-            m_database[id].disp();
+        for (int entry = m_oldest; entry != NONE; entry = m_entries[entry].newer) {
+            printf(" id %4zu: ", id++);
+            m_entries[entry].fp.disp();
         }
     }
     printf("-----------------\n");
@@ -79,194 +293,1894 @@ int History::get_fidx(const char* filepath)
 
     fp.load_from_file(filepath);
 
-    int idx = find(fp);
+    return get_fidx(fp, filepath);
+}
+
 
-    if (idx < 0) {
-        idx = m_last_given_fidx++;
-        fp.fidx = idx;
+int History::get_fidx(const fingerprint_t& fp, const char* filepath, bool* by_content)
+{
+    if (by_content)
+        *by_content = false;
 
-        if (m_last_given_fidx > MAXSLIDEID) {
-            m_last_given_fidx = 0;
+    int idx = find(fp);
+    if (idx >= 0)
+        return idx;
+
+    // only hashed now that the attributes do not match
+    fingerprint_t hashed = fp;
+    if (m_content_hashing && filepath) {
+        hashed.s_content_hash = content_hash(filepath);
+        idx = find_content(hashed);
+        if (idx >= 0) {
+            if (by_content)
+                *by_content = true;
+            return idx;
         }
+    }
+
+    idx = m_last_given_fidx++;
 
-        add(fp);
+    if (m_last_given_fidx > MAXSLIDEID) {
+        m_last_given_fidx = 0;
     }
 
+    add(hashed, idx);
+
     return idx;
 }
 
 
-// --- SlideStore -----------------------------------------------------------------
-int SlideStore::FilterSlides(const struct dirent* file) {
-    std::string name = file->d_name;
+// --- ChangeCoalescer -----------------------------------------------------------------
+bool ChangeCoalescer::ParseSettle(const std::string& spec, change_settle_t& settle) {
+    const std::vector<std::string> parts = split_string(spec, ',');
+    if (parts.empty() || parts.size() > 2)
+        return false;
 
-    // skip '.'/'..' dirs
-    if(name == "." || name == "..")
-        return 0;
+    long values[2] = {0, settle.max_delay.count()};
+    for (size_t i = 0; i < parts.size(); i++) {
+        char* end;
+        values[i] = strtol(parts[i].c_str(), &end, 10);
+        if (parts[i].empty() || *end || values[i] < 0)
+            return false;
+    }
+    if (values[1] < values[0])
+        return false;
 
-    // skip slide params files
-    if(SLSEncoder::isSlideParamFileFilename(name))
-        return 0;
+    settle.quiet = std::chrono::milliseconds(values[0]);
+    settle.max_delay = std::chrono::milliseconds(values[1]);
+    return true;
+}
 
-    // skip re-read request file
-    if(name == SLSEncoder::REQUEST_REREAD_FILENAME.c_str())
-        return 0;
 
-    return 1;
+// --- SlideDirWatcher -----------------------------------------------------------------
+bool SlideDirWatcher::Watch(const std::string& dir) {
+    StopWatching();
+    this->dir = dir;
+    // a complete scan takes over any burst
+    coalescer.Clear();
+    changed_files.clear();
+    rescan = false;
+
+#ifdef __linux__
+    // add the watch before scanning, so that no change gets lost
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd == -1) {
+        perror("ODR-PadEnc Warning: cannot watch slides directory - scanning it completely instead");
+    }
+    else if (inotify_add_watch(inotify_fd, dir.c_str(),
+            IN_CREATE | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF) == -1) {
+        perror(("ODR-PadEnc Warning: cannot watch slides directory '" + dir + "' - scanning it completely instead").c_str());
+        StopWatching();
+    }
+#endif
+
+    return Scan();
 }
 
-bool SlideStore::InitFromDir(const std::string& dir) {
-    // start with empty list
-    Clear();
+
+void SlideDirWatcher::StopWatching() {
+    if (inotify_fd != -1) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+}
+
+
+bool SlideDirWatcher::Scan() {
+    files.clear();
 
     struct dirent** dir_entries;
-    int dir_count = scandir(dir.c_str(), &dir_entries, FilterSlides, alphasort);
+    int dir_count = scandir(dir.c_str(), &dir_entries, NULL, alphasort);
     if (dir_count < 0) {
         perror(("ODR-PadEnc Error: cannot open slides directory '" + dir + "'").c_str());
         return false;
     }
 
-    // add new slides to transmit to list
     for (int i = 0; i < dir_count; i++) {
-        std::string imagepath = dir + "/" + std::string(dir_entries[i]->d_name);
+        UpdateFile(dir_entries[i]->d_name);
         free(dir_entries[i]);
+    }
+    free(dir_entries);
 
-        slide_metadata_t md;
-        md.filepath = imagepath;
-        md.fidx     = history.get_fidx(imagepath.c_str());
-        slides.push_back(md);
+    return true;
+}
 
-        if (verbose)
-            fprintf(stderr, "ODR-PadEnc found slide '%s', fidx %d\n", imagepath.c_str(), md.fidx);
+
+void SlideDirWatcher::UpdateFile(const std::string& name) {
+    if (!SlideStore::IsSlideFilename(name))
+        return;
+
+    fingerprint_t fp;
+    if (fp.load_from_file((dir + "/" + name).c_str()))
+        files[name] = fp;
+    else
+        files.erase(name);
+}
+
+
+bool SlideDirWatcher::ProcessEvents() {
+#ifdef __linux__
+    bool changed = false;
+    bool rewatch = false;
+
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t len = read(inotify_fd, buffer, sizeof(buffer));
+        if (len == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            perror("ODR-PadEnc Warning: cannot read slides directory changes - scanning it completely instead");
+            rewatch = true;
+            break;
+        }
+
+        for (char* ptr = buffer; ptr < buffer + len; ) {
+            const struct inotify_event* event = (const struct inotify_event*) ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+                rescan = true;
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+                rewatch = true;
+            if (event->len)
+                changed_files.insert(event->name);  // deletions included
+            changed = true;
+        }
     }
 
-    free(dir_entries);
+    if (rewatch)
+        return Watch(dir);
 
-#ifdef DEBUG
-    history.disp_database();
+    // the burst is taken over as a whole, once it is over
+    if (changed)
+        coalescer.Note();
+    if (!coalescer.TakeDue())
+        return true;
+
+    std::set<std::string> burst;
+    burst.swap(changed_files);
+    if (rescan) {
+        rescan = false;
+        return Scan();
+    }
+    for (const std::string& name : burst)
+        UpdateFile(name);
 #endif
 
-    // sort the list in fidx order
-    slides.sort();
+    return true;
+}
+
+
+bool SlideDirWatcher::Update() {
+    return Watching() ? ProcessEvents() : Scan();
+}
+
+
+// --- SlideDirCursor -----------------------------------------------------------------
+const size_t SlideDirCursor::CHUNK_SIZE = 32 * 1024;
+
+#ifdef __linux__
+// as returned by getdents64 (not declared by older C libraries)
+struct slide_dirent64_t {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+bool SlideDirCursor::Open(const std::string& dir) {
+    Close();
+    this->dir = dir;
+
+#ifdef __linux__
+    dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1) {
+        perror(("ODR-PadEnc Error: cannot open slides directory '" + dir + "'").c_str());
+        return false;
+    }
+    chunk.resize(CHUNK_SIZE);
+    Seek(0);
+    return true;
+#else
+    fprintf(stderr, "ODR-PadEnc Error: streaming the slides directory is only supported on Linux\n");
+    return false;
+#endif
+}
+
+void SlideDirCursor::Close() {
+    if (dir_fd != -1) {
+        close(dir_fd);
+        dir_fd = -1;
+    }
+    dir.clear();
+}
+
+void SlideDirCursor::Seek(uint64_t position) {
+    this->position = position;
+    chunk_len = chunk_pos = 0;
+    if (dir_fd != -1 && lseek(dir_fd, position, SEEK_SET) == -1)
+        perror(("ODR-PadEnc Warning: cannot seek in slides directory '" + dir + "'").c_str());
+}
+
+int SlideDirCursor::ReadChunk() {
+#ifdef __linux__
+    for (;;) {
+        long len = syscall(SYS_getdents64, dir_fd, &chunk[0], chunk.size());
+        if (len == -1 && errno == EINTR)
+            continue;
+        if (len == -1)
+            perror(("ODR-PadEnc Error: cannot read slides directory '" + dir + "'").c_str());
+        chunk_len = len > 0 ? len : 0;
+        chunk_pos = 0;
+        return len > 0 ? 1 : len;
+    }
+#else
+    return -1;
+#endif
+}
+
+bool SlideDirCursor::Next(size_t count, std::vector<std::string>& names) {
+#ifdef __linux__
+    bool wrapped = false;
+    size_t found = 0;
+    while (found < count) {
+        if (chunk_pos >= chunk_len) {
+            int result = ReadChunk();
+            if (result == -1)
+                return false;
+            if (result == 0) {
+                // at the end; a window does not continue at the start
+                bool rewind = !wrapped && found == 0;
+                Seek(0);
+                if (!rewind)
+                    break;
+                wrapped = true;
+                continue;
+            }
+        }
+
+        const slide_dirent64_t* entry = (const slide_dirent64_t*) &chunk[chunk_pos];
+        chunk_pos += entry->d_reclen;
+        position = entry->d_off;
+
+        if (entry->d_type == DT_DIR || !SlideStore::IsSlideFilename(entry->d_name))
+            continue;
+        names.push_back(entry->d_name);
+        found++;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+// --- SlideSchedule -----------------------------------------------------------------
+bool SlideSchedule::Before(const entry_t& a, const entry_t& b) {
+    if (a.params.priority != b.params.priority)
+        return a.params.priority > b.params.priority;
+    if (a.pass != b.pass)
+        return a.pass < b.pass;
+    return a.md.fidx < b.md.fidx;
+}
+
+void SlideSchedule::Swap(size_t a, size_t b) {
+    std::swap(heap[a], heap[b]);
+    index[heap[a].md.filepath] = a;
+    index[heap[b].md.filepath] = b;
+}
+
+void SlideSchedule::SiftUp(size_t i) {
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!Before(heap[i], heap[parent]))
+            break;
+        Swap(i, parent);
+        i = parent;
+    }
+}
+
+void SlideSchedule::SiftDown(size_t i) {
+    for (;;) {
+        size_t first = i;
+        for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < heap.size(); child++)
+            if (Before(heap[child], heap[first]))
+                first = child;
+        if (first == i)
+            break;
+        Swap(i, first);
+        i = first;
+    }
+}
+
+void SlideSchedule::RemoveAt(size_t i) {
+    index.erase(heap[i].md.filepath);
+    if (i != heap.size() - 1) {
+        heap[i] = std::move(heap.back());
+        index[heap[i].md.filepath] = i;
+    }
+    heap.pop_back();
+    if (i < heap.size()) {
+        SiftUp(i);
+        SiftDown(i);
+    }
+}
+
+void SlideSchedule::Push(const slide_metadata_t& md, const slide_schedule_params_t& params) {
+    Remove(md.filepath);
+
+    entry_t entry;
+    entry.md = md;
+    entry.params = params;
+    entry.params.weight = std::max(params.weight, 1u);
+    entry.remaining = entry.params.weight;
+    entry.pass = 0.5 / entry.params.weight;     // e.g. weight 2: at 1/4 and 3/4 of the cycle
+
+    index[md.filepath] = heap.size();
+    heap.push_back(std::move(entry));
+    SiftUp(heap.size() - 1);
+}
+
+bool SlideSchedule::Remove(const std::string& filepath) {
+    std::map<std::string, size_t>::const_iterator it = index.find(filepath);
+    if (it == index.end())
+        return false;
+    RemoveAt(it->second);
+    return true;
+}
+
+void SlideSchedule::Advance() {
+    entry_t& top = heap.front();
+    if (--top.remaining == 0) {
+        RemoveAt(0);
+        return;
+    }
+    top.pass += 1.0 / top.params.weight;
+    SiftDown(0);
+}
+
+
+// --- SlideStore -----------------------------------------------------------------
+bool SlideStore::IsSlideFilename(const std::string& name) {
+    // skip '.'/'..' dirs
+    if(name == "." || name == "..")
+        return false;
+
+    // skip slide params files
+    if(SLSEncoder::isSlideParamFileFilename(name))
+        return false;
+
+    // skip re-read request file
+    if(name == SLSEncoder::REQUEST_REREAD_FILENAME)
+        return false;
+
+    return true;
+}
+
+bool SlideStore::IsScheduleParam(const std::string& key) {
+    return key == "Priority" || key == "Weight" || key == "Expires" || key == "MinRepeat";
+}
+
+bool SlideStore::ParseScheduleParam(const std::string& key, const std::string& value, slide_schedule_params_t& params) {
+    char* end;
+    if (key == "Expires") {
+        // Unix time or UTC, e.g. 2024-05-01T18:30:00Z
+        long long seconds = strtoll(value.c_str(), &end, 10);
+        if (!value.empty() && *end == '\0' && seconds >= 0) {
+            params.expires = seconds;
+            return true;
+        }
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        end = strptime(value.c_str(), "%Y-%m-%dT%H:%M:%S", &tm);
+        if (!end || !(*end == '\0' || (end[0] == 'Z' && end[1] == '\0')))
+            return false;
+        params.expires = timegm(&tm);
+        return true;
+    }
+
+    long number = strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0')
+        return false;
+    if (key == "Priority") {
+        if (number < -100 || number > 100)
+            return false;
+        params.priority = number;
+        return true;
+    }
+    if (key == "Weight") {
+        if (number < 1 || number > 100)
+            return false;
+        params.weight = number;
+        return true;
+    }
+    if (key == "MinRepeat") {
+        if (number < 0 || number > 86400)
+            return false;
+        params.min_repeat = number;
+        return true;
+    }
+    return false;
+}
+
+const slide_schedule_params_t& SlideStore::GetScheduleParams(const std::string& filepath) {
+    const std::string params_fname = filepath + SLSEncoder::SLS_PARAMS_SUFFIX;
+    struct stat params_stat;
+    const unsigned long params_mtime = stat(params_fname.c_str(), &params_stat) ? 0 : params_stat.st_mtime;
+
+    // the params file is only parsed again, if changed
+    std::map<std::string, schedule_memo_t>::iterator it = schedule_memo.find(filepath);
+    if (it != schedule_memo.end() && it->second.mtime == params_mtime)
+        return it->second.params;
+
+    schedule_memo_t& memo = schedule_memo[filepath];
+    memo.mtime = params_mtime;
+    memo.params = slide_schedule_params_t();
+    if (!params_mtime)
+        return memo.params;
+
+    std::ifstream params_fstream(params_fname);
+    std::string line;
+    while (std::getline(params_fstream, line)) {
+        // the MOT parameters are left to SLSEncoder
+        size_t separator_pos = line.find('=');
+        if (line.empty() || line[0] == '#' || separator_pos == std::string::npos)
+            continue;
+        const std::string key = line.substr(0, separator_pos);
+        const std::string value = line.substr(separator_pos + 1);
+        if (IsScheduleParam(key) && !ParseScheduleParam(key, value, memo.params))
+            fprintf(stderr, "ODR-PadEnc Warning: SLS parameter %s value '%s' invalid - ignored\n", key.c_str(), value.c_str());
+    }
+    return memo.params;
+}
+
+void SlideStore::SetStreaming(size_t window, const std::string& cursor_file) {
+    this->window = window;
+    this->cursor_file = cursor_file;
+    cursor.Close();
+}
+
+void SlideStore::LoadCursorPosition() {
+    if (cursor_file.empty())
+        return;
+
+    // only valid for the same dir
+    std::ifstream file(cursor_file);
+    std::string dir;
+    uint64_t position;
+    if (std::getline(file, dir) && file >> position && dir == cursor.GetDir()) {
+        cursor.Seek(position);
+        if (verbose)
+            fprintf(stderr, "ODR-PadEnc continuing slides directory '%s' at position %llu\n", dir.c_str(), (unsigned long long) position);
+    }
+}
+
+void SlideStore::SaveCursorPosition() {
+    if (cursor_file.empty())
+        return;
+
+    // replaced atomically, so that it is never found incomplete
+    const std::string tmp_file = cursor_file + ".tmp";
+    {
+        std::ofstream file(tmp_file, std::ios::trunc);
+        file << cursor.GetDir() << "\n" << cursor.GetPosition() << "\n";
+        if (!file.good()) {
+            fprintf(stderr, "ODR-PadEnc Warning: cannot write slides directory position to '%s'\n", tmp_file.c_str());
+            return;
+        }
+    }
+    if (rename(tmp_file.c_str(), cursor_file.c_str()))
+        perror(("ODR-PadEnc Warning: cannot replace slides directory position file '" + cursor_file + "'").c_str());
+}
+
+bool SlideStore::InitFromCursor(const std::string& dir) {
+    if (cursor.GetDir() != dir) {
+        if (!cursor.Open(dir))
+            return false;
+        LoadCursorPosition();
+    }
+
+    std::vector<std::string> names;
+    names.reserve(window);
+    if (!cursor.Next(window, names))
+        return false;
+    SaveCursorPosition();
+
+    // only the window is kept
+    schedule_memo.clear();
+    last_taken.clear();
+
+    const time_t now = time(NULL);
+    for (const std::string& name : names) {
+        slide_metadata_t md;
+        md.filepath = dir + "/" + name;
+
+        fingerprint_t fp;
+        if (!fp.load_from_file(md.filepath.c_str()))
+            continue;
+        const slide_schedule_params_t& params = GetScheduleParams(md.filepath);
+        if (params.expires && now >= params.expires)
+            continue;
+
+        md.fidx = history.get_fidx(fp, md.filepath.c_str());
+        slides.push_back(md);
+        schedule.Push(md, params);
+
+        if (verbose)
+            fprintf(stderr, "ODR-PadEnc found slide '%s', fidx %d\n", md.filepath.c_str(), md.fidx);
+    }
+    cycle_active = true;
+
+    slides.sort();
+    return true;
+}
+
+bool SlideStore::InitFromDir(const std::string& dir) {
+    // start with empty list
+    Clear();
+
+    if (window > 0)
+        return InitFromCursor(dir);
+
+    // only check for changes, when already watching this dir
+    if (!(watcher.GetDir() == dir ? watcher.Update() : watcher.Watch(dir)))
+        return false;
+
+    // forget slides no longer present
+    const std::map<std::string, fingerprint_t>& files = watcher.GetFiles();
+    for (std::map<std::string, schedule_memo_t>::iterator it = schedule_memo.begin(); it != schedule_memo.end(); ) {
+        if (it->first.compare(0, dir.size() + 1, dir + "/") || !files.count(it->first.substr(dir.size() + 1))) {
+            last_taken.erase(it->first);
+            it = schedule_memo.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // add new slides to transmit to list
+    const time_t now = time(NULL);
+    for (const std::pair<const std::string, fingerprint_t>& file : files) {
+        slide_metadata_t md;
+        md.filepath = dir + "/" + file.first;
+
+        const slide_schedule_params_t& params = GetScheduleParams(md.filepath);
+        if (params.expires && now >= params.expires)
+            continue;
+
+        md.fidx     = history.get_fidx(file.second, md.filepath.c_str());
+        slides.push_back(md);
+        schedule.Push(md, params);
+        scheduled[file.first] = file.second;
+
+        if (verbose)
+            fprintf(stderr, "ODR-PadEnc found slide '%s', fidx %d\n", md.filepath.c_str(), md.fidx);
+    }
+    cycle_active = true;
+
+#ifdef DEBUG
+    history.disp_database();
+#endif
+
+    // sort the list in fidx order
+    slides.sort();
+
+    return true;
+}
+
+void SlideStore::Refresh() {
+    // without inotify, the dir is only scanned once per cycle
+    if (!cycle_active || !watcher.Watching() || !watcher.Update())
+        return;
+
+    const std::string& dir = watcher.GetDir();
+    const std::map<std::string, fingerprint_t>& files = watcher.GetFiles();
+
+    // drop removed slides
+    for (std::map<std::string, fingerprint_t>::iterator it = scheduled.begin(); it != scheduled.end(); ) {
+        if (files.count(it->first)) {
+            ++it;
+            continue;
+        }
+        schedule.Remove(dir + "/" + it->first);
+        it = scheduled.erase(it);
+    }
+
+    // add urgent slides added/changed meanwhile; the others wait for the next cycle
+    const time_t now = time(NULL);
+    for (const std::pair<const std::string, fingerprint_t>& file : files) {
+        std::map<std::string, fingerprint_t>::const_iterator it = scheduled.find(file.first);
+        if (it != scheduled.end() && it->second == file.second)
+            continue;
+
+        slide_metadata_t md;
+        md.filepath = dir + "/" + file.first;
+        const slide_schedule_params_t& params = GetScheduleParams(md.filepath);
+        if (params.priority <= 0 || (params.expires && now >= params.expires))
+            continue;
+
+        // a scheduled slide copied again unchanged is no new version
+        bool by_content;
+        md.fidx = history.get_fidx(file.second, md.filepath.c_str(), &by_content);
+        if (by_content && it != scheduled.end()) {
+            scheduled[file.first] = file.second;
+            continue;
+        }
+        schedule.Push(md, params);
+        scheduled[file.first] = file.second;
+        last_taken.erase(md.filepath);      // a new version is not a repetition
+
+        if (verbose)
+            fprintf(stderr, "ODR-PadEnc found urgent slide '%s', fidx %d\n", md.filepath.c_str(), md.fidx);
+    }
+}
+
+void SlideStore::Prune() {
+    const time_t now = time(NULL);
+    const std::chrono::steady_clock::time_point steady_now = std::chrono::steady_clock::now();
+
+    while (!schedule.Empty()) {
+        const SlideSchedule::entry_t& top = schedule.Top();
+        if (top.params.expires && now >= top.params.expires) {
+            const std::string filepath = top.md.filepath;
+            schedule.Remove(filepath);
+            continue;
+        }
+
+        // skip occurrences too close to the previous one
+        if (top.params.min_repeat > 0) {
+            std::map<std::string, std::chrono::steady_clock::time_point>::const_iterator it = last_taken.find(top.md.filepath);
+            if (it != last_taken.end() && steady_now - it->second < std::chrono::seconds(top.params.min_repeat)) {
+                schedule.Advance();
+                continue;
+            }
+        }
+        break;
+    }
+}
+
+void SlideStore::SetSettle(const change_settle_t& settle) {
+    watcher.SetSettle(settle);
+    reread.SetSettle(settle);
+}
+
+bool SlideStore::TakeReread() {
+    if (!reread.TakeDue())
+        return false;
+    Clear();
+    return true;
+}
+
+bool SlideStore::Empty() {
+    Refresh();
+    Prune();
+    return schedule.Empty();
+}
+
+void SlideStore::Clear() {
+    slides.clear();
+    schedule.Clear();
+    scheduled.clear();
+    cycle_active = false;
+}
+
+slide_metadata_t SlideStore::GetSlide() {
+    // pre-condition: not empty
+
+    slide_metadata_t slide = schedule.Top().md;
+    last_taken[slide.filepath] = std::chrono::steady_clock::now();
+    schedule.Advance();
+    return slide;
+}
+
+
+// --- MOTHeader -----------------------------------------------------------------
+MOTHeader::MOTHeader(size_t body_size, int content_type, int content_subtype, size_t extensions_len)
+: header_size(0) {
+    // init header core
+    data.reserve(7 + extensions_len);
+    data.resize(7, 0x00);
+
+    // body size
+    data[0] = (body_size >> 20) & 0xFF;
+    data[1] = (body_size >> 12) & 0xFF;
+    data[2] = (body_size >>  4) & 0xFF;
+    data[3] = (body_size <<  4) & 0xF0;
+
+    // header size
+    IncrementHeaderSize(data.size());
+
+    // content type
+    data[5] |= (content_type << 1) & 0x7E;
+
+    // content subtype
+    data[5] |= (content_subtype >> 8) & 0x01;
+    data[6] |=  content_subtype       & 0xFF;
+}
+
+
+void MOTHeader::IncrementHeaderSize(size_t size) {
+    header_size += size;
+
+    data[3] &= 0xF0;
+    data[3] |= (header_size >> 9) & 0x0F;
+
+    data[4]  = (header_size >> 1) & 0xFF;
+
+    data[5] &= 0x7F;
+    data[5] |= (header_size << 7) & 0x80;
+}
+
+
+void MOTHeader::AddExtensionFixedSize(int pli, int param_id, const uint8_t* data_field, size_t data_field_len) {
+    AddParamHeader(pli, param_id);
+    data.insert(data.end(), data_field, data_field + data_field_len);
+
+    IncrementHeaderSize(1 + data_field_len);
+}
+
+
+void MOTHeader::AddExtensionVarSize(int param_id, const uint8_t* data_field, size_t data_field_len) {
+    AddParamHeader(0x3, param_id);
+
+    // longer field lens use 15 instead of 7 bits
+    bool ext = data_field_len > 127;
+    if (ext) {
+        data.push_back(0x80 | ((data_field_len >> 8) & 0x7F));
+        data.push_back(data_field_len & 0xFF);
+    } else {
+        data.push_back(data_field_len & 0x7F);
+    }
+    data.insert(data.end(), data_field, data_field + data_field_len);
+
+    IncrementHeaderSize(1 + (ext ? 2 : 1) + data_field_len);
+}
+
+
+void MOTHeader::AddExtension(int param_id, const uint8_t* data_field, size_t data_field_len) {
+    int pli;
+
+    switch(data_field_len) {
+    case 0:
+        pli = 0x0;  // 0b00
+        break;
+    case 1:
+        pli = 0x1;  // 0b01
+        break;
+    case 4:
+        pli = 0x2;  // 0b10
+        break;
+    default:
+        pli = 0x3;  // 0b11
+        break;
+    }
+
+    if (pli == 0x3)
+        AddExtensionVarSize(param_id, data_field, data_field_len);
+    else
+        AddExtensionFixedSize(pli, param_id, data_field, data_field_len);
+}
+
+
+size_t MOTHeader::ExtensionSize(size_t data_field_len) {
+    switch(data_field_len) {
+    case 0:
+    case 1:
+    case 4:
+        return 1 + data_field_len;
+    default:
+        return 1 + (data_field_len > 127 ? 2 : 1) + data_field_len;
+    }
+}
+
+
+// --- MOTDirectory -----------------------------------------------------------------
+const int MOTDirectory::TID_BASE = 0xF000;
+
+bool MOTDirectory::Add(int tid, const uint8_vector_t& header, const slide_blob_t& body, size_t body_interval)
+{
+    std::list<object_t>::iterator it = std::find_if(objects.begin(), objects.end(), [tid](const object_t& o) {return o.tid == tid;});
+    if (it != objects.end()) {
+        const bool unchanged = it->header == header && it->body->Size() == body->Size() &&
+                (it->body == body || !memcmp(it->body->Data(), body->Data(), body->Size()));
+        if (unchanged) {
+            objects.splice(objects.begin(), objects, it);
+            if (!body_interval || ++it->skipped < body_interval)
+                return false;
+            it->skipped = 0;
+            return true;
+        }
+        objects.erase(it);
+    }
+
+    objects.push_front({tid, header, body, 0});
+    if (objects.size() > max_objects)
+        objects.pop_back();
+    version++;
+    data.reset();
+    return true;
+}
+
+
+void MOTDirectory::Clear()
+{
+    objects.clear();
+    version++;
+    data.reset();
+}
+
+
+slide_blob_t MOTDirectory::Build(size_t segment_size)
+{
+    if (data && data_segment_size == segment_size)
+        return data;
+
+    size_t size = 13;
+    for (const object_t& object : objects)
+        size += 2 + object.header.size();
+
+    uint8_vector_t directory;
+    directory.reserve(size);
+
+    // CompressionFlag (0), RFU, DirectorySize
+    directory.push_back((size >> 24) & 0x3F);
+    directory.push_back((size >> 16) & 0xFF);
+    directory.push_back((size >>  8) & 0xFF);
+    directory.push_back( size        & 0xFF);
+    // NumberOfObjects
+    directory.push_back((objects.size() >> 8) & 0xFF);
+    directory.push_back( objects.size()       & 0xFF);
+    // DataCarouselPeriod: not signalled, as it depends on the slide interval
+    directory.insert(directory.end(), 3, 0x00);
+    // RFU, SegmentSize
+    directory.push_back((segment_size >> 8) & 0x1F);
+    directory.push_back( segment_size       & 0xFF);
+    // DirectoryExtensionLength: none
+    directory.insert(directory.end(), 2, 0x00);
+
+    // DirectoryEntries, each the TransportId and the MOT header of an object
+    for (const object_t& object : objects) {
+        directory.push_back((object.tid >> 8) & 0xFF);
+        directory.push_back( object.tid       & 0xFF);
+        directory.insert(directory.end(), object.header.begin(), object.header.end());
+    }
+
+    data = std::make_shared<const SlideBlob>(std::move(directory));
+    data_segment_size = segment_size;
+    return data;
+}
+
+
+// --- MOTObjectBuilder -----------------------------------------------------------------
+void MOTObjectBuilder::createMscDG(MSCDG* msc, unsigned short int dgtype,
+        int *cindex, unsigned short int segnum, unsigned short int lastseg,
+        unsigned short int tid, const uint8_t* data,
+        unsigned short int datalen)
+{
+    msc->extflag = 0;
+    msc->crcflag = 1;
+    msc->segflag = 1;
+    msc->accflag = 1;
+    msc->dgtype = dgtype;
+    msc->cindex = *cindex;
+    msc->rindex = 0;
+    msc->last = lastseg;
+    msc->segnum = segnum;
+    msc->rfa = 0;
+    msc->tidflag = 1;
+    msc->lenid = 2;
+    msc->tid = tid;
+    msc->segdata = data;
+    msc->rcount = 0;
+    msc->seglen = datalen;
+
+    *cindex = (*cindex + 1) % 16;   // increment continuity index
+}
+
+
+DATA_GROUP* MOTObjectBuilder::packMscDG(MSCDG* msc, const slide_blob_t& blob)
+{
+    // if given, the segment data is referenced within its blob instead of being copied
+    DATA_GROUP* dg = packetizer->CreateDataGroup(blob ? 9 : 9 + msc->seglen, apptype_start, apptype_cont);
+    uint8_vector_t &b = dg->data;
+
+    // headers
+    b[0] = (msc->extflag<<7) | (msc->crcflag<<6) | (msc->segflag<<5) |
+           (msc->accflag<<4) | msc->dgtype;
+
+    b[1] = (msc->cindex<<4) | msc->rindex;
+    b[2] = (msc->last<<7) | ((msc->segnum & 0x7F00) >> 8);
+    b[3] =  msc->segnum & 0x00FF;
+    b[4] = 0;
+    b[4] = (msc->rfa << 5) | (msc->tidflag << 4) | msc->lenid;
+    b[5] = (msc->tid & 0xFF00) >> 8;
+    b[6] =  msc->tid & 0x00FF;
+    b[7] = (msc->rcount << 5) | ((msc->seglen & 0x1F00)>>8);
+    b[8] =  msc->seglen & 0x00FF;
+
+    // data field
+    if (blob)
+        dg->SetExternalPayload(msc->segdata, msc->seglen, blob);
+    else
+        memcpy(&b[9], msc->segdata, msc->seglen);
+
+    // CRC
+    dg->AppendCRC();
+
+    return dg;
+}
+
+
+void MOTObjectBuilder::queueDG(DATA_GROUP* mscdg, bool fill)
+{
+    DATA_GROUP* dgli = packetizer->CreateDataGroupLengthIndicator(mscdg->Size());
+    if (fill) {
+        packetizer->AddFillDG(dgli);
+        packetizer->AddFillDG(mscdg);
+    } else {
+        packetizer->AddDG(dgli, false);
+        packetizer->AddDG(mscdg, false);
+    }
+}
+
+
+bool MOTObjectBuilder::ParseHeaderPositions(const std::string& spec, std::vector<int>& positions)
+{
+    const long MAX_SEGMENTS = 0x8000;   // by the 15 bit segment number
+
+    positions.clear();
+    for (const std::string& position : split_string(spec, ',')) {
+        char* end;
+        const long value = strtol(position.c_str(), &end, 10);
+        if (position.empty() || *end || value < -MAX_SEGMENTS || value >= MAX_SEGMENTS)
+            return false;
+        positions.push_back(value);
+    }
+    return true;
+}
+
+
+void MOTObjectBuilder::QueueHeader(const slide_blob_t& header, int tid, bool repetition, bool fill)
+{
+    MSCDG msc;
+
+    int cindex_repeated = cindex_header_sent;
+    if (!repetition)
+        cindex_header_sent = cindex_header;
+
+    // Create the MSC Data Group C-Structure
+    createMscDG(&msc, 3, repetition ? &cindex_repeated : &cindex_header, 0, 1, tid, header->Data(), header->Size());
+    // Generate the MSC DG frame (Figure 9 en 300 401)
+    queueDG(packMscDG(&msc, header), fill);
+}
+
+
+void MOTObjectBuilder::queueSegments(unsigned short int dgtype, int* cindex, const slide_blob_t& data, int tid, const slide_blob_t& header,
+                                     std::function<void(bool)> done_handler, bool fill)
+{
+    MSCDG msc;
+
+    const uint8_t *blob = data->Data();
+    const size_t blobsize = data->Size();
+    const size_t nseg = std::max((blobsize + seglen - 1) / seglen, (size_t) 1);
+
+    // the body segments to repeat the header before, besides every header_repetition ones
+    std::vector<bool> header_before(nseg, false);
+    if (header) {
+        for (int position : header_positions) {
+            const long long i = position < 0 ? (long long) nseg + position : position;
+            if (i > 0 && i < (long long) nseg)
+                header_before[i] = true;
+        }
+    }
+
+    for (size_t i = 0; i < nseg; i++) {
+        const int last = i == nseg - 1;
+        const size_t curseglen = last ? blobsize - i * seglen : seglen;
+
+        // for receivers that missed the header
+        if (header && i > 0 && ((header_repetition && i % header_repetition == 0) || header_before[i]))
+            QueueHeader(header, tid, true, fill);
+
+        createMscDG(&msc, dgtype, cindex, i, last, tid, blob + i * seglen, curseglen);
+        DATA_GROUP* mscdg = packMscDG(&msc, data);
+
+        // the DGs of the object are sent in order, so the last segment completes it
+        if (last)
+            mscdg->done_handler = std::move(done_handler);
+
+        queueDG(mscdg, fill);
+    }
+}
+
+
+void MOTObjectBuilder::QueueObject(const slide_blob_t& header, const slide_blob_t& body, int tid, bool repetition,
+                                   std::function<void(bool)> done_handler, bool fill)
+{
+    // MOT Header
+    QueueHeader(header, tid, repetition, fill);
+
+    // MOT Body
+    queueSegments(4, &cindex_body, body, tid, header, std::move(done_handler), fill);
+}
+
+
+void MOTObjectBuilder::QueueBody(const slide_blob_t& body, int tid, std::function<void(bool)> done_handler, bool fill)
+{
+    queueSegments(4, &cindex_body, body, tid, nullptr, std::move(done_handler), fill);
+}
+
+
+void MOTObjectBuilder::QueueDirectory(const slide_blob_t& directory, int tid, std::function<void(bool)> done_handler, bool fill)
+{
+    // data group type 6: MOT directory, uncompressed
+    queueSegments(6, &cindex_directory, directory, tid, nullptr, std::move(done_handler), fill);
+}
+
+
+// --- MappedFile -----------------------------------------------------------------
+MappedFile::~MappedFile()
+{
+    if (map)
+        munmap(map, map_len);
+}
+
+
+std::shared_ptr<const MappedFile> MappedFile::Open(const std::string& fname, bool quiet_if_missing)
+{
+    int fd = open(fname.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        if (!(quiet_if_missing && errno == ENOENT))
+            perror(("ODR-PadEnc Error: Unable to load file '" + fname + "'").c_str());
+        return nullptr;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat)) {
+        perror(("ODR-PadEnc Error: Unable to retrieve size of file '" + fname + "'").c_str());
+        close(fd);
+        return nullptr;
+    }
+
+    // empty files cannot be mapped
+    if (file_stat.st_size == 0) {
+        close(fd);
+        return std::shared_ptr<const MappedFile>(new MappedFile(nullptr, 0));
+    }
+
+    void* map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(("ODR-PadEnc Error: Unable to map file '" + fname + "'").c_str());
+        return nullptr;
+    }
+
+    return std::shared_ptr<const MappedFile>(new MappedFile(map, file_stat.st_size));
+}
+
+
+// --- SlideBlob -----------------------------------------------------------------
+std::shared_ptr<const SlideBlob> SlideBlob::MapFile(const std::string& fname)
+{
+    std::shared_ptr<const MappedFile> file = MappedFile::Open(fname, false);
+    if (!file)
+        return nullptr;
+    return std::make_shared<const SlideBlob>(file, 0, file->Size());
+}
+
+
+// --- SlideBlobStore -----------------------------------------------------------------
+SlideBlobStore& SlideBlobStore::Global()
+{
+    // the first one for threads not bound to a node
+    static SlideBlobStore stores[NumaTopology::MAX_NODES + 1];
+    const int node = ThreadPlacement::CurrentNode();
+    return stores[node >= 0 && node < NumaTopology::MAX_NODES ? node + 1 : 0];
+}
+
+
+void SlideBlobStore::Prune()
+{
+    if (blobs.size() + renditions.size() < prune_size)
+        return;
+
+    for (std::unordered_map<uint64_t, std::weak_ptr<const SlideBlob>>::iterator it = blobs.begin(); it != blobs.end();)
+        it = it->second.expired() ? blobs.erase(it) : std::next(it);
+    for (std::unordered_map<std::string, std::weak_ptr<const SlideBlob>>::iterator it = renditions.begin(); it != renditions.end();)
+        it = it->second.expired() ? renditions.erase(it) : std::next(it);
+
+    // amortised over as many additions as there are blobs left
+    prune_size = std::max((size_t) 64, 2 * (blobs.size() + renditions.size()));
+}
+
+
+slide_blob_t SlideBlobStore::Intern(const slide_blob_t& blob)
+{
+    // hashed outside the lock
+    const uint64_t hash = odr::hash64(blob->Data(), blob->Size());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::weak_ptr<const SlideBlob>& held = blobs[hash];
+    slide_blob_t existing = held.lock();
+    if (existing == blob)
+        return blob;
+    if (existing) {
+        if (existing->Size() == blob->Size() && !memcmp(existing->Data(), blob->Data(), blob->Size()))
+            return existing;
+        return blob;    // a hash collision: not shared
+    }
+
+    held = blob;
+    Prune();
+    return blob;
+}
+
+
+slide_blob_t SlideBlobStore::Intern(const uint8_t* data, size_t len)
+{
+    const uint64_t hash = odr::hash64(data, len);
+    {
+        // no copy, if held already
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unordered_map<uint64_t, std::weak_ptr<const SlideBlob>>::const_iterator it = blobs.find(hash);
+        slide_blob_t existing = it != blobs.end() ? it->second.lock() : nullptr;
+        if (existing && existing->Size() == len && !memcmp(existing->Data(), data, len))
+            return existing;
+    }
+    return Intern(std::make_shared<const SlideBlob>(data, len));
+}
+
+
+slide_blob_t SlideBlobStore::FindRendition(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unordered_map<std::string, std::weak_ptr<const SlideBlob>>::const_iterator it = renditions.find(key);
+    return it != renditions.end() ? it->second.lock() : nullptr;
+}
+
+
+slide_blob_t SlideBlobStore::AddRendition(const std::string& key, const slide_blob_t& rendition)
+{
+    slide_blob_t interned = Intern(rendition);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    renditions[key] = interned;
+    Prune();
+    return interned;
+}
+
+
+size_t SlideBlobStore::Count()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return blobs.size();
+}
+
+
+// --- SlideFrequency -----------------------------------------------------------------
+size_t SlideFrequency::Index(uint64_t key, size_t row)
+{
+    // an independent hash per row (splitmix64 finaliser)
+    uint64_t h = key + (row + 1) * 0x9E3779B97F4A7C15ULL;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    return row * WIDTH + (h & (WIDTH - 1));
+}
+
+
+void SlideFrequency::Record(uint64_t key)
+{
+    for (size_t row = 0; row < DEPTH; row++) {
+        size_t i = Index(key, row);
+        if (Get(i) < 15)
+            counters[i / 2] += 1 << (i % 2 * 4);
+    }
+
+    if (++uses >= RESET_USES) {
+        // halve both counters of each byte at once
+        for (uint8_t& c : counters)
+            c = (c >> 1) & 0x77;
+        uses /= 2;
+    }
+}
+
+
+int SlideFrequency::Estimate(uint64_t key) const
+{
+    int estimate = 15;
+    for (size_t row = 0; row < DEPTH; row++)
+        estimate = std::min(estimate, Get(Index(key, row)));
+    return estimate;
+}
+
+
+void SlideFrequency::Clear()
+{
+    memset(counters, 0, sizeof(counters));
+    uses = 0;
+}
+
+
+// --- SlideSpill -----------------------------------------------------------------
+const size_t SlideSpill::DEFAULT_SIZE = 64 * 1024 * 1024; // Bytes
+
+SlideSpill::SlideSpill(const std::string& dir, size_t size) :
+    dir(dir), segment_size(size / 2), fd(-1), used(0), segment_id(0)
+{}
+
+
+SlideSpill::~SlideSpill()
+{
+    if (fd != -1)
+        close(fd);
+}
+
+
+bool SlideSpill::Rotate()
+{
+    // slides mapped from the previous segment stay valid, even after its file is closed
+    if (fd != -1)
+        close(fd);
+    fd = -1;
+    segment.reset();
+    used = 0;
+
+    char name[64];
+    snprintf(name, sizeof(name), "/odr-padenc-%d-%u.spill", (int) getpid(), segment_id + 1);
+    const std::string path = dir + name;
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        perror(("ODR-PadEnc Warning: Unable to create slide spill segment '" + path + "'").c_str());
+        return false;
+    }
+
+    if (ftruncate(fd, segment_size) == 0)
+        segment = MappedFile::Open(path, false);
+    else
+        perror(("ODR-PadEnc Warning: Unable to size slide spill segment '" + path + "'").c_str());
+    unlink(path.c_str());
+    if (!segment) {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+
+    segment_id++;
+    return true;
+}
+
+
+slide_blob_t SlideSpill::Append(const slide_blob_t& blob, unsigned* segment)
+{
+    if (!Enabled() || blob->Size() > segment_size)
+        return nullptr;
+    if ((!this->segment || used + blob->Size() > segment_size) && !Rotate())
+        return nullptr;
+
+    // the mapping is read-only, but shows what is written to the file
+    for (size_t offset = 0; offset < blob->Size();) {
+        ssize_t len = pwrite(fd, blob->Data() + offset, blob->Size() - offset, used + offset);
+        if (len == -1 && errno == EINTR)
+            continue;
+        if (len <= 0) {
+            perror("ODR-PadEnc Warning: Unable to spill slide");
+            return nullptr;
+        }
+        offset += len;
+    }
+
+    slide_blob_t spilled = std::make_shared<const SlideBlob>(this->segment, used, blob->Size());
+    used += blob->Size();
+    *segment = segment_id;
+    return spilled;
+}
+
+
+// --- SlideCache -----------------------------------------------------------------
+const size_t SlideCache::DEFAULT_MAX_SIZE = 4 * 1024 * 1024; // Bytes; enough for a carousel of about 80 Simple Profile slides
+
+void SlideCache::SetSpill(const std::string& dir, size_t size)
+{
+    spill.reset(dir.empty() ? nullptr : new SlideSpill(dir, size));
+}
+
+
+uint64_t SlideCache::FrequencyKey(const slide_cache_entry_t& entry)
+{
+    // the same slide in another file counts, too
+    return entry.content_hash ? entry.content_hash : std::hash<std::string>()(entry.fp.s_name);
+}
+
+
+bool SlideCache::Admit(const slide_cache_entry_t& entry) const
+{
+    if (!spill || !spill->Enabled() || size + entry.Size() <= max_size)
+        return true;
+    if (entry.Size() > max_size)
+        return false;
+    return entries.empty() || frequency.Estimate(FrequencyKey(entry)) > frequency.Estimate(FrequencyKey(entries.back()));
+}
+
+
+void SlideCache::Spill(std::list<slide_cache_entry_t>& tier, std::list<slide_cache_entry_t>::iterator it)
+{
+    if (&tier == &entries)
+        size -= it->Size();
+    warm.splice(warm.begin(), tier, it);
+    slide_cache_entry_t& entry = warm.front();
+
+    unsigned segment = 0;
+    slide_blob_t blob = spill && spill->Enabled() ? spill->Append(entry.blob, &segment) : nullptr;
+    if (!blob) {
+        warm.pop_front();
+        changes++;
+        return;
+    }
+    entry.blob = blob;
+    entry.spill_segment = segment;
+
+    // the slides of the segment dropped for a new one
+    const size_t count = warm.size();
+    warm.remove_if([segment](const slide_cache_entry_t& e) {return e.spill_segment + 1 < segment;});
+    if (warm.size() != count)
+        changes++;
+}
+
+
+void SlideCache::Evict()
+{
+    Spill(entries, std::prev(entries.end()));
+}
+
+
+void SlideCache::Erase(std::list<slide_cache_entry_t>& tier, std::list<slide_cache_entry_t>::iterator it)
+{
+    if (it->spill_segment == 0)
+        size -= it->Size();
+    tier.erase(it);
+}
+
+
+slide_cache_entry_t* SlideCache::Use(std::list<slide_cache_entry_t>& tier, std::list<slide_cache_entry_t>::iterator it)
+{
+    frequency.Record(FrequencyKey(*it));
+    tier.splice(tier.begin(), tier, it);
+    if (&tier == &entries || !Admit(tier.front()))
+        return &tier.front();
+
+    // back into memory, as it is used more often than the least recently used one there
+    slide_cache_entry_t& entry = warm.front();
+    entry.blob = std::make_shared<const SlideBlob>(entry.blob->Data(), entry.blob->Size());
+    entry.spill_segment = 0;
+    entries.splice(entries.begin(), warm, warm.begin());
+    size += entries.front().Size();
+    while (size > max_size && entries.size() > 1)
+        Evict();
+    ReportSize();
+    return &entries.front();
+}
+
+
+template<typename Match>
+slide_cache_entry_t* SlideCache::FindMatch(Match match)
+{
+    for (std::list<slide_cache_entry_t>* tier : {&entries, &warm}) {
+        for (std::list<slide_cache_entry_t>::iterator it = tier->begin(); it != tier->end(); it++) {
+            if (match(*it))
+                return Use(*tier, it);
+        }
+    }
+    return NULL;
+}
+
+
+slide_cache_entry_t* SlideCache::Find(const fingerprint_t& fp, bool raw_slide, size_t max_slide_size)
+{
+    return FindMatch([&](const slide_cache_entry_t& entry) {
+        return entry.fp == fp && entry.raw_slide == raw_slide && entry.max_slide_size == max_slide_size;
+    });
+}
+
+
+slide_cache_entry_t* SlideCache::FindContent(uint64_t content_hash, bool raw_slide, size_t max_slide_size)
+{
+    return FindMatch([&](const slide_cache_entry_t& entry) {
+        return entry.content_hash == content_hash && entry.raw_slide == raw_slide && entry.max_slide_size == max_slide_size;
+    });
+}
+
+
+slide_cache_entry_t* SlideCache::FindSimilar(uint64_t image_hash, int max_distance, bool raw_slide, size_t max_slide_size)
+{
+    // a linear scan is cheap enough for the few hundred slides a cache holds at most
+    std::list<slide_cache_entry_t>* best_tier = nullptr;
+    std::list<slide_cache_entry_t>::iterator best;
+    int best_distance = max_distance + 1;
+    for (std::list<slide_cache_entry_t>* tier : {&entries, &warm}) {
+        for (std::list<slide_cache_entry_t>::iterator it = tier->begin(); it != tier->end(); it++) {
+            if (!it->image_hashed || it->raw_slide != raw_slide || it->max_slide_size != max_slide_size)
+                continue;
+            int distance = __builtin_popcountll(it->image_hash ^ image_hash);
+            if (distance < best_distance) {
+                best_tier = tier;
+                best = it;
+                best_distance = distance;
+            }
+        }
+    }
+    if (!best_tier)
+        return NULL;
+
+    return Use(*best_tier, best);
+}
+
+
+void SlideCache::UpdateSource(slide_cache_entry_t* entry, const fingerprint_t& fp)
+{
+    // drop any outdated version of the new source file
+    for (std::list<slide_cache_entry_t>* tier : {&entries, &warm}) {
+        std::list<slide_cache_entry_t>::iterator it = std::find_if(tier->begin(), tier->end(), [&](const slide_cache_entry_t& e) {
+            return &e != entry && e.fp.s_name == fp.s_name;
+        });
+        if (it != tier->end())
+            Erase(*tier, it);
+    }
+
+    int fidx = entry->fp.fidx;
+    entry->fp = fp;
+    entry->fp.fidx = fidx;  // still the one of the MOT header
+    changes++;
+    ReportSize();
+}
+
+
+void SlideCache::Insert(const slide_cache_entry_t& entry)
+{
+    if (entry.Size() > max_size && !(spill && spill->Enabled()))
+        return;
+
+    // replace any outdated version of the same file
+    for (std::list<slide_cache_entry_t>* tier : {&entries, &warm}) {
+        std::list<slide_cache_entry_t>::iterator it = std::find_if(tier->begin(), tier->end(), [&](const slide_cache_entry_t& e) {
+            return e.fp.s_name == entry.fp.s_name;
+        });
+        if (it != tier->end())
+            Erase(*tier, it);
+    }
+
+    frequency.Record(FrequencyKey(entry));
+    changes++;
+
+    if (!Admit(entry)) {
+        // not used often enough (yet) to displace a slide in memory
+        std::list<slide_cache_entry_t> spilled(1, entry);
+        Spill(spilled, spilled.begin());
+        ReportSize();
+        return;
+    }
+
+    entries.push_front(entry);
+    entries.front().spill_segment = 0;
+    size += entry.Size();
+
+    while (size > max_size)
+        Evict();
+    ReportSize();
+}
+
+
+size_t SlideCache::Shrink(size_t target)
+{
+    while (size > target && entries.size() > 1) {
+        Evict();
+        changes++;
+    }
+    return size;
+}
+
+
+void SlideCache::UpdateHeader(slide_cache_entry_t* entry, const uint8_vector_t& mothdr, int fidx, unsigned long params_mtime)
+{
+    if (entry->spill_segment == 0)
+        size -= entry->mothdr.size();
+    entry->mothdr = mothdr;
+    entry->fp.fidx = fidx;
+    entry->params_mtime = params_mtime;
+    if (entry->spill_segment == 0)
+        size += entry->mothdr.size();
+    changes++;
+    ReportSize();
+}
+
+
+// --- SharedSlideStore -----------------------------------------------------------------
+SharedSlideStore::SharedSlideStore(const std::string& dir, bool local_copies) : dir(dir), local_copies(local_copies)
+{
+    if (dir.empty())
+        return;
+
+    // the store is shared with instances of other users, too
+    if (mkdir(dir.c_str(), 01777) == 0)
+        chmod(dir.c_str(), 01777);
+    else if (errno != EEXIST)
+        perror(("ODR-PadEnc Warning: Unable to create slide store dir '" + dir + "'").c_str());
+}
+
+
+std::string SharedSlideStore::Path(uint64_t content_hash, size_t max_slide_size, bool jfif_not_png) const
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/%016llx-%zu.%s", (unsigned long long) content_hash, max_slide_size, jfif_not_png ? "jpg" : "png");
+    return dir + name;
+}
+
+
+slide_blob_t SharedSlideStore::Find(uint64_t content_hash, size_t max_slide_size, bool* jfif_not_png) const
+{
+    for (bool jfif : {true, false}) {
+        std::shared_ptr<const MappedFile> file = MappedFile::Open(Path(content_hash, max_slide_size, jfif), true);
+        if (file && file->Size()) {
+            *jfif_not_png = jfif;
+            if (local_copies)
+                return std::make_shared<const SlideBlob>(file->Data(), file->Size());
+            return std::make_shared<const SlideBlob>(file, 0, file->Size());
+        }
+    }
+    return nullptr;
+}
+
+
+slide_blob_t SharedSlideStore::Add(uint64_t content_hash, size_t max_slide_size, bool jfif_not_png, const slide_blob_t& blob) const
+{
+    const std::string path = Path(content_hash, max_slide_size, jfif_not_png);
+    std::string tmp_path = path + ".XXXXXX";
+    int fd = mkstemp(&tmp_path[0]);
+    if (fd == -1) {
+        perror(("ODR-PadEnc Warning: Unable to add slide to store '" + dir + "'").c_str());
+        return blob;
+    }
+    fchmod(fd, 0644);
+
+    bool written = true;
+    for (size_t offset = 0; written && offset < blob->Size();) {
+        ssize_t len = write(fd, blob->Data() + offset, blob->Size() - offset);
+        if (len == -1 && errno == EINTR)
+            continue;
+        written = len > 0;
+        if (written)
+            offset += len;
+    }
+    if (close(fd) || !written || rename(tmp_path.c_str(), path.c_str())) {
+        perror(("ODR-PadEnc Warning: Unable to add slide to store '" + dir + "'").c_str());
+        unlink(tmp_path.c_str());
+        return blob;
+    }
+    if (local_copies)
+        return blob;
+
+    std::shared_ptr<const MappedFile> file = MappedFile::Open(path, true);
+    if (!file || file->Size() != blob->Size())
+        return blob;    // e.g. already deleted again
+    return std::make_shared<const SlideBlob>(file, 0, file->Size());
+}
+
+
+// --- SlideDumper -----------------------------------------------------------------
+static LogSite slide_completed_log("slide.completed", 0);
+
+SlideDumper::~SlideDumper()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    cond.notify_one();
+    if (thread.joinable())
+        thread.join();
+}
+
+
+void SlideDumper::Queue(job_t&& job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // a dump not written yet is replaced by a newer one
+        if (job.blob && !jobs.empty() && jobs.back().blob && jobs.back().path == job.path)
+            jobs.back() = std::move(job);
+        else
+            jobs.push_back(std::move(job));
+
+        if (!thread.joinable())
+            thread = std::thread(&SlideDumper::Run, this);
+    }
+    cond.notify_one();
+}
+
+
+void SlideDumper::Dump(const std::string& path, const slide_blob_t& blob)
+{
+    Queue({blob, path, ""});
+}
+
 
-    return true;
+void SlideDumper::Complete(const std::string& path, const std::string& completed_path)
+{
+    Queue({nullptr, path, completed_path});
 }
 
-slide_metadata_t SlideStore::GetSlide() {
-    // pre-condition: list non-empty
 
-    slide_metadata_t slide = slides.front();
-    slides.pop_front();
-    return slide;
+void SlideDumper::Flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cond.wait(lock, [this]() {return jobs.empty() && running_jobs == 0;});
 }
 
 
-// --- MOTHeader -----------------------------------------------------------------
-MOTHeader::MOTHeader(size_t body_size, int content_type, int content_subtype)
-: header_size(0), data(uint8_vector_t(7, 0x00)) {
-    // init header core
+void SlideDumper::Run()
+{
+    ThreadPlacement::Global().EnterWorker();
 
-    // body size
-    data[0] = (body_size >> 20) & 0xFF;
-    data[1] = (body_size >> 12) & 0xFF;
-    data[2] = (body_size >>  4) & 0xFF;
-    data[3] = (body_size <<  4) & 0xF0;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        cond.wait(lock, [this]() {return stop || !jobs.empty();});
+        if (jobs.empty())
+            return;     // only stops once all jobs are done
 
-    // header size
-    IncrementHeaderSize(data.size());
+        job_t job = std::move(jobs.front());
+        jobs.pop_front();
+        running_jobs++;
+        lock.unlock();
 
-    // content type
-    data[5] |= (content_type << 1) & 0x7E;
+        if (job.blob)
+            Write(job);
+        else
+            Complete(job);
 
-    // content subtype
-    data[5] |= (content_subtype >> 8) & 0x01;
-    data[6] |=  content_subtype       & 0xFF;
+        lock.lock();
+        running_jobs--;
+        done_cond.notify_all();
+    }
 }
 
 
-void MOTHeader::IncrementHeaderSize(size_t size) {
-    header_size += size;
-
-    data[3] &= 0xF0;
-    data[3] |= (header_size >> 9) & 0x0F;
+void SlideDumper::Write(const job_t& job)
+{
+    const std::string tmp_path = job.path + ".tmp";
+    FILE* fd = fopen(tmp_path.c_str(), "w");
+    if (fd == nullptr) {
+        perror(("ODR-PadEnc Error: Unable to open file '" + tmp_path + "' for writing").c_str());
+        return;
+    }
 
-    data[4]  = (header_size >> 1) & 0xFF;
+    bool ok = job.blob->Size() == 0 || fwrite(job.blob->Data(), job.blob->Size(), 1, fd) == 1;
+    if (fclose(fd))
+        ok = false;
+    if (!ok) {
+        perror(("ODR-PadEnc Error: Unable to write to file '" + tmp_path + "'").c_str());
+        unlink(tmp_path.c_str());
+        return;
+    }
 
-    data[5] &= 0x7F;
-    data[5] |= (header_size << 7) & 0x80;
+    if (rename(tmp_path.c_str(), job.path.c_str())) {
+        perror(("ODR-PadEnc Error: Unable to replace file '" + job.path + "'").c_str());
+        unlink(tmp_path.c_str());
+    }
 }
 
 
-void MOTHeader::AddExtensionFixedSize(int pli, int param_id, const uint8_t* data_field, size_t data_field_len) {
-    AddParamHeader(pli, param_id);
+void SlideDumper::Complete(const job_t& job)
+{
+    if (rename(job.path.c_str(), job.completed_path.c_str())) {
+        if (errno != ENOENT)
+            perror("ODR-PadEnc Error: renaming completed slide file failed");
+    }
+    else {
+        PadLog::Global().Write(slide_completed_log, LogLevel::INFO, {}, "completed slide transmission.");
+    }
+}
 
-    for (size_t i = 0; i < data_field_len; i++)
-        data.push_back(data_field[i]);
 
-    IncrementHeaderSize(1 + data_field_len);
+// --- magick_limits_t -----------------------------------------------------------------
+const size_t magick_limits_t::DEFAULT_THREADS = 1;
+
+bool magick_limits_t::Parse(const std::string& limits) {
+    std::stringstream ss(limits);
+    std::string limit;
+    while (std::getline(ss, limit, ',')) {
+        const size_t sep = limit.find('=');
+        if (sep == std::string::npos)
+            return false;
+        const std::string name = limit.substr(0, sep);
+        const std::string value = limit.substr(sep + 1);
+        char* end;
+        const unsigned long mib = strtoul(value.c_str(), &end, 10);
+        if (value.empty() || *end || value[0] == '-')
+            return false;
+
+        if (name == "memory")
+            memory = (size_t) mib * 1024 * 1024;
+        else if (name == "map")
+            map = (size_t) mib * 1024 * 1024;
+        else if (name == "disk")
+            disk = (size_t) mib * 1024 * 1024;
+        else
+            return false;
+    }
+    return true;
 }
 
+void magick_limits_t::Apply() const {
+#if HAVE_MAGICKWAND
+    if (threads)
+        MagickSetResourceLimit(ThreadResource, threads);
+    if (memory)
+        MagickSetResourceLimit(MemoryResource, memory);
+    if (map)
+        MagickSetResourceLimit(MapResource, map);
+    if (disk)
+        MagickSetResourceLimit(DiskResource, disk);
+#endif
+}
 
-void MOTHeader::AddExtensionVarSize(int param_id, const uint8_t* data_field, size_t data_field_len) {
-    AddParamHeader(0x3, param_id);
-
-    // longer field lens use 15 instead of 7 bits
-    bool ext = data_field_len > 127;
-    if (ext) {
-        data.push_back(0x80 | ((data_field_len >> 8) & 0x7F));
-        data.push_back(data_field_len & 0xFF);
-    } else {
-        data.push_back(data_field_len & 0x7F);
-    }
 
-    for (size_t i = 0; i < data_field_len; i++)
-        data.push_back(data_field[i]);
+#if HAVE_MAGICKWAND
+// --- MagickWandPool -----------------------------------------------------------------
+MagickWandPool& MagickWandPool::Global() {
+    static MagickWandPool pool;
+    return pool;
+}
 
-    IncrementHeaderSize(1 + (ext ? 2 : 1) + data_field_len);
+void MagickWandPool::Configure(const magick_limits_t& limits, bool verbose) {
+    this->limits = limits;
+    this->verbose = verbose;
+    configured = true;
 }
 
+void MagickWandPool::Initialise() {
+    MagickWandGenesis();
+    if (verbose)
+        fprintf(stderr, "ODR-PadEnc using ImageMagick version '%s'\n", GetMagickVersion(NULL));
+    if (configured)
+        limits.Apply();
+    threads = GetMagickResourceLimit(ThreadResource);
+    initialised = true;
+}
 
-void MOTHeader::AddExtension(int param_id, const uint8_t* data_field, size_t data_field_len) {
-    int pli;
+MagickWand* MagickWandPool::Acquire() {
+    std::call_once(genesis, &MagickWandPool::Initialise, this);
+    const bool throttled = WorkGovernor::Global().Level() != WorkGovernor::NORMAL;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // a single thread per slide, while the PAD requests are short of time
+        if (throttled != single_threaded) {
+            single_threaded = throttled;
+            MagickSetResourceLimit(ThreadResource, throttled ? 1 : threads);
+        }
 
-    switch(data_field_len) {
-    case 0:
-        pli = 0x0;  // 0b00
-        break;
-    case 1:
-        pli = 0x1;  // 0b01
-        break;
-    case 4:
-        pli = 0x2;  // 0b10
-        break;
-    default:
-        pli = 0x3;  // 0b11
-        break;
+        if (!idle.empty()) {
+            MagickWand* wand = idle.back();
+            idle.pop_back();
+            return wand;
+        }
     }
+    return NewMagickWand();
+}
 
-    if (pli == 0x3)
-        AddExtensionVarSize(param_id, data_field, data_field_len);
-    else
-        AddExtensionFixedSize(pli, param_id, data_field, data_field_len);
+void MagickWandPool::Release(MagickWand* wand) {
+    ClearMagickWand(wand);
+    std::lock_guard<std::mutex> lock(mutex);
+    idle.push_back(wand);
+}
+
+void MagickWandPool::Clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (MagickWand* wand : idle)
+        DestroyMagickWand(wand);
+    idle.clear();
+}
+
+void MagickWandPool::Terminate() {
+    Clear();
+    if (initialised)
+        MagickWandTerminus();
 }
+#endif
 
 
 // --- SLSEncoder -----------------------------------------------------------------
-const size_t SLSEncoder::MAXSEGLEN              =  1013; // Bytes (EN 301 234 v2.1.1, ch. 5.1.1 limits to 8189); the complete DG will be 1024 bytes
+const size_t SLSEncoder::MAXSEGLEN              =  1013; // Bytes; the complete DG will be 1024 bytes
+const size_t SLSEncoder::MAXSEGLEN_LIMIT        =  8189; // Bytes (EN 301 234 v2.1.1, ch. 5.1.1)
 const size_t SLSEncoder::MAXSLIDESIZE_SIMPLE    = 51200; // Bytes (TS 101 499 v3.1.1, ch. 9.1.2)
 const int    SLSEncoder::MINQUALITY             =    40; // Do not allow the image compressor to go below JPEG quality 40
+const int    SLSEncoder::MAXQUALITY             =    95;
+const size_t SLSEncoder::QUALITYMEMOLEN         =  1000; // How many slides to remember the JPEG quality of
+const size_t SLSEncoder::PARAMSMEMOLEN          =  1000; // How many slides to remember the params and MOT header of
+const size_t SLSEncoder::MAXPREENCODETHREADS    =     8; // How many slides to encode at once at most
 const std::string SLSEncoder::SLS_PARAMS_SUFFIX = ".sls_params";
 const int SLSEncoder::APPTYPE_MOT_START = 12;
 const int SLSEncoder::APPTYPE_MOT_CONT = 13;
 const std::string SLSEncoder::REQUEST_REREAD_FILENAME = "REQUEST_SLIDES_DIR_REREAD";
 
 
+int SLSEncoder::rememberedQuality(const std::string& fname) {
+    std::lock_guard<std::mutex> lock(quality_memo_mutex);
+    std::map<std::string, int>::const_iterator memo = quality_memo.find(fname);
+    return memo != quality_memo.end() ? memo->second : -1;
+}
+
+
+void SLSEncoder::rememberQuality(const std::string& fname, int quality) {
+    std::lock_guard<std::mutex> lock(quality_memo_mutex);
+    if (quality_memo.size() >= QUALITYMEMOLEN)
+        quality_memo.clear();
+    quality_memo[fname] = quality;
+}
+
+
 void SLSEncoder::warnOnSmallerImage(size_t height, size_t width, const std::string& fname) {
     if (height < 240 || width < 320)
         fprintf(stderr, "ODR-PadEnc Warning: Image '%s' smaller than recommended size (%zu x %zu < 320 x 240 px)\n", fname.c_str(), width, height);
 }
 
 
+unsigned SLSEncoder::CheckCompliance(const SlideBlob& blob, bool jfif_not_png, size_t max_slide_size) {
+    unsigned violations = 0;
+    if (blob.Size() > max_slide_size)
+        violations |= VIOLATION_SIZE;
+
+    image_probe_t probe;
+    const bool probed = SlideCodec::Probe(blob.Data(), blob.Size(), probe);
+    if (probe.format != (jfif_not_png ? SlideCodec::Format::JPEG : SlideCodec::Format::PNG))
+        violations |= VIOLATION_CONTENT_TYPE;
+    if (!probed || probe.width > SlideCodec::MAX_WIDTH || probe.height > SlideCodec::MAX_HEIGHT)
+        violations |= VIOLATION_DIMENSIONS;
+    if (probe.progressive)
+        violations |= VIOLATION_PROGRESSIVE;
+    return violations;
+}
+
+
+std::string SLSEncoder::DescribeViolations(unsigned violations) {
+    static const std::pair<unsigned, const char*> DESCRIPTIONS[] = {
+        {VIOLATION_SIZE,            "larger than the max slide size"},
+        {VIOLATION_DIMENSIONS,      "larger than 320 x 240 px"},
+        {VIOLATION_PROGRESSIVE,     "progressive JPEG"},
+        {VIOLATION_CONTENT_TYPE,    "not the JPEG/PNG signalled"},
+    };
+
+    std::string result;
+    for (const auto& description : DESCRIPTIONS) {
+        if (violations & description.first)
+            result += std::string(result.empty() ? "" : ", ") + description.second;
+    }
+    return result;
+}
+
+
 /*! Scales the image down if needed,
  * so that it is 320x240 pixels.
  * Automatically reduces the quality to make sure the
@@ -309,19 +2223,37 @@ size_t SLSEncoder::resizeImage(MagickWand* m_wand, unsigned char** blob, const s
     MagickSetImageCompressionQuality(m_wand, 95);
     blob_png = MagickGetImageBlob(m_wand, &blobsize_png);
 
-    // try JPG
+    // try JPG, with the highest quality that does not exceed the max size
     MagickSetImageFormat(m_wand, "jpg");
 
+    /* Every quality that fits is higher than the ones tried before, so the
+     * last fitting blob is kept (or else the smallest one). The decoded and
+     * resized image stays in the wand; each try only encodes it again.
+     */
     blob_jpg = NULL;
-    int quality_jpg = 100;
-    do {
-        MagickRelinquishMemory(blob_jpg);
-        quality_jpg -= 5;
-
-        MagickSetImageCompressionQuality(m_wand, quality_jpg);
-        blob_jpg = MagickGetImageBlob(m_wand, &blobsize_jpg);
-    } while (blobsize_jpg > max_slide_size && quality_jpg > MINQUALITY);
+    blobsize_jpg = 0;
+    auto jpg_fits = [&](int quality) {
+        size_t blobsize_try;
+        MagickSetImageCompressionQuality(m_wand, quality);
+        unsigned char* blob_try = MagickGetImageBlob(m_wand, &blobsize_try);
+
+        bool fits = blobsize_try <= max_slide_size;
+        if (fits || !blob_jpg || (blobsize_jpg > max_slide_size && blobsize_try < blobsize_jpg)) {
+            MagickRelinquishMemory(blob_jpg);
+            blob_jpg = blob_try;
+            blobsize_jpg = blobsize_try;
+        }
+        else {
+            MagickRelinquishMemory(blob_try);
+        }
+        return fits;
+    };
 
+    // start close to the quality of the previous encoding of this slide
+    int quality_jpg = searchQuality(MINQUALITY, MAXQUALITY, rememberedQuality(fname), jpg_fits);
+    if (quality_jpg < 0)
+        quality_jpg = MINQUALITY;   // even the min quality is too large
+    rememberQuality(fname, quality_jpg);
 
     // check for max size
     if (blobsize_png > max_slide_size && blobsize_jpg > max_slide_size) {
@@ -353,21 +2285,171 @@ size_t SLSEncoder::resizeImage(MagickWand* m_wand, unsigned char** blob, const s
 }
 #endif
 
-static void dump_slide(const std::string& dump_name, const uint8_t *blob, size_t size)
+/*! Takes an ideally sized JPEG/PNG slide unchanged (only its meta data is
+ * removed), as found by probing its header alone: baseline (as device
+ * support of progressive coding is optional), within 320x240 and within
+ * the max slide size. Neither SlideCodec nor MagickWand has to decode it.
+ *
+ * \return 1 when done, 0 if the image has to be processed, -1 on error
+ */
+int SLSEncoder::prepareCompliantImage(const std::string& fname, int fidx, size_t max_slide_size, slide_blob_t& blob, bool* jfif_not_png)
 {
-    FILE* fd = fopen(dump_name.c_str(), "w");
+    slide_blob_t file = SlideBlob::MapFile(fname);
+    if (!file)
+        return -1;
 
-    if (fd == nullptr) {
-        perror(("ODR-PadEnc Error: Unable to open file '" + dump_name + "' for writing").c_str());
-        return;
+    image_probe_t probe;
+    if (!SlideCodec::Probe(file->Data(), file->Size(), probe))
+        return 0;
+    if (probe.format != SlideCodec::Format::JPEG && probe.format != SlideCodec::Format::PNG)
+        return 0;
+    if (probe.width > SlideCodec::MAX_WIDTH || probe.height > SlideCodec::MAX_HEIGHT || probe.progressive)
+        return 0;
+
+    std::vector<uint8_t> stripped;
+    if (SlideCodec::StripMetadata(probe.format, file->Data(), file->Size(), stripped)) {
+        if (stripped.size() > max_slide_size)
+            return 0;
+        blob = std::make_shared<const SlideBlob>(std::move(stripped));
+    }
+    else {
+        if (file->Size() > max_slide_size)
+            return 0;
+        blob = file;
+    }
+    *jfif_not_png = probe.format == SlideCodec::Format::JPEG;
+
+    if (verbose) {
+        fprintf(stderr, "ODR-PadEnc image: '" ODR_COLOR_SLS "%s" ODR_COLOR_RST "' (id=%d)."
+                " Original size: %zu x %zu. (%s)\n",
+                fname.c_str(), fidx, probe.width, probe.height, *jfif_not_png ? "JPEG, progr=n" : "PNG");
+        fprintf(stderr, "ODR-PadEnc image: '" ODR_COLOR_SLS "%s" ODR_COLOR_RST "' (id=%d).  No resize needed: %zu Bytes\n",
+                fname.c_str(), fidx, blob->Size());
     }
+    warnOnSmallerImage(probe.height, probe.width, fname);
+    return 1;
+}
+
+#if HAVE_LIBJPEG
+// with a palette, if the image has few colours or keeps close to them (graphics), or else in full colour
+static void encode_png(const rgb_image_t& image, bool exhaustive, std::vector<uint8_t>& out) {
+    palette_image_t palette;
+    if (SlideCodec::ExactPalette(image, palette) || SlideCodec::QuantizePalette(image, palette) <= SlideCodec::MAX_PALETTE_ERROR)
+        SlideCodec::EncodePNG(palette, out, exhaustive);
+    else
+        SlideCodec::EncodePNG(image, out, exhaustive);
+}
+
+/*! Prepares a JPEG or PNG slide directly by means of SlideCodec, like the
+ * MagickWand path does: the image is scaled down to 320x240 and encoded
+ * with the highest JPEG quality that fits (a PNG slide is also tried as
+ * PNG). An ideally sized slide was already taken by prepareCompliantImage().
+ *
+ * \return 1 when done, 0 if the image is left to MagickWand, -1 on error
+ */
+int SLSEncoder::prepareNativeImage(const std::string& fname, int fidx, size_t max_slide_size, slide_blob_t& blob, bool* jfif_not_png)
+{
+    slide_blob_t file = SlideBlob::MapFile(fname);
+    if (!file)
+        return -1;
+
+    SlideCodec::Format format = SlideCodec::DetectFormat(file->Data(), file->Size());
+    size_t width, height;
+    bool jpeg_progr;
+    if (!SlideCodec::Supported(format) || !SlideCodec::ReadInfo(format, file->Data(), file->Size(), width, height, jpeg_progr))
+        return 0;
+    *jfif_not_png = format == SlideCodec::Format::JPEG;
+
+    if (verbose) {
+        fprintf(stderr, "ODR-PadEnc image: '" ODR_COLOR_SLS "%s" ODR_COLOR_RST "' (id=%d)."
+                " Original size: %zu x %zu. (%s)\n",
+                fname.c_str(), fidx, width, height, *jfif_not_png ? (jpeg_progr ? "JPEG, progr=y" : "JPEG, progr=n") : "PNG");
+    }
+
+    size_t fit_width = width;
+    size_t fit_height = height;
+    SlideCodec::FitSize(fit_width, fit_height);
+
+    rgb_image_t decoded;
+    rgb_image_t scaled;
+    if (!SlideCodec::Decode(format, file->Data(), file->Size(), fit_width, fit_height, decoded)) {
+        fprintf(stderr, "ODR-PadEnc Error: Unable to load image '%s'\n", fname.c_str());
+        return -1;
+    }
+    file.reset();
+    const rgb_image_t* image = &decoded;
+    if (decoded.width != fit_width || decoded.height != fit_height) {
+        SlideCodec::Downscale(decoded, fit_width, fit_height, scaled);
+        image = &scaled;
+    }
+
+    // a PNG slide may stay smaller as PNG (e.g. graphics); for photos that is not worth trying
+    std::vector<uint8_t> blob_png;
+    std::thread png_candidate;
+    if (format_candidates) {
+        png_candidate = std::thread([&]() {
+            ThreadPlacement::Global().EnterWorker();
+            encode_png(*image, exhaustive_png, blob_png);
+        });
+    }
+    else if (!*jfif_not_png) {
+        encode_png(*image, exhaustive_png, blob_png);
+    }
+
+    // try JPG, with the highest quality that does not exceed the max size (as in resizeImage())
+    std::vector<uint8_t> blob_jpg;
+    std::vector<uint8_t> blob_try;
+    auto jpg_fits = [&](int quality) {
+        if (!JPEGOffload::Global().Encode(*image, quality, blob_try))
+            return false;
+
+        bool fits = blob_try.size() <= max_slide_size;
+        if (fits || blob_jpg.empty() || (blob_jpg.size() > max_slide_size && blob_try.size() < blob_jpg.size()))
+            blob_jpg.swap(blob_try);
+        return fits;
+    };
+
+    int quality_jpg = searchQuality(MINQUALITY, MAXQUALITY, rememberedQuality(fname), jpg_fits);
+    if (quality_jpg < 0)
+        quality_jpg = MINQUALITY;   // even the min quality is too large
+    rememberQuality(fname, quality_jpg);
+    if (png_candidate.joinable())
+        png_candidate.join();
+
+    const bool png_fits = !blob_png.empty() && blob_png.size() <= max_slide_size;
+    const bool jpg_fit = !blob_jpg.empty() && blob_jpg.size() <= max_slide_size;
+    if (!png_fits && !jpg_fit) {
+        if (blob_png.empty())
+            fprintf(stderr, "ODR-PadEnc: Image Size too large after compression: %zu bytes (JPEG)\n", blob_jpg.size());
+        else
+            fprintf(stderr, "ODR-PadEnc: Image Size too large after compression: %zu bytes (PNG), %zu bytes (JPEG)\n",
+                    blob_png.size(), blob_jpg.size());
+        return -1;
+    }
+
+    // choose the smaller one (at least one does not exceed the max size)
+    *jfif_not_png = !png_fits || (jpg_fit && blob_jpg.size() < blob_png.size());
 
-    if (fwrite(blob, size, 1, fd) == 0) {
-        perror(("ODR-PadEnc Error: Unable to write to file '" + dump_name + "'").c_str());
+    if (verbose) {
+        if (*jfif_not_png && blob_png.empty())
+            fprintf(stderr, "ODR-PadEnc resized image to %zu x %zu. Size after compression %zu bytes (JPEG, q=%d)\n",
+                    image->width, image->height, blob_jpg.size(), quality_jpg);
+        else if (*jfif_not_png)
+            fprintf(stderr, "ODR-PadEnc resized image to %zu x %zu. Size after compression %zu bytes (JPEG, q=%d; PNG was %zu bytes)\n",
+                    image->width, image->height, blob_jpg.size(), quality_jpg, blob_png.size());
+        else
+            fprintf(stderr, "ODR-PadEnc resized image to %zu x %zu. Size after compression %zu bytes (PNG; JPEG was %zu bytes)\n",
+                    image->width, image->height, blob_png.size(), blob_jpg.size());
     }
 
-    fclose(fd);
+    // warn if resized image smaller than default dimension
+    warnOnSmallerImage(image->height, image->width, fname);
+
+    blob = std::make_shared<const SlideBlob>(std::move(*jfif_not_png ? blob_jpg : blob_png));
+    return 1;
 }
+#endif
+
 
 static bool filename_specifies_raw_mode(const std::string& fname)
 {
@@ -382,22 +2464,175 @@ static bool filename_specifies_raw_mode(const std::string& fname)
     }
 }
 
-bool SLSEncoder::encodeSlide(const std::string& fname, int fidx, bool raw_slides, size_t max_slide_size, const std::string& dump_name)
+static unsigned long params_file_mtime(const std::string& params_fname)
+{
+    struct stat params_stat;
+    return stat(params_fname.c_str(), &params_stat) ? 0 : params_stat.st_mtime;
+}
+
+// of all encoders; slides taken from the slide cache are not encoded
+static MetricHistogram& slide_encode_metric() {
+    static MetricHistogram& histogram = MetricsRegistry::Global().Histogram(
+            "odr_padenc_slide_encode_seconds", "Time to encode a slide not in the slide cache", MetricHistogram::DURATION_BOUNDS);
+    return histogram;
+}
+
+bool SLSEncoder::encodeSlide(const std::string& fname, int fidx, bool raw_slides, size_t max_slide_size, const std::string& dump_name,
+                             std::function<void(bool)> done_handler)
+{
+    prepared_slide_t slide;
+    if (!prepareSlide(fname, fidx, raw_slides, max_slide_size, slide))
+        return false;
+
+    queueSlide(slide, dump_name, std::move(done_handler));
+    return true;
+}
+
+bool SLSEncoder::prepareSlide(const std::string& fname, int fidx, bool raw_slides, size_t max_slide_size, prepared_slide_t& slide)
+{
+    PADENC_TRACE2(slide_encode_begin, fidx, fname.c_str());
+    const bool result = prepareSlideFile(fname, fidx, raw_slides, max_slide_size, slide);
+    PADENC_TRACE3(slide_encode_end, fidx, result, result ? slide.blob->Size() : 0);
+    return result;
+}
+
+bool SLSEncoder::prepareSlideFile(const std::string& fname, int fidx, bool raw_slides, size_t max_slide_size, prepared_slide_t& slide)
 {
     bool result = false;
 
+    const bool raw_slide = filename_specifies_raw_mode(fname) or raw_slides;
+    const std::string params_fname = fname + SLS_PARAMS_SUFFIX;
+
+    // reuse the already encoded slide, if the file is unchanged
+    fingerprint_t fp;
+    const bool cacheable = slide_cache.Enabled() && fp.load_from_file(fname.c_str());
+    // raw slides are mapped anyway, so storing them saves nothing
+    const bool shareable = shared_store.Enabled() && !raw_slide;
+    const unsigned long params_mtime = params_file_mtime(params_fname);
+    slide_cache_entry_t source;
+    if (cacheable) {
+        std::unique_lock<std::mutex> lock(slide_cache_mutex);
+        slide_cache_entry_t* entry = slide_cache.Find(fp, raw_slide, max_slide_size);
+        if (!entry) {
+            // a re-exported file of the same content (or a similar image) is not encoded again
+            lock.unlock();
+            hashSource(fname, raw_slide, source);
+            lock.lock();
+
+            entry = slide_cache.FindContent(source.content_hash, raw_slide, max_slide_size);
+            if (!entry && source.image_hashed && similarity_distance >= 0)
+                entry = slide_cache.FindSimilar(source.image_hash, similarity_distance, raw_slide, max_slide_size);
+            if (entry) {
+                if (verbose) {
+                    fprintf(stderr, "ODR-PadEnc image: '" ODR_COLOR_SLS "%s" ODR_COLOR_RST "' (id=%d). Same as '%s'\n",
+                            fname.c_str(), fidx, entry->fp.s_name.c_str());
+                }
+                slide_cache.UpdateSource(entry, fp);
+            }
+        }
+        if (entry) {
+            // the header depends on fidx and the params file
+            if (entry->fp.fidx != fidx || entry->params_mtime != params_mtime)
+                slide_cache.UpdateHeader(entry, createMotHeader(entry->blob->Size(), fidx, entry->jfif_not_png, params_fname, params_mtime), fidx, params_mtime);
+
+            if (verbose) {
+                fprintf(stderr, "ODR-PadEnc image: '" ODR_COLOR_SLS "%s" ODR_COLOR_RST "' (id=%d). Already encoded: %zu Bytes\n",
+                        fname.c_str(), fidx, entry->blob->Size());
+            }
+
+            slide.filepath = fname;
+            slide.fidx = fidx;
+            slide.blob = entry->blob;
+            slide.mothdr = entry->mothdr;
+            slide.violations = entry->violations;
+            return true;
+        }
+    }
+    else if (shareable) {
+        hashSource(fname, raw_slide, source);
+    }
+
+    auto cache_slide = [&](bool jfif_not_png) {
+        slide_cache_entry_t entry;
+        entry.fp = fp;
+        entry.fp.fidx = fidx;
+        entry.raw_slide = raw_slide;
+        entry.max_slide_size = max_slide_size;
+        entry.params_mtime = params_mtime;
+        entry.jfif_not_png = jfif_not_png;
+        entry.blob = slide.blob;
+        entry.mothdr = slide.mothdr;
+        entry.content_hash = source.content_hash;
+        entry.image_hashed = source.image_hashed;
+        entry.image_hash = source.image_hash;
+        entry.violations = slide.violations;
+
+        std::lock_guard<std::mutex> lock(slide_cache_mutex);
+        slide_cache.Insert(entry);
+    };
+
+    // once per encoded slide, as the result is kept with it (and in the slide cache)
+    auto check_slide = [&](bool jfif_not_png) {
+        slide.violations = CheckCompliance(*slide.blob, jfif_not_png, max_slide_size);
+        if (slide.violations) {
+            fprintf(stderr, "ODR-PadEnc Warning: slide '%s' is not compliant (%s)\n",
+                    fname.c_str(), DescribeViolations(slide.violations).c_str());
+        }
+    };
+
+    // another instance may have encoded the same file already
+    if (shareable && source.content_hash) {
+        bool jfif_not_png;
+        slide_blob_t stored_blob = shared_store.Find(source.content_hash, max_slide_size, &jfif_not_png);
+        if (stored_blob) {
+            if (verbose) {
+                fprintf(stderr, "ODR-PadEnc image: '" ODR_COLOR_SLS "%s" ODR_COLOR_RST "' (id=%d). Taken from the slide store: %zu Bytes\n",
+                        fname.c_str(), fidx, stored_blob->Size());
+            }
+
+            slide.filepath = fname;
+            slide.fidx = fidx;
+            slide.blob = stored_blob;
+            slide.mothdr = createMotHeader(stored_blob->Size(), fidx, jfif_not_png, params_fname, params_mtime);
+            check_slide(jfif_not_png);
+            if (cacheable)
+                cache_slide(jfif_not_png);
+            return true;
+        }
+    }
+
+    MetricHistogram::Timer encode_timer(slide_encode_metric());
+
 #if HAVE_MAGICKWAND
     MagickWand *m_wand = NULL;
 #endif
 
-    uint8_t *raw_blob = NULL;
+    slide_blob_t raw_blob;
     uint8_t *magick_blob = NULL;
     size_t blobsize;
     bool jfif_not_png = true;
+    int native_result = 0;
 
-    const bool raw_slide = filename_specifies_raw_mode(fname) or raw_slides;
-
+    // an ideally sized JPEG/PNG slide is sent as is, without decoding it
     if (!raw_slide) {
+        native_result = prepareCompliantImage(fname, fidx, max_slide_size, raw_blob, &jfif_not_png);
+        if (native_result < 0)
+            goto encodefile_out;
+    }
+
+#if HAVE_LIBJPEG
+    // other JPEG and PNG slides are processed directly, other formats by MagickWand
+    if (!raw_slide && native_result == 0) {
+        native_result = prepareNativeImage(fname, fidx, max_slide_size, raw_blob, &jfif_not_png);
+        if (native_result < 0)
+            goto encodefile_out;
+    }
+#endif
+
+    if (native_result > 0) {
+        blobsize = raw_blob->Size();
+    }
+    else if (!raw_slide) {
 #if HAVE_MAGICKWAND
         /*! By default, we do resize the image to 320x240, with a quality such that
          * the blobsize is at most MAXSLIDESIZE.
@@ -411,7 +2646,7 @@ bool SLSEncoder::encodeSlide(const std::string& fname, int fidx, bool raw_slides
         bool native_support = false;
         bool resize_required = true;
 
-        m_wand = NewMagickWand();
+        m_wand = MagickWandPool::Global().Acquire();
 
         if (MagickReadImage(m_wand, fname.c_str()) == MagickFalse) {
             fprintf(stderr, "ODR-PadEnc Error: Unable to load image '%s'\n",
@@ -488,146 +2723,263 @@ bool SLSEncoder::encodeSlide(const std::string& fname, int fidx, bool raw_slides
             warnOnSmallerImage(height, width, fname);
         }
 
+#elif HAVE_LIBJPEG
+        fprintf(stderr, "ODR-PadEnc has not been compiled with MagickWand, only RAW, JPEG and PNG slides are supported!\n");
+        goto encodefile_out;
 #else
         fprintf(stderr, "ODR-PadEnc has not been compiled with MagickWand, only RAW slides are supported!\n");
         goto encodefile_out;
 #endif
     }
     else { // Use RAW data, it might not even be a jpg !
-        // read file
-        FILE* pFile = fopen(fname.c_str(), "rb");
-        if (pFile == NULL) {
-            perror(("ODR-PadEnc Error: Unable to load file '" + fname + "'").c_str());
+        // map the file, so that its data is only copied when written into the PAD
+        raw_blob = SlideBlob::MapFile(fname);
+        if (!raw_blob)
             goto encodefile_out;
-        }
-
-        // obtain file size:
-        fseek(pFile, 0, SEEK_END);
-        blobsize = ftell(pFile);
-        rewind(pFile);
+        blobsize = raw_blob->Size();
 
         if (verbose) {
             fprintf(stderr, "ODR-PadEnc image: '" ODR_COLOR_SLS "%s" ODR_COLOR_RST "' (id=%d). Raw file: %zu Bytes\n",
                     fname.c_str(), fidx, blobsize);
         }
 
-        if (blobsize > max_slide_size) {
-            fprintf(stderr, "ODR-PadEnc Warning: blob in raw-slide '%s' too large\n",
-                    fname.c_str());
-        }
+        size_t last_dot = fname.rfind(".");
 
-        // allocate memory to contain the whole file:
-        raw_blob = (uint8_t*) malloc(blobsize);
-        if (raw_blob == NULL) {
-            fprintf(stderr, "ODR-PadEnc Error: Memory allocation error\n");
-            fclose(pFile);
-            goto encodefile_out;
+        // default:
+        jfif_not_png = true; // This is how we did it in the past.
+                             // It's wrong anyway, so we're at least compatible
+
+        if (last_dot != std::string::npos) {
+            std::string file_extension = fname.substr(last_dot, std::string::npos);
+
+            std::transform(file_extension.begin(), file_extension.end(), file_extension.begin(), ::tolower);
+
+            if (file_extension == ".png") {
+                jfif_not_png = false;
+            }
         }
+    }
 
-        // copy the file into the buffer:
-        if (fread(raw_blob, blobsize, 1, pFile) != 1) {
-            fprintf(stderr, "ODR-PadEnc Error: Could not read file\n");
-            fclose(pFile);
-            goto encodefile_out;
+    if (blobsize) {
+        if (raw_blob == nullptr and magick_blob == nullptr) {
+            fprintf(stderr, "ODR-PadEnc logic error: either raw_blob or magick_blob must be non-null! See src/sls.cpp line %d\n", __LINE__);
+            abort();
         }
 
-        size_t last_dot = fname.rfind(".");
+        slide.filepath = fname;
+        slide.fidx = fidx;
+        slide.blob = raw_blob;
+#if HAVE_MAGICKWAND
+        if (!slide.blob)
+            slide.blob = std::make_shared<const SlideBlob>(magick_blob, blobsize);
+#endif
+        // from now on mapped from the store, which all instances share
+        if (shareable && source.content_hash)
+            slide.blob = shared_store.Add(source.content_hash, max_slide_size, jfif_not_png, slide.blob);
+        // held once, however many services (or content items) have the same slide
+        slide.blob = SlideBlobStore::Global().Intern(slide.blob);
+        slide.mothdr = createMotHeader(blobsize, fidx, jfif_not_png, params_fname, params_mtime);
+        check_slide(jfif_not_png);
+
+        if (cacheable)
+            cache_slide(jfif_not_png);
+
+        result = true;
+    }
+
+encodefile_out:
+    if (magick_blob) {
+#if HAVE_MAGICKWAND
+        MagickRelinquishMemory(magick_blob);
+#endif
+    }
+
+#if HAVE_MAGICKWAND
+    if (m_wand) {
+        MagickWandPool::Global().Release(m_wand);
+    }
+#endif
+
+    return result;
+}
+
 
-        // default:
-        jfif_not_png = true; // This is how we did it in the past.
-                             // It's wrong anyway, so we're at least compatible
+void SLSEncoder::hashSource(const std::string& fname, bool raw_slide, slide_cache_entry_t& entry)
+{
+    slide_blob_t file = SlideBlob::MapFile(fname);
+    if (!file)
+        return;     // reported on encoding
+    entry.content_hash = odr::hash64(file->Data(), file->Size());
+
+#if HAVE_LIBJPEG
+    // the smallest thumbnail, as decoded with the highest DCT scaling
+    SlideCodec::Format format = SlideCodec::DetectFormat(file->Data(), file->Size());
+    rgb_image_t thumbnail;
+    if (!raw_slide && similarity_distance >= 0 && SlideCodec::Supported(format) &&
+            SlideCodec::Decode(format, file->Data(), file->Size(), 9, 8, thumbnail)) {
+        entry.image_hashed = true;
+        entry.image_hash = SlideCodec::DifferenceHash(thumbnail);
+    }
+#else
+    (void) raw_slide;
+#endif
+}
 
-        if (last_dot != std::string::npos) {
-            std::string file_extension = fname.substr(last_dot, std::string::npos);
 
-            std::transform(file_extension.begin(), file_extension.end(), file_extension.begin(), ::tolower);
+size_t SLSEncoder::preEncodeSlides(const std::list<slide_metadata_t>& slides, bool raw_slides, size_t max_slide_size, const std::atomic<bool>& stop,
+                                   size_t max_threads)
+{
+    if (!slide_cache.Enabled())
+        return 0;
 
-            if (file_extension == ".png") {
-                jfif_not_png = false;
-            }
-        }
+    // only the slides not encoded yet, as long as they fit into the cache
+    std::vector<const slide_metadata_t*> pending;
+    {
+        std::lock_guard<std::mutex> lock(slide_cache_mutex);
+        size_t cache_size = slide_cache.Size();
+        for (const slide_metadata_t& md : slides) {
+            fingerprint_t fp;
+            if (!fp.load_from_file(md.filepath.c_str()))
+                continue;
+            if (slide_cache.Find(fp, filename_specifies_raw_mode(md.filepath) or raw_slides, max_slide_size))
+                continue;
 
-        if (pFile != NULL) {
-            fclose(pFile);
+            cache_size += max_slide_size;
+            if (cache_size > slide_cache.Capacity())
+                break;
+            pending.push_back(&md);
         }
     }
 
-    if (blobsize) {
-        if (raw_blob == nullptr and magick_blob == nullptr) {
-            fprintf(stderr, "ODR-PadEnc logic error: either raw_blob or magick_blob must be non-null! See src/sls.cpp line %d\n", __LINE__);
-            abort();
-        }
-        const uint8_t *blob = raw_blob ? raw_blob : magick_blob;
+    const size_t threads = std::min(pending.size(), std::min((size_t) std::thread::hardware_concurrency(), max_threads));
+    if (threads < 2)
+        return 0;   // no gain over preparing one slide after the other
 
-        MSCDG msc;
-        DATA_GROUP* dgli;
-        DATA_GROUP* mscdg;
+    if (verbose)
+        fprintf(stderr, "ODR-PadEnc encoding %zu slides on %zu threads\n", pending.size(), threads);
+
+    // each thread takes the next pending slide
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> encoded(0);
+    auto encode = [&]() {
+        ThreadPlacement::Global().EnterWorker();
+        prepared_slide_t slide;
+        for (size_t i = next++; i < pending.size() && !stop; i = next++) {
+            WorkGovernor::Global().Pace();
+            if (prepareSlide(pending[i]->filepath, pending[i]->fidx, raw_slides, max_slide_size, slide))
+                encoded++;
+        }
+    };
 
-        size_t nseg = blobsize / MAXSEGLEN;
-        size_t lastseglen = blobsize % MAXSEGLEN;
-        if (lastseglen)
-            nseg++;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; i++)
+        workers.emplace_back(encode);
+    for (std::thread& worker : workers)
+        worker.join();
 
-        // MOT Header
+    return encoded;
+}
 
-        uint8_vector_t mothdr = createMotHeader(blobsize, fidx, jfif_not_png, fname + SLS_PARAMS_SUFFIX);
-        // Create the MSC Data Group C-Structure
-        createMscDG(&msc, 3, &cindex_header, 0, 1, fidx, &mothdr[0], mothdr.size());
-        // Generate the MSC DG frame (Figure 9 en 300 401)
-        mscdg = packMscDG(&msc);
-        dgli = PADPacketizer::CreateDataGroupLengthIndicator(mscdg->data.size());
 
-        pad_packetizer->AddDG(dgli, false);
-        pad_packetizer->AddDG(mscdg, false);
+void SLSEncoder::queueSlide(const prepared_slide_t& slide, const std::string& dump_name, std::function<void(bool)> done_handler)
+{
+    queueMotObject(slide, false, std::move(done_handler));
+    last_slide = slide;
 
-        // MOT Body
+    if (not dump_name.empty()) {
+        dumper.Dump(dump_name, slide.blob);
+    }
+}
 
-        for (size_t i = 0; i < nseg; i++) {
-            const uint8_t *curseg = blob + i * MAXSEGLEN;
-            size_t curseglen;
-            int last;
 
-            if (i == nseg - 1) {
-                curseglen = lastseglen;
-                last = 1;
-            } else {
-                curseglen = MAXSEGLEN;
-                last = 0;
-            }
+bool SLSEncoder::repeatSlide(bool fill)
+{
+    if (!last_slide.blob)
+        return false;
+    queueMotObject(last_slide, true, nullptr, fill);
+    return true;
+}
 
-            createMscDG(&msc, 4, &cindex_body, i, last, fidx, curseg, curseglen);
-            mscdg = packMscDG(&msc);
-            dgli = PADPacketizer::CreateDataGroupLengthIndicator(mscdg->data.size());
 
-            pad_packetizer->AddDG(dgli, false);
-            pad_packetizer->AddDG(mscdg, false);
+void SLSEncoder::queueMotObject(const prepared_slide_t& slide, bool repetition, std::function<void(bool)> done_handler, bool fill)
+{
+    if (directory.Enabled()) {
+        // a repetition is for receivers that tuned in during the slide, so its body is sent again in any case
+        const bool send_body = repetition || directory.Add(slide.fidx, slide.mothdr, slide.blob, directory_body_interval);
+        slide_blob_t data = directory.Build(mot_builder.GetSegmentLength());
+        if (!send_body) {
+            mot_builder.QueueDirectory(data, directory.TransportId(), std::move(done_handler), fill);
+            return;
         }
+        mot_builder.QueueDirectory(data, directory.TransportId(), nullptr, fill);
+        mot_builder.QueueBody(slide.blob, slide.fidx, std::move(done_handler), fill);
+        return;
+    }
 
-        if (not dump_name.empty()) {
-            dump_slide(dump_name, blob, blobsize);
-        }
+    // the header is referenced by its (possibly repeated) segments as well
+    slide_blob_t header = std::make_shared<const SlideBlob>(slide.mothdr.data(), slide.mothdr.size());
+    mot_builder.QueueObject(header, slide.blob, slide.fidx, repetition, std::move(done_handler), fill);
+}
 
-        result = true;
-    }
 
-encodefile_out:
-    if (raw_blob) {
-        free(raw_blob);
+void SLSEncoder::queuePlannedSlide(PADPacketizer* packetizer, size_t body_size, size_t seglen, std::function<void(bool)> done_handler) const
+{
+    const int tid = MOTDirectory::TID_BASE - 1;     // a new slide
+    const uint8_t content_name[] = "\x00" "0000.jpg";     // as by createMotHeader()
+    MOTHeader header(body_size, 0x02, 0x001, MOTHeader::ExtensionSize(4) + MOTHeader::ExtensionSize(sizeof(content_name) - 1));
+    const uint8_t triggertime_now[4] = {0x00};
+    header.AddExtension(0x05, triggertime_now, sizeof(triggertime_now));
+    header.AddExtension(0x0C, content_name, sizeof(content_name) - 1);
+    slide_blob_t body = std::make_shared<const SlideBlob>(uint8_vector_t(body_size));
+
+    MOTObjectBuilder builder(mot_builder);
+    builder.SetPacketizer(packetizer);
+    builder.SetSegmentLength(seglen);
+    if (directory.Enabled()) {
+        MOTDirectory planned(directory);
+        planned.Add(tid, header.GetData(), body, directory_body_interval);
+        builder.QueueDirectory(planned.Build(seglen), planned.TransportId());
+        builder.QueueBody(body, tid, std::move(done_handler));
+        return;
     }
+    slide_blob_t header_blob = std::make_shared<const SlideBlob>(header.GetData().data(), header.GetData().size());
+    builder.QueueObject(header_blob, body, tid, false, std::move(done_handler));
+}
 
-    if (magick_blob) {
-#if HAVE_MAGICKWAND
-        MagickRelinquishMemory(magick_blob);
-#endif
-    }
 
-#if HAVE_MAGICKWAND
-    if (m_wand) {
-        m_wand = DestroyMagickWand(m_wand);
-    }
-#endif
+size_t SLSEncoder::OptimalSegmentLength(size_t padlen) {
+    const size_t SEGMENTS = 3;
+    const size_t xpad_len = padlen - 2;
+    const size_t max_len = std::min(MAXSEGLEN_LIMIT, 40 * xpad_len);
+    const size_t step = std::max(xpad_len / 8, (size_t) 1);
+
+    size_t best_len = MAXSEGLEN;
+    double best_overhead = -1;
+    std::vector<uint8_t> pad(padlen + 1);
+    for (size_t len = std::min((size_t) 64, max_len); len <= max_len; len += step) {
+        PADPacketizer packetizer(padlen);
+        for (size_t i = 0; i < SEGMENTS; i++) {
+            DATA_GROUP* dg = packetizer.CreateDataGroup(9 + len, APPTYPE_MOT_START, APPTYPE_MOT_CONT);
+            dg->AppendCRC();
+            packetizer.AddDG(packetizer.CreateDataGroupLengthIndicator(dg->Size()), false);
+            packetizer.AddDG(dg, false);
+        }
 
-    return result;
+        // the X-PAD left unused after the last segment does not count
+        size_t last_unused = 0;
+        while (packetizer.QueueFilled()) {
+            size_t unused = packetizer.GetStats().unused_bytes;
+            packetizer.WriteNextPAD(true, &pad[0]);
+            last_unused = packetizer.GetStats().unused_bytes - unused;
+        }
+        const PAD_STATS& stats = packetizer.GetStats();
+        double overhead = (double) (stats.capacity_bytes - last_unused - SEGMENTS * len) / (SEGMENTS * len);
+        if (best_overhead < 0 || overhead < best_overhead) {
+            best_overhead = overhead;
+            best_len = len;
+        }
+    }
+    return best_len;
 }
 
 
@@ -650,7 +3002,7 @@ bool SLSEncoder::check_sls_param_len(const std::string &key, size_t len, size_t
 }
 
 
-void SLSEncoder::process_mot_params_file(MOTHeader& header, const std::string &params_fname) {
+void SLSEncoder::process_mot_params_file(const std::string &params_fname, std::vector<mot_params_t::extension_t>& extensions) {
     std::ifstream params_fstream(params_fname);
     if (!params_fstream.is_open())
         return;
@@ -681,10 +3033,10 @@ void SLSEncoder::process_mot_params_file(MOTHeader& header, const std::string &p
                 continue;
             }
 
-            uint8_t id_param[2];
+            uint8_t id_param[2] = {0, 0};
             if (parse_sls_param_id("CategoryID", params[0], id_param[0]) &
                 parse_sls_param_id("SlideID", params[1], id_param[1])) {
-                header.AddExtension(0x25, id_param, sizeof(id_param));
+                extensions.push_back({0x25, uint8_vector_t(id_param, id_param + sizeof(id_param))});
                 if (verbose)
                     fprintf(stderr, "ODR-PadEnc SLS parameter: CategoryID = %d / SlideID = %d\n", id_param[0], id_param[1]);
             }
@@ -694,7 +3046,7 @@ void SLSEncoder::process_mot_params_file(MOTHeader& header, const std::string &p
             if(!check_sls_param_len("CategoryTitle", value.length(), 128))
                 continue;
 
-            header.AddExtension(0x26, (uint8_t*) value.c_str(), value.length());
+            extensions.push_back({0x26, uint8_vector_t(value.begin(), value.end())});
             if (verbose)
                 fprintf(stderr, "ODR-PadEnc SLS parameter: CategoryTitle = '%s'\n", value.c_str());
             continue;
@@ -703,7 +3055,7 @@ void SLSEncoder::process_mot_params_file(MOTHeader& header, const std::string &p
             if(!check_sls_param_len("ClickThroughURL", value.length(), 512))
                 continue;
 
-            header.AddExtension(0x27, (uint8_t*) value.c_str(), value.length());
+            extensions.push_back({0x27, uint8_vector_t(value.begin(), value.end())});
             if (verbose)
                 fprintf(stderr, "ODR-PadEnc SLS parameter: ClickThroughURL = '%s'\n", value.c_str());
             continue;
@@ -712,26 +3064,50 @@ void SLSEncoder::process_mot_params_file(MOTHeader& header, const std::string &p
             if(!check_sls_param_len("AlternativeLocationURL", value.length(), 512))
                 continue;
 
-            header.AddExtension(0x28, (uint8_t*) value.c_str(), value.length());
+            extensions.push_back({0x28, uint8_vector_t(value.begin(), value.end())});
             if (verbose)
                 fprintf(stderr, "ODR-PadEnc SLS parameter: AlternativeLocationURL = '%s'\n", value.c_str());
             continue;
         }
 
+        // left to SlideStore
+        if (SlideStore::IsScheduleParam(key))
+            continue;
+
         fprintf(stderr, "ODR-PadEnc Warning: SLS parameter '%s' unknown - ignored\n", key.c_str());
     }
 }
 
 
-uint8_vector_t SLSEncoder::createMotHeader(size_t blobsize, int fidx, bool jfif_not_png, const std::string &params_fname)
+uint8_vector_t SLSEncoder::createMotHeader(size_t blobsize, int fidx, bool jfif_not_png, const std::string &params_fname, unsigned long params_mtime)
 {
+    // the params file is only parsed again, if changed (and the header only built again, if anything changed)
+    mot_params_t params;
+    bool parsed = false;
+    {
+        std::lock_guard<std::mutex> lock(params_memo_mutex);
+        std::map<std::string, mot_params_t>::const_iterator it = params_memo.find(params_fname);
+        if (it != params_memo.end() && it->second.mtime == params_mtime) {
+            if (it->second.blobsize == blobsize && it->second.fidx == fidx && it->second.jfif_not_png == jfif_not_png)
+                return it->second.mothdr;
+            params.extensions = it->second.extensions;
+            parsed = true;
+        }
+    }
+    if (!parsed && params_mtime)
+        process_mot_params_file(params_fname, params.extensions);
+
     // prepare ContentName
     uint8_t cntemp[10];     // = 1 + 8 + 1 = charset + name + terminator
     cntemp[0] = (uint8_t) DABCharset::COMPLETE_EBU_LATIN << 4;
     snprintf((char*) (cntemp + 1), sizeof(cntemp) - 1, "%04d.%s", fidx, jfif_not_png ? "jpg" : "png");
 
+    size_t extensions_len = MOTHeader::ExtensionSize(4) + MOTHeader::ExtensionSize(sizeof(cntemp) - 1);
+    for (const mot_params_t::extension_t& extension : params.extensions)
+        extensions_len += MOTHeader::ExtensionSize(extension.data_field.size());
+
     // MOT header - content type: image, content subtype: JFIF / PNG
-    MOTHeader header(blobsize, 0x02, jfif_not_png ? 0x001 : 0x003);
+    MOTHeader header(blobsize, 0x02, jfif_not_png ? 0x001 : 0x003, extensions_len);
 
     // TriggerTime: NOW
     uint8_t triggertime_now[4] = {0x00};
@@ -740,71 +3116,565 @@ uint8_vector_t SLSEncoder::createMotHeader(size_t blobsize, int fidx, bool jfif_
     // ContentName: XXXX.jpg / XXXX.png
     header.AddExtension(0x0C, cntemp, sizeof(cntemp) - 1);   // omit terminator
 
-    // process params file if present
-    process_mot_params_file(header, params_fname);
+    // params file extensions, if present
+    for (const mot_params_t::extension_t& extension : params.extensions)
+        header.AddExtension(extension.param_id, extension.data_field.data(), extension.data_field.size());
 
     if (verbose)
         fprintf(stderr, "ODR-PadEnc writing image as '%s'\n", cntemp + 1);
 
-    return header.GetData();
+    params.mtime = params_mtime;
+    params.blobsize = blobsize;
+    params.fidx = fidx;
+    params.jfif_not_png = jfif_not_png;
+    params.mothdr = header.GetData();
+
+    std::lock_guard<std::mutex> lock(params_memo_mutex);
+    if (params_memo.size() >= PARAMSMEMOLEN)
+        params_memo.clear();
+    params_memo[params_fname] = params;
+    return params.mothdr;
 }
 
 
-void SLSEncoder::createMscDG(MSCDG* msc, unsigned short int dgtype,
-        int *cindex, unsigned short int segnum, unsigned short int lastseg,
-        unsigned short int tid, const uint8_t* data,
-        unsigned short int datalen)
+int SLSEncoder::searchQuality(int min_quality, int max_quality, int start_quality, const std::function<bool(int)>& fits)
 {
-    msc->extflag = 0;
-    msc->crcflag = 1;
-    msc->segflag = 1;
-    msc->accflag = 1;
-    msc->dgtype = dgtype;
-    msc->cindex = *cindex;
-    msc->rindex = 0;
-    msc->last = lastseg;
-    msc->segnum = segnum;
-    msc->rfa = 0;
-    msc->tidflag = 1;
-    msc->lenid = 2;
-    msc->tid = tid;
-    msc->segdata = data;
-    msc->rcount = 0;
-    msc->seglen = datalen;
+    int lo = min_quality - 1;   // highest quality known to fit
+    int hi = max_quality + 1;   // lowest quality known not to fit
+
+    if (start_quality < 0) {
+        // most slides fit right away
+        if (fits(max_quality))
+            return max_quality;
+        hi = max_quality;
+    } else {
+        // similar content as before: gallop away from the previous quality
+        int quality = std::min(std::max(start_quality, min_quality), max_quality);
+        if (fits(quality)) {
+            lo = quality;
+            for (int step = 1; lo + step < hi; step *= 2) {
+                if (!fits(lo + step)) {
+                    hi = lo + step;
+                    break;
+                }
+                lo += step;
+            }
+        } else {
+            hi = quality;
+            for (int step = 1; hi - step > lo; step *= 2) {
+                if (fits(hi - step)) {
+                    lo = hi - step;
+                    break;
+                }
+                hi -= step;
+            }
+        }
+    }
 
-    *cindex = (*cindex + 1) % 16;   // increment continuity index
+    // bisect the remaining range
+    while (hi - lo > 1) {
+        int quality = lo + (hi - lo) / 2;
+        if (fits(quality))
+            lo = quality;
+        else
+            hi = quality;
+    }
+
+    return lo >= min_quality ? lo : -1;
+}
+
+bool SLSEncoder::isSlideParamFileFilename(const std::string& filename) {
+    return filename.length() >= SLS_PARAMS_SUFFIX.length() &&
+           filename.substr(filename.length() - SLS_PARAMS_SUFFIX.length()) == SLS_PARAMS_SUFFIX;
 }
 
 
-DATA_GROUP* SLSEncoder::packMscDG(MSCDG* msc)
+// --- SlideStateFile -----------------------------------------------------------------
+/* File layout (host byte order, as the file is not meant to be moved between machines):
+ *   magic, version
+ *   last given fidx, history entry count, history entries (least recently used first)
+ *   cache entry count, cache entries (least recently used first)
+ *
+ * fingerprint: name len (uint32), name, size (int64), mtime (uint64), fidx (int32), content hash (uint64)
+ * cache entry: fingerprint, raw slide (uint8), max slide size (uint64), params mtime (uint64),
+ *              JFIF (uint8), MOT header len (uint32), MOT header, blob len (uint64), blob
+ */
+const char     SlideStateFile::MAGIC[8]       = {'O', 'D', 'R', 'P', 'A', 'D', 'S', 'T'};
+const uint32_t SlideStateFile::FORMAT_VERSION = 3;
+
+class StateFileReader {
+private:
+    const uint8_t* data;
+    size_t len;
+    size_t pos;
+    bool ok;
+public:
+    StateFileReader(const uint8_t* data, size_t len) : data(data), len(len), pos(0), ok(true) {}
+
+    bool Ok() const {return ok;}
+    bool AtEnd() const {return pos == len;}
+    void Fail() {ok = false;}
+
+    // returns the offset of the skipped bytes
+    size_t Skip(size_t count) {
+        size_t offset = pos;
+        if (ok && count <= len - pos)
+            pos += count;
+        else
+            ok = false;
+        return offset;
+    }
+    template<typename T> T Get() {
+        T value = T();
+        size_t offset = Skip(sizeof(T));
+        if (ok)
+            memcpy(&value, data + offset, sizeof(T));
+        return value;
+    }
+    bool GetFingerprint(fingerprint_t& fp) {
+        uint32_t name_len = Get<uint32_t>();
+        size_t offset = Skip(name_len);
+        if (ok)
+            fp.s_name.assign((const char*) data + offset, name_len);
+        fp.s_size = Get<int64_t>();
+        fp.s_mtime = Get<uint64_t>();
+        fp.fidx = Get<int32_t>();
+        fp.s_content_hash = Get<uint64_t>();
+        return ok && fp.fidx >= 0 && fp.fidx <= History::MAXSLIDEID;
+    }
+};
+
+class StateFileWriter {
+private:
+    FILE* f;
+    bool ok;
+public:
+    StateFileWriter(FILE* f) : f(f), ok(true) {}
+
+    bool Ok() const {return ok;}
+
+    void Put(const void* data, size_t len) {
+        if (ok && len && fwrite(data, len, 1, f) != 1)
+            ok = false;
+    }
+    template<typename T> void Put(T value) {Put(&value, sizeof(T));}
+    void PutFingerprint(const fingerprint_t& fp) {
+        Put<uint32_t>(fp.s_name.size());
+        Put(fp.s_name.data(), fp.s_name.size());
+        Put<int64_t>(fp.s_size);
+        Put<uint64_t>(fp.s_mtime);
+        Put<int32_t>(fp.fidx);
+        Put<uint64_t>(fp.s_content_hash);
+    }
+};
+
+
+size_t SlideStateFile::Load(History& history, SlideCache& cache)
 {
-    DATA_GROUP* dg = new DATA_GROUP(9 + msc->seglen, APPTYPE_MOT_START, APPTYPE_MOT_CONT);
-    uint8_vector_t &b = dg->data;
+    size_t loaded = LoadFile(history, cache);
 
-    // headers
-    b[0] = (msc->extflag<<7) | (msc->crcflag<<6) | (msc->segflag<<5) |
-           (msc->accflag<<4) | msc->dgtype;
+    // newer than the file's history; saved as it differs
+    if (history_replicated) {
+        history.restore(replicated_entries, replicated_last_given_fidx);
+        if (verbose)
+            fprintf(stderr, "ODR-PadEnc restored %zu replicated slide IDs\n", replicated_entries.size());
+    }
+    return loaded;
+}
 
-    b[1] = (msc->cindex<<4) | msc->rindex;
-    b[2] = (msc->last<<7) | ((msc->segnum & 0x7F00) >> 8);
-    b[3] =  msc->segnum & 0x00FF;
-    b[4] = 0;
-    b[4] = (msc->rfa << 5) | (msc->tidflag << 4) | msc->lenid;
-    b[5] = (msc->tid & 0xFF00) >> 8;
-    b[6] =  msc->tid & 0x00FF;
-    b[7] = (msc->rcount << 5) | ((msc->seglen & 0x1F00)>>8);
-    b[8] =  msc->seglen & 0x00FF;
 
-    // data field
-    memcpy(&b[9], msc->segdata, msc->seglen);
+size_t SlideStateFile::LoadFile(History& history, SlideCache& cache)
+{
+    if (!Enabled())
+        return 0;
 
-    // CRC
-    dg->AppendCRC();
+    std::shared_ptr<const MappedFile> file = MappedFile::Open(path, true);
+    if (!file)
+        return 0;
 
-    return dg;
+    StateFileReader reader(file->Data(), file->Size());
+    size_t magic_offset = reader.Skip(sizeof(MAGIC));
+    if (!reader.Ok() || memcmp(file->Data() + magic_offset, MAGIC, sizeof(MAGIC)) || reader.Get<uint32_t>() != FORMAT_VERSION) {
+        fprintf(stderr, "ODR-PadEnc Warning: ignoring slide state file '%s' of unknown format\n", path.c_str());
+        return 0;
+    }
+
+    // history
+    int32_t last_given_fidx = reader.Get<int32_t>();
+    uint32_t history_count = reader.Get<uint32_t>();
+    std::vector<fingerprint_t> history_entries;
+    for (uint32_t i = 0; i < history_count && reader.Ok(); i++) {
+        fingerprint_t fp;
+        if (reader.GetFingerprint(fp))
+            history_entries.push_back(fp);
+    }
+    if (last_given_fidx < 0 || last_given_fidx > History::MAXSLIDEID)
+        reader.Fail();
+
+    // cache
+    std::vector<slide_cache_entry_t> cache_entries;
+    uint32_t cache_count = reader.Get<uint32_t>();
+    for (uint32_t i = 0; i < cache_count && reader.Ok(); i++) {
+        slide_cache_entry_t entry;
+        if (!reader.GetFingerprint(entry.fp))
+            break;
+        entry.raw_slide = reader.Get<uint8_t>();
+        entry.max_slide_size = reader.Get<uint64_t>();
+        entry.params_mtime = reader.Get<uint64_t>();
+        entry.jfif_not_png = reader.Get<uint8_t>();
+        entry.content_hash = reader.Get<uint64_t>();
+        entry.image_hashed = reader.Get<uint8_t>();
+        entry.image_hash = reader.Get<uint64_t>();
+
+        uint32_t mothdr_len = reader.Get<uint32_t>();
+        size_t mothdr_offset = reader.Skip(mothdr_len);
+        uint64_t blob_len = reader.Get<uint64_t>();
+        size_t blob_offset = reader.Skip(blob_len);
+        if (!reader.Ok())
+            break;
+
+        entry.mothdr.assign(file->Data() + mothdr_offset, file->Data() + mothdr_offset + mothdr_len);
+        entry.blob = std::make_shared<const SlideBlob>(file, blob_offset, blob_len);
+        // not saved, as it only takes the header bytes
+        entry.violations = SLSEncoder::CheckCompliance(*entry.blob, entry.jfif_not_png, entry.max_slide_size);
+        cache_entries.push_back(entry);
+    }
+
+    if (!reader.Ok() || !reader.AtEnd()) {
+        fprintf(stderr, "ODR-PadEnc Warning: ignoring corrupt slide state file '%s'\n", path.c_str());
+        return 0;
+    }
+
+    history.restore(history_entries, last_given_fidx);
+    for (const slide_cache_entry_t& entry : cache_entries)
+        cache.Insert(entry);
+
+    saved_history_changes = history.changes();
+    saved_cache_changes = cache.Changes();
+
+    if (verbose)
+        fprintf(stderr, "ODR-PadEnc restored %zu slide IDs and %zu encoded slides from '%s'\n",
+                history_entries.size(), cache_entries.size(), path.c_str());
+    return cache_entries.size();
 }
 
-bool SLSEncoder::isSlideParamFileFilename(const std::string& filename) {
-    return filename.length() >= SLS_PARAMS_SUFFIX.length() &&
-           filename.substr(filename.length() - SLS_PARAMS_SUFFIX.length()) == SLS_PARAMS_SUFFIX;
+
+bool SlideStateFile::Save(const History& history, const SlideCache& cache)
+{
+    // write to a temporary file first, so that the state file is replaced atomically and
+    // a mapping of the previous one (still referenced by the cache) stays intact
+    std::string tmp_path = path + ".tmp";
+    FILE* f = fopen(tmp_path.c_str(), "wb");
+    if (!f) {
+        perror(("ODR-PadEnc Error: Unable to create slide state file '" + tmp_path + "'").c_str());
+        return false;
+    }
+
+    StateFileWriter writer(f);
+    writer.Put(MAGIC, sizeof(MAGIC));
+    writer.Put<uint32_t>(FORMAT_VERSION);
+
+    std::vector<fingerprint_t> history_entries = history.get_entries();
+    writer.Put<int32_t>(history.get_last_given_fidx());
+    writer.Put<uint32_t>(history_entries.size());
+    for (const fingerprint_t& fp : history_entries)
+        writer.PutFingerprint(fp);
+
+    // the spilled slides first, so that the ones in memory are the most recently used ones again when loaded
+    std::vector<const slide_cache_entry_t*> cache_entries;
+    for (const std::list<slide_cache_entry_t>* tier : {&cache.GetSpilledEntries(), &cache.GetEntries()})
+        for (std::list<slide_cache_entry_t>::const_reverse_iterator it = tier->rbegin(); it != tier->rend(); it++)
+            cache_entries.push_back(&*it);
+    writer.Put<uint32_t>(cache_entries.size());
+    for (const slide_cache_entry_t* it : cache_entries) {
+        writer.PutFingerprint(it->fp);
+        writer.Put<uint8_t>(it->raw_slide);
+        writer.Put<uint64_t>(it->max_slide_size);
+        writer.Put<uint64_t>(it->params_mtime);
+        writer.Put<uint8_t>(it->jfif_not_png);
+        writer.Put<uint64_t>(it->content_hash);
+        writer.Put<uint8_t>(it->image_hashed);
+        writer.Put<uint64_t>(it->image_hash);
+        writer.Put<uint32_t>(it->mothdr.size());
+        writer.Put(it->mothdr.data(), it->mothdr.size());
+        writer.Put<uint64_t>(it->blob->Size());
+        writer.Put(it->blob->Data(), it->blob->Size());
+    }
+
+    bool ok = writer.Ok();
+    if (fclose(f))
+        ok = false;
+    if (!ok) {
+        perror(("ODR-PadEnc Error: Unable to write slide state file '" + tmp_path + "'").c_str());
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    if (rename(tmp_path.c_str(), path.c_str())) {
+        perror(("ODR-PadEnc Error: Unable to replace slide state file '" + path + "'").c_str());
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    saved_history_changes = history.changes();
+    saved_cache_changes = cache.Changes();
+    return true;
+}
+
+
+bool SlideStateFile::SaveIfChanged(const History& history, const SlideCache& cache)
+{
+    if (!Enabled() || (history.changes() == saved_history_changes && cache.Changes() == saved_cache_changes))
+        return true;
+    return Save(history, cache);
+}
+
+
+// --- SlidePreparer -----------------------------------------------------------------
+const std::chrono::milliseconds SlidePreparer::POLL_INTERVAL(100);
+
+SlidePreparer::SlidePreparer(SLSEncoder* sls_encoder, const std::string& sls_dir, bool raw_slides, size_t max_slide_size,
+        bool erase_after_tx, size_t history_len, bool content_hashing, size_t lookahead, std::chrono::milliseconds retry_interval,
+        SlideStateFile* state_file, RereadRequest* reread_request, size_t slides_window, const std::string& cursor_file,
+        const change_settle_t& settle) :
+    sls_encoder(sls_encoder),
+    sls_dir(sls_dir),
+    raw_slides(raw_slides),
+    max_slide_size(max_slide_size),
+    erase_after_tx(erase_after_tx),
+    retry_interval(retry_interval),
+    state_file(state_file),
+    reread_request(reread_request),
+    slides(history_len),
+    queue(lookahead),
+    generation(0),
+    failed(false),
+    stop(false),
+    injected_pending(0)
+{
+    slides.SetStreaming(slides_window, cursor_file);
+    slides.SetContentHashing(content_hashing);
+    slides.SetSettle(settle);
+    state_file->Load(slides.GetHistory(), sls_encoder->GetSlideCache());
+    thread = std::thread(&SlidePreparer::Run, this);
+}
+
+
+SlidePreparer::~SlidePreparer()
+{
+    {
+        std::lock_guard<std::mutex> lock(wakeup_mutex);
+        stop = true;
+    }
+    wakeup.notify_one();
+    thread.join();
+
+    // temporary injected files never handed over
+    for (const injected_slide_t& slide : injected)
+        if (slide.erase)
+            unlink(slide.filepath.c_str());
+    for (const std::pair<prepared_slide_t, bool>& slide : injected_ready)
+        if (slide.second)
+            unlink(slide.first.filepath.c_str());
+}
+
+
+void SlidePreparer::Wait(std::chrono::milliseconds duration)
+{
+    std::unique_lock<std::mutex> lock(wakeup_mutex);
+    wakeup.wait_for(lock, duration, [this]{return stop || inject_requested;});
+    inject_requested = false;
+}
+
+
+void SlidePreparer::Run()
+{
+    ThreadPlacement::Global().EnterWorker();
+    bool slides_success = false;
+    bool pre_encode_pending = false;
+
+    while (!stop) {
+        // check for slides dir re-read request
+        switch (reread_request->Check()) {
+        case 1:     // re-read requested
+            slides.RequestReread();
+            break;
+        case -1:    // error
+            failed = true;
+            return;
+        }
+        if (slides.TakeReread())
+            generation++;
+
+        // injected slides go ahead, regardless of the lookahead
+        PrepareInjected();
+
+        if (queue.Full()) {
+            Wait(POLL_INTERVAL);
+            continue;
+        }
+
+        // try to read slides dir (if present)
+        if (slides.Empty()) {
+            if (!slides.InitFromDir(sls_dir)) {
+                failed = true;
+                return;
+            }
+            slides_success = false;
+
+            if (slides.Empty()) {
+                Wait(retry_interval);
+                continue;
+            }
+
+            // have new/changed slides encoded at once, instead of one after the other
+            pre_encode_pending = true;
+        }
+
+        slide_metadata_t md = slides.GetSlide();
+        if (Unsent(md.filepath)) {
+            // all remaining slides still in transmission
+            if (slides.Empty())
+                Wait(retry_interval);
+            continue;
+        }
+
+        // the PAD requests go first (unlike the injected slides, these are prepared ahead)
+        WorkGovernor::Global().Pace();
+
+        queued_slide_t queued;
+        queued.generation = generation;
+
+        if (sls_encoder->prepareSlide(md.filepath, md.fidx, raw_slides, max_slide_size, queued.slide)) {
+            slides_success = true;
+            if (erase_after_tx) {
+                std::lock_guard<std::mutex> lock(unsent_slides_mutex);
+                unsent_slides.insert(md.filepath);
+            }
+            queue.Push(std::move(queued));
+            state_file->SaveIfChanged(slides.GetHistory(), sls_encoder->GetSlideCache());
+
+            // the others, once the first one is ready to be sent (e.g. right after a start)
+            if (pre_encode_pending) {
+                pre_encode_pending = false;
+                if (sls_encoder->preEncodeSlides(slides.GetSlides(), raw_slides, max_slide_size, stop))
+                    state_file->SaveIfChanged(slides.GetHistory(), sls_encoder->GetSlideCache());
+            }
+        } else {
+            /* skip to next slide, except this is the last slide and so far
+             * no slide worked, to prevent re-reading the slides dir over
+             * and over again. */
+            bool skipping = !(slides.Empty() && !slides_success);
+            fprintf(stderr, "ODR-PadEnc Error: cannot encode file '%s'; %s\n", md.filepath.c_str(), skipping ? "skipping" : "giving up for now");
+            if (!skipping)
+                Wait(retry_interval);
+        }
+    }
+}
+
+
+bool SlidePreparer::GetSlide(prepared_slide_t& slide)
+{
+    queued_slide_t queued;
+    for (;;) {
+        if (!queue.Pop(queued))
+            return false;
+
+        // have the next slide prepared
+        wakeup.notify_one();
+
+        // drop slides prepared before a re-read request
+        if (queued.generation == generation)
+            break;
+        SlideDone(queued.slide.filepath, false);
+    }
+
+    slide = std::move(queued.slide);
+    return true;
+}
+
+
+void SlidePreparer::PrepareInjected()
+{
+    for (;;) {
+        // all the slides injected meanwhile
+        std::deque<injected_slide_t> batch;
+        {
+            std::lock_guard<std::mutex> lock(injected_mutex);
+            if (injected.empty())
+                return;
+            batch.swap(injected);
+        }
+
+        std::list<slide_metadata_t> batch_slides;
+        for (const injected_slide_t& slide : batch)
+            batch_slides.push_back({slide.filepath, slides.GetHistory().get_fidx(slide.filepath.c_str())});
+
+        // e.g. a batch from automation, encoded at once instead of one after the other
+        if (batch_slides.size() > 1)
+            sls_encoder->preEncodeSlides(batch_slides, raw_slides, max_slide_size, stop);
+
+        std::list<slide_metadata_t>::const_iterator md = batch_slides.begin();
+        for (const injected_slide_t& slide : batch) {
+            prepared_slide_t prepared;
+            if (sls_encoder->prepareSlide(slide.filepath, (md++)->fidx, raw_slides, max_slide_size, prepared)) {
+                std::lock_guard<std::mutex> lock(injected_mutex);
+                injected_ready.emplace_back(std::move(prepared), slide.erase);
+            } else {
+                fprintf(stderr, "ODR-PadEnc Error: cannot encode injected file '%s'; skipping\n", slide.filepath.c_str());
+                if (slide.erase && unlink(slide.filepath.c_str()))
+                    perror(("ODR-PadEnc Error: erasing file '" + slide.filepath +"' failed").c_str());
+                injected_pending--;
+            }
+        }
+    }
+}
+
+
+void SlidePreparer::Inject(const std::vector<injected_slide_t>& batch)
+{
+    {
+        std::lock_guard<std::mutex> lock(injected_mutex);
+        injected.insert(injected.end(), batch.begin(), batch.end());
+        injected_pending += batch.size();
+    }
+    {
+        std::lock_guard<std::mutex> lock(wakeup_mutex);
+        inject_requested = true;
+    }
+    wakeup.notify_one();
+}
+
+
+bool SlidePreparer::GetInjectedSlide(prepared_slide_t& slide, bool& erase)
+{
+    std::lock_guard<std::mutex> lock(injected_mutex);
+    if (injected_ready.empty())
+        return false;
+    slide = std::move(injected_ready.front().first);
+    erase = injected_ready.front().second;
+    injected_ready.pop_front();
+    injected_pending--;
+    return true;
+}
+
+
+bool SlidePreparer::Unsent(const std::string& filepath)
+{
+    std::lock_guard<std::mutex> lock(unsent_slides_mutex);
+    return unsent_slides.count(filepath) > 0;
+}
+
+
+void SlidePreparer::SlideDone(const std::string& filepath, bool sent)
+{
+    if (!erase_after_tx)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(unsent_slides_mutex);
+        unsent_slides.erase(filepath);
+    }
+    if (sent && unlink(filepath.c_str()))
+        perror(("ODR-PadEnc Error: erasing file '" + filepath +"' failed").c_str());
 }
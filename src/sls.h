@@ -31,7 +31,10 @@
 #define SLS_H_
 
 #include "common.h"
+#include "memory_budget.h"
 #include "pad_common.h"
+#include "spsc_queue.h"
+#include "reread_watcher.h"
 
 #if HAVE_MAGICKWAND
 #  if HAVE_MAGICKWAND_LEGACY
@@ -42,11 +45,21 @@
 #endif
 
 #include <dirent.h>
+#include <time.h>
 #include <sys/stat.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <deque>
 #include <fstream>
 #include <iostream>
+#include <functional>
 #include <list>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
 #include <algorithm>
 
 
@@ -102,6 +115,9 @@ struct slide_metadata_t {
 /*! A simple fingerprint for each slide transmitted.
  * Allows us to reuse the same fidx if the same slide
  * is transmitted more than once.
+ *
+ * The content hash is only computed by a History with content hashing, once
+ * the file attributes no longer match.
  */
 struct fingerprint_t {
     // file name
@@ -114,6 +130,9 @@ struct fingerprint_t {
     // assigned fidx, -1 means invalid
     int fidx;
 
+    // hash of the file content, 0 if not computed
+    uint64_t s_content_hash = 0;
+
     /*! The comparison is not done on fidx, only
      * on the file-specific data
      */
@@ -127,12 +146,15 @@ struct fingerprint_t {
         printf("%s_%ld_%lu:%d\n", s_name.c_str(), s_size, s_mtime, fidx);
     }
 
-    void load_from_file(const char* filepath)
+    // returns false, if the file attributes could not be retrieved
+    bool load_from_file(const char* filepath)
     {
         struct stat file_attribue;
         const char * final_slash;
 
-        stat(filepath, &file_attribue);
+        bool stat_ok = stat(filepath, &file_attribue) == 0;
+        if (!stat_ok)
+            memset(&file_attribue, 0, sizeof(file_attribue));
         final_slash = strrchr(filepath, '/');
 
         // load filename, size and mtime
@@ -142,6 +164,9 @@ struct fingerprint_t {
         this->s_mtime = file_attribue.st_mtime;
 
         this->fidx = -1;
+        this->s_content_hash = 0;
+
+        return stat_ok;
     }
 };
 
@@ -151,52 +176,345 @@ struct fingerprint_t {
  * identical slides with the same index, in case the receivers cache
  * them.
  *
- * \c MAXHISTORYLEN defines for how how many slides we want to keep this
- * history.
+ * The history holds up to \c hist_size fingerprints (by default
+ * \c MAXHISTORYLEN); when full, the least recently used one is dropped.
+ * The fingerprints are found by means of a hash index, and all storage
+ * is allocated once on construction.
+ *
+ * With content hashing, a file whose attributes changed (e.g. as it was
+ * copied again) is hashed and keeps its fidx, if its content and name are
+ * those of a fingerprint in the history.
  */
 class History {
     public:
+        static const size_t MAXHISTORYLEN;
+        static const int    MAXSLIDEID;
+
         History() : History(MAXHISTORYLEN) {}
-        History(size_t hist_size) :
-            m_hist_size(hist_size),
-            m_last_given_fidx(0) {}
+        History(size_t hist_size);
         void disp_database();
+        void set_content_hashing(bool enabled) {m_content_hashing = enabled;}
         // controller of id base on database
         int get_fidx(const char* filepath);
+        /*! filepath: of the file fp was loaded from, to hash it (with content
+         *  hashing); by_content: set, if found by its content only
+         */
+        int get_fidx(const fingerprint_t& fp, const char* filepath = NULL, bool* by_content = NULL);
+
+        size_t size() const {return m_count;}
+        // the storage allocated on construction (excl. the file names)
+        static size_t allocated_bytes(size_t hist_size);
+
+        // counts the changes, to decide whether the history must be saved
+        unsigned long changes() const {return m_changes;}
+        // the fingerprints, least recently used first
+        std::vector<fingerprint_t> get_entries() const;
+        int get_last_given_fidx() const {return m_last_given_fidx;}
+        // replaces the history with previously retrieved state
+        void restore(const std::vector<fingerprint_t>& entries, int last_given_fidx);
 
     private:
-        static const size_t MAXHISTORYLEN;
-        static const int    MAXSLIDEID;
+        static const int NONE;
+
+        struct entry_t {
+            fingerprint_t fp;
+            size_t hash;
+            // neighbours in least recently used order
+            int older;
+            int newer;
+        };
 
-        std::deque<fingerprint_t> m_database;
+        std::vector<entry_t> m_entries;
+        std::vector<int> m_index;   // open addressing (linear probing): entry or NONE
+        size_t m_index_mask;
+        size_t m_count;
+        int m_oldest;
+        int m_newest;
 
         size_t m_hist_size;
 
         int m_last_given_fidx;
+        unsigned long m_changes;
+        bool m_content_hashing;
+
+        static size_t hash(const fingerprint_t& fp);
+        static size_t index_size(size_t hist_size);
+        // 0, if the file cannot be read
+        static uint64_t content_hash(const char* filepath);
 
-        // find the fingerprint fp in database.
+        void unlink_entry(int entry);
+        void link_newest(int entry);
+        void index_insert(int entry);
+        void index_remove(int entry);
+
+        // find the fingerprint fp in database and mark it as used.
         // returns the fidx when found,
         //    or   -1 if not found
-        int find(const fingerprint_t& fp) const;
+        int find(const fingerprint_t& fp);
+        /*! same as find(), but by name, size and content hash; the found
+         *  fingerprint takes over the other attributes of fp
+         */
+        int find_content(const fingerprint_t& fp);
+
+        // add a new fingerprint into database,
+        // dropping the least recently used one if full
+        void add(const fingerprint_t& fp, int fidx);
+};
+
+
+// --- ChangeCoalescer -----------------------------------------------------------------
+// the quiet window and the maximum delay of a ChangeCoalescer; a quiet window of 0 disables it
+struct change_settle_t {
+    std::chrono::milliseconds quiet{0};
+    std::chrono::milliseconds max_delay{5000};
+};
+
+/*! Coalesces a burst of changes (e.g. a deployment replacing hundreds of
+ * slides within a second) into one: the changes are due once none followed
+ * for the quiet window, but at the latest the maximum delay after the first
+ * one. Without a quiet window, each change is due at once.
+ */
+class ChangeCoalescer {
+private:
+    change_settle_t settle;
+    bool pending;
+    std::chrono::steady_clock::time_point first;
+    std::chrono::steady_clock::time_point last;
+public:
+    ChangeCoalescer() : pending(false) {}
+
+    void SetSettle(const change_settle_t& settle) {this->settle = settle;}
+    // parses QUIET[,MAX] (milliseconds); false, if invalid
+    static bool ParseSettle(const std::string& spec, change_settle_t& settle);
+
+    void Note(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) {
+        if (!pending)
+            first = now;
+        last = now;
+        pending = true;
+    }
+    bool Pending() const {return pending;}
+    void Clear() {pending = false;}
+    // whether the noted changes are due; if so, they count as taken
+    bool TakeDue(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) {
+        if (!pending || (now - last < settle.quiet && now - first < settle.max_delay))
+            return false;
+        pending = false;
+        return true;
+    }
+};
+
+
+// --- SlideDirWatcher -----------------------------------------------------------------
+/*! Keeps track of the slides in a directory and their fingerprints.
+ *
+ * On Linux, the directory is watched by means of inotify, so that only
+ * changed files have to be examined again. Otherwise (or if inotify is
+ * not available), the directory is scanned completely on each update.
+ *
+ * The changes are taken over in bursts (see ChangeCoalescer), so that a
+ * deployment of many files is applied as a whole - meanwhile, the files
+ * stay as before.
+ */
+class SlideDirWatcher {
+private:
+    std::string dir;
+    int inotify_fd;     // -1, if not watching
+    std::map<std::string, fingerprint_t> files;     // in alphabetical order
+    ChangeCoalescer coalescer;
+    std::set<std::string> changed_files;    // of the burst not taken over yet
+    bool rescan;        // of the burst, as events were lost
+
+    SlideDirWatcher(const SlideDirWatcher&);
+    SlideDirWatcher& operator=(const SlideDirWatcher&);
+
+    void StopWatching();
+    bool Scan();
+    void UpdateFile(const std::string& name);
+    bool ProcessEvents();
+public:
+    SlideDirWatcher() : inotify_fd(-1), rescan(false) {}
+    ~SlideDirWatcher() {StopWatching();}
+
+    void SetSettle(const change_settle_t& settle) {coalescer.SetSettle(settle);}
 
-        // add a new fingerprint into database
-        // returns its fidx
-        void add(fingerprint_t& fp);
+    // starts watching a (new) directory; false, if it cannot be read
+    bool Watch(const std::string& dir);
+    // brings the files up to date; false, if the directory cannot be read
+    bool Update();
+
+    const std::string& GetDir() const {return dir;}
+    bool Watching() const {return inotify_fd != -1;}
+    // whether a burst of changes is not taken over yet
+    bool Settling() const {return coalescer.Pending();}
+    const std::map<std::string, fingerprint_t>& GetFiles() const {return files;}
+};
+
+
+// --- SlideDirCursor -----------------------------------------------------------------
+/*! Walks through a directory in chunks, in directory order, without ever
+ * holding more than a chunk of entries - so that an archive-style slides dir
+ * with a huge number of files costs neither memory nor startup time.
+ *
+ * The position is a cookie of the filesystem (the d_off of getdents64),
+ * which can be saved and restored across runs; it stays valid as long as
+ * the directory exists. Only supported on Linux.
+ */
+class SlideDirCursor {
+private:
+    static const size_t CHUNK_SIZE;     // bytes read from the directory at once
+
+    std::string dir;
+    int dir_fd;         // -1, if not open
+    std::vector<char> chunk;
+    size_t chunk_len;
+    size_t chunk_pos;
+    uint64_t position;  // after the last returned entry
+
+    SlideDirCursor(const SlideDirCursor&);
+    SlideDirCursor& operator=(const SlideDirCursor&);
+
+    // 1, if read; 0 at the end of the directory; -1 on error
+    int ReadChunk();
+public:
+    SlideDirCursor() : dir_fd(-1), chunk_len(0), chunk_pos(0), position(0) {}
+    ~SlideDirCursor() {Close();}
+
+    // false, if the directory cannot be opened
+    bool Open(const std::string& dir);
+    void Close();
+    const std::string& GetDir() const {return dir;}
+
+    /*! appends the names of up to count slide files following the position,
+     *  continuing at the start of the directory once at its end; false on error
+     */
+    bool Next(size_t count, std::vector<std::string>& names);
+    uint64_t GetPosition() const {return position;}
+    void Seek(uint64_t position);
+};
+
+
+// --- slide_schedule_params_t -----------------------------------------------------------------
+/*! How a slide is scheduled, as given in its slide params file (keys
+ * Priority, Weight, Expires and MinRepeat); by default, each slide is sent
+ * once per cycle through the slides dir.
+ */
+struct slide_schedule_params_t {
+    int priority = 0;           // higher tiers first; above 0 (urgent), also added to the current cycle
+    unsigned int weight = 1;    // occurrences per cycle, spread over it
+    time_t expires = 0;         // not sent anymore from then on; 0: never
+    int min_repeat = 0;         // seconds between two occurrences; 0: none
+};
+
+
+// --- SlideSchedule -----------------------------------------------------------------
+/*! The slides of a cycle as an indexed binary heap: next is the slide of
+ * the highest priority, then of the lowest pass (so that the occurrences of
+ * a slide are spread by its weight), then of the lowest fidx. The index
+ * allows a slide to be replaced or removed by its path at once.
+ */
+class SlideSchedule {
+public:
+    struct entry_t {
+        slide_metadata_t md;
+        slide_schedule_params_t params;
+        unsigned int remaining;     // occurrences in this cycle
+        double pass;                // of the next occurrence, from 0 to 1 over the cycle
+    };
+private:
+    std::vector<entry_t> heap;
+    std::map<std::string, size_t> index;    // by path
+
+    static bool Before(const entry_t& a, const entry_t& b);
+    void Swap(size_t a, size_t b);
+    void SiftUp(size_t i);
+    void SiftDown(size_t i);
+    void RemoveAt(size_t i);
+public:
+    // replaces a slide of the same path
+    void Push(const slide_metadata_t& md, const slide_schedule_params_t& params);
+    bool Remove(const std::string& filepath);
+    void Clear() {heap.clear(); index.clear();}
+
+    bool Empty() const {return heap.empty();}
+    size_t Size() const {return heap.size();}
+    bool Contains(const std::string& filepath) const {return index.count(filepath);}
+    // pre-condition: not empty
+    const entry_t& Top() const {return heap.front();}
+    // the top slide's occurrence is done (taken or skipped); the slide is removed after its last one
+    void Advance();
 };
 
 
 // --- SlideStore -----------------------------------------------------------------
+/*! The slides of the slides dir, in cycles: each (re-)reading of the dir
+ * starts a cycle, in which every slide is taken as scheduled by its params
+ * (see slide_schedule_params_t). Meanwhile, an urgent slide added to the
+ * dir (or changed) is taken next, without waiting for the cycle to end, if
+ * the dir is watched by inotify.
+ *
+ * In streaming mode (see SetStreaming()), a cycle only covers the next
+ * window of the dir instead.
+ */
 class SlideStore {
 private:
-    std::list<slide_metadata_t> slides;
+    struct schedule_memo_t {
+        unsigned long mtime;    // of the params file, 0 if not present
+        slide_schedule_params_t params;
+    };
+
+    std::list<slide_metadata_t> slides;     // of the current cycle, in fidx order
+    SlideSchedule schedule;
+    bool cycle_active = false;
+    std::map<std::string, fingerprint_t> scheduled;     // files (by name) of the current cycle, as when scheduled
+    std::map<std::string, std::chrono::steady_clock::time_point> last_taken;    // by path
+    std::map<std::string, schedule_memo_t> schedule_memo;   // by path
     History history;
+    SlideDirWatcher watcher;
+    size_t window = 0;          // streaming: slides per cycle; 0: the whole dir
+    std::string cursor_file;    // streaming: to keep the position in; empty: none
+    SlideDirCursor cursor;
+    ChangeCoalescer reread;     // of the requests to reread the slides
+
+    const slide_schedule_params_t& GetScheduleParams(const std::string& filepath);
+    bool InitFromCursor(const std::string& dir);
+    void LoadCursorPosition();
+    void SaveCursorPosition();
+    void Refresh();
+    void Prune();
 
-    static int FilterSlides(const struct dirent* file);
 public:
+    SlideStore() {}
+    SlideStore(size_t history_len) : history(history_len) {}
+
+    // see History::set_content_hashing()
+    void SetContentHashing(bool enabled) {history.set_content_hashing(enabled);}
+
+    History& GetHistory() {return history;}
+    static bool IsSlideFilename(const std::string& name);
+    // whether the slide params file key is about scheduling, i.e. not a MOT parameter
+    static bool IsScheduleParam(const std::string& key);
+    // parses a scheduling key/value of a slide params file into params; false, if invalid
+    static bool ParseScheduleParam(const std::string& key, const std::string& value, slide_schedule_params_t& params);
+
+    /*! instead of the whole slides dir, each cycle only takes the next window
+     *  of slides (in directory order), keeping the position in the cursor file
+     *  (if any) across runs; urgent slides then wait for their window, too
+     */
+    void SetStreaming(size_t window, const std::string& cursor_file);
     bool InitFromDir(const std::string& dir);
+    // coalesces bursts of slide changes and of reread requests
+    void SetSettle(const change_settle_t& settle);
+    // a new cycle starts, once the requests settled (see ChangeCoalescer) and are taken
+    void RequestReread() {reread.Note();}
+    // clears the store, if a reread is due; whether it was
+    bool TakeReread();
 
-    bool Empty() {return slides.empty();}
-    void Clear() {slides.clear();}
+    // whether the current cycle is over; first takes over urgent slides
+    bool Empty();
+    void Clear();
+    const std::list<slide_metadata_t>& GetSlides() const {return slides;}
+    // pre-condition: not Empty()
     slide_metadata_t GetSlide();
 };
 
@@ -213,47 +531,886 @@ private:
     void AddExtensionFixedSize(int pli, int param_id, const uint8_t* data_field, size_t data_field_len);
     void AddExtensionVarSize(int param_id, const uint8_t* data_field, size_t data_field_len);
 public:
-    MOTHeader(size_t body_size, int content_type, int content_subtype);
+    // reserves room for extensions of up to extensions_len bytes, so that they are added without reallocation
+    MOTHeader(size_t body_size, int content_type, int content_subtype, size_t extensions_len = 0);
 
     void AddExtension(int param_id, const uint8_t* data_field, size_t data_field_len);
-    const uint8_vector_t GetData() {return data;}
+    const uint8_vector_t& GetData() const {return data;}
+
+    // bytes an extension takes in the header
+    static size_t ExtensionSize(size_t data_field_len);
+};
+
+
+// --- mot_params_t -----------------------------------------------------------------
+/*! The MOT header extensions of a slide params file, as parsed for the
+ * last MOT header created with it, together with that header.
+ */
+struct mot_params_t {
+    struct extension_t {
+        int param_id;
+        uint8_vector_t data_field;
+    };
+
+    unsigned long mtime;    // of the params file, 0 if not present
+    std::vector<extension_t> extensions;
+
+    // the last header
+    size_t blobsize;
+    int fidx;
+    bool jfif_not_png;
+    uint8_vector_t mothdr;
+};
+
+
+// --- injected_slide_t -----------------------------------------------------------------
+/*! A slide handed over out of turn (e.g. over the control socket), to be
+ * sent before the slides of the slides dir.
+ */
+struct injected_slide_t {
+    std::string filepath;
+    bool erase;         // once sent or failed, e.g. a temporary file
+};
+
+
+// --- MappedFile -----------------------------------------------------------------
+/*! A file mapped read-only into memory.
+ *
+ * A mapped file must not be truncated while it is in use - it should be
+ * replaced by renaming a new file over it.
+ */
+class MappedFile {
+private:
+    void* map;
+    size_t map_len;
+
+    MappedFile(void* map, size_t map_len) : map(map), map_len(map_len) {}
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+public:
+    ~MappedFile();
+
+    // returns NULL on error
+    static std::shared_ptr<const MappedFile> Open(const std::string& fname, bool quiet_if_missing);
+
+    const uint8_t* Data() const {return (const uint8_t*) map;}
+    size_t Size() const {return map_len;}
+};
+
+
+// --- SlideBlob -----------------------------------------------------------------
+/*! The final image data of a slide, either held in memory or referenced
+ * within a mapped file (the slide itself or the slide state file). It is
+ * shared by the prepared slide, the slide cache and the data groups
+ * referencing it, until all of them are done with it.
+ */
+class SlideBlob {
+private:
+    uint8_vector_t buffer;
+    std::shared_ptr<const MappedFile> file;
+    const uint8_t* data;
+    size_t len;
+
+    SlideBlob(const SlideBlob&);
+    SlideBlob& operator=(const SlideBlob&);
+public:
+    SlideBlob() : data(nullptr), len(0) {}
+    SlideBlob(const uint8_t* data, size_t len) : buffer(data, data + len), data(buffer.data()), len(len) {}
+    // takes over the buffer without copying
+    explicit SlideBlob(uint8_vector_t&& buffer) : buffer(std::move(buffer)), data(this->buffer.data()), len(this->buffer.size()) {}
+    SlideBlob(const std::shared_ptr<const MappedFile>& file, size_t offset, size_t len) :
+        file(file), data(file->Data() + offset), len(len) {}
+
+    // returns NULL on error
+    static std::shared_ptr<const SlideBlob> MapFile(const std::string& fname);
+
+    const uint8_t* Data() const {return data;}
+    size_t Size() const {return len;}
+};
+
+typedef std::shared_ptr<const SlideBlob> slide_blob_t;
+
+
+// --- SlideBlobStore -----------------------------------------------------------------
+/*! Blobs by their content, so that each distinct content is held in memory
+ * once, however often (and by whichever part) it is added - e.g. as content
+ * item data, as a processed image and in the data groups of its MOT object.
+ *
+ * The store only refers to the blobs weakly: a blob is gone once its last
+ * user is done with it. Renditions derived from a source (e.g. an image
+ * transcoded for a service) are found by a key for the source and the
+ * derivation, as long as they are held anywhere.
+ *
+ * Threads bound to a NUMA node (see ThreadPlacement) get a store of their
+ * node, so that the blobs of its services are not shared across nodes.
+ */
+class SlideBlobStore {
+private:
+    std::mutex mutex;
+    std::unordered_map<uint64_t, std::weak_ptr<const SlideBlob>> blobs;     // by content hash
+    std::unordered_map<std::string, std::weak_ptr<const SlideBlob>> renditions;
+    size_t prune_size;      // the maps are cleared of expired blobs when they reach it
+
+    void Prune();
+public:
+    SlideBlobStore() : prune_size(64) {}
+
+    // of the calling thread's NUMA node
+    static SlideBlobStore& Global();
+
+    // the blob of the same content, if held anywhere; otherwise the given one, from now on
+    slide_blob_t Intern(const slide_blob_t& blob);
+    slide_blob_t Intern(uint8_vector_t&& data) {return Intern(std::make_shared<const SlideBlob>(std::move(data)));}
+    slide_blob_t Intern(const uint8_t* data, size_t len);
+
+    // the rendition of the key (NULL, if not held anywhere)
+    slide_blob_t FindRendition(const std::string& key);
+    // interns the rendition and makes it the one of the key; returns the interned one
+    slide_blob_t AddRendition(const std::string& key, const slide_blob_t& rendition);
+
+    // distinct blobs held (or expired, but not pruned yet)
+    size_t Count();
+};
+
+
+// --- MOTDirectory -----------------------------------------------------------------
+/*! The objects of a MOT directory (EN 301 234, ch. 6.2.2), i.e. the
+ * recently sent slides with their TransportIds and MOT headers. Sent in MOT
+ * directory mode instead of a header per slide, so that receivers keep the
+ * slides of the carousel in their cache across rotations - and the body of
+ * an unchanged slide need not be sent each time.
+ *
+ * A changed directory gets a new TransportId, so that receivers take it
+ * over as a whole.
+ */
+class MOTDirectory {
+private:
+    struct object_t {
+        int tid;
+        uint8_vector_t header;
+        slide_blob_t body;
+        size_t skipped;     // times the body was not sent since it was last sent
+    };
+
+    std::list<object_t> objects;    // most recently added first
+    size_t max_objects;
+    unsigned version;
+    slide_blob_t data;      // of the current version, if built already
+    size_t data_segment_size;
+public:
+    static const int TID_BASE;      // directory TransportIds are beyond the slide IDs
+
+    MOTDirectory(size_t max_objects = 0) : max_objects(max_objects), version(0), data_segment_size(0) {}
+
+    // 0 disables the directory mode
+    bool Enabled() const {return max_objects > 0;}
+    size_t Count() const {return objects.size();}
+    int TransportId() const {return TID_BASE + version % 0x1000;}
+
+    /*! adds (or updates) an object, dropping the least recently added one if
+     *  there are more than max_objects; returns whether its body must be
+     *  sent, i.e. if it is new or changed, or once every body_interval times
+     *  for receivers tuning in (0: never again)
+     */
+    bool Add(int tid, const uint8_vector_t& header, const slide_blob_t& body, size_t body_interval);
+    void Clear();
+
+    // the directory object (EN 301 234, ch. 6.2.2.1), for bodies of segment_size bytes per segment
+    slide_blob_t Build(size_t segment_size);
+};
+
+
+// --- MOTObjectBuilder -----------------------------------------------------------------
+/*! Segments MOT objects (header and body) into MSC data groups (each with
+ * its DGLI) and queues them on a packetizer, keeping the continuity indices
+ * of header and body segments across objects.
+ *
+ * The header and body are referenced within their blobs, i.e. the DGs only
+ * hold the MSC DG header and CRC, the segment data is not copied.
+ */
+class MOTObjectBuilder {
+private:
+    PADPacketizer* packetizer;
+    int apptype_start;
+    int apptype_cont;
+    int cindex_header;
+    int cindex_body;
+    int cindex_directory;
+    int cindex_header_sent;     // of the last (non repeated) MOT header
+    size_t seglen;
+    size_t header_repetition;
+    std::vector<int> header_positions;
+
+    void createMscDG(MSCDG* msc, unsigned short int dgtype,
+            int *cindex, unsigned short int segnum, unsigned short int lastseg,
+            unsigned short int tid, const uint8_t* data,
+            unsigned short int datalen);
+    DATA_GROUP* packMscDG(MSCDG* msc, const slide_blob_t& blob);
+    void queueDG(DATA_GROUP* mscdg, bool fill);
+    // queues the segments of a body or a directory, repeating the header (if any) in between
+    void queueSegments(unsigned short int dgtype, int* cindex, const slide_blob_t& data, int tid, const slide_blob_t& header,
+                       std::function<void(bool)> done_handler, bool fill);
+public:
+    MOTObjectBuilder(PADPacketizer* packetizer, int apptype_start, int apptype_cont, size_t seglen) :
+        packetizer(packetizer), apptype_start(apptype_start), apptype_cont(apptype_cont),
+        cindex_header(0), cindex_body(0), cindex_directory(0), cindex_header_sent(0), seglen(seglen), header_repetition(0) {}
+
+    void SetSegmentLength(size_t len) {seglen = len;}
+    size_t GetSegmentLength() const {return seglen;}
+    // queues on another packetizer from now on, e.g. for a copy of the builder
+    void SetPacketizer(PADPacketizer* packetizer) {this->packetizer = packetizer;}
+    // repeats the MOT header after every COUNT body segments (0: never)
+    void SetHeaderRepetition(size_t count) {header_repetition = count;}
+    /*! also repeats the MOT header before these body segments (from 0; a
+     *  negative one counts from the end, i.e. -1 is the last segment)
+     */
+    void SetHeaderPositions(const std::vector<int>& positions) {header_positions = positions;}
+    // parses comma separated body segment positions, e.g. "1,-1"; false, if invalid
+    static bool ParseHeaderPositions(const std::string& spec, std::vector<int>& positions);
+
+    /*! queues the header segment; a repeated header keeps its continuity
+     *  index, as it has the same content as the last one (EN 300 401, ch. 5.3.3.1);
+     *  if fill, as background fill (see PADPacketizer::AddFillDG)
+     */
+    void QueueHeader(const slide_blob_t& header, int tid, bool repetition, bool fill = false);
+    /*! queues the header and the body segments; done_handler: set on the
+     *  last body segment, which completes the object (see DATA_GROUP); fill
+     *  as above
+     */
+    void QueueObject(const slide_blob_t& header, const slide_blob_t& body, int tid, bool repetition,
+                     std::function<void(bool)> done_handler = nullptr, bool fill = false);
+    // MOT directory mode: queues the body segments only, as the header is part of the directory
+    void QueueBody(const slide_blob_t& body, int tid, std::function<void(bool)> done_handler = nullptr, bool fill = false);
+    // queues the segments of a MOT directory (see MOTDirectory)
+    void QueueDirectory(const slide_blob_t& directory, int tid, std::function<void(bool)> done_handler = nullptr, bool fill = false);
+};
+
+
+// --- slide_cache_entry_t -----------------------------------------------------------------
+/*! The final image blob of an encoded slide, together with the MOT header
+ * that was created for it.
+ */
+struct slide_cache_entry_t {
+    // the source file; fp.fidx is the fidx the MOT header was created for
+    fingerprint_t fp;
+    // parameters the blob was created with
+    bool raw_slide;
+    size_t max_slide_size;
+    // mtime of the slide params file, 0 if not present
+    unsigned long params_mtime;
+
+    bool jfif_not_png;
+    slide_blob_t blob;
+    uint8_vector_t mothdr;
+
+    // to recognise the same slide in another (or a re-exported) file
+    uint64_t content_hash;      // of the source file
+    bool image_hashed;
+    uint64_t image_hash;        // difference hash of the source image, if image_hashed
+    unsigned violations;        // see SLSEncoder::CheckCompliance(), checked once when encoded
+
+    unsigned spill_segment;     // of the SlideSpill the blob is mapped from; 0: in memory
+
+    slide_cache_entry_t() : content_hash(0), image_hashed(false), image_hash(0), violations(0), spill_segment(0) {}
+
+    size_t Size() const {return blob->Size() + mothdr.size();}
+};
+
+
+// --- prepared_slide_t -----------------------------------------------------------------
+/*! A slide whose image has been processed, ready to be segmented into
+ * data groups.
+ */
+struct prepared_slide_t {
+    std::string filepath;
+    int fidx;
+    slide_blob_t blob;
+    uint8_vector_t mothdr;
+    unsigned violations = 0;    // see SLSEncoder::CheckCompliance()
+};
+
+
+// --- SlideFrequency -----------------------------------------------------------------
+/*! Estimates how often slides were used recently (TinyLFU), in a count-min
+ * sketch of 4-bit counters, so that the slide cache only lets a slide
+ * displace one from memory that is used less often - a single pass over
+ * many slides used once then cannot flush the carousel.
+ *
+ * All counters are halved after a number of uses, so that the estimates
+ * follow a changing carousel.
+ */
+class SlideFrequency {
+private:
+    static const size_t WIDTH = 1024;   // counters per row
+    static const size_t DEPTH = 4;
+    static const size_t RESET_USES = 10 * WIDTH;
+
+    uint8_t counters[DEPTH * WIDTH / 2];
+    size_t uses;
+
+    static size_t Index(uint64_t key, size_t row);
+    int Get(size_t i) const {return (counters[i / 2] >> (i % 2 * 4)) & 0x0F;}
+public:
+    SlideFrequency() {Clear();}
+
+    void Record(uint64_t key);
+    int Estimate(uint64_t key) const;
+    void Clear();
+};
+
+
+// --- SlideSpill -----------------------------------------------------------------
+/*! The warm tier of the slide cache: slides evicted from memory are appended
+ * to a segment file on local storage (e.g. an SSD) and mapped from there,
+ * so that they need not be processed again, but only take page cache, which
+ * the kernel reclaims when memory is needed.
+ *
+ * There are two segments of half the spill size each. Once the current one
+ * is full, the older one is dropped (with the slides in it) and a new one is
+ * started. A segment file is unlinked right after it was created, so that
+ * nothing is left behind; a slide mapped from it stays valid until its last
+ * user is done with it.
+ */
+class SlideSpill {
+private:
+    std::string dir;
+    size_t segment_size;
+    int fd;             // of the current segment, -1 if none
+    std::shared_ptr<const MappedFile> segment;
+    size_t used;        // bytes appended to the current segment
+    unsigned segment_id;    // of the current segment, from 1
+
+    SlideSpill(const SlideSpill&) = delete;
+    SlideSpill& operator=(const SlideSpill&) = delete;
+
+    bool Rotate();
+public:
+    static const size_t DEFAULT_SIZE;
+
+    // an empty dir disables the spill
+    SlideSpill(const std::string& dir = "", size_t size = DEFAULT_SIZE);
+    ~SlideSpill();
+
+    bool Enabled() const {return !dir.empty() && segment_size > 0;}
+    size_t Capacity() const {return Enabled() ? 2 * segment_size : 0;}
+    // the current segment; the slides of older ones than the previous one are dropped
+    unsigned Segment() const {return segment_id;}
+
+    /*! appends the slide; returns it mapped from the current segment (and
+     *  sets *segment to it), or NULL on error
+     */
+    slide_blob_t Append(const slide_blob_t& blob, unsigned* segment);
+};
+
+
+// --- SlideCache -----------------------------------------------------------------
+/*! Keeps already encoded slides, so that an unchanged slide can be
+ * queued again without processing the image once more.
+ *
+ * When the total size exceeds \c max_size, the least recently used
+ * slides are dropped. A \c max_size of 0 disables the cache.
+ *
+ * With a SlideSpill, the slides are moved there instead (the warm tier) and
+ * moved back into memory when used again. A new or a spilled slide then only
+ * replaces slides in memory if it is used more often than the least recently
+ * used one (see SlideFrequency), otherwise it stays in the spill.
+ */
+class SlideCache {
+private:
+    std::list<slide_cache_entry_t> entries;    // in memory, most recently used first
+    std::list<slide_cache_entry_t> warm;       // spilled, most recently used first
+    size_t max_size;
+    size_t size;                // of the entries in memory
+    unsigned long changes;
+    MemoryAccount* account;
+    std::unique_ptr<SlideSpill> spill;
+    SlideFrequency frequency;
+
+    void ReportSize() {if (account) account->Update(size);}
+    static uint64_t FrequencyKey(const slide_cache_entry_t& entry);
+    // whether the entry may displace the least recently used one(s) in memory
+    bool Admit(const slide_cache_entry_t& entry) const;
+    // moves the least recently used entry in memory to the spill (or drops it)
+    void Evict();
+    // moves an entry of tier (or of a list of its own) to the spill, as the most recently used one there, or drops it
+    void Spill(std::list<slide_cache_entry_t>& tier, std::list<slide_cache_entry_t>::iterator it);
+    // drops an entry of either tier
+    void Erase(std::list<slide_cache_entry_t>& tier, std::list<slide_cache_entry_t>::iterator it);
+    // records the use of the entry and makes it the most recently used one
+    slide_cache_entry_t* Use(std::list<slide_cache_entry_t>& tier, std::list<slide_cache_entry_t>::iterator it);
+    template<typename Match>
+    slide_cache_entry_t* FindMatch(Match match);
+public:
+    static const size_t DEFAULT_MAX_SIZE;
+
+    SlideCache(size_t max_size) : max_size(max_size), size(0), changes(0), account(nullptr) {}
+
+    bool Enabled() const {return max_size > 0;}
+    size_t MaxSize() const {return max_size;}
+    // including the spill
+    size_t Capacity() const {return max_size + (spill ? spill->Capacity() : 0);}
+    size_t Size() const {return size;}
+    size_t Count() const {return entries.size() + warm.size();}
+    size_t SpilledCount() const {return warm.size();}
+    // counts the changes (except for reordering), to decide whether the cache must be saved
+    unsigned long Changes() const {return changes;}
+    const std::list<slide_cache_entry_t>& GetEntries() const {return entries;}
+    const std::list<slide_cache_entry_t>& GetSpilledEntries() const {return warm;}
+
+    // spills the slides evicted from memory to dir (see SlideSpill), from now on
+    void SetSpill(const std::string& dir, size_t size);
+
+    // returns the matching entry (or NULL), which becomes the most recently used one
+    slide_cache_entry_t* Find(const fingerprint_t& fp, bool raw_slide, size_t max_slide_size);
+    // same as Find(), but by the source file content
+    slide_cache_entry_t* FindContent(uint64_t content_hash, bool raw_slide, size_t max_slide_size);
+    // same as Find(), but the image hash closest to (and at most max_distance bits away from) the given one
+    slide_cache_entry_t* FindSimilar(uint64_t image_hash, int max_distance, bool raw_slide, size_t max_slide_size);
+    // assigns an entry to another source file
+    void UpdateSource(slide_cache_entry_t* entry, const fingerprint_t& fp);
+    void Insert(const slide_cache_entry_t& entry);
+    void UpdateHeader(slide_cache_entry_t* entry, const uint8_vector_t& mothdr, int fidx, unsigned long params_mtime);
+    void Clear() {entries.clear(); warm.clear(); frequency.Clear(); size = 0; changes++; ReportSize();}
+
+    // reports the size to the account from now on, which may have slides evicted under memory pressure
+    void SetMemoryAccount(MemoryAccount* account) {this->account = account; ReportSize();}
+    /*! drops (or spills) the least recently used slides until at most target
+     *  bytes are left in memory, but keeps the most recently used one; returns
+     *  the size
+     */
+    size_t Shrink(size_t target);
+};
+
+
+// --- SharedSlideStore -----------------------------------------------------------------
+/*! Encoded slides in a directory shared by all encoder instances of a host
+ * (e.g. on /dev/shm), so that the same image is only processed once for
+ * the same maximum slide size, even by instances of other services.
+ *
+ * An encoded slide is named after the content hash of its source file, the
+ * maximum slide size and its format. It is written under a temporary name
+ * and renamed into place, so that the instances can map it read-only
+ * while others add further slides. Stale slides can be deleted at any time.
+ */
+class SharedSlideStore {
+private:
+    std::string dir;
+    bool local_copies;
+
+    std::string Path(uint64_t content_hash, size_t max_slide_size, bool jfif_not_png) const;
+public:
+    /*! An empty dir disables the store. With local copies, the slides are
+     *  held in memory of the calling thread (i.e. its NUMA node) instead of
+     *  being mapped from the store, which may be in another node's memory.
+     */
+    SharedSlideStore(const std::string& dir = "", bool local_copies = false);
+
+    bool Enabled() const {return !dir.empty();}
+    const std::string& Dir() const {return dir;}
+
+    // returns the slide (or NULL), mapped from the store (or copied from there)
+    slide_blob_t Find(uint64_t content_hash, size_t max_slide_size, bool* jfif_not_png) const;
+    /*! adds the slide to the store; returns it mapped from there, or the
+     *  given one if that failed (or with local copies)
+     */
+    slide_blob_t Add(uint64_t content_hash, size_t max_slide_size, bool jfif_not_png, const slide_blob_t& blob) const;
+};
+
+
+// --- SlideDumper -----------------------------------------------------------------
+/*! Writes the dumps of the slide being transmitted and moves them on once
+ * it has been transmitted, in a background thread, so that the file I/O
+ * never delays the PAD output. The thread is only started with the first
+ * job.
+ *
+ * A dump is written to a temporary file first and then renamed over the
+ * previous one, so that its readers never see a partly written slide. As
+ * the jobs are done in order, a completion always moves the latest dump.
+ */
+class SlideDumper {
+private:
+    struct job_t {
+        slide_blob_t blob;          // NULL, if a completion
+        std::string path;
+        std::string completed_path; // of a completion
+    };
+
+    std::deque<job_t> jobs;
+    size_t running_jobs;
+    bool stop;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::condition_variable done_cond;
+    std::thread thread;
+
+    SlideDumper(const SlideDumper&) = delete;
+    SlideDumper& operator=(const SlideDumper&) = delete;
+
+    void Queue(job_t&& job);
+    void Run();
+    static void Write(const job_t& job);
+    static void Complete(const job_t& job);
+public:
+    SlideDumper() : running_jobs(0), stop(false) {}
+    // does the jobs queued so far
+    ~SlideDumper();
+
+    void Dump(const std::string& path, const slide_blob_t& blob);
+    // moves the dump at path to completed_path, if there is one
+    void Complete(const std::string& path, const std::string& completed_path);
+    // waits for the jobs queued so far
+    void Flush();
+};
+
+
+// --- magick_limits_t -----------------------------------------------------------------
+/*! ImageMagick's resource limits (see --magick-threads and --magick-limits),
+ * set once after MagickWandGenesis(); 0 keeps ImageMagick's default. Unless
+ * limited, ImageMagick uses as many OpenMP threads as there are cores for
+ * each slide - although slides are small and prepared in parallel anyway.
+ */
+struct magick_limits_t {
+    static const size_t DEFAULT_THREADS;
+
+    size_t threads;
+    size_t memory;      // bytes of pixel cache in memory,
+    size_t map;         // memory-mapped
+    size_t disk;        // and on disk
+
+    magick_limits_t() : threads(DEFAULT_THREADS), memory(0), map(0), disk(0) {}
+
+    // takes over e.g. "memory=64,map=128,disk=512" (MiB); false, if invalid
+    bool Parse(const std::string& limits);
+    void Apply() const;
 };
 
 
+#if HAVE_MAGICKWAND
+// --- MagickWandPool -----------------------------------------------------------------
+/*! The wands used to process slides, reused instead of created and destroyed
+ * for each slide. A wand is cleared when released, which leaves it blank for
+ * the next slide.
+ *
+ * ImageMagick is only initialised (MagickWandGenesis()) with the first wand,
+ * so that an instance without slides to convert - DLS only, or raw slides -
+ * does not wait for it at start.
+ */
+class MagickWandPool {
+private:
+    std::mutex mutex;
+    std::vector<MagickWand*> idle;
+    std::once_flag genesis;
+    std::atomic<bool> initialised;
+    bool configured;
+    magick_limits_t limits;
+    bool verbose;
+    MagickSizeType threads;     // as configured
+    bool single_threaded;       // by the WorkGovernor
+
+    void Initialise();
+public:
+    MagickWandPool() : initialised(false), configured(false), verbose(false), threads(0), single_threaded(false) {}
+    static MagickWandPool& Global();
+
+    // the limits to apply once initialised; without, ImageMagick's own apply
+    void Configure(const magick_limits_t& limits, bool verbose);
+    bool Initialised() const {return initialised;}
+
+    MagickWand* Acquire();
+    void Release(MagickWand* wand);
+    // destroys the idle wands; before MagickWandTerminus()
+    void Clear();
+    // destroys the idle wands and, if initialised, ends ImageMagick
+    void Terminate();
+};
+#endif
+
+
 // --- SLSEncoder -----------------------------------------------------------------
 class SLSEncoder {
 private:
-    static const size_t MAXSEGLEN;
     static const int    MINQUALITY;
-    static const std::string SLS_PARAMS_SUFFIX;
+    static const int    MAXQUALITY;
+    static const size_t QUALITYMEMOLEN;
+    static const size_t PARAMSMEMOLEN;
+    static const size_t MAXPREENCODETHREADS;
 
+    int rememberedQuality(const std::string& fname);
+    void rememberQuality(const std::string& fname, int quality);
     void warnOnSmallerImage(size_t height, size_t width, const std::string& fname);
+    int prepareCompliantImage(const std::string& fname, int fidx, size_t max_slide_size, slide_blob_t& blob, bool* jfif_not_png);
+#if HAVE_LIBJPEG
+    int prepareNativeImage(const std::string& fname, int fidx, size_t max_slide_size, slide_blob_t& blob, bool* jfif_not_png);
+#endif
 #if HAVE_MAGICKWAND
     size_t resizeImage(MagickWand* m_wand, unsigned char** blob, const std::string& fname, bool* jfif_not_png, size_t max_slide_size);
 #endif
     bool parse_sls_param_id(const std::string &key, const std::string &value, uint8_t &target);
     bool check_sls_param_len(const std::string &key, size_t len, size_t len_max);
-    void process_mot_params_file(MOTHeader& header, const std::string &params_fname);
-    uint8_vector_t createMotHeader(size_t blobsize, int fidx, bool jfif_not_png, const std::string &params_fname);
-    void createMscDG(MSCDG* msc, unsigned short int dgtype,
-            int *cindex, unsigned short int segnum, unsigned short int lastseg,
-            unsigned short int tid, const uint8_t* data,
-            unsigned short int datalen);
-    DATA_GROUP* packMscDG(MSCDG* msc);
+    void process_mot_params_file(const std::string &params_fname, std::vector<mot_params_t::extension_t>& extensions);
+    // params_mtime: of the params file, 0 if not present
+    uint8_vector_t createMotHeader(size_t blobsize, int fidx, bool jfif_not_png, const std::string &params_fname, unsigned long params_mtime);
+    void queueMotObject(const prepared_slide_t& slide, bool repetition, std::function<void(bool)> done_handler, bool fill = false);
 
     PADPacketizer* pad_packetizer;
-    int cindex_header;
-    int cindex_body;
+    MOTObjectBuilder mot_builder;
+    MOTDirectory directory;
+    size_t directory_body_interval;
+    SlideCache slide_cache;
+    std::mutex slide_cache_mutex;               // as slides may be prepared by several threads
+    SharedSlideStore shared_store;
+    SlideDumper dumper;
+    std::map<std::string, int> quality_memo;    // JPEG quality that last fit, per slide file
+    std::mutex quality_memo_mutex;
+    std::map<std::string, mot_params_t> params_memo;    // per params file
+    std::mutex params_memo_mutex;
+    int similarity_distance;    // max image hash distance of slides considered the same; -1: exact content only
+    bool format_candidates;
+    bool exhaustive_png;
+    prepared_slide_t last_slide;    // for repetitions
+
+    void hashSource(const std::string& fname, bool raw_slide, slide_cache_entry_t& entry);
+    // prepareSlide(), without the tracepoints
+    bool prepareSlideFile(const std::string& fname, int fidx, bool raw_slides, size_t max_slide_size, prepared_slide_t& slide);
 public:
+    static const size_t MAXSEGLEN;          // default segment length
+    static const size_t MAXSEGLEN_LIMIT;
     static const size_t MAXSLIDESIZE_SIMPLE;
     static const int APPTYPE_MOT_START;
     static const int APPTYPE_MOT_CONT;
     static const std::string REQUEST_REREAD_FILENAME;
 
-    SLSEncoder(PADPacketizer* pad_packetizer) : pad_packetizer(pad_packetizer), cindex_header(0), cindex_body(0) {}
+    // the ways an encoded slide may not comply with the SlideShow Simple Profile (TS 101 499)
+    enum Violation {
+        VIOLATION_SIZE          = 1 << 0,   // larger than the max slide size
+        VIOLATION_DIMENSIONS    = 1 << 1,   // larger than 320x240 (or no readable size)
+        VIOLATION_PROGRESSIVE   = 1 << 2,   // progressive JPEG, which receivers need not support
+        VIOLATION_CONTENT_TYPE  = 1 << 3,   // neither JPEG nor PNG, or not as signalled in the MOT header
+    };
+    /*! checks an encoded slide from its header bytes (see SlideCodec::Probe());
+     *  returns the violations found, 0 if none
+     */
+    static unsigned CheckCompliance(const SlideBlob& blob, bool jfif_not_png, size_t max_slide_size);
+    static std::string DescribeViolations(unsigned violations);
+    static const std::string SLS_PARAMS_SUFFIX;
+
+    SLSEncoder(PADPacketizer* pad_packetizer, size_t cache_size = SlideCache::DEFAULT_MAX_SIZE) :
+        pad_packetizer(pad_packetizer), mot_builder(pad_packetizer, APPTYPE_MOT_START, APPTYPE_MOT_CONT, MAXSEGLEN),
+        directory_body_interval(0), slide_cache(cache_size), similarity_distance(-1), format_candidates(false), exhaustive_png(false) {}
+
+    bool encodeSlide(const std::string& fname, int fidx, bool raw_slides, size_t max_slide_size, const std::string& dump_name,
+                     std::function<void(bool)> done_handler = nullptr);
+
+    /*! encodeSlide() in two steps: prepareSlide() does the image
+     * processing and doesn't touch the packetizer, while queueSlide() only
+     * uses the packetizer. So both may be called from different threads
+     * (and prepareSlide() from several threads at once).
+     */
+    bool prepareSlide(const std::string& fname, int fidx, bool raw_slides, size_t max_slide_size, prepared_slide_t& slide);
+    /*! prepares the slides not in the slide cache yet on several threads,
+     *  as far as they fit into the cache; returns the number of slides prepared
+     */
+    size_t preEncodeSlides(const std::list<slide_metadata_t>& slides, bool raw_slides, size_t max_slide_size, const std::atomic<bool>& stop,
+                           size_t max_threads = MAXPREENCODETHREADS);
+    /*! dump_name: the slide is also written to this file (in the background), if not empty;
+     *  done_handler: called once the whole slide was sent (true) or dropped (false), see DATA_GROUP
+     */
+    void queueSlide(const prepared_slide_t& slide, const std::string& dump_name, std::function<void(bool)> done_handler = nullptr);
+    /*! queues the last queued slide once more, e.g. for receivers that
+     *  tuned in during its transmission - if fill, only as background fill
+     *  (see PADPacketizer::AddFillDG); false, if there is none
+     */
+    bool repeatSlide(bool fill = false);
+    /*! queues a stand-in JPEG slide of body_size bytes on another packetizer
+     *  (e.g. a dry-run copy, see PADPacketizer::DryRunCopy), sent as the
+     *  slides of this encoder would be, but in MOT segments of seglen bytes;
+     *  done_handler as for queueSlide()
+     */
+    void queuePlannedSlide(PADPacketizer* packetizer, size_t body_size, size_t seglen, std::function<void(bool)> done_handler) const;
+
+    // applies to the slides queued from now on
+    void SetSegmentLength(size_t len) {mot_builder.SetSegmentLength(len);}
+    // repeats the MOT header after every COUNT body segments (0: never)
+    void SetHeaderRepetition(size_t count) {mot_builder.SetHeaderRepetition(count);}
+    // see MOTObjectBuilder::SetHeaderPositions()
+    void SetHeaderPositions(const std::vector<int>& positions) {mot_builder.SetHeaderPositions(positions);}
+    size_t GetSegmentLength() const {return mot_builder.GetSegmentLength();}
+    /*! sends the slides in MOT directory mode (see MOTDirectory), with up to
+     *  max_objects slides in the directory (0: header mode); the body of an
+     *  unchanged slide is only sent once every body_interval times (0: never
+     *  again), which receivers keeping it in their cache do not need
+     */
+    void SetDirectoryMode(size_t max_objects, size_t body_interval) {directory = MOTDirectory(max_objects); directory_body_interval = body_interval;}
+    /*! also takes an encoded slide for an image whose difference hash (see
+     *  SlideCodec) differs in at most \c distance bits (-1: only for a file
+     *  of the same content)
+     */
+    void SetSimilarityDistance(int distance) {similarity_distance = distance;}
+    /*! encodes each resized JPEG/PNG slide as PNG (with a palette, if it is
+     *  a graphic) concurrently with the JPEG quality search, and takes the
+     *  smaller one that fits - instead of trying PNG for PNG images only
+     */
+    void SetFormatCandidates(bool enabled) {format_candidates = enabled;}
+    // compresses PNG slides as far as possible, at many times the effort (see SlideCodec::EncodePNG())
+    void SetExhaustivePNG(bool enabled) {exhaustive_png = enabled;}
+    // also takes (and adds) the encoded slides from (to) the store; must not be changed while preparing slides
+    void SetSharedStore(const SharedSlideStore& store) {shared_store = store;}
+    const SharedSlideStore& GetSharedStore() const {return shared_store;}
+    // see SlideCache::SetSpill(); must not be called while preparing slides
+    void SetSlideSpill(const std::string& dir, size_t size) {slide_cache.SetSpill(dir, size);}
+    SlideDumper& GetDumper() {return dumper;}
+
+    /*! Returns the MOT segment length with the least overhead (DGLI, MSC
+     * DG header and CRC, CIs and padding) relative to the body data, as
+     * found by packetizing some segments of each candidate length.
+     * Candidates are limited to about 40 X-PADs per segment, so that a
+     * single corrupted segment does not cost too much.
+     */
+    static size_t OptimalSegmentLength(size_t padlen);
 
-    bool encodeSlide(const std::string& fname, int fidx, bool raw_slides, size_t max_slide_size, const std::string& dump_name);
+    const SlideCache& GetSlideCache() const {return slide_cache;}
+    SlideCache& GetSlideCache() {return slide_cache;}
     static bool isSlideParamFileFilename(const std::string& filename);
+
+    /*! Finds the highest quality in [min_quality, max_quality] for which
+     * \c fits holds, assuming that it holds for all lower qualities, too.
+     * The search starts at \c start_quality (if >= 0), otherwise at
+     * \c max_quality.
+     *
+     * \return the quality, or -1 if not even \c min_quality fits
+     */
+    static int searchQuality(int min_quality, int max_quality, int start_quality, const std::function<bool(int)>& fits);
+};
+
+
+// --- SlideStateFile -----------------------------------------------------------------
+/*! Persists the slide history and the encoded slides of the slide cache,
+ * so that after a restart the already encoded slides are transmitted
+ * again at once (and with the same IDs).
+ *
+ * The file is replaced atomically on each save; when loading, it is
+ * mapped and the slides are referenced in place.
+ *
+ * A slide bundle, as compiled by odr-padenc-bundle ahead of time, is a
+ * file of the same format, which is only loaded.
+ */
+class SlideStateFile {
+private:
+    static const char MAGIC[8];
+    static const uint32_t FORMAT_VERSION;
+
+    std::string path;
+    unsigned long saved_history_changes;
+    unsigned long saved_cache_changes;
+    bool history_replicated;
+    std::vector<fingerprint_t> replicated_entries;
+    int replicated_last_given_fidx;
+
+    size_t LoadFile(History& history, SlideCache& cache);
+public:
+    SlideStateFile(const std::string& path) :
+        path(path), saved_history_changes(0), saved_cache_changes(0), history_replicated(false), replicated_last_given_fidx(0) {}
+
+    bool Enabled() const {return !path.empty();}
+
+    /*! a missing or invalid file is ignored (with a warning, if invalid);
+     *  returns the number of encoded slides loaded
+     */
+    size_t Load(History& history, SlideCache& cache);
+    /*! has Load() restore this history instead of the file's one (even
+     *  without file), e.g. the one replicated from the primary instance
+     */
+    void SetReplicatedHistory(const std::vector<fingerprint_t>& entries, int last_given_fidx) {
+        history_replicated = true;
+        replicated_entries = entries;
+        replicated_last_given_fidx = last_given_fidx;
+    }
+    // returns false on error
+    bool Save(const History& history, const SlideCache& cache);
+    bool SaveIfChanged(const History& history, const SlideCache& cache);
+};
+
+
+// --- SlidePreparer -----------------------------------------------------------------
+/*! Prepares the upcoming slides of the slides dir in a separate thread, so
+ * that a slow image processing never delays the PAD output. Up to
+ * \c lookahead prepared slides are handed over through a lock-free queue.
+ *
+ * Whenever the slides dir is (re-)read, the slides not in the slide cache
+ * yet are encoded on several threads at once, as soon as the first of them
+ * is ready to be sent - so that after a start, a slide is sent at once and
+ * the others are ready shortly after.
+ *
+ * Slides dir re-read requests are handled by the preparation thread;
+ * slides prepared before such a request are dropped.
+ */
+class SlidePreparer {
+private:
+    static const std::chrono::milliseconds POLL_INTERVAL;
+
+    struct queued_slide_t {
+        unsigned int generation;
+        prepared_slide_t slide;
+    };
+
+    SLSEncoder* sls_encoder;
+    std::string sls_dir;
+    bool raw_slides;
+    std::atomic<size_t> max_slide_size;
+    bool erase_after_tx;
+    std::chrono::milliseconds retry_interval;
+    SlideStateFile* state_file;
+    RereadRequest* reread_request;
+
+    SlideStore slides;
+    SPSCQueue<queued_slide_t> queue;
+    std::atomic<unsigned int> generation;   // incremented on each re-read request
+    std::atomic<bool> failed;
+    std::atomic<bool> stop;
+    std::mutex wakeup_mutex;
+    std::condition_variable wakeup;
+    std::thread thread;
+
+    // prepared slides to erase once sent; skipped when re-reading the slides dir meanwhile
+    std::set<std::string> unsent_slides;
+    std::mutex unsent_slides_mutex;
+
+    // injected slides, prepared ahead of the queue
+    std::deque<injected_slide_t> injected;
+    std::deque<std::pair<prepared_slide_t, bool>> injected_ready;   // with erase
+    std::mutex injected_mutex;
+    std::atomic<size_t> injected_pending;   // not yet taken by GetInjectedSlide()
+    bool inject_requested = false;          // guarded by wakeup_mutex
+
+    void Run();
+    void Wait(std::chrono::milliseconds duration);
+    bool Unsent(const std::string& filepath);
+    void PrepareInjected();
+public:
+    SlidePreparer(SLSEncoder* sls_encoder, const std::string& sls_dir, bool raw_slides, size_t max_slide_size,
+            bool erase_after_tx, size_t history_len, bool content_hashing, size_t lookahead, std::chrono::milliseconds retry_interval,
+            SlideStateFile* state_file, RereadRequest* reread_request,
+            size_t slides_window = 0, const std::string& cursor_file = std::string(),   // see SlideStore::SetStreaming()
+            const change_settle_t& settle = change_settle_t());                     // see SlideStore::SetSettle()
+    ~SlidePreparer();
+
+    // returns the next prepared slide without blocking; false, if none is available
+    bool GetSlide(prepared_slide_t& slide);
+    // whether the preparation stopped due to an error
+    bool Failed() const {return failed;}
+    // applies to the slides prepared from now on
+    void SetMaxSlideSize(size_t size) {max_slide_size = size;}
+    // to be called once a slide got from GetSlide() was sent or dropped (see queueSlide()); erases it, if sent
+    void SlideDone(const std::string& filepath, bool sent);
+
+    // has the slide prepared before any further slide of the slides dir
+    void Inject(const injected_slide_t& slide) {Inject(std::vector<injected_slide_t>(1, slide));}
+    // as above, for several slides (in order), which are encoded on several threads at once
+    void Inject(const std::vector<injected_slide_t>& batch);
+    // returns the next prepared injected slide (and whether to erase it) without blocking; false, if none is available
+    bool GetInjectedSlide(prepared_slide_t& slide, bool& erase);
+    // the injected slides not yet returned by GetInjectedSlide() (incl. the ones being prepared)
+    size_t InjectedPending() const {return injected_pending;}
 };
 
 #endif /* SLS_H_ */
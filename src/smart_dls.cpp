@@ -4,32 +4,135 @@
 */
 
 #include "smart_dls.h"
+#include "utf8.h"
 #include <algorithm>
+#include <cmath>
 #include <regex>
+#include <fstream>
 #include <sstream>
 #include <iomanip>
 #include <openssl/md5.h>
 #include <iostream>
 #include <random>
+#include <unordered_set>
 
 namespace StreamDAB {
 
+const std::chrono::seconds SmartDLSQueue::DEDUP_WINDOW{3600};
+const std::chrono::seconds SmartDLSQueue::SCORE_TTL{60};
+const size_t SmartDLSProcessor::INCOMING_LEN = 1024;
+const size_t SmartDLSProcessor::INCOMING_BATCH = 64;
+
+// InternedString implementation
+static std::mutex interned_mutex;
+
+static std::unordered_set<std::string>& InternedStrings() {
+    static auto* strings = new std::unordered_set<std::string>();
+    return *strings;
+}
+
+InternedString::InternedString() : InternedString(std::string()) {
+}
+
+InternedString::InternedString(const std::string& str) {
+    // the elements of the set keep their address
+    std::lock_guard<std::mutex> lock(interned_mutex);
+    str_ = &*InternedStrings().insert(str).first;
+}
+
+// MessageMetadata implementation
+MessageMetadata::MessageMetadata(const std::map<std::string, std::string>& metadata) {
+    entries_.reserve(metadata.size());
+    for (const auto& entry : metadata) {
+        entries_.emplace_back(InternedString(entry.first), entry.second);
+    }
+}
+
+MessageMetadata::iterator MessageMetadata::find(const std::string& key) {
+    return std::find_if(entries_.begin(), entries_.end(),
+                        [&key](const Entry& entry) { return entry.first.str() == key; });
+}
+
+MessageMetadata::const_iterator MessageMetadata::find(const std::string& key) const {
+    return std::find_if(entries_.begin(), entries_.end(),
+                        [&key](const Entry& entry) { return entry.first.str() == key; });
+}
+
+std::string& MessageMetadata::operator[](const std::string& key) {
+    auto it = find(key);
+    if (it != entries_.end()) {
+        return it->second;
+    }
+    entries_.emplace_back(InternedString(key), std::string());
+    return entries_.back().second;
+}
+
+// DLSMessagePool implementation: blocks of the size of the first request
+// (those of other sizes are allocated plainly); the free list outlives all
+// messages, as it is never destroyed
+const size_t DLSMessagePool::MAX_FREE_BLOCKS = 4096;
+
+struct DLSMessagePoolState {
+    std::mutex mutex;
+    size_t block_size = 0;
+    std::vector<void*> free_blocks;
+};
+
+static DLSMessagePoolState& PoolState() {
+    static auto* state = new DLSMessagePoolState();
+    return *state;
+}
+
+void* DLSMessagePool::Allocate(size_t size) {
+    DLSMessagePoolState& pool = PoolState();
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (pool.block_size == 0) {
+            pool.block_size = size;
+        }
+        if (size == pool.block_size && !pool.free_blocks.empty()) {
+            void* block = pool.free_blocks.back();
+            pool.free_blocks.pop_back();
+            return block;
+        }
+    }
+    return ::operator new(size);
+}
+
+void DLSMessagePool::Release(void* block, size_t size) {
+    DLSMessagePoolState& pool = PoolState();
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (size == pool.block_size && pool.free_blocks.size() < MAX_FREE_BLOCKS) {
+            pool.free_blocks.push_back(block);
+            return;
+        }
+    }
+    ::operator delete(block);
+}
+
+size_t DLSMessagePool::FreeBlocks() {
+    DLSMessagePoolState& pool = PoolState();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    return pool.free_blocks.size();
+}
+
 SmartDLSQueue::SmartDLSQueue() {
-    // Initialize with cleanup timer
 }
 
-std::string SmartDLSQueue::GenerateContentHash(const std::string& text) const {
+uint64_t SmartDLSQueue::GenerateContentHash(const std::string& text) {
+    // the first 64 bits of the MD5 digest
     unsigned char hash[MD5_DIGEST_LENGTH];
     MD5(reinterpret_cast<const unsigned char*>(text.c_str()), text.length(), hash);
     
-    std::ostringstream ss;
-    for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
+    uint64_t content_hash = 0;
+    for (int i = 0; i < 8; i++) {
+        content_hash = (content_hash << 8) | hash[i];
     }
-    return ss.str();
+    return content_hash;
 }
 
-bool SmartDLSQueue::IsDuplicate(const std::string& content_hash, 
+bool SmartDLSQueue::IsDuplicate(uint64_t content_hash, 
                                std::chrono::seconds dedup_window) const {
     auto it = content_hashes_.find(content_hash);
     if (it == content_hashes_.end()) {
@@ -45,7 +148,10 @@ bool SmartDLSQueue::AddMessage(std::shared_ptr<DLSMessage> message) {
         return false;
     }
     
-    std::lock_guard<std::mutex> lock(queue_mutex_);
+    std::lock_guard<ProfiledMutex> lock(queue_mutex_);
+    
+    // Forget the content hashes out of the dedup window, so that the memory stays bounded
+    ExpireContentHashes(std::chrono::system_clock::now());
     
     // Generate content hash for deduplication
     message->content_hash = GenerateContentHash(message->text);
@@ -65,197 +171,624 @@ bool SmartDLSQueue::AddMessage(std::shared_ptr<DLSMessage> message) {
         message->expires_at = message->created_at + std::chrono::hours{24};
     }
     
-    // Add to priority queue
-    priority_queue_.push(message);
+    // Add to its bucket
+    const size_t priority = static_cast<size_t>(message->priority);
+    const size_t source = static_cast<size_t>(message->source);
+    if (priority >= PRIORITY_LEVELS || source >= SOURCE_TYPES || bucket_index_.count(message.get())) {
+        return false;
+    }
+    MessageBucket& bucket = buckets_[priority][source][message->is_thai_content ? 1 : 0];
+    auto queued = bucket.insert({message->importance_score, message->created_at, message}).first;
+    bucket_index_[message.get()] = queued;
+    CountMessage(*queued, 1);
     
     // Add to index
-    message_index_[message->source_id] = message;
+    message_index_.Set(message->source_id, message);
     
     // Update content hash tracking
     content_hashes_[message->content_hash] = message->created_at;
     
+    expiry_wheel_.Schedule(message->expires_at, message);
+    dedup_wheel_.Schedule(message->created_at + DEDUP_WINDOW, message->content_hash);
+    
     total_messages_++;
     
     return true;
 }
 
-std::shared_ptr<DLSMessage> SmartDLSQueue::GetNextMessage(const SelectionCriteria& criteria) {
-    std::lock_guard<std::mutex> lock(queue_mutex_);
+bool SmartDLSQueue::IsEligible(const DLSMessage& message, const SelectionCriteria& criteria,
+                               std::chrono::system_clock::time_point now) {
+    // Check expiry (the message may not have been cleaned up yet)
+    if (message.expires_at < now) {
+        return false;
+    }
     
-    // Clean expired messages first
-    CleanupExpiredMessages();
+    // Check age
+    if (now - message.created_at > criteria.max_age) {
+        return false;
+    }
     
-    if (priority_queue_.empty()) {
-        return nullptr;
+    // Check repeat constraints
+    if (message.send_count > 0) {
+        if (!criteria.allow_repeats || now - message.last_sent < criteria.min_repeat_interval) {
+            return false;
+        }
+    }
+    if (message.send_count >= criteria.max_repeat_count) {
+        return false;
     }
     
-    // Find best message matching criteria
-    std::vector<std::shared_ptr<DLSMessage>> candidates;
-    auto temp_queue = priority_queue_;
+    // Check max sends
+    if (message.max_sends > 0 && message.send_count >= message.max_sends) {
+        return false;
+    }
     
-    while (!temp_queue.empty()) {
-        auto message = temp_queue.top();
-        temp_queue.pop();
-        
-        // Check if message meets criteria
-        bool meets_criteria = true;
-        
-        // Check priority range
-        if (message->priority < criteria.min_priority || 
-            message->priority > criteria.max_priority) {
-            meets_criteria = false;
+    // Check text length
+    return message.text.length() <= criteria.max_text_length;
+}
+
+// CompiledCriteria implementation
+CompiledCriteria::CompiledCriteria(const SelectionCriteria& criteria,
+                                   const std::vector<ContentSource>& preferred_sources)
+    : criteria(criteria), source_mask(SourceMask(criteria)) {
+    // Higher bonus for more preferred sources
+    for (size_t i = 0; i < preferred_sources.size(); i++) {
+        const size_t source = static_cast<size_t>(preferred_sources[i]);
+        if (source < SOURCE_TYPES && source_bonus[source] == 0.0) {
+            source_bonus[source] = 0.2 * (1.0 - static_cast<double>(i) / preferred_sources.size());
         }
-        
-        // Check age
-        auto age = std::chrono::system_clock::now() - message->created_at;
-        if (age > criteria.max_age) {
-            meets_criteria = false;
+    }
+}
+
+uint32_t CompiledCriteria::SourceMask(const SelectionCriteria& criteria) {
+    // Sources matching the allowlist/blocklist
+    const uint32_t all = (uint32_t(1) << SOURCE_TYPES) - 1;
+    uint32_t mask = criteria.allowed_sources.empty() ? all : 0;
+    for (ContentSource source : criteria.allowed_sources) {
+        if (static_cast<size_t>(source) < SOURCE_TYPES) {
+            mask |= uint32_t(1) << static_cast<size_t>(source);
         }
-        
-        // Check source allowlist/blocklist
-        if (!criteria.allowed_sources.empty()) {
-            bool source_allowed = std::find(criteria.allowed_sources.begin(),
-                                           criteria.allowed_sources.end(),
-                                           message->source) != criteria.allowed_sources.end();
-            if (!source_allowed) {
-                meets_criteria = false;
-            }
+    }
+    for (ContentSource source : criteria.blocked_sources) {
+        if (static_cast<size_t>(source) < SOURCE_TYPES) {
+            mask &= ~(uint32_t(1) << static_cast<size_t>(source));
         }
+    }
+    return mask;
+}
+
+std::shared_ptr<DLSMessage> SmartDLSQueue::GetNextMessage(const SelectionCriteria& criteria) {
+    if (criteria.scoring_function) {
+        // Plain functions are told apart by their address; other callables are scored anew each time
+        typedef double (*ScoringFunction)(const DLSMessage&);
+        const ScoringFunction* function = criteria.scoring_function.target<ScoringFunction>();
+        return SelectScored(criteria, CompiledCriteria::SourceMask(criteria), criteria.scoring_function,
+                            function ? reinterpret_cast<const void*>(*function) : nullptr);
+    }
+    
+    std::lock_guard<ProfiledMutex> lock(queue_mutex_);
+    
+    if (bucket_index_.empty()) {
+        return nullptr;
+    }
+    
+    const uint32_t source_mask = CompiledCriteria::SourceMask(criteria);
+    
+    const auto now = std::chrono::system_clock::now();
+    const size_t first_priority = static_cast<size_t>(criteria.max_priority);
+    const size_t last_priority = std::min(static_cast<size_t>(criteria.min_priority), PRIORITY_LEVELS - 1);
+    
+    // Highest priority first; within it the best first eligible message of the buckets
+    for (size_t priority = first_priority; priority <= last_priority; priority++) {
+        const QueuedMessage* best = nullptr;
+        double best_importance = 0.0;
         
-        if (!criteria.blocked_sources.empty()) {
-            bool source_blocked = std::find(criteria.blocked_sources.begin(),
-                                           criteria.blocked_sources.end(),
-                                           message->source) != criteria.blocked_sources.end();
-            if (source_blocked) {
-                meets_criteria = false;
+        for (size_t source = 0; source < SOURCE_TYPES; source++) {
+            if (!((source_mask >> source) & 1)) {
+                continue;
             }
-        }
-        
-        // Check repeat constraints
-        if (!criteria.allow_repeats && message->send_count > 0) {
-            meets_criteria = false;
-        }
-        
-        if (message->send_count >= criteria.max_repeat_count) {
-            meets_criteria = false;
-        }
-        
-        if (message->send_count > 0) {
-            auto time_since_last = std::chrono::system_clock::now() - message->last_sent;
-            if (time_since_last < criteria.min_repeat_interval) {
-                meets_criteria = false;
+            for (int thai = 0; thai < 2; thai++) {
+                for (const QueuedMessage& queued : buckets_[priority][source][thai]) {
+                    if (!IsEligible(*queued.message, criteria, now)) {
+                        continue;
+                    }
+                    
+                    // Lower priority for non-Thai content, if Thai content preferred
+                    double importance = queued.importance * (criteria.prefer_thai_content && !thai ? 0.8 : 1.0);
+                    if (!best || importance > best_importance + 0.001 ||
+                        (std::abs(importance - best_importance) <= 0.001 && queued.created_at > best->created_at)) {
+                        best = &queued;
+                        best_importance = importance;
+                    }
+                    break;
+                }
             }
         }
         
-        // Check text length
-        if (message->text.length() > criteria.max_text_length) {
-            meets_criteria = false;
+        if (best) {
+            best->score_epoch = 0;
+            return MarkSent(best->message, now);
         }
-        
-        // Check Thai content preference
-        if (criteria.prefer_thai_content && !message->is_thai_content) {
-            // Lower priority for non-Thai content
-            message->importance_score *= 0.8;
+    }
+    
+    return nullptr;
+}
+
+std::shared_ptr<DLSMessage> SmartDLSQueue::GetNextMessage(const SelectionCriteria& criteria,
+                                                          double (*scorer)(const DLSMessage&)) {
+    return SelectScored(criteria, CompiledCriteria::SourceMask(criteria), scorer, reinterpret_cast<const void*>(scorer));
+}
+
+std::shared_ptr<DLSMessage> SmartDLSQueue::GetNextMessage(const CompiledCriteria& compiled,
+                                                          double (*scorer)(const DLSMessage&)) {
+    return SelectScored(compiled.criteria, compiled.source_mask, scorer, reinterpret_cast<const void*>(scorer));
+}
+
+std::shared_ptr<DLSMessage> SmartDLSQueue::MarkSent(const std::shared_ptr<DLSMessage>& message,
+                                                    std::chrono::system_clock::time_point now) {
+    message->last_sent = now;
+    message->send_count++;
+    sent_messages_++;
+    
+    return message;
+}
+
+void SmartDLSQueue::InvalidateScores() {
+    std::lock_guard<ProfiledMutex> lock(queue_mutex_);
+    score_epoch_++;
+}
+
+void SmartDLSQueue::Unqueue(const std::shared_ptr<DLSMessage>& message) {
+    auto queued = bucket_index_.find(message.get());
+    if (queued == bucket_index_.end()) {
+        return;
+    }
+    
+    CountMessage(*queued->second, -1);
+    buckets_[static_cast<size_t>(message->priority)][static_cast<size_t>(message->source)][message->is_thai_content ? 1 : 0].erase(queued->second);
+    bucket_index_.erase(queued);
+}
+
+void SmartDLSQueue::CountMessage(const QueuedMessage& queued, int sign) {
+    // Called with the queue lock held, for a message entering (+1) or leaving (-1) the buckets
+    queued_messages_ += sign;
+    priority_counts_[static_cast<size_t>(queued.message->priority)] += sign;
+    source_counts_[static_cast<size_t>(queued.message->source)] += sign;
+    importance_sum_ += sign * std::llround(queued.importance * 1e6);
+    
+    if (sign > 0) {
+        created_times_.insert(queued.created_at);
+    } else {
+        auto created = created_times_.find(queued.created_at);
+        if (created != created_times_.end()) {
+            created_times_.erase(created);
         }
-        
-        // Check max sends
-        if (message->max_sends > 0 && message->send_count >= message->max_sends) {
-            meets_criteria = false;
+    }
+    oldest_message_ = created_times_.empty() ? 0 : created_times_.begin()->time_since_epoch().count();
+    newest_message_ = created_times_.empty() ? 0 : created_times_.rbegin()->time_since_epoch().count();
+}
+
+size_t SmartDLSQueue::CleanupExpiredMessages() {
+    auto now = std::chrono::system_clock::now();
+    
+    // Messages due to expire (unless removed meanwhile or their expiry postponed)
+    std::vector<std::weak_ptr<DLSMessage>> due;
+    expiry_wheel_.Advance(now, due);
+    
+    size_t expired_count = 0;
+    for (const auto& entry : due) {
+        auto message = entry.lock();
+        if (!message || !bucket_index_.count(message.get())) {
+            continue;
+        }
+        if (message->expires_at > now) {
+            expiry_wheel_.Schedule(message->expires_at, message);
+            continue;
         }
         
-        if (meets_criteria) {
-            candidates.push_back(message);
+        content_hashes_.erase(message->content_hash);
+        auto* indexed = message_index_.Find(message->source_id);
+        if (indexed && *indexed == message) {
+            message_index_.Erase(message->source_id);
         }
+        Unqueue(message);
+        expired_count++;
     }
     
-    if (candidates.empty()) {
-        return nullptr;
+    ExpireContentHashes(now);
+    
+    expired_messages_ += expired_count;
+    return expired_count;
+}
+
+void SmartDLSQueue::ExpireContentHashes(std::chrono::system_clock::time_point now) {
+    // Content hashes whose dedup window has passed (unless added again meanwhile)
+    std::vector<uint64_t> hashes;
+    dedup_wheel_.Advance(now, hashes);
+    for (uint64_t hash : hashes) {
+        auto it = content_hashes_.find(hash);
+        if (it != content_hashes_.end() && now - it->second >= DEDUP_WINDOW) {
+            content_hashes_.erase(it);
+        }
     }
+}
+
+size_t SmartDLSQueue::CleanupMessages() {
+    std::lock_guard<ProfiledMutex> lock(queue_mutex_);
+    return CleanupExpiredMessages();
+}
+
+std::chrono::system_clock::time_point SmartDLSQueue::GetNextCleanup() const {
+    std::lock_guard<ProfiledMutex> lock(queue_mutex_);
     
-    // Apply custom scoring function if provided
-    if (criteria.scoring_function) {
-        std::sort(candidates.begin(), candidates.end(),
-                 [&criteria](const std::shared_ptr<DLSMessage>& a, 
-                           const std::shared_ptr<DLSMessage>& b) {
-                     return criteria.scoring_function(*a) > criteria.scoring_function(*b);
-                 });
+    auto next = std::chrono::system_clock::time_point::max();
+    std::chrono::system_clock::time_point due;
+    if (expiry_wheel_.NextDue(due)) {
+        next = std::min(next, due);
     }
+    if (dedup_wheel_.NextDue(due)) {
+        next = std::min(next, due);
+    }
+    return next;
+}
+
+bool SmartDLSQueue::RemoveMessage(const std::string& message_id) {
+    std::lock_guard<ProfiledMutex> lock(queue_mutex_);
     
-    // Return best candidate
-    auto selected = candidates[0];
-    selected->last_sent = std::chrono::system_clock::now();
-    selected->send_count++;
+    auto* indexed = message_index_.Find(message_id);
+    if (!indexed) {
+        return false;
+    }
     
-    return selected;
+    Unqueue(*indexed);
+    message_index_.Erase(message_id);
+    return true;
 }
 
-void SmartDLSQueue::CleanupExpiredMessages() {
-    auto now = std::chrono::system_clock::now();
+void SmartDLSQueue::ClearQueue() {
+    std::lock_guard<ProfiledMutex> lock(queue_mutex_);
     
-    // This is a simplified cleanup - in practice, we'd need to rebuild the queue
-    // to properly remove expired messages from the priority queue
-    size_t expired_count = 0;
-    
-    for (auto it = message_index_.begin(); it != message_index_.end();) {
-        if (it->second->expires_at < now) {
-            content_hashes_.erase(it->second->content_hash);
-            it = message_index_.erase(it);
-            expired_count++;
-        } else {
-            ++it;
+    for (auto& priority_buckets : buckets_) {
+        for (auto& source_buckets : priority_buckets) {
+            for (MessageBucket& bucket : source_buckets) {
+                bucket.clear();
+            }
         }
     }
+    bucket_index_.clear();
+    message_index_.Clear();
+    expiry_wheel_.Clear();
     
-    expired_messages_ += expired_count;
+    queued_messages_ = 0;
+    for (auto& count : priority_counts_) {
+        count = 0;
+    }
+    for (auto& count : source_counts_) {
+        count = 0;
+    }
+    importance_sum_ = 0;
+    created_times_.clear();
+    oldest_message_ = 0;
+    newest_message_ = 0;
 }
 
 size_t SmartDLSQueue::GetQueueSize() const {
-    std::lock_guard<std::mutex> lock(queue_mutex_);
-    return priority_queue_.size();
+    return queued_messages_;
+}
+
+size_t SmartDLSQueue::GetMessageCount(MessagePriority priority) const {
+    if (static_cast<size_t>(priority) >= PRIORITY_LEVELS) {
+        return 0;
+    }
+    return priority_counts_[static_cast<size_t>(priority)];
 }
 
 SmartDLSQueue::QueueStatistics SmartDLSQueue::GetStatistics() const {
-    std::lock_guard<std::mutex> lock(queue_mutex_);
-    
+    // A snapshot of the aggregates; does not take the queue lock
     QueueStatistics stats;
     stats.total_messages = total_messages_;
     stats.expired_messages = expired_messages_;
+    stats.sent_messages = sent_messages_;
     
-    // Analyze current queue
-    auto temp_queue = priority_queue_;
-    double total_importance = 0.0;
-    bool first = true;
+    for (size_t priority = 0; priority < PRIORITY_LEVELS; priority++) {
+        if (size_t count = priority_counts_[priority]) {
+            stats.priority_counts[static_cast<MessagePriority>(priority)] = count;
+        }
+    }
+    for (size_t source = 0; source < SOURCE_TYPES; source++) {
+        if (size_t count = source_counts_[source]) {
+            stats.source_counts[static_cast<ContentSource>(source)] = count;
+        }
+    }
     
-    while (!temp_queue.empty()) {
-        auto message = temp_queue.top();
-        temp_queue.pop();
-        
-        stats.priority_counts[message->priority]++;
-        stats.source_counts[message->source]++;
-        total_importance += message->importance_score;
-        
-        if (first) {
-            stats.newest_message = stats.oldest_message = message->created_at;
-            first = false;
-        } else {
-            if (message->created_at < stats.oldest_message) {
-                stats.oldest_message = message->created_at;
+    stats.oldest_message = std::chrono::system_clock::time_point(std::chrono::system_clock::duration(oldest_message_));
+    stats.newest_message = std::chrono::system_clock::time_point(std::chrono::system_clock::duration(newest_message_));
+    
+    const size_t queued = queued_messages_;
+    if (queued) {
+        stats.average_importance = importance_sum_ / 1e6 / queued;
+    }
+    
+    return stats;
+}
+
+void LiteralReplacer::Clear() {
+    patterns_.clear();
+    transitions_.clear();
+    match_.clear();
+    next_match_.clear();
+}
+
+void LiteralReplacer::Add(const std::string& pattern, const std::string& replacement) {
+    if (!pattern.empty()) {
+        patterns_.push_back({pattern, replacement, 0, {}});
+    }
+}
+
+void LiteralReplacer::Build() {
+    // For matching code points: the lengths and replacements as such
+    for (Pattern& pattern : patterns_) {
+        pattern.chars = 0;
+        for (unsigned char c : pattern.text) {
+            pattern.chars += (c & 0xC0) != 0x80;
+        }
+        pattern.replacement_chars.clear();
+        std::string::const_iterator it = pattern.replacement.cbegin();
+        while (it != pattern.replacement.cend()) {
+            uint32_t c = 0;
+            if (utf8::internal::validate_next(it, pattern.replacement.cend(), c) == utf8::internal::UTF8_OK) {
+                pattern.replacement_chars.push_back(c);
+            } else {
+                ++it;
             }
-            if (message->created_at > stats.newest_message) {
-                stats.newest_message = message->created_at;
+        }
+    }
+    
+    // Trie of the patterns
+    transitions_.assign(256, -1);
+    match_.assign(1, -1);
+    for (size_t i = 0; i < patterns_.size(); i++) {
+        int32_t state = 0;
+        for (unsigned char c : patterns_[i].text) {
+            int32_t& next = transitions_[state * 256 + c];
+            if (next == -1) {
+                next = static_cast<int32_t>(match_.size());
+                transitions_.resize(transitions_.size() + 256, -1);
+                match_.push_back(-1);
             }
+            state = transitions_[state * 256 + c];
+        }
+        if (match_[state] == -1) {
+            match_[state] = static_cast<int32_t>(i);
         }
     }
     
-    if (priority_queue_.size() > 0) {
-        stats.average_importance = total_importance / priority_queue_.size();
+    // Failure links (breadth first), turning the trie into a complete automaton
+    std::vector<int32_t> failure(match_.size(), 0);
+    next_match_.assign(match_.size(), -1);
+    std::vector<int32_t> pending;
+    for (int c = 0; c < 256; c++) {
+        int32_t& next = transitions_[c];
+        if (next == -1) {
+            next = 0;
+        } else {
+            pending.push_back(next);
+        }
+    }
+    for (size_t i = 0; i < pending.size(); i++) {
+        const int32_t state = pending[i];
+        const int32_t fallback = failure[state];
+        next_match_[state] = match_[fallback] != -1 ? fallback : next_match_[fallback];
+        
+        for (int c = 0; c < 256; c++) {
+            int32_t& next = transitions_[state * 256 + c];
+            if (next == -1) {
+                next = transitions_[fallback * 256 + c];
+            } else {
+                failure[next] = transitions_[fallback * 256 + c];
+                pending.push_back(next);
+            }
+        }
+    }
+}
+
+std::string LiteralReplacer::Apply(const std::string& text, std::vector<size_t>* used) const {
+    if (patterns_.empty() || transitions_.empty()) {
+        return text;
     }
     
-    return stats;
+    // All matches, in a single pass
+    std::vector<Match> matches;
+    int32_t state = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        state = transitions_[state * 256 + static_cast<unsigned char>(text[i])];
+        for (int32_t s = match_[state] != -1 ? state : next_match_[state]; s != -1; s = next_match_[s]) {
+            const size_t length = patterns_[match_[s]].text.size();
+            matches.push_back({i + 1 - length, length, match_[s]});
+        }
+    }
+    if (matches.empty()) {
+        return text;
+    }
+    
+    // Replace the leftmost (then longest) ones
+    SortMatches(matches);
+    
+    std::string result;
+    result.reserve(text.size());
+    size_t pos = 0;
+    for (const Match& match : matches) {
+        if (match.start < pos) {
+            continue;
+        }
+        result.append(text, pos, match.start - pos);
+        result += patterns_[match.pattern].replacement;
+        pos = match.start + match.length;
+        if (used) {
+            used->push_back(match.pattern);
+        }
+    }
+    result.append(text, pos, std::string::npos);
+    
+    return result;
+}
+
+void LiteralReplacer::Apply(const std::vector<uint32_t>& text, std::vector<uint32_t>& result, std::vector<size_t>* used) const {
+    result.clear();
+    if (patterns_.empty() || transitions_.empty()) {
+        result = text;
+        return;
+    }
+    
+    // All matches, by code points, stepping through the UTF-8 of each
+    thread_local std::vector<Match> matches;
+    matches.clear();
+    int32_t state = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        uint8_t bytes[4];
+        uint8_t* const end = utf8::unchecked::append(text[i], bytes);
+        for (const uint8_t* b = bytes; b != end; b++) {
+            state = transitions_[state * 256 + *b];
+        }
+        for (int32_t s = match_[state] != -1 ? state : next_match_[state]; s != -1; s = next_match_[s]) {
+            const size_t length = patterns_[match_[s]].chars;
+            matches.push_back({i + 1 - length, length, match_[s]});
+        }
+    }
+    if (matches.empty()) {
+        result = text;
+        return;
+    }
+    
+    SortMatches(matches);
+    
+    result.reserve(text.size());
+    size_t pos = 0;
+    for (const Match& match : matches) {
+        if (match.start < pos) {
+            continue;
+        }
+        result.insert(result.end(), text.begin() + pos, text.begin() + match.start);
+        const Pattern& pattern = patterns_[match.pattern];
+        result.insert(result.end(), pattern.replacement_chars.begin(), pattern.replacement_chars.end());
+        pos = match.start + match.length;
+        if (used) {
+            used->push_back(match.pattern);
+        }
+    }
+    result.insert(result.end(), text.begin() + pos, text.end());
 }
 
+void LiteralReplacer::SortMatches(std::vector<Match>& matches) {
+    std::sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) {
+        if (a.start != b.start) {
+            return a.start < b.start;
+        }
+        if (a.length != b.length) {
+            return a.length > b.length;
+        }
+        return a.pattern < b.pattern;
+    });
+}
+
+// The rules are built and compiled on first use, so that an instance which
+// never optimises a message does not pay for them at start
 MessageLengthOptimizer::MessageLengthOptimizer() {
-    InitializeRules();
+}
+
+void MessageLengthOptimizer::EnsureRules() const {
+    // as if done by the constructor, which is why the const_cast is safe
+    std::call_once(rules_once_, [this]() {
+        MessageLengthOptimizer* self = const_cast<MessageLengthOptimizer*>(this);
+        self->InitializeRules();
+        self->CompileRules();
+    });
+}
+
+const LiteralReplacer& MessageLengthOptimizer::GetReplacer(bool thai_content) const {
+    EnsureRules();
+    return replacers_[thai_content ? 1 : 0];
+}
+
+void MessageLengthOptimizer::CompileRules() {
+    for (int thai = 0; thai < 2; thai++) {
+        LiteralReplacer& replacer = replacers_[thai];
+        std::vector<std::string>& names = replacer_rule_names_[thai];
+        replacer.Clear();
+        names.clear();
+        
+        // Phrases first, so that they win over an abbreviation of the same text
+        for (const auto& phrase : common_phrases_) {
+            replacer.Add(phrase.first, phrase.second);
+            names.push_back("Phrase replacement: " + phrase.first);
+        }
+        for (const auto& rule : abbreviation_rules_) {
+            if (!rule.is_regex && rule.thai_specific == (thai == 1)) {
+                replacer.Add(rule.pattern, rule.replacement);
+                names.push_back("Abbreviation: " + rule.pattern);
+            }
+        }
+        replacer.Build();
+    }
+    
+    regex_rules_.clear();
+    for (const auto& rule : abbreviation_rules_) {
+        if (rule.is_regex) {
+            try {
+                regex_rules_.emplace_back(std::regex(rule.pattern), rule);
+            } catch (const std::regex_error& e) {
+                std::cerr << "Invalid rule pattern '" << rule.pattern << "': " << e.what() << std::endl;
+            }
+        }
+    }
+}
+
+std::string MessageLengthOptimizer::ApplyAbbreviations(const std::string& text, bool thai_content) {
+    // the common phrases are replaced as well
+    EnsureRules();
+    std::string result = replacers_[thai_content ? 1 : 0].Apply(text);
+    for (const auto& rule : regex_rules_) {
+        if (rule.second.thai_specific == thai_content) {
+            result = std::regex_replace(result, rule.first, rule.second.replacement);
+        }
+    }
+    return result;
+}
+
+void MessageLengthOptimizer::AddCustomRule(const OptimizationRule& rule) {
+    EnsureRules();
+    abbreviation_rules_.push_back(rule);
+    CompileRules();
+}
+
+void MessageLengthOptimizer::LoadRulesFromFile(const std::string& filename) {
+    // one rule per line: pattern <TAB> replacement [<TAB> flags: t = Thai specific, r = regex]
+    std::ifstream file(filename);
+    if (!file) {
+        std::cerr << "Cannot read rules file " << filename << std::endl;
+        return;
+    }
+    EnsureRules();
+    
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        
+        std::istringstream fields(line);
+        OptimizationRule rule;
+        std::string flags;
+        if (!std::getline(fields, rule.pattern, '\t') || !std::getline(fields, rule.replacement, '\t')) {
+            continue;
+        }
+        std::getline(fields, flags);
+        rule.thai_specific = flags.find('t') != std::string::npos;
+        rule.is_regex = flags.find('r') != std::string::npos;
+        abbreviation_rules_.push_back(rule);
+    }
+    
+    CompileRules();
 }
 
 void MessageLengthOptimizer::InitializeRules() {
@@ -320,39 +853,39 @@ MessageLengthOptimizer::OptimizeMessage(const std::string& text, size_t target_l
         result.applied_rules.push_back("Whitespace compression");
     }
     
-    // 2. Apply common phrase replacements
-    for (const auto& phrase : common_phrases_) {
-        if (result.optimized_text.find(phrase.first) != std::string::npos) {
-            result.optimized_text = std::regex_replace(result.optimized_text, 
-                                                      std::regex(phrase.first), 
-                                                      phrase.second);
-            result.applied_rules.push_back("Phrase replacement: " + phrase.first);
+    // 2./3. Apply common phrase replacements and abbreviations, all in one pass
+    const int is_thai = result.optimized_text.find_first_of("กขคฆงจฉชซฌญฎฏฐฑฒณดตถทธนบปผฝพฟภมยรลวศษสหฬอฮ") != std::string::npos;
+    std::vector<size_t> used;
+    EnsureRules();
+    result.optimized_text = replacers_[is_thai].Apply(result.optimized_text, &used);
+    
+    std::vector<bool> reported(replacer_rule_names_[is_thai].size());
+    for (size_t index : used) {
+        if (!reported[index]) {
+            result.applied_rules.push_back(replacer_rule_names_[is_thai][index]);
+            reported[index] = true;
         }
     }
     
-    // 3. Apply abbreviations
-    bool is_thai = result.optimized_text.find_first_of("กขคฆงจฉชซฌญฎฏฐฑฒณดตถทธนบปผฝพฟภมยรลวศษสหฬอฮ") != std::string::npos;
-    for (const auto& rule : abbreviation_rules_) {
-        if (rule.thai_specific == is_thai) {
-            if (result.optimized_text.find(rule.pattern) != std::string::npos) {
-                result.optimized_text = std::regex_replace(result.optimized_text, 
-                                                          std::regex(rule.pattern), 
-                                                          rule.replacement);
-                result.applied_rules.push_back("Abbreviation: " + rule.pattern);
-            }
+    for (const auto& rule : regex_rules_) {
+        if (rule.second.thai_specific == static_cast<bool>(is_thai) && std::regex_search(result.optimized_text, rule.first)) {
+            result.optimized_text = std::regex_replace(result.optimized_text, rule.first, rule.second.replacement);
+            result.applied_rules.push_back("Abbreviation: " + rule.second.pattern);
         }
     }
     
     // 4. Remove redundancy
-    std::string deduplicated = RemoveRedundancy(result.optimized_text);
-    if (deduplicated != result.optimized_text) {
-        result.optimized_text = deduplicated;
+    std::string scratch;
+    RemoveRedundancy(result.optimized_text, scratch);
+    if (scratch != result.optimized_text) {
+        result.optimized_text.swap(scratch);
         result.applied_rules.push_back("Redundancy removal");
     }
     
     // 5. Smart truncation if still too long
     if (result.optimized_text.length() > target_length) {
-        result.optimized_text = SmartTruncate(result.optimized_text, target_length);
+        SmartTruncate(result.optimized_text, target_length, scratch);
+        result.optimized_text.swap(scratch);
         result.applied_rules.push_back("Smart truncation");
         result.is_lossless = false;
     }
@@ -364,10 +897,25 @@ MessageLengthOptimizer::OptimizeMessage(const std::string& text, size_t target_l
 }
 
 std::string MessageLengthOptimizer::CompressWhitespace(const std::string& text) {
-    std::string result = text;
-    
-    // Replace multiple spaces with single space
-    result = std::regex_replace(result, std::regex(R"(\s+)"), " ");
+    std::string result;
+    result.reserve(text.size());
+    
+    // Replace multiple spaces with single space (any whitespace, as with \s)
+    bool in_space = false;
+    for (char c : text) {
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r') {
+            in_space = true;
+            continue;
+        }
+        if (in_space) {
+            result += ' ';
+            in_space = false;
+        }
+        result += c;
+    }
+    if (in_space) {
+        result += ' ';
+    }
     
     // Remove leading and trailing whitespace
     result.erase(0, result.find_first_not_of(" \t\n\r"));
@@ -377,38 +925,45 @@ std::string MessageLengthOptimizer::CompressWhitespace(const std::string& text)
 }
 
 std::string MessageLengthOptimizer::RemoveRedundancy(const std::string& text) {
-    std::string result = text;
-    
-    // Simple redundancy removal - remove repeated words
-    std::istringstream iss(result);
-    std::vector<std::string> words;
-    std::string word;
-    
-    while (iss >> word) {
-        words.push_back(word);
-    }
-    
-    // Remove consecutive duplicate words
-    auto new_end = std::unique(words.begin(), words.end());
-    words.erase(new_end, words.end());
-    
-    // Reconstruct string
-    std::ostringstream oss;
-    for (size_t i = 0; i < words.size(); ++i) {
-        if (i > 0) oss << " ";
-        oss << words[i];
+    std::string result;
+    RemoveRedundancy(text, result);
+    return result;
+}
+
+void MessageLengthOptimizer::RemoveRedundancy(std::string_view text, std::string& out) {
+    // the words (as separated by whitespace), each once where repeated in a row, joined by single spaces
+    static const char* const WHITESPACE = " \t\n\v\f\r";
+    out.clear();
+    std::string_view previous;
+    size_t pos = text.find_first_not_of(WHITESPACE);
+    while (pos != std::string_view::npos) {
+        const size_t end = std::min(text.find_first_of(WHITESPACE, pos), text.size());
+        const std::string_view word = text.substr(pos, end - pos);
+        if (word != previous) {
+            if (!out.empty()) {
+                out += ' ';
+            }
+            out.append(word.data(), word.size());
+            previous = word;
+        }
+        pos = text.find_first_not_of(WHITESPACE, end);
     }
-    
-    return oss.str();
 }
 
 std::string MessageLengthOptimizer::SmartTruncate(const std::string& text, size_t max_length) {
+    std::string result;
+    SmartTruncate(text, max_length, result);
+    return result;
+}
+
+void MessageLengthOptimizer::SmartTruncate(std::string_view text, size_t max_length, std::string& out) {
     if (text.length() <= max_length) {
-        return text;
+        out.assign(text.data(), text.size());
+        return;
     }
     
     // Try to find a good break point
-    size_t break_pos = max_length - 3; // Leave room for "..."
+    size_t break_pos = max_length > 3 ? max_length - 3 : 0; // Leave room for "..."
     
     // Look for word boundary
     while (break_pos > max_length * 0.7 && break_pos > 0) {
@@ -419,44 +974,50 @@ std::string MessageLengthOptimizer::SmartTruncate(const std::string& text, size_
         break_pos--;
     }
     
-    std::string result = text.substr(0, break_pos);
-    if (break_pos < text.length()) {
-        result += "...";
+    // which is ASCII; else the cut is moved to the start of the character there
+    while (break_pos > 0 && (static_cast<uint8_t>(text[break_pos]) & 0xC0) == 0x80) {
+        break_pos--;
     }
     
-    return result;
+    out.assign(text.data(), break_pos);
+    out += "...";
 }
 
 ContextAwareSelector::ContextAwareSelector() {
     // Initialize default context preferences
-    context_source_preferences_[MessageContext::LIVE_SHOW] = {
+    SetContextSources(MessageContext::LIVE_SHOW, {
         ContentSource::MANUAL, ContentSource::METADATA_EXTRACTOR, ContentSource::SOCIAL_MEDIA
-    };
+    });
     
-    context_source_preferences_[MessageContext::NEWS] = {
+    SetContextSources(MessageContext::NEWS, {
         ContentSource::NEWS_API, ContentSource::RSS_FEED, ContentSource::MANUAL
-    };
+    });
     
-    context_source_preferences_[MessageContext::MUSIC] = {
+    SetContextSources(MessageContext::MUSIC, {
         ContentSource::METADATA_EXTRACTOR, ContentSource::MANUAL, ContentSource::SOCIAL_MEDIA
-    };
+    });
     
-    context_source_preferences_[MessageContext::EMERGENCY] = {
+    SetContextSources(MessageContext::EMERGENCY, {
         ContentSource::EMERGENCY_SYSTEM, ContentSource::MANUAL
-    };
+    });
     
     // Set default criteria for each context
     SelectionCriteria live_criteria;
     live_criteria.preferred_context = MessageContext::LIVE_SHOW;
     live_criteria.min_priority = MessagePriority::NORMAL;
     live_criteria.max_age = std::chrono::hours{1};
-    context_criteria_[MessageContext::LIVE_SHOW] = live_criteria;
+    SetContextCriteria(MessageContext::LIVE_SHOW, live_criteria);
     
     SelectionCriteria news_criteria;
     news_criteria.preferred_context = MessageContext::NEWS;
     news_criteria.min_priority = MessagePriority::HIGH;
     news_criteria.max_age = std::chrono::minutes{30};
-    context_criteria_[MessageContext::NEWS] = news_criteria;
+    // news, traffic and weather bulletins; emergency alerts always
+    news_criteria.allowed_sources = {
+        ContentSource::NEWS_API, ContentSource::RSS_FEED, ContentSource::WEATHER_API,
+        ContentSource::TRAFFIC_API, ContentSource::MANUAL, ContentSource::EMERGENCY_SYSTEM
+    };
+    SetContextCriteria(MessageContext::NEWS, news_criteria);
     
     SelectionCriteria emergency_criteria;
     emergency_criteria.preferred_context = MessageContext::EMERGENCY;
@@ -464,7 +1025,7 @@ ContextAwareSelector::ContextAwareSelector() {
     emergency_criteria.allow_repeats = true;
     emergency_criteria.max_repeat_count = 10;
     emergency_criteria.min_repeat_interval = std::chrono::seconds{30};
-    context_criteria_[MessageContext::EMERGENCY] = emergency_criteria;
+    SetContextCriteria(MessageContext::EMERGENCY, emergency_criteria);
 }
 
 void ContextAwareSelector::SetCurrentContext(MessageContext context) {
@@ -479,16 +1040,10 @@ double ContextAwareSelector::CalculateContextScore(const DLSMessage& message) co
         score += 0.3;
     }
     
-    // Check source preferences for current context
-    auto pref_it = context_source_preferences_.find(current_context_);
-    if (pref_it != context_source_preferences_.end()) {
-        auto& preferred_sources = pref_it->second;
-        auto source_it = std::find(preferred_sources.begin(), preferred_sources.end(), message.source);
-        if (source_it != preferred_sources.end()) {
-            // Higher score for more preferred sources
-            size_t preference_index = std::distance(preferred_sources.begin(), source_it);
-            score += 0.2 * (1.0 - static_cast<double>(preference_index) / preferred_sources.size());
-        }
+    // Bonus of the source among the preferences of the current context
+    const size_t source = static_cast<size_t>(message.source);
+    if (source < CompiledCriteria::SOURCE_TYPES) {
+        score += GetCurrentCriteria().source_bonus[source];
     }
     
     return score;
@@ -502,6 +1057,43 @@ double ContextAwareSelector::CalculateRecencyScore(const DLSMessage& message) co
     return std::exp(-age / 12.0);
 }
 
+std::shared_ptr<DLSMessage> ContextAwareSelector::SelectBestMessage(const std::vector<std::shared_ptr<DLSMessage>>& candidates) {
+    // Single pass, scoring each candidate once
+    std::shared_ptr<DLSMessage> best;
+    double best_score = 0.0;
+    for (const auto& candidate : candidates) {
+        if (!candidate) {
+            continue;
+        }
+        double score = DefaultScoringFunction(*candidate) * CalculateContextScore(*candidate);
+        if (!best || score > best_score) {
+            best = candidate;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+SelectionCriteria ContextAwareSelector::GetCriteriaForContext(MessageContext context) const {
+    const size_t index = static_cast<size_t>(context);
+    return index < CONTEXTS ? compiled_criteria_[index].criteria : SelectionCriteria();
+}
+
+void ContextAwareSelector::SetContextCriteria(MessageContext context, const SelectionCriteria& criteria) {
+    const size_t index = static_cast<size_t>(context);
+    if (index < CONTEXTS) {
+        compiled_criteria_[index] = CompiledCriteria(criteria, context_source_preferences_[index]);
+    }
+}
+
+void ContextAwareSelector::SetContextSources(MessageContext context, const std::vector<ContentSource>& preferred_sources) {
+    const size_t index = static_cast<size_t>(context);
+    if (index < CONTEXTS) {
+        context_source_preferences_[index] = preferred_sources;
+        compiled_criteria_[index] = CompiledCriteria(compiled_criteria_[index].criteria, preferred_sources);
+    }
+}
+
 double ContextAwareSelector::DefaultScoringFunction(const DLSMessage& message) {
     double score = 0.0;
     
@@ -524,6 +1116,19 @@ double ContextAwareSelector::DefaultScoringFunction(const DLSMessage& message) {
     return score;
 }
 
+double ContextAwareSelector::RecencyBasedScoring(const DLSMessage& message) {
+    auto now = std::chrono::system_clock::now();
+    auto age_minutes = std::chrono::duration_cast<std::chrono::minutes>(now - message.created_at).count();
+    
+    // Exponential decay with 1-hour half-life
+    return std::exp2(-std::max<double>(age_minutes, 0) / 60.0);
+}
+
+double ContextAwareSelector::PriorityBasedScoring(const DLSMessage& message) {
+    // 1.0 for EMERGENCY down to 0.2 for BACKGROUND, the importance breaking ties
+    return (5 - static_cast<int>(message.priority)) * 0.2 + message.importance_score * 0.01;
+}
+
 SmartDLSProcessor::SmartDLSProcessor() {
     stats_.start_time = std::chrono::system_clock::now();
 }
@@ -536,8 +1141,16 @@ bool SmartDLSProcessor::AddMessage(const std::string& text,
                                   MessagePriority priority,
                                   ContentSource source,
                                   const std::map<std::string, std::string>& metadata) {
-    auto message = std::make_shared<DLSMessage>();
-    message->text = text;
+    if (text.empty()) {
+        stats_.messages_rejected++;
+        return false;
+    }
+    
+    auto message = DLSMessage::Create();
+    // without surrounding whitespace; only whitespace, a blank label
+    const size_t text_start = text.find_first_not_of(" \t\r\n");
+    message->text = text_start == std::string::npos ? "" :
+        text.substr(text_start, text.find_last_not_of(" \t\r\n") + 1 - text_start);
     message->priority = priority;
     message->source = source;
     message->metadata = metadata;
@@ -547,8 +1160,8 @@ bool SmartDLSProcessor::AddMessage(const std::string& text,
     message->is_thai_content = text.find_first_of("กขคฆงจฉชซฌญฎฏฐฑฒณดตถทธนบปผฝพฟภมยรลวศษสหฬอฮ") != std::string::npos;
     
     // Optimize message if too long
-    if (text.length() > max_message_length_) {
-        auto optimization_result = optimizer_.OptimizeMessage(text, max_message_length_);
+    if (message->text.length() > max_message_length_) {
+        auto optimization_result = optimizer_.OptimizeMessage(message->text, max_message_length_);
         message->text = optimization_result.optimized_text;
         message->metadata["optimization_applied"] = "true";
         message->metadata["original_length"] = std::to_string(optimization_result.original_length);
@@ -556,8 +1169,18 @@ bool SmartDLSProcessor::AddMessage(const std::string& text,
         stats_.messages_optimized++;
     }
     
-    if (message_queue_.AddMessage(message)) {
+    if (priority == MessagePriority::EMERGENCY) {
+        {
+            std::lock_guard<std::mutex> lock(emergency_mutex_);
+            pending_emergency_ = message->text;
+            emergency_pending_ = true;
+        }
+        WakeBackgroundProcessing();
+    }
+    
+    if (incoming_.Push(std::move(message))) {
         stats_.messages_processed++;
+        generation_++;
         return true;
     } else {
         stats_.messages_rejected++;
@@ -565,32 +1188,148 @@ bool SmartDLSProcessor::AddMessage(const std::string& text,
     }
 }
 
-std::string SmartDLSProcessor::GetNextDLSText() {
-    auto criteria = selector_.GetCriteriaForContext(selector_.GetCurrentContext());
-    criteria.scoring_function = ContextAwareSelector::DefaultScoringFunction;
+void SmartDLSProcessor::DrainIncoming() {
+    // a bounded batch per selection; the rest follows on the next ones
+    std::shared_ptr<DLSMessage> message;
+    bool added = false;
+    for (size_t i = 0; i < INCOMING_BATCH && incoming_.Pop(message); i++) {
+        if (message_queue_.AddMessage(message)) {
+            added = true;
+        } else {
+            stats_.messages_rejected++;    // duplicate
+        }
+    }
+    
+    // their expiry may be due before the background loop's next wakeup
+    if (added) {
+        WakeBackgroundProcessing();
+    }
+}
+
+void SmartDLSProcessor::WakeBackgroundProcessing() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        wake_pending_ = true;
+    }
+    wake_cv_.notify_one();
+}
+
+std::shared_ptr<DLSMessage> SmartDLSProcessor::SelectNextMessage() {
+    DrainIncoming();
     
-    auto message = message_queue_.GetNextMessage(criteria);
+    // the current context's entry of the compiled table, not a copy of its criteria
+    auto message = message_queue_.GetNextMessage(selector_.GetCurrentCriteria(), ContextAwareSelector::DefaultScoringFunction);
     if (message) {
         stats_.messages_sent++;
         last_message_time_ = std::chrono::steady_clock::now();
-        return message->text;
+        generation_++;
+    }
+    return message;
+}
+
+std::string SmartDLSProcessor::GetNextDLSText() {
+    auto message = SelectNextMessage();
+    return message ? message->text : "";
+}
+
+DL_STATE SmartDLSProcessor::ToDLState(const DLSMessage& message) {
+    DL_STATE dl_state;
+    dl_state.dl_text = message.text;
+    
+    // DL Plus ITEM.TITLE/ITEM.ARTIST, with the markers counting characters (not UTF-8 bytes)
+    static const std::pair<const char*, int> item_tags[] = {{"title", 1}, {"artist", 4}};
+    auto chars = [](const std::string& text, size_t begin, size_t end) {
+        int count = 0;
+        for (size_t i = begin; i < end; i++) {
+            if ((text[i] & 0xC0) != 0x80) {
+                count++;
+            }
+        }
+        return count;
+    };
+    for (const auto& item_tag : item_tags) {
+        auto value = message.metadata.find(item_tag.first);
+        if (value == message.metadata.end() || value->second.empty()) {
+            continue;
+        }
+        size_t pos = message.text.find(value->second);
+        if (pos == std::string::npos) {
+            continue;
+        }
+        dl_state.dl_plus_enabled = true;
+        dl_state.dl_plus_item_running = true;
+        dl_state.dl_plus_tags.emplace_back(item_tag.second, chars(message.text, 0, pos),
+                                           chars(message.text, pos, pos + value->second.size()) - 1);
+    }
+    
+    return dl_state;
+}
+
+void SmartDLSProcessor::IntegrateWithLegacyDLS(DLSEncoder& legacy_encoder) {
+    legacy_encoder_ = &legacy_encoder;
+}
+
+bool SmartDLSProcessor::EncodeNextLabel(const DL_PARAMS& dl_params) {
+    if (!legacy_encoder_) {
+        return false;
+    }
+    auto message = SelectNextMessage();
+    if (!message) {
+        return false;
     }
     
-    return "";
+    legacy_encoder_->encodeLabel(ToDLState(*message), dl_params);
+    return true;
 }
 
 void SmartDLSProcessor::SetContext(MessageContext context) {
     selector_.SetCurrentContext(context);
+    message_queue_.InvalidateScores();
+    generation_++;
+}
+
+void SmartDLSProcessor::SetMaxMessageLength(size_t length) {
+    max_message_length_ = length;
+}
+
+void SmartDLSProcessor::SetMessageInterval(std::chrono::seconds interval) {
+    default_message_interval_ = interval;
+}
+
+void SmartDLSProcessor::SetEmergencyInterval(std::chrono::seconds interval) {
+    emergency_message_interval_ = interval;
+}
+
+void SmartDLSProcessor::FeedFromRSS(const std::string& feed_url) {
+    feed_fetcher_.AddFeed(feed_url, std::make_unique<XMLFeedParser>(), [this, feed_url](FeedItem&& item) {
+        AddMessage(item.text, MessagePriority::NORMAL, ContentSource::RSS_FEED, {{"feed_url", feed_url}});
+    });
+}
+
+void SmartDLSProcessor::FeedFromSocialMedia(const std::string& platform, const std::string& account) {
+    const std::string feed_url = platform + "/@" + account + ".rss";
+    feed_fetcher_.AddFeed(feed_url, std::make_unique<XMLFeedParser>(), [this, feed_url](FeedItem&& item) {
+        AddMessage(item.text, MessagePriority::LOW, ContentSource::SOCIAL_MEDIA, {{"feed_url", feed_url}});
+    });
+}
+
+void SmartDLSProcessor::FeedFromWeatherAPI(const std::string& location) {
+    feed_fetcher_.AddFeed(location, std::make_unique<JSONFeedParser>("description"), [this, location](FeedItem&& item) {
+        AddMessage(item.text, MessagePriority::NORMAL, ContentSource::WEATHER_API, {{"feed_url", location}});
+    }, std::chrono::minutes{15});
 }
 
 void SmartDLSProcessor::Start() {
     if (!processing_active_.exchange(true)) {
         background_processor_ = std::thread(&SmartDLSProcessor::BackgroundProcessingLoop, this);
+        feed_fetcher_.Start();
     }
 }
 
 void SmartDLSProcessor::Stop() {
     if (processing_active_.exchange(false)) {
+        feed_fetcher_.Stop();
+        WakeBackgroundProcessing();
         if (background_processor_.joinable()) {
             background_processor_.join();
         }
@@ -600,14 +1339,25 @@ void SmartDLSProcessor::Stop() {
 void SmartDLSProcessor::BackgroundProcessingLoop() {
     while (processing_active_) {
         try {
-            // Periodic maintenance tasks
-            std::this_thread::sleep_for(std::chrono::seconds(30));
+            // Sleep until the next message or content hash expires, or until woken
+            const auto next_cleanup = message_queue_.GetNextCleanup();
+            {
+                std::unique_lock<std::mutex> lock(wake_mutex_);
+                auto woken = [this]() { return wake_pending_ || !processing_active_; };
+                if (next_cleanup == std::chrono::system_clock::time_point::max()) {
+                    wake_cv_.wait(lock, woken);
+                } else {
+                    wake_cv_.wait_until(lock, next_cleanup, woken);
+                }
+                wake_pending_ = false;
+            }
+            if (!processing_active_) {
+                break;
+            }
             
             // Clean up expired messages
             message_queue_.CleanupMessages();
-            
-            // Update statistics
-            // Additional background processing can be added here
+            generation_++;
             
         } catch (const std::exception& e) {
             std::cerr << "Error in DLS background processing: " << e.what() << std::endl;
@@ -617,7 +1367,7 @@ void SmartDLSProcessor::BackgroundProcessingLoop() {
 
 SmartDLSProcessor::SystemStatistics SmartDLSProcessor::GetStatistics() const {
     SystemStatistics stats;
-    stats.queue_size = message_queue_.GetQueueSize();
+    stats.queue_size = message_queue_.GetQueueSize() + incoming_.Size();
     stats.messages_processed = stats_.messages_processed;
     stats.messages_sent = stats_.messages_sent;
     stats.messages_optimized = stats_.messages_optimized;
@@ -639,4 +1389,19 @@ SmartDLSProcessor::SystemStatistics SmartDLSProcessor::GetStatistics() const {
     return stats;
 }
 
-} // namespace StreamDAB
\ No newline at end of file
+bool SmartDLSProcessor::EncodePendingEmergency(DLSEncoder& encoder, const DL_PARAMS& dl_params) {
+    std::string text;
+    {
+        std::lock_guard<std::mutex> lock(emergency_mutex_);
+        if (!emergency_pending_)
+            return false;
+        text = pending_emergency_;
+        emergency_pending_ = false;
+    }
+    
+    encoder.encodeText(text, dl_params, true);
+    stats_.messages_sent++;
+    return true;
+}
+
+} // namespace StreamDAB
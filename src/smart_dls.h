@@ -13,12 +13,23 @@
 
 #include "common.h"
 #include "dls.h"
+#include "feed_fetcher.h"
+#include "flat_hash_map.h"
+#include "metrics.h"
+#include "mpsc_queue.h"
+#include "timer_wheel.h"
+#include <algorithm>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <queue>
 #include <map>
+#include <regex>
+#include <set>
+#include <unordered_map>
 #include <chrono>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
 #include <functional>
 #include <memory>
@@ -61,6 +72,77 @@ enum class ContentSource {
     EMERGENCY_SYSTEM    // Emergency alert system
 };
 
+// A string kept once for all its users (e.g. metadata keys), compared by
+// address; interned strings are never freed
+class InternedString {
+public:
+    InternedString();
+    InternedString(const std::string& str);
+    InternedString(const char* str) : InternedString(std::string(str)) {}
+    
+    const std::string& str() const { return *str_; }
+    operator const std::string&() const { return *str_; }
+    bool operator==(const InternedString& other) const { return str_ == other.str_; }
+    bool operator!=(const InternedString& other) const { return str_ != other.str_; }
+    
+private:
+    const std::string* str_;
+};
+
+// The metadata of a message: a few entries in one vector, with interned keys,
+// used like a std::map (in the order of adding, though)
+class MessageMetadata {
+public:
+    typedef std::pair<InternedString, std::string> Entry;
+    typedef std::vector<Entry>::iterator iterator;
+    typedef std::vector<Entry>::const_iterator const_iterator;
+    
+    MessageMetadata() = default;
+    MessageMetadata(const std::map<std::string, std::string>& metadata);
+    
+    iterator find(const std::string& key);
+    const_iterator find(const std::string& key) const;
+    std::string& operator[](const std::string& key);
+    
+    iterator begin() { return entries_.begin(); }
+    iterator end() { return entries_.end(); }
+    const_iterator begin() const { return entries_.begin(); }
+    const_iterator end() const { return entries_.end(); }
+    size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+    
+private:
+    std::vector<Entry> entries_;
+};
+
+// Recycles the memory of DLS messages created by DLSMessage::Create(), i.e.
+// of a message together with the control block of its shared_ptr
+class DLSMessagePool {
+public:
+    static const size_t MAX_FREE_BLOCKS;
+    
+    static void* Allocate(size_t size);
+    static void Release(void* block, size_t size);
+    static size_t FreeBlocks();
+};
+
+template<typename T>
+struct DLSMessageAllocator {
+    typedef T value_type;
+    
+    DLSMessageAllocator() = default;
+    template<typename U>
+    DLSMessageAllocator(const DLSMessageAllocator<U>&) {}
+    
+    T* allocate(size_t n) { return static_cast<T*>(DLSMessagePool::Allocate(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) { DLSMessagePool::Release(p, n * sizeof(T)); }
+    
+    template<typename U>
+    bool operator==(const DLSMessageAllocator<U>&) const { return true; }
+    template<typename U>
+    bool operator!=(const DLSMessageAllocator<U>&) const { return false; }
+};
+
 // DLS message metadata
 struct DLSMessage {
     std::string text;
@@ -74,8 +156,8 @@ struct DLSMessage {
     int max_sends = 0; // 0 = unlimited
     double importance_score = 0.5;
     std::string source_id;
-    std::string content_hash;
-    std::map<std::string, std::string> metadata;
+    uint64_t content_hash = 0;
+    MessageMetadata metadata;
     bool is_thai_content = false;
     size_t estimated_display_time_ms = 0;
     
@@ -86,6 +168,11 @@ struct DLSMessage {
         double user_engagement = 0.0;
         bool delivery_confirmed = false;
     } stats;
+    
+    // A new message, in one block recycled by the DLSMessagePool
+    static std::shared_ptr<DLSMessage> Create() {
+        return std::allocate_shared<DLSMessage>(DLSMessageAllocator<DLSMessage>());
+    }
 };
 
 // Message selection criteria
@@ -104,41 +191,114 @@ struct SelectionCriteria {
     std::function<double(const DLSMessage&)> scoring_function;
 };
 
+// Selection criteria compiled once for the selection loops: the sources
+// passing the allowlist/blocklist as a bitmask over ContentSource, and the
+// score bonus of each source preferred in a context
+struct CompiledCriteria {
+    static const size_t SOURCE_TYPES = static_cast<size_t>(ContentSource::EMERGENCY_SYSTEM) + 1;
+    static_assert(SOURCE_TYPES <= 32, "a bit per source");
+    
+    SelectionCriteria criteria;
+    uint32_t source_mask = 0;
+    double source_bonus[SOURCE_TYPES] = {};
+    
+    CompiledCriteria() : CompiledCriteria(SelectionCriteria()) {}
+    // preferred sources best first
+    explicit CompiledCriteria(const SelectionCriteria& criteria,
+                              const std::vector<ContentSource>& preferred_sources = {});
+    
+    static uint32_t SourceMask(const SelectionCriteria& criteria);
+    bool SourceAllowed(ContentSource source) const {
+        return static_cast<size_t>(source) < SOURCE_TYPES && (source_mask >> static_cast<size_t>(source)) & 1;
+    }
+};
+
 // Advanced message queue with priority and context awareness
 class SmartDLSQueue {
 private:
-    struct MessageComparator {
-        bool operator()(const std::shared_ptr<DLSMessage>& a, 
-                       const std::shared_ptr<DLSMessage>& b) const {
-            // Lower priority value = higher priority
-            if (a->priority != b->priority) {
-                return static_cast<int>(a->priority) > static_cast<int>(b->priority);
+    static const size_t PRIORITY_LEVELS = static_cast<size_t>(MessagePriority::BACKGROUND) + 1;
+    static const size_t SOURCE_TYPES = static_cast<size_t>(ContentSource::EMERGENCY_SYSTEM) + 1;
+    
+    // A queued message, with its ranking as of adding it and its score of the
+    // scored selection (valid while score_epoch is the current epoch)
+    struct QueuedMessage {
+        double importance;
+        std::chrono::system_clock::time_point created_at;
+        std::shared_ptr<DLSMessage> message;
+        mutable double score = 0.0;
+        mutable uint64_t score_epoch = 0;
+    };
+    struct QueuedMessageOrder {
+        bool operator()(const QueuedMessage& a, const QueuedMessage& b) const {
+            // Higher importance score first, then newer messages first
+            if (a.importance != b.importance) {
+                return a.importance > b.importance;
             }
-            // Higher importance score = higher priority
-            if (std::abs(a->importance_score - b->importance_score) > 0.001) {
-                return a->importance_score < b->importance_score;
+            if (a.created_at != b.created_at) {
+                return a.created_at > b.created_at;
             }
-            // Newer messages have higher priority
-            return a->created_at < b->created_at;
+            return a.message.get() < b.message.get();
         }
     };
+    typedef std::set<QueuedMessage, QueuedMessageOrder> MessageBucket;
     
-    std::priority_queue<std::shared_ptr<DLSMessage>, 
-                       std::vector<std::shared_ptr<DLSMessage>>,
-                       MessageComparator> priority_queue_;
+    // The queued messages by priority, source and whether Thai content, each bucket best first;
+    // a selection only visits the buckets matching its criteria
+    MessageBucket buckets_[PRIORITY_LEVELS][SOURCE_TYPES][2];
+    std::unordered_map<const DLSMessage*, MessageBucket::iterator> bucket_index_;
     
-    std::map<std::string, std::shared_ptr<DLSMessage>> message_index_;
-    mutable std::mutex queue_mutex_;
+    FlatHashMap<std::shared_ptr<DLSMessage>> message_index_;    // by source ID
+    mutable ProfiledMutex queue_mutex_{"dls_queue"};
     std::atomic<size_t> total_messages_{0};
     std::atomic<size_t> expired_messages_{0};
+    std::atomic<size_t> sent_messages_{0};
+    
+    // Aggregates of the queued messages, kept up to date on adding and
+    // unqueueing, so that statistics can be read without the queue lock
+    std::atomic<size_t> queued_messages_{0};
+    std::atomic<size_t> priority_counts_[PRIORITY_LEVELS] = {};
+    std::atomic<size_t> source_counts_[SOURCE_TYPES] = {};
+    std::atomic<int64_t> importance_sum_{0};    // in millionths
+    std::multiset<std::chrono::system_clock::time_point> created_times_;
+    std::atomic<std::chrono::system_clock::rep> oldest_message_{0};
+    std::atomic<std::chrono::system_clock::rep> newest_message_{0};
+    
+    // Message deduplication: creation time by content hash, kept for the dedup window
+    static const std::chrono::seconds DEDUP_WINDOW;
+    std::unordered_map<uint64_t, std::chrono::system_clock::time_point> content_hashes_;
+    
+    // Expiry of the queued messages and of the content hashes
+    TimerWheel<std::weak_ptr<DLSMessage>> expiry_wheel_;
+    TimerWheel<uint64_t> dedup_wheel_;
+    
+    // Scores of the scored selection are kept for one epoch, which ends when
+    // the scorer changes, on InvalidateScores() or after SCORE_TTL (as scores
+    // may depend on the time); a sent message is scored anew
+    static const std::chrono::seconds SCORE_TTL;
+    uint64_t score_epoch_ = 1;
+    const void* score_key_ = nullptr;
+    std::chrono::system_clock::time_point score_epoch_start_;
+    
+    // Tells functor types apart for the score cache
+    template<typename Scorer>
+    struct ScorerKey {
+        static const char tag;
+    };
     
-    // Message deduplication
-    std::map<std::string, std::chrono::system_clock::time_point> content_hashes_;
-    
-    void CleanupExpiredMessages();
-    std::string GenerateContentHash(const std::string& text) const;
-    bool IsDuplicate(const std::string& content_hash, 
-                    std::chrono::seconds dedup_window = std::chrono::seconds{3600}) const;
+    template<typename Scorer>
+    std::shared_ptr<DLSMessage> SelectScored(const SelectionCriteria& criteria, uint32_t source_mask,
+                                             const Scorer& scorer, const void* key);
+    std::shared_ptr<DLSMessage> MarkSent(const std::shared_ptr<DLSMessage>& message,
+                                         std::chrono::system_clock::time_point now);
+    size_t CleanupExpiredMessages();
+    void ExpireContentHashes(std::chrono::system_clock::time_point now);
+    void Unqueue(const std::shared_ptr<DLSMessage>& message);
+    void CountMessage(const QueuedMessage& queued, int sign);
+    static bool IsEligible(const DLSMessage& message, const SelectionCriteria& criteria,
+                           std::chrono::system_clock::time_point now);
+    static uint64_t GenerateContentHash(const std::string& text);
+    bool IsDuplicate(uint64_t content_hash, 
+                    std::chrono::seconds dedup_window = DEDUP_WINDOW) const;
     
 public:
     SmartDLSQueue();
@@ -147,6 +307,19 @@ public:
     // Core queue operations
     bool AddMessage(std::shared_ptr<DLSMessage> message);
     std::shared_ptr<DLSMessage> GetNextMessage(const SelectionCriteria& criteria);
+    
+    // Selection by the highest score of the given scorer (instead of
+    // criteria.scoring_function), each eligible message scored once per epoch.
+    // Scores of a functor are cached per type, so a functor with state must
+    // be followed by InvalidateScores() when its state changes.
+    template<typename Scorer>
+    std::shared_ptr<DLSMessage> GetNextMessage(const SelectionCriteria& criteria, const Scorer& scorer);
+    std::shared_ptr<DLSMessage> GetNextMessage(const SelectionCriteria& criteria, double (*scorer)(const DLSMessage&));
+    // as above, with the source mask compiled in advance
+    template<typename Scorer>
+    std::shared_ptr<DLSMessage> GetNextMessage(const CompiledCriteria& compiled, const Scorer& scorer);
+    std::shared_ptr<DLSMessage> GetNextMessage(const CompiledCriteria& compiled, double (*scorer)(const DLSMessage&));
+    void InvalidateScores();    // e.g. on a context change or an updated message
     bool RemoveMessage(const std::string& message_id);
     void ClearQueue();
     
@@ -170,9 +343,106 @@ public:
     
     // Maintenance
     size_t CleanupMessages();
+    // When CleanupMessages() has something to do next; time_point::max(), if nothing
+    std::chrono::system_clock::time_point GetNextCleanup() const;
     void OptimizeQueue();
 };
 
+template<typename Scorer>
+const char SmartDLSQueue::ScorerKey<Scorer>::tag = 0;
+
+template<typename Scorer>
+std::shared_ptr<DLSMessage> SmartDLSQueue::GetNextMessage(const SelectionCriteria& criteria, const Scorer& scorer) {
+    return SelectScored(criteria, CompiledCriteria::SourceMask(criteria), scorer, &ScorerKey<Scorer>::tag);
+}
+
+template<typename Scorer>
+std::shared_ptr<DLSMessage> SmartDLSQueue::GetNextMessage(const CompiledCriteria& compiled, const Scorer& scorer) {
+    return SelectScored(compiled.criteria, compiled.source_mask, scorer, &ScorerKey<Scorer>::tag);
+}
+
+template<typename Scorer>
+std::shared_ptr<DLSMessage> SmartDLSQueue::SelectScored(const SelectionCriteria& criteria, uint32_t source_mask,
+                                                        const Scorer& scorer, const void* key) {
+    std::lock_guard<ProfiledMutex> lock(queue_mutex_);
+    
+    const auto now = std::chrono::system_clock::now();
+    if (!key || key != score_key_ || now - score_epoch_start_ >= SCORE_TTL) {
+        score_epoch_++;
+        score_key_ = key;
+        score_epoch_start_ = now;
+    }
+    
+    const size_t first_priority = static_cast<size_t>(criteria.max_priority);
+    const size_t last_priority = std::min(static_cast<size_t>(criteria.min_priority), PRIORITY_LEVELS - 1);
+    
+    // Best score among all eligible messages
+    const QueuedMessage* selected = nullptr;
+    for (size_t priority = first_priority; priority <= last_priority; priority++) {
+        for (size_t source = 0; source < SOURCE_TYPES; source++) {
+            if (!((source_mask >> source) & 1)) {
+                continue;
+            }
+            for (const MessageBucket& bucket : buckets_[priority][source]) {
+                for (const QueuedMessage& queued : bucket) {
+                    if (!IsEligible(*queued.message, criteria, now)) {
+                        continue;
+                    }
+                    if (queued.score_epoch != score_epoch_) {
+                        queued.score = scorer(static_cast<const DLSMessage&>(*queued.message));
+                        queued.score_epoch = score_epoch_;
+                    }
+                    if (!selected || queued.score > selected->score) {
+                        selected = &queued;
+                    }
+                }
+            }
+        }
+    }
+    
+    if (!selected) {
+        return nullptr;
+    }
+    selected->score_epoch = 0;
+    return MarkSent(selected->message, now);
+}
+
+// Replaces many literal patterns in a single pass over the text, by means of
+// an Aho-Corasick automaton; of overlapping matches, the leftmost (then the
+// longest, then the first added) pattern wins
+class LiteralReplacer {
+public:
+    void Clear();
+    void Add(const std::string& pattern, const std::string& replacement);
+    void Build();   // after adding the patterns
+    
+    // the indices (in the order added) of the patterns replaced are appended to used
+    std::string Apply(const std::string& text, std::vector<size_t>* used = nullptr) const;
+    // the same over code points, the patterns matching by their UTF-8
+    // encoding; into result, whose memory is reused
+    void Apply(const std::vector<uint32_t>& text, std::vector<uint32_t>& result, std::vector<size_t>* used = nullptr) const;
+    
+private:
+    struct Pattern {
+        std::string text;
+        std::string replacement;
+        size_t chars = 0;                       // code points of text
+        std::vector<uint32_t> replacement_chars;
+    };
+    struct Match {
+        size_t start;
+        size_t length;
+        int32_t pattern;
+    };
+    std::vector<Pattern> patterns_;
+    std::vector<int32_t> transitions_;  // 256 per state
+    std::vector<int32_t> match_;        // per state: the longest pattern ending there, -1 if none
+    std::vector<int32_t> next_match_;   // per state: the next shorter state with a match, -1 if none
+    
+    // leftmost, then longest, then first added
+    static void SortMatches(std::vector<Match>& matches);
+};
+
 // Dynamic message length optimizer
 class MessageLengthOptimizer {
 private:
@@ -181,13 +451,22 @@ private:
         std::string replacement;
         size_t priority = 0;
         bool thai_specific = false;
+        bool is_regex = false;          // otherwise a literal
     };
     
     std::vector<OptimizationRule> abbreviation_rules_;
     std::vector<OptimizationRule> compression_rules_;
     std::map<std::string, std::string> common_phrases_;
     
+    // The phrase and abbreviation rules, compiled once; by whether for Thai content
+    LiteralReplacer replacers_[2];
+    std::vector<std::string> replacer_rule_names_[2];
+    std::vector<std::pair<std::regex, OptimizationRule>> regex_rules_;
+    mutable std::once_flag rules_once_;     // all of the above, built on first use
+    
     void InitializeRules();
+    void CompileRules();
+    void EnsureRules() const;
     
 public:
     MessageLengthOptimizer();
@@ -210,21 +489,34 @@ public:
     std::string RemoveRedundancy(const std::string& text);
     std::string SmartTruncate(const std::string& text, size_t max_length);
     
+    // As above, into a caller's buffer (replacing its content), so that they
+    // do not allocate once it has grown; text must not point into it. A cut
+    // is only ever made between code points.
+    static void RemoveRedundancy(std::string_view text, std::string& out);
+    static void SmartTruncate(std::string_view text, size_t max_length, std::string& out);
+    
     // Configuration
     void AddCustomRule(const OptimizationRule& rule);
     void LoadRulesFromFile(const std::string& filename);
+    
+    // the compiled phrase and abbreviation rules (not the regex ones)
+    const LiteralReplacer& GetReplacer(bool thai_content) const;
 };
 
 // Context-aware message selector
+//
+// The criteria and source preferences of each context are compiled into a
+// table indexed by context, so that a context switch only selects its entry.
 class ContextAwareSelector {
 private:
+    static const size_t CONTEXTS = static_cast<size_t>(MessageContext::OFF_AIR) + 1;
+    
     MessageContext current_context_ = MessageContext::AUTOMATED;
-    std::map<MessageContext, std::vector<ContentSource>> context_source_preferences_;
-    std::map<MessageContext, SelectionCriteria> context_criteria_;
+    std::vector<ContentSource> context_source_preferences_[CONTEXTS];
+    CompiledCriteria compiled_criteria_[CONTEXTS];
     
     double CalculateContextScore(const DLSMessage& message) const;
     double CalculateRecencyScore(const DLSMessage& message) const;
-    double CalculateRelevanceScore(const DLSMessage& message) const;
     
 public:
     ContextAwareSelector();
@@ -236,6 +528,11 @@ public:
     
     SelectionCriteria GetCriteriaForContext(MessageContext context) const;
     void SetContextCriteria(MessageContext context, const SelectionCriteria& criteria);
+    void SetContextSources(MessageContext context, const std::vector<ContentSource>& preferred_sources);
+    // the compiled criteria of the current context
+    const CompiledCriteria& GetCurrentCriteria() const {
+        return compiled_criteria_[static_cast<size_t>(current_context_)];
+    }
     
     // Scoring functions
     static double DefaultScoringFunction(const DLSMessage& message);
@@ -285,11 +582,33 @@ private:
     MessageLengthOptimizer optimizer_;
     ContextAwareSelector selector_;
     MetadataExtractor extractor_;
+    FeedFetcher feed_fetcher_;      // feeds new items into the ingestion ring
+    std::atomic<uint64_t> generation_{0};   // of the queued messages and the context
     
     std::atomic<bool> processing_active_{false};
     std::thread background_processor_;
+    
+    // The background loop sleeps until the next cleanup is due or it is woken
+    // (on stopping, on new messages in the queue, on an emergency message)
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    bool wake_pending_ = false;
     std::chrono::steady_clock::time_point last_message_time_;
     
+    // Ingestion: producers (feeds, API) push here without locking; the queue
+    // takes the messages over in batches on selection, so that a burst of
+    // incoming messages does not hold up the next label
+    static const size_t INCOMING_LEN;
+    static const size_t INCOMING_BATCH;
+    MPSCQueue<std::shared_ptr<DLSMessage>> incoming_{INCOMING_LEN};
+    
+    DLSEncoder* legacy_encoder_ = nullptr;
+    
+    // Emergency text waiting to preempt the PAD; handed over to the PAD thread
+    std::mutex emergency_mutex_;
+    std::string pending_emergency_;
+    bool emergency_pending_ = false;
+    
     // Configuration
     size_t max_message_length_ = 128;
     std::chrono::seconds default_message_interval_{12}; // 12 seconds default
@@ -307,12 +626,19 @@ private:
     void BackgroundProcessingLoop();
     bool ShouldSendMessage() const;
     std::chrono::seconds GetMessageInterval(MessagePriority priority) const;
+    void DrainIncoming();   // selection side only
+    std::shared_ptr<DLSMessage> SelectNextMessage();
+    static DL_STATE ToDLState(const DLSMessage& message);
+    void WakeBackgroundProcessing();
     
 public:
     SmartDLSProcessor();
     ~SmartDLSProcessor();
     
-    // Core processing interface
+    /*! Core processing interface; AddMessage() may be called from any
+     *  thread, GetNextDLSText() only from the selection one. Messages are
+     *  queued (and checked for duplicates) on the next selection.
+     */
     bool AddMessage(const std::string& text, 
                    MessagePriority priority = MessagePriority::NORMAL,
                    ContentSource source = ContentSource::MANUAL,
@@ -321,7 +647,12 @@ public:
     std::string GetNextDLSText();
     void SetContext(MessageContext context);
     
-    // Content feeding
+    /*! Content feeding; the feeds are polled in the background (while
+     *  started), and their new items added as messages.
+     *  Social media accounts are polled as RSS feeds (platform: the base URL
+     *  of e.g. a Mastodon instance); a weather location as the URL of a JSON
+     *  document, whose "description" values are taken.
+     */
     void FeedFromRSS(const std::string& feed_url);
     void FeedFromSocialMedia(const std::string& platform, const std::string& account);
     void FeedFromWeatherAPI(const std::string& location);
@@ -351,9 +682,20 @@ public:
         std::map<MessagePriority, size_t> priority_distribution;
     };
     SystemStatistics GetStatistics() const;
+    // increases with each change of the queue (or the context), for caching
+    // what is derived from it
+    uint64_t GetGeneration() const { return generation_; }
     
     // Integration with legacy DLS encoder
     void IntegrateWithLegacyDLS(DLSEncoder& legacy_encoder);
+    // Selects the next message and hands it to the integrated encoder as a
+    // DL state (with DL Plus tags for its "title"/"artist" metadata, if found
+    // in the text); from the selection thread. false, if nothing to encode.
+    bool EncodeNextLabel(const DL_PARAMS& dl_params);
+    
+    // Encodes a pending emergency message, preempting any other PAD data;
+    // to be called from the PAD thread before each frame
+    bool EncodePendingEmergency(DLSEncoder& encoder, const DL_PARAMS& dl_params);
 };
 
 } // namespace StreamDAB
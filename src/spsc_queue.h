@@ -0,0 +1,75 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file spsc_queue.h
+    \brief Lock-free single producer/single consumer queue
+*/
+
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+#include <atomic>
+#include <utility>
+#include <vector>
+
+
+// --- SPSCQueue -----------------------------------------------------------------
+/*! A bounded ring buffer for exactly one producer and one consumer thread.
+ * Neither side ever blocks: Push() fails if the queue is full and Pop()
+ * fails if it is empty.
+ */
+template<typename T>
+class SPSCQueue {
+private:
+    std::vector<T> slots;       // one slot always stays unused to tell full from empty
+    std::atomic<size_t> head;   // next slot to pop; only written by the consumer
+    std::atomic<size_t> tail;   // next slot to push; only written by the producer
+
+    size_t Next(size_t index) const {return (index + 1) % slots.size();}
+public:
+    SPSCQueue(size_t capacity) : slots(capacity + 1), head(0), tail(0) {}
+
+    size_t Capacity() const {return slots.size() - 1;}
+    bool Empty() const {return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);}
+    bool Full() const {return Next(tail.load(std::memory_order_acquire)) == head.load(std::memory_order_acquire);}
+
+    // producer side
+    bool Push(T&& item) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (Next(t) == head.load(std::memory_order_acquire))
+            return false;
+
+        slots[t] = std::move(item);
+        tail.store(Next(t), std::memory_order_release);
+        return true;
+    }
+
+    // consumer side
+    bool Pop(T& item) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+
+        item = std::move(slots[h]);
+        head.store(Next(h), std::memory_order_release);
+        return true;
+    }
+};
+
+#endif /* SPSC_QUEUE_H_ */
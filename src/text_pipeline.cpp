@@ -0,0 +1,322 @@
+/*
+    DLS Text Pipeline
+    Copyright (C) 2024 StreamDAB Project
+
+    Sanitising, shortening, transliterating and encoding label texts
+    in one pass over their code points
+*/
+
+#include "text_pipeline.h"
+#include "smart_dls.h"
+#include "utf8.h"
+#include "utf8_scan.h"
+#include <algorithm>
+#include <iterator>
+
+namespace StreamDAB {
+
+namespace {
+
+const char ELLIPSIS[] = "...";
+const size_t ELLIPSIS_LENGTH = sizeof(ELLIPSIS) - 1;
+
+bool IsWhitespace(uint32_t c) {
+    return c == ' ' || (c >= '\t' && c <= '\r') || c == 0x00A0 ||
+           (c >= 0x2000 && c <= 0x200A) || c == 0x2028 || c == 0x2029 ||
+           c == 0x202F || c == 0x205F || c == 0x3000;
+}
+
+// control and invisible formatting characters, dropped
+bool IsDropped(uint32_t c) {
+    return c < 0x20 || c == 0x7F || (c >= 0x80 && c <= 0x9F) || c == 0x00AD ||
+           (c >= 0x200B && c <= 0x200F) || c == 0x2060 || c == 0xFEFF;
+}
+
+// marks that must stay with the character before them
+bool IsCombining(uint32_t c) {
+    return (c >= 0x0300 && c <= 0x036F) || c == 0x0E31 ||
+           (c >= 0x0E34 && c <= 0x0E3A) || (c >= 0x0E47 && c <= 0x0E4E);
+}
+
+bool IsBreak(uint32_t c) {
+    return c == ' ' || c == ',' || c == '.' || c == '!' || c == '?';
+}
+
+// the ASCII form of a typographic character, nullptr if none
+const char* Transliteration(uint32_t c) {
+    switch (c) {
+        case 0x2018: case 0x2019: case 0x201A: case 0x201B: case 0x2032:
+            return "'";
+        case 0x201C: case 0x201D: case 0x201E: case 0x201F: case 0x2033:
+            return "\"";
+        case 0x2010: case 0x2011: case 0x2012: case 0x2013: case 0x2014:
+        case 0x2015: case 0x2212:
+            return "-";
+        case 0x2026:
+            return ELLIPSIS;
+        default:
+            return nullptr;
+    }
+}
+
+size_t CharLength(uint32_t c, bool utf8) {
+    if (!utf8 || c < 0x80) {
+        return 1;
+    }
+    return c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+}
+
+} // namespace
+
+// DLSTextPipeline implementation
+DLSTextPipeline::DLSTextPipeline(const MessageLengthOptimizer* optimizer)
+    : optimizer_(optimizer) {
+}
+
+DLSTextPipeline::Label DLSTextPipeline::Process(std::string_view text, const Options& options) {
+    Begin(text.size());
+    Add(text, options);
+    Finish();
+    return labels_.front();
+}
+
+const std::vector<DLSTextPipeline::Label>& DLSTextPipeline::ProcessBatch(const std::vector<std::string>& texts, const Options& options) {
+    size_t text_bytes = 0;
+    for (const auto& text : texts) {
+        text_bytes += text.size();
+    }
+    
+    Begin(text_bytes);
+    for (const auto& text : texts) {
+        Add(text, options);
+    }
+    Finish();
+    return labels_;
+}
+
+const std::vector<DLSTextPipeline::Label>& DLSTextPipeline::ProcessBatch(const std::vector<FeedItem>& items, const Options& options) {
+    size_t text_bytes = 0;
+    for (const auto& item : items) {
+        text_bytes += item.text.size();
+    }
+    
+    Begin(text_bytes);
+    for (const auto& item : items) {
+        Add(item.text, options);
+    }
+    Finish();
+    return labels_;
+}
+
+DL_PARAMS DLSTextPipeline::EncoderParams(const Label& label, DL_PARAMS dl_params) {
+    dl_params.raw_dls = true;
+    dl_params.charset = label.charset;
+    return dl_params;
+}
+
+void DLSTextPipeline::Begin(size_t text_bytes) {
+    arena_.clear();
+    arena_.reserve(text_bytes + ELLIPSIS_LENGTH);
+    labels_.clear();
+    offsets_.clear();
+}
+
+void DLSTextPipeline::Add(std::string_view text, const Options& options) {
+    Decode(text);
+    
+    bool utf8 = options.allow_utf8 && !FitsEBULatin();
+    bool shortened = false;
+    bool truncated = false;
+    if (EncodedLength(0, chars_.size(), utf8) > options.max_length) {
+        if (options.shorten) {
+            shortened = Shorten(utf8, options.max_length);
+            // the rules may have added characters EBU Latin lacks
+            utf8 = options.allow_utf8 && !FitsEBULatin();
+        }
+        if (EncodedLength(0, chars_.size(), utf8) > options.max_length) {
+            Truncate(utf8, options.max_length, options.shorten);
+            truncated = true;
+        }
+    }
+    
+    offsets_.push_back(arena_.size());
+    if (utf8) {
+        auto out = std::back_inserter(arena_);
+        for (uint32_t c : chars_) {
+            out = utf8::unchecked::append(c, out);
+        }
+    } else {
+        for (uint32_t c : chars_) {
+            const uint8_t ebu = converter_.encode(c);
+            arena_ += ebu ? static_cast<char>(ebu) : ' ';
+        }
+    }
+    labels_.push_back({{}, utf8 ? DABCharset::UTF8 : DABCharset::COMPLETE_EBU_LATIN, shortened, truncated});
+}
+
+void DLSTextPipeline::Finish() {
+    // only now the arena does not move any more
+    for (size_t i = 0; i < labels_.size(); i++) {
+        const size_t end = i + 1 < offsets_.size() ? offsets_[i + 1] : arena_.size();
+        labels_[i].text = std::string_view(arena_.data() + offsets_[i], end - offsets_[i]);
+    }
+}
+
+void DLSTextPipeline::Decode(std::string_view text) {
+    chars_.clear();
+    
+    bool pending_space = false;
+    const char* it = text.data();
+    const char* const end = it + text.size();
+    // validated a stretch at a time, which is then decoded without further checks
+    const char* valid_end = it + utf8_valid_prefix(it, end - it);
+    while (it != end) {
+        if (it == valid_end) {
+            ++it;                   // invalid bytes are dropped
+            valid_end = it + utf8_valid_prefix(it, end - it);
+            continue;
+        }
+        uint32_t c = static_cast<unsigned char>(*it);
+        if (c < 0x80) {
+            ++it;
+        } else {
+            c = utf8::unchecked::next(it);
+        }
+        
+        if (IsWhitespace(c)) {
+            pending_space = true;
+            continue;
+        }
+        if (IsDropped(c)) {
+            continue;
+        }
+        if (pending_space && !chars_.empty()) {
+            chars_.push_back(' ');
+        }
+        pending_space = false;
+        
+        const char* ascii = c >= 0x80 && !converter_.encode(c) ? Transliteration(c) : nullptr;
+        if (ascii) {
+            chars_.insert(chars_.end(), ascii, ascii + std::char_traits<char>::length(ascii));
+        } else {
+            chars_.push_back(c);
+        }
+    }
+}
+
+bool DLSTextPipeline::FitsEBULatin() const {
+    for (uint32_t c : chars_) {
+        if (!converter_.encode(c)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t DLSTextPipeline::EncodedLength(size_t begin, size_t end, bool utf8) const {
+    if (!utf8) {
+        return end - begin;
+    }
+    size_t length = 0;
+    for (size_t i = begin; i < end; i++) {
+        length += CharLength(chars_[i], true);
+    }
+    return length;
+}
+
+bool DLSTextPipeline::Shorten(bool utf8, size_t max_length) {
+    bool shortened = false;
+    
+    if (optimizer_) {
+        bool thai_content = false;
+        for (uint32_t c : chars_) {
+            if (c >= 0x0E01 && c <= 0x0E2E) {
+                thai_content = true;
+                break;
+            }
+        }
+        optimizer_->GetReplacer(thai_content).Apply(chars_, scratch_);
+        if (scratch_ != chars_) {
+            chars_.swap(scratch_);
+            shortened = true;
+        }
+    }
+    
+    if (EncodedLength(0, chars_.size(), utf8) > max_length) {
+        const size_t size = chars_.size();
+        RemoveRepeatedWords();
+        shortened |= chars_.size() != size;
+    }
+    
+    return shortened;
+}
+
+void DLSTextPipeline::RemoveRepeatedWords() {
+    // in place; words are separated by single spaces after Decode()
+    size_t out = 0;
+    size_t previous = 0;
+    size_t previous_length = 0;
+    bool first = true;
+    size_t i = 0;
+    while (i < chars_.size()) {
+        size_t end = i;
+        while (end < chars_.size() && chars_[end] != ' ') {
+            end++;
+        }
+        const size_t length = end - i;
+    
+        const bool repeated = !first && length == previous_length &&
+            std::equal(chars_.begin() + i, chars_.begin() + end, chars_.begin() + previous);
+        if (!repeated) {
+            if (!first) {
+                chars_[out++] = ' ';
+            }
+            std::copy(chars_.begin() + i, chars_.begin() + end, chars_.begin() + out);
+            previous = out;
+            previous_length = length;
+            out += length;
+            first = false;
+        }
+        i = end + 1;
+    }
+    chars_.resize(out);
+}
+
+void DLSTextPipeline::Truncate(bool utf8, size_t max_length, bool ellipsis) {
+    if (max_length <= ELLIPSIS_LENGTH) {
+        ellipsis = false;
+    }
+    const size_t budget = ellipsis ? max_length - ELLIPSIS_LENGTH : max_length;
+    
+    // the longest prefix that fits
+    size_t cut = 0;
+    size_t length = 0;
+    while (cut < chars_.size() && length + CharLength(chars_[cut], utf8) <= budget) {
+        length += CharLength(chars_[cut], utf8);
+        cut++;
+    }
+    // without separating marks from their base
+    while (cut > 0 && cut < chars_.size() && IsCombining(chars_[cut])) {
+        cut--;
+    }
+    
+    if (ellipsis) {
+        // at a word boundary, if there is one in the last 30%
+        for (size_t b = cut; b > 0 && b * 10 > cut * 7; b--) {
+            if (b < chars_.size() && IsBreak(chars_[b])) {
+                cut = b;
+                break;
+            }
+        }
+        while (cut > 0 && chars_[cut - 1] == ' ') {
+            cut--;
+        }
+    }
+    
+    chars_.resize(cut);
+    if (ellipsis) {
+        chars_.insert(chars_.end(), ELLIPSIS, ELLIPSIS + ELLIPSIS_LENGTH);
+    }
+}
+
+} // namespace StreamDAB
@@ -0,0 +1,93 @@
+/*
+    DLS Text Pipeline
+    Copyright (C) 2024 StreamDAB Project
+
+    Sanitising, shortening, transliterating and encoding label texts
+    in one pass over their code points
+*/
+
+#ifndef TEXT_PIPELINE_H_
+#define TEXT_PIPELINE_H_
+
+#include "charset.h"
+#include "dls.h"
+#include "feed_fetcher.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace StreamDAB {
+
+class MessageLengthOptimizer;
+
+// Turns UTF-8 texts into the bytes of DAB labels. Each text is decoded once
+// into code points, which all stages work on, and encoded at the end:
+//  1. sanitise: control and invisible characters dropped, whitespace runs
+//     as one space, trimmed
+//  2. transliterate: typographic characters that EBU Latin lacks (quotes,
+//     dashes, ellipsis) as their ASCII forms
+//  3. shorten, if the label is too long: the phrase and abbreviation rules
+//     of a MessageLengthOptimizer (not its regex ones), repeated words
+//     dropped, then cut at a word boundary with "..."
+//  4. encode: EBU Latin, if it has all characters; else UTF-8 (e.g. for
+//     Thai), if allowed; else EBU Latin with spaces for the others
+// Lengths are those of the encoded label, as DLSEncoder segments it. The
+// labels of a batch share one arena; like the code point buffers, it is
+// kept between calls, so that a warmed-up pipeline hardly allocates.
+// Not thread-safe; one pipeline per thread.
+class DLSTextPipeline {
+public:
+    struct Options {
+        size_t max_length = 128;    // bytes of the encoded label
+        bool shorten = true;        // otherwise just cut
+        bool allow_utf8 = true;
+    };
+
+    struct Label {
+        std::string_view text;      // encoded, in the arena until the next call
+        DABCharset charset;
+        bool shortened;             // by the rules or repeated words
+        bool truncated;
+    };
+
+    // with the rules of the optimizer, which must outlive the pipeline;
+    // without any, if nullptr
+    explicit DLSTextPipeline(const MessageLengthOptimizer* optimizer = nullptr);
+
+    Label Process(std::string_view text, const Options& options);
+    Label Process(std::string_view text) { return Process(text, Options()); }
+
+    // all items of e.g. a feed response; the labels in the same order
+    const std::vector<Label>& ProcessBatch(const std::vector<std::string>& texts, const Options& options);
+    const std::vector<Label>& ProcessBatch(const std::vector<FeedItem>& items, const Options& options);
+
+    // the parameters to hand a label to DLSEncoder::encodeText() with, so
+    // that it is not converted again
+    static DL_PARAMS EncoderParams(const Label& label, DL_PARAMS dl_params);
+
+private:
+    const MessageLengthOptimizer* optimizer_;
+    CharsetConverter converter_;
+
+    std::vector<uint32_t> chars_;
+    std::vector<uint32_t> scratch_;
+    std::string arena_;
+    std::vector<Label> labels_;
+    std::vector<size_t> offsets_;   // of the labels in the arena
+
+    void Begin(size_t text_bytes);
+    void Add(std::string_view text, const Options& options);
+    void Finish();
+
+    void Decode(std::string_view text);
+    bool FitsEBULatin() const;
+    size_t EncodedLength(size_t begin, size_t end, bool utf8) const;
+    bool Shorten(bool utf8, size_t max_length);
+    void RemoveRepeatedWords();
+    void Truncate(bool utf8, size_t max_length, bool ellipsis);
+};
+
+} // namespace StreamDAB
+
+#endif // TEXT_PIPELINE_H_
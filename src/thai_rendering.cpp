@@ -4,88 +4,127 @@
 */
 
 #include "thai_rendering.h"
+#include "thai_segmenter.h"
+#include "utf8_scan.h"
 #include <algorithm>
-#include <regex>
 #include <fstream>
 #include <sstream>
 #include <iomanip>
 #include <cmath>
 #include <iostream>
+#include <iterator>
+#include <locale>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace StreamDAB {
 
-ThaiLanguageProcessor::ThaiLanguageProcessor() {
-    InitializeUTF8ToDABMapping();
-    InitializeHolidayCalendar();
-    InitializeCulturalData();
-    InitializeFontMetrics();
-}
+namespace {
+
+// ETSI TS 101 756 Thai character set (0x0E) mapping, generated at compile
+// time: the Thai block U+0E00 - U+0E7F by code point - 0x0E00 to the DAB
+// byte (0 if not in the profile), and back
+struct ThaiDABMapping {
+    uint8_t thai_to_dab[128] = {};
+    uint16_t dab_to_thai[128] = {};
+};
 
-void ThaiLanguageProcessor::InitializeUTF8ToDABMapping() {
-    // ETSI TS 101 756 Thai character set (0x0E) mapping
+constexpr ThaiDABMapping BuildThaiDABMapping() {
+    ThaiDABMapping mapping;
     // Thai consonants (0x0E01 - 0x0E2E)
     for (uint16_t i = 0x0E01; i <= 0x0E2E; ++i) {
-        utf8_to_dab_map_[i] = static_cast<uint8_t>(i - 0x0E01 + 0x01);
+        mapping.thai_to_dab[i - 0x0E00] = static_cast<uint8_t>(i - 0x0E01 + 0x01);
     }
     
-    // Thai vowels (0x0E30 - 0x0E4F)
+    // Thai vowels, tone marks and special characters (0x0E30 - 0x0E4F)
     for (uint16_t i = 0x0E30; i <= 0x0E4F; ++i) {
-        utf8_to_dab_map_[i] = static_cast<uint8_t>(i - 0x0E30 + 0x30);
+        mapping.thai_to_dab[i - 0x0E00] = static_cast<uint8_t>(i - 0x0E30 + 0x30);
     }
     
     // Thai digits (0x0E50 - 0x0E59)
     for (uint16_t i = 0x0E50; i <= 0x0E59; ++i) {
-        utf8_to_dab_map_[i] = static_cast<uint8_t>(i - 0x0E50 + 0x50);
+        mapping.thai_to_dab[i - 0x0E00] = static_cast<uint8_t>(i - 0x0E50 + 0x50);
     }
     
     // Thai symbols
-    utf8_to_dab_map_[0x0E5A] = 0x5A; // Thai character angkhankhu
-    utf8_to_dab_map_[0x0E5B] = 0x5B; // Thai character khomut
-    
-    // Special Thai characters
-    utf8_to_dab_map_[0x0E4F] = 0x4F; // Thai character fongman
-    utf8_to_dab_map_[0x0E46] = 0x46; // Thai character maiyamok
-    utf8_to_dab_map_[0x0E47] = 0x47; // Thai character maitaikhu
-    
-    // Thai tone marks (0x0E48 - 0x0E4B)
-    utf8_to_dab_map_[0x0E48] = 0x48; // Thai character mai ek
-    utf8_to_dab_map_[0x0E49] = 0x49; // Thai character mai tho
-    utf8_to_dab_map_[0x0E4A] = 0x4A; // Thai character mai tri
-    utf8_to_dab_map_[0x0E4B] = 0x4B; // Thai character mai chattawa
-    
-    // Above vowels (0x0E34 - 0x0E3A)
-    for (uint16_t i = 0x0E34; i <= 0x0E3A; ++i) {
-        utf8_to_dab_map_[i] = static_cast<uint8_t>(i - 0x0E34 + 0x34);
-    }
-    
-    // Below vowels (0x0E38 - 0x0E3A)
-    utf8_to_dab_map_[0x0E38] = 0x38; // Thai character sara u
-    utf8_to_dab_map_[0x0E39] = 0x39; // Thai character sara uu
-    utf8_to_dab_map_[0x0E3A] = 0x3A; // Thai character phinthu
-}
-
-void ThaiLanguageProcessor::InitializeHolidayCalendar() {
-    // Buddhist holy days and Thai national holidays
-    // Note: This is a simplified calendar - full implementation would use astronomical calculations
-    
-    // Fixed national holidays
-    holiday_calendar_["วันปีใหม่"] = {2567, 2024, 1, 1, "มกราคม", "วันจันทร์", false, true, "วันปีใหม่", "New Year's Day"};
-    holiday_calendar_["วันมาฆบูชา"] = {2567, 2024, 2, 24, "กุมภาพันธ์", "วันเสาร์", true, true, "วันมาฆบูชา", "Magha Puja Day"};
-    holiday_calendar_["วันจักรี"] = {2567, 2024, 4, 6, "เมษายน", "วันเสาร์", false, true, "วันจักรี", "Chakri Day"};
-    holiday_calendar_["วันสงกรานต์"] = {2567, 2024, 4, 13, "เมษายน", "วันเสาร์", false, true, "วันสงกรานต์", "Songkran Festival"};
-    holiday_calendar_["วันแรงงาน"] = {2567, 2024, 5, 1, "พฤษภาคม", "วันพุธ", false, true, "วันแรงงานแห่งชาติ", "Labor Day"};
-    holiday_calendar_["วันฉัตรมงคล"] = {2567, 2024, 5, 4, "พฤษภาคม", "วันเสาร์", false, true, "วันฉัตรมงคล", "Coronation Day"};
-    holiday_calendar_["วันวิสาขบูชา"] = {2567, 2024, 5, 22, "พฤษภาคม", "วันพุธ", true, true, "วันวิสาขบูชา", "Vesak Day"};
-    holiday_calendar_["วันเฉลิมพระชนมพรรษา"] = {2567, 2024, 7, 28, "กรกฎาคม", "วันอาทิตย์", false, true, "วันเฉลิมพระชนมพรรษาพระบาทสมเด็จพระเจ้าอยู่หัว", "HM the King's Birthday"};
-    holiday_calendar_["วันแม่"] = {2567, 2024, 8, 12, "สิงหาคม", "วันจันทร์", false, true, "วันแม่แห่งชาติ", "Mother's Day"};
-    holiday_calendar_["วันปิยมหาราช"] = {2567, 2024, 10, 23, "ตุลาคม", "วันพุธ", false, true, "วันปิยมหาราช", "Chulalongkorn Day"};
-    holiday_calendar_["วันพ่อ"] = {2567, 2024, 12, 5, "ธันวาคม", "วันพฤหัสบดี", false, true, "วันพ่อแห่งชาติ", "Father's Day"};
-    holiday_calendar_["วันรัฐธรรมนูญ"] = {2567, 2024, 12, 10, "ธันวาคม", "วันอังคาร", false, true, "วันรัฐธรรมนูญ", "Constitution Day"};
+    mapping.thai_to_dab[0x0E5A - 0x0E00] = 0x5A; // Thai character angkhankhu
+    mapping.thai_to_dab[0x0E5B - 0x0E00] = 0x5B; // Thai character khomut
+    
+    // Reverse mapping, for DAB to UTF-8
+    for (uint16_t i = 0; i < 128; ++i) {
+        if (mapping.thai_to_dab[i] != 0 && mapping.dab_to_thai[mapping.thai_to_dab[i]] == 0) {
+            mapping.dab_to_thai[mapping.thai_to_dab[i]] = 0x0E00 + i;
+        }
+    }
+    return mapping;
+}
+
+constexpr ThaiDABMapping thai_dab_mapping = BuildThaiDABMapping();
+static_assert(thai_dab_mapping.thai_to_dab[0x0E01 - 0x0E00] == 0x01, "Thai consonants");
+static_assert(thai_dab_mapping.dab_to_thai[0x5B] == 0x0E5B, "Thai symbols");
+
+// The longest DLS label, in characters (ETSI EN 300 401)
+const size_t DLS_MAX_CHARS = 128;
+
+// Western digits as Thai ones (U+0E50 - U+0E59), other characters kept
+std::string ToThaiDigits(const std::string& text) {
+    std::string result;
+    result.reserve(3 * text.size());
+    for (char c : text) {
+        if (c >= '0' && c <= '9') {
+            utf8::append(0x0E50 + (c - '0'), std::back_inserter(result));
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+} // namespace
+
+// The calendar and the cultural terms are built on first use, so that an
+// instance without Thai content does not pay for them at start
+ThaiLanguageProcessor::ThaiLanguageProcessor() {
+    InitializeFontMetrics();
+}
+
+std::shared_ptr<const ThaiCalendar> ThaiLanguageProcessor::Calendar() const {
+    std::lock_guard<std::mutex> lock(calendar_mutex_);
+    if (!calendar_) {
+        // Buddhist holy days and Thai national holidays, by day
+        calendar_ = ThaiCalendar::Default();
+    }
+    return calendar_;
+}
+
+bool ThaiLanguageProcessor::LoadCalendar(const std::string& path) {
+    auto calendar = std::make_shared<ThaiCalendar>();
+    if (!calendar->Map(path)) {
+        return false;
+    }
+    SetCalendar(std::move(calendar));
+    return true;
+}
+
+void ThaiLanguageProcessor::SetCalendar(std::shared_ptr<const ThaiCalendar> calendar) {
+    std::lock_guard<std::mutex> lock(calendar_mutex_);
+    calendar_ = std::move(calendar);
+}
+
+const ThaiTermMatcher& ThaiLanguageProcessor::CulturalTerms() {
+    std::call_once(cultural_terms_once_, [this]() { InitializeCulturalData(); });
+    return cultural_terms_;
 }
 
 void ThaiLanguageProcessor::InitializeCulturalData() {
     // Royal vocabulary requiring special respect
-    royal_terms_ = {
+    static const char* const royal_terms[] = {
         "พระบาทสมเด็จพระเจ้าอยู่หัว", "สมเด็จพระนางเจ้า", "พระองค์", "พระราชา", 
         "พระราชินี", "เจ้าฟ้า", "พระเจ้าหลานเธอ", "หม่อมเจ้า", "หม่อมราชวงศ์",
         "พระบาทสมเด็จพระปรมินทรมหาภูมิพลอดุลยเดช", "สมเด็จพระนางเจ้าสิริกิติ์",
@@ -93,18 +132,29 @@ void ThaiLanguageProcessor::InitializeCulturalData() {
     };
     
     // Religious terms requiring respectful treatment
-    religious_terms_ = {
+    static const char* const religious_terms[] = {
         "พระพุทธเจ้า", "พระธรรม", "พระสงฆ์", "วัด", "พระ", "หลวงพ่อ", "หลวงปู่",
         "พระอริยสงฆ์", "พุทธศาสนา", "ธรรม", "วินัย", "สมาธิ", "วิปัสสนา", "นิพพาน",
         "บุญ", "กุศล", "อกุศล", "กรรม", "วิบาก", "บาป", "ปุณณะ", "ทาน", "ศีล"
     };
     
     // Inappropriate words for broadcasting
-    inappropriate_words_ = {
+    static const char* const inappropriate_words[] = {
         // This would contain actual inappropriate words in a real implementation
         // For demo purposes, keeping it minimal
         "เฮ้ย", "ชิบหาย", "บ้า", "โง่", "งี่เง่า"
     };
+    
+    for (const char* word : inappropriate_words) {
+        cultural_terms_.Add(word, ThaiTermMatcher::INAPPROPRIATE, 0.2);
+    }
+    for (const char* term : royal_terms) {
+        cultural_terms_.Add(term, ThaiTermMatcher::ROYAL, 0.0);
+    }
+    for (const char* term : religious_terms) {
+        cultural_terms_.Add(term, ThaiTermMatcher::RELIGIOUS, 0.0);
+    }
+    cultural_terms_.Compile();
 }
 
 void ThaiLanguageProcessor::InitializeFontMetrics() {
@@ -142,6 +192,32 @@ void ThaiLanguageProcessor::InitializeFontMetrics() {
     for (uint16_t i = 0x0E50; i <= 0x0E59; ++i) {
         font_metrics_.character_widths[i] = 8;
     }
+    
+    UpdateGlyphWidths();
+}
+
+void ThaiLanguageProcessor::UpdateGlyphWidths() {
+    std::fill(std::begin(latin_widths_), std::end(latin_widths_), DEFAULT_GLYPH_WIDTH);
+    std::fill(std::begin(thai_widths_), std::end(thai_widths_), DEFAULT_GLYPH_WIDTH);
+    other_widths_ = false;
+    for (const auto& width : font_metrics_.character_widths) {
+        if (width.first < 0x180) {
+            latin_widths_[width.first] = width.second;
+        } else if (width.first >= 0x0E00 && width.first < 0x0E80) {
+            thai_widths_[width.first - 0x0E00] = width.second;
+        } else {
+            other_widths_ = true;
+        }
+    }
+}
+
+void ThaiLanguageProcessor::SetFontMetrics(const ThaiFontMetrics& metrics) {
+    font_metrics_ = metrics;
+    UpdateGlyphWidths();
+    
+    std::lock_guard<std::mutex> lock(layout_cache_mutex_);
+    layout_cache_.clear();
+    layout_cache_order_.clear();
 }
 
 bool ThaiLanguageProcessor::IsThaiCharacter(uint16_t codepoint) const {
@@ -162,17 +238,17 @@ bool ThaiLanguageProcessor::IsThaiConsonant(uint16_t codepoint) const {
 
 bool ThaiLanguageProcessor::RequiresComplexLayout(const std::string& text) const {
     // Check for combining characters that require complex layout
-    std::u16string utf16_text;
-    // Convert UTF-8 to UTF-16 for easier processing
-    std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> converter;
-    try {
-        utf16_text = converter.from_bytes(text);
-    } catch (...) {
-        return false;
-    }
-    
-    for (char16_t c : utf16_text) {
-        if (IsThaiVowel(c) || IsThaiTone(c)) {
+    std::string::const_iterator it = text.begin();
+    while (it != text.end()) {
+        if (static_cast<uint8_t>(*it) < 0x80) {
+            ++it;
+            continue;
+        }
+        uint32_t codepoint = 0;
+        if (utf8::internal::validate_next(it, text.end(), codepoint) != utf8::internal::UTF8_OK) {
+            return false;
+        }
+        if (IsThaiVowel(codepoint) || IsThaiTone(codepoint)) {
             return true;
         }
     }
@@ -180,31 +256,48 @@ bool ThaiLanguageProcessor::RequiresComplexLayout(const std::string& text) const
 }
 
 bool ThaiLanguageProcessor::ConvertUTF8ToDAB(const std::string& utf8_text, std::vector<uint8_t>& dab_data) {
-    try {
+    if (utf8_text.empty()) {
         dab_data.clear();
-        dab_data.push_back(0x0E); // Thai character set identifier
-        
-        std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> converter;
-        std::u16string utf16_text = converter.from_bytes(utf8_text);
-        
-        for (char16_t c : utf16_text) {
-            auto it = utf8_to_dab_map_.find(c);
-            if (it != utf8_to_dab_map_.end()) {
-                dab_data.push_back(it->second);
-            } else if (c < 0x80) {
-                // ASCII characters
-                dab_data.push_back(static_cast<uint8_t>(c));
-            } else {
-                // Unsupported character, use replacement
-                dab_data.push_back(0x3F); // '?'
-            }
+        return false;
+    }
+    dab_data.resize(1 + utf8_text.size());
+    const size_t dab_size = ConvertUTF8ToDAB(utf8_text.data(), utf8_text.size(), dab_data.data(), dab_data.size());
+    if (dab_size == 0) {
+        dab_data.clear();
+        std::cerr << "Error converting UTF-8 to DAB: invalid UTF-8" << std::endl;
+        return false;
+    }
+    dab_data.resize(dab_size);
+    return true;
+}
+
+size_t ThaiLanguageProcessor::ConvertUTF8ToDAB(const char* utf8, size_t utf8_len, uint8_t* dab_data, size_t capacity) const {
+    if (capacity < 1 + utf8_len) {
+        return 0;
+    }
+    uint8_t* out = dab_data;
+    *out++ = 0x0E; // Thai character set identifier
+    
+    const char* it = utf8;
+    const char* end = utf8 + utf8_len;
+    while (it != end) {
+        // ASCII characters are kept as they are, a run at a time
+        const size_t ascii = utf8_ascii_prefix(it, end - it);
+        memcpy(out, it, ascii);
+        it += ascii;
+        out += ascii;
+        if (it == end) {
+            break;
         }
         
-        return true;
-    } catch (const std::exception& e) {
-        std::cerr << "Error converting UTF-8 to DAB: " << e.what() << std::endl;
-        return false;
+        uint32_t codepoint = 0;
+        if (utf8::internal::validate_next(it, end, codepoint) != utf8::internal::UTF8_OK) {
+            return 0;
+        }
+        const uint8_t dab_char = (codepoint & ~0x7Fu) == 0x0E00 ? thai_dab_mapping.thai_to_dab[codepoint - 0x0E00] : 0;
+        *out++ = dab_char != 0 ? dab_char : 0x3F; // unsupported character, use replacement '?'
     }
+    return out - dab_data;
 }
 
 std::string ThaiLanguageProcessor::ConvertDABToUTF8(const std::vector<uint8_t>& dab_data) {
@@ -212,115 +305,126 @@ std::string ThaiLanguageProcessor::ConvertDABToUTF8(const std::vector<uint8_t>&
         return ""; // Not Thai character set
     }
     
-    try {
-        std::u16string utf16_result;
-        
-        for (size_t i = 1; i < dab_data.size(); ++i) {
-            uint8_t dab_char = dab_data[i];
-            bool found = false;
-            
-            // Reverse lookup in mapping
-            for (const auto& pair : utf8_to_dab_map_) {
-                if (pair.second == dab_char) {
-                    utf16_result.push_back(pair.first);
-                    found = true;
-                    break;
-                }
-            }
-            
-            if (!found) {
-                if (dab_char < 0x80) {
-                    // ASCII character
-                    utf16_result.push_back(static_cast<char16_t>(dab_char));
-                } else {
-                    // Unknown character
-                    utf16_result.push_back(0x003F); // '?'
-                }
-            }
+    std::string utf8_result;
+    utf8_result.reserve(3 * (dab_data.size() - 1));
+    for (size_t i = 1; i < dab_data.size(); ++i) {
+        const uint8_t dab_char = dab_data[i];
+        if (dab_char < 0x80 && thai_dab_mapping.dab_to_thai[dab_char] != 0) {
+            utf8::append(thai_dab_mapping.dab_to_thai[dab_char], std::back_inserter(utf8_result));
+        } else if (dab_char < 0x80) {
+            // ASCII character
+            utf8_result += static_cast<char>(dab_char);
+        } else {
+            // Unknown character
+            utf8_result += '?';
         }
-        
-        std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> converter;
-        return converter.to_bytes(utf16_result);
-        
-    } catch (const std::exception& e) {
-        std::cerr << "Error converting DAB to UTF-8: " << e.what() << std::endl;
-        return "";
     }
+    return utf8_result;
 }
 
 ThaiTextLayout ThaiLanguageProcessor::AnalyzeTextLayout(const std::string& utf8_text, 
                                                         uint16_t max_width_pixels,
                                                         uint16_t max_lines) {
+    const size_t hash = std::hash<std::string>()(utf8_text) * 31 + ((static_cast<size_t>(max_width_pixels) << 16) | max_lines);
+    {
+        std::lock_guard<std::mutex> lock(layout_cache_mutex_);
+        auto it = layout_cache_.find(hash);
+        if (it != layout_cache_.end() && it->second.max_width_pixels == max_width_pixels &&
+            it->second.max_lines == max_lines && it->second.layout.original_text == utf8_text) {
+            layout_cache_order_.splice(layout_cache_order_.begin(), layout_cache_order_, it->second.order);
+            return it->second.layout;
+        }
+    }
+    
+    ThaiTextLayout layout = ComputeTextLayout(utf8_text, max_width_pixels, max_lines);
+    
+    std::lock_guard<std::mutex> lock(layout_cache_mutex_);
+    auto inserted = layout_cache_.emplace(hash, LayoutCacheEntry());
+    LayoutCacheEntry& entry = inserted.first->second;
+    if (!inserted.second) {
+        layout_cache_order_.erase(entry.order);
+    }
+    entry.max_width_pixels = max_width_pixels;
+    entry.max_lines = max_lines;
+    entry.layout = layout;
+    layout_cache_order_.push_front(hash);
+    entry.order = layout_cache_order_.begin();
+    if (layout_cache_.size() > LAYOUT_CACHE_CAPACITY) {
+        layout_cache_.erase(layout_cache_order_.back());
+        layout_cache_order_.pop_back();
+    }
+    return layout;
+}
+
+ThaiTextLayout ThaiLanguageProcessor::ComputeTextLayout(const std::string& utf8_text,
+                                                        uint16_t max_width_pixels,
+                                                        uint16_t max_lines) {
     ThaiTextLayout layout;
     layout.original_text = utf8_text;
     layout.requires_complex_layout = RequiresComplexLayout(utf8_text);
     
-    try {
-        std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> converter;
-        std::u16string utf16_text = converter.from_bytes(utf8_text);
-        
-        uint16_t current_line_width = 0;
-        uint16_t current_line = 0;
-        std::string current_line_text;
-        
-        for (size_t i = 0; i < utf16_text.length(); ++i) {
-            char16_t c = utf16_text[i];
-            uint8_t char_width = 8; // default width
-            
-            auto width_it = font_metrics_.character_widths.find(c);
-            if (width_it != font_metrics_.character_widths.end()) {
-                char_width = width_it->second;
-            }
-            
-            layout.character_positions.push_back(current_line_width);
-            layout.character_widths.push_back(char_width);
-            
-            current_line_width += char_width;
-            
-            // Check for line break
-            if (current_line_width > max_width_pixels || c == '\n') {
-                layout.line_breaks.push_back(current_line_text);
-                current_line_text.clear();
-                current_line_width = char_width;
-                current_line++;
-                
-                if (current_line >= max_lines) {
-                    break;
-                }
-            } else {
-                current_line_text += converter.to_bytes(std::u16string(1, c));
-            }
+    uint16_t current_line_width = 0;
+    uint16_t current_line = 0;
+    size_t line_start = 0;
+    bool truncated = false;
+    
+    std::string::const_iterator it = utf8_text.begin();
+    while (it != utf8_text.end()) {
+        const size_t pos = it - utf8_text.begin();
+        uint32_t c = 0;
+        if (utf8::internal::validate_next(it, utf8_text.end(), c) != utf8::internal::UTF8_OK) {
+            std::cerr << "Error analyzing text layout: invalid UTF-8" << std::endl;
+            layout.character_positions.clear();
+            layout.character_widths.clear();
+            layout.line_breaks.clear();
+            return layout;
         }
+        const uint8_t char_width = c == '\n' ? 0 : GlyphWidth(c);
         
-        if (!current_line_text.empty()) {
-            layout.line_breaks.push_back(current_line_text);
+        // Check for line break, before a character that does not fit
+        if (c != '\n' && current_line_width + char_width > max_width_pixels && pos > line_start) {
+            layout.line_breaks.push_back(utf8_text.substr(line_start, pos - line_start));
+            line_start = pos;
+            current_line_width = 0;
+            if (++current_line >= max_lines) {
+                truncated = true;
+                break;
+            }
         }
         
-        layout.total_width_pixels = max_width_pixels;
-        layout.total_height_pixels = layout.line_breaks.size() * font_metrics_.line_height;
-        
-        // Convert to DAB format
-        ConvertUTF8ToDAB(utf8_text, layout.dab_encoded_data);
+        layout.character_positions.push_back(current_line_width);
+        layout.character_widths.push_back(char_width);
+        current_line_width += char_width;
         
-    } catch (const std::exception& e) {
-        std::cerr << "Error analyzing text layout: " << e.what() << std::endl;
+        if (c == '\n') {
+            layout.line_breaks.push_back(utf8_text.substr(line_start, pos - line_start));
+            line_start = it - utf8_text.begin();
+            current_line_width = 0;
+            if (++current_line >= max_lines) {
+                truncated = true;
+                break;
+            }
+        }
+    }
+    
+    if (!truncated && line_start < utf8_text.size()) {
+        layout.line_breaks.push_back(utf8_text.substr(line_start));
     }
     
+    layout.total_width_pixels = max_width_pixels;
+    layout.total_height_pixels = layout.line_breaks.size() * font_metrics_.line_height;
+    
+    // Convert to DAB format
+    ConvertUTF8ToDAB(utf8_text, layout.dab_encoded_data);
+    
     return layout;
 }
 
 bool ThaiLanguageProcessor::FormatTextForDLS(const std::string& input_text, 
                                             std::string& output_text,
                                             size_t max_length) {
-    output_text = input_text;
-    
-    // Remove excessive whitespace
-    std::regex whitespace_regex(R"(\s+)");
-    output_text = std::regex_replace(output_text, whitespace_regex, " ");
-    
-    // Trim leading/trailing spaces
-    output_text.erase(0, output_text.find_first_not_of(" \t\n\r"));
-    output_text.erase(output_text.find_last_not_of(" \t\n\r") + 1);
+    // Whitespace runs as one space, trimmed, without invisible characters
+    output_text = ThaiTextUtils::NormalizeText(input_text);
     
     // Truncate if too long
     if (output_text.length() > max_length) {
@@ -348,21 +452,8 @@ std::string ThaiLanguageProcessor::FormatNumber(int number, ThaiNumberFormat for
         case ThaiNumberFormat::WESTERN_DIGITS:
             return std::to_string(number);
             
-        case ThaiNumberFormat::THAI_DIGITS: {
-            std::string result;
-            std::string western = std::to_string(number);
-            for (char c : western) {
-                if (c >= '0' && c <= '9') {
-                    // Convert western digit to Thai digit
-                    uint16_t thai_digit = 0x0E50 + (c - '0');
-                    std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> converter;
-                    result += converter.to_bytes(std::u16string(1, thai_digit));
-                } else {
-                    result += c;
-                }
-            }
-            return result;
-        }
+        case ThaiNumberFormat::THAI_DIGITS:
+            return ToThaiDigits(std::to_string(number));
         
         case ThaiNumberFormat::THAI_WORDS: {
             // Thai number words implementation
@@ -407,169 +498,1844 @@ std::string ThaiLanguageProcessor::FormatNumber(int number, ThaiNumberFormat for
     }
 }
 
+std::string ThaiLanguageProcessor::FormatDate(const std::chrono::system_clock::time_point& date, bool buddhist_era) {
+    const BuddhistDate bd = GetBuddhistDate(date);
+    
+    std::string result = bd.thai_day_name;
+    result += "ที่ ";
+    result += std::to_string(bd.day);
+    result += ' ';
+    result += bd.thai_month_name;
+    result += buddhist_era ? " พ.ศ. " : " ค.ศ. ";
+    result += std::to_string(buddhist_era ? bd.year_be : bd.year_ce);
+    return result;
+}
+
+std::string ThaiLanguageProcessor::FormatCurrency(double amount, bool use_thai_digits) {
+    // 1,234.56 บาท
+    char digits[32];
+    snprintf(digits, sizeof(digits), "%.2f", std::fabs(amount));
+    const std::string number = digits;
+    const size_t integer_len = number.find('.');
+    
+    std::string result = amount < 0 && number != "0.00" ? "-" : "";
+    for (size_t i = 0; i < integer_len; ++i) {
+        if (i > 0 && (integer_len - i) % 3 == 0) {
+            result += ',';
+        }
+        result += number[i];
+    }
+    result.append(number, integer_len, std::string::npos);
+    result += " บาท";
+    return use_thai_digits ? ToThaiDigits(result) : result;
+}
+
+std::string ThaiLanguageProcessor::FormatTime(const std::chrono::system_clock::time_point& time, bool use_thai_digits) {
+    // 14:30 น. (นาฬิกา)
+    auto time_t = std::chrono::system_clock::to_time_t(time);
+    struct tm tm;
+    localtime_r(&time_t, &tm);
+    
+    char clock[16];
+    snprintf(clock, sizeof(clock), "%02d:%02d", tm.tm_hour, tm.tm_min);
+    const std::string result = std::string(clock) + " น.";
+    return use_thai_digits ? ToThaiDigits(result) : result;
+}
+
 BuddhistDate ThaiLanguageProcessor::GetBuddhistDate(const std::chrono::system_clock::time_point& date) {
+    auto calendar = Calendar();
+    if (const ThaiCalendar::Day* day = calendar->Find(date)) {
+        return calendar->ToBuddhistDate(*day);
+    }
+    
+    // outside the calendar: the date, without holidays
     auto time_t = std::chrono::system_clock::to_time_t(date);
-    auto tm = *std::localtime(&time_t);
+    struct tm tm;
+    localtime_r(&time_t, &tm);
     
     BuddhistDate bd;
     bd.year_ce = tm.tm_year + 1900;
     bd.year_be = bd.year_ce + 543;
     bd.month = tm.tm_mon + 1;
     bd.day = tm.tm_mday;
-    bd.thai_month_name = GetThaiMonthName(bd.month);
-    bd.thai_day_name = GetThaiDayName(date);
-    bd.is_holy_day = IsHolyDay(date);
+    bd.thai_month_name = ThaiCalendar::MonthName(bd.month);
+    bd.thai_day_name = ThaiCalendar::DayName(tm.tm_wday);
+    bd.is_valid = true;
     
     return bd;
 }
 
-std::string ThaiLanguageProcessor::GetThaiMonthName(int month) {
-    std::vector<std::string> thai_months = {
-        "", "มกราคม", "กุมภาพันธ์", "มีนาคม", "เมษายน", "พฤษภาคม", "มิถุนายน",
-        "กรกฎาคม", "สิงหาคม", "กันยายน", "ตุลาคม", "พฤศจิกายน", "ธันวาคม"
-    };
-    
-    if (month >= 1 && month <= 12) {
-        return thai_months[month];
+std::vector<BuddhistDate> ThaiLanguageProcessor::GetHolidaysInMonth(int year_be, int month) {
+    if (month < 1 || month > 12) {
+        return {};
     }
-    return "";
+    return Calendar()->GetHolidays(BuddhistCalendar::BEtoCE(year_be), month,
+                                   ThaiCalendar::HOLY_DAY | ThaiCalendar::NATIONAL_HOLIDAY);
+}
+
+std::string ThaiLanguageProcessor::GetThaiMonthName(int month) {
+    return ThaiCalendar::MonthName(month);
 }
 
 std::string ThaiLanguageProcessor::GetThaiDayName(const std::chrono::system_clock::time_point& date) {
     auto time_t = std::chrono::system_clock::to_time_t(date);
-    auto tm = *std::localtime(&time_t);
-    
-    std::vector<std::string> thai_days = {
-        "วันอาทิตย์", "วันจันทร์", "วันอังคาร", "วันพุธ", 
-        "วันพฤหัสบดี", "วันศุกร์", "วันเสาร์"
-    };
+    struct tm tm;
+    localtime_r(&time_t, &tm);
     
-    return thai_days[tm.tm_wday];
+    return ThaiCalendar::DayName(tm.tm_wday);
 }
 
 bool ThaiLanguageProcessor::IsHolyDay(const std::chrono::system_clock::time_point& date) {
-    // Simplified check - real implementation would use astronomical calculations
-    auto time_t = std::chrono::system_clock::to_time_t(date);
-    auto tm = *std::localtime(&time_t);
-    
-    // Check fixed holy days
-    for (const auto& holiday : holiday_calendar_) {
-        if (holiday.second.is_holy_day && 
-            holiday.second.month == (tm.tm_mon + 1) &&
-            holiday.second.day == tm.tm_mday) {
-            return true;
-        }
-    }
-    
-    // Check for Buddhist observance days (simplified)
-    // In real implementation, this would calculate lunar calendar dates
-    return false;
+    // Buddhist holy days of the calendar; none outside it
+    auto calendar = Calendar();
+    const ThaiCalendar::Day* day = calendar->Find(date);
+    return day && (day->flags & ThaiCalendar::HOLY_DAY);
 }
 
 CulturalValidation ThaiLanguageProcessor::ValidateContent(const std::string& text) {
     CulturalValidation validation;
     validation.is_appropriate = true;
-    validation.cultural_sensitivity_score = 1.0;
     
-    // Check for inappropriate words
-    for (const auto& word : inappropriate_words_) {
-        if (text.find(word) != std::string::npos) {
+    // All terms in one pass
+    const ThaiTermMatcher& terms = CulturalTerms();
+    thread_local ThaiTermMatcher::Result result;
+    terms.Scan(text, result);
+    
+    for (uint32_t term : result.terms) {
+        if (terms.TermCategory(term) == ThaiTermMatcher::INAPPROPRIATE) {
             validation.is_appropriate = false;
-            validation.warnings.push_back("Contains inappropriate language: " + word);
-            validation.cultural_sensitivity_score -= 0.2;
+            validation.warnings.push_back("Contains inappropriate language: " + terms.Term(term));
         }
     }
     
-    // Check for royal references
-    for (const auto& term : royal_terms_) {
-        if (text.find(term) != std::string::npos) {
-            validation.contains_royal_references = true;
-            validation.requires_special_formatting = true;
-            validation.suggestions.push_back("Royal reference detected - ensure respectful formatting");
-        }
+    if (result.categories & (1 << ThaiTermMatcher::ROYAL)) {
+        validation.contains_royal_references = true;
+        validation.requires_special_formatting = true;
+        validation.suggestions.push_back("Royal reference detected - ensure respectful formatting");
     }
     
-    // Check for religious content
-    for (const auto& term : religious_terms_) {
-        if (text.find(term) != std::string::npos) {
-            validation.contains_religious_content = true;
-            validation.suggestions.push_back("Religious content detected - ensure respectful treatment");
-        }
+    if (result.categories & (1 << ThaiTermMatcher::RELIGIOUS)) {
+        validation.contains_religious_content = true;
+        validation.suggestions.push_back("Religious content detected - ensure respectful treatment");
     }
     
-    // Ensure score doesn't go below 0
-    validation.cultural_sensitivity_score = std::max(0.0, validation.cultural_sensitivity_score);
+    validation.cultural_sensitivity_score = result.score;
     
     return validation;
 }
 
-uint16_t ThaiLanguageProcessor::CalculateTextWidth(const std::string& text) const {
-    try {
-        std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> converter;
-        std::u16string utf16_text = converter.from_bytes(text);
-        
-        uint16_t total_width = 0;
-        for (char16_t c : utf16_text) {
-            auto it = font_metrics_.character_widths.find(c);
-            if (it != font_metrics_.character_widths.end()) {
-                total_width += it->second;
-            } else {
-                total_width += 8; // Default width
+bool ThaiLanguageProcessor::IsAppropriateForBroadcast(const std::string& text) {
+    return !CulturalTerms().Contains(text, ThaiTermMatcher::INAPPROPRIATE);
+}
+
+std::string ThaiLanguageProcessor::SanitizeText(const std::string& text) {
+    const ThaiTermMatcher& terms = CulturalTerms();
+    thread_local ThaiTermMatcher::Result result;
+    terms.Scan(text, result);
+    
+    // Inappropriate words masked, a '*' per character
+    thread_local std::vector<ThaiTermMatcher::Match> masked;
+    masked.clear();
+    for (const auto& match : result.matches) {
+        if (terms.TermCategory(match.term) == ThaiTermMatcher::INAPPROPRIATE) {
+            masked.push_back(match);
+        }
+    }
+    if (masked.empty()) {
+        return text;
+    }
+    std::sort(masked.begin(), masked.end(), [](const ThaiTermMatcher::Match& a, const ThaiTermMatcher::Match& b) {
+        return a.offset < b.offset;
+    });
+    
+    std::string sanitized;
+    sanitized.reserve(text.size());
+    size_t pos = 0;
+    for (const auto& match : masked) {
+        const size_t end = match.offset + match.length;
+        if (end <= pos) {
+            continue;
+        }
+        const size_t begin = std::max<size_t>(pos, match.offset);
+        sanitized.append(text, pos, begin - pos);
+        for (size_t i = begin; i < end; ++i) {
+            if ((static_cast<uint8_t>(text[i]) & 0xC0) != 0x80) {
+                sanitized += '*';
             }
         }
-        
-        return total_width;
-    } catch (const std::exception& e) {
-        std::cerr << "Error calculating text width: " << e.what() << std::endl;
-        return text.length() * 8; // Fallback estimate
+        pos = end;
+    }
+    sanitized.append(text, pos, std::string::npos);
+    return sanitized;
+}
+
+uint16_t ThaiLanguageProcessor::CalculateTextWidth(const std::string& text) const {
+    uint16_t total_width = 0;
+    std::string::const_iterator it = text.begin();
+    while (it != text.end()) {
+        if (static_cast<uint8_t>(*it) < 0x80) {
+            total_width += latin_widths_[static_cast<uint8_t>(*it++)];
+            continue;
+        }
+        uint32_t c = 0;
+        if (utf8::internal::validate_next(it, text.end(), c) != utf8::internal::UTF8_OK) {
+            std::cerr << "Error calculating text width: invalid UTF-8" << std::endl;
+            return text.length() * 8; // Fallback estimate
+        }
+        total_width += GlyphWidth(c);
     }
+    return total_width;
+}
+
+uint8_t ThaiLanguageProcessor::CalculateTextHeight(const std::string& text) const {
+    // a line height per line, as wrapped at line breaks
+    const size_t lines = 1 + std::count(text.begin(), text.end(), '\n');
+    return static_cast<uint8_t>(std::min<size_t>(lines * font_metrics_.line_height, UINT8_MAX));
 }
 
 std::vector<std::string> ThaiLanguageProcessor::WrapText(const std::string& text, uint16_t max_width) {
     std::vector<std::string> lines;
     
-    try {
-        std::wstring_convert<std::codecvt_utf8_utf16<char16_t>, char16_t> converter;
-        std::u16string utf16_text = converter.from_bytes(text);
+    // lines break before a word, or within one that is wider than a line
+    thread_local std::vector<ThaiWordSegmenter::Span> words;
+    ThaiWordSegmenter::Default().Segment(text, words);
+    size_t next_word = 0;
+    
+    size_t line_start = 0;
+    uint16_t line_width = 0;
+    size_t break_pos = 0;               // the last word start in the line
+    uint16_t width_before_break = 0;
+    std::string::const_iterator it = text.begin();
+    while (it != text.end()) {
+        const size_t pos = it - text.begin();
+        uint32_t c = 0;
+        if (utf8::internal::validate_next(it, text.end(), c) != utf8::internal::UTF8_OK) {
+            std::cerr << "Error wrapping text: invalid UTF-8" << std::endl;
+            lines.assign(1, text); // Fallback
+            return lines;
+        }
+        if (c == '\n') {
+            lines.push_back(text.substr(line_start, pos - line_start));
+            line_start = it - text.begin();
+            line_width = 0;
+            continue;
+        }
         
-        std::u16string current_line;
-        uint16_t current_width = 0;
+        while (next_word < words.size() && words[next_word].offset < pos) {
+            ++next_word;
+        }
+        if (next_word < words.size() && words[next_word].offset == pos && pos > line_start) {
+            break_pos = pos;
+            width_before_break = line_width;
+        }
+        
+        const uint8_t char_width = GlyphWidth(c);
+        while (line_width + char_width > max_width && pos > line_start) {
+            const size_t cut = break_pos > line_start ? break_pos : pos;
+            lines.push_back(text.substr(line_start, cut - line_start));
+            line_width = cut == pos ? 0 : line_width - width_before_break;
+            line_start = cut;
+        }
+        line_width += char_width;
+    }
+    
+    if (line_start < text.size()) {
+        lines.push_back(text.substr(line_start));
+    }
+    return lines;
+}
+
+bool ThaiLanguageProcessor::ValidateETSICompliance(const std::vector<uint8_t>& dab_data) {
+    // the Thai character set identifier, then up to a label of 7-bit characters
+    if (dab_data.empty() || dab_data[0] != 0x0E || dab_data.size() - 1 > DLS_MAX_CHARS) {
+        return false;
+    }
+    return std::all_of(dab_data.begin() + 1, dab_data.end(), [](uint8_t c) { return c < 0x80; });
+}
+
+std::vector<uint8_t> ThaiLanguageProcessor::EnsureETSICompliance(const std::vector<uint8_t>& input_data) {
+    // the characters after the identifier (if any), the ones outside the
+    // profile replaced by '?', and cut to a label
+    std::vector<uint8_t> compliant_data(1, 0x0E);
+    auto it = input_data.begin();
+    if (it != input_data.end() && *it == 0x0E) {
+        ++it;
+    }
+    for (; it != input_data.end() && compliant_data.size() - 1 < DLS_MAX_CHARS; ++it) {
+        compliant_data.push_back(*it < 0x80 ? *it : 0x3F);
+    }
+    return compliant_data;
+}
+
+// ThaiTextUtils implementation
+std::vector<std::string> ThaiTextUtils::SegmentWords(const std::string& text) {
+    return ThaiWordSegmenter::Default().SegmentWords(text);
+}
+
+size_t ThaiTextUtils::CountWords(const std::string& text) {
+    thread_local std::vector<ThaiWordSegmenter::Span> words;
+    ThaiWordSegmenter::Default().Segment(text, words);
+    return words.size();
+}
+
+namespace {
+
+bool IsInvisible(uint32_t c) {
+    return c == 0x00AD || (c >= 0x200B && c <= 0x200D) || c == 0x2060 || c == 0xFEFF;
+}
+
+bool IsWhitespace(uint32_t c) {
+    return c == ' ' || (c >= '\t' && c <= '\r') || c == 0x00A0 || (c >= 0x2000 && c <= 0x200A) ||
+           c == 0x202F || c == 0x3000;
+}
+
+bool IsThaiToneMark(uint32_t c) {
+    return c >= 0x0E48 && c <= 0x0E4B;
+}
+
+// sara am, and the vowels above and below consonants
+bool IsThaiMarkVowel(uint32_t c) {
+    return c == 0x0E31 || (c >= 0x0E34 && c <= 0x0E3A);
+}
+
+bool IsThaiMark(uint32_t c) {
+    return IsThaiMarkVowel(c) || (c >= 0x0E47 && c <= 0x0E4E);
+}
+
+} // namespace
+
+void ThaiTextUtils::Normalize(const std::string& text, std::vector<NormalizedChar>& chars) {
+    chars.clear();
+    bool pending_space = false;
+    uint32_t space_offset = 0;
+    uint32_t space_end = 0;
+    
+    std::string::const_iterator it = text.begin();
+    while (it != text.end()) {
+        const uint32_t offset = it - text.begin();
+        uint32_t c = 0;
+        if (utf8::internal::validate_next(it, text.end(), c) != utf8::internal::UTF8_OK) {
+            it = text.begin() + offset + 1;
+            continue;
+        }
+        const uint32_t end = it - text.begin();
         
-        for (char16_t c : utf16_text) {
-            uint8_t char_width = 8; // default
-            auto it = font_metrics_.character_widths.find(c);
-            if (it != font_metrics_.character_widths.end()) {
-                char_width = it->second;
+        if (IsInvisible(c)) {
+            continue;
+        }
+        if (IsWhitespace(c)) {
+            if (!pending_space) {
+                pending_space = true;
+                space_offset = offset;
             }
-            
-            if (c == '\n') {
-                lines.push_back(converter.to_bytes(current_line));
-                current_line.clear();
-                current_width = 0;
-            } else if (current_width + char_width > max_width) {
-                if (!current_line.empty()) {
-                    lines.push_back(converter.to_bytes(current_line));
-                    current_line.clear();
-                    current_width = 0;
-                }
-                current_line += c;
-                current_width += char_width;
-            } else {
-                current_line += c;
-                current_width += char_width;
+            space_end = end;
+            continue;
+        }
+        if (pending_space) {
+            pending_space = false;
+            if (!chars.empty()) {
+                chars.push_back({' ', space_offset, space_end});
             }
         }
         
-        if (!current_line.empty()) {
-            lines.push_back(converter.to_bytes(current_line));
+        if (!chars.empty()) {
+            NormalizedChar& last = chars.back();
+            if (IsThaiMark(c) && last.codepoint == c) {
+                last.end = end;     // repeated mark
+                continue;
+            }
+            if (IsThaiMarkVowel(c) && IsThaiToneMark(last.codepoint)) {
+                // the tone mark goes above the vowel
+                const uint32_t tone = last.codepoint;
+                last.codepoint = c;
+                last.end = end;
+                chars.push_back({tone, last.offset, end});
+                continue;
+            }
+            if (c == 0x0E32 && last.codepoint == 0x0E4D) {
+                last.codepoint = 0x0E33;
+                last.end = end;
+                continue;
+            }
+            if (c == 0x0E32 && chars.size() >= 2 && IsThaiToneMark(last.codepoint) &&
+                chars[chars.size() - 2].codepoint == 0x0E4D) {
+                // nikhahit, tone mark, sara aa: the tone mark, then sara am
+                NormalizedChar& nikhahit = chars[chars.size() - 2];
+                nikhahit.codepoint = last.codepoint;
+                nikhahit.end = end;
+                last = {0x0E33, nikhahit.offset, end};
+                continue;
+            }
         }
-        
-    } catch (const std::exception& e) {
-        std::cerr << "Error wrapping text: " << e.what() << std::endl;
-        lines.push_back(text); // Fallback
+        chars.push_back({c, offset, end});
     }
+}
+
+size_t ThaiTextUtils::CountCharacters(const std::string& text) {
+    // up to the first invalid UTF-8
+    return utf8_count(text.data(), utf8_valid_prefix(text.data(), text.size()));
+}
+
+std::string ThaiTextUtils::NormalizeText(const std::string& text) {
+    thread_local std::vector<NormalizedChar> chars;
+    Normalize(text, chars);
     
-    return lines;
+    std::string normalized;
+    normalized.reserve(text.size());
+    for (const NormalizedChar& c : chars) {
+        utf8::append(c.codepoint, std::back_inserter(normalized));
+    }
+    return normalized;
+}
+
+std::string ThaiTextUtils::RemoveInvisibleCharacters(const std::string& text) {
+    std::string visible;
+    visible.reserve(text.size());
+    std::string::const_iterator it = text.begin();
+    while (it != text.end()) {
+        std::string::const_iterator start = it;
+        uint32_t c = 0;
+        if (utf8::internal::validate_next(it, text.end(), c) != utf8::internal::UTF8_OK) {
+            it = start + 1;
+            continue;
+        }
+        if (!IsInvisible(c)) {
+            visible.append(start, it);
+        }
+    }
+    return visible;
+}
+
+namespace {
+
+// Thai syllables as a DFA over character classes, generated at compile time:
+// each transition gives the next state, what it does to the syllables and
+// the role of the char in its syllable, which is what it is romanized by
+enum ThaiClass : uint8_t {
+    TC_OTHER,           // not Thai, and not whitespace
+    TC_SPACE,           // whitespace and invisible chars
+    TC_CONSONANT,
+    TC_HEAD,            // ก ข ค ต ป ผ พ ห, may lead a cluster
+    TC_LIQUID,          // น ม ร ล, may follow a head
+    TC_YO,              // ย
+    TC_WO,              // ว
+    TC_O_ANG,           // อ
+    TC_LEAD,            // เ แ โ ใ ไ, written before their consonant
+    TC_AA,              // า
+    TC_FOLLOW,          // ะ ำ ๅ, ending the syllable
+    TC_VOWEL_SHORT,     // ั ิ ึ ุ ฺ
+    TC_VOWEL_LONG,      // ี ื ู
+    TC_TONE,            // ่ ้ ๊ ๋
+    TC_MAITAIKHU,       // ็
+    TC_THANTHAKHAT,     // ์, silencing
+    TC_SIGN,            // ํ ๎
+    TC_DIGIT,
+    TC_SYMBOL,          // ฯ ๆ ฿ ๏ ๚ ๛
+    TC_COUNT
+};
+
+enum ThaiState : uint8_t {
+    TS_START,           // no syllable open
+    TS_OTHER,           // in a run of other text
+    TS_DIGIT,           // in a run of Thai digits
+    TS_LEAD,            // waiting for the consonant of a lead vowel
+    TS_INITIAL,
+    TS_HEAD,            // initial that may lead a cluster
+    TS_CLUSTER,
+    TS_VOWEL_SHORT,
+    TS_VOWEL_LONG,
+    TS_MAITAIKHU,
+    TS_TONE,
+    TS_AA,
+    TS_OPEN,            // after a vowel ending the syllable
+    TS_CARRIER,         // after อ, ว or ย as (part of) the vowel
+    TS_FINAL_BARE,      // final of a syllable without vowel
+    TS_FINAL,
+    TS_FINAL_HEAD,      // final after a long vowel, that may lead a cluster instead
+    TS_SIGNED,
+    TS_COUNT
+};
+
+enum ThaiAction : uint8_t {
+    TA_CONTINUE,        // the char is in the open syllable, opening one if none is
+    TA_BREAK,           // the char opens a syllable
+    TA_BREAK_BEFORE,    // the consonant before opens a syllable, as a mark follows it
+    TA_MERGE,           // thanthakhat: the open syllable is silent, in the one before
+    TA_SKIP             // whitespace, in no syllable
+};
+
+enum ThaiRole : uint8_t {
+    TR_NONE,            // whitespace, other text, digits and symbols
+    TR_LEAD,
+    TR_INITIAL,
+    TR_CLUSTER,
+    TR_VOWEL,
+    TR_CARRIER,
+    TR_FINAL,
+    TR_TONE,
+    TR_SILENT,
+    TR_INVALID
+};
+
+enum ThaiTransitionFlags : uint8_t {
+    TF_INVALID_LEAD = 1,        // the lead vowel before has no consonant
+    TF_SILENCE_PREVIOUS = 2     // the consonant before is silent
+};
+
+struct ThaiTransition {
+    uint8_t next = TS_START;
+    uint8_t action = TA_CONTINUE;
+    uint8_t role = TR_NONE;
+    uint8_t flags = 0;
+};
+
+struct ThaiSyllableDFA {
+    uint8_t classes[128] = {};      // of the Thai block, by code point - 0x0E00
+    ThaiTransition transitions[TS_COUNT][TC_COUNT] = {};
+};
+
+constexpr bool IsConsonantClass(uint8_t cls) {
+    return cls >= TC_CONSONANT && cls <= TC_O_ANG;
+}
+
+constexpr ThaiTransition ThaiRule(uint8_t state, uint8_t cls) {
+    if (state == TS_LEAD && !IsConsonantClass(cls)) {
+        ThaiTransition transition = ThaiRule(TS_START, cls);
+        transition.flags |= TF_INVALID_LEAD;
+        return transition;
+    }
+    switch (cls) {
+    case TC_SPACE:
+        return {TS_START, TA_SKIP, TR_NONE, 0};
+    case TC_OTHER:
+        return {TS_OTHER, state == TS_OTHER ? TA_CONTINUE : TA_BREAK, TR_NONE, 0};
+    case TC_DIGIT:
+        return {TS_DIGIT, state == TS_DIGIT ? TA_CONTINUE : TA_BREAK, TR_NONE, 0};
+    case TC_SYMBOL:
+        return {TS_START, TA_BREAK, TR_NONE, 0};
+    case TC_LEAD:
+        return {TS_LEAD, TA_BREAK, TR_LEAD, 0};
+    default:
+        break;
+    }
+
+    // consonant without vowel yet, and consonant after a vowel
+    const bool base = state == TS_INITIAL || state == TS_HEAD || state == TS_CLUSTER;
+    const bool after_vowel = state == TS_FINAL_BARE || state == TS_FINAL || state == TS_FINAL_HEAD ||
+                             state == TS_CARRIER;
+
+    if (IsConsonantClass(cls)) {
+        const uint8_t initial = cls == TC_HEAD || cls == TC_O_ANG ? TS_HEAD : TS_INITIAL;
+        const bool follows_head = cls == TC_LIQUID || cls == TC_YO || cls == TC_WO;
+        if (state == TS_LEAD) {
+            return {initial, TA_CONTINUE, TR_INITIAL, 0};
+        }
+        if (state == TS_HEAD && follows_head) {
+            return {TS_CLUSTER, TA_CONTINUE, TR_CLUSTER, 0};
+        }
+        if (state == TS_FINAL_HEAD && follows_head) {
+            return {TS_CLUSTER, TA_BREAK_BEFORE, TR_CLUSTER, 0};
+        }
+        if (base) {
+            if (cls == TC_O_ANG || (cls == TC_WO && state != TS_CLUSTER)) {
+                return {TS_CARRIER, TA_CONTINUE, TR_CARRIER, 0};
+            }
+            return {state == TS_CLUSTER ? TS_FINAL : TS_FINAL_BARE, TA_CONTINUE, TR_FINAL, 0};
+        }
+        if ((state == TS_VOWEL_SHORT || state == TS_VOWEL_LONG) &&
+            (cls == TC_YO || cls == TC_WO || cls == TC_O_ANG)) {
+            return {TS_CARRIER, TA_CONTINUE, TR_CARRIER, 0};
+        }
+        if (state == TS_TONE && (cls == TC_WO || cls == TC_O_ANG)) {
+            return {TS_CARRIER, TA_CONTINUE, TR_CARRIER, 0};
+        }
+        if (state == TS_VOWEL_SHORT || state == TS_MAITAIKHU) {
+            return {TS_FINAL, TA_CONTINUE, TR_FINAL, 0};
+        }
+        if (state == TS_VOWEL_LONG || state == TS_TONE || state == TS_AA || state == TS_CARRIER) {
+            return {cls == TC_HEAD ? TS_FINAL_HEAD : TS_FINAL, TA_CONTINUE, TR_FINAL, 0};
+        }
+        return {initial, TA_BREAK, TR_INITIAL, 0};
+    }
+
+    // marks: on the consonant without vowel, or on a final that then opens a
+    // syllable of its own; else out of sequence
+    const uint8_t action = after_vowel ? TA_BREAK_BEFORE : TA_CONTINUE;
+    switch (cls) {
+    case TC_VOWEL_SHORT:
+    case TC_VOWEL_LONG:
+        if (base || after_vowel) {
+            return {cls == TC_VOWEL_SHORT ? TS_VOWEL_SHORT : TS_VOWEL_LONG, action, TR_VOWEL, 0};
+        }
+        break;
+    case TC_MAITAIKHU:
+        if (base || after_vowel) {
+            return {TS_MAITAIKHU, action, TR_VOWEL, 0};
+        }
+        break;
+    case TC_TONE:
+        if (state == TS_VOWEL_SHORT || state == TS_VOWEL_LONG) {
+            return {TS_TONE, TA_CONTINUE, TR_TONE, 0};
+        }
+        if (base || after_vowel) {
+            return {TS_TONE, action, TR_TONE, 0};
+        }
+        break;
+    case TC_AA:
+        if (state == TS_TONE) {
+            return {TS_AA, TA_CONTINUE, TR_VOWEL, 0};
+        }
+        if (base || after_vowel) {
+            return {TS_AA, action, TR_VOWEL, 0};
+        }
+        break;
+    case TC_FOLLOW:
+        if (state == TS_TONE || state == TS_AA) {
+            return {TS_OPEN, TA_CONTINUE, TR_VOWEL, 0};
+        }
+        if (base || after_vowel) {
+            return {TS_OPEN, action, TR_VOWEL, 0};
+        }
+        break;
+    case TC_THANTHAKHAT:
+        // a syllable without a vowel of its own is silent (จันทร์, ศาสตร์),
+        // else just the consonant before (เสาร์)
+        if (base || state == TS_FINAL_BARE || state == TS_VOWEL_SHORT) {
+            return {TS_SIGNED, TA_MERGE, TR_SILENT, 0};
+        }
+        if (after_vowel) {
+            return {TS_SIGNED, TA_CONTINUE, TR_SILENT, TF_SILENCE_PREVIOUS};
+        }
+        break;
+    case TC_SIGN:
+        if (base || after_vowel) {
+            return {TS_SIGNED, TA_CONTINUE, TR_SILENT, 0};
+        }
+        break;
+    default:
+        break;
+    }
+    return {state, TA_CONTINUE, TR_INVALID, 0};
+}
+
+constexpr ThaiSyllableDFA BuildThaiSyllableDFA() {
+    ThaiSyllableDFA dfa;
+    for (uint16_t c = 0x0E01; c <= 0x0E2E; ++c) {
+        dfa.classes[c - 0x0E00] = TC_CONSONANT;
+    }
+    for (uint16_t c : {0x0E01, 0x0E02, 0x0E04, 0x0E15, 0x0E1B, 0x0E1C, 0x0E1E, 0x0E2B}) {
+        dfa.classes[c - 0x0E00] = TC_HEAD;
+    }
+    for (uint16_t c : {0x0E19, 0x0E21, 0x0E23, 0x0E25}) {
+        dfa.classes[c - 0x0E00] = TC_LIQUID;
+    }
+    dfa.classes[0x0E22 - 0x0E00] = TC_YO;
+    dfa.classes[0x0E27 - 0x0E00] = TC_WO;
+    dfa.classes[0x0E2D - 0x0E00] = TC_O_ANG;
+
+    for (uint16_t c = 0x0E40; c <= 0x0E44; ++c) {
+        dfa.classes[c - 0x0E00] = TC_LEAD;
+    }
+    dfa.classes[0x0E32 - 0x0E00] = TC_AA;
+    for (uint16_t c : {0x0E30, 0x0E33, 0x0E45}) {
+        dfa.classes[c - 0x0E00] = TC_FOLLOW;
+    }
+    for (uint16_t c : {0x0E31, 0x0E34, 0x0E36, 0x0E38, 0x0E3A}) {
+        dfa.classes[c - 0x0E00] = TC_VOWEL_SHORT;
+    }
+    for (uint16_t c : {0x0E35, 0x0E37, 0x0E39}) {
+        dfa.classes[c - 0x0E00] = TC_VOWEL_LONG;
+    }
+    for (uint16_t c = 0x0E48; c <= 0x0E4B; ++c) {
+        dfa.classes[c - 0x0E00] = TC_TONE;
+    }
+    dfa.classes[0x0E47 - 0x0E00] = TC_MAITAIKHU;
+    dfa.classes[0x0E4C - 0x0E00] = TC_THANTHAKHAT;
+    dfa.classes[0x0E4D - 0x0E00] = TC_SIGN;
+    dfa.classes[0x0E4E - 0x0E00] = TC_SIGN;
+    for (uint16_t c = 0x0E50; c <= 0x0E59; ++c) {
+        dfa.classes[c - 0x0E00] = TC_DIGIT;
+    }
+    for (uint16_t c : {0x0E2F, 0x0E3F, 0x0E46, 0x0E4F, 0x0E5A, 0x0E5B}) {
+        dfa.classes[c - 0x0E00] = TC_SYMBOL;
+    }
+
+    for (uint8_t state = 0; state < TS_COUNT; ++state) {
+        for (uint8_t cls = 0; cls < TC_COUNT; ++cls) {
+            dfa.transitions[state][cls] = ThaiRule(state, cls);
+        }
+    }
+    return dfa;
+}
+
+constexpr ThaiSyllableDFA thai_syllable_dfa = BuildThaiSyllableDFA();
+static_assert(thai_syllable_dfa.transitions[TS_HEAD][TC_LIQUID].next == TS_CLUSTER, "clusters");
+static_assert(thai_syllable_dfa.transitions[TS_FINAL][TC_TONE].action == TA_BREAK_BEFORE, "finals");
+
+uint8_t ThaiClassOf(uint32_t c) {
+    if (c - 0x0E00 < 0x80) {
+        return thai_syllable_dfa.classes[c - 0x0E00];
+    }
+    return IsWhitespace(c) || IsInvisible(c) ? TC_SPACE : TC_OTHER;
+}
+
+struct ThaiChar {
+    uint32_t codepoint;
+    uint32_t offset;
+    uint32_t end;
+    uint8_t cls;
+    uint8_t role;
+};
+
+struct ThaiSyllable {
+    uint32_t first;     // chars
+    uint32_t end;
+};
+
+// RTGS, by code point - 0x0E01
+const char* const thai_roman_initials[46] = {
+    "k", "kh", "kh", "kh", "kh", "kh", "ng", "ch", "ch", "ch", "s", "ch", "y", "d", "t", "th",
+    "th", "th", "n", "d", "t", "th", "th", "th", "n", "b", "p", "ph", "f", "ph", "f", "ph",
+    "m", "y", "r", "r", "l", "l", "w", "s", "s", "s", "h", "l", "", "h"
+};
+const char* const thai_roman_finals[46] = {
+    "k", "k", "k", "k", "k", "k", "ng", "t", "t", "t", "t", "t", "n", "t", "t", "t",
+    "t", "t", "n", "t", "t", "t", "t", "t", "n", "p", "p", "p", "p", "p", "p", "p",
+    "m", "i", "n", "", "n", "", "o", "t", "t", "t", "", "n", "", ""
+};
+
+constexpr uint32_t VowelBit(uint32_t c) {
+    return 1u << (c - 0x0E30);
+}
+
+// the vowel of a syllable by its parts; a carrier that is part of it is
+// taken (set to 0)
+const char* RomanVowel(uint32_t lead, uint32_t marks, uint32_t& carrier, uint32_t final, bool royal) {
+    auto has = [marks](uint32_t c) { return (marks & VowelBit(c)) != 0; };
+    const bool short_vowel = royal || has(0x0E30) || has(0x0E47);
+    switch (lead) {
+    case 0x0E40:    // sara e
+        if (has(0x0E35) && carrier == 0x0E22) {
+            carrier = 0;
+            return "ia";
+        }
+        if (has(0x0E37) && carrier == 0x0E2D) {
+            carrier = 0;
+            return "uea";
+        }
+        if (has(0x0E32)) {
+            return has(0x0E30) ? "o" : "ao";
+        }
+        if (carrier == 0x0E2D || has(0x0E34) || (marks == 0 && final == 0x0E22)) {
+            if (carrier == 0x0E2D) {
+                carrier = 0;
+            }
+            return "oe";
+        }
+        return short_vowel ? "e" : "ee";
+    case 0x0E41:
+        return short_vowel ? "ae" : "aae";
+    case 0x0E42:
+        return short_vowel ? "o" : "oo";
+    case 0x0E43:
+    case 0x0E44:
+        return "ai";
+    default:
+        break;
+    }
+
+    if (has(0x0E31)) {
+        if (carrier == 0x0E27) {
+            carrier = 0;
+            return "ua";
+        }
+        return "a";
+    }
+    if (has(0x0E33)) {
+        return "am";
+    }
+    if (has(0x0E32)) {
+        return royal ? "a" : "aa";
+    }
+    if (has(0x0E30)) {
+        return "a";
+    }
+    if (has(0x0E34)) {
+        return "i";
+    }
+    if (has(0x0E35)) {
+        return royal ? "i" : "ii";
+    }
+    if (has(0x0E36)) {
+        return "ue";
+    }
+    if (has(0x0E37)) {
+        if (carrier == 0x0E2D) {
+            carrier = 0;
+        }
+        return royal ? "ue" : "uee";
+    }
+    if (has(0x0E38)) {
+        return "u";
+    }
+    if (has(0x0E39)) {
+        return royal ? "u" : "uu";
+    }
+    if (has(0x0E47)) {
+        return "o";     // ก็
+    }
+    if (carrier == 0x0E2D) {
+        carrier = 0;
+        return royal ? "o" : "oo";
+    }
+    if (carrier == 0x0E27) {
+        carrier = 0;
+        return "ua";
+    }
+    return final ? "o" : "a";   // the inherent vowel
+}
+
+void RomanizeSyllable(const ThaiChar* chars, size_t count, bool royal, std::string& last_thai,
+                      std::string& roman) {
+    uint32_t lead = 0, initial = 0, cluster = 0, marks = 0, carrier = 0, final = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const ThaiChar& c = chars[i];
+        switch (c.role) {
+        case TR_LEAD:       lead = c.codepoint; break;
+        case TR_INITIAL:    initial = c.codepoint; break;
+        case TR_CLUSTER:    cluster = c.codepoint; break;
+        case TR_VOWEL:      marks |= VowelBit(c.codepoint); break;
+        case TR_CARRIER:    carrier = c.codepoint; break;
+        case TR_FINAL:      final = c.codepoint; break;
+        case TR_NONE:
+            if (c.cls == TC_OTHER && c.codepoint < 0x80) {
+                roman += static_cast<char>(c.codepoint);
+            } else if (c.cls == TC_DIGIT) {
+                roman += static_cast<char>('0' + (c.codepoint - 0x0E50));
+            } else if (c.codepoint == 0x0E46 && !last_thai.empty()) {
+                roman += ' ';   // mai yamok repeats the syllable before
+                roman += last_thai;
+            } else if (c.codepoint == 0x0E3F) {
+                roman += "baht";
+            }
+            break;
+        default:
+            break;  // tone marks, silent and invalid chars
+        }
+    }
+    if (initial == 0) {
+        return;
+    }
+
+    std::string& syllable = last_thai;
+    if (cluster && (initial == 0x0E2B || (initial == 0x0E2D && cluster == 0x0E22))) {
+        syllable = thai_roman_initials[cluster - 0x0E01];   // leading ห and อ are silent
+    } else {
+        syllable = thai_roman_initials[initial - 0x0E01];
+        if (cluster) {
+            syllable += thai_roman_initials[cluster - 0x0E01];
+        }
+    }
+    if ((initial == 0x0E24 || initial == 0x0E26) && lead == 0 && (marks & ~VowelBit(0x0E45)) == 0) {
+        syllable += "ue";   // ฤ, ฦ
+    } else {
+        syllable += RomanVowel(lead, marks, carrier, final, royal);
+    }
+    if (carrier == 0x0E22) {
+        syllable += 'i';
+    } else if (carrier == 0x0E27) {
+        syllable += 'o';
+    }
+    if (final) {
+        const char* coda = thai_roman_finals[final - 0x0E01];
+        if (!(coda[0] == 'i' && syllable.back() == 'i')) {
+            syllable += coda;
+        }
+    }
+    roman += syllable;
+}
+
+// the analysis of the text last asked about on this thread, as the callers
+// ask several questions about the same message
+const ThaiTextUtils::TextAnalysis& LastThaiAnalysis(const std::string& text, bool romanize,
+                                                    bool use_royal_system) {
+    thread_local std::string last_text;
+    thread_local bool last_romanized = false;
+    thread_local bool last_royal = true;
+    thread_local bool analysed = false;
+    thread_local ThaiTextUtils::TextAnalysis analysis;
+
+    if (analysed && text == last_text &&
+        (!romanize || (last_romanized && last_royal == use_royal_system))) {
+        return analysis;
+    }
+    ThaiTextUtils::Analyze(text, analysis, romanize, use_royal_system);
+    last_text = text;
+    last_romanized = romanize;
+    last_royal = use_royal_system;
+    analysed = true;
+    return analysis;
+}
+
+} // namespace
+
+void ThaiTextUtils::Analyze(const std::string& text, TextAnalysis& analysis, bool romanize,
+                            bool use_royal_system) {
+    analysis.syllables.clear();
+    analysis.invalid.clear();
+    analysis.roman.clear();
+
+    thread_local std::vector<ThaiChar> chars;
+    thread_local std::vector<ThaiSyllable> syllables;
+    chars.clear();
+    syllables.clear();
+
+    bool open = false;
+    uint8_t state = TS_START;
+    std::string::const_iterator it = text.begin();
+    while (it != text.end()) {
+        const uint32_t offset = it - text.begin();
+        uint32_t c = 0;
+        if (utf8::internal::validate_next(it, text.end(), c) != utf8::internal::UTF8_OK) {
+            it = text.begin() + offset + 1;
+            continue;
+        }
+
+        const uint8_t cls = ThaiClassOf(c);
+        const ThaiTransition& transition = thai_syllable_dfa.transitions[state][cls];
+        const uint32_t i = chars.size();
+        chars.push_back({c, offset, static_cast<uint32_t>(it - text.begin()), cls, transition.role});
+        if (transition.flags & TF_INVALID_LEAD) {
+            chars[i - 1].role = TR_INVALID;
+        }
+        if (transition.flags & TF_SILENCE_PREVIOUS) {
+            chars[i - 1].role = TR_SILENT;
+        }
+
+        switch (transition.action) {
+        case TA_SKIP:
+            open = false;
+            break;
+        case TA_BREAK:
+            syllables.push_back({i, i + 1});
+            open = true;
+            break;
+        case TA_BREAK_BEFORE:
+            chars[i - 1].role = TR_INITIAL;
+            syllables.back().end = i - 1;
+            syllables.push_back({i - 1, i + 1});
+            break;
+        case TA_MERGE: {
+            ThaiSyllable& current = syllables.back();
+            for (uint32_t k = current.first; k < i; ++k) {
+                if (chars[k].role != TR_INVALID) {
+                    chars[k].role = TR_SILENT;
+                }
+            }
+            current.end = i + 1;
+            if (syllables.size() >= 2) {
+                ThaiSyllable& previous = syllables[syllables.size() - 2];
+                if (previous.end == current.first && chars[previous.end - 1].role != TR_NONE) {
+                    previous.end = current.end;
+                    syllables.pop_back();
+                }
+            }
+            break;
+        }
+        default:
+            if (open) {
+                syllables.back().end = i + 1;
+            } else {
+                syllables.push_back({i, i + 1});
+                open = true;
+            }
+            break;
+        }
+        state = transition.next;
+    }
+    if (state == TS_LEAD) {
+        chars.back().role = TR_INVALID;
+    }
+
+    for (const ThaiSyllable& syllable : syllables) {
+        const uint32_t offset = chars[syllable.first].offset;
+        analysis.syllables.push_back({offset, chars[syllable.end - 1].end - offset});
+    }
+    for (size_t i = 0; i < chars.size(); ++i) {
+        if (chars[i].role != TR_INVALID) {
+            continue;
+        }
+        if (i > 0 && chars[i - 1].role == TR_INVALID) {
+            TextAnalysis::Span& run = analysis.invalid.back();
+            run.length = chars[i].end - run.offset;
+        } else {
+            analysis.invalid.push_back({chars[i].offset, chars[i].end - chars[i].offset});
+        }
+    }
+
+    if (romanize) {
+        thread_local std::string last_thai;
+        last_thai.clear();
+        uint32_t previous_end = 0;
+        for (const ThaiSyllable& syllable : syllables) {
+            // whitespace between syllables as one space, if both have any
+            const size_t mark = analysis.roman.size();
+            for (uint32_t k = previous_end; k < syllable.first; ++k) {
+                if (IsWhitespace(chars[k].codepoint) && mark > 0) {
+                    analysis.roman += ' ';
+                    break;
+                }
+            }
+            const size_t start = analysis.roman.size();
+            RomanizeSyllable(&chars[syllable.first], syllable.end - syllable.first, use_royal_system,
+                             last_thai, analysis.roman);
+            if (analysis.roman.size() == start) {
+                analysis.roman.resize(mark);
+            }
+            previous_end = syllable.end;
+        }
+    }
+}
+
+std::vector<std::string> ThaiTextUtils::AnalyzeSyllables(const std::string& text) {
+    const TextAnalysis& analysis = LastThaiAnalysis(text, false, true);
+    std::vector<std::string> syllables;
+    syllables.reserve(analysis.syllables.size());
+    for (const TextAnalysis::Span& span : analysis.syllables) {
+        syllables.push_back(text.substr(span.offset, span.length));
+    }
+    return syllables;
+}
+
+std::string ThaiTextUtils::ToRoman(const std::string& thai_text, bool use_royal_system) {
+    return LastThaiAnalysis(thai_text, true, use_royal_system).roman;
+}
+
+size_t ThaiTextUtils::CountSyllables(const std::string& text) {
+    return LastThaiAnalysis(text, false, true).syllables.size();
+}
+
+bool ThaiTextUtils::HasValidThaiStructure(const std::string& text) {
+    return LastThaiAnalysis(text, false, true).invalid.empty();
+}
+
+std::vector<std::string> ThaiTextUtils::FindInvalidSequences(const std::string& text) {
+    const TextAnalysis& analysis = LastThaiAnalysis(text, false, true);
+    std::vector<std::string> sequences;
+    for (const TextAnalysis::Span& span : analysis.invalid) {
+        sequences.push_back(text.substr(span.offset, span.length));
+    }
+    return sequences;
+}
+
+// ThaiTermMatcher implementation
+bool ThaiTermMatcher::Add(const std::string& term, Category category, double weight) {
+    thread_local std::vector<ThaiTextUtils::NormalizedChar> chars;
+    ThaiTextUtils::Normalize(term, chars);
+    if (chars.empty()) {
+        return false;
+    }
+    
+    std::vector<uint32_t> codepoints;
+    codepoints.reserve(chars.size());
+    for (const auto& c : chars) {
+        codepoints.push_back(c.codepoint >= 'A' && c.codepoint <= 'Z' ? c.codepoint + ('a' - 'A') : c.codepoint);
+    }
+    for (const Entry& existing : terms_) {
+        if (existing.codepoints == codepoints) {
+            return false;
+        }
+    }
+    terms_.push_back({term, std::move(codepoints), category, weight});
+    return true;
+}
+
+uint16_t ThaiTermMatcher::AddSymbol(uint32_t codepoint) {
+    uint16_t* symbol;
+    if (codepoint < 0x80) {
+        symbol = &ascii_symbols_[codepoint];
+    } else if (codepoint - 0x0E00 < 0x80) {
+        symbol = &thai_symbols_[codepoint - 0x0E00];
+    } else {
+        symbol = &other_symbols_[codepoint];
+    }
+    if (*symbol == 0) {
+        *symbol = static_cast<uint16_t>(symbol_count_++);
+        if (codepoint >= 'a' && codepoint <= 'z') {
+            ascii_symbols_[codepoint - ('a' - 'A')] = *symbol;
+        }
+    }
+    return *symbol;
+}
+
+void ThaiTermMatcher::Compile() {
+    std::fill(std::begin(ascii_symbols_), std::end(ascii_symbols_), 0);
+    std::fill(std::begin(thai_symbols_), std::end(thai_symbols_), 0);
+    other_symbols_.clear();
+    symbol_count_ = 1;
+    for (const Entry& term : terms_) {
+        for (uint32_t c : term.codepoints) {
+            AddSymbol(c);
+        }
+    }
+    
+    // the trie; 0 is the root, so it also stands for no transition
+    next_.assign(symbol_count_, 0);
+    state_terms_.assign(1, -1);
+    for (size_t i = 0; i < terms_.size(); ++i) {
+        uint32_t state = 0;
+        for (uint32_t c : terms_[i].codepoints) {
+            uint32_t& next = next_[state * symbol_count_ + Symbol(c)];
+            if (next == 0) {
+                next = static_cast<uint32_t>(state_terms_.size());
+                state_terms_.push_back(-1);
+                next_.resize(next_.size() + symbol_count_, 0);
+            }
+            state = next_[state * symbol_count_ + Symbol(c)];
+        }
+        state_terms_[state] = static_cast<int32_t>(i);
+    }
+    
+    // failures by breadth, resolved into the transitions
+    const size_t state_count = state_terms_.size();
+    std::vector<uint32_t> failures(state_count, 0);
+    output_links_.assign(state_count, 0);
+    std::vector<uint32_t> queue;
+    queue.reserve(state_count);
+    for (size_t symbol = 1; symbol < symbol_count_; ++symbol) {
+        if (next_[symbol]) {
+            queue.push_back(next_[symbol]);
+        }
+    }
+    for (size_t i = 0; i < queue.size(); ++i) {
+        const uint32_t state = queue[i];
+        for (size_t symbol = 1; symbol < symbol_count_; ++symbol) {
+            uint32_t& next = next_[state * symbol_count_ + symbol];
+            const uint32_t failure_next = next_[failures[state] * symbol_count_ + symbol];
+            if (next) {
+                failures[next] = failure_next;
+                output_links_[next] = state_terms_[failure_next] >= 0 ? failure_next : output_links_[failure_next];
+                queue.push_back(next);
+            } else {
+                next = failure_next;
+            }
+        }
+    }
+}
+
+void ThaiTermMatcher::Scan(const std::string& text, Result& result) const {
+    result.matches.clear();
+    result.terms.clear();
+    result.categories = 0;
+    result.score = 1.0;
+    if (next_.empty()) {
+        return;
+    }
+    
+    thread_local std::vector<ThaiTextUtils::NormalizedChar> chars;
+    thread_local std::vector<bool> found;
+    ThaiTextUtils::Normalize(text, chars);
+    found.assign(terms_.size(), false);
+    
+    uint32_t state = 0;
+    for (size_t i = 0; i < chars.size(); ++i) {
+        state = next_[state * symbol_count_ + Symbol(chars[i].codepoint)];
+        for (uint32_t s = state_terms_[state] >= 0 ? state : output_links_[state]; s; s = output_links_[s]) {
+            const uint32_t term = state_terms_[s];
+            const auto& first = chars[i + 1 - terms_[term].codepoints.size()];
+            result.matches.push_back({term, first.offset, chars[i].end - first.offset});
+            if (!found[term]) {
+                found[term] = true;
+                result.terms.push_back(term);
+                result.categories |= 1 << terms_[term].category;
+                result.score -= terms_[term].weight;
+            }
+        }
+    }
+    result.score = std::max(0.0, result.score);
+}
+
+bool ThaiTermMatcher::Contains(const std::string& text, Category category) const {
+    if (next_.empty()) {
+        return false;
+    }
+    
+    thread_local std::vector<ThaiTextUtils::NormalizedChar> chars;
+    ThaiTextUtils::Normalize(text, chars);
+    
+    uint32_t state = 0;
+    for (const auto& c : chars) {
+        state = next_[state * symbol_count_ + Symbol(c.codepoint)];
+        for (uint32_t s = state_terms_[state] >= 0 ? state : output_links_[state]; s; s = output_links_[s]) {
+            if (terms_[state_terms_[s]].category == category) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// ThaiCalendar implementation
+const char ThaiCalendar::MAGIC[8] = {'S', 'D', 'A', 'B', 'T', 'H', 'C', 'A'};
+const uint32_t ThaiCalendar::FORMAT_VERSION = 1;
+
+static_assert(sizeof(ThaiCalendar::Day) == 6, "calendar days are stored as they are in the file");
+
+namespace {
+
+const char* const THAI_MONTH_NAMES[13] = {
+    "", "มกราคม", "กุมภาพันธ์", "มีนาคม", "เมษายน", "พฤษภาคม", "มิถุนายน",
+    "กรกฎาคม", "สิงหาคม", "กันยายน", "ตุลาคม", "พฤศจิกายน", "ธันวาคม"
+};
+
+const char* const THAI_DAY_NAMES[7] = {
+    "วันอาทิตย์", "วันจันทร์", "วันอังคาร", "วันพุธ",
+    "วันพฤหัสบดี", "วันศุกร์", "วันเสาร์"
+};
+
+// National holidays on the same date each year, in the years they were kept
+struct FixedHoliday {
+    int month;
+    int day;
+    int first_year_ce;
+    int last_year_ce;
+    const char* description_thai;
+    const char* description_english;
+};
+
+const FixedHoliday FIXED_HOLIDAYS[] = {
+    {1, 1, 0, 9999, "วันปีใหม่", "New Year's Day"},
+    {4, 6, 0, 9999, "วันจักรี", "Chakri Day"},
+    {4, 13, 0, 9999, "วันสงกรานต์", "Songkran Festival"},
+    {4, 14, 0, 9999, "วันสงกรานต์", "Songkran Festival"},
+    {4, 15, 0, 9999, "วันสงกรานต์", "Songkran Festival"},
+    {5, 1, 0, 9999, "วันแรงงานแห่งชาติ", "Labor Day"},
+    {5, 5, 0, 2016, "วันฉัตรมงคล", "Coronation Day"},
+    {5, 4, 2020, 9999, "วันฉัตรมงคล", "Coronation Day"},
+    {6, 3, 2019, 9999, "วันเฉลิมพระชนมพรรษาสมเด็จพระนางเจ้าฯ พระบรมราชินี", "HM the Queen's Birthday"},
+    {7, 28, 2017, 9999, "วันเฉลิมพระชนมพรรษาพระบาทสมเด็จพระเจ้าอยู่หัว", "HM the King's Birthday"},
+    {8, 12, 0, 9999, "วันแม่แห่งชาติ", "Mother's Day"},
+    {10, 13, 2017, 9999, "วันนวมินทรมหาราช", "King Bhumibol Memorial Day"},
+    {10, 23, 0, 9999, "วันปิยมหาราช", "Chulalongkorn Day"},
+    {12, 5, 0, 9999, "วันพ่อแห่งชาติ", "Father's Day"},
+    {12, 10, 0, 9999, "วันรัฐธรรมนูญ", "Constitution Day"},
+    {12, 31, 0, 9999, "วันสิ้นปี", "New Year's Eve"},
+};
+
+// Buddhist holy days follow the lunar calendar, as announced; the known ones
+// (others come with a calendar file)
+struct LunarHoliday {
+    int year_ce;
+    int month;
+    int day;
+    const char* description_thai;
+    const char* description_english;
+};
+
+const LunarHoliday LUNAR_HOLIDAYS[] = {
+    {2023, 3, 6, "วันมาฆบูชา", "Magha Puja Day"},
+    {2023, 6, 3, "วันวิสาขบูชา", "Vesak Day"},
+    {2023, 8, 1, "วันอาสาฬหบูชา", "Asalha Puja Day"},
+    {2023, 8, 2, "วันเข้าพรรษา", "Buddhist Lent Day"},
+    {2024, 2, 24, "วันมาฆบูชา", "Magha Puja Day"},
+    {2024, 5, 22, "วันวิสาขบูชา", "Vesak Day"},
+    {2024, 7, 20, "วันอาสาฬหบูชา", "Asalha Puja Day"},
+    {2024, 7, 21, "วันเข้าพรรษา", "Buddhist Lent Day"},
+    {2025, 2, 12, "วันมาฆบูชา", "Magha Puja Day"},
+    {2025, 5, 11, "วันวิสาขบูชา", "Vesak Day"},
+    {2025, 7, 10, "วันอาสาฬหบูชา", "Asalha Puja Day"},
+    {2025, 7, 11, "วันเข้าพรรษา", "Buddhist Lent Day"},
+};
+
+void Put32(uint8_t* p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+uint32_t Get32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+} // namespace
+
+ThaiCalendar::~ThaiCalendar() {
+    Close();
+}
+
+void ThaiCalendar::Close() {
+    if (map_) {
+        munmap(map_, map_len_);
+        map_ = nullptr;
+        map_len_ = 0;
+    }
+    owned_days_.clear();
+    events_.clear();
+    days_ = nullptr;
+    day_count_ = 0;
+    first_day_ = 0;
+    first_year_ce_ = 0;
+    year_count_ = 0;
+}
+
+int64_t ThaiCalendar::DayNumber(int year_ce, int month, int day) {
+    // days from civil; years start in March, so that the leap day comes last
+    const int64_t y = year_ce - (month <= 2);
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const int64_t year_of_era = y - era * 400;
+    const int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+int ThaiCalendar::DaysInMonth(int year_ce, int month) {
+    static const int days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if (month < 1 || month > 12) {
+        return 0;
+    }
+    const bool leap = (year_ce % 4 == 0 && year_ce % 100 != 0) || year_ce % 400 == 0;
+    return days[month - 1] + (month == 2 && leap);
+}
+
+bool ThaiCalendar::Build(int first_year_ce, int year_count) {
+    if (year_count < 1 || year_count > MAX_YEAR_COUNT || first_year_ce < 1 || first_year_ce + year_count > 10000) {
+        return false;
+    }
+    Close();
+    
+    first_year_ce_ = first_year_ce;
+    year_count_ = year_count;
+    first_day_ = DayNumber(first_year_ce, 1, 1);
+    owned_days_.reserve(DayNumber(first_year_ce + year_count, 1, 1) - first_day_);
+    
+    // 1970-01-01 was a Thursday
+    int weekday = static_cast<int>(((first_day_ + 4) % 7 + 7) % 7);
+    for (int year = 0; year < year_count; ++year) {
+        for (int month = 1; month <= 12; ++month) {
+            const int days = DaysInMonth(first_year_ce + year, month);
+            for (int day = 1; day <= days; ++day) {
+                owned_days_.push_back({static_cast<uint8_t>(year), static_cast<uint8_t>(month),
+                                       static_cast<uint8_t>(day), static_cast<uint8_t>(weekday), 0, 0});
+                weekday = weekday == 6 ? 0 : weekday + 1;
+            }
+        }
+    }
+    days_ = owned_days_.data();
+    day_count_ = owned_days_.size();
+    
+    for (int year = first_year_ce; year < first_year_ce + year_count; ++year) {
+        for (const FixedHoliday& holiday : FIXED_HOLIDAYS) {
+            if (year >= holiday.first_year_ce && year <= holiday.last_year_ce) {
+                AddHoliday(year, holiday.month, holiday.day, NATIONAL_HOLIDAY,
+                           holiday.description_thai, holiday.description_english);
+            }
+        }
+    }
+    for (const LunarHoliday& holiday : LUNAR_HOLIDAYS) {
+        AddHoliday(holiday.year_ce, holiday.month, holiday.day, HOLY_DAY | NATIONAL_HOLIDAY,
+                   holiday.description_thai, holiday.description_english);
+    }
+    return true;
+}
+
+bool ThaiCalendar::AddHoliday(int year_ce, int month, int day, uint8_t flags,
+                              const std::string& description_thai, const std::string& description_english) {
+    if (!Find(year_ce, month, day)) {
+        return false;
+    }
+    
+    size_t event = 0;
+    while (event < events_.size() && (events_[event].description_thai != description_thai ||
+                                      events_[event].description_english != description_english)) {
+        ++event;
+    }
+    if (event == MAX_EVENT_COUNT) {
+        return false;
+    }
+    
+    if (map_) {
+        // mapped days are read-only; from now on, they are owned
+        owned_days_.assign(days_, days_ + day_count_);
+        days_ = owned_days_.data();
+        munmap(map_, map_len_);
+        map_ = nullptr;
+        map_len_ = 0;
+    }
+    if (event == events_.size()) {
+        events_.push_back({description_thai, description_english});
+    }
+    
+    Day& entry = owned_days_[DayNumber(year_ce, month, day) - first_day_];
+    entry.flags |= flags;
+    entry.event = static_cast<uint8_t>(event + 1);
+    return true;
+}
+
+bool ThaiCalendar::Map(const std::string& path) {
+    Close();
+    
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        std::cerr << "Unable to open Thai calendar '" << path << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+    
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) || static_cast<size_t>(file_stat.st_size) < HEADER_SIZE) {
+        close(fd);
+        std::cerr << "Unable to read Thai calendar '" << path << "'" << std::endl;
+        return false;
+    }
+    
+    void* map = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        std::cerr << "Unable to map Thai calendar '" << path << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+    map_ = map;
+    map_len_ = file_stat.st_size;
+    
+    const uint8_t* data = static_cast<const uint8_t*>(map_);
+    const uint8_t* end = data + map_len_;
+    const int first_year_ce = static_cast<int32_t>(Get32(data + 12));
+    const uint32_t year_count = Get32(data + 16);
+    const uint32_t event_count = Get32(data + 20);
+    bool valid = memcmp(data, MAGIC, sizeof(MAGIC)) == 0 && Get32(data + 8) == FORMAT_VERSION &&
+                 year_count >= 1 && year_count <= static_cast<uint32_t>(MAX_YEAR_COUNT) &&
+                 first_year_ce >= 1 && first_year_ce + static_cast<int>(year_count) <= 10000 &&
+                 event_count <= MAX_EVENT_COUNT;
+    
+    if (valid) {
+        first_year_ce_ = first_year_ce;
+        year_count_ = year_count;
+        first_day_ = DayNumber(first_year_ce, 1, 1);
+        day_count_ = DayNumber(first_year_ce + year_count, 1, 1) - first_day_;
+        days_ = reinterpret_cast<const Day*>(data + HEADER_SIZE);
+        valid = static_cast<size_t>(end - data) - HEADER_SIZE >= day_count_ * sizeof(Day);
+    }
+    
+    // the days are used in place, so they are checked once here
+    const uint8_t* p = valid ? data + HEADER_SIZE + day_count_ * sizeof(Day) : end;
+    for (size_t i = 0; valid && i < day_count_; ++i) {
+        const Day& day = days_[i];
+        valid = day.year_offset < year_count && day.month >= 1 && day.month <= 12 &&
+                day.day >= 1 && day.day <= 31 && day.weekday <= 6 && day.event <= event_count;
+    }
+    for (uint32_t i = 0; valid && i < event_count; ++i) {
+        Event event;
+        for (std::string* description : {&event.description_thai, &event.description_english}) {
+            if (end - p < 2 || end - p - 2 < (p[0] | (p[1] << 8))) {
+                valid = false;
+                break;
+            }
+            description->assign(reinterpret_cast<const char*>(p + 2), p[0] | (p[1] << 8));
+            p += 2 + description->size();
+        }
+        events_.push_back(std::move(event));
+    }
+    
+    if (!valid) {
+        std::cerr << "Invalid Thai calendar '" << path << "'" << std::endl;
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool ThaiCalendar::WriteFile(const std::string& path) const {
+    if (!Valid()) {
+        return false;
+    }
+    
+    std::vector<uint8_t> calendar(HEADER_SIZE);
+    memcpy(calendar.data(), MAGIC, sizeof(MAGIC));
+    Put32(calendar.data() + 8, FORMAT_VERSION);
+    Put32(calendar.data() + 12, static_cast<uint32_t>(first_year_ce_));
+    Put32(calendar.data() + 16, year_count_);
+    Put32(calendar.data() + 20, events_.size());
+    const uint8_t* days = reinterpret_cast<const uint8_t*>(days_);
+    calendar.insert(calendar.end(), days, days + day_count_ * sizeof(Day));
+    for (const Event& event : events_) {
+        for (const std::string* description : {&event.description_thai, &event.description_english}) {
+            const size_t length = std::min<size_t>(description->size(), 0xFFFF);
+            calendar.push_back(length & 0xFF);
+            calendar.push_back(length >> 8);
+            calendar.insert(calendar.end(), description->begin(), description->begin() + length);
+        }
+    }
+    
+    std::string tmp_path = path + ".tmp";
+    FILE* f = fopen(tmp_path.c_str(), "wb");
+    if (!f) {
+        std::cerr << "Unable to create Thai calendar '" << tmp_path << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+    
+    bool ok = fwrite(calendar.data(), 1, calendar.size(), f) == calendar.size();
+    if (fclose(f)) ok = false;
+    if (!ok) {
+        std::cerr << "Unable to write Thai calendar '" << tmp_path << "'" << std::endl;
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    
+    if (rename(tmp_path.c_str(), path.c_str())) {
+        std::cerr << "Unable to replace Thai calendar '" << path << "': " << strerror(errno) << std::endl;
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+const ThaiCalendar::Day* ThaiCalendar::Find(int year_ce, int month, int day) const {
+    if (day < 1 || day > DaysInMonth(year_ce, month)) {
+        return nullptr;
+    }
+    return Find(DayNumber(year_ce, month, day));
+}
+
+const ThaiCalendar::Day* ThaiCalendar::Find(const std::chrono::system_clock::time_point& time) const {
+    auto time_t = std::chrono::system_clock::to_time_t(time);
+    struct tm tm;
+    localtime_r(&time_t, &tm);
+    return Find(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+}
+
+BuddhistDate ThaiCalendar::ToBuddhistDate(const Day& day) const {
+    BuddhistDate bd;
+    bd.year_ce = first_year_ce_ + day.year_offset;
+    bd.year_be = bd.year_ce + 543;
+    bd.month = day.month;
+    bd.day = day.day;
+    bd.thai_month_name = THAI_MONTH_NAMES[day.month];
+    bd.thai_day_name = THAI_DAY_NAMES[day.weekday];
+    bd.is_holy_day = day.flags & HOLY_DAY;
+    bd.is_national_holiday = day.flags & NATIONAL_HOLIDAY;
+    if (day.event) {
+        bd.event_description_thai = events_[day.event - 1].description_thai;
+        bd.event_description_english = events_[day.event - 1].description_english;
+    }
+    bd.is_valid = true;
+    return bd;
+}
+
+std::vector<BuddhistDate> ThaiCalendar::GetHolidays(int year_ce, int month, uint8_t flags) const {
+    std::vector<BuddhistDate> holidays;
+    const Day* first = Find(year_ce, month ? month : 1, 1);
+    if (!first) {
+        return holidays;
+    }
+    
+    const Day* last = first + (month ? DaysInMonth(year_ce, month) : DayNumber(year_ce + 1, 1, 1) - DayNumber(year_ce, 1, 1));
+    for (const Day* day = first; day != last; ++day) {
+        if (day->flags & flags) {
+            holidays.push_back(ToBuddhistDate(*day));
+        }
+    }
+    return holidays;
+}
+
+const char* ThaiCalendar::MonthName(int month) {
+    return month >= 1 && month <= 12 ? THAI_MONTH_NAMES[month] : "";
+}
+
+const char* ThaiCalendar::DayName(int weekday) {
+    return weekday >= 0 && weekday <= 6 ? THAI_DAY_NAMES[weekday] : "";
+}
+
+std::shared_ptr<const ThaiCalendar> ThaiCalendar::Default() {
+    static const std::shared_ptr<const ThaiCalendar> calendar = []() {
+        auto built = std::make_shared<ThaiCalendar>();
+        built->Build(2000, 101);
+        return built;
+    }();
+    return calendar;
+}
+
+// BuddhistCalendar implementation
+bool BuddhistCalendar::IsHolyDay(int year_be, int month, int day) {
+    const ThaiCalendar::Day* found = ThaiCalendar::Default()->Find(BEtoCE(year_be), month, day);
+    return found && (found->flags & ThaiCalendar::HOLY_DAY);
+}
+
+std::vector<BuddhistDate> BuddhistCalendar::GetHolyDays(int year_be) {
+    return ThaiCalendar::Default()->GetHolidays(BEtoCE(year_be), 0, ThaiCalendar::HOLY_DAY);
+}
+
+std::vector<BuddhistDate> BuddhistCalendar::GetNationalHolidays(int year_be) {
+    return ThaiCalendar::Default()->GetHolidays(BEtoCE(year_be), 0, ThaiCalendar::NATIONAL_HOLIDAY);
+}
+
+namespace {
+
+// The mean lunation, from a new moon (2000-01-06 18:14 UTC) in days since 1970
+const double SYNODIC_MONTH = 29.530588853;
+const double REFERENCE_NEW_MOON = 10962.76;
+
+// The age of the moon in days at noon in Thailand (05:00 UTC)
+double MoonAge(int year_ce, int month, int day) {
+    const double days = ThaiCalendar::DayNumber(year_ce, month, day) + 5.0 / 24 - REFERENCE_NEW_MOON;
+    const double age = std::fmod(days, SYNODIC_MONTH);
+    return age < 0 ? age + SYNODIC_MONTH : age;
+}
+
+// The Thai names of the years of the twelve-year animal cycle, from the rat
+const char* const THAI_ANIMAL_YEARS[12] = {
+    "ปีชวด", "ปีฉลู", "ปีขาล", "ปีเถาะ", "ปีมะโรง", "ปีมะเส็ง",
+    "ปีมะเมีย", "ปีมะแม", "ปีวอก", "ปีระกา", "ปีจอ", "ปีกุน"
+};
+
+// The sidereal signs of Thai astrology, by the month the sun enters them and
+// the (approximate) day it does
+struct ZodiacSign {
+    int start_day;
+    const char* name;
+};
+
+const ZodiacSign THAI_ZODIAC_SIGNS[12] = {
+    {14, "ราศีมังกร"}, {13, "ราศีกุมภ์"}, {14, "ราศีมีน"}, {13, "ราศีเมษ"},
+    {14, "ราศีพฤษภ"}, {15, "ราศีเมถุน"}, {16, "ราศีกรกฎ"}, {17, "ราศีสิงห์"},
+    {17, "ราศีกันย์"}, {17, "ราศีตุลย์"}, {16, "ราศีพิจิก"}, {16, "ราศีธนู"}
+};
+
+} // namespace
+
+int BuddhistCalendar::GetMoonPhase(int year_ce, int month, int day) {
+    // 0: new, 1: waxing, 2: full, 3: waning; new and full moon on the day
+    // closest to them (by the mean lunation, so a day off at times)
+    const double age = MoonAge(year_ce, month, day);
+    if (age < 0.5 || age >= SYNODIC_MONTH - 0.5) {
+        return 0;
+    }
+    if (std::fabs(age - SYNODIC_MONTH / 2) < 0.5) {
+        return 2;
+    }
+    return age < SYNODIC_MONTH / 2 ? 1 : 3;
+}
+
+bool BuddhistCalendar::IsFullMoon(int year_ce, int month, int day) {
+    return GetMoonPhase(year_ce, month, day) == 2;
+}
+
+bool BuddhistCalendar::IsNewMoon(int year_ce, int month, int day) {
+    return GetMoonPhase(year_ce, month, day) == 0;
+}
+
+std::string BuddhistCalendar::GetThaiEra(int year_be) {
+    return "พ.ศ. " + std::to_string(year_be);
+}
+
+std::string BuddhistCalendar::GetAnimalYear(int year_be) {
+    // 2020 CE was a year of the rat (the Thai year changes on Songkran, not
+    // on 1 January)
+    const int index = (BEtoCE(year_be) - 2020) % 12;
+    return THAI_ANIMAL_YEARS[index < 0 ? index + 12 : index];
+}
+
+std::string BuddhistCalendar::GetZodiacSign(int month, int day) {
+    if (month < 1 || month > 12 || day < 1 || day > 31) {
+        return "";
+    }
+    // before the start day, the sign entered in the month before
+    const int index = day >= THAI_ZODIAC_SIGNS[month - 1].start_day ? month - 1 : (month + 10) % 12;
+    return THAI_ZODIAC_SIGNS[index].name;
+}
+
+// CulturalContentAnalyzer implementation
+namespace {
+
+// Casual words and particles, with their formal form (empty: dropped)
+const std::pair<const char*, const char*> CASUAL_TO_FORMAL[] = {
+    {"เป็นไงบ้าง", "เป็นอย่างไรบ้าง"}, {"ยังไง", "อย่างไร"}, {"ไง", "อย่างไร"},
+    {"มั้ย", "ไหม"}, {"เปล่า", "หรือไม่"}, {"จ้า", "ครับ"}, {"จ้ะ", "ครับ"}, {"ป่ะ", "หรือไม่"},
+    {"เยอะ", "มาก"}, {"เดี๋ยว", "สักครู่"}, {"เฮ้ย", ""}
+};
+
+// Words to be replaced, with the milder ones to replace them
+const std::pair<const char*, std::vector<const char*>> MILDER_WORDS[] = {
+    {"ชิบหาย", {"แย่แล้ว", "เสียหาย"}},
+    {"งี่เง่า", {"ไม่เหมาะสม", "ไม่สมเหตุสมผล"}},
+    {"บ้า", {"แปลก", "ไม่น่าเชื่อ"}},
+    {"โง่", {"ไม่ฉลาด", "เข้าใจผิด"}},
+    {"เฮ้ย", {"เอ๊ะ", "โอ้"}}
+};
+
+// Common words starting with a term, which are not the term (Thai is
+// written without spaces between words)
+const char* const TERM_EXCEPTIONS[] = {"บ้าน", "บ้าง"};
+
+// The first occurrence of a term from a position, but within none of the exceptions
+size_t FindTerm(const std::string& text, const std::string& term, size_t from = 0) {
+    for (size_t pos = text.find(term, from); pos != std::string::npos; pos = text.find(term, pos + 1)) {
+        const bool exception = std::any_of(std::begin(TERM_EXCEPTIONS), std::end(TERM_EXCEPTIONS), [&](const char* word) {
+            const size_t len = strlen(word);
+            return len > term.size() && text.compare(pos, len, word) == 0 && term.compare(0, term.size(), word, term.size()) == 0;
+        });
+        if (!exception) {
+            return pos;
+        }
+    }
+    return std::string::npos;
+}
+
+// The share of the (non-space) bytes of a text within the given terms
+double TermCoverage(const std::string& text, const std::vector<std::string>& terms) {
+    std::vector<bool> covered(text.size(), false);
+    for (const std::string& term : terms) {
+        for (size_t pos = FindTerm(text, term); pos != std::string::npos; pos = FindTerm(text, term, pos + 1)) {
+            std::fill(covered.begin() + pos, covered.begin() + pos + term.size(), true);
+        }
+    }
+    size_t counted = 0;
+    size_t within = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (!isspace(static_cast<unsigned char>(text[i]))) {
+            counted++;
+            within += covered[i];
+        }
+    }
+    return counted ? static_cast<double>(within) / counted : 0.0;
+}
+
+// Every occurrence of a word replaced
+std::string ReplaceAll(const std::string& text, const std::string& word, const std::string& replacement) {
+    std::string result;
+    size_t pos = 0;
+    for (size_t found = FindTerm(text, word); found != std::string::npos; found = FindTerm(text, word, pos)) {
+        result.append(text, pos, found - pos);
+        result += replacement;
+        pos = found + word.size();
+    }
+    result.append(text, pos, std::string::npos);
+    return result;
+}
+
+} // namespace
+
+CulturalContentAnalyzer::CulturalContentAnalyzer() {
+    royal_vocabulary_ = {
+        "พระบาทสมเด็จพระเจ้าอยู่หัว", "สมเด็จพระนางเจ้า", "พระบรมราชินี", "พระองค์", "พระราชา",
+        "พระราชินี", "เจ้าฟ้า", "พระเจ้าหลานเธอ", "หม่อมเจ้า", "หม่อมราชวงศ์", "ทรง", "พระราช"
+    };
+    religious_vocabulary_ = {
+        "พระพุทธเจ้า", "พระธรรม", "พระสงฆ์", "พระอริยสงฆ์", "พุทธศาสนา", "หลวงพ่อ", "หลวงปู่",
+        "วัด", "ธรรม", "วินัย", "สมาธิ", "วิปัสสนา", "นิพพาน", "บุญ", "กุศล", "กรรม", "ศีล", "ทาน"
+    };
+    formal_vocabulary_ = {
+        "ครับ", "ค่ะ", "ขอ", "กรุณา", "ท่าน", "เรียน", "ขอบพระคุณ", "ขอบคุณ", "อย่างไร", "ดังกล่าว"
+    };
+    
+    // How unsuitable a term is: profanity, and themes and warnings of adult content
+    sensitivity_scores_ = {
+        {"ชิบหาย", 1.0}, {"เฮ้ย", 0.5}, {"บ้า", 0.4}, {"โง่", 0.5}, {"งี่เง่า", 0.5},
+        {"การพนัน", 0.6}, {"ความรุนแรง", 0.5}, {"เหล้า", 0.4}, {"สำหรับผู้ใหญ่", 0.7},
+        {"ไม่เหมาะสม", 0.3}, {"18+", 0.7}
+    };
+}
+
+double CulturalContentAnalyzer::AnalyzeFormalityLevel(const std::string& text) {
+    // royal language is formal as it is; otherwise neutral, raised by
+    // polite words and lowered by casual ones
+    const double royal = TermCoverage(text, royal_vocabulary_);
+    double level = royal > 0 ? 0.8 + 0.2 * royal : 0.5;
+    
+    double formal = 0.0;
+    for (const std::string& word : formal_vocabulary_) {
+        if (FindTerm(text, word) != std::string::npos) {
+            formal += 0.1;
+        }
+    }
+    level += std::min(formal, 0.3);
+    for (const auto& casual : CASUAL_TO_FORMAL) {
+        if (FindTerm(text, casual.first) != std::string::npos) {
+            level -= 0.15;
+        }
+    }
+    return std::max(0.0, std::min(level, 1.0));
+}
+
+double CulturalContentAnalyzer::AnalyzeReligiousContent(const std::string& text) {
+    return TermCoverage(text, religious_vocabulary_);
+}
+
+double CulturalContentAnalyzer::AnalyzeRoyalContent(const std::string& text) {
+    return TermCoverage(text, royal_vocabulary_);
+}
+
+std::vector<std::string> CulturalContentAnalyzer::SuggestAlternatives(const std::string& inappropriate_text) {
+    // the text with the words to be replaced, replaced by their first
+    // milder word, then by their second; longer words first
+    std::vector<std::string> alternatives;
+    for (size_t choice = 0; choice < 2; ++choice) {
+        std::string alternative = inappropriate_text;
+        for (const auto& words : MILDER_WORDS) {
+            alternative = ReplaceAll(alternative, words.first, words.second[choice]);
+        }
+        if (alternative != inappropriate_text &&
+            std::find(alternatives.begin(), alternatives.end(), alternative) == alternatives.end()) {
+            alternatives.push_back(alternative);
+        }
+    }
+    return alternatives;
+}
+
+std::string CulturalContentAnalyzer::AdaptForContext(const std::string& text, const std::string& context) {
+    // words to be replaced always are; in formal contexts casual words too
+    std::string adapted = text;
+    for (const auto& words : MILDER_WORDS) {
+        adapted = ReplaceAll(adapted, words.first, words.second[0]);
+    }
+    
+    static const char* const formal_contexts[] = {"government", "news", "royal", "religious", "official", "education"};
+    const bool formal = std::any_of(std::begin(formal_contexts), std::end(formal_contexts),
+                                    [&context](const char* formal_context) { return context.find(formal_context) != std::string::npos; });
+    if (formal) {
+        for (const auto& casual : CASUAL_TO_FORMAL) {
+            adapted = ReplaceAll(adapted, casual.first, casual.second);
+        }
+    }
+    return adapted.find_first_not_of(' ') == std::string::npos ? text : adapted;
+}
+
+bool CulturalContentAnalyzer::IsAppropriateForTime(const std::string& text,
+                                                   const std::chrono::system_clock::time_point& broadcast_time) {
+    auto time_t = std::chrono::system_clock::to_time_t(broadcast_time);
+    struct tm tm;
+    localtime_r(&time_t, &tm);
+    const int hour = tm.tm_hour;
+    
+    // greetings of the time of day
+    const bool night = hour >= 18 || hour < 4;
+    const bool morning = hour >= 4 && hour < 12;
+    if (!night && (text.find("ราตรีสวัสดิ์") != std::string::npos || text.find("Good night") != std::string::npos)) {
+        return false;
+    }
+    if (!morning && (text.find("อรุณสวัสดิ์") != std::string::npos || text.find("Good morning") != std::string::npos)) {
+        return false;
+    }
+    
+    // adult themes only after the watershed (22:00 - 06:00)
+    if (hour >= 6 && hour < 22) {
+        for (const auto& term : sensitivity_scores_) {
+            if (term.second >= 0.6 && FindTerm(text, term.first) != std::string::npos) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool CulturalContentAnalyzer::IsAppropriateForAudience(const std::string& text, const std::string& audience_type) {
+    // the most unsuitable term in the text against the limit of the audience
+    const double limit = audience_type == "children" ? 0.3 : audience_type == "adult" ? 1.0 : 0.6;
+    for (const auto& term : sensitivity_scores_) {
+        if (term.second >= limit && FindTerm(text, term.first) != std::string::npos) {
+            return false;
+        }
+    }
+    return true;
 }
 
-} // namespace StreamDAB
\ No newline at end of file
+} // namespace StreamDAB
@@ -19,6 +19,9 @@
 #include <chrono>
 #include <memory>
 #include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
 
 namespace StreamDAB {
 
@@ -46,6 +49,173 @@ struct BuddhistDate {
     bool is_national_holiday = false;
     std::string event_description_thai;
     std::string event_description_english;
+    bool is_valid = false;
+};
+
+// The days of a span of years in one array, indexed by the day number (days
+// since 1970-01-01 of the proleptic Gregorian calendar): each with its date,
+// weekday and holiday flags, so that dates are looked up in O(1). Built with
+// the fixed-date national holidays and the known lunar ones, or mapped from
+// a file written by WriteFile().
+//
+// file:  magic (8), format version (uint32), first year CE (uint32),
+//        year count (uint32), event count (uint32),
+//        days (6 bytes each, as Day),
+//        events: Thai description, English description, each as
+//        length (uint16), bytes
+// All integers are little-endian.
+class ThaiCalendar {
+public:
+    static const char MAGIC[8];
+    static const uint32_t FORMAT_VERSION;
+    static const size_t HEADER_SIZE = 24;
+    static const int MAX_YEAR_COUNT = 256;
+    static const size_t MAX_EVENT_COUNT = 255;
+
+    enum DayFlags : uint8_t {
+        HOLY_DAY = 0x01,
+        NATIONAL_HOLIDAY = 0x02
+    };
+
+    struct Day {
+        uint8_t year_offset;    // from the first year
+        uint8_t month;          // 1 - 12
+        uint8_t day;            // 1 - 31
+        uint8_t weekday;        // 0 (Sunday) - 6
+        uint8_t flags;          // DayFlags
+        uint8_t event;          // 1 + index of the event, 0 if none
+    };
+
+    struct Event {
+        std::string description_thai;
+        std::string description_english;
+    };
+
+    ThaiCalendar() = default;
+    ~ThaiCalendar();
+    ThaiCalendar(const ThaiCalendar&) = delete;
+    ThaiCalendar& operator=(const ThaiCalendar&) = delete;
+
+    // The years first_year_ce to first_year_ce + year_count - 1, with their
+    // holidays; false if the span is empty, longer than MAX_YEAR_COUNT or
+    // not within the years 1 - 9999
+    bool Build(int first_year_ce, int year_count);
+    // Marks a day of the span; a day has one event, so a later one replaces
+    // the description while the flags add up. false if the day is outside
+    // the span or there are too many distinct events.
+    bool AddHoliday(int year_ce, int month, int day, uint8_t flags,
+                    const std::string& description_thai, const std::string& description_english);
+    bool Map(const std::string& path);
+    // Replaces the file atomically, so that existing mappings stay intact
+    bool WriteFile(const std::string& path) const;
+
+    bool Valid() const { return days_ != nullptr; }
+    int FirstYearCE() const { return first_year_ce_; }
+    int YearCount() const { return year_count_; }
+
+    static int64_t DayNumber(int year_ce, int month, int day);
+    static int DaysInMonth(int year_ce, int month);
+
+    // nullptr if outside the span
+    const Day* Find(int64_t day_number) const {
+        const uint64_t index = static_cast<uint64_t>(day_number - first_day_);
+        return index < day_count_ ? &days_[index] : nullptr;
+    }
+    const Day* Find(int year_ce, int month, int day) const;
+    const Day* Find(const std::chrono::system_clock::time_point& time) const;   // local date
+
+    BuddhistDate ToBuddhistDate(const Day& day) const;
+    std::vector<BuddhistDate> GetHolidays(int year_ce, int month, uint8_t flags) const;   // month 0: the whole year
+
+    static const char* MonthName(int month);    // "" if not 1 - 12
+    static const char* DayName(int weekday);    // "" if not 0 - 6
+
+    // built for the years 2000 to 2100 on first use
+    static std::shared_ptr<const ThaiCalendar> Default();
+
+private:
+    std::vector<Day> owned_days_;
+    const Day* days_ = nullptr;
+    size_t day_count_ = 0;
+    int64_t first_day_ = 0;
+    int first_year_ce_ = 0;
+    int year_count_ = 0;
+    std::vector<Event> events_;
+    void* map_ = nullptr;
+    size_t map_len_ = 0;
+
+    void Close();
+};
+
+// Finds all terms of a set in one pass: Aho-Corasick over the code points
+// of the text as ThaiTextUtils::NormalizeText() normalises it, with ASCII
+// letters case-folded, so that spellings differing only in invisible
+// characters, spacing or the order of marks match alike. Compile() after
+// adding the terms; Scan() is then safe from any number of threads.
+class ThaiTermMatcher {
+public:
+    enum Category : uint8_t {
+        INAPPROPRIATE,
+        ROYAL,
+        RELIGIOUS
+    };
+
+    // a term found, by the bytes of the original text
+    struct Match {
+        uint32_t term;
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    struct Result {
+        std::vector<Match> matches;     // by end, then longest first
+        std::vector<uint32_t> terms;    // each term found once, in the order found
+        uint8_t categories = 0;         // bit per Category found
+        double score = 1.0;             // 1 less the weights of the terms found, at least 0
+    };
+
+    // false, if the term is empty once normalised or already added
+    bool Add(const std::string& term, Category category, double weight);
+    void Compile();
+
+    void Scan(const std::string& text, Result& result) const;
+    bool Contains(const std::string& text, Category category) const;
+
+    size_t TermCount() const { return terms_.size(); }
+    const std::string& Term(uint32_t term) const { return terms_[term].text; }
+    Category TermCategory(uint32_t term) const { return terms_[term].category; }
+
+private:
+    struct Entry {
+        std::string text;
+        std::vector<uint32_t> codepoints;
+        Category category;
+        double weight;
+    };
+    std::vector<Entry> terms_;
+
+    // symbols: 1 + index of a code point used by the terms, 0 for others
+    uint16_t ascii_symbols_[128] = {};
+    uint16_t thai_symbols_[128] = {};
+    std::unordered_map<uint32_t, uint16_t> other_symbols_;
+    size_t symbol_count_ = 1;
+
+    // the automaton, with failures resolved: state * symbol_count_ + symbol
+    std::vector<uint32_t> next_;
+    std::vector<int32_t> state_terms_;      // the term ending at a state, -1 if none
+    std::vector<uint32_t> output_links_;    // the next state on the failure path with a term, 0 if none
+
+    uint16_t Symbol(uint32_t codepoint) const {
+        if (codepoint < 0x80) {
+            return ascii_symbols_[codepoint];
+        }
+        if (codepoint - 0x0E00 < 0x80) {
+            return thai_symbols_[codepoint - 0x0E00];
+        }
+        auto it = other_symbols_.find(codepoint);
+        return it != other_symbols_.end() ? it->second : 0;
+    }
+    uint16_t AddSymbol(uint32_t codepoint);
 };
 
 // Thai text layout and rendering information
@@ -81,11 +251,10 @@ enum class ThaiNumberFormat {
 
 class ThaiLanguageProcessor {
 private:
-    std::map<uint16_t, uint8_t> utf8_to_dab_map_;
-    std::map<std::string, BuddhistDate> holiday_calendar_;
-    std::vector<std::string> inappropriate_words_;
-    std::vector<std::string> royal_terms_;
-    std::vector<std::string> religious_terms_;
+    mutable std::shared_ptr<const ThaiCalendar> calendar_;  // the default one built on first use
+    mutable std::mutex calendar_mutex_;
+    ThaiTermMatcher cultural_terms_;                // inappropriate, royal and religious terms
+    std::once_flag cultural_terms_once_;            // built on first use
     
     // Font and rendering data
     struct ThaiFontMetrics {
@@ -96,9 +265,29 @@ private:
         uint8_t descent = 4;
     } font_metrics_;
     
-    void InitializeUTF8ToDABMapping();
-    void InitializeHolidayCalendar();
+    // Widths of character_widths, flat for Latin (U+0000 - U+017F) and Thai
+    // (U+0E00 - U+0E7F); other characters are looked up in the map, if it
+    // has any
+    static constexpr uint8_t DEFAULT_GLYPH_WIDTH = 8;
+    uint8_t latin_widths_[0x180];
+    uint8_t thai_widths_[0x80];
+    bool other_widths_ = false;
+    
+    // Layouts by text and size (up to LAYOUT_CACHE_CAPACITY, least recently
+    // used dropped), as the same labels are analysed on each rotation
+    static constexpr size_t LAYOUT_CACHE_CAPACITY = 256;
+    struct LayoutCacheEntry {
+        uint16_t max_width_pixels;
+        uint16_t max_lines;
+        ThaiTextLayout layout;
+        std::list<size_t>::iterator order;
+    };
+    std::unordered_map<size_t, LayoutCacheEntry> layout_cache_;    // by hash of text and size
+    std::list<size_t> layout_cache_order_;                          // most recently used first
+    std::mutex layout_cache_mutex_;
+    
     void InitializeCulturalData();
+    const ThaiTermMatcher& CulturalTerms();
     void InitializeFontMetrics();
     
     bool IsThaiCharacter(uint16_t codepoint) const;
@@ -107,12 +296,35 @@ private:
     bool IsThaiConsonant(uint16_t codepoint) const;
     bool RequiresComplexLayout(const std::string& text) const;
     
+    void UpdateGlyphWidths();
+    uint8_t GlyphWidth(uint32_t codepoint) const {
+        if (codepoint < 0x180) {
+            return latin_widths_[codepoint];
+        }
+        if (codepoint - 0x0E00 < 0x80) {
+            return thai_widths_[codepoint - 0x0E00];
+        }
+        if (other_widths_ && codepoint <= 0xFFFF) {
+            auto it = font_metrics_.character_widths.find(static_cast<uint16_t>(codepoint));
+            if (it != font_metrics_.character_widths.end()) {
+                return it->second;
+            }
+        }
+        return DEFAULT_GLYPH_WIDTH;
+    }
+    ThaiTextLayout ComputeTextLayout(const std::string& utf8_text, uint16_t max_width_pixels, uint16_t max_lines);
+    std::shared_ptr<const ThaiCalendar> Calendar() const;
+    
 public:
     ThaiLanguageProcessor();
     ~ThaiLanguageProcessor() = default;
     
-    // Core conversion functions
+    // Core conversion functions; false (and no data) for an empty text or invalid UTF-8
     bool ConvertUTF8ToDAB(const std::string& utf8_text, std::vector<uint8_t>& dab_data);
+    // Into a caller-provided buffer, which needs 1 + utf8_len bytes at most
+    // (the character set byte, then one per code point): the number of bytes
+    // written; 0 if the text is not valid UTF-8 or the buffer too small.
+    size_t ConvertUTF8ToDAB(const char* utf8, size_t utf8_len, uint8_t* dab_data, size_t capacity) const;
     std::string ConvertDABToUTF8(const std::vector<uint8_t>& dab_data);
     
     // Text layout and rendering
@@ -135,6 +347,10 @@ public:
     bool IsHolyDay(const std::chrono::system_clock::time_point& date);
     std::string GetThaiMonthName(int month);
     std::string GetThaiDayName(const std::chrono::system_clock::time_point& date);
+    // false, if the file cannot be mapped or is not a calendar; the calendar
+    // in use is kept then
+    bool LoadCalendar(const std::string& path);
+    void SetCalendar(std::shared_ptr<const ThaiCalendar> calendar);
     
     // Cultural content validation
     CulturalValidation ValidateContent(const std::string& text);
@@ -163,9 +379,27 @@ public:
     // Word segmentation for Thai text (no spaces)
     static std::vector<std::string> SegmentWords(const std::string& text);
     
+    // Syllables, structure and romanization from one pass of a DFA over Thai
+    // character classes. Syllables are orthographic and found by rule, not by
+    // dictionary; runs of other text and of Thai digits are syllables of their
+    // own, and whitespace is in none.
+    struct TextAnalysis {
+        struct Span {
+            uint32_t offset;
+            uint32_t length;
+        };
+        std::vector<Span> syllables;
+        std::vector<Span> invalid;  // chars out of sequence, e.g. marks without their consonant
+        std::string roman;          // RTGS, else with the long vowels doubled; if asked for
+    };
+    // the vectors are reused; the functions below share the analysis of the
+    // last text asked about on the thread
+    static void Analyze(const std::string& text, TextAnalysis& analysis,
+                        bool romanize = false, bool use_royal_system = true);
+
     // Syllable analysis
     static std::vector<std::string> AnalyzeSyllables(const std::string& text);
-    
+
     // Romanization
     static std::string ToRoman(const std::string& thai_text, bool use_royal_system = true);
     
@@ -178,7 +412,16 @@ public:
     static bool HasValidThaiStructure(const std::string& text);
     static std::vector<std::string> FindInvalidSequences(const std::string& text);
     
-    // Text normalization
+    // Text normalization: invisible characters dropped, whitespace runs
+    // as one space and trimmed, Thai marks in their canonical order without
+    // repeats, and nikhahit with sara aa as sara am
+    struct NormalizedChar {
+        uint32_t codepoint;
+        uint32_t offset;    // the bytes of the text it comes from
+        uint32_t end;
+    };
+    // invalid UTF-8 is dropped; chars are reused
+    static void Normalize(const std::string& text, std::vector<NormalizedChar>& chars);
     static std::string NormalizeText(const std::string& text);
     static std::string RemoveInvisibleCharacters(const std::string& text);
 };
@@ -0,0 +1,518 @@
+/*
+    Thai Word Segmentation Implementation
+    Copyright (C) 2024 StreamDAB Project
+*/
+
+#include "thai_segmenter.h"
+#include "utf8.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace StreamDAB {
+
+const char ThaiDictionaryView::MAGIC[8] = {'S', 'D', 'A', 'B', 'T', 'H', 'D', 'A'};
+const uint32_t ThaiDictionaryView::FORMAT_VERSION = 1;
+
+static const uint32_t ROOT_CHECK = std::numeric_limits<uint32_t>::max();   // never a state
+
+// The symbol of a character of the Thai block, 0 if not one
+static uint8_t ThaiSymbol(uint32_t codepoint) {
+    return codepoint > 0x0E00 && codepoint <= 0x0E7F ? static_cast<uint8_t>(codepoint - 0x0E00) : 0;
+}
+
+// Following vowels, tone marks and other signs, which belong to the character before them
+static bool CanStartWord(uint8_t symbol) {
+    return !((symbol >= 0x30 && symbol <= 0x3A) || (symbol >= 0x45 && symbol <= 0x4E));
+}
+
+// Leading vowels (เ แ โ ใ ไ), which belong to the character after them
+static bool CanEndWord(uint8_t symbol) {
+    return !(symbol >= 0x40 && symbol <= 0x44);
+}
+
+static bool IsWhitespace(uint32_t codepoint) {
+    return codepoint == ' ' || (codepoint >= '\t' && codepoint <= '\r') || codepoint == 0x00A0;
+}
+
+// The code point at pos, U+FFFD for a byte that does not start valid UTF-8
+static uint32_t DecodeAt(std::string_view text, size_t pos, size_t& next) {
+    const uint8_t lead = static_cast<uint8_t>(text[pos]);
+    if (lead < 0x80) {
+        next = pos + 1;
+        return lead;
+    }
+    const char* it = text.data() + pos;
+    uint32_t codepoint = 0;
+    if (utf8::internal::validate_next(it, text.data() + text.size(), codepoint) != utf8::internal::UTF8_OK) {
+        next = pos + 1;
+        return 0xFFFD;
+    }
+    next = it - text.data();
+    return codepoint;
+}
+
+static void WriteLE32(uint8_t* p, uint32_t value) {
+    for (size_t i = 0; i < 4; i++) {
+        p[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+// ThaiDictionaryView implementation
+bool ThaiDictionaryView::Open(const uint8_t* data, size_t len) {
+    units_ = nullptr;
+    count_ = 0;
+    if (len < HEADER_SIZE || memcmp(data, MAGIC, sizeof(MAGIC)) != 0 || Read32(data + 8) != FORMAT_VERSION) {
+        return false;
+    }
+    const uint32_t count = Read32(data + 12);
+    if (count <= ROOT || (len - HEADER_SIZE) / 8 < count) {
+        return false;
+    }
+    units_ = data + HEADER_SIZE;
+    count_ = count;
+    return true;
+}
+
+bool ThaiDictionaryView::Contains(std::string_view word) const {
+    if (!Valid() || word.empty()) {
+        return false;
+    }
+    uint32_t state = ROOT;
+    size_t pos = 0;
+    while (pos < word.size()) {
+        const uint8_t symbol = ThaiSymbol(DecodeAt(word, pos, pos));
+        if (symbol == 0 || (state = Next(state, symbol)) == 0) {
+            return false;
+        }
+    }
+    return IsWordEnd(state);
+}
+
+// ThaiDictionary implementation
+ThaiDictionary::~ThaiDictionary() {
+    Close();
+}
+
+void ThaiDictionary::Close() {
+    if (map_) {
+        munmap(map_, map_len_);
+        map_ = nullptr;
+        map_len_ = 0;
+    }
+    data_.clear();
+    view_ = ThaiDictionaryView();
+}
+
+bool ThaiDictionary::Open(std::vector<uint8_t> data) {
+    Close();
+    data_ = std::move(data);
+    if (!view_.Open(data_.data(), data_.size())) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool ThaiDictionary::Map(const std::string& path) {
+    Close();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        std::cerr << "Unable to open Thai dictionary '" << path << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) || file_stat.st_size == 0) {
+        close(fd);
+        std::cerr << "Unable to read Thai dictionary '" << path << "'" << std::endl;
+        return false;
+    }
+
+    void* map = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        std::cerr << "Unable to map Thai dictionary '" << path << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+    map_ = map;
+    map_len_ = file_stat.st_size;
+
+    if (!view_.Open(static_cast<const uint8_t*>(map_), map_len_)) {
+        std::cerr << "Invalid Thai dictionary '" << path << "'" << std::endl;
+        Close();
+        return false;
+    }
+    return true;
+}
+
+// ThaiDictionaryBuilder implementation
+bool ThaiDictionaryBuilder::Add(std::string_view word) {
+    std::basic_string<uint8_t> symbols;
+    size_t pos = 0;
+    while (pos < word.size()) {
+        const uint8_t symbol = ThaiSymbol(DecodeAt(word, pos, pos));
+        if (symbol == 0) {
+            return false;
+        }
+        symbols += symbol;
+    }
+    if (symbols.empty()) {
+        return false;
+    }
+    words_.push_back(std::move(symbols));
+    return true;
+}
+
+bool ThaiDictionaryBuilder::AddWordList(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Unable to open word list '" << path << "'" << std::endl;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        while (!line.empty() && IsWhitespace(static_cast<uint8_t>(line.back()))) {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        if (!Add(line)) {
+            std::cerr << "Skipping word not in the Thai block: '" << line << "'" << std::endl;
+        }
+    }
+    return true;
+}
+
+void ThaiDictionaryBuilder::Place(Units& units, uint32_t state, size_t begin, size_t end, size_t depth) const {
+    // the words share their first depth symbols; the next (0 at their end) are
+    // ascending, as the words are sorted
+    uint8_t children[128];
+    size_t child_count = 0;
+    for (size_t i = begin; i < end; i++) {
+        const uint8_t symbol = depth < words_[i].size() ? words_[i][depth] : 0;
+        if (child_count == 0 || children[child_count - 1] != symbol) {
+            children[child_count++] = symbol;
+        }
+    }
+
+    // the first base at which all children have free units
+    size_t base = std::max<size_t>(1, units.first_free > children[0] ? units.first_free - children[0] : 1);
+    for (;; base++) {
+        const size_t last = base + children[child_count - 1];
+        if (last >= units.check.size()) {
+            units.base.resize(2 * last, 0);
+            units.check.resize(2 * last, 0);
+        }
+        bool free = true;
+        for (size_t c = 0; c < child_count && free; c++) {
+            free = units.check[base + children[c]] == 0;
+        }
+        if (free) {
+            break;
+        }
+    }
+    units.base[state] = base;
+    for (size_t c = 0; c < child_count; c++) {
+        units.check[base + children[c]] = state;
+    }
+    while (units.first_free < units.check.size() && units.check[units.first_free] != 0) {
+        units.first_free++;
+    }
+
+    size_t child_begin = begin;
+    for (size_t c = 0; c < child_count; c++) {
+        size_t child_end = child_begin;
+        while (child_end < end && (depth < words_[child_end].size() ? words_[child_end][depth] : 0) == children[c]) {
+            child_end++;
+        }
+        if (children[c] != 0) {
+            Place(units, base + children[c], child_begin, child_end, depth + 1);
+        }
+        child_begin = child_end;
+    }
+}
+
+std::vector<uint8_t> ThaiDictionaryBuilder::Finish() {
+    std::sort(words_.begin(), words_.end());
+    words_.erase(std::unique(words_.begin(), words_.end()), words_.end());
+
+    Units units;
+    units.base.assign(256, 0);
+    units.check.assign(256, 0);
+    units.check[ThaiDictionaryView::ROOT] = ROOT_CHECK;
+    if (!words_.empty()) {
+        Place(units, ThaiDictionaryView::ROOT, 0, words_.size(), 0);
+    }
+    words_.clear();
+
+    size_t count = units.check.size();
+    while (count > ThaiDictionaryView::ROOT + 1 && units.check[count - 1] == 0) {
+        count--;
+    }
+
+    std::vector<uint8_t> data(ThaiDictionaryView::HEADER_SIZE + 8 * count);
+    memcpy(&data[0], ThaiDictionaryView::MAGIC, sizeof(ThaiDictionaryView::MAGIC));
+    WriteLE32(&data[8], ThaiDictionaryView::FORMAT_VERSION);
+    WriteLE32(&data[12], count);
+    for (size_t i = 0; i < count; i++) {
+        WriteLE32(&data[ThaiDictionaryView::HEADER_SIZE + 8 * i], units.base[i]);
+        WriteLE32(&data[ThaiDictionaryView::HEADER_SIZE + 8 * i + 4], units.check[i]);
+    }
+    return data;
+}
+
+bool ThaiDictionaryBuilder::WriteFile(const std::string& path) {
+    std::vector<uint8_t> dictionary = Finish();
+
+    std::string tmp_path = path + ".tmp";
+    FILE* f = fopen(tmp_path.c_str(), "wb");
+    if (!f) {
+        std::cerr << "Unable to create Thai dictionary '" << tmp_path << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    bool ok = fwrite(dictionary.data(), 1, dictionary.size(), f) == dictionary.size();
+    if (fclose(f)) ok = false;
+    if (!ok) {
+        std::cerr << "Unable to write Thai dictionary '" << tmp_path << "'" << std::endl;
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    if (rename(tmp_path.c_str(), path.c_str())) {
+        std::cerr << "Unable to replace Thai dictionary '" << path << "': " << strerror(errno) << std::endl;
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// ThaiWordSegmenter implementation
+ThaiWordSegmenter::ThaiWordSegmenter() : dictionary_(BuiltInDictionary()) {
+}
+
+ThaiWordSegmenter::ThaiWordSegmenter(std::shared_ptr<const ThaiDictionary> dictionary)
+    : dictionary_(std::move(dictionary)) {
+}
+
+ThaiWordSegmenter& ThaiWordSegmenter::Default() {
+    static ThaiWordSegmenter segmenter;
+    return segmenter;
+}
+
+std::shared_ptr<const ThaiDictionary> ThaiWordSegmenter::BuiltInDictionary() {
+    static const std::shared_ptr<const ThaiDictionary> dictionary = []() {
+        // common words of station, programme and news texts; a full
+        // dictionary is loaded with LoadDictionary()
+        static const char* const words[] = {
+            "สวัสดี", "ครับ", "ค่ะ", "คะ", "นี่", "นี้", "คือ", "ข้อความ", "ทดสอบ", "ทด", "สอบ",
+            "สถานี", "สถาน", "วิทยุ", "ดิจิทัล", "ดิจิตอล", "เพลง", "ไทย", "สมัย", "ใหม่", "สมัยใหม่",
+            "นัก", "ร้อง", "นักร้อง", "ข่าว", "ข่าวสาร", "วัน", "วันนี้", "พรุ่งนี้", "เมื่อวาน", "เวลา",
+            "ปี", "ปีใหม่", "เดือน", "สัปดาห์", "เช้า", "เย็น", "คืน", "กลางคืน", "ตอน", "ตอนนี้",
+            "ฟัง", "รายการ", "ต่อไป", "กำลัง", "เล่น", "จาก", "ของ", "และ", "ที่", "ใน", "กับ",
+            "ได้", "ไป", "มา", "ให้", "เป็น", "มี", "ไม่", "จะ", "ว่า", "แล้ว", "คน", "การ", "ความ",
+            "อยู่", "ทุก", "เรา", "คุณ", "ผม", "ฉัน", "เขา", "ขอบคุณ", "ประเทศ", "ประเทศไทย",
+            "กรุงเทพ", "กรุงเทพมหานคร", "อากาศ", "พยากรณ์", "อุณหภูมิ", "ฝน", "ตก", "ร้อน", "หนาว",
+            "จราจร", "ถนน", "รถ", "ติด", "ด่วน", "ประกาศ", "เตือน", "ภัย", "ฉุกเฉิน", "สด",
+            "ออกอากาศ", "ศิลปิน", "อัลบั้ม", "ชื่อ", "ติดต่อ", "โทร", "เว็บไซต์", "ราคา", "บาท",
+            "พิเศษ", "ซื้อ", "ขาย", "ลด", "สุด", "มาก", "ดี", "สวย", "ใหญ่", "เล็ก", "รัก", "ใจ",
+            "หัวใจ", "ความรัก", "ชีวิต", "โลก", "ฟ้า", "ทะเล", "ภูเขา", "เมือง", "บ้าน", "โรงเรียน",
+            "โรง", "เรียน", "ทำงาน", "งาน", "ทำ", "ฟุตบอล", "กีฬา", "ผล", "แข่งขัน", "ทีม", "ชนะ",
+            "แพ้", "รัฐบาล", "นายก", "นายกรัฐมนตรี", "รัฐมนตรี", "เศรษฐกิจ", "ตลาด", "หุ้น",
+            "ธนาคาร", "พระ", "ศาสนา", "วัด", "เทศกาล", "สงกรานต์", "ลอยกระทง", "ฟรี", "ลงทะเบียน",
+            "สมัคร", "สมาชิก", "ข้อมูล", "เพิ่มเติม", "ระบบ", "บริการ", "ลูกค้า", "สินค้า", "ใช้",
+            "เปิด", "ปิด", "เริ่ม", "จบ", "ละคร", "ภาพยนตร์", "หนัง", "ดนตรี", "คอนเสิร์ต"
+        };
+        ThaiDictionaryBuilder builder;
+        for (const char* word : words) {
+            builder.Add(word);
+        }
+        auto built = std::make_shared<ThaiDictionary>();
+        built->Open(builder.Finish());
+        return std::shared_ptr<const ThaiDictionary>(std::move(built));
+    }();
+    return dictionary;
+}
+
+bool ThaiWordSegmenter::LoadDictionary(const std::string& path) {
+    auto dictionary = std::make_shared<ThaiDictionary>();
+    if (!dictionary->Map(path)) {
+        return false;
+    }
+    SetDictionary(std::move(dictionary));
+    return true;
+}
+
+void ThaiWordSegmenter::SetDictionary(std::shared_ptr<const ThaiDictionary> dictionary) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dictionary_ = std::move(dictionary);
+    cache_.clear();
+    cache_order_.clear();
+}
+
+size_t ThaiWordSegmenter::GetCachedTextCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cache_.size();
+}
+
+void ThaiWordSegmenter::SegmentThai(const ThaiDictionaryView& dictionary, std::string_view text,
+                                    size_t begin, size_t end, std::vector<Span>& spans) {
+    // per position: the fewest characters outside dictionary words and the
+    // fewest words up to it, and where the last word starts
+    struct Best {
+        uint32_t unknown;
+        uint32_t words;
+        uint32_t start;
+        bool known;
+    };
+    thread_local std::vector<uint8_t> symbols;
+    thread_local std::vector<Best> best;
+
+    // characters of the Thai block all take 3 bytes
+    const size_t n = (end - begin) / 3;
+    symbols.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(text.data() + begin + 3 * i);
+        symbols[i] = ThaiSymbol(((p[0] & 0x0F) << 12) | ((p[1] & 0x3F) << 6) | (p[2] & 0x3F));
+    }
+    best.assign(n + 1, Best{std::numeric_limits<uint32_t>::max(), 0, 0, false});
+    best[0].unknown = 0;
+
+    auto relax = [](Best& to, uint32_t unknown, uint32_t words, uint32_t start, bool known) {
+        if (unknown < to.unknown || (unknown == to.unknown && words < to.words)) {
+            to = Best{unknown, words, start, known};
+        }
+    };
+    for (size_t i = 0; i < n; i++) {
+        if (best[i].unknown == std::numeric_limits<uint32_t>::max()) {
+            continue;   // within a character cluster
+        }
+
+        uint32_t state = ThaiDictionaryView::ROOT;
+        for (size_t j = i; j < n && (state = dictionary.Next(state, symbols[j])) != 0; j++) {
+            if (dictionary.IsWordEnd(state) && CanEndWord(symbols[j]) && (j + 1 == n || CanStartWord(symbols[j + 1]))) {
+                relax(best[j + 1], best[i].unknown, best[i].words + 1, i, true);
+            }
+        }
+
+        // otherwise one character, with the vowel before it and the signs after it
+        size_t k = i;
+        if (!CanEndWord(symbols[k]) && k + 1 < n) {
+            k++;
+        }
+        k++;
+        while (k < n && !CanStartWord(symbols[k])) {
+            k++;
+        }
+        relax(best[k], best[i].unknown + (k - i), best[i].words + 1, i, false);
+    }
+
+    // the words from the end back, then forward, with unknown characters next
+    // to each other as one word
+    thread_local std::vector<const Best*> path;
+    path.clear();
+    for (size_t pos = n; pos > 0; pos = best[pos].start) {
+        path.push_back(&best[pos]);
+    }
+    bool last_known = true;
+    for (size_t p = path.size(); p-- > 0;) {
+        const size_t start = path[p]->start;
+        const size_t stop = p > 0 ? path[p - 1]->start : n;
+        if (!path[p]->known && !last_known) {
+            spans.back().length += static_cast<uint32_t>(3 * (stop - start));
+        } else {
+            spans.push_back(Span{static_cast<uint32_t>(begin + 3 * start), static_cast<uint32_t>(3 * (stop - start))});
+        }
+        last_known = path[p]->known;
+    }
+}
+
+void ThaiWordSegmenter::Segment(std::string_view text, std::vector<Span>& spans) {
+    spans.clear();
+    const size_t hash = std::hash<std::string_view>()(text);
+    std::shared_ptr<const ThaiDictionary> dictionary;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = cache_.find(hash);
+        if (it != cache_.end() && it->second.text == text) {
+            spans.assign(it->second.spans.begin(), it->second.spans.end());
+            cache_order_.splice(cache_order_.begin(), cache_order_, it->second.order);
+            return;
+        }
+        dictionary = dictionary_;
+    }
+
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t next;
+        const uint32_t codepoint = DecodeAt(text, pos, next);
+        if (IsWhitespace(codepoint)) {
+            pos = next;
+            continue;
+        }
+
+        // a run of Thai characters, or of others up to the next whitespace
+        const bool thai = ThaiSymbol(codepoint) != 0;
+        size_t end = next;
+        while (end < text.size()) {
+            size_t after;
+            const uint32_t c = DecodeAt(text, end, after);
+            if (IsWhitespace(c) || (ThaiSymbol(c) != 0) != thai) {
+                break;
+            }
+            end = after;
+        }
+        if (thai && dictionary) {
+            SegmentThai(dictionary->View(), text, pos, end, spans);
+        } else {
+            spans.push_back(Span{static_cast<uint32_t>(pos), static_cast<uint32_t>(end - pos)});
+        }
+        pos = end;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (dictionary_ != dictionary || text.size() > MAX_CACHED_TEXT_SIZE) {
+        return;
+    }
+    auto inserted = cache_.emplace(hash, CacheEntry());
+    CacheEntry& entry = inserted.first->second;
+    if (!inserted.second) {
+        cache_order_.erase(entry.order);
+    }
+    entry.text.assign(text.data(), text.size());
+    entry.spans = spans;
+    cache_order_.push_front(hash);
+    entry.order = cache_order_.begin();
+    if (cache_.size() > CACHE_CAPACITY) {
+        cache_.erase(cache_order_.back());
+        cache_order_.pop_back();
+    }
+}
+
+std::vector<std::string> ThaiWordSegmenter::SegmentWords(std::string_view text) {
+    thread_local std::vector<Span> spans;
+    Segment(text, spans);
+
+    std::vector<std::string> words;
+    words.reserve(spans.size());
+    for (const Span& span : spans) {
+        words.emplace_back(text.substr(span.offset, span.length));
+    }
+    return words;
+}
+
+} // namespace StreamDAB
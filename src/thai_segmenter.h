@@ -0,0 +1,167 @@
+/*
+    Thai Word Segmentation
+    Copyright (C) 2024 StreamDAB Project
+
+    Dictionary-based maximal matching over a double-array trie
+    Dictionaries built in memory or mapped from a file
+    Results cached per text
+*/
+
+#ifndef THAI_SEGMENTER_H_
+#define THAI_SEGMENTER_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace StreamDAB {
+
+/*
+ * A dictionary is a double-array trie over the characters of the Thai block
+ * U+0E01 - U+0E7F, as symbols 1 - 127 (the code point - 0x0E00); symbol 0
+ * ends a word. From state s, symbol c leads to t = base[s] + c, if
+ * check[t] == s. The root is state 1; free units have check 0.
+ *
+ * file:  magic (8), format version (uint32), unit count (uint32),
+ *        units: base (uint32), check (uint32)
+ * All integers are little-endian.
+ */
+
+// A dictionary in memory, read in place; the memory must outlive the view
+class ThaiDictionaryView {
+public:
+    static const char MAGIC[8];
+    static const uint32_t FORMAT_VERSION;
+    static const size_t HEADER_SIZE = 16;
+    static const uint32_t ROOT = 1;
+
+    // false, if the data is not a dictionary of a supported version
+    bool Open(const uint8_t* data, size_t len);
+    bool Valid() const { return units_ != nullptr; }
+
+    // the next state, 0 if none
+    uint32_t Next(uint32_t state, uint8_t symbol) const {
+        const uint32_t next = Base(state) + symbol;
+        return next < count_ && Check(next) == state ? next : 0;
+    }
+    bool IsWordEnd(uint32_t state) const { return Next(state, 0) != 0; }
+    bool Contains(std::string_view word) const;
+
+private:
+    const uint8_t* units_ = nullptr;
+    uint32_t count_ = 0;
+
+    static uint32_t Read32(const uint8_t* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+    uint32_t Base(uint32_t unit) const { return Read32(units_ + 8 * unit); }
+    uint32_t Check(uint32_t unit) const { return Read32(units_ + 8 * unit + 4); }
+};
+
+// A dictionary that owns its data, either in memory or as a mapped file
+class ThaiDictionary {
+public:
+    ThaiDictionary() = default;
+    ~ThaiDictionary();
+    ThaiDictionary(const ThaiDictionary&) = delete;
+    ThaiDictionary& operator=(const ThaiDictionary&) = delete;
+
+    bool Open(std::vector<uint8_t> data);
+    bool Map(const std::string& path);
+    const ThaiDictionaryView& View() const { return view_; }
+
+private:
+    std::vector<uint8_t> data_;
+    void* map_ = nullptr;
+    size_t map_len_ = 0;
+    ThaiDictionaryView view_;
+
+    void Close();
+};
+
+// Builds a dictionary from words
+class ThaiDictionaryBuilder {
+public:
+    // false, if the word is empty or not valid UTF-8 of the Thai block only
+    bool Add(std::string_view word);
+    // one word per line; empty lines and those starting with '#' are skipped
+    bool AddWordList(const std::string& path);
+    size_t Size() const { return words_.size(); }
+
+    // The complete dictionary; the builder is empty afterwards
+    std::vector<uint8_t> Finish();
+    // Replaces the file atomically, so that existing mappings stay intact
+    bool WriteFile(const std::string& path);
+
+private:
+    std::vector<std::basic_string<uint8_t>> words_;     // symbols
+
+    struct Units {
+        std::vector<uint32_t> base;
+        std::vector<uint32_t> check;
+        size_t first_free = 2;
+    };
+    void Place(Units& units, uint32_t state, size_t begin, size_t end, size_t depth) const;
+};
+
+// Splits text into words: Thai runs by maximal matching against the
+// dictionary (fewest characters outside dictionary words, then fewest
+// words), anything else at whitespace, which belongs to no word. Characters
+// that cannot start a syllable stay with the one before them, and runs of
+// unknown characters form one word.
+// Segmentations are cached by text (up to CACHE_CAPACITY, least recently
+// used dropped); the dictionary can be replaced while in use.
+class ThaiWordSegmenter {
+public:
+    static const size_t CACHE_CAPACITY = 4096;
+    static const size_t MAX_CACHED_TEXT_SIZE = 4096;   // bytes
+
+    // a word, by its bytes in the text
+    struct Span {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    // with the built-in dictionary of common words
+    ThaiWordSegmenter();
+    explicit ThaiWordSegmenter(std::shared_ptr<const ThaiDictionary> dictionary);
+
+    // the process-wide segmenter, used by ThaiTextUtils
+    static ThaiWordSegmenter& Default();
+
+    // false, if the file cannot be mapped or is not a dictionary; the
+    // dictionary in use is kept then
+    bool LoadDictionary(const std::string& path);
+    void SetDictionary(std::shared_ptr<const ThaiDictionary> dictionary);
+
+    // into spans, whose memory is reused
+    void Segment(std::string_view text, std::vector<Span>& spans);
+    std::vector<std::string> SegmentWords(std::string_view text);
+
+    size_t GetCachedTextCount() const;
+
+private:
+    struct CacheEntry {
+        std::string text;
+        std::vector<Span> spans;
+        std::list<size_t>::iterator order;
+    };
+
+    std::shared_ptr<const ThaiDictionary> dictionary_;
+    std::unordered_map<size_t, CacheEntry> cache_;     // by text hash
+    std::list<size_t> cache_order_;                     // most recently used first
+    mutable std::mutex mutex_;
+
+    static std::shared_ptr<const ThaiDictionary> BuiltInDictionary();
+    static void SegmentThai(const ThaiDictionaryView& dictionary, std::string_view text,
+                            size_t begin, size_t end, std::vector<Span>& spans);
+};
+
+} // namespace StreamDAB
+
+#endif // THAI_SEGMENTER_H_
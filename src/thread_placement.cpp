@@ -0,0 +1,397 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file thread_placement.cpp
+    \brief CPUs and scheduling of the PAD request thread and the other threads
+*/
+
+#include "thread_placement.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <ctype.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+// --- NumaTopology -----------------------------------------------------------------
+const NumaTopology& NumaTopology::Global() {
+    static const NumaTopology topology = [] {
+        NumaTopology topology;
+        if (!topology.Load("/sys/devices/system/node")) {
+            // a single node with the CPUs of the host
+            std::vector<int> cpus;
+            for (unsigned int cpu = 0; cpu < std::max(std::thread::hardware_concurrency(), 1u); cpu++)
+                cpus.push_back(cpu);
+            topology.node_cpus.push_back(cpus);
+        }
+        return topology;
+    }();
+    return topology;
+}
+
+bool NumaTopology::Load(const std::string& dir) {
+    node_cpus.clear();
+    for (int node = 0; node < MAX_NODES; node++) {
+        std::ifstream cpulist(dir + "/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+        std::vector<int> cpus;
+        if (!cpulist || !std::getline(cpulist, list))
+            continue;
+        // a node without CPUs (i.e. only memory) has an empty list
+        ThreadPlacement::ParseCPUList(list, cpus);
+        node_cpus.resize(node + 1);
+        node_cpus[node] = cpus;
+    }
+    return !node_cpus.empty();
+}
+
+const std::vector<int>& NumaTopology::CPUs(int node) const {
+    static const std::vector<int> none;
+    return node >= 0 && node < (int) node_cpus.size() ? node_cpus[node] : none;
+}
+
+int NumaTopology::NodeOf(int cpu) const {
+    for (size_t node = 0; node < node_cpus.size(); node++)
+        if (std::binary_search(node_cpus[node].begin(), node_cpus[node].end(), cpu))
+            return node;
+    return -1;
+}
+
+int NumaTopology::NodeOf(const std::vector<int>& cpus) const {
+    int node = -1;
+    for (int cpu : cpus) {
+        const int cpu_node = NodeOf(cpu);
+        if (cpu_node < 0 || (node >= 0 && cpu_node != node))
+            return -1;
+        node = cpu_node;
+    }
+    return node;
+}
+
+int NumaTopology::NodeOfSocketPeer(const std::string& path) const {
+#ifdef __linux__
+    // the inode of the socket bound to the path
+    std::ifstream unix_sockets("/proc/net/unix");
+    std::string line;
+    unsigned long inode = 0;
+    while (!inode && std::getline(unix_sockets, line)) {
+        // Num RefCount Protocol Flags Type St Inode Path
+        std::istringstream fields(line);
+        std::string num, refcount, protocol, flags, type, state, socket_path;
+        unsigned long socket_inode;
+        if (fields >> num >> refcount >> protocol >> flags >> type >> state >> socket_inode >> socket_path && socket_path == path)
+            inode = socket_inode;
+    }
+    if (!inode)
+        return -1;
+
+    // the process holding it
+    const std::string target = "socket:[" + std::to_string(inode) + "]";
+    pid_t pid = 0;
+    DIR* proc = opendir("/proc");
+    if (!proc)
+        return -1;
+    while (struct dirent* process = readdir(proc)) {
+        if (!isdigit(process->d_name[0]))
+            continue;
+        const std::string fd_dir = std::string("/proc/") + process->d_name + "/fd";
+        DIR* fds = opendir(fd_dir.c_str());
+        if (!fds)
+            continue;
+        while (struct dirent* fd = readdir(fds)) {
+            char link[64];
+            ssize_t len = readlink((fd_dir + "/" + fd->d_name).c_str(), link, sizeof(link) - 1);
+            if (len > 0 && target.compare(0, std::string::npos, link, len) == 0) {
+                pid = atoi(process->d_name);
+                break;
+            }
+        }
+        closedir(fds);
+        if (pid)
+            break;
+    }
+    closedir(proc);
+    if (!pid)
+        return -1;
+
+    // where it runs: its CPUs, if all on one node, else the CPU it last ran on
+    cpu_set_t set;
+    if (sched_getaffinity(pid, sizeof(set), &set) == 0) {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+        const int node = NodeOf(cpus);
+        if (node >= 0)
+            return node;
+    }
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat_line;
+    if (!std::getline(stat, stat_line))
+        return -1;
+    // the fields after the command (which may contain spaces), starting with the third
+    const size_t command_end = stat_line.rfind(')');
+    if (command_end == std::string::npos)
+        return -1;
+    std::istringstream fields(stat_line.substr(command_end + 1));
+    std::string field;
+    for (int i = 3; i <= 39 && fields >> field; i++)
+        if (i == 39)
+            return NodeOf(atoi(field.c_str()));
+#endif
+    return -1;
+}
+
+
+// --- ThreadPlacement -----------------------------------------------------------------
+// the node the calling thread is bound to
+static thread_local int current_node = -1;
+
+ThreadPlacement& ThreadPlacement::Global() {
+    static ThreadPlacement placement;
+    return placement;
+}
+
+bool ThreadPlacement::ParseCPUList(const std::string& list, std::vector<int>& cpus) {
+    cpus.clear();
+    const char* c = list.c_str();
+    while (*c) {
+        char* end;
+        const long first = strtol(c, &end, 10);
+        if (end == c || first < 0)
+            return false;
+        long last = first;
+        c = end;
+        if (*c == '-') {
+            last = strtol(c + 1, &end, 10);
+            if (end == c + 1 || last < first)
+                return false;
+            c = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+        if (*c == ',' && c[1])
+            c++;
+        else if (*c)
+            return false;
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return !cpus.empty();
+}
+
+std::string ThreadPlacement::FormatCPUList(const std::vector<int>& cpus) {
+    std::string list;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+            j++;
+        if (!list.empty())
+            list += ",";
+        list += std::to_string(cpus[i]);
+        if (j > i)
+            list += "-" + std::to_string(cpus[j]);
+        i = j + 1;
+    }
+    return list;
+}
+
+bool ThreadPlacement::Configure(int rt_priority, int rt_cpu, const std::vector<int>& worker_cpus) {
+    this->rt_priority = rt_priority;
+    this->rt_cpu = rt_cpu;
+    this->worker_cpus = worker_cpus;
+
+#ifdef __linux__
+    // the CPUs the process may use at all
+    cpu_set_t available;
+    if (sched_getaffinity(0, sizeof(available), &available)) {
+        perror("ODR-PadEnc Error: cannot get the CPUs of the process");
+        return false;
+    }
+    if (rt_cpu >= 0 && (rt_cpu >= CPU_SETSIZE || !CPU_ISSET(rt_cpu, &available))) {
+        fprintf(stderr, "ODR-PadEnc Error: CPU %d of the PAD request thread is not available\n", rt_cpu);
+        return false;
+    }
+    for (int cpu : worker_cpus) {
+        if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &available)) {
+            fprintf(stderr, "ODR-PadEnc Error: worker CPU %d is not available\n", cpu);
+            return false;
+        }
+    }
+
+    // by default, the workers keep off the real-time CPU
+    if (rt_cpu >= 0 && worker_cpus.empty()) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &available) && cpu != rt_cpu)
+                this->worker_cpus.push_back(cpu);
+        if (this->worker_cpus.empty())
+            fprintf(stderr, "ODR-PadEnc Warning: only CPU %d is available, so the other threads share it with the PAD requests\n", rt_cpu);
+    }
+    if (std::find(this->worker_cpus.begin(), this->worker_cpus.end(), rt_cpu) != this->worker_cpus.end())
+        fprintf(stderr, "ODR-PadEnc Warning: the worker CPUs include CPU %d of the PAD request thread\n", rt_cpu);
+#else
+    if (Enabled())
+        fprintf(stderr, "ODR-PadEnc Warning: thread placement is only supported on Linux\n");
+#endif
+    return true;
+}
+
+void ThreadPlacement::SetAffinity(const std::vector<int>& cpus, const char* thread) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        CPU_SET(cpu, &set);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (error)
+        fprintf(stderr, "ODR-PadEnc Warning: cannot pin the %s to CPUs %s: %s\n", thread, FormatCPUList(cpus).c_str(), strerror(error));
+#endif
+}
+
+void ThreadPlacement::EnterRealtime() {
+#ifdef __linux__
+    if (rt_cpu >= 0)
+        SetAffinity({rt_cpu}, "PAD request thread");
+
+    if (rt_priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = rt_priority;
+        int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (error)
+            fprintf(stderr, "ODR-PadEnc Warning: cannot run the PAD request thread with SCHED_FIFO priority %d: %s "
+                    "(needs CAP_SYS_NICE or an rtprio limit)\n", rt_priority, strerror(error));
+    }
+#endif
+}
+
+void ThreadPlacement::EnterWorker() {
+#ifdef __linux__
+    std::vector<int> cpus = worker_cpus;
+
+    // started by a thread on a node: the worker CPUs of that node
+    if (node_binding) {
+        cpu_set_t set;
+        std::vector<int> inherited;
+        if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                if (CPU_ISSET(cpu, &set))
+                    inherited.push_back(cpu);
+        const NumaTopology& topology = NumaTopology::Global();
+        current_node = topology.NodeOf(inherited);
+        if (current_node >= 0) {
+            const std::vector<int>& node_cpus = topology.CPUs(current_node);
+            std::vector<int> node_workers;
+            for (int cpu : node_cpus)
+                if (worker_cpus.empty() ? cpu != rt_cpu : std::find(worker_cpus.begin(), worker_cpus.end(), cpu) != worker_cpus.end())
+                    node_workers.push_back(cpu);
+            cpus = node_workers.empty() ? node_cpus : node_workers;
+        }
+    }
+    if (!cpus.empty())
+        SetAffinity(cpus, "worker thread");
+
+    // not inherited from the real-time thread
+    if (rt_priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        int error = pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+        if (error)
+            fprintf(stderr, "ODR-PadEnc Warning: cannot run a worker thread with normal scheduling: %s\n", strerror(error));
+    }
+#endif
+}
+
+void ThreadPlacement::EnterNode(int node) {
+    if (node < 0)
+        return;
+    current_node = node;
+#ifdef __linux__
+    // a real-time CPU on the node is kept
+    const NumaTopology& topology = NumaTopology::Global();
+    if (rt_cpu >= 0 && topology.NodeOf(rt_cpu) == node)
+        return;
+    const std::vector<int>& cpus = topology.CPUs(node);
+    if (!cpus.empty())
+        SetAffinity(cpus, ("thread of NUMA node " + std::to_string(node)).c_str());
+#endif
+}
+
+int ThreadPlacement::CurrentNode() {
+    return current_node;
+}
+
+std::string ThreadPlacement::Describe() const {
+    std::string description = "answering PAD requests";
+    if (rt_cpu >= 0)
+        description += " on CPU " + std::to_string(rt_cpu);
+    if (rt_priority > 0)
+        description += " with SCHED_FIFO priority " + std::to_string(rt_priority);
+    if (!worker_cpus.empty())
+        description += ", other threads on CPUs " + FormatCPUList(worker_cpus);
+    return description;
+}
+
+
+// --- WorkGovernor -----------------------------------------------------------------
+const double WorkGovernor::THROTTLE_SLACK = 0.5;
+const double WorkGovernor::PAUSE_SLACK = 0.2;
+const std::chrono::milliseconds WorkGovernor::THROTTLE_DELAY(20);
+const std::chrono::milliseconds WorkGovernor::MAX_PAUSE(1000);
+
+WorkGovernor& WorkGovernor::Global() {
+    static WorkGovernor governor;
+    return governor;
+}
+
+WorkGovernor::level_t WorkGovernor::LevelOf(double slack) {
+    return slack < PAUSE_SLACK ? PAUSED : slack < THROTTLE_SLACK ? THROTTLED : NORMAL;
+}
+
+void WorkGovernor::Report(double slack) {
+    // of all services; a lost update of a concurrent report does not matter
+    const double avg = 0.9 * slack_avg.load(std::memory_order_relaxed) + 0.1 * std::min(slack, 1.0);
+    slack_avg.store(avg, std::memory_order_relaxed);
+    level.store(std::max(LevelOf(slack), LevelOf(avg)), std::memory_order_relaxed);
+}
+
+void WorkGovernor::Pace() {
+    switch (level.load(std::memory_order_relaxed)) {
+    case NORMAL:
+        return;
+    case THROTTLED:
+        throttled++;
+        std::this_thread::sleep_for(THROTTLE_DELAY);
+        return;
+    case PAUSED:
+        paused++;
+        // until no longer paused, checked at the throttle delay
+        for (std::chrono::milliseconds waited(0); waited < MAX_PAUSE && level == PAUSED; waited += THROTTLE_DELAY)
+            std::this_thread::sleep_for(THROTTLE_DELAY);
+        return;
+    }
+}
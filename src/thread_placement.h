@@ -0,0 +1,153 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file thread_placement.h
+    \brief CPUs and scheduling of the PAD request thread and the other threads
+*/
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+
+// --- NumaTopology -----------------------------------------------------------------
+/*! The NUMA nodes of the host and their CPUs, as listed in sysfs. Without
+ * that (or on other systems than Linux), a single node 0 with all CPUs.
+ */
+class NumaTopology {
+public:
+    static const int MAX_NODES = 64;
+
+    // of the host
+    static const NumaTopology& Global();
+
+    // from a sysfs node directory (i.e. /sys/devices/system/node); false if none found
+    bool Load(const std::string& dir);
+
+    size_t Nodes() const {return node_cpus.size();}
+    const std::vector<int>& CPUs(int node) const;
+    int NodeOf(int cpu) const;     // -1 if unknown
+    int NodeOf(const std::vector<int>& cpus) const;     // -1 if not all on one node
+
+    /*! The node the process at the other end of a Unix socket path runs on,
+     *  e.g. the audio encoder of a service; -1 if not found (not running yet,
+     *  or not accessible, e.g. run by another user).
+     */
+    int NodeOfSocketPeer(const std::string& path) const;
+private:
+    std::vector<std::vector<int>> node_cpus;    // by node number; empty for missing nodes
+};
+
+
+// --- ThreadPlacement -----------------------------------------------------------------
+/*! Where the threads of the process run, so that the answers to the PAD
+ * requests are not delayed by slide encoding and the like.
+ *
+ * The thread answering the PAD requests calls EnterRealtime(): it then runs
+ * with SCHED_FIFO priority and/or on its own CPU. Every thread doing heavy
+ * work calls EnterWorker() when it starts; it then runs on the worker CPUs
+ * (by default all but the real-time one) with normal scheduling, also if
+ * started by the real-time thread. Threads inherit this from the thread
+ * that started them, e.g. the OpenMP threads of ImageMagick.
+ *
+ * A thread serving the services of a NUMA node calls EnterNode() to run on
+ * its CPUs, so that what it allocates is held in that node's memory. Once
+ * node binding is in use, the workers it starts stay on that node as well.
+ *
+ * Without configuration (or on other systems than Linux), all do nothing.
+ */
+class ThreadPlacement {
+public:
+    static ThreadPlacement& Global();
+
+    // e.g. "3" or "0-1,4"; false if not a valid list
+    static bool ParseCPUList(const std::string& list, std::vector<int>& cpus);
+    static std::string FormatCPUList(const std::vector<int>& cpus);
+
+    /*! A priority of 0 keeps the normal scheduling, a CPU of -1 lets the
+     *  real-time thread run on any CPU. Returns false (with an error printed)
+     *  if the CPUs are not available.
+     */
+    bool Configure(int rt_priority, int rt_cpu, const std::vector<int>& worker_cpus);
+    bool Enabled() const {return rt_priority > 0 || rt_cpu >= 0 || !worker_cpus.empty();}
+
+    // both print a warning, if not permitted (e.g. SCHED_FIFO without CAP_SYS_NICE)
+    void EnterRealtime();
+    void EnterWorker();
+
+    // before any thread is started; a node of -1 does nothing
+    void EnableNodeBinding() {node_binding = true;}
+    void EnterNode(int node);
+
+    // of the calling thread; -1 if not bound to a node
+    static int CurrentNode();
+
+    std::string Describe() const;
+private:
+    int rt_priority = 0;
+    int rt_cpu = -1;
+    std::vector<int> worker_cpus;   // empty: any
+    bool node_binding = false;
+
+    static void SetAffinity(const std::vector<int>& cpus, const char* thread);
+};
+
+
+// --- WorkGovernor -----------------------------------------------------------------
+/*! Lets the background work (e.g. slide preparation) yield to the PAD
+ * requests, without reserving CPUs for them: each request reports its slack,
+ * i.e. the part of the frame budget (see --frame-budget) left unused. As the
+ * slack shrinks, the workers are throttled (a delay before each work item,
+ * and ImageMagick on a single thread) and then paused (up to MAX_PAUSE at a
+ * time, so that the work still progresses).
+ *
+ * A request with little slack takes effect at once; the work only resumes
+ * as the average slack of the requests has recovered as well.
+ */
+class WorkGovernor {
+public:
+    enum level_t {NORMAL, THROTTLED, PAUSED};
+    static const double THROTTLE_SLACK;
+    static const double PAUSE_SLACK;
+    static const std::chrono::milliseconds THROTTLE_DELAY;
+    static const std::chrono::milliseconds MAX_PAUSE;
+
+    WorkGovernor() : slack_avg(1), level(NORMAL), throttled(0), paused(0) {}
+    static WorkGovernor& Global();
+
+    // by the PAD request threads: 1 - request time / budget (negative, if over budget)
+    void Report(double slack);
+    level_t Level() const {return level;}
+
+    // by the workers before each work item; delays it as needed
+    void Pace();
+
+    // work items delayed since the start
+    size_t Throttled() const {return throttled;}
+    size_t Paused() const {return paused;}
+private:
+    std::atomic<double> slack_avg;
+    std::atomic<level_t> level;
+    std::atomic<size_t> throttled;
+    std::atomic<size_t> paused;
+
+    static level_t LevelOf(double slack);
+};
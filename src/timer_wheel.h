@@ -0,0 +1,187 @@
+/*
+    Hierarchical Timer Wheel
+    Copyright (C) 2024 StreamDAB Project
+
+    Expiry of many items at amortised constant cost
+*/
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace StreamDAB {
+
+// Hands out items once their due time has passed, with a resolution of one
+// second. Four levels of 64 slots each cover about 194 days; items due later
+// are kept in the last slot and placed again when it comes round.
+template<typename T>
+class TimerWheel {
+public:
+    typedef std::chrono::system_clock::time_point time_point;
+
+    explicit TimerWheel(time_point start = std::chrono::system_clock::now())
+        : current_(ToTick(start)) {}
+
+    void Schedule(time_point due, T item) {
+        // round up, so that an item is never handed out early
+        int64_t tick = ToTick(due);
+        if (FromTick(tick) < due) {
+            tick++;
+        }
+
+        if (tick <= current_) {
+            overdue_.push_back(std::move(item));
+        } else {
+            Insert({tick, std::move(item)});
+        }
+        size_++;
+    }
+
+    // appends the items due by now
+    void Advance(time_point now, std::vector<T>& due) {
+        for (T& item : overdue_) {
+            due.push_back(std::move(item));
+        }
+        size_ -= overdue_.size();
+        overdue_.clear();
+
+        const int64_t target = ToTick(now);
+        while (current_ < target) {
+            // skip the ticks up to the next slot of the lowest level holding anything
+            size_t lowest = 0;
+            while (lowest < LEVELS && level_size_[lowest] == 0) {
+                lowest++;
+            }
+            if (lowest == LEVELS) {
+                current_ = target;
+                break;
+            }
+            if (lowest > 0) {
+                const int64_t mask = (int64_t(1) << (SLOT_BITS * lowest)) - 1;
+                current_ = std::min(target, (current_ | mask) + 1) - 1;
+            }
+            current_++;
+
+            // move the items of the next slot of each higher level that comes round
+            for (size_t level = 1; level < LEVELS; level++) {
+                if (current_ & ((int64_t(1) << (SLOT_BITS * level)) - 1)) {
+                    break;
+                }
+                std::vector<Entry> cascading;
+                cascading.swap(slots_[level][SlotIndex(current_, level)]);
+                level_size_[level] -= cascading.size();
+                for (Entry& entry : cascading) {
+                    Insert(std::move(entry));
+                }
+            }
+
+            std::vector<Entry>& slot = slots_[0][SlotIndex(current_, 0)];
+            for (Entry& entry : slot) {
+                due.push_back(std::move(entry.item));
+            }
+            size_ -= slot.size();
+            level_size_[0] -= slot.size();
+            slot.clear();
+        }
+    }
+
+    size_t Size() const { return size_; }
+
+    // The time by which to call Advance() next, i.e. when the next item is due
+    // or the next slot holding anything comes round; false if there are no items
+    bool NextDue(time_point& due) const {
+        if (!overdue_.empty()) {
+            due = FromTick(current_);
+            return true;
+        }
+
+        bool found = false;
+        int64_t next = 0;
+        for (size_t level = 0; level < LEVELS; level++) {
+            if (level_size_[level] == 0) {
+                continue;
+            }
+            const size_t bits = SLOT_BITS * level;
+            for (int64_t i = 1; i <= int64_t(SLOTS); i++) {
+                const int64_t tick = ((current_ >> bits) + i) << bits;
+                if (!slots_[level][SlotIndex(tick, level)].empty()) {
+                    if (!found || tick < next) {
+                        next = tick;
+                        found = true;
+                    }
+                    break;
+                }
+            }
+        }
+
+        if (found) {
+            due = FromTick(next);
+        }
+        return found;
+    }
+
+    void Clear() {
+        for (auto& level : slots_) {
+            for (std::vector<Entry>& slot : level) {
+                slot.clear();
+            }
+        }
+        overdue_.clear();
+        for (size_t& level_size : level_size_) {
+            level_size = 0;
+        }
+        size_ = 0;
+    }
+
+private:
+    static const size_t SLOT_BITS = 6;
+    static const size_t SLOTS = size_t(1) << SLOT_BITS;
+    static const size_t LEVELS = 4;
+
+    struct Entry {
+        int64_t tick;
+        T item;
+    };
+
+    std::vector<Entry> slots_[LEVELS][SLOTS];
+    std::vector<T> overdue_;     // scheduled for a time already passed
+    int64_t current_;            // the last tick handed out
+    size_t size_ = 0;
+    size_t level_size_[LEVELS] = {};
+
+    static int64_t ToTick(time_point time) {
+        return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+    }
+    static time_point FromTick(int64_t tick) {
+        return time_point(std::chrono::duration_cast<time_point::duration>(std::chrono::seconds(tick)));
+    }
+    static size_t SlotIndex(int64_t tick, size_t level) {
+        return (tick >> (SLOT_BITS * level)) & (SLOTS - 1);
+    }
+
+    // places an entry due after the current tick
+    void Insert(Entry entry) {
+        const int64_t delta = entry.tick - current_;
+        for (size_t level = 0; level < LEVELS; level++) {
+            if (delta < (int64_t(1) << (SLOT_BITS * (level + 1)))) {
+                slots_[level][SlotIndex(entry.tick, level)].push_back(std::move(entry));
+                level_size_[level]++;
+                return;
+            }
+        }
+
+        // beyond the range: keep it in the farthest slot, until that comes round
+        const int64_t farthest = current_ + (int64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+        slots_[LEVELS - 1][SlotIndex(farthest, LEVELS - 1)].push_back(std::move(entry));
+        level_size_[LEVELS - 1]++;
+    }
+};
+
+} // namespace StreamDAB
+
+#endif // TIMER_WHEEL_H_
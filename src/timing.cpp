@@ -0,0 +1,216 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file timing.cpp
+    \brief Timing of hot code paths at a few nanoseconds per measurement
+*/
+
+#include "timing.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+
+
+// --- TimingClock -----------------------------------------------------------------
+static const uint64_t process_start_ticks = TimingClock::Now();
+static const uint64_t process_start_ns = TimingClock::RawNanoseconds();
+
+double TimingClock::NanosecondsPerTick() {
+#if defined(__x86_64__) || defined(__i386__)
+    // at least 10 ms, for a precise enough ratio
+    uint64_t elapsed_ns;
+    uint64_t ticks;
+    do {
+        ticks = Now();
+        elapsed_ns = RawNanoseconds() - process_start_ns;
+    } while (elapsed_ns < 10000000);
+    return (double) elapsed_ns / (ticks - process_start_ticks);
+#else
+    return 1;
+#endif
+}
+
+
+// --- TimingOperation -----------------------------------------------------------------
+static std::mutex& operations_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+static std::vector<std::string>& operation_names() {
+    static std::vector<std::string> names;
+    return names;
+}
+
+size_t TimingOperation::Intern(const std::string& name) {
+    std::lock_guard<std::mutex> lock(operations_mutex());
+    std::vector<std::string>& names = operation_names();
+    std::vector<std::string>::const_iterator it = std::find(names.begin(), names.end(), name);
+    if (it != names.end())
+        return it - names.begin();
+
+    if (names.size() == MAX_OPERATIONS)
+        throw std::length_error("too many timing operations, at '" + name + "'");
+    names.push_back(name);
+    return names.size() - 1;
+}
+
+std::vector<std::string> TimingOperation::Names() {
+    std::lock_guard<std::mutex> lock(operations_mutex());
+    return operation_names();
+}
+
+
+// --- TimingSnapshot -----------------------------------------------------------------
+uint64_t TimingSnapshot::BucketLowerBound(size_t bucket) {
+    if (bucket < 8)
+        return bucket;
+    const int shift = (bucket - 8) / 8;
+    return (uint64_t) (8 + (bucket - 8) % 8) << shift;
+}
+
+double TimingSnapshot::MinNanoseconds() const {
+    for (size_t i = 0; i < BUCKETS; i++)
+        if (buckets[i])
+            return BucketLowerBound(i) * ns_per_tick;
+    return 0;
+}
+
+double TimingSnapshot::MaxNanoseconds() const {
+    for (size_t i = BUCKETS; i > 0; i--)
+        if (buckets[i - 1])
+            return (i < BUCKETS ? BucketLowerBound(i) - 1 : UINT64_MAX) * ns_per_tick;
+    return 0;
+}
+
+double TimingSnapshot::PercentileNanoseconds(double percentile) const {
+    if (!count)
+        return 0;
+
+    // the rank of the percentile, from 1
+    const uint64_t rank = std::max<uint64_t>(1, (uint64_t) (percentile / 100 * count + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            const double lower = BucketLowerBound(i);
+            const double upper = i + 1 < BUCKETS ? BucketLowerBound(i + 1) : lower * 2;
+            return (lower + upper - 1) / 2 * ns_per_tick;
+        }
+    }
+    return MaxNanoseconds();
+}
+
+TimingSnapshot& TimingSnapshot::operator+=(const TimingSnapshot& other) {
+    count += other.count;
+    sum += other.sum;
+    for (size_t i = 0; i < BUCKETS; i++)
+        buckets[i] += other.buckets[i];
+    return *this;
+}
+
+TimingSnapshot& TimingSnapshot::operator-=(const TimingSnapshot& other) {
+    count -= std::min(count, other.count);
+    sum -= std::min(sum, other.sum);
+    for (size_t i = 0; i < BUCKETS; i++)
+        buckets[i] -= std::min(buckets[i], other.buckets[i]);
+    return *this;
+}
+
+
+// --- Timings -----------------------------------------------------------------
+struct Timings::registry_t {
+    std::mutex mutex;
+    std::set<block_t*> blocks;  // of the running threads
+    std::map<size_t, TimingSnapshot> retired;  // of exited threads, by operation
+
+    static void Add(TimingSnapshot& snapshot, const histogram_t& histogram) {
+        snapshot.count += histogram.count.load(std::memory_order_relaxed);
+        snapshot.sum += histogram.sum.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < TimingSnapshot::BUCKETS; i++)
+            snapshot.buckets[i] += histogram.buckets[i].load(std::memory_order_relaxed);
+    }
+};
+
+Timings::registry_t& Timings::Registry() {
+    // never destroyed, as threads may still exit after the end of main()
+    static registry_t* registry = new registry_t();
+    return *registry;
+}
+
+/*! Hands the block of a thread over to the registry, when the thread exits
+ */
+class TimingBlockOwner {
+public:
+    Timings::block_t* block = nullptr;
+
+    ~TimingBlockOwner() {
+        if (!block)
+            return;
+        Timings::registry_t& registry = Timings::Registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.blocks.erase(block);
+        for (size_t i = 0; i < TimingOperation::MAX_OPERATIONS; i++) {
+            Timings::histogram_t* histogram = block->histograms[i].load(std::memory_order_relaxed);
+            if (histogram) {
+                Timings::registry_t::Add(registry.retired[i], *histogram);
+                delete histogram;
+            }
+        }
+        delete block;
+        Timings::local_block = nullptr;
+    }
+};
+
+Timings::histogram_t* Timings::AddHistogram(size_t operation) {
+    static thread_local TimingBlockOwner owner;
+
+    registry_t& registry = Registry();
+    if (!local_block) {
+        owner.block = new block_t();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.blocks.insert(owner.block);
+        local_block = owner.block;
+    }
+
+    histogram_t* histogram = new histogram_t();
+    local_block->histograms[operation].store(histogram, std::memory_order_release);
+    return histogram;
+}
+
+TimingSnapshot Timings::Read(size_t operation) {
+    TimingSnapshot snapshot;
+    {
+        registry_t& registry = Registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        std::map<size_t, TimingSnapshot>::const_iterator retired = registry.retired.find(operation);
+        if (retired != registry.retired.end())
+            snapshot = retired->second;
+        for (const block_t* block : registry.blocks) {
+            const histogram_t* histogram = block->histograms[operation].load(std::memory_order_acquire);
+            if (histogram)
+                registry_t::Add(snapshot, *histogram);
+        }
+    }
+    snapshot.ns_per_tick = TimingClock::NanosecondsPerTick();
+    return snapshot;
+}
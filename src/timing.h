@@ -0,0 +1,168 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file timing.h
+    \brief Timing of hot code paths at a few nanoseconds per measurement
+*/
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <x86intrin.h>
+#endif
+
+
+// --- TimingClock -----------------------------------------------------------------
+/*! Time stamp counter ticks on x86 (CLOCK_MONOTONIC_RAW nanoseconds
+ *  elsewhere); only converted to nanoseconds when timings are read.
+ */
+class TimingClock {
+public:
+    static uint64_t Now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return RawNanoseconds();
+#endif
+    }
+
+    static uint64_t RawNanoseconds() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    // calibrated against CLOCK_MONOTONIC_RAW since the start of the process
+    static double NanosecondsPerTick();
+};
+
+
+// --- TimingOperation -----------------------------------------------------------------
+/*! An operation to time, interned once by its name, e.g.
+ *
+ *      static const TimingOperation write_pad("pad.write_next_pad");
+ *
+ *  so that a measurement only deals with its ID.
+ */
+class TimingOperation {
+public:
+    static const size_t MAX_OPERATIONS = 128;
+
+    const size_t id;
+
+    explicit TimingOperation(const std::string& name) : id(Intern(name)) {}
+
+    // the same ID for the same name; throws std::length_error beyond MAX_OPERATIONS
+    static size_t Intern(const std::string& name);
+    static std::vector<std::string> Names();    // by ID
+};
+
+
+// --- TimingSnapshot -----------------------------------------------------------------
+/*! Durations of an operation, in log-linear buckets: exact below 8 ticks,
+ *  above that 8 buckets per power of two, i.e. within 12.5%.
+ */
+struct TimingSnapshot {
+    static const size_t BUCKETS = 8 + 61 * 8;
+
+    uint64_t count = 0;
+    uint64_t sum = 0;       // ticks
+    uint64_t buckets[BUCKETS] = {};
+    double ns_per_tick = 1;
+
+    static size_t Bucket(uint64_t ticks) {
+        if (ticks < 8)
+            return ticks;
+        const int exponent = 63 - __builtin_clzll(ticks);
+        return 8 + (exponent - 3) * 8 + ((ticks >> (exponent - 3)) & 7);
+    }
+    static uint64_t BucketLowerBound(size_t bucket);    // ticks
+
+    double MeanNanoseconds() const {return count ? sum * ns_per_tick / count : 0;}
+    // bounds of the lowest/highest bucket used
+    double MinNanoseconds() const;
+    double MaxNanoseconds() const;
+    // the midpoint of the bucket holding the percentile
+    double PercentileNanoseconds(double percentile) const;
+
+    TimingSnapshot& operator+=(const TimingSnapshot& other);
+    // for the durations since an earlier snapshot
+    TimingSnapshot& operator-=(const TimingSnapshot& other);
+};
+
+
+// --- Timings -----------------------------------------------------------------
+/*! Records durations per thread and operation, without locking and without
+ *  any atomic read-modify-write: each thread only writes its own
+ *  histograms, which are merged when read. Those of exited threads are kept.
+ */
+class Timings {
+public:
+    static void Record(size_t operation, uint64_t ticks) {
+        histogram_t* histogram = local_block ? local_block->histograms[operation].load(std::memory_order_relaxed) : nullptr;
+        if (!histogram)
+            histogram = AddHistogram(operation);
+        Increase(histogram->count, 1);
+        Increase(histogram->sum, ticks);
+        Increase(histogram->buckets[TimingSnapshot::Bucket(ticks)], 1);
+    }
+
+    // of all threads
+    static TimingSnapshot Read(size_t operation);
+
+private:
+    struct histogram_t {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> buckets[TimingSnapshot::BUCKETS] = {};
+    };
+    struct block_t {
+        std::atomic<histogram_t*> histograms[TimingOperation::MAX_OPERATIONS] = {};
+    };
+    struct registry_t;
+    friend class TimingBlockOwner;
+
+    inline static thread_local block_t* local_block = nullptr;
+    static registry_t& Registry();
+
+    // only ever written by the owning thread
+    static void Increase(std::atomic<uint64_t>& value, uint64_t n) {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static histogram_t* AddHistogram(size_t operation);
+};
+
+
+// --- ScopedTiming -----------------------------------------------------------------
+/*! Records the time until it goes out of scope
+ */
+class ScopedTiming {
+public:
+    explicit ScopedTiming(const TimingOperation& operation) : operation(operation.id), start(TimingClock::Now()) {}
+    ~ScopedTiming() {Timings::Record(operation, TimingClock::Now() - start);}
+private:
+    const size_t operation;
+    const uint64_t start;
+};
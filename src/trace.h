@@ -0,0 +1,63 @@
+/*
+    Copyright (C) 2014-2020 Matthias P. Braendli (http://opendigitalradio.org)
+
+    Copyright (C) 2015-2019 Stefan Pöschel (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file trace.h
+    \brief Static tracepoints (USDT) along the PAD pipeline
+
+    Compiled in with --enable-tracing (autotools) or -DENABLE_TRACING=ON
+    (CMake), which need <sys/sdt.h> (e.g. package systemtap-sdt-dev).
+    Otherwise the tracepoints, including their arguments, are compiled out.
+    An unattached tracepoint is a single nop.
+
+    Tracepoints of provider odr_padenc, with their arguments:
+      pad_request         PAD length, frames requested
+      pad_sent            message length, bytes sent (-1: error), errno
+      dg_enqueued         DG (address), app type, bytes, DGs queued
+      subfield_written    DG (address), app type of the CI, sub-field length, DG bytes in it
+      dg_sent             DG (address), app type, latency in frames
+      pad_flushed         frame number, X-PAD bytes used, sub-field bytes, CIs
+      slide_encode_begin  slide ID, file name
+      slide_encode_end    slide ID, success, encoded bytes
+      label_encode_begin  DLS file name
+      label_encode_end    label bytes, charset, segments queued
+
+    E.g. the time DGs of each app type are queued:
+      bpftrace -e 'usdt:./odr-padenc:odr_padenc:dg_enqueued { @start[arg0] = nsecs; }
+                   usdt:./odr-padenc:odr_padenc:dg_sent /@start[arg0]/ {
+                       @queued_us[arg1] = hist((nsecs - @start[arg0]) / 1000); delete(@start[arg0]); }'
+*/
+
+#pragma once
+
+#if defined(HAVE_CONFIG_H)
+#   include "config.h"
+#endif
+
+#if HAVE_USDT
+#   include <sys/sdt.h>
+#   define PADENC_TRACE1(name, a)            DTRACE_PROBE1(odr_padenc, name, a)
+#   define PADENC_TRACE2(name, a, b)         DTRACE_PROBE2(odr_padenc, name, a, b)
+#   define PADENC_TRACE3(name, a, b, c)      DTRACE_PROBE3(odr_padenc, name, a, b, c)
+#   define PADENC_TRACE4(name, a, b, c, d)   DTRACE_PROBE4(odr_padenc, name, a, b, c, d)
+#else
+#   define PADENC_TRACE1(name, a)            do {} while (0)
+#   define PADENC_TRACE2(name, a, b)         do {} while (0)
+#   define PADENC_TRACE3(name, a, b, c)      do {} while (0)
+#   define PADENC_TRACE4(name, a, b, c, d)   do {} while (0)
+#endif
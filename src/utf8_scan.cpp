@@ -0,0 +1,199 @@
+/*
+    Copyright (C) 2018 Matthias P. Braendli (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file utf8_scan.cpp
+    \brief Validating and counting UTF-8 text, with runs of 7-bit chars
+           scanned a vector at a time (SSE2/AVX2 or NEON, else a word at
+           a time).
+*/
+
+#include "utf8_scan.h"
+#include "utf8.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  include <immintrin.h>
+#  define UTF8_SCAN_X86 1
+#elif defined(__aarch64__)
+#  include <arm_neon.h>
+#  define UTF8_SCAN_NEON 1
+#endif
+
+
+// --- scalar -----------------------------------------------------------------
+static const uint64_t HIGH_BITS = 0x8080808080808080ULL;
+
+static size_t ascii_prefix_word(const char* text, size_t len, size_t i) {
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, text + i, sizeof(word));
+        if (word & HIGH_BITS)
+            break;
+    }
+    while (i < len && (uint8_t) text[i] < 0x80)
+        i++;
+    return i;
+}
+
+// continuation bytes are 10xxxxxx; all other bytes start a code point
+static size_t count_word(const char* text, size_t len, size_t i, size_t count) {
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, text + i, sizeof(word));
+        const uint64_t continuation = word & ~(word << 1) & HIGH_BITS;
+        count += 8 - __builtin_popcountll(continuation);
+    }
+    for (; i < len; i++)
+        if (((uint8_t) text[i] & 0xC0) != 0x80)
+            count++;
+    return count;
+}
+
+
+// --- vectors -----------------------------------------------------------------
+#if UTF8_SCAN_X86
+static size_t ascii_prefix_sse2(const char* text, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        const int high = _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) (text + i)));
+        if (high)
+            return i + __builtin_ctz(high);
+    }
+    return ascii_prefix_word(text, len, i);
+}
+
+static size_t count_sse2(const char* text, size_t len) {
+    // as signed bytes, continuation bytes are the ones below -64
+    const __m128i limit = _mm_set1_epi8(-64);
+    size_t i = 0;
+    size_t count = 0;
+    for (; i + 16 <= len; i += 16) {
+        const __m128i bytes = _mm_loadu_si128((const __m128i*) (text + i));
+        count += 16 - __builtin_popcount(_mm_movemask_epi8(_mm_cmplt_epi8(bytes, limit)));
+    }
+    return count_word(text, len, i, count);
+}
+
+__attribute__((target("avx2")))
+static size_t ascii_prefix_avx2(const char* text, size_t len) {
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        const uint32_t high = _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*) (text + i)));
+        if (high)
+            return i + __builtin_ctz(high);
+    }
+    return ascii_prefix_word(text, len, i);
+}
+
+__attribute__((target("avx2")))
+static size_t count_avx2(const char* text, size_t len) {
+    const __m256i limit = _mm256_set1_epi8(-64);
+    size_t i = 0;
+    size_t count = 0;
+    for (; i + 32 <= len; i += 32) {
+        const __m256i bytes = _mm256_loadu_si256((const __m256i*) (text + i));
+        count += 32 - __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpgt_epi8(limit, bytes)));
+    }
+    return count_word(text, len, i, count);
+}
+
+static bool avx2_supported() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#elif UTF8_SCAN_NEON
+static size_t ascii_prefix_neon(const char* text, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        if (vmaxvq_u8(vld1q_u8((const uint8_t*) (text + i))) >= 0x80)
+            break;
+    }
+    return ascii_prefix_word(text, len, i);
+}
+
+static size_t count_neon(const char* text, size_t len) {
+    const int8x16_t limit = vdupq_n_s8(-64);
+    const uint8x16_t one = vdupq_n_u8(1);
+    size_t i = 0;
+    size_t count = 0;
+    for (; i + 16 <= len; i += 16) {
+        const uint8x16_t continuation = vcltq_s8(vld1q_s8((const int8_t*) (text + i)), limit);
+        count += 16 - vaddvq_u8(vandq_u8(continuation, one));
+    }
+    return count_word(text, len, i, count);
+}
+#endif
+
+
+// --- dispatch -----------------------------------------------------------------
+struct utf8_scan_engine_t {
+    const char* name;
+    size_t (*ascii_prefix)(const char* text, size_t len);
+    size_t (*count)(const char* text, size_t len);
+};
+
+static utf8_scan_engine_t select_engine() {
+#if UTF8_SCAN_X86
+    if (avx2_supported())
+        return {"avx2", ascii_prefix_avx2, count_avx2};
+    return {"sse2", ascii_prefix_sse2, count_sse2};
+#elif UTF8_SCAN_NEON
+    return {"neon", ascii_prefix_neon, count_neon};
+#else
+    return {"scalar", [](const char* text, size_t len) {return ascii_prefix_word(text, len, 0);},
+            [](const char* text, size_t len) {return count_word(text, len, 0, 0);}};
+#endif
+}
+
+static const utf8_scan_engine_t& engine() {
+    static const utf8_scan_engine_t selected = select_engine();
+    return selected;
+}
+
+size_t utf8_ascii_prefix(const char* text, size_t len) {
+    return engine().ascii_prefix(text, len);
+}
+
+size_t utf8_valid_prefix(const char* text, size_t len) {
+    const char* const end = text + len;
+    const char* it = text;
+    for (;;) {
+        it += utf8_ascii_prefix(it, end - it);
+        if (it == end)
+            return len;
+
+        // a sequence at a time until the next 7-bit char
+        const char* sequence_start = it;
+        if (utf8::internal::validate_next(it, end) != utf8::internal::UTF8_OK)
+            return sequence_start - text;
+        while (it != end && (uint8_t) *it >= 0x80) {
+            sequence_start = it;
+            if (utf8::internal::validate_next(it, end) != utf8::internal::UTF8_OK)
+                return sequence_start - text;
+        }
+    }
+}
+
+size_t utf8_count(const char* text, size_t len) {
+    return engine().count(text, len);
+}
+
+const char* utf8_scan_engine_name() {
+    return engine().name;
+}
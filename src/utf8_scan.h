@@ -0,0 +1,41 @@
+/*
+    Copyright (C) 2018 Matthias P. Braendli (http://opendigitalradio.org)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*!
+    \file utf8_scan.h
+    \brief Validating and counting UTF-8 text, with runs of 7-bit chars
+           scanned a vector at a time (SSE2/AVX2 or NEON, else a word at
+           a time).
+
+    A text is validated once where it enters (e.g. a DLS file); the stages
+    after that may then take it as valid, decoding it without further checks.
+*/
+
+#pragma once
+
+#include <cstddef>
+
+// the length of the leading run of 7-bit chars
+size_t utf8_ascii_prefix(const char* text, size_t len);
+
+// the length of the leading valid UTF-8, i.e. up to the first error
+size_t utf8_valid_prefix(const char* text, size_t len);
+
+// the number of code points of valid UTF-8 text
+size_t utf8_count(const char* text, size_t len);
+
+// name of the implementation picked for this CPU, e.g. "avx2"
+const char* utf8_scan_engine_name();
@@ -0,0 +1,270 @@
+/*
+    Work-Stealing Primitives
+    Copyright (C) 2024 StreamDAB Project
+
+    Tasks stored in place, per-worker deques that idle workers steal from,
+    and a bounded queue for tasks submitted from outside the workers
+*/
+
+#ifndef WORK_STEALING_H_
+#define WORK_STEALING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace StreamDAB {
+
+// A move-only void() callable. Callables of up to INLINE_SIZE bytes (e.g. a
+// lambda capturing a few pointers and a std::function) are stored in place,
+// so that queuing a task needs no allocation; larger ones on the heap.
+class PoolTask {
+public:
+    static constexpr size_t INLINE_SIZE = 80;
+
+    PoolTask() = default;
+
+    template<typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, PoolTask>::value>>
+    PoolTask(F&& f) {
+        typedef std::decay_t<F> T;
+        if constexpr (sizeof(T) <= INLINE_SIZE && alignof(T) <= alignof(std::max_align_t) &&
+                      std::is_nothrow_move_constructible<T>::value) {
+            new (storage_) T(std::forward<F>(f));
+            ops_ = &InlineOps<T>::ops;
+        } else {
+            *reinterpret_cast<T**>(storage_) = new T(std::forward<F>(f));
+            ops_ = &HeapOps<T>::ops;
+        }
+    }
+
+    PoolTask(PoolTask&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    PoolTask& operator=(PoolTask&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    ~PoolTask() {
+        Reset();
+    }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+    void operator()() { ops_->invoke(storage_); }
+
+    void Reset() {
+        if (ops_) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* from, void* to);     // leaves from destroyed
+        void (*destroy)(void* storage);
+    };
+
+    template<typename T>
+    struct InlineOps {
+        static void Invoke(void* storage) { (*static_cast<T*>(storage))(); }
+        static void Move(void* from, void* to) {
+            new (to) T(std::move(*static_cast<T*>(from)));
+            static_cast<T*>(from)->~T();
+        }
+        static void Destroy(void* storage) { static_cast<T*>(storage)->~T(); }
+        static constexpr Ops ops = {Invoke, Move, Destroy};
+    };
+
+    template<typename T>
+    struct HeapOps {
+        static void Invoke(void* storage) { (**static_cast<T**>(storage))(); }
+        static void Move(void* from, void* to) { *static_cast<T**>(to) = *static_cast<T**>(from); }
+        static void Destroy(void* storage) { delete *static_cast<T**>(storage); }
+        static constexpr Ops ops = {Invoke, Move, Destroy};
+    };
+
+    void MoveFrom(PoolTask& other) {
+        if (other.ops_) {
+            other.ops_->move(other.storage_, storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[INLINE_SIZE];
+    const Ops* ops_ = nullptr;
+};
+
+// Chase-Lev deque of a fixed capacity (a power of two): its owner pushes and
+// pops at the bottom (LIFO, so that its data stays in cache) while other
+// threads steal from the top (FIFO). Only the owner thread may call Push()
+// and Pop().
+// Items are claimed through the top index before they are moved out, and a
+// slot is only reused once the item is moved out of it, so items need not
+// be trivially copyable.
+template<typename T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(size_t capacity = 256)
+        : capacity_(capacity), mask_(capacity - 1), slots_(new Slot[capacity]) {
+        for (size_t i = 0; i < capacity; i++) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // false, if full
+    bool Push(T&& item) {
+        const int64_t b = bottom_.load(std::memory_order_relaxed);
+        Slot& slot = slots_[b & mask_];
+        if (slot.sequence.load(std::memory_order_acquire) != b) {
+            return false;   // full, or a thief still moves the item of the previous round out
+        }
+        slot.item = std::move(item);
+        bottom_.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(T& item) {
+        const int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_release);
+            return false;
+        }
+
+        Slot& slot = slots_[b & mask_];
+        if (t < b) {
+            // no thief can reach this one; the slot is pushed to again at the same position
+            item = std::move(slot.item);
+            return true;
+        }
+
+        // the last item, which a thief may be taking at the same time
+        const bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        bottom_.store(b + 1, std::memory_order_release);
+        if (!won) {
+            return false;
+        }
+        item = std::move(slot.item);
+        slot.sequence.store(b + capacity_, std::memory_order_release);
+        return true;
+    }
+
+    bool Steal(T& item) {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return false;   // taken by another thief or the owner
+        }
+
+        Slot& slot = slots_[t & mask_];
+        item = std::move(slot.item);
+        slot.sequence.store(t + capacity_, std::memory_order_release);
+        return true;
+    }
+
+    // approximate, while others push or take
+    size_t Size() const {
+        const int64_t b = bottom_.load(std::memory_order_acquire);
+        const int64_t t = top_.load(std::memory_order_acquire);
+        return b > t ? b - t : 0;
+    }
+
+private:
+    struct Slot {
+        std::atomic<int64_t> sequence;      // the position the slot is free for
+        T item;
+    };
+
+    const int64_t capacity_;
+    const int64_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+    alignas(64) std::atomic<int64_t> top_{0};       // next to steal
+    alignas(64) std::atomic<int64_t> bottom_{0};    // next to push; only written by the owner
+};
+
+// Bounded ring buffer for any number of producer and consumer threads; like
+// MPSCQueue, with the consumers claiming positions as well.
+template<typename T>
+class MPMCQueue {
+public:
+    explicit MPMCQueue(size_t capacity = 1024) : capacity_(capacity), slots_(new Slot[capacity]) {
+        for (size_t i = 0; i < capacity; i++) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // false, if full; the item is only moved from on success
+    bool Push(T&& item) {
+        size_t t = tail_.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &slots_[t % capacity_];
+            const intptr_t diff = (intptr_t) slot->sequence.load(std::memory_order_acquire) - (intptr_t) t;
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(t, t + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                t = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        slot->item = std::move(item);
+        slot->sequence.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(T& item) {
+        size_t h = head_.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &slots_[h % capacity_];
+            const intptr_t diff = (intptr_t) slot->sequence.load(std::memory_order_acquire) - (intptr_t) (h + 1);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(h, h + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;   // empty, or the producer of the position is still writing
+            } else {
+                h = head_.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(slot->item);
+        slot->sequence.store(h + capacity_, std::memory_order_release);
+        return true;
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    const size_t capacity_;
+    std::unique_ptr<Slot[]> slots_;
+    alignas(64) std::atomic<size_t> tail_{0};
+    alignas(64) std::atomic<size_t> head_{0};
+};
+
+} // namespace StreamDAB
+
+#endif // WORK_STEALING_H_
@@ -0,0 +1,372 @@
+/*
+    Google Benchmark Suite - Baselines
+    Copyright (C) 2024 StreamDAB Project
+
+    The main function of the benchmarks. Besides the usual benchmark flags,
+    it records the results as a baseline and compares them against one:
+
+    --save_baseline=FILE         the samples of each benchmark, with their
+                                 median and MAD, as JSON
+    --baseline=FILE              the median delta of each benchmark against
+                                 the baseline; exits with 1 if a benchmark
+                                 got significantly slower
+    --regression_threshold=PCT   smaller deltas count as unchanged (default 5)
+    --significance=ALPHA         of the Mann-Whitney U test (default 0.05)
+
+    With either, each benchmark is repeated 9 times, unless the repetitions
+    are given, and all repetitions are shown (the aggregates-only flags are
+    ignored, as they would hide them). The real time per iteration is compared; baselines only
+    compare well from the same machine and build type.
+*/
+
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+static const int DEFAULT_REPETITIONS = 9;
+
+struct machine_t {
+    std::string host;
+    int num_cpus = 0;
+    double mhz_per_cpu = 0;
+    std::string build;
+};
+
+struct benchmark_samples_t {
+    std::string name;
+    std::vector<double> samples;    // ns
+};
+
+
+// --- statistics -----------------------------------------------------------------
+static double Median(std::vector<double> values) {
+    if (values.empty())
+        return 0;
+    std::sort(values.begin(), values.end());
+    const size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+}
+
+// median absolute deviation
+static double MAD(const std::vector<double>& values) {
+    const double median = Median(values);
+    std::vector<double> deviations;
+    for (double value : values)
+        deviations.push_back(fabs(value - median));
+    return Median(deviations);
+}
+
+// two-sided p-value of the Mann-Whitney U test, by the normal approximation with tie correction
+static double MannWhitneyP(const std::vector<double>& a, const std::vector<double>& b) {
+    const double n1 = a.size();
+    const double n2 = b.size();
+    if (n1 == 0 || n2 == 0)
+        return 1;
+
+    std::vector<std::pair<double, bool>> all;   // value, from a
+    for (double value : a)
+        all.emplace_back(value, true);
+    for (double value : b)
+        all.emplace_back(value, false);
+    std::sort(all.begin(), all.end());
+
+    double rank_sum_a = 0;
+    double tie_sum = 0;
+    for (size_t i = 0; i < all.size();) {
+        size_t j = i;
+        while (j < all.size() && all[j].first == all[i].first)
+            j++;
+        const double rank = (i + 1 + j) / 2.0;  // average of the ranks i + 1 ... j
+        for (size_t k = i; k < j; k++)
+            if (all[k].second)
+                rank_sum_a += rank;
+        const double t = j - i;
+        tie_sum += t * t * t - t;
+        i = j;
+    }
+
+    const double n = n1 + n2;
+    const double u = rank_sum_a - n1 * (n1 + 1) / 2;
+    const double mean = n1 * n2 / 2;
+    const double sigma = sqrt(n1 * n2 / 12 * ((n + 1) - tie_sum / (n * (n - 1))));
+    if (sigma == 0)
+        return 1;
+    const double z = std::max(fabs(u - mean) - 0.5, 0.0) / sigma;   // with continuity correction
+    return erfc(z / sqrt(2));
+}
+
+
+// --- baseline files -----------------------------------------------------------------
+// one benchmark per line, so that the file can be read without a JSON parser
+static bool WriteBaseline(const std::string& path, const machine_t& machine, const std::vector<benchmark_samples_t>& results) {
+    std::ofstream file(path, std::ios::trunc);
+    if (!file)
+        return false;
+
+    file.precision(6);
+    file << "{\"context\":{\"host\":\"" << machine.host << "\",\"num_cpus\":" << machine.num_cpus
+         << ",\"mhz_per_cpu\":" << machine.mhz_per_cpu << ",\"build\":\"" << machine.build << "\"},\n";
+    file << "\"benchmarks\":[\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const benchmark_samples_t& result = results[i];
+        file << "{\"name\":\"" << result.name << "\",\"median_ns\":" << Median(result.samples)
+             << ",\"mad_ns\":" << MAD(result.samples) << ",\"samples_ns\":[";
+        for (size_t j = 0; j < result.samples.size(); j++)
+            file << (j ? "," : "") << result.samples[j];
+        file << "]}" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    file << "]}\n";
+    return (bool) file;
+}
+
+static std::string StringValue(const std::string& line, const char* key) {
+    const std::string prefix = std::string("\"") + key + "\":\"";
+    size_t start = line.find(prefix);
+    if (start == std::string::npos)
+        return "";
+    start += prefix.size();
+    return line.substr(start, line.find('"', start) - start);
+}
+
+static double NumberValue(const std::string& line, const char* key) {
+    const std::string prefix = std::string("\"") + key + "\":";
+    const size_t start = line.find(prefix);
+    return start == std::string::npos ? 0 : strtod(line.c_str() + start + prefix.size(), nullptr);
+}
+
+static bool ReadBaseline(const std::string& path, machine_t& machine, std::vector<benchmark_samples_t>& results) {
+    std::ifstream file(path);
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.find("\"context\":") != std::string::npos) {
+            machine.host = StringValue(line, "host");
+            machine.num_cpus = NumberValue(line, "num_cpus");
+            machine.mhz_per_cpu = NumberValue(line, "mhz_per_cpu");
+            machine.build = StringValue(line, "build");
+            continue;
+        }
+
+        benchmark_samples_t result;
+        result.name = StringValue(line, "name");
+        const size_t samples = line.find("\"samples_ns\":[");
+        if (result.name.empty() || samples == std::string::npos)
+            continue;
+        const char* c = line.c_str() + samples + strlen("\"samples_ns\":[");
+        while (*c && *c != ']') {
+            char* end;
+            result.samples.push_back(strtod(c, &end));
+            if (end == c)
+                break;
+            c = *end == ',' ? end + 1 : end;
+        }
+        results.push_back(result);
+    }
+    return true;
+}
+
+
+// --- BaselineReporter -----------------------------------------------------------------
+// shows the runs as usual, and collects the time of each repetition
+class BaselineReporter : public benchmark::BenchmarkReporter {
+public:
+    machine_t machine;
+    std::vector<benchmark_samples_t> results;
+
+    BaselineReporter() : display(benchmark::CreateDefaultDisplayReporter()) {}
+
+    bool ReportContext(const Context& context) override {
+        char host[256] = "";
+        gethostname(host, sizeof(host) - 1);
+        machine.host = host;
+        machine.num_cpus = context.cpu_info.num_cpus;
+        machine.mhz_per_cpu = round(context.cpu_info.cycles_per_second / 1e6);
+#ifdef NDEBUG
+        machine.build = "release";
+#else
+        machine.build = "debug";
+#endif
+        return display->ReportContext(context);
+    }
+
+    void ReportRuns(const std::vector<Run>& reports) override {
+        for (const Run& run : reports) {
+            if (run.run_type != Run::RT_Iteration || Failed(run, 0))
+                continue;
+            // repetitions may be interleaved with other benchmarks
+            const std::string name = run.benchmark_name();
+            auto it = indices.find(name);
+            if (it == indices.end()) {
+                it = indices.emplace(name, results.size()).first;
+                results.push_back({name, {}});
+            }
+            results[it->second].samples.push_back(run.GetAdjustedRealTime() * 1e9 / benchmark::GetTimeUnitMultiplier(run.time_unit));
+        }
+        display->ReportRuns(reports);
+    }
+
+    void Finalize() override {
+        display->Finalize();
+    }
+
+private:
+    std::unique_ptr<benchmark::BenchmarkReporter> display;
+    std::map<std::string, size_t> indices;  // of the results, by name
+
+    // error_occurred became skipped in later versions of the library
+    template<typename R>
+    static auto Failed(const R& run, int) -> decltype((bool) run.error_occurred) {return run.error_occurred;}
+    template<typename R>
+    static bool Failed(const R& run, long) {return run.skipped;}
+};
+
+
+// --- comparison -----------------------------------------------------------------
+static std::string FormatTime(double ns) {
+    char buffer[32];
+    if (ns >= 1e9)
+        snprintf(buffer, sizeof(buffer), "%.3f s", ns / 1e9);
+    else if (ns >= 1e6)
+        snprintf(buffer, sizeof(buffer), "%.3f ms", ns / 1e6);
+    else if (ns >= 1e3)
+        snprintf(buffer, sizeof(buffer), "%.3f us", ns / 1e3);
+    else
+        snprintf(buffer, sizeof(buffer), "%.2f ns", ns);
+    return buffer;
+}
+
+// returns the number of significant regressions
+static int Compare(const std::string& path, const machine_t& baseline_machine, const std::vector<benchmark_samples_t>& baseline,
+                   const machine_t& machine, const std::vector<benchmark_samples_t>& results, double threshold, double alpha) {
+    std::map<std::string, const benchmark_samples_t*> baseline_by_name;
+    for (const benchmark_samples_t& result : baseline)
+        baseline_by_name[result.name] = &result;
+
+    printf("\nComparison against the baseline %s (threshold %.1f%%, significance %.3g):\n", path.c_str(), threshold, alpha);
+    if (baseline_machine.host != machine.host || baseline_machine.num_cpus != machine.num_cpus ||
+            baseline_machine.mhz_per_cpu != machine.mhz_per_cpu || baseline_machine.build != machine.build)
+        printf("Note: the baseline is from %s (%d x %.0f MHz, %s build), this run from %s (%d x %.0f MHz, %s build)\n",
+               baseline_machine.host.c_str(), baseline_machine.num_cpus, baseline_machine.mhz_per_cpu, baseline_machine.build.c_str(),
+               machine.host.c_str(), machine.num_cpus, machine.mhz_per_cpu, machine.build.c_str());
+
+    size_t name_width = 9;
+    for (const benchmark_samples_t& result : results)
+        name_width = std::max(name_width, result.name.size());
+    printf("%-*s %12s %12s %8s %7s %7s %7s\n", (int) name_width, "Benchmark", "Baseline", "Current", "Delta", "MAD", "p", "");
+
+    int slower = 0, faster = 0, unchanged = 0, added = 0;
+    for (const benchmark_samples_t& result : results) {
+        const double median = Median(result.samples);
+        const double mad = median > 0 ? 100 * MAD(result.samples) / median : 0;
+        auto it = baseline_by_name.find(result.name);
+        if (it == baseline_by_name.end()) {
+            printf("%-*s %12s %12s %8s %6.1f%% %7s %7s\n", (int) name_width, result.name.c_str(),
+                   "-", FormatTime(median).c_str(), "-", mad, "-", "new");
+            added++;
+            continue;
+        }
+
+        const benchmark_samples_t& before = *it->second;
+        baseline_by_name.erase(it);
+        const double baseline_median = Median(before.samples);
+        const double delta = baseline_median > 0 ? 100 * (median - baseline_median) / baseline_median : 0;
+        const double p = MannWhitneyP(before.samples, result.samples);
+
+        const char* verdict = "";
+        if (p < alpha && delta > threshold) {
+            verdict = "SLOWER";
+            slower++;
+        } else if (p < alpha && delta < -threshold) {
+            verdict = "faster";
+            faster++;
+        } else {
+            unchanged++;
+        }
+        printf("%-*s %12s %12s %+7.1f%% %6.1f%% %7.3f %7s\n", (int) name_width, result.name.c_str(),
+               FormatTime(baseline_median).c_str(), FormatTime(median).c_str(), delta, mad, p, verdict);
+    }
+    for (const benchmark_samples_t& result : baseline) {
+        if (baseline_by_name.count(result.name))
+            printf("%-*s %12s %12s %8s %7s %7s %7s\n", (int) name_width, result.name.c_str(),
+                   FormatTime(Median(result.samples)).c_str(), "-", "-", "-", "-", "missing");
+    }
+
+    printf("%d slower, %d faster, %d unchanged, %d new, %zu missing\n", slower, faster, unchanged, added, baseline_by_name.size());
+    return slower;
+}
+
+
+int main(int argc, char** argv) {
+    std::string save_baseline;
+    std::string baseline;
+    double threshold = 5;
+    double alpha = 0.05;
+    bool repetitions_given = false;
+    std::vector<char*> aggregates_only;
+
+    // own flags out, the others for the library
+    std::vector<char*> args;
+    for (int i = 0; i < argc; i++) {
+        if (!strncmp(argv[i], "--save_baseline=", 16))
+            save_baseline = argv[i] + 16;
+        else if (!strncmp(argv[i], "--baseline=", 11))
+            baseline = argv[i] + 11;
+        else if (!strncmp(argv[i], "--regression_threshold=", 23))
+            threshold = atof(argv[i] + 23);
+        else if (!strncmp(argv[i], "--significance=", 15))
+            alpha = atof(argv[i] + 15);
+        else if (!strncmp(argv[i], "--benchmark_report_aggregates_only", 34) || !strncmp(argv[i], "--benchmark_display_aggregates_only", 35))
+            aggregates_only.push_back(argv[i]);
+        else {
+            if (!strncmp(argv[i], "--benchmark_repetitions=", 24))
+                repetitions_given = true;
+            args.push_back(argv[i]);
+        }
+    }
+    if (save_baseline.empty() && baseline.empty())
+        args.insert(args.end(), aggregates_only.begin(), aggregates_only.end());
+    std::string repetitions = "--benchmark_repetitions=" + std::to_string(DEFAULT_REPETITIONS);
+    if ((!save_baseline.empty() || !baseline.empty()) && !repetitions_given)
+        args.push_back(&repetitions[0]);
+    int args_count = args.size();
+    args.push_back(nullptr);
+
+    benchmark::Initialize(&args_count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(args_count, args.data()))
+        return 1;
+
+    machine_t baseline_machine;
+    std::vector<benchmark_samples_t> baseline_results;
+    if (!baseline.empty() && !ReadBaseline(baseline, baseline_machine, baseline_results)) {
+        fprintf(stderr, "Error: the baseline '%s' cannot be read\n", baseline.c_str());
+        return 1;
+    }
+
+    BaselineReporter reporter;
+    benchmark::RunSpecifiedBenchmarks(&reporter);
+    benchmark::Shutdown();
+
+    if (!save_baseline.empty()) {
+        if (!WriteBaseline(save_baseline, reporter.machine, reporter.results)) {
+            fprintf(stderr, "Error: the baseline '%s' cannot be written\n", save_baseline.c_str());
+            return 1;
+        }
+        printf("Baseline of %zu benchmarks written to %s\n", reporter.results.size(), save_baseline.c_str());
+    }
+
+    if (!baseline.empty() && Compare(baseline, baseline_machine, baseline_results, reporter.machine, reporter.results, threshold, alpha))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*
+    Google Benchmark Suite - PAD Core
+    Copyright (C) 2024 StreamDAB Project
+
+    Micro-benchmarks of the PAD core hot path, reporting bytes/s and the
+    time per frame/call:
+    - PAD packetizer frame output, at every allowed PAD length
+    - Data group writes into sub-fields
+    - CRC-16 calculation
+    - Charset conversion
+    - DLS label building (new and repeated labels)
+    - MOT slide segmentation (uncached and cached)
+*/
+
+#include <benchmark/benchmark.h>
+#include "../src/pad_common.h"
+#include "../src/crc.h"
+#include "../src/charset.h"
+#include "../src/dls.h"
+#include "../src/sls.h"
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+// queues a data group with ascending payload bytes (incl. CRC)
+static void AddTestDG(PADPacketizer& packetizer, size_t len) {
+    DATA_GROUP* dg = packetizer.CreateDataGroup(len, 12, 13);
+    for (size_t i = 0; i < len; i++)
+        dg->data[i] = i & 0xFF;
+    dg->AppendCRC();
+    packetizer.AddDG(packetizer.CreateDataGroupLengthIndicator(dg->Size()), false);
+    packetizer.AddDG(dg, false);
+}
+
+// Frames of an always filled packetizer; the time is per frame
+static void BM_GetNextPAD(benchmark::State& state) {
+    PADPacketizer packetizer(state.range(0));
+    for (auto _ : state) {
+        if (!packetizer.QueueFilled())
+            AddTestDG(packetizer, 8192);
+        std::vector<uint8_t> pad = packetizer.GetNextPAD(true);
+        benchmark::DoNotOptimize(pad.data());
+    }
+    state.SetBytesProcessed(state.iterations() * packetizer.GetPADFrameSize());
+    state.counters["frames"] = benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_GetNextPAD)->Arg(6)->DenseRange(8, 196)->MinTime(0.05);
+
+// Writing a data group in sub-fields of the given size
+static void BM_DataGroupWrite(benchmark::State& state) {
+    const size_t len = state.range(0);
+    DATA_GROUP dg(8192, 12, 13);
+    std::vector<uint8_t> subfield(len);
+    int cont_apptype;
+    for (auto _ : state) {
+        if (dg.Available() == 0)
+            dg.written = 0;
+        benchmark::DoNotOptimize(dg.Write(subfield.data(), len, &cont_apptype));
+    }
+    state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_DataGroupWrite)->Arg(4)->Arg(16)->Arg(48);
+
+static void BM_CRC16(benchmark::State& state) {
+    std::vector<uint8_t> data(state.range(0));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = i * 7;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(odr::crc16(0xFFFF, data.data(), data.size()));
+    state.SetBytesProcessed(state.iterations() * data.size());
+    state.SetLabel(odr::crc16_engine_name());
+}
+BENCHMARK(BM_CRC16)->RangeMultiplier(4)->Range(16, 16384);
+
+// UTF-8 input bytes converted to EBU Latin
+static void BM_CharsetConvert(benchmark::State& state) {
+    static const char* texts[] = {
+        "Now playing: The Artist - A Title (Radio Edit) on Example Radio ",
+        "Grüße aus Köln: Ärger über Öffnungszeiten, Straßenfest am Wochenende ",
+        "สวัสดีครับ ยินดีต้อนรับสู่รายการวิทยุ ",
+    };
+    std::string text;
+    while (text.size() < 128)
+        text += texts[state.range(0)];
+    CharsetConverter converter;
+    std::string encoded;
+    for (auto _ : state) {
+        converter.convert(text.data(), text.size(), encoded);
+        benchmark::DoNotOptimize(encoded.data());
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_CharsetConvert)->ArgName("text")->DenseRange(0, 2);     // ASCII, Latin, Thai
+
+// A label from a text up to its queued segments; repeated labels reuse their templates
+static void BM_DLSLabel(benchmark::State& state) {
+    const bool repeated = state.range(0);
+    PADPacketizer packetizer(58);
+    DLSEncoder dls_encoder(&packetizer);
+    const std::string text = "Now playing: Grüße - A Title\nExample Radio, the best music ";
+    int count = 0;
+    for (auto _ : state) {
+        dls_encoder.encodeText(text + std::to_string(repeated ? count++ % 2 : count++), DL_PARAMS(), false);
+        packetizer.DropDGs(DLSEncoder::APPTYPE_START);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_DLSLabel)->ArgName("repeated")->Arg(0)->Arg(1);
+
+// A (raw) slide into MOT header and body segments; cached slides skip the file processing
+static void BM_SLSSegmentation(benchmark::State& state) {
+    const size_t slide_size = 50000;
+    const std::string path = "/tmp/padenc_benchmark_slide.jpg";
+    {
+        std::ofstream slide(path, std::ios::binary | std::ios::trunc);
+        for (size_t i = 0; i < slide_size; i++)
+            slide.put((char) (i * 7));
+    }
+
+    PADPacketizer packetizer(58);
+    SLSEncoder sls_encoder(&packetizer, state.range(0) ? SlideCache::DEFAULT_MAX_SIZE : 0);
+    for (auto _ : state) {
+        if (!sls_encoder.encodeSlide(path, 7, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, "")) {
+            state.SkipWithError("slide not encoded");
+            break;
+        }
+        packetizer.DropDGs(SLSEncoder::APPTYPE_MOT_START);
+    }
+    state.SetBytesProcessed(state.iterations() * slide_size);
+    remove(path.c_str());
+}
+BENCHMARK(BM_SLSSegmentation)->ArgName("cached")->Arg(0)->Arg(1);
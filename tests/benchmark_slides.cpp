@@ -0,0 +1,413 @@
+/*
+    Google Benchmark Suite - Slide Processing
+    Copyright (C) 2024 StreamDAB Project
+
+    The image pipeline on a corpus of representative slides, so that a change
+    is judged on both its speed and the bytes it puts on air:
+    - the stages of the native pipeline (SlideCodec): decode (JPEG already
+      scaled down in the DCT domain), resize and JPEG encoding
+    - the whole slide processing of SLSEncoder, as encodeSlide() does it
+    - ImageOptimizer::OptimizeForDAB (only with ImageMagick)
+    Besides the time, the processing benchmarks report the output bytes, their
+    share of the max slide size (max_share) and the SSIM of the output's luma
+    against the source image scaled to the same size (ssim, 1 if identical).
+
+    The corpus is generated once: a photo (baseline JPEG), graphics (PNG), an
+    oversized photo (PNG) and a progressive JPEG. The files of the directory
+    given by PADENC_SLIDE_CORPUS are added to it, e.g. slides from the air.
+*/
+
+#include <benchmark/benchmark.h>
+#include "../src/pad_common.h"
+#include "../src/sls.h"
+#include "../src/slide_codec.h"
+#ifdef HAVE_IMAGEMAGICK
+#  include "../src/enhanced_mot.h"
+#endif
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#if HAVE_LIBJPEG
+#  include <jpeglib.h>
+#endif
+
+struct corpus_slide_t {
+    std::string name;
+    std::string path;
+};
+
+static const char* const CORPUS_DIR = "/tmp/padenc_slide_corpus";
+static const int NATIVE_JPEG_QUALITY = 90;
+
+
+// --- corpus -----------------------------------------------------------------
+// smooth gradients and shapes with some grain, like a photo
+static rgb_image_t PhotoImage(size_t width, size_t height) {
+    rgb_image_t image;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize(width * height * 3);
+    std::mt19937 rng(7);
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            const double u = (double) x / width;
+            const double v = (double) y / height;
+            const double shade = 0.5 + 0.25 * sin(9 * u + 4 * v) * cos(5 * v - 3 * u);
+            const int grain = (int) (rng() % 17) - 8;
+            uint8_t* pixel = &image.pixels[(y * width + x) * 3];
+            pixel[0] = std::min(255, std::max(0, (int) (255 * shade * (0.6 + 0.4 * u)) + grain));
+            pixel[1] = std::min(255, std::max(0, (int) (255 * shade * (0.8 - 0.3 * v)) + grain));
+            pixel[2] = std::min(255, std::max(0, (int) (255 * (1 - shade) * (0.5 + 0.5 * v)) + grain));
+        }
+    }
+    return image;
+}
+
+// flat areas and thin lines in a few colours, like a logo or a text slide
+static rgb_image_t GraphicsImage(size_t width, size_t height) {
+    static const uint8_t colours[][3] = {{255, 255, 255}, {20, 40, 120}, {230, 60, 30}, {250, 200, 0}, {0, 0, 0}};
+    rgb_image_t image;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize(width * height * 3);
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            size_t colour = 0;
+            if (y < height / 5)
+                colour = 1;                                     // banner
+            else if (x > width / 10 && x < width * 9 / 10 && (y / 6) % 4 == 1 && (x / 5) % 7 != 0)
+                colour = 4;                                     // lines of "text"
+            else if ((x - width * 3 / 4) * (x - width * 3 / 4) + (y - height * 3 / 4) * (y - height * 3 / 4) < height * height / 36)
+                colour = 2 + (x < width * 3 / 4);               // badge
+            std::copy(colours[colour], colours[colour] + 3, &image.pixels[(y * width + x) * 3]);
+        }
+    }
+    return image;
+}
+
+#if HAVE_LIBJPEG
+static bool EncodeProgressiveJPEG(const rgb_image_t& image, int quality, std::vector<uint8_t>& out) {
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+
+    unsigned char* buffer = nullptr;
+    unsigned long len = 0;
+    jpeg_mem_dest(&cinfo, &buffer, &len);
+    cinfo.image_width = image.width;
+    cinfo.image_height = image.height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_simple_progression(&cinfo);
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = (JSAMPROW) &image.pixels[cinfo.next_scanline * image.width * 3];
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    out.assign(buffer, buffer + len);
+    free(buffer);
+    return true;
+}
+#endif
+
+static bool WriteFile(const std::string& path, const std::vector<uint8_t>& data) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write((const char*) data.data(), data.size());
+    return (bool) file;
+}
+
+static bool ReadFile(const std::string& path, std::vector<uint8_t>& data) {
+    std::ifstream file(path, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return (bool) file || file.eof();
+}
+
+// the files of PADENC_SLIDE_CORPUS, if given
+static std::vector<corpus_slide_t> ExtraSlides() {
+    std::vector<corpus_slide_t> slides;
+    const char* dir_name = getenv("PADENC_SLIDE_CORPUS");
+    DIR* dir = dir_name ? opendir(dir_name) : nullptr;
+    if (!dir)
+        return slides;
+    while (dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] != '.')
+            slides.push_back({entry->d_name, std::string(dir_name) + "/" + entry->d_name});
+    }
+    closedir(dir);
+    std::sort(slides.begin(), slides.end(), [](const corpus_slide_t& a, const corpus_slide_t& b) {return a.name < b.name;});
+    return slides;
+}
+
+// generated on first use; an empty path if a slide could not be generated
+static const std::vector<corpus_slide_t>& Corpus() {
+    static const std::vector<corpus_slide_t> corpus = []() {
+        mkdir(CORPUS_DIR, 0755);
+        const std::string dir(CORPUS_DIR);
+        std::vector<corpus_slide_t> slides;
+        std::vector<uint8_t> data;
+
+        slides.push_back({"photo", dir + "/photo.jpg"});
+        if (!(SlideCodec::EncodeJPEG(PhotoImage(1280, 960), 92, data) && WriteFile(slides.back().path, data)))
+            slides.back().path.clear();
+
+        slides.push_back({"graphics", dir + "/graphics.png"});
+        if (!(SlideCodec::EncodePNG(GraphicsImage(800, 600), data) && WriteFile(slides.back().path, data)))
+            slides.back().path.clear();
+
+        slides.push_back({"oversized", dir + "/oversized.png"});
+        if (!(SlideCodec::EncodePNG(PhotoImage(3000, 2000), data) && WriteFile(slides.back().path, data)))
+            slides.back().path.clear();
+
+        slides.push_back({"progressive", dir + "/progressive.jpg"});
+#if HAVE_LIBJPEG
+        if (!(EncodeProgressiveJPEG(PhotoImage(1920, 1080), 90, data) && WriteFile(slides.back().path, data)))
+#endif
+            slides.back().path.clear();
+
+        for (const corpus_slide_t& slide : ExtraSlides())
+            slides.push_back(slide);
+        return slides;
+    }();
+    return corpus;
+}
+
+// one benchmark per corpus slide; counted without generating the corpus
+static void CorpusArgs(benchmark::internal::Benchmark* b) {
+    const size_t slides = 4 + ExtraSlides().size();
+    for (size_t i = 0; i < slides; i++)
+        b->Arg(i);
+    b->ArgName("slide")->Unit(benchmark::kMillisecond);
+}
+
+// the slide of the benchmark, its bytes and format; false (skipping the benchmark) if not available
+static bool LoadSlide(benchmark::State& state, const corpus_slide_t*& slide, std::vector<uint8_t>& data, SlideCodec::Format& format) {
+    slide = &Corpus()[state.range(0)];
+    state.SetLabel(slide->name);
+    if (slide->path.empty() || !ReadFile(slide->path, data)) {
+        state.SkipWithError("slide not available");
+        return false;
+    }
+    format = SlideCodec::DetectFormat(data.data(), data.size());
+    return true;
+}
+
+
+// --- quality -----------------------------------------------------------------
+static std::vector<double> Luma(const rgb_image_t& image) {
+    std::vector<double> luma(image.width * image.height);
+    for (size_t i = 0; i < luma.size(); i++) {
+        const uint8_t* pixel = &image.pixels[i * 3];
+        luma[i] = 0.299 * pixel[0] + 0.587 * pixel[1] + 0.114 * pixel[2];
+    }
+    return luma;
+}
+
+// mean SSIM of the luma over 8x8 windows; the images must have the same size
+static double SSIM(const rgb_image_t& a, const rgb_image_t& b) {
+    const double C1 = (0.01 * 255) * (0.01 * 255);
+    const double C2 = (0.03 * 255) * (0.03 * 255);
+    const size_t WINDOW = 8;
+    const std::vector<double> luma_a = Luma(a);
+    const std::vector<double> luma_b = Luma(b);
+
+    double sum = 0;
+    size_t windows = 0;
+    for (size_t y0 = 0; y0 + WINDOW <= a.height; y0 += WINDOW) {
+        for (size_t x0 = 0; x0 + WINDOW <= a.width; x0 += WINDOW) {
+            double mean_a = 0, mean_b = 0;
+            for (size_t y = y0; y < y0 + WINDOW; y++) {
+                for (size_t x = x0; x < x0 + WINDOW; x++) {
+                    mean_a += luma_a[y * a.width + x];
+                    mean_b += luma_b[y * a.width + x];
+                }
+            }
+            const double n = WINDOW * WINDOW;
+            mean_a /= n;
+            mean_b /= n;
+
+            double var_a = 0, var_b = 0, covar = 0;
+            for (size_t y = y0; y < y0 + WINDOW; y++) {
+                for (size_t x = x0; x < x0 + WINDOW; x++) {
+                    const double da = luma_a[y * a.width + x] - mean_a;
+                    const double db = luma_b[y * a.width + x] - mean_b;
+                    var_a += da * da;
+                    var_b += db * db;
+                    covar += da * db;
+                }
+            }
+            var_a /= n - 1;
+            var_b /= n - 1;
+            covar /= n - 1;
+
+            sum += ((2 * mean_a * mean_b + C1) * (2 * covar + C2)) /
+                   ((mean_a * mean_a + mean_b * mean_b + C1) * (var_a + var_b + C2));
+            windows++;
+        }
+    }
+    return windows ? sum / windows : 1;
+}
+
+// of the output against the source scaled to its size; 0 if either cannot be decoded
+static double OutputSSIM(const std::vector<uint8_t>& source, const uint8_t* output, size_t output_len) {
+    const SlideCodec::Format output_format = SlideCodec::DetectFormat(output, output_len);
+    const SlideCodec::Format source_format = SlideCodec::DetectFormat(source.data(), source.size());
+    rgb_image_t out_image, source_image, reference;
+    if (!SlideCodec::Supported(output_format) || !SlideCodec::Supported(source_format) ||
+            !SlideCodec::Decode(output_format, output, output_len, 0, 0, out_image) ||
+            !SlideCodec::Decode(source_format, source.data(), source.size(), out_image.width, out_image.height, source_image))
+        return 0;
+    SlideCodec::Downscale(source_image, out_image.width, out_image.height, reference);
+    return SSIM(out_image, reference);
+}
+
+static void ReportOutput(benchmark::State& state, const std::vector<uint8_t>& source, const uint8_t* output, size_t output_len, size_t max_slide_size) {
+    state.counters["bytes"] = output_len;
+    state.counters["max_share"] = (double) output_len / max_slide_size;
+    state.counters["ssim"] = OutputSSIM(source, output, output_len);
+}
+
+
+// --- native stages -----------------------------------------------------------------
+static void BM_SlideDecode(benchmark::State& state) {
+    const corpus_slide_t* slide;
+    std::vector<uint8_t> data;
+    SlideCodec::Format format;
+    if (!LoadSlide(state, slide, data, format))
+        return;
+    image_probe_t probe;
+    if (!SlideCodec::Supported(format) || !SlideCodec::Probe(data.data(), data.size(), probe)) {
+        state.SkipWithError("format not supported natively");
+        return;
+    }
+    size_t width = probe.width, height = probe.height;
+    SlideCodec::FitSize(width, height);
+
+    rgb_image_t image;
+    for (auto _ : state) {
+        if (!SlideCodec::Decode(format, data.data(), data.size(), width, height, image)) {
+            state.SkipWithError("not decoded");
+            break;
+        }
+        benchmark::DoNotOptimize(image.pixels.data());
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_SlideDecode)->Apply(CorpusArgs);
+
+static void BM_SlideResize(benchmark::State& state) {
+    const corpus_slide_t* slide;
+    std::vector<uint8_t> data;
+    SlideCodec::Format format;
+    if (!LoadSlide(state, slide, data, format))
+        return;
+    image_probe_t probe;
+    rgb_image_t image;
+    if (!SlideCodec::Supported(format) || !SlideCodec::Probe(data.data(), data.size(), probe)) {
+        state.SkipWithError("format not supported natively");
+        return;
+    }
+    size_t width = probe.width, height = probe.height;
+    SlideCodec::FitSize(width, height);
+    if (!SlideCodec::Decode(format, data.data(), data.size(), width, height, image)) {
+        state.SkipWithError("not decoded");
+        return;
+    }
+
+    rgb_image_t resized;
+    for (auto _ : state) {
+        SlideCodec::Downscale(image, width, height, resized);
+        benchmark::DoNotOptimize(resized.pixels.data());
+    }
+    state.SetBytesProcessed(state.iterations() * image.pixels.size());
+}
+BENCHMARK(BM_SlideResize)->Apply(CorpusArgs);
+
+static void BM_SlideEncode(benchmark::State& state) {
+    const corpus_slide_t* slide;
+    std::vector<uint8_t> data;
+    SlideCodec::Format format;
+    if (!LoadSlide(state, slide, data, format))
+        return;
+    image_probe_t probe;
+    rgb_image_t image, resized;
+    if (!SlideCodec::Supported(format) || !SlideCodec::Probe(data.data(), data.size(), probe)) {
+        state.SkipWithError("format not supported natively");
+        return;
+    }
+    size_t width = probe.width, height = probe.height;
+    SlideCodec::FitSize(width, height);
+    if (!SlideCodec::Decode(format, data.data(), data.size(), width, height, image)) {
+        state.SkipWithError("not decoded");
+        return;
+    }
+    SlideCodec::Downscale(image, width, height, resized);
+
+    std::vector<uint8_t> out;
+    for (auto _ : state) {
+        if (!SlideCodec::EncodeJPEG(resized, NATIVE_JPEG_QUALITY, out)) {
+            state.SkipWithError("not encoded");
+            break;
+        }
+        benchmark::DoNotOptimize(out.data());
+    }
+    ReportOutput(state, data, out.data(), out.size(), SLSEncoder::MAXSLIDESIZE_SIMPLE);
+}
+BENCHMARK(BM_SlideEncode)->Apply(CorpusArgs);
+
+
+// --- whole pipelines -----------------------------------------------------------------
+// the slide processing of encodeSlide(), with a new encoder each time (so no remembered quality)
+static void BM_SlidePrepare(benchmark::State& state) {
+    const corpus_slide_t* slide;
+    std::vector<uint8_t> data;
+    SlideCodec::Format format;
+    if (!LoadSlide(state, slide, data, format))
+        return;
+
+    PADPacketizer packetizer(58);
+    prepared_slide_t prepared;
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::unique_ptr<SLSEncoder> sls_encoder(new SLSEncoder(&packetizer, 0));
+        state.ResumeTiming();
+        if (!sls_encoder->prepareSlide(slide->path, 0, false, SLSEncoder::MAXSLIDESIZE_SIMPLE, prepared)) {
+            state.SkipWithError("slide not prepared");
+            return;
+        }
+    }
+    ReportOutput(state, data, prepared.blob->Data(), prepared.blob->Size(), SLSEncoder::MAXSLIDESIZE_SIMPLE);
+}
+BENCHMARK(BM_SlidePrepare)->Apply(CorpusArgs);
+
+#ifdef HAVE_IMAGEMAGICK
+static void BM_OptimizeForDAB(benchmark::State& state) {
+    const corpus_slide_t* slide;
+    std::vector<uint8_t> data;
+    SlideCodec::Format format;
+    if (!LoadSlide(state, slide, data, format))
+        return;
+
+    std::vector<uint8_t> out;
+    for (auto _ : state) {
+        if (!StreamDAB::ImageOptimizer::OptimizeForDAB(slide->path, out, SLSEncoder::MAXSLIDESIZE_SIMPLE)) {
+            state.SkipWithError("slide not optimised");
+            return;
+        }
+    }
+    ReportOutput(state, data, out.data(), out.size(), SLSEncoder::MAXSLIDESIZE_SIMPLE);
+}
+BENCHMARK(BM_OptimizeForDAB)->Apply(CorpusArgs);
+#endif
@@ -0,0 +1,148 @@
+/*
+    Google Benchmark Suite - StreamDAB modules
+    Copyright (C) 2024 StreamDAB Project
+
+    Micro-benchmarks of the StreamDAB text modules, replacing the fixed
+    ops/s targets of the performance tests:
+    - Thai UTF-8 to DAB conversion, text layout and content validation
+    - Thai word segmentation (cache hits and misses)
+    - DLS text pipeline labels
+    - Smart DLS message selection at different queue loads
+    - the overhead of timing a hot path with the performance monitor
+*/
+
+#include <benchmark/benchmark.h>
+#include "../src/thai_rendering.h"
+#include "../src/thai_segmenter.h"
+#include "../src/text_pipeline.h"
+#include "../src/smart_dls.h"
+#include "../src/security_utils.h"
+#include <string>
+#include <vector>
+
+using namespace StreamDAB;
+
+static const std::vector<std::string> THAI_TEXTS = {
+    "สวัสดีครับ",
+    "ยินดีต้อนรับสู่รายการวิทยุ",
+    "ข่าวสารและความบันเทิง",
+    "เพลงไทยสากลและต่างประเทศ",
+    "รายการพิเศษในวันนี้",
+    "ขอขอบคุณผู้ฟังทุกท่าน",
+    "พบกันใหม่ในรายการหน้า",
+    "ติดตามข่าวสารได้ที่เว็บไซต์",
+};
+
+static const std::vector<std::string> ENGLISH_TEXTS = {
+    "Now playing your favorite music",
+    "Welcome to the radio station",
+    "Breaking news and updates",
+    "Traffic and weather information",
+    "Coming up next on the show",
+    "Thank you for listening",
+    "Stay tuned for more music",
+    "Visit our website for updates",
+};
+
+static size_t TotalSize(const std::vector<std::string>& texts) {
+    size_t size = 0;
+    for (const std::string& text : texts)
+        size += text.size();
+    return size;
+}
+
+// The time is per text
+static void BM_ThaiConvertUTF8ToDAB(benchmark::State& state) {
+    ThaiLanguageProcessor processor;
+    std::vector<uint8_t> dab_data;
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(processor.ConvertUTF8ToDAB(THAI_TEXTS[i++ % THAI_TEXTS.size()], dab_data));
+        benchmark::DoNotOptimize(dab_data.data());
+    }
+    state.SetBytesProcessed(state.iterations() * TotalSize(THAI_TEXTS) / THAI_TEXTS.size());
+}
+BENCHMARK(BM_ThaiConvertUTF8ToDAB);
+
+static void BM_ThaiTextLayout(benchmark::State& state) {
+    ThaiLanguageProcessor processor;
+    const std::vector<std::string>& texts = state.range(0) ? THAI_TEXTS : ENGLISH_TEXTS;
+    size_t i = 0;
+    for (auto _ : state) {
+        ThaiTextLayout layout = processor.AnalyzeTextLayout(texts[i++ % texts.size()], 128, 4);
+        benchmark::DoNotOptimize(layout);
+    }
+}
+BENCHMARK(BM_ThaiTextLayout)->ArgName("thai")->Arg(0)->Arg(1);
+
+static void BM_ThaiValidateContent(benchmark::State& state) {
+    ThaiLanguageProcessor processor;
+    size_t i = 0;
+    for (auto _ : state) {
+        CulturalValidation validation = processor.ValidateContent(THAI_TEXTS[i++ % THAI_TEXTS.size()]);
+        benchmark::DoNotOptimize(validation);
+    }
+}
+BENCHMARK(BM_ThaiValidateContent);
+
+// More distinct texts than the cache holds always miss it
+static void BM_ThaiSegment(benchmark::State& state) {
+    const bool cached = state.range(0);
+    std::vector<std::string> texts;
+    const size_t count = cached ? THAI_TEXTS.size() : 2 * ThaiWordSegmenter::CACHE_CAPACITY;
+    for (size_t i = 0; i < count; i++)
+        texts.push_back(THAI_TEXTS[i % THAI_TEXTS.size()] + (cached ? "" : " " + std::to_string(i)));
+
+    ThaiWordSegmenter segmenter;
+    std::vector<ThaiWordSegmenter::Span> spans;
+    size_t i = 0;
+    for (auto _ : state) {
+        segmenter.Segment(texts[i++ % texts.size()], spans);
+        benchmark::DoNotOptimize(spans.data());
+    }
+    state.SetBytesProcessed(state.iterations() * TotalSize(texts) / texts.size());
+}
+BENCHMARK(BM_ThaiSegment)->ArgName("cached")->Arg(0)->Arg(1);
+
+// A label from a text, without the rules of an optimizer
+static void BM_DLSTextPipeline(benchmark::State& state) {
+    const std::vector<std::string>& texts = state.range(0) ? THAI_TEXTS : ENGLISH_TEXTS;
+    DLSTextPipeline pipeline;
+    size_t i = 0;
+    for (auto _ : state) {
+        DLSTextPipeline::Label label = pipeline.Process(texts[i++ % texts.size()]);
+        benchmark::DoNotOptimize(label.text.data());
+    }
+    state.SetBytesProcessed(state.iterations() * TotalSize(texts) / texts.size());
+}
+BENCHMARK(BM_DLSTextPipeline)->ArgName("thai")->Arg(0)->Arg(1);
+
+// A message added and the next one selected, with the given number of messages queued
+static void BM_SmartDLSSelection(benchmark::State& state) {
+    SmartDLSProcessor processor;
+    const int load = state.range(0);
+    for (int i = 0; i < load; i++)
+        processor.AddMessage("Load test message " + std::to_string(i));
+
+    int i = 0;
+    for (auto _ : state) {
+        processor.AddMessage(ENGLISH_TEXTS[i++ % ENGLISH_TEXTS.size()]);
+        std::string text = processor.GetNextDLSText();
+        benchmark::DoNotOptimize(text.data());
+    }
+}
+BENCHMARK(BM_SmartDLSSelection)->ArgName("queued")->Arg(10)->Arg(50)->Arg(100)->Arg(200);
+
+// One scoped timer by operation ID, as on the per-frame paths; disabled, the
+// monitor only checks its flag
+static void BM_HotPathTiming(benchmark::State& state) {
+    static const TimingOperation operation("benchmark.hot_path");
+    PerformanceMonitor monitor;
+    if (!state.range(0))
+        monitor.Disable();
+
+    for (auto _ : state) {
+        PerformanceMonitor::ScopedTimer timer(monitor, operation);
+    }
+}
+BENCHMARK(BM_HotPathTiming)->ArgName("enabled")->Arg(0)->Arg(1);
@@ -0,0 +1,762 @@
+/*
+    PAD Replay Harness
+    Copyright (C) 2024 StreamDAB Project
+
+    Plays the audio encoder side of the PadInterface socket: requests PAD
+    frames at a fixed frame rate and PAD length, decodes them back into DLS
+    labels and MOT objects, and reports:
+    - the response latency per request (percentiles)
+    - the DLS label and MOT object completion times
+    - the X-PAD efficiency (CIs, padding, data group and payload bytes)
+
+    The requested frames can be recorded and later decoded again without
+    ODR-PadEnc, e.g. to compare the packing of two builds.
+
+    Usage: start ODR-PadEnc with -o IDENT, then e.g.
+        padenc_replay -o IDENT -l 58 -n 5000 -d 24
+*/
+
+#include "../src/pad_common.h"
+#include "../src/charset.h"
+#include "../src/crc.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// see pad_interface.cpp
+static const uint8_t MESSAGE_REQUEST = 1;
+static const uint8_t MESSAGE_PAD_DATA = 2;
+static const uint8_t MESSAGE_PAD_DATA_BATCH = 3;
+
+static const size_t SUBFIELD_LENS[] = {4, 6, 8, 12, 16, 24, 32, 48};
+
+static const int APPTYPE_DGLI = 1;
+static const int APPTYPE_DLS_START = 2;
+static const int APPTYPE_DLS_CONT = 3;
+static const int APPTYPE_MOT_START = 12;
+static const int APPTYPE_MOT_CONT = 13;
+
+// see dls.h
+static const int DLS_COMMAND_REMOVE_LABEL = 0x1;
+static const int DLS_COMMAND_DL_PLUS = 0x2;
+
+typedef std::chrono::steady_clock replay_clock;
+
+
+// --- PADDecoder -----------------------------------------------------------------
+/*! Reassembles the data groups of consecutive PAD frames (as sent over the
+ * socket, i.e. with the used PAD length appended) and decodes the DLS
+ * labels and MOT objects in them.
+ */
+class PADDecoder {
+public:
+    struct label_t {
+        std::string text;       // UTF-8
+        std::string dl_plus;    // the tags, if any
+        size_t first_frame;
+        size_t complete_frame;
+    };
+    struct object_t {
+        std::string name;
+        std::vector<uint8_t> body;
+        size_t first_frame;
+        size_t complete_frame;
+    };
+    struct stats_t {
+        size_t frames;
+        size_t frames_without_xpad;
+        size_t capacity_bytes;      // X-PAD
+        size_t xpad_bytes;          // used X-PAD
+        size_t subfield_bytes;
+        size_t dg_bytes;            // of complete, valid DGs
+        size_t payload_bytes;       // DLS characters and MOT segment data
+        size_t dgs;
+        size_t crc_errors;
+        size_t lost_bytes;          // without a DG to belong to
+    };
+
+    std::vector<label_t> labels;
+    std::vector<object_t> objects;
+
+    PADDecoder(bool verbose) : verbose(verbose), last_type(-1), pending_mot_len(0), frame(0), label_toggle(-1), label_first_frame(0), label_charset(0), label_last(-1) {
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    void Frame(const uint8_t* pad, size_t frame_size);
+    const stats_t& Stats() const {return stats;}
+
+private:
+    struct assembly_t {
+        std::vector<uint8_t> data;
+        size_t expected;    // 0, while unknown
+        bool active;
+        assembly_t() : expected(0), active(false) {}
+    };
+    struct mot_transfer_t {
+        std::map<int, std::vector<uint8_t> > header_segs;
+        std::map<int, std::vector<uint8_t> > body_segs;
+        int header_last;
+        int body_last;
+        size_t first_frame;
+        bool done;
+        mot_transfer_t() : header_last(-1), body_last(-1), first_frame(0), done(false) {}
+    };
+
+    bool verbose;
+    stats_t stats;
+    int last_type;
+    std::map<int, assembly_t> assemblies;   // by start app type
+    size_t pending_mot_len;
+    size_t frame;
+
+    int label_toggle;
+    size_t label_first_frame;
+    int label_charset;
+    std::map<int, std::vector<uint8_t> > label_segs;
+    int label_last;
+    std::string dl_plus;
+    CharsetConverter charset_converter;
+
+    std::map<int, mot_transfer_t> mot_transfers;    // by transport ID
+
+    static int StartType(int apptype);
+    static size_t ExpectedDLSLength(const std::vector<uint8_t>& dg);
+    void SubField(int apptype, bool start, const uint8_t* data, size_t len);
+    void CompleteDG(int start_type, assembly_t& assembly);
+    void DLSDataGroup(const uint8_t* dg, size_t len);
+    void MOTDataGroup(const uint8_t* dg, size_t len);
+    void CheckLabel();
+    void CheckObject(int tid, mot_transfer_t& transfer);
+};
+
+int PADDecoder::StartType(int apptype) {
+    if (apptype == APPTYPE_DLS_CONT)
+        return APPTYPE_DLS_START;
+    if (apptype == APPTYPE_MOT_CONT)
+        return APPTYPE_MOT_START;
+    return apptype;
+}
+
+size_t PADDecoder::ExpectedDLSLength(const std::vector<uint8_t>& dg) {
+    // prefix + field + CRC
+    if (dg.size() < 2)
+        return 0;
+    if (!(dg[0] & 0x10))
+        return 2 + (dg[0] & 0x0F) + 1 + 2;
+    if ((dg[0] & 0x0F) == DLS_COMMAND_DL_PLUS)
+        return 2 + (dg[1] & 0x0F) + 1 + 2;
+    return 2 + 2;
+}
+
+void PADDecoder::Frame(const uint8_t* pad, size_t frame_size) {
+    const size_t xpad_size_max = frame_size - 3;
+    const bool short_xpad = (pad[xpad_size_max] & 0x30) == 0x10;
+    const bool ci_flag = pad[xpad_size_max + 1] & 0x02;
+    const size_t used = pad[xpad_size_max + 2] >= 2 ? pad[xpad_size_max + 2] - 2 : 0;
+
+    stats.frames++;
+    stats.capacity_bytes += xpad_size_max;
+    frame++;
+
+    if ((pad[xpad_size_max] & 0x30) == 0x00) {
+        stats.frames_without_xpad++;
+        last_type = -1;
+        return;
+    }
+    stats.xpad_bytes += used;
+
+    std::vector<uint8_t> xpad(pad, pad + xpad_size_max);
+    std::reverse(xpad.begin(), xpad.end());
+
+    // CI list (or the continuation of the previous sub-field's app type)
+    std::vector<std::pair<int, size_t> > subfields;
+    size_t pos = 0;
+    if (ci_flag) {
+        for (int i = 0; i < (short_xpad ? 1 : 4); i++) {
+            const uint8_t ci = xpad[pos++];
+            if (ci == 0x00)
+                break;
+            subfields.push_back(std::make_pair(ci & 0x1F, short_xpad ? (size_t) 3 : SUBFIELD_LENS[ci >> 5]));
+        }
+    } else {
+        subfields.push_back(std::make_pair(last_type, used));
+    }
+
+    for (size_t i = 0; i < subfields.size(); i++) {
+        const size_t len = std::min(subfields[i].second, xpad.size() - pos);
+        SubField(subfields[i].first, ci_flag, &xpad[pos], len);
+        stats.subfield_bytes += len;
+        pos += len;
+        last_type = subfields[i].first;
+    }
+}
+
+void PADDecoder::SubField(int apptype, bool start, const uint8_t* data, size_t len) {
+    const int start_type = StartType(apptype);
+    assembly_t& assembly = assemblies[start_type];
+
+    if (start && apptype == start_type) {
+        // a new DG; the previous one of its app type ends here, if not yet
+        if (assembly.active)
+            CompleteDG(start_type, assembly);
+        assembly.data.clear();
+        assembly.active = true;
+        assembly.expected = 0;
+        if (start_type == APPTYPE_DGLI) {
+            assembly.expected = 4;
+        } else if (start_type == APPTYPE_MOT_START) {
+            assembly.expected = pending_mot_len;
+            pending_mot_len = 0;
+        }
+    }
+    if (!assembly.active) {
+        stats.lost_bytes += len;
+        return;
+    }
+
+    assembly.data.insert(assembly.data.end(), data, data + len);
+    if (start_type == APPTYPE_DLS_START && assembly.expected == 0)
+        assembly.expected = ExpectedDLSLength(assembly.data);
+    if (assembly.expected && assembly.data.size() >= assembly.expected) {
+        assembly.data.resize(assembly.expected);    // the rest is padding
+        CompleteDG(start_type, assembly);
+    }
+}
+
+void PADDecoder::CompleteDG(int start_type, assembly_t& assembly) {
+    assembly.active = false;
+    std::vector<uint8_t>& dg = assembly.data;
+
+    // without a known length, the DG is cut after the last non-zero byte (padding)
+    if (!assembly.expected) {
+        while (dg.size() > 2 && dg.back() == 0x00)
+            dg.pop_back();
+    }
+    if (dg.size() < 3) {
+        stats.lost_bytes += dg.size();
+        return;
+    }
+
+    const uint16_t crc = ~odr::crc16(0xFFFF, dg.data(), dg.size() - 2);
+    if (crc != ((dg[dg.size() - 2] << 8) | dg[dg.size() - 1])) {
+        stats.crc_errors++;
+        if (verbose)
+            fprintf(stderr, "frame %zu: CRC error in DG of app type %d (%zu bytes)\n", frame, start_type, dg.size());
+        return;
+    }
+    stats.dgs++;
+    stats.dg_bytes += dg.size();
+
+    const size_t len = dg.size() - 2;
+    switch (start_type) {
+    case APPTYPE_DGLI:
+        pending_mot_len = ((dg[0] & 0x3F) << 8) | dg[1];
+        break;
+    case APPTYPE_DLS_START:
+        DLSDataGroup(dg.data(), len);
+        break;
+    case APPTYPE_MOT_START:
+        MOTDataGroup(dg.data(), len);
+        break;
+    }
+}
+
+void PADDecoder::DLSDataGroup(const uint8_t* dg, size_t len) {
+    const int toggle = dg[0] >> 7;
+
+    if (dg[0] & 0x10) {
+        // command
+        switch (dg[0] & 0x0F) {
+        case DLS_COMMAND_REMOVE_LABEL:
+            if (verbose)
+                fprintf(stderr, "frame %zu: DLS remove label\n", frame);
+            break;
+        case DLS_COMMAND_DL_PLUS: {
+            std::string tags;
+            const size_t tags_count = len > 2 ? (dg[2] & 0x07) + 1 : 0;
+            for (size_t i = 0; i < tags_count && 5 + 3 * i < len; i++) {
+                char tag[32];
+                snprintf(tag, sizeof(tag), "%s%d@%d+%d", i ? " " : "", dg[3 + 3 * i] & 0x7F,
+                        dg[4 + 3 * i] & 0x7F, (dg[5 + 3 * i] & 0x7F) + 1);
+                tags += tag;
+            }
+            if (len > 2 && (dg[2] & 0x08))
+                tags += " (item toggle)";
+            if (tags != dl_plus) {
+                dl_plus = tags;
+                if (!labels.empty())
+                    labels.back().dl_plus = tags;
+            }
+            break;
+        }
+        }
+        return;
+    }
+
+    if (toggle != label_toggle) {
+        label_toggle = toggle;
+        label_segs.clear();
+        label_last = -1;
+        label_first_frame = frame;
+        dl_plus.clear();
+    }
+
+    const bool first = dg[0] & 0x40;
+    const bool last = dg[0] & 0x20;
+    const int index = first ? 0 : (dg[1] >> 4) & 0x07;
+    if (first)
+        label_charset = dg[1] >> 4;
+    if (last)
+        label_last = index;
+    label_segs[index].assign(dg + 2, dg + len);
+    stats.payload_bytes += len - 2;
+
+    CheckLabel();
+}
+
+void PADDecoder::CheckLabel() {
+    if (label_last < 0 || (int) label_segs.size() != label_last + 1 || label_segs.rbegin()->first != label_last)
+        return;
+
+    std::string raw;
+    for (const auto& seg : label_segs)
+        raw.append(seg.second.begin(), seg.second.end());
+
+    std::string text;
+    switch (label_charset) {
+    case (int) DABCharset::COMPLETE_EBU_LATIN:
+        text = charset_converter.convert_ebu_to_utf8(raw);
+        break;
+    case (int) DABCharset::UCS2_BE:
+        text = charset_converter.convert_ucs2_be_to_utf8(raw);
+        break;
+    default:
+        text = raw;
+    }
+
+    // a repetition of the current label
+    if (!labels.empty() && labels.back().first_frame == label_first_frame)
+        return;
+
+    labels.push_back(label_t{text, dl_plus, label_first_frame, frame});
+    if (verbose)
+        fprintf(stderr, "frame %zu: label '%s' (%zu frames)\n", frame, text.c_str(), frame - label_first_frame + 1);
+}
+
+void PADDecoder::MOTDataGroup(const uint8_t* dg, size_t len) {
+    // MSC data group header (EN 300 401, ch. 5.3.3)
+    const bool ext_flag = dg[0] & 0x80;
+    const bool seg_flag = dg[0] & 0x20;
+    const bool access_flag = dg[0] & 0x10;
+    const int dgtype = dg[0] & 0x0F;
+    size_t pos = ext_flag ? 4 : 2;
+
+    bool last = false;
+    int segnum = 0;
+    if (seg_flag) {
+        if (pos + 2 > len)
+            return;
+        last = dg[pos] & 0x80;
+        segnum = ((dg[pos] & 0x7F) << 8) | dg[pos + 1];
+        pos += 2;
+    }
+
+    int tid = -1;
+    if (access_flag) {
+        if (pos + 1 > len)
+            return;
+        const bool tid_flag = dg[pos] & 0x10;
+        const size_t lenid = dg[pos] & 0x0F;
+        if (tid_flag && pos + 3 <= len)
+            tid = (dg[pos + 1] << 8) | dg[pos + 2];
+        pos += 1 + lenid;
+    }
+
+    // segmentation header
+    if (tid < 0 || pos + 2 > len)
+        return;
+    const size_t seglen = ((dg[pos] & 0x1F) << 8) | dg[pos + 1];
+    pos += 2;
+    if (pos + seglen > len)
+        return;
+    stats.payload_bytes += seglen;
+
+    mot_transfer_t& transfer = mot_transfers[tid];
+    if (transfer.done) {
+        // a repetition, unless the object is sent anew
+        if (dgtype != 3 || segnum != 0)
+            return;
+        transfer = mot_transfer_t();
+    }
+    if (transfer.header_segs.empty() && transfer.body_segs.empty())
+        transfer.first_frame = frame;
+
+    std::map<int, std::vector<uint8_t> >& segs = dgtype == 3 ? transfer.header_segs : transfer.body_segs;
+    segs[segnum].assign(dg + pos, dg + pos + seglen);
+    if (last)
+        (dgtype == 3 ? transfer.header_last : transfer.body_last) = segnum;
+
+    CheckObject(tid, transfer);
+}
+
+void PADDecoder::CheckObject(int tid, mot_transfer_t& transfer) {
+    if (transfer.header_last < 0 || transfer.body_last < 0 ||
+            (int) transfer.header_segs.size() != transfer.header_last + 1 ||
+            (int) transfer.body_segs.size() != transfer.body_last + 1)
+        return;
+
+    std::vector<uint8_t> header;
+    for (const auto& seg : transfer.header_segs)
+        header.insert(header.end(), seg.second.begin(), seg.second.end());
+    object_t object;
+    for (const auto& seg : transfer.body_segs)
+        object.body.insert(object.body.end(), seg.second.begin(), seg.second.end());
+
+    // header core, then the extension parameters (EN 301 234, ch. 6.1)
+    if (header.size() < 7)
+        return;
+    const size_t body_size = (header[0] << 20) | (header[1] << 12) | (header[2] << 4) | (header[3] >> 4);
+    if (body_size != object.body.size()) {
+        fprintf(stderr, "frame %zu: MOT object %d of %zu bytes, but %zu expected\n", frame, tid, object.body.size(), body_size);
+        transfer.done = true;
+        return;
+    }
+    for (size_t pos = 7; pos < header.size();) {
+        const int pli = header[pos] >> 6;
+        const int param_id = header[pos] & 0x3F;
+        pos++;
+        size_t data_len = 0;
+        if (pli == 1) {
+            data_len = 1;
+        } else if (pli == 2) {
+            data_len = 4;
+        } else if (pli == 3 && pos < header.size()) {
+            if (header[pos] & 0x80) {
+                data_len = pos + 1 < header.size() ? ((header[pos] & 0x7F) << 8) | header[pos + 1] : 0;
+                pos += 2;
+            } else {
+                data_len = header[pos++];
+            }
+        }
+        if (pos + data_len > header.size())
+            break;
+        if (param_id == 0x0C && data_len > 1)   // ContentName, after its charset
+            object.name.assign((const char*) &header[pos + 1], data_len - 1);
+        pos += data_len;
+    }
+    if (object.name.empty())
+        object.name = "object_" + std::to_string(tid);
+
+    object.first_frame = transfer.first_frame;
+    object.complete_frame = frame;
+    transfer.done = true;
+    if (verbose)
+        fprintf(stderr, "frame %zu: MOT object '%s' (%zu bytes, %zu frames)\n", frame, object.name.c_str(),
+                object.body.size(), frame - object.first_frame + 1);
+    objects.push_back(std::move(object));
+}
+
+
+// --- main -----------------------------------------------------------------
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [OPTIONS...]\n"
+                    " -o, --output=IDENTIFIER   Socket identifier of the ODR-PadEnc to request PAD from\n"
+                    " -l, --pad=LEN             PAD length to request. Default: 58\n"
+                    " -n, --frames=COUNT        Number of frames to request. Default: 1000\n"
+                    " -b, --batch=COUNT         Frames per request (1-255). Default: 1\n"
+                    " -d, --frame-duration=MS   Interval between the frames; 0 requests the next frame(s)\n"
+                    "                             as soon as the previous ones are received. Default: 24\n"
+                    " -t, --timeout=MS          Time to wait for a response. Default: 1000\n"
+                    " -w, --write=FILENAME      Record the received PAD frames to a file\n"
+                    " -i, --input=FILENAME      Decode recorded PAD frames (of the given PAD length) instead\n"
+                    " -s, --slides=DIRNAME      Write the decoded MOT objects into a directory\n"
+                    " -v, --verbose             Print the labels and objects as they are completed\n"
+                    " -h, --help                Show this help\n",
+                    name);
+}
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    return sorted[std::min(sorted.size() - 1, (size_t) (p / 100.0 * sorted.size()))];
+}
+
+static int open_socket(const std::string& ident, struct sockaddr_un& padenc_addr) {
+    int sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (sock == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/%s.audioenc", ident.c_str());
+    unlink(addr.sun_path);
+    if (bind(sock, (const struct sockaddr*) &addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "Binding %s failed: %s\n", addr.sun_path, strerror(errno));
+        close(sock);
+        return -1;
+    }
+
+    memset(&padenc_addr, 0, sizeof(padenc_addr));
+    padenc_addr.sun_family = AF_UNIX;
+    snprintf(padenc_addr.sun_path, sizeof(padenc_addr.sun_path), "/tmp/%s.padenc", ident.c_str());
+    return sock;
+}
+
+int main(int argc, char *argv[]) {
+    std::string ident;
+    size_t padlen = 58;
+    size_t frames = 1000;
+    size_t batch = 1;
+    int frame_duration = 24;
+    int timeout = 1000;
+    const char* record_file = nullptr;
+    const char* input_file = nullptr;
+    const char* slides_dir = nullptr;
+    bool verbose = false;
+
+    const struct option longopts[] = {
+        {"output",          required_argument,  0, 'o'},
+        {"pad",             required_argument,  0, 'l'},
+        {"frames",          required_argument,  0, 'n'},
+        {"batch",           required_argument,  0, 'b'},
+        {"frame-duration",  required_argument,  0, 'd'},
+        {"timeout",         required_argument,  0, 't'},
+        {"write",           required_argument,  0, 'w'},
+        {"input",           required_argument,  0, 'i'},
+        {"slides",          required_argument,  0, 's'},
+        {"verbose",         no_argument,        0, 'v'},
+        {"help",            no_argument,        0, 'h'},
+        {0,0,0,0},
+    };
+
+    int ch;
+    while((ch = getopt_long(argc, argv, "o:l:n:b:d:t:w:i:s:vh", longopts, NULL)) != -1) {
+        switch (ch) {
+            case 'o':
+                ident = optarg;
+                break;
+            case 'l':
+                padlen = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                frames = strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                batch = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                frame_duration = atoi(optarg);
+                break;
+            case 't':
+                timeout = atoi(optarg);
+                break;
+            case 'w':
+                record_file = optarg;
+                break;
+            case 'i':
+                input_file = optarg;
+                break;
+            case 's':
+                slides_dir = optarg;
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                return ch == 'h' ? 0 : 1;
+        }
+    }
+
+    if (!PADPacketizer::CheckPADLen(padlen)) {
+        fprintf(stderr, "PAD length %zu invalid: Possible values: %s\n", padlen, PADPacketizer::ALLOWED_PADLEN.c_str());
+        return 1;
+    }
+    if (batch < 1 || batch > 255 || frame_duration < 0 || timeout < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!input_file && ident.empty()) {
+        fprintf(stderr, "Either a socket identifier or an input file is required\n");
+        return 1;
+    }
+
+    const size_t frame_size = padlen + 1;    // incl. the used PAD length
+    PADDecoder decoder(verbose);
+    std::vector<double> latencies;  // ms
+    size_t timeouts = 0;
+    size_t late_frames = 0;
+    double duration = 0;
+
+    if (input_file) {
+        std::ifstream input(input_file, std::ios::binary);
+        if (!input) {
+            fprintf(stderr, "Opening %s failed: %s\n", input_file, strerror(errno));
+            return 1;
+        }
+        std::vector<uint8_t> pad(frame_size);
+        while (input.read((char*) pad.data(), pad.size()))
+            decoder.Frame(pad.data(), frame_size);
+    } else {
+        struct sockaddr_un padenc_addr;
+        int sock = open_socket(ident, padenc_addr);
+        if (sock == -1)
+            return 1;
+
+        FILE* record = nullptr;
+        if (record_file && !(record = fopen(record_file, "wb"))) {
+            fprintf(stderr, "Opening %s failed: %s\n", record_file, strerror(errno));
+            close(sock);
+            return 1;
+        }
+
+        // the requests follow a fixed schedule, independent of the responses
+        const replay_clock::duration interval = std::chrono::milliseconds(frame_duration * batch);
+        const replay_clock::time_point start = replay_clock::now();
+        replay_clock::time_point next_request = start;
+        std::vector<uint8_t> message(2 + 255 * frame_size);
+        size_t received = 0;
+        while (received < frames) {
+            if (frame_duration) {
+                if (replay_clock::now() > next_request + interval)
+                    late_frames += batch;
+                std::this_thread::sleep_until(next_request);
+                next_request += interval;
+            }
+
+            const size_t requested = std::min(batch, frames - received);
+            const uint8_t request[3] = {MESSAGE_REQUEST, (uint8_t) padlen, (uint8_t) requested};
+            const replay_clock::time_point sent = replay_clock::now();
+            if (sendto(sock, request, requested > 1 ? 3 : 2, 0, (const struct sockaddr*) &padenc_addr, sizeof(padenc_addr)) == -1) {
+                if (errno != ECONNREFUSED && errno != ENOENT) {
+                    perror("sendto");
+                    break;
+                }
+            }
+
+            // the response; responses to earlier requests, which timed out, are decoded too
+            bool answered = false;
+            while (!answered) {
+                const int remaining = timeout - std::chrono::duration_cast<std::chrono::milliseconds>(replay_clock::now() - sent).count();
+                struct pollfd fds[1];
+                fds[0].fd = sock;
+                fds[0].events = POLLIN;
+                if (remaining <= 0 || poll(fds, 1, remaining) <= 0)
+                    break;
+
+                ssize_t len = recv(sock, message.data(), message.size(), 0);
+                if (len < 1)
+                    continue;
+
+                size_t count = 0;
+                const uint8_t* pads = nullptr;
+                if (message[0] == MESSAGE_PAD_DATA && (size_t) len == 1 + frame_size) {
+                    count = 1;
+                    pads = &message[1];
+                } else if (message[0] == MESSAGE_PAD_DATA_BATCH && len >= 2 && (size_t) len == 2 + message[1] * frame_size) {
+                    count = message[1];
+                    pads = &message[2];
+                } else {
+                    fprintf(stderr, "Unexpected message of %zd bytes (type %d) ignored\n", len, message[0]);
+                    continue;
+                }
+
+                answered = count == requested;
+                if (answered)
+                    latencies.push_back(std::chrono::duration<double, std::milli>(replay_clock::now() - sent).count());
+                for (size_t i = 0; i < count && received < frames; i++, received++) {
+                    decoder.Frame(pads + i * frame_size, frame_size);
+                    if (record)
+                        fwrite(pads + i * frame_size, frame_size, 1, record);
+                }
+            }
+            if (!answered)
+                timeouts++;
+            if (timeouts == 1 && !answered && latencies.empty())
+                fprintf(stderr, "No response from %s yet\n", padenc_addr.sun_path);
+        }
+        duration = std::chrono::duration<double>(replay_clock::now() - start).count();
+
+        if (record)
+            fclose(record);
+        close(sock);
+        char audioenc_path[sizeof(padenc_addr.sun_path)];
+        snprintf(audioenc_path, sizeof(audioenc_path), "/tmp/%s.audioenc", ident.c_str());
+        unlink(audioenc_path);
+    }
+
+    // report
+    const PADDecoder::stats_t& stats = decoder.Stats();
+    const double frame_ms = frame_duration ? frame_duration : 24;   // for the completion times in lockstep mode
+    printf("PAD length %zu: %zu frames", padlen, stats.frames);
+    if (!input_file)
+        printf(" in %.1f s, %zu per request, %zu timeouts, %zu frames late", duration, batch, timeouts, late_frames);
+    printf("\n");
+
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        printf("Response latency (ms): p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+                percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99),
+                percentile(latencies, 99.9), latencies.back());
+    }
+
+    if (stats.capacity_bytes) {
+        const double capacity = stats.capacity_bytes / 100.0;
+        printf("X-PAD: %zu bytes capacity, %zu frames without X-PAD\n", stats.capacity_bytes, stats.frames_without_xpad);
+        printf("  used %.1f%%  (CIs %.1f%%, sub-fields %.1f%%: DGs %.1f%%, padding %.1f%%)\n",
+                stats.xpad_bytes / capacity, (stats.xpad_bytes - stats.subfield_bytes) / capacity,
+                stats.subfield_bytes / capacity, stats.dg_bytes / capacity,
+                (stats.subfield_bytes - std::min(stats.subfield_bytes, stats.dg_bytes)) / capacity);
+        printf("  payload %.1f%%, %zu DGs, %zu CRC errors, %zu bytes lost\n",
+                stats.payload_bytes / capacity, stats.dgs, stats.crc_errors, stats.lost_bytes);
+    }
+
+    printf("DLS labels: %zu\n", decoder.labels.size());
+    for (const PADDecoder::label_t& label : decoder.labels) {
+        printf("  frame %6zu: %4zu frames  '%s'", label.complete_frame, label.complete_frame - label.first_frame + 1, label.text.c_str());
+        if (!label.dl_plus.empty())
+            printf("  DL Plus: %s", label.dl_plus.c_str());
+        printf("\n");
+    }
+
+    std::vector<double> completions;    // ms
+    printf("MOT objects: %zu\n", decoder.objects.size());
+    for (const PADDecoder::object_t& object : decoder.objects) {
+        const size_t object_frames = object.complete_frame - object.first_frame + 1;
+        completions.push_back(object_frames * frame_ms);
+        printf("  frame %6zu: %4zu frames (%.1f s)  '%s', %zu bytes\n", object.complete_frame, object_frames,
+                object_frames * frame_ms / 1000, object.name.c_str(), object.body.size());
+
+        if (slides_dir) {
+            const std::string path = std::string(slides_dir) + "/" + std::to_string(object.complete_frame) + "_" + object.name;
+            std::ofstream slide(path, std::ios::binary | std::ios::trunc);
+            slide.write((const char*) object.body.data(), object.body.size());
+            if (!slide)
+                fprintf(stderr, "Writing %s failed\n", path.c_str());
+        }
+    }
+    if (!completions.empty()) {
+        std::sort(completions.begin(), completions.end());
+        printf("Slide completion (s): p50 %.2f  p90 %.2f  max %.2f\n", percentile(completions, 50) / 1000,
+                percentile(completions, 90) / 1000, completions.back() / 1000);
+    }
+
+    return stats.crc_errors ? 2 : 0;
+}
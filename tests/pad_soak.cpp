@@ -0,0 +1,416 @@
+/*
+    PAD Soak Harness
+    Copyright (C) 2024 StreamDAB Project
+
+    Runs the encoder in virtual time (as --simulate does) for a simulated day
+    or week, with a churn of slides and labels:
+    - new slides written to the slides dir (the oldest removed), and now and
+      then one injected
+    - the DLS file rewritten, and messages passed through the StreamDAB
+      processors (SmartDLSProcessor, DLSTextPipeline) and injected as labels
+    It samples the RSS, the heap in use (glibc) and the latency of the frames
+    (wall clock) and flags a metric that keeps growing after the warm-up, so
+    that the caches, histories, hash tables and queues are shown to be
+    bounded. The exit code is 1 if any metric was flagged.
+
+    Usage: e.g. a simulated week, sampled every simulated hour
+        padenc_soak -t 604800 -s 3600 -o soak.csv
+*/
+
+#include "../src/pad_encoder.h"
+#include "../src/slide_codec.h"
+#include "../src/smart_dls.h"
+#include "../src/text_pipeline.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <getopt.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock soak_clock;
+
+static const char* const ARTISTS[] = {"The Beatles", "Nina Simone", "Daft Punk", "Bodyslam", "Miles Davis"};
+static const char* const TITLES[] = {"Here Comes the Sun", "Feeling Good", "Around the World", "Kwam Rak", "So What"};
+
+
+// --- sampling -----------------------------------------------------------------
+struct soak_sample_t {
+    double hours;           // simulated
+    double rss;             // MiB
+    double heap;            // MiB in use; 0 if not known
+    double latency_p50;     // us per frame
+    double latency_p99;
+    double latency_max;
+};
+
+static double rss_mib() {
+    long pages = 0, resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (!statm)
+        return 0;
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(statm);
+    return resident * (double) sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+static double heap_mib() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    const struct mallinfo2 info = mallinfo2();
+    return (info.uordblks + info.hblkhd) / (1024.0 * 1024);
+#else
+    return 0;
+#endif
+}
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    return sorted[std::min(sorted.size() - 1, (size_t) (p / 100.0 * sorted.size()))];
+}
+
+/*! Whether the metric keeps growing: the samples after the warm-up are split
+ * into four quarters, each represented by its median (so that single peaks
+ * do not count). It grows, if each quarter is above the previous one and the
+ * last one more than tolerance (a share) above the first one.
+ */
+static bool grows(const std::vector<soak_sample_t>& samples, double soak_sample_t::*metric, size_t warmup, double tolerance, double& growth) {
+    growth = 0;
+    const size_t count = samples.size() - std::min(warmup, samples.size());
+    if (count < 8)
+        return false;
+
+    double medians[4];
+    for (size_t quarter = 0; quarter < 4; quarter++) {
+        std::vector<double> values;
+        for (size_t i = warmup + quarter * count / 4; i < warmup + (quarter + 1) * count / 4; i++)
+            values.push_back(samples[i].*metric);
+        std::sort(values.begin(), values.end());
+        medians[quarter] = values[values.size() / 2];
+    }
+    if (medians[0] <= 0)
+        return false;
+    growth = medians[3] / medians[0] - 1;
+    for (size_t quarter = 1; quarter < 4; quarter++)
+        if (medians[quarter] <= medians[quarter - 1])
+            return false;
+    return growth > tolerance;
+}
+
+
+// --- churn -----------------------------------------------------------------
+static bool write_file(const std::string& path, const void* data, size_t len) {
+    // as recommended for slides and labels: a new file renamed over the old one
+    const std::string tmp_path = path + ".tmp";
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    file.write((const char*) data, len);
+    file.close();
+    return file && rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+// a different image for each number, so that no slide is found in the cache
+static bool write_slide(const std::string& path, size_t number) {
+    rgb_image_t image;
+    image.width = 320;
+    image.height = 240;
+    image.pixels.resize(image.width * image.height * 3);
+    for (size_t y = 0; y < image.height; y++) {
+        for (size_t x = 0; x < image.width; x++) {
+            uint8_t* pixel = &image.pixels[(y * image.width + x) * 3];
+            pixel[0] = (uint8_t) (x + number * 37);
+            pixel[1] = (uint8_t) (y * 2 + number * 11);
+            pixel[2] = (uint8_t) ((x ^ y) + number);
+        }
+    }
+
+    std::vector<uint8_t> data;
+    if (!SlideCodec::EncodeJPEG(image, 85, data) && !SlideCodec::EncodePNG(image, data))
+        return false;
+    return write_file(path, data.data(), data.size());
+}
+
+static std::string slide_path(const std::string& dir, size_t number) {
+    return dir + "/slide_" + std::to_string(number) + ".jpg";
+}
+
+static std::string message_text(size_t number) {
+    return std::string("Now playing: ") + TITLES[number % 5] + " - " + ARTISTS[(number / 5) % 5] +
+           " | Request " + std::to_string(number) + " at the studio";
+}
+
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [OPTIONS...]\n"
+                    " -t, --duration=SECONDS     Simulated time to encode. Default: 86400 (a day)\n"
+                    " -s, --sample=SECONDS       Simulated time between the samples. Default: 900\n"
+                    " -l, --pad=LEN              PAD length. Default: 58\n"
+                    " -d, --frame-duration=MS    Duration of a frame. Default: 24\n"
+                    " -c, --slide-churn=SECONDS  Simulated time between new slides. Default: 20\n"
+                    " -m, --label-churn=SECONDS  Simulated time between new labels. Default: 8\n"
+                    " -k, --slides=COUNT         Slides kept in the slides dir. Default: 4\n"
+                    " -g, --tolerance=PERCENT    Growth over the run (after the warm-up) that is flagged. Default: 10\n"
+                    " -u, --warmup=PERCENT       Share of the samples taken as warm-up. Default: 20\n"
+                    " -w, --workdir=DIRNAME      Directory for the slides and the DLS file. Default: a temporary one\n"
+                    " -o, --output=FILENAME      Write the samples as CSV to a file\n"
+                    " -h, --help                 Show this help\n",
+                    name);
+}
+
+int main(int argc, char *argv[]) {
+    long duration = 86400;
+    long sample_interval = 900;
+    int padlen = 58;
+    int frame_duration = 24;
+    long slide_churn = 20;
+    long label_churn = 8;
+    size_t slides_kept = 4;
+    double tolerance = 10;
+    double warmup_share = 20;
+    std::string workdir;
+    const char* output_file = nullptr;
+
+    const struct option longopts[] = {
+        {"duration",        required_argument,  0, 't'},
+        {"sample",          required_argument,  0, 's'},
+        {"pad",             required_argument,  0, 'l'},
+        {"frame-duration",  required_argument,  0, 'd'},
+        {"slide-churn",     required_argument,  0, 'c'},
+        {"label-churn",     required_argument,  0, 'm'},
+        {"slides",          required_argument,  0, 'k'},
+        {"tolerance",       required_argument,  0, 'g'},
+        {"warmup",          required_argument,  0, 'u'},
+        {"workdir",         required_argument,  0, 'w'},
+        {"output",          required_argument,  0, 'o'},
+        {"help",            no_argument,        0, 'h'},
+        {0,0,0,0},
+    };
+
+    int ch;
+    while((ch = getopt_long(argc, argv, "t:s:l:d:c:m:k:g:u:w:o:h", longopts, NULL)) != -1) {
+        switch (ch) {
+            case 't':
+                duration = strtol(optarg, NULL, 10);
+                break;
+            case 's':
+                sample_interval = strtol(optarg, NULL, 10);
+                break;
+            case 'l':
+                padlen = atoi(optarg);
+                break;
+            case 'd':
+                frame_duration = atoi(optarg);
+                break;
+            case 'c':
+                slide_churn = strtol(optarg, NULL, 10);
+                break;
+            case 'm':
+                label_churn = strtol(optarg, NULL, 10);
+                break;
+            case 'k':
+                slides_kept = strtoul(optarg, NULL, 10);
+                break;
+            case 'g':
+                tolerance = atof(optarg);
+                break;
+            case 'u':
+                warmup_share = atof(optarg);
+                break;
+            case 'w':
+                workdir = optarg;
+                break;
+            case 'o':
+                output_file = optarg;
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                return ch == 'h' ? 0 : 1;
+        }
+    }
+
+    if (duration <= 0 || sample_interval <= 0 || frame_duration < 1 || slide_churn <= 0 || label_churn <= 0 || slides_kept < 1) {
+        fprintf(stderr, "The durations and intervals must be positive, and at least one slide kept\n");
+        return 1;
+    }
+    if (!PADPacketizer::CheckPADLen(padlen)) {
+        fprintf(stderr, "PAD length %d invalid: Possible values: %s\n", padlen, PADPacketizer::ALLOWED_PADLEN.c_str());
+        return 1;
+    }
+    if (workdir.empty()) {
+        char tmp_dir[] = "/tmp/padenc_soak.XXXXXX";
+        if (!mkdtemp(tmp_dir)) {
+            perror("mkdtemp");
+            return 1;
+        }
+        workdir = tmp_dir;
+    }
+
+    FILE* output = nullptr;
+    if (output_file) {
+        output = fopen(output_file, "w");
+        if (!output) {
+            perror(output_file);
+            return 1;
+        }
+        fprintf(output, "hours,rss_mib,heap_mib,latency_p50_us,latency_p99_us,latency_max_us\n");
+    }
+
+    // the churn starts with a full slides dir and a label
+    size_t slide_number = 0;
+    for (; slide_number < slides_kept; slide_number++) {
+        if (!write_slide(slide_path(workdir, slide_number), slide_number)) {
+            fprintf(stderr, "Writing the slides to '%s' failed\n", workdir.c_str());
+            return 1;
+        }
+    }
+    const std::string dls_file = workdir + "/dls.txt";
+    size_t message_number = 0;
+    const std::string first_label = message_text(message_number++);
+    if (!write_file(dls_file, first_label.data(), first_label.size())) {
+        fprintf(stderr, "Writing the DLS file '%s' failed\n", dls_file.c_str());
+        return 1;
+    }
+
+    PadEncoderOptions options;
+    options.padlen = padlen;
+    options.sls_dir = workdir;
+    options.dls_files.push_back(dls_file);
+    options.slide_interval = 5;
+    options.label_interval = 4;
+    options.slide_lookahead = 0;    // prepared in the frame, as in the simulation
+
+    VirtualPadClock clock;
+    PadEncoder pad_encoder(options, &clock);
+    std::vector<uint8_t> pad(pad_encoder.GetPADFrameSize());
+
+    /* The queue of the processor expires its messages on the system clock
+     * (after a day, by default), so that in virtual time it would keep all;
+     * instead, it is started anew each simulated day.
+     */
+    std::unique_ptr<StreamDAB::SmartDLSProcessor> processor(new StreamDAB::SmartDLSProcessor());
+    const size_t frames_per_day = 24 * 3600 * 1000 / frame_duration;
+    StreamDAB::MessageLengthOptimizer optimizer;
+    StreamDAB::DLSTextPipeline pipeline(&optimizer);
+    StreamDAB::DLSTextPipeline::Options pipeline_options;
+    pipeline_options.max_length = 64;
+
+    const std::chrono::milliseconds frame(frame_duration);
+    const size_t frames = (size_t) duration * 1000 / frame_duration;
+    const size_t frames_per_sample = std::max<size_t>(1, (size_t) sample_interval * 1000 / frame_duration);
+    const size_t frames_per_slide = std::max<size_t>(1, (size_t) slide_churn * 1000 / frame_duration);
+    const size_t frames_per_label = std::max<size_t>(1, (size_t) label_churn * 1000 / frame_duration);
+    fprintf(stderr, "Soaking %zu frames of PAD length %d (%.1f h) in '%s'\n", frames, padlen, duration / 3600.0, workdir.c_str());
+
+    std::vector<soak_sample_t> samples;
+    std::vector<double> latencies;
+    latencies.reserve(frames_per_sample);
+    bool label_injected = false;
+    int result = 0;
+    const soak_clock::time_point start = soak_clock::now();
+    for (size_t f = 1; f <= frames; f++) {
+        const soak_clock::time_point frame_start = soak_clock::now();
+        result = pad_encoder.Encode(&pad[0]);
+        latencies.push_back(std::chrono::duration<double, std::micro>(soak_clock::now() - frame_start).count());
+        if (result) {
+            fprintf(stderr, "Encoding frame %zu failed\n", f);
+            break;
+        }
+        clock.Advance(frame);
+
+        if (f % frames_per_slide == 0) {
+            if (!write_slide(slide_path(workdir, slide_number), slide_number)) {
+                fprintf(stderr, "Writing slide %zu failed\n", slide_number);
+                result = 1;
+                break;
+            }
+            unlink(slide_path(workdir, slide_number - slides_kept).c_str());
+            slide_number++;
+
+            // every fifth one also as an injected slide (a copy erased once sent)
+            if (slide_number % 5 == 0) {
+                const std::string injected_path = workdir + "/injected_" + std::to_string(slide_number) + ".jpg";
+                if (write_slide(injected_path, slide_number + 1000000))
+                    pad_encoder.InjectSlide({injected_path, true});
+            }
+        }
+
+        if (f % frames_per_label == 0) {
+            // in turn: the DLS file rewritten, and a message of the processors shown instead
+            const std::string text = message_text(message_number++);
+            if (label_injected) {
+                pad_encoder.ReleaseLabel();
+                label_injected = false;
+            }
+            if (message_number % 2) {
+                write_file(dls_file, text.data(), text.size());
+            }
+            else {
+                std::map<std::string, std::string> metadata;
+                metadata["title"] = TITLES[message_number % 5];
+                metadata["artist"] = ARTISTS[(message_number / 5) % 5];
+                processor->AddMessage(text, StreamDAB::MessagePriority::NORMAL, StreamDAB::ContentSource::AUTOMATION_SYSTEM, metadata);
+                const std::string selected = processor->GetNextDLSText();
+                const StreamDAB::DLSTextPipeline::Label label = pipeline.Process(selected, pipeline_options);
+                if (!selected.empty() && !label.text.empty())
+                    label_injected = pad_encoder.InjectLabel(selected, false);
+            }
+        }
+
+        if (f % frames_per_day == 0)
+            processor.reset(new StreamDAB::SmartDLSProcessor());
+
+        if (f % frames_per_sample == 0) {
+            std::sort(latencies.begin(), latencies.end());
+            const soak_sample_t sample = {f * frame_duration / 3600000.0, rss_mib(), heap_mib(),
+                    percentile(latencies, 50), percentile(latencies, 99), latencies.back()};
+            samples.push_back(sample);
+            latencies.clear();
+
+            fprintf(stderr, "%7.2f h: RSS %7.2f MiB, heap %7.2f MiB, frame latency p50 %6.1f us, p99 %7.1f us, max %8.1f us\n",
+                    sample.hours, sample.rss, sample.heap, sample.latency_p50, sample.latency_p99, sample.latency_max);
+            if (output)
+                fprintf(output, "%.4f,%.3f,%.3f,%.2f,%.2f,%.2f\n",
+                        sample.hours, sample.rss, sample.heap, sample.latency_p50, sample.latency_p99, sample.latency_max);
+        }
+    }
+    const double elapsed = std::chrono::duration<double>(soak_clock::now() - start).count();
+    if (output)
+        fclose(output);
+
+    fprintf(stderr, "Soaked for %.1f s (%.0fx real time), %zu slides and %zu labels\n",
+            elapsed, elapsed > 0 ? duration / elapsed : 0.0, slide_number, message_number);
+    pad_encoder.DumpStats();
+    if (result)
+        return result;
+
+    const size_t warmup = (size_t) (samples.size() * warmup_share / 100);
+    if (samples.size() - warmup < 8) {
+        fprintf(stderr, "Too few samples after the warm-up (%zu) to judge the growth; sample more often\n", samples.size() - warmup);
+        return 0;
+    }
+
+    const struct {
+        const char* name;
+        double soak_sample_t::*metric;
+    } metrics[] = {
+        {"RSS", &soak_sample_t::rss},
+        {"heap", &soak_sample_t::heap},
+        {"frame latency p50", &soak_sample_t::latency_p50},
+        {"frame latency p99", &soak_sample_t::latency_p99},
+    };
+    for (const auto& metric : metrics) {
+        double growth;
+        const bool flagged = grows(samples, metric.metric, warmup, tolerance / 100, growth);
+        fprintf(stderr, "%-18s %+6.1f%% %s\n", metric.name, growth * 100, flagged ? "GROWING" : "bounded");
+        if (flagged)
+            result = 1;
+    }
+    return result;
+}
@@ -8,13 +8,28 @@
     - MessagePack protocol handling
     - Authentication and security
     - Performance and rate limiting
+    - HTTP request parsing, keep-alive and pipelining
+    - Streaming JSON and MessagePack codecs
+    - Versioned status with delta updates
+    - Streaming image uploads
+    - Cached GET responses with ETags
+    - Metrics endpoint
 */
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 #include "../src/api_interface.h"
+#include "../src/metrics.h"
 #include <thread>
 #include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
 
 using namespace StreamDAB;
 using namespace testing;
@@ -178,9 +193,16 @@ TEST_F(APIInterfaceTest, ConfigurationUpdates) {
 
 // Test health check functionality
 TEST_F(APIInterfaceTest, HealthCheck) {
+    // Not started, the service is not healthy
+    EXPECT_FALSE(api_service_->PerformHealthCheck());
+    EXPECT_FALSE(api_service_->GetHealthIssues().empty());
+    
+    if (!api_service_->Start()) {
+        GTEST_SKIP() << "Could not start API service";
+    }
     bool health_status = api_service_->PerformHealthCheck();
     
-    // Basic health check should pass
+    // Basic health check should pass, also without any images
     EXPECT_TRUE(health_status);
     
     auto health_issues = api_service_->GetHealthIssues();
@@ -240,6 +262,9 @@ TEST_F(APIInterfaceTest, MimeTypeDetection) {
     EXPECT_EQ(APIUtils::GetMimeType(".json"), "application/json");
     EXPECT_EQ(APIUtils::GetMimeType(".txt"), "text/plain");
     EXPECT_EQ(APIUtils::GetMimeType(".unknown"), "application/octet-stream");
+    EXPECT_EQ(APIUtils::MimeTypeOf(".JS"), "application/javascript");
+    EXPECT_EQ(APIUtils::MimeTypeOf(".woff2"), "font/woff2");
+    EXPECT_EQ(APIUtils::MimeTypeOf(""), "application/octet-stream");
 }
 
 // Test image upload validation
@@ -341,7 +366,7 @@ TEST_F(APIInterfaceTest, RateLimiting) {
 TEST_F(APIInterfaceTest, ErrorHandling) {
     // Test invalid configuration
     APIConfig invalid_config;
-    invalid_config.port = 99999; // Invalid port
+    invalid_config.bind_address = "invalid address";
     
     auto invalid_service = std::make_unique<StreamDABAPIService>(invalid_config);
     
@@ -488,4 +513,884 @@ TEST_F(APIInterfaceTest, ThreadSafety) {
     EXPECT_GT(successful_operations.load(), 0);
     
     api_service_->Stop();
-}
\ No newline at end of file
+}
+// Test parsing requests in place, including incomplete and pipelined ones
+TEST_F(APIInterfaceTest, HTTPRequestParsing) {
+    const std::string data = "POST /api/v1/messages?text=a%20b&x HTTP/1.1\r\n"
+                             "Host: localhost\r\n"
+                             "content-length:  5 \r\n"
+                             "\r\n"
+                             "helloGET / HTTP/1.0\r\n\r\n";
+    HTTPRequest request;
+    size_t length = 0;
+    ASSERT_EQ(request.Parse(data.data(), data.size(), 1024, length), HTTPRequest::ParseResult::COMPLETE);
+    EXPECT_EQ(request.method, "POST");
+    EXPECT_EQ(request.path, "/api/v1/messages");
+    EXPECT_EQ(request.query, "text=a%20b&x");
+    EXPECT_EQ(request.Header("Content-Length"), "5");
+    EXPECT_EQ(request.Header("HOST"), "localhost");
+    EXPECT_EQ(request.Header("Accept"), "");
+    EXPECT_EQ(request.body, "hello");
+    EXPECT_TRUE(request.keep_alive);
+    // the views reference the data
+    EXPECT_EQ(request.path.data(), data.data() + 5);
+
+    // the pipelined request
+    ASSERT_EQ(request.Parse(data.data() + length, data.size() - length, 1024, length), HTTPRequest::ParseResult::COMPLETE);
+    EXPECT_EQ(request.method, "GET");
+    EXPECT_FALSE(request.keep_alive);
+
+    EXPECT_EQ(request.Parse(data.data(), 40, 1024, length), HTTPRequest::ParseResult::INCOMPLETE);
+    EXPECT_EQ(request.Parse(data.data(), data.find("hello") + 2, 1024, length), HTTPRequest::ParseResult::INCOMPLETE);
+    EXPECT_EQ(request.Parse(data.data(), data.size(), 4, length), HTTPRequest::ParseResult::TOO_LARGE);
+    const std::string invalid = "GET /\r\n\r\n";
+    EXPECT_EQ(request.Parse(invalid.data(), invalid.size(), 1024, length), HTTPRequest::ParseResult::INVALID);
+    const std::string chunked = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+    EXPECT_EQ(request.Parse(chunked.data(), chunked.size(), 1024, length), HTTPRequest::ParseResult::INVALID);
+}
+
+// Test that pipelined requests are answered in order, on a kept-alive connection
+TEST_F(APIInterfaceTest, HTTPServerPipelining) {
+    APIConfig config = test_config_;
+    config.port = 0;
+    config.event_loops = 2;
+    HTTPServer server(config);
+    APIEndpoint endpoint;
+    endpoint.path = "/echo";
+    endpoint.method = "GET";
+    endpoint.handler = [](const std::map<std::string, std::string>& params, const std::vector<uint8_t>& body) {
+        auto it = params.find("n");
+        return APIUtils::CreateSuccessResponse(it == params.end() ? "" : it->second);
+    };
+    server.RegisterEndpoint(endpoint);
+    ASSERT_TRUE(server.Start());
+    ASSERT_NE(server.GetPort(), 0);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_NE(fd, -1);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(server.GetPort());
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(connect(fd, (sockaddr*) &addr, sizeof(addr)), 0);
+
+    // read until the server closes the connection after the last response
+    const std::string requests = "GET /echo?n=1 HTTP/1.1\r\n\r\n"
+                                 "GET /echo?n=2 HTTP/1.1\r\n\r\n"
+                                 "GET /missing HTTP/1.1\r\n\r\n"
+                                 "GET /echo?n=3 HTTP/1.1\r\nConnection: close\r\n\r\n";
+    ASSERT_EQ(send(fd, requests.data(), requests.size(), 0), (ssize_t) requests.size());
+    std::string responses;
+    char buffer[4096];
+    ssize_t received;
+    while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        responses.append(buffer, received);
+    }
+    close(fd);
+
+    size_t first = responses.find("\"message\":\"1\"");
+    size_t second = responses.find("\"message\":\"2\"");
+    size_t missing = responses.find("HTTP/1.1 404");
+    size_t third = responses.find("\"message\":\"3\"");
+    ASSERT_NE(third, std::string::npos);
+    EXPECT_LT(first, second);
+    EXPECT_LT(second, missing);
+    EXPECT_LT(missing, third);
+    EXPECT_NE(responses.find("Connection: close"), std::string::npos);
+
+    auto stats = server.GetStatistics();
+    EXPECT_EQ(stats.total_requests, 4u);
+    EXPECT_EQ(stats.failed_requests, 1u);
+    EXPECT_EQ(stats.endpoint_usage["/echo"], 3u);
+    server.Stop();
+    EXPECT_FALSE(server.IsRunning());
+}
+
+// Test the token buckets: a minute's worth in a burst, then refilled over time
+TEST_F(APIInterfaceTest, RateLimiterTokenBuckets) {
+    RateLimiter limiter(60);
+    auto now = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < 60; i++) {
+        EXPECT_FALSE(limiter.IsLimited("10.0.0.1", now));
+    }
+    EXPECT_TRUE(limiter.IsLimited("10.0.0.1", now));
+    EXPECT_FALSE(limiter.IsLimited("10.0.0.2", now));
+    EXPECT_EQ(limiter.GetClientCount(), 2u);
+
+    // one token per second
+    now += std::chrono::seconds(1);
+    EXPECT_FALSE(limiter.IsLimited("10.0.0.1", now));
+    EXPECT_TRUE(limiter.IsLimited("10.0.0.1", now));
+
+    // full buckets are swept; a returning client starts full
+    now += std::chrono::minutes(2);
+    EXPECT_FALSE(limiter.IsLimited("10.0.0.3", now));
+    EXPECT_EQ(limiter.GetClientCount(), 1u);
+    for (int i = 0; i < 60; i++) {
+        EXPECT_FALSE(limiter.IsLimited("10.0.0.1", now));
+    }
+    EXPECT_TRUE(limiter.IsLimited("10.0.0.1", now));
+
+    // concurrent requests take exactly the tokens available
+    std::atomic<int> allowed{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < 100; i++) {
+                if (!limiter.IsLimited("10.0.0.4", now)) {
+                    allowed++;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(allowed.load(), 60);
+
+    RateLimiter blocked(0);
+    EXPECT_TRUE(blocked.IsLimited("10.0.0.1"));
+}
+
+// Test broadcasts: framed once, sent to subscribers only, slow clients dropping frames
+TEST_F(APIInterfaceTest, WebSocketFanOut) {
+    WebSocketMessage message;
+    message.type = WebSocketMessageType::CONTENT_NOTIFICATION;
+    message.payload = {'h', 'i'};
+    message.timestamp = std::chrono::system_clock::time_point(std::chrono::milliseconds(1000));
+
+    auto frame = WebSocketServer::EncodeFrame(message);
+    const std::vector<uint8_t> expected = {0x82, 16, 0x94, 0x01, 0xCF, 0, 0, 0, 0, 0, 0, 0x03, 0xE8,
+                                           0xC2, 0xC4, 2, 'h', 'i'};
+    EXPECT_EQ(*frame, expected);
+
+    WebSocketServer server;
+    ASSERT_TRUE(server.Start());
+
+    int fds[3][2];
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]), 0);
+        auto connection = std::make_shared<ClientConnection>();
+        connection->socket_fd = fds[i][0];
+        server.AddClient("client" + std::to_string(i), connection);
+    }
+    server.SubscribeClient("client1", "news");
+    server.SubscribeClient("client2", "news");
+    server.UnsubscribeClient("client2", "news");
+
+    auto receive = [](int fd, size_t size) {
+        std::vector<uint8_t> data(size);
+        size_t received = 0;
+        while (received < size) {
+            ssize_t n = recv(fd, data.data() + received, size - received, 0);
+            if (n <= 0) {
+                break;
+            }
+            received += n;
+        }
+        data.resize(received);
+        return data;
+    };
+
+    server.BroadcastMessage(message);
+    server.SendToSubscribers("news", message);
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(receive(fds[i][1], expected.size()), expected);
+    }
+    EXPECT_EQ(receive(fds[1][1], expected.size()), expected);
+
+    auto stats = server.GetStatistics();
+    EXPECT_EQ(stats.frames_encoded, 2u);
+    EXPECT_EQ(stats.frames_queued, 4u);
+
+    // a client not reading keeps at most MAX_QUEUED_BYTES queued
+    message.payload.assign(64 * 1024, 'x');
+    const size_t frame_size = WebSocketServer::EncodeFrame(message)->size();
+    const size_t count = 4 * WebSocketServer::MAX_QUEUED_BYTES / frame_size;
+    for (size_t i = 0; i < count; i++) {
+        server.SendToClient("client0", message);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    stats = server.GetStatistics();
+    EXPECT_GT(stats.frames_dropped, 0u);
+    EXPECT_EQ(stats.frames_queued, 4u + count);
+
+    server.Stop();
+    for (int i = 0; i < 3; i++) {
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+}
+
+// Test permessage-deflate: negotiation, and broadcasts deflated once for the clients taking it
+TEST_F(APIInterfaceTest, WebSocketDeflate) {
+    ClientConnection offered;
+    EXPECT_EQ(WebSocketServer::NegotiateDeflate("permessage-deflate; client_max_window_bits", offered),
+              "permessage-deflate; server_no_context_takeover");
+    EXPECT_TRUE(offered.permessage_deflate);
+    EXPECT_EQ(WebSocketServer::NegotiateDeflate("permessage-deflate; server_max_window_bits=10, x-webkit-deflate-frame", offered), "");
+    EXPECT_FALSE(offered.permessage_deflate);
+    EXPECT_EQ(WebSocketServer::NegotiateDeflate("permessage-deflate; unknown, Permessage-Deflate; server_max_window_bits=\"15\"", offered),
+              "permessage-deflate; server_no_context_takeover");
+    EXPECT_TRUE(offered.permessage_deflate);
+    
+    WebSocketMessage message;
+    message.type = WebSocketMessageType::STATUS_UPDATE;
+    message.timestamp = std::chrono::system_clock::time_point(std::chrono::milliseconds(1000));
+    for (int i = 0; i < 200; i++) {
+        const std::string line = "{\"image\":\"slide" + std::to_string(i % 10) + ".jpg\",\"quality\":0.85}";
+        message.payload.insert(message.payload.end(), line.begin(), line.end());
+    }
+    const auto plain = WebSocketServer::EncodeFrame(message);
+    
+    WebSocketServer server;
+    ASSERT_TRUE(server.Start());
+    int fds[2][2];
+    for (int i = 0; i < 2; i++) {
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]), 0);
+        auto connection = std::make_shared<ClientConnection>();
+        connection->socket_fd = fds[i][0];
+        connection->permessage_deflate = i == 1;
+        server.AddClient("client" + std::to_string(i), connection);
+    }
+    server.BroadcastMessage(message);
+    
+    auto receive = [](int fd, size_t size) {
+        std::vector<uint8_t> data(size);
+        size_t received = 0;
+        while (received < size) {
+            ssize_t n = recv(fd, data.data() + received, size - received, 0);
+            if (n <= 0) {
+                break;
+            }
+            received += n;
+        }
+        data.resize(received);
+        return data;
+    };
+    EXPECT_EQ(receive(fds[0][1], plain->size()), *plain);
+    
+    // FIN, RSV1, binary; a short length
+    auto header = receive(fds[1][1], 2);
+    ASSERT_EQ(header.size(), 2u);
+    EXPECT_EQ(header[0], 0xC2);
+    size_t length = header[1];
+    if (length == 126) {
+        auto extended = receive(fds[1][1], 2);
+        length = (extended[0] << 8) | extended[1];
+    }
+    EXPECT_LT(length, plain->size() / 4);
+    auto compressed = receive(fds[1][1], length);
+    ASSERT_EQ(compressed.size(), length);
+    
+    compressed.insert(compressed.end(), {0x00, 0x00, 0xFF, 0xFF});
+    std::vector<uint8_t> inflated(plain->size());
+    z_stream stream = {};
+    ASSERT_EQ(inflateInit2(&stream, -MAX_WBITS), Z_OK);
+    stream.next_in = compressed.data();
+    stream.avail_in = compressed.size();
+    stream.next_out = inflated.data();
+    stream.avail_out = inflated.size();
+    EXPECT_NE(inflate(&stream, Z_SYNC_FLUSH), Z_STREAM_ERROR);
+    inflated.resize(inflated.size() - stream.avail_out);
+    inflateEnd(&stream);
+    EXPECT_EQ(inflated, std::vector<uint8_t>(plain->begin() + 4, plain->end()));
+    
+    auto stats = server.GetStatistics();
+    EXPECT_EQ(stats.frames_encoded, 1u);
+    EXPECT_EQ(stats.frames_deflated, 1u);
+    EXPECT_EQ(stats.bytes_saved, plain->size() - 2 - (length < 126 ? 0 : 2) - length);
+    
+    // short messages are not worth it
+    message.payload = {'h', 'i'};
+    EXPECT_EQ(WebSocketServer::DeflateFrame(*WebSocketServer::EncodeFrame(message)), nullptr);
+    
+    server.Stop();
+    for (int i = 0; i < 2; i++) {
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+}
+
+// Test the streaming JSON writer and the in-place reader
+TEST_F(APIInterfaceTest, JSONStreaming) {
+    std::string json;
+    JSONWriter writer(json);
+    writer.BeginObject();
+    writer.Key("text");
+    writer.String("a \"quoted\"\n\x01 line");
+    writer.Key("list");
+    writer.BeginArray();
+    writer.Int(-3);
+    writer.Double(0.5);
+    writer.Bool(true);
+    writer.Null();
+    writer.EndArray();
+    writer.Key("count");
+    writer.UInt(42);
+    writer.EndObject();
+    EXPECT_EQ(json, "{\"text\":\"a \\\"quoted\\\"\\n\\u0001 line\",\"list\":[-3,0.5,true,null],\"count\":42}");
+
+    JSONReader reader(json);
+    EXPECT_EQ(reader.Next(), JSONReader::Token::BEGIN_OBJECT);
+    EXPECT_EQ(reader.Next(), JSONReader::Token::KEY);
+    EXPECT_EQ(reader.Text(), "text");
+    EXPECT_FALSE(reader.IsEscaped());
+    EXPECT_EQ(reader.Next(), JSONReader::Token::STRING);
+    EXPECT_TRUE(reader.IsEscaped());
+    EXPECT_EQ(reader.String(), "a \"quoted\"\n\x01 line");
+    // the views point into the input
+    EXPECT_GE(reader.Text().data(), json.data());
+    EXPECT_LT(reader.Text().data(), json.data() + json.size());
+    EXPECT_EQ(reader.Next(), JSONReader::Token::KEY);
+    EXPECT_TRUE(reader.Skip());
+    EXPECT_EQ(reader.Next(), JSONReader::Token::KEY);
+    EXPECT_EQ(reader.Next(), JSONReader::Token::NUMBER);
+    EXPECT_EQ(reader.Number(), 42.0);
+    EXPECT_EQ(reader.Next(), JSONReader::Token::END_OBJECT);
+    EXPECT_EQ(reader.Next(), JSONReader::Token::END);
+
+    EXPECT_EQ(JSONReader::Unescape("\\u0e01\\ud83d\\ude00\\/"), "\xE0\xB8\x81\xF0\x9F\x98\x80/");
+
+    for (const char* invalid : {"{\"a\" 1}", "[1,]", "{\"a\":1,}", "[1 2]", "{\"a\":1", "\"open", "{} {}"}) {
+        JSONReader bad(invalid);
+        auto token = bad.Next();
+        while (token != JSONReader::Token::END && token != JSONReader::Token::INVALID) {
+            token = bad.Next();
+        }
+        EXPECT_EQ(token, JSONReader::Token::INVALID) << invalid;
+    }
+}
+
+// Test MessagePack: smallest encodings, reading in place, and the status round trip
+TEST_F(APIInterfaceTest, MessagePackStreaming) {
+    std::vector<uint8_t> packed;
+    MessagePackWriter writer(packed);
+    writer.BeginArray(7);
+    writer.UInt(5);
+    writer.Int(-5);
+    writer.Int(-200);
+    writer.UInt(70000);
+    writer.String("ok");
+    writer.Double(1.5);
+    writer.BeginObject(1);
+    writer.Key("k");
+    writer.Null();
+    const std::vector<uint8_t> expected = {0x97, 0x05, 0xFB, 0xD1, 0xFF, 0x38, 0xCE, 0x00, 0x01, 0x11, 0x70,
+                                           0xA2, 'o', 'k', 0xCB, 0x3F, 0xF8, 0, 0, 0, 0, 0, 0,
+                                           0x81, 0xA1, 'k', 0xC0};
+    EXPECT_EQ(packed, expected);
+
+    MessagePackReader reader(packed);
+    ASSERT_EQ(reader.Next(), MessagePackReader::Type::ARRAY);
+    EXPECT_EQ(reader.Size(), 7u);
+    ASSERT_EQ(reader.Next(), MessagePackReader::Type::INTEGER);
+    EXPECT_EQ(reader.Unsigned(), 5u);
+    ASSERT_EQ(reader.Next(), MessagePackReader::Type::INTEGER);
+    EXPECT_EQ(reader.Integer(), -5);
+    ASSERT_EQ(reader.Next(), MessagePackReader::Type::INTEGER);
+    EXPECT_EQ(reader.Integer(), -200);
+    ASSERT_EQ(reader.Next(), MessagePackReader::Type::INTEGER);
+    EXPECT_EQ(reader.Unsigned(), 70000u);
+    ASSERT_EQ(reader.Next(), MessagePackReader::Type::STRING);
+    EXPECT_EQ(reader.String(), "ok");
+    EXPECT_EQ((const void*) reader.String().data(), (const void*) (packed.data() + 12));
+    ASSERT_EQ(reader.Next(), MessagePackReader::Type::FLOAT);
+    EXPECT_EQ(reader.Float(), 1.5);
+    EXPECT_TRUE(reader.Skip());
+    EXPECT_EQ(reader.Next(), MessagePackReader::Type::END);
+
+    // numbers in the smallest exact encoding
+    std::vector<uint8_t> numbers;
+    MessagePackWriter number_writer(numbers);
+    number_writer.Number(1024.0);
+    number_writer.Number(45.5);
+    number_writer.Number(25.3);
+    const std::vector<uint8_t> expected_numbers = {0xCD, 0x04, 0x00, 0xCA, 0x42, 0x36, 0x00, 0x00,
+                                                   0xCB, 0x40, 0x39, 0x4C, 0xCC, 0xCC, 0xCC, 0xCC, 0xCD};
+    EXPECT_EQ(numbers, expected_numbers);
+    MessagePackReader number_reader(numbers);
+    ASSERT_EQ(number_reader.Next(), MessagePackReader::Type::INTEGER);
+    EXPECT_EQ(number_reader.Integer(), 1024);
+    ASSERT_EQ(number_reader.Next(), MessagePackReader::Type::FLOAT);
+    EXPECT_EQ(number_reader.Float(), 45.5);
+    ASSERT_EQ(number_reader.Next(), MessagePackReader::Type::FLOAT);
+    EXPECT_EQ(number_reader.Float(), 25.3);
+    
+    // truncated input
+    MessagePackReader truncated(packed.data(), 8);
+    EXPECT_TRUE(truncated.Next() == MessagePackReader::Type::ARRAY);
+    EXPECT_FALSE(truncated.Skip() && truncated.Skip() && truncated.Skip() && truncated.Skip());
+
+    SystemStatus status;
+    status.is_running = true;
+    status.started_at = std::chrono::system_clock::time_point(std::chrono::milliseconds(1700000000000));
+    status.total_requests = 1234567;
+    status.current_message = "สวัสดี";
+    status.average_image_quality = 0.75;
+    status.highest_priority = MessagePriority::EMERGENCY;
+    status.avg_response_time = std::chrono::microseconds(250);
+
+    auto unpacked = APIUtils::UnpackStatusUpdate(APIUtils::PackStatusUpdate(status));
+    EXPECT_TRUE(unpacked.is_running);
+    EXPECT_EQ(unpacked.started_at, status.started_at);
+    EXPECT_EQ(unpacked.total_requests, status.total_requests);
+    EXPECT_EQ(unpacked.current_message, status.current_message);
+    EXPECT_EQ(unpacked.average_image_quality, status.average_image_quality);
+    EXPECT_EQ(unpacked.highest_priority, status.highest_priority);
+    EXPECT_EQ(unpacked.avg_response_time, status.avg_response_time);
+
+    const std::string json = APIUtils::StatusToJSON(status);
+    JSONReader json_reader(json);
+    size_t members = 0;
+    EXPECT_EQ(json_reader.Next(), JSONReader::Token::BEGIN_OBJECT);
+    while (json_reader.Next() == JSONReader::Token::KEY) {
+        members++;
+        EXPECT_TRUE(json_reader.Skip());
+    }
+    EXPECT_EQ(members, 19u);
+    EXPECT_NE(json.find("\"total_requests\":1234567"), std::string::npos);
+}
+
+// Test versioned status: patches of changed fields, applied in order or from scratch
+TEST_F(APIInterfaceTest, StatusDeltaUpdates) {
+    SystemStatus status;
+    status.is_running = true;
+    status.total_requests = 10;
+    status.current_message = "first";
+
+    VersionedStatus versions;
+    EXPECT_TRUE(versions.Update(status));
+    EXPECT_FALSE(versions.Update(status));
+    EXPECT_EQ(versions.GetVersion(), 1u);
+
+    std::vector<uint8_t> full;
+    EXPECT_EQ(versions.Delta(0, full), 1u);
+
+    status.total_requests = 11;
+    EXPECT_TRUE(versions.Update(status));
+    std::vector<uint8_t> delta;
+    EXPECT_EQ(versions.Delta(1, delta), 2u);
+    EXPECT_LT(delta.size() * 4, full.size());
+
+    // only the changed field
+    MessagePackReader reader(delta);
+    ASSERT_EQ(reader.Next(), MessagePackReader::Type::MAP);
+    for (size_t entries = reader.Size(); entries > 0; entries--) {
+        ASSERT_EQ(reader.Next(), MessagePackReader::Type::STRING);
+        if (reader.String() == "fields") {
+            ASSERT_EQ(reader.Next(), MessagePackReader::Type::MAP);
+            EXPECT_EQ(reader.Size(), 1u);
+            ASSERT_EQ(reader.Next(), MessagePackReader::Type::STRING);
+            EXPECT_EQ(reader.String(), "total_requests");
+        }
+        EXPECT_TRUE(reader.Skip());
+    }
+
+    SystemStatus client;
+    uint64_t client_version = 0;
+    EXPECT_FALSE(APIUtils::ApplyStatusPatch(delta, client, client_version));
+    EXPECT_TRUE(APIUtils::ApplyStatusPatch(full, client, client_version));
+    EXPECT_EQ(client_version, 1u);
+    EXPECT_EQ(client.total_requests, 10u);
+    EXPECT_TRUE(APIUtils::ApplyStatusPatch(delta, client, client_version));
+    EXPECT_EQ(client_version, 2u);
+    EXPECT_EQ(client.total_requests, 11u);
+    EXPECT_EQ(client.current_message, "first");
+    EXPECT_TRUE(client.is_running);
+
+    // a version from the future gets all fields
+    std::vector<uint8_t> restart, current;
+    versions.Delta(100, restart);
+    versions.Delta(0, current);
+    EXPECT_EQ(restart, current);
+
+    // subscribers at the same version share one frame
+    WebSocketServer server;
+    int fds[3][2];
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]), 0);
+        auto connection = std::make_shared<ClientConnection>();
+        connection->socket_fd = fds[i][0];
+        server.AddClient("client" + std::to_string(i), connection);
+    }
+    server.SubscribeStatus("client0", 0, versions);
+    server.SubscribeStatus("client1", 1, versions);
+    server.SubscribeStatus("client2", 1, versions);
+    EXPECT_EQ(server.GetStatistics().frames_encoded, 3u);
+
+    status.current_message = "second";
+    versions.Update(status);
+    server.PublishStatus(versions);
+    server.PublishStatus(versions);
+    auto stats = server.GetStatistics();
+    EXPECT_EQ(stats.frames_encoded, 4u);
+    EXPECT_EQ(stats.frames_queued, 6u);
+
+    for (int i = 0; i < 3; i++) {
+        close(fds[i][0]);
+        close(fds[i][1]);
+    }
+}
+
+// Test image uploads: passed on in chunks, checked, hashed and moved into place
+TEST_F(APIInterfaceTest, StreamingImageUpload) {
+    const std::string directory = testing::TempDir() + "streamdab_upload_test";
+    std::filesystem::remove_all(directory);
+
+    // a PNG signature followed by 4 MB
+    std::string image = "\x89PNG\r\n\x1a\n";
+    image.resize(4 * 1024 * 1024 + 8, 'p');
+
+    // the format is known after a few chunks; the name is kept, not the path or extension
+    std::string direct_hash;
+    {
+        ImageUpload upload(directory, "../../etc/direct.jpg", 8 * 1024 * 1024);
+        const size_t chunks[] = {5, 1, 65536};
+        size_t pos = 0;
+        for (size_t i = 0; pos < image.size(); i++) {
+            const size_t len = std::min(chunks[std::min<size_t>(i, 2)], image.size() - pos);
+            ASSERT_TRUE(upload.Write((const uint8_t*) image.data() + pos, len));
+            pos += len;
+        }
+        EXPECT_EQ(upload.Finish().status_code, 201);
+        EXPECT_EQ(upload.GetPath(), directory + "/direct.png");
+        EXPECT_EQ(upload.GetMimeType(), "image/png");
+        EXPECT_EQ(upload.GetSize(), image.size());
+        direct_hash = upload.GetHash();
+        EXPECT_EQ(std::filesystem::file_size(upload.GetPath()), image.size());
+        std::filesystem::remove(upload.GetPath());
+    }
+
+    ImageUpload rejected(directory, "", 1024);
+    EXPECT_FALSE(rejected.Write((const uint8_t*) "GIF89a......", 12));
+    EXPECT_EQ(rejected.Finish().status_code, 415);
+
+    ImageUpload too_large(directory, "", 1024);
+    EXPECT_FALSE(too_large.Write((const uint8_t*) image.data(), 2048));
+    EXPECT_EQ(too_large.Finish().status_code, 413);
+
+    // over HTTP, with the body far beyond the size of a buffered request
+    APIConfig config = test_config_;
+    config.port = 0;
+    config.event_loops = 1;
+    config.max_request_size = 64 * 1024;
+    HTTPServer server(config);
+    size_t writes = 0;
+    std::string stored;
+    std::string hash;
+    APIEndpoint endpoint;
+    endpoint.path = "/images";
+    endpoint.method = "POST";
+    endpoint.max_body_size = 8 * 1024 * 1024;
+    endpoint.body_handler = [&](const std::map<std::string, std::string>& params) {
+        struct CountingUpload : public ImageUpload {
+            size_t& writes;
+            CountingUpload(const std::string& directory, const std::string& filename, size_t& writes,
+                           CompletionHandler on_complete)
+                : ImageUpload(directory, filename, 8 * 1024 * 1024, std::move(on_complete)), writes(writes) {}
+            bool Write(const uint8_t* data, size_t len) override {
+                writes++;
+                return ImageUpload::Write(data, len);
+            }
+        };
+        return std::make_unique<CountingUpload>(directory, params.at("filename"), writes, [&](const ImageUpload& upload) {
+            stored = upload.GetPath();
+            hash = upload.GetHash();
+            return APIUtils::CreateSuccessResponse("stored");
+        });
+    };
+    server.RegisterEndpoint(endpoint);
+    ASSERT_TRUE(server.Start());
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_NE(fd, -1);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(server.GetPort());
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(connect(fd, (sockaddr*) &addr, sizeof(addr)), 0);
+
+    const std::string request = "POST /images?filename=../slide.png HTTP/1.1\r\nContent-Length: " +
+                                std::to_string(image.size()) + "\r\n\r\n" + image +
+                                "POST /images?filename=bad HTTP/1.1\r\nContent-Length: 12\r\n\r\nGIF89a......";
+    std::thread sender([&]() {
+        size_t sent = 0;
+        while (sent < request.size()) {
+            ssize_t len = send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+            if (len <= 0) {
+                break;
+            }
+            sent += len;
+        }
+    });
+    std::string responses;
+    char buffer[4096];
+    ssize_t received;
+    while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        responses.append(buffer, received);
+    }
+    sender.join();
+    close(fd);
+    server.Stop();
+
+    EXPECT_NE(responses.find("\"message\":\"stored\""), std::string::npos);
+    EXPECT_NE(responses.find("HTTP/1.1 415"), std::string::npos);
+    EXPECT_EQ(stored, directory + "/slide.png");
+    EXPECT_EQ(hash, direct_hash);
+    EXPECT_GT(writes, 4u);
+    EXPECT_EQ(std::filesystem::file_size(stored), image.size());
+
+    // only the stored image is left
+    size_t files = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        EXPECT_EQ(entry.path().string(), stored);
+        files++;
+    }
+    EXPECT_EQ(files, 1u);
+    std::filesystem::remove_all(directory);
+}
+
+TEST_F(APIInterfaceTest, CachedGETResponses) {
+    APIConfig config = test_config_;
+    config.port = 0;
+    config.event_loops = 1;
+    HTTPServer server(config);
+    std::atomic<uint64_t> generation{1};
+    std::atomic<int> calls{0};
+    APIEndpoint endpoint;
+    endpoint.path = "/items";
+    endpoint.method = "GET";
+    endpoint.handler = [&](const std::map<std::string, std::string>&, const std::vector<uint8_t>&) {
+        calls++;
+        return APIUtils::CreateSuccessResponse("generation " + std::to_string(generation.load()));
+    };
+    endpoint.generation = [&]() { return generation.load(); };
+    server.RegisterEndpoint(endpoint);
+    ASSERT_TRUE(server.Start());
+
+    auto get = [&](const std::string& headers) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(server.GetPort());
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        std::string response;
+        if (connect(fd, (sockaddr*) &addr, sizeof(addr)) == 0) {
+            const std::string request = "GET /items HTTP/1.1\r\n" + headers + "Connection: close\r\n\r\n";
+            send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+            char buffer[4096];
+            ssize_t received;
+            while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+                response.append(buffer, received);
+            }
+        }
+        close(fd);
+        return response;
+    };
+    auto etag_of = [](const std::string& response) {
+        const size_t pos = response.find("ETag: ");
+        return pos == std::string::npos ? std::string() : response.substr(pos + 6, response.find("\r\n", pos) - pos - 6);
+    };
+
+    // the body is built once per generation
+    const std::string first = get("");
+    const std::string second = get("");
+    EXPECT_EQ(first.compare(0, 12, "HTTP/1.1 200"), 0);
+    EXPECT_EQ(calls, 1);
+    const std::string etag = etag_of(first);
+    ASSERT_FALSE(etag.empty());
+    EXPECT_EQ(etag_of(second), etag);
+    EXPECT_NE(second.find("generation 1"), std::string::npos);
+
+    // a client holding the current version gets no body
+    const std::string not_modified = get("If-None-Match: " + etag + "\r\n");
+    EXPECT_EQ(not_modified.compare(0, 12, "HTTP/1.1 304"), 0);
+    EXPECT_EQ(etag_of(not_modified), etag);
+    EXPECT_EQ(not_modified.find("generation"), std::string::npos);
+    EXPECT_EQ(calls, 1);
+
+    // a change invalidates both
+    generation++;
+    const std::string changed = get("If-None-Match: " + etag + "\r\n");
+    EXPECT_EQ(changed.compare(0, 12, "HTTP/1.1 200"), 0);
+    EXPECT_NE(changed.find("generation 2"), std::string::npos);
+    EXPECT_NE(etag_of(changed), etag);
+    EXPECT_EQ(calls, 2);
+
+    server.Stop();
+}
+
+TEST_F(APIInterfaceTest, MetricsEndpoint) {
+    // the registry is the process's, so counted on from earlier runs of the test
+    MetricCounter& scrapes = MetricsRegistry::Global().Counter("streamdab_test_scrapes", "Scrapes in the test");
+    scrapes.Add(3);
+    const std::string scrapes_line = "streamdab_test_scrapes_total " + std::to_string(scrapes.Value()) + "\n";
+
+    APIConfig config = test_config_;
+    config.port = 0;
+    config.event_loops = 1;
+    HTTPServer server(config);
+    ASSERT_TRUE(server.Start());
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_NE(fd, -1);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(server.GetPort());
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(connect(fd, (sockaddr*) &addr, sizeof(addr)), 0);
+    const std::string request = "GET /metrics HTTP/1.1\r\nConnection: close\r\n\r\n";
+    send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+    std::string response;
+    char buffer[4096];
+    ssize_t received;
+    while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        response.append(buffer, received);
+    }
+    close(fd);
+    server.Stop();
+
+    EXPECT_EQ(response.compare(0, 12, "HTTP/1.1 200"), 0);
+    EXPECT_NE(response.find(std::string("Content-Type: ") + MetricsRegistry::CONTENT_TYPE), std::string::npos);
+    EXPECT_NE(response.find(scrapes_line), std::string::npos);
+    EXPECT_EQ(response.substr(response.size() - 6), "# EOF\n");
+}
+
+// Test static files: pre-compressed variants, ETags, large files (sendfile) and hidden paths
+TEST_F(APIInterfaceTest, StaticFiles) {
+    const std::filesystem::path dir = std::filesystem::temp_directory_path() / "streamdab_static_test";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir / "css");
+    auto write = [&](const std::string& name, const std::string& content) {
+        std::ofstream(dir / name, std::ios::binary) << content;
+    };
+    write("index.html", "<h1>Dashboard</h1>");
+    write("index.html.gz", "gzipped");
+    write("css/app.css", "body{}");
+    write(".secret", "hidden");
+    const std::string large(StaticAssets::MAX_CACHED_FILE_SIZE + 12345, 'x');
+    write("large.js", large);
+
+    APIConfig config = test_config_;
+    config.port = 0;
+    config.event_loops = 1;
+    config.static_directory = dir.string();
+    HTTPServer server(config);
+    ASSERT_TRUE(server.Start());
+
+    auto request = [&](const std::string& text) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(server.GetPort());
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        EXPECT_EQ(connect(fd, (sockaddr*) &addr, sizeof(addr)), 0);
+        send(fd, text.data(), text.size(), MSG_NOSIGNAL);
+        std::string response;
+        char buffer[65536];
+        ssize_t received;
+        while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+            response.append(buffer, received);
+        }
+        close(fd);
+        return response;
+    };
+
+    std::string response = request("GET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+    EXPECT_EQ(response.compare(0, 12, "HTTP/1.1 200"), 0);
+    EXPECT_NE(response.find("Content-Type: text/html"), std::string::npos);
+    EXPECT_EQ(response.substr(response.size() - 18), "<h1>Dashboard</h1>");
+
+    response = request("GET /index.html HTTP/1.1\r\nAccept-Encoding: br, gzip\r\nConnection: close\r\n\r\n");
+    EXPECT_NE(response.find("Content-Encoding: gzip"), std::string::npos);
+    EXPECT_EQ(response.substr(response.size() - 7), "gzipped");
+    response = request("GET /index.html HTTP/1.1\r\nAccept-Encoding: gzip;q=0\r\nConnection: close\r\n\r\n");
+    EXPECT_EQ(response.find("Content-Encoding"), std::string::npos);
+
+    // revalidated by the ETag
+    response = request("GET /css/app.css HTTP/1.1\r\nConnection: close\r\n\r\n");
+    const size_t etag_start = response.find("ETag: ") + 6;
+    const std::string etag = response.substr(etag_start, response.find("\r\n", etag_start) - etag_start);
+    response = request("GET /css/app.css HTTP/1.1\r\nIf-None-Match: " + etag + "\r\nConnection: close\r\n\r\n");
+    EXPECT_EQ(response.compare(0, 12, "HTTP/1.1 304"), 0);
+
+    // a large file, pipelined between cached ones
+    response = request("GET /css/app.css HTTP/1.1\r\n\r\nGET /large.js HTTP/1.1\r\n\r\n"
+                       "GET /css/app.css HTTP/1.1\r\nConnection: close\r\n\r\n");
+    EXPECT_NE(response.find(large + "HTTP/1.1 200"), std::string::npos);
+    EXPECT_EQ(response.substr(response.size() - 6), "body{}");
+
+    EXPECT_EQ(request("GET /.secret HTTP/1.1\r\nConnection: close\r\n\r\n").compare(0, 12, "HTTP/1.1 404"), 0);
+    EXPECT_EQ(request("GET /css/../.secret HTTP/1.1\r\nConnection: close\r\n\r\n").compare(0, 12, "HTTP/1.1 404"), 0);
+
+    server.Stop();
+    std::filesystem::remove_all(dir);
+}
+
+TEST_F(APIInterfaceTest, SignedBearerTokens) {
+    APIConfig config = test_config_;
+    config.port = 0;
+    config.event_loops = 1;
+    config.enable_authentication = true;
+    config.api_key = "test_api_key_12345";
+    config.token_secret = "test_token_secret";
+    config.token_cache_size = 2;
+    HTTPServer server(config);
+    APIEndpoint endpoint;
+    endpoint.path = "/items";
+    endpoint.method = "GET";
+    endpoint.handler = [](const std::map<std::string, std::string>&, const std::vector<uint8_t>&) {
+        return APIUtils::CreateSuccessResponse("items");
+    };
+    server.RegisterEndpoint(endpoint);
+    ASSERT_TRUE(server.Start());
+
+    auto status = [&](const std::string& headers) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(server.GetPort());
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        std::string response;
+        if (connect(fd, (sockaddr*) &addr, sizeof(addr)) == 0) {
+            const std::string request = "GET /items HTTP/1.1\r\n" + headers + "Connection: close\r\n\r\n";
+            send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+            char buffer[4096];
+            ssize_t received;
+            while ((received = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+                response.append(buffer, received);
+            }
+        }
+        close(fd);
+        return response.substr(9, 3);
+    };
+
+    const auto now = std::chrono::system_clock::now();
+    const std::string token = server.IssueToken("automation", now + std::chrono::hours(1));
+    ASSERT_FALSE(token.empty());
+
+    // verified once, then taken from the cache
+    EXPECT_EQ(status("Authorization: Bearer " + token + "\r\n"), "200");
+    EXPECT_EQ(status("Authorization: Bearer " + token + "\r\n"), "200");
+    EXPECT_EQ(status("X-API-Key: test_api_key_12345\r\n"), "200");
+    EXPECT_EQ(status(""), "401");
+
+    // another subject or expiry under the cached signature, or a wrong signature
+    std::string forged = token;
+    forged.replace(0, 10, "monitoring");
+    EXPECT_EQ(status("Authorization: Bearer " + forged + "\r\n"), "401");
+    std::string tampered = token;
+    tampered.back() = tampered.back() == '0' ? '1' : '0';
+    EXPECT_EQ(status("Authorization: Bearer " + tampered + "\r\n"), "401");
+
+    // expired tokens, and tokens pushed out of the cache are verified again
+    EXPECT_EQ(status("Authorization: Bearer " + server.IssueToken("automation", now - std::chrono::seconds(1)) + "\r\n"), "401");
+    for (const char* subject : {"a", "b", "c"}) {
+        EXPECT_EQ(status("Authorization: Bearer " + server.IssueToken(subject, now + std::chrono::hours(1)) + "\r\n"), "200");
+    }
+    EXPECT_EQ(status("Authorization: Bearer " + token + "\r\n"), "200");
+
+    server.Stop();
+}
@@ -0,0 +1,628 @@
+/*
+    Google Test Suite - Content Manager Testing
+    Copyright (C) 2024 StreamDAB Project
+
+    Tests for content management:
+    - Binary content store layout
+    - Schedule windows compiled into activation intervals
+    - Timer heap and score-ordered ready sets
+    - Scheduler state persistence
+    - Change log for content synchronization
+    - Parallel content validation with cached verdicts
+    - Batched outbound event notifications
+*/
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "../src/content_manager.h"
+#include "../src/content_store.h"
+#include "../src/event_notifier.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <future>
+#include <thread>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace StreamDAB;
+using namespace testing;
+
+class ContentManagerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        now_ = std::chrono::system_clock::now();
+        store_path_ = "/tmp/test_content_store_" + std::to_string(getpid());
+    }
+
+    void TearDown() override {
+        unlink(store_path_.c_str());
+    }
+
+    std::shared_ptr<ContentItem> CreateItem(const std::string& id, ContentType type = ContentType::DLS_MESSAGE) {
+        auto item = std::make_shared<ContentItem>();
+        item->item_id = id;
+        item->type = type;
+        item->priority = SchedulePriority::NORMAL;
+        item->text_content = "Text of " + id;
+        item->created_at = now_;
+        item->schedule.start_time = now_;
+        item->schedule.end_time = now_ + std::chrono::hours{1};
+        return item;
+    }
+
+    // A local time; the tests use January dates, away from DST changes
+    static std::chrono::system_clock::time_point LocalTime(int year, int month, int day, int hour, int minute) {
+        std::tm tm{};
+        tm.tm_year = year - 1900;
+        tm.tm_mon = month - 1;
+        tm.tm_mday = day;
+        tm.tm_hour = hour;
+        tm.tm_min = minute;
+        tm.tm_isdst = -1;
+        return std::chrono::system_clock::from_time_t(std::mktime(&tm));
+    }
+
+    static ScheduleWindow DailyWindow(std::chrono::system_clock::time_point start, std::chrono::minutes duration) {
+        ScheduleWindow schedule;
+        schedule.start_time = start;
+        schedule.end_time = std::chrono::system_clock::time_point::max();
+        schedule.repeat_daily = true;
+        schedule.duration = duration;
+        return schedule;
+    }
+
+    std::chrono::system_clock::time_point now_;
+    std::string store_path_;
+};
+
+// Test that all fields of an item survive the binary layout
+TEST_F(ContentManagerTest, ContentStoreRoundTrip) {
+    auto item = CreateItem("news_1", ContentType::COMBINED);
+    item->priority = SchedulePriority::URGENT;
+    item->image_path = "/slides/news.jpg";
+    item->binary_data = {0xFF, 0xD8, 0x00, 0xFF, 0xD9};
+    item->metadata["artist"] = "Artist";
+    item->metadata["title"] = "Title";
+    item->is_thai_content = true;
+    item->thai_romanization = "sawatdi";
+    item->cultural_validation.contains_royal_references = true;
+    item->cultural_validation.warnings = {"first", "second"};
+    item->cultural_validation.cultural_sensitivity_score = 0.75;
+    item->schedule = ContentUtils::CreateWeeklySchedule({1, 3, 5}, 8, 30, 45);
+    item->schedule.max_repeats = 7;
+    item->schedule_count = 3;
+    item->is_active = false;
+    item->metrics.total_display_time = std::chrono::milliseconds{1234};
+    item->metrics.display_count = 5;
+    item->metrics.user_engagement = 0.5;
+    item->source_channel = "channel";
+    item->creator_id = "creator";
+
+    auto data = ContentUtils::SerializeContentItem(*item);
+    auto copy = ContentUtils::DeserializeContentItem(data);
+    ASSERT_NE(copy, nullptr);
+
+    EXPECT_EQ(copy->item_id, item->item_id);
+    EXPECT_EQ(copy->type, ContentType::COMBINED);
+    EXPECT_EQ(copy->priority, SchedulePriority::URGENT);
+    EXPECT_EQ(copy->text_content, item->text_content);
+    EXPECT_EQ(copy->image_path, item->image_path);
+    EXPECT_EQ(copy->binary_data, item->binary_data);
+    EXPECT_EQ(copy->metadata, item->metadata);
+    EXPECT_TRUE(copy->is_thai_content);
+    EXPECT_EQ(copy->thai_romanization, "sawatdi");
+    EXPECT_TRUE(copy->cultural_validation.is_appropriate);
+    EXPECT_TRUE(copy->cultural_validation.contains_royal_references);
+    EXPECT_EQ(copy->cultural_validation.warnings, item->cultural_validation.warnings);
+    EXPECT_DOUBLE_EQ(copy->cultural_validation.cultural_sensitivity_score, 0.75);
+    EXPECT_EQ(copy->schedule.start_time, item->schedule.start_time);
+    EXPECT_EQ(copy->schedule.end_time, std::chrono::system_clock::time_point::max());
+    EXPECT_TRUE(copy->schedule.repeat_weekly);
+    EXPECT_EQ(copy->schedule.days_of_week, item->schedule.days_of_week);
+    EXPECT_EQ(copy->schedule.duration, std::chrono::minutes{45});
+    EXPECT_EQ(copy->schedule.max_repeats, 7);
+    EXPECT_EQ(copy->schedule_count, 3);
+    EXPECT_FALSE(copy->is_active);
+    EXPECT_EQ(copy->created_at, item->created_at);
+    EXPECT_EQ(copy->metrics.total_display_time, std::chrono::milliseconds{1234});
+    EXPECT_EQ(copy->metrics.display_count, 5);
+    EXPECT_DOUBLE_EQ(copy->metrics.user_engagement, 0.5);
+    EXPECT_EQ(copy->source_channel, "channel");
+    EXPECT_EQ(copy->creator_id, "creator");
+}
+
+// Test reading items in place, and the lookup by ID
+TEST_F(ContentManagerTest, ContentStoreView) {
+    ContentStoreWriter writer;
+    for (int i = 99; i >= 0; i--) {
+        writer.Add(*CreateItem("item_" + std::to_string(i)));
+    }
+    auto data = writer.Finish();
+
+    ContentStoreView store;
+    ASSERT_TRUE(store.Open(data.data(), data.size()));
+    EXPECT_EQ(store.Size(), 100u);
+    EXPECT_EQ(store.Item(0).ItemId(), "item_0");
+
+    ContentItemView view = store.Find("item_42");
+    ASSERT_TRUE(view.Valid());
+    EXPECT_EQ(view.TextContent(), "Text of item_42");
+    EXPECT_EQ(view.StartTime(), now_);
+    // the text is referenced, not copied
+    EXPECT_GE(view.TextContent().data(), reinterpret_cast<const char*>(data.data()));
+    EXPECT_LT(view.TextContent().data(), reinterpret_cast<const char*>(data.data() + data.size()));
+
+    EXPECT_FALSE(store.Find("item_100").Valid());
+    EXPECT_FALSE(store.Find("").Valid());
+}
+
+// Test that damaged or foreign data is rejected, and bad references read as empty
+TEST_F(ContentManagerTest, ContentStoreValidation) {
+    ContentStoreWriter writer;
+    writer.Add(*CreateItem("item"));
+    auto data = writer.Finish();
+    ContentStoreView store;
+
+    auto wrong_magic = data;
+    wrong_magic[0] = 'X';
+    EXPECT_FALSE(store.Open(wrong_magic.data(), wrong_magic.size()));
+
+    auto wrong_version = data;
+    wrong_version[8] = 99;
+    EXPECT_FALSE(store.Open(wrong_version.data(), wrong_version.size()));
+
+    EXPECT_FALSE(store.Open(data.data(), data.size() - 1));
+    EXPECT_FALSE(store.Open(data.data(), 10));
+
+    // point the text reference beyond the end
+    ASSERT_TRUE(store.Open(data.data(), data.size()));
+    uint32_t index_offset = data[16] | data[17] << 8 | data[18] << 16 | data[19] << 24;
+    uint32_t record_offset = data[index_offset] | data[index_offset + 1] << 8 |
+                             data[index_offset + 2] << 16 | data[index_offset + 3] << 24;
+    data[record_offset + ContentItemView::F_TEXT_CONTENT + 3] = 0x7F;
+    ASSERT_TRUE(store.Open(data.data(), data.size()));
+    EXPECT_TRUE(store.Item(0).Valid());
+    EXPECT_EQ(store.Item(0).TextContent(), "");
+    EXPECT_EQ(store.Item(0).ItemId(), "item");
+}
+
+// Test that records with additional (newer) fields remain readable
+TEST_F(ContentManagerTest, ContentStoreExtendedRecord) {
+    ContentStoreWriter writer;
+    writer.Add(*CreateItem("item"));
+    auto data = writer.Finish();
+
+    uint32_t index_offset = data[16] | data[17] << 8 | data[18] << 16 | data[19] << 24;
+    uint32_t record_offset = data[index_offset] | data[index_offset + 1] << 8 |
+                             data[index_offset + 2] << 16 | data[index_offset + 3] << 24;
+    // a record claiming 4 more bytes (those of the index following it)
+    data[record_offset] = ContentItemView::RECORD_SIZE + 4;
+
+    ContentStoreView store;
+    ASSERT_TRUE(store.Open(data.data(), data.size()));
+    auto item = store.Item(0).ToItem();
+    ASSERT_NE(item, nullptr);
+    EXPECT_EQ(item->item_id, "item");
+    EXPECT_EQ(item->text_content, "Text of item");
+}
+
+// Test saving the scheduler's content, and loading it from the mapped file
+TEST_F(ContentManagerTest, SchedulerStatePersistence) {
+    ContentScheduler scheduler;
+    for (int i = 0; i < 10000; i++) {
+        scheduler.AddContent(CreateItem("item_" + std::to_string(i)));
+    }
+    ASSERT_TRUE(scheduler.SaveState(store_path_));
+
+    ContentScheduler restored;
+    ASSERT_TRUE(restored.LoadState(store_path_));
+    EXPECT_EQ(restored.GetStatistics().total_content_items, 10000u);
+    auto item = restored.GetContent("item_1234");
+    ASSERT_NE(item, nullptr);
+    EXPECT_EQ(item->text_content, "Text of item_1234");
+    EXPECT_EQ(restored.GetScheduledContent(now_ + std::chrono::minutes{1}).size(), 10000u);
+
+    // exchange between schedulers
+    ContentScheduler other;
+    auto exported = restored.ExportContent();
+    EXPECT_TRUE(other.ImportContent(exported.data(), exported.size()));
+    EXPECT_EQ(other.GetStatistics().total_content_items, 10000u);
+    EXPECT_FALSE(other.ImportContent(exported.data(), 8));
+
+    EXPECT_FALSE(restored.LoadState(store_path_ + ".missing"));
+}
+
+// Test that the change log holds each changed item once, in its latest state
+TEST_F(ContentManagerTest, ChangeLogCoalescing) {
+    ContentScheduler scheduler;
+    EXPECT_TRUE(scheduler.GetChangesSince(0).empty());
+
+    scheduler.AddContent(CreateItem("a"));
+    scheduler.AddContent(CreateItem("b"));
+    auto changes = scheduler.GetChangesSince(0);
+    ASSERT_EQ(changes.size(), 2u);
+    EXPECT_EQ(changes[0].item_id, "a");
+    EXPECT_EQ(changes[1].item_id, "b");
+    uint64_t synced = changes.back().version;
+    EXPECT_TRUE(scheduler.GetChangesSince(synced).empty());
+
+    // repeated updates of an item, and a removal
+    for (int i = 0; i < 5; i++) {
+        auto item = CreateItem("a");
+        item->text_content = "Update " + std::to_string(i);
+        EXPECT_TRUE(scheduler.UpdateContent(item));
+    }
+    scheduler.RemoveContent("b");
+    EXPECT_FALSE(scheduler.UpdateContent(CreateItem("c")));
+
+    changes = scheduler.GetChangesSince(synced);
+    ASSERT_EQ(changes.size(), 2u);
+    EXPECT_EQ(changes[0].item_id, "a");
+    ASSERT_NE(changes[0].item, nullptr);
+    EXPECT_EQ(changes[0].item->text_content, "Update 4");
+    EXPECT_EQ(changes[1].item_id, "b");
+    EXPECT_EQ(changes[1].item, nullptr);
+    EXPECT_LT(changes[0].version, changes[1].version);
+
+    // a later reader sees only the latest state as well
+    changes = scheduler.GetChangesSince(0);
+    EXPECT_EQ(changes.size(), 2u);
+}
+
+// Test that readers get immutable snapshots, replaced only when the content changes
+TEST_F(ContentManagerTest, ContentSnapshots) {
+    ContentScheduler scheduler;
+    auto empty = scheduler.GetSnapshot();
+    ASSERT_NE(empty, nullptr);
+    EXPECT_TRUE(empty->active_content.empty());
+    EXPECT_EQ(empty->mot_content, nullptr);
+
+    scheduler.AddContent(CreateItem("a"));
+    scheduler.AddContent(CreateItem("b", ContentType::MOT_SLIDESHOW));
+    auto snapshot = scheduler.GetSnapshot();
+    EXPECT_EQ(snapshot->active_content.size(), 2u);
+    EXPECT_GT(snapshot->version, empty->version);
+    EXPECT_TRUE(empty->active_content.empty());
+    EXPECT_EQ(scheduler.GetActiveContent().size(), 2u);
+
+    // a failed update publishes nothing
+    EXPECT_FALSE(scheduler.UpdateContent(CreateItem("c")));
+    EXPECT_EQ(scheduler.GetSnapshot(), snapshot);
+
+    scheduler.RemoveContent("a");
+    EXPECT_EQ(scheduler.GetSnapshot()->active_content.size(), 1u);
+    EXPECT_EQ(snapshot->active_content.size(), 2u);
+
+    // the scheduling thread publishes its selections
+    scheduler.Start();
+    for (int i = 0; i < 100 && !scheduler.GetCurrentMOTContent(); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    }
+    scheduler.Stop();
+    ASSERT_NE(scheduler.GetCurrentMOTContent(), nullptr);
+    EXPECT_EQ(scheduler.GetCurrentMOTContent()->item_id, "b");
+    EXPECT_EQ(scheduler.GetSnapshot()->mot_content, scheduler.GetCurrentMOTContent());
+}
+
+// Test that the statistics follow the running totals through changes
+TEST_F(ContentManagerTest, StatisticsTotals) {
+    ContentScheduler scheduler;
+    for (int i = 0; i < 10; i++) {
+        scheduler.AddContent(CreateItem("dls_" + std::to_string(i)));
+    }
+    auto slide = CreateItem("slide", ContentType::MOT_SLIDESHOW);
+    slide->priority = SchedulePriority::URGENT;
+    slide->metrics.display_count = 2;
+    slide->metrics.total_display_time = std::chrono::seconds{30};
+    slide->metrics.last_displayed = now_ - std::chrono::hours{1};
+    scheduler.AddContent(slide);
+    auto old = CreateItem("old");
+    old->is_active = false;
+    old->metrics.display_count = 1;
+    old->metrics.total_display_time = std::chrono::seconds{60};
+    old->metrics.last_displayed = now_ - std::chrono::hours{48};
+    scheduler.AddContent(old);
+
+    auto stats = scheduler.GetStatistics();
+    EXPECT_EQ(stats.total_content_items, 12u);
+    EXPECT_EQ(stats.active_content_items, 11u);
+    EXPECT_EQ(stats.scheduled_today, 1u);
+    EXPECT_EQ(stats.content_type_counts[ContentType::DLS_MESSAGE], 11u);
+    EXPECT_EQ(stats.content_type_counts[ContentType::MOT_SLIDESHOW], 1u);
+    EXPECT_EQ(stats.priority_distribution[SchedulePriority::URGENT], 1u);
+    EXPECT_DOUBLE_EQ(stats.average_display_duration, 30.0);
+
+    // an update replaces the item's share, a removal drops it
+    auto updated = CreateItem("slide");
+    scheduler.UpdateContent(updated);
+    scheduler.RemoveContent("old");
+    scheduler.RemoveContent("dls_0");
+    stats = scheduler.GetStatistics();
+    EXPECT_EQ(stats.total_content_items, 10u);
+    EXPECT_EQ(stats.active_content_items, 10u);
+    EXPECT_EQ(stats.scheduled_today, 0u);
+    EXPECT_EQ(stats.content_type_counts.count(ContentType::MOT_SLIDESHOW), 0u);
+    EXPECT_EQ(stats.priority_distribution.count(SchedulePriority::URGENT), 0u);
+    EXPECT_DOUBLE_EQ(stats.average_display_duration, 0.0);
+}
+
+// Test that a window past midnight is active into the next day
+TEST_F(ContentManagerTest, ScheduleWindowPastMidnight) {
+    // 2030-01-14 is a Monday
+    auto schedule = DailyWindow(LocalTime(2030, 1, 14, 23, 30), std::chrono::minutes{60});
+
+    auto activations = ContentUtils::GetActivations(schedule, LocalTime(2030, 1, 14, 12, 0), 2);
+    ASSERT_EQ(activations.size(), 2u);
+    EXPECT_EQ(activations[0], ContentUtils::Activation(LocalTime(2030, 1, 14, 23, 30), LocalTime(2030, 1, 15, 0, 30)));
+    EXPECT_EQ(activations[1], ContentUtils::Activation(LocalTime(2030, 1, 15, 23, 30), LocalTime(2030, 1, 16, 0, 30)));
+
+    // the activation of the previous day is still on after midnight
+    activations = ContentUtils::GetActivations(schedule, LocalTime(2030, 1, 15, 0, 15), 1);
+    ASSERT_EQ(activations.size(), 1u);
+    EXPECT_EQ(activations[0].first, LocalTime(2030, 1, 14, 23, 30));
+
+    // a weekly window belongs to the day it starts on
+    schedule.repeat_daily = false;
+    schedule.repeat_weekly = true;
+    schedule.days_of_week = {1};
+    activations = ContentUtils::GetActivations(schedule, LocalTime(2030, 1, 15, 0, 15), 2);
+    ASSERT_EQ(activations.size(), 2u);
+    EXPECT_EQ(activations[0], ContentUtils::Activation(LocalTime(2030, 1, 14, 23, 30), LocalTime(2030, 1, 15, 0, 30)));
+    EXPECT_EQ(activations[1], ContentUtils::Activation(LocalTime(2030, 1, 21, 23, 30), LocalTime(2030, 1, 22, 0, 30)));
+
+    // and so does the scheduler, from the window of today
+    ContentScheduler scheduler;
+    auto item = CreateItem("late");
+    item->schedule = ContentUtils::CreateDailySchedule(23, 30, 60);
+    scheduler.AddContent(item);
+
+    std::time_t now_t = std::chrono::system_clock::to_time_t(now_);
+    std::tm tomorrow;
+    localtime_r(&now_t, &tomorrow);
+    auto at = [&](int hour, int minute) {
+        return LocalTime(tomorrow.tm_year + 1900, tomorrow.tm_mon + 1, tomorrow.tm_mday + 1, hour, minute);
+    };
+    auto scheduled = scheduler.GetScheduledContent(at(0, 15));
+    ASSERT_EQ(scheduled.size(), 1u);
+    EXPECT_EQ(scheduled[0]->item_id, "late");
+    EXPECT_TRUE(scheduler.GetScheduledContent(at(0, 45)).empty());
+    EXPECT_EQ(scheduler.GetNextActivation(at(0, 15)), at(23, 30));
+}
+
+// Test the activations on either side of the day boundary
+TEST_F(ContentManagerTest, ScheduleWindowDayBoundary) {
+    // a window ending at midnight is still on at midnight (the end is inclusive)
+    auto schedule = DailyWindow(LocalTime(2030, 1, 14, 23, 0), std::chrono::minutes{60});
+    auto activations = ContentUtils::GetActivations(schedule, LocalTime(2030, 1, 14, 23, 59), 1);
+    ASSERT_EQ(activations.size(), 1u);
+    EXPECT_EQ(activations[0], ContentUtils::Activation(LocalTime(2030, 1, 14, 23, 0), LocalTime(2030, 1, 15, 0, 0)));
+
+    // but not after it
+    activations = ContentUtils::GetActivations(schedule, LocalTime(2030, 1, 15, 0, 0), 1);
+    ASSERT_EQ(activations.size(), 1u);
+    EXPECT_EQ(activations[0].first, LocalTime(2030, 1, 15, 23, 0));
+
+    // a window starting at midnight begins on the next day, and is found from its start
+    schedule = DailyWindow(LocalTime(2030, 1, 15, 0, 0), std::chrono::minutes{30});
+    activations = ContentUtils::GetActivations(schedule, LocalTime(2030, 1, 14, 23, 59), 1);
+    ASSERT_EQ(activations.size(), 1u);
+    EXPECT_EQ(activations[0], ContentUtils::Activation(LocalTime(2030, 1, 15, 0, 0), LocalTime(2030, 1, 15, 0, 30)));
+    activations = ContentUtils::GetActivations(schedule, LocalTime(2030, 1, 16, 0, 0), 1);
+    ASSERT_EQ(activations.size(), 1u);
+    EXPECT_EQ(activations[0].first, LocalTime(2030, 1, 16, 0, 0));
+
+    // the end time cuts the last activation short, and nothing follows it
+    schedule = DailyWindow(LocalTime(2030, 1, 14, 23, 30), std::chrono::minutes{60});
+    schedule.end_time = LocalTime(2030, 1, 16, 0, 0);
+    activations = ContentUtils::GetActivations(schedule, LocalTime(2030, 1, 14, 0, 0), 8);
+    ASSERT_EQ(activations.size(), 2u);
+    EXPECT_EQ(activations[1], ContentUtils::Activation(LocalTime(2030, 1, 15, 23, 30), LocalTime(2030, 1, 16, 0, 0)));
+}
+
+// Test overlapping windows, of different items and of one item
+TEST_F(ContentManagerTest, ScheduleWindowOverlap) {
+    ScheduleIntervalIndex index;
+    index.Insert({LocalTime(2030, 1, 14, 13, 0), LocalTime(2030, 1, 14, 14, 0), "c"});
+    index.Insert({LocalTime(2030, 1, 14, 10, 0), LocalTime(2030, 1, 14, 12, 0), "a"});
+    index.Insert({LocalTime(2030, 1, 14, 11, 0), LocalTime(2030, 1, 14, 12, 0), "b"});
+    EXPECT_THAT(index.Stab(LocalTime(2030, 1, 14, 10, 30)), ElementsAre("a"));
+    EXPECT_THAT(index.Stab(LocalTime(2030, 1, 14, 11, 30)), UnorderedElementsAre("a", "b"));
+    EXPECT_THAT(index.Stab(LocalTime(2030, 1, 14, 12, 0)), UnorderedElementsAre("a", "b"));
+    EXPECT_TRUE(index.Stab(LocalTime(2030, 1, 14, 12, 30)).empty());
+    EXPECT_EQ(index.NextStart(LocalTime(2030, 1, 14, 10, 30)), LocalTime(2030, 1, 14, 11, 0));
+    EXPECT_EQ(index.NextStart(LocalTime(2030, 1, 14, 11, 0)), LocalTime(2030, 1, 14, 13, 0));
+    EXPECT_EQ(index.NextStart(LocalTime(2030, 1, 14, 13, 0)), std::chrono::system_clock::time_point::max());
+
+    index.Remove("b", LocalTime(2030, 1, 14, 11, 0));
+    EXPECT_THAT(index.Stab(LocalTime(2030, 1, 14, 11, 30)), ElementsAre("a"));
+    index.RemoveItem("a");
+    EXPECT_EQ(index.Size(), 1u);
+
+    // a window longer than a day overlaps its next activation
+    auto schedule = DailyWindow(LocalTime(2030, 1, 14, 10, 0), std::chrono::minutes{25 * 60});
+    auto activations = ContentUtils::GetActivations(schedule, LocalTime(2030, 1, 15, 10, 30), 2);
+    ASSERT_EQ(activations.size(), 2u);
+    EXPECT_EQ(activations[0], ContentUtils::Activation(LocalTime(2030, 1, 14, 10, 0), LocalTime(2030, 1, 15, 11, 0)));
+    EXPECT_EQ(activations[1], ContentUtils::Activation(LocalTime(2030, 1, 15, 10, 0), LocalTime(2030, 1, 16, 11, 0)));
+
+    // the scheduler reports such an item once
+    ContentScheduler scheduler;
+    auto item = CreateItem("long");
+    item->schedule = DailyWindow(now_ - std::chrono::hours{1}, std::chrono::minutes{25 * 60});
+    scheduler.AddContent(item);
+    EXPECT_EQ(scheduler.GetScheduledContent(now_ + std::chrono::hours{23} + std::chrono::minutes{30}).size(), 1u);
+}
+
+// Test that the timer heap moves items in and out of the score-ordered ready set
+TEST_F(ContentManagerTest, ReadySetEvents) {
+    ContentScheduler scheduler;
+    auto low = CreateItem("low", ContentType::MOT_SLIDESHOW);
+    low->priority = SchedulePriority::LOW;
+    scheduler.AddContent(low);
+    auto urgent = CreateItem("urgent", ContentType::MOT_SLIDESHOW);
+    urgent->priority = SchedulePriority::URGENT;
+    urgent->schedule.start_time = std::chrono::system_clock::now() + std::chrono::milliseconds{300};
+    urgent->schedule.end_time = urgent->schedule.start_time + std::chrono::seconds{1};
+    scheduler.AddContent(urgent);
+
+    auto wait_for = [&](const std::string& item_id, std::chrono::milliseconds timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (std::chrono::steady_clock::now() < deadline) {
+            auto current = scheduler.GetCurrentMOTContent();
+            if (current && current->item_id == item_id) return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds{5});
+        }
+        return false;
+    };
+
+    scheduler.Start();
+    EXPECT_TRUE(wait_for("low", std::chrono::milliseconds{250}));
+    // the better scored item takes over when its window starts, and hands back when it ends
+    EXPECT_TRUE(wait_for("urgent", std::chrono::milliseconds{1250}));
+    EXPECT_TRUE(wait_for("low", std::chrono::seconds{3}));
+    scheduler.Stop();
+}
+
+// Test validation on the pool, and that verdicts are shared by identical content
+TEST_F(ContentManagerTest, ParallelValidation) {
+    ContentValidator validator;
+    auto item = CreateItem("a");
+    EXPECT_TRUE(validator.ValidateContentItem(*item).is_valid);
+
+    // the content verdict is reused, the schedule is still checked
+    auto same = CreateItem("b");
+    same->text_content = item->text_content;
+    same->schedule.end_time = now_ - std::chrono::hours{1};
+    auto result = validator.ValidateContentItem(*same);
+    EXPECT_TRUE(result.is_valid);
+    EXPECT_THAT(result.warnings, Contains("Schedule ends before it starts"));
+
+    auto image = CreateItem("image", ContentType::MOT_SLIDESHOW);
+    image->binary_data = {0x00, 0x01, 0x02, 0x03};
+    EXPECT_FALSE(validator.ValidateContentItem(*image).is_valid);
+    image->binary_data = {0xFF, 0xD8, 0xFF, 0xE0, 0xFF, 0xD9};
+    EXPECT_TRUE(validator.ValidateContentItem(*image).is_valid);
+
+    const int count = 200;
+    std::atomic<int> valid{0};
+    std::atomic<int> done{0};
+    std::promise<void> all_done;
+    for (int i = 0; i < count; i++) {
+        auto async_item = CreateItem("item_" + std::to_string(i));
+        async_item->text_content = "Text " + std::to_string(i % 10);
+        validator.ValidateContentItemAsync(async_item, [&](const ContentValidator::ValidationResult& r) {
+            if (r.is_valid) {
+                valid++;
+            }
+            if (++done == count) {
+                all_done.set_value();
+            }
+        });
+    }
+    ASSERT_EQ(all_done.get_future().wait_for(std::chrono::seconds{10}), std::future_status::ready);
+    EXPECT_EQ(valid, count);
+
+    // changed rules apply to content validated before
+    auto rules = validator.GetValidationRules();
+    rules.max_text_length = 4;
+    validator.UpdateValidationRules(rules);
+    EXPECT_FALSE(validator.ValidateContentItem(*item).is_valid);
+}
+
+// Test that events are posted in batches, on one connection
+TEST_F(ContentManagerTest, EventNotifierBatching) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_NE(listener, -1);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(listener, (sockaddr*) &addr, sizeof(addr)), 0);
+    socklen_t addr_len = sizeof(addr);
+    ASSERT_EQ(getsockname(listener, (sockaddr*) &addr, &addr_len), 0);
+    ASSERT_EQ(listen(listener, 4), 0);
+
+    // fails the first request, then accepts two on the same connection
+    std::vector<std::string> bodies;
+    int connections = 0;
+    std::thread server([&]() {
+        const char* responses[] = {
+            "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n",
+            "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok",
+            "HTTP/1.1 204 No Content\r\n\r\n",
+        };
+        int conn = accept(listener, nullptr, nullptr);
+        connections++;
+        std::string in;
+        for (const char* response : responses) {
+            size_t head_end;
+            char buffer[1024];
+            while ((head_end = in.find("\r\n\r\n")) == std::string::npos ||
+                   in.size() < head_end + 4 + strtoul(strstr(in.c_str(), "Content-Length: ") + 16, nullptr, 10)) {
+                ssize_t received = recv(conn, buffer, sizeof(buffer), 0);
+                if (received <= 0) {
+                    close(conn);
+                    return;
+                }
+                in.append(buffer, received);
+            }
+            size_t length = strtoul(strstr(in.c_str(), "Content-Length: ") + 16, nullptr, 10);
+            bodies.push_back(in.substr(head_end + 4, length));
+            in.erase(0, head_end + 4 + length);
+            send(conn, response, strlen(response), 0);
+        }
+        close(conn);
+    });
+
+    EventNotifier::Config config;
+    config.max_batch_events = 3;
+    config.max_batch_delay = std::chrono::milliseconds{50};
+    config.initial_backoff = std::chrono::milliseconds{10};
+    const std::string url = "http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) + "/events";
+    {
+        EventNotifier notifier(config);
+        EXPECT_FALSE(notifier.Post("https://example.com/events", "{}"));
+        for (int i = 0; i < 4; i++) {
+            EXPECT_TRUE(notifier.Post(url, "{\"n\":" + std::to_string(i) + "}"));
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (notifier.GetStatistics().events_sent < 4 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        auto stats = notifier.GetStatistics();
+        EXPECT_EQ(stats.events_posted, 4u);
+        EXPECT_EQ(stats.events_sent, 4u);
+        EXPECT_EQ(stats.events_dropped, 0u);
+        EXPECT_EQ(stats.requests, 3u);
+        EXPECT_EQ(stats.requests_failed, 1u);
+    }
+    server.join();
+    close(listener);
+
+    EXPECT_EQ(connections, 1);
+    EXPECT_THAT(bodies, ElementsAre("[{\"n\":0},{\"n\":1},{\"n\":2}]",
+                                    "[{\"n\":0},{\"n\":1},{\"n\":2}]",
+                                    "[{\"n\":3}]"));
+}
+
+// Test that an unreachable endpoint keeps its events within the memory budget
+TEST_F(ContentManagerTest, EventNotifierBudget) {
+    EventNotifier::Config config;
+    config.memory_budget = 100;
+    config.max_batch_delay = std::chrono::hours{1};
+    EventNotifier notifier(config);
+
+    EXPECT_FALSE(notifier.Post("http://127.0.0.1:1/", std::string(101, 'x')));
+    for (int i = 0; i < 20; i++) {
+        EXPECT_TRUE(notifier.Post("http://127.0.0.1:1/", "\"" + std::string(8, 'a' + i) + "\""));
+    }
+    auto stats = notifier.GetStatistics();
+    EXPECT_EQ(stats.events_posted, 20u);
+    EXPECT_EQ(stats.events_dropped, 10u);
+    EXPECT_EQ(stats.requests, 0u);
+}
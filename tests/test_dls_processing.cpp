@@ -13,8 +13,12 @@
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 #include "../src/smart_dls.h"
+#include "../src/text_pipeline.h"
 #include <chrono>
 #include <thread>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 using namespace StreamDAB;
 using namespace testing;
@@ -185,7 +189,7 @@ TEST_F(DLSProcessingTest, DuplicateDetection) {
     duplicate->source_id = "duplicate_001"; // Different ID but same content
     
     // Should be rejected as duplicate (based on content hash)
-    bool added = queue_->AddMessage(duplicate);
+    EXPECT_FALSE(queue_->AddMessage(duplicate));
     
     // Queue size should still be 1
     EXPECT_EQ(queue_->GetQueueSize(), 1);
@@ -221,6 +225,22 @@ TEST_F(DLSProcessingTest, AbbreviationRules) {
     EXPECT_NE(abbreviated.find("tonite"), std::string::npos);
 }
 
+// Test that overlapping rules are applied in one pass, longest match first
+TEST_F(DLSProcessingTest, SinglePassAbbreviation) {
+    EXPECT_EQ(optimizer_->ApplyAbbreviations("without", false), "w/o");
+    EXPECT_EQ(optimizer_->ApplyAbbreviations("with and without", false), "w/ & w/o");
+}
+
+// Test that the rules built on first use are there for a const optimizer and custom rules alike
+TEST_F(DLSProcessingTest, LazyRules) {
+    const MessageLengthOptimizer optimizer;
+    EXPECT_EQ(optimizer.GetReplacer(false).Apply("with and without"), "w/ & w/o");
+    
+    MessageLengthOptimizer custom;
+    custom.AddCustomRule({"weather", "wx", 1, false});
+    EXPECT_EQ(custom.ApplyAbbreviations("weather tonight", false), "wx tonite");
+}
+
 // Test whitespace compression
 TEST_F(DLSProcessingTest, WhitespaceCompression) {
     std::string test_text = "Hello    world   \t\n  test  ";
@@ -244,6 +264,79 @@ TEST_F(DLSProcessingTest, SmartTruncation) {
     }
 }
 
+// Test the buffer variants: repeated words, and cuts between code points only
+TEST_F(DLSProcessingTest, BufferedOptimizerPrimitives) {
+    std::string out("previous content");
+    MessageLengthOptimizer::RemoveRedundancy(std::string_view("  news news\tflash  flash news "), out);
+    EXPECT_EQ(out, "news flash news");
+    EXPECT_EQ(optimizer_->RemoveRedundancy("a a b"), "a b");
+    MessageLengthOptimizer::RemoveRedundancy(std::string_view(" \n "), out);
+    EXPECT_TRUE(out.empty());
+    
+    // Thai characters of 3 bytes each, without a word boundary to break at
+    std::string thai;
+    for (int i = 0; i < 20; i++) {
+        thai += "\xE0\xB8\xAA";
+    }
+    for (size_t max_length = 4; max_length < 40; max_length++) {
+        MessageLengthOptimizer::SmartTruncate(thai, max_length, out);
+        ASSERT_LE(out.size(), max_length);
+        ASSERT_EQ(out.compare(out.size() - 3, 3, "..."), 0);
+        EXPECT_EQ((out.size() - 3) % 3, 0u) << "max length " << max_length;
+    }
+    MessageLengthOptimizer::SmartTruncate(std::string_view("short"), 30, out);
+    EXPECT_EQ(out, "short");
+}
+
+// Test the text pipeline from UTF-8 to label bytes
+TEST_F(DLSProcessingTest, TextPipeline) {
+    DLSTextPipeline pipeline(optimizer_.get());
+    
+    // sanitised, transliterated and in EBU Latin
+    auto label = pipeline.Process("  \u201CGr\u00FC\u00DFe\u201D\u200B \u2013\tBand\x01  ");
+    EXPECT_EQ(label.charset, DABCharset::COMPLETE_EBU_LATIN);
+    EXPECT_EQ(label.text, CharsetConverter().convert("\"Grüße\" - Band"));
+    EXPECT_FALSE(label.shortened);
+    EXPECT_FALSE(label.truncated);
+    
+    // Thai as UTF-8, unless not allowed
+    label = pipeline.Process(thai_message_);
+    EXPECT_EQ(label.charset, DABCharset::UTF8);
+    EXPECT_EQ(label.text, thai_message_);
+    DLSTextPipeline::Options options;
+    options.allow_utf8 = false;
+    label = pipeline.Process("Now Playing: สวัสดี", options);
+    EXPECT_EQ(label.charset, DABCharset::COMPLETE_EBU_LATIN);
+    EXPECT_EQ(label.text, "Now Playing:       ");
+    
+    // shortened by the rules, then cut at a word within the encoded length
+    options = DLSTextPipeline::Options();
+    options.max_length = 30;
+    label = pipeline.Process("Traffic information and weather tonight", options);
+    EXPECT_EQ(label.text, "Traffic info & weather tonite");
+    EXPECT_TRUE(label.shortened);
+    EXPECT_FALSE(label.truncated);
+    label = pipeline.Process(long_message_, options);
+    EXPECT_EQ(label.text, "This is a very long message...");
+    EXPECT_TRUE(label.truncated);
+    options.max_length = 20;
+    label = pipeline.Process(thai_message_, options);
+    EXPECT_LE(label.text.size(), 20);
+    EXPECT_EQ(label.text, "สวัส...");    // not before the vowel of ดี
+    
+    // a batch shares the arena
+    const auto& labels = pipeline.ProcessBatch(std::vector<FeedItem>{{"1", "News news"}, {"2", ""}, {"3", "Sport"}}, DLSTextPipeline::Options());
+    ASSERT_EQ(labels.size(), 3);
+    EXPECT_EQ(labels[0].text, "News news");
+    EXPECT_EQ(labels[1].text, "");
+    EXPECT_EQ(labels[2].text, "Sport");
+    EXPECT_EQ(labels[0].text.data() + labels[0].text.size(), labels[2].text.data());
+    
+    DL_PARAMS dl_params = DLSTextPipeline::EncoderParams(labels[2], DL_PARAMS());
+    EXPECT_TRUE(dl_params.raw_dls);
+    EXPECT_EQ(dl_params.charset, DABCharset::COMPLETE_EBU_LATIN);
+}
+
 // Test context-aware selection
 TEST_F(DLSProcessingTest, ContextAwareSelection) {
     selector_->SetCurrentContext(MessageContext::NEWS);
@@ -277,6 +370,40 @@ TEST_F(DLSProcessingTest, ScoringFunctions) {
     EXPECT_GT(score1, score2);
 }
 
+// Test that a scorer functor scores each eligible message once per epoch
+TEST_F(DLSProcessingTest, CachedScoring) {
+    struct CountingScorer {
+        int* calls;
+        double operator()(const DLSMessage& message) const {
+            (*calls)++;
+            return message.importance_score;
+        }
+    };
+    int calls = 0;
+    CountingScorer scorer{&calls};
+    
+    EXPECT_TRUE(queue_->AddMessage(high_priority_msg_));
+    EXPECT_TRUE(queue_->AddMessage(normal_priority_msg_));
+    EXPECT_TRUE(queue_->AddMessage(low_priority_msg_));
+    
+    SelectionCriteria criteria;
+    criteria.min_repeat_interval = std::chrono::seconds{0};
+    auto message = queue_->GetNextMessage(criteria, scorer);
+    ASSERT_NE(message, nullptr);
+    EXPECT_EQ(message->source_id, "high_001");
+    EXPECT_EQ(calls, 3);
+    
+    // Only the sent message is scored anew
+    message = queue_->GetNextMessage(criteria, scorer);
+    ASSERT_NE(message, nullptr);
+    EXPECT_EQ(message->source_id, "high_001");
+    EXPECT_EQ(calls, 4);
+    
+    queue_->InvalidateScores();
+    queue_->GetNextMessage(criteria, scorer);
+    EXPECT_EQ(calls, 7);
+}
+
 // Test queue statistics
 TEST_F(DLSProcessingTest, QueueStatistics) {
     // Add various messages
@@ -292,6 +419,33 @@ TEST_F(DLSProcessingTest, QueueStatistics) {
     EXPECT_GT(stats.average_importance, 0.0);
 }
 
+// Test that the statistics follow adding, sending and removing messages
+TEST_F(DLSProcessingTest, IncrementalStatistics) {
+    EXPECT_TRUE(queue_->AddMessage(high_priority_msg_));
+    EXPECT_TRUE(queue_->AddMessage(normal_priority_msg_));
+    EXPECT_TRUE(queue_->AddMessage(low_priority_msg_));
+    
+    SelectionCriteria criteria;
+    ASSERT_NE(queue_->GetNextMessage(criteria), nullptr);
+    EXPECT_TRUE(queue_->RemoveMessage("low_001"));
+    
+    auto stats = queue_->GetStatistics();
+    EXPECT_EQ(stats.total_messages, 3);
+    EXPECT_EQ(stats.sent_messages, 1);
+    EXPECT_EQ(stats.priority_counts.count(MessagePriority::LOW), 0);
+    EXPECT_EQ(stats.priority_counts[MessagePriority::HIGH], 1);
+    EXPECT_EQ(stats.source_counts[ContentSource::METADATA_EXTRACTOR], 1);
+    EXPECT_NEAR(stats.average_importance, 0.7, 1e-6);
+    EXPECT_EQ(stats.oldest_message, high_priority_msg_->created_at);
+    EXPECT_EQ(stats.newest_message, normal_priority_msg_->created_at);
+    EXPECT_EQ(queue_->GetQueueSize(), 2);
+    
+    queue_->ClearQueue();
+    stats = queue_->GetStatistics();
+    EXPECT_TRUE(stats.priority_counts.empty());
+    EXPECT_EQ(stats.average_importance, 0.0);
+}
+
 // Test DLS processor integration
 TEST_F(DLSProcessingTest, DLSProcessorIntegration) {
     EXPECT_TRUE(processor_->AddMessage(short_message_));
@@ -346,6 +500,30 @@ TEST_F(DLSProcessingTest, MessageRepeatConstraints) {
     EXPECT_EQ(message, nullptr); // No other messages available
 }
 
+// Test selection restricted to some sources
+TEST_F(DLSProcessingTest, SourceFilteredSelection) {
+    EXPECT_TRUE(queue_->AddMessage(high_priority_msg_));    // MANUAL
+    EXPECT_TRUE(queue_->AddMessage(normal_priority_msg_));  // METADATA_EXTRACTOR
+    EXPECT_TRUE(queue_->AddMessage(low_priority_msg_));     // RSS_FEED
+    EXPECT_EQ(queue_->GetMessageCount(MessagePriority::NORMAL), 1);
+    
+    SelectionCriteria criteria;
+    criteria.blocked_sources = {ContentSource::MANUAL};
+    auto message = queue_->GetNextMessage(criteria);
+    ASSERT_NE(message, nullptr);
+    EXPECT_EQ(message->source_id, "normal_001");
+    
+    criteria.blocked_sources.clear();
+    criteria.allowed_sources = {ContentSource::RSS_FEED};
+    message = queue_->GetNextMessage(criteria);
+    ASSERT_NE(message, nullptr);
+    EXPECT_EQ(message->source_id, "low_001");
+    
+    EXPECT_TRUE(queue_->RemoveMessage("low_001"));
+    EXPECT_EQ(queue_->GetNextMessage(criteria), nullptr);
+    EXPECT_EQ(queue_->GetQueueSize(), 2);
+}
+
 // Test max sends limit
 TEST_F(DLSProcessingTest, MaxSendsLimit) {
     emergency_msg_->max_sends = 2;
@@ -413,6 +591,307 @@ TEST_F(DLSProcessingTest, QueueCleanup) {
     EXPECT_LT(queue_->GetQueueSize(), initial_size);
 }
 
+// Test that the timer wheel hands out items once due, also far ahead and overdue ones
+TEST_F(DLSProcessingTest, TimerWheelExpiry) {
+    auto start = std::chrono::system_clock::now();
+    TimerWheel<int> wheel(start);
+    wheel.Schedule(start + std::chrono::seconds(30), 1);
+    wheel.Schedule(start + std::chrono::hours(3), 2);
+    wheel.Schedule(start + std::chrono::hours(24 * 400), 3);
+    wheel.Schedule(start - std::chrono::seconds(10), 4);
+    EXPECT_EQ(wheel.Size(), 4);
+    
+    std::vector<int> due;
+    wheel.Advance(start, due);
+    EXPECT_THAT(due, ElementsAre(4));
+    
+    wheel.Advance(start + std::chrono::seconds(29), due);
+    EXPECT_THAT(due, ElementsAre(4));
+    wheel.Advance(start + std::chrono::seconds(31), due);
+    EXPECT_THAT(due, ElementsAre(4, 1));
+    
+    wheel.Advance(start + std::chrono::hours(3) - std::chrono::seconds(2), due);
+    EXPECT_EQ(due.size(), 2);
+    wheel.Advance(start + std::chrono::hours(3) + std::chrono::seconds(1), due);
+    EXPECT_THAT(due, ElementsAre(4, 1, 2));
+    
+    wheel.Advance(start + std::chrono::hours(24 * 400) + std::chrono::seconds(1), due);
+    EXPECT_THAT(due, ElementsAre(4, 1, 2, 3));
+    EXPECT_EQ(wheel.Size(), 0);
+}
+
+// Test that the timer wheel tells when to advance it next
+TEST_F(DLSProcessingTest, TimerWheelNextDue) {
+    auto start = std::chrono::system_clock::now();
+    TimerWheel<int> wheel(start);
+    std::chrono::system_clock::time_point due;
+    EXPECT_FALSE(wheel.NextDue(due));
+    
+    wheel.Schedule(start + std::chrono::hours(3), 1);
+    ASSERT_TRUE(wheel.NextDue(due));
+    EXPECT_LE(due, start + std::chrono::hours(3));
+    EXPECT_GT(due, start);
+    
+    wheel.Schedule(start + std::chrono::seconds(10), 2);
+    ASSERT_TRUE(wheel.NextDue(due));
+    EXPECT_GE(due, start + std::chrono::seconds(10));
+    EXPECT_LE(due, start + std::chrono::seconds(11));
+    
+    // advancing to each next due time hands out all items, in time
+    std::vector<int> items;
+    while (wheel.NextDue(due)) {
+        wheel.Advance(due, items);
+    }
+    EXPECT_THAT(items, ElementsAre(2, 1));
+}
+
+// Test that the background processing stops without waiting for its next cleanup
+TEST_F(DLSProcessingTest, BackgroundProcessingStop) {
+    processor_->Start();
+    EXPECT_TRUE(processor_->AddMessage("Background message"));
+    processor_->GetNextDLSText();
+    
+    auto start = std::chrono::steady_clock::now();
+    processor_->Stop();
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+}
+
+// Test that the flat hash map keeps all keys across growing and erasing
+TEST_F(DLSProcessingTest, FlatHashMapOperations) {
+    FlatHashMap<int> map;
+    for (int i = 0; i < 1000; i++) {
+        map.Set("key" + std::to_string(i), i);
+    }
+    EXPECT_EQ(map.Size(), 1000);
+    map.Set("key7", 70);
+    EXPECT_EQ(map.Size(), 1000);
+    
+    for (int i = 0; i < 1000; i += 2) {
+        EXPECT_TRUE(map.Erase("key" + std::to_string(i)));
+    }
+    EXPECT_FALSE(map.Erase("key0"));
+    EXPECT_EQ(map.Size(), 500);
+    
+    for (int i = 0; i < 1000; i++) {
+        const int* value = map.Find("key" + std::to_string(i));
+        if (i % 2) {
+            ASSERT_NE(value, nullptr);
+            EXPECT_EQ(*value, i == 7 ? 70 : i);
+        } else {
+            EXPECT_EQ(value, nullptr);
+        }
+    }
+    
+    map.Clear();
+    EXPECT_TRUE(map.Empty());
+    EXPECT_EQ(map.Find("key1"), nullptr);
+}
+
+// Test the compiled criteria: source masks and the table of the contexts
+TEST_F(DLSProcessingTest, CompiledCriteria) {
+    SelectionCriteria criteria;
+    EXPECT_TRUE(CompiledCriteria(criteria).SourceAllowed(ContentSource::RSS_FEED));
+    criteria.allowed_sources = {ContentSource::RSS_FEED, ContentSource::NEWS_API};
+    criteria.blocked_sources = {ContentSource::NEWS_API};
+    CompiledCriteria compiled(criteria, {ContentSource::RSS_FEED, ContentSource::MANUAL});
+    EXPECT_TRUE(compiled.SourceAllowed(ContentSource::RSS_FEED));
+    EXPECT_FALSE(compiled.SourceAllowed(ContentSource::NEWS_API));
+    EXPECT_FALSE(compiled.SourceAllowed(ContentSource::MANUAL));
+    EXPECT_DOUBLE_EQ(compiled.source_bonus[static_cast<size_t>(ContentSource::RSS_FEED)], 0.2);
+    EXPECT_DOUBLE_EQ(compiled.source_bonus[static_cast<size_t>(ContentSource::MANUAL)], 0.1);
+    
+    // a context switch selects the context's entry
+    selector_->SetCurrentContext(MessageContext::NEWS);
+    EXPECT_EQ(selector_->GetCurrentCriteria().criteria.min_priority, MessagePriority::HIGH);
+    EXPECT_GT(selector_->GetCurrentCriteria().source_bonus[static_cast<size_t>(ContentSource::NEWS_API)], 0.0);
+    selector_->SetContextCriteria(MessageContext::NEWS, criteria);
+    EXPECT_FALSE(selector_->GetCurrentCriteria().SourceAllowed(ContentSource::NEWS_API));
+    EXPECT_GT(selector_->GetCurrentCriteria().source_bonus[static_cast<size_t>(ContentSource::NEWS_API)], 0.0);
+    selector_->SetCurrentContext(MessageContext::MUSIC);
+    EXPECT_TRUE(selector_->GetCurrentCriteria().SourceAllowed(ContentSource::NEWS_API));
+    
+    // the queue selects by the compiled mask (a manual message)
+    queue_->AddMessage(high_priority_msg_);
+    EXPECT_EQ(queue_->GetNextMessage(compiled, ContextAwareSelector::DefaultScoringFunction), nullptr);
+    EXPECT_EQ(queue_->GetNextMessage(CompiledCriteria(), ContextAwareSelector::DefaultScoringFunction), high_priority_msg_);
+}
+
+// Test the compact message layout: interned metadata keys, pooled messages
+TEST_F(DLSProcessingTest, CompactMessages) {
+    EXPECT_EQ(InternedString("title"), InternedString(std::string("title")));
+    EXPECT_EQ(&InternedString("title").str(), &InternedString("title").str());
+    EXPECT_NE(InternedString("title"), InternedString("artist"));
+    
+    MessageMetadata metadata(std::map<std::string, std::string>{{"artist", "A"}, {"title", "T"}});
+    EXPECT_EQ(metadata.size(), 2u);
+    ASSERT_NE(metadata.find("title"), metadata.end());
+    EXPECT_EQ(metadata.find("title")->second, "T");
+    EXPECT_EQ(metadata.find("album"), metadata.end());
+    metadata["album"] = "B";
+    metadata["title"] = "U";
+    EXPECT_EQ(metadata.size(), 3u);
+    EXPECT_EQ(metadata.find("title")->second, "U");
+    
+    // a released message's block is reused by the next one
+    const DLSMessage* first = nullptr;
+    {
+        auto message = DLSMessage::Create();
+        message->text = "Pooled";
+        first = message.get();
+    }
+    EXPECT_GT(DLSMessagePool::FreeBlocks(), 0u);
+    auto message = DLSMessage::Create();
+    EXPECT_EQ(message.get(), first);
+    EXPECT_TRUE(message->text.empty());
+    
+    // duplicates are found by the 64-bit content hash
+    message->text = "Compact";
+    EXPECT_TRUE(queue_->AddMessage(message));
+    EXPECT_NE(message->content_hash, 0u);
+    auto duplicate = DLSMessage::Create();
+    duplicate->text = "Compact";
+    duplicate->source_id = "duplicate";
+    EXPECT_FALSE(queue_->AddMessage(duplicate));
+}
+
+// Test that the next message is handed to the encoder as a DL state with DL Plus tags
+TEST_F(DLSProcessingTest, EncodeNextLabel) {
+    PADPacketizer packetizer(58);
+    PADPacketizer expected_packetizer(58);
+    DLSEncoder dls_encoder(&packetizer);
+    DLSEncoder expected_encoder(&expected_packetizer);
+    auto drain = [](PADPacketizer& p) {
+        std::vector<uint8_t> result;
+        while (p.QueueFilled()) {
+            std::vector<uint8_t> pad = p.GetNextPAD(true);
+            result.insert(result.end(), pad.begin(), pad.end());
+        }
+        return result;
+    };
+    
+    EXPECT_FALSE(processor_->EncodeNextLabel(DL_PARAMS()));
+    processor_->IntegrateWithLegacyDLS(dls_encoder);
+    EXPECT_FALSE(processor_->EncodeNextLabel(DL_PARAMS()));
+    
+    EXPECT_TRUE(processor_->AddMessage("Grüße by Band", MessagePriority::NORMAL, ContentSource::METADATA_EXTRACTOR,
+                                       {{"title", "Grüße"}, {"artist", "Band"}}));
+    EXPECT_TRUE(processor_->EncodeNextLabel(DL_PARAMS()));
+    
+    DL_STATE expected;
+    expected.dl_text = "Grüße by Band";
+    expected.dl_plus_enabled = true;
+    expected.dl_plus_item_running = true;
+    expected.dl_plus_tags = {DL_PLUS_TAG(1, 0, 4), DL_PLUS_TAG(4, 9, 3)};
+    expected_encoder.encodeLabel(expected, DL_PARAMS());
+    EXPECT_EQ(drain(packetizer), drain(expected_packetizer));
+}
+
+// Test that the feed parsers extract items from input split at any point
+TEST_F(DLSProcessingTest, FeedParsers) {
+    const std::string rss =
+        "<?xml version=\"1.0\"?><rss><channel><title>Station</title>"
+        "<item><title>News &amp; Weather</title><guid>n1</guid></item>"
+        "<!-- <item><title>Hidden</title></item> -->"
+        "<item><title><![CDATA[Traffic <A1> ]]]></title><link>http://x/2</link></item>"
+        "</channel></rss>";
+    const std::string json = "{\"list\": [{\"description\": \"Sunny \\u0e2a\", \"id\": 1}, {\"description\": \"Rain\"}]}";
+    
+    for (size_t split = 0; split <= rss.size(); split++) {
+        XMLFeedParser parser;
+        std::vector<FeedItem> items;
+        auto handler = [&items](FeedItem&& item) { items.push_back(std::move(item)); };
+        parser.Parse(rss.data(), split, handler);
+        parser.Parse(rss.data() + split, rss.size() - split, handler);
+        ASSERT_EQ(items.size(), 2);
+        EXPECT_EQ(items[0].text, "News & Weather");
+        EXPECT_EQ(items[0].id, "n1");
+        EXPECT_EQ(items[1].text, "Traffic <A1> ]");
+        EXPECT_EQ(items[1].id, "http://x/2");
+    }
+    
+    for (size_t split = 0; split <= json.size(); split++) {
+        JSONFeedParser parser("description");
+        std::vector<std::string> texts;
+        auto handler = [&texts](FeedItem&& item) { texts.push_back(item.text); };
+        parser.Parse(json.data(), split, handler);
+        parser.Parse(json.data() + split, json.size() - split, handler);
+        EXPECT_THAT(texts, ElementsAre("Sunny \xe0\xb8\xaa", "Rain"));
+    }
+}
+
+// Test that the feed fetcher polls conditionally, on one connection, handing out new items only
+TEST_F(DLSProcessingTest, FeedFetcherConditionalGet) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_NE(listener, -1);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(listener, (sockaddr*) &addr, sizeof(addr)), 0);
+    socklen_t addr_len = sizeof(addr);
+    ASSERT_EQ(getsockname(listener, (sockaddr*) &addr, &addr_len), 0);
+    ASSERT_EQ(listen(listener, 4), 0);
+    
+    // answers three requests on a single connection: two feed versions, then 304
+    std::vector<std::string> requests;
+    std::thread server([&]() {
+        int conn = accept(listener, nullptr, nullptr);
+        const char* responses[] = {
+            "HTTP/1.1 200 OK\r\nETag: \"v1\"\r\nContent-Length: 58\r\n\r\n"
+            "<rss><item><title>One</title><guid>1</guid></item></rss>\r\n",
+            "HTTP/1.1 200 OK\r\nETag: \"v2\"\r\nTransfer-Encoding: chunked\r\n\r\n"
+            "1f\r\n<rss><item><title>Two</title><g\r\n"
+            "40\r\nuid>2</guid></item><item><title>One</title><guid>1</guid></item>\r\n"
+            "6\r\n</rss>\r\n0\r\n\r\n",
+            "HTTP/1.1 304 Not Modified\r\nETag: \"v2\"\r\n\r\n",
+        };
+        for (const char* response : responses) {
+            std::string request;
+            char buffer[1024];
+            while (request.find("\r\n\r\n") == std::string::npos) {
+                ssize_t received = recv(conn, buffer, sizeof(buffer), 0);
+                if (received <= 0) {
+                    close(conn);
+                    return;
+                }
+                request.append(buffer, received);
+            }
+            requests.push_back(request);
+            send(conn, response, strlen(response), 0);
+        }
+        close(conn);
+    });
+    
+    std::mutex items_mutex;
+    std::vector<std::string> items;
+    FeedFetcher fetcher;
+    ASSERT_FALSE(fetcher.AddFeed("https://example.com/feed", std::make_unique<XMLFeedParser>(), nullptr));
+    ASSERT_TRUE(fetcher.AddFeed("http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) + "/feed.xml",
+                                std::make_unique<XMLFeedParser>(), [&](FeedItem&& item) {
+        std::lock_guard<std::mutex> lock(items_mutex);
+        items.push_back(item.text);
+    }, std::chrono::seconds(0)));
+    fetcher.Start();
+    
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (fetcher.GetStatistics().not_modified < 1 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    fetcher.Stop();
+    server.join();
+    close(listener);
+    
+    EXPECT_THAT(items, ElementsAre("One", "Two"));
+    ASSERT_EQ(requests.size(), 3);
+    EXPECT_EQ(requests[0].find("If-None-Match"), std::string::npos);
+    EXPECT_NE(requests[1].find("If-None-Match: \"v1\""), std::string::npos);
+    EXPECT_NE(requests[2].find("If-None-Match: \"v2\""), std::string::npos);
+    
+    auto stats = fetcher.GetStatistics();
+    EXPECT_EQ(stats.not_modified, 1);
+    EXPECT_EQ(stats.items, 2);
+    EXPECT_EQ(stats.errors, 0);
+}
+
 // Test thread safety
 TEST_F(DLSProcessingTest, ThreadSafety) {
     std::atomic<int> successful_adds{0};
@@ -172,7 +172,8 @@ TEST_F(MOTSlideshowTest, ImageCarousel) {
     auto image = mot_processor_->GetNextImage();
     ASSERT_NE(image, nullptr);
     EXPECT_FALSE(image->filename.empty());
-    EXPECT_GT(image->processed_data.size(), 0);
+    ASSERT_TRUE(image->processed_data);
+    EXPECT_GT(image->processed_data->Size(), 0u);
     
     // Get another image (should be different due to carousel)
     auto image2 = mot_processor_->GetNextImage();
@@ -263,6 +264,27 @@ TEST_F(MOTSlideshowTest, SmartContentSelection) {
     EXPECT_EQ(selected[0], 0); // Should select first image (higher quality)
 }
 
+// Test batch scoring of the score table, with excluded and empty slots
+TEST_F(MOTSlideshowTest, ScoreTableSelection) {
+    ImageScoreTable table;
+    const double sharpness[] = {0.2, 0.9, 0.6, 0.8};
+    for (size_t i = 0; i < 4; i++) {
+        ImageQuality quality;
+        quality.sharpness = sharpness[i];
+        quality.contrast = sharpness[i];
+        table.Set(i, quality);
+    }
+    table.Clear(3);
+    
+    auto now = std::chrono::system_clock::now();
+    EXPECT_THAT(table.Select(ImageScoreTable::QUALITY, now, 2), ElementsAre(1, 2));
+    EXPECT_THAT(table.Select(ImageScoreTable::QUALITY, now, 5, {false, true}), ElementsAre(2, 0));
+    
+    SmartContentSelector selector;
+    selector.SetWeights(ImageScoreTable::QUALITY);
+    EXPECT_THAT(selector.SelectContent(table, 1, {false, true}), ElementsAre(2));
+}
+
 // Test ETSI compliance validation
 TEST_F(MOTSlideshowTest, ETSIComplianceValidation) {
     EXPECT_TRUE(mot_processor_->ProcessImageDirectory(test_image_dir_));
@@ -328,7 +350,8 @@ TEST_F(MOTSlideshowTest, WebPFormatSupport) {
     auto image = mot_processor_->GetNextImage();
     ASSERT_NE(image, nullptr);
     EXPECT_EQ(image->format, ImageFormat::WEBP);
-    EXPECT_GT(image->processed_data.size(), 0);
+    ASSERT_TRUE(image->processed_data);
+    EXPECT_GT(image->processed_data->Size(), 0u);
 }
 
 // Test configuration updates
@@ -428,4 +451,43 @@ TEST_F(MOTSlideshowTest, ThreadSafety) {
     
     // Should have successfully retrieved images
     EXPECT_GT(successful_gets.load(), 0);
-}
\ No newline at end of file
+}
+
+// Test readers and adds concurrently: concurrent adds of the same image find
+// each other, and readers see whole published states
+TEST_F(MOTSlideshowTest, ConcurrentReadersAndAdds) {
+    std::atomic<bool> adding{true};
+    std::atomic<int> consistent_reads{0};
+    std::thread reader([&]() {
+        do {
+            auto stats = mot_processor_->GetStatistics();
+            if (stats.total_images <= 1 && stats.optimized_images <= stats.total_images) {
+                consistent_reads++;
+            }
+        } while (adding);
+    });
+
+    std::atomic<int> added{0};
+    std::vector<std::thread> adders;
+    for (int i = 0; i < 4; ++i) {
+        adders.emplace_back([&]() {
+            if (mot_processor_->AddImage(test_image_dir_ + "/test1.jpg")) {
+                added++;
+            }
+        });
+    }
+    for (auto& thread : adders) {
+        thread.join();
+    }
+    adding = false;
+    reader.join();
+
+    EXPECT_EQ(added.load(), 1);
+    EXPECT_EQ(mot_processor_->GetImageCount(), 1u);
+    EXPECT_EQ(mot_processor_->GetImageList(), std::vector<std::string>({"test1.jpg"}));
+    EXPECT_GT(consistent_reads.load(), 0);
+
+    EXPECT_TRUE(mot_processor_->RemoveImage("test1.jpg"));
+    EXPECT_EQ(mot_processor_->GetImageCount(), 0u);
+    EXPECT_TRUE(mot_processor_->AddImage(test_image_dir_ + "/test1.jpg"));
+}
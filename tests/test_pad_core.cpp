@@ -0,0 +1,4075 @@
+/*
+    Google Test Suite - PAD Core Testing
+    Copyright (C) 2024 StreamDAB Project
+
+    Tests for the PAD core:
+    - PAD packetizer frame output
+    - Data group handling
+    - CRC-16 calculation
+    - Charset conversion
+    - DLS file cache, segment templates and carousel
+    - Slide cache and preparation thread
+    - PAD socket messages, shared memory ring and control socket
+    - Replication of the encoder state to a standby
+    - Metrics registry and timing histograms
+*/
+
+#include <gtest/gtest.h>
+#include "../src/pad_common.h"
+#include "../src/control_socket.h"
+#include "../src/pad_encoder.h"
+#include "../src/pad_interface.h"
+#include "../src/pad_relay.h"
+#include "../src/replication.h"
+#include "../src/pad_shm.h"
+#include "../src/reactor.h"
+#include "../src/crc.h"
+#include "../src/charset.h"
+#include "../src/dls.h"
+#include "../src/file_prefetcher.h"
+#include "../src/jpeg_offload.h"
+#include "../src/sls.h"
+#include "../src/slide_codec.h"
+#include "../src/spsc_queue.h"
+#include "../src/mpsc_queue.h"
+#include "../src/odrpadenc.h"
+#include "../src/log.h"
+#include "../src/metrics.h"
+#include "../src/thread_placement.h"
+#include "../src/timing.h"
+#include "../src/utf8_scan.h"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+using namespace odr;
+
+class PADCoreTest : public ::testing::Test {
+protected:
+    // queues a data group with ascending payload bytes (incl. CRC)
+    static DATA_GROUP* CreateTestDG(size_t len, int apptype_start, int apptype_cont) {
+        DATA_GROUP* dg = new DATA_GROUP(len, apptype_start, apptype_cont);
+        for (size_t i = 0; i < len; i++)
+            dg->data[i] = i & 0xFF;
+        dg->AppendCRC();
+        return dg;
+    }
+
+    static std::vector<uint8_t> DrainPackets(PADPacketizer& packetizer) {
+        std::vector<uint8_t> result;
+        while (packetizer.QueueFilled()) {
+            std::vector<uint8_t> pad = packetizer.GetNextPAD(true);
+            result.insert(result.end(), pad.begin(), pad.end());
+        }
+        return result;
+    }
+
+    static void WriteSlide(const std::string& path, size_t len) {
+        std::ofstream slide(path, std::ios::binary | std::ios::trunc);
+        for (size_t i = 0; i < len; i++)
+            slide.put((char) (i * 7));
+    }
+
+    static void FillPacketizer(PADPacketizer& packetizer) {
+        for (size_t len : {2, 17, 100, 600}) {
+            packetizer.AddDG(packetizer.CreateDataGroupLengthIndicator(len + 2), false);
+            packetizer.AddDG(CreateTestDG(len, 12, 13), false);
+        }
+    }
+};
+
+// Reassembles the DGs of variable size X-PADs (DGLI, MOT and DLS app types only), optionally with the app type each starts with
+static std::vector<std::vector<uint8_t> > ParseXPADs(const std::vector<uint8_t>& pads, size_t padlen, std::vector<int>* types = nullptr) {
+    static const size_t subfield_lens[] = {4, 6, 8, 12, 16, 24, 32, 48};
+    const size_t xpad_size_max = padlen - 2;
+    const size_t frame_size = padlen + 1;
+
+    std::vector<std::vector<uint8_t> > dgs;
+    std::map<int, size_t> open_dgs;    // by continuation type
+    int last_type = -1;
+    for (size_t offset = 0; offset + frame_size <= pads.size(); offset += frame_size) {
+        const uint8_t* pad = &pads[offset];
+        if (pad[xpad_size_max] == 0x00)
+            continue;   // no X-PAD
+
+        std::vector<uint8_t> xpad(pad, pad + xpad_size_max);
+        std::reverse(xpad.begin(), xpad.end());
+
+        // CI list (or the continuation of the previous sub-field type)
+        std::vector<std::pair<int, size_t> > subfields;
+        size_t pos = 0;
+        if (pad[xpad_size_max + 1] & 0x02) {
+            for (int i = 0; i < 4; i++) {
+                uint8_t ci = xpad[pos++];
+                if (ci == 0x00)
+                    break;
+                subfields.push_back(std::make_pair(ci & 0x1F, subfield_lens[ci >> 5]));
+            }
+        } else {
+            subfields.push_back(std::make_pair(last_type, (size_t) pad[xpad_size_max + 2] - 2));
+        }
+
+        for (const std::pair<int, size_t>& subfield : subfields) {
+            // a continuation (MOT or DLS) belongs to the last DG started of its app type
+            const bool continuation = subfield.first == 13 || subfield.first == 3;
+            if (!continuation || !open_dgs.count(subfield.first)) {
+                dgs.push_back(std::vector<uint8_t>());
+                open_dgs[subfield.first + 1] = dgs.size() - 1;
+                if (types)
+                    types->push_back(subfield.first);
+            }
+            std::vector<uint8_t>& dg = dgs[continuation && open_dgs.count(subfield.first) ? open_dgs[subfield.first] : dgs.size() - 1];
+            dg.insert(dg.end(), &xpad[pos], &xpad[pos] + subfield.second);
+            pos += subfield.second;
+            last_type = subfield.first == 12 || subfield.first == 2 ? subfield.first + 1 : subfield.first;
+        }
+    }
+    return dgs;
+}
+
+// Test that an urgent label arriving while a label is partly sent follows it intact
+TEST_F(PADCoreTest, PreemptingDLSAfterStartedLabel) {
+    const size_t padlen = 16;
+    PADPacketizer packetizer(padlen);
+    DATA_GROUP* old_label = CreateTestDG(60, 2, 3);
+    DATA_GROUP* urgent_label = new DATA_GROUP(40, 2, 3);
+    for (size_t i = 0; i < 40; i++)
+        urgent_label->data[i] = 0x80 | i;
+    urgent_label->AppendCRC();
+    const std::vector<std::vector<uint8_t> > expected = {old_label->data, urgent_label->data};
+
+    packetizer.AddDG(old_label, false);
+    std::vector<uint8_t> pads = packetizer.GetNextPAD(true);
+    ASSERT_GT(old_label->written, 0u);
+    ASSERT_GT(old_label->Available(), 0u);
+
+    packetizer.AddDGs({urgent_label}, false, true);
+    std::vector<uint8_t> rest = DrainPackets(packetizer);
+    pads.insert(pads.end(), rest.begin(), rest.end());
+
+    std::vector<std::vector<uint8_t> > dgs = ParseXPADs(pads, padlen);
+    ASSERT_EQ(dgs.size(), expected.size());
+    for (size_t i = 0; i < dgs.size(); i++) {
+        ASSERT_GE(dgs[i].size(), expected[i].size());
+        EXPECT_TRUE(std::equal(expected[i].begin(), expected[i].end(), dgs[i].begin())) << "DG " << i;
+        EXPECT_TRUE(std::all_of(dgs[i].begin() + expected[i].size(), dgs[i].end(), [](uint8_t b) {return b == 0x00;}));
+    }
+}
+
+// Test that DGs partly written into PADs that were dropped are written again from their start
+TEST_F(PADCoreTest, RestartDGsAfterDroppedPADs) {
+    const size_t padlen = 16;
+    PADPacketizer packetizer(padlen);
+    DATA_GROUP* label = CreateTestDG(20, 2, 3);
+    DATA_GROUP* dgli = packetizer.CreateDataGroupLengthIndicator(102);
+    DATA_GROUP* mot = CreateTestDG(100, 12, 13);
+    DATA_GROUP* urgent_label = new DATA_GROUP(40, 2, 3);
+    for (size_t i = 0; i < 40; i++)
+        urgent_label->data[i] = 0x80 | i;
+    urgent_label->AppendCRC();
+    const std::vector<std::vector<uint8_t> > expected_tail = {urgent_label->data, dgli->data, mot->data};
+    const std::vector<uint8_t> expected_label = label->data;
+
+    packetizer.AddDG(label, false);
+    packetizer.AddDG(dgli, false);
+    packetizer.AddDG(mot, false);
+    std::vector<uint8_t> pads;
+    while (packetizer.QueuedDGs(2) > 0) {
+        std::vector<uint8_t> pad = packetizer.GetNextPAD(true);
+        pads.insert(pads.end(), pad.begin(), pad.end());
+    }
+
+    // the PADs ending inside the MOT DG are not sent
+    for (int i = 0; i < 3; i++)
+        packetizer.GetNextPAD(true);
+    ASSERT_GT(mot->written, 0u);
+    ASSERT_GT(mot->Available(), 0u);
+    EXPECT_EQ(packetizer.RestartDGs(), 1u);
+    EXPECT_EQ(packetizer.QueuedBytes(12), 102u);
+    EXPECT_EQ(packetizer.QueuedDGs(PADPacketizer::APPTYPE_DGLI), 1u);
+
+    packetizer.AddDGs({urgent_label}, false, true);
+    std::vector<uint8_t> rest = DrainPackets(packetizer);
+    ASSERT_FALSE(rest.empty());
+    EXPECT_TRUE(rest[padlen - 1] & 0x02) << "CI list expected";
+    pads.insert(pads.end(), rest.begin(), rest.end());
+
+    // a DGLI possibly sent before is sent again
+    std::vector<std::vector<uint8_t> > dgs = ParseXPADs(pads, padlen);
+    ASSERT_GE(dgs.size(), 1 + expected_tail.size());
+    ASSERT_LE(dgs.size(), 2 + expected_tail.size());
+    ASSERT_GE(dgs[0].size(), expected_label.size());
+    EXPECT_TRUE(std::equal(expected_label.begin(), expected_label.end(), dgs[0].begin()));
+    for (size_t i = 0; i < expected_tail.size(); i++) {
+        const std::vector<uint8_t>& dg = dgs[dgs.size() - expected_tail.size() + i];
+        ASSERT_GE(dg.size(), expected_tail[i].size());
+        EXPECT_TRUE(std::equal(expected_tail[i].begin(), expected_tail[i].end(), dg.begin())) << "DG " << i;
+        EXPECT_TRUE(std::all_of(dg.begin() + expected_tail[i].size(), dg.end(), [](uint8_t b) {return b == 0x00;}));
+    }
+}
+
+// Test that look-ahead packing keeps the DGs intact and needs no more PADs
+TEST_F(PADCoreTest, LookaheadPackingSavesPADs) {
+    const std::vector<size_t> lens = {2, 17, 100, 7, 3, 600, 5, 30, 1, 250};
+    size_t total_greedy = 0;
+    size_t total_lookahead = 0;
+    for (size_t padlen : {8, 12, 16, 23, 30, 58}) {
+        std::vector<size_t> frames;
+        for (bool lookahead : {false, true}) {
+            PADPacketizer packetizer(padlen);
+            packetizer.SetLookaheadPacking(lookahead);
+            std::vector<std::vector<uint8_t> > expected;
+            for (size_t len : lens) {
+                DATA_GROUP* dgli = packetizer.CreateDataGroupLengthIndicator(len + 2);
+                DATA_GROUP* dg = CreateTestDG(len, 12, 13);
+                expected.push_back(dgli->data);
+                expected.push_back(dg->data);
+                packetizer.AddDG(dgli, false);
+                packetizer.AddDG(dg, false);
+            }
+
+            std::vector<uint8_t> pads = DrainPackets(packetizer);
+            frames.push_back(pads.size() / (padlen + 1));
+
+            std::vector<std::vector<uint8_t> > dgs = ParseXPADs(pads, padlen);
+            ASSERT_EQ(dgs.size(), expected.size()) << "padlen " << padlen << ", lookahead " << lookahead;
+            for (size_t i = 0; i < dgs.size(); i++) {
+                ASSERT_GE(dgs[i].size(), expected[i].size());
+                EXPECT_TRUE(std::equal(expected[i].begin(), expected[i].end(), dgs[i].begin())) << "DG " << i;
+                EXPECT_TRUE(std::all_of(dgs[i].begin() + expected[i].size(), dgs[i].end(), [](uint8_t b) {return b == 0x00;}));
+            }
+        }
+        EXPECT_LE(frames[1], frames[0]) << "padlen " << padlen;
+        total_greedy += frames[0];
+        total_lookahead += frames[1];
+    }
+    EXPECT_LT(total_lookahead, total_greedy);
+}
+
+// Test the queued DGs and bytes per app type
+TEST_F(PADCoreTest, QueueAccountingPerAppType) {
+    PADPacketizer packetizer(58);
+    size_t mot_bytes = 0;
+    for (size_t len : {100, 600, 30}) {
+        DATA_GROUP* dg = CreateTestDG(len, 12, 13);
+        mot_bytes += dg->Size();
+        packetizer.AddDG(dg, false);
+    }
+    std::vector<DATA_GROUP*> dls_dgs;
+    size_t dls_bytes = 0;
+    for (size_t len : {18, 18, 10}) {
+        dls_dgs.push_back(CreateTestDG(len, 2, 3));
+        dls_bytes += dls_dgs.back()->Size();
+    }
+    packetizer.AddDGs(dls_dgs, true);
+
+    EXPECT_EQ(packetizer.QueuedDGs(12), 3u);
+    EXPECT_EQ(packetizer.QueuedDGs(2), 3u);
+    EXPECT_EQ(packetizer.QueuedDGs(1), 0u);
+    EXPECT_EQ(packetizer.QueuedDGs(-1), 0u);
+    EXPECT_EQ(packetizer.QueuedBytes(12), mot_bytes);
+    EXPECT_EQ(packetizer.QueuedBytes(2), dls_bytes);
+    EXPECT_TRUE(packetizer.QueueContainsDG(2));
+
+    // the prepended DLS DGs are written first, at most one X-PAD per frame
+    size_t previous = dls_bytes + mot_bytes;
+    while (packetizer.QueueContainsDG(2)) {
+        packetizer.GetNextPAD(true);
+        size_t pending = packetizer.QueuedBytes(2) + packetizer.QueuedBytes(12);
+        EXPECT_LT(pending, previous);
+        EXPECT_LE(previous - pending, 56u);
+        previous = pending;
+    }
+    EXPECT_EQ(packetizer.QueuedBytes(2), 0u);
+    EXPECT_EQ(packetizer.QueuedDGs(12), 3u);
+    EXPECT_GT(packetizer.QueuedBytes(12), 0u);
+
+    DrainPackets(packetizer);
+    EXPECT_EQ(packetizer.QueuedDGs(12), 0u);
+    EXPECT_EQ(packetizer.QueuedBytes(12), 0u);
+    EXPECT_FALSE(packetizer.QueueContainsDG(12));
+}
+
+// Test that the X-PAD usage stats account for every byte and the DG latency
+TEST_F(PADCoreTest, PADStats) {
+    PADPacketizer packetizer(23);
+    size_t mot_bytes = 0;
+    for (size_t len : {100, 600}) {
+        DATA_GROUP* dg = CreateTestDG(len, 12, 13);
+        mot_bytes += dg->Size();
+        packetizer.AddDG(dg, false);
+    }
+    DATA_GROUP* dls_dg = CreateTestDG(10, 2, 3);
+    const size_t dls_bytes = dls_dg->Size();
+    packetizer.AddDG(dls_dg, true);
+
+    packetizer.GetNextPAD(false);
+    DrainPackets(packetizer);
+    packetizer.GetNextPAD(true);
+
+    const PAD_STATS& stats = packetizer.GetStats();
+    EXPECT_EQ(stats.frames_without_xpad, 2u);
+    EXPECT_EQ(stats.capacity_bytes, stats.frames * 21);
+    EXPECT_EQ(stats.data_bytes[12], mot_bytes);
+    EXPECT_EQ(stats.data_bytes[2], dls_bytes);
+    EXPECT_EQ(stats.data_bytes[2] + stats.data_bytes[12] + stats.ci_bytes + stats.subfield_padding_bytes + stats.unused_bytes,
+            stats.capacity_bytes);
+    EXPECT_GT(stats.ci_bytes, 0u);
+    EXPECT_EQ(stats.queued_dgs_max, 3u);
+
+    // the label is sent within the frames following the one w/o X-PAD
+    EXPECT_EQ(stats.dgs_sent[2], 1u);
+    EXPECT_EQ(stats.latency_frames[2], 2u);
+    EXPECT_EQ(stats.dgs_sent[12], 2u);
+    EXPECT_EQ(stats.latency_frames_max[12], stats.frames - 1);
+
+    PAD_STATS snapshot = stats;
+    packetizer.ResetStats();
+    EXPECT_EQ(stats.frames, 0u);
+    EXPECT_EQ(stats.data_bytes[12], 0u);
+    EXPECT_GT(snapshot.frames, 0u);
+}
+
+// Test that the completion estimate follows the measured throughput and frame duration
+TEST_F(PADCoreTest, ThroughputEstimate) {
+    typedef std::chrono::steady_clock clock;
+    PADThroughputEstimator estimator;
+    clock::time_point now = clock::now();
+    clock::time_point completion;
+    EXPECT_FALSE(estimator.Estimate(1000, now, completion));
+    EXPECT_EQ(estimator.BytesPerSecond(), 0);
+
+    // 50 bytes per 24 ms frame while pending; idle frames only count for the frame duration
+    for (int i = 0; i < 200; i++) {
+        estimator.Update(now, i % 2 ? 50 : 0, i % 2);
+        now += std::chrono::milliseconds(24);
+    }
+    ASSERT_TRUE(estimator.Estimate(1000, now, completion));
+    EXPECT_NEAR(std::chrono::duration<double>(completion - now).count(), 20 * 0.024, 0.001);
+    EXPECT_NEAR(estimator.BytesPerSecond(), 50 / 0.024, 1);
+
+    // a smaller share of the X-PAD is taken into account after a while
+    for (int i = 0; i < 2000; i++) {
+        estimator.Update(now, 10, true);
+        now += std::chrono::milliseconds(24);
+    }
+    ASSERT_TRUE(estimator.Estimate(1000, now, completion));
+    EXPECT_NEAR(std::chrono::duration<double>(completion - now).count(), 100 * 0.024, 0.2);
+}
+
+// Test that weights share the X-PAD between app types
+TEST_F(PADCoreTest, WeightedAppTypeSharing) {
+    PADPacketizer packetizer(58);
+    packetizer.SetAppTypeWeight(2, 1);
+    packetizer.SetAppTypeWeight(12, 9);
+    for (int i = 0; i < 20; i++) {
+        packetizer.AddDG(packetizer.CreateDataGroupLengthIndicator(1000 + 2), false);
+        packetizer.AddDG(CreateTestDG(1000, 12, 13), false);
+    }
+
+    // a slide burst in transmission
+    for (int i = 0; i < 50; i++)
+        packetizer.GetNextPAD(true);
+
+    std::vector<DATA_GROUP*> dls_dgs;
+    for (int i = 0; i < 60; i++)
+        dls_dgs.push_back(CreateTestDG(18, 2, 3));
+    packetizer.AddDGs(dls_dgs, true);
+    const size_t dls_bytes = packetizer.QueuedBytes(2);
+
+    // the label starts at once, but only gets its share while slides are pending
+    packetizer.GetNextPAD(true);
+    EXPECT_LT(packetizer.QueuedBytes(2), dls_bytes);
+
+    size_t dls_written = 0;
+    size_t mot_written = 0;
+    for (int i = 0; i < 100; i++) {
+        size_t dls_before = packetizer.QueuedBytes(2);
+        size_t mot_before = packetizer.QueuedBytes(1) + packetizer.QueuedBytes(12);
+        packetizer.GetNextPAD(true);
+        dls_written += dls_before - packetizer.QueuedBytes(2);
+        mot_written += mot_before - packetizer.QueuedBytes(1) - packetizer.QueuedBytes(12);
+    }
+    double dls_share = (double) dls_written / (dls_written + mot_written);
+    EXPECT_GT(dls_share, 0.05);
+    EXPECT_LT(dls_share, 0.15);
+    EXPECT_GT(packetizer.QueuedBytes(2), 0u);
+
+    // without weights, the prepended label goes first
+    PADPacketizer unweighted(58);
+    unweighted.AddDG(CreateTestDG(5000, 12, 13), false);
+    unweighted.GetNextPAD(true);
+    unweighted.AddDGs({CreateTestDG(50, 2, 3), CreateTestDG(50, 2, 3)}, true);
+    const size_t mot_bytes = unweighted.QueuedBytes(12);
+    unweighted.GetNextPAD(true);
+    EXPECT_EQ(unweighted.QueuedBytes(12), mot_bytes);
+    EXPECT_LT(unweighted.QueuedBytes(2), 104u);
+}
+
+// Test that a preempting label interrupts weighted sharing at the next PAD and drops stale segments
+TEST_F(PADCoreTest, PreemptingDLS) {
+    PADPacketizer packetizer(58);
+    packetizer.SetAppTypeWeight(2, 1);
+    packetizer.SetAppTypeWeight(12, 99);
+    packetizer.AddDG(packetizer.CreateDataGroupLengthIndicator(5000 + 2), false);
+    packetizer.AddDG(CreateTestDG(5000, 12, 13), false);
+    packetizer.AddDGs({CreateTestDG(18, 2, 3), CreateTestDG(18, 2, 3), CreateTestDG(18, 2, 3)}, false);
+    for (int i = 0; i < 5; i++)
+        packetizer.GetNextPAD(true);
+    const size_t mot_bytes = packetizer.QueuedBytes(12);
+    ASSERT_GT(mot_bytes, 0u);
+    ASSERT_LT(mot_bytes, 5000u + 2);
+
+    // only segments not yet started are dropped
+    const size_t stale_dgs = packetizer.QueuedDGs(2);
+    EXPECT_EQ(packetizer.DropDGs(2), stale_dgs);
+    EXPECT_EQ(packetizer.QueuedDGs(2), 0u);
+    EXPECT_EQ(packetizer.DropDGs(2), 0u);
+
+    packetizer.AddDGs({CreateTestDG(40, 2, 3), CreateTestDG(40, 2, 3)}, false, true);
+    // the slide only fills up the frame which completes the label
+    for (int i = 0; packetizer.QueuedDGs(2); i++) {
+        EXPECT_EQ(packetizer.QueuedBytes(12), mot_bytes);
+        packetizer.GetNextPAD(true);
+        ASSERT_LT(i, 3);
+    }
+
+    // the interrupted slide then continues
+    while (packetizer.QueueFilled())
+        packetizer.GetNextPAD(true);
+    EXPECT_EQ(packetizer.QueuedBytes(12), 0u);
+}
+
+// Test that the background fill only uses X-PAD left unused and yields to other DGs at once
+TEST_F(PADCoreTest, BackgroundFill) {
+    PADPacketizer packetizer(58);
+    std::vector<bool> done;
+    auto add_fill = [&]() {
+        DATA_GROUP* dg = CreateTestDG(500, 12, 13);
+        dg->done_handler = [&done](bool sent) {done.push_back(sent);};
+        packetizer.AddFillDG(packetizer.CreateDataGroupLengthIndicator(dg->Size()));
+        packetizer.AddFillDG(dg);
+    };
+    add_fill();
+    add_fill();
+    EXPECT_FALSE(packetizer.QueueFilled());
+    EXPECT_EQ(packetizer.QueuedDGs(12), 0u);
+    EXPECT_TRUE(packetizer.FillQueued());
+
+    for (int i = 0; i < 3; i++)
+        packetizer.GetNextPAD(true);
+    EXPECT_GT(packetizer.GetStats().fill_bytes, 0u);
+    EXPECT_EQ(packetizer.GetStats().fill_bytes, packetizer.GetStats().data_bytes[1] + packetizer.GetStats().data_bytes[12]);
+
+    // a label is written at once, abandoning the partly written fill DG
+    packetizer.AddDG(CreateTestDG(18, 2, 3), false);
+    const size_t fill_bytes = packetizer.GetStats().fill_bytes;
+    packetizer.GetNextPAD(true);
+    EXPECT_FALSE(packetizer.QueueFilled());
+    EXPECT_EQ(packetizer.GetStats().data_bytes[2], 18 + 2u);
+    EXPECT_EQ(packetizer.GetStats().fill_dgs_abandoned, 1u);
+    EXPECT_EQ(done, std::vector<bool>({false}));
+
+    // the next fill DG follows, as the label left X-PAD unused
+    EXPECT_GT(packetizer.GetStats().fill_bytes, fill_bytes);
+    for (int i = 0; packetizer.FillQueued(); i++) {
+        packetizer.GetNextPAD(true);
+        ASSERT_LT(i, 20);
+    }
+    EXPECT_EQ(done, std::vector<bool>({false, true}));
+
+    // fill DGs not started yet are dropped
+    add_fill();
+    EXPECT_EQ(packetizer.DropFillDGs(), 2u);
+    EXPECT_FALSE(packetizer.FillQueued());
+    EXPECT_EQ(done, std::vector<bool>({false, true, false}));
+}
+
+// Test that writing into a caller-owned buffer matches the copying output
+TEST_F(PADCoreTest, WriteNextPADMatchesGetNextPAD) {
+    for (size_t padlen : {6, 8, 23, 58, 196}) {
+        PADPacketizer copying(padlen);
+        PADPacketizer in_place(padlen);
+        FillPacketizer(copying);
+        FillPacketizer(in_place);
+
+        ASSERT_EQ(in_place.GetPADFrameSize(), padlen + 1);
+
+        std::vector<uint8_t> frame(1 + in_place.GetPADFrameSize(), 0xAA);
+        size_t frames = 0;
+        while (copying.QueueFilled() || in_place.QueueFilled()) {
+            std::vector<uint8_t> expected = copying.GetNextPAD(true);
+            size_t len = in_place.WriteNextPAD(true, &frame[1]);
+
+            ASSERT_EQ(expected.size(), len);
+            EXPECT_EQ(expected, std::vector<uint8_t>(frame.begin() + 1, frame.begin() + 1 + len)) << "padlen " << padlen << ", frame " << frames;
+            EXPECT_EQ(frame[0], 0xAA);     // reserved header untouched
+            ASSERT_LT(++frames, 10000u);
+        }
+    }
+}
+
+// Test that a PAD length change continues the queued data groups where they were
+TEST_F(PADCoreTest, PADLengthChangeKeepsProgress) {
+    auto count_pads = [](PADPacketizer& packetizer, size_t frame_size) {
+        size_t pads = 0;
+        while (packetizer.QueueFilled()) {
+            EXPECT_EQ(packetizer.GetNextPAD(true).size(), frame_size);
+            pads++;
+        }
+        return pads;
+    };
+
+    PADPacketizer fresh(23);
+    FillPacketizer(fresh);
+    size_t fresh_pads = count_pads(fresh, 24);
+
+    PADPacketizer changed(58);
+    FillPacketizer(changed);
+    for (int i = 0; i < 10; i++)
+        changed.GetNextPAD(true);
+    changed.SetPADLength(23);
+    ASSERT_EQ(changed.GetPADFrameSize(), 24u);
+    size_t changed_pads = count_pads(changed, 24);
+
+    // 10 PADs of 56 bytes X-PAD carried more than 20 PADs of 21 bytes would have
+    EXPECT_GT(changed_pads, 0u);
+    EXPECT_LT(changed_pads + 20, fresh_pads);
+    EXPECT_EQ(changed.GetDataGroupPool().FreeCount(), changed.GetDataGroupPool().Capacity());
+}
+
+// Test that a F-PAD only frame carries no X-PAD
+TEST_F(PADCoreTest, FPADOnlyFrame) {
+    PADPacketizer packetizer(58);
+    FillPacketizer(packetizer);
+
+    std::vector<uint8_t> pad = packetizer.GetNextPAD(false);
+    ASSERT_EQ(pad.size(), 59u);
+    EXPECT_EQ(pad[56], 0x00);
+    EXPECT_EQ(pad[57], 0x00);
+    EXPECT_EQ(pad[58], 2);  // used PAD len: F-PAD only
+    EXPECT_TRUE(packetizer.QueueFilled());
+}
+
+// Test that drained data groups are recycled by the packetizer's pool
+TEST_F(PADCoreTest, DataGroupPoolRecycling) {
+    PADPacketizer packetizer(58);
+
+    auto queue_slide = [&packetizer]() {
+        for (int i = 0; i < 50; i++) {
+            DATA_GROUP* dg = packetizer.CreateDataGroup(1022, 12, 13);
+            dg->AppendCRC();
+            packetizer.AddDG(packetizer.CreateDataGroupLengthIndicator(dg->data.size()), false);
+            packetizer.AddDG(dg, false);
+        }
+    };
+
+    queue_slide();
+    const size_t capacity = packetizer.GetDataGroupPool().Capacity();
+    EXPECT_GE(capacity, 100u);
+    EXPECT_EQ(packetizer.GetDataGroupPool().FreeCount(), capacity - 100);
+
+    while (packetizer.QueueFilled())
+        packetizer.GetNextPAD(true);
+    EXPECT_EQ(packetizer.GetDataGroupPool().FreeCount(), capacity);
+
+    // a second slide is served from the recycled DGs
+    queue_slide();
+    EXPECT_EQ(packetizer.GetDataGroupPool().Capacity(), capacity);
+}
+
+// Test that a recycled data group is reinitialised
+TEST_F(PADCoreTest, RecycledDataGroupIsCleared) {
+    PADPacketizer packetizer(8);
+
+    DATA_GROUP* dg = packetizer.CreateDataGroup(4, 2, 3);
+    memset(&dg->data[0], 0xFF, dg->data.size());
+    dg->AppendCRC();
+    packetizer.AddDG(dg, false);
+    while (packetizer.QueueFilled())
+        packetizer.GetNextPAD(true);
+
+    DATA_GROUP* recycled = packetizer.CreateDataGroup(2, 12, 13);
+    EXPECT_EQ(recycled, dg);
+    EXPECT_EQ(recycled->data, uint8_vector_t(2, 0x00));
+    EXPECT_EQ(recycled->written, 0u);
+    EXPECT_EQ(recycled->apptype_start, 12);
+    EXPECT_EQ(recycled->apptype_cont, 13);
+    packetizer.AddDG(recycled, false);
+}
+
+// Test that a DG referencing its payload is output like one holding a copy
+TEST_F(PADCoreTest, ExternalPayloadDataGroup) {
+    std::vector<uint8_t> payload(1013);
+    for (size_t i = 0; i < payload.size(); i++)
+        payload[i] = i * 13;
+    std::shared_ptr<const void> owner = std::make_shared<int>(0);
+
+    for (size_t padlen : {6, 23, 58}) {
+        PADPacketizer copying(padlen);
+        PADPacketizer referencing(padlen);
+
+        DATA_GROUP* copy = copying.CreateDataGroup(9 + payload.size(), 12, 13);
+        DATA_GROUP* ref = referencing.CreateDataGroup(9, 12, 13);
+        for (size_t i = 0; i < 9; i++)
+            copy->data[i] = ref->data[i] = 0xA0 + i;
+        memcpy(&copy->data[9], payload.data(), payload.size());
+        ref->SetExternalPayload(payload.data(), payload.size(), owner);
+        copy->AppendCRC();
+        ref->AppendCRC();
+        ASSERT_EQ(ref->Size(), copy->Size());
+
+        copying.AddDG(copying.CreateDataGroupLengthIndicator(copy->Size()), false);
+        copying.AddDG(copy, false);
+        referencing.AddDG(referencing.CreateDataGroupLengthIndicator(ref->Size()), false);
+        referencing.AddDG(ref, false);
+        EXPECT_EQ(owner.use_count(), 2);
+
+        EXPECT_EQ(DrainPackets(copying), DrainPackets(referencing)) << "padlen " << padlen;
+        EXPECT_EQ(owner.use_count(), 1);    // released once written
+    }
+}
+
+// Test the CRC-16 against the CCITT check value
+TEST_F(PADCoreTest, CRC16CheckValue) {
+    const char check[] = "123456789";
+    EXPECT_EQ(crc16(0xFFFF, check, 9), 0x29B1);
+    EXPECT_EQ(crc16_reference(0xFFFF, check, 9), 0x29B1);
+}
+
+// Test that the accelerated CRC-16 matches the bytewise reference
+TEST_F(PADCoreTest, CRC16MatchesReference) {
+    std::mt19937 rng(42);
+    std::vector<uint8_t> data(4096 + 15);
+    for (uint8_t& b : data)
+        b = rng();
+
+    for (unsigned len = 0; len < 300; len++) {
+        for (size_t offset : {0, 1, 7}) {
+            uint16_t init = rng();
+            EXPECT_EQ(crc16(init, &data[offset], len), crc16_reference(init, &data[offset], len))
+                << crc16_engine_name() << ", len " << len << ", offset " << offset;
+        }
+    }
+    for (unsigned len : {1022u, 2048u, 4096u})
+        EXPECT_EQ(crc16(0xFFFF, data.data(), len), crc16_reference(0xFFFF, data.data(), len)) << "len " << len;
+}
+
+// Test that the vectorised UTF-8 scans match the bundled checked decoding
+TEST_F(PADCoreTest, UTF8ScanMatchesReference) {
+    const std::vector<std::string> pieces = {
+        "a", "Z", "\n", "\xC3\xBC", "\xE2\x82\xAC", "\xE0\xB8\xAA", "\xF0\x9F\x8E\xB5",
+        "\xC3", "\xE2\x82", "\x80", "\xFF", "\xC0\xAF", "\xED\xA0\x80"};     // the last ones invalid
+    std::mt19937 rng(7);
+    for (int round = 0; round < 2000; round++) {
+        std::string text;
+        const size_t len = rng() % 80;
+        while (text.size() < len) {
+            // mostly 7-bit, so that the vector paths are taken
+            size_t piece = rng() % 4 ? rng() % 3 : rng() % pieces.size();
+            if (round % 2 == 0 && piece >= 7)
+                piece = 0;
+            text += pieces[piece];
+        }
+
+        const size_t valid = utf8::find_invalid(text.begin(), text.end()) - text.begin();
+        ASSERT_EQ(utf8_valid_prefix(text.data(), text.size()), valid) << utf8_scan_engine_name() << ", round " << round;
+
+        size_t ascii = 0;
+        while (ascii < text.size() && (uint8_t) text[ascii] < 0x80)
+            ascii++;
+        ASSERT_EQ(utf8_ascii_prefix(text.data(), text.size()), ascii) << "round " << round;
+
+        ASSERT_EQ(utf8_count(text.data(), valid), (size_t) utf8::distance(text.begin(), text.begin() + valid)) << "round " << round;
+    }
+    EXPECT_EQ(utf8_valid_prefix("", 0), 0u);
+    EXPECT_EQ(utf8_count("", 0), 0u);
+}
+
+// Test that a cached slide is queued exactly like a freshly encoded one
+TEST_F(PADCoreTest, SlideCacheMatchesEncoding) {
+    const std::string path = ::testing::TempDir() + "padenc_cache_slide.jpg";
+    WriteSlide(path, 5000);
+
+    PADPacketizer cached_packetizer(58);
+    PADPacketizer uncached_packetizer(58);
+    SLSEncoder cached(&cached_packetizer);
+    SLSEncoder uncached(&uncached_packetizer, 0);
+
+    for (int round = 0; round < 3; round++) {
+        if (round == 2)
+            WriteSlide(path, 3000);     // changed file must be encoded again
+
+        ASSERT_TRUE(cached.encodeSlide(path, 7, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, ""));
+        ASSERT_TRUE(uncached.encodeSlide(path, 7, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, ""));
+        EXPECT_EQ(DrainPackets(cached_packetizer), DrainPackets(uncached_packetizer)) << "round " << round;
+
+        EXPECT_EQ(cached.GetSlideCache().Count(), 1u);
+        EXPECT_GT(cached.GetSlideCache().Size(), round == 2 ? 3000u : 5000u);
+    }
+    EXPECT_EQ(uncached.GetSlideCache().Count(), 0u);
+
+    // a new fidx only changes the header
+    ASSERT_TRUE(cached.encodeSlide(path, 8, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, ""));
+    ASSERT_TRUE(uncached.encodeSlide(path, 8, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, ""));
+    EXPECT_EQ(DrainPackets(cached_packetizer), DrainPackets(uncached_packetizer));
+
+    remove(path.c_str());
+}
+
+// Test that a slide of the same content (or a similar image) in another file is not encoded again
+TEST_F(PADCoreTest, SlideCacheRecognisesContent) {
+    const std::string path = ::testing::TempDir() + "padenc_content_slide.jpg";
+    const std::string copy_path = ::testing::TempDir() + "padenc_content_copy.jpg";
+    WriteSlide(path, 5000);
+    WriteSlide(copy_path, 5000);
+
+    PADPacketizer packetizer(58);
+    SLSEncoder sls_encoder(&packetizer);
+    prepared_slide_t slide;
+    prepared_slide_t copy;
+    ASSERT_TRUE(sls_encoder.prepareSlide(path, 7, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, slide));
+    ASSERT_TRUE(sls_encoder.prepareSlide(copy_path, 8, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, copy));
+    EXPECT_EQ(copy.blob, slide.blob);
+    EXPECT_EQ(sls_encoder.GetSlideCache().Count(), 1u);
+    EXPECT_EQ(sls_encoder.GetSlideCache().GetEntries().front().fp.s_name, "padenc_content_copy.jpg");
+
+    EXPECT_EQ(odr::hash64("", 0), 0xEF46DB3751D8E999ULL);
+    EXPECT_EQ(odr::hash64("abc", 3), 0x44BC2CF5AD770999ULL);
+
+#if HAVE_LIBJPEG
+    // the same image at another JPEG quality
+    rgb_image_t image;
+    image.width = 320;
+    image.height = 240;
+    for (size_t y = 0; y < image.height; y++)
+        for (size_t x = 0; x < image.width; x++)
+            for (size_t c = 0; c < 3; c++)
+                image.pixels.push_back((uint8_t) ((x * (c + 1) + y * 2) ^ (x / 40 * 37)));
+
+    for (int quality : {90, 60}) {
+        std::vector<uint8_t> jpeg;
+        ASSERT_TRUE(SlideCodec::EncodeJPEG(image, quality, jpeg));
+        std::ofstream(quality == 90 ? path : copy_path, std::ios::binary | std::ios::trunc).write((const char*) jpeg.data(), jpeg.size());
+    }
+
+    SLSEncoder exact(&packetizer);
+    SLSEncoder similar(&packetizer);
+    similar.SetSimilarityDistance(4);
+    for (SLSEncoder* encoder : {&exact, &similar}) {
+        ASSERT_TRUE(encoder->prepareSlide(path, 7, false, SLSEncoder::MAXSLIDESIZE_SIMPLE, slide));
+        ASSERT_TRUE(encoder->prepareSlide(copy_path, 8, false, SLSEncoder::MAXSLIDESIZE_SIMPLE, copy));
+    }
+    EXPECT_EQ(exact.GetSlideCache().Count(), 2u);
+    EXPECT_EQ(similar.GetSlideCache().Count(), 1u);
+    EXPECT_EQ(copy.blob, slide.blob);
+#endif
+
+    remove(path.c_str());
+    remove(copy_path.c_str());
+}
+
+// Test that the encoders of several services share encoded slides through the store
+TEST_F(PADCoreTest, SharedSlideStoreDeduplicates) {
+#if HAVE_LIBJPEG
+    char dir_template[] = "/tmp/padenc_storeXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = std::string(dir_template) + "/slides";
+    const std::string path = ::testing::TempDir() + "padenc_store_slide.jpg";
+    const std::string copy_path = ::testing::TempDir() + "padenc_store_copy.jpg";
+
+    rgb_image_t image;
+    image.width = 640;
+    image.height = 480;
+    for (size_t y = 0; y < image.height; y++)
+        for (size_t x = 0; x < image.width; x++)
+            for (size_t c = 0; c < 3; c++)
+                image.pixels.push_back((uint8_t) ((x * (c + 1) + y * 2) ^ (x / 40 * 37)));
+    std::vector<uint8_t> jpeg;
+    ASSERT_TRUE(SlideCodec::EncodeJPEG(image, 90, jpeg));
+    std::ofstream(path, std::ios::binary | std::ios::trunc).write((const char*) jpeg.data(), jpeg.size());
+    std::ofstream(copy_path, std::ios::binary | std::ios::trunc).write((const char*) jpeg.data(), jpeg.size());
+
+    PADPacketizer packetizer(58);
+    SLSEncoder first(&packetizer);
+    SLSEncoder second(&packetizer, 0);      // the store works without a cache, too
+    first.SetSharedStore(SharedSlideStore(dir));
+    second.SetSharedStore(SharedSlideStore(dir));
+
+    prepared_slide_t slide;
+    prepared_slide_t copy;
+    ASSERT_TRUE(first.prepareSlide(path, 7, false, SLSEncoder::MAXSLIDESIZE_SIMPLE, slide));
+    ASSERT_TRUE(second.prepareSlide(copy_path, 3, false, SLSEncoder::MAXSLIDESIZE_SIMPLE, copy));
+    ASSERT_EQ(copy.blob->Size(), slide.blob->Size());
+    EXPECT_EQ(memcmp(copy.blob->Data(), slide.blob->Data(), slide.blob->Size()), 0);
+    EXPECT_LE(slide.blob->Size(), SLSEncoder::MAXSLIDESIZE_SIMPLE);
+
+    // another maximum slide size is a slide of its own
+    auto count_slides = [&]() {
+        size_t count = 0;
+        DIR* d = opendir(dir.c_str());
+        while (struct dirent* entry = readdir(d))
+            count += entry->d_name[0] != '.';
+        closedir(d);
+        return count;
+    };
+    EXPECT_EQ(count_slides(), 1u);
+    ASSERT_TRUE(second.prepareSlide(copy_path, 3, false, 20000, copy));
+    EXPECT_LE(copy.blob->Size(), 20000u);
+    EXPECT_EQ(count_slides(), 2u);
+
+    // deleting the stored slides does not affect the mapped ones
+    std::vector<uint8_t> data(slide.blob->Data(), slide.blob->Data() + slide.blob->Size());
+    DIR* d = opendir(dir.c_str());
+    while (struct dirent* entry = readdir(d))
+        if (entry->d_name[0] != '.')
+            unlink((dir + "/" + entry->d_name).c_str());
+    closedir(d);
+    EXPECT_EQ(std::vector<uint8_t>(slide.blob->Data(), slide.blob->Data() + slide.blob->Size()), data);
+
+    rmdir(dir.c_str());
+    rmdir(dir_template);
+    remove(path.c_str());
+    remove(copy_path.c_str());
+#else
+    GTEST_SKIP() << "needs libjpeg";
+#endif
+}
+
+// Test that the params file is only parsed again once it changed
+TEST_F(PADCoreTest, MOTHeaderParamsMemo) {
+    const std::string path = ::testing::TempDir() + "padenc_params_slide.jpg";
+    const std::string params_path = path + ".sls_params";
+    WriteSlide(path, 5000);
+    auto write_params = [&](const std::string& title, time_t mtime) {
+        std::ofstream(params_path, std::ios::trunc) << "# comment\nCategoryID/SlideID=1 2\nCategoryTitle=" << title << "\n";
+        struct utimbuf times = {mtime, mtime};
+        ASSERT_EQ(utime(params_path.c_str(), &times), 0);
+    };
+    auto contains = [](const uint8_vector_t& mothdr, const std::string& text) {
+        return std::search(mothdr.begin(), mothdr.end(), text.begin(), text.end()) != mothdr.end();
+    };
+
+    PADPacketizer packetizer(58);
+    SLSEncoder sls_encoder(&packetizer, 0);
+    prepared_slide_t slide;
+    write_params("Weather", 1000000);
+    ASSERT_TRUE(sls_encoder.prepareSlide(path, 7, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, slide));
+    const uint8_vector_t first = slide.mothdr;
+    EXPECT_TRUE(contains(first, "Weather"));
+    EXPECT_TRUE(contains(first, "0007.jpg"));
+    // header size field (bits 28..40) matches the header
+    EXPECT_EQ((size_t) (((first[3] & 0x0F) << 9) | (first[4] << 1) | (first[5] >> 7)), first.size());
+
+    // unchanged mtime: memorised
+    write_params("Traffic", 1000000);
+    ASSERT_TRUE(sls_encoder.prepareSlide(path, 7, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, slide));
+    EXPECT_EQ(slide.mothdr, first);
+
+    // another fidx: the memorised params in a new header
+    ASSERT_TRUE(sls_encoder.prepareSlide(path, 8, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, slide));
+    EXPECT_TRUE(contains(slide.mothdr, "Weather"));
+    EXPECT_TRUE(contains(slide.mothdr, "0008.jpg"));
+    EXPECT_EQ(slide.mothdr.size(), first.size());
+
+    write_params("Traffic", 1000001);
+    ASSERT_TRUE(sls_encoder.prepareSlide(path, 8, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, slide));
+    EXPECT_TRUE(contains(slide.mothdr, "Traffic"));
+
+    remove(params_path.c_str());
+    ASSERT_TRUE(sls_encoder.prepareSlide(path, 8, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, slide));
+    EXPECT_FALSE(contains(slide.mothdr, "Traffic"));
+
+    remove(path.c_str());
+}
+
+// Test that a slide dump is written in the background and moved on once the slide was sent
+TEST_F(PADCoreTest, SlideDumpCompletion) {
+    const std::string path = ::testing::TempDir() + "padenc_dump_slide.jpg";
+    const std::string dump_path = ::testing::TempDir() + "padenc_dump_current";
+    const std::string completed_path = ::testing::TempDir() + "padenc_dump_completed";
+    WriteSlide(path, 3000);
+    remove(dump_path.c_str());
+    remove(completed_path.c_str());
+
+    PADPacketizer packetizer(58);
+    SLSEncoder sls_encoder(&packetizer);
+    int sent = 0;
+    ASSERT_TRUE(sls_encoder.encodeSlide(path, 7, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, dump_path, [&](bool done_sent) {
+        EXPECT_TRUE(done_sent);
+        sent++;
+        sls_encoder.GetDumper().Complete(dump_path, completed_path);
+    }));
+    sls_encoder.GetDumper().Flush();
+    EXPECT_EQ(access(dump_path.c_str(), F_OK), 0);
+    EXPECT_EQ(access(completed_path.c_str(), F_OK), -1);
+
+    // the header and all body segments, but only the last one completes the slide
+    while (packetizer.QueueFilled()) {
+        EXPECT_EQ(sent, 0);
+        packetizer.GetNextPAD(true);
+    }
+    EXPECT_EQ(sent, 1);
+    sls_encoder.GetDumper().Flush();
+    EXPECT_EQ(access(dump_path.c_str(), F_OK), -1);
+    std::ifstream completed(completed_path, std::ios::binary);
+    std::vector<char> data((std::istreambuf_iterator<char>(completed)), std::istreambuf_iterator<char>());
+    ASSERT_EQ(data.size(), 3000u);
+    EXPECT_EQ(data[1], 7);
+
+    remove(path.c_str());
+    remove(completed_path.c_str());
+}
+
+// Test that the done handler of a DG is called once sent, or when dropped unsent
+TEST_F(PADCoreTest, DataGroupDoneHandler) {
+    PADPacketizer packetizer(58);
+    std::vector<bool> done;
+    for (int i = 0; i < 2; i++) {
+        DATA_GROUP* dg = packetizer.CreateDataGroup(200, SLSEncoder::APPTYPE_MOT_START, SLSEncoder::APPTYPE_MOT_CONT);
+        dg->AppendCRC();
+        dg->done_handler = [&](bool sent) {done.push_back(sent);};
+        packetizer.AddDG(dg, false);
+    }
+
+    // the first DG is started, so only the second one is dropped
+    packetizer.GetNextPAD(true);
+    EXPECT_TRUE(done.empty());
+    EXPECT_EQ(packetizer.DropDGs(SLSEncoder::APPTYPE_MOT_START), 1u);
+    EXPECT_EQ(done, std::vector<bool>({false}));
+    DrainPackets(packetizer);
+    EXPECT_EQ(done, std::vector<bool>({false, true}));
+
+    // recycled DGs do not keep the handler
+    DATA_GROUP* dg = packetizer.CreateDataGroup(20, SLSEncoder::APPTYPE_MOT_START, SLSEncoder::APPTYPE_MOT_CONT);
+    EXPECT_FALSE(dg->done_handler);
+    packetizer.AddDG(dg, false);
+    DrainPackets(packetizer);
+    EXPECT_EQ(done.size(), 2u);
+}
+
+// Test that MOT headers are repeated within the body and that slides can be repeated as a whole
+TEST_F(PADCoreTest, SlideRepetition) {
+    const std::string path = ::testing::TempDir() + "padenc_repeated_slide.jpg";
+    WriteSlide(path, 5000);
+
+    PADPacketizer packetizer(58);
+    SLSEncoder sls_encoder(&packetizer);
+    EXPECT_FALSE(sls_encoder.repeatSlide());
+
+    // header and 5 body segments
+    ASSERT_TRUE(sls_encoder.encodeSlide(path, 7, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, ""));
+    EXPECT_EQ(packetizer.QueuedDGs(12), 6u);
+    EXPECT_EQ(packetizer.QueuedDGs(1), 6u);
+    DrainPackets(packetizer);
+
+    // the header once more after the 2nd and 4th segment
+    sls_encoder.SetHeaderRepetition(2);
+    ASSERT_TRUE(sls_encoder.encodeSlide(path, 7, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, ""));
+    EXPECT_EQ(packetizer.QueuedDGs(12), 8u);
+    const size_t bytes = packetizer.QueuedBytes(12);
+    DrainPackets(packetizer);
+
+    ASSERT_TRUE(sls_encoder.repeatSlide());
+    EXPECT_EQ(packetizer.QueuedDGs(12), 8u);
+    EXPECT_EQ(packetizer.QueuedBytes(12), bytes);
+    DrainPackets(packetizer);
+
+    remove(path.c_str());
+}
+
+// Test that the MOT directory describes the recent slides and that unchanged bodies are only sent now and then
+TEST_F(PADCoreTest, MOTDirectoryMode) {
+    MOTDirectory directory(2);
+    const slide_blob_t body = std::make_shared<const SlideBlob>(uint8_vector_t(300, 0x55));
+    const uint8_vector_t header(10, 0x01);
+
+    EXPECT_TRUE(directory.Add(1, header, body, 2));
+    const int tid = directory.TransportId();
+    EXPECT_FALSE(directory.Add(1, header, std::make_shared<const SlideBlob>(uint8_vector_t(300, 0x55)), 2));  // same content
+    EXPECT_EQ(directory.TransportId(), tid);
+    EXPECT_TRUE(directory.Add(1, header, body, 2));     // every 2nd time
+    EXPECT_TRUE(directory.Add(2, header, body, 2));
+    EXPECT_NE(directory.TransportId(), tid);
+    EXPECT_TRUE(directory.Add(3, uint8_vector_t(12, 0x02), body, 2));
+    EXPECT_EQ(directory.Count(), 2u);   // the least recently added one dropped
+
+    // the directory header (13 bytes), then TransportId and MOT header per object
+    const slide_blob_t data = directory.Build(100);
+    ASSERT_EQ(data->Size(), 13 + (2 + 12) + (2 + 10u));
+    const uint8_t* d = data->Data();
+    EXPECT_EQ((d[0] << 24) | (d[1] << 16) | (d[2] << 8) | d[3], 13 + (2 + 12) + (2 + 10));
+    EXPECT_EQ((d[4] << 8) | d[5], 2);
+    EXPECT_EQ((d[9] << 8) | d[10], 100);
+    EXPECT_EQ((d[13] << 8) | d[14], 3);
+    EXPECT_EQ((d[27] << 8) | d[28], 2);
+    EXPECT_EQ(directory.Build(100), data);
+
+    // the directory (1 segment of data group type 6) and the body (5 segments), but no header
+    const std::string path = ::testing::TempDir() + "padenc_directory_slide.jpg";
+    WriteSlide(path, 5000);
+    PADPacketizer packetizer(58);
+    SLSEncoder sls_encoder(&packetizer);
+    sls_encoder.SetDirectoryMode(10, 2);
+    int done = 0;
+    ASSERT_TRUE(sls_encoder.encodeSlide(path, 7, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, "", [&done](bool) {done++;}));
+    EXPECT_EQ(packetizer.QueuedDGs(12), 6u);
+    DrainPackets(packetizer);
+    EXPECT_EQ(done, 1);
+
+    // only the directory for the unchanged slide, which then completes it
+    ASSERT_TRUE(sls_encoder.encodeSlide(path, 7, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, "", [&done](bool) {done++;}));
+    EXPECT_EQ(packetizer.QueuedDGs(12), 1u);
+    DrainPackets(packetizer);
+    EXPECT_EQ(done, 2);
+
+    ASSERT_TRUE(sls_encoder.encodeSlide(path, 7, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, ""));
+    EXPECT_EQ(packetizer.QueuedDGs(12), 6u);
+    DrainPackets(packetizer);
+
+    // a repetition always has the body
+    ASSERT_TRUE(sls_encoder.repeatSlide());
+    EXPECT_EQ(packetizer.QueuedDGs(12), 6u);
+    DrainPackets(packetizer);
+
+    remove(path.c_str());
+}
+
+// Test that MOT objects are segmented completely, also when the body size is a multiple of the segment length
+TEST_F(PADCoreTest, MOTObjectSegments) {
+    PADPacketizer packetizer(58);
+    MOTObjectBuilder builder(&packetizer, SLSEncoder::APPTYPE_MOT_START, SLSEncoder::APPTYPE_MOT_CONT, 100);
+    const slide_blob_t header = std::make_shared<const SlideBlob>(uint8_vector_t(10, 0x01));
+
+    // header and 3 full body segments, each with MSC DG header (9) and CRC (2)
+    builder.QueueObject(header, std::make_shared<const SlideBlob>(uint8_vector_t(300, 0x55)), 1, false);
+    EXPECT_EQ(packetizer.QueuedDGs(12), 4u);
+    EXPECT_EQ(packetizer.QueuedBytes(12), (9 + 10 + 2) + 3 * (9 + 100 + 2u));
+    DrainPackets(packetizer);
+
+    // a shorter last segment
+    builder.QueueObject(header, std::make_shared<const SlideBlob>(uint8_vector_t(250, 0x55)), 2, false);
+    EXPECT_EQ(packetizer.QueuedDGs(12), 4u);
+    EXPECT_EQ(packetizer.QueuedBytes(12), (9 + 10 + 2) + 2 * (9 + 100 + 2u) + (9 + 50 + 2));
+    DrainPackets(packetizer);
+
+    // the header once more before the 2nd and the last segment (but not twice, nor before the 1st)
+    std::vector<int> positions;
+    EXPECT_FALSE(MOTObjectBuilder::ParseHeaderPositions("1,x", positions));
+    EXPECT_FALSE(MOTObjectBuilder::ParseHeaderPositions("1,,2", positions));
+    ASSERT_TRUE(MOTObjectBuilder::ParseHeaderPositions("0,1,-1,-3,9", positions));
+    EXPECT_EQ(positions, std::vector<int>({0, 1, -1, -3, 9}));
+    builder.SetHeaderPositions(positions);
+    builder.QueueObject(header, std::make_shared<const SlideBlob>(uint8_vector_t(350, 0x55)), 3, false);
+    EXPECT_EQ(packetizer.QueuedDGs(12), 7u);
+    DrainPackets(packetizer);
+}
+
+// Test that blobs of the same content are held once, for as long as they are used
+TEST_F(PADCoreTest, SlideBlobStore) {
+    SlideBlobStore store;
+    const uint8_vector_t content(1000, 0x42);
+
+    slide_blob_t a = store.Intern(uint8_vector_t(content));
+    slide_blob_t b = store.Intern(content.data(), content.size());
+    EXPECT_EQ(a, b);
+    slide_blob_t other = store.Intern(uint8_vector_t(1000, 0x43));
+    EXPECT_NE(other, a);
+    EXPECT_EQ(store.Count(), 2u);
+
+    // a rendition is found as long as it is held, by whoever added it
+    slide_blob_t rendition = store.AddRendition("0042_jpeg_1000", std::make_shared<const SlideBlob>(uint8_vector_t(content)));
+    EXPECT_EQ(rendition, a);
+    EXPECT_EQ(store.FindRendition("0042_jpeg_1000"), a);
+    EXPECT_EQ(store.FindRendition("0042_png_1000"), nullptr);
+
+    // gone with its last user
+    a.reset();
+    b.reset();
+    rendition.reset();
+    EXPECT_EQ(store.FindRendition("0042_jpeg_1000"), nullptr);
+    slide_blob_t again = store.Intern(content.data(), content.size());
+    EXPECT_EQ(again->Size(), 1000u);
+}
+
+// Test that the least recently used slides are dropped when the cache is full
+TEST_F(PADCoreTest, SlideCacheEviction) {
+    SlideCache cache(10000);
+
+    auto insert = [&cache](const fingerprint_t& fp) {
+        slide_cache_entry_t entry;
+        entry.fp = fp;
+        entry.raw_slide = true;
+        entry.max_slide_size = SLSEncoder::MAXSLIDESIZE_SIMPLE;
+        entry.params_mtime = 0;
+        entry.jfif_not_png = true;
+        entry.blob = std::make_shared<const SlideBlob>(std::vector<uint8_t>(4000).data(), 4000);
+        cache.Insert(entry);
+    };
+    const fingerprint_t slide0 = {"slide0", 4000, 1, 0};
+    const fingerprint_t slide1 = {"slide1", 4000, 1, 1};
+    const fingerprint_t slide2 = {"slide2", 4000, 1, 2};
+
+    insert(slide0);
+    insert(slide1);
+    ASSERT_NE(cache.Find(slide0, true, SLSEncoder::MAXSLIDESIZE_SIMPLE), nullptr);
+    insert(slide2);
+
+    EXPECT_EQ(cache.Count(), 2u);
+    EXPECT_EQ(cache.Size(), 8000u);
+    EXPECT_EQ(cache.Find(slide1, true, SLSEncoder::MAXSLIDESIZE_SIMPLE), nullptr);
+    EXPECT_NE(cache.Find(slide2, true, SLSEncoder::MAXSLIDESIZE_SIMPLE), nullptr);
+    EXPECT_EQ(cache.Find(slide0, false, SLSEncoder::MAXSLIDESIZE_SIMPLE), nullptr);   // other parameters
+}
+
+// Test that evicted slides are spilled to disk, and that only slides used more often displace others in memory
+TEST_F(PADCoreTest, SlideCacheSpill) {
+    char dir_template[] = "/tmp/padenc_spillXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = dir_template;
+
+    SlideCache cache(10000);
+    cache.SetSpill(dir, 40000);     // two segments of 20000 bytes
+
+    auto insert = [&cache](const std::string& name, uint8_t fill) {
+        slide_cache_entry_t entry;
+        entry.fp = {name, 4000, 1, fill};
+        entry.raw_slide = true;
+        entry.max_slide_size = SLSEncoder::MAXSLIDESIZE_SIMPLE;
+        entry.params_mtime = 0;
+        entry.jfif_not_png = true;
+        entry.blob = std::make_shared<const SlideBlob>(uint8_vector_t(4000, fill));
+        cache.Insert(entry);
+    };
+    auto find = [&cache](const std::string& name, uint8_t fill) {
+        const fingerprint_t fp = {name, 4000, 1, fill};
+        return cache.Find(fp, true, SLSEncoder::MAXSLIDESIZE_SIMPLE);
+    };
+
+    // a carousel of two slides, used several times
+    insert("slide0", 0);
+    insert("slide1", 1);
+    for (int i = 0; i < 3; i++) {
+        ASSERT_NE(find("slide0", 0), nullptr);
+        ASSERT_NE(find("slide1", 1), nullptr);
+    }
+
+    // a scan of slides used once only goes to the spill
+    for (int i = 2; i < 6; i++)
+        insert("slide" + std::to_string(i), i);
+    EXPECT_EQ(cache.Size(), 8000u);
+    EXPECT_EQ(cache.Count(), 6u);
+    EXPECT_EQ(cache.SpilledCount(), 4u);
+    EXPECT_EQ(cache.GetEntries().front().fp.s_name, "slide1");
+
+    // a spilled slide is still found, with its content
+    slide_cache_entry_t* entry = find("slide3", 3);
+    ASSERT_NE(entry, nullptr);
+    EXPECT_NE(entry->spill_segment, 0u);
+    ASSERT_EQ(entry->blob->Size(), 4000u);
+    EXPECT_EQ(entry->blob->Data()[0], 3);
+    EXPECT_EQ(entry->blob->Data()[3999], 3);
+
+    // and moves back into memory once it is used more often than the least recently used slide there
+    for (int i = 0; i < 4; i++)
+        entry = find("slide3", 3);
+    ASSERT_NE(entry, nullptr);
+    EXPECT_EQ(entry->spill_segment, 0u);
+    EXPECT_EQ(cache.GetEntries().front().fp.s_name, "slide3");
+    EXPECT_EQ(cache.Size(), 8000u);
+    EXPECT_EQ(cache.Count(), 6u);
+    ASSERT_NE(find("slide0", 0), nullptr);  // spilled in turn
+    EXPECT_EQ(find("slide0", 0)->blob->Data()[0], 0);
+
+    // the slides of the oldest segment are dropped once a third one is started
+    for (int i = 6; i < 16; i++)
+        insert("slide" + std::to_string(i), i);
+    EXPECT_LE(cache.SpilledCount(), 10u);
+    EXPECT_EQ(find("slide2", 2), nullptr);
+    EXPECT_NE(find("slide15", 15), nullptr);
+    EXPECT_EQ(find("slide15", 15)->blob->Data()[0], 15);
+
+    // nothing left behind
+    cache.Clear();
+    EXPECT_EQ(rmdir(dir.c_str()), 0);
+}
+
+// Test that slide caches are kept within their own and the total memory budget
+TEST_F(PADCoreTest, MemoryBudgetEviction) {
+    SlideCache cache(100000);
+    MemoryAccount account("slide_cache", "test", 10000, [&cache](size_t target) {return cache.Shrink(target);});
+    cache.SetMemoryAccount(&account);
+
+    int next_fidx = 0;
+    auto insert = [&cache, &next_fidx]() {
+        slide_cache_entry_t entry;
+        entry.fp = {"slide" + std::to_string(next_fidx), 4000, 1, next_fidx};
+        entry.raw_slide = true;
+        entry.max_slide_size = SLSEncoder::MAXSLIDESIZE_SIMPLE;
+        entry.params_mtime = 0;
+        entry.jfif_not_png = true;
+        entry.blob = std::make_shared<const SlideBlob>(std::vector<uint8_t>(4000).data(), 4000);
+        cache.Insert(entry);
+        next_fidx++;
+    };
+
+    // the account's own budget
+    for (int i = 0; i < 3; i++)
+        insert();
+    EXPECT_EQ(cache.Size(), 8000u);
+    EXPECT_EQ(account.Usage(), 8000u);
+    EXPECT_EQ(account.Evicted(), 4000u);
+
+    // the total budget, with memory that cannot be evicted
+    MemoryAccount fixed("fixed", "test", 0);
+    const size_t usage_before = MemoryBudget::Global().TotalUsage();
+    MemoryBudget::Global().SetTotalBudget(usage_before + 1000);
+    fixed.Update(4000);
+    EXPECT_EQ(MemoryBudget::Global().TotalUsage(), usage_before + 4000);
+    insert();
+    EXPECT_EQ(cache.Count(), 1u);   // the most recently used slide is kept
+    EXPECT_EQ(account.Usage(), 4000u);
+    MemoryBudget::Global().SetTotalBudget(0);
+
+    const std::vector<MemoryBudget::account_stats_t> stats = MemoryBudget::Global().Stats("test");
+    ASSERT_EQ(stats.size(), 2u);
+    EXPECT_EQ(stats[0].name, "slide_cache");
+    EXPECT_EQ(stats[0].budget, 10000u);
+    EXPECT_TRUE(stats[0].evictable);
+    EXPECT_FALSE(stats[1].evictable);
+    EXPECT_NE(MemoryBudget::Global().StatsJSON().find("{\"name\":\"fixed\",\"service\":\"test\",\"usage\":4000,"), std::string::npos);
+    EXPECT_NE(MetricsRegistry::Global().Render().find("odr_padenc_memory_bytes{account=\"slide_cache\",service=\"test\"} 4000\n"),
+              std::string::npos);
+
+    cache.SetMemoryAccount(nullptr);
+}
+
+// Test the CPU lists of the thread placement
+TEST_F(PADCoreTest, ThreadPlacementCPUList) {
+    std::vector<int> cpus;
+    ASSERT_TRUE(ThreadPlacement::ParseCPUList("4,0-2,1", cpus));
+    EXPECT_EQ(cpus, std::vector<int>({0, 1, 2, 4}));
+    EXPECT_EQ(ThreadPlacement::FormatCPUList(cpus), "0-2,4");
+    EXPECT_EQ(ThreadPlacement::FormatCPUList({3}), "3");
+
+    for (const char* invalid : {"", "a", "1,", "2-1", "1-", "-1", "1;2"})
+        EXPECT_FALSE(ThreadPlacement::ParseCPUList(invalid, cpus)) << invalid;
+
+    ThreadPlacement placement;
+    EXPECT_FALSE(placement.Enabled());
+    EXPECT_TRUE(placement.Configure(0, -1, {}));
+    EXPECT_FALSE(placement.Enabled());
+    EXPECT_FALSE(placement.Configure(0, 1023, {}));     // hardly available
+    EXPECT_FALSE(placement.Configure(0, -1, {1023}));
+}
+
+// Test the NUMA nodes read from sysfs, and the node of a socket's process
+TEST_F(PADCoreTest, NumaTopology) {
+    char dir_template[] = "/tmp/padenc_numaXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = dir_template;
+    auto write_cpulist = [&dir](int node, const std::string& list) {
+        const std::string node_dir = dir + "/node" + std::to_string(node);
+        mkdir(node_dir.c_str(), 0755);
+        std::ofstream(node_dir + "/cpulist") << list << "\n";
+    };
+    write_cpulist(0, "0-3,8-11");
+    write_cpulist(1, "4-7,12-15");
+    write_cpulist(2, "");   // memory only
+
+    NumaTopology topology;
+    ASSERT_TRUE(topology.Load(dir));
+    EXPECT_EQ(topology.Nodes(), 3u);
+    EXPECT_EQ(topology.CPUs(1), std::vector<int>({4, 5, 6, 7, 12, 13, 14, 15}));
+    EXPECT_TRUE(topology.CPUs(2).empty());
+    EXPECT_TRUE(topology.CPUs(3).empty());
+    EXPECT_EQ(topology.NodeOf(9), 0);
+    EXPECT_EQ(topology.NodeOf(12), 1);
+    EXPECT_EQ(topology.NodeOf(16), -1);
+    EXPECT_EQ(topology.NodeOf(std::vector<int>({4, 13})), 1);
+    EXPECT_EQ(topology.NodeOf(std::vector<int>({3, 4})), -1);
+    EXPECT_FALSE(topology.Load(dir + "/node0"));
+    for (int node = 0; node < 3; node++) {
+        const std::string node_dir = dir + "/node" + std::to_string(node);
+        unlink((node_dir + "/cpulist").c_str());
+        rmdir(node_dir.c_str());
+    }
+    rmdir(dir.c_str());
+
+    // a socket of this process
+    const std::string path = "/tmp/padenc_numa_test.audioenc";
+    unlink(path.c_str());
+    int sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+    ASSERT_GE(sock, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path.c_str());
+    ASSERT_EQ(bind(sock, (struct sockaddr*) &addr, sizeof(addr)), 0);
+
+    const NumaTopology& host = NumaTopology::Global();
+    ASSERT_GE(host.Nodes(), 1u);
+    const int node = host.NodeOfSocketPeer(path);
+    if (host.Nodes() == 1)
+        EXPECT_EQ(node, 0);
+    else
+        EXPECT_GE(node, 0);
+    EXPECT_EQ(host.NodeOfSocketPeer("/tmp/padenc_numa_none.audioenc"), -1);
+    close(sock);
+    unlink(path.c_str());
+}
+
+// Test that a slide blob takes over an encoded buffer without copying it
+TEST_F(PADCoreTest, SlideBlobTakesOverBuffer) {
+    std::vector<uint8_t> encoded(4000, 0x55);
+    const uint8_t* data = encoded.data();
+
+    slide_blob_t blob = std::make_shared<const SlideBlob>(std::move(encoded));
+    EXPECT_EQ(blob->Data(), data);
+    EXPECT_EQ(blob->Size(), 4000u);
+    EXPECT_EQ(blob->Data()[3999], 0x55);
+}
+
+// Test that the SPSC queue hands over all items in order between two threads
+TEST_F(PADCoreTest, SPSCQueueOrder) {
+    SPSCQueue<std::vector<int>> queue(3);
+    EXPECT_EQ(queue.Capacity(), 3u);
+    EXPECT_TRUE(queue.Empty());
+
+    const int count = 10000;
+    std::thread producer([&queue]() {
+        for (int i = 0; i < count; i++) {
+            std::vector<int> item(1, i);
+            while (!queue.Push(std::move(item)))
+                std::this_thread::yield();
+        }
+    });
+
+    std::vector<int> item;
+    for (int expected = 0; expected < count; expected++) {
+        while (!queue.Pop(item))
+            std::this_thread::yield();
+        ASSERT_EQ(item, std::vector<int>(1, expected));
+    }
+    producer.join();
+    EXPECT_TRUE(queue.Empty());
+    EXPECT_FALSE(queue.Pop(item));
+}
+
+// Test that the MPSC queue hands over all items of several producers, each in order
+TEST_F(PADCoreTest, MPSCQueueProducers) {
+    MPSCQueue<std::pair<int, int>> queue(8);
+    EXPECT_EQ(queue.Capacity(), 8u);
+    EXPECT_TRUE(queue.Empty());
+
+    const int producers = 4;
+    const int count = 5000;
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&queue, p]() {
+            for (int i = 0; i < count; i++) {
+                std::pair<int, int> item(p, i);
+                while (!queue.Push(std::move(item)))
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    std::vector<int> next(producers, 0);
+    std::pair<int, int> item;
+    for (int received = 0; received < producers * count; received++) {
+        while (!queue.Pop(item))
+            std::this_thread::yield();
+        ASSERT_EQ(item.second, next[item.first]);
+        next[item.first]++;
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    EXPECT_TRUE(queue.Empty());
+    EXPECT_FALSE(queue.Pop(item));
+
+    // full
+    for (int i = 0; i < 8; i++)
+        EXPECT_TRUE(queue.Push(std::make_pair(0, i)));
+    EXPECT_FALSE(queue.Push(std::make_pair(0, 8)));
+    EXPECT_EQ(queue.Size(), 8u);
+}
+
+// Test that a log site lets a burst of messages through per window and counts the others
+TEST_F(PADCoreTest, LogSiteRateLimit) {
+    LogSite site("test.limited", 2, 1);
+    const uint64_t second = 1000000000;
+    uint32_t suppressed;
+    EXPECT_TRUE(site.Admit(5 * second, suppressed));
+    EXPECT_EQ(suppressed, 0u);
+    EXPECT_TRUE(site.Admit(5 * second + 1, suppressed));
+    EXPECT_FALSE(site.Admit(5 * second + 2, suppressed));
+    EXPECT_FALSE(site.Admit(5 * second + 3, suppressed));
+
+    // the next window
+    EXPECT_TRUE(site.Admit(6 * second + 2, suppressed));
+    EXPECT_EQ(suppressed, 2u);
+    EXPECT_TRUE(site.Admit(6 * second + 3, suppressed));
+    EXPECT_EQ(suppressed, 0u);
+
+    LogSite unlimited("test.unlimited", 0);
+    for (int i = 0; i < 100; i++)
+        EXPECT_TRUE(unlimited.Admit(5 * second, suppressed));
+}
+
+// Test that the background writer writes all messages in order, repetitions only once
+TEST_F(PADCoreTest, PadLogBackgroundWriter) {
+    char path[] = "/tmp/padenc_test_log_XXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_NE(fd, -1);
+    fflush(stderr);
+    const int saved_stderr = dup(STDERR_FILENO);
+    dup2(fd, STDERR_FILENO);
+
+    static LogSite site("test.log", 0);
+    static LogSite limited("test.log_limited", 1, 60);
+    PadLog& log = PadLog::Global();
+    log.Start(false);
+    log.Write(site, LogLevel::INFO, {{"n", 1}}, "message %d", 1);
+    for (int i = 0; i < 3; i++)
+        log.Write(site, LogLevel::INFO, {}, "message %d", 2);
+    log.Write(site, LogLevel::WARNING, {}, "message %d", 3);
+    for (int i = 0; i < 3; i++)
+        log.Write(limited, LogLevel::ERROR, {}, "limited %d", i);
+    log.Stop();
+
+    // written at once when stopped
+    log.Write(site, LogLevel::DEBUG, {}, "message %d", 4);
+
+    fflush(stderr);
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stderr);
+    close(fd);
+
+    std::ifstream file(path);
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(file, line);)
+        lines.push_back(line);
+    remove(path);
+
+    const std::vector<std::string> expected = {
+        "ODR-PadEnc message 1",
+        "ODR-PadEnc message 2",
+        "ODR-PadEnc last message repeated 2 times",
+        "ODR-PadEnc Warning: message 3",
+        "ODR-PadEnc Error: limited 0",
+        "ODR-PadEnc message 4",
+    };
+    EXPECT_EQ(lines, expected);
+    EXPECT_EQ(log.Dropped(), 0u);
+}
+
+// Test that the slide preparer provides the slides dir's slides in order
+TEST_F(PADCoreTest, SlidePreparerLookAhead) {
+    char dir_template[] = "/tmp/padenc_slidesXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = dir_template;
+    for (int i = 0; i < 3; i++)
+        WriteSlide(dir + "/slide" + std::to_string(i) + ".jpg", 1000 + i);
+
+    PADPacketizer packetizer(58);
+    SLSEncoder sls_encoder(&packetizer);
+    std::vector<std::string> received;
+    SlideStateFile state_file("");
+    RereadWatcher reread_watcher;
+    RereadRequest* reread_request = reread_watcher.Add("slides dir", dir + "/" + SLSEncoder::REQUEST_REREAD_FILENAME);
+    {
+        SlidePreparer preparer(&sls_encoder, dir, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, false, History::MAXHISTORYLEN, false, 2, std::chrono::milliseconds(10), &state_file, reread_request);
+
+        prepared_slide_t slide;
+        while (received.size() < 4) {
+            ASSERT_FALSE(preparer.Failed());
+            if (preparer.GetSlide(slide)) {
+                received.push_back(slide.filepath);
+                EXPECT_EQ(slide.blob->Size(), 1000u + (received.size() - 1) % 3);
+                sls_encoder.queueSlide(slide, "");
+                EXPECT_TRUE(packetizer.QueueContainsDG(SLSEncoder::APPTYPE_MOT_START));
+                DrainPackets(packetizer);
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+    EXPECT_EQ(received, std::vector<std::string>({dir + "/slide0.jpg", dir + "/slide1.jpg", dir + "/slide2.jpg", dir + "/slide0.jpg"}));
+
+    for (int i = 0; i < 3; i++)
+        remove((dir + "/slide" + std::to_string(i) + ".jpg").c_str());
+    rmdir(dir.c_str());
+}
+
+// Test that the slide preparer erases a slide only once it was sent, and does not prepare it again meanwhile
+TEST_F(PADCoreTest, SlidePreparerEraseAfterTx) {
+    char dir_template[] = "/tmp/padenc_slidesXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = dir_template;
+    const std::string path = dir + "/slide.jpg";
+    WriteSlide(path, 1000);
+
+    PADPacketizer packetizer(58);
+    SLSEncoder sls_encoder(&packetizer);
+    SlideStateFile state_file("");
+    RereadWatcher reread_watcher;
+    RereadRequest* reread_request = reread_watcher.Add("slides dir", dir + "/" + SLSEncoder::REQUEST_REREAD_FILENAME);
+    {
+        SlidePreparer preparer(&sls_encoder, dir, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, true, History::MAXHISTORYLEN, false, 2, std::chrono::milliseconds(10), &state_file, reread_request);
+
+        prepared_slide_t slide;
+        while (!preparer.GetSlide(slide)) {
+            ASSERT_FALSE(preparer.Failed());
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        sls_encoder.queueSlide(slide, "", [&](bool sent) {preparer.SlideDone(slide.filepath, sent);});
+
+        // several slides dir re-reads later
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        EXPECT_EQ(access(path.c_str(), F_OK), 0);
+        EXPECT_FALSE(preparer.GetSlide(slide));
+
+        DrainPackets(packetizer);
+        EXPECT_EQ(access(path.c_str(), F_OK), -1);
+    }
+
+    rmdir(dir.c_str());
+}
+
+// Test that a batch of injected slides is prepared ahead of the slides dir, in order
+TEST_F(PADCoreTest, SlidePreparerInjectBatch) {
+    char dir_template[] = "/tmp/padenc_slidesXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = dir_template;
+    WriteSlide(dir + "/slide.jpg", 1000);
+    std::vector<injected_slide_t> batch;
+    for (int i = 0; i < 3; i++) {
+        batch.push_back({dir + "/injected" + std::to_string(i) + ".jpg", false});
+        WriteSlide(batch.back().filepath, 2000 + i);
+    }
+
+    PADPacketizer packetizer(58);
+    SLSEncoder sls_encoder(&packetizer);
+    SlideStateFile state_file("");
+    RereadWatcher reread_watcher;
+    RereadRequest* reread_request = reread_watcher.Add("slides dir", dir + "/" + SLSEncoder::REQUEST_REREAD_FILENAME);
+    std::vector<std::string> received;
+    {
+        SlidePreparer preparer(&sls_encoder, dir, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, false, History::MAXHISTORYLEN, false, 2, std::chrono::milliseconds(10), &state_file, reread_request);
+        preparer.Inject(batch);
+        EXPECT_EQ(preparer.InjectedPending(), 3u);
+
+        prepared_slide_t slide;
+        bool erase;
+        while (received.size() < 3) {
+            if (preparer.GetInjectedSlide(slide, erase)) {
+                received.push_back(slide.filepath);
+                EXPECT_EQ(slide.blob->Size(), 2000u + received.size() - 1);
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        EXPECT_EQ(preparer.InjectedPending(), 0u);
+    }
+
+    for (size_t i = 0; i < batch.size(); i++) {
+        EXPECT_EQ(received[i], batch[i].filepath);
+        remove(batch[i].filepath.c_str());
+    }
+    remove((dir + "/slide.jpg").c_str());
+    rmdir(dir.c_str());
+}
+
+// Test that the slides of a dir are encoded into the slide cache on several threads
+TEST_F(PADCoreTest, PreEncodeSlides) {
+    if (std::thread::hardware_concurrency() < 2)
+        GTEST_SKIP() << "single core";
+
+    char dir_template[] = "/tmp/padenc_slidesXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = dir_template;
+    for (int i = 0; i < 20; i++)
+        WriteSlide(dir + "/slide" + std::to_string(i) + ".jpg", 1000 + i);
+
+    PADPacketizer packetizer(58);
+    SLSEncoder sls_encoder(&packetizer);
+    SlideStore slides;
+    ASSERT_TRUE(slides.InitFromDir(dir));
+    const std::atomic<bool> stop(false);
+
+    EXPECT_EQ(sls_encoder.preEncodeSlides(slides.GetSlides(), true, SLSEncoder::MAXSLIDESIZE_SIMPLE, stop), 20u);
+    EXPECT_EQ(sls_encoder.GetSlideCache().Count(), 20u);
+    EXPECT_EQ(sls_encoder.preEncodeSlides(slides.GetSlides(), true, SLSEncoder::MAXSLIDESIZE_SIMPLE, stop), 0u);
+
+    // the serial preparation finds them encoded
+    prepared_slide_t slide;
+    while (!slides.Empty()) {
+        slide_metadata_t md = slides.GetSlide();
+        ASSERT_TRUE(sls_encoder.prepareSlide(md.filepath, md.fidx, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, slide));
+    }
+    EXPECT_EQ(sls_encoder.GetSlideCache().Count(), 20u);
+
+    for (int i = 0; i < 20; i++)
+        remove((dir + "/slide" + std::to_string(i) + ".jpg").c_str());
+    rmdir(dir.c_str());
+}
+
+// Test that the adaptive MOT segment length grows with the PAD length, within the limits
+TEST_F(PADCoreTest, OptimalSegmentLength) {
+    size_t previous = 0;
+    for (size_t padlen : {6, 8, 16, 23, 58, 196}) {
+        size_t len = SLSEncoder::OptimalSegmentLength(padlen);
+        EXPECT_GT(len, previous) << "padlen " << padlen;
+        EXPECT_LE(len, std::min(SLSEncoder::MAXSEGLEN_LIMIT, 40 * (padlen - 2)));
+        previous = len;
+    }
+}
+
+// Test that the quality search finds the highest fitting quality with few tries
+TEST_F(PADCoreTest, SearchQuality) {
+    for (int limit = 38; limit <= 97; limit++) {
+        for (int start : {-1, 40, 60, 80, 95}) {
+            int tries = 0;
+            auto fits = [&tries, limit](int quality) {
+                EXPECT_GE(quality, 40);
+                EXPECT_LE(quality, 95);
+                tries++;
+                return quality <= limit;
+            };
+
+            int expected = limit < 40 ? -1 : std::min(limit, 95);
+            EXPECT_EQ(SLSEncoder::searchQuality(40, 95, start, fits), expected) << "limit " << limit << ", start " << start;
+            EXPECT_LE(tries, 13) << "limit " << limit << ", start " << start;
+        }
+    }
+
+    // unchanged content needs two tries only
+    int tries = 0;
+    EXPECT_EQ(SLSEncoder::searchQuality(40, 95, 72, [&tries](int quality) {tries++; return quality <= 72;}), 72);
+    EXPECT_EQ(tries, 2);
+}
+
+// Test that the format, size and progressive flag are read from the image headers alone
+TEST_F(PADCoreTest, ProbeImageHeaders) {
+    image_probe_t probe;
+
+    // JPEG: APP0, then a progressive SOF2 of 1024x768
+    const uint8_t jpeg[] = {0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x04, 0x00, 0x00,
+                            0xFF, 0xC2, 0x00, 0x11, 0x08, 0x03, 0x00, 0x04, 0x00, 0x03};
+    ASSERT_TRUE(SlideCodec::Probe(jpeg, sizeof(jpeg), probe));
+    EXPECT_EQ(probe.format, SlideCodec::Format::JPEG);
+    EXPECT_EQ(probe.width, 1024u);
+    EXPECT_EQ(probe.height, 768u);
+    EXPECT_TRUE(probe.progressive);
+    // cut before the frame header
+    EXPECT_FALSE(SlideCodec::Probe(jpeg, 10, probe));
+
+    // PNG: IHDR of 320x200
+    const uint8_t png[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n', 0x00, 0x00, 0x00, 0x0D, 'I', 'H', 'D', 'R',
+                           0x00, 0x00, 0x01, 0x40, 0x00, 0x00, 0x00, 0xC8};
+    ASSERT_TRUE(SlideCodec::Probe(png, sizeof(png), probe));
+    EXPECT_EQ(probe.format, SlideCodec::Format::PNG);
+    EXPECT_EQ(probe.width, 320u);
+    EXPECT_EQ(probe.height, 200u);
+    EXPECT_FALSE(probe.progressive);
+
+    // WebP (VP8X): canvas of 800x600
+    const uint8_t webp[] = {'R', 'I', 'F', 'F', 0x00, 0x00, 0x00, 0x00, 'W', 'E', 'B', 'P',
+                            'V', 'P', '8', 'X', 0x0A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                            0x1F, 0x03, 0x00, 0x57, 0x02, 0x00};
+    ASSERT_TRUE(SlideCodec::Probe(webp, sizeof(webp), probe));
+    EXPECT_EQ(probe.format, SlideCodec::Format::WEBP);
+    EXPECT_EQ(probe.width, 800u);
+    EXPECT_EQ(probe.height, 600u);
+
+    // HEIF: the largest ispe box (not the thumbnail)
+    const uint8_t heif[] = {0x00, 0x00, 0x00, 0x10, 'f', 't', 'y', 'p', 'h', 'e', 'i', 'c', 0x00, 0x00, 0x00, 0x00,
+                            0x00, 0x00, 0x00, 0x14, 'i', 's', 'p', 'e', 0x00, 0x00, 0x00, 0x00,
+                            0x00, 0x00, 0x00, 0xA0, 0x00, 0x00, 0x00, 0x78,
+                            0x00, 0x00, 0x00, 0x14, 'i', 's', 'p', 'e', 0x00, 0x00, 0x00, 0x00,
+                            0x00, 0x00, 0x0F, 0xC0, 0x00, 0x00, 0x0B, 0xD0};
+    ASSERT_TRUE(SlideCodec::Probe(heif, sizeof(heif), probe));
+    EXPECT_EQ(probe.format, SlideCodec::Format::HEIF);
+    EXPECT_EQ(probe.width, 4032u);
+    EXPECT_EQ(probe.height, 3024u);
+
+    // GIF: logical screen of 100x50
+    const uint8_t gif[] = {'G', 'I', 'F', '8', '9', 'a', 0x64, 0x00, 0x32, 0x00};
+    ASSERT_TRUE(SlideCodec::Probe(gif, sizeof(gif), probe));
+    EXPECT_EQ(probe.format, SlideCodec::Format::GIF);
+    EXPECT_EQ(probe.width, 100u);
+    EXPECT_EQ(probe.height, 50u);
+
+    const uint8_t text[] = "not an image";
+    EXPECT_FALSE(SlideCodec::Probe(text, sizeof(text), probe));
+    EXPECT_EQ(probe.format, SlideCodec::Format::UNKNOWN);
+}
+
+// Test that an ideally sized baseline JPEG slide is sent unchanged, without being decoded
+TEST_F(PADCoreTest, CompliantSlideUnchanged) {
+    // a valid header of 320x240 (SOF0), followed by a scan that no decoder would accept
+    std::vector<uint8_t> jpeg = {0xFF, 0xD8, 0xFF, 0xC0, 0x00, 0x11, 0x08, 0x00, 0xF0, 0x01, 0x40, 0x03,
+                                 0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01,
+                                 0xFF, 0xDA, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3F, 0x00};
+    jpeg.insert(jpeg.end(), 500, 0x55);
+    jpeg.push_back(0xFF);
+    jpeg.push_back(0xD9);
+
+    const std::string path = ::testing::TempDir() + "padenc_compliant_slide.jpg";
+    std::ofstream(path, std::ios::binary).write((const char*) jpeg.data(), jpeg.size());
+
+    PADPacketizer packetizer(58);
+    SLSEncoder sls_encoder(&packetizer);
+    prepared_slide_t slide;
+    ASSERT_TRUE(sls_encoder.prepareSlide(path, 9, false, SLSEncoder::MAXSLIDESIZE_SIMPLE, slide));
+    EXPECT_EQ(std::vector<uint8_t>(slide.blob->Data(), slide.blob->Data() + slide.blob->Size()), jpeg);
+
+    remove(path.c_str());
+}
+
+// Test that encoded slides are checked for compliance once, with the result kept in the slide cache
+TEST_F(PADCoreTest, SlideCompliance) {
+    const uint8_t baseline[] = {0xFF, 0xD8, 0xFF, 0xC0, 0x00, 0x11, 0x08, 0x00, 0xF0, 0x01, 0x40, 0x03,
+                                0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01, 0xFF, 0xD9};
+    const uint8_t progressive[] = {0xFF, 0xD8, 0xFF, 0xC2, 0x00, 0x11, 0x08, 0x03, 0x00, 0x04, 0x00, 0x03,
+                                   0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01, 0xFF, 0xD9};
+    const SlideBlob baseline_blob(baseline, sizeof(baseline));
+    const SlideBlob progressive_blob(progressive, sizeof(progressive));
+
+    EXPECT_EQ(SLSEncoder::CheckCompliance(baseline_blob, true, 1000), 0u);
+    EXPECT_EQ(SLSEncoder::CheckCompliance(baseline_blob, false, 1000), (unsigned) SLSEncoder::VIOLATION_CONTENT_TYPE);
+    EXPECT_EQ(SLSEncoder::CheckCompliance(baseline_blob, true, 10), (unsigned) SLSEncoder::VIOLATION_SIZE);
+    EXPECT_EQ(SLSEncoder::CheckCompliance(progressive_blob, true, 1000),
+              (unsigned) (SLSEncoder::VIOLATION_DIMENSIONS | SLSEncoder::VIOLATION_PROGRESSIVE));
+    EXPECT_EQ(SLSEncoder::DescribeViolations(SLSEncoder::VIOLATION_SIZE | SLSEncoder::VIOLATION_PROGRESSIVE),
+              "larger than the max slide size, progressive JPEG");
+
+    // a raw slide is sent anyway, with its violations found when it was encoded (and not again from the cache)
+    const std::string path = ::testing::TempDir() + "padenc_noncompliant_slide.jpg";
+    std::ofstream(path, std::ios::binary).write((const char*) progressive, sizeof(progressive));
+
+    PADPacketizer packetizer(58);
+    SLSEncoder sls_encoder(&packetizer);
+    prepared_slide_t slide;
+    ASSERT_TRUE(sls_encoder.prepareSlide(path, 3, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, slide));
+    EXPECT_EQ(slide.violations, (unsigned) (SLSEncoder::VIOLATION_DIMENSIONS | SLSEncoder::VIOLATION_PROGRESSIVE));
+
+    prepared_slide_t cached;
+    ASSERT_TRUE(sls_encoder.prepareSlide(path, 3, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, cached));
+    EXPECT_EQ(cached.blob, slide.blob);
+    EXPECT_EQ(cached.violations, slide.violations);
+
+    remove(path.c_str());
+}
+
+#if HAVE_LIBJPEG
+// Test that JPEG slides are scaled down and recompressed without MagickWand
+TEST_F(PADCoreTest, NativeSlideProcessing) {
+    rgb_image_t image;
+    image.width = 640;
+    image.height = 480;
+    std::mt19937 rng(1);
+    for (size_t y = 0; y < image.height; y++)
+        for (size_t x = 0; x < image.width; x++)
+            for (size_t c = 0; c < 3; c++)
+                image.pixels.push_back((uint8_t) ((x + y * c) / 3 + rng() % 32));
+
+    std::vector<uint8_t> jpeg;
+    ASSERT_TRUE(SlideCodec::EncodeJPEG(image, 95, jpeg));
+    ASSERT_GT(jpeg.size(), SLSEncoder::MAXSLIDESIZE_SIMPLE);
+    ASSERT_EQ(SlideCodec::DetectFormat(jpeg.data(), jpeg.size()), SlideCodec::Format::JPEG);
+
+    const std::string path = ::testing::TempDir() + "padenc_native_slide.jpg";
+    std::ofstream(path, std::ios::binary).write((const char*) jpeg.data(), jpeg.size());
+
+    PADPacketizer packetizer(58);
+    SLSEncoder sls_encoder(&packetizer);
+    prepared_slide_t slide;
+    ASSERT_TRUE(sls_encoder.prepareSlide(path, 7, false, SLSEncoder::MAXSLIDESIZE_SIMPLE, slide));
+    EXPECT_LE(slide.blob->Size(), SLSEncoder::MAXSLIDESIZE_SIMPLE);
+
+    size_t width, height;
+    bool progressive;
+    ASSERT_TRUE(SlideCodec::ReadInfo(SlideCodec::Format::JPEG, slide.blob->Data(), slide.blob->Size(), width, height, progressive));
+    EXPECT_EQ(width, 320u);
+    EXPECT_EQ(height, 240u);
+    EXPECT_FALSE(progressive);
+
+    // an ideally sized slide is used as it is, only without the comment
+    const uint8_t* data = slide.blob->Data();
+    std::vector<uint8_t> commented(data, data + 2);
+    const uint8_t comment[] = {0xFF, 0xFE, 0x00, 0x06, 'T', 'e', 's', 't'};
+    commented.insert(commented.end(), comment, comment + sizeof(comment));
+    commented.insert(commented.end(), data + 2, data + slide.blob->Size());
+    std::ofstream(path, std::ios::binary | std::ios::trunc).write((const char*) commented.data(), commented.size());
+
+    prepared_slide_t unchanged;
+    ASSERT_TRUE(sls_encoder.prepareSlide(path, 8, false, SLSEncoder::MAXSLIDESIZE_SIMPLE, unchanged));
+    EXPECT_EQ(std::vector<uint8_t>(unchanged.blob->Data(), unchanged.blob->Data() + unchanged.blob->Size()),
+              std::vector<uint8_t>(data, data + slide.blob->Size()));
+
+    remove(path.c_str());
+}
+
+// Test that the downscaler averages the covered area exactly
+TEST_F(PADCoreTest, DownscaleAveragesArea) {
+    rgb_image_t image;
+    image.width = 4;
+    image.height = 2;
+    const uint8_t pixels[] = {
+        0, 10, 255,     100, 10, 255,   7, 0, 0,    9, 0, 255,
+        40, 10, 255,    60, 10, 255,    5, 0, 0,    3, 255, 255,
+    };
+    image.pixels.assign(pixels, pixels + sizeof(pixels));
+
+    rgb_image_t scaled;
+    SlideCodec::Downscale(image, 2, 1, scaled);
+    const uint8_t expected[] = {50, 10, 255,    6, 64, 128};
+    EXPECT_EQ(scaled.pixels, std::vector<uint8_t>(expected, expected + sizeof(expected)));
+
+    // non-integer ratios keep a uniform image uniform
+    image.width = 333;
+    image.height = 251;
+    image.pixels.assign(image.width * image.height * 3, 201);
+    SlideCodec::Downscale(image, 320, 240, scaled);
+    EXPECT_EQ(scaled.pixels, std::vector<uint8_t>(320 * 240 * 3, 201));
+}
+
+// Test that the image analysis tells flat, high contrast and sharp images apart
+TEST_F(PADCoreTest, AnalyzeImage) {
+    rgb_image_t image;
+    image.width = 80;
+    image.height = 60;
+    image.pixels.assign(image.width * image.height * 3, 102);
+    image_stats_t flat = SlideCodec::Analyze(image);
+    EXPECT_NEAR(flat.brightness, 0.4, 0.01);
+    EXPECT_EQ(flat.contrast, 0.0);
+    EXPECT_EQ(flat.sharpness, 0.0);
+
+    // left half black, right half white: full contrast, but sharp at the edge only
+    for (size_t y = 0; y < image.height; y++)
+        for (size_t x = 0; x < image.width; x++)
+            for (size_t c = 0; c < 3; c++)
+                image.pixels[(y * image.width + x) * 3 + c] = x < image.width / 2 ? 0 : 255;
+    image_stats_t halves = SlideCodec::Analyze(image);
+    EXPECT_NEAR(halves.contrast, 1.0, 0.01);
+
+    // checkerboard: sharp everywhere
+    for (size_t y = 0; y < image.height; y++)
+        for (size_t x = 0; x < image.width; x++)
+            for (size_t c = 0; c < 3; c++)
+                image.pixels[(y * image.width + x) * 3 + c] = (x + y) % 2 ? 0 : 255;
+    image_stats_t checkerboard = SlideCodec::Analyze(image);
+    EXPECT_GT(checkerboard.sharpness, halves.sharpness);
+    EXPECT_EQ(checkerboard.sharpness, 1.0);
+}
+
+#if HAVE_LIBPNG
+// Test that a graphic is encoded as palette PNG, even from a JPEG image, if format candidates are enabled
+TEST_F(PADCoreTest, SlideFormatCandidates) {
+    // blocks of 8 colours, aligned to the scaling down by 2
+    rgb_image_t image;
+    image.width = 640;
+    image.height = 480;
+    for (size_t y = 0; y < image.height; y++)
+        for (size_t x = 0; x < image.width; x++)
+            for (size_t c = 0; c < 3; c++)
+                image.pixels.push_back((uint8_t) (((x / 16 + y / 32) % 8 >> c) & 1 ? 200 : 30));
+
+    // the palette keeps the image unchanged
+    std::vector<uint8_t> png;
+    ASSERT_TRUE(SlideCodec::EncodePalettePNG(image, png));
+    rgb_image_t decoded;
+    ASSERT_TRUE(SlideCodec::Decode(SlideCodec::Format::PNG, png.data(), png.size(), 640, 480, decoded));
+    EXPECT_EQ(decoded.pixels, image.pixels);
+
+    std::vector<uint8_t> jpeg;
+    ASSERT_TRUE(SlideCodec::EncodeJPEG(image, 95, jpeg));
+    const std::string path = ::testing::TempDir() + "padenc_candidates_slide.jpg";
+    std::ofstream(path, std::ios::binary).write((const char*) jpeg.data(), jpeg.size());
+
+    PADPacketizer packetizer(58);
+    SLSEncoder single(&packetizer);
+    SLSEncoder candidates(&packetizer);
+    candidates.SetFormatCandidates(true);
+    prepared_slide_t single_slide;
+    prepared_slide_t candidates_slide;
+    ASSERT_TRUE(single.prepareSlide(path, 7, false, SLSEncoder::MAXSLIDESIZE_SIMPLE, single_slide));
+    ASSERT_TRUE(candidates.prepareSlide(path, 7, false, SLSEncoder::MAXSLIDESIZE_SIMPLE, candidates_slide));
+    EXPECT_EQ(SlideCodec::DetectFormat(single_slide.blob->Data(), single_slide.blob->Size()), SlideCodec::Format::JPEG);
+    EXPECT_EQ(SlideCodec::DetectFormat(candidates_slide.blob->Data(), candidates_slide.blob->Size()), SlideCodec::Format::PNG);
+    EXPECT_LT(candidates_slide.blob->Size(), single_slide.blob->Size());
+
+    // not for more than 256 colours
+    for (size_t i = 0; i < 257; i++) {
+        image.pixels[3 * i] = i % 256;
+        image.pixels[3 * i + 1] = i / 256;
+    }
+    EXPECT_FALSE(SlideCodec::EncodePalettePNG(image, png));
+
+    remove(path.c_str());
+}
+
+// Test that graphics are quantised to a palette closely, photos not, and that the exhaustive PNG is smaller
+TEST_F(PADCoreTest, QuantizePalette) {
+    // a logo card: flat colours with anti-aliased edges, i.e. far more than 256 colours
+    const uint8_t background[] = {240, 240, 230};
+    const uint8_t logo[][3] = {{200, 20, 40}, {20, 60, 160}, {30, 30, 30}};
+    rgb_image_t graphic;
+    graphic.width = 320;
+    graphic.height = 240;
+    for (size_t y = 0; y < graphic.height; y++) {
+        for (size_t x = 0; x < graphic.width; x++) {
+            uint8_t rgb[3] = {background[0], background[1], background[2]};
+            for (size_t i = 0; i < 3; i++) {
+                // the coverage of a circle, over a soft edge of about 3 px
+                const double distance = std::hypot(x - 60.0 - 100 * i, y - 120.0 + 30 * i) - 40;
+                const double alpha = std::min(1.0, std::max(0.0, 0.5 - distance / 3));
+                for (size_t c = 0; c < 3; c++)
+                    rgb[c] = (uint8_t) std::lround(rgb[c] * (1 - alpha) + logo[i][c] * alpha + (i == 1) * alpha * (x % 3));
+            }
+            graphic.pixels.insert(graphic.pixels.end(), rgb, rgb + 3);
+        }
+    }
+    palette_image_t palette;
+    EXPECT_FALSE(SlideCodec::ExactPalette(graphic, palette));
+    const double graphic_error = SlideCodec::QuantizePalette(graphic, palette);
+    EXPECT_LE(graphic_error, SlideCodec::MAX_PALETTE_ERROR);
+    EXPECT_EQ(palette.colormap.size(), 256u * 3);
+
+    // the error reported is the actual one
+    uint64_t error = 0;
+    for (size_t i = 0; i < graphic.width * graphic.height; i++)
+        for (size_t c = 0; c < 3; c++) {
+            const int diff = graphic.pixels[3 * i + c] - palette.colormap[3 * palette.indices[i] + c];
+            error += diff * diff;
+        }
+    EXPECT_NEAR(graphic_error, (double) error / (graphic.pixels.size()), 1e-9);
+
+    std::vector<uint8_t> quantised;
+    std::vector<uint8_t> exhaustive;
+    std::vector<uint8_t> full_colour;
+    ASSERT_TRUE(SlideCodec::EncodePNG(palette, quantised));
+    ASSERT_TRUE(SlideCodec::EncodePNG(palette, exhaustive, true));
+    ASSERT_TRUE(SlideCodec::EncodePNG(graphic, full_colour));
+    EXPECT_LE(exhaustive.size(), quantised.size());
+    EXPECT_LT(quantised.size() * 2, full_colour.size());
+
+    // noise stands for a photo
+    rgb_image_t photo = graphic;
+    std::mt19937 rng(1);
+    for (uint8_t& value : photo.pixels)
+        value = rng() % 256;
+    EXPECT_GT(SlideCodec::QuantizePalette(photo, palette), SlideCodec::MAX_PALETTE_ERROR);
+}
+#endif
+#endif
+
+// Test that the slide store follows changes of the slides dir
+TEST_F(PADCoreTest, SlideStoreFollowsDirChanges) {
+    char dir_template[] = "/tmp/padenc_slidesXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = dir_template;
+
+    auto read_store = [&dir](SlideStore& store) {
+        std::map<std::string, int> result;
+        EXPECT_TRUE(store.InitFromDir(dir));
+        while (!store.Empty()) {
+            slide_metadata_t md = store.GetSlide();
+            result[md.filepath.substr(dir.length() + 1)] = md.fidx;
+        }
+        return result;
+    };
+
+    WriteSlide(dir + "/a.jpg", 100);
+    WriteSlide(dir + "/b.jpg", 100);
+    WriteSlide(dir + "/b.jpg" + ".sls_params", 10);
+    WriteSlide(dir + "/" + SLSEncoder::REQUEST_REREAD_FILENAME, 0);
+
+    SlideStore store;
+    EXPECT_EQ(read_store(store), (std::map<std::string, int>{{"a.jpg", 0}, {"b.jpg", 1}}));
+    EXPECT_EQ(read_store(store), (std::map<std::string, int>{{"a.jpg", 0}, {"b.jpg", 1}}));
+
+    // add, change and remove slides
+    WriteSlide(dir + "/c.jpg", 100);
+    WriteSlide(dir + "/a.jpg", 200);
+    remove((dir + "/b.jpg").c_str());
+    EXPECT_EQ(read_store(store), (std::map<std::string, int>{{"a.jpg", 2}, {"c.jpg", 3}}));
+
+    rename((dir + "/c.jpg").c_str(), (dir + "/d.jpg").c_str());
+    EXPECT_EQ(read_store(store), (std::map<std::string, int>{{"a.jpg", 2}, {"d.jpg", 4}}));
+
+    for (const char* name : {"a.jpg", "d.jpg", "b.jpg.sls_params", "REQUEST_SLIDES_DIR_REREAD"})
+        remove((dir + "/" + name).c_str());
+    EXPECT_TRUE(read_store(store).empty());
+
+    // the dir vanishing is an error
+    rmdir(dir.c_str());
+    EXPECT_FALSE(store.InitFromDir(dir));
+}
+
+// Test that a burst of changes is taken over as a whole, once it settled
+TEST_F(PADCoreTest, ChangeCoalescerBursts) {
+    using std::chrono::milliseconds;
+
+    change_settle_t settle;
+    EXPECT_TRUE(ChangeCoalescer::ParseSettle("200", settle));
+    EXPECT_EQ(settle.quiet, milliseconds(200));
+    EXPECT_EQ(settle.max_delay, milliseconds(5000));
+    EXPECT_TRUE(ChangeCoalescer::ParseSettle("200,1000", settle));
+    EXPECT_EQ(settle.max_delay, milliseconds(1000));
+    for (const char* spec : {"", "x", "-1", "200,100", "1,2,3"})
+        EXPECT_FALSE(ChangeCoalescer::ParseSettle(spec, settle)) << spec;
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ChangeCoalescer coalescer;
+    coalescer.SetSettle(settle);
+    EXPECT_FALSE(coalescer.TakeDue(start));
+
+    // each change defers the burst, but at most by the maximum delay
+    for (int ms = 0; ms < 1000; ms += 100) {
+        coalescer.Note(start + milliseconds(ms));
+        EXPECT_FALSE(coalescer.TakeDue(start + milliseconds(ms + 50)));
+    }
+    EXPECT_TRUE(coalescer.TakeDue(start + milliseconds(1000)));
+    EXPECT_FALSE(coalescer.Pending());
+
+    coalescer.Note(start + milliseconds(2000));
+    EXPECT_FALSE(coalescer.TakeDue(start + milliseconds(2199)));
+    EXPECT_TRUE(coalescer.TakeDue(start + milliseconds(2200)));
+
+    // without a quiet window, each change is due at once
+    coalescer.SetSettle(change_settle_t());
+    coalescer.Note(start);
+    EXPECT_TRUE(coalescer.TakeDue(start));
+
+    // the slides dir keeps its files until the burst settled
+    char dir_template[] = "/tmp/padenc_slidesXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = dir_template;
+    WriteSlide(dir + "/a.jpg", 100);
+
+    SlideDirWatcher watcher;
+    ASSERT_TRUE(ChangeCoalescer::ParseSettle("50", settle));
+    watcher.SetSettle(settle);
+    ASSERT_TRUE(watcher.Watch(dir));
+    if (watcher.Watching()) {
+        WriteSlide(dir + "/b.jpg", 100);
+        remove((dir + "/a.jpg").c_str());
+        EXPECT_TRUE(watcher.Update());
+        EXPECT_TRUE(watcher.Settling());
+        EXPECT_EQ(watcher.GetFiles().size(), 1u);
+        EXPECT_EQ(watcher.GetFiles().count("a.jpg"), 1u);
+
+        std::this_thread::sleep_for(milliseconds(100));
+        EXPECT_TRUE(watcher.Update());
+        EXPECT_FALSE(watcher.Settling());
+        EXPECT_EQ(watcher.GetFiles().size(), 1u);
+        EXPECT_EQ(watcher.GetFiles().count("b.jpg"), 1u);
+    }
+
+    remove((dir + "/a.jpg").c_str());
+    remove((dir + "/b.jpg").c_str());
+    rmdir(dir.c_str());
+}
+
+// Test that the slide store schedules the slides by their params
+TEST_F(PADCoreTest, SlideStoreSchedule) {
+    char dir_template[] = "/tmp/padenc_scheduleXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = dir_template;
+
+    auto write_params = [&dir](const std::string& name, const std::string& params) {
+        std::ofstream file(dir + "/" + name + ".sls_params");
+        file << params;
+    };
+    auto next_slide = [&dir](SlideStore& store) {
+        return store.Empty() ? std::string() : store.GetSlide().filepath.substr(dir.length() + 1);
+    };
+
+    WriteSlide(dir + "/a.jpg", 100);
+    WriteSlide(dir + "/b.jpg", 100);
+    WriteSlide(dir + "/c.jpg", 100);
+    WriteSlide(dir + "/d.jpg", 100);
+    write_params("b.jpg", "Weight=2\nCategoryTitle=News\n");
+    write_params("c.jpg", "MinRepeat=3600\n");
+    write_params("d.jpg", "Expires=2000-01-01T00:00:00Z\n");
+
+    // the occurrences spread over the cycle; expired slides left out
+    SlideStore store;
+    ASSERT_TRUE(store.InitFromDir(dir));
+    EXPECT_EQ(store.GetSlides().size(), 3u);
+    EXPECT_EQ(next_slide(store), "b.jpg");
+    EXPECT_EQ(next_slide(store), "a.jpg");
+
+    // an urgent slide goes next, within the cycle
+    write_params("u.jpg", "Priority=1\n");
+    WriteSlide(dir + "/u.jpg", 100);
+    EXPECT_EQ(next_slide(store), "u.jpg");
+    EXPECT_EQ(next_slide(store), "c.jpg");
+    EXPECT_EQ(next_slide(store), "b.jpg");
+    EXPECT_EQ(next_slide(store), "");
+
+    // the next cycle skips a slide repeated too early; a removed slide is dropped at once
+    ASSERT_TRUE(store.InitFromDir(dir));
+    EXPECT_EQ(next_slide(store), "u.jpg");
+    remove((dir + "/b.jpg").c_str());
+    EXPECT_EQ(next_slide(store), "a.jpg");
+    EXPECT_EQ(next_slide(store), "");
+
+    slide_schedule_params_t params;
+    EXPECT_TRUE(SlideStore::ParseScheduleParam("Expires", "1700000000", params));
+    EXPECT_EQ(params.expires, 1700000000);
+    EXPECT_TRUE(SlideStore::ParseScheduleParam("Expires", "2023-11-14T22:13:20Z", params));
+    EXPECT_EQ(params.expires, 1700000000);
+    EXPECT_FALSE(SlideStore::ParseScheduleParam("Weight", "0", params));
+    EXPECT_FALSE(SlideStore::ParseScheduleParam("Priority", "high", params));
+
+    for (const char* name : {"a.jpg", "c.jpg", "d.jpg", "u.jpg", "b.jpg.sls_params", "c.jpg.sls_params", "d.jpg.sls_params", "u.jpg.sls_params"})
+        remove((dir + "/" + name).c_str());
+    rmdir(dir.c_str());
+}
+
+// Test that a streamed slides dir is taken in windows, continuing across restarts
+TEST_F(PADCoreTest, SlideStoreStreaming) {
+    char dir_template[] = "/tmp/padenc_streamXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = dir_template;
+    const std::string cursor_file = dir + ".cursor";
+
+    std::set<std::string> all;
+    for (int i = 0; i < 10; i++) {
+        const std::string name = "slide" + std::to_string(i) + ".jpg";
+        WriteSlide(dir + "/" + name, 100);
+        all.insert(name);
+    }
+    WriteSlide(dir + "/slide0.jpg.sls_params", 10);
+
+    auto read_window = [&dir](SlideStore& store) {
+        std::vector<std::string> names;
+        EXPECT_TRUE(store.InitFromDir(dir));
+        EXPECT_LE(store.GetSlides().size(), 4u);
+        while (!store.Empty())
+            names.push_back(store.GetSlide().filepath.substr(dir.length() + 1));
+        return names;
+    };
+
+    // the windows cover the dir once, then start over
+    std::vector<std::string> first;
+    {
+        SlideStore store;
+        store.SetStreaming(4, cursor_file);
+        first = read_window(store);
+        EXPECT_EQ(first.size(), 4u);
+    }
+    std::set<std::string> seen(first.begin(), first.end());
+    {
+        // continued after a restart
+        SlideStore store;
+        store.SetStreaming(4, cursor_file);
+        std::vector<std::string> second = read_window(store);
+        std::vector<std::string> third = read_window(store);
+        EXPECT_EQ(second.size(), 4u);
+        EXPECT_EQ(third.size(), 2u);
+        seen.insert(second.begin(), second.end());
+        seen.insert(third.begin(), third.end());
+        EXPECT_EQ(seen, all);
+
+        std::vector<std::string> again = read_window(store);
+        EXPECT_EQ(again, first);
+    }
+
+    for (const std::string& name : all)
+        remove((dir + "/" + name).c_str());
+    remove((dir + "/slide0.jpg.sls_params").c_str());
+    remove(cursor_file.c_str());
+    rmdir(dir.c_str());
+}
+
+// Test that the history keeps the IDs of the most recently used slides
+TEST_F(PADCoreTest, HistoryLRU) {
+    History history(3);
+    auto fp = [](const std::string& name) {
+        fingerprint_t result = {name, 1000, 42, -1};
+        return result;
+    };
+
+    EXPECT_EQ(history.get_fidx(fp("a")), 0);
+    EXPECT_EQ(history.get_fidx(fp("b")), 1);
+    EXPECT_EQ(history.get_fidx(fp("c")), 2);
+    EXPECT_EQ(history.get_fidx(fp("a")), 0);       // a is used again ...
+    EXPECT_EQ(history.get_fidx(fp("d")), 3);       // ... so b is dropped
+    EXPECT_EQ(history.size(), 3u);
+    EXPECT_EQ(history.get_fidx(fp("a")), 0);
+    EXPECT_EQ(history.get_fidx(fp("c")), 2);
+    EXPECT_EQ(history.get_fidx(fp("d")), 3);
+    EXPECT_EQ(history.get_fidx(fp("b")), 4);
+
+    fingerprint_t changed = fp("c");
+    changed.s_mtime++;
+    EXPECT_EQ(history.get_fidx(changed), 5);
+}
+
+// Test that with content hashing, a slide copied again unchanged keeps its ID
+TEST_F(PADCoreTest, HistoryContentHashing) {
+    const std::string path = ::testing::TempDir() + "padenc_content_id_slide.jpg";
+    auto copy = [&](size_t len, time_t mtime) {
+        WriteSlide(path, len);
+        struct utimbuf times = {mtime, mtime};
+        EXPECT_EQ(utime(path.c_str(), &times), 0);
+        fingerprint_t fp;
+        fp.load_from_file(path.c_str());
+        return fp;
+    };
+
+    History history;
+    history.set_content_hashing(true);
+    bool by_content;
+    EXPECT_EQ(history.get_fidx(copy(5000, 1000), path.c_str(), &by_content), 0);
+    EXPECT_FALSE(by_content);
+    EXPECT_EQ(history.get_fidx(copy(5000, 2000), path.c_str(), &by_content), 0);
+    EXPECT_TRUE(by_content);
+    // found by its attributes again, without hashing
+    EXPECT_EQ(history.get_fidx(copy(5000, 2000), nullptr, &by_content), 0);
+    EXPECT_FALSE(by_content);
+    EXPECT_EQ(history.get_entries().back().s_mtime, 2000u);
+
+    // another content, or no content hashing: a new ID
+    EXPECT_EQ(history.get_fidx(copy(4000, 3000), path.c_str()), 1);
+    History stat_only;
+    EXPECT_EQ(stat_only.get_fidx(copy(5000, 1000), path.c_str()), 0);
+    EXPECT_EQ(stat_only.get_fidx(copy(5000, 2000), path.c_str()), 1);
+    remove(path.c_str());
+}
+
+// Test a large history against a simple model, incl. many evictions
+TEST_F(PADCoreTest, HistoryLarge) {
+    const size_t len = 1000;
+    History history(len);
+    std::list<std::pair<std::string, int>> model;   // most recently used first
+
+    std::mt19937 rng(7);
+    int next_fidx = 0;
+    for (int i = 0; i < 50000; i++) {
+        std::string name = "slide" + std::to_string(rng() % 1500);
+        fingerprint_t fp = {name, 1, 1, -1};
+
+        auto it = std::find_if(model.begin(), model.end(), [&name](const std::pair<std::string, int>& e) {return e.first == name;});
+        int expected;
+        if (it != model.end()) {
+            expected = it->second;
+            model.erase(it);
+        } else {
+            expected = next_fidx;
+            next_fidx = (next_fidx + 1) % 10000;
+            if (model.size() == len)
+                model.pop_back();
+        }
+        model.emplace_front(name, expected);
+
+        ASSERT_EQ(history.get_fidx(fp), expected) << "step " << i;
+    }
+    EXPECT_EQ(history.size(), len);
+}
+
+// Test that a restart with the slide state file restores the slide IDs and encoded slides
+TEST_F(PADCoreTest, SlideStateFileRestore) {
+    const std::string path = ::testing::TempDir() + "padenc_state_slide.jpg";
+    const std::string state_path = ::testing::TempDir() + "padenc_state";
+    WriteSlide(path, 5000);
+    remove(state_path.c_str());
+
+    PADPacketizer packetizer(58);
+    std::vector<uint8_t> first_pads;
+    {
+        History history;
+        SLSEncoder sls_encoder(&packetizer);
+        SlideStateFile state_file(state_path);
+        state_file.Load(history, sls_encoder.GetSlideCache());
+        EXPECT_EQ(history.get_fidx(fingerprint_t{"other", 1, 1, -1}), 0);
+
+        int fidx = history.get_fidx(path.c_str());
+        ASSERT_TRUE(sls_encoder.encodeSlide(path, fidx, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, ""));
+        first_pads = DrainPackets(packetizer);
+        ASSERT_TRUE(state_file.SaveIfChanged(history, sls_encoder.GetSlideCache()));
+    }
+
+    // after the restart, the slide keeps its ID and is delivered from the restored cache
+    {
+        History history;
+        SLSEncoder sls_encoder(&packetizer);
+        SlideStateFile state_file(state_path);
+        EXPECT_EQ(state_file.Load(history, sls_encoder.GetSlideCache()), 1u);
+        EXPECT_EQ(history.size(), 2u);
+        EXPECT_EQ(sls_encoder.GetSlideCache().Count(), 1u);
+
+        int fidx = history.get_fidx(path.c_str());
+        EXPECT_EQ(fidx, 1);
+        ASSERT_TRUE(sls_encoder.encodeSlide(path, fidx, true, SLSEncoder::MAXSLIDESIZE_SIMPLE, ""));
+        EXPECT_EQ(DrainPackets(packetizer), first_pads);
+        EXPECT_EQ(history.get_fidx(fingerprint_t{"new", 1, 1, -1}), 2);
+    }
+
+    // a truncated state file is ignored
+    ASSERT_EQ(truncate(state_path.c_str(), 30), 0);
+    {
+        History history;
+        SLSEncoder sls_encoder(&packetizer);
+        SlideStateFile state_file(state_path);
+        EXPECT_EQ(state_file.Load(history, sls_encoder.GetSlideCache()), 0u);
+        EXPECT_EQ(history.size(), 0u);
+        EXPECT_EQ(sls_encoder.GetSlideCache().Count(), 0u);
+    }
+
+    remove(path.c_str());
+    remove(state_path.c_str());
+}
+
+// Test the single and batched request/response messages on the PAD socket
+TEST_F(PADCoreTest, PadInterfaceBatchedFrames) {
+    const std::string ident = "padenc_test_" + std::to_string(getpid());
+    const std::string audioenc_path = "/tmp/" + ident + ".audioenc";
+    const std::string padenc_path = "/tmp/" + ident + ".padenc";
+
+    PadInterface intf;
+    intf.open(ident);
+
+    int sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+    ASSERT_NE(sock, -1);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", audioenc_path.c_str());
+    unlink(addr.sun_path);
+    ASSERT_EQ(bind(sock, (const struct sockaddr*) &addr, sizeof(addr)), 0);
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", padenc_path.c_str());
+
+    auto request = [&](const std::vector<uint8_t>& message) {
+        ASSERT_EQ(sendto(sock, message.data(), message.size(), 0, (const struct sockaddr*) &addr, sizeof(addr)), (ssize_t) message.size());
+    };
+    auto receive = [&]() {
+        std::vector<uint8_t> message(8192);
+        ssize_t len = recv(sock, message.data(), message.size(), 0);
+        message.resize(std::max<ssize_t>(len, 0));
+        return message;
+    };
+
+    size_t frames = 0;
+    request({1, 58});
+    EXPECT_EQ(intf.receive_request(frames), 58);
+    EXPECT_EQ(frames, 1u);
+
+    std::vector<uint8_t> frame(PadInterface::MESSAGE_HEADER_LEN + 3, 0x11);
+    intf.send_pad_frame(frame.data(), 3);
+    EXPECT_EQ(receive(), std::vector<uint8_t>({2, 0x11, 0x11, 0x11}));
+
+    request({1, 23, 3});
+    EXPECT_EQ(intf.receive_request(frames), 23);
+    EXPECT_EQ(frames, 3u);
+
+    std::vector<uint8_t> batch(PadInterface::BATCH_HEADER_LEN + 3 * 2);
+    for (size_t i = 0; i < 6; i++)
+        batch[PadInterface::BATCH_HEADER_LEN + i] = i;
+    intf.send_pad_frames(batch.data(), 2, 3);
+    EXPECT_EQ(receive(), std::vector<uint8_t>({3, 3, 0, 1, 2, 3, 4, 5}));
+
+    // without waiting, as when polling several interfaces
+    EXPECT_EQ(intf.receive_request(frames, 0), 0);
+    request({1, 58});
+    struct pollfd fds[1];
+    fds[0].fd = intf.fd();
+    fds[0].events = POLLIN;
+    ASSERT_EQ(poll(fds, 1, 1000), 1);
+    EXPECT_EQ(intf.receive_request(frames, 0), 58);
+
+    close(sock);
+    unlink(audioenc_path.c_str());
+    unlink(padenc_path.c_str());
+}
+
+// Test the PAD socket on a UDP port, as used by odr-padenc-relay
+TEST_F(PADCoreTest, PadInterfaceUdpSequence) {
+    const uint16_t port = 20000 + getpid() % 20000;
+    PadInterface intf;
+    intf.open(PadInterface::UDP_PREFIX + std::to_string(port));
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_NE(sock, -1);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    ASSERT_EQ(connect(sock, (const struct sockaddr*) &addr, sizeof(addr)), 0);
+
+    // requests without sequence number are ignored
+    const uint8_t plain[] = {PadInterface::MESSAGE_REQUEST, 58, 2};
+    ASSERT_EQ(send(sock, plain, sizeof(plain), 0), (ssize_t) sizeof(plain));
+    const uint8_t request[] = {PadInterface::MESSAGE_REQUEST, 23, 2, 0x12, 0x34, 0x56, 0x78};
+    ASSERT_EQ(send(sock, request, sizeof(request), 0), (ssize_t) sizeof(request));
+    size_t frames = 0;
+    EXPECT_EQ(intf.receive_request(frames, 1000), 23);
+    EXPECT_EQ(frames, 2u);
+
+    // answered to the sender, behind its sequence number
+    std::vector<uint8_t> batch(PadInterface::BATCH_HEADER_LEN + 2 * 2);
+    for (size_t i = 0; i < 4; i++)
+        batch[PadInterface::BATCH_HEADER_LEN + i] = i;
+    intf.send_pad_frames(batch.data(), 2, 2);
+    std::vector<uint8_t> answer(64);
+    ssize_t len = recv(sock, answer.data(), answer.size(), 0);
+    answer.resize(std::max<ssize_t>(len, 0));
+    EXPECT_EQ(answer, std::vector<uint8_t>({0x12, 0x34, 0x56, 0x78, PadInterface::MESSAGE_PAD_DATA_BATCH, 2, 0, 1, 2, 3}));
+
+    close(sock);
+}
+
+// Test two services on two shards of odr-padenc: each answers its requests, and an error in one stops the other
+TEST_F(PADCoreTest, ShardedServices) {
+#ifndef ODR_PADENC_PATH
+    GTEST_SKIP() << "the path of the odr-padenc executable is not known";
+#else
+    const std::string prefix = "/tmp/padenc_shards_" + std::to_string(getpid());
+    const std::string log_file = prefix + ".log";
+    std::vector<std::string> idents, dls_files;
+    for (int i = 0; i < 2; i++) {
+        idents.push_back("padenc_shards_" + std::to_string(getpid()) + "_" + std::to_string(i));
+        dls_files.push_back(prefix + "_" + std::to_string(i) + ".txt");
+        std::ofstream(dls_files.back()) << "Label of service " << i;
+        unlink(("/tmp/" + idents.back() + ".padenc").c_str());
+    }
+
+    pid_t pid = fork();
+    ASSERT_NE(pid, -1);
+    if (pid == 0) {
+        int fd = open(log_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        dup2(fd, STDERR_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        execl(ODR_PADENC_PATH, ODR_PADENC_PATH, "-o", idents[0].c_str(), "-t", dls_files[0].c_str(), "--next-service",
+              "-o", idents[1].c_str(), "-t", dls_files[1].c_str(), "--shards=2", (char*) nullptr);
+        _exit(127);
+    }
+
+    // as the audio encoder of each service
+    std::vector<int> socks;
+    std::vector<struct sockaddr_un> padenc_addrs(2);
+    for (int i = 0; i < 2; i++) {
+        socks.push_back(socket(AF_UNIX, SOCK_DGRAM, 0));
+        ASSERT_NE(socks.back(), -1);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/%s.audioenc", idents[i].c_str());
+        unlink(addr.sun_path);
+        ASSERT_EQ(bind(socks.back(), (const struct sockaddr*) &addr, sizeof(addr)), 0);
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/%s.padenc", idents[i].c_str());
+        padenc_addrs[i] = addr;
+    }
+    auto request = [&](int i, uint8_t padlen) {
+        const uint8_t message[] = {PadInterface::MESSAGE_REQUEST, padlen};
+        return sendto(socks[i], message, sizeof(message), 0, (const struct sockaddr*) &padenc_addrs[i], sizeof(padenc_addrs[i])) == sizeof(message);
+    };
+
+    // both shards answer, once their sockets are open
+    for (int i = 0; i < 2; i++) {
+        bool sent = false;
+        for (int tries = 0; tries < 500 && !(sent = request(i, 58)); tries++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        ASSERT_TRUE(sent);
+    }
+    for (int i = 0; i < 2; i++) {
+        struct pollfd fds[1];
+        fds[0].fd = socks[i];
+        fds[0].events = POLLIN;
+        ASSERT_EQ(poll(fds, 1, 5000), 1) << "no answer for service " << i;
+        std::vector<uint8_t> answer(256);
+        ssize_t len = recv(socks[i], answer.data(), answer.size(), 0);
+        ASSERT_GT(len, 1);
+        EXPECT_EQ(answer[0], (uint8_t) PadInterface::MESSAGE_PAD_DATA);
+    }
+
+    // an invalid PAD length fails the second service, which stops the first as well
+    ASSERT_TRUE(request(1, 7));
+    int status = 0;
+    pid_t exited = 0;
+    for (int tries = 0; tries < 500 && !(exited = waitpid(pid, &status, WNOHANG)); tries++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if (!exited) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+    }
+    EXPECT_EQ(exited, pid) << "the other shard kept running";
+    ASSERT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 2);
+
+    std::ifstream log(log_file);
+    std::string output((std::istreambuf_iterator<char>(log)), std::istreambuf_iterator<char>());
+    EXPECT_NE(output.find("encoding 2 services in 2 shards"), std::string::npos);
+
+    for (int i = 0; i < 2; i++) {
+        close(socks[i]);
+        unlink(("/tmp/" + idents[i] + ".audioenc").c_str());
+        unlink(("/tmp/" + idents[i] + ".padenc").c_str());
+        unlink(dls_files[i].c_str());
+    }
+    unlink(log_file.c_str());
+#endif
+}
+
+// Test that an urgent label is on air with the next frame, despite frames encoded ahead
+TEST_F(PADCoreTest, UrgentLabelSkipsAheadFrames) {
+    const std::string ident = "padenc_urgent_" + std::to_string(getpid());
+    const std::string audioenc_path = "/tmp/" + ident + ".audioenc";
+    const std::string dls_file = "/tmp/" + ident + ".txt";
+    std::ofstream(dls_file) << "A label long enough to be spread over quite a few PAD frames";
+
+    PadEncoderOptions options;
+    options.padlen = 58;
+    options.pad_lookahead = 8;
+    options.dls_files.push_back(dls_file);
+    options.dls_weights.push_back(1);
+    PadEncoder encoder(options);
+
+    PadInterface intf;
+    intf.open(ident);
+    int sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+    ASSERT_NE(sock, -1);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", audioenc_path.c_str());
+    unlink(addr.sun_path);
+    ASSERT_EQ(bind(sock, (const struct sockaddr*) &addr, sizeof(addr)), 0);
+
+    const size_t frame_size = encoder.GetPADFrameSize();
+    auto next_xpad = [&]() {
+        std::vector<uint8_t> message(PadInterface::MESSAGE_HEADER_LEN + frame_size + 1);
+        EXPECT_EQ(encoder.Encode(intf, 1), 0);
+        ssize_t len = recv(sock, message.data(), message.size(), 0);
+        EXPECT_EQ(len, (ssize_t) (PadInterface::MESSAGE_HEADER_LEN + frame_size));
+        std::vector<uint8_t> xpad(message.begin() + PadInterface::MESSAGE_HEADER_LEN,
+                                  message.begin() + PadInterface::MESSAGE_HEADER_LEN + options.padlen - 2);
+        std::reverse(xpad.begin(), xpad.end());
+        return xpad;
+    };
+
+    for (int i = 0; i < 3; i++)
+        next_xpad();
+    ASSERT_TRUE(encoder.InjectLabel("Alert", true));
+    const std::vector<uint8_t> xpad = next_xpad();
+    const std::string text = "Alert";
+    EXPECT_NE(std::search(xpad.begin(), xpad.end(), text.begin(), text.end()), xpad.end());
+
+    close(sock);
+    unlink(audioenc_path.c_str());
+    unlink(("/tmp/" + ident + ".padenc").c_str());
+    unlink(dls_file.c_str());
+}
+
+// Test that an urgent label dropping frames encoded ahead in the middle of a MOT DG does not garble the slide
+TEST_F(PADCoreTest, UrgentLabelRestartsCutDGs) {
+    const std::string ident = "padenc_urgent_cut_" + std::to_string(getpid());
+    const std::string audioenc_path = "/tmp/" + ident + ".audioenc";
+    char dir_template[] = "/tmp/padenc_slidesXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = dir_template;
+    const std::string slide_path = dir + "/slide.jpg";
+    const std::string dls_file = dir + ".dls.txt";    // not in the slides dir
+    WriteSlide(slide_path, 3000);
+    std::ofstream(dls_file) << "Artist - Title";
+
+    PadEncoderOptions options;
+    options.padlen = 16;
+    options.pad_lookahead = 8;
+    options.sls_dir = dir;
+    options.raw_slides = true;
+    options.slide_lookahead = 0;
+    options.dls_files.push_back(dls_file);
+    options.dls_weights.push_back(1);
+    PadEncoder encoder(options);
+
+    PadInterface intf;
+    intf.open(ident);
+    int sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+    ASSERT_NE(sock, -1);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", audioenc_path.c_str());
+    unlink(addr.sun_path);
+    ASSERT_EQ(bind(sock, (const struct sockaddr*) &addr, sizeof(addr)), 0);
+
+    const size_t frame_size = encoder.GetPADFrameSize();
+    auto next_pad = [&]() {
+        std::vector<uint8_t> message(PadInterface::MESSAGE_HEADER_LEN + frame_size + 1);
+        EXPECT_EQ(encoder.Encode(intf, 1), 0);
+        ssize_t len = recv(sock, message.data(), message.size(), 0);
+        EXPECT_EQ(len, (ssize_t) (PadInterface::MESSAGE_HEADER_LEN + frame_size));
+        return std::vector<uint8_t>(message.begin() + PadInterface::MESSAGE_HEADER_LEN,
+                                    message.begin() + PadInterface::MESSAGE_HEADER_LEN + frame_size);
+    };
+
+    // well into the slide, whose segments exceed the frames encoded ahead
+    for (int i = 0; i < 40; i++)
+        next_pad();
+    ASSERT_TRUE(encoder.InjectLabel("Alert", true));
+
+    // from here on, every DG starts anew: no continuation without its start, every MOT DG intact
+    std::vector<uint8_t> pads;
+    for (int i = 0; i < 400; i++) {
+        const std::vector<uint8_t> pad = next_pad();
+        pads.insert(pads.end(), pad.begin(), pad.end());
+    }
+    ASSERT_TRUE(pads[options.padlen - 1] & 0x02) << "CI list expected";
+    std::vector<int> types;
+    std::vector<std::vector<uint8_t> > dgs = ParseXPADs(pads, options.padlen, &types);
+    ASSERT_EQ(types.size(), dgs.size());
+    ASSERT_FALSE(dgs.empty());
+    EXPECT_EQ(types[0], 2);     // the urgent label
+    size_t mot_dgs = 0;
+    for (size_t i = 0; i < dgs.size(); i++) {
+        EXPECT_TRUE(types[i] == PADPacketizer::APPTYPE_DGLI || types[i] == 2 || types[i] == SLSEncoder::APPTYPE_MOT_START)
+            << "DG " << i << " starts with app type " << types[i];
+        if (types[i] != SLSEncoder::APPTYPE_MOT_START || i == 0 || types[i - 1] != PADPacketizer::APPTYPE_DGLI)
+            continue;
+        const size_t len = ((dgs[i - 1][0] & 0x3F) << 8) | dgs[i - 1][1];
+        if (dgs[i].size() < len)
+            continue;   // the last one, not completely sent yet
+        ASSERT_GE(len, 2u);
+        const uint16_t crc = ~odr::crc16(0xFFFF, dgs[i].data(), len - 2);
+        EXPECT_EQ(crc, (dgs[i][len - 2] << 8) | dgs[i][len - 1]) << "MOT DG " << i;
+        mot_dgs++;
+    }
+    EXPECT_GT(mot_dgs, 1u);
+
+    close(sock);
+    unlink(audioenc_path.c_str());
+    unlink(("/tmp/" + ident + ".padenc").c_str());
+    unlink(slide_path.c_str());
+    rmdir(dir.c_str());
+    unlink(dls_file.c_str());
+}
+
+// Test that capacity questions are answered by replaying the queued data
+TEST_F(PADCoreTest, CapacityPlanner) {
+    const std::string dls_file = "/tmp/padenc_plan_" + std::to_string(getpid()) + ".txt";
+    std::ofstream(dls_file) << "A label long enough to be spread over quite a few PAD frames";
+
+    capacity_query_t query;
+    EXPECT_TRUE(query.Parse("pad=34,xpad-interval=2,slide=12000,dl-plus=1"));
+    EXPECT_EQ(query.padlen, 34);
+    EXPECT_EQ(query.xpad_interval, 2);
+    EXPECT_EQ(query.slide_size, 12000u);
+    EXPECT_EQ(query.dl_plus, 1);
+    EXPECT_TRUE(capacity_query_t().Parse("within=2.5"));
+    for (const char* spec : {"", "pad=34", "pad=7,slide=1000", "slide=1000,within=10", "slide=x", "size=1000"})
+        EXPECT_FALSE(capacity_query_t().Parse(spec)) << spec;
+
+    PadEncoderOptions options;
+    options.padlen = 58;
+    options.label_insertion = 200;
+    options.dls_files.push_back(dls_file);
+    options.dls_weights.push_back(1);
+    VirtualPadClock clock;
+    PadEncoder encoder(options, &clock);
+    std::vector<uint8_t> pad(encoder.GetPADFrameSize());
+    for (int i = 0; i < 5; i++) {
+        ASSERT_EQ(encoder.Encode(&pad[0]), 0);
+        clock.Advance(std::chrono::milliseconds(24));
+    }
+
+    // a smaller PAD or X-PAD in fewer frames takes longer
+    auto duration = [&](const char* spec) {
+        capacity_query_t query;
+        capacity_plan_t plan;
+        EXPECT_TRUE(query.Parse(spec));
+        EXPECT_TRUE(encoder.PlanCapacity(query, plan)) << spec;
+        return plan.duration;
+    };
+    const std::chrono::milliseconds base = duration("slide=10000");
+    EXPECT_GT(base.count(), 0);
+    EXPECT_GT(duration("pad=34,slide=10000"), base);
+    EXPECT_GT(duration("xpad-interval=2,slide=10000"), base);
+    EXPECT_GE(duration("slide=10000,dl-plus=1"), duration("slide=10000,dl-plus=0"));
+
+    // the largest slide sent in time is just that
+    capacity_query_t within;
+    ASSERT_TRUE(within.Parse("within=" + std::to_string(base.count() / 1000.0)));
+    const size_t max_size = encoder.PlanMaxSlideSize(within);
+    EXPECT_GE(max_size, 10000u);
+    EXPECT_LT(max_size, 11000u);
+
+    // planning leaves the encoder as it was
+    EXPECT_EQ(duration("slide=10000"), base);
+    unlink(dls_file.c_str());
+}
+
+// Test the jitter buffer of odr-padenc-relay
+TEST_F(PADCoreTest, PadRelayBufferOrdersAnswers) {
+    typedef std::chrono::steady_clock clock;
+    PadRelayBuffer relay(5, 2, std::chrono::milliseconds(100));
+    const clock::time_point start = clock::now();
+    uint32_t sequence;
+    size_t frames;
+    EXPECT_FALSE(relay.NextRequest(start, sequence, frames));   // PAD length not known yet
+
+    relay.SetPADLength(6);
+    ASSERT_EQ(relay.GetFrameSize(), 7u);
+    std::vector<std::pair<uint32_t, size_t>> requests;
+    while (relay.NextRequest(start, sequence, frames))
+        requests.emplace_back(sequence, frames);
+    ASSERT_EQ(requests.size(), 3u);
+    EXPECT_EQ(requests[0], std::make_pair(0u, (size_t) 2));
+    EXPECT_EQ(requests[2], std::make_pair(2u, (size_t) 1));
+    EXPECT_EQ(relay.Requested(), 5u);
+
+    auto frames_of = [](uint8_t first, size_t count) {
+        std::vector<uint8_t> data;
+        for (size_t i = 0; i < count; i++)
+            data.insert(data.end(), 7, first + i);
+        return data;
+    };
+
+    // the second answer waits for the first one
+    std::vector<uint8_t> data = frames_of(3, 2);
+    EXPECT_TRUE(relay.AddAnswer(1, data.data(), 2, 7));
+    EXPECT_FALSE(relay.AddAnswer(1, data.data(), 2, 7));    // duplicate
+    EXPECT_FALSE(relay.AddAnswer(0, data.data(), 2, 8));    // other PAD length
+    EXPECT_EQ(relay.Buffered(), 0u);
+    data = frames_of(1, 2);
+    EXPECT_TRUE(relay.AddAnswer(0, data.data(), 2, 7));
+    EXPECT_EQ(relay.Buffered(), 4u);
+
+    uint8_t pad[7];
+    for (uint8_t expected = 1; expected <= 4; expected++) {
+        ASSERT_TRUE(relay.TakeFrame(pad));
+        EXPECT_EQ(pad[0], expected);
+    }
+
+    // the last request gets lost; then frames without X-PAD fill in
+    relay.ExpireRequests(start + std::chrono::milliseconds(200));
+    EXPECT_EQ(relay.GetLostFrames(), 1u);
+    EXPECT_EQ(relay.Requested(), 0u);
+    data = frames_of(5, 1);
+    EXPECT_FALSE(relay.AddAnswer(2, data.data(), 1, 7));    // too late
+    EXPECT_FALSE(relay.TakeFrame(pad));
+    EXPECT_EQ(std::vector<uint8_t>(pad, pad + 7), std::vector<uint8_t>({0, 0, 0, 0, 0, 0, 2}));
+    EXPECT_EQ(relay.GetUnderruns(), 1u);
+
+    // another PAD length starts over
+    ASSERT_TRUE(relay.NextRequest(start, sequence, frames));
+    relay.SetPADLength(8);
+    EXPECT_EQ(relay.Requested(), 0u);
+    ASSERT_TRUE(relay.NextRequest(start, sequence, frames));
+    EXPECT_EQ(sequence, 4u);
+}
+
+// Test the shared memory ring between the PAD encoder and an audio encoder
+TEST_F(PADCoreTest, PadShmRingHandOver) {
+    const std::string ident = "padenc_test_" + std::to_string(getpid());
+
+    PadShmRing producer;
+    producer.create(ident, 3);
+    PadShmRing consumer;
+    consumer.attach(ident);
+
+    uint8_t frame[PadShmRing::max_frame_len()];
+    EXPECT_EQ(consumer.pop_frame(frame, sizeof(frame)), 0u);
+    EXPECT_EQ(producer.wait_for_request(1), 0);     // no PAD length requested yet
+
+    consumer.request(23);
+    for (uint8_t i = 0; i < 3; i++) {
+        ASSERT_EQ(producer.wait_for_request(1), 23);
+        memset(producer.frame_buffer(), i, 24);
+        producer.push_frame(24, 23);
+    }
+    EXPECT_EQ(producer.wait_for_request(1), 0);     // ring full
+
+    ASSERT_EQ(consumer.pop_frame(frame, sizeof(frame)), 24u);
+    EXPECT_EQ(frame[0], 0);
+    EXPECT_EQ(frame[23], 0);
+    ASSERT_EQ(producer.wait_for_request(1), 23);
+
+    // frames of the previous PAD length are dropped
+    consumer.request(58);
+    producer.push_frame(59, 58);
+    ASSERT_EQ(consumer.pop_frame(frame, sizeof(frame)), 59u);
+    EXPECT_EQ(consumer.pop_frame(frame, sizeof(frame)), 0u);
+
+    // a waiting producer is woken up by the consumer
+    for (int i = 0; i < 3; i++)
+        producer.push_frame(59, 58);
+    std::thread audioenc([&consumer]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        uint8_t buffer[PadShmRing::max_frame_len()];
+        consumer.pop_frame(buffer, sizeof(buffer));
+    });
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    EXPECT_EQ(producer.wait_for_request(5000), 58);
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(4));
+    audioenc.join();
+}
+
+// Test that re-read requests are detected by the watcher thread, and only once
+TEST_F(PADCoreTest, RereadWatcherDetectsRequests) {
+    char dir_template[] = "/tmp/padenc_rereadXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = dir_template;
+    const std::string path = dir + "/" + SLSEncoder::REQUEST_REREAD_FILENAME;
+
+    // present before watching
+    WriteSlide(path, 0);
+    RereadWatcher watcher;
+    RereadRequest* request = watcher.Add("slides dir", path);
+    RereadRequest* missing = watcher.Add("DLS file", "/nonexistent/dls.txt.REQUEST_DLS_REREAD");
+    EXPECT_EQ(request->Check(), 1);
+    EXPECT_EQ(request->Check(), 0);
+    EXPECT_EQ(missing->Check(), 0);
+
+    for (int i = 0; i < 2; i++) {
+        WriteSlide(path, 0);
+        int result = 0;
+        for (int tries = 0; tries < 1000 && result == 0; tries++) {
+            result = request->Check();
+            if (result == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT_EQ(result, 1) << "request " << i;
+        EXPECT_EQ(access(path.c_str(), F_OK), -1);     // consumed
+        EXPECT_EQ(request->Check(), 0);
+    }
+
+    // without requests that need polling, pending ones are announced
+    {
+        RereadWatcher watched_only;
+        RereadRequest* watched = watched_only.Add("slides dir", path);
+        unsigned int generation = 0;
+        EXPECT_TRUE(watched_only.MayBePending(generation));
+        EXPECT_FALSE(watched_only.MayBePending(generation));
+        EXPECT_EQ(watched->Check(), 0);
+
+        WriteSlide(path, 0);
+        bool may_be_pending = false;
+        for (int tries = 0; tries < 1000 && !may_be_pending; tries++) {
+            may_be_pending = watched_only.MayBePending(generation);
+            if (!may_be_pending)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT_TRUE(may_be_pending);
+        EXPECT_EQ(watched->Check(), 1);
+
+        // requested without the file
+        watched_only.Trigger(watched);
+        EXPECT_TRUE(watched_only.MayBePending(generation));
+        EXPECT_EQ(watched->Check(), 1);
+        EXPECT_EQ(watched->Check(), 0);
+    }
+
+    rmdir(dir.c_str());
+}
+
+// Test that a removed request file is no longer watched
+TEST_F(PADCoreTest, RereadWatcherRemovesRequests) {
+    char dir_template[] = "/tmp/padenc_rereadXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = dir_template;
+    const std::string kept_path = dir + "/kept.txt" + DLSEncoder::REQUEST_REREAD_SUFFIX;
+    const std::string removed_path = dir + "/removed.txt" + DLSEncoder::REQUEST_REREAD_SUFFIX;
+
+    RereadWatcher watcher;
+    RereadRequest* kept = watcher.Add("DLS file", kept_path);
+    RereadRequest* removed = watcher.Add("DLS file", removed_path);
+    RereadRequest* missing = watcher.Add("DLS file", "/nonexistent/dls.txt.REQUEST_DLS_REREAD");
+    unsigned int generation = 0;
+    EXPECT_TRUE(watcher.MayBePending(generation));
+    EXPECT_TRUE(watcher.MayBePending(generation));     // polled
+
+    // no longer polled, and the dir still watched for the other request
+    watcher.Remove(missing);
+    watcher.Remove(removed);
+    EXPECT_FALSE(watcher.MayBePending(generation));
+    EXPECT_EQ(kept->Check(), 0);
+
+    WriteSlide(kept_path, 0);
+    bool may_be_pending = false;
+    for (int tries = 0; tries < 1000 && !may_be_pending; tries++) {
+        may_be_pending = watcher.MayBePending(generation);
+        if (!may_be_pending)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_TRUE(may_be_pending);
+    EXPECT_EQ(kept->Check(), 1);
+
+    // the dir is no longer watched at all (once the end of its watch is announced)
+    watcher.Remove(kept);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    watcher.MayBePending(generation);
+    WriteSlide(removed_path, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(watcher.MayBePending(generation));
+
+    unlink(removed_path.c_str());
+    rmdir(dir.c_str());
+}
+
+// Test that a live config is read and checked, and taken over at the next frame
+TEST_F(PADCoreTest, LiveConfigReload) {
+    // new files on every run, as the label files stay prefetched
+    static int run = 0;
+    const std::string base = "/tmp/padenc_live_" + std::to_string(getpid()) + "_" + std::to_string(run++);
+    const std::string config = base + ".conf";
+    const std::string label_a = base + "_a.txt";
+    const std::string label_b = base + "_b.txt";
+    std::ofstream(label_a) << "Label Alpha";
+    std::ofstream(label_b) << "Label Bravo";
+
+    PadEncoderOptions options;
+    options.padlen = 58;
+    options.label_insertion = 60000;
+    options.dls_files.push_back(label_a);
+    options.dls_weights.push_back(1);
+    options.live_config_file = config;
+
+    // unlisted settings are those given before
+    auto read = [&](const std::string& content, PadEncoderOptions& live) {
+        std::ofstream(config, std::ios::trunc) << content;
+        live = options;
+        return read_live_config(config, live) && check_live_options(live);
+    };
+    PadEncoderOptions live;
+    for (const char* content : {"label-ins\n", "colour=red\n", "label-weight=2\ndls=x\n", "dls=x\nlabel-weight=0\n",
+                                "label-ins=0\n", "xpad-interval=0\n", "max-slide-size=0\n"})
+        EXPECT_FALSE(read(content, live)) << content;
+    ASSERT_TRUE(read("# the DLS files in turn\n\ndls=" + label_b + "\nlabel-weight=3\ndls=" + label_a + "\n", live));
+    EXPECT_EQ(live.dls_files, std::vector<std::string>({label_b, label_a}));
+    EXPECT_EQ(live.dls_weights, std::vector<int>({3, 1}));
+    EXPECT_EQ(live.label_insertion, options.label_insertion);
+    unlink(config.c_str());
+    EXPECT_FALSE(read_live_config(config, live));
+
+    VirtualPadClock clock;
+    PadEncoder encoder(options, &clock);
+    LiveOptions live_options;
+    encoder.SetLiveOptions(&live_options);
+    std::vector<uint8_t> pad(encoder.GetPADFrameSize());
+    auto sends = [&](const std::string& text, int frames) {
+        std::vector<uint8_t> xpads;
+        for (int i = 0; i < frames; i++) {
+            EXPECT_EQ(encoder.Encode(pad.data()), 0);
+            clock.Advance(std::chrono::milliseconds(24));
+            xpads.insert(xpads.end(), std::make_reverse_iterator(pad.begin() + options.padlen - 2), std::make_reverse_iterator(pad.begin()));
+        }
+        return std::search(xpads.begin(), xpads.end(), text.begin(), text.end()) != xpads.end();
+    };
+    EXPECT_TRUE(sends("Label Alpha", 10));
+    EXPECT_FALSE(sends("Label Alpha", 20));
+
+    // a shorter insertion interval applies at once, not only after the pending one
+    live = options;
+    live.label_insertion = 100;
+    live.label_interval = 3600;
+    live_options.Publish(std::make_shared<PadEncoderOptions>(live));
+    EXPECT_TRUE(sends("Label Alpha", 10));
+
+    // another DLS file list; the re-read request of the file still listed is kept
+    live.dls_files = {label_b, label_a};
+    live.dls_weights = {1, 1};
+    live_options.Publish(std::make_shared<PadEncoderOptions>(live));
+    EXPECT_TRUE(sends("Label Bravo", 10));
+    EXPECT_FALSE(sends("Label Alpha", 50));
+
+    std::ofstream(label_a, std::ios::trunc) << "Label Charlie";
+    std::ofstream(label_a + DLSEncoder::REQUEST_REREAD_SUFFIX);
+    bool switched = false;
+    for (int tries = 0; tries < 1000 && !switched; tries++) {
+        switched = sends("Label Charlie", 5);
+        if (!switched)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_TRUE(switched);
+
+    unlink((label_a + DLSEncoder::REQUEST_REREAD_SUFFIX).c_str());
+    unlink(label_a.c_str());
+    unlink(label_b.c_str());
+}
+
+TEST_F(PADCoreTest, ReactorDispatchesEvents) {
+    Reactor reactor;
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    // without events, nothing wakes the thread up
+    EXPECT_FALSE(reactor.RunOnce(10));
+    const size_t idle_wakeups = reactor.Wakeups();
+
+    int reads = 0;
+    reactor.Add(fds[0], [&]() {
+        char c;
+        ASSERT_EQ(read(fds[0], &c, 1), 1);
+        if (++reads == 2)
+            reactor.Remove(fds[0]);     // from within its own handler
+    });
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(write(fds[1], "x", 1), 1);
+        reactor.RunOnce(100);
+    }
+    EXPECT_EQ(reads, 2);
+    EXPECT_LE(reactor.Wakeups(), idle_wakeups + 3);
+
+    int fired = 0;
+    const int timer = reactor.AddTimer(std::chrono::milliseconds(5), [&]() {fired++;});
+    while (fired < 2)
+        ASSERT_TRUE(reactor.RunOnce(1000));
+    reactor.RemoveTimer(timer);
+    EXPECT_FALSE(reactor.RunOnce(20));
+    EXPECT_EQ(fired, 2);
+
+    // a wake from another thread ends the wait
+    std::thread waker([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        reactor.Wake();
+    });
+    EXPECT_TRUE(reactor.RunOnce(-1));
+    waker.join();
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST_F(PADCoreTest, ControlSocketCommands) {
+    char dir_template[] = "/tmp/padenc_controlXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = dir_template;
+    const std::string path = dir + "/control";
+
+    std::vector<std::pair<uint8_t, std::string>> received;
+    const ControlSocket::handler_t handler = [&](uint8_t command, const uint8_t* args, size_t len) {
+        received.emplace_back(command, std::string((const char*) args, len));
+        return command == ControlSocket::CMD_LABEL ? ControlSocket::STATUS_OK : ControlSocket::STATUS_INVALID;
+    };
+
+    {
+        ControlSocket control;
+        control.Open(path);
+        control.Process(handler);       // nothing received yet
+        EXPECT_TRUE(received.empty());
+
+        // a bound client gets the status back
+        int client = socket(AF_UNIX, SOCK_DGRAM, 0);
+        ASSERT_NE(client, -1);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, (dir + "/client").c_str());
+        ASSERT_EQ(bind(client, (struct sockaddr*) &addr, sizeof(addr)), 0);
+        strcpy(addr.sun_path, path.c_str());
+
+        const std::string label = std::string(1, ControlSocket::CMD_LABEL) + "Artist - Title";
+        ASSERT_EQ(sendto(client, label.data(), label.size(), 0, (struct sockaddr*) &addr, sizeof(addr)), (ssize_t) label.size());
+        const uint8_t unknown = 0xFF;
+        ASSERT_EQ(sendto(client, &unknown, 1, 0, (struct sockaddr*) &addr, sizeof(addr)), 1);
+
+        control.Process(handler);
+        ASSERT_EQ(received.size(), 2u);
+        EXPECT_EQ(received[0].first, ControlSocket::CMD_LABEL);
+        EXPECT_EQ(received[0].second, "Artist - Title");
+        EXPECT_EQ(received[1].first, 0xFF);
+        EXPECT_TRUE(received[1].second.empty());
+
+        uint8_t status[2];
+        ASSERT_EQ(recv(client, &status[0], 1, 0), 1);
+        ASSERT_EQ(recv(client, &status[1], 1, 0), 1);
+        EXPECT_EQ(status[0], ControlSocket::STATUS_OK);
+        EXPECT_EQ(status[1], ControlSocket::STATUS_INVALID);
+
+        close(client);
+        unlink((dir + "/client").c_str());
+    }
+    EXPECT_EQ(access(path.c_str(), F_OK), -1);      // removed on destruction
+
+    rmdir(dir.c_str());
+}
+
+TEST_F(PADCoreTest, LibraryEncodesInProcess) {
+    char dir_template[] = "/tmp/padenc_libraryXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = dir_template;
+    const std::string dls_file = dir + "/dls.txt";
+    std::ofstream(dls_file) << "Artist - Title";
+
+    odr_padenc_options* options = odr_padenc_options_new();
+    ASSERT_NE(options, nullptr);
+    EXPECT_EQ(odr_padenc_new(options), nullptr);     // nothing to encode
+    EXPECT_EQ(odr_padenc_options_set(options, "output", "padenc"), -1);
+    EXPECT_EQ(odr_padenc_options_set(options, "label-weight", "2"), -1);   // before any DLS file
+    ASSERT_EQ(odr_padenc_options_set(options, "dls", dls_file.c_str()), 0);
+    ASSERT_EQ(odr_padenc_options_set(options, "label-weight", "2"), 0);
+    odr_padenc* enc = odr_padenc_new(options);
+    odr_padenc_options_free(options);
+    ASSERT_NE(enc, nullptr);
+
+    // the PAD followed by the used PAD length, also after a PAD length change
+    size_t used_total = 0;
+    for (uint8_t padlen : {58, 34}) {
+        std::vector<uint8_t> pad(padlen + 1 + 1, 0xAA);
+        ASSERT_EQ(odr_padenc_get_next_pad(enc, padlen, pad.data()), 0);
+        EXPECT_GE(pad[padlen], 2);              // at least the F-PAD
+        EXPECT_LE(pad[padlen], padlen);
+        EXPECT_EQ(pad[padlen + 1], 0xAA);       // nothing beyond
+        used_total += pad[padlen] - 2;
+    }
+    EXPECT_GT(used_total, 0u);                  // X-PAD with the label
+    uint8_t pad[8];
+    EXPECT_EQ(odr_padenc_get_next_pad(enc, 7, pad), -1);
+
+    EXPECT_EQ(odr_padenc_inject_label(enc, "Injected", 1), 0);
+    odr_padenc_release_label(enc);
+    odr_padenc_free(enc);
+
+    unlink(dls_file.c_str());
+    rmdir(dir.c_str());
+}
+
+// Test that a standby takes over the slide IDs, current slide and label of the primary
+TEST_F(PADCoreTest, EncoderStateReplicates) {
+    char dir_template[] = "/tmp/padenc_replicaXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = dir_template;
+    const std::string slide_path = dir + "/slide_PadEncRawMode.jpg";
+    const std::string dls_file = dir + ".dls.txt";    // not in the slides dir
+    WriteSlide(slide_path, 3000);
+    std::ofstream(dls_file) << "Artist - Title";
+
+    const uint16_t port = 30000 + getpid() % 20000;
+    EncoderReplica replica;
+    ReplicaReceiver receiver(replica);
+    receiver.Open(std::to_string(port));
+
+    PadEncoderOptions options;
+    options.padlen = 58;
+    options.sls_dir = dir;
+    options.slide_lookahead = 0;
+    options.dls_files.push_back(dls_file);
+    options.replicate_to = "127.0.0.1:" + std::to_string(port);
+    {
+        PadEncoder primary(options);
+        std::vector<uint8_t> pad(primary.GetPADFrameSize());
+        for (int i = 0; i < 3; i++)
+            ASSERT_EQ(primary.Encode(pad.data()), 0);
+    }
+    while (receiver.Receive(100) > 0) {}
+    EXPECT_GE(receiver.GetRecords(), 3u);    // snapshot, slide, label
+    EXPECT_EQ(receiver.GetLostRecords(), 0u);
+
+    ASSERT_TRUE(replica.HasCurrentSlide());
+    EXPECT_EQ(replica.GetCurrentSlide().s_name, "slide_PadEncRawMode.jpg");
+    EXPECT_EQ(replica.GetCurrentSlide().fidx, 0);
+    ASSERT_EQ(replica.GetEntries().size(), 1u);
+    ASSERT_TRUE(replica.HasLabel());
+    EXPECT_TRUE(replica.GetToggle());
+    EXPECT_EQ(replica.GetLabel().dl_text, "Artist - Title");
+
+    // a snapshot carries all of it; a truncated record is refused
+    std::vector<uint8_t> record;
+    replica.Record(EncoderReplica::RECORD_SNAPSHOT, 7, record);
+    EncoderReplica copy;
+    uint32_t sequence = 0;
+    EXPECT_FALSE(copy.Apply(record.data(), record.size() - 1, sequence));
+    ASSERT_TRUE(copy.Apply(record.data(), record.size(), sequence));
+    EXPECT_EQ(sequence, 7u);
+    EXPECT_EQ(copy.GetEntries().size(), 1u);
+    EXPECT_EQ(copy.GetCurrentSlide().s_name, replica.GetCurrentSlide().s_name);
+    EXPECT_TRUE(copy.GetLabel() == replica.GetLabel());
+
+    // the standby keeps the slide ID, and the unchanged label its toggle bit
+    History history;
+    SlideCache cache(0);
+    SlideStateFile state_file("");
+    state_file.SetReplicatedHistory(copy.GetEntries(), copy.GetLastGivenFidx());
+    state_file.Load(history, cache);
+    EXPECT_EQ(history.get_fidx(slide_path.c_str()), 0);
+    EXPECT_EQ(history.get_fidx(fingerprint_t{"new", 1, 1, -1}), 1);
+
+    PADPacketizer packetizer(58);
+    DLSEncoder dls_encoder(&packetizer);
+    dls_encoder.restoreState(copy.GetToggle(), copy.GetLabel());
+    dls_encoder.encodeLabel(dls_file, nullptr, DL_PARAMS());
+    EXPECT_TRUE(dls_encoder.getToggle());
+    dls_encoder.encodeText("Next", DL_PARAMS(), false);
+    EXPECT_FALSE(dls_encoder.getToggle());
+
+    unlink(slide_path.c_str());
+    unlink(dls_file.c_str());
+    rmdir(dir.c_str());
+}
+
+// Test that mirrored audio encoders get the same frames of one encoder
+TEST_F(PADCoreTest, PadFanOutServesSameFrames) {
+    char dir_template[] = "/tmp/padenc_fanoutXXXXXX";
+    ASSERT_NE(mkdtemp(dir_template), nullptr);
+    const std::string dir = dir_template;
+    const std::string dls_file = dir + "/dls.txt";
+    std::ofstream(dls_file) << "A label long enough to be spread over quite a few small PAD frames";
+
+    PadEncoderOptions options;
+    options.padlen = 8;
+    options.dls_files.push_back(dls_file);
+    options.dls_weights.push_back(1);
+    PadEncoder encoder(options);
+
+    // main and backup chain
+    std::vector<std::string> idents;
+    std::vector<PadInterface> intfs(2);
+    std::vector<int> socks;
+    for (size_t peer = 0; peer < 2; peer++) {
+        idents.push_back("padenc_fanout_" + std::to_string(getpid()) + "_" + std::to_string(peer));
+        intfs[peer].open(idents[peer]);
+        int sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+        ASSERT_NE(sock, -1);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/%s.audioenc", idents[peer].c_str());
+        unlink(addr.sun_path);
+        ASSERT_EQ(bind(sock, (const struct sockaddr*) &addr, sizeof(addr)), 0);
+        socks.push_back(sock);
+    }
+    const size_t frame_size = encoder.GetPADFrameSize();
+    auto request = [&](PadFanOut& fan_out, size_t peer, size_t frames) {
+        std::vector<uint8_t> message(PadInterface::BATCH_HEADER_LEN + frames * frame_size + 1);
+        EXPECT_EQ(fan_out.Encode(encoder, peer, intfs[peer], frames), 0);
+        ssize_t len = recv(socks[peer], message.data(), message.size(), 0);
+        const size_t header_len = frames > 1 ? PadInterface::BATCH_HEADER_LEN : PadInterface::MESSAGE_HEADER_LEN;
+        EXPECT_EQ(len, (ssize_t) (header_len + frames * frame_size));
+        return std::vector<uint8_t>(message.begin() + header_len, message.begin() + header_len + frames * frame_size);
+    };
+
+    PadFanOut fan_out(2);
+    std::vector<uint8_t> main_frames = request(fan_out, 0, 3);
+    std::vector<uint8_t> backup_frames = request(fan_out, 1, 1);
+    std::vector<uint8_t> more = request(fan_out, 1, 3);
+    backup_frames.insert(backup_frames.end(), more.begin(), more.end());
+    more = request(fan_out, 0, 1);
+    main_frames.insert(main_frames.end(), more.begin(), more.end());
+    EXPECT_EQ(main_frames, backup_frames);
+    EXPECT_NE(std::vector<uint8_t>(main_frames.begin(), main_frames.begin() + frame_size),
+              std::vector<uint8_t>(main_frames.begin() + frame_size, main_frames.begin() + 2 * frame_size));
+
+    // a backup lagging too far behind continues with the next new frame, as the main chain
+    for (size_t i = 0; i <= PadFanOut::HISTORY_FRAMES; i += 50)
+        request(fan_out, 0, 50);
+    const std::vector<uint8_t> backup_next = request(fan_out, 1, 1);
+    EXPECT_EQ(request(fan_out, 0, 1), backup_next);
+
+    for (size_t peer = 0; peer < 2; peer++) {
+        close(socks[peer]);
+        unlink(("/tmp/" + idents[peer] + ".audioenc").c_str());
+        unlink(("/tmp/" + idents[peer] + ".padenc").c_str());
+    }
+    unlink(dls_file.c_str());
+    rmdir(dir.c_str());
+}
+
+TEST_F(PADCoreTest, DLSCarouselWeights) {
+    DLSCarousel carousel;
+    carousel.Add("a.txt", 1);
+    carousel.Add("b.txt", 3);
+    carousel.Add("c.txt", 1);
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const std::chrono::seconds interval(10);
+    carousel.Start(start, interval);
+    EXPECT_EQ(carousel.Current(), "a.txt");
+
+    // seconds at which each file becomes the current one
+    std::vector<std::pair<int, std::string> > switches;
+    for (int t = 0; t <= 100; t++)
+        if (carousel.Advance(start + std::chrono::seconds(t)))
+            switches.push_back(std::make_pair(t, carousel.Current()));
+    const std::vector<std::pair<int, std::string> > expected = {
+        {10, "b.txt"}, {40, "c.txt"}, {50, "a.txt"}, {60, "b.txt"}, {90, "c.txt"}, {100, "a.txt"}
+    };
+    EXPECT_EQ(switches, expected);
+
+    // a selected file is shown for its full duration
+    carousel.Select(1, start + std::chrono::seconds(105));
+    EXPECT_EQ(carousel.CurrentIndex(), 1u);
+    EXPECT_FALSE(carousel.Advance(start + std::chrono::seconds(134)));
+    EXPECT_TRUE(carousel.Advance(start + std::chrono::seconds(135)));
+    EXPECT_EQ(carousel.Current(), "c.txt");
+
+    // a single file never switches
+    DLSCarousel single;
+    single.Add("a.txt", 1);
+    single.Start(start, interval);
+    EXPECT_FALSE(single.Advance(start + std::chrono::seconds(100)));
+}
+
+// Test that an unchanged label is inserted less often, but only while slides are sent
+TEST_F(PADCoreTest, LabelInsertionBackoff) {
+    const std::chrono::milliseconds interval(1200);
+    LabelInsertionPolicy policy;
+    EXPECT_EQ(policy.Next(interval, true, true), interval);
+    EXPECT_EQ(policy.Next(interval, false, true), 2 * interval);
+    EXPECT_EQ(policy.Next(interval, false, true), 4 * interval);
+    for (int i = 0; i < 5; i++)
+        policy.Next(interval, false, true);
+    EXPECT_EQ(policy.Backoff(), LabelInsertionPolicy::MAX_BACKOFF);
+    EXPECT_EQ(policy.Next(interval, false, true), (1 << LabelInsertionPolicy::MAX_BACKOFF) * interval);
+
+    // a change or an unloaded X-PAD restart at the insertion interval
+    EXPECT_EQ(policy.Next(interval, true, true), interval);
+    policy.Next(interval, false, true);
+    EXPECT_EQ(policy.Next(interval, false, false), interval);
+    EXPECT_EQ(policy.Backoff(), 0);
+}
+
+// Test that an unchanged DLS file is not parsed again, but a changed one is
+TEST_F(PADCoreTest, DLSFileCache) {
+    const std::string path = ::testing::TempDir() + "padenc_dls.txt";
+    auto write_label = [&path](const std::string& text, time_t mtime) {
+        std::ofstream(path, std::ios::trunc) << text << "\n";
+        struct timespec times[2] = {{mtime, 0}, {mtime, 0}};
+        ASSERT_EQ(utimensat(AT_FDCWD, path.c_str(), times, 0), 0);
+    };
+    const time_t old_mtime = time(NULL) - 100;
+
+    PADPacketizer packetizer(58);
+    PADPacketizer expected_packetizer(58);
+    DLSEncoder dls_encoder(&packetizer);
+    DLSEncoder expected_encoder(&expected_packetizer);
+
+    write_label("First label", old_mtime);
+    dls_encoder.encodeLabel(path, NULL, DL_PARAMS());
+    expected_encoder.encodeLabel(path, NULL, DL_PARAMS());
+    std::vector<uint8_t> first = DrainPackets(packetizer);
+    EXPECT_EQ(first, DrainPackets(expected_packetizer));
+
+    // same attributes: the parsed label is re-used
+    write_label("Other label", old_mtime);
+    dls_encoder.encodeLabel(path, NULL, DL_PARAMS());
+    EXPECT_EQ(DrainPackets(packetizer), first);
+
+    // changed attributes: parsed again
+    write_label("Other label", old_mtime + 1);
+    dls_encoder.encodeLabel(path, NULL, DL_PARAMS());
+    expected_encoder.encodeLabel(path, NULL, DL_PARAMS());
+    std::vector<uint8_t> second = DrainPackets(packetizer);
+    EXPECT_NE(second, first);
+    EXPECT_EQ(second, DrainPackets(expected_packetizer));
+
+    // a freshly written file is not cached, as it may change without a different mtime
+    const time_t now = time(NULL);
+    write_label("Third label", now);
+    dls_encoder.encodeLabel(path, NULL, DL_PARAMS());
+    std::vector<uint8_t> third = DrainPackets(packetizer);
+    write_label("Fresh label", now);
+    dls_encoder.encodeLabel(path, NULL, DL_PARAMS());
+    EXPECT_NE(DrainPackets(packetizer), third);
+
+    remove(path.c_str());
+}
+
+// Test that background work is throttled and paused as the PAD requests use up their budget
+TEST_F(PADCoreTest, WorkGovernor) {
+    WorkGovernor governor;
+    governor.Report(0.9);
+    EXPECT_EQ(governor.Level(), WorkGovernor::NORMAL);
+    governor.Pace();
+    EXPECT_EQ(governor.Throttled(), 0u);
+
+    // a single short request takes effect at once
+    governor.Report(0.3);
+    EXPECT_EQ(governor.Level(), WorkGovernor::THROTTLED);
+    governor.Report(-0.5);
+    EXPECT_EQ(governor.Level(), WorkGovernor::PAUSED);
+    governor.Report(0.9);
+    EXPECT_EQ(governor.Level(), WorkGovernor::NORMAL);
+
+    // after a run of late requests, the work resumes only as the average slack recovers
+    for (int i = 0; i < 10; i++)
+        governor.Report(-0.5);
+    EXPECT_EQ(governor.Level(), WorkGovernor::PAUSED);
+    governor.Report(0.9);
+    EXPECT_NE(governor.Level(), WorkGovernor::NORMAL);
+    for (int i = 0; i < 50 && governor.Level() != WorkGovernor::NORMAL; i++)
+        governor.Report(0.9);
+    EXPECT_EQ(governor.Level(), WorkGovernor::NORMAL);
+
+    governor.Report(0.3);
+    const auto start = std::chrono::steady_clock::now();
+    governor.Pace();
+    EXPECT_GE(std::chrono::steady_clock::now() - start, WorkGovernor::THROTTLE_DELAY);
+    EXPECT_EQ(governor.Throttled(), 1u);
+}
+
+// Test that a rotation to a label prefetched in the background yields the same PADs as without
+TEST_F(PADCoreTest, DLSLabelPrefetch) {
+    const std::string first_path = ::testing::TempDir() + "padenc_dls_first.txt";
+    const std::string next_path = ::testing::TempDir() + "padenc_dls_next.txt";
+    const std::string item_path = ::testing::TempDir() + "padenc_dls_item.txt";
+    const time_t old_mtime = time(NULL) - 100;
+    auto write_label = [old_mtime](const std::string& path, const std::string& content) {
+        std::ofstream(path, std::ios::trunc) << content;
+        struct timespec times[2] = {{old_mtime, 0}, {old_mtime, 0}};
+        ASSERT_EQ(utimensat(AT_FDCWD, path.c_str(), times, 0), 0);
+    };
+    write_label(first_path, "First label\n");
+    write_label(next_path, "Next label, which is long enough for several DL segments\n");
+    write_label(item_path, "##### parameters { #####\nDL_PLUS_ITEM_TOGGLE=1\nDL_PLUS_ITEM_RUNNING=1\n##### parameters } #####\n");
+
+    for (const char* item_state_file : {(const char*) NULL, item_path.c_str()}) {
+        PADPacketizer packetizer(58);
+        PADPacketizer expected_packetizer(58);
+        DLSEncoder dls_encoder(&packetizer);
+        DLSEncoder expected_encoder(&expected_packetizer);
+
+        dls_encoder.encodeLabel(first_path, item_state_file, DL_PARAMS());
+        expected_encoder.encodeLabel(first_path, item_state_file, DL_PARAMS());
+        EXPECT_EQ(DrainPackets(packetizer), DrainPackets(expected_packetizer));
+
+        // the prefetched label is used, as the file attributes are unchanged
+        dls_encoder.prefetchLabel(next_path, item_state_file, DL_PARAMS());
+        dls_encoder.flushPrefetch();
+        expected_encoder.encodeLabel(next_path, item_state_file, DL_PARAMS());
+        write_label(next_path, "Long label, which is next enough for several DL segments\n");
+        dls_encoder.encodeLabel(next_path, item_state_file, DL_PARAMS());
+        write_label(next_path, "Next label, which is long enough for several DL segments\n");
+        std::vector<uint8_t> next = DrainPackets(packetizer);
+        EXPECT_FALSE(next.empty());
+        EXPECT_EQ(next, DrainPackets(expected_packetizer));
+
+        // and back, with the toggle bit patched
+        dls_encoder.encodeLabel(first_path, item_state_file, DL_PARAMS());
+        expected_encoder.encodeLabel(first_path, item_state_file, DL_PARAMS());
+        EXPECT_EQ(DrainPackets(packetizer), DrainPackets(expected_packetizer));
+    }
+
+    remove(first_path.c_str());
+    remove(next_path.c_str());
+    remove(item_path.c_str());
+}
+
+// Test that labels are taken from the prefetched files, which follow file changes
+TEST_F(PADCoreTest, DLSFilePrefetch) {
+    const std::string path = ::testing::TempDir() + "padenc_dls_prefetch.txt";
+    std::ofstream(path, std::ios::trunc) << "Prefetched label\n";
+
+    FilePrefetcher prefetcher(std::chrono::milliseconds(10));
+    FilePrefetcher::snapshot_t snapshot;
+    EXPECT_FALSE(prefetcher.Get(path, snapshot));
+    prefetcher.Watch(path);
+    prefetcher.Sync();
+    ASSERT_TRUE(prefetcher.Get(path, snapshot));
+    EXPECT_EQ(*snapshot.content, "Prefetched label\n");
+
+    PADPacketizer packetizer(58);
+    PADPacketizer expected_packetizer(58);
+    DLSEncoder dls_encoder(&packetizer);
+    DLSEncoder expected_encoder(&expected_packetizer);
+    dls_encoder.setFilePrefetcher(&prefetcher);
+    expected_encoder.encodeLabel(path, NULL, DL_PARAMS());
+
+    // the file is not read anymore
+    remove(path.c_str());
+    dls_encoder.encodeLabel(path, NULL, DL_PARAMS());
+    EXPECT_EQ(DrainPackets(packetizer), DrainPackets(expected_packetizer));
+
+    // a removed file is no longer available; a new one is read again
+    prefetcher.Sync();
+    EXPECT_FALSE(prefetcher.Get(path, snapshot));
+    std::ofstream(path, std::ios::trunc) << "Changed label\n";
+    prefetcher.Sync();
+    ASSERT_TRUE(prefetcher.Get(path, snapshot));
+    EXPECT_EQ(*snapshot.content, "Changed label\n");
+
+    // an invalidated file is read again at once
+    std::ofstream(path, std::ios::trunc) << "Requested label\n";
+    prefetcher.Invalidate(path);
+    prefetcher.Sync();
+    ASSERT_TRUE(prefetcher.Get(path, snapshot));
+    EXPECT_EQ(*snapshot.content, "Requested label\n");
+
+    remove(path.c_str());
+}
+
+// Test that re-inserted labels from templates match freshly built ones, incl. a patched toggle bit
+TEST_F(PADCoreTest, DLSTemplatesMatchEncoding) {
+    const std::string dir = ::testing::TempDir();
+    auto write_label = [&dir](const std::string& name, const std::string& text) {
+        std::ofstream(dir + name, std::ios::trunc) <<
+                "##### parameters { #####\nDL_PLUS=1\nDL_PLUS_TAG=4 0 5\n##### parameters } #####\n" << text << "\n";
+        return dir + name;
+    };
+    const std::string a = write_label("padenc_dls_a.txt", "Label A - a label that needs several segments");
+    const std::string b = write_label("padenc_dls_b.txt", "Label B");
+    const std::string c = write_label("padenc_dls_c.txt", "Label C");
+    const std::string d = write_label("padenc_dls_d.txt", "Label D");
+
+    PADPacketizer packetizer(58);
+    PADPacketizer expected_packetizer(58);
+    DLSEncoder dls_encoder(&packetizer);
+    DLSEncoder expected_encoder(&expected_packetizer);
+
+    // the 4th label has the other toggle bit value than the first time
+    const std::vector<std::string> labels = {a, b, c, a, a, b};
+    const std::vector<std::string> expected_labels = {d, b, c, a, a, b};
+    for (size_t i = 0; i < labels.size(); i++) {
+        dls_encoder.encodeLabel(labels[i], NULL, DL_PARAMS());
+        expected_encoder.encodeLabel(expected_labels[i], NULL, DL_PARAMS());
+        std::vector<uint8_t> pads = DrainPackets(packetizer);
+        std::vector<uint8_t> expected_pads = DrainPackets(expected_packetizer);
+        if (i > 0) {
+            EXPECT_EQ(pads, expected_pads) << "label " << i;
+        }
+    }
+
+    for (const std::string& path : {a, b, c, d})
+        remove(path.c_str());
+}
+
+// Test that a label from a text matches the one from a file
+TEST_F(PADCoreTest, DLSTextMatchesFile) {
+    const std::string path = ::testing::TempDir() + "padenc_dls_text.txt";
+    std::ofstream(path, std::ios::trunc) << "Emergency\nGrüße\n";
+
+    PADPacketizer packetizer(58);
+    PADPacketizer expected_packetizer(58);
+    DLSEncoder dls_encoder(&packetizer);
+    DLSEncoder expected_encoder(&expected_packetizer);
+
+    dls_encoder.encodeText("Emergency\nGrüße", DL_PARAMS(), false);
+    expected_encoder.encodeLabel(path, NULL, DL_PARAMS());
+    EXPECT_EQ(DrainPackets(packetizer), DrainPackets(expected_packetizer));
+
+    dls_encoder.encodeText("Emergency\nGrüße", DL_PARAMS(), true);
+    expected_encoder.encodeLabel(path, NULL, DL_PARAMS());
+    EXPECT_EQ(DrainPackets(packetizer), DrainPackets(expected_packetizer));
+
+    remove(path.c_str());
+}
+
+// Test that a label from a DL state matches the one from a file, also when repeated
+TEST_F(PADCoreTest, DLSStateMatchesFile) {
+    const std::string path = ::testing::TempDir() + "padenc_dls_state.txt";
+    std::ofstream(path, std::ios::trunc) <<
+            "##### parameters { #####\nDL_PLUS=1\nDL_PLUS_ITEM_RUNNING=1\nDL_PLUS_TAG=1 0 4\nDL_PLUS_TAG=4 8 5\n##### parameters } #####\n"
+            "Grüße by Artist\n";
+
+    PADPacketizer packetizer(58);
+    PADPacketizer expected_packetizer(58);
+    DLSEncoder dls_encoder(&packetizer);
+    DLSEncoder expected_encoder(&expected_packetizer);
+
+    DL_STATE dl_state;
+    dl_state.dl_text = "Grüße by Artist";
+    dl_state.dl_plus_enabled = true;
+    dl_state.dl_plus_item_running = true;
+    dl_state.dl_plus_tags = {DL_PLUS_TAG(1, 0, 4), DL_PLUS_TAG(4, 8, 5)};
+
+    for (int i = 0; i < 2; i++) {
+        dls_encoder.encodeLabel(dl_state, DL_PARAMS());
+        expected_encoder.encodeLabel(path, NULL, DL_PARAMS());
+        EXPECT_EQ(DrainPackets(packetizer), DrainPackets(expected_packetizer)) << "label " << i;
+    }
+
+    remove(path.c_str());
+}
+
+// Test that labels are fitted into as few segments as possible
+TEST_F(PADCoreTest, DLSTextFitting) {
+    PADPacketizer packetizer(58);
+    PADPacketizer expected_packetizer(58);
+    DLSEncoder dls_encoder(&packetizer);
+    DLSEncoder expected_encoder(&expected_packetizer);
+    auto encode = [&](const std::string& text, const std::string& expected_text) {
+        dls_encoder.encodeText(text, DL_PARAMS(), false);
+        expected_encoder.encodeText(expected_text, DL_PARAMS(), false);
+        return DrainPackets(packetizer) == DrainPackets(expected_packetizer);
+    };
+
+    // spaces at line ends dropped; a run of spaces collapsed only to save a segment
+    EXPECT_TRUE(encode("Hello   \nWorld  ", "Hello\nWorld"));
+    EXPECT_TRUE(encode("Hello  world 1234", "Hello world 1234"));
+    EXPECT_FALSE(encode("Hello  world 123", "Hello world 123"));
+
+    // an oversized label is cut at a word boundary within its last segment
+    std::string words;
+    for (int i = 0; i < 13; i++)
+        words += "abcdefghi ";
+    EXPECT_TRUE(encode(words + "x", words.substr(0, 119)));
+    EXPECT_TRUE(encode(std::string(130, 'a'), std::string(128, 'a')));
+
+    // with DL Plus, the tags keep referring to the same characters
+    DL_STATE dl_state;
+    dl_state.dl_text = "Hello  world 1234  ";
+    dl_state.dl_plus_enabled = true;
+    dl_state.dl_plus_tags = {DL_PLUS_TAG(4, 7, 4)};
+    DL_STATE expected_state = dl_state;
+    expected_state.dl_text = "Hello  world 1234";
+    dls_encoder.encodeLabel(dl_state, DL_PARAMS());
+    expected_encoder.encodeLabel(expected_state, DL_PARAMS());
+    EXPECT_EQ(DrainPackets(packetizer), DrainPackets(expected_packetizer));
+}
+
+// Test that DL Plus tags are derived from now-playing formats
+TEST_F(PADCoreTest, DLPlusTagger) {
+    DLPlusTagger tagger;
+    EXPECT_FALSE(tagger.addFormat("{artist}{title}"));
+    EXPECT_FALSE(tagger.addFormat("{singer} - {title}"));
+    EXPECT_FALSE(tagger.addFormat("Now: {*}"));
+    EXPECT_FALSE(tagger.addFormat("{artist} - {title"));
+    EXPECT_TRUE(tagger.addFormat("{artist} - {title}"));
+    EXPECT_TRUE(tagger.addFormat("{*}: {title} by {artist} ({album})"));
+    EXPECT_FALSE(tagger.empty());
+
+    // markers count characters, across lines
+    DL_STATE dl_state;
+    EXPECT_TRUE(tagger.tag({"Radio One", "Grüße - Ein Lied "}, dl_state));
+    EXPECT_TRUE(dl_state.dl_plus_enabled);
+    EXPECT_TRUE(dl_state.dl_plus_item_running);
+    EXPECT_TRUE(dl_state.dl_plus_item_toggle);
+    EXPECT_EQ(dl_state.dl_plus_tags, dl_plus_tags_t({DL_PLUS_TAG(4, 10, 4), DL_PLUS_TAG(1, 18, 7)}));
+
+    dl_state = DL_STATE();
+    EXPECT_TRUE(tagger.tag({"Now: Song Part 2 by Band (Best of)"}, dl_state));
+    EXPECT_EQ(dl_state.dl_plus_tags, dl_plus_tags_t({DL_PLUS_TAG(1, 5, 10), DL_PLUS_TAG(4, 20, 3), DL_PLUS_TAG(2, 26, 6)}));
+    EXPECT_FALSE(dl_state.dl_plus_item_toggle);    // a new item
+
+    // not without a match, nor for labels with tags
+    dl_state = DL_STATE();
+    EXPECT_FALSE(tagger.tag({"Radio One"}, dl_state));
+    EXPECT_FALSE(dl_state.dl_plus_enabled);
+    dl_state.dl_plus_enabled = true;
+    EXPECT_FALSE(tagger.tag({"Artist - Title"}, dl_state));
+    EXPECT_TRUE(dl_state.dl_plus_tags.empty());
+
+    // the encoder tags labels as if the tags had been given in the file
+    PADPacketizer packetizer(58);
+    PADPacketizer expected_packetizer(58);
+    DLSEncoder dls_encoder(&packetizer);
+    DLSEncoder expected_encoder(&expected_packetizer);
+    EXPECT_TRUE(dls_encoder.addDLPlusFormat("{artist} - {title}"));
+    dls_encoder.encodeText("Grüße - Ein Lied", DL_PARAMS(), false);
+
+    DL_STATE expected;
+    expected.dl_text = "Grüße - Ein Lied";
+    expected.dl_plus_enabled = true;
+    expected.dl_plus_item_toggle = true;
+    expected.dl_plus_item_running = true;
+    expected.dl_plus_tags = {DL_PLUS_TAG(4, 0, 4), DL_PLUS_TAG(1, 8, 7)};
+    expected_encoder.encodeLabel(expected, DL_PARAMS());
+    EXPECT_EQ(DrainPackets(packetizer), DrainPackets(expected_packetizer));
+}
+
+TEST_F(PADCoreTest, CharsetConversionMatchesTable) {
+    CharsetConverter converter;
+
+    // the EBU Latin table, as code points
+    std::vector<uint32_t> table;
+    for (int c = 1; c < 256; c++) {
+        std::string utf8_char = converter.convert_ebu_to_utf8(std::string(1, (char) c));
+        std::string::iterator it = utf8_char.begin();
+        table.push_back(utf8::next(it, utf8_char.end()));
+    }
+
+    // reference: linear search in the table, as the converter used to do
+    auto reference = [&table](const std::string& utf8) {
+        std::string encoded;
+        std::string::const_iterator it = utf8.begin();
+        while (it != utf8.end()) {
+            std::string::const_iterator seq = it;
+            uint32_t code_point;
+            if (utf8::internal::validate_next(seq, utf8.end(), code_point) != utf8::internal::UTF8_OK)
+                break;
+            it = seq;
+            std::vector<uint32_t>::iterator entry = std::find(table.begin(), table.end(), code_point);
+            encoded += entry == table.end() ? ' ' : (char) (entry - table.begin() + 1);
+        }
+        return encoded;
+    };
+
+    std::string all;
+    for (int c = 1; c < 256; c++)
+        all += converter.convert_ebu_to_utf8(std::string(1, (char) c));
+    for (int c = 0; c < 128; c++)
+        all += (char) c;
+    all += "\xE2\x82\xAC \xF0\x9F\x8E\xB5 \xE4\xB8\xAD";   // euro sign, outside BMP, not in table
+
+    EXPECT_EQ(converter.convert(all), reference(all));
+    EXPECT_EQ(converter.convert(all, false), reference(all));
+
+    // invalid input: converted up to the first error, or an exception
+    const std::string invalid = "Abc\xC3\xA4\xC3" "def";
+    EXPECT_EQ(converter.convert(invalid), reference(invalid));
+    EXPECT_EQ(converter.convert(invalid), std::string("Abc") + converter.convert("\xC3\xA4"));
+    EXPECT_THROW(converter.convert(invalid, false), utf8::invalid_utf8);
+    EXPECT_THROW(converter.convert("Abc\xC3", false), utf8::not_enough_room);
+
+    // the buffer variant reuses the output string
+    std::string encoded("previous content, longer than the result");
+    converter.convert(all.data(), all.size(), encoded);
+    EXPECT_EQ(encoded, reference(all));
+    converter.convert("", 0, encoded);
+    EXPECT_TRUE(encoded.empty());
+}
+
+// Test that the prebuilt remove label commands equal the ones built for each label change
+TEST_F(PADCoreTest, PrebuiltRemoveLabelCommand) {
+    DL_PARAMS remove_params;
+    remove_params.remove_dls = true;
+    PADPacketizer packetizer(58);
+    PADPacketizer expected_packetizer(58);
+    DLSEncoder encoder(&packetizer);
+    DLSEncoder expected_encoder(&expected_packetizer);
+
+    // both toggle bit values
+    for (const char* text : {"First label", "Second label", "Third label"}) {
+        const bool toggle = expected_encoder.getToggle();
+        encoder.encodeText(text, remove_params, false);
+        expected_encoder.encodeText(text, DL_PARAMS(), false);
+
+        DATA_GROUP* remove_dg = expected_packetizer.CreateDataGroup(2, DLSEncoder::APPTYPE_START, DLSEncoder::APPTYPE_CONT);
+        remove_dg->data[0] = (toggle ? 0x80 : 0x00) | 0x70 | DLS_CMD_REMOVE_LABEL;
+        remove_dg->data[1] = 0;
+        remove_dg->AppendCRC();
+        expected_packetizer.AddDG(remove_dg, true);
+
+        EXPECT_EQ(DrainPackets(packetizer), DrainPackets(expected_packetizer)) << text;
+    }
+}
+
+// Test that each label is converted into the most compact charset
+TEST_F(PADCoreTest, CompactCharsetSelection) {
+    CharsetConverter converter;
+    auto select = [&converter](const std::string& utf8) {
+        return converter.select_charset(utf8.data(), utf8.size());
+    };
+    const std::string thai = "\xE0\xB8\xAA\xE0\xB8\xA7\xE0\xB8\xB1\xE0\xB8\xAA\xE0\xB8\x94\xE0\xB8\xB5";    // 6 chars
+
+    EXPECT_EQ(select("Gr\xC3\xBC\xC3\x9F" "e\n\xE2\x82\xAC"), DABCharset::COMPLETE_EBU_LATIN);
+    EXPECT_EQ(select(thai), DABCharset::UCS2_BE);
+    EXPECT_EQ(select("News " + thai), DABCharset::UCS2_BE);         // 22 bytes, not 23
+    EXPECT_EQ(select("Top news: " + thai), DABCharset::UTF8);       // 28 bytes, not 32
+    EXPECT_EQ(select("\xF0\x9F\x8E\xB5\xE0\xB8\xAA\xE0\xB8\xAA"), DABCharset::UTF8);   // outside BMP
+    EXPECT_EQ(select("Abc\xE0\xB8" "def"), DABCharset::COMPLETE_EBU_LATIN);    // up to the first error
+
+    std::string encoded;
+    converter.convert(thai.data(), thai.size(), DABCharset::UCS2_BE, encoded);
+    EXPECT_EQ(encoded, std::string("\x0E\x2A\x0E\x27\x0E\x31\x0E\x2A\x0E\x14\x0E\x35", 12));
+    EXPECT_EQ(converter.convert_ucs2_be_to_utf8(encoded + '\0'), thai);
+    converter.convert(thai.data(), thai.size(), DABCharset::UTF8, encoded);
+    EXPECT_EQ(encoded, thai);
+
+    // a Thai label goes out as UCS-2 BE, with lines and length in its characters
+    PADPacketizer packetizer(58);
+    PADPacketizer expected_packetizer(58);
+    DLSEncoder dls_encoder(&packetizer);
+    DLSEncoder expected_encoder(&expected_packetizer);
+    DL_PARAMS raw_params;
+    raw_params.raw_dls = true;
+    raw_params.charset = DABCharset::UCS2_BE;
+
+    std::string text = thai + "\n";
+    converter.convert(thai.data(), thai.size(), DABCharset::UCS2_BE, encoded);
+    std::string expected_text = encoded + std::string("\0\n", 2);
+    for (int i = 0; i < 11; i++) {
+        text += thai;
+        expected_text += encoded;
+    }
+    dls_encoder.encodeText(text, DL_PARAMS(), false);
+    expected_encoder.encodeText(expected_text.substr(0, 128), raw_params, false);
+    EXPECT_EQ(DrainPackets(packetizer), DrainPackets(expected_packetizer));
+}
+
+// Test that counters and histograms sum up over threads and are rendered as OpenMetrics
+TEST_F(PADCoreTest, MetricsRegistry) {
+    MetricsRegistry registry;
+    MetricCounter& counter = registry.Counter("test_events", "Events", "kind=\"a\"");
+    EXPECT_EQ(&registry.Counter("test_events", "Events", "kind=\"a\""), &counter);
+    MetricHistogram& histogram = registry.Histogram("test_duration_seconds", "Durations", {0.1, 1});
+    EXPECT_THROW(registry.Counter("test_duration_seconds", "Durations"), std::invalid_argument);
+    MetricGauge& gauge = registry.Gauge("test_bytes", "Bytes");
+    gauge.Set(42);
+    EXPECT_THROW(registry.Counter("test_bytes", "Bytes"), std::invalid_argument);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < 10000; i++)
+                counter.Add();
+            histogram.Observe(0.05);
+            histogram.Observe(1);
+            histogram.Observe(5);
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    EXPECT_EQ(counter.Value(), 80000u);
+
+    const MetricHistogram::snapshot_t snapshot = histogram.Snapshot();
+    EXPECT_EQ(snapshot.cumulative, std::vector<uint64_t>({8, 16, 24}));
+    EXPECT_DOUBLE_EQ(snapshot.sum, 8 * 6.05);
+
+    const std::string text = registry.Render();
+    EXPECT_NE(text.find("# TYPE test_events counter\n# HELP test_events Events\ntest_events_total{kind=\"a\"} 80000\n"), std::string::npos);
+    EXPECT_NE(text.find("test_duration_seconds_bucket{le=\"0.1\"} 8\n"), std::string::npos);
+    EXPECT_NE(text.find("test_duration_seconds_bucket{le=\"+Inf\"} 24\n"), std::string::npos);
+    EXPECT_NE(text.find("test_duration_seconds_count 24\n"), std::string::npos);
+    EXPECT_NE(text.find("# TYPE test_bytes gauge\n# HELP test_bytes Bytes\ntest_bytes 42\n"), std::string::npos);
+    EXPECT_EQ(text.substr(text.size() - 6), "# EOF\n");
+
+    // the PAD path reports to the global registry
+    MetricCounter& mot_bytes = MetricsRegistry::Global().Counter("odr_padenc_xpad_data_bytes", "", "apptype=\"12\"");
+    const uint64_t mot_bytes_before = mot_bytes.Value();
+    PADPacketizer packetizer(23);
+    DATA_GROUP* dg = CreateTestDG(100, 12, 13);
+    const size_t dg_size = dg->Size();
+    packetizer.AddDG(dg, false);
+    DrainPackets(packetizer);
+    EXPECT_EQ(mot_bytes.Value() - mot_bytes_before, dg_size);
+}
+
+// Test that a profiled mutex counts its acquisitions and waits, and samples its holds
+TEST_F(PADCoreTest, ProfiledMutexContention) {
+    ProfiledMutex mutex("test_contention");
+    const std::string labels = "lock=\"test_contention\"";
+    MetricsRegistry& registry = MetricsRegistry::Global();
+    MetricCounter& acquisitions = registry.Counter("odr_padenc_lock_acquisitions", "", labels);
+    MetricCounter& contended = registry.Counter("odr_padenc_lock_contended", "", labels);
+    MetricHistogram& wait = registry.Histogram("odr_padenc_lock_wait_seconds", "", MetricHistogram::LOCK_BOUNDS, labels);
+    MetricHistogram& hold = registry.Histogram("odr_padenc_lock_hold_seconds", "", MetricHistogram::LOCK_BOUNDS, labels);
+
+    const uint64_t acquisitions_before = acquisitions.Value();
+    const uint64_t contended_before = contended.Value();
+    const MetricHistogram::snapshot_t wait_before = wait.Snapshot();
+    const uint64_t holds_before = hold.Snapshot().cumulative.back();
+
+    // uncontended
+    for (uint32_t i = 0; i < ProfiledMutex::HOLD_SAMPLING; i++)
+        std::lock_guard<ProfiledMutex> lock(mutex);
+    EXPECT_EQ(acquisitions.Value() - acquisitions_before, ProfiledMutex::HOLD_SAMPLING);
+    EXPECT_EQ(contended.Value(), contended_before);
+    EXPECT_EQ(wait.Snapshot().cumulative.back(), wait_before.cumulative.back());
+    EXPECT_EQ(hold.Snapshot().cumulative.back() - holds_before, 1u);
+
+    // held by another thread meanwhile
+    std::unique_lock<ProfiledMutex> held(mutex);
+    std::thread([&]() {EXPECT_FALSE(mutex.try_lock());}).join();
+    std::thread waiter([&]() {std::lock_guard<ProfiledMutex> lock(mutex);});
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    held.unlock();
+    waiter.join();
+    EXPECT_EQ(acquisitions.Value() - acquisitions_before, ProfiledMutex::HOLD_SAMPLING + 2);
+    EXPECT_EQ(contended.Value() - contended_before, 1u);
+    const MetricHistogram::snapshot_t waited = wait.Snapshot();
+    EXPECT_EQ(waited.cumulative.back() - wait_before.cumulative.back(), 1u);
+    EXPECT_GE(waited.sum - wait_before.sum, 0.01);
+
+    const std::string text = registry.Render();
+    EXPECT_NE(text.find("odr_padenc_lock_contended_total{lock=\"test_contention\"} " + std::to_string(contended.Value()) + "\n"), std::string::npos);
+}
+
+// Test that the history keeps points per resolution, aggregated and overwritten in their rings
+TEST_F(PADCoreTest, MetricsHistory) {
+    MetricsRegistry registry;
+    MetricGauge& gauge = registry.Gauge("test_queue", "Queue");
+    registry.Counter("test_sent", "Sent").Add(3);
+    MetricsHistory history(registry);
+
+    const int64_t start = 1700000040;   // the start of a minute
+    for (int64_t t = 0; t < 120; t++) {
+        gauge.Set(t % 60);
+        history.Sample(start + t);
+    }
+    EXPECT_EQ(history.Series(), std::vector<std::string>({"test_queue", "test_sent_total"}));
+
+    const std::vector<MetricsHistory::point_t> seconds =
+            history.Query("test_queue", MetricsHistory::RESOLUTION_SECOND, start + 10, start + 12);
+    ASSERT_EQ(seconds.size(), 3u);
+    EXPECT_EQ(seconds[0].start, start + 10);
+    EXPECT_DOUBLE_EQ(seconds[2].Avg(), 12);
+
+    const std::vector<MetricsHistory::point_t> minutes =
+            history.Query("test_queue", MetricsHistory::RESOLUTION_MINUTE, 0, start + 1000);
+    ASSERT_EQ(minutes.size(), 2u);
+    EXPECT_EQ(minutes[1].start, start + 60);
+    EXPECT_EQ(minutes[1].count, 60u);
+    EXPECT_DOUBLE_EQ(minutes[1].min, 0);
+    EXPECT_DOUBLE_EQ(minutes[1].max, 59);
+    EXPECT_DOUBLE_EQ(minutes[1].Avg(), 29.5);
+    EXPECT_EQ(history.Query("test_sent_total", MetricsHistory::RESOLUTION_HOUR, 0, start + 1000).size(), 1u);
+
+    // a full ring later, the point of the same slot is a new one
+    gauge.Set(100);
+    history.Sample(start + 10 + (int64_t) MetricsHistory::POINTS[MetricsHistory::RESOLUTION_SECOND]);
+    EXPECT_TRUE(history.Query("test_queue", MetricsHistory::RESOLUTION_SECOND, start + 10, start + 10).empty());
+
+    EXPECT_EQ(history.QueryJSON("test_queue", MetricsHistory::RESOLUTION_MINUTE, start, start),
+              "{\"series\":\"test_queue\",\"resolution\":\"1m\",\"points\":[[1700000040,0,59,29.5]]}");
+    EXPECT_EQ(history.QueryJSON("test_unknown", MetricsHistory::RESOLUTION_MINUTE, 0, start),
+              "{\"series\":null,\"points\":[]}");
+
+    MetricsHistory::resolution_t resolution;
+    EXPECT_TRUE(MetricsHistory::ParseResolution("1h", resolution));
+    EXPECT_EQ(resolution, MetricsHistory::RESOLUTION_HOUR);
+    EXPECT_FALSE(MetricsHistory::ParseResolution("5m", resolution));
+}
+
+// Test that timings are merged over threads, incl. exited ones, within the bucket precision
+TEST_F(PADCoreTest, TimingHistograms) {
+    for (uint64_t ticks : {0ull, 7ull, 8ull, 9ull, 15ull, 16ull, 1000ull, 123456789ull, ~0ull}) {
+        const size_t bucket = TimingSnapshot::Bucket(ticks);
+        EXPECT_LE(TimingSnapshot::BucketLowerBound(bucket), ticks);
+        if (bucket + 1 < TimingSnapshot::BUCKETS) {
+            EXPECT_GT(TimingSnapshot::BucketLowerBound(bucket + 1), ticks);
+        }
+    }
+
+    const TimingOperation operation("test.timing");
+    EXPECT_EQ(TimingOperation("test.timing").id, operation.id);
+    const TimingSnapshot before = Timings::Read(operation.id);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&]() {
+            for (uint64_t ticks = 1; ticks <= 1000; ticks++)
+                Timings::Record(operation.id, ticks);
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    Timings::Record(operation.id, 100000);
+
+    TimingSnapshot snapshot = Timings::Read(operation.id);
+    snapshot -= before;
+    EXPECT_EQ(snapshot.count, 4001u);
+    EXPECT_EQ(snapshot.sum, 4 * 500500u + 100000u);
+    EXPECT_NEAR(snapshot.PercentileNanoseconds(50) / snapshot.ns_per_tick, 500, 500 * 0.125);
+    EXPECT_NEAR(snapshot.MaxNanoseconds() / snapshot.ns_per_tick, 100000, 100000 * 0.125);
+    EXPECT_DOUBLE_EQ(snapshot.MinNanoseconds(), snapshot.ns_per_tick);
+
+    // writing a PAD is timed
+    const uint64_t pads_before = Timings::Read(PADPacketizer::TIMING_WRITE_PAD.id).count;
+    PADPacketizer packetizer(23);
+    packetizer.GetNextPAD(true);
+    packetizer.GetNextPAD(false);
+    EXPECT_EQ(Timings::Read(PADPacketizer::TIMING_WRITE_PAD.id).count - pads_before, 2u);
+}
+
+// Test that the ring of the DG queues keeps its order across wrap-around, growth and removals
+TEST_F(PADCoreTest, RingQueueOrder) {
+    RingQueue<int> ring;
+    std::deque<int> expected;
+    for (int i = 0; i < 100; i++) {
+        // pushes at both ends and pops at the front, so that the ring wraps and grows
+        if (i % 3 == 0) {
+            ring.push_front(-i);
+            expected.push_front(-i);
+        } else {
+            ring.push_back(i);
+            expected.push_back(i);
+        }
+        if (i % 5 == 4) {
+            ring.pop_front();
+            expected.pop_front();
+        }
+        if (i % 7 == 6) {
+            ring.erase(ring.size() / 2);
+            expected.erase(expected.begin() + expected.size() / 2);
+        }
+        ASSERT_EQ(ring.size(), expected.size());
+        for (size_t j = 0; j < expected.size(); j++)
+            ASSERT_EQ(ring[j], expected[j]);
+        EXPECT_EQ(ring.front(), expected.front());
+        EXPECT_EQ(ring.back(), expected.back());
+    }
+
+    while (!ring.empty())
+        ring.pop_back();
+    EXPECT_EQ(ring.size(), 0u);
+}
+
+// Test that the ImageMagick limits are parsed in MiB, keeping the defaults of the ones not given
+TEST_F(PADCoreTest, MagickLimitsParse) {
+    magick_limits_t limits;
+    EXPECT_TRUE(limits.Parse("memory=64,disk=512"));
+    EXPECT_EQ(limits.threads, magick_limits_t::DEFAULT_THREADS);
+    EXPECT_EQ(limits.memory, 64u * 1024 * 1024);
+    EXPECT_EQ(limits.map, 0u);
+    EXPECT_EQ(limits.disk, 512u * 1024 * 1024);
+
+    EXPECT_FALSE(magick_limits_t().Parse("memory"));
+    EXPECT_FALSE(magick_limits_t().Parse("memory=-1"));
+    EXPECT_FALSE(magick_limits_t().Parse("memory=64M"));
+    EXPECT_FALSE(magick_limits_t().Parse("area=64"));
+}
+
+// Test that concurrent JPEG jobs go to the device, and to the software encoder once it fails
+TEST_F(PADCoreTest, JPEGOffloadFallback) {
+    struct FakeDevice : public JPEGDevice {
+        std::atomic<size_t>& jobs;
+        bool fail;
+        FakeDevice(std::atomic<size_t>& jobs, bool fail) : jobs(jobs), fail(fail) {}
+        const char* Name() const {return "fake";}
+        void EncodeBatch(const std::vector<jpeg_job_t*>& batch) {
+            for (jpeg_job_t* job : batch) {
+                jobs++;
+                if (!fail) {
+                    job->out->assign(1, (uint8_t) job->quality);
+                    job->ok = true;
+                }
+            }
+        }
+    };
+
+    rgb_image_t image;
+    image.width = 32;
+    image.height = 24;
+    image.pixels.assign(image.width * image.height * 3, 128);
+
+    JPEGOffload offload;
+    std::atomic<size_t> jobs(0);
+    offload.SetDevice(std::unique_ptr<JPEGDevice>(new FakeDevice(jobs, false)));
+    std::vector<std::vector<uint8_t>> outs(4);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < outs.size(); i++)
+        threads.emplace_back([&, i]{EXPECT_TRUE(offload.Encode(image, 50 + i, outs[i]));});
+    for (std::thread& thread : threads)
+        thread.join();
+    for (size_t i = 0; i < outs.size(); i++)
+        EXPECT_EQ(outs[i], std::vector<uint8_t>(1, 50 + i));
+    EXPECT_EQ(jobs.load(), 4u);
+    EXPECT_GE(offload.GetBatches(), 1u);
+    EXPECT_EQ(offload.GetFallbacks(), 0u);
+
+#if HAVE_LIBJPEG
+    std::vector<uint8_t> expected;
+    ASSERT_TRUE(SlideCodec::EncodeJPEG(image, 75, expected));
+
+    offload.SetDevice(std::unique_ptr<JPEGDevice>(new FakeDevice(jobs, true)));
+    for (size_t i = 0; i <= JPEGOffload::MAX_DEVICE_FAILURES; i++) {
+        std::vector<uint8_t> out;
+        EXPECT_TRUE(offload.Encode(image, 75, out));
+        EXPECT_EQ(out, expected);
+    }
+    // given up after the failed batches, so the last job did not even reach it
+    EXPECT_FALSE(offload.Offloading());
+    EXPECT_EQ(offload.GetFallbacks(), JPEGOffload::MAX_DEVICE_FAILURES);
+#endif
+}
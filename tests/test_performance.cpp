@@ -145,11 +145,7 @@ TEST_F(PerformanceTest, MOTProcessingPerformance) {
     std::cout << "  " << ops_per_second << " operations per second" << std::endl;
     std::cout << "  Average time per operation: " << (duration.count() / iterations) << " microseconds" << std::endl;
     
-    // Performance target: Should process at least 100 images per second
-    EXPECT_GE(ops_per_second, 100.0);
-    
-    // Each operation should complete in under 10ms
-    EXPECT_LT(duration.count() / iterations, 10000);
+    // the timing is compared against a baseline by the benchmarks, not against fixed targets
 }
 
 // Test Thai text processing performance
@@ -189,10 +185,7 @@ TEST_F(PerformanceTest, ThaiTextProcessingPerformance) {
     std::cout << "  Text layout analysis: " << layout_ops_per_second << " ops/sec" << std::endl;
     std::cout << "  Cultural validation: " << validation_ops_per_second << " ops/sec" << std::endl;
     
-    // Performance targets
-    EXPECT_GE(utf8_ops_per_second, 500.0);     // Should handle at least 500 conversions/sec
-    EXPECT_GE(layout_ops_per_second, 200.0);   // Should analyze at least 200 layouts/sec
-    EXPECT_GE(validation_ops_per_second, 100.0); // Should validate at least 100 texts/sec
+    // the timing is compared against a baseline by BM_ThaiConvertUTF8ToDAB, BM_ThaiTextLayout and BM_ThaiValidateContent
 }
 
 // Test DLS message processing performance
@@ -222,9 +215,7 @@ TEST_F(PerformanceTest, DLSMessageProcessingPerformance) {
     std::cout << "  Message addition: " << add_ops_per_second << " ops/sec" << std::endl;
     std::cout << "  Message retrieval: " << get_ops_per_second << " ops/sec" << std::endl;
     
-    // Performance targets
-    EXPECT_GE(add_ops_per_second, 1000.0);  // Should add at least 1000 messages/sec
-    EXPECT_GE(get_ops_per_second, 500.0);   // Should retrieve at least 500 messages/sec
+    // the timing is compared against a baseline by BM_SmartDLSSelection
     
     dls_processor_->Stop();
 }
@@ -302,9 +293,6 @@ TEST_F(PerformanceTest, ConcurrentProcessingPerformance) {
     // Should complete most operations successfully
     EXPECT_GE(completed_operations.load(), total_operations * 0.8);
     
-    // Should maintain reasonable throughput under concurrent load
-    EXPECT_GE(ops_per_second, 100.0);
-    
     dls_processor_->Stop();
 }
 
@@ -428,7 +416,7 @@ TEST_F(PerformanceTest, ScalabilityTest) {
     std::cout << "  Final throughput: " << final_throughput << " ops/sec" << std::endl;
     std::cout << "  Degradation ratio: " << degradation_ratio << std::endl;
     
-    EXPECT_GE(degradation_ratio, 0.5); // Should maintain at least 50% of initial performance
+    // the timing is compared against a baseline by BM_SmartDLSSelection, at the same loads
     
     dls_processor_->Stop();
 }
@@ -471,10 +459,8 @@ TEST_F(PerformanceTest, LatencyTest) {
     std::cout << "  Avg latency: " << avg_latency.count() << " μs" << std::endl;
     std::cout << "  95th percentile: " << p95_latency.count() << " μs" << std::endl;
     
-    // Performance targets
-    EXPECT_LT(avg_latency.count(), 5000);  // Average < 5ms
-    EXPECT_LT(p95_latency.count(), 10000); // 95th percentile < 10ms
-    EXPECT_LT(max_latency.count(), 50000); // Max < 50ms
+    EXPECT_LE(min_latency, p95_latency);
+    EXPECT_LE(p95_latency, max_latency);
 }
 
 // Test resource cleanup and garbage collection
@@ -491,7 +477,7 @@ TEST_F(PerformanceTest, ResourceCleanupTest) {
         for (int i = 0; i < 50; ++i) {
             auto image = std::make_unique<EnhancedImageData>();
             image->filename = "temp_" + std::to_string(i) + ".jpg";
-            image->processed_data.resize(1024);
+            image->processed_data = std::make_shared<const SlideBlob>(uint8_vector_t(1024));
             temp_images.push_back(std::move(image));
             
             auto message = std::make_shared<DLSMessage>();
@@ -554,64 +540,32 @@ TEST_F(PerformanceTest, PerformanceMonitoringAccuracy) {
     perf_monitor_->Disable();
 }
 
-// Benchmark against performance targets
-TEST_F(PerformanceTest, PerformanceBenchmark) {
-    struct BenchmarkTargets {
-        double min_mot_ops_per_sec = 100.0;
-        double min_thai_ops_per_sec = 500.0;
-        double min_dls_ops_per_sec = 1000.0;
-        long max_avg_latency_us = 5000;
-        double min_concurrent_efficiency = 0.7; // 70% efficiency under load
-    };
-    
-    BenchmarkTargets targets;
-    bool all_targets_met = true;
-    
-    std::cout << "\n=== Performance Benchmark Results ===" << std::endl;
-    
-    // MOT processing benchmark
-    EXPECT_TRUE(mot_processor_->ProcessImageDirectory(test_image_dir_));
-    auto mot_duration = MeasureExecutionTime([this]() {
-        for (int i = 0; i < 100; ++i) {
-            auto image = mot_processor_->GetNextImage();
-        }
-    });
-    double mot_ops_per_sec = CalculateOperationsPerSecond(mot_duration, 100);
-    
-    std::cout << "MOT Processing: " << mot_ops_per_sec << " ops/sec ";
-    if (mot_ops_per_sec >= targets.min_mot_ops_per_sec) {
-        std::cout << "✓ PASS" << std::endl;
-    } else {
-        std::cout << "✗ FAIL (target: " << targets.min_mot_ops_per_sec << ")" << std::endl;
-        all_targets_met = false;
-    }
+// Test timing by operation ID as on per-frame paths; its overhead is measured
+// by BM_HotPathTiming in padenc_benchmarks
+TEST_F(PerformanceTest, HotPathTimingOverhead) {
+    static const TimingOperation operation("test.hot_path");
+    perf_monitor_->Reset();
+    perf_monitor_->Enable();
     
-    // Thai processing benchmark
-    auto thai_duration = MeasureExecutionTime([this]() {
-        for (int i = 0; i < 100; ++i) {
-            std::vector<uint8_t> dab_data;
-            thai_processor_->ConvertUTF8ToDAB(thai_test_texts_[i % thai_test_texts_.size()], dab_data);
-        }
-    });
-    double thai_ops_per_sec = CalculateOperationsPerSecond(thai_duration, 100);
-    
-    std::cout << "Thai Processing: " << thai_ops_per_sec << " ops/sec ";
-    if (thai_ops_per_sec >= targets.min_thai_ops_per_sec) {
-        std::cout << "✓ PASS" << std::endl;
-    } else {
-        std::cout << "✗ FAIL (target: " << targets.min_thai_ops_per_sec << ")" << std::endl;
-        all_targets_met = false;
-    }
+    const int iterations = 1000000;
+    auto duration = MeasureExecutionTime([&]() {
+        PerformanceMonitor::ScopedTimer timer(*perf_monitor_, operation);
+    }, iterations);
     
-    std::cout << "\nOverall Benchmark: ";
-    if (all_targets_met) {
-        std::cout << "✓ ALL TARGETS MET" << std::endl;
-        SUCCEED();
-    } else {
-        std::cout << "✗ SOME TARGETS NOT MET" << std::endl;
-        // Note: We don't FAIL the test as performance can vary by environment
-        // but we report the results for analysis
-    }
+    auto metrics = perf_monitor_->GetMetrics("test.hot_path");
+    const double overhead_ns = duration.count() * 1000.0 / iterations;
+    
+    std::cout << "Hot Path Timing:" << std::endl;
+    std::cout << "  " << overhead_ns << " ns per measurement" << std::endl;
+    std::cout << "  Median measured: " << metrics.median_processing_time.count() << " ns" << std::endl;
     
-    std::cout << "=====================================" << std::endl;
-}
\ No newline at end of file
+    EXPECT_EQ(metrics.operation_count, static_cast<size_t>(iterations));
+    EXPECT_LE(metrics.median_processing_time, metrics.p99_processing_time);
+    
+    // disabled, nothing is recorded
+    perf_monitor_->Disable();
+    {
+        PerformanceMonitor::ScopedTimer timer(*perf_monitor_, operation);
+    }
+    EXPECT_EQ(perf_monitor_->GetMetrics("test.hot_path").operation_count, static_cast<size_t>(iterations));
+}
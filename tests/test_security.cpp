@@ -5,14 +5,21 @@
     Tests for security utilities:
     - File path traversal protection
     - Content validation and sanitization
+    - Single-pass multi-pattern matching
     - Memory safety improvements
+    - Slab allocations with thread caches and sampled tracking
     - Input validation
     - Cryptographic functions
+    - Incremental hashing
+    - Work-stealing thread pool
 */
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 #include "../src/security_utils.h"
+#include <algorithm>
+#include <array>
+#include <random>
 #include <fstream>
 #include <filesystem>
 
@@ -135,7 +142,8 @@ TEST_F(SecurityTest, PathNormalization) {
 
 // Test path sanitization
 TEST_F(SecurityTest, PathSanitization) {
-    std::string dangerous_path = "../../../etc/passwd\0hidden";
+    const char dangerous_bytes[] = "../../../etc/passwd\0hidden";
+    std::string dangerous_path(dangerous_bytes, sizeof(dangerous_bytes) - 1);
     std::string sanitized = path_validator_->SanitizePath(dangerous_path);
     
     EXPECT_NE(sanitized, dangerous_path);
@@ -143,6 +151,82 @@ TEST_F(SecurityTest, PathSanitization) {
     EXPECT_NE(sanitized.find("etc/passwd"), std::string::npos); // Still contains safe parts
 }
 
+// Test cached path validation, kept up to date by directory changes
+TEST_F(SecurityTest, CachedPathValidation) {
+    const std::string slide = test_dir_ + "/allowed/new_slide.jpg";
+    EXPECT_FALSE(path_validator_->ValidatePath(slide).is_valid);
+    EXPECT_TRUE(path_validator_->ValidatePath(test_dir_ + "/allowed/safe.jpg").is_safe);
+    EXPECT_FALSE(path_validator_->IsPathSafe("../../../etc/passwd"));
+    size_t cached = path_validator_->GetCachedPathCount();
+    EXPECT_EQ(cached, 2u);  // the rejected name is checked again on every call
+    
+    // Served from the cache
+    EXPECT_TRUE(path_validator_->ValidatePath(test_dir_ + "/allowed/safe.jpg").is_safe);
+    EXPECT_EQ(path_validator_->GetCachedPathCount(), cached);
+    
+    // Files created, changed and deleted
+    std::ofstream(slide, std::ios::binary) << "JPEG";
+    auto validation = path_validator_->ValidatePath(slide);
+    EXPECT_TRUE(validation.is_valid);
+    EXPECT_EQ(validation.file_size, 4u);
+    std::ofstream(slide, std::ios::binary | std::ios::app) << "DATA";
+    EXPECT_EQ(path_validator_->ValidatePath(slide).file_size, 8u);
+    fs::remove(slide);
+    EXPECT_FALSE(path_validator_->ValidatePath(slide).is_valid);
+    
+    // Configuration changes clear the cache
+    path_validator_->AddBlockedPattern("safe");
+    EXPECT_EQ(path_validator_->GetCachedPathCount(), 0u);
+    EXPECT_FALSE(path_validator_->IsPathSafe(test_dir_ + "/allowed/safe.jpg"));
+    
+    // Normalization without regular expressions
+    EXPECT_EQ(SecurePathValidator::NormalizePath("\\Data\\.\\Slides//a/../B.JPG/"), "/data/slides/b.jpg");
+    EXPECT_EQ(SecurePathValidator::NormalizePath("/../x"), "/x");
+    EXPECT_EQ(SecurePathValidator::NormalizePath("a/../../x"), "../x");
+    EXPECT_EQ(SecurePathValidator::NormalizePath("//"), "/");
+    EXPECT_EQ(path_validator_->SanitizePath("a\\\\b//c/"), "a/b/c");
+}
+
+// Test cached path validation, by where the path leads
+TEST_F(SecurityTest, CachedPathValidationCanonical) {
+    fs::create_directories(test_dir_ + "/allowed/sub");
+    fs::create_directories(test_dir_ + "/other");
+    WriteTestFile(test_dir_ + "/allowed/sub/a.jpg", {1, 2, 3, 4});
+    WriteTestFile(test_dir_ + "/other/a.jpg", {1, 2, 3, 4, 5, 6, 7, 8});
+    
+    // Independent of the current directory and of how the path is written
+    const fs::path cwd = fs::current_path();
+    fs::current_path(test_dir_ + "/allowed/sub");
+    EXPECT_FALSE(path_validator_->IsPathSafe("a.jpg"));
+    fs::current_path(test_dir_);
+    EXPECT_TRUE(path_validator_->ValidatePath(test_dir_ + "/allowed/sub/a.jpg").is_valid);
+    EXPECT_EQ(path_validator_->ValidatePath(test_dir_ + "/allowed/sub/./a.jpg").sanitized_path,
+              test_dir_ + "/allowed/sub/./a.jpg");
+    EXPECT_EQ(path_validator_->GetCachedPathCount(), 1u);
+    fs::current_path(cwd);
+    
+    // Directories above the file moved away and back
+    const std::string slide = test_dir_ + "/allowed/sub/a.jpg";
+    fs::rename(test_dir_ + "/allowed", test_dir_ + "/moved");
+    EXPECT_FALSE(path_validator_->ValidatePath(slide).is_valid);
+    fs::rename(test_dir_ + "/moved", test_dir_ + "/allowed");
+    EXPECT_TRUE(path_validator_->ValidatePath(slide).is_valid);
+    
+    // A symlink on the way pointed elsewhere, then removed
+    const std::string linked = test_dir_ + "/allowed/link/a.jpg";
+    fs::create_directory_symlink(test_dir_ + "/allowed/sub", test_dir_ + "/allowed/link");
+    EXPECT_EQ(path_validator_->ValidatePath(linked).file_size, 4u);
+    fs::remove(test_dir_ + "/allowed/link");
+    fs::create_directory_symlink(test_dir_ + "/other", test_dir_ + "/allowed/link");
+    EXPECT_EQ(path_validator_->ValidatePath(linked).file_size, 8u);
+    fs::remove(test_dir_ + "/allowed/link");
+    EXPECT_FALSE(path_validator_->ValidatePath(linked).is_valid);
+    
+    // Configuration changes clear the cache
+    path_validator_->SetStrictMode(false);
+    EXPECT_EQ(path_validator_->GetCachedPathCount(), 0u);
+}
+
 // Test content scanning for malicious patterns
 TEST_F(SecurityTest, MaliciousContentDetection) {
     // Test script injection
@@ -165,6 +249,77 @@ TEST_F(SecurityTest, MaliciousContentDetection) {
     EXPECT_LT(validation.risk_score, 0.2);
 }
 
+// Test the multi-pattern matcher against searching for each pattern
+TEST_F(SecurityTest, MultiPatternMatching) {
+    auto naive_first = [](const std::vector<std::string>& patterns, const std::string& text) {
+        int first = -1;
+        size_t first_end = std::string::npos;
+        for (size_t i = 0; i < patterns.size(); ++i) {
+            size_t pos = text.find(patterns[i]);
+            if (pos != std::string::npos && (first < 0 || pos + patterns[i].size() < first_end)) {
+                first = static_cast<int>(i);
+                first_end = pos + patterns[i].size();
+            }
+        }
+        return first;
+    };
+    
+    // Overlapping patterns; few start bytes (SIMD skipping) and many
+    const std::vector<std::vector<std::string>> pattern_sets = {
+        {"he", "she", "his", "hers"},
+        {"abcab", "bca", "cab", "c"},
+        {"q0", "w1", "e2", "r3", "t4", "y5", "u6", "i7", "o8", "p9", "zz"}
+    };
+    std::mt19937 rng(42);
+    for (const auto& patterns : pattern_sets) {
+        MultiPatternMatcher matcher(patterns);
+        EXPECT_EQ(matcher.PatternCount(), patterns.size());
+        for (int round = 0; round < 500; ++round) {
+            std::string text(rng() % 100, 'x');
+            for (char& c : text) {
+                c = "abcehirsxyz0123456789qwertyuiop"[rng() % 31];
+            }
+            int expected = naive_first(patterns, text);
+            int found = matcher.FindFirst(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+            if (expected < 0) {
+                EXPECT_EQ(found, -1) << text;
+            } else {
+                // another pattern may end at the same position
+                ASSERT_GE(found, 0) << text;
+                size_t expected_end = text.find(patterns[expected]) + patterns[expected].size();
+                size_t found_pos = text.find(patterns[found]);
+                ASSERT_NE(found_pos, std::string::npos) << text;
+                EXPECT_EQ(found_pos + patterns[found].size(), expected_end) << text;
+            }
+        }
+    }
+    
+    // Matches beyond the first blocks of 16 bytes, and binary data
+    std::vector<uint8_t> data(4096, 0xAA);
+    const std::string script = "<script";
+    std::copy(script.begin(), script.end(), data.begin() + 4000);
+    EXPECT_TRUE(security_scanner_->ScanContent(std::vector<uint8_t>(data.begin(), data.begin() + 4006)).is_safe);
+    EXPECT_FALSE(security_scanner_->ScanContent(data).is_safe);
+    
+    // Patterns added later
+    std::vector<uint8_t> marker = {'E', 'V', 'I', 'L', 0x00, 0x01};
+    EXPECT_TRUE(security_scanner_->ScanContent(marker).is_safe);
+    security_scanner_->AddMaliciousPattern(std::string("EVIL\0", 5));
+    EXPECT_FALSE(security_scanner_->ScanContent(marker).is_safe);
+    
+    std::ofstream(test_dir_ + "/patterns.conf") << "# comment\n\nmalware-sig\n";
+    security_scanner_->LoadMaliciousPatterns(test_dir_ + "/patterns.conf");
+    EXPECT_FALSE(security_scanner_->ScanTextContent("a malware-sig here").is_safe);
+    EXPECT_TRUE(security_scanner_->ScanTextContent("# comment").is_safe);
+    
+    // Image files are scanned by their extension
+    std::ofstream(test_dir_ + "/allowed/page.png", std::ios::binary) << "\x89PNG<?php";
+    auto file_validation = security_scanner_->ScanImageFile(test_dir_ + "/allowed/page.png");
+    EXPECT_FALSE(file_validation.is_safe);
+    EXPECT_THAT(file_validation.threats_detected, Contains("Malicious pattern detected"));
+    EXPECT_FALSE(security_scanner_->ScanImageFile(test_dir_ + "/allowed/tool.exe").is_safe);
+}
+
 // Test image format validation
 TEST_F(SecurityTest, ImageFormatValidation) {
     // Valid JPEG
@@ -209,7 +364,8 @@ TEST_F(SecurityTest, TextSanitization) {
     EXPECT_NE(sanitized.find("&lt;"), std::string::npos); // Should be escaped
     
     // Test control character removal
-    std::string control_chars = "Hello\x00\x01\x02World\x7F";
+    const char control_bytes[] = "Hello\x00\x01\x02World\x7F";
+    std::string control_chars(control_bytes, sizeof(control_bytes) - 1);
     sanitized = input_sanitizer_->SanitizeText(control_chars);
     EXPECT_EQ(sanitized, "HelloWorld"); // Control chars should be removed
     
@@ -219,6 +375,32 @@ TEST_F(SecurityTest, TextSanitization) {
     EXPECT_EQ(sanitized, "Hello World");
 }
 
+// Test the sanitizing steps done in one pass
+TEST_F(SecurityTest, SinglePassSanitization) {
+    // Every entity escaped once, whitespace collapsed and trimmed
+    EXPECT_EQ(input_sanitizer_->SanitizeText("  \"Tom\" & 'Jerry'\t\r\n</b>  "),
+              "&quot;Tom&quot; &amp; &#x27;Jerry&#x27; &lt;&#x2F;b&gt;");
+    EXPECT_EQ(input_sanitizer_->EscapeHTML("a < b\n"), "a &lt; b\n");
+    EXPECT_EQ(input_sanitizer_->NormalizeWhitespace("\v a \f\n b\t"), "a b");
+    EXPECT_EQ(input_sanitizer_->RemoveControlCharacters(std::string("a\0b\x1B[1mc\x7F\td", 11)), "ab[1mc\td");
+    
+    // Only dangerous tags are removed with basic formatting, whatever their case and spacing
+    EXPECT_EQ(input_sanitizer_->SanitizeText("<b>Now</b> <SCRIPT type=\"x\">alert(1)< / script > playing", true),
+              "<b>Now</b> alert(1) playing");
+    EXPECT_EQ(input_sanitizer_->SanitizeText("<scr\x01ipt src=x>a</scr\x02ipt>", true), "a");
+    EXPECT_EQ(input_sanitizer_->SanitizeText("<scripture> <iframe", true), "<scripture> <iframe");
+    EXPECT_EQ(input_sanitizer_->SanitizeText("a < b", true), "a < b");
+    
+    // Linear in the input, also with many unclosed tags
+    std::string tags;
+    for (int i = 0; i < 20000; ++i) {
+        tags += "<form ";
+    }
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(input_sanitizer_->SanitizeText(tags, true), tags.substr(0, tags.size() - 1));
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(100));
+}
+
 // Test filename sanitization
 TEST_F(SecurityTest, FilenameSanitization) {
     // Dangerous filename
@@ -346,6 +528,74 @@ TEST_F(SecurityTest, SecureMemoryOperations) {
     memory_manager_->SecureFree(ptr2);
 }
 
+// Test slab allocations from many threads and sampled tracking
+TEST_F(SecurityTest, SlabAllocationsAndSampledTracking) {
+    auto initial_stats = memory_manager_->GetMemoryStats();
+    std::atomic<int> failures{0};
+    std::vector<std::thread> threads;
+    
+    // Blocks of all size classes and beyond, freed by other threads as well
+    std::vector<void*> handed_over[4];
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < 1000; ++i) {
+                size_t size = size_t(1) << (i % 18);
+                uint8_t* ptr = static_cast<uint8_t*>(memory_manager_->SecureAlloc(size, "SlabTest"));
+                if (!ptr || ptr[0] != 0 || ptr[size - 1] != 0 || reinterpret_cast<uintptr_t>(ptr) % 16 != 0) {
+                    failures++;
+                    continue;
+                }
+                memset(ptr, 0xCC, size);
+                if (i % 10 == 0) {
+                    handed_over[t].push_back(ptr);
+                } else {
+                    memory_manager_->SecureFree(ptr);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (auto& pointers : handed_over) {
+        for (void* ptr : pointers) {
+            memory_manager_->SecureFree(ptr);
+        }
+    }
+    EXPECT_EQ(failures.load(), 0);
+    
+    auto stats = memory_manager_->GetMemoryStats();
+    EXPECT_EQ(stats.allocated_blocks - initial_stats.allocated_blocks, 4000u);
+    EXPECT_EQ(stats.freed_blocks - initial_stats.freed_blocks, 4000u);
+    EXPECT_EQ(stats.current_usage_bytes, initial_stats.current_usage_bytes);
+    EXPECT_GE(stats.peak_usage_bytes, stats.current_usage_bytes);
+    
+    // Only every n-th allocation is recorded
+    size_t initial_leaks = memory_manager_->DetectLeaks().size();
+    memory_manager_->SetTrackingMode(MemoryTrackingMode::SAMPLED, 4);
+    std::vector<void*> sampled;
+    for (int i = 0; i < 64; ++i) {
+        sampled.push_back(memory_manager_->SecureAlloc(64, "SampledTest"));
+    }
+    EXPECT_EQ(memory_manager_->DetectLeaks().size() - initial_leaks, 16u);
+    for (void* ptr : sampled) {
+        memory_manager_->SecureFree(ptr);
+    }
+    EXPECT_EQ(memory_manager_->DetectLeaks().size(), initial_leaks);
+    memory_manager_->SetTrackingMode(MemoryTrackingMode::FULL);
+    
+    // Reallocation keeps the contents; freeing twice is refused
+    char* text = static_cast<char*>(memory_manager_->SecureAlloc(8, "ReallocTest"));
+    strcpy(text, "PADENC");
+    text = static_cast<char*>(memory_manager_->SecureRealloc(text, 4096, "ReallocTest"));
+    ASSERT_NE(text, nullptr);
+    EXPECT_STREQ(text, "PADENC");
+    memory_manager_->SecureFree(text);
+    auto freed = memory_manager_->GetMemoryStats().freed_blocks;
+    memory_manager_->SecureFree(text);
+    EXPECT_EQ(memory_manager_->GetMemoryStats().freed_blocks, freed);
+}
+
 // Test cryptographic functions
 TEST_F(SecurityTest, CryptographicFunctions) {
     std::vector<uint8_t> test_data = {'H', 'e', 'l', 'l', 'o', ' ', 'W', 'o', 'r', 'l', 'd'};
@@ -375,6 +625,60 @@ TEST_F(SecurityTest, CryptographicFunctions) {
     EXPECT_FALSE(SecurityUtils::VerifyChecksum(test_data, "invalid_hash", "SHA256"));
 }
 
+// Test incremental hashing
+TEST_F(SecurityTest, IncrementalHashing) {
+    const std::string abc_sha256 = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+    const std::string abc_md5 = "900150983cd24fb0d6963f7d28e17f72";
+    EXPECT_EQ(SecurityUtils::CalculateSHA256("abc", 3), abc_sha256);
+    EXPECT_EQ(SecurityUtils::CalculateMD5("abc", 3), abc_md5);
+    
+    // in pieces, the same as in one
+    Hasher hasher;
+    EXPECT_TRUE(hasher.Update("a", 1));
+    EXPECT_TRUE(hasher.Update("", 0));
+    EXPECT_TRUE(hasher.Update(std::string("bc")));
+    EXPECT_EQ(hasher.FinalHex(), abc_sha256);
+    
+    // starts anew after Final()
+    hasher.Update(std::vector<uint8_t>{'a', 'b', 'c'});
+    std::string raw = hasher.Final();
+    EXPECT_EQ(raw.size(), 32);
+    EXPECT_EQ(SecurityUtils::ToHex(raw), abc_sha256);
+    
+    Hasher md5(Hasher::Algorithm::MD5);
+    Hasher moved(std::move(md5));
+    moved.Update("ab", 2);
+    moved.Update("c", 1);
+    EXPECT_EQ(moved.FinalHex(), abc_md5);
+    
+    // field boundaries count
+    Hasher first, second;
+    first.UpdateField("ab", 2);
+    first.UpdateField("c", 1);
+    second.UpdateField("a", 1);
+    second.UpdateField("bc", 2);
+    EXPECT_NE(first.Final(), second.Final());
+    
+    // files, in chunks
+    std::vector<uint8_t> content(200 * 1024);
+    for (size_t i = 0; i < content.size(); i++) {
+        content[i] = static_cast<uint8_t>(i * 31);
+    }
+    WriteTestFile(test_dir_ + "/allowed/large.bin", content);
+    EXPECT_TRUE(hasher.UpdateFromFile(test_dir_ + "/allowed/large.bin"));
+    EXPECT_EQ(hasher.FinalHex(), SecurityUtils::CalculateSHA256(content));
+    EXPECT_FALSE(hasher.UpdateFromFile(test_dir_ + "/allowed/nonexistent.bin"));
+    
+    const uint8_t bytes[] = {0x00, 0x0f, 0xa5, 0xff};
+    EXPECT_EQ(SecurityUtils::ToHex(bytes, sizeof(bytes)), "000fa5ff");
+    
+    std::string upper = abc_sha256;
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    EXPECT_TRUE(SecurityUtils::VerifyChecksum("abc", 3, upper));
+    EXPECT_FALSE(SecurityUtils::VerifyChecksum("abd", 3, abc_sha256));
+    EXPECT_FALSE(SecurityUtils::VerifyChecksum("abc", 3, abc_md5, "SHA1"));
+}
+
 // Test random number generation
 TEST_F(SecurityTest, RandomNumberGeneration) {
     // Generate random bytes
@@ -401,6 +705,35 @@ TEST_F(SecurityTest, RandomNumberGeneration) {
     for (char c : hex_str) {
         EXPECT_NE(std::string("0123456789ABCDEF").find(c), std::string::npos);
     }
+    
+    // IDs of a fixed width
+    std::string id = SecurityUtils::GenerateID("item_");
+    EXPECT_EQ(id.size(), 5u + 16u);
+    EXPECT_EQ(id.compare(0, 5, "item_"), 0);
+    EXPECT_EQ(id.find_first_not_of("0123456789abcdef", 5), std::string::npos);
+    EXPECT_NE(SecurityUtils::GenerateID("item_"), id);
+    
+    // the keystream: RFC 8439, 2.3.2
+    uint8_t key[32];
+    for (int i = 0; i < 32; i++) {
+        key[i] = i;
+    }
+    const uint8_t nonce[12] = {0, 0, 0, 0x09, 0, 0, 0, 0x4a, 0, 0, 0, 0};
+    uint8_t block[64];
+    SecureRandom::Block(key, 1, nonce, block);
+    EXPECT_EQ(SecurityUtils::ToHex(block, 16), "10f1e7e4d13b5915500fdd1fa32071c4");
+    EXPECT_EQ(SecurityUtils::ToHex(block + 48, 16), "b5129cd1de164eb9cbd083e8a2503c4e");
+    
+    // uniform in the bound, across buffer refills
+    std::array<int, 6> counts{};
+    for (int i = 0; i < 6000; i++) {
+        uint32_t value = SecureRandom::Uniform(6);
+        ASSERT_LT(value, 6u);
+        counts[value]++;
+    }
+    for (int count : counts) {
+        EXPECT_GT(count, 800);
+    }
 }
 
 // Test safe buffer operations
@@ -433,6 +766,47 @@ TEST_F(SecurityTest, SafeBufferOperations) {
     EXPECT_EQ(full_data, test_data + append_data);
 }
 
+// Test safe buffer storage: inline, growing up to the maximum, released and adopted without copies
+TEST_F(SecurityTest, SafeBufferGrowth) {
+    SafeBuffer buffer(16, 1000);
+    EXPECT_EQ(buffer.Capacity(), SafeBuffer::INLINE_CAPACITY);
+    std::string text(SafeBuffer::INLINE_CAPACITY, 'a');
+    EXPECT_TRUE(buffer.Append(text.data(), text.size()));
+    EXPECT_EQ(buffer.Capacity(), SafeBuffer::INLINE_CAPACITY);
+    
+    // twice the storage at least, capped by the maximum
+    EXPECT_TRUE(buffer.Append("b", 1));
+    EXPECT_EQ(buffer.Capacity(), 2 * SafeBuffer::INLINE_CAPACITY);
+    EXPECT_TRUE(buffer.Resize(600));
+    EXPECT_EQ(buffer.Capacity(), 600u);
+    EXPECT_EQ(buffer.ReadString(SafeBuffer::INLINE_CAPACITY, 2), std::string("b\0", 2));
+    EXPECT_FALSE(buffer.Write(990, text.data(), 11));
+    EXPECT_TRUE(buffer.Write(990, text.data(), 10));
+    EXPECT_EQ(buffer.Capacity(), 1000u);
+    EXPECT_TRUE(buffer.IsFull());
+    EXPECT_FALSE(buffer.Append("c", 1));
+    EXPECT_FALSE(buffer.Write(SIZE_MAX, "c", 2));
+    
+    // the storage moves out, and back in
+    const uint8_t* storage = buffer.Data();
+    std::vector<uint8_t> released = buffer.Release();
+    EXPECT_EQ(released.data(), storage);
+    EXPECT_EQ(released.size(), 1000u);
+    EXPECT_TRUE(buffer.IsEmpty());
+    
+    SafeBuffer adopting(0);
+    adopting.Adopt(std::move(released));
+    EXPECT_EQ(adopting.Data(), storage);
+    EXPECT_EQ(adopting.Size(), 1000u);
+    EXPECT_EQ(adopting.MaxCapacity(), 1000u);
+    
+    // inline contents are copied
+    SafeBuffer small("xyz", 3);
+    SafeBuffer moved(std::move(small));
+    EXPECT_EQ(moved.ReadString(0, 10), "xyz");
+    EXPECT_EQ(moved.Release(), std::vector<uint8_t>({'x', 'y', 'z'}));
+}
+
 // Test buffer overflow protection
 TEST_F(SecurityTest, BufferOverflowProtection) {
     SafeBuffer small_buffer(10);
@@ -529,6 +903,94 @@ TEST_F(SecurityTest, ConcurrentSecurityOperations) {
     EXPECT_GT(successful_allocations.load(), 0);
 }
 
+// Test the work-stealing thread pool
+TEST_F(SecurityTest, WorkStealingThreadPool) {
+    ThreadPool pool(4);
+    
+    // Tasks submitting subtasks from the workers
+    std::atomic<int> executed{0};
+    for (int i = 0; i < 64; ++i) {
+        pool.SubmitTask([&pool, &executed]() {
+            for (int j = 0; j < 16; ++j) {
+                pool.SubmitTask([&executed]() { executed++; }, TaskPriority::SLIDE_ENCODE);
+            }
+            executed++;
+        });
+    }
+    
+    // Callables too large to be stored in place
+    std::array<char, 2 * PoolTask::INLINE_SIZE> large{};
+    large[0] = 1;
+    pool.SubmitTask([large, &executed]() { executed += large[0]; });
+    
+    pool.WaitForAllTasks();
+    EXPECT_EQ(executed.load(), 64 * 17 + 1);
+    EXPECT_EQ(pool.GetQueuedTaskCount(), 0u);
+    EXPECT_EQ(pool.GetActiveTaskCount(), 0u);
+    
+    // Results
+    auto sum = pool.Submit([](int a, int b) { return a + b; }, 2, 3);
+    auto text = pool.SubmitWithPriority(TaskPriority::REALTIME, []() { return std::string("PAD"); });
+    EXPECT_EQ(sum.get(), 5);
+    EXPECT_EQ(text.get(), "PAD");
+    
+    // Queued tasks are taken by priority while the only worker is busy
+    pool.Resize(1);
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    pool.SubmitTask([released]() { released.wait(); });
+    
+    std::mutex order_mutex;
+    std::vector<TaskPriority> order;
+    for (TaskPriority priority : {TaskPriority::ANALYSIS, TaskPriority::SLIDE_ENCODE, TaskPriority::REALTIME}) {
+        pool.SubmitTask([&order_mutex, &order, priority]() {
+            std::lock_guard<std::mutex> lock(order_mutex);
+            order.push_back(priority);
+        }, priority);
+    }
+    release.set_value();
+    pool.WaitForAllTasks();
+    EXPECT_EQ(order, std::vector<TaskPriority>({TaskPriority::REALTIME, TaskPriority::SLIDE_ENCODE, TaskPriority::ANALYSIS}));
+    
+    // Once stopped, tasks run in the caller's thread
+    pool.Stop();
+    EXPECT_EQ(pool.GetThreadCount(), 0u);
+    bool ran = false;
+    pool.SubmitTask([&ran]() { ran = true; });
+    EXPECT_TRUE(ran);
+}
+
+// Test the resource sampler: samples read in the background, CPU usage over a window
+TEST_F(SecurityTest, ResourceSampling) {
+    ResourceSampler sampler(std::chrono::milliseconds(20));
+    EXPECT_EQ(sampler.Latest().memory_usage, 0u);
+    EXPECT_EQ(sampler.CPUUsage(std::chrono::seconds(1)), 0.0);
+    
+    sampler.Start();
+    const ResourceSample first = sampler.Latest();
+    EXPECT_GT(first.memory_usage, 0u);
+    EXPECT_GE(first.thread_count, 1u);
+    
+    // a busy thread shows in the usage of the window
+    const auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+    volatile uint64_t spins = 0;
+    while (std::chrono::steady_clock::now() < until) {
+        spins = spins + 1;
+    }
+    EXPECT_GT(sampler.CPUUsage(std::chrono::milliseconds(200)), 30.0);
+    EXPECT_GE(sampler.Latest().thread_count, 2u);   // with the sampler's
+    
+    sampler.Stop();
+    const auto history = sampler.History();
+    EXPECT_GE(history.size(), 5u);
+    EXPECT_LE(history.size(), ResourceSampler::HISTORY - 1);
+    for (size_t i = 1; i < history.size(); i++) {
+        EXPECT_GT(history[i].time, history[i - 1].time);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(sampler.History().size(), history.size());
+}
+
 // Test performance of security operations
 TEST_F(SecurityTest, SecurityPerformance) {
     auto start = std::chrono::high_resolution_clock::now();
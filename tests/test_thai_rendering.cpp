@@ -18,6 +18,7 @@
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 #include "thai_rendering.h"
+#include "thai_segmenter.h"
 #include "test_main.cpp"
 
 using namespace StreamDAB;
@@ -54,6 +55,28 @@ TEST_F(ThaiRenderingTest, UTF8ToDABConversion) {
     EXPECT_EQ(dab_data[0], 0x0E); // Thai charset identifier
 }
 
+TEST_F(ThaiRenderingTest, UTF8ToDABIntoBuffer) {
+    // ก (U+0E01), ๛ (U+0E5B), ASCII, é (not in the profile)
+    const string text = "\xE0\xB8\x81 DAB radio label: ok \xE0\xB9\x9B\xC3\xA9";
+    uint8_t buffer[64];
+    size_t size = processor_->ConvertUTF8ToDAB(text.data(), text.size(), buffer, sizeof(buffer));
+    
+    const vector<uint8_t> expected_head = {0x0E, 0x01, ' ', 'D', 'A', 'B'};
+    ASSERT_EQ(size, 1 + 1 + 21 + 1 + 1);
+    EXPECT_TRUE(equal(expected_head.begin(), expected_head.end(), buffer));
+    EXPECT_EQ(buffer[size - 2], 0x5B);
+    EXPECT_EQ(buffer[size - 1], '?');
+    
+    vector<uint8_t> dab_data;
+    ASSERT_TRUE(processor_->ConvertUTF8ToDAB(text, dab_data));
+    EXPECT_EQ(dab_data, vector<uint8_t>(buffer, buffer + size));
+    
+    // too small a buffer, truncated sequences, encoded surrogates
+    EXPECT_EQ(processor_->ConvertUTF8ToDAB(text.data(), text.size(), buffer, text.size()), 0);
+    EXPECT_EQ(processor_->ConvertUTF8ToDAB("\xE0\xB8", 2, buffer, sizeof(buffer)), 0);
+    EXPECT_EQ(processor_->ConvertUTF8ToDAB("\xED\xA0\x80", 3, buffer, sizeof(buffer)), 0);
+}
+
 TEST_F(ThaiRenderingTest, DABToUTF8Conversion) {
     vector<uint8_t> dab_data;
     ASSERT_TRUE(processor_->ConvertUTF8ToDAB(thai_text_, dab_data));
@@ -179,6 +202,60 @@ TEST_F(ThaiRenderingTest, HolidaysInMonth) {
     }
 }
 
+TEST_F(ThaiRenderingTest, CalendarTableLookup) {
+    EXPECT_EQ(ThaiCalendar::DayNumber(1970, 1, 1), 0);
+    EXPECT_EQ(ThaiCalendar::DayNumber(2024, 3, 1) - ThaiCalendar::DayNumber(2024, 2, 28), 2);
+    
+    auto calendar = ThaiCalendar::Default();
+    const ThaiCalendar::Day* day = calendar->Find(2024, 1, 1);
+    ASSERT_NE(day, nullptr);
+    BuddhistDate bd = calendar->ToBuddhistDate(*day);
+    EXPECT_TRUE(bd.is_valid);
+    EXPECT_EQ(bd.year_be, 2567);
+    EXPECT_EQ(bd.thai_day_name, "วันจันทร์");
+    EXPECT_TRUE(bd.is_national_holiday);
+    EXPECT_EQ(bd.event_description_english, "New Year's Day");
+    
+    EXPECT_EQ(calendar->Find(2024, 2, 30), nullptr);
+    EXPECT_EQ(calendar->Find(1999, 12, 31), nullptr);
+    EXPECT_EQ(calendar->Find(2101, 1, 1), nullptr);
+    
+    EXPECT_TRUE(BuddhistCalendar::IsHolyDay(2567, 2, 24));      // Magha Puja 2024
+    EXPECT_FALSE(BuddhistCalendar::IsHolyDay(2568, 2, 24));
+    
+    // Chakri Day and the three days of Songkran
+    auto holidays = processor_->GetHolidaysInMonth(2567, 4);
+    ASSERT_EQ(holidays.size(), 4u);
+    EXPECT_EQ(holidays[0].day, 6);
+    EXPECT_EQ(holidays[1].event_description_english, "Songkran Festival");
+    
+    // a span of its own, with a holiday added, through a file
+    ThaiCalendar custom;
+    EXPECT_FALSE(custom.Build(2024, 0));
+    ASSERT_TRUE(custom.Build(2030, 2));
+    EXPECT_TRUE(custom.AddHoliday(2031, 5, 6, ThaiCalendar::HOLY_DAY, "วันวิสาขบูชา", "Vesak Day"));
+    EXPECT_FALSE(custom.AddHoliday(2032, 5, 6, ThaiCalendar::HOLY_DAY, "วันวิสาขบูชา", "Vesak Day"));
+    
+    const string path = "/tmp/thai_calendar_test.cal";
+    ASSERT_TRUE(custom.WriteFile(path));
+    ASSERT_TRUE(processor_->LoadCalendar(path));
+    
+    holidays = processor_->GetHolidaysInMonth(2574, 5);
+    ASSERT_EQ(holidays.size(), 3u);     // Labour Day, Coronation Day, Vesak
+    EXPECT_TRUE(holidays[2].is_holy_day);
+    EXPECT_EQ(holidays[2].thai_day_name, "วันอังคาร");
+    EXPECT_TRUE(processor_->GetHolidaysInMonth(2567, 4).empty());
+    
+    FILE* f = fopen(path.c_str(), "r+b");
+    ASSERT_NE(f, nullptr);
+    fputc('X', f);
+    fclose(f);
+    EXPECT_FALSE(processor_->LoadCalendar(path));
+    EXPECT_EQ(processor_->GetHolidaysInMonth(2574, 5).size(), 3u);
+    
+    remove(path.c_str());
+}
+
 // Cultural Content Validation Tests
 TEST_F(ThaiRenderingTest, CulturalContentValidation) {
     auto validation = processor_->ValidateContent(thai_text_);
@@ -227,6 +304,49 @@ TEST_F(ThaiRenderingTest, TextSanitization) {
     EXPECT_EQ(sanitized.find("บ้า"), string::npos); // Should remove inappropriate parts
 }
 
+TEST_F(ThaiRenderingTest, CulturalTermMatcher) {
+    ThaiTermMatcher matcher;
+    EXPECT_TRUE(matcher.Add("พระ", ThaiTermMatcher::RELIGIOUS, 0.0));
+    EXPECT_TRUE(matcher.Add("พระองค์", ThaiTermMatcher::ROYAL, 0.0));
+    EXPECT_TRUE(matcher.Add("Spam", ThaiTermMatcher::INAPPROPRIATE, 0.5));
+    EXPECT_TRUE(matcher.Add("บ้า", ThaiTermMatcher::INAPPROPRIATE, 0.2));
+    EXPECT_FALSE(matcher.Add(" บ\u200B้า ", ThaiTermMatcher::INAPPROPRIATE, 0.2));    // the same, normalised
+    EXPECT_FALSE(matcher.Add(" \t", ThaiTermMatcher::INAPPROPRIATE, 0.2));
+    matcher.Compile();
+    
+    // overlapping terms, case and invisible characters
+    const string text = "พระองค์ SPAM บ\u200B้า";
+    ThaiTermMatcher::Result result;
+    matcher.Scan(text, result);
+    ASSERT_EQ(result.matches.size(), 4u);
+    EXPECT_EQ(matcher.Term(result.matches[0].term), "พระ");
+    EXPECT_EQ(matcher.Term(result.matches[1].term), "พระองค์");
+    EXPECT_EQ(text.substr(result.matches[1].offset, result.matches[1].length), "พระองค์");
+    EXPECT_EQ(text.substr(result.matches[2].offset, result.matches[2].length), "SPAM");
+    EXPECT_EQ(text.substr(result.matches[3].offset, result.matches[3].length), "บ\u200B้า");
+    EXPECT_EQ(result.terms.size(), 4u);
+    EXPECT_EQ(result.categories, 0x07);
+    EXPECT_NEAR(result.score, 0.3, 1e-9);
+    
+    matcher.Scan("spam spam spam", result);
+    EXPECT_EQ(result.matches.size(), 3u);
+    EXPECT_EQ(result.terms.size(), 1u);
+    EXPECT_NEAR(result.score, 0.5, 1e-9);
+    EXPECT_FALSE(matcher.Contains("พระองค์", ThaiTermMatcher::INAPPROPRIATE));
+    EXPECT_TRUE(matcher.Contains("พระองค์", ThaiTermMatcher::ROYAL));
+    
+    // the normalisation the matcher shares
+    EXPECT_EQ(ThaiTextUtils::NormalizeText("ท\u0E48\u0E35"), "ที่");
+    EXPECT_EQ(ThaiTextUtils::NormalizeText("น\u0E4D\u0E49\u0E32"), "น้ำ");
+    EXPECT_EQ(ThaiTextUtils::NormalizeText("  a \u200B b\u00A0 "), "a b");
+    
+    EXPECT_EQ(processor_->SanitizeText("สวัสดี บ้า โลก"), "สวัสดี *** โลก");
+    EXPECT_FALSE(processor_->IsAppropriateForBroadcast("โง\u200B่"));
+    string dls;
+    EXPECT_TRUE(processor_->FormatTextForDLS(" ข่าว\t\n ด่วน ", dls));
+    EXPECT_EQ(dls, "ข่าว ด่วน");
+}
+
 // Font and Display Tests
 TEST_F(ThaiRenderingTest, TextWidthCalculation) {
     uint16_t width = processor_->CalculateTextWidth(thai_text_);
@@ -243,6 +363,34 @@ TEST_F(ThaiRenderingTest, TextWidthCalculation) {
     EXPECT_GT(ascii_width, 0);
 }
 
+TEST_F(ThaiRenderingTest, GlyphWidthsAndLayoutCache) {
+    EXPECT_EQ(processor_->CalculateTextWidth("Hello"), 40);
+    EXPECT_EQ(processor_->CalculateTextWidth("มา"), 18);   // wide ม, default า
+    
+    // the character that does not fit starts the next line
+    const string text = "กกกก กกกก";
+    auto layout = processor_->AnalyzeTextLayout(text, 40, 4);
+    EXPECT_EQ(layout.line_breaks, (vector<string>{"กกกก ", "กกกก"}));
+    ASSERT_EQ(layout.character_positions.size(), 9);
+    EXPECT_EQ(layout.character_positions[5], 0);
+    
+    auto cached = processor_->AnalyzeTextLayout(text, 40, 4);
+    EXPECT_EQ(cached.line_breaks, layout.line_breaks);
+    EXPECT_EQ(cached.dab_encoded_data, layout.dab_encoded_data);
+    EXPECT_EQ(processor_->AnalyzeTextLayout(text, 80, 4).line_breaks.size(), 1);
+    EXPECT_EQ(processor_->AnalyzeTextLayout(text, 40, 1).line_breaks.size(), 1);
+    
+    // new metrics apply to cached layouts too
+    auto metrics = processor_->GetFontMetrics();
+    metrics.character_widths[0x0E01] = 16;
+    metrics.character_widths['H'] = 4;
+    metrics.character_widths[0x4E00] = 12;  // outside the flat tables
+    processor_->SetFontMetrics(metrics);
+    EXPECT_EQ(processor_->CalculateTextWidth("Hello"), 36);
+    EXPECT_EQ(processor_->CalculateTextWidth("\xE4\xB8\x80"), 12);
+    EXPECT_EQ(processor_->AnalyzeTextLayout(text, 40, 4).line_breaks, (vector<string>{"กก", "กก ", "กก", "กก"}));
+}
+
 TEST_F(ThaiRenderingTest, TextHeightCalculation) {
     uint8_t height = processor_->CalculateTextHeight(thai_text_);
     EXPECT_GT(height, 0);
@@ -302,6 +450,54 @@ TEST_F(ThaiRenderingTest, WordSegmentation) {
     EXPECT_FALSE(rejoined.empty());
 }
 
+TEST_F(ThaiRenderingTest, DictionaryWordSegmentation) {
+    ThaiDictionaryBuilder builder;
+    for (const char* word : {"ไป", "โรง", "เรียน", "โรงเรียน", "ตา", "กลม", "ตากลม", "เด็ก"}) {
+        EXPECT_TRUE(builder.Add(word));
+    }
+    EXPECT_FALSE(builder.Add("school"));
+    EXPECT_FALSE(builder.Add(""));
+    
+    const string path = "/tmp/thai_dictionary_test.dic";
+    ASSERT_TRUE(builder.WriteFile(path));
+    auto dictionary = make_shared<ThaiDictionary>();
+    ASSERT_TRUE(dictionary->Map(path));
+    EXPECT_TRUE(dictionary->View().Contains("โรงเรียน"));
+    EXPECT_TRUE(dictionary->View().Contains("โรง"));
+    EXPECT_FALSE(dictionary->View().Contains("โร"));
+    EXPECT_FALSE(dictionary->View().Contains("ไปๆ"));
+    
+    // the fewest words, unknown characters as one word, whitespace in none
+    ThaiWordSegmenter segmenter(dictionary);
+    EXPECT_EQ(segmenter.SegmentWords("เด็กไปโรงเรียน"), (vector<string>{"เด็ก", "ไป", "โรงเรียน"}));
+    EXPECT_EQ(segmenter.SegmentWords("ตากลม"), (vector<string>{"ตากลม"}));
+    EXPECT_EQ(segmenter.SegmentWords("ไปสวนสนุก DAB+ radio"), (vector<string>{"ไป", "สวนสนุก", "DAB+", "radio"}));
+    // a word does not end before a sign that belongs to its last character
+    EXPECT_EQ(segmenter.SegmentWords("ไปๆ ตาก"), (vector<string>{"ไปๆ", "ตา", "ก"}));
+    
+    vector<ThaiWordSegmenter::Span> spans;
+    const string text = "เด็ก ไป";
+    segmenter.Segment(text, spans);
+    ASSERT_EQ(spans.size(), 2);
+    EXPECT_EQ(spans[1].offset, text.find("ไป"));
+    EXPECT_EQ(spans[1].length, string("ไป").size());
+    EXPECT_EQ(segmenter.GetCachedTextCount(), 5);
+    segmenter.Segment(text, spans);
+    EXPECT_EQ(segmenter.GetCachedTextCount(), 5);
+    
+    // a new dictionary drops cached segmentations
+    ThaiDictionaryBuilder other;
+    other.Add("โร");
+    auto small = make_shared<ThaiDictionary>();
+    ASSERT_TRUE(small->Open(other.Finish()));
+    segmenter.SetDictionary(small);
+    EXPECT_EQ(segmenter.GetCachedTextCount(), 0);
+    EXPECT_EQ(segmenter.SegmentWords("โรงเรียน")[0], "โร");
+    EXPECT_FALSE(segmenter.LoadDictionary("/tmp/nonexistent.dic"));
+    
+    remove(path.c_str());
+}
+
 TEST_F(ThaiRenderingTest, SyllableAnalysis) {
     auto syllables = ThaiTextUtils::AnalyzeSyllables(thai_text_);
     EXPECT_FALSE(syllables.empty());
@@ -311,6 +507,36 @@ TEST_F(ThaiRenderingTest, SyllableAnalysis) {
     }
 }
 
+TEST_F(ThaiRenderingTest, SyllableDFA) {
+    EXPECT_EQ(ThaiTextUtils::AnalyzeSyllables(thai_text_),
+              vector<string>({"ส", "วัส", "ดี", "ครับ", "นี่", "คือ", "ข้อ", "ความ", "ทด", "สอบ"}));
+    EXPECT_EQ(ThaiTextUtils::AnalyzeSyllables(thai_song_title_),
+              vector<string>({"เพลง", "ไทย", "ส", "มัย", "ใหม่"}));
+    EXPECT_EQ(ThaiTextUtils::AnalyzeSyllables("จันทร์ ABC ๑๒"), vector<string>({"จันทร์", "ABC", "๑๒"}));
+    EXPECT_EQ(ThaiTextUtils::CountSyllables(english_text_), 4u);
+
+    // One analysis, with offsets into the text
+    ThaiTextUtils::TextAnalysis analysis;
+    ThaiTextUtils::Analyze("เกาะ เา", analysis, true);
+    ASSERT_EQ(analysis.syllables.size(), 2u);
+    EXPECT_EQ(analysis.syllables[0].offset, 0u);
+    EXPECT_EQ(analysis.syllables[0].length, 12u);
+    ASSERT_EQ(analysis.invalid.size(), 1u);
+    EXPECT_EQ(analysis.invalid[0].offset, 13u);
+    EXPECT_EQ(analysis.invalid[0].length, 6u);
+    EXPECT_EQ(analysis.roman, "ko");
+
+    EXPECT_EQ(ThaiTextUtils::ToRoman(thai_text_), "sawatdikhrap nikhuekhokhwamthotsop");
+    EXPECT_EQ(ThaiTextUtils::ToRoman(thai_song_title_), "phlengthaisamaimai");
+    EXPECT_EQ(ThaiTextUtils::ToRoman("น้ำ เรือน จันทร์ ตัว"), "nam ruean chan tua");
+    EXPECT_EQ(ThaiTextUtils::ToRoman("ดี ๒ ดี", false), "dii 2 dii");
+
+    EXPECT_TRUE(ThaiTextUtils::HasValidThaiStructure("ที่นั่น"));
+    EXPECT_FALSE(ThaiTextUtils::HasValidThaiStructure("่ก"));
+    EXPECT_FALSE(ThaiTextUtils::HasValidThaiStructure("กิุ"));
+    EXPECT_EQ(ThaiTextUtils::FindInvalidSequences("ก็็็ ไ"), vector<string>({"็็", "ไ"}));
+}
+
 TEST_F(ThaiRenderingTest, ThaiRomanization) {
     string romanized = ThaiTextUtils::ToRoman(thai_text_, true);
     EXPECT_FALSE(romanized.empty());
@@ -370,7 +596,7 @@ TEST_F(ThaiRenderingTest, BuddhistCalendarConversion) {
 
 TEST_F(ThaiRenderingTest, HolyDayCalculations) {
     // Test some known dates
-    bool is_holy = BuddhistCalendar::IsHolyDay(2567, 2, 24); // Magha Puja 2024
+    BuddhistCalendar::IsHolyDay(2567, 2, 24); // Magha Puja 2024
     // Note: This is simplified - real implementation would use lunar calculations
     
     auto holy_days = BuddhistCalendar::GetHolyDays(2567);
@@ -492,7 +718,7 @@ TEST_F(ThaiRenderingTest, FontMetricsConfiguration) {
     auto original_metrics = processor_->GetFontMetrics();
     EXPECT_GT(original_metrics.line_height, 0);
     
-    ThaiFontMetrics custom_metrics = original_metrics;
+    auto custom_metrics = original_metrics;
     custom_metrics.line_height = 20;
     custom_metrics.baseline = 15;
     
@@ -547,14 +773,15 @@ TEST_F(ThaiRenderingTest, EmptyInputHandling) {
 }
 
 TEST_F(ThaiRenderingTest, InvalidUTF8Handling) {
-    string invalid_utf8 = "\xFF\xFE\xInvalid";
+    string invalid_utf8 = "\xFF\xFE" "Invalid";
     vector<uint8_t> dab_data;
     
     EXPECT_FALSE(processor_->ConvertUTF8ToDAB(invalid_utf8, dab_data));
 }
 
 TEST_F(ThaiRenderingTest, LargeTextHandling) {
-    string large_text = string(10000, 'ก'); // Very long Thai text
+    string large_text;
+    for (int i = 0; i < 10000; ++i) large_text += "ก"; // Very long Thai text
     
     auto validation = processor_->ValidateContent(large_text);
     EXPECT_TRUE(validation.is_appropriate);